@@ -0,0 +1,329 @@
+#include "cache.h"
+#include "repository.h"
+#include "config.h"
+#include "refs.h"
+#include "lockfile.h"
+#include "pkt-line.h"
+#include "string-list.h"
+#include "advertised-refs.h"
+
+/*
+ * The cache in "$GIT_DIR/advertised-refs" starts with the line
+ *
+ *   # advertised-refs <hash of the ref store's fingerprint>
+ *
+ * which is followed by one pkt-line per reference below "refs/", in
+ * refname order, exactly as ls-refs sends it to a client that asked
+ * for "peel" and "symrefs":
+ *
+ *   <len><oid> <refname>[ symref-target:<target>][ peeled:<oid>]\n
+ *
+ * The names in these records are compared and searched for in place,
+ * so that only the records a request needs are ever parsed.
+ */
+
+#define CACHE_HEADER "# advertised-refs "
+
+struct record_parser {
+	struct advertised_ref ref;
+	struct strbuf refname;
+	struct strbuf symref_target;
+};
+
+#define RECORD_PARSER_INIT { \
+	.refname = STRBUF_INIT, \
+	.symref_target = STRBUF_INIT, \
+}
+
+static const char *record_refname(const char *rec)
+{
+	return rec + 4 + the_hash_algo->hexsz + 1;
+}
+
+/*
+ * Parse the record at `rec`, which must not extend beyond `eof`.
+ * Return the start of the next record, or NULL if the record is
+ * malformed.
+ */
+static const char *parse_record(struct record_parser *p,
+				const char *rec, const char *eof)
+{
+	const char *line, *end, *pos, *value;
+	size_t value_len;
+	int len;
+
+	if (eof - rec < 4)
+		return NULL;
+	len = packet_length(rec);
+	if (len < 4 + (int)the_hash_algo->hexsz + 3 || len > eof - rec ||
+	    rec[len - 1] != '\n')
+		return NULL;
+
+	line = rec + 4;
+	end = rec + len - 1;
+	p->ref.line = line;
+	p->ref.line_len = end + 1 - line;
+	if (parse_oid_hex(line, &p->ref.oid, &pos) || *pos++ != ' ')
+		return NULL;
+
+	value = pos;
+	while (pos < end && *pos != ' ')
+		pos++;
+	strbuf_reset(&p->refname);
+	strbuf_add(&p->refname, value, pos - value);
+	p->ref.refname = p->refname.buf;
+	p->ref.symref_target = NULL;
+	p->ref.has_peeled = 0;
+
+	while (pos < end) {
+		const char *field = ++pos;
+
+		while (pos < end && *pos != ' ')
+			pos++;
+		if (skip_prefix_mem(field, pos - field, "symref-target:",
+				    &value, &value_len)) {
+			strbuf_reset(&p->symref_target);
+			strbuf_add(&p->symref_target, value, value_len);
+			p->ref.symref_target = p->symref_target.buf;
+		} else if (skip_prefix_mem(field, pos - field, "peeled:",
+					   &value, &value_len)) {
+			const char *oid_end;
+
+			if (parse_oid_hex(value, &p->ref.peeled, &oid_end) ||
+			    oid_end != pos)
+				return NULL;
+			p->ref.has_peeled = 1;
+		} else {
+			return NULL;
+		}
+	}
+	return rec + len;
+}
+
+static void record_parser_release(struct record_parser *p)
+{
+	strbuf_release(&p->refname);
+	strbuf_release(&p->symref_target);
+}
+
+/*
+ * Compare the refname of the record at `rec` to `name`, like strcmp()
+ * does, or only whether it starts with `name` if `prefix_only`.
+ */
+static int cmp_record_refname(const char *rec, const char *name,
+			      int prefix_only)
+{
+	const unsigned char *r = (const unsigned char *)record_refname(rec);
+	const unsigned char *n = (const unsigned char *)name;
+
+	for (;; r++, n++) {
+		int c = (*r == ' ' || *r == '\n') ? 0 : *r;
+
+		if (!*n)
+			return prefix_only ? 0 : c;
+		if (c != *n)
+			return c - *n;
+	}
+}
+
+/*
+ * Return the first record in `buf..eof` whose refname is not less than
+ * `name`, or `eof` if there is none.
+ */
+static const char *find_record(const char *buf, const char *eof,
+			       const char *name)
+{
+	const char *lo = buf, *hi = eof;
+
+	/* `lo` and `hi` are always at the start of a record. */
+	while (lo < hi) {
+		const char *rec = lo + (hi - lo) / 2;
+
+		while (rec > lo && rec[-1] != '\n')
+			rec--;
+		if (cmp_record_refname(rec, name, 0) < 0)
+			lo = rec + packet_length(rec);
+		else
+			hi = rec;
+	}
+	return lo;
+}
+
+struct build_data {
+	struct repository *r;
+	struct strbuf *out;
+};
+
+static int add_record(const char *refname, const struct object_id *oid,
+		      int flag, void *cb_data)
+{
+	struct build_data *data = cb_data;
+	struct strbuf *out = data->out;
+	size_t start = out->len;
+	struct object_id peeled;
+
+	strbuf_addstr(out, "0000");
+	strbuf_addf(out, "%s %s", oid_to_hex(oid), refname);
+	if (flag & REF_ISSYMREF) {
+		struct object_id unused;
+		const char *symref_target =
+			refs_resolve_ref_unsafe(get_main_ref_store(data->r),
+						refname, 0, &unused, &flag);
+
+		if (!symref_target)
+			die("'%s' is a symref but it is not?", refname);
+		strbuf_addf(out, " symref-target:%s", symref_target);
+	}
+	if (!peel_iterated_oid(oid, &peeled))
+		strbuf_addf(out, " peeled:%s", oid_to_hex(&peeled));
+	strbuf_addch(out, '\n');
+
+	if (out->len - start > LARGE_PACKET_MAX)
+		die(_("advertisement of '%s' is too long"), refname);
+	set_packet_header(out->buf + start, out->len - start);
+	return 0;
+}
+
+/*
+ * Map the cache at `path`, if it has the header `header` followed by
+ * well-formed records. Return NULL if it is missing or stale.
+ */
+static char *read_cache(const char *path, const char *header, size_t *size)
+{
+	struct record_parser p = RECORD_PARSER_INIT;
+	size_t header_len = strlen(header);
+	const char *rec, *eof;
+	struct stat st;
+	char *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || xsize_t(st.st_size) < header_len) {
+		close(fd);
+		return NULL;
+	}
+	*size = xsize_t(st.st_size);
+	map = xmmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	rec = map + header_len;
+	eof = map + *size;
+	if (memcmp(map, header, header_len))
+		rec = NULL;
+	while (rec && rec < eof)
+		rec = parse_record(&p, rec, eof);
+	record_parser_release(&p);
+	if (!rec) {
+		munmap(map, *size);
+		return NULL;
+	}
+	return map;
+}
+
+/*
+ * Replace the cache at `path`. This is only an optimization, so give
+ * up quietly if somebody else is writing it or the repository is
+ * read-only to us.
+ */
+static void write_cache(const char *path, const char *header,
+			const struct strbuf *records)
+{
+	struct lock_file lk = LOCK_INIT;
+	int fd;
+
+	fd = hold_lock_file_for_update(&lk, path, 0);
+	if (fd < 0)
+		return;
+	if (write_in_full(fd, header, strlen(header)) < 0 ||
+	    write_in_full(fd, records->buf, records->len) < 0 ||
+	    commit_lock_file(&lk) < 0)
+		rollback_lock_file(&lk);
+}
+
+static void emit_records(const char *buf, const char *eof,
+			 const char **prefixes,
+			 each_advertised_ref_fn fn, void *cb_data)
+{
+	struct record_parser p = RECORD_PARSER_INIT;
+	struct string_list sorted = STRING_LIST_INIT_NODUP;
+	const char *last = NULL;
+	size_t i;
+
+	if (!prefixes || !*prefixes)
+		string_list_append(&sorted, "");
+	for (; prefixes && *prefixes; prefixes++)
+		string_list_append(&sorted, *prefixes);
+	string_list_sort(&sorted);
+
+	for (i = 0; i < sorted.nr; i++) {
+		const char *prefix = sorted.items[i].string;
+		const char *rec;
+
+		/* Covered by a shorter prefix already? */
+		if (last && starts_with(prefix, last))
+			continue;
+		last = prefix;
+
+		rec = find_record(buf, eof, prefix);
+		while (rec < eof && !cmp_record_refname(rec, prefix, 1)) {
+			rec = parse_record(&p, rec, eof);
+			fn(&p.ref, cb_data);
+		}
+	}
+
+	string_list_clear(&sorted, 0);
+	record_parser_release(&p);
+}
+
+int for_each_advertised_ref(struct repository *r, const char **prefixes,
+			    each_advertised_ref_fn fn, void *cb_data)
+{
+	struct strbuf fingerprint = STRBUF_INIT;
+	struct strbuf header = STRBUF_INIT;
+	struct strbuf records = STRBUF_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	char *path, *map;
+	size_t size;
+	int enabled = 0;
+
+	if (repo_config_get_bool(r, "uploadpack.cacheadvertisement", &enabled) ||
+	    !enabled || *get_git_namespace())
+		return -1;
+
+	/*
+	 * Take the fingerprint before reading any ref, so that the
+	 * cache we write is stale if anything changes while we do.
+	 */
+	if (refs_fingerprint(get_main_ref_store(r), &fingerprint)) {
+		strbuf_release(&fingerprint);
+		return -1;
+	}
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, fingerprint.buf, fingerprint.len);
+	the_hash_algo->final_fn(hash, &ctx);
+	strbuf_addf(&header, "%s%s\n", CACHE_HEADER, hash_to_hex(hash));
+
+	path = repo_git_path(r, "advertised-refs");
+	map = read_cache(path, header.buf, &size);
+	if (map) {
+		emit_records(map + header.len, map + size, prefixes,
+			     fn, cb_data);
+		munmap(map, size);
+	} else {
+		struct build_data data = { r, &records };
+
+		refs_for_each_ref(get_main_ref_store(r), add_record, &data);
+		write_cache(path, header.buf, &records);
+		emit_records(records.buf, records.buf + records.len, prefixes,
+			     fn, cb_data);
+	}
+
+	free(path);
+	strbuf_release(&records);
+	strbuf_release(&header);
+	strbuf_release(&fingerprint);
+	return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef ADVERTISED_REFS_H
+#define ADVERTISED_REFS_H
+
+#include "hash.h"
+
+struct repository;
+
+/*
+ * A reference as upload-pack and ls-refs advertise it.
+ */
+struct advertised_ref {
+	const char *refname;
+	struct object_id oid;
+
+	/* The fully resolved target of a symbolic ref, or NULL. */
+	const char *symref_target;
+
+	/* What the ref peels to, if `has_peeled`. */
+	struct object_id peeled;
+	unsigned has_peeled : 1;
+
+	/*
+	 * The line ls-refs sends for this ref to a client that asked
+	 * for "peel" and "symrefs", without the pkt-line header but
+	 * with the trailing newline.
+	 */
+	const char *line;
+	size_t line_len;
+};
+
+typedef void each_advertised_ref_fn(const struct advertised_ref *ref,
+				    void *cb_data);
+
+/*
+ * If `uploadpack.cacheAdvertisement` is enabled, call `fn` for each
+ * reference below "refs/" that starts with one of `prefixes` (a
+ * NULL-terminated array, or NULL for all of them), in refname order.
+ * The references and their peeled values and symref targets come
+ * from "$GIT_DIR/advertised-refs", which is rebuilt first if the
+ * references changed since it was written. Hidden refs are not
+ * filtered out.
+ *
+ * Return 0 if `fn` was called for all matching references, or -1
+ * without calling it at all if the cache is disabled or cannot be
+ * trusted right now; the caller then has to iterate over the
+ * references itself.
+ */
+int for_each_advertised_ref(struct repository *r, const char **prefixes,
+			    each_advertised_ref_fn fn, void *cb_data);
+
+#endif /* ADVERTISED_REFS_H */
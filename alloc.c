@@ -30,6 +30,7 @@ struct alloc_state {
 	int count; /* total number of nodes allocated */
 	int nr;    /* number of nodes left in current allocation */
 	void *p;   /* first free node in current allocation */
+	size_t node_size;
 
 	/* bookkeeping of allocations */
 	void **slabs;
@@ -56,6 +57,7 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 	void *ret;
 
 	if (!s->nr) {
+		s->node_size = node_size;
 		s->nr = BLOCKING;
 		s->p = xmalloc(BLOCKING * node_size);
 
@@ -123,6 +125,87 @@ void *alloc_commit_node(struct repository *r)
 	return c;
 }
 
+/*
+ * A node can also be named by a 32-bit index, which has the kind of
+ * allocation it came from in its top bits and its position among the
+ * nodes of that kind below.
+ */
+#define NODE_POS_BITS 29
+#define NODE_POS_MASK ((1u << NODE_POS_BITS) - 1)
+
+enum node_kind {
+	NODE_BLOB,
+	NODE_TREE,
+	NODE_COMMIT,
+	NODE_TAG,
+	NODE_OBJECT,
+};
+
+static struct alloc_state *node_state(const struct parsed_object_pool *o,
+				      enum node_kind kind)
+{
+	switch (kind) {
+	case NODE_BLOB:
+		return o->blob_state;
+	case NODE_TREE:
+		return o->tree_state;
+	case NODE_COMMIT:
+		return o->commit_state;
+	case NODE_TAG:
+		return o->tag_state;
+	case NODE_OBJECT:
+		return o->object_state;
+	}
+	BUG("unknown node kind %d", kind);
+}
+
+static enum node_kind node_kind(enum object_type type)
+{
+	switch (type) {
+	case OBJ_BLOB:
+		return NODE_BLOB;
+	case OBJ_TREE:
+		return NODE_TREE;
+	case OBJ_COMMIT:
+		return NODE_COMMIT;
+	case OBJ_TAG:
+		return NODE_TAG;
+	default:
+		return NODE_OBJECT;
+	}
+}
+
+uint32_t alloc_node_index(const struct parsed_object_pool *o,
+			  const struct object *obj)
+{
+	enum node_kind kind = node_kind(obj->type);
+	const struct alloc_state *s = node_state(o, kind);
+	uintptr_t addr = (uintptr_t)obj;
+	int i;
+
+	/* nodes are usually asked for right after being allocated */
+	for (i = s->slab_nr - 1; i >= 0; i--) {
+		uintptr_t slab = (uintptr_t)s->slabs[i];
+		size_t pos;
+
+		if (addr < slab || addr >= slab + BLOCKING * s->node_size)
+			continue;
+		pos = st_add(st_mult(i, BLOCKING), (addr - slab) / s->node_size);
+		if (pos > NODE_POS_MASK)
+			die(_("too many objects of type %s"), type_name(obj->type));
+		return ((uint32_t)kind << NODE_POS_BITS) | pos;
+	}
+	BUG("object %s was not allocated here", oid_to_hex(&obj->oid));
+}
+
+void *alloc_node_at(const struct parsed_object_pool *o, uint32_t index)
+{
+	const struct alloc_state *s = node_state(o, index >> NODE_POS_BITS);
+	uint32_t pos = index & NODE_POS_MASK;
+
+	return (char *)s->slabs[pos / BLOCKING] + (pos % BLOCKING) * s->node_size;
+}
+
 static void report(const char *name, unsigned int count, size_t size)
 {
 	fprintf(stderr, "%10s: %8u (%"PRIuMAX" kB)\n",
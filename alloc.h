@@ -2,6 +2,8 @@
 #define ALLOC_H
 
 struct alloc_state;
+struct object;
+struct parsed_object_pool;
 struct tree;
 struct commit;
 struct tag;
@@ -15,6 +17,15 @@ void *alloc_tag_node(struct repository *r);
 void *alloc_object_node(struct repository *r);
 void alloc_report(struct repository *r);
 
+/*
+ * Return a 32-bit index naming `obj`, which must have come from one of
+ * the functions above and not have changed type since. alloc_node_at()
+ * turns the index back into a pointer.
+ */
+uint32_t alloc_node_index(const struct parsed_object_pool *o,
+			  const struct object *obj);
+void *alloc_node_at(const struct parsed_object_pool *o, uint32_t index);
+
 struct alloc_state *allocate_alloc_state(void);
 void clear_alloc_state(struct alloc_state *s);
 
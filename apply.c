@@ -22,6 +22,8 @@
 #include "rerere.h"
 #include "apply.h"
 #include "entry.h"
+#include "promisor-remote.h"
+#include "thread-utils.h"
 
 struct gitdiff_data {
 	struct strbuf *root;
@@ -2931,7 +2933,8 @@ static int apply_one_fragment(struct apply_state *state,
 			/* Ignore it, we already handled it */
 			break;
 		default:
-			if (state->apply_verbosity > verbosity_normal)
+			if (state->apply_verbosity > verbosity_normal &&
+			    !state->preapplying)
 				error(_("invalid start of line: '%c'"), first);
 			applied_pos = -1;
 			goto out;
@@ -3026,7 +3029,22 @@ static int apply_one_fragment(struct apply_state *state,
 		}
 	}
 
-	if (applied_pos >= 0) {
+	/*
+	 * On a thread, give up on a hunk that we would have to say
+	 * something about below, for check_patch() to apply it again
+	 * and say it in order.
+	 */
+	if (state->preapplying && applied_pos >= 0 &&
+	    ((new_blank_lines_at_end &&
+	      preimage.nr + applied_pos >= img->nr &&
+	      (ws_rule & WS_BLANK_AT_EOF) &&
+	      state->ws_error_action != nowarn_ws_error) ||
+	     (state->apply_verbosity > verbosity_normal &&
+	      applied_pos != pos) ||
+	     (state->apply_verbosity > verbosity_silent &&
+	      (leading != frag->leading || trailing != frag->trailing))))
+		applied_pos = -1;
+	else if (applied_pos >= 0) {
 		if (new_blank_lines_at_end &&
 		    preimage.nr + applied_pos >= img->nr &&
 		    (ws_rule & WS_BLANK_AT_EOF) &&
@@ -3069,7 +3087,7 @@ static int apply_one_fragment(struct apply_state *state,
 					     " to apply fragment at %d"),
 				   leading, trailing, applied_pos+1);
 		update_image(state, img, applied_pos, &preimage, &postimage);
-	} else {
+	} else if (!state->preapplying) {
 		if (state->apply_verbosity > verbosity_normal)
 			error(_("while searching for:\n%.*s"),
 			      (int)(old - oldlines), oldlines);
@@ -3628,6 +3646,66 @@ static int try_threeway(struct apply_state *state,
 	return 0;
 }
 
+/*
+ * The fragments of a patch that check_patch_list() had applied on a
+ * thread, to what the working tree or the index had at "old_name"
+ * then, before check_patch() got to it.
+ */
+struct preapplied_patch {
+	struct patch *patch;
+
+	/* the blob to read, or NULL to read the working tree file */
+	const struct object_id *oid;
+
+	int status;
+	char *preimage;
+	size_t preimage_len;
+	struct image result;
+};
+
+#define PREAPPLY_BATCH_PER_THREAD 32
+
+struct preapply_batch {
+	int nr_threads;
+
+	/* the first patch that has not been looked at yet */
+	struct patch *unscanned;
+
+	/* in the order of the patches */
+	struct preapplied_patch *jobs;
+	int nr, taken;
+};
+
+/*
+ * If "patch" was applied on a thread to the same preimage as the one
+ * in "image", replace "image" with the result and return 1.
+ */
+static int take_preapplied(struct apply_state *state, struct patch *patch,
+			   struct image *image)
+{
+	struct preapply_batch *batch = state->preapplied;
+	struct preapplied_patch *job;
+	int i;
+
+	if (!batch)
+		return 0;
+	for (i = batch->taken; i < batch->nr; i++)
+		if (batch->jobs[i].patch == patch)
+			break;
+	if (i == batch->nr)
+		return 0;
+	batch->taken = i + 1;
+
+	job = &batch->jobs[i];
+	if (job->status || job->preimage_len != image->len ||
+	    memcmp(job->preimage, image->buf, image->len))
+		return 0;
+	clear_image(image);
+	*image = job->result;
+	memset(&job->result, 0, sizeof(job->result));
+	return 1;
+}
+
 static int apply_data(struct apply_state *state, struct patch *patch,
 		      struct stat *st, const struct cache_entry *ce)
 {
@@ -3636,7 +3714,9 @@ static int apply_data(struct apply_state *state, struct patch *patch,
 	if (load_preimage(state, &image, patch, st, ce) < 0)
 		return -1;
 
-	if (!state->threeway || try_threeway(state, &image, patch, st, ce) < 0) {
+	if (take_preapplied(state, patch, &image))
+		; /* the fragments have already been applied */
+	else if (!state->threeway || try_threeway(state, &image, patch, st, ce) < 0) {
 		if (state->apply_verbosity > verbosity_silent &&
 		    state->threeway && !patch->direct_to_threeway)
 			fprintf(stderr, _("Falling back to direct application...\n"));
@@ -4007,23 +4087,246 @@ static int check_patch(struct apply_state *state, struct patch *patch)
 	return 0;
 }
 
+/*
+ * Finding where the hunks of a patch apply does not depend on the
+ * other patches, unless they touch the same path. So with several
+ * threads, check_patch_list() has the upcoming patches applied on
+ * threads a batch at a time, each to what its path has in the working
+ * tree or the index. check_patch() still checks everything and loads
+ * the preimage itself in order, and takes the result from the thread
+ * only if the preimage is the same, so that the outcome and the
+ * messages are the same as without threads.
+ */
+struct preapply_thread_data {
+	pthread_t pthread;
+	struct apply_state *state;
+	struct preapply_batch *batch;
+
+	/* Shared by all threads and guarded by "mutex". */
+	pthread_mutex_t *mutex;
+	int *next;
+};
+
+static int apply_threads(struct apply_state *state)
+{
+	int nr_threads;
+
+	/*
+	 * Three-way merges and fixing whitespace errors need more
+	 * than the preimage, and fetching a missing blob cannot be
+	 * done from a thread.
+	 */
+	if (!HAVE_THREADS || state->threeway ||
+	    state->ws_error_action == correct_ws_error ||
+	    ((state->cached || state->check_index) && has_promisor_remote()))
+		return 1;
+
+	nr_threads = git_env_ulong("GIT_TEST_APPLY_THREADS", 0);
+	if (nr_threads)
+		return nr_threads;
+
+	if (git_config_get_int("apply.threads", &nr_threads))
+		nr_threads = 1;
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    nr_threads, "apply.threads");
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+/*
+ * Can "patch" be applied on a thread? If so, set up "job" for it.
+ */
+static int prepare_preapply(struct apply_state *state, struct patch *patch,
+			    struct preapplied_patch *job)
+{
+	const char *name = patch->old_name;
+	int conv_flags = patch->crlf_in_old ?
+		CONV_EOL_KEEP_CRLF : CONV_EOL_RENORMALIZE;
+
+	if (!name || !patch->fragments || patch->is_binary ||
+	    0 < patch->is_new || S_ISGITLINK(patch->old_mode))
+		return 0;
+
+	memset(job, 0, sizeof(*job));
+	job->patch = patch;
+	if (state->cached || state->check_index) {
+		int pos = index_name_pos(state->repo->index, name, strlen(name));
+		const struct cache_entry *ce;
+
+		if (pos < 0)
+			return 0;
+		ce = state->repo->index->cache[pos];
+		if (S_ISGITLINK(ce->ce_mode))
+			return 0;
+		job->oid = &ce->oid;
+		return 1;
+	}
+
+	/* read_old_data() would convert the file; not on a thread */
+	return !convert_to_git(NULL, name, NULL, 0, NULL, conv_flags);
+}
+
+static int preapply_patch(struct apply_state *state,
+			  struct preapplied_patch *job)
+{
+	struct patch *patch = job->patch;
+	struct strbuf buf = STRBUF_INIT;
+	struct fragment *frag;
+	size_t len;
+	char *img;
+	int nth = 0;
+
+	if (job->oid) {
+		if (read_blob_object(&buf, job->oid, S_IFREG))
+			return -1;
+	} else {
+		struct stat st;
+
+		if (lstat(patch->old_name, &st) || !S_ISREG(st.st_mode) ||
+		    strbuf_read_file(&buf, patch->old_name,
+				     st.st_size) != st.st_size) {
+			strbuf_release(&buf);
+			return -1;
+		}
+	}
+
+	job->preimage_len = buf.len;
+	job->preimage = xmemdupz(buf.buf, buf.len);
+	img = strbuf_detach(&buf, &len);
+	prepare_image(&job->result, img, len, 1);
+
+	for (frag = patch->fragments; frag; frag = frag->next)
+		if (apply_one_fragment(state, &job->result, frag,
+				       patch->inaccurate_eof, patch->ws_rule,
+				       ++nth))
+			return -1;
+	return 0;
+}
+
+static void *preapply_thread(void *_data)
+{
+	struct preapply_thread_data *d = _data;
+
+	trace2_thread_start("apply-worker");
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(d->mutex);
+		i = (*d->next)++;
+		pthread_mutex_unlock(d->mutex);
+		if (i >= d->batch->nr)
+			break;
+
+		d->batch->jobs[i].status = preapply_patch(d->state,
+							  &d->batch->jobs[i]);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void release_preapplied(struct preapply_batch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->nr; i++) {
+		free(batch->jobs[i].preimage);
+		clear_image(&batch->jobs[i].result);
+	}
+	batch->nr = 0;
+	batch->taken = 0;
+}
+
+/*
+ * Apply the next batch of patches that can be applied on threads,
+ * starting with batch->unscanned.
+ */
+static void preapply_patches(struct apply_state *state,
+			     struct preapply_batch *batch)
+{
+	int max = batch->nr_threads * PREAPPLY_BATCH_PER_THREAD;
+	struct preapply_thread_data *data;
+	struct apply_state thread_state;
+	struct patch *patch;
+	pthread_mutex_t mutex;
+	int next = 0, i, err;
+
+	release_preapplied(batch);
+	for (patch = batch->unscanned; patch && batch->nr < max;
+	     patch = patch->next)
+		if (prepare_preapply(state, patch, &batch->jobs[batch->nr]))
+			batch->nr++;
+	batch->unscanned = patch;
+	if (!batch->nr)
+		return;
+
+	/* apply_one_fragment() only reads it in this mode */
+	thread_state = *state;
+	thread_state.preapplying = 1;
+
+	pthread_mutex_init(&mutex, NULL);
+	enable_obj_read_lock();
+	CALLOC_ARRAY(data, batch->nr_threads);
+	for (i = 0; i < batch->nr_threads; i++) {
+		struct preapply_thread_data *d = &data[i];
+
+		d->state = &thread_state;
+		d->batch = batch;
+		d->mutex = &mutex;
+		d->next = &next;
+		err = pthread_create(&d->pthread, NULL, preapply_thread, d);
+		if (err)
+			die(_("unable to create apply thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < batch->nr_threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join apply thread");
+	free(data);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&mutex);
+}
+
 static int check_patch_list(struct apply_state *state, struct patch *patch)
 {
+	struct preapply_batch batch = { 0 };
 	int err = 0;
 
 	prepare_symlink_changes(state, patch);
 	prepare_fn_table(state, patch);
+
+	batch.nr_threads = apply_threads(state);
+	if (batch.nr_threads > 1) {
+		trace2_data_intmax("apply", state->repo, "threads",
+				   batch.nr_threads);
+		batch.unscanned = patch;
+		CALLOC_ARRAY(batch.jobs, batch.nr_threads *
+					 PREAPPLY_BATCH_PER_THREAD);
+		state->preapplied = &batch;
+	}
+
 	while (patch) {
 		int res;
+		if (state->preapplied && patch == batch.unscanned)
+			preapply_patches(state, &batch);
 		if (state->apply_verbosity > verbosity_normal)
 			say_patch_name(stderr,
 				       _("Checking patch %s..."), patch);
 		res = check_patch(state, patch);
-		if (res == -128)
-			return -128;
+		if (res == -128) {
+			err = -128;
+			break;
+		}
 		err |= res;
 		patch = patch->next;
 	}
+
+	if (state->preapplied) {
+		release_preapplied(&batch);
+		free(batch.jobs);
+		state->preapplied = NULL;
+	}
 	return err;
 }
 
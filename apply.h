@@ -5,6 +5,7 @@
 #include "lockfile.h"
 #include "string-list.h"
 
+struct preapply_batch;
 struct repository;
 
 enum apply_ws_error_action {
@@ -101,6 +102,18 @@ struct apply_state {
 	 */
 	struct string_list fn_table;
 
+	/*
+	 * While check_patch_list() applies patches ahead of time on
+	 * threads, the results of the current batch; NULL otherwise.
+	 */
+	struct preapply_batch *preapplied;
+
+	/*
+	 * Set on the copy of the state those threads use; they give up
+	 * on a patch instead of reporting anything about it.
+	 */
+	int preapplying;
+
 	/*
 	 * This is to save reporting routines before using
 	 * set_error_routine() or set_warn_routine() to install muting
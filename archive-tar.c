@@ -8,6 +8,7 @@
 #include "object-store.h"
 #include "streaming.h"
 #include "run-command.h"
+#include "thread-utils.h"
 
 #define RECORDSIZE	(512)
 #define BLOCKSIZE	(RECORDSIZE * 20)
@@ -18,6 +19,10 @@ static unsigned long offset;
 static int tar_umask = 002;
 
 static gzFile gzip;
+static int use_parallel_gzip;
+static int parallel_gzip;
+
+static void parallel_gzip_write(const char *data, unsigned long len);
 
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args);
@@ -42,7 +47,9 @@ static int write_tar_filter_archive(const struct archiver *ar,
 
 /* writes out the whole block, or dies if fails */
 static void write_block_or_die(const char *block) {
-	if (gzip) {
+	if (parallel_gzip) {
+		parallel_gzip_write(block, BLOCKSIZE);
+	} else if (gzip) {
 		if (gzwrite(gzip, block, (unsigned) BLOCKSIZE) != BLOCKSIZE)
 			die(_("gzwrite failed"));
 	} else {
@@ -412,6 +419,10 @@ static int tar_filter_config(const char *var, const char *value, void *data)
 
 static int git_tar_config(const char *var, const char *value, void *cb)
 {
+	if (!strcmp(var, "tar.parallelgzip")) {
+		use_parallel_gzip = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "tar.umask")) {
 		if (value && !strcmp(value, "user")) {
 			tar_umask = umask(0);
@@ -437,6 +448,246 @@ static int write_tar_archive(const struct archiver *ar,
 	return err;
 }
 
+/*
+ * With tar.parallelGzip, the internal gzip splits the archive into
+ * blocks of GZIP_BLOCK_SIZE bytes and deflates them independently, on
+ * `args->threads` threads, the way pigz does: each block is primed with
+ * the last GZIP_DICT_SIZE bytes of the one before and ends with a sync
+ * flush, so that their concatenation is a single valid deflate stream.
+ * The result does not depend on the number of threads, but is not byte
+ * for byte what "gzip -cn" would produce.
+ */
+#define GZIP_BLOCK_SIZE (128 * 1024)
+#define GZIP_DICT_SIZE (32 * 1024)
+#define GZIP_WINDOW 4
+
+struct gzip_block {
+	unsigned char *in;
+	unsigned long len;
+	unsigned char dict[GZIP_DICT_SIZE];
+	unsigned long dict_len;
+	unsigned char *out;
+	unsigned long out_len;
+	unsigned long crc;
+	unsigned last : 1;
+	unsigned done : 1;
+};
+
+static struct {
+	int level;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int nr_threads;
+	struct gzip_block *ring;
+	size_t ring_size;
+	size_t head, next, tail;
+	unsigned stop : 1;
+
+	/* The block being filled, and the one before it. */
+	unsigned char *cur;
+	unsigned long cur_len;
+	unsigned char dict[GZIP_DICT_SIZE];
+	unsigned long dict_len;
+
+	unsigned long crc;
+	uintmax_t total;
+} pgz;
+
+static void deflate_gzip_block(struct gzip_block *b)
+{
+	git_zstream stream;
+	unsigned long bound;
+	int result;
+
+	b->crc = crc32(crc32(0, NULL, 0), b->in, b->len);
+
+	git_deflate_init_raw(&stream, pgz.level);
+	if (b->dict_len &&
+	    deflateSetDictionary(&stream.z, b->dict, b->dict_len) != Z_OK)
+		die(_("unable to set deflate dictionary"));
+
+	/* Room for the sync flush marker and the final empty block, too. */
+	bound = git_deflate_bound(&stream, b->len) + 16;
+	b->out = xmalloc(bound);
+	stream.next_in = b->in;
+	stream.avail_in = b->len;
+	stream.next_out = b->out;
+	stream.avail_out = bound;
+	result = git_deflate(&stream, b->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (b->last ? result != Z_STREAM_END : result != Z_OK || stream.avail_in)
+		die(_("deflate error (%d)"), result);
+	b->out_len = stream.total_out;
+	git_deflate_abort(&stream);
+}
+
+static void *gzip_thread_proc(void *data)
+{
+	pthread_mutex_lock(&pgz.mutex);
+	for (;;) {
+		struct gzip_block *b;
+
+		while (pgz.next == pgz.tail && !pgz.stop)
+			pthread_cond_wait(&pgz.work_cond, &pgz.mutex);
+		if (pgz.next == pgz.tail)
+			break;
+		b = &pgz.ring[pgz.next++ % pgz.ring_size];
+		pthread_mutex_unlock(&pgz.mutex);
+
+		deflate_gzip_block(b);
+
+		pthread_mutex_lock(&pgz.mutex);
+		b->done = 1;
+		pthread_cond_broadcast(&pgz.done_cond);
+	}
+	pthread_mutex_unlock(&pgz.mutex);
+	return NULL;
+}
+
+static void write_gzip_block(void)
+{
+	struct gzip_block *b = &pgz.ring[pgz.head % pgz.ring_size];
+
+	if (pgz.nr_threads) {
+		pthread_mutex_lock(&pgz.mutex);
+		while (!b->done)
+			pthread_cond_wait(&pgz.done_cond, &pgz.mutex);
+		pthread_mutex_unlock(&pgz.mutex);
+	}
+
+	write_or_die(1, b->out, b->out_len);
+	pgz.crc = crc32_combine(pgz.crc, b->crc, b->len);
+	FREE_AND_NULL(b->in);
+	FREE_AND_NULL(b->out);
+
+	if (pgz.nr_threads)
+		pthread_mutex_lock(&pgz.mutex);
+	b->done = 0;
+	pgz.head++;
+	if (pgz.nr_threads)
+		pthread_mutex_unlock(&pgz.mutex);
+}
+
+static void queue_gzip_block(int last)
+{
+	struct gzip_block *b;
+
+	if (pgz.tail - pgz.head == pgz.ring_size)
+		write_gzip_block();
+
+	if (pgz.nr_threads)
+		pthread_mutex_lock(&pgz.mutex);
+	b = &pgz.ring[pgz.tail % pgz.ring_size];
+	b->in = pgz.cur;
+	b->len = pgz.cur_len;
+	memcpy(b->dict, pgz.dict, pgz.dict_len);
+	b->dict_len = pgz.dict_len;
+	b->last = last;
+	pgz.tail++;
+	if (pgz.nr_threads) {
+		pthread_cond_signal(&pgz.work_cond);
+		pthread_mutex_unlock(&pgz.mutex);
+	} else {
+		deflate_gzip_block(b);
+	}
+
+	/* The next block is primed with the end of this one. */
+	if (b->len >= GZIP_DICT_SIZE) {
+		memcpy(pgz.dict, b->in + b->len - GZIP_DICT_SIZE, GZIP_DICT_SIZE);
+		pgz.dict_len = GZIP_DICT_SIZE;
+	}
+	pgz.total += b->len;
+	pgz.cur = xmalloc(GZIP_BLOCK_SIZE);
+	pgz.cur_len = 0;
+}
+
+static void parallel_gzip_write(const char *data, unsigned long len)
+{
+	while (len) {
+		unsigned long chunk = GZIP_BLOCK_SIZE - pgz.cur_len;
+
+		if (chunk > len)
+			chunk = len;
+		memcpy(pgz.cur + pgz.cur_len, data, chunk);
+		pgz.cur_len += chunk;
+		data += chunk;
+		len -= chunk;
+		if (pgz.cur_len == GZIP_BLOCK_SIZE)
+			queue_gzip_block(0);
+	}
+}
+
+static void parallel_gzip_start(struct archiver_args *args)
+{
+	/* magic, deflate, no flags, no mtime, no extra flags, Unix */
+	static const unsigned char header[10] = {
+		0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+	};
+	int t;
+
+	pgz.level = args->compression_level;
+	if (pgz.level < 0 || pgz.level > 9)
+		pgz.level = Z_DEFAULT_COMPRESSION;
+	pgz.crc = crc32(0, NULL, 0);
+	pgz.cur = xmalloc(GZIP_BLOCK_SIZE);
+
+	if (HAVE_THREADS && args->threads > 1) {
+		pgz.nr_threads = args->threads;
+		pgz.ring_size = st_mult(args->threads, GZIP_WINDOW);
+		pthread_mutex_init(&pgz.mutex, NULL);
+		pthread_cond_init(&pgz.work_cond, NULL);
+		pthread_cond_init(&pgz.done_cond, NULL);
+	} else {
+		pgz.ring_size = 1;
+	}
+	CALLOC_ARRAY(pgz.ring, pgz.ring_size);
+
+	ALLOC_ARRAY(pgz.threads, pgz.nr_threads);
+	for (t = 0; t < pgz.nr_threads; t++) {
+		int ret = pthread_create(&pgz.threads[t], NULL,
+					 gzip_thread_proc, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+
+	write_or_die(1, header, sizeof(header));
+}
+
+static void parallel_gzip_finish(void)
+{
+	unsigned char trailer[8];
+	int t;
+
+	queue_gzip_block(1);
+	while (pgz.head != pgz.tail)
+		write_gzip_block();
+	free(pgz.cur);
+
+	if (pgz.nr_threads) {
+		pthread_mutex_lock(&pgz.mutex);
+		pgz.stop = 1;
+		pthread_cond_broadcast(&pgz.work_cond);
+		pthread_mutex_unlock(&pgz.mutex);
+		for (t = 0; t < pgz.nr_threads; t++) {
+			int ret = pthread_join(pgz.threads[t], NULL);
+			if (ret)
+				die(_("unable to join thread: %s"), strerror(ret));
+		}
+		pthread_cond_destroy(&pgz.done_cond);
+		pthread_cond_destroy(&pgz.work_cond);
+		pthread_mutex_destroy(&pgz.mutex);
+	}
+	free(pgz.threads);
+	free(pgz.ring);
+
+	for (t = 0; t < 4; t++) {
+		trailer[t] = (pgz.crc >> (8 * t)) & 0xff;
+		trailer[t + 4] = (pgz.total >> (8 * t)) & 0xff;
+	}
+	write_or_die(1, trailer, sizeof(trailer));
+}
+
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args)
 {
@@ -458,7 +709,10 @@ static int write_tar_filter_archive(const struct archiver *ar,
 	filter.use_shell = 1;
 	filter.in = -1;
 
-	if (!strcmp("gzip -cn", ar->data)) {
+	if (!strcmp("gzip -cn", ar->data) && use_parallel_gzip) {
+		parallel_gzip = 1;
+		parallel_gzip_start(args);
+	} else if (!strcmp("gzip -cn", ar->data)) {
 		char outmode[4] = "wb\0";
 
 		if (args->compression_level >= 0 && args->compression_level <= 9)
@@ -478,7 +732,9 @@ static int write_tar_filter_archive(const struct archiver *ar,
 
 	r = write_tar_archive(ar, args);
 
-	if (gzip) {
+	if (parallel_gzip) {
+		parallel_gzip_finish();
+	} else if (gzip) {
 		if (gzclose(gzip) != Z_OK)
 			die(_("gzclose failed"));
 	} else {
@@ -9,6 +9,7 @@
 #include "object-store.h"
 #include "userdiff.h"
 #include "xdiff-interface.h"
+#include "thread-utils.h"
 
 static int zip_date;
 static int zip_time;
@@ -282,11 +283,19 @@ static int entry_is_binary(struct index_state *istate, const char *path,
 
 #define STREAM_BUFFER_SIZE (1024 * 16)
 
-static int write_zip_entry(struct archiver_args *args,
-			   const struct object_id *oid,
-			   const char *path, size_t pathlen,
-			   unsigned int mode,
-			   void *buffer, unsigned long size)
+/* The checksum and compressed form of an entry, worked out ahead. */
+struct zip_deflated {
+	unsigned long crc;
+	void *deflated;
+	unsigned long compressed_size;
+};
+
+static int write_zip_entry_1(struct archiver_args *args,
+			     const struct object_id *oid,
+			     const char *path, size_t pathlen,
+			     unsigned int mode,
+			     void *buffer, unsigned long size,
+			     struct zip_deflated *pre)
 {
 	struct zip_local_header header;
 	uintmax_t offset = zip_offset;
@@ -347,7 +356,7 @@ static int write_zip_entry(struct archiver_args *args,
 			flags |= ZIP_STREAM;
 			out = NULL;
 		} else {
-			crc = crc32(crc, buffer, size);
+			crc = pre ? pre->crc : crc32(crc, buffer, size);
 			is_binary = entry_is_binary(args->repo->index,
 						    path_without_prefix,
 						    buffer, size);
@@ -363,9 +372,14 @@ static int write_zip_entry(struct archiver_args *args,
 		max_creator_version = creator_version;
 
 	if (buffer && method == ZIP_METHOD_DEFLATE) {
-		out = deflated = zlib_deflate_raw(buffer, size,
-						  args->compression_level,
-						  &compressed_size);
+		if (pre) {
+			out = deflated = pre->deflated;
+			compressed_size = pre->compressed_size;
+		} else {
+			out = deflated = zlib_deflate_raw(buffer, size,
+							  args->compression_level,
+							  &compressed_size);
+		}
 		if (!out || compressed_size >= size) {
 			out = buffer;
 			method = ZIP_METHOD_STORE;
@@ -546,6 +560,186 @@ static int write_zip_entry(struct archiver_args *args,
 	return 0;
 }
 
+/*
+ * Entries that are in memory are compressed by `args->threads` threads
+ * ahead of being written, which still happens in the order
+ * write_zip_entry() was called. `head` is the next entry to write,
+ * `next` the next one for a thread to compress, and `tail` the next
+ * free slot. Entries that are streamed, and everything that is not a
+ * regular file, are written once all the queued ones are out.
+ */
+#define ZIP_QUEUE_WINDOW 8
+
+struct zip_job {
+	struct object_id oid;
+	char *path;
+	size_t pathlen;
+	unsigned int mode;
+	void *buffer;
+	unsigned long size;
+	struct zip_deflated result;
+	unsigned done : 1;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int nr_threads;
+	int compression_level;
+	struct zip_job *ring;
+	size_t ring_size;
+	size_t head, next, tail;
+	unsigned stop : 1;
+} zip_queue;
+
+static void *zip_thread_proc(void *data)
+{
+	pthread_mutex_lock(&zip_queue.mutex);
+	for (;;) {
+		struct zip_job *job;
+
+		while (zip_queue.next == zip_queue.tail && !zip_queue.stop)
+			pthread_cond_wait(&zip_queue.work_cond, &zip_queue.mutex);
+		if (zip_queue.next == zip_queue.tail)
+			break;
+		job = &zip_queue.ring[zip_queue.next++ % zip_queue.ring_size];
+		pthread_mutex_unlock(&zip_queue.mutex);
+
+		job->result.crc = crc32(crc32(0, NULL, 0), job->buffer,
+					job->size);
+		job->result.deflated = zlib_deflate_raw(job->buffer, job->size,
+							zip_queue.compression_level,
+							&job->result.compressed_size);
+
+		pthread_mutex_lock(&zip_queue.mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&zip_queue.done_cond);
+	}
+	pthread_mutex_unlock(&zip_queue.mutex);
+	return NULL;
+}
+
+static void start_zip_threads(struct archiver_args *args)
+{
+	int t;
+
+	if (!HAVE_THREADS || args->threads <= 1 || !args->compression_level)
+		return;
+
+	zip_queue.nr_threads = args->threads;
+	zip_queue.compression_level = args->compression_level;
+	zip_queue.ring_size = st_mult(args->threads, ZIP_QUEUE_WINDOW);
+	CALLOC_ARRAY(zip_queue.ring, zip_queue.ring_size);
+	pthread_mutex_init(&zip_queue.mutex, NULL);
+	pthread_cond_init(&zip_queue.work_cond, NULL);
+	pthread_cond_init(&zip_queue.done_cond, NULL);
+
+	ALLOC_ARRAY(zip_queue.threads, zip_queue.nr_threads);
+	for (t = 0; t < zip_queue.nr_threads; t++) {
+		int ret = pthread_create(&zip_queue.threads[t], NULL,
+					 zip_thread_proc, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+/* Write the oldest queued entry, waiting for it to be compressed. */
+static int write_queued_entry(struct archiver_args *args)
+{
+	struct zip_job *job = &zip_queue.ring[zip_queue.head % zip_queue.ring_size];
+	int ret;
+
+	pthread_mutex_lock(&zip_queue.mutex);
+	while (!job->done)
+		pthread_cond_wait(&zip_queue.done_cond, &zip_queue.mutex);
+	pthread_mutex_unlock(&zip_queue.mutex);
+
+	ret = write_zip_entry_1(args, &job->oid, job->path, job->pathlen,
+				job->mode, job->buffer, job->size,
+				&job->result);
+	FREE_AND_NULL(job->path);
+	FREE_AND_NULL(job->buffer);
+
+	pthread_mutex_lock(&zip_queue.mutex);
+	job->done = 0;
+	zip_queue.head++;
+	pthread_mutex_unlock(&zip_queue.mutex);
+	return ret;
+}
+
+static int flush_zip_queue(struct archiver_args *args)
+{
+	int ret = 0;
+
+	while (zip_queue.head != zip_queue.tail)
+		ret |= write_queued_entry(args);
+	return ret;
+}
+
+static int stop_zip_threads(struct archiver_args *args)
+{
+	int t, ret;
+
+	if (!zip_queue.nr_threads)
+		return 0;
+
+	ret = flush_zip_queue(args);
+	pthread_mutex_lock(&zip_queue.mutex);
+	zip_queue.stop = 1;
+	pthread_cond_broadcast(&zip_queue.work_cond);
+	pthread_mutex_unlock(&zip_queue.mutex);
+
+	for (t = 0; t < zip_queue.nr_threads; t++) {
+		int err = pthread_join(zip_queue.threads[t], NULL);
+		if (err)
+			die(_("unable to join thread: %s"), strerror(err));
+	}
+	FREE_AND_NULL(zip_queue.threads);
+	zip_queue.nr_threads = 0;
+
+	pthread_cond_destroy(&zip_queue.done_cond);
+	pthread_cond_destroy(&zip_queue.work_cond);
+	pthread_mutex_destroy(&zip_queue.mutex);
+	FREE_AND_NULL(zip_queue.ring);
+	return ret;
+}
+
+static int write_zip_entry(struct archiver_args *args,
+			   const struct object_id *oid,
+			   const char *path, size_t pathlen,
+			   unsigned int mode,
+			   void *buffer, unsigned long size)
+{
+	struct zip_job *job;
+	int ret = 0;
+
+	if (!zip_queue.nr_threads || !buffer || !S_ISREG(mode) || !size ||
+	    pathlen > 0xffff) {
+		if (zip_queue.nr_threads)
+			ret = flush_zip_queue(args);
+		return ret | write_zip_entry_1(args, oid, path, pathlen, mode,
+					       buffer, size, NULL);
+	}
+
+	if (zip_queue.tail - zip_queue.head == zip_queue.ring_size)
+		ret = write_queued_entry(args);
+
+	/* The caller frees `buffer` once we return. */
+	pthread_mutex_lock(&zip_queue.mutex);
+	job = &zip_queue.ring[zip_queue.tail++ % zip_queue.ring_size];
+	oidcpy(&job->oid, oid);
+	job->path = xmemdupz(path, pathlen);
+	job->pathlen = pathlen;
+	job->mode = mode;
+	job->buffer = xmemdupz(buffer, size);
+	job->size = size;
+	pthread_cond_signal(&zip_queue.work_cond);
+	pthread_mutex_unlock(&zip_queue.mutex);
+	return ret;
+}
+
 static void write_zip64_trailer(void)
 {
 	struct zip64_dir_trailer trailer64;
@@ -627,7 +821,9 @@ static int write_zip_archive(const struct archiver *ar,
 
 	strbuf_init(&zip_dir, 0);
 
+	start_zip_threads(args);
 	err = write_archive_entries(args, write_zip_entry);
+	err |= stop_zip_threads(args);
 	if (!err)
 		write_zip_trailer(args->commit_oid);
 
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "config.h"
+#include "thread-utils.h"
 #include "refs.h"
 #include "object-store.h"
 #include "commit.h"
@@ -638,6 +639,11 @@ int write_archive(int argc, const char **argv, const char *prefix,
 	git_config_get_bool("uploadarchive.allowunreachable", &remote_allow_unreachable);
 	git_config(git_default_config, NULL);
 
+	args.threads = 0;
+	git_config_get_int("archive.threads", &args.threads);
+	if (args.threads <= 0)
+		args.threads = online_cpus();
+
 	describe_status.max_invocations = 1;
 	ctx.date_mode.type = DATE_NORMAL;
 	ctx.abbrev = DEFAULT_ABBREV;
@@ -22,6 +22,7 @@ struct archiver_args {
 	unsigned int worktree_attributes : 1;
 	unsigned int convert : 1;
 	int compression_level;
+	int threads;
 	struct string_list extra_files;
 	struct pretty_print_context *pretty_ctx;
 };
@@ -13,6 +13,7 @@
 #include "dir.h"
 #include "utf8.h"
 #include "quote.h"
+#include "object-store.h"
 #include "thread-utils.h"
 
 const char git_attr__true[] = "(builtin)true";
@@ -447,12 +448,86 @@ struct attr_stack {
 	unsigned num_matches;
 	unsigned alloc;
 	struct match_attr **attrs;
+	struct attr_index *index; /* built lazily by fill() */
+
+	/*
+	 * If non-NULL, 'attrs' and 'num_matches' are borrowed from this
+	 * parsed .gitattributes blob, see read_attr_from_index(), and so
+	 * is 'index' unless it points elsewhere.
+	 */
+	const struct attr_stack *shared;
+};
+
+/*
+ * Most patterns in .gitattributes files are a literal basename
+ * ("Makefile"), an extension ("*.c") or start with a literal leading
+ * directory ("docs/html/", relative to the .gitattributes file), and
+ * can only match paths that have that basename, extension or
+ * leading directory.  The index of a frame files such patterns under
+ * that string, so that a lookup only tries the patterns filed under
+ * the strings of the path at hand, plus the ones that cannot be filed.
+ */
+enum attr_index_kind {
+	ATTR_INDEX_BASENAME,
+	ATTR_INDEX_EXTENSION,
+	ATTR_INDEX_DIRECTORY,
+	ATTR_INDEX_NR
+};
+
+struct attr_index_list {
+	int *nr_list; /* positions in attr_stack->attrs, ascending */
+	size_t nr, alloc;
 };
 
+struct attr_index_entry {
+	struct hashmap_entry ent;
+	enum attr_index_kind kind;
+	struct attr_index_list list;
+	size_t keylen;
+	char key[FLEX_ARRAY];
+};
+
+struct attr_index_key {
+	enum attr_index_kind kind;
+	const char *key;
+	size_t keylen;
+};
+
+struct attr_index {
+	int icase; /* the value of ignore_case when it was built */
+	struct hashmap map;
+	struct attr_index_list others; /* patterns not in the map */
+	struct attr_index_list macros;
+};
+
+static void attr_index_free(struct attr_index *index)
+{
+	struct hashmap_iter iter;
+	struct attr_index_entry *e;
+
+	if (!index)
+		return;
+	hashmap_for_each_entry(&index->map, &iter, e, ent)
+		free(e->list.nr_list);
+	hashmap_clear_and_free(&index->map, struct attr_index_entry, ent);
+	free(index->others.nr_list);
+	free(index->macros.nr_list);
+	free(index);
+}
+
+static struct attr_index *attr_index_build(const struct attr_stack *stack);
+
 static void attr_stack_free(struct attr_stack *e)
 {
 	int i;
 	free(e->origin);
+	if (e->shared) {
+		if (e->index != e->shared->index)
+			attr_index_free(e->index);
+		free(e);
+		return;
+	}
+	attr_index_free(e->index);
 	for (i = 0; i < e->num_matches; i++) {
 		struct match_attr *a = e->attrs[i];
 		int j;
@@ -733,20 +808,54 @@ static struct attr_stack *read_attr_from_file(const char *path, unsigned flags)
 	return res;
 }
 
-static struct attr_stack *read_attr_from_index(struct index_state *istate,
-					       const char *path,
-					       unsigned flags)
+/*
+ * The .gitattributes blobs read from the index, parsed, keyed by their
+ * object name and the READ_ATTR_* flags they were parsed with.  Bare
+ * repositories read them for each tree they look at (e.g. merge-ort
+ * with renormalization, archive), and most trees share them with
+ * others; this way each distinct blob is parsed only once per process.
+ * The entries are never freed.
+ */
+struct attr_blob_entry {
+	struct hashmap_entry ent;
+	struct object_id oid;
+	unsigned flags;
+	struct attr_stack *stack;
+};
+
+static int attr_blob_entry_cmp(const void *unused_cmp_data,
+			       const struct hashmap_entry *eptr,
+			       const struct hashmap_entry *entry_or_key,
+			       const void *unused_keydata)
+{
+	const struct attr_blob_entry *a, *b;
+
+	a = container_of(eptr, const struct attr_blob_entry, ent);
+	b = container_of(entry_or_key, const struct attr_blob_entry, ent);
+	return a->flags != b->flags || !oideq(&a->oid, &b->oid);
+}
+
+static struct attr_blob_cache {
+	struct hashmap map;
+	pthread_mutex_t mutex;
+} attr_blob_cache = {
+	HASHMAP_INIT(attr_blob_entry_cmp, NULL)
+};
+
+static struct attr_stack *parse_attr_blob(const struct object_id *oid,
+					  const char *path, unsigned flags)
 {
 	struct attr_stack *res;
+	enum object_type type;
+	unsigned long size;
 	char *buf, *sp;
 	int lineno = 0;
 
-	if (!istate)
-		return NULL;
-
-	buf = read_blob_data_from_index(istate, path, NULL);
-	if (!buf)
+	buf = read_object_file(oid, &type, &size);
+	if (!buf || type != OBJ_BLOB) {
+		free(buf);
 		return NULL;
+	}
 
 	CALLOC_ARRAY(res, 1);
 	for (sp = buf; *sp; ) {
@@ -763,6 +872,52 @@ static struct attr_stack *read_attr_from_index(struct index_state *istate,
 	return res;
 }
 
+static struct attr_stack *read_attr_from_index(struct index_state *istate,
+					       const char *path,
+					       unsigned flags)
+{
+	const struct object_id *oid;
+	struct attr_blob_entry key, *e;
+	struct attr_stack *res;
+
+	if (!istate)
+		return NULL;
+
+	oid = blob_oid_from_index(istate, path);
+	if (!oid)
+		return NULL;
+
+	pthread_mutex_lock(&attr_blob_cache.mutex);
+	hashmap_entry_init(&key.ent, oidhash(oid) ^ flags);
+	oidcpy(&key.oid, oid);
+	key.flags = flags;
+	e = hashmap_get_entry(&attr_blob_cache.map, &key, ent, NULL);
+	if (!e) {
+		struct attr_stack *parsed = parse_attr_blob(oid, path, flags);
+
+		if (!parsed) {
+			pthread_mutex_unlock(&attr_blob_cache.mutex);
+			return NULL;
+		}
+		parsed->index = attr_index_build(parsed);
+
+		CALLOC_ARRAY(e, 1);
+		hashmap_entry_init(&e->ent, key.ent.hash);
+		oidcpy(&e->oid, oid);
+		e->flags = flags;
+		e->stack = parsed;
+		hashmap_add(&attr_blob_cache.map, &e->ent);
+	}
+	pthread_mutex_unlock(&attr_blob_cache.mutex);
+
+	CALLOC_ARRAY(res, 1);
+	res->shared = e->stack;
+	res->attrs = e->stack->attrs;
+	res->num_matches = e->stack->num_matches;
+	res->index = e->stack->index;
+	return res;
+}
+
 static struct attr_stack *read_attr(struct index_state *istate,
 				    const char *path, unsigned flags)
 {
@@ -1012,6 +1167,242 @@ static int path_matches(const char *pathname, int pathlen,
 			      pattern, prefix, pat->patternlen, pat->flags);
 }
 
+static int attr_index_cmp(const void *cmp_data,
+			  const struct hashmap_entry *eptr,
+			  const struct hashmap_entry *entry_or_key,
+			  const void *keydata)
+{
+	const struct attr_index *index = cmp_data;
+	const struct attr_index_entry *e;
+	const struct attr_index_key *k = keydata;
+
+	e = container_of(eptr, const struct attr_index_entry, ent);
+	if (!k) {
+		const struct attr_index_entry *f;
+
+		f = container_of(entry_or_key, const struct attr_index_entry, ent);
+		return e->kind != f->kind || e->keylen != f->keylen ||
+			(index->icase ? strncasecmp : strncmp)(e->key, f->key,
+							       e->keylen);
+	}
+	return e->kind != k->kind || e->keylen != k->keylen ||
+		(index->icase ? strncasecmp : strncmp)(e->key, k->key,
+						       e->keylen);
+}
+
+static unsigned int attr_index_hash(const struct attr_index *index,
+				    enum attr_index_kind kind,
+				    const char *key, size_t keylen)
+{
+	unsigned int hash = index->icase ?
+		memihash(key, keylen) : memhash(key, keylen);
+	return hash ^ kind;
+}
+
+static void attr_index_list_add(struct attr_index_list *list, int nr)
+{
+	ALLOC_GROW(list->nr_list, list->nr + 1, list->alloc);
+	list->nr_list[list->nr++] = nr;
+}
+
+static void attr_index_add(struct attr_index *index,
+			   enum attr_index_kind kind,
+			   const char *key, size_t keylen, int nr)
+{
+	struct attr_index_key k = { kind, key, keylen };
+	unsigned int hash = attr_index_hash(index, kind, key, keylen);
+	struct attr_index_entry *e;
+
+	e = hashmap_get_entry_from_hash(&index->map, hash, &k,
+					struct attr_index_entry, ent);
+	if (!e) {
+		FLEX_ALLOC_MEM(e, key, key, keylen);
+		hashmap_entry_init(&e->ent, hash);
+		e->kind = kind;
+		e->keylen = keylen;
+		hashmap_add(&index->map, &e->ent);
+	}
+	attr_index_list_add(&e->list, nr);
+}
+
+static const struct attr_index_list *attr_index_get(const struct attr_index *index,
+						    enum attr_index_kind kind,
+						    const char *key, size_t keylen)
+{
+	struct attr_index_key k = { kind, key, keylen };
+	struct attr_index_entry *e;
+
+	e = hashmap_get_entry_from_hash(&index->map,
+					attr_index_hash(index, kind, key, keylen),
+					&k, struct attr_index_entry, ent);
+	return e ? &e->list : NULL;
+}
+
+/*
+ * The part of a basename after its last dot, which every basename
+ * that ends with 'str' shares with 'str' if 'str' has a dot at all.
+ */
+static const char *extension_of(const char *str, size_t len)
+{
+	while (len--)
+		if (str[len] == '.')
+			return str + len + 1;
+	return NULL;
+}
+
+/* The key under which a pattern is filed, if any */
+static int attr_index_key_of(const struct pattern *pat,
+			     enum attr_index_kind *kind,
+			     const char **key, size_t *keylen)
+{
+	const char *p = pat->pattern;
+	int len = pat->patternlen;
+	int prefix = pat->nowildcardlen;
+	const char *slash;
+
+	if (pat->flags & PATTERN_FLAG_NODIR) {
+		if (prefix == len) {
+			*kind = ATTR_INDEX_BASENAME;
+			*key = p;
+			*keylen = len;
+			return 1;
+		}
+		if (pat->flags & PATTERN_FLAG_ENDSWITH) {
+			const char *ext = extension_of(p + 1, len - 1);
+			if (!ext)
+				return 0;
+			*kind = ATTR_INDEX_EXTENSION;
+			*key = ext;
+			*keylen = p + len - ext;
+			return 1;
+		}
+		return 0;
+	}
+
+	/* see match_pathname() */
+	if (*p == '/') {
+		p++;
+		len--;
+		prefix--;
+	}
+	slash = memchr(p, '/', prefix);
+	if (!slash) {
+		if (prefix != len)
+			return 0;
+		slash = p + len;
+	}
+	*kind = ATTR_INDEX_DIRECTORY;
+	*key = p;
+	*keylen = slash - p;
+	return 1;
+}
+
+static struct attr_index *attr_index_build(const struct attr_stack *stack)
+{
+	struct attr_index *index;
+	int i;
+
+	CALLOC_ARRAY(index, 1);
+	index->icase = ignore_case;
+	hashmap_init(&index->map, attr_index_cmp, index, 0);
+
+	for (i = 0; i < stack->num_matches; i++) {
+		const struct match_attr *a = stack->attrs[i];
+		enum attr_index_kind kind;
+		const char *key;
+		size_t keylen;
+
+		if (a->is_macro)
+			attr_index_list_add(&index->macros, i);
+		else if (attr_index_key_of(&a->u.pat, &kind, &key, &keylen))
+			attr_index_add(index, kind, key, keylen, i);
+		else
+			attr_index_list_add(&index->others, i);
+	}
+	return index;
+}
+
+static struct attr_index *attr_stack_index(struct attr_stack *stack)
+{
+	if (stack->index && stack->index->icase != ignore_case) {
+		if (!stack->shared || stack->index != stack->shared->index)
+			attr_index_free(stack->index);
+		stack->index = NULL;
+	}
+	if (!stack->index)
+		stack->index = attr_index_build(stack);
+	return stack->index;
+}
+
+/*
+ * Find the patterns of the frame that can match 'path', highest
+ * position first.
+ */
+struct attr_candidates {
+	const struct attr_index_list *list[ATTR_INDEX_NR + 1];
+	size_t pos[ATTR_INDEX_NR + 1];
+};
+
+static void attr_candidates_init(struct attr_candidates *c,
+				 struct attr_stack *stack,
+				 const char *path, int pathlen,
+				 int basename_offset)
+{
+	struct attr_index *index = attr_stack_index(stack);
+	const char *basename = path + basename_offset;
+	int isdir = (pathlen && path[pathlen - 1] == '/');
+	int baselen = pathlen - basename_offset - isdir;
+	const char *name, *end, *ext;
+	int i;
+
+	c->list[ATTR_INDEX_BASENAME] =
+		attr_index_get(index, ATTR_INDEX_BASENAME, basename, baselen);
+
+	ext = extension_of(basename, baselen);
+	c->list[ATTR_INDEX_EXTENSION] = !ext ? NULL :
+		attr_index_get(index, ATTR_INDEX_EXTENSION,
+			       ext, basename + baselen - ext);
+
+	/* the path is below the origin of the frame, see match_pathname() */
+	name = path;
+	if (stack->originlen)
+		name += stack->originlen + 1;
+	end = path + pathlen - isdir;
+	if (name < end) {
+		const char *slash = memchr(name, '/', end - name);
+		c->list[ATTR_INDEX_DIRECTORY] =
+			attr_index_get(index, ATTR_INDEX_DIRECTORY,
+				       name, (slash ? slash : end) - name);
+	} else {
+		c->list[ATTR_INDEX_DIRECTORY] = NULL;
+	}
+
+	c->list[ATTR_INDEX_NR] = &index->others;
+
+	for (i = 0; i <= ATTR_INDEX_NR; i++)
+		c->pos[i] = c->list[i] ? c->list[i]->nr : 0;
+}
+
+static int attr_candidates_next(struct attr_candidates *c)
+{
+	int i, best = -1, nr = -1;
+
+	for (i = 0; i <= ATTR_INDEX_NR; i++) {
+		int candidate;
+
+		if (!c->pos[i])
+			continue;
+		candidate = c->list[i]->nr_list[c->pos[i] - 1];
+		if (candidate > nr) {
+			nr = candidate;
+			best = i;
+		}
+	}
+	if (best >= 0)
+		c->pos[best]--;
+	return nr;
+}
+
 static int macroexpand_one(struct all_attrs_item *all_attrs, int nr, int rem);
 
 static int fill_one(const char *what, struct all_attrs_item *all_attrs,
@@ -1037,17 +1428,18 @@ static int fill_one(const char *what, struct all_attrs_item *all_attrs,
 }
 
 static int fill(const char *path, int pathlen, int basename_offset,
-		const struct attr_stack *stack,
+		struct attr_stack *stack,
 		struct all_attrs_item *all_attrs, int rem)
 {
 	for (; rem > 0 && stack; stack = stack->prev) {
+		struct attr_candidates candidates;
 		int i;
 		const char *base = stack->origin ? stack->origin : "";
 
-		for (i = stack->num_matches - 1; 0 < rem && 0 <= i; i--) {
+		attr_candidates_init(&candidates, stack, path, pathlen,
+				     basename_offset);
+		while (0 < rem && 0 <= (i = attr_candidates_next(&candidates))) {
 			const struct match_attr *a = stack->attrs[i];
-			if (a->is_macro)
-				continue;
 			if (path_matches(path, pathlen, basename_offset,
 					 &a->u.pat, base, stack->originlen))
 				rem = fill_one("fill", all_attrs, a, rem);
@@ -1073,12 +1465,15 @@ static int macroexpand_one(struct all_attrs_item *all_attrs, int nr, int rem)
  * a macro needs to be expanded during the fill stage.
  */
 static void determine_macros(struct all_attrs_item *all_attrs,
-			     const struct attr_stack *stack)
+			     struct attr_stack *stack)
 {
 	for (; stack; stack = stack->prev) {
+		const struct attr_index_list *macros =
+			&attr_stack_index(stack)->macros;
 		int i;
-		for (i = stack->num_matches - 1; i >= 0; i--) {
-			const struct match_attr *ma = stack->attrs[i];
+		for (i = macros->nr - 1; i >= 0; i--) {
+			const struct match_attr *ma =
+				stack->attrs[macros->nr_list[i]];
 			if (ma->is_macro) {
 				int n = ma->u.attr->attr_nr;
 				if (!all_attrs[n].macro) {
@@ -1163,4 +1558,5 @@ void attr_start(void)
 {
 	pthread_mutex_init(&g_attr_hashmap.mutex, NULL);
 	pthread_mutex_init(&check_vector.mutex, NULL);
+	pthread_mutex_init(&attr_blob_cache.mutex, NULL);
 }
@@ -16,6 +16,7 @@
 #include "commit-reach.h"
 #include "object-store.h"
 #include "dir.h"
+#include "ewah/ewok.h"
 
 static struct oid_array good_revs;
 static struct oid_array skipped_revs;
@@ -77,6 +78,14 @@ static void clear_distance(struct commit_list *list)
 define_commit_slab(commit_weight, int *);
 static struct commit_weight commit_weight;
 
+define_commit_slab(commit_pos, int);
+
+/*
+ * count_merge_distances() keeps this many 64-bit words per commit at
+ * most, i.e. 32MB whatever the number of commits.
+ */
+#define MERGE_DISTANCE_MAX_WORDS (1 << 22)
+
 #define DEBUG_BISECT 0
 
 static inline int weight(struct commit_list *elem)
@@ -257,6 +266,121 @@ static struct commit_list *best_bisection_sorted(struct commit_list *list, int n
 	return list;
 }
 
+/*
+ * Count what count_distance() does for each of the merges on the list,
+ * all at once, which is much quicker when there are many of them. Each
+ * tree-changing commit gets a bit, and a pass over the list with
+ * parents before children ORs the bits a commit can reach from those
+ * of its parents. If they do not all fit in memory, only a block of
+ * them is kept at a time and there is a pass for each block.
+ *
+ * Return the distances by position on the list (those of other commits
+ * are zero), or NULL if count_distance() would walk to a commit that is
+ * not on the list.
+ */
+static int *count_merge_distances(struct commit_list *list, int on_list)
+{
+	struct commit_pos pos;
+	struct commit_list *p;
+	struct commit **commits;
+	int *parents_at, *parents = NULL, *children, *order, *bit;
+	int *distances = NULL;
+	int nr_parents = 0, alloc_parents = 0, nr_bits = 0, i, j, k;
+	size_t words, start;
+	uint64_t *masks = NULL;
+
+	init_commit_pos(&pos);
+	ALLOC_ARRAY(commits, on_list);
+	ALLOC_ARRAY(parents_at, on_list + 1);
+	CALLOC_ARRAY(children, on_list);
+	ALLOC_ARRAY(order, on_list);
+	ALLOC_ARRAY(bit, on_list);
+	for (i = 0, p = list; p; p = p->next, i++) {
+		commits[i] = p->item;
+		*commit_pos_at(&pos, p->item) = i + 1;
+		bit[i] = (p->item->object.flags & TREESAME) ? -1 : nr_bits++;
+	}
+
+	for (i = 0; i < on_list; i++) {
+		struct commit_list *q;
+
+		parents_at[i] = nr_parents;
+		for (q = commits[i]->parents; q; q = q->next) {
+			int *at;
+
+			if (q->item->object.flags & UNINTERESTING)
+				continue;
+			at = commit_pos_peek(&pos, q->item);
+			if (!at || !*at)
+				goto out;
+			ALLOC_GROW(parents, nr_parents + 1, alloc_parents);
+			parents[nr_parents++] = *at - 1;
+			children[*at - 1]++;
+		}
+	}
+	parents_at[on_list] = nr_parents;
+
+	/* sort the list topologically, children first */
+	for (i = k = 0; i < on_list; i++)
+		if (!children[i])
+			order[k++] = i;
+	for (i = 0; i < k; i++)
+		for (j = parents_at[order[i]]; j < parents_at[order[i] + 1]; j++)
+			if (!--children[parents[j]])
+				order[k++] = parents[j];
+	if (k != on_list)
+		goto out;
+
+	words = DIV_ROUND_UP(nr_bits, 64);
+	if (st_mult(words, on_list) > MERGE_DISTANCE_MAX_WORDS)
+		words = MERGE_DISTANCE_MAX_WORDS / on_list;
+	if (!words)
+		words = 1;
+	ALLOC_ARRAY(masks, st_mult(words, on_list));
+	CALLOC_ARRAY(distances, on_list);
+
+	for (start = 0; start < nr_bits; start += words * 64) {
+		for (k = on_list - 1; 0 <= k; k--) {
+			uint64_t *mask = masks + st_mult(order[k], words);
+			size_t b;
+
+			memset(mask, 0, words * sizeof(*mask));
+			for (j = parents_at[order[k]]; j < parents_at[order[k] + 1]; j++) {
+				const uint64_t *from = masks + st_mult(parents[j], words);
+
+				for (b = 0; b < words; b++)
+					mask[b] |= from[b];
+			}
+			if (bit[order[k]] >= 0 && start <= bit[order[k]] &&
+			    bit[order[k]] < start + words * 64) {
+				b = bit[order[k]] - start;
+				mask[b / 64] |= (uint64_t)1 << (b % 64);
+			}
+		}
+
+		for (i = 0; i < on_list; i++) {
+			const uint64_t *mask = masks + st_mult(i, words);
+			size_t b;
+
+			if (parents_at[i + 1] - parents_at[i] < 2)
+				continue;
+			for (b = 0; b < words; b++)
+				distances[i] += ewah_bit_popcount64(mask[b]);
+		}
+	}
+
+out:
+	clear_commit_pos(&pos);
+	free(commits);
+	free(parents_at);
+	free(parents);
+	free(children);
+	free(order);
+	free(bit);
+	free(masks);
+	return distances;
+}
+
 /*
  * zero or positive weight is the number of interesting commits it can
  * reach, including itself.  Especially, weight = 0 means it does not
@@ -274,7 +398,8 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 					     int nr, int *weights,
 					     unsigned bisect_flags)
 {
-	int n, counted;
+	int n, counted, merges = 0;
+	int *distances = NULL;
 	struct commit_list *p;
 
 	counted = 0;
@@ -302,6 +427,7 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 			break;
 		default:
 			weight_set(p, -2);
+			merges++;
 			break;
 		}
 	}
@@ -321,23 +447,35 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 	 *
 	 * So we will first count distance of merges the usual
 	 * way, and then fill the blanks using cheaper algorithm.
+	 * Walking from each merge costs about as much as a pass over
+	 * the list, so with more merges than a pass over the list
+	 * counts commits, count them all at once instead.
 	 */
-	for (p = list; p; p = p->next) {
+	if (merges > 1 && merges >= nr / 64)
+		distances = count_merge_distances(list, n);
+	for (n = 0, p = list; p; p = p->next, n++) {
 		if (p->item->object.flags & UNINTERESTING)
 			continue;
 		if (weight(p) != -2)
 			continue;
 		if (bisect_flags & FIND_BISECTION_FIRST_PARENT_ONLY)
 			BUG("shouldn't be calling count-distance in fp mode");
-		weight_set(p, count_distance(p));
-		clear_distance(list);
+		if (distances) {
+			weight_set(p, distances[n]);
+		} else {
+			weight_set(p, count_distance(p));
+			clear_distance(list);
+		}
 
 		/* Does it happen to be at half-way? */
 		if (!(bisect_flags & FIND_BISECTION_ALL) &&
-		      approx_halfway(p, nr))
+		      approx_halfway(p, nr)) {
+			free(distances);
 			return p;
+		}
 		counted++;
 	}
+	free(distances);
 
 	show_list("bisection 2 count_distance", counted, nr, list);
 
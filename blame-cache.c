@@ -0,0 +1,424 @@
+#include "cache.h"
+#include "repository.h"
+#include "lockfile.h"
+#include "object-store.h"
+#include "blame-cache.h"
+
+/*
+ * The file starts with a header
+ *
+ *   4-byte signature "BLCA"
+ *   4-byte version number (1)
+ *   4-byte hash format id
+ *   4-byte number of records
+ *
+ * which is followed by a table with an entry for each record, sorted
+ * by the name of the commit, the options and the path:
+ *
+ *   name of the commit (the_hash_algo->rawsz bytes)
+ *   4-byte options
+ *   8-byte offset of the record from the start of the file
+ *
+ * and then by the records, in the same order:
+ *
+ *   NUL-terminated path
+ *   name of the blob (the_hash_algo->rawsz bytes)
+ *   4-byte number of origins
+ *   4-byte number of ranges
+ *   for each origin:
+ *     name of the commit (the_hash_algo->rawsz bytes)
+ *     NUL-terminated path
+ *     1-byte flag telling whether a previous origin follows
+ *     name of the previous commit (the_hash_algo->rawsz bytes)
+ *     NUL-terminated previous path
+ *   for each range:
+ *     4-byte number of lines
+ *     4-byte first line in the origin (0-based)
+ *     4-byte index of the origin
+ *
+ * All numbers are in network byte order.
+ */
+
+#define BLAME_CACHE_SIGNATURE 0x424c4341 /* "BLCA" */
+#define BLAME_CACHE_VERSION 1
+#define BLAME_CACHE_HEADER_SIZE 16
+
+struct cache_file {
+	const unsigned char *map;
+	size_t size;
+	const unsigned char *table;
+	uint32_t nr;
+};
+
+static struct {
+	int initialized;
+	struct cache_file file;
+} cache;
+
+static size_t table_entry_size(void)
+{
+	return the_hash_algo->rawsz + 12;
+}
+
+static char *cache_path(struct repository *r)
+{
+	return xstrfmt("%s/info/blame-cache", r->objects->odb->path);
+}
+
+static size_t record_offset(const struct cache_file *f, uint32_t i)
+{
+	const unsigned char *p = f->table + i * table_entry_size();
+	uint64_t offset = get_be64(p + the_hash_algo->rawsz + 4);
+
+	return (size_t)offset;
+}
+
+static size_t record_end(const struct cache_file *f, uint32_t i)
+{
+	return i + 1 < f->nr ? record_offset(f, i + 1) : f->size;
+}
+
+static const char *record_path(const struct cache_file *f, uint32_t i)
+{
+	return (const char *)f->map + record_offset(f, i);
+}
+
+/*
+ * Check that the offsets of the records are in order and that each
+ * starts with a path, so that looking up records cannot stray out of
+ * the file.
+ */
+static int check_table(const struct cache_file *f)
+{
+	size_t table_end = BLAME_CACHE_HEADER_SIZE + f->nr * table_entry_size();
+	size_t prev = table_end;
+	uint32_t i;
+
+	for (i = 0; i < f->nr; i++) {
+		const unsigned char *p = f->table + i * table_entry_size();
+		uint64_t offset = get_be64(p + the_hash_algo->rawsz + 4);
+
+		if (offset < prev || offset > f->size)
+			return -1;
+		prev = offset;
+	}
+	for (i = 0; i < f->nr; i++) {
+		size_t offset = record_offset(f, i);
+
+		if (!memchr(f->map + offset, '\0', record_end(f, i) - offset))
+			return -1;
+	}
+	return 0;
+}
+
+static void release_cache_file(struct cache_file *f)
+{
+	if (f->map)
+		munmap((void *)f->map, f->size);
+	memset(f, 0, sizeof(*f));
+}
+
+/*
+ * Map the file, if there is one. Return -1 if it is malformed.
+ */
+static int read_cache_file(struct repository *r, struct cache_file *f)
+{
+	char *path;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	memset(f, 0, sizeof(*f));
+	path = cache_path(r);
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return 0;
+	}
+	size = xsize_t(st.st_size);
+	if (size < BLAME_CACHE_HEADER_SIZE) {
+		close(fd);
+		return -1;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	f->map = map;
+	f->size = size;
+	f->table = f->map + BLAME_CACHE_HEADER_SIZE;
+	f->nr = get_be32(f->map + 12);
+	if (get_be32(f->map) != BLAME_CACHE_SIGNATURE ||
+	    get_be32(f->map + 4) != BLAME_CACHE_VERSION ||
+	    get_be32(f->map + 8) != the_hash_algo->format_id ||
+	    (size - BLAME_CACHE_HEADER_SIZE) / table_entry_size() < f->nr ||
+	    check_table(f)) {
+		release_cache_file(f);
+		return -1;
+	}
+	return 0;
+}
+
+static void read_cache(struct repository *r)
+{
+	if (cache.initialized)
+		return;
+	cache.initialized = 1;
+	if (read_cache_file(r, &cache.file))
+		warning(_("ignoring malformed blame cache"));
+}
+
+static int cmp_entry(const struct cache_file *f, uint32_t i,
+		     const struct object_id *commit, uint32_t options,
+		     const char *path)
+{
+	const unsigned char *p = f->table + i * table_entry_size();
+	uint32_t entry_options;
+	int cmp = hashcmp(p, commit->hash);
+
+	if (cmp)
+		return cmp;
+	entry_options = get_be32(p + the_hash_algo->rawsz);
+	if (entry_options != options)
+		return entry_options < options ? -1 : 1;
+	return strcmp(record_path(f, i), path);
+}
+
+/*
+ * Return the position of the record in the table, or the position
+ * it would be inserted at, encoded as -1 - pos, if there is none.
+ */
+static int64_t find_entry(const struct cache_file *f,
+			  const struct object_id *commit, uint32_t options,
+			  const char *path)
+{
+	uint32_t lo = 0, hi = f->nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = cmp_entry(f, mi, commit, options, path);
+
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -1 - (int64_t)lo;
+}
+
+static int parse_record(const unsigned char *p, const unsigned char *end,
+			struct blame_cache_record *rec)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	const unsigned char *nul;
+	uint32_t nr_origins, nr_ranges, i;
+
+	memset(rec, 0, sizeof(*rec));
+
+	/* skip the path, which has been checked already */
+	p += strlen((const char *)p) + 1;
+	if (end - p < rawsz + 8)
+		return -1;
+	oidread(&rec->blob, p);
+	p += rawsz;
+	nr_origins = get_be32(p);
+	nr_ranges = get_be32(p + 4);
+	p += 8;
+	if (nr_origins > end - p || nr_ranges > (end - p) / 12)
+		return -1;
+
+	CALLOC_ARRAY(rec->origins, nr_origins);
+	for (i = 0; i < nr_origins; i++) {
+		struct blame_cache_origin *o = &rec->origins[i];
+
+		if (end - p < rawsz + 2 ||
+		    !(nul = memchr(p + rawsz, '\0', end - p - rawsz)) ||
+		    nul + 2 > end)
+			goto malformed;
+		oidread(&o->commit, p);
+		o->path = (const char *)p + rawsz;
+		p = nul + 1;
+		o->has_previous = *p++;
+		if (!o->has_previous)
+			continue;
+		if (end - p < rawsz + 1 ||
+		    !(nul = memchr(p + rawsz, '\0', end - p - rawsz)))
+			goto malformed;
+		oidread(&o->previous_commit, p);
+		o->previous_path = (const char *)p + rawsz;
+		p = nul + 1;
+	}
+	rec->nr_origins = nr_origins;
+
+	if ((end - p) / 12 < nr_ranges)
+		goto malformed;
+	ALLOC_ARRAY(rec->ranges, nr_ranges);
+	for (i = 0; i < nr_ranges; i++, p += 12) {
+		struct blame_cache_range *range = &rec->ranges[i];
+
+		range->num_lines = get_be32(p);
+		range->s_lno = get_be32(p + 4);
+		range->origin = get_be32(p + 8);
+		if (range->num_lines <= 0 || range->s_lno < 0 ||
+		    range->origin < 0 || range->origin >= rec->nr_origins)
+			goto malformed;
+	}
+	rec->nr_ranges = nr_ranges;
+	return 0;
+
+malformed:
+	blame_cache_record_release(rec);
+	return -1;
+}
+
+int blame_cache_get(struct repository *r, const struct object_id *commit,
+		    const char *path, uint32_t options,
+		    struct blame_cache_record *rec)
+{
+	int64_t pos;
+
+	if (r != the_repository)
+		return -1;
+	read_cache(r);
+	pos = find_entry(&cache.file, commit, options, path);
+	if (pos < 0)
+		return -1;
+	if (parse_record(cache.file.map + record_offset(&cache.file, pos),
+			 cache.file.map + record_end(&cache.file, pos), rec)) {
+		warning(_("ignoring malformed blame cache entry for '%s' in %s"),
+			path, oid_to_hex(commit));
+		return -1;
+	}
+	return 0;
+}
+
+void blame_cache_record_release(struct blame_cache_record *rec)
+{
+	FREE_AND_NULL(rec->origins);
+	FREE_AND_NULL(rec->ranges);
+	rec->nr_origins = 0;
+	rec->nr_ranges = 0;
+}
+
+static void add_be32(struct strbuf *sb, uint32_t value)
+{
+	unsigned char buf[4];
+
+	put_be32(buf, value);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void add_be64(struct strbuf *sb, uint64_t value)
+{
+	unsigned char buf[8];
+
+	put_be64(buf, value);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void encode_record(struct strbuf *out, const char *path,
+			  const struct blame_cache_record *rec)
+{
+	int i;
+
+	strbuf_add(out, path, strlen(path) + 1);
+	strbuf_add(out, rec->blob.hash, the_hash_algo->rawsz);
+	add_be32(out, rec->nr_origins);
+	add_be32(out, rec->nr_ranges);
+	for (i = 0; i < rec->nr_origins; i++) {
+		const struct blame_cache_origin *o = &rec->origins[i];
+
+		strbuf_add(out, o->commit.hash, the_hash_algo->rawsz);
+		strbuf_add(out, o->path, strlen(o->path) + 1);
+		strbuf_addch(out, !!o->has_previous);
+		if (!o->has_previous)
+			continue;
+		strbuf_add(out, o->previous_commit.hash, the_hash_algo->rawsz);
+		strbuf_add(out, o->previous_path, strlen(o->previous_path) + 1);
+	}
+	for (i = 0; i < rec->nr_ranges; i++) {
+		add_be32(out, rec->ranges[i].num_lines);
+		add_be32(out, rec->ranges[i].s_lno);
+		add_be32(out, rec->ranges[i].origin);
+	}
+}
+
+void blame_cache_put(struct repository *r, const struct object_id *commit,
+		     const char *path, uint32_t options,
+		     const struct blame_cache_record *rec)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf table = STRBUF_INIT, records = STRBUF_INIT;
+	struct strbuf new_record = STRBUF_INIT;
+	struct cache_file f;
+	size_t records_start;
+	int64_t pos;
+	uint32_t i;
+	char *file;
+	int fd;
+
+	if (r != the_repository)
+		return;
+
+	file = cache_path(r);
+	if (safe_create_leading_directories(file) < 0 ||
+	    (fd = hold_lock_file_for_update(&lk, file, 0)) < 0) {
+		free(file);
+		return;
+	}
+
+	/*
+	 * Merge into what is there now rather than what was read, as
+	 * other processes may have added records since. A malformed
+	 * file is replaced by one with only the new record.
+	 */
+	read_cache_file(r, &f);
+	pos = find_entry(&f, commit, options, path);
+	if (pos >= 0) {
+		rollback_lock_file(&lk);
+		goto out;
+	}
+	pos = -1 - pos;
+
+	encode_record(&new_record, path, rec);
+	records_start = BLAME_CACHE_HEADER_SIZE +
+		(f.nr + 1) * table_entry_size();
+	add_be32(&table, BLAME_CACHE_SIGNATURE);
+	add_be32(&table, BLAME_CACHE_VERSION);
+	add_be32(&table, the_hash_algo->format_id);
+	add_be32(&table, f.nr + 1);
+	for (i = 0; i <= f.nr; i++) {
+		if (i == pos) {
+			strbuf_add(&table, commit->hash, the_hash_algo->rawsz);
+			add_be32(&table, options);
+			add_be64(&table, records_start + records.len);
+			strbuf_addbuf(&records, &new_record);
+		}
+		if (i < f.nr) {
+			const unsigned char *p = f.table + i * table_entry_size();
+			size_t offset = record_offset(&f, i);
+
+			strbuf_add(&table, p, the_hash_algo->rawsz + 4);
+			add_be64(&table, records_start + records.len);
+			strbuf_add(&records, f.map + offset,
+				   record_end(&f, i) - offset);
+		}
+	}
+
+	if (write_in_full(fd, table.buf, table.len) < 0 ||
+	    write_in_full(fd, records.buf, records.len) < 0 ||
+	    commit_lock_file(&lk) < 0)
+		rollback_lock_file(&lk);
+
+out:
+	release_cache_file(&f);
+	strbuf_release(&table);
+	strbuf_release(&records);
+	strbuf_release(&new_record);
+	free(file);
+}
@@ -0,0 +1,68 @@
+#ifndef BLAME_CACHE_H
+#define BLAME_CACHE_H
+
+#include "hash.h"
+
+struct repository;
+
+/*
+ * The blame cache in "$GIT_DIR/objects/info/blame-cache" remembers the
+ * result of blaming a whole file, i.e. which origin (a commit and the
+ * path of the file in it) each line came from, so that a later blame
+ * that digs down to the same commit and path can take the rest of the
+ * result from there instead of going through all the history below it.
+ *
+ * A record is looked up by the commit, the path and the options that
+ * can change the result (the diff options and the way the history is
+ * walked); it is up to the caller not to use the cache at all with
+ * options that make the result depend on more than that.
+ */
+
+struct blame_cache_origin {
+	struct object_id commit;
+	const char *path;
+	/* the origin the lines were compared with, if any */
+	int has_previous;
+	struct object_id previous_commit;
+	const char *previous_path;
+};
+
+/* `num_lines` lines of the file, starting at line `s_lno` of `origin` */
+struct blame_cache_range {
+	int num_lines;
+	int s_lno;
+	int origin;
+};
+
+struct blame_cache_record {
+	/* the blob the record is about */
+	struct object_id blob;
+
+	struct blame_cache_origin *origins;
+	int nr_origins;
+
+	/* in the order of the lines of the file they cover */
+	struct blame_cache_range *ranges;
+	int nr_ranges;
+};
+
+/*
+ * Look up the record. Return 0 and fill `rec` if it was found; the
+ * strings in it stay valid for the rest of the process.
+ */
+int blame_cache_get(struct repository *r, const struct object_id *commit,
+		    const char *path, uint32_t options,
+		    struct blame_cache_record *rec);
+
+/*
+ * Add the record to the file, unless one is already there. Failing to
+ * do so is not an error, as the cache is only an optimization.
+ */
+void blame_cache_put(struct repository *r, const struct object_id *commit,
+		     const char *path, uint32_t options,
+		     const struct blame_cache_record *rec);
+
+/* Free the arrays of `rec`, but not the strings they point at. */
+void blame_cache_record_release(struct blame_cache_record *rec);
+
+#endif /* BLAME_CACHE_H */
@@ -11,6 +11,12 @@
 #include "commit-slab.h"
 #include "bloom.h"
 #include "commit-graph.h"
+#include "blame-cache.h"
+#include "shallow.h"
+#include "userdiff.h"
+#include "thread-utils.h"
+#include "strmap.h"
+#include "promisor-remote.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -1251,23 +1257,34 @@ static int fill_blob_sha1_and_mode(struct repository *r,
 
 struct blame_bloom_data {
 	/*
-	 * Changed-path Bloom filter keys. These can help prevent
-	 * computing diffs against first parents, but we need to
-	 * expand the list as code is moved or files are renamed.
+	 * Changed-path Bloom filter keys, one for each path of an
+	 * origin we asked about, as code is moved or files are
+	 * renamed.  These can help prevent computing diffs against
+	 * first parents.
 	 */
 	struct bloom_filter_settings *settings;
-	struct bloom_key **keys;
-	int nr;
-	int alloc;
+	struct strmap keys;
 };
 
+static struct bloom_key *get_bloom_key(struct blame_bloom_data *bd,
+				       const char *path)
+{
+	struct bloom_key *key = strmap_get(&bd->keys, path);
+
+	if (!key) {
+		key = xmalloc(sizeof(*key));
+		fill_bloom_key(path, strlen(path), key, bd->settings);
+		strmap_put(&bd->keys, path, key);
+	}
+	return key;
+}
+
 static int bloom_count_queries = 0;
 static int bloom_count_no = 0;
 static int maybe_changed_path(struct repository *r,
 			      struct blame_origin *origin,
 			      struct blame_bloom_data *bd)
 {
-	int i;
 	struct bloom_filter *filter;
 
 	if (!bd)
@@ -1281,34 +1298,20 @@ static int maybe_changed_path(struct repository *r,
 	if (!filter)
 		return 1;
 
+	/*
+	 * The filter tells which paths the commit changed relative to
+	 * its first parent, and find_origin() only needs to know if
+	 * origin->path is one of them.
+	 */
 	bloom_count_queries++;
-	for (i = 0; i < bd->nr; i++) {
-		if (bloom_filter_contains(filter,
-					  bd->keys[i],
-					  bd->settings))
-			return 1;
-	}
+	if (bloom_filter_contains(filter, get_bloom_key(bd, origin->path),
+				  bd->settings))
+		return 1;
 
 	bloom_count_no++;
 	return 0;
 }
 
-static void add_bloom_key(struct blame_bloom_data *bd,
-			  const char *path)
-{
-	if (!bd)
-		return;
-
-	if (bd->nr >= bd->alloc) {
-		bd->alloc *= 2;
-		REALLOC_ARRAY(bd->keys, bd->alloc);
-	}
-
-	bd->keys[bd->nr] = xmalloc(sizeof(struct bloom_key));
-	fill_bloom_key(path, strlen(path), bd->keys[bd->nr], bd->settings);
-	bd->nr++;
-}
-
 /*
  * We have an origin -- check if the same path exists in the
  * parent and return an origin structure to represent it.
@@ -1439,7 +1442,6 @@ static struct blame_origin *find_rename(struct repository *r,
 		struct diff_filepair *p = diff_queued_diff.queue[i];
 		if ((p->status == 'R' || p->status == 'C') &&
 		    !strcmp(p->two->path, origin->path)) {
-			add_bloom_key(bd, p->one->path);
 			porigin = get_origin(parent, p->one->path);
 			oidcpy(&porigin->blob_oid, &p->one->oid);
 			porigin->mode = p->one->mode;
@@ -2119,6 +2121,76 @@ static void find_copy_in_blob(struct blame_scoreboard *sb,
 	handle_split(sb, ent, d.tlno, d.plno, ent->num_lines, parent, split);
 }
 
+/*
+ * The hunks of the diff between a candidate file and the lines of a
+ * blame_entry, recorded by a worker thread of find_copy_in_parent()
+ * and replayed through handle_split() afterwards.  Each hunk takes
+ * four longs: start_a, count_a, start_b and count_b.
+ */
+struct copy_hunks {
+	long *hunk;
+	size_t nr, alloc;
+};
+
+static int record_hunk_cb(long start_a, long count_a,
+			  long start_b, long count_b, void *data)
+{
+	struct copy_hunks *h = data;
+
+	ALLOC_GROW(h->hunk, 4 * (h->nr + 1), h->alloc);
+	h->hunk[4 * h->nr + 0] = start_a;
+	h->hunk[4 * h->nr + 1] = count_a;
+	h->hunk[4 * h->nr + 2] = start_b;
+	h->hunk[4 * h->nr + 3] = count_b;
+	h->nr++;
+	return 0;
+}
+
+/*
+ * Same as find_copy_in_blob(), but with the hunks of the diff
+ * already computed by record_copy_hunks().
+ */
+static void replay_copy_hunks(struct blame_scoreboard *sb,
+			      struct blame_entry *ent,
+			      struct blame_origin *parent,
+			      struct blame_entry *split,
+			      const struct copy_hunks *h)
+{
+	long plno = 0, tlno = 0;
+	size_t i;
+
+	memset(split, 0, sizeof(struct blame_entry [3]));
+	for (i = 0; i < h->nr; i++) {
+		const long *hunk = h->hunk + 4 * i;
+		handle_split(sb, ent, tlno, plno, hunk[2], parent, split);
+		plno = hunk[0] + hunk[1];
+		tlno = hunk[2] + hunk[3];
+	}
+	handle_split(sb, ent, tlno, plno, ent->num_lines, parent, split);
+}
+
+/*
+ * Only reads the final image and file_p, and does not touch any
+ * reference counts, so that it can be run by several threads at once.
+ */
+static void record_copy_hunks(struct blame_scoreboard *sb,
+			      struct blame_entry *ent,
+			      struct blame_origin *parent,
+			      mmfile_t *file_p,
+			      struct copy_hunks *h)
+{
+	const char *cp;
+	mmfile_t file_o;
+
+	cp = blame_nth_line(sb, ent->lno);
+	file_o.ptr = (char *) cp;
+	file_o.size = blame_nth_line(sb, ent->lno + ent->num_lines) - cp;
+
+	if (diff_hunks(file_p, &file_o, record_hunk_cb, h, sb->xdl_opts))
+		die("unable to generate diff (%s)",
+		    oid_to_hex(&parent->commit->object.oid));
+}
+
 /* Move all blame entries from list *source that have a score smaller
  * than score_min to the front of list *small.
  * Returns a pointer to the link pointing to the old head of the small list.
@@ -2223,6 +2295,99 @@ static struct blame_list *setup_blame_list(struct blame_entry *unblamed,
 	return blame_list;
 }
 
+/*
+ * The candidate files of a parent that find_copy_in_parent() compares
+ * the lines of the target with.  They are collected in batches, so
+ * that the diffs against several files can be run on threads.
+ */
+struct copy_batch {
+	struct blame_scoreboard *sb;
+	struct blame_list *blame_list;
+	int num_ents;
+	struct blame_origin **origin;
+	mmfile_t *file;
+	int nr, alloc;
+	/* num_ents entries for each file, filled by the threads */
+	struct copy_hunks *hunks;
+};
+
+struct copy_thread_data {
+	pthread_t pthread;
+	struct copy_batch *batch;
+	int offset, step;
+};
+
+static void *copy_thread(void *data)
+{
+	struct copy_thread_data *t = data;
+	struct copy_batch *b = t->batch;
+	int k;
+
+	for (k = t->offset; k < b->nr * b->num_ents; k += t->step)
+		record_copy_hunks(b->sb, b->blame_list[k % b->num_ents].ent,
+				  b->origin[k / b->num_ents],
+				  &b->file[k / b->num_ents], &b->hunks[k]);
+	return NULL;
+}
+
+/*
+ * Compare the lines of each entry with each file of the batch, and
+ * keep the best split for each entry.  The diffs may be computed on
+ * threads, but their results are always taken in the order of the
+ * files, so that the outcome does not depend on the threads.
+ */
+static void flush_copy_batch(struct copy_batch *b)
+{
+	struct blame_scoreboard *sb = b->sb;
+	int nr_threads = sb->num_threads;
+	int i, j;
+
+	if (nr_threads > b->nr * b->num_ents)
+		nr_threads = b->nr * b->num_ents;
+
+	if (nr_threads > 1) {
+		struct copy_thread_data *data;
+
+		CALLOC_ARRAY(b->hunks, st_mult(b->nr, b->num_ents));
+		CALLOC_ARRAY(data, nr_threads);
+		for (i = 0; i < nr_threads; i++) {
+			data[i].batch = b;
+			data[i].offset = i;
+			data[i].step = nr_threads;
+			if (pthread_create(&data[i].pthread, NULL,
+					   copy_thread, &data[i]))
+				die(_("unable to create thread"));
+		}
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(data[i].pthread, NULL))
+				die(_("unable to join thread"));
+		free(data);
+	}
+
+	for (i = 0; i < b->nr; i++) {
+		for (j = 0; j < b->num_ents; j++) {
+			struct blame_entry *ent = b->blame_list[j].ent;
+			struct blame_entry potential[3];
+
+			if (b->hunks) {
+				struct copy_hunks *h = &b->hunks[i * b->num_ents + j];
+				replay_copy_hunks(sb, ent, b->origin[i],
+						  potential, h);
+				free(h->hunk);
+			} else {
+				find_copy_in_blob(sb, ent, b->origin[i],
+						  potential, &b->file[i]);
+			}
+			copy_split_if_better(sb, b->blame_list[j].split,
+					     potential);
+			decref_split(potential);
+		}
+		blame_origin_decref(b->origin[i]);
+	}
+	FREE_AND_NULL(b->hunks);
+	b->nr = 0;
+}
+
 /*
  * For lines target is suspected for, see if we can find code movement
  * across file boundary from the parent commit.  porigin is the path
@@ -2242,6 +2407,8 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 	int num_ents;
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
+	struct copy_batch batch = { 0 };
+	int batch_size;
 
 	if (!unblamed)
 		return; /* nothing remains for this target */
@@ -2274,15 +2441,19 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 	if (!diff_opts.flags.find_copies_harder)
 		diffcore_std(&diff_opts);
 
+	batch.sb = sb;
+	batch_size = sb->num_threads > 1 ? 16 * sb->num_threads : 1;
+
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
 		blame_list = setup_blame_list(unblamed, &num_ents);
+		batch.blame_list = blame_list;
+		batch.num_ents = num_ents;
 
 		for (i = 0; i < diff_queued_diff.nr; i++) {
 			struct diff_filepair *p = diff_queued_diff.queue[i];
 			struct blame_origin *norigin;
 			mmfile_t file_p;
-			struct blame_entry potential[3];
 
 			if (!DIFF_FILE_VALID(p->one))
 				continue; /* does not exist in parent */
@@ -2300,15 +2471,14 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 			if (!file_p.ptr)
 				continue;
 
-			for (j = 0; j < num_ents; j++) {
-				find_copy_in_blob(sb, blame_list[j].ent,
-						  norigin, potential, &file_p);
-				copy_split_if_better(sb, blame_list[j].split,
-						     potential);
-				decref_split(potential);
-			}
-			blame_origin_decref(norigin);
+			ALLOC_GROW(batch.origin, batch.nr + 1, batch.alloc);
+			REALLOC_ARRAY(batch.file, batch.alloc);
+			batch.origin[batch.nr] = norigin;
+			batch.file[batch.nr] = file_p;
+			if (++batch.nr >= batch_size)
+				flush_copy_batch(&batch);
 		}
+		flush_copy_batch(&batch);
 
 		for (j = 0; j < num_ents; j++) {
 			struct blame_entry *split = blame_list[j].split;
@@ -2327,6 +2497,8 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 		toosmall = filter_small(sb, toosmall, &unblamed, sb->copy_score);
 	} while (unblamed);
 	target->suspects = reverse_blame(leftover, NULL);
+	free(batch.origin);
+	free(batch.file);
 	diff_flush(&diff_opts);
 	clear_pathspec(&diff_opts.pathspec);
 }
@@ -2410,6 +2582,40 @@ typedef struct blame_origin *(*blame_find_alg)(struct repository *,
 					       struct blame_origin *,
 					       struct blame_bloom_data *);
 
+/* How many first-parent ancestors to look ahead into in a partial clone */
+#define BLAME_PREFETCH_DEPTH 64
+
+/*
+ * In a partial clone, the blob of "porigin" may be about to be fetched,
+ * and those of the same path in the commits below it would follow one
+ * fetch at a time. Hint them to the lazy fetcher so that they all come
+ * with the first one.
+ */
+static void hint_ancestor_blobs(struct blame_scoreboard *sb,
+				struct blame_origin *porigin)
+{
+	struct commit *c = porigin->commit;
+	int i;
+
+	if (sb->reverse || !has_promisor_remote() ||
+	    !oid_object_info_extended(sb->repo, &porigin->blob_oid, NULL,
+				      OBJECT_INFO_FOR_PREFETCH))
+		return;
+
+	for (i = 0; c && i < BLAME_PREFETCH_DEPTH; i++) {
+		struct object_id blob_oid;
+		unsigned short mode;
+
+		if (repo_parse_commit(sb->repo, c) ||
+		    get_tree_entry(sb->repo, &c->object.oid, porigin->path,
+				   &blob_oid, &mode))
+			break;
+		if (S_ISREG(mode))
+			promisor_remote_hint(&blob_oid);
+		c = c->parents ? c->parents->item : NULL;
+	}
+}
+
 static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin, int opt)
 {
 	struct rev_info *revs = sb->revs;
@@ -2468,6 +2674,9 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	}
 
 	sb->num_commits++;
+	for (i = 0; i < num_sg; i++)
+		if (sg_origin[i])
+			hint_ancestor_blobs(sb, sg_origin[i]);
 	for (i = 0, sg = first_scapegoat(revs, commit, sb->reverse);
 	     i < num_sg && sg;
 	     sg = sg->next, i++) {
@@ -2578,6 +2787,283 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		free(sg_origin);
 }
 
+/*
+ * The xdiff flags leave the top bits of the options a record in the
+ * blame cache is looked up by for the other options that matter.
+ */
+#define BLAME_CACHE_FIRST_PARENT (1U << 31)
+#define BLAME_CACHE_NO_WHOLE_FILE_RENAME (1U << 30)
+
+static int blame_cache_hits;
+
+static uint32_t blame_cache_options(struct blame_scoreboard *sb)
+{
+	uint32_t options = sb->xdl_opts;
+
+	if (sb->revs->first_parent_only)
+		options |= BLAME_CACHE_FIRST_PARENT;
+	if (sb->no_whole_file_rename)
+		options |= BLAME_CACHE_NO_WHOLE_FILE_RENAME;
+	return options;
+}
+
+/*
+ * The cache only records which origin the lines came from when they
+ * are dug down to the root commits and compared line by line, so it
+ * cannot be used with the options that find lines elsewhere or stop
+ * digging early.
+ */
+static int can_use_blame_cache(struct blame_scoreboard *sb, int opt)
+{
+	struct commit_list *l;
+
+	if (!sb->use_cache || opt || sb->reverse ||
+	    oidset_size(&sb->ignore_list) ||
+	    sb->revs->max_age != -1 ||
+	    is_repository_shallow(sb->repo))
+		return 0;
+	for (l = sb->revs->commits; l; l = l->next)
+		if (l->item->object.flags & UNINTERESTING)
+			return 0;
+	return 1;
+}
+
+static int has_textconv(struct blame_scoreboard *sb, const char *path)
+{
+	struct userdiff_driver *drv;
+
+	if (!sb->revs->diffopt.flags.allow_textconv)
+		return 0;
+	drv = userdiff_find_by_path(sb->repo->index, path);
+	return drv && userdiff_get_textconv(sb->repo, drv);
+}
+
+static struct blame_origin *get_cached_origin(struct blame_scoreboard *sb,
+					      const struct object_id *oid,
+					      const char *path)
+{
+	struct commit *commit = lookup_commit(sb->repo, oid);
+	struct blame_origin *o;
+
+	if (!commit || parse_commit(commit))
+		return NULL;
+	o = get_origin(commit, path);
+	if (fill_blob_sha1_and_mode(sb->repo, o)) {
+		blame_origin_decref(o);
+		return NULL;
+	}
+	/* treat root commit as boundary */
+	if (!commit->parents && !sb->show_root)
+		commit->object.flags |= UNINTERESTING;
+	return o;
+}
+
+static void ship_cached_entry(struct blame_scoreboard *sb,
+			      struct blame_origin *o,
+			      int lno, int num_lines, int s_lno)
+{
+	struct blame_entry *e = xcalloc(1, sizeof(*e));
+
+	e->lno = lno;
+	e->num_lines = num_lines;
+	e->s_lno = s_lno;
+	e->suspect = blame_origin_incref(o);
+	o->guilty = 1;
+	if (sb->found_guilty_entry)
+		sb->found_guilty_entry(e, sb->found_guilty_entry_data);
+	e->next = sb->ent;
+	sb->ent = e;
+}
+
+/*
+ * If the blame for the whole of the blob of `origin` is in the
+ * cache, take the blame for all of its suspects from there instead of
+ * passing it to the parents. Return 1 if it did.
+ */
+static int pass_cached_blame(struct blame_scoreboard *sb,
+			     struct blame_origin *origin)
+{
+	struct blame_cache_record rec;
+	struct blame_origin **origins;
+	struct blame_entry *e, *next;
+	int *start;
+	int i, ret = 0;
+
+	if (has_textconv(sb, origin->path) ||
+	    blame_cache_get(sb->repo, &origin->commit->object.oid,
+			    origin->path, blame_cache_options(sb), &rec))
+		return 0;
+
+	CALLOC_ARRAY(origins, rec.nr_origins);
+	ALLOC_ARRAY(start, rec.nr_ranges + 1);
+	if (!oideq(&rec.blob, &origin->blob_oid))
+		goto out;
+	for (i = 0; i < rec.nr_origins; i++) {
+		const struct blame_cache_origin *co = &rec.origins[i];
+
+		origins[i] = get_cached_origin(sb, &co->commit, co->path);
+		if (!origins[i])
+			goto out;
+		if (co->has_previous && !origins[i]->previous) {
+			origins[i]->previous =
+				get_cached_origin(sb, &co->previous_commit,
+						  co->previous_path);
+			if (!origins[i]->previous)
+				goto out;
+		}
+	}
+	start[0] = 0;
+	for (i = 0; i < rec.nr_ranges; i++)
+		start[i + 1] = start[i] + rec.ranges[i].num_lines;
+	for (e = origin->suspects; e; e = e->next)
+		if (e->s_lno + e->num_lines > start[rec.nr_ranges])
+			goto out;
+
+	for (e = origin->suspects; e; e = next) {
+		int lno = e->lno, s_lno = e->s_lno, left = e->num_lines;
+		int lo = 0, hi = rec.nr_ranges;
+
+		/* find the range the first line of the entry is in */
+		while (hi - lo > 1) {
+			int mi = lo + (hi - lo) / 2;
+
+			if (start[mi] <= s_lno)
+				lo = mi;
+			else
+				hi = mi;
+		}
+		for (i = lo; left; i++) {
+			const struct blame_cache_range *r = &rec.ranges[i];
+			int skip = s_lno - start[i];
+			int n = r->num_lines - skip;
+
+			if (n > left)
+				n = left;
+			ship_cached_entry(sb, origins[r->origin], lno, n,
+					  r->s_lno + skip);
+			lno += n;
+			s_lno += n;
+			left -= n;
+		}
+
+		next = e->next;
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	origin->suspects = NULL;
+	blame_cache_hits++;
+	ret = 1;
+
+out:
+	for (i = 0; i < rec.nr_origins; i++)
+		blame_origin_decref(origins[i]);
+	free(origins);
+	free(start);
+	blame_cache_record_release(&rec);
+	return ret;
+}
+
+static int cmp_origin_ptr(const void *a, const void *b)
+{
+	const struct blame_origin *x = *(const struct blame_origin **)a;
+	const struct blame_origin *y = *(const struct blame_origin **)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int find_origin_index(struct blame_origin **origins, int nr,
+			     struct blame_origin *o)
+{
+	int lo = 0, hi = nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+
+		if (origins[mi] == o)
+			return mi;
+		if (origins[mi] < o)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	BUG("origin not found");
+}
+
+/*
+ * Record the blame for the final commit in the cache, if it is for
+ * all of the file.
+ */
+static void put_cached_blame(struct blame_scoreboard *sb)
+{
+	struct blame_cache_record rec = { 0 };
+	struct blame_origin **origins = NULL;
+	struct blame_entry *e;
+	unsigned short mode;
+	int nr = 0, lno = 0, i;
+
+	if (is_null_oid(&sb->final->object.oid) ||
+	    has_textconv(sb, sb->path) ||
+	    get_tree_entry(sb->repo, &sb->final->object.oid, sb->path,
+			   &rec.blob, &mode))
+		return;
+
+	blame_sort_final(sb);
+	for (e = sb->ent; e; e = e->next) {
+		if (e->lno != lno)
+			return;
+		lno += e->num_lines;
+		nr++;
+	}
+	if (lno != sb->num_lines)
+		return;
+
+	ALLOC_ARRAY(origins, nr);
+	for (e = sb->ent, i = 0; e; e = e->next)
+		origins[i++] = e->suspect;
+	QSORT(origins, nr, cmp_origin_ptr);
+	for (i = 0; i < nr; i++)
+		if (!rec.nr_origins || origins[rec.nr_origins - 1] != origins[i])
+			origins[rec.nr_origins++] = origins[i];
+
+	CALLOC_ARRAY(rec.origins, rec.nr_origins);
+	for (i = 0; i < rec.nr_origins; i++) {
+		struct blame_cache_origin *co = &rec.origins[i];
+		struct blame_origin *o = origins[i];
+
+		oidcpy(&co->commit, &o->commit->object.oid);
+		co->path = o->path;
+		if (o->previous) {
+			co->has_previous = 1;
+			oidcpy(&co->previous_commit,
+			       &o->previous->commit->object.oid);
+			co->previous_path = o->previous->path;
+		}
+	}
+
+	ALLOC_ARRAY(rec.ranges, nr);
+	for (e = sb->ent; e; e = e->next) {
+		int origin = find_origin_index(origins, rec.nr_origins,
+					       e->suspect);
+		struct blame_cache_range *r = rec.nr_ranges ?
+			&rec.ranges[rec.nr_ranges - 1] : NULL;
+
+		if (r && r->origin == origin &&
+		    r->s_lno + r->num_lines == e->s_lno) {
+			r->num_lines += e->num_lines;
+			continue;
+		}
+		r = &rec.ranges[rec.nr_ranges++];
+		r->num_lines = e->num_lines;
+		r->s_lno = e->s_lno;
+		r->origin = origin;
+	}
+
+	blame_cache_put(sb->repo, &sb->final->object.oid, sb->path,
+			blame_cache_options(sb), &rec);
+	free(origins);
+	blame_cache_record_release(&rec);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -2586,6 +3072,7 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 {
 	struct rev_info *revs = sb->revs;
 	struct commit *commit = prio_queue_get(&sb->commits);
+	int use_cache = can_use_blame_cache(sb, opt);
 
 	while (commit) {
 		struct blame_entry *ent;
@@ -2610,9 +3097,10 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		parse_commit(commit);
 		if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
-		     !(revs->max_age != -1 && commit->date < revs->max_age)))
-			pass_blame(sb, suspect, opt);
-		else {
+		     !(revs->max_age != -1 && commit->date < revs->max_age))) {
+			if (!use_cache || !pass_cached_blame(sb, suspect))
+				pass_blame(sb, suspect, opt);
+		} else {
 			commit->object.flags |= UNINTERESTING;
 			if (commit->object.parsed)
 				mark_parents_uninteresting(commit);
@@ -2644,6 +3132,9 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		if (sb->debug) /* sanity */
 			sanity_check_refcnt(sb);
 	}
+
+	if (use_cache)
+		put_cached_blame(sb);
 }
 
 /*
@@ -2901,12 +3392,7 @@ void setup_blame_bloom_data(struct blame_scoreboard *sb)
 	bd = xmalloc(sizeof(struct blame_bloom_data));
 
 	bd->settings = bs;
-
-	bd->alloc = 4;
-	bd->nr = 0;
-	ALLOC_ARRAY(bd->keys, bd->alloc);
-
-	add_bloom_key(bd, sb->path);
+	strmap_init(&bd->keys);
 
 	sb->bloom_data = bd;
 }
@@ -2914,12 +3400,14 @@ void setup_blame_bloom_data(struct blame_scoreboard *sb)
 void cleanup_scoreboard(struct blame_scoreboard *sb)
 {
 	if (sb->bloom_data) {
-		int i;
-		for (i = 0; i < sb->bloom_data->nr; i++) {
-			free(sb->bloom_data->keys[i]->hashes);
-			free(sb->bloom_data->keys[i]);
+		struct hashmap_iter iter;
+		struct strmap_entry *e;
+
+		strmap_for_each_entry(&sb->bloom_data->keys, &iter, e) {
+			struct bloom_key *key = e->value;
+			free(key->hashes);
 		}
-		free(sb->bloom_data->keys);
+		strmap_clear(&sb->bloom_data->keys, 1);
 		FREE_AND_NULL(sb->bloom_data);
 
 		trace2_data_intmax("blame", sb->repo,
@@ -2927,4 +3415,7 @@ void cleanup_scoreboard(struct blame_scoreboard *sb)
 		trace2_data_intmax("blame", sb->repo,
 				   "bloom/response-no", bloom_count_no);
 	}
+	if (sb->use_cache)
+		trace2_data_intmax("blame", sb->repo,
+				   "cache/hits", blame_cache_hits);
 }
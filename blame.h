@@ -152,6 +152,10 @@ struct blame_scoreboard {
 	int xdl_opts;
 	int no_whole_file_rename;
 	int debug;
+	/* use and fill the blame cache (see blame-cache.h) */
+	int use_cache;
+	/* threads to look for copies in other files with; 0 or 1 for none */
+	int num_threads;
 
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
@@ -6,6 +6,11 @@
 #include "hashmap.h"
 #include "commit-graph.h"
 #include "commit.h"
+#include "object-store.h"
+#include "tree-walk.h"
+#include "progress.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
@@ -144,6 +149,45 @@ void clear_bloom_key(struct bloom_key *key)
 	FREE_AND_NULL(key->hashes);
 }
 
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyvec *vec;
+	size_t i, count = 1;
+
+	for (i = 0; i < len; i++)
+		if (path[i] == '/')
+			count++;
+
+	vec = xcalloc(1, st_add(sizeof(*vec),
+				st_mult(count, sizeof(struct bloom_key))));
+	vec->count = count;
+
+	/*
+	 * At this point, the path is normalized to use Unix-style
+	 * path separators. This is required due to how the
+	 * changed-path Bloom filters store the paths.
+	 */
+	fill_bloom_key(path, len, &vec->key[0], settings);
+	count = 1;
+	for (i = len - 1; i > 0; i--)
+		if (path[i] == '/')
+			fill_bloom_key(path, i, &vec->key[count++], settings);
+
+	return vec;
+}
+
+void bloom_keyvec_free(struct bloom_keyvec *vec)
+{
+	size_t i;
+
+	if (!vec)
+		return;
+	for (i = 0; i < vec->count; i++)
+		clear_bloom_key(&vec->key[i]);
+	free(vec);
+}
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings)
@@ -184,57 +228,29 @@ static void init_truncated_large_filter(struct bloom_filter *filter)
 	filter->len = 1;
 }
 
-struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
-						 struct commit *c,
-						 int compute_if_not_present,
-						 const struct bloom_filter_settings *settings,
-						 enum bloom_filter_computed *computed)
+/*
+ * Fill "filter" from the "nr" changed paths in "paths", together with
+ * their leading directories, or mark it as too large.
+ */
+static void fill_bloom_filter(struct bloom_filter *filter,
+			      const char **paths, size_t nr,
+			      const struct bloom_filter_settings *settings,
+			      enum bloom_filter_computed *computed)
 {
-	struct bloom_filter *filter;
-	int i;
-	struct diff_options diffopt;
-
-	if (computed)
-		*computed = BLOOM_NOT_COMPUTED;
-
-	if (!bloom_filters.slab_size)
-		return NULL;
-
-	filter = bloom_filter_slab_at(&bloom_filters, c);
-
-	if (!filter->data) {
-		load_commit_graph_info(r, c);
-		if (commit_graph_position(c) != COMMIT_NOT_FROM_GRAPH)
-			load_bloom_filter_from_graph(r->objects->commit_graph, filter, c);
-	}
-
-	if (filter->data && filter->len)
-		return filter;
-	if (!compute_if_not_present)
-		return NULL;
-
-	repo_diff_setup(r, &diffopt);
-	diffopt.flags.recursive = 1;
-	diffopt.detect_rename = 0;
-	diffopt.max_changes = settings->max_changed_paths;
-	diff_setup_done(&diffopt);
-
-	/* ensure commit is parsed so we have parent information */
-	repo_parse_commit(r, c);
-
-	if (c->parents)
-		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
-	else
-		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
-	diffcore_std(&diffopt);
+	size_t i;
 
-	if (diff_queued_diff.nr <= settings->max_changed_paths) {
+	if (nr <= settings->max_changed_paths) {
 		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
+		struct strbuf buf = STRBUF_INIT;
 		struct pathmap_hash_entry *e;
 		struct hashmap_iter iter;
 
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
+		for (i = 0; i < nr; i++) {
+			char *path;
+
+			strbuf_reset(&buf);
+			strbuf_addstr(&buf, paths[i]);
+			path = buf.buf;
 
 			/*
 			 * Add each leading directory of the changed file, i.e. for
@@ -260,9 +276,8 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 				*last_slash = '\0';
 
 			} while (*path);
-
-			diff_free_filepair(diff_queued_diff.queue[i]);
 		}
+		strbuf_release(&buf);
 
 		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
 			init_truncated_large_filter(filter);
@@ -289,8 +304,6 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 	cleanup:
 		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
 	} else {
-		for (i = 0; i < diff_queued_diff.nr; i++)
-			diff_free_filepair(diff_queued_diff.queue[i]);
 		init_truncated_large_filter(filter);
 
 		if (computed)
@@ -299,13 +312,338 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 
 	if (computed)
 		*computed |= BLOOM_COMPUTED;
+}
+
+struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int compute_if_not_present,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+	const char **paths;
+	int i;
+	struct diff_options diffopt;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	if (!bloom_filters.slab_size)
+		return NULL;
+
+	filter = bloom_filter_slab_at(&bloom_filters, c);
+
+	if (!filter->data) {
+		load_commit_graph_info(r, c);
+		if (commit_graph_position(c) != COMMIT_NOT_FROM_GRAPH)
+			load_bloom_filter_from_graph(r->objects->commit_graph, filter, c);
+	}
+
+	if (filter->data && filter->len)
+		return filter;
+	if (!compute_if_not_present)
+		return NULL;
+
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.detect_rename = 0;
+	diffopt.max_changes = settings->max_changed_paths;
+	diff_setup_done(&diffopt);
+
+	/* ensure commit is parsed so we have parent information */
+	repo_parse_commit(r, c);
+
+	if (c->parents)
+		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
+	else
+		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
+	diffcore_std(&diffopt);
 
+	ALLOC_ARRAY(paths, diff_queued_diff.nr);
+	for (i = 0; i < diff_queued_diff.nr; i++)
+		paths[i] = diff_queued_diff.queue[i]->two->path;
+	fill_bloom_filter(filter, paths, diff_queued_diff.nr, settings, computed);
+	free(paths);
+
+	for (i = 0; i < diff_queued_diff.nr; i++)
+		diff_free_filepair(diff_queued_diff.queue[i]);
 	free(diff_queued_diff.queue);
 	DIFF_QUEUE_CLEAR(&diff_queued_diff);
 
 	return filter;
 }
 
+/*
+ * The changed paths between two trees, as diff_tree_oid() with the
+ * "recursive" flag would report them. Unlike the diff machinery, this
+ * uses neither the global diff queue nor the parsed object table, so
+ * several threads can run it at once as long as object reads are
+ * protected by enable_obj_read_lock().
+ */
+struct changed_paths {
+	struct repository *r;
+	struct strbuf base;
+	struct string_list paths;
+	uint32_t max_changes;
+};
+
+static int read_bloom_tree(struct repository *r, const struct object_id *oid,
+			   struct tree_desc *desc, void **buf)
+{
+	enum object_type type;
+	unsigned long size;
+
+	if (!oid) {
+		init_tree_desc(desc, NULL, 0);
+		return 0;
+	}
+
+	*buf = repo_read_object_file(r, oid, &type, &size);
+	if (!*buf || type != OBJ_TREE)
+		return -1;
+	return init_tree_desc_gently(desc, *buf, size);
+}
+
+static int walk_changed_paths(struct changed_paths *cp,
+			      const struct object_id *old_tree,
+			      const struct object_id *new_tree);
+
+static int add_changed_entry(struct changed_paths *cp,
+			     const struct name_entry *old_entry,
+			     const struct name_entry *new_entry)
+{
+	const struct name_entry *e = new_entry ? new_entry : old_entry;
+	size_t baselen = cp->base.len;
+	int ret = 0;
+
+	strbuf_add(&cp->base, e->path, tree_entry_len(e));
+	if (S_ISDIR(e->mode)) {
+		strbuf_addch(&cp->base, '/');
+		ret = walk_changed_paths(cp,
+					 old_entry ? &old_entry->oid : NULL,
+					 new_entry ? &new_entry->oid : NULL);
+	} else
+		string_list_append(&cp->paths, cp->base.buf);
+	strbuf_setlen(&cp->base, baselen);
+
+	return ret;
+}
+
+static int walk_changed_paths(struct changed_paths *cp,
+			      const struct object_id *old_tree,
+			      const struct object_id *new_tree)
+{
+	struct tree_desc t1, t2;
+	void *buf1 = NULL, *buf2 = NULL;
+	int ret = 0;
+
+	if (read_bloom_tree(cp->r, old_tree, &t1, &buf1) ||
+	    read_bloom_tree(cp->r, new_tree, &t2, &buf2)) {
+		ret = -1;
+		goto out;
+	}
+
+	while (!ret && (t1.size || t2.size)) {
+		int cmp;
+
+		/* like diff_tree_oid(), stop once there are too many */
+		if (cp->max_changes && cp->paths.nr > cp->max_changes)
+			break;
+
+		if (!t1.size)
+			cmp = 1;
+		else if (!t2.size)
+			cmp = -1;
+		else
+			cmp = base_name_compare(t1.entry.path,
+						tree_entry_len(&t1.entry),
+						t1.entry.mode,
+						t2.entry.path,
+						tree_entry_len(&t2.entry),
+						t2.entry.mode);
+
+		if (!cmp) {
+			if (t1.entry.mode != t2.entry.mode ||
+			    !oideq(&t1.entry.oid, &t2.entry.oid))
+				ret = add_changed_entry(cp, &t1.entry, &t2.entry);
+			if (update_tree_entry_gently(&t1) ||
+			    update_tree_entry_gently(&t2))
+				ret = -1;
+		} else if (cmp < 0) {
+			ret = add_changed_entry(cp, &t1.entry, NULL);
+			if (update_tree_entry_gently(&t1))
+				ret = -1;
+		} else {
+			ret = add_changed_entry(cp, NULL, &t2.entry);
+			if (update_tree_entry_gently(&t2))
+				ret = -1;
+		}
+	}
+
+out:
+	free(buf1);
+	free(buf2);
+	return ret;
+}
+
+struct bloom_job {
+	struct commit *commit;
+	struct bloom_filter *filter;
+	struct object_id tree;
+	struct object_id parent_tree;
+	unsigned has_parent : 1,
+		 failed : 1;
+	enum bloom_filter_computed computed;
+};
+
+struct bloom_jobs {
+	struct repository *r;
+	const struct bloom_filter_settings *settings;
+	struct bloom_job *jobs;
+	size_t nr, next, done;
+	struct progress *progress;
+	pthread_mutex_t mutex;
+};
+
+static void *bloom_thread_proc(void *data)
+{
+	struct bloom_jobs *jobs = data;
+	struct changed_paths cp = {
+		.r = jobs->r,
+		.base = STRBUF_INIT,
+		.paths = STRING_LIST_INIT_DUP,
+		.max_changes = jobs->settings->max_changed_paths,
+	};
+
+	for (;;) {
+		struct bloom_job *job;
+		const char **paths;
+		size_t i;
+
+		pthread_mutex_lock(&jobs->mutex);
+		job = jobs->next < jobs->nr ? &jobs->jobs[jobs->next++] : NULL;
+		pthread_mutex_unlock(&jobs->mutex);
+		if (!job)
+			break;
+
+		strbuf_reset(&cp.base);
+		string_list_clear(&cp.paths, 0);
+		if (walk_changed_paths(&cp,
+				       job->has_parent ? &job->parent_tree : NULL,
+				       &job->tree)) {
+			job->failed = 1;
+		} else {
+			ALLOC_ARRAY(paths, cp.paths.nr);
+			for (i = 0; i < cp.paths.nr; i++)
+				paths[i] = cp.paths.items[i].string;
+			job->computed = 0;
+			fill_bloom_filter(job->filter, paths, cp.paths.nr,
+					  jobs->settings, &job->computed);
+			free(paths);
+		}
+
+		pthread_mutex_lock(&jobs->mutex);
+		display_progress(jobs->progress, ++jobs->done);
+		pthread_mutex_unlock(&jobs->mutex);
+	}
+
+	strbuf_release(&cp.base);
+	string_list_clear(&cp.paths, 0);
+	return NULL;
+}
+
+/*
+ * Give each thread at least this many commits, so that starting it is
+ * worth it.
+ */
+#define BLOOM_FILTERS_PER_THREAD 64
+
+void compute_commit_bloom_filters(struct repository *r,
+				  struct commit **commits, size_t nr,
+				  const struct bloom_filter_settings *settings,
+				  int nr_threads, struct progress *progress,
+				  enum bloom_filter_computed *computed)
+{
+	struct bloom_jobs jobs = { 0 };
+	pthread_t *threads;
+	size_t i;
+	int t;
+
+	if (nr_threads > nr / BLOOM_FILTERS_PER_THREAD)
+		nr_threads = nr / BLOOM_FILTERS_PER_THREAD;
+
+	if (!HAVE_THREADS || nr_threads <= 1) {
+		for (i = 0; i < nr; i++) {
+			get_or_compute_bloom_filter(r, commits[i], 1, settings,
+						    &computed[i]);
+			display_progress(progress, i + 1);
+		}
+		return;
+	}
+
+	trace2_region_enter("bloom", "compute_bloom_filters", r);
+
+	/*
+	 * Everything that touches the parsed objects or the slab happens
+	 * here; the threads only read trees and fill their own filters.
+	 */
+	jobs.r = r;
+	jobs.settings = settings;
+	jobs.nr = nr;
+	jobs.progress = progress;
+	CALLOC_ARRAY(jobs.jobs, nr);
+	for (i = 0; i < nr; i++) {
+		struct bloom_job *job = &jobs.jobs[i];
+		struct commit *c = commits[i];
+
+		repo_parse_commit(r, c);
+		job->commit = c;
+		job->filter = bloom_filter_slab_at(&bloom_filters, c);
+		oidcpy(&job->tree, get_commit_tree_oid(c));
+		if (c->parents) {
+			repo_parse_commit(r, c->parents->item);
+			oidcpy(&job->parent_tree,
+			       get_commit_tree_oid(c->parents->item));
+			job->has_parent = 1;
+		}
+	}
+
+	pthread_mutex_init(&jobs.mutex, NULL);
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		int err = pthread_create(&threads[t], NULL, bloom_thread_proc,
+					 &jobs);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (t = 0; t < nr_threads; t++) {
+		int err = pthread_join(threads[t], NULL);
+		if (err)
+			die(_("unable to join thread: %s"), strerror(err));
+	}
+	free(threads);
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&jobs.mutex);
+
+	for (i = 0; i < nr; i++) {
+		struct bloom_job *job = &jobs.jobs[i];
+
+		/* let the diff machinery report whatever went wrong */
+		if (job->failed)
+			get_or_compute_bloom_filter(r, job->commit, 1, settings,
+						    &job->computed);
+		computed[i] = job->computed;
+	}
+	free(jobs.jobs);
+
+	trace2_data_intmax("bloom", r, "compute_bloom_filters_threads",
+			   nr_threads);
+	trace2_region_leave("bloom", "compute_bloom_filters", r);
+}
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings)
@@ -325,3 +663,16 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 
 	return 1;
 }
+
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings)
+{
+	int ret = 1;
+	size_t i;
+
+	for (i = 0; ret && i < vec->count; i++)
+		ret = bloom_filter_contains(filter, &vec->key[i], settings);
+
+	return ret;
+}
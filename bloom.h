@@ -2,6 +2,7 @@
 #define BLOOM_H
 
 struct commit;
+struct progress;
 struct repository;
 
 struct bloom_filter_settings {
@@ -68,6 +69,16 @@ struct bloom_key {
 	uint32_t *hashes;
 };
 
+/*
+ * The keys of a path and of each of its leading directories, longest
+ * first. A changed path adds all of them to its commit's filter, so a
+ * filter can only have changed the path if it contains every key.
+ */
+struct bloom_keyvec {
+	size_t count;
+	struct bloom_key key[FLEX_ARRAY];
+};
+
 /*
  * Calculate the murmur3 32-bit hash value for the given data
  * using the given seed.
@@ -83,6 +94,14 @@ void fill_bloom_key(const char *data,
 		    const struct bloom_filter_settings *settings);
 void clear_bloom_key(struct bloom_key *key);
 
+/*
+ * Allocate the keys of the "len" bytes at "path", which must neither be
+ * empty nor end in a slash.
+ */
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings);
+void bloom_keyvec_free(struct bloom_keyvec *vec);
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings);
@@ -105,8 +124,29 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 #define get_bloom_filter(r, c) get_or_compute_bloom_filter( \
 	(r), (c), 0, NULL, NULL)
 
+/*
+ * Compute the Bloom filters of the "nr" commits in "commits", none of
+ * which may have one yet, storing what was done for each in the
+ * corresponding entry of "computed". With "nr_threads" > 1, the tree
+ * diffs of independent commits run in parallel; the filters are the
+ * same as those get_or_compute_bloom_filter() would compute.
+ */
+void compute_commit_bloom_filters(struct repository *r,
+				  struct commit **commits, size_t nr,
+				  const struct bloom_filter_settings *settings,
+				  int nr_threads, struct progress *progress,
+				  enum bloom_filter_computed *computed);
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings);
 
+/*
+ * Like bloom_filter_contains(), but for all the keys of "vec": 0 when
+ * at least one of them is definitely not in the filter.
+ */
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings);
+
 #endif
@@ -196,6 +196,7 @@ int cmd_prune(int argc, const char **argv, const char *prefix);
 int cmd_prune_packed(int argc, const char **argv, const char *prefix);
 int cmd_pull(int argc, const char **argv, const char *prefix);
 int cmd_push(int argc, const char **argv, const char *prefix);
+int cmd_query__daemon(int argc, const char **argv, const char *prefix);
 int cmd_range_diff(int argc, const char **argv, const char *prefix);
 int cmd_read_tree(int argc, const char **argv, const char *prefix);
 int cmd_rebase(int argc, const char **argv, const char *prefix);
@@ -246,5 +247,6 @@ int cmd_verify_pack(int argc, const char **argv, const char *prefix);
 int cmd_show_ref(int argc, const char **argv, const char *prefix);
 int cmd_pack_refs(int argc, const char **argv, const char *prefix);
 int cmd_replace(int argc, const char **argv, const char *prefix);
+int cmd_replay(int argc, const char **argv, const char *prefix);
 
 #endif
@@ -85,11 +85,60 @@ static int fix_unmerged_status(struct diff_filepair *p,
 		return DIFF_STATUS_MODIFIED;
 }
 
+/*
+ * Tell the clean filters which files we are about to read, that is
+ * those of 'paths' that add_to_index() will not find up to date, so
+ * that they can be sent several of them at a time.
+ */
+static void start_clean_filters(struct string_list *paths, int flags)
+{
+	struct string_list to_clean = STRING_LIST_INIT_NODUP;
+	/* the same as in add_to_index() */
+	unsigned ce_option = CE_MATCH_IGNORE_VALID |
+			     CE_MATCH_IGNORE_SKIP_WORKTREE |
+			     CE_MATCH_RACY_IS_DIRTY;
+	int i;
+
+	if (flags & (ADD_CACHE_PRETEND | ADD_CACHE_INTENT) ||
+	    !have_process_filters())
+		return;
+
+	for (i = 0; i < paths->nr; i++) {
+		const char *path = paths->items[i].string;
+		const struct cache_entry *ce;
+		struct stat st;
+
+		if (lstat(path, &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (!(flags & ADD_CACHE_RENORMALIZE)) {
+			ce = index_file_exists(&the_index, path, strlen(path),
+					       ignore_case);
+			if (ce && !ce_stage(ce) &&
+			    !ie_match_stat(&the_index, ce, &st, ce_option))
+				continue;
+		}
+		string_list_append(&to_clean, path);
+	}
+	start_clean_pipeline(&the_index, &to_clean);
+	string_list_clear(&to_clean, 0);
+}
+
 static void update_callback(struct diff_queue_struct *q,
 			    struct diff_options *opt, void *cbdata)
 {
 	int i;
 	struct update_callback_data *data = cbdata;
+	struct string_list paths = STRING_LIST_INIT_NODUP;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+		int status = fix_unmerged_status(p, data);
+		if (status == DIFF_STATUS_MODIFIED ||
+		    status == DIFF_STATUS_TYPE_CHANGED)
+			string_list_append(&paths, p->one->path);
+	}
+	start_clean_filters(&paths, data->flags);
+	string_list_clear(&paths, 0);
 
 	for (i = 0; i < q->nr; i++) {
 		struct diff_filepair *p = q->queue[i];
@@ -115,6 +164,7 @@ static void update_callback(struct diff_queue_struct *q,
 			break;
 		}
 	}
+	finish_clean_pipeline();
 }
 
 int add_files_to_cache(const char *prefix,
@@ -454,6 +504,15 @@ static int add_files(struct dir_struct *dir, int flags)
 		exit_status = 1;
 	}
 
+	if (have_process_filters()) {
+		struct string_list paths = STRING_LIST_INIT_NODUP;
+
+		for (i = 0; i < dir->nr; i++)
+			string_list_append(&paths, dir->entries[i]->name);
+		start_clean_filters(&paths, flags);
+		string_list_clear(&paths, 0);
+	}
+
 	for (i = 0; i < dir->nr; i++) {
 		if (add_file_to_index(&the_index, dir->entries[i]->name, flags)) {
 			if (!ignore_add_errors)
@@ -463,6 +522,7 @@ static int add_files(struct dir_struct *dir, int flags)
 			check_embedded_repo(dir->entries[i]->name);
 		}
 	}
+	finish_clean_pipeline();
 	return exit_status;
 }
 
@@ -528,6 +588,9 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 	add_new_files = !take_worktree_changes && !refresh_only && !add_renormalize;
 	require_pathspec = !(take_worktree_changes || (0 < addremove_explicit));
 
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
+
 	hold_locked_index(&lock_file, LOCK_DIE_ON_ERROR);
 
 	/*
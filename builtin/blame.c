@@ -28,6 +28,7 @@
 #include "blame.h"
 #include "refs.h"
 #include "tag.h"
+#include "thread-utils.h"
 
 static char blame_usage[] = N_("git blame [<options>] [<rev-opts>] [<rev>] [--] <file>");
 
@@ -44,6 +45,8 @@ static int max_orig_digits;
 static int max_digits;
 static int max_score_digits;
 static int show_root;
+static int use_blame_cache;
+static int blame_threads;
 static int reverse;
 static int blank_boundary;
 static int incremental;
@@ -687,6 +690,21 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 		show_root = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "blame.threads")) {
+		blame_threads = git_config_int(var, value);
+		if (blame_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    blame_threads, var);
+		else if (!HAVE_THREADS && blame_threads > 1) {
+			warning(_("no threads support, ignoring %s"), var);
+			blame_threads = 1;
+		}
+		return 0;
+	}
 	if (!strcmp(var, "blame.blankboundary")) {
 		blank_boundary = git_config_bool(var, value);
 		return 0;
@@ -1087,12 +1105,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	string_list_clear(&ignore_rev_list, 0);
 	setup_scoreboard(&sb, &o);
 
-	/*
-	 * Changed-path Bloom filters are disabled when looking
-	 * for copies.
-	 */
-	if (!(opt & PICKAXE_BLAME_COPY))
-		setup_blame_bloom_data(&sb);
+	setup_blame_bloom_data(&sb);
 
 	lno = sb.num_lines;
 
@@ -1148,6 +1161,11 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	sb.show_root = show_root;
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
+	sb.use_cache = use_blame_cache;
+	if (!HAVE_THREADS)
+		sb.num_threads = 1;
+	else
+		sb.num_threads = blame_threads ? blame_threads : online_cpus();
 
 	read_mailmap(&mailmap);
 
@@ -24,6 +24,7 @@ struct batch_options {
 	int buffer_output;
 	int all_objects;
 	int unordered;
+	unsigned batch_size;
 	int cmdmode; /* may be 'w' or 'c' for --filters or --textconv */
 	const char *format;
 };
@@ -227,6 +228,15 @@ struct expand_data {
 	 * optimized out.
 	 */
 	unsigned skip_object_info : 1;
+
+	/*
+	 * Contents of the object read ahead of time by --batch-size, to
+	 * be printed instead of reading the object again; NULL if the
+	 * object was not read ahead.
+	 */
+	void *prefetched;
+	unsigned long prefetched_size;
+	enum object_type prefetched_type;
 };
 
 static int is_atom(const char *atom, const char *s, int slen)
@@ -303,6 +313,15 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 
 	assert(data->info.typep);
 
+	if (data->prefetched && !opt->cmdmode) {
+		if (data->prefetched_type != data->type)
+			die("object %s changed type!?", oid_to_hex(oid));
+		if (data->info.sizep && data->prefetched_size != data->size)
+			die("object %s changed size!?", oid_to_hex(oid));
+		batch_write(opt, data->prefetched, data->prefetched_size);
+		return;
+	}
+
 	if (data->type == OBJ_BLOB) {
 		if (opt->buffer_output)
 			fflush(stdout);
@@ -380,17 +399,24 @@ static void batch_object_write(const char *obj_name,
 	}
 }
 
-static void batch_one_object(const char *obj_name,
-			     struct strbuf *scratch,
-			     struct batch_options *opt,
-			     struct expand_data *data)
+static enum get_oid_result batch_resolve_object(const char *obj_name,
+						struct batch_options *opt,
+						struct object_id *oid,
+						struct object_context *ctx)
 {
-	struct object_context ctx;
 	int flags = opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0;
-	enum get_oid_result result;
 
-	result = get_oid_with_context(the_repository, obj_name,
-				      flags, &data->oid, &ctx);
+	return get_oid_with_context(the_repository, obj_name,
+				    flags, oid, ctx);
+}
+
+static void batch_resolved_object(const char *obj_name,
+				  enum get_oid_result result,
+				  struct object_context *ctx,
+				  struct strbuf *scratch,
+				  struct batch_options *opt,
+				  struct expand_data *data)
+{
 	if (result != FOUND) {
 		switch (result) {
 		case MISSING_OBJECT:
@@ -420,10 +446,10 @@ static void batch_one_object(const char *obj_name,
 		return;
 	}
 
-	if (ctx.mode == 0) {
+	if (ctx->mode == 0) {
 		printf("symlink %"PRIuMAX"\n%s\n",
-		       (uintmax_t)ctx.symlink_path.len,
-		       ctx.symlink_path.buf);
+		       (uintmax_t)ctx->symlink_path.len,
+		       ctx->symlink_path.buf);
 		fflush(stdout);
 		return;
 	}
@@ -431,6 +457,106 @@ static void batch_one_object(const char *obj_name,
 	batch_object_write(obj_name, scratch, opt, data);
 }
 
+static void batch_one_object(const char *obj_name,
+			     struct strbuf *scratch,
+			     struct batch_options *opt,
+			     struct expand_data *data)
+{
+	struct object_context ctx;
+	enum get_oid_result result;
+
+	result = batch_resolve_object(obj_name, opt, &data->oid, &ctx);
+	batch_resolved_object(obj_name, result, &ctx, scratch, opt, data);
+}
+
+/*
+ * An input line queued by --batch-size, together with what we learned
+ * about it while reading the batch ahead.
+ */
+struct batch_entry {
+	char *name;
+	const char *rest;
+	struct object_id oid;
+	struct object_context ctx;
+	enum get_oid_result result;
+	void *contents;
+	unsigned long size;
+	enum object_type type;
+};
+
+static void batch_prefetch_contents(struct batch_entry *entries, size_t nr)
+{
+	struct object_id *oids;
+	size_t *which, *order;
+	size_t i, oids_nr = 0;
+
+	ALLOC_ARRAY(oids, nr);
+	ALLOC_ARRAY(which, nr);
+	for (i = 0; i < nr; i++) {
+		if (entries[i].result != FOUND || !entries[i].ctx.mode)
+			continue;
+		oidcpy(&oids[oids_nr], &entries[i].oid);
+		which[oids_nr++] = i;
+	}
+
+	ALLOC_ARRAY(order, oids_nr);
+	sort_oids_in_pack_order(the_repository, oids, oids_nr, order);
+
+	for (i = 0; i < oids_nr; i++) {
+		struct batch_entry *e = &entries[which[order[i]]];
+		struct pack_entry pe;
+		unsigned long size;
+
+		if (find_pack_entry(the_repository, &e->oid, &pe))
+			pack_readahead(pe.p, pe.offset);
+
+		/* large blobs are streamed when printed */
+		if (oid_object_info(the_repository, &e->oid, &size) == OBJ_BLOB &&
+		    size > big_file_threshold)
+			continue;
+		e->contents = read_object_file(&e->oid, &e->type, &e->size);
+	}
+
+	free(order);
+	free(which);
+	free(oids);
+}
+
+static void batch_flush_entries(struct batch_entry *entries, size_t nr,
+				struct strbuf *scratch,
+				struct batch_options *opt,
+				struct expand_data *data)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		entries[i].result = batch_resolve_object(entries[i].name, opt,
+							 &entries[i].oid,
+							 &entries[i].ctx);
+
+	if (opt->print_contents && !opt->cmdmode)
+		batch_prefetch_contents(entries, nr);
+
+	for (i = 0; i < nr; i++) {
+		struct batch_entry *e = &entries[i];
+
+		oidcpy(&data->oid, &e->oid);
+		data->rest = e->rest;
+		data->prefetched = e->contents;
+		data->prefetched_size = e->size;
+		data->prefetched_type = e->type;
+
+		batch_resolved_object(e->name, e->result, &e->ctx,
+				      scratch, opt, data);
+
+		data->prefetched = NULL;
+		free(e->contents);
+		free(e->name);
+		free(e->ctx.path);
+		strbuf_release(&e->ctx.symlink_path);
+	}
+}
+
 struct object_cb_data {
 	struct batch_options *opt;
 	struct expand_data *expand;
@@ -493,6 +619,8 @@ static int batch_objects(struct batch_options *opt)
 	struct strbuf input = STRBUF_INIT;
 	struct strbuf output = STRBUF_INIT;
 	struct expand_data data;
+	struct batch_entry *entries = NULL;
+	size_t entries_nr = 0, entries_alloc = 0;
 	int save_warning;
 	int retval = 0;
 
@@ -585,9 +713,31 @@ static int batch_objects(struct batch_options *opt)
 			data.rest = p;
 		}
 
+		if (opt->batch_size > 1) {
+			struct batch_entry *e;
+			size_t rest_off = data.rest ? data.rest - input.buf : 0;
+
+			ALLOC_GROW(entries, entries_nr + 1, entries_alloc);
+			e = &entries[entries_nr++];
+			memset(e, 0, sizeof(*e));
+			e->rest = data.rest;
+			e->name = strbuf_detach(&input, NULL);
+			if (e->rest)
+				e->rest = e->name + rest_off;
+
+			if (entries_nr >= opt->batch_size) {
+				batch_flush_entries(entries, entries_nr,
+						    &output, opt, &data);
+				entries_nr = 0;
+			}
+			continue;
+		}
+
 		batch_one_object(input.buf, &output, opt, &data);
 	}
 
+	batch_flush_entries(entries, entries_nr, &output, opt, &data);
+	free(entries);
 	strbuf_release(&input);
 	strbuf_release(&output);
 	warn_on_object_refname_ambiguity = save_warning;
@@ -633,6 +783,7 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 	const char *exp_type = NULL, *obj_name = NULL;
 	struct batch_options batch = {0};
 	int unknown_type = 0;
+	int batch_size = 0;
 
 	const struct option options[] = {
 		OPT_GROUP(N_("<type> can be one of: blob, tree, commit, tag")),
@@ -664,6 +815,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			 N_("show all objects with --batch or --batch-check")),
 		OPT_BOOL(0, "unordered", &batch.unordered,
 			 N_("do not order --batch-all-objects output")),
+		OPT_INTEGER(0, "batch-size", &batch_size,
+			    N_("read objects named on standard input in batches of <n>, in pack order")),
 		OPT_END()
 	};
 
@@ -671,6 +824,9 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 
 	batch.buffer_output = -1;
 	argc = parse_options(argc, argv, prefix, options, cat_file_usage, 0);
+	if (batch_size < 0)
+		die(_("--batch-size must be non-negative"));
+	batch.batch_size = batch_size;
 
 	if (opt) {
 		if (batch.enabled && (opt == 'c' || opt == 'w'))
@@ -695,7 +851,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			    "--textconv nor with --filters");
 	}
 
-	if ((batch.follow_symlinks || batch.all_objects) && !batch.enabled) {
+	if ((batch.follow_symlinks || batch.all_objects || batch.batch_size) &&
+	    !batch.enabled) {
 		usage_with_options(cat_file_usage, options);
 	}
 
@@ -709,8 +866,11 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		usage_with_options(cat_file_usage, options);
 	}
 
+	if (batch.batch_size && batch.all_objects)
+		die(_("--batch-size cannot be combined with --batch-all-objects"));
+
 	if (batch.buffer_output < 0)
-		batch.buffer_output = batch.all_objects;
+		batch.buffer_output = batch.all_objects || batch.batch_size > 1;
 
 	if (batch.enabled)
 		return batch_objects(&batch);
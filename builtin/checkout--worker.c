@@ -19,7 +19,8 @@ static void packet_to_pc_item(const char *buffer, int len,
 	fixed_portion = (struct pc_item_fixed_portion *)buffer;
 
 	if (len - sizeof(struct pc_item_fixed_portion) !=
-		fixed_portion->name_len + fixed_portion->working_tree_encoding_len)
+		fixed_portion->name_len + fixed_portion->working_tree_encoding_len +
+		fixed_portion->filter_name_len)
 		BUG("checkout worker received corrupted item");
 
 	variant = buffer + sizeof(struct pc_item_fixed_portion);
@@ -39,6 +40,18 @@ static void packet_to_pc_item(const char *buffer, int len,
 	}
 
 	memset(pc_item, 0, sizeof(*pc_item));
+
+	if (fixed_portion->filter_name_len) {
+		char *filter_name = xmemdupz(variant,
+					     fixed_portion->filter_name_len);
+
+		if (conv_attrs_set_filter(&pc_item->ca, filter_name))
+			die("checkout worker does not know filter '%s'",
+			    filter_name);
+		free(filter_name);
+		variant += fixed_portion->filter_name_len;
+	}
+
 	pc_item->ce = make_empty_transient_cache_entry(fixed_portion->name_len, NULL);
 	pc_item->ce->ce_namelen = fixed_portion->name_len;
 	pc_item->ce->ce_mode = fixed_portion->ce_mode;
@@ -79,6 +92,7 @@ static void release_pc_item_data(struct parallel_checkout_item *pc_item)
 static void worker_loop(struct checkout *state)
 {
 	struct parallel_checkout_item *items = NULL;
+	struct cache_def cache = CACHE_DEF_INIT;
 	size_t i, nr = 0, alloc = 0;
 
 	while (1) {
@@ -96,13 +110,14 @@ static void worker_loop(struct checkout *state)
 
 	for (i = 0; i < nr; i++) {
 		struct parallel_checkout_item *pc_item = &items[i];
-		write_pc_item(pc_item, state);
+		write_pc_item(pc_item, state, &cache);
 		report_result(pc_item);
 		release_pc_item_data(pc_item);
 	}
 
 	packet_flush(1);
 
+	cache_def_clear(&cache);
 	free(items);
 }
 
@@ -114,9 +129,15 @@ static const char * const checkout_worker_usage[] = {
 int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
 {
 	struct checkout state = CHECKOUT_INIT;
+	const char *refname = NULL, *treeish_hex = NULL;
+	struct object_id treeish;
 	struct option checkout_worker_options[] = {
 		OPT_STRING(0, "prefix", &state.base_dir, N_("string"),
 			N_("when creating files, prepend <string>")),
+		OPT_STRING(0, "refname", &refname, N_("refname"),
+			N_("tell filters the entries come from <refname>")),
+		OPT_STRING(0, "treeish", &treeish_hex, N_("tree-ish"),
+			N_("tell filters the entries come from <tree-ish>")),
 		OPT_END()
 	};
 
@@ -132,6 +153,10 @@ int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
 
 	if (state.base_dir)
 		state.base_dir_len = strlen(state.base_dir);
+	if (treeish_hex && get_oid_hex(treeish_hex, &treeish))
+		die("invalid --treeish value: '%s'", treeish_hex);
+	init_checkout_metadata(&state.meta, refname,
+			       treeish_hex ? &treeish : NULL, NULL);
 
 	/*
 	 * Setting this on a worker won't actually update the index. We just
@@ -19,9 +19,12 @@
 #include "pathspec.h"
 #include "help.h"
 #include "prompt.h"
+#include "thread-utils.h"
+#include "compat/bulk-lstat.h"
 
 static int force = -1; /* unset */
 static int interactive;
+static int clean_threads;
 static struct string_list del_list = STRING_LIST_INIT_DUP;
 static unsigned int colopts;
 
@@ -128,6 +131,13 @@ static int git_clean_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "clean.threads")) {
+		clean_threads = git_config_int(var, value);
+		if (clean_threads < 0)
+			die(_("invalid value for '%s': %d"), var, clean_threads);
+		return 0;
+	}
+
 	/* inspect the color.ui config variable and others */
 	return git_color_default_config(var, value, cb);
 }
@@ -152,12 +162,44 @@ static int exclude_cb(const struct option *opt, const char *arg, int unset)
 	return 0;
 }
 
+/*
+ * What removing one of the paths to clean printed, kept aside so that
+ * the paths can be removed in parallel and reported in order.
+ */
+struct clean_report {
+	struct strbuf out;
+	struct string_list warnings;
+	int errors;
+};
+
+static void report_removal(struct clean_report *report, int dry_run,
+			   const char *quoted)
+{
+	strbuf_addf(&report->out,
+		    dry_run ? _(msg_would_remove) : _(msg_remove), quoted);
+}
+
+/* Like warning_errno(fmt, arg), but into the report. */
+static void report_warning_errno(struct clean_report *report,
+				 const char *fmt, const char *arg)
+{
+	int saved_errno = errno;
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_addf(&sb, fmt, arg);
+	strbuf_addf(&sb, ": %s", strerror(saved_errno));
+	string_list_append_nodup(&report->warnings, strbuf_detach(&sb, NULL));
+	errno = saved_errno;
+}
+
 static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
-		int dry_run, int quiet, int *dir_gone)
+		int dry_run, int quiet, int *dir_gone,
+		struct clean_report *report)
 {
 	DIR *dir;
 	struct strbuf quoted = STRBUF_INIT;
 	struct dirent *e;
+	struct bulk_lstat bs = BULK_LSTAT_INIT;
 	int res = 0, ret = 0, gone = 1, original_len = path->len, len;
 	struct string_list dels = STRING_LIST_INIT_DUP;
 
@@ -167,8 +209,10 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 	    is_nonbare_repository_dir(path)) {
 		if (!quiet) {
 			quote_path(path->buf, prefix, &quoted, 0);
-			printf(dry_run ?  _(msg_would_skip_git_dir) : _(msg_skip_git_dir),
-					quoted.buf);
+			strbuf_addf(&report->out,
+				    dry_run ? _(msg_would_skip_git_dir) :
+				    _(msg_skip_git_dir),
+				    quoted.buf);
 		}
 
 		*dir_gone = 0;
@@ -179,9 +223,10 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 #ifndef CAN_UNLINK_MOUNT_POINTS
 		if (!quiet) {
 			quote_path(path->buf, prefix, &quoted, 0);
-			printf(dry_run ?
-			       _(msg_would_skip_mount_point) :
-			       _(msg_skip_mount_point), quoted.buf);
+			strbuf_addf(&report->out,
+				    dry_run ?
+				    _(msg_would_skip_mount_point) :
+				    _(msg_skip_mount_point), quoted.buf);
 		}
 		*dir_gone = 0;
 #else
@@ -189,7 +234,8 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 			int saved_errno = errno;
 			quote_path(path->buf, prefix, &quoted, 0);
 			errno = saved_errno;
-			warning_errno(_(msg_warn_remove_failed), quoted.buf);
+			report_warning_errno(report, _(msg_warn_remove_failed),
+					     quoted.buf);
 			*dir_gone = 0;
 			ret = -1;
 		}
@@ -206,7 +252,8 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 			int saved_errno = errno;
 			quote_path(path->buf, prefix, &quoted, 0);
 			errno = saved_errno;
-			warning_errno(_(msg_warn_remove_failed), quoted.buf);
+			report_warning_errno(report, _(msg_warn_remove_failed),
+					     quoted.buf);
 			*dir_gone = 0;
 		}
 		ret = res;
@@ -221,10 +268,12 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 
 		strbuf_setlen(path, len);
 		strbuf_addstr(path, e->d_name);
-		if (lstat(path->buf, &st))
-			warning_errno(_(msg_warn_lstat_failed), path->buf);
+		if (bulk_lstat(&bs, path->buf, &st))
+			report_warning_errno(report, _(msg_warn_lstat_failed),
+					     path->buf);
 		else if (S_ISDIR(st.st_mode)) {
-			if (remove_dirs(path, prefix, force_flag, dry_run, quiet, &gone))
+			if (remove_dirs(path, prefix, force_flag, dry_run, quiet,
+					&gone, report))
 				ret = 1;
 			if (gone) {
 				quote_path(path->buf, prefix, &quoted, 0);
@@ -241,7 +290,9 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 				int saved_errno = errno;
 				quote_path(path->buf, prefix, &quoted, 0);
 				errno = saved_errno;
-				warning_errno(_(msg_warn_remove_failed), quoted.buf);
+				report_warning_errno(report,
+						     _(msg_warn_remove_failed),
+						     quoted.buf);
 				*dir_gone = 0;
 				ret = 1;
 			}
@@ -254,6 +305,7 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 		break;
 	}
 	closedir(dir);
+	bulk_lstat_release(&bs);
 
 	strbuf_setlen(path, original_len);
 
@@ -265,7 +317,8 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 			int saved_errno = errno;
 			quote_path(path->buf, prefix, &quoted, 0);
 			errno = saved_errno;
-			warning_errno(_(msg_warn_remove_failed), quoted.buf);
+			report_warning_errno(report, _(msg_warn_remove_failed),
+					     quoted.buf);
 			*dir_gone = 0;
 			ret = 1;
 		}
@@ -274,7 +327,7 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 	if (!*dir_gone && !quiet) {
 		int i;
 		for (i = 0; i < dels.nr; i++)
-			printf(dry_run ?  _(msg_would_remove) : _(msg_remove), dels.items[i].string);
+			report_removal(report, dry_run, dels.items[i].string);
 	}
 out:
 	strbuf_release(&quoted);
@@ -282,6 +335,187 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 	return ret;
 }
 
+struct clean_options {
+	const char *prefix;
+	int rm_flags;
+	int dry_run;
+	int quiet;
+};
+
+/* Remove one of the paths in del_list, relative to the prefix. */
+static void clean_path(const struct clean_options *opts, const char *name,
+		       struct clean_report *report)
+{
+	struct strbuf abs_path = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct stat st;
+	int res, gone;
+
+	if (opts->prefix)
+		strbuf_addstr(&abs_path, opts->prefix);
+
+	strbuf_addstr(&abs_path, name);
+
+	/*
+	 * we might have removed this as part of earlier
+	 * recursive directory removal, so lstat() here could
+	 * fail with ENOENT.
+	 */
+	if (lstat(abs_path.buf, &st))
+		goto out;
+
+	if (S_ISDIR(st.st_mode)) {
+		if (remove_dirs(&abs_path, opts->prefix, opts->rm_flags,
+				opts->dry_run, opts->quiet, &gone, report))
+			report->errors++;
+		if (gone && !opts->quiet)
+			report_removal(report, opts->dry_run,
+				       quote_path(name, NULL, &buf, 0));
+	} else {
+		res = opts->dry_run ? 0 : unlink(abs_path.buf);
+		if (res) {
+			int saved_errno = errno;
+			quote_path(name, NULL, &buf, 0);
+			errno = saved_errno;
+			report_warning_errno(report, _(msg_warn_remove_failed),
+					     buf.buf);
+			report->errors++;
+		} else if (!opts->quiet) {
+			report_removal(report, opts->dry_run,
+				       quote_path(name, NULL, &buf, 0));
+		}
+	}
+out:
+	strbuf_release(&abs_path);
+	strbuf_release(&buf);
+}
+
+/* Print what was reported and return the number of errors. */
+static int flush_clean_report(struct clean_report *report)
+{
+	struct string_list_item *item;
+	int errors = report->errors;
+
+	for_each_string_list_item(item, &report->warnings)
+		warning("%s", item->string);
+	fputs(report->out.buf, stdout);
+	strbuf_release(&report->out);
+	string_list_clear(&report->warnings, 0);
+	return errors;
+}
+
+/*
+ * The paths in del_list are never inside one another, so they can be
+ * removed by several threads at once. Each thread takes the next path
+ * in the list; the main thread prints what was reported for each path
+ * in order as soon as it is done.
+ */
+struct clean_thread_data {
+	pthread_t thread;
+	const struct clean_options *opts;
+	struct clean_report *reports;
+	int *done;
+	int *next;
+	pthread_mutex_t *mutex;
+	pthread_cond_t *cond;
+};
+
+static void *clean_thread(void *data_)
+{
+	struct clean_thread_data *data = data_;
+
+	trace2_thread_start("clean");
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(data->mutex);
+		i = (*data->next)++;
+		pthread_mutex_unlock(data->mutex);
+		if (i >= del_list.nr)
+			break;
+
+		clean_path(data->opts, del_list.items[i].string,
+			   &data->reports[i]);
+
+		pthread_mutex_lock(data->mutex);
+		data->done[i] = 1;
+		pthread_cond_broadcast(data->cond);
+		pthread_mutex_unlock(data->mutex);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static int clean_paths(const struct clean_options *opts)
+{
+	struct clean_thread_data *threads;
+	struct clean_report *reports;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int *done;
+	int i, nr_threads = clean_threads, next = 0, errors = 0;
+
+	if (!HAVE_THREADS)
+		nr_threads = 1;
+	else if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > del_list.nr)
+		nr_threads = del_list.nr;
+
+	CALLOC_ARRAY(reports, del_list.nr);
+	for (i = 0; i < del_list.nr; i++) {
+		strbuf_init(&reports[i].out, 0);
+		string_list_init(&reports[i].warnings, 1);
+	}
+
+	if (nr_threads <= 1) {
+		for (i = 0; i < del_list.nr; i++) {
+			clean_path(opts, del_list.items[i].string, &reports[i]);
+			errors += flush_clean_report(&reports[i]);
+		}
+		free(reports);
+		return errors;
+	}
+
+	CALLOC_ARRAY(done, del_list.nr);
+	CALLOC_ARRAY(threads, nr_threads);
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		int err;
+
+		threads[i].opts = opts;
+		threads[i].reports = reports;
+		threads[i].done = done;
+		threads[i].next = &next;
+		threads[i].mutex = &mutex;
+		threads[i].cond = &cond;
+		err = pthread_create(&threads[i].thread, NULL, clean_thread,
+				     &threads[i]);
+		if (err)
+			die(_("unable to create clean thread: %s"),
+			    strerror(err));
+	}
+
+	for (i = 0; i < del_list.nr; i++) {
+		pthread_mutex_lock(&mutex);
+		while (!done[i])
+			pthread_cond_wait(&cond, &mutex);
+		pthread_mutex_unlock(&mutex);
+		errors += flush_clean_report(&reports[i]);
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].thread, NULL))
+			die(_("unable to join thread"));
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+	free(threads);
+	free(done);
+	free(reports);
+	return errors;
+}
+
 static void pretty_print_dels(void)
 {
 	struct string_list list = STRING_LIST_INIT_DUP;
@@ -912,18 +1146,15 @@ static void correct_untracked_entries(struct dir_struct *dir)
 
 int cmd_clean(int argc, const char **argv, const char *prefix)
 {
-	int i, res;
+	int i;
 	int dry_run = 0, remove_directories = 0, quiet = 0, ignored = 0;
-	int ignored_only = 0, config_set = 0, errors = 0, gone = 1;
+	int ignored_only = 0, config_set = 0, errors = 0;
 	int rm_flags = REMOVE_DIR_KEEP_NESTED_GIT;
-	struct strbuf abs_path = STRBUF_INIT;
 	struct dir_struct dir;
 	struct pathspec pathspec;
 	struct strbuf buf = STRBUF_INIT;
 	struct string_list exclude_list = STRING_LIST_INIT_NODUP;
 	struct pattern_list *pl;
-	struct string_list_item *item;
-	const char *qname;
 	struct option options[] = {
 		OPT__QUIET(&quiet, N_("do not print names of files removed")),
 		OPT__DRY_RUN(&dry_run, N_("dry run")),
@@ -1050,47 +1281,18 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 	if (interactive && del_list.nr > 0)
 		interactive_main_loop();
 
-	for_each_string_list_item(item, &del_list) {
-		struct stat st;
-
-		strbuf_reset(&abs_path);
-		if (prefix)
-			strbuf_addstr(&abs_path, prefix);
-
-		strbuf_addstr(&abs_path, item->string);
-
-		/*
-		 * we might have removed this as part of earlier
-		 * recursive directory removal, so lstat() here could
-		 * fail with ENOENT.
-		 */
-		if (lstat(abs_path.buf, &st))
-			continue;
+	if (del_list.nr) {
+		struct clean_options opts = {
+			.prefix = prefix,
+			.rm_flags = rm_flags,
+			.dry_run = dry_run,
+			.quiet = quiet,
+		};
 
-		if (S_ISDIR(st.st_mode)) {
-			if (remove_dirs(&abs_path, prefix, rm_flags, dry_run, quiet, &gone))
-				errors++;
-			if (gone && !quiet) {
-				qname = quote_path(item->string, NULL, &buf, 0);
-				printf(dry_run ? _(msg_would_remove) : _(msg_remove), qname);
-			}
-		} else {
-			res = dry_run ? 0 : unlink(abs_path.buf);
-			if (res) {
-				int saved_errno = errno;
-				qname = quote_path(item->string, NULL, &buf, 0);
-				errno = saved_errno;
-				warning_errno(_(msg_warn_remove_failed), qname);
-				errors++;
-			} else if (!quiet) {
-				qname = quote_path(item->string, NULL, &buf, 0);
-				printf(dry_run ? _(msg_would_remove) : _(msg_remove), qname);
-			}
-		}
+		errors = clean_paths(&opts);
 	}
 
 	disable_fscache();
-	strbuf_release(&abs_path);
 	strbuf_release(&buf);
 	string_list_clear(&del_list, 0);
 	string_list_clear(&exclude_list, 0);
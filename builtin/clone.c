@@ -32,6 +32,8 @@
 #include "connected.h"
 #include "packfile.h"
 #include "list-objects-filter-options.h"
+#include "bundle-uri.h"
+#include "thread-utils.h"
 
 /*
  * Overall FIXMEs:
@@ -73,6 +75,8 @@ static struct string_list option_recurse_submodules = STRING_LIST_INIT_NODUP;
 static struct list_objects_filter_options filter_options;
 static struct string_list server_options = STRING_LIST_INIT_NODUP;
 static int option_remote_submodules;
+static const char *bundle_uri;
+static int transfer_bundle_uri;
 
 static int recurse_submodules_cb(const struct option *opt,
 				 const char *arg, int unset)
@@ -154,9 +158,44 @@ static struct option builtin_clone_options[] = {
 		    N_("any cloned submodules will use their remote-tracking branch")),
 	OPT_BOOL(0, "sparse", &option_sparse_checkout,
 		    N_("initialize sparse-checkout file to include only files at root")),
+	OPT_STRING(0, "bundle-uri", &bundle_uri,
+		   N_("uri"), N_("a URI for downloading bundles before fetching from origin remote")),
 	OPT_END()
 };
 
+/*
+ * Seed the new repository from bundles, either the ones at --bundle-uri
+ * or, with transfer.bundleURI, the ones the remote advertises, so that
+ * the fetch that follows only has to transfer what they lack.
+ */
+static void fetch_bundles(struct transport *transport)
+{
+	uint64_t token = 0;
+
+	if (bundle_uri) {
+		if (fetch_bundle_uri(the_repository, bundle_uri, &token))
+			warning(_("failed to fetch objects from bundle URI '%s'"),
+				bundle_uri);
+		else if (token) {
+			char value[32];
+
+			/* Let later fetches pick up newer bundles. */
+			xsnprintf(value, sizeof(value), "%"PRIuMAX,
+				  (uintmax_t)token);
+			git_config_set("fetch.bundleuri", bundle_uri);
+			git_config_set("fetch.bundlecreationtoken", value);
+		}
+		return;
+	}
+
+	if (!transfer_bundle_uri || deepen ||
+	    transport_get_remote_bundle_uri(transport) ||
+	    !transport->bundles->nr)
+		return;
+	if (fetch_bundle_list(the_repository, transport->bundles, &token))
+		warning(_("failed to fetch advertised bundles"));
+}
+
 static const char *get_repo_path_1(struct strbuf *path, int *is_bundle)
 {
 	static char *suffix[] = { "/.git", "", ".git/.git", ".git" };
@@ -418,9 +457,97 @@ static void mkdir_if_missing(const char *pathname, mode_t mode)
 		die(_("%s exists and is not a directory"), pathname);
 }
 
+/*
+ * The files that cannot be hardlinked are copied by several threads,
+ * as a clone that has to copy large packs is mostly waiting for them.
+ * Each thread takes the next file in the list.
+ */
+struct copy_files_data {
+	pthread_t thread;
+	struct string_list *files;
+	int *next;
+	pthread_mutex_t *mutex;
+};
+
+static void copy_one_file(struct string_list_item *item)
+{
+	char *src = item->util;
+	int err = 0;
+
+	if (copy_file_with_time(item->string, src, 0666))
+		err = errno ? errno : EIO;
+	free(src);
+	item->util = (void *)(intptr_t)err;
+}
+
+static void *copy_files_thread(void *data_)
+{
+	struct copy_files_data *data = data_;
+
+	trace2_thread_start("clone-copy");
+	while (1) {
+		struct string_list_item *item;
+
+		pthread_mutex_lock(data->mutex);
+		item = *data->next < data->files->nr ?
+			&data->files->items[(*data->next)++] : NULL;
+		pthread_mutex_unlock(data->mutex);
+		if (!item)
+			break;
+		copy_one_file(item);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Copy each file in `files` from the path in its util field, which is
+ * freed and replaced with the errno of a failure or 0.
+ */
+static void copy_files(struct string_list *files)
+{
+	struct copy_files_data *threads;
+	pthread_mutex_t mutex;
+	int i, nr_threads, next = 0;
+
+	nr_threads = HAVE_THREADS ? online_cpus() : 1;
+	if (nr_threads > files->nr)
+		nr_threads = files->nr;
+	if (nr_threads <= 1) {
+		for (i = 0; i < files->nr; i++)
+			copy_one_file(&files->items[i]);
+		return;
+	}
+
+	/* read the configuration adjust_shared_perm() needs up front */
+	get_shared_repository();
+
+	CALLOC_ARRAY(threads, nr_threads);
+	pthread_mutex_init(&mutex, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		int err;
+
+		threads[i].files = files;
+		threads[i].next = &next;
+		threads[i].mutex = &mutex;
+		err = pthread_create(&threads[i].thread, NULL,
+				     copy_files_thread, &threads[i]);
+		if (err)
+			die(_("unable to create copy thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].thread, NULL))
+			die(_("unable to join thread"));
+	pthread_mutex_destroy(&mutex);
+	free(threads);
+}
+
 static void copy_or_link_directory(struct strbuf *src, struct strbuf *dest,
 				   const char *src_repo)
 {
+	struct string_list to_copy = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
 	int src_len, dest_len;
 	struct dir_iterator *iter;
 	int iter_status;
@@ -467,8 +594,8 @@ static void copy_or_link_directory(struct strbuf *src, struct strbuf *dest,
 				die_errno(_("failed to create link '%s'"), dest->buf);
 			option_no_hardlinks = 1;
 		}
-		if (copy_file_with_time(dest->buf, src->buf, 0666))
-			die_errno(_("failed to copy file to '%s'"), dest->buf);
+		string_list_append(&to_copy, dest->buf)->util =
+			xstrdup(src->buf);
 	}
 
 	if (iter_status != ITER_DONE) {
@@ -476,6 +603,17 @@ static void copy_or_link_directory(struct strbuf *src, struct strbuf *dest,
 		die(_("failed to iterate over '%s'"), src->buf);
 	}
 
+	copy_files(&to_copy);
+	for_each_string_list_item(item, &to_copy) {
+		int err = (intptr_t)item->util;
+
+		if (err) {
+			errno = err;
+			die_errno(_("failed to copy file to '%s'"), item->string);
+		}
+	}
+	string_list_clear(&to_copy, 0);
+
 	strbuf_release(&realpath);
 }
 
@@ -864,6 +1002,8 @@ static int git_clone_config(const char *k, const char *v, void *cb)
 	}
 	if (!strcmp(k, "clone.rejectshallow"))
 		config_reject_shallow = git_config_bool(k, v);
+	if (!strcmp(k, "transfer.bundleuri"))
+		transfer_bundle_uri = git_config_bool(k, v);
 
 	return git_default_config(k, v, cb);
 }
@@ -1011,6 +1151,8 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		deepen = 1;
 	if (option_single_branch == -1)
 		option_single_branch = deepen ? 1 : 0;
+	if (bundle_uri && deepen)
+		die(_("--bundle-uri is incompatible with --depth, --shallow-since, and --shallow-exclude"));
 
 	if (option_mirror)
 		option_bare = 1;
@@ -1149,7 +1291,8 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		}
 	}
 
-	init_db(git_dir, real_git_dir, option_template, GIT_HASH_UNKNOWN, NULL,
+	init_db(git_dir, real_git_dir, option_template, GIT_HASH_UNKNOWN,
+		REF_STORAGE_FORMAT_UNKNOWN, NULL,
 		INIT_DB_QUIET);
 
 	if (real_git_dir)
@@ -1301,9 +1444,13 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		 * Now that we know what algorithm the remote side is using,
 		 * let's set ours to the same thing.
 		 */
-		initialize_repository_version(hash_algo, 1);
+		initialize_repository_version(hash_algo,
+					      the_repository->ref_storage_format, 1);
 		repo_set_hash_algo(the_repository, hash_algo);
 
+		if (!is_local)
+			fetch_bundles(transport);
+
 		mapped_refs = wanted_peer_refs(refs, &remote->fetch);
 		/*
 		 * transport_get_remote_refs() may return refs with null sha-1
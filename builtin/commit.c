@@ -978,8 +978,7 @@ static int prepare_to_commit(const char *index_file, const char *prefix,
 		if (get_oid(parent, &oid)) {
 			int i, ita_nr = 0;
 
-			/* TODO: audit for interaction with sparse-index. */
-			ensure_full_index(&the_index);
+			/* a sparse directory is never intent-to-add */
 			for (i = 0; i < active_nr; i++)
 				if (ce_intent_to_add(active_cache[i]))
 					ita_nr++;
@@ -1553,6 +1552,8 @@ int cmd_status(int argc, const char **argv, const char *prefix)
 	if (status_format != STATUS_FORMAT_PORCELAIN &&
 	    status_format != STATUS_FORMAT_PORCELAIN_V2)
 		progress_flag = REFRESH_PROGRESS;
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
 	repo_read_index(the_repository);
 	refresh_index(&the_index,
 		      REFRESH_QUIET|REFRESH_UNMERGED|progress_flag,
@@ -1704,6 +1705,8 @@ int cmd_commit(int argc, const char **argv, const char *prefix)
 
 	status_init_config(&s, git_commit_config);
 	s.commit_template = 1;
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
 	status_format = STATUS_FORMAT_NONE; /* Ignore status.short */
 	s.colopts = 0;
 
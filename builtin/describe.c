@@ -25,6 +25,7 @@ define_commit_slab(commit_names, struct commit_name *);
 static const char * const describe_usage[] = {
 	N_("git describe [<options>] [<commit-ish>...]"),
 	N_("git describe [<options>] --dirty"),
+	N_("git describe [<options>] --stdin"),
 	NULL
 };
 
@@ -549,7 +550,8 @@ static void describe(const char *arg, int last_one)
 
 int cmd_describe(int argc, const char **argv, const char *prefix)
 {
-	int contains = 0;
+	int contains = 0, read_stdin = 0;
+	struct strvec stdin_args = STRVEC_INIT;
 	struct option options[] = {
 		OPT_BOOL(0, "contains",   &contains, N_("find the tag that comes after the commit")),
 		OPT_BOOL(0, "debug",      &debug, N_("debug search strategy on stderr")),
@@ -557,6 +559,7 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 		OPT_BOOL(0, "tags",       &tags, N_("use any tag, even unannotated")),
 		OPT_BOOL(0, "long",       &longformat, N_("always use long format")),
 		OPT_BOOL(0, "first-parent", &first_parent, N_("only follow first parent")),
+		OPT_BOOL(0, "stdin", &read_stdin, N_("read commit-ishes from stdin")),
 		OPT__ABBREV(&abbrev),
 		OPT_SET_INT(0, "exact-match", &max_candidates,
 			    N_("only output exact matches"), 0),
@@ -592,6 +595,27 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 	if (longformat && abbrev == 0)
 		die(_("--long is incompatible with --abbrev=0"));
 
+	if (read_stdin) {
+		struct strbuf buf = STRBUF_INIT;
+
+		if (argc)
+			die(_("--stdin is incompatible with commit-ishes"));
+		if (dirty)
+			die(_("--dirty is incompatible with commit-ishes"));
+		if (broken)
+			die(_("--broken is incompatible with commit-ishes"));
+		while (strbuf_getline(&buf, stdin) != EOF) {
+			strbuf_trim(&buf);
+			if (buf.len)
+				strvec_push(&stdin_args, buf.buf);
+		}
+		strbuf_release(&buf);
+		if (!stdin_args.nr)
+			return 0;
+		argc = stdin_args.nr;
+		argv = stdin_args.v;
+	}
+
 	if (contains) {
 		struct string_list_item *item;
 		struct strvec args;
@@ -24,6 +24,10 @@
 #include "remote.h"
 #include "blob.h"
 #include "commit-slab.h"
+#include "csum-file.h"
+#include "hash-lookup.h"
+#include "lockfile.h"
+#include "thread-utils.h"
 
 static const char *fast_export_usage[] = {
 	N_("git fast-export [rev-list-opts]"),
@@ -47,6 +51,8 @@ static struct refspec refspecs = REFSPEC_INIT_FETCH;
 static int anonymize;
 static struct hashmap anonymized_seeds;
 static struct revision_sources revision_sources;
+static enum { MARKS_FORMAT_TEXT, MARKS_FORMAT_BINARY } marks_format = MARKS_FORMAT_TEXT;
+static int nr_threads;
 
 static int parse_opt_signed_tag_mode(const struct option *opt,
 				     const char *arg, int unset)
@@ -66,6 +72,18 @@ static int parse_opt_signed_tag_mode(const struct option *opt,
 	return 0;
 }
 
+static int parse_opt_marks_format(const struct option *opt,
+				  const char *arg, int unset)
+{
+	if (unset || !strcmp(arg, "text"))
+		marks_format = MARKS_FORMAT_TEXT;
+	else if (!strcmp(arg, "binary"))
+		marks_format = MARKS_FORMAT_BINARY;
+	else
+		return error("Unknown marks format: %s", arg);
+	return 0;
+}
+
 static int parse_opt_tag_of_filtered_mode(const struct option *opt,
 					  const char *arg, int unset)
 {
@@ -108,13 +126,45 @@ static int parse_opt_reencode_mode(const struct option *opt,
 static struct decoration idnums;
 static uint32_t last_idnum;
 
+/*
+ * A binary marks file, as written by --marks-format=binary:
+ *
+ *	4-byte signature "FEMK", 4-byte version (1), 4-byte hash
+ *	function id, 4-byte number of marks, 4-byte largest mark used
+ *	256-entry fanout of 4-byte cumulative counts by first oid byte
+ *	the object names of the marked commits, sorted
+ *	a 4-byte mark for each of them, in the same order
+ *	a checksum of everything above
+ *
+ * All integers are in network byte order. The file is mapped rather
+ * than read, and a mark is only looked up once the export reaches the
+ * commit it names, so that an incremental export does not pay for the
+ * marks of all the history it has exported before.
+ */
+#define MARKS_SIGNATURE 0x46454d4b /* "FEMK" */
+#define MARKS_VERSION 1
+#define MARKS_HEADER_SIZE 20
+#define MARKS_FANOUT_SIZE (256 * 4)
+
+static struct imported_marks {
+	const unsigned char *data;
+	size_t data_len;
+	const uint32_t *fanout;
+	const unsigned char *oids;
+	const unsigned char *marks;
+	uint32_t nr;
+} imported_marks;
+
+static int load_imported_mark(struct object *object);
+
 static int has_unshown_parent(struct commit *commit)
 {
 	struct commit_list *parent;
 
 	for (parent = commit->parents; parent; parent = parent->next)
 		if (!(parent->item->object.flags & SHOWN) &&
-		    !(parent->item->object.flags & UNINTERESTING))
+		    !(parent->item->object.flags & UNINTERESTING) &&
+		    !load_imported_mark(&parent->item->object))
 			return 1;
 	return 0;
 }
@@ -232,11 +282,30 @@ static inline void mark_next_object(struct object *object)
 	mark_object(object, ++last_idnum);
 }
 
+/*
+ * Mark `object` as exported if a binary marks file we imported names
+ * it, returning its mark, or 0 if it does not.
+ */
+static int load_imported_mark(struct object *object)
+{
+	uint32_t pos, mark;
+
+	if (!imported_marks.nr ||
+	    !bsearch_hash(object->oid.hash, imported_marks.fanout,
+			  imported_marks.oids, the_hash_algo->rawsz, &pos))
+		return 0;
+
+	mark = get_be32(imported_marks.marks + st_mult(pos, 4));
+	mark_object(object, mark);
+	object->flags |= SHOWN;
+	return mark;
+}
+
 static int get_object_mark(struct object *object)
 {
 	void *decoration = lookup_decoration(&idnums, object);
 	if (!decoration)
-		return 0;
+		return load_imported_mark(object);
 	return ptr_to_mark(decoration);
 }
 
@@ -285,6 +354,201 @@ static char *anonymize_blob(unsigned long *size)
 	return strbuf_detach(&out, NULL);
 }
 
+static void write_blob(const struct object_id *oid, struct object *object,
+		       const char *buf, unsigned long size)
+{
+	mark_next_object(object);
+
+	printf("blob\nmark :%"PRIu32"\n", last_idnum);
+	if (show_original_ids)
+		printf("original-oid %s\n", oid_to_hex(oid));
+	printf("data %"PRIuMAX"\n", (uintmax_t)size);
+	if (size && fwrite(buf, size, 1, stdout) != 1)
+		die_errno("could not write blob '%s'", oid_to_hex(oid));
+	printf("\n");
+
+	show_progress();
+
+	object->flags |= SHOWN;
+}
+
+/*
+ * Blobs are read and hashed by `nr_threads` threads ahead of the
+ * output, which still writes them in the order export_blob() was
+ * called. The ring holds the blobs that have been queued but not yet
+ * written; `head` is the next one to write, `next` the next one for a
+ * thread to read, and `tail` the next free slot.
+ */
+#define PREFETCH_WINDOW 16
+
+struct blob_prefetch {
+	struct object_id oid;
+	enum object_type type;
+	unsigned long size;
+	char *buf;
+	int status;
+	unsigned done : 1;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int nr_threads;
+	struct blob_prefetch *ring;
+	size_t ring_size;
+	size_t head, next, tail;
+	unsigned stop : 1;
+} prefetch;
+
+static void *prefetch_thread_proc(void *data)
+{
+	pthread_mutex_lock(&prefetch.mutex);
+	for (;;) {
+		struct blob_prefetch *slot;
+
+		while (prefetch.next == prefetch.tail && !prefetch.stop)
+			pthread_cond_wait(&prefetch.work_cond, &prefetch.mutex);
+		if (prefetch.next == prefetch.tail)
+			break;
+		slot = &prefetch.ring[prefetch.next++ % prefetch.ring_size];
+		pthread_mutex_unlock(&prefetch.mutex);
+
+		slot->buf = read_object_file(&slot->oid, &slot->type,
+					     &slot->size);
+		if (!slot->buf)
+			slot->status = -1;
+		else if (check_object_signature(the_repository, &slot->oid,
+						slot->buf, slot->size,
+						type_name(slot->type)) < 0)
+			slot->status = -2;
+
+		pthread_mutex_lock(&prefetch.mutex);
+		slot->done = 1;
+		pthread_cond_broadcast(&prefetch.done_cond);
+	}
+	pthread_mutex_unlock(&prefetch.mutex);
+	return NULL;
+}
+
+static void start_prefetch(void)
+{
+	int t;
+
+	if (!HAVE_THREADS || nr_threads <= 1 || no_data || anonymize)
+		return;
+
+	prefetch.nr_threads = nr_threads;
+	prefetch.ring_size = st_mult(nr_threads, PREFETCH_WINDOW);
+	CALLOC_ARRAY(prefetch.ring, prefetch.ring_size);
+	pthread_mutex_init(&prefetch.mutex, NULL);
+	pthread_cond_init(&prefetch.work_cond, NULL);
+	pthread_cond_init(&prefetch.done_cond, NULL);
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(prefetch.threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		int ret = pthread_create(&prefetch.threads[t], NULL,
+					 prefetch_thread_proc, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+/* Write the oldest queued blob, waiting for it to be read if need be. */
+static void write_prefetched_blob(void)
+{
+	struct blob_prefetch *slot = &prefetch.ring[prefetch.head % prefetch.ring_size];
+	struct object *object;
+	int eaten;
+
+	pthread_mutex_lock(&prefetch.mutex);
+	while (!slot->done)
+		pthread_cond_wait(&prefetch.done_cond, &prefetch.mutex);
+	pthread_mutex_unlock(&prefetch.mutex);
+
+	if (slot->status == -1)
+		die("could not read blob %s", oid_to_hex(&slot->oid));
+	if (slot->status == -2)
+		die("oid mismatch in blob %s", oid_to_hex(&slot->oid));
+
+	/* The same blob may have been queued twice before it was written. */
+	object = lookup_object(the_repository, &slot->oid);
+	if (object && object->flags & SHOWN) {
+		free(slot->buf);
+	} else {
+		object = parse_object_buffer(the_repository, &slot->oid,
+					     slot->type, slot->size, slot->buf,
+					     &eaten);
+		if (!object)
+			die("Could not read blob %s", oid_to_hex(&slot->oid));
+		write_blob(&slot->oid, object, slot->buf, slot->size);
+		if (!eaten)
+			free(slot->buf);
+	}
+
+	pthread_mutex_lock(&prefetch.mutex);
+	slot->buf = NULL;
+	slot->status = 0;
+	slot->done = 0;
+	prefetch.head++;
+	pthread_mutex_unlock(&prefetch.mutex);
+}
+
+static void queue_blob(const struct object_id *oid)
+{
+	struct blob_prefetch *slot;
+
+	if (prefetch.tail - prefetch.head == prefetch.ring_size)
+		write_prefetched_blob();
+
+	pthread_mutex_lock(&prefetch.mutex);
+	slot = &prefetch.ring[prefetch.tail++ % prefetch.ring_size];
+	oidcpy(&slot->oid, oid);
+	pthread_cond_signal(&prefetch.work_cond);
+	pthread_mutex_unlock(&prefetch.mutex);
+}
+
+/* Write out all the blobs that export_blob() has queued. */
+static void flush_blobs(void)
+{
+	while (prefetch.head != prefetch.tail)
+		write_prefetched_blob();
+}
+
+static void stop_prefetch(void)
+{
+	int t;
+
+	if (!prefetch.nr_threads)
+		return;
+
+	flush_blobs();
+	pthread_mutex_lock(&prefetch.mutex);
+	prefetch.stop = 1;
+	pthread_cond_broadcast(&prefetch.work_cond);
+	pthread_mutex_unlock(&prefetch.mutex);
+
+	for (t = 0; t < prefetch.nr_threads; t++) {
+		int ret = pthread_join(prefetch.threads[t], NULL);
+		if (ret)
+			die(_("unable to join thread: %s"), strerror(ret));
+	}
+	FREE_AND_NULL(prefetch.threads);
+	prefetch.nr_threads = 0;
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&prefetch.done_cond);
+	pthread_cond_destroy(&prefetch.work_cond);
+	pthread_mutex_destroy(&prefetch.mutex);
+	FREE_AND_NULL(prefetch.ring);
+}
+
+/*
+ * Export the blob `oid` unless it has been already. With threads, it
+ * is only queued to be written by the next flush_blobs().
+ */
 static void export_blob(const struct object_id *oid)
 {
 	unsigned long size;
@@ -303,6 +567,11 @@ static void export_blob(const struct object_id *oid)
 	if (object && object->flags & SHOWN)
 		return;
 
+	if (prefetch.nr_threads) {
+		queue_blob(oid);
+		return;
+	}
+
 	if (anonymize) {
 		buf = anonymize_blob(&size);
 		object = (struct object *)lookup_blob(the_repository, oid);
@@ -321,19 +590,8 @@ static void export_blob(const struct object_id *oid)
 	if (!object)
 		die("Could not read blob %s", oid_to_hex(oid));
 
-	mark_next_object(object);
+	write_blob(oid, object, buf, size);
 
-	printf("blob\nmark :%"PRIu32"\n", last_idnum);
-	if (show_original_ids)
-		printf("original-oid %s\n", oid_to_hex(oid));
-	printf("data %"PRIuMAX"\n", (uintmax_t)size);
-	if (size && fwrite(buf, size, 1, stdout) != 1)
-		die_errno("could not write blob '%s'", oid_to_hex(oid));
-	printf("\n");
-
-	show_progress();
-
-	object->flags |= SHOWN;
 	if (!eaten)
 		free(buf);
 }
@@ -664,6 +922,7 @@ static void handle_commit(struct commit *commit, struct rev_info *rev,
 	for (i = 0; i < diff_queued_diff.nr; i++)
 		if (!S_ISGITLINK(diff_queued_diff.queue[i]->two->mode))
 			export_blob(&diff_queued_diff.queue[i]->two->oid);
+	flush_blobs();
 
 	refname = *revision_sources_at(&revision_sources, commit);
 	/*
@@ -1052,34 +1311,173 @@ static void handle_tags_and_duplicates(struct string_list *extras)
 	}
 }
 
-static void export_marks(char *file)
-{
-	unsigned int i;
+struct mark_entry {
+	struct object_id oid;
 	uint32_t mark;
+};
+
+static int mark_entry_cmp(const void *a_, const void *b_)
+{
+	const struct mark_entry *a = a_, *b = b_;
+	return oidcmp(&a->oid, &b->oid);
+}
+
+/*
+ * Collect the marks of all commits, both those marked by this export
+ * and those imported from a binary marks file, sorted by object name.
+ */
+static struct mark_entry *collect_marks(size_t *nr_out)
+{
 	struct decoration_entry *deco = idnums.entries;
+	struct mark_entry *entries = NULL;
+	size_t i, j, nr = 0, alloc = 0;
+
+	ALLOC_GROW(entries, imported_marks.nr + 1, alloc);
+	for (i = 0; i < idnums.size; i++, deco++) {
+		if (!deco->base || deco->base->type != OBJ_COMMIT)
+			continue;
+		ALLOC_GROW(entries, nr + 1, alloc);
+		oidcpy(&entries[nr].oid, &deco->base->oid);
+		entries[nr].mark = ptr_to_mark(deco->decoration);
+		nr++;
+	}
+	for (i = 0; i < imported_marks.nr; i++) {
+		ALLOC_GROW(entries, nr + 1, alloc);
+		oidread(&entries[nr].oid, imported_marks.oids +
+			st_mult(i, the_hash_algo->rawsz));
+		entries[nr].mark = get_be32(imported_marks.marks +
+					    st_mult(i, 4));
+		nr++;
+	}
+
+	QSORT(entries, nr, mark_entry_cmp);
+	for (i = j = 0; i < nr; i++)
+		if (!j || !oideq(&entries[j - 1].oid, &entries[i].oid))
+			entries[j++] = entries[i];
+	*nr_out = j;
+	return entries;
+}
+
+/*
+ * Unmap the imported marks; they are not looked up after the export,
+ * and the marks file may be about to be replaced.
+ */
+static void release_imported_marks(void)
+{
+	if (!imported_marks.data)
+		return;
+	munmap((void *)imported_marks.data, imported_marks.data_len);
+	memset(&imported_marks, 0, sizeof(imported_marks));
+}
+
+static void export_binary_marks(const char *file,
+				struct mark_entry *entries, size_t nr)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	uint32_t fanout[256] = { 0 };
+	size_t i;
+	int j;
+
+	if (nr > UINT32_MAX)
+		die("too many marks to write to %s", file);
+
+	for (i = 0; i < nr; i++)
+		fanout[entries[i].oid.hash[0]]++;
+	for (j = 1; j < 256; j++)
+		fanout[j] += fanout[j - 1];
+
+	hold_lock_file_for_update(&lk, file, LOCK_DIE_ON_ERROR);
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite_be32(f, MARKS_SIGNATURE);
+	hashwrite_be32(f, MARKS_VERSION);
+	hashwrite_be32(f, the_hash_algo->format_id);
+	hashwrite_be32(f, nr);
+	hashwrite_be32(f, last_idnum);
+	for (j = 0; j < 256; j++)
+		hashwrite_be32(f, fanout[j]);
+	for (i = 0; i < nr; i++)
+		hashwrite(f, entries[i].oid.hash, the_hash_algo->rawsz);
+	for (i = 0; i < nr; i++)
+		hashwrite_be32(f, entries[i].mark);
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM);
+
+	if (commit_lock_file(&lk))
+		error_errno("Unable to write marks file %s.", file);
+}
+
+static void export_marks(char *file)
+{
+	struct mark_entry *entries;
+	size_t i, nr;
 	FILE *f;
 	int e = 0;
 
+	entries = collect_marks(&nr);
+	release_imported_marks();
+	if (marks_format == MARKS_FORMAT_BINARY) {
+		export_binary_marks(file, entries, nr);
+		free(entries);
+		return;
+	}
+
 	f = fopen_for_writing(file);
 	if (!f)
 		die_errno("Unable to open marks file %s for writing.", file);
 
-	for (i = 0; i < idnums.size; i++) {
-		if (deco->base && deco->base->type == 1) {
-			mark = ptr_to_mark(deco->decoration);
-			if (fprintf(f, ":%"PRIu32" %s\n", mark,
-				oid_to_hex(&deco->base->oid)) < 0) {
-			    e = 1;
-			    break;
-			}
+	for (i = 0; i < nr; i++) {
+		if (fprintf(f, ":%"PRIu32" %s\n", entries[i].mark,
+			    oid_to_hex(&entries[i].oid)) < 0) {
+			e = 1;
+			break;
 		}
-		deco++;
 	}
 
 	e |= ferror(f);
 	e |= fclose(f);
 	if (e)
 		error("Unable to write marks file %s.", file);
+	free(entries);
+}
+
+static void import_binary_marks(const char *file, int fd)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	const unsigned char *data;
+	struct stat st;
+	size_t len;
+	uint32_t nr, max_mark;
+
+	if (fstat(fd, &st))
+		die_errno("could not stat marks file %s", file);
+	len = xsize_t(st.st_size);
+	if (len < MARKS_HEADER_SIZE + MARKS_FANOUT_SIZE + rawsz)
+		die("marks file %s is too small", file);
+
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (get_be32(data) != MARKS_SIGNATURE)
+		die("corrupt marks file %s", file);
+	if (get_be32(data + 4) != MARKS_VERSION)
+		die("marks file %s has unsupported version %"PRIu32,
+		    file, get_be32(data + 4));
+	if (get_be32(data + 8) != the_hash_algo->format_id)
+		die("marks file %s uses a different hash algorithm", file);
+	nr = get_be32(data + 12);
+	max_mark = get_be32(data + 16);
+	if (len != st_add4(MARKS_HEADER_SIZE, MARKS_FANOUT_SIZE,
+			   st_mult(nr, rawsz + 4), rawsz) ||
+	    get_be32(data + MARKS_HEADER_SIZE + MARKS_FANOUT_SIZE - 4) != nr)
+		die("corrupt marks file %s", file);
+
+	imported_marks.data = data;
+	imported_marks.data_len = len;
+	imported_marks.fanout = (const uint32_t *)(data + MARKS_HEADER_SIZE);
+	imported_marks.oids = data + MARKS_HEADER_SIZE + MARKS_FANOUT_SIZE;
+	imported_marks.marks = imported_marks.oids + st_mult(nr, rawsz);
+	imported_marks.nr = nr;
+
+	if (last_idnum < max_mark)
+		last_idnum = max_mark;
 }
 
 static void import_marks(char *input_file, int check_exists)
@@ -1087,11 +1485,21 @@ static void import_marks(char *input_file, int check_exists)
 	char line[512];
 	FILE *f;
 	struct stat sb;
+	int c;
 
 	if (check_exists && stat(input_file, &sb))
 		return;
 
 	f = xfopen(input_file, "r");
+	c = getc(f);
+	if (c != EOF && c != ':') {
+		import_binary_marks(input_file, fileno(f));
+		fclose(f);
+		return;
+	}
+	if (c != EOF)
+		ungetc(c, f);
+
 	while (fgets(line, sizeof(line), f)) {
 		uint32_t mark;
 		char *line_end, *mark_end;
@@ -1206,6 +1614,9 @@ int cmd_fast_export(int argc, const char **argv, const char *prefix)
 			     parse_opt_reencode_mode),
 		OPT_STRING(0, "export-marks", &export_filename, N_("file"),
 			     N_("dump marks to this file")),
+		OPT_CALLBACK(0, "marks-format", &marks_format, N_("format"),
+			     N_("write marks as text or binary"),
+			     parse_opt_marks_format),
 		OPT_STRING(0, "import-marks", &import_filename, N_("file"),
 			     N_("import marks from this file")),
 		OPT_STRING(0, "import-marks-if-exists",
@@ -1231,6 +1642,8 @@ int cmd_fast_export(int argc, const char **argv, const char *prefix)
 			    N_("show original object ids of blobs/commits")),
 		OPT_BOOL(0, "mark-tags", &mark_tags,
 			    N_("label tags with mark ids")),
+		OPT_INTEGER(0, "threads", &nr_threads,
+			    N_("use threads to read blobs")),
 
 		OPT_END()
 	};
@@ -1255,6 +1668,11 @@ int cmd_fast_export(int argc, const char **argv, const char *prefix)
 	if (anonymized_seeds.cmpfn && !anonymize)
 		die(_("--anonymize-map without --anonymize does not make sense"));
 
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), nr_threads);
+	if (!nr_threads)
+		nr_threads = online_cpus();
+
 	if (refspecs_list.nr) {
 		int i;
 
@@ -1285,7 +1703,10 @@ int cmd_fast_export(int argc, const char **argv, const char *prefix)
 	revs.diffopt.format_callback = show_filemodify;
 	revs.diffopt.format_callback_data = &paths_of_changed_objects;
 	revs.diffopt.flags.recursive = 1;
+	start_prefetch();
 	while ((commit = get_revision(&revs))) {
+		if (load_imported_mark(&commit->object))
+			continue;
 		if (has_unshown_parent(commit)) {
 			add_object_array(&commit->object, NULL, &commits);
 		}
@@ -1295,12 +1716,15 @@ int cmd_fast_export(int argc, const char **argv, const char *prefix)
 		}
 	}
 
+	stop_prefetch();
+
 	handle_tags_and_duplicates(&extra_refs);
 	handle_tags_and_duplicates(&tag_refs);
 	handle_deletes();
 
 	if (export_filename && lastimportid != last_idnum)
 		export_marks(export_filename);
+	release_imported_marks();
 
 	if (use_done_feature)
 		printf("done\n");
@@ -19,6 +19,7 @@
 #include "mem-pool.h"
 #include "commit-reach.h"
 #include "khash.h"
+#include "thread-utils.h"
 
 #define PACK_ID_BITS 16
 #define MAX_PACK_ID ((1<<PACK_ID_BITS)-1)
@@ -82,6 +83,8 @@ struct last_object {
 	off_t offset;
 	unsigned int depth;
 	unsigned no_swap : 1;
+	/* the object "data" belongs to, if known */
+	struct object_entry *entry;
 };
 
 struct atom_str {
@@ -396,6 +399,7 @@ static void write_crash_report(const char *err)
 }
 
 static void end_packfile(void);
+static void flush_blob_queue(void);
 static void unkeep_all_packs(void);
 static void dump_marks(void);
 
@@ -845,6 +849,7 @@ static void end_packfile(void)
 	if (running || !pack_data)
 		return;
 
+	flush_blob_queue();
 	running = 1;
 	clear_delta_base_cache();
 	if (object_count) {
@@ -912,6 +917,7 @@ static void end_packfile(void)
 	strbuf_release(&last_blob.data);
 	last_blob.offset = 0;
 	last_blob.depth = 0;
+	last_blob.entry = NULL;
 }
 
 static void cycle_packfile(void)
@@ -920,6 +926,314 @@ static void cycle_packfile(void)
 	start_packfile();
 }
 
+/*
+ * Finding a delta against the previous blob and deflating the result is
+ * most of the work of importing blobs, and needs nothing but the two
+ * blobs. store_object() therefore queues blobs for a pool of threads to
+ * do that, and writes the results to the pack in the order the blobs
+ * arrived. Which blobs are deltified against which, and where the pack
+ * is cycled, is decided from that order alone, so the pack we write does
+ * not depend on the number of threads or on their timing.
+ *
+ * Everything else that writes to the pack or reads from it waits for the
+ * queue to drain first, with flush_blob_queue().
+ */
+struct blob_job {
+	struct object_entry *e;
+	struct strbuf data;
+	/* the delta base and the object it belongs to, if any */
+	struct strbuf base;
+	struct object_entry *base_e;
+	unsigned int depth;
+
+	/* filled in by deflate_blob_job() */
+	void *delta;
+	unsigned long deltalen;
+	void *out;
+	unsigned long outlen;
+	int done;
+};
+
+#define BLOB_QUEUE_JOBS_PER_THREAD 16
+#define BLOB_QUEUE_MAX_BYTES (256 * 1024 * 1024)
+
+static struct blob_job *blob_queue;
+static unsigned int blob_queue_size;
+static unsigned int blob_queue_head, blob_queue_nr, blob_queue_taken;
+static size_t blob_queue_bytes;
+static int blob_queue_writing;
+static int blob_threads = -1;
+static pthread_t *blob_workers;
+static int blob_workers_exit;
+static pthread_mutex_t blob_queue_mutex;
+static pthread_cond_t blob_work_cond;
+static pthread_cond_t blob_done_cond;
+
+static void *deflate_buffer(const void *in, unsigned long len,
+			    unsigned long *outlen)
+{
+	git_zstream s;
+	void *out;
+
+	git_deflate_init(&s, pack_compression_level);
+	s.next_in = (void *)in;
+	s.avail_in = len;
+	s.avail_out = git_deflate_bound(&s, s.avail_in);
+	s.next_out = out = xmalloc(s.avail_out);
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	*outlen = s.total_out;
+	return out;
+}
+
+static void deflate_blob_job(struct blob_job *job)
+{
+	if (job->base.len)
+		job->delta = diff_delta(job->base.buf, job->base.len,
+					job->data.buf, job->data.len,
+					&job->deltalen,
+					job->data.len - the_hash_algo->rawsz);
+	if (job->delta)
+		job->out = deflate_buffer(job->delta, job->deltalen,
+					  &job->outlen);
+	else
+		job->out = deflate_buffer(job->data.buf, job->data.len,
+					  &job->outlen);
+}
+
+static void *blob_worker_proc(void *data)
+{
+	pthread_mutex_lock(&blob_queue_mutex);
+	for (;;) {
+		struct blob_job *job;
+
+		while (!blob_workers_exit && blob_queue_taken == blob_queue_nr)
+			pthread_cond_wait(&blob_work_cond, &blob_queue_mutex);
+		if (blob_queue_taken == blob_queue_nr)
+			break;
+		job = &blob_queue[(blob_queue_head + blob_queue_taken++) %
+				  blob_queue_size];
+		pthread_mutex_unlock(&blob_queue_mutex);
+
+		deflate_blob_job(job);
+
+		pthread_mutex_lock(&blob_queue_mutex);
+		job->done = 1;
+		pthread_cond_signal(&blob_done_cond);
+	}
+	pthread_mutex_unlock(&blob_queue_mutex);
+	return NULL;
+}
+
+static void start_blob_workers(void)
+{
+	int i;
+
+	if (blob_threads < 0)
+		blob_threads = online_cpus();
+	if (!HAVE_THREADS || blob_threads < 2)
+		blob_threads = 0;
+
+	blob_queue_size = BLOB_QUEUE_JOBS_PER_THREAD * (blob_threads + 1);
+	CALLOC_ARRAY(blob_queue, blob_queue_size);
+	if (!blob_threads)
+		return;
+
+	pthread_mutex_init(&blob_queue_mutex, NULL);
+	pthread_cond_init(&blob_work_cond, NULL);
+	pthread_cond_init(&blob_done_cond, NULL);
+	ALLOC_ARRAY(blob_workers, blob_threads);
+	for (i = 0; i < blob_threads; i++) {
+		int err = pthread_create(&blob_workers[i], NULL,
+					 blob_worker_proc, NULL);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+static void stop_blob_workers(void)
+{
+	int i;
+
+	flush_blob_queue();
+	if (blob_threads) {
+		pthread_mutex_lock(&blob_queue_mutex);
+		blob_workers_exit = 1;
+		pthread_cond_broadcast(&blob_work_cond);
+		pthread_mutex_unlock(&blob_queue_mutex);
+		for (i = 0; i < blob_threads; i++)
+			pthread_join(blob_workers[i], NULL);
+		FREE_AND_NULL(blob_workers);
+		pthread_cond_destroy(&blob_done_cond);
+		pthread_cond_destroy(&blob_work_cond);
+		pthread_mutex_destroy(&blob_queue_mutex);
+	}
+	FREE_AND_NULL(blob_queue);
+}
+
+/* Write the oldest queued blob to the pack. */
+static void write_queued_blob(void)
+{
+	struct blob_job *job = &blob_queue[blob_queue_head];
+	struct object_entry *e = job->e;
+	unsigned char hdr[96];
+	unsigned long hdrlen;
+	int use_delta;
+
+	if (blob_threads) {
+		pthread_mutex_lock(&blob_queue_mutex);
+		while (!job->done)
+			pthread_cond_wait(&blob_done_cond, &blob_queue_mutex);
+		pthread_mutex_unlock(&blob_queue_mutex);
+	}
+
+	/* Determine if we should auto-checkpoint. */
+	if ((max_packsize
+		&& (pack_size + PACK_SIZE_THRESHOLD + job->outlen) > max_packsize)
+		|| (pack_size + PACK_SIZE_THRESHOLD + job->outlen) < pack_size) {
+		struct last_object saved = last_blob;
+		unsigned int i;
+
+		/* The queued blobs need to *not* have the current pack_id. */
+		for (i = 0; i < blob_queue_nr; i++)
+			blob_queue[(blob_queue_head + i) % blob_queue_size].e->pack_id = pack_id + 1;
+
+		/*
+		 * end_packfile() forgets the last blob, but that is the one
+		 * the next blob to be queued is compared with, not this one.
+		 */
+		strbuf_init(&last_blob.data, 0);
+		cycle_packfile();
+		last_blob = saved;
+	}
+
+	/* We cannot carry a delta into another pack. */
+	use_delta = job->delta && job->base_e->pack_id == pack_id;
+	if (job->delta && !use_delta) {
+		free(job->out);
+		job->out = deflate_buffer(job->data.buf, job->data.len,
+					  &job->outlen);
+	}
+
+	e->pack_id = pack_id;
+	e->idx.offset = pack_size;
+	object_count++;
+	object_count_by_type[OBJ_BLOB]++;
+
+	crc32_begin(pack_file);
+
+	if (use_delta) {
+		off_t ofs = e->idx.offset - job->base_e->idx.offset;
+		unsigned pos = sizeof(hdr) - 1;
+
+		delta_count_by_type[OBJ_BLOB]++;
+		e->depth = job->depth;
+
+		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
+						      OBJ_OFS_DELTA,
+						      job->deltalen);
+		hashwrite(pack_file, hdr, hdrlen);
+		pack_size += hdrlen;
+
+		hdr[pos] = ofs & 127;
+		while (ofs >>= 7)
+			hdr[--pos] = 128 | (--ofs & 127);
+		hashwrite(pack_file, hdr + pos, sizeof(hdr) - pos);
+		pack_size += sizeof(hdr) - pos;
+	} else {
+		e->depth = 0;
+		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
+						      OBJ_BLOB, job->data.len);
+		hashwrite(pack_file, hdr, hdrlen);
+		pack_size += hdrlen;
+	}
+
+	hashwrite(pack_file, job->out, job->outlen);
+	pack_size += job->outlen;
+
+	e->idx.crc32 = crc32_end(pack_file);
+
+	if (last_blob.entry == e)
+		last_blob.offset = e->idx.offset;
+
+	blob_queue_bytes -= job->data.len + job->base.len;
+	strbuf_release(&job->data);
+	strbuf_release(&job->base);
+	FREE_AND_NULL(job->delta);
+	FREE_AND_NULL(job->out);
+	job->done = 0;
+
+	if (blob_threads)
+		pthread_mutex_lock(&blob_queue_mutex);
+	blob_queue_head = (blob_queue_head + 1) % blob_queue_size;
+	blob_queue_nr--;
+	blob_queue_taken--;
+	if (blob_threads)
+		pthread_mutex_unlock(&blob_queue_mutex);
+}
+
+static void flush_blob_queue(void)
+{
+	if (blob_queue_writing)
+		return;
+	blob_queue_writing = 1;
+	while (blob_queue_nr)
+		write_queued_blob();
+	blob_queue_writing = 0;
+}
+
+static void queue_blob(struct object_entry *e, struct strbuf *dat)
+{
+	struct blob_job *job;
+
+	/* Making room may cycle the pack; "e" must not be in the old one. */
+	e->pack_id = MAX_PACK_ID;
+	blob_queue_writing = 1;
+	while (blob_queue_nr &&
+	       (blob_queue_nr == blob_queue_size ||
+		blob_queue_bytes > BLOB_QUEUE_MAX_BYTES))
+		write_queued_blob();
+	blob_queue_writing = 0;
+
+	job = &blob_queue[(blob_queue_head + blob_queue_nr) % blob_queue_size];
+	job->e = e;
+	strbuf_init(&job->data, 0);
+	strbuf_addbuf(&job->data, dat);
+	strbuf_init(&job->base, 0);
+	job->base_e = NULL;
+	job->depth = 0;
+	if (last_blob.data.len && last_blob.entry &&
+	    last_blob.depth < max_depth && dat->len > the_hash_algo->rawsz) {
+		delta_count_attempts_by_type[OBJ_BLOB]++;
+		strbuf_addbuf(&job->base, &last_blob.data);
+		job->base_e = last_blob.entry;
+		job->depth = last_blob.depth + 1;
+	}
+	blob_queue_bytes += job->data.len + job->base.len;
+
+	/* Not written yet, but no longer a candidate for dedup either. */
+	e->type = OBJ_BLOB;
+	e->pack_id = pack_id;
+	e->idx.offset = 1; /* just not zero! */
+
+	strbuf_swap(&last_blob.data, dat);
+	last_blob.offset = 0;
+	last_blob.depth = job->depth;
+	last_blob.entry = e;
+
+	if (blob_threads) {
+		pthread_mutex_lock(&blob_queue_mutex);
+		blob_queue_nr++;
+		pthread_cond_signal(&blob_work_cond);
+		pthread_mutex_unlock(&blob_queue_mutex);
+	} else {
+		deflate_blob_job(job);
+		job->done = 1;
+		blob_queue_nr++;
+	}
+}
+
 static int store_object(
 	enum object_type type,
 	struct strbuf *dat,
@@ -935,6 +1249,9 @@ static int store_object(
 	git_hash_ctx c;
 	git_zstream s;
 
+	if (last != &last_blob)
+		flush_blob_queue();
+
 	hdrlen = xsnprintf((char *)hdr, sizeof(hdr), "%s %lu",
 			   type_name(type), (unsigned long)dat->len) + 1;
 	the_hash_algo->init_fn(&c);
@@ -959,6 +1276,11 @@ static int store_object(
 		return 1;
 	}
 
+	if (last == &last_blob) {
+		queue_blob(e, dat);
+		return 0;
+	}
+
 	if (last && last->data.len && last->data.buf && last->depth < max_depth
 		&& dat->len > the_hash_algo->rawsz) {
 
@@ -1080,6 +1402,8 @@ static void stream_blob(uintmax_t len, struct object_id *oidout, uintmax_t mark)
 	struct hashfile_checkpoint checkpoint;
 	int status = Z_OK;
 
+	flush_blob_queue();
+
 	/* Determine if we should auto-checkpoint. */
 	if ((max_packsize
 		&& (pack_size + PACK_SIZE_THRESHOLD + len) > max_packsize)
@@ -1195,7 +1519,10 @@ static void *gfi_unpack_entry(
 	unsigned long *sizep)
 {
 	enum object_type type;
-	struct packed_git *p = all_packs[oe->pack_id];
+	struct packed_git *p;
+
+	flush_blob_queue();
+	p = all_packs[oe->pack_id];
 	if (p == pack_data && p->pack_size < (pack_size + the_hash_algo->rawsz)) {
 		/* The object is stored in the packfile we are writing to
 		 * and we have modified it since the last time we scanned
@@ -1339,6 +1666,9 @@ static void store_tree(struct tree_entry *root)
 	if (!is_null_oid(&root->versions[1].oid))
 		return;
 
+	/* Deltas against "le" must not span a pack cycled by queued blobs. */
+	flush_blob_queue();
+
 	if (!root->tree)
 		load_tree(root);
 	t = root->tree;
@@ -1998,6 +2328,7 @@ static void parse_and_store_blob(
 			strbuf_release(&last->data);
 			last->offset = 0;
 			last->depth = 0;
+			last->entry = NULL;
 		}
 		stream_blob(len, oidout, mark);
 		skip_optional_lf();
@@ -2960,6 +3291,7 @@ static void cat_blob(struct object_entry *oe, struct object_id *oid)
 		last_blob.offset = oe->idx.offset;
 		strbuf_attach(&last_blob.data, buf, size, size);
 		last_blob.depth = oe->depth;
+		last_blob.entry = oe;
 	} else
 		free(buf);
 }
@@ -3460,6 +3792,8 @@ static void git_pack_config(void)
 	}
 	if (!git_config_get_ulong("pack.packsizelimit", &packsizelimit_value))
 		max_packsize = packsizelimit_value;
+	if (!git_config_get_int("pack.threads", &blob_threads) && !blob_threads)
+		blob_threads = -1;
 
 	if (!git_config_get_int("fastimport.unpacklimit", &limit))
 		unpack_limit = limit;
@@ -3548,6 +3882,7 @@ int cmd_fast_import(int argc, const char **argv, const char *prefix)
 		rc_free[i].next = &rc_free[i + 1];
 	rc_free[cmd_save - 1].next = NULL;
 
+	start_blob_workers();
 	start_packfile();
 	set_die_routine(die_nicely);
 	set_checkpoint_signal();
@@ -3596,6 +3931,7 @@ int cmd_fast_import(int argc, const char **argv, const char *prefix)
 		die("stream ends early");
 
 	end_packfile();
+	stop_blob_workers();
 
 	dump_branches();
 	dump_tags();
@@ -28,6 +28,7 @@
 #include "promisor-remote.h"
 #include "commit-graph.h"
 #include "shallow.h"
+#include "bundle-uri.h"
 
 #define FORCED_UPDATES_DELAY_WARNING_IN_MS (10 * 1000)
 
@@ -1881,6 +1882,32 @@ static inline void fetch_one_setup_partial(struct remote *remote)
 	return;
 }
 
+/*
+ * A clone seeded from a bundle list that orders its bundles by creation
+ * token remembers the list and the newest bundle it applied. Apply the
+ * bundles that were added to the list since, before fetching the rest.
+ */
+static void fetch_new_bundles(void)
+{
+	const char *uri, *value;
+	uint64_t token = 0, old_token;
+
+	if (git_config_get_string_tmp("fetch.bundleuri", &uri))
+		return;
+	if (!git_config_get_string_tmp("fetch.bundlecreationtoken", &value))
+		token = strtoumax(value, NULL, 10);
+
+	old_token = token;
+	if (fetch_bundle_uri(the_repository, uri, &token))
+		warning(_("failed to fetch bundles from '%s'"), uri);
+	else if (token > old_token) {
+		char buf[32];
+
+		xsnprintf(buf, sizeof(buf), "%"PRIuMAX, (uintmax_t)token);
+		git_config_set("fetch.bundlecreationtoken", buf);
+	}
+}
+
 static int fetch_one(struct remote *remote, int argc, const char **argv,
 		     int prune_tags_ok, int use_stdin_refspecs)
 {
@@ -2071,6 +2098,8 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 	} else if (remote) {
 		if (filter_options.choice || has_promisor_remote())
 			fetch_one_setup_partial(remote);
+		if (!dry_run)
+			fetch_new_bundles();
 		result = fetch_one(remote, argc, argv, prune_tags_ok, stdin_refspecs);
 	} else {
 		int max_children = max_jobs;
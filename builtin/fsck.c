@@ -21,6 +21,7 @@
 #include "object-store.h"
 #include "run-command.h"
 #include "worktree.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -44,6 +45,7 @@ static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
 static int name_objects;
+static int nr_threads;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -766,6 +768,7 @@ static struct option fsck_opts[] = {
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
+	OPT_INTEGER(0, "threads", &nr_threads, N_("use threads when checking packs")),
 	OPT_END(),
 };
 
@@ -788,6 +791,11 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	if (check_strict)
 		fsck_obj_options.strict = 1;
 
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), nr_threads);
+	if (!nr_threads)
+		nr_threads = online_cpus();
+
 	if (show_progress == -1)
 		show_progress = isatty(2);
 	if (verbose)
@@ -831,7 +839,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 				/* verify gives error messages itself */
 				if (verify_pack(the_repository,
 						p, fsck_obj_buffer,
-						progress, count))
+						progress, count, nr_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
@@ -563,6 +563,9 @@ static void with_lock__do_force_resync(struct fsmonitor_daemon_state *state)
 
 	fsmonitor_free_token_data(free_me);
 
+	/* A shared untracked cache cannot be brought up to date anymore. */
+	strbuf_reset(&state->untracked_snapshot);
+
 	with_lock__abort_all_cookies(state);
 }
 
@@ -917,6 +920,55 @@ static int do_handle_client(struct fsmonitor_daemon_state *state,
 	return 0;
 }
 
+/*
+ * Clients share their untracked cache with us so that another index
+ * of this worktree that has none (because some other tool rewrote it,
+ * say) can start from it, rather than from scratch:
+ *
+ * <command> := untracked-put NUL <token> NUL <"UNTR" extension data>
+ *            | untracked-get NUL
+ *
+ * We just keep the last one we were sent in memory and reply with its
+ * token and data when asked.  It is up to the client to ask us what
+ * changed since that token.
+ */
+static int do_handle_untracked(struct fsmonitor_daemon_state *state,
+			       const char *command, size_t command_len,
+			       ipc_server_reply_cb *reply,
+			       struct ipc_server_reply_data *reply_data)
+{
+	struct strbuf snapshot = STRBUF_INIT;
+
+	if (!strcmp(command, "untracked-put")) {
+		size_t len = strlen(command) + 1;
+
+		if (command_len <= len ||
+		    !starts_with(command + len, "builtin:") ||
+		    !memchr(command + len, '\0', command_len - len))
+			return 0;
+
+		pthread_mutex_lock(&state->main_lock);
+		strbuf_reset(&state->untracked_snapshot);
+		strbuf_add(&state->untracked_snapshot, command + len,
+			   command_len - len);
+		pthread_mutex_unlock(&state->main_lock);
+
+		trace2_data_intmax("fsmonitor", the_repository,
+				   "untracked-put/length", command_len - len);
+		return 0;
+	}
+
+	pthread_mutex_lock(&state->main_lock);
+	strbuf_addbuf(&snapshot, &state->untracked_snapshot);
+	pthread_mutex_unlock(&state->main_lock);
+
+	trace2_data_intmax("fsmonitor", the_repository,
+			   "untracked-get/length", snapshot.len);
+	reply(reply_data, snapshot.buf, snapshot.len);
+	strbuf_release(&snapshot);
+	return 0;
+}
+
 static ipc_server_application_cb handle_client;
 
 static int handle_client(void *data,
@@ -927,10 +979,16 @@ static int handle_client(void *data,
 	struct fsmonitor_daemon_state *state = data;
 	int result;
 
+	if (!strcmp(command, "untracked-put") ||
+	    !strcmp(command, "untracked-get"))
+		return do_handle_untracked(state, command, command_len,
+					   reply, reply_data);
+
 	/*
 	 * The Simple IPC API now supports {char*, len} arguments, but
-	 * FSMonitor always uses proper null-terminated strings, so
-	 * we can ignore the command_len argument.  (Trust, but verify.)
+	 * FSMonitor always uses proper null-terminated strings (except
+	 * for the untracked cache above), so we can ignore the
+	 * command_len argument.  (Trust, but verify.)
 	 */
 	if (command_len != strlen(command))
 		BUG("FSMonitor assumes text messages");
@@ -1199,6 +1257,7 @@ static int fsmonitor_run_daemon(void)
 	pthread_cond_init(&state.cookies_cond, NULL);
 	state.error_code = 0;
 	state.current_token_data = fsmonitor_new_token_data();
+	strbuf_init(&state.untracked_snapshot, 0);
 
 	/* Prepare to (recursively) watch the <worktree-root> directory. */
 	strbuf_init(&state.path_worktree_watch, 0);
@@ -1258,6 +1317,7 @@ static int fsmonitor_run_daemon(void)
 	strbuf_release(&state.path_worktree_watch);
 	strbuf_release(&state.path_gitdir_watch);
 	strbuf_release(&state.path_cookie_prefix);
+	strbuf_release(&state.untracked_snapshot);
 
 	/*
 	 * NEEDSWORK: Consider "rm -rf <gitdir>/<fsmonitor-dir>"
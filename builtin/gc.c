@@ -25,6 +25,7 @@
 #include "object-store.h"
 #include "pack.h"
 #include "pack-objects.h"
+#include "pack-geometry.h"
 #include "blob.h"
 #include "tree.h"
 #include "promisor-remote.h"
@@ -32,6 +33,10 @@
 #include "remote.h"
 #include "object-store.h"
 #include "exec-cmd.h"
+#include "grep-trigrams.h"
+#include "notes-index.h"
+#include "patch-id-cache.h"
+#include "strmap.h"
 
 #define FAILED_RUN "failed to run %s"
 
@@ -46,6 +51,8 @@ static int aggressive_depth = 50;
 static int aggressive_window = 250;
 static int gc_auto_threshold = 6700;
 static int gc_auto_pack_limit = 50;
+static int gc_auto_geometric;
+static int cruft_packs;
 static int detach_auto = 1;
 static timestamp_t gc_log_expire_time;
 static const char *gc_log_expire = "1.day.ago";
@@ -151,7 +158,9 @@ static void gc_config(void)
 	git_config_get_int("gc.aggressivedepth", &aggressive_depth);
 	git_config_get_int("gc.auto", &gc_auto_threshold);
 	git_config_get_int("gc.autopacklimit", &gc_auto_pack_limit);
+	git_config_get_int("gc.autogeometric", &gc_auto_geometric);
 	git_config_get_bool("gc.autodetach", &detach_auto);
+	git_config_get_bool("gc.cruftpacks", &cruft_packs);
 	git_config_get_expiry("gc.pruneexpire", &prune_expire);
 	git_config_get_expiry("gc.worktreepruneexpire", &prune_worktrees_expire);
 	git_config_get_expiry("gc.logexpiry", &gc_log_expire);
@@ -307,7 +316,7 @@ static uint64_t estimate_repack_memory(struct packed_git *pack)
 	 */
 	heap += sizeof(struct tree) * nr_objects / 2;
 	/* and then obj_hash[], underestimated in fact */
-	heap += sizeof(struct object *) * nr_objects;
+	heap += (sizeof(uint32_t) + 1) * nr_objects;
 	/* revindex is used also */
 	heap += (sizeof(off_t) + sizeof(uint32_t)) * nr_objects;
 	/*
@@ -327,11 +336,42 @@ static int keep_one_pack(struct string_list_item *item, void *data)
 	return 0;
 }
 
+/*
+ * Do the local packs fail to form a geometric progression with the
+ * given factor, so that "repack --geometric" would roll some up?
+ */
+static int packs_out_of_progression(int factor)
+{
+	struct pack_geometry geometry;
+	unsigned long max_objects = 0;
+	int pack_kept_objects;
+	int ret;
+
+	/*
+	 * The defaults of "repack --geometric", which we are about to
+	 * run. It never writes a single-pack bitmap, so its default for
+	 * kept packs does not depend on repack.writeBitmaps.
+	 */
+	if (git_config_get_bool("repack.packkeptobjects", &pack_kept_objects))
+		pack_kept_objects = pack_kept_objects_default(-1, 1);
+	git_config_get_ulong("repack.geometricmaxobjects", &max_objects);
+
+	init_pack_geometry(&geometry, the_repository, pack_kept_objects);
+	split_pack_geometry(&geometry, factor, max_objects);
+	ret = !!geometry.split;
+	clear_pack_geometry(&geometry);
+	return ret;
+}
+
 static void add_repack_all_option(struct string_list *keep_pack)
 {
 	if (prune_expire && !strcmp(prune_expire, "now"))
 		strvec_push(&repack, "-a");
-	else {
+	else if (cruft_packs) {
+		strvec_push(&repack, "--cruft");
+		if (prune_expire)
+			strvec_pushf(&repack, "--cruft-expiration=%s", prune_expire);
+	} else {
 		strvec_push(&repack, "-A");
 		if (prune_expire)
 			strvec_pushf(&repack, "--unpack-unreachable=%s", prune_expire);
@@ -360,8 +400,19 @@ static int need_to_gc(void)
 	 * packs, we run "repack -d -l".  If there are too many packs,
 	 * we run "repack -A -d -l".  Otherwise we tell the caller
 	 * there is no need.
+	 *
+	 * With gc.autoGeometric, we instead run "repack -d -l
+	 * --geometric" whenever the packs are out of progression or
+	 * there are too many loose objects, which only ever rewrites
+	 * the smallest packs.
 	 */
-	if (too_many_packs()) {
+	if (gc_auto_geometric > 1) {
+		if (!packs_out_of_progression(gc_auto_geometric) &&
+		    !too_many_loose_objects())
+			return 0;
+		strvec_pushf(&repack, "--geometric=%d", gc_auto_geometric);
+		add_repack_incremental_option();
+	} else if (too_many_packs()) {
 		struct string_list keep_pack = STRING_LIST_INIT_NODUP;
 
 		if (big_pack_threshold) {
@@ -550,6 +601,7 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 		{ OPTION_STRING, 0, "prune", &prune_expire, N_("date"),
 			N_("prune unreferenced objects"),
 			PARSE_OPT_OPTARG, NULL, (intptr_t)prune_expire },
+		OPT_BOOL(0, "cruft", &cruft_packs, N_("pack unreferenced objects separately")),
 		OPT_BOOL(0, "aggressive", &aggressive, N_("be more thorough (increased runtime)")),
 		OPT_BOOL_F(0, "auto", &auto_gc, N_("enable auto-gc mode"),
 			   PARSE_OPT_NOCOMPLETE),
@@ -712,7 +764,8 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 }
 
 static const char *const builtin_maintenance_run_usage[] = {
-	N_("git maintenance run [--auto] [--[no-]quiet] [--task=<task>] [--schedule]"),
+	N_("git maintenance run [--auto] [--[no-]quiet] [--task=<task>] [--schedule]\n"
+	   "                    [--time-budget=<seconds>]"),
 	NULL
 };
 
@@ -756,8 +809,28 @@ struct maintenance_run_opts {
 	int auto_flag;
 	int quiet;
 	enum schedule_priority schedule;
+
+	/*
+	 * When the --time-budget of this run runs out, in getnanotime()
+	 * terms, or 0 if it has none.
+	 */
+	uint64_t deadline;
+
+	/* Set by a task that stopped with work left when time ran out. */
+	unsigned incomplete:1;
 };
 
+/*
+ * Return 1 if the time budget of this run is used up. Tasks whose work
+ * can be split call this between the units of it, and set
+ * `opts->incomplete` if they stop early, so that the next run with a
+ * budget resumes them first.
+ */
+static int budget_exhausted(struct maintenance_run_opts *opts)
+{
+	return opts->deadline && getnanotime() >= opts->deadline;
+}
+
 /* Remember to update object flag allocation in object.h */
 #define SEEN		(1u<<0)
 
@@ -881,6 +954,11 @@ static int fetch_remote(struct remote *remote, void *cbdata)
 	if (remote->skip_default_update)
 		return 0;
 
+	if (budget_exhausted(opts)) {
+		opts->incomplete = 1;
+		return 0;
+	}
+
 	child.git_cmd = 1;
 	strvec_pushl(&child.args, "fetch", remote->name,
 		     "--prefetch", "--prune", "--no-tags",
@@ -1045,7 +1123,27 @@ static int pack_loose(struct maintenance_run_opts *opts)
 
 static int maintenance_task_loose_objects(struct maintenance_run_opts *opts)
 {
-	return prune_packed(opts) || pack_loose(opts);
+	if (prune_packed(opts) || pack_loose(opts))
+		return 1;
+
+	/*
+	 * Without a time budget the objects packed above are pruned by the
+	 * next run; with one, keep packing batches while there is time.
+	 */
+	while (opts->deadline) {
+		if (prune_packed(opts))
+			return 1;
+		if (!for_each_loose_file_in_objdir(the_repository->objects->odb->path,
+						   bail_on_loose, NULL, NULL, NULL))
+			break;
+		if (budget_exhausted(opts)) {
+			opts->incomplete = 1;
+			break;
+		}
+		if (pack_loose(opts))
+			return 1;
+	}
+	return 0;
 }
 
 static int incremental_repack_auto_condition(void)
@@ -1182,11 +1280,55 @@ static int maintenance_task_incremental_repack(struct maintenance_run_opts *opts
 
 	if (multi_pack_index_write(opts))
 		return 1;
+	if (budget_exhausted(opts))
+		goto incomplete;
 	if (multi_pack_index_expire(opts))
 		return 1;
+	if (budget_exhausted(opts))
+		goto incomplete;
 	if (multi_pack_index_repack(opts))
 		return 1;
 	return 0;
+
+incomplete:
+	opts->incomplete = 1;
+	return 0;
+}
+
+static int maintenance_task_grep_trigrams(struct maintenance_run_opts *opts)
+{
+	if (write_grep_trigrams(the_repository, !opts->quiet)) {
+		error(_("failed to write the grep trigram index"));
+		return 1;
+	}
+	return 0;
+}
+
+static int maintenance_task_commit_trigrams(struct maintenance_run_opts *opts)
+{
+	if (write_commit_trigrams(the_repository, !opts->quiet)) {
+		error(_("failed to write the commit trigram index"));
+		return 1;
+	}
+	return 0;
+}
+
+static int maintenance_task_notes_index(struct maintenance_run_opts *opts)
+{
+	if (write_notes_indexes(the_repository)) {
+		error(_("failed to write the notes indexes"));
+		return 1;
+	}
+	return 0;
+}
+
+static int maintenance_task_patch_ids(struct maintenance_run_opts *opts)
+{
+	if (write_patch_id_cache(the_repository, !opts->quiet)) {
+		error(_("failed to write the patch-id cache"));
+		return 1;
+	}
+	return 0;
 }
 
 typedef int maintenance_task_fn(struct maintenance_run_opts *opts);
@@ -1208,6 +1350,15 @@ struct maintenance_task {
 
 	/* -1 if not selected. */
 	int selected_order;
+
+	/*
+	 * Set if a run with a time budget left this task undone; see
+	 * read_pending_tasks().
+	 */
+	unsigned pending:1;
+
+	/* The order in which the run picks this task up, or -1. */
+	int tier;
 };
 
 enum maintenance_task_label {
@@ -1217,6 +1368,10 @@ enum maintenance_task_label {
 	TASK_GC,
 	TASK_COMMIT_GRAPH,
 	TASK_PACK_REFS,
+	TASK_GREP_TRIGRAMS,
+	TASK_COMMIT_TRIGRAMS,
+	TASK_NOTES_INDEX,
+	TASK_PATCH_IDS,
 
 	/* Leave as final value */
 	TASK__COUNT
@@ -1253,6 +1408,26 @@ static struct maintenance_task tasks[] = {
 		maintenance_task_pack_refs,
 		NULL,
 	},
+	[TASK_GREP_TRIGRAMS] = {
+		"grep-trigrams",
+		maintenance_task_grep_trigrams,
+		NULL,
+	},
+	[TASK_COMMIT_TRIGRAMS] = {
+		"commit-trigrams",
+		maintenance_task_commit_trigrams,
+		NULL,
+	},
+	[TASK_NOTES_INDEX] = {
+		"notes-index",
+		maintenance_task_notes_index,
+		NULL,
+	},
+	[TASK_PATCH_IDS] = {
+		"patch-ids",
+		maintenance_task_patch_ids,
+		NULL,
+	},
 };
 
 static int compare_tasks_by_selection(const void *a_, const void *b_)
@@ -1263,9 +1438,52 @@ static int compare_tasks_by_selection(const void *a_, const void *b_)
 	return b->selected_order - a->selected_order;
 }
 
+/*
+ * A run with a time budget that could not get to all of its tasks, or
+ * that stopped one of them early, lists them one per line in
+ * "$GIT_DIR/maintenance-pending", and the next run with a budget does
+ * those first.
+ */
+static void read_pending_tasks(struct repository *r)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list names = STRING_LIST_INIT_NODUP;
+	char *path = repo_git_path(r, "maintenance-pending");
+	int i, j;
+
+	if (strbuf_read_file(&buf, path, 0) >= 0) {
+		string_list_split_in_place(&names, buf.buf, '\n', -1);
+		for (i = 0; i < names.nr; i++)
+			for (j = 0; j < TASK__COUNT; j++)
+				if (!strcmp(tasks[j].name, names.items[i].string))
+					tasks[j].pending = 1;
+	}
+	string_list_clear(&names, 0);
+	strbuf_release(&buf);
+	free(path);
+}
+
+static void write_pending_tasks(struct repository *r)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *path = repo_git_path(r, "maintenance-pending");
+	int i;
+
+	for (i = 0; i < TASK__COUNT; i++)
+		if (tasks[i].pending && tasks[i].tier >= 0)
+			strbuf_addf(&buf, "%s\n", tasks[i].name);
+
+	if (buf.len)
+		write_file_buf(path, buf.buf, buf.len);
+	else
+		unlink_or_warn(path);
+	strbuf_release(&buf);
+	free(path);
+}
+
 static int maintenance_run_tasks(struct maintenance_run_opts *opts)
 {
-	int i, found_selected = 0;
+	int i, tier, found_selected = 0;
 	int result = 0;
 	struct lock_file lk;
 	struct repository *r = the_repository;
@@ -1292,14 +1510,29 @@ static int maintenance_run_tasks(struct maintenance_run_opts *opts)
 
 	if (found_selected)
 		QSORT(tasks, TASK__COUNT, compare_tasks_by_selection);
+	else if (opts->deadline)
+		read_pending_tasks(r);
 
+	/*
+	 * Without a time budget every task that applies is in tier 1. With
+	 * one, the work is ordered by how much it is worth: first what an
+	 * earlier run left pending (tier 0), then tasks whose auto
+	 * condition says they are due, and only then the others (tier 2).
+	 */
 	for (i = 0; i < TASK__COUNT; i++) {
+		tasks[i].tier = -1;
+
 		if (found_selected && tasks[i].selected_order < 0)
 			continue;
 
 		if (!found_selected && !tasks[i].enabled)
 			continue;
 
+		if (tasks[i].pending) {
+			tasks[i].tier = 0;
+			continue;
+		}
+
 		if (opts->auto_flag &&
 		    (!tasks[i].auto_condition ||
 		     !tasks[i].auto_condition()))
@@ -1308,14 +1541,43 @@ static int maintenance_run_tasks(struct maintenance_run_opts *opts)
 		if (opts->schedule && tasks[i].schedule < opts->schedule)
 			continue;
 
-		trace2_region_enter("maintenance", tasks[i].name, r);
-		if (tasks[i].fn(opts)) {
-			error(_("task '%s' failed"), tasks[i].name);
-			result = 1;
+		tasks[i].tier = 1;
+		if (opts->deadline && !found_selected && !opts->auto_flag &&
+		    tasks[i].auto_condition && !tasks[i].auto_condition())
+			tasks[i].tier = 2;
+	}
+
+	for (tier = 0; tier <= 2; tier++) {
+		for (i = 0; i < TASK__COUNT; i++) {
+			uint64_t start;
+
+			if (tasks[i].tier != tier)
+				continue;
+
+			if (budget_exhausted(opts)) {
+				trace2_data_string("maintenance", r, "deferred",
+						   tasks[i].name);
+				tasks[i].pending = 1;
+				continue;
+			}
+
+			opts->incomplete = 0;
+			start = getnanotime();
+			trace2_region_enter("maintenance", tasks[i].name, r);
+			if (tasks[i].fn(opts)) {
+				error(_("task '%s' failed"), tasks[i].name);
+				result = 1;
+			}
+			trace2_data_intmax("maintenance", r, "elapsed-ms",
+					   (getnanotime() - start) / 1000000);
+			trace2_region_leave("maintenance", tasks[i].name, r);
+			tasks[i].pending = opts->incomplete;
 		}
-		trace2_region_leave("maintenance", tasks[i].name, r);
 	}
 
+	if (opts->deadline && !found_selected)
+		write_pending_tasks(r);
+
 	rollback_lock_file(&lk);
 	return result;
 }
@@ -1408,7 +1670,7 @@ static int task_option_parse(const struct option *opt,
 
 static int maintenance_run(int argc, const char **argv, const char *prefix)
 {
-	int i;
+	int i, time_budget = -1;
 	struct maintenance_run_opts opts;
 	struct option builtin_maintenance_run_options[] = {
 		OPT_BOOL(0, "auto", &opts.auto_flag,
@@ -1421,6 +1683,8 @@ static int maintenance_run(int argc, const char **argv, const char *prefix)
 		OPT_CALLBACK_F(0, "task", NULL, N_("task"),
 			N_("run a specific task"),
 			PARSE_OPT_NONEG, task_option_parse),
+		OPT_INTEGER(0, "time-budget", &time_budget,
+			    N_("stop starting new work after <n> seconds")),
 		OPT_END()
 	};
 	memset(&opts, 0, sizeof(opts));
@@ -1440,6 +1704,11 @@ static int maintenance_run(int argc, const char **argv, const char *prefix)
 
 	initialize_task_config(opts.schedule);
 
+	if (time_budget < 0)
+		git_config_get_int("maintenance.timebudget", &time_budget);
+	if (time_budget > 0)
+		opts.deadline = getnanotime() + (uint64_t)time_budget * 1000000000;
+
 	if (argc != 0)
 		usage_with_options(builtin_maintenance_run_usage,
 				   builtin_maintenance_run_options);
@@ -1515,6 +1784,188 @@ static int maintenance_unregister(void)
 	return rc;
 }
 
+static const char * const builtin_maintenance_daemon_usage[] = {
+	N_("git maintenance daemon [--jobs=<n>] [--interval=<seconds>] [--scans=<n>]"),
+	NULL
+};
+
+/*
+ * The daemon checks the repositories listed in "maintenance.repo" for
+ * activity, and runs "git maintenance run --auto" in those that had
+ * some, instead of running every one of them on a fixed schedule.
+ */
+struct daemon_repo {
+	char *path;
+	uint64_t stamp;
+};
+
+/*
+ * Return a stamp that changes when objects or refs are written to the
+ * repository at `path`, or 0 if it cannot be found. Only a few paths
+ * are looked at, so that a scan stays cheap for many repositories: the
+ * object directory and its "pack" and "info" subdirectories, the
+ * packed and top-level ref directories, and the reflog of HEAD.
+ */
+static uint64_t repo_activity_stamp(const char *path)
+{
+	static const char *watched[] = {
+		"objects", "objects/pack", "objects/info",
+		"packed-refs", "refs", "refs/heads", "refs/tags",
+		"refs/remotes", "logs/HEAD", "FETCH_HEAD",
+	};
+	struct strbuf sb = STRBUF_INIT;
+	const char *gitdir;
+	uint64_t stamp = 0;
+	size_t len;
+	int i;
+
+	gitdir = resolve_gitdir_gently(path, NULL);
+	if (!gitdir) {
+		strbuf_addf(&sb, "%s/.git", path);
+		gitdir = resolve_gitdir_gently(sb.buf, NULL);
+	}
+	if (!gitdir) {
+		strbuf_release(&sb);
+		return 0;
+	}
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/", gitdir);
+	len = sb.len;
+
+	for (i = 0; i < ARRAY_SIZE(watched); i++) {
+		struct stat st;
+		uint64_t mtime;
+
+		strbuf_setlen(&sb, len);
+		strbuf_addstr(&sb, watched[i]);
+		if (stat(sb.buf, &st))
+			continue;
+		mtime = (uint64_t)st.st_mtime * 1000000000 + ST_MTIME_NSEC(st);
+		if (mtime > stamp)
+			stamp = mtime;
+	}
+
+	strbuf_release(&sb);
+	return stamp ? stamp : 1;
+}
+
+struct daemon_scan {
+	struct daemon_repo **todo;
+	size_t nr, alloc, next;
+	int failed;
+};
+
+static int daemon_next_repo(struct child_process *cp, struct strbuf *out,
+			    void *cb, void **task_cb)
+{
+	struct daemon_scan *scan = cb;
+	struct daemon_repo *repo;
+
+	if (scan->next >= scan->nr)
+		return 0;
+	repo = scan->todo[scan->next++];
+
+	cp->git_cmd = 1;
+	strvec_pushl(&cp->args, "-C", repo->path, "maintenance", "run",
+		     "--auto", "--quiet", NULL);
+	*task_cb = repo;
+	return 1;
+}
+
+static int daemon_repo_done(int result, struct strbuf *out,
+			    void *cb, void *task_cb)
+{
+	struct daemon_scan *scan = cb;
+	struct daemon_repo *repo = task_cb;
+
+	/*
+	 * Take the stamp after the run, so that what maintenance itself
+	 * wrote does not count as activity.
+	 */
+	repo->stamp = repo_activity_stamp(repo->path);
+	if (result) {
+		strbuf_addf(out, _("maintenance failed in '%s'\n"), repo->path);
+		scan->failed = 1;
+	}
+	return 0;
+}
+
+static int maintenance_daemon(int argc, const char **argv, const char *prefix)
+{
+	int jobs = 0, interval = 60, scans = 0, scan_nr;
+	struct strmap repos = STRMAP_INIT;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	int failed = 0;
+	struct option options[] = {
+		OPT_INTEGER('j', "jobs", &jobs,
+			    N_("run maintenance in <n> repositories at a time")),
+		OPT_INTEGER(0, "interval", &interval,
+			    N_("look for activity every <n> seconds")),
+		OPT_INTEGER(0, "scans", &scans,
+			    N_("stop after <n> scans")),
+		OPT_END()
+	};
+
+	git_config_get_int("maintenance.daemon.jobs", &jobs);
+	git_config_get_int("maintenance.daemon.interval", &interval);
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_maintenance_daemon_usage, 0);
+	if (argc)
+		usage_with_options(builtin_maintenance_daemon_usage, options);
+	if (jobs < 0 || interval < 0 || scans < 0)
+		die(_("--jobs, --interval and --scans cannot be negative"));
+	if (!jobs)
+		jobs = online_cpus();
+
+	for (scan_nr = 1; ; scan_nr++) {
+		struct daemon_scan scan = { 0 };
+		const struct string_list *paths;
+		int i;
+
+		/* Pick up repositories registered since the last scan. */
+		git_config_clear();
+		paths = git_config_get_value_multi("maintenance.repo");
+
+		trace2_region_enter("maintenance", "daemon-scan", NULL);
+		for (i = 0; paths && i < paths->nr; i++) {
+			const char *path = paths->items[i].string;
+			struct daemon_repo *repo = strmap_get(&repos, path);
+			uint64_t stamp = repo_activity_stamp(path);
+
+			if (!repo) {
+				CALLOC_ARRAY(repo, 1);
+				repo->path = xstrdup(path);
+				strmap_put(&repos, path, repo);
+			}
+			if (!stamp || stamp == repo->stamp)
+				continue;
+			ALLOC_GROW(scan.todo, scan.nr + 1, scan.alloc);
+			scan.todo[scan.nr++] = repo;
+		}
+		trace2_data_intmax("maintenance", NULL, "active", scan.nr);
+
+		if (scan.nr)
+			run_processes_parallel_tr2(jobs, daemon_next_repo, NULL,
+						   daemon_repo_done, &scan,
+						   "maintenance", "daemon-run");
+		trace2_region_leave("maintenance", "daemon-scan", NULL);
+		failed |= scan.failed;
+		free(scan.todo);
+
+		if (scans && scan_nr >= scans)
+			break;
+		sleep_millisec(interval * 1000);
+	}
+
+	strmap_for_each_entry(&repos, &iter, e) {
+		struct daemon_repo *repo = e->value;
+		free(repo->path);
+	}
+	strmap_clear(&repos, 1);
+	return failed;
+}
+
 static const char *get_frequency(enum schedule_priority schedule)
 {
 	switch (schedule) {
@@ -2015,6 +2466,13 @@ int cmd_maintenance(int argc, const char **argv, const char *prefix)
 	    (argc == 2 && !strcmp(argv[1], "-h")))
 		usage(builtin_maintenance_usage);
 
+	/* The daemon looks after other repositories, and needs none. */
+	if (!strcmp(argv[1], "daemon"))
+		return maintenance_daemon(argc - 1, argv + 1, prefix);
+	if (!startup_info->have_repository)
+		die(_("not a git repository (or any of the parent directories): %s"),
+		    DEFAULT_GIT_DIR_ENVIRONMENT);
+
 	if (!strcmp(argv[1], "run"))
 		return maintenance_run(argc - 1, argv + 1, prefix);
 	if (!strcmp(argv[1], "start"))
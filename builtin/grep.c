@@ -18,6 +18,7 @@
 #include "run-command.h"
 #include "userdiff.h"
 #include "grep.h"
+#include "grep-trigrams.h"
 #include "quote.h"
 #include "dir.h"
 #include "pathspec.h"
@@ -25,6 +26,7 @@
 #include "submodule-config.h"
 #include "object-store.h"
 #include "packfile.h"
+#include "oidset.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [<options>] [-e] <pattern> [<rev>...] [[--] <path>...]"),
@@ -35,6 +37,25 @@ static int recurse_submodules;
 
 static int num_threads;
 
+static struct grep_trigram_filter *trigram_filter;
+
+/*
+ * Blobs that were searched without a hit or any output. The same blob
+ * in another revision or at another path gives the same result, unless
+ * its attributes decide whether it is searched at all (binary files
+ * with -I) or what is searched (textconv).
+ */
+static int skip_blobs_without_hits;
+static struct oidset blobs_without_hits = OIDSET_INIT;
+
+/*
+ * Blobs queued for the threads but not searched yet. Another request
+ * for one of them waits for the result instead of queuing it again, so
+ * that what is skipped does not depend on timing.
+ */
+static struct oidset blobs_queued = OIDSET_INIT;
+static unsigned long nr_blobs_skipped;
+
 static pthread_t *threads;
 
 /* We use one producer thread and THREADS consumer
@@ -44,6 +65,7 @@ static pthread_t *threads;
 struct work_item {
 	struct grep_source source;
 	char done;
+	char hit;
 	struct strbuf out;
 };
 
@@ -54,10 +76,14 @@ struct work_item {
  * The work_items in [todo_start, todo_end) are waiting to be picked
  * up by a consumer thread.
  *
- * The ranges are modulo TODO_SIZE.
+ * The ranges are modulo todo_size, which is TODO_PER_THREAD items for
+ * each thread but at least TODO_MIN_SIZE, so that a slow item at
+ * todo_done does not keep many threads from picking up more work.
  */
-#define TODO_SIZE 128
-static struct work_item todo[TODO_SIZE];
+#define TODO_MIN_SIZE 128
+#define TODO_PER_THREAD 8
+static struct work_item *todo;
+static int todo_size;
 static int todo_start;
 static int todo_end;
 static int todo_done;
@@ -65,6 +91,9 @@ static int todo_done;
 /* Has all work items been added? */
 static int all_work_added;
 
+/* Is a consumer thread writing out results? */
+static int writing_results;
+
 /* This lock protects all the variables above. */
 static pthread_mutex_t grep_mutex;
 
@@ -89,6 +118,9 @@ static pthread_cond_t cond_write;
 /* Signalled when we are finished with everything. */
 static pthread_cond_t cond_result;
 
+/* Signalled when a blob in blobs_queued has been searched. */
+static pthread_cond_t cond_searched;
+
 static int skip_first_line;
 
 static void add_work(struct grep_opt *opt, struct grep_source *gs)
@@ -98,14 +130,14 @@ static void add_work(struct grep_opt *opt, struct grep_source *gs)
 
 	grep_lock();
 
-	while ((todo_end+1) % ARRAY_SIZE(todo) == todo_done) {
+	while ((todo_end+1) % todo_size == todo_done) {
 		pthread_cond_wait(&cond_write, &grep_mutex);
 	}
 
 	todo[todo_end].source = *gs;
 	todo[todo_end].done = 0;
 	strbuf_reset(&todo[todo_end].out);
-	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
+	todo_end = (todo_end + 1) % todo_size;
 
 	pthread_cond_signal(&cond_add);
 	grep_unlock();
@@ -124,43 +156,77 @@ static struct work_item *get_work(void)
 		ret = NULL;
 	} else {
 		ret = &todo[todo_start];
-		todo_start = (todo_start + 1) % ARRAY_SIZE(todo);
+		todo_start = (todo_start + 1) % todo_size;
 	}
 	grep_unlock();
 	return ret;
 }
 
-static void work_done(struct work_item *w)
+static void write_result(struct work_item *w)
 {
-	int old_done;
+	if (w->out.len) {
+		const char *p = w->out.buf;
+		size_t len = w->out.len;
+
+		/* Skip the leading hunk mark of the first file. */
+		if (skip_first_line) {
+			while (len) {
+				len--;
+				if (*p++ == '\n')
+					break;
+			}
+			skip_first_line = 0;
+		}
+
+		write_or_die(1, p, len);
+	}
+	grep_source_clear(&w->source);
+}
 
+static void work_done(struct work_item *w)
+{
 	grep_lock();
 	w->done = 1;
-	old_done = todo_done;
-	for(; todo[todo_done].done && todo_done != todo_start;
-	    todo_done = (todo_done+1) % ARRAY_SIZE(todo)) {
-		w = &todo[todo_done];
-		if (w->out.len) {
-			const char *p = w->out.buf;
-			size_t len = w->out.len;
-
-			/* Skip the leading hunk mark of the first file. */
-			if (skip_first_line) {
-				while (len) {
-					len--;
-					if (*p++ == '\n')
-						break;
-				}
-				skip_first_line = 0;
-			}
+	if (skip_blobs_without_hits && w->source.type == GREP_SOURCE_OID) {
+		if (!w->hit && !w->out.len)
+			oidset_insert(&blobs_without_hits, w->source.identifier);
+		oidset_remove(&blobs_queued, w->source.identifier);
+		pthread_cond_broadcast(&cond_searched);
+	}
 
-			write_or_die(1, p, len);
-		}
-		grep_source_clear(&w->source);
+	/*
+	 * Only one thread writes out results at a time; it will find
+	 * this item done when it comes back for more.
+	 */
+	if (writing_results) {
+		grep_unlock();
+		return;
 	}
+	writing_results = 1;
+
+	while (1) {
+		int start = todo_done, end = todo_done, i;
+
+		while (end != todo_start && todo[end].done)
+			end = (end + 1) % todo_size;
+		if (start == end)
+			break;
+
+		/*
+		 * Nobody else touches the items in [todo_done, end)
+		 * until todo_done moves past them, so write them out
+		 * without keeping the other threads waiting for the
+		 * lock.
+		 */
+		grep_unlock();
+		for (i = start; i != end; i = (i + 1) % todo_size)
+			write_result(&todo[i]);
+		grep_lock();
 
-	if (old_done != todo_done)
+		todo_done = end;
 		pthread_cond_signal(&cond_write);
+	}
+	writing_results = 0;
 
 	if (all_work_added && todo_done == todo_end)
 		pthread_cond_signal(&cond_result);
@@ -179,7 +245,8 @@ static void *run(void *arg)
 			break;
 
 		opt->output_priv = w;
-		hit |= grep_source(opt, &w->source);
+		w->hit = grep_source(opt, &w->source);
+		hit |= w->hit;
 		grep_source_clear_data(&w->source);
 		work_done(w);
 	}
@@ -204,10 +271,15 @@ static void start_threads(struct grep_opt *opt)
 	pthread_cond_init(&cond_add, NULL);
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
+	pthread_cond_init(&cond_searched, NULL);
 	grep_use_locks = 1;
 	enable_obj_read_lock();
 
-	for (i = 0; i < ARRAY_SIZE(todo); i++) {
+	todo_size = TODO_MIN_SIZE;
+	if (num_threads > TODO_MIN_SIZE / TODO_PER_THREAD)
+		todo_size = st_mult(num_threads, TODO_PER_THREAD);
+	CALLOC_ARRAY(todo, todo_size);
+	for (i = 0; i < todo_size; i++) {
 		strbuf_init(&todo[i].out, 0);
 	}
 
@@ -253,12 +325,16 @@ static int wait_all(void)
 	}
 
 	free(threads);
+	for (i = 0; i < todo_size; i++)
+		strbuf_release(&todo[i].out);
+	FREE_AND_NULL(todo);
 
 	pthread_mutex_destroy(&grep_mutex);
 	pthread_mutex_destroy(&grep_attr_mutex);
 	pthread_cond_destroy(&cond_add);
 	pthread_cond_destroy(&cond_write);
 	pthread_cond_destroy(&cond_result);
+	pthread_cond_destroy(&cond_searched);
 	grep_use_locks = 0;
 	disable_obj_read_lock();
 
@@ -332,6 +408,30 @@ static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
 	struct strbuf pathbuf = STRBUF_INIT;
 	struct grep_source gs;
 
+	if (trigram_filter && opt->repo == the_repository &&
+	    grep_trigram_filter_skip(trigram_filter, oid))
+		return 0;
+
+	if (skip_blobs_without_hits) {
+		int seen;
+
+		if (num_threads > 1) {
+			grep_lock();
+			while (oidset_contains(&blobs_queued, oid))
+				pthread_cond_wait(&cond_searched, &grep_mutex);
+			seen = oidset_contains(&blobs_without_hits, oid);
+			if (!seen)
+				oidset_insert(&blobs_queued, oid);
+			grep_unlock();
+		} else {
+			seen = oidset_contains(&blobs_without_hits, oid);
+		}
+		if (seen) {
+			nr_blobs_skipped++;
+			return 0;
+		}
+	}
+
 	grep_source_name(opt, filename, tree_name_len, &pathbuf);
 	grep_source_init(&gs, GREP_SOURCE_OID, pathbuf.buf, path, oid);
 	strbuf_release(&pathbuf);
@@ -347,6 +447,8 @@ static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
 		int hit;
 
 		hit = grep_source(opt, &gs);
+		if (skip_blobs_without_hits && !hit)
+			oidset_insert(&blobs_without_hits, oid);
 
 		grep_source_clear(&gs);
 		return hit;
@@ -1160,6 +1262,12 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	if (untracked && cached)
 		die(_("--untracked cannot be used with --cached"));
 
+	if (use_index && !untracked)
+		trigram_filter = grep_trigram_filter_prepare(the_repository,
+							     &opt);
+	skip_blobs_without_hits = !opt.allow_textconv &&
+		opt.binary != GREP_BINARY_NOMATCH;
+
 	if (!use_index || untracked) {
 		int use_exclude = (opt_exclude < 0) ? use_index : !!opt_exclude;
 		hit = grep_directory(&opt, &pathspec, use_exclude, use_index);
@@ -1182,6 +1290,12 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	if (hit && show_in_pager)
 		run_pager(&opt, prefix);
 	clear_pathspec(&pathspec);
+	if (nr_blobs_skipped)
+		trace2_data_intmax("grep", the_repository, "blobs/skipped-seen",
+				   nr_blobs_skipped);
+	oidset_clear(&blobs_without_hits);
+	oidset_clear(&blobs_queued);
+	grep_trigram_filter_free(trigram_filter);
 	free_grep_patterns(&opt);
 	return !hit;
 }
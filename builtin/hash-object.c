@@ -11,6 +11,7 @@
 #include "quote.h"
 #include "parse-options.h"
 #include "exec-cmd.h"
+#include "bulk-checkin.h"
 
 /*
  * This is to create corrupt objects for debugging and as such it
@@ -31,20 +32,32 @@ static int hash_literally(struct object_id *oid, int fd, const char *type, unsig
 	return ret;
 }
 
+static NORETURN void die_hash_failure(const char *path, unsigned flags)
+{
+	die((flags & HASH_WRITE_OBJECT)
+	    ? "Unable to add %s to database"
+	    : "Unable to hash %s", path);
+}
+
+static int hash_fd_to_oid(struct object_id *oid, int fd, const char *type,
+			  const char *path, unsigned flags, int literally)
+{
+	struct stat st;
+
+	return fstat(fd, &st) < 0 ||
+		(literally
+		 ? hash_literally(oid, fd, type, flags)
+		 : index_fd(the_repository->index, oid, fd, &st,
+			    type_from_string(type), path, flags));
+}
+
 static void hash_fd(int fd, const char *type, const char *path, unsigned flags,
 		    int literally)
 {
-	struct stat st;
 	struct object_id oid;
 
-	if (fstat(fd, &st) < 0 ||
-	    (literally
-	     ? hash_literally(&oid, fd, type, flags)
-	     : index_fd(the_repository->index, &oid, fd, &st,
-			type_from_string(type), path, flags)))
-		die((flags & HASH_WRITE_OBJECT)
-		    ? "Unable to add %s to database"
-		    : "Unable to hash %s", path);
+	if (hash_fd_to_oid(&oid, fd, type, path, flags, literally))
+		die_hash_failure(path, flags);
 	printf("%s\n", oid_to_hex(&oid));
 	maybe_flush_or_die(stdout, "hash to stdout");
 }
@@ -59,19 +72,155 @@ static void hash_object(const char *path, const char *type, const char *vpath,
 	hash_fd(fd, type, vpath, flags, literally);
 }
 
+static int unquote_path(struct strbuf *buf, struct strbuf *unquoted)
+{
+	if (buf->buf[0] != '"')
+		return 0;
+	strbuf_reset(unquoted);
+	if (unquote_c_style(unquoted, buf->buf, NULL))
+		return -1;
+	strbuf_swap(buf, unquoted);
+	return 0;
+}
+
+/*
+ * Blobs named on the standard input are read, hashed and written a batch
+ * at a time by index_files_bulk_checkin(), out of whatever input is
+ * already there; their names are printed once the objects are in the
+ * object store, and always before waiting for more input, so that a
+ * caller that writes a path and waits for its object name still gets it.
+ */
+#define STDIN_BATCH_SIZE 1024
+
+static void print_hashed(struct bulk_checkin_file *files, size_t nr)
+{
+	size_t i;
+
+	unplug_bulk_checkin();
+	for (i = 0; i < nr; i++)
+		printf("%s\n", oid_to_hex(&files[i].oid));
+	maybe_flush_or_die(stdout, "hash to stdout");
+}
+
+static void hash_batch(struct bulk_checkin_file *files, size_t done,
+		       size_t nr, int no_filters, unsigned flags)
+{
+	struct index_state *istate = the_repository->index;
+	size_t i;
+
+	plug_bulk_checkin();
+	for (i = done; i < nr; i++) {
+		const char *path = files[i].path;
+
+		if ((!no_filters && would_convert_to_git(istate, path)) ||
+		    stat(path, &files[i].st) < 0)
+			memset(&files[i].st, 0, sizeof(files[i].st));
+	}
+	index_files_bulk_checkin(files + done, nr - done, flags);
+
+	for (i = done; i < nr; i++) {
+		const char *path = files[i].path;
+		const char *vpath = no_filters ? NULL : path;
+		int fd;
+
+		if (files[i].indexed)
+			continue;
+		/* show what we have before giving up on this one */
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			int saved_errno = errno;
+
+			print_hashed(files, i);
+			errno = saved_errno;
+			die_errno("Cannot open '%s'", path);
+		}
+		if (hash_fd_to_oid(&files[i].oid, fd, blob_type, vpath,
+				   flags, 0)) {
+			print_hashed(files, i);
+			die_hash_failure(vpath, flags);
+		}
+	}
+}
+
+static int input_pending(int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) > 0;
+}
+
+static void hash_stdin_paths_batched(int no_filters, unsigned flags)
+{
+	struct strbuf in = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct strbuf unquoted = STRBUF_INIT;
+	struct bulk_checkin_file *files = NULL;
+	size_t i, nr = 0, alloc = 0, done = 0, pos = 0;
+	ssize_t len;
+	int eof = 0;
+
+	for (;;) {
+		const char *eol = memchr(in.buf + pos, '\n', in.len - pos);
+
+		if (eol || (eof && pos < in.len)) {
+			size_t end = eol ? eol - in.buf : in.len;
+
+			strbuf_reset(&buf);
+			strbuf_add(&buf, in.buf + pos, end - pos);
+			pos = end + !!eol;
+			if (buf.len && buf.buf[buf.len - 1] == '\r')
+				strbuf_setlen(&buf, buf.len - 1);
+			if (unquote_path(&buf, &unquoted))
+				die("line is badly quoted");
+			ALLOC_GROW(files, nr + 1, alloc);
+			memset(&files[nr], 0, sizeof(files[nr]));
+			files[nr++].path = xstrdup(buf.buf);
+			if (nr - done >= STDIN_BATCH_SIZE) {
+				hash_batch(files, done, nr, no_filters, flags);
+				done = nr;
+			}
+			continue;
+		}
+
+		strbuf_remove(&in, 0, pos);
+		pos = 0;
+		if (eof || !input_pending(0)) {
+			if (done < nr)
+				hash_batch(files, done, nr, no_filters, flags);
+			print_hashed(files, nr);
+			for (i = 0; i < nr; i++)
+				free((char *)files[i].path);
+			nr = done = 0;
+		}
+		if (eof)
+			break;
+		len = strbuf_read_once(&in, 0, 0);
+		if (len < 0)
+			die_errno("unable to read from stdin");
+		eof = !len;
+	}
+	free(files);
+	strbuf_release(&in);
+	strbuf_release(&buf);
+	strbuf_release(&unquoted);
+}
+
 static void hash_stdin_paths(const char *type, int no_filters, unsigned flags,
 			     int literally)
 {
 	struct strbuf buf = STRBUF_INIT;
 	struct strbuf unquoted = STRBUF_INIT;
 
+	if (!literally && !strcmp(type, blob_type)) {
+		hash_stdin_paths_batched(no_filters, flags);
+		return;
+	}
+
 	while (strbuf_getline(&buf, stdin) != EOF) {
-		if (buf.buf[0] == '"') {
-			strbuf_reset(&unquoted);
-			if (unquote_c_style(&unquoted, buf.buf, NULL))
-				die("line is badly quoted");
-			strbuf_swap(&buf, &unquoted);
-		}
+		if (unquote_path(&buf, &unquoted))
+			die("line is badly quoted");
 		hash_object(buf.buf, type, no_filters ? NULL : buf.buf, flags,
 			    literally);
 	}
@@ -15,6 +15,7 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "promisor-remote.h"
+#include "oidset.h"
 
 static const char index_pack_usage[] =
 "git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
@@ -161,6 +162,29 @@ static pthread_mutex_t deepest_delta_mutex;
 
 static pthread_key_t key;
 
+/*
+ * During the first pass, the thread reading the pack only inflates each
+ * object to find where it ends; non-delta objects are queued here and
+ * hashed and checked by a pool of workers.
+ */
+struct first_pass_item {
+	struct object_entry *obj;
+	void *data;
+};
+
+#define FIRST_PASS_QUEUE_SIZE 1024
+#define FIRST_PASS_QUEUE_BYTES (32 * 1024 * 1024)
+
+static struct first_pass_item first_pass_queue[FIRST_PASS_QUEUE_SIZE];
+static unsigned int first_pass_head, first_pass_nr;
+static size_t first_pass_bytes;
+static int first_pass_done;
+static int nr_first_pass_threads;
+static pthread_t *first_pass_threads;
+static pthread_mutex_t first_pass_mutex;
+static pthread_cond_t first_pass_cond;
+static pthread_cond_t first_pass_space;
+
 static inline void lock_mutex(pthread_mutex_t *mutex)
 {
 	if (threads_active)
@@ -455,18 +479,24 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
-		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX,
-				   type_name(type),(uintmax_t)size) + 1;
-		the_hash_algo->init_fn(&c);
-		the_hash_algo->update_fn(&c, hdr, hdrlen);
-	} else
-		oid = NULL;
 	if (type == OBJ_BLOB && size > big_file_threshold)
 		buf = fixed_buf;
 	else
 		buf = xmallocz(size);
 
+	/*
+	 * Objects we keep in memory are hashed by the first pass workers,
+	 * if there are any; streamed large blobs must be hashed here.
+	 */
+	if (is_delta_type(type) || (nr_first_pass_threads && buf != fixed_buf))
+		oid = NULL;
+	if (oid) {
+		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX,
+				   type_name(type),(uintmax_t)size) + 1;
+		the_hash_algo->init_fn(&c);
+		the_hash_algo->update_fn(&c, hdr, hdrlen);
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
@@ -888,6 +918,99 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 	free(new_data);
 }
 
+static void *first_pass_worker(void *unused)
+{
+	for (;;) {
+		struct first_pass_item item;
+
+		pthread_mutex_lock(&first_pass_mutex);
+		while (!first_pass_nr && !first_pass_done)
+			pthread_cond_wait(&first_pass_cond, &first_pass_mutex);
+		if (!first_pass_nr) {
+			pthread_mutex_unlock(&first_pass_mutex);
+			break;
+		}
+		item = first_pass_queue[first_pass_head];
+		first_pass_head = (first_pass_head + 1) % FIRST_PASS_QUEUE_SIZE;
+		first_pass_nr--;
+		first_pass_bytes -= item.obj->size;
+		pthread_cond_signal(&first_pass_space);
+		pthread_mutex_unlock(&first_pass_mutex);
+
+		hash_object_file(the_hash_algo, item.data, item.obj->size,
+				 type_name(item.obj->type), &item.obj->idx.oid);
+		sha1_object(item.data, NULL, item.obj->size, item.obj->type,
+			    &item.obj->idx.oid);
+		free(item.data);
+	}
+	return NULL;
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	nr_first_pass_threads = nr_threads > 1 ? nr_threads - 1 : 1;
+	init_recursive_mutex(&read_mutex);
+	pthread_mutex_init(&first_pass_mutex, NULL);
+	pthread_cond_init(&first_pass_cond, NULL);
+	pthread_cond_init(&first_pass_space, NULL);
+	threads_active = 1;
+
+	CALLOC_ARRAY(first_pass_threads, nr_first_pass_threads);
+	for (i = 0; i < nr_first_pass_threads; i++) {
+		int ret = pthread_create(&first_pass_threads[i], NULL,
+					 first_pass_worker, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+/*
+ * Hand a non-delta object over to the workers, which take ownership of
+ * "data". Waits while the queue is full, but always accepts an object
+ * when nothing else is queued, however large.
+ */
+static void queue_first_pass(struct object_entry *obj, void *data)
+{
+	struct first_pass_item *item;
+
+	pthread_mutex_lock(&first_pass_mutex);
+	while (first_pass_nr == FIRST_PASS_QUEUE_SIZE ||
+	       (first_pass_nr &&
+		first_pass_bytes + obj->size > FIRST_PASS_QUEUE_BYTES))
+		pthread_cond_wait(&first_pass_space, &first_pass_mutex);
+	item = &first_pass_queue[(first_pass_head + first_pass_nr) %
+				 FIRST_PASS_QUEUE_SIZE];
+	item->obj = obj;
+	item->data = data;
+	first_pass_nr++;
+	first_pass_bytes += obj->size;
+	pthread_cond_signal(&first_pass_cond);
+	pthread_mutex_unlock(&first_pass_mutex);
+}
+
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	pthread_mutex_lock(&first_pass_mutex);
+	first_pass_done = 1;
+	pthread_cond_broadcast(&first_pass_cond);
+	pthread_mutex_unlock(&first_pass_mutex);
+
+	for (i = 0; i < nr_first_pass_threads; i++)
+		pthread_join(first_pass_threads[i], NULL);
+	FREE_AND_NULL(first_pass_threads);
+	nr_first_pass_threads = 0;
+
+	threads_active = 0;
+	pthread_cond_destroy(&first_pass_space);
+	pthread_cond_destroy(&first_pass_cond);
+	pthread_mutex_destroy(&first_pass_mutex);
+	pthread_mutex_destroy(&read_mutex);
+}
+
 /*
  * Ensure that this node has been reconstructed and return its contents.
  *
@@ -1161,6 +1284,8 @@ static void parse_pack_objects(unsigned char *hash)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS"))
+		start_first_pass_threads();
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
@@ -1180,6 +1305,9 @@ static void parse_pack_objects(unsigned char *hash)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
+		} else if (nr_first_pass_threads) {
+			queue_first_pass(obj, data);
+			data = NULL;
 		} else
 			sha1_object(data, NULL, obj->size, obj->type,
 				    &obj->idx.oid);
@@ -1187,6 +1315,8 @@ static void parse_pack_objects(unsigned char *hash)
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+	if (nr_first_pass_threads)
+		finish_first_pass_threads();
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1308,33 +1438,35 @@ static void conclude_pack(int fix_thin_pack, const char *curr_pack, unsigned cha
 		    nr_ofs_deltas + nr_ref_deltas - nr_resolved_deltas);
 }
 
-static int write_compressed(struct hashfile *f, void *in, unsigned int size)
+static void *compress_object(void *in, unsigned long size,
+			     unsigned long *zsize)
 {
 	git_zstream stream;
+	unsigned long maxsize;
+	void *out;
 	int status;
-	unsigned char outbuf[4096];
 
 	git_deflate_init(&stream, zlib_compression_level);
+	maxsize = git_deflate_bound(&stream, size);
+	out = xmalloc(maxsize);
 	stream.next_in = in;
 	stream.avail_in = size;
+	stream.next_out = out;
+	stream.avail_out = maxsize;
 
-	do {
-		stream.next_out = outbuf;
-		stream.avail_out = sizeof(outbuf);
-		status = git_deflate(&stream, Z_FINISH);
-		hashwrite(f, outbuf, sizeof(outbuf) - stream.avail_out);
-	} while (status == Z_OK);
-
+	while ((status = git_deflate(&stream, Z_FINISH)) == Z_OK)
+		; /* nothing */
 	if (status != Z_STREAM_END)
 		die(_("unable to deflate appended object (%d)"), status);
-	size = stream.total_out;
+	*zsize = stream.total_out;
 	git_deflate_end(&stream);
-	return size;
+	return out;
 }
 
 static struct object_entry *append_obj_to_pack(struct hashfile *f,
-			       const unsigned char *sha1, void *buf,
-			       unsigned long size, enum object_type type)
+			       const unsigned char *sha1, void *zdata,
+			       unsigned long zsize, unsigned long size,
+			       enum object_type type)
 {
 	struct object_entry *obj = &objects[nr_objects++];
 	unsigned char header[10];
@@ -1350,12 +1482,13 @@ static struct object_entry *append_obj_to_pack(struct hashfile *f,
 	header[n++] = c;
 	crc32_begin(f);
 	hashwrite(f, header, n);
+	hashwrite(f, zdata, zsize);
 	obj[0].size = size;
 	obj[0].hdr_size = n;
 	obj[0].type = type;
 	obj[0].real_type = type;
 	obj[1].idx.offset = obj[0].idx.offset + n;
-	obj[1].idx.offset += write_compressed(f, buf, size);
+	obj[1].idx.offset += zsize;
 	obj[0].idx.crc32 = crc32_end(f);
 	hashflush(f);
 	oidread(&obj->idx.oid, sha1);
@@ -1369,9 +1502,125 @@ static int delta_pos_compare(const void *_a, const void *_b)
 	return a->obj_no - b->obj_no;
 }
 
+/*
+ * A local base object to append to a thin pack, read, checked and
+ * deflated by the workers while the main thread appends the bases
+ * before it and resolves the deltas against them.  "zdata" is NULL
+ * if the object is not available locally.
+ */
+struct thin_base {
+	const struct object_id *oid;
+	enum object_type type;
+	unsigned long size;
+	void *zdata;
+	unsigned long zsize;
+	int ready;
+};
+
+/* How far ahead of the main thread the workers may go. */
+#define THIN_BASE_LOOKAHEAD 256
+
+static struct thin_base *thin_bases;
+static int nr_thin_bases, thin_bases_taken, thin_bases_consumed;
+static pthread_t *thin_base_threads;
+static int nr_thin_base_threads;
+static pthread_mutex_t thin_base_mutex;
+static pthread_cond_t thin_base_ready;
+static pthread_cond_t thin_base_space;
+
+static void prepare_thin_base(struct thin_base *b)
+{
+	void *data = read_object_file(b->oid, &b->type, &b->size);
+
+	if (!data)
+		return;
+	if (check_object_signature(the_repository, b->oid, data, b->size,
+				   type_name(b->type)))
+		die(_("local object %s is corrupt"), oid_to_hex(b->oid));
+	b->zdata = compress_object(data, b->size, &b->zsize);
+	free(data);
+}
+
+static void *thin_base_worker(void *unused)
+{
+	for (;;) {
+		struct thin_base *b;
+
+		pthread_mutex_lock(&thin_base_mutex);
+		while (thin_bases_taken < nr_thin_bases &&
+		       thin_bases_taken >=
+		       thin_bases_consumed + THIN_BASE_LOOKAHEAD)
+			pthread_cond_wait(&thin_base_space, &thin_base_mutex);
+		if (thin_bases_taken >= nr_thin_bases) {
+			pthread_mutex_unlock(&thin_base_mutex);
+			break;
+		}
+		b = &thin_bases[thin_bases_taken++];
+		pthread_mutex_unlock(&thin_base_mutex);
+
+		prepare_thin_base(b);
+
+		pthread_mutex_lock(&thin_base_mutex);
+		b->ready = 1;
+		pthread_cond_broadcast(&thin_base_ready);
+		pthread_mutex_unlock(&thin_base_mutex);
+	}
+	return NULL;
+}
+
+static void start_thin_base_threads(void)
+{
+	int i;
+
+	enable_obj_read_lock();
+	pthread_mutex_init(&thin_base_mutex, NULL);
+	pthread_cond_init(&thin_base_ready, NULL);
+	pthread_cond_init(&thin_base_space, NULL);
+
+	nr_thin_base_threads = nr_threads > 1 ? nr_threads : 1;
+	CALLOC_ARRAY(thin_base_threads, nr_thin_base_threads);
+	for (i = 0; i < nr_thin_base_threads; i++) {
+		int ret = pthread_create(&thin_base_threads[i], NULL,
+					 thin_base_worker, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+/* Wait for the next base in order, and let the workers go further. */
+static struct thin_base *take_thin_base(void)
+{
+	struct thin_base *b = &thin_bases[thin_bases_consumed];
+
+	pthread_mutex_lock(&thin_base_mutex);
+	while (!b->ready)
+		pthread_cond_wait(&thin_base_ready, &thin_base_mutex);
+	thin_bases_consumed++;
+	pthread_cond_broadcast(&thin_base_space);
+	pthread_mutex_unlock(&thin_base_mutex);
+	return b;
+}
+
+static void finish_thin_base_threads(void)
+{
+	int i;
+
+	for (i = 0; i < nr_thin_base_threads; i++)
+		pthread_join(thin_base_threads[i], NULL);
+	FREE_AND_NULL(thin_base_threads);
+	nr_thin_base_threads = 0;
+	pthread_cond_destroy(&thin_base_space);
+	pthread_cond_destroy(&thin_base_ready);
+	pthread_mutex_destroy(&thin_base_mutex);
+	disable_obj_read_lock();
+	FREE_AND_NULL(thin_bases);
+}
+
 static void fix_unresolved_deltas(struct hashfile *f)
 {
 	struct ref_delta_entry **sorted_by_pos;
+	struct oidset seen = OIDSET_INIT;
+	int *base_nr = NULL;
 	int i;
 
 	/*
@@ -1405,35 +1654,61 @@ static void fix_unresolved_deltas(struct hashfile *f)
 		promisor_remote_get_direct(the_repository,
 					   to_fetch.oid, to_fetch.nr);
 		oid_array_clear(&to_fetch);
+	} else if (nr_ref_deltas > 1 &&
+		   (nr_threads > 1 || getenv("GIT_FORCE_THREADS"))) {
+		/*
+		 * Have the workers prepare the first delta against each
+		 * base; a later delta against the same base is resolved
+		 * by the time it comes up.
+		 */
+		CALLOC_ARRAY(thin_bases, nr_ref_deltas);
+		ALLOC_ARRAY(base_nr, nr_ref_deltas);
+		nr_thin_bases = thin_bases_taken = thin_bases_consumed = 0;
+		for (i = 0; i < nr_ref_deltas; i++) {
+			const struct object_id *oid = &sorted_by_pos[i]->oid;
+
+			if (oidset_insert(&seen, oid)) {
+				base_nr[i] = -1;
+				continue;
+			}
+			base_nr[i] = nr_thin_bases;
+			thin_bases[nr_thin_bases++].oid = oid;
+		}
+		oidset_clear(&seen);
+		start_thin_base_threads();
 	}
 
 	for (i = 0; i < nr_ref_deltas; i++) {
 		struct ref_delta_entry *d = sorted_by_pos[i];
-		enum object_type type;
-		void *data;
-		unsigned long size;
+		struct thin_base local = { .oid = &d->oid }, *b = &local;
 
-		if (objects[d->obj_no].real_type != OBJ_REF_DELTA)
+		if (base_nr && base_nr[i] >= 0)
+			b = take_thin_base();
+
+		if (objects[d->obj_no].real_type != OBJ_REF_DELTA) {
+			free(b->zdata);
 			continue;
-		data = read_object_file(&d->oid, &type, &size);
-		if (!data)
+		}
+		if (b == &local)
+			prepare_thin_base(b);
+		if (!b->zdata)
 			continue;
 
-		if (check_object_signature(the_repository, &d->oid,
-					   data, size,
-					   type_name(type)))
-			die(_("local object %s is corrupt"), oid_to_hex(&d->oid));
-
 		/*
 		 * Add this as an object to the objects array and call
 		 * threaded_second_pass() (which will pick up the added
 		 * object).
 		 */
-		append_obj_to_pack(f, d->oid.hash, data, size, type);
+		append_obj_to_pack(f, d->oid.hash, b->zdata, b->zsize,
+				   b->size, b->type);
+		FREE_AND_NULL(b->zdata);
 		threaded_second_pass(NULL);
 
 		display_progress(progress, nr_resolved_deltas);
 	}
+	if (base_nr)
+		finish_thin_base_threads();
+	free(base_nr);
 	free(sorted_by_pos);
 }
 
@@ -1483,6 +1758,38 @@ static void write_special_file(const char *suffix, const char *msg,
 	strbuf_release(&name_buf);
 }
 
+/*
+ * The objects[] array is in pack order, so the reverse index does not
+ * need to be sorted: the index position of objects[i] is the i-th
+ * entry. Thin packs are completed by appending to the pack, so they
+ * keep that order, but fall back to sorting should it ever not hold.
+ * The idx entries are the first members of the objects they belong to.
+ */
+static const char *write_rev_index(const char *rev_index_name,
+				   struct pack_idx_entry **idx_objects,
+				   const unsigned char *pack_hash,
+				   unsigned flags)
+{
+	uint32_t *pack_order;
+	const char *ret;
+	int i;
+
+	for (i = 1; i < nr_objects; i++)
+		if (objects[i].idx.offset <= objects[i - 1].idx.offset)
+			return write_rev_file(rev_index_name, idx_objects,
+					      nr_objects, pack_hash, flags);
+
+	ALLOC_ARRAY(pack_order, nr_objects);
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *obj = (struct object_entry *)idx_objects[i];
+		pack_order[obj - objects] = i;
+	}
+	ret = write_rev_file_order(rev_index_name, pack_order, nr_objects,
+				   pack_hash, flags);
+	free(pack_order);
+	return ret;
+}
+
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
 		  const char *final_rev_index_name, const char *curr_rev_index_name,
@@ -1919,9 +2226,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_hash);
 	if (rev_index)
-		curr_rev_index = write_rev_file(rev_index_name, idx_objects,
-						nr_objects, pack_hash,
-						opts.flags);
+		curr_rev_index = write_rev_index(rev_index_name, idx_objects,
+						 pack_hash, opts.flags);
 	free(idx_objects);
 
 	if (!verify)
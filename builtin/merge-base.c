@@ -34,6 +34,7 @@ static const char * const merge_base_usage[] = {
 	N_("git merge-base --independent <commit>..."),
 	N_("git merge-base --is-ancestor <commit> <commit>"),
 	N_("git merge-base --fork-point <ref> [<commit>]"),
+	N_("git merge-base [-a | --all] --batch"),
 	NULL
 };
 
@@ -132,6 +133,50 @@ static int handle_fork_point(int argc, const char **argv)
 	return 0;
 }
 
+static int handle_batch(int show_all)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct commit **one = NULL, **two = NULL;
+	struct commit_list **result;
+	size_t nr = 0, alloc_one = 0, alloc_two = 0, i;
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		const char *sp = strchr(line.buf, ' ');
+
+		if (!sp)
+			die("--batch expects two commits per line, got '%s'",
+			    line.buf);
+		ALLOC_GROW(one, nr + 1, alloc_one);
+		ALLOC_GROW(two, nr + 1, alloc_two);
+		two[nr] = get_commit_reference(sp + 1);
+		strbuf_setlen(&line, sp - line.buf);
+		one[nr] = get_commit_reference(line.buf);
+		nr++;
+	}
+	strbuf_release(&line);
+
+	CALLOC_ARRAY(result, nr);
+	repo_get_merge_bases_batch(the_repository, one, two, nr, result);
+
+	for (i = 0; i < nr; i++) {
+		struct commit_list *r;
+
+		for (r = result[i]; r; r = r->next) {
+			fputs(oid_to_hex(&r->item->object.oid), stdout);
+			if (!show_all || !r->next)
+				break;
+			putchar(' ');
+		}
+		putchar('\n');
+		free_commit_list(result[i]);
+	}
+
+	free(result);
+	free(one);
+	free(two);
+	return 0;
+}
+
 int cmd_merge_base(int argc, const char **argv, const char *prefix)
 {
 	struct commit **rev;
@@ -149,6 +194,8 @@ int cmd_merge_base(int argc, const char **argv, const char *prefix)
 			    N_("is the first one ancestor of the other?"), 'a'),
 		OPT_CMDMODE(0, "fork-point", &cmdmode,
 			    N_("find where <commit> forked from reflog of <ref>"), 'f'),
+		OPT_CMDMODE(0, "batch", &cmdmode,
+			    N_("read pairs of commits from stdin"), 'b'),
 		OPT_END()
 	};
 
@@ -163,6 +210,12 @@ int cmd_merge_base(int argc, const char **argv, const char *prefix)
 		return handle_is_ancestor(argc, argv);
 	}
 
+	if (cmdmode == 'b') {
+		if (argc)
+			usage_with_options(merge_base_usage, options);
+		return handle_batch(show_all);
+	}
+
 	if (cmdmode == 'r' && show_all)
 		die("--independent cannot be used with --all");
 
@@ -8,8 +8,11 @@
 #include "exec-cmd.h"
 #include "merge-blobs.h"
 #include "config.h"
-
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+#include "parse-options.h"
+#include "commit.h"
+#include "merge-ort.h"
+#include "quote.h"
+#include "string-list.h"
 
 struct merge_list {
 	struct merge_list *next;
@@ -29,7 +32,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -229,7 +232,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(r, t + 2, ENTRY_OID(n + 2));
 #undef ENTRY_OID
 
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -346,7 +349,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -370,20 +373,18 @@ static void *get_tree_descriptor(struct repository *r,
 	return buf;
 }
 
-int cmd_merge_tree(int argc, const char **argv, const char *prefix)
+static int trivial_merge(const char *base,
+			 const char *branch1,
+			 const char *branch2)
 {
 	struct repository *r = the_repository;
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
 
-	if (argc != 4)
-		usage(merge_tree_usage);
-
-	git_config(git_default_config, NULL);
-	buf1 = get_tree_descriptor(r, t+0, argv[1]);
-	buf2 = get_tree_descriptor(r, t+1, argv[2]);
-	buf3 = get_tree_descriptor(r, t+2, argv[3]);
-	merge_trees(t, "");
+	buf1 = get_tree_descriptor(r, t+0, base);
+	buf2 = get_tree_descriptor(r, t+1, branch1);
+	buf3 = get_tree_descriptor(r, t+2, branch2);
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
@@ -391,3 +392,127 @@ int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 	show_result();
 	return 0;
 }
+
+enum mode {
+	MODE_UNKNOWN,
+	MODE_TRIVIAL,
+	MODE_REAL,
+};
+
+struct merge_tree_options {
+	int mode;
+	int show_messages;
+	int name_only;
+	int line_termination;
+};
+
+static struct commit *get_branch_commit(const char *name)
+{
+	struct commit *commit;
+
+	commit = lookup_commit_reference_by_name(name);
+	if (!commit)
+		die(_("could not parse as commit '%s'"), name);
+	return commit;
+}
+
+static int real_merge(struct merge_tree_options *o,
+		      const char *branch1, const char *branch2)
+{
+	struct commit *parent1 = get_branch_commit(branch1);
+	struct commit *parent2 = get_branch_commit(branch2);
+	struct merge_options opt;
+	struct merge_result result = { 0 };
+
+	init_merge_options(&opt, the_repository);
+	opt.show_rename_progress = 0;
+	opt.branch1 = branch1;
+	opt.branch2 = branch2;
+
+	/* with no merge bases given, merge-ort finds them itself */
+	merge_incore_recursive(&opt, NULL, parent1, parent2, &result);
+	if (result.clean < 0)
+		die(_("failure to merge"));
+
+	if (o->show_messages == -1)
+		o->show_messages = !result.clean;
+
+	printf("%s%c", oid_to_hex(&result.tree->object.oid),
+	       o->line_termination);
+	if (!result.clean) {
+		struct string_list conflicted_files = STRING_LIST_INIT_NODUP;
+		const char *last = NULL;
+		int i;
+
+		merge_get_conflicted_files(&result, &conflicted_files);
+		for (i = 0; i < conflicted_files.nr; i++) {
+			const char *name = conflicted_files.items[i].string;
+			struct stage_info *c = conflicted_files.items[i].util;
+
+			if (o->name_only) {
+				if (last && !strcmp(last, name))
+					continue;
+				last = name;
+			} else {
+				printf("%06o %s %d\t", c->mode,
+				       oid_to_hex(&c->oid), c->stage);
+			}
+			write_name_quoted_relative(name, NULL, stdout,
+						   o->line_termination);
+		}
+		string_list_clear(&conflicted_files, 1);
+	}
+	if (o->show_messages) {
+		putchar(o->line_termination);
+		fflush(stdout);
+	}
+	merge_switch_to_result(&opt, NULL, &result, 0, o->show_messages);
+	return !result.clean;
+}
+
+int cmd_merge_tree(int argc, const char **argv, const char *prefix)
+{
+	struct merge_tree_options o = { .show_messages = -1 };
+	int expected_remaining_argc;
+	int line_termination = '\n';
+
+	const char * const merge_tree_usage[] = {
+		N_("git merge-tree [--write-tree] [<options>] <branch1> <branch2>"),
+		N_("git merge-tree [--trivial-merge] <base-tree> <branch1> <branch2>"),
+		NULL
+	};
+	struct option mt_options[] = {
+		OPT_CMDMODE(0, "write-tree", &o.mode,
+			    N_("do a real merge instead of a trivial merge"),
+			    MODE_REAL),
+		OPT_CMDMODE(0, "trivial-merge", &o.mode,
+			    N_("do a trivial merge only"), MODE_TRIVIAL),
+		OPT_BOOL(0, "messages", &o.show_messages,
+			 N_("also show informational/conflict messages")),
+		OPT_BOOL(0, "name-only", &o.name_only,
+			 N_("list filenames without modes/oids/stages")),
+		OPT_SET_INT('z', NULL, &line_termination,
+			    N_("separate paths with the NUL character"), '\0'),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, mt_options,
+			     merge_tree_usage, PARSE_OPT_STOP_AT_NON_OPTION);
+	o.line_termination = line_termination;
+
+	/* the mode defaults to the one the number of arguments asks for */
+	if (o.mode == MODE_UNKNOWN)
+		o.mode = argc == 2 ? MODE_REAL : MODE_TRIVIAL;
+	expected_remaining_argc = (o.mode == MODE_REAL ? 2 : 3);
+	if (argc != expected_remaining_argc)
+		usage_with_options(merge_tree_usage, mt_options);
+	if (o.mode == MODE_TRIVIAL &&
+	    (o.show_messages != -1 || o.name_only || !line_termination))
+		die(_("--trivial-merge is incompatible with all other options"));
+
+	git_config(git_default_config, NULL);
+	if (o.mode == MODE_TRIVIAL)
+		return trivial_merge(argv[0], argv[1], argv[2]);
+
+	return real_merge(&o, argv[0], argv[1]) ? 1 : 0;
+}
@@ -7,7 +7,7 @@
 #include "object-store.h"
 
 #define BUILTIN_MIDX_WRITE_USAGE \
-	N_("git multi-pack-index [<options>] write [--preferred-pack=<pack>]")
+	N_("git multi-pack-index [<options>] write [--preferred-pack=<pack>] [--[no-]bitmap] [--incremental]")
 
 #define BUILTIN_MIDX_VERIFY_USAGE \
 	N_("git multi-pack-index [<options>] verify")
@@ -68,6 +68,11 @@ static int cmd_multi_pack_index_write(int argc, const char **argv)
 		OPT_STRING(0, "preferred-pack", &opts.preferred_pack,
 			   N_("preferred-pack"),
 			   N_("pack for reuse when computing a multi-pack bitmap")),
+		OPT_BIT(0, "bitmap", &opts.flags, N_("write multi-pack bitmap"),
+			MIDX_WRITE_BITMAP | MIDX_WRITE_REV_INDEX),
+		OPT_BIT(0, "incremental", &opts.flags,
+			N_("write a new layer on top of the multi-pack-index chain"),
+			MIDX_WRITE_INCREMENTAL),
 		OPT_END(),
 	};
 
@@ -84,6 +89,10 @@ static int cmd_multi_pack_index_write(int argc, const char **argv)
 
 	FREE_AND_NULL(options);
 
+	if ((opts.flags & MIDX_WRITE_INCREMENTAL) &&
+	    (opts.flags & MIDX_WRITE_BITMAP))
+		die(_("--bitmap and --incremental are mutually exclusive"));
+
 	return write_midx_file(opts.object_dir, opts.preferred_pack,
 			       opts.flags);
 }
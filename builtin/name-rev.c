@@ -9,6 +9,7 @@
 #include "prio-queue.h"
 #include "hash-lookup.h"
 #include "commit-slab.h"
+#include "commit-graph.h"
 
 /*
  * One day.  See the 'name a rev shortly after epoch' test in t6120 when
@@ -27,11 +28,29 @@ struct rev_name {
 define_commit_slab(commit_rev_name, struct rev_name);
 
 static timestamp_t cutoff = TIME_MAX;
+static timestamp_t generation_cutoff = GENERATION_NUMBER_INFINITY;
 static struct commit_rev_name rev_names;
 
+/* The commits to name, unless all of them are (--all, --stdin). */
+static struct commit **wanted;
+static size_t wanted_nr, wanted_alloc;
+
 /* How many generations are maximally preferred over _one_ merge traversal? */
 #define MERGE_TRAVERSAL_WEIGHT 65535
 
+/*
+ * Commits with a lower generation number than all of the commits to
+ * name cannot reach any of them; without generation numbers, fall back
+ * on the (slopped) commit dates.
+ */
+static int commit_is_before_cutoff(struct commit *commit)
+{
+	if (generation_cutoff < GENERATION_NUMBER_INFINITY)
+		return generation_cutoff &&
+			commit_graph_generation(commit) < generation_cutoff;
+	return commit->date < cutoff;
+}
+
 static int is_valid_rev_name(const struct rev_name *name)
 {
 	return name && (name->generation || name->tip_name);
@@ -142,7 +161,7 @@ static void name_rev(struct commit *start_commit,
 	struct rev_name *start_name;
 
 	parse_commit(start_commit);
-	if (start_commit->date < cutoff)
+	if (commit_is_before_cutoff(start_commit))
 		return;
 
 	start_name = create_or_update_name(start_commit, taggerdate, 0, 0,
@@ -172,7 +191,7 @@ static void name_rev(struct commit *start_commit,
 			int generation, distance;
 
 			parse_commit(parent);
-			if (parent->date < cutoff)
+			if (commit_is_before_cutoff(parent))
 				continue;
 
 			if (parent_number > 1) {
@@ -372,6 +391,23 @@ static int name_ref(const char *path, const struct object_id *oid, int flags, vo
 	return 0;
 }
 
+/*
+ * Whether the reachability index of the commit-graph says that "tip"
+ * cannot reach any of the commits to name, so that the walk from it
+ * would only name commits nobody asked about.
+ */
+static int tip_is_useless(struct commit *tip)
+{
+	size_t i;
+
+	if (!wanted_nr)
+		return 0;
+	for (i = 0; i < wanted_nr; i++)
+		if (commit_graph_can_reach(the_repository, tip, wanted[i]))
+			return 0;
+	return 1;
+}
+
 static void name_tips(void)
 {
 	int i;
@@ -383,7 +419,7 @@ static void name_tips(void)
 	QSORT(tip_table.table, tip_table.nr, cmp_by_tag_and_age);
 	for (i = 0; i < tip_table.nr; i++) {
 		struct tip_table_entry *e = &tip_table.table[i];
-		if (e->commit) {
+		if (e->commit && !tip_is_useless(e->commit)) {
 			name_rev(e->commit, e->refname, e->taggerdate,
 				 e->from_tag, e->deref);
 		}
@@ -549,8 +585,10 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 		error("Specify either a list, or --all, not both!");
 		usage_with_options(name_rev_usage, opts);
 	}
-	if (all || transform_stdin)
+	if (all || transform_stdin) {
 		cutoff = 0;
+		generation_cutoff = 0;
+	}
 
 	for (; argc; argc--, argv++) {
 		struct object_id oid;
@@ -579,8 +617,14 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 		}
 
 		if (commit) {
+			timestamp_t generation = commit_graph_generation(commit);
+
 			if (cutoff > commit->date)
 				cutoff = commit->date;
+			if (generation_cutoff > generation)
+				generation_cutoff = generation;
+			ALLOC_GROW(wanted, wanted_nr + 1, wanted_alloc);
+			wanted[wanted_nr++] = commit;
 		}
 
 		if (peel_tag) {
@@ -594,6 +638,8 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 		add_object_array(object, *argv, &revs);
 	}
 
+	if (!generation_numbers_enabled(the_repository))
+		generation_cutoff = GENERATION_NUMBER_INFINITY;
 	if (cutoff) {
 		/* check for undeflow */
 		if (cutoff > TIME_MIN + CUTOFF_DATE_SLOP)
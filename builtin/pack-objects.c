@@ -34,8 +34,10 @@
 #include "dir.h"
 #include "midx.h"
 #include "trace2.h"
+#include "json-writer.h"
 #include "shallow.h"
 #include "promisor-remote.h"
+#include "pack-mtimes.h"
 
 /*
  * Objects we are going to pack are collected in the `to_pack` structure.
@@ -99,8 +101,10 @@ static inline struct object_entry *oe_delta_sibling(
 		const struct packing_data *pack,
 		const struct object_entry *e)
 {
-	if (e->delta_sibling_idx)
-		return &pack->objects[e->delta_sibling_idx - 1];
+	uint32_t sibling = pack->delta_sibling[e - pack->objects];
+
+	if (sibling)
+		return &pack->objects[sibling - 1];
 	return NULL;
 }
 
@@ -128,9 +132,9 @@ static inline void oe_set_delta_sibling(struct packing_data *pack,
 					struct object_entry *delta)
 {
 	if (delta)
-		e->delta_sibling_idx = (delta - pack->objects) + 1;
+		pack->delta_sibling[e - pack->objects] = (delta - pack->objects) + 1;
 	else
-		e->delta_sibling_idx = 0;
+		pack->delta_sibling[e - pack->objects] = 0;
 }
 
 static inline void oe_set_size(struct packing_data *pack,
@@ -194,6 +198,8 @@ static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static timestamp_t unpack_unreachable_expiration;
 static int pack_loose_unreachable;
+static int cruft;
+static timestamp_t cruft_expiration;
 static int local;
 static int have_non_local_packs;
 static int incremental;
@@ -229,13 +235,24 @@ static uint16_t write_bitmap_options = BITMAP_OPT_HASH_CACHE;
 
 static int exclude_promisor_objects;
 
+static int name_hash_version = 1;
+
+static inline uint32_t get_name_hash(const char *name)
+{
+	if (name_hash_version == 2)
+		return pack_full_name_hash(name);
+	return pack_name_hash(name);
+}
+
 static int use_delta_islands;
+static int delta_candidates;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = DEFAULT_DELTA_CACHE_SIZE;
 static unsigned long cache_max_small_delta_size = 1000;
 
 static unsigned long window_memory_limit = 0;
+static unsigned long pack_memory_limit;
 
 static struct list_objects_filter_options filter_options;
 
@@ -281,20 +298,20 @@ static void index_commit_for_bitmap(struct commit *commit)
 	indexed_commits[indexed_commits_nr++] = commit;
 }
 
-static void *get_delta(struct object_entry *entry)
+static void *get_delta(struct object_entry *entry, struct object_entry *base)
 {
 	unsigned long size, base_size, delta_size;
 	void *buf, *base_buf, *delta_buf;
 	enum object_type type;
 
+	packing_data_lock(&to_pack);
 	buf = read_object_file(&entry->idx.oid, &type, &size);
 	if (!buf)
 		die(_("unable to read %s"), oid_to_hex(&entry->idx.oid));
-	base_buf = read_object_file(&DELTA(entry)->idx.oid, &type,
-				    &base_size);
+	base_buf = read_object_file(&base->idx.oid, &type, &base_size);
+	packing_data_unlock(&to_pack);
 	if (!base_buf)
-		die("unable to read %s",
-		    oid_to_hex(&DELTA(entry)->idx.oid));
+		die("unable to read %s", oid_to_hex(&base->idx.oid));
 	delta_buf = diff_delta(base_buf, base_size,
 			       buf, size, &delta_size, 0);
 	/*
@@ -347,7 +364,9 @@ static unsigned long write_large_blob_data(struct git_istream *st, struct hashfi
 	for (;;) {
 		ssize_t readlen;
 		int zret = Z_OK;
+		packing_data_lock(&to_pack);
 		readlen = read_istream(st, ibuf, sizeof(ibuf));
+		packing_data_unlock(&to_pack);
 		if (readlen == -1)
 			die(_("unable to read %s"), oid_to_hex(oid));
 
@@ -433,6 +452,322 @@ static inline int oe_size_greater_than(struct packing_data *pack,
 	return oe_get_size_slow(pack, lhs) > rhs;
 }
 
+static int want_reuse_object(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!IN_PACK(entry))
+		return 0;	/* can't reuse what we don't have */
+	else if (oe_type(entry) == OBJ_REF_DELTA ||
+		 oe_type(entry) == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (oe_type(entry) != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (DELTA(entry))
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+/*
+ * Read an object we cannot reuse and deflate it, or, when "base" is
+ * given, deflate its delta against "base": the cached "delta_data"
+ * the caller took over from the entry, or a freshly recomputed one if
+ * that is NULL.  Large blobs are not read at all; "*st" is set to a
+ * stream for them instead, and NULL is returned.
+ *
+ * For deltas, "*type" is left alone, as whether we can use an
+ * OFS_DELTA depends on the base having been written already.
+ */
+static void *read_and_compress_object(struct object_entry *entry,
+				      struct object_entry *base,
+				      void *delta_data,
+				      enum object_type *type,
+				      unsigned long *size,
+				      unsigned long *datalen,
+				      struct git_istream **st)
+{
+	void *buf;
+
+	*st = NULL;
+	if (!base) {
+		if (oe_type(entry) == OBJ_BLOB &&
+		    oe_size_greater_than(&to_pack, entry, big_file_threshold)) {
+			packing_data_lock(&to_pack);
+			*st = open_istream(the_repository, &entry->idx.oid,
+					   type, size, NULL);
+			packing_data_unlock(&to_pack);
+		}
+		if (*st)
+			buf = NULL;
+		else {
+			packing_data_lock(&to_pack);
+			buf = read_object_file(&entry->idx.oid, type, size);
+			packing_data_unlock(&to_pack);
+			if (!buf)
+				die(_("unable to read %s"),
+				    oid_to_hex(&entry->idx.oid));
+		}
+	} else if (delta_data) {
+		*size = DELTA_SIZE(entry);
+		buf = delta_data;
+	} else {
+		buf = get_delta(entry, base);
+		*size = DELTA_SIZE(entry);
+	}
+
+	if (*st)	/* large blob case, just assume we don't compress well */
+		*datalen = *size;
+	else if (base && entry->z_delta_size)
+		*datalen = entry->z_delta_size;
+	else
+		*datalen = do_compress(&buf, *size);
+	return buf;
+}
+
+/*
+ * When writing a pack in one go, worker threads walk ahead of
+ * write_pack_file() in write order and read and deflate the objects
+ * that cannot be reused, so that the writer only has to append the
+ * results to the hashfile and record their offsets.  The workers stay
+ * within a bounded number of objects and bytes ahead of the writer.
+ *
+ * The writer takes an object's result with take_compressed_object();
+ * if no worker has started on it yet, it is marked as taken and the
+ * writer compresses it itself.
+ */
+struct compressed_object {
+	void *buf;
+	unsigned long size;
+	unsigned long datalen;
+	enum object_type type;
+	int usable_delta;
+};
+
+enum compress_state {
+	COMPRESS_PENDING = 0,
+	COMPRESS_BUSY,
+	COMPRESS_DONE,
+	COMPRESS_TAKEN
+};
+
+#define WRITE_PIPELINE_OBJECTS 256
+#define WRITE_PIPELINE_BYTES (16 * 1024 * 1024)
+
+static int write_pipeline_active;
+static int write_pipeline_nr_threads;
+static pthread_t *write_pipeline_threads;
+static pthread_mutex_t write_pipeline_mutex;
+static pthread_cond_t write_pipeline_cond;
+static struct object_entry **write_pipeline_order;
+static uint32_t write_pipeline_nr, write_pipeline_next, write_pipeline_pos;
+static unsigned long write_pipeline_bytes, write_pipeline_max_bytes;
+static int write_pipeline_done;
+static struct compressed_object **compressed_objects;
+static unsigned char *compress_state;
+
+/*
+ * Called with write_pipeline_mutex held, as write_one() may drop the
+ * delta of any entry that is not busy.
+ */
+static int want_compress_ahead(struct object_entry *entry,
+			       struct object_entry *base)
+{
+	if (entry->preferred_base)
+		return 0;
+	if (want_reuse_object(entry, !!base))
+		return 0;
+	if (base)
+		return !entry->z_delta_size;
+	return !(oe_type(entry) == OBJ_BLOB &&
+		 oe_size_greater_than(&to_pack, entry, big_file_threshold));
+}
+
+static void *write_pipeline_worker(void *data)
+{
+	pthread_mutex_lock(&write_pipeline_mutex);
+	for (;;) {
+		struct object_entry *entry;
+		struct compressed_object *c;
+		struct object_entry *base;
+		struct git_istream *st;
+		void *delta_data;
+		uint32_t idx;
+
+		while (!write_pipeline_done &&
+		       write_pipeline_next < write_pipeline_nr &&
+		       (write_pipeline_next >= write_pipeline_pos + WRITE_PIPELINE_OBJECTS ||
+			write_pipeline_bytes >= write_pipeline_max_bytes))
+			pthread_cond_wait(&write_pipeline_cond, &write_pipeline_mutex);
+		if (write_pipeline_done || write_pipeline_next >= write_pipeline_nr)
+			break;
+
+		entry = write_pipeline_order[write_pipeline_next++];
+		idx = entry - to_pack.objects;
+		if (compress_state[idx] != COMPRESS_PENDING)
+			continue;
+		base = DELTA(entry);
+		if (!want_compress_ahead(entry, base))
+			continue;
+		delta_data = entry->delta_data;
+		entry->delta_data = NULL;
+		if (!base) {
+			/* no delta data from before a pack split */
+			FREE_AND_NULL(delta_data);
+			entry->z_delta_size = 0;
+		}
+		compress_state[idx] = COMPRESS_BUSY;
+		pthread_mutex_unlock(&write_pipeline_mutex);
+
+		CALLOC_ARRAY(c, 1);
+		c->usable_delta = !!base;
+		c->buf = read_and_compress_object(entry, base, delta_data,
+						  &c->type, &c->size,
+						  &c->datalen, &st);
+		if (st)
+			BUG("large blob %s compressed ahead of time",
+			    oid_to_hex(&entry->idx.oid));
+
+		pthread_mutex_lock(&write_pipeline_mutex);
+		compressed_objects[idx] = c;
+		compress_state[idx] = COMPRESS_DONE;
+		write_pipeline_bytes += c->datalen;
+		pthread_cond_broadcast(&write_pipeline_cond);
+	}
+	pthread_mutex_unlock(&write_pipeline_mutex);
+	return NULL;
+}
+
+/*
+ * Without a pack size limit, everything goes into a single pack, so
+ * whether an object is written as a delta is known ahead of time.
+ */
+static void start_write_pipeline(struct object_entry **write_order,
+				 uint32_t nr)
+{
+	int i;
+
+	if (pack_size_limit || delta_search_threads <= 1 || nr < 2)
+		return;
+
+	write_pipeline_nr_threads = delta_search_threads;
+	write_pipeline_order = write_order;
+	write_pipeline_nr = nr;
+	write_pipeline_next = write_pipeline_pos = 0;
+	write_pipeline_bytes = 0;
+	write_pipeline_max_bytes = st_mult(WRITE_PIPELINE_BYTES,
+					   write_pipeline_nr_threads);
+	if (pack_memory_limit &&
+	    write_pipeline_max_bytes > pack_memory_limit - max_delta_cache_size)
+		write_pipeline_max_bytes = pack_memory_limit - max_delta_cache_size;
+	write_pipeline_done = 0;
+	CALLOC_ARRAY(compressed_objects, to_pack.nr_objects);
+	CALLOC_ARRAY(compress_state, to_pack.nr_objects);
+	CALLOC_ARRAY(write_pipeline_threads, write_pipeline_nr_threads);
+	pthread_mutex_init(&write_pipeline_mutex, NULL);
+	pthread_cond_init(&write_pipeline_cond, NULL);
+
+	for (i = 0; i < write_pipeline_nr_threads; i++) {
+		int ret = pthread_create(&write_pipeline_threads[i], NULL,
+					 write_pipeline_worker, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	write_pipeline_active = 1;
+}
+
+static void stop_write_pipeline(void)
+{
+	uint32_t i;
+
+	if (!write_pipeline_active)
+		return;
+
+	pthread_mutex_lock(&write_pipeline_mutex);
+	write_pipeline_done = 1;
+	pthread_cond_broadcast(&write_pipeline_cond);
+	pthread_mutex_unlock(&write_pipeline_mutex);
+	for (i = 0; i < write_pipeline_nr_threads; i++)
+		pthread_join(write_pipeline_threads[i], NULL);
+	write_pipeline_active = 0;
+
+	for (i = 0; i < to_pack.nr_objects; i++) {
+		if (compressed_objects[i]) {
+			free(compressed_objects[i]->buf);
+			free(compressed_objects[i]);
+		}
+	}
+	FREE_AND_NULL(compressed_objects);
+	FREE_AND_NULL(compress_state);
+	FREE_AND_NULL(write_pipeline_threads);
+	pthread_cond_destroy(&write_pipeline_cond);
+	pthread_mutex_destroy(&write_pipeline_mutex);
+}
+
+/* Let the workers know that everything before "pos" has been written. */
+static void advance_write_pipeline(uint32_t pos)
+{
+	if (!write_pipeline_active)
+		return;
+	pthread_mutex_lock(&write_pipeline_mutex);
+	write_pipeline_pos = pos;
+	pthread_cond_broadcast(&write_pipeline_cond);
+	pthread_mutex_unlock(&write_pipeline_mutex);
+}
+
+static struct compressed_object *take_compressed_object(struct object_entry *entry,
+							int usable_delta)
+{
+	struct compressed_object *c = NULL;
+	uint32_t idx = entry - to_pack.objects;
+
+	if (!write_pipeline_active)
+		return NULL;
+
+	pthread_mutex_lock(&write_pipeline_mutex);
+	while (compress_state[idx] == COMPRESS_BUSY)
+		pthread_cond_wait(&write_pipeline_cond, &write_pipeline_mutex);
+	if (compress_state[idx] == COMPRESS_DONE) {
+		c = compressed_objects[idx];
+		compressed_objects[idx] = NULL;
+		write_pipeline_bytes -= c->datalen;
+		pthread_cond_broadcast(&write_pipeline_cond);
+	}
+	compress_state[idx] = COMPRESS_TAKEN;
+	pthread_mutex_unlock(&write_pipeline_mutex);
+
+	/* write_one() may have dropped a recursive delta meanwhile */
+	if (c && c->usable_delta != usable_delta) {
+		free(c->buf);
+		FREE_AND_NULL(c);
+	}
+	return c;
+}
+
+/*
+ * write_one() found "entry" to be part of a delta cycle; wait for any
+ * worker looking at it to finish before dropping its delta.
+ */
+static void drop_write_delta(struct object_entry *entry)
+{
+	uint32_t idx = entry - to_pack.objects;
+
+	if (!write_pipeline_active) {
+		SET_DELTA(entry, NULL);
+		return;
+	}
+
+	pthread_mutex_lock(&write_pipeline_mutex);
+	while (compress_state[idx] == COMPRESS_BUSY)
+		pthread_cond_wait(&write_pipeline_cond, &write_pipeline_mutex);
+	SET_DELTA(entry, NULL);
+	pthread_mutex_unlock(&write_pipeline_mutex);
+}
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct hashfile *f, struct object_entry *entry,
 					   unsigned long limit, int usable_delta)
@@ -444,45 +779,35 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	enum object_type type;
 	void *buf;
 	struct git_istream *st = NULL;
+	struct compressed_object *c;
 	const unsigned hashsz = the_hash_algo->rawsz;
 
-	if (!usable_delta) {
-		if (oe_type(entry) == OBJ_BLOB &&
-		    oe_size_greater_than(&to_pack, entry, big_file_threshold) &&
-		    (st = open_istream(the_repository, &entry->idx.oid, &type,
-				       &size, NULL)) != NULL)
-			buf = NULL;
-		else {
-			buf = read_object_file(&entry->idx.oid, &type, &size);
-			if (!buf)
-				die(_("unable to read %s"),
-				    oid_to_hex(&entry->idx.oid));
-		}
+	c = take_compressed_object(entry, usable_delta);
+	if (c) {
+		buf = c->buf;
+		size = c->size;
+		datalen = c->datalen;
+		type = c->type;
+		free(c);
+	} else if (usable_delta) {
+		void *delta_data = entry->delta_data;
+
+		entry->delta_data = NULL;
+		buf = read_and_compress_object(entry, DELTA(entry), delta_data,
+					       &type, &size, &datalen, &st);
+	} else {
 		/*
 		 * make sure no cached delta data remains from a
 		 * previous attempt before a pack split occurred.
 		 */
 		FREE_AND_NULL(entry->delta_data);
 		entry->z_delta_size = 0;
-	} else if (entry->delta_data) {
-		size = DELTA_SIZE(entry);
-		buf = entry->delta_data;
-		entry->delta_data = NULL;
-		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
-			OBJ_OFS_DELTA : OBJ_REF_DELTA;
-	} else {
-		buf = get_delta(entry);
-		size = DELTA_SIZE(entry);
+		buf = read_and_compress_object(entry, NULL, NULL, &type,
+					       &size, &datalen, &st);
+	}
+	if (usable_delta)
 		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
-	}
-
-	if (st)	/* large blob case, just assume we don't compress well */
-		datalen = size;
-	else if (entry->z_delta_size)
-		datalen = entry->z_delta_size;
-	else
-		datalen = do_compress(&buf, size);
 
 	/*
 	 * The object header is a byte of 'type' followed by zero or
@@ -567,6 +892,8 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 	hdrlen = encode_in_pack_object_header(header, sizeof(header),
 					      type, entry_size);
 
+	/* pipeline workers may be reading packs at the same time */
+	packing_data_lock(&to_pack);
 	offset = entry->in_pack_offset;
 	if (offset_to_pack_pos(p, offset, &pos) < 0)
 		die(_("write_reuse_object: could not locate %s, expected at "
@@ -580,6 +907,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
+		packing_data_unlock(&to_pack);
 		return write_no_reuse_object(f, entry, limit, usable_delta);
 	}
 
@@ -591,6 +919,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("corrupt packed object for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
+		packing_data_unlock(&to_pack);
 		return write_no_reuse_object(f, entry, limit, usable_delta);
 	}
 
@@ -602,6 +931,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 			dheader[--pos] = 128 | (--ofs & 127);
 		if (limit && hdrlen + sizeof(dheader) - pos + datalen + hashsz >= limit) {
 			unuse_pack(&w_curs);
+			packing_data_unlock(&to_pack);
 			return 0;
 		}
 		hashwrite(f, header, hdrlen);
@@ -611,6 +941,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 	} else if (type == OBJ_REF_DELTA) {
 		if (limit && hdrlen + hashsz + datalen + hashsz >= limit) {
 			unuse_pack(&w_curs);
+			packing_data_unlock(&to_pack);
 			return 0;
 		}
 		hashwrite(f, header, hdrlen);
@@ -620,12 +951,14 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 	} else {
 		if (limit && hdrlen + datalen + hashsz >= limit) {
 			unuse_pack(&w_curs);
+			packing_data_unlock(&to_pack);
 			return 0;
 		}
 		hashwrite(f, header, hdrlen);
 	}
 	copy_pack_data(f, p, &w_curs, offset, datalen);
 	unuse_pack(&w_curs);
+	packing_data_unlock(&to_pack);
 	reused++;
 	return hdrlen + datalen;
 }
@@ -665,23 +998,7 @@ static off_t write_object(struct hashfile *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!IN_PACK(entry))
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (oe_type(entry) == OBJ_REF_DELTA ||
-		 oe_type(entry) == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (oe_type(entry) != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (DELTA(entry))
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
+	to_reuse = want_reuse_object(entry, usable_delta);
 
 	if (!to_reuse)
 		len = write_no_reuse_object(f, entry, limit, usable_delta);
@@ -733,7 +1050,7 @@ static enum write_one_status write_one(struct hashfile *f,
 		switch (write_one(f, DELTA(e), offset)) {
 		case WRITE_ONE_RECURSIVE:
 			/* we cannot depend on this one */
-			SET_DELTA(e, NULL);
+			drop_write_delta(e);
 			break;
 		default:
 			break;
@@ -919,7 +1236,7 @@ static struct object_entry **compute_write_order(void)
 		if (!DELTA(e))
 			continue;
 		/* Mark me as the first child */
-		e->delta_sibling_idx = DELTA(e)->delta_child_idx;
+		SET_DELTA_SIBLING(e, DELTA_CHILD(DELTA(e)));
 		SET_DELTA_CHILD(DELTA(e), e);
 	}
 
@@ -1151,6 +1468,217 @@ static void write_excluded_by_configs(void)
 	}
 }
 
+/*
+ * With pack.deltaCandidates, every pack we write gets a ".dcand"
+ * sidecar that records, for each object stored as a delta, the base
+ * it was stored against and the size of that delta.  The file is
+ *
+ *   4-byte signature "DCND", 4-byte version (1), 4-byte hash id,
+ *   4-byte number of records (all in network byte order),
+ *   records of (object name, base name, 4-byte delta size) sorted
+ *   by object name,
+ *   trailing checksum of the above.
+ *
+ * A later delta search tries the recorded base of an object first,
+ * and skips its window search if the delta is no larger than last
+ * time.
+ */
+#define DELTA_CAND_SIGNATURE 0x44434e44 /* "DCND" */
+#define DELTA_CAND_VERSION 1
+#define DELTA_CAND_HEADER_SIZE 16
+
+struct delta_cand_file {
+	void *map;
+	size_t map_size;
+	const unsigned char *records;
+	uint32_t nr;
+};
+
+static struct delta_cand_file *delta_cand_files;
+static size_t delta_cand_files_nr, delta_cand_files_alloc;
+
+static size_t delta_cand_record_size(void)
+{
+	return 2 * the_hash_algo->rawsz + 4;
+}
+
+static int delta_cand_cmp(const void *a_, const void *b_)
+{
+	const struct object_entry *a = *(const struct object_entry **)a_;
+	const struct object_entry *b = *(const struct object_entry **)b_;
+	return oidcmp(&a->idx.oid, &b->idx.oid);
+}
+
+static void write_delta_candidates(const char *filename)
+{
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct object_entry **list;
+	struct hashfile *f;
+	uint32_t i, nr = 0;
+	int fd;
+
+	ALLOC_ARRAY(list, nr_written);
+	for (i = 0; i < nr_written; i++) {
+		/* "idx" is the first member of struct object_entry */
+		struct object_entry *e = (struct object_entry *)written_list[i];
+		if (DELTA(e))
+			list[nr++] = e;
+	}
+	QSORT(list, nr, delta_cand_cmp);
+
+	fd = odb_mkstemp(&tmp_file, "pack/tmp_dcand_XXXXXX");
+	f = hashfd(fd, tmp_file.buf);
+	hashwrite_be32(f, DELTA_CAND_SIGNATURE);
+	hashwrite_be32(f, DELTA_CAND_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(the_hash_algo));
+	hashwrite_be32(f, nr);
+	for (i = 0; i < nr; i++) {
+		unsigned long size = DELTA_SIZE(list[i]);
+
+		hashwrite(f, list[i]->idx.oid.hash, the_hash_algo->rawsz);
+		hashwrite(f, DELTA(list[i])->idx.oid.hash, the_hash_algo->rawsz);
+		hashwrite_be32(f, size > UINT32_MAX ? UINT32_MAX : size);
+	}
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
+
+	if (adjust_shared_perm(tmp_file.buf))
+		die_errno(_("unable to make temporary delta candidate file readable"));
+	if (rename(tmp_file.buf, filename))
+		die_errno(_("unable to rename temporary delta candidate file to '%s'"),
+			  filename);
+
+	strbuf_release(&tmp_file);
+	free(list);
+}
+
+/*
+ * Record the mtime of each object written to a cruft pack in the
+ * .mtimes file "filename". finish_tmp_packfile() has left written_list
+ * sorted by object name, which is the order the file is in.
+ */
+static void write_cruft_mtimes(const char *filename, const unsigned char *hash)
+{
+	const char *tmp_name;
+	uint32_t *mtimes;
+	uint32_t i;
+
+	ALLOC_ARRAY(mtimes, nr_written);
+	for (i = 0; i < nr_written; i++) {
+		/* "idx" is the first member of struct object_entry */
+		struct object_entry *e = (struct object_entry *)written_list[i];
+		mtimes[i] = oe_cruft_mtime(&to_pack, e);
+	}
+
+	tmp_name = write_mtimes_file(mtimes, nr_written, hash);
+	if (rename(tmp_name, filename))
+		die_errno(_("unable to rename temporary mtimes file to '%s'"),
+			  filename);
+
+	free((char *)tmp_name);
+	free(mtimes);
+}
+
+static void load_delta_candidates_one(struct packed_git *p)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct delta_cand_file *dc;
+	struct stat st;
+	unsigned char *map;
+	size_t size;
+	uint32_t nr;
+	int fd;
+
+	strbuf_addstr(&path, p->pack_name);
+	strbuf_strip_suffix(&path, ".pack");
+	strbuf_addstr(&path, ".dcand");
+	fd = git_open(path.buf);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	size = xsize_t(st.st_size);
+	if (size < DELTA_CAND_HEADER_SIZE + the_hash_algo->rawsz) {
+		close(fd);
+		warning(_("delta candidate file '%s' is too small"), path.buf);
+		goto out;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	nr = get_be32(map + 12);
+	if (get_be32(map) != DELTA_CAND_SIGNATURE ||
+	    get_be32(map + 4) != DELTA_CAND_VERSION ||
+	    get_be32(map + 8) != hash_algo_by_ptr(the_hash_algo) ||
+	    (size - DELTA_CAND_HEADER_SIZE - the_hash_algo->rawsz) /
+	    delta_cand_record_size() != nr ||
+	    (size - DELTA_CAND_HEADER_SIZE - the_hash_algo->rawsz) %
+	    delta_cand_record_size()) {
+		warning(_("ignoring corrupt delta candidate file '%s'"), path.buf);
+		munmap(map, size);
+		goto out;
+	}
+
+	ALLOC_GROW(delta_cand_files, delta_cand_files_nr + 1,
+		   delta_cand_files_alloc);
+	dc = &delta_cand_files[delta_cand_files_nr++];
+	dc->map = map;
+	dc->map_size = size;
+	dc->records = map + DELTA_CAND_HEADER_SIZE;
+	dc->nr = nr;
+out:
+	strbuf_release(&path);
+}
+
+static void load_delta_candidates(void)
+{
+	struct packed_git *p;
+
+	for (p = get_all_packs(the_repository); p; p = p->next)
+		if (p->pack_local)
+			load_delta_candidates_one(p);
+}
+
+static void free_delta_candidates(void)
+{
+	size_t i;
+
+	for (i = 0; i < delta_cand_files_nr; i++)
+		munmap(delta_cand_files[i].map, delta_cand_files[i].map_size);
+	FREE_AND_NULL(delta_cand_files);
+	delta_cand_files_nr = delta_cand_files_alloc = 0;
+}
+
+/*
+ * Return the record for "oid" from the first sidecar that has one,
+ * or NULL.
+ */
+static const unsigned char *find_delta_candidate(const struct object_id *oid)
+{
+	size_t rec = delta_cand_record_size();
+	size_t i;
+
+	for (i = 0; i < delta_cand_files_nr; i++) {
+		const struct delta_cand_file *dc = &delta_cand_files[i];
+		uint32_t lo = 0, hi = dc->nr;
+
+		while (lo < hi) {
+			uint32_t mi = lo + (hi - lo) / 2;
+			const unsigned char *r = dc->records + st_mult(mi, rec);
+			int cmp = hashcmp(oid->hash, r);
+
+			if (!cmp)
+				return r;
+			if (cmp < 0)
+				hi = mi;
+			else
+				lo = mi + 1;
+		}
+	}
+	return NULL;
+}
+
 static const char no_split_warning[] = N_(
 "disabling bitmap writing, packs are split due to pack.packSizeLimit"
 );
@@ -1187,12 +1715,20 @@ static void write_pack_file(void)
 		}
 
 		nr_written = 0;
+		start_write_pipeline(write_order, to_pack.nr_objects);
 		for (; i < to_pack.nr_objects; i++) {
 			struct object_entry *e = write_order[i];
+			if (IN_PACK(e)) {
+				packing_data_lock(&to_pack);
+				pack_readahead(IN_PACK(e), e->in_pack_offset);
+				packing_data_unlock(&to_pack);
+			}
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
+			advance_write_pipeline(i + 1);
 			display_progress(progress_state, written);
 		}
+		stop_write_pipeline();
 
 		/*
 		 * Did we write the wrong # entries in the header?
@@ -1255,13 +1791,27 @@ static void write_pack_file(void)
 				stop_progress(&progress_state);
 
 				bitmap_writer_show_progress(progress);
+				bitmap_writer_set_threads(delta_search_threads);
 				bitmap_writer_select_commits(indexed_commits, indexed_commits_nr, -1);
-				bitmap_writer_build(&to_pack);
+				if (bitmap_writer_build(&to_pack) < 0)
+					die(_("failed to write bitmap index"));
 				bitmap_writer_finish(written_list, nr_written,
 						     tmpname.buf, write_bitmap_options);
 				write_bitmap_index = 0;
 			}
 
+			if (delta_candidates) {
+				strbuf_setlen(&tmpname, strlen(base_name) + 1);
+				strbuf_addf(&tmpname, "%s.dcand", hash_to_hex(hash));
+				write_delta_candidates(tmpname.buf);
+			}
+
+			if (cruft) {
+				strbuf_setlen(&tmpname, strlen(base_name) + 1);
+				strbuf_addf(&tmpname, "%s.mtimes", hash_to_hex(hash));
+				write_cruft_mtimes(tmpname.buf, hash);
+			}
+
 			strbuf_release(&tmpname);
 			free(pack_tmp_name);
 			puts(hash_to_hex(hash));
@@ -1494,18 +2044,18 @@ static int want_object_in_pack(const struct object_id *oid,
 	return 1;
 }
 
-static void create_object_entry(const struct object_id *oid,
-				enum object_type type,
-				uint32_t hash,
-				int exclude,
-				int no_try_delta,
-				struct packed_git *found_pack,
-				off_t found_offset)
+static struct object_entry *create_object_entry(const struct object_id *oid,
+						enum object_type type,
+						uint32_t hash,
+						int exclude,
+						int no_try_delta,
+						struct packed_git *found_pack,
+						off_t found_offset)
 {
 	struct object_entry *entry;
 
 	entry = packlist_alloc(&to_pack, oid);
-	entry->hash = hash;
+	oe_set_name_hash(&to_pack, entry, hash);
 	oe_set_type(entry, type);
 	if (exclude)
 		entry->preferred_base = 1;
@@ -1517,6 +2067,8 @@ static void create_object_entry(const struct object_id *oid,
 	}
 
 	entry->no_try_delta = no_try_delta;
+
+	return entry;
 }
 
 static const char no_closure_warning[] = N_(
@@ -1544,7 +2096,7 @@ static int add_object_entry(const struct object_id *oid, enum object_type type,
 		return 0;
 	}
 
-	create_object_entry(oid, type, pack_name_hash(name),
+	create_object_entry(oid, type, get_name_hash(name),
 			    exclude, name && no_try_delta(name),
 			    found_pack, found_offset);
 	return 1;
@@ -1760,7 +2312,7 @@ static void add_preferred_base_object(const char *name)
 {
 	struct pbase_tree *it;
 	int cmplen;
-	unsigned hash = pack_name_hash(name);
+	unsigned hash = get_name_hash(name);
 
 	if (!num_preferred_base || check_pbase_path(hash))
 		return;
@@ -2001,7 +2553,7 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 
 			if (base_entry) {
 				SET_DELTA(entry, base_entry);
-				entry->delta_sibling_idx = base_entry->delta_child_idx;
+				SET_DELTA_SIBLING(entry, DELTA_CHILD(base_entry));
 				SET_DELTA_CHILD(base_entry, entry);
 			} else {
 				SET_DELTA_EXT(entry, &base_ref);
@@ -2101,12 +2653,12 @@ static void drop_reused_delta(struct object_entry *entry)
 	unsigned long size;
 
 	while (*idx) {
-		struct object_entry *oe = &to_pack.objects[*idx - 1];
+		uint32_t pos = *idx - 1;
 
-		if (oe == entry)
-			*idx = oe->delta_sibling_idx;
+		if (to_pack.objects + pos == entry)
+			*idx = to_pack.delta_sibling[pos];
 		else
-			idx = &oe->delta_sibling_idx;
+			idx = &to_pack.delta_sibling[pos];
 	}
 	SET_DELTA(entry, NULL);
 	entry->depth = 0;
@@ -2301,6 +2853,8 @@ static int type_size_sort(const void *_a, const void *_b)
 	const struct object_entry *b = *(struct object_entry **)_b;
 	const enum object_type a_type = oe_type(a);
 	const enum object_type b_type = oe_type(b);
+	const uint32_t a_hash = oe_name_hash(&to_pack, a);
+	const uint32_t b_hash = oe_name_hash(&to_pack, b);
 	const unsigned long a_size = SIZE(a);
 	const unsigned long b_size = SIZE(b);
 
@@ -2308,9 +2862,9 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a_type < b_type)
 		return 1;
-	if (a->hash > b->hash)
+	if (a_hash > b_hash)
 		return -1;
-	if (a->hash < b->hash)
+	if (a_hash < b_hash)
 		return 1;
 	if (a->preferred_base > b->preferred_base)
 		return -1;
@@ -2606,10 +3160,220 @@ static unsigned long free_unpacked(struct unpacked *n)
 	return freed_mem;
 }
 
-static void find_deltas(struct object_entry **list, unsigned *list_size,
-			int window, int depth, unsigned *processed)
+/*
+ * The sorted delta search list is cut into work units of consecutive
+ * objects, preferably at "path" (name hash) boundaries, and each
+ * worker owns a contiguous range of them.  A worker consumes its
+ * units from the front, keeping its delta window across them, so that
+ * adjacent units lose no delta opportunities.  When it runs out, it
+ * steals the back half of the range of the worker with the most units
+ * left; units themselves are never split once handed out.
+ */
+struct delta_unit {
+	struct object_entry **list;
+	unsigned nr;
+};
+
+static struct delta_unit *delta_units;
+
+struct thread_params {
+	pthread_t thread;
+	int window;
+	int depth;
+	unsigned *processed;
+
+	/* units [next_unit, end_unit) are ours; protected by "mutex" */
+	pthread_mutex_t mutex;
+	unsigned next_unit, end_unit;
+
+	/* the unit we are working on, only ever touched by us */
+	struct object_entry **unit_start;
+	struct object_entry **list;
+	unsigned remaining;
+	unsigned unreported;
+
+	/* statistics */
+	unsigned steals;
+	uint32_t objects;
+	uint64_t start_ns, idle_ns, done_ns;
+};
+
+static struct thread_params *delta_workers;
+static int nr_delta_workers;
+
+static void flush_delta_progress(struct thread_params *me)
+{
+	if (!me->unreported)
+		return;
+	progress_lock();
+	*me->processed += me->unreported;
+	display_progress(progress_state, *me->processed);
+	progress_unlock();
+	me->unreported = 0;
+}
+
+static int steal_delta_units(struct thread_params *me)
+{
+	uint64_t start = getnanotime();
+	int ret = 0;
+
+	for (;;) {
+		struct thread_params *victim = NULL;
+		unsigned most = 0, take, first;
+		int i;
+
+		for (i = 0; i < nr_delta_workers; i++) {
+			struct thread_params *p = &delta_workers[i];
+			unsigned left;
+
+			if (p == me)
+				continue;
+			pthread_mutex_lock(&p->mutex);
+			left = p->end_unit - p->next_unit;
+			pthread_mutex_unlock(&p->mutex);
+			if (left > most) {
+				most = left;
+				victim = p;
+			}
+		}
+		if (!victim)
+			break;
+
+		pthread_mutex_lock(&victim->mutex);
+		take = (victim->end_unit - victim->next_unit + 1) / 2;
+		victim->end_unit -= take;
+		first = victim->end_unit;
+		pthread_mutex_unlock(&victim->mutex);
+		if (!take)
+			continue; /* somebody else was faster */
+
+		pthread_mutex_lock(&me->mutex);
+		me->next_unit = first;
+		me->end_unit = first + take;
+		pthread_mutex_unlock(&me->mutex);
+		me->steals++;
+		ret = 1;
+		break;
+	}
+	me->idle_ns += getnanotime() - start;
+	return ret;
+}
+
+static struct object_entry *next_delta_entry(struct thread_params *me)
+{
+	for (;;) {
+		int have_unit = 0;
+
+		if (me->remaining) {
+			struct object_entry *entry = *me->list++;
+			me->remaining--;
+			me->objects++;
+			if (!entry->preferred_base && ++me->unreported >= 64)
+				flush_delta_progress(me);
+			return entry;
+		}
+		flush_delta_progress(me);
+
+		pthread_mutex_lock(&me->mutex);
+		if (me->next_unit < me->end_unit) {
+			struct delta_unit *u = &delta_units[me->next_unit++];
+			me->unit_start = u->list;
+			me->list = u->list;
+			me->remaining = u->nr;
+			have_unit = 1;
+		}
+		pthread_mutex_unlock(&me->mutex);
+
+		if (!have_unit && !steal_delta_units(me))
+			return NULL;
+	}
+}
+
+/*
+ * Where each object sits in the delta search list, or DELTA_LIST_NONE;
+ * only set up when there are delta candidates to try.
+ */
+#define DELTA_LIST_NONE UINT32_MAX
+static struct object_entry **delta_list_base;
+static uint32_t *delta_list_pos;
+
+/*
+ * Has "e" reached its final delta state?  Objects outside the search
+ * list never change; within it, we can only trust those we have
+ * already been through ourselves in the current unit, as nobody else
+ * touches them.
+ */
+static int delta_settled(struct thread_params *me, struct object_entry *e)
+{
+	uint32_t pos = delta_list_pos[e - to_pack.objects];
+	struct object_entry **p;
+
+	if (pos == DELTA_LIST_NONE)
+		return !DELTA(e);
+	p = delta_list_base + pos;
+	return me->unit_start <= p && p < me->list - 1;
+}
+
+/*
+ * Try the base an earlier pack recorded for "n".  Returns 1 if that
+ * gave us a delta at least as good as the recorded one, in which case
+ * the window search can be skipped.
+ */
+static int try_delta_candidate(struct thread_params *me, struct unpacked *n,
+			       struct unpacked *array, int window,
+			       int max_depth, unsigned long *mem_usage,
+			       int *best_base)
+{
+	struct object_entry *trg = n->entry, *base, *e;
+	struct unpacked tmp, *src = NULL;
+	const unsigned char *rec;
+	struct object_id base_oid;
+	uint32_t recorded;
+	int i, depth = 0, ret;
+
+	rec = find_delta_candidate(&trg->idx.oid);
+	if (!rec)
+		return 0;
+	oidread(&base_oid, rec + the_hash_algo->rawsz);
+	recorded = get_be32(rec + 2 * the_hash_algo->rawsz);
+
+	base = packlist_find(&to_pack, &base_oid);
+	if (!base || base == trg)
+		return 0;
+	for (e = base; ; e = DELTA(e)) {
+		if (!delta_settled(me, e))
+			return 0;
+		if (!DELTA(e))
+			break;
+		if (++depth >= max_depth)
+			return 0;
+	}
+
+	for (i = 0; i < window; i++) {
+		if (array[i].entry == base && array + i != n) {
+			src = array + i;
+			break;
+		}
+	}
+	if (!src) {
+		memset(&tmp, 0, sizeof(tmp));
+		tmp.entry = base;
+		tmp.depth = depth;
+		src = &tmp;
+	}
+
+	ret = try_delta(n, src, max_depth, mem_usage);
+	if (src == &tmp)
+		*mem_usage -= free_unpacked(&tmp);
+	else if (ret > 0)
+		*best_base = src - array;
+	return ret > 0 && DELTA_SIZE(trg) <= recorded;
+}
+
+static void find_deltas(struct thread_params *me)
 {
 	uint32_t i, idx = 0, count = 0;
+	int window = me->window, depth = me->depth;
 	struct unpacked *array;
 	unsigned long mem_usage = 0;
 
@@ -2620,18 +3384,9 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		struct unpacked *n = array + idx;
 		int j, max_depth, best_base = -1;
 
-		progress_lock();
-		if (!*list_size) {
-			progress_unlock();
+		entry = next_delta_entry(me);
+		if (!entry)
 			break;
-		}
-		entry = *list++;
-		(*list_size)--;
-		if (!entry->preferred_base) {
-			(*processed)++;
-			display_progress(progress_state, *processed);
-		}
-		progress_unlock();
 
 		mem_usage -= free_unpacked(n);
 		n->entry = entry;
@@ -2663,6 +3418,14 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		}
 
 		j = window;
+		/*
+		 * Skip the window search if the base an earlier pack
+		 * recorded for this object is still as good.
+		 */
+		if (delta_cand_files_nr &&
+		    try_delta_candidate(me, n, array, window, max_depth,
+					&mem_usage, &best_base))
+			j = 1;
 		while (--j > 0) {
 			int ret;
 			uint32_t other_idx = idx + j;
@@ -2721,7 +3484,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * currently deltified object, to keep it longer.  It will
 		 * be the first base object to be attempted next.
 		 */
-		if (DELTA(entry)) {
+		if (DELTA(entry) && best_base >= 0) {
 			struct unpacked swap = array[best_base];
 			int dist = (window + idx - best_base) % window;
 			int dst = best_base;
@@ -2748,38 +3511,6 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 	free(array);
 }
 
-/*
- * The main object list is split into smaller lists, each is handed to
- * one worker.
- *
- * The main thread waits on the condition that (at least) one of the workers
- * has stopped working (which is indicated in the .working member of
- * struct thread_params).
- *
- * When a work thread has completed its work, it sets .working to 0 and
- * signals the main thread and waits on the condition that .data_ready
- * becomes 1.
- *
- * The main thread steals half of the work from the worker that has
- * most work left to hand it to the idle worker.
- */
-
-struct thread_params {
-	pthread_t thread;
-	struct object_entry **list;
-	unsigned list_size;
-	unsigned remaining;
-	int window;
-	int depth;
-	int working;
-	int data_ready;
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
-	unsigned *processed;
-};
-
-static pthread_cond_t progress_cond;
-
 /*
  * Mutex and conditional variable can't be statically-initialized on Windows.
  */
@@ -2787,180 +3518,177 @@ static void init_threaded_search(void)
 {
 	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_mutex_init(&progress_mutex, NULL);
-	pthread_cond_init(&progress_cond, NULL);
 }
 
 static void cleanup_threaded_search(void)
 {
-	pthread_cond_destroy(&progress_cond);
 	pthread_mutex_destroy(&cache_mutex);
 	pthread_mutex_destroy(&progress_mutex);
 }
 
+/*
+ * Cut "list" into work units.  Aim for 16 units per thread so that
+ * stealing can balance the load, and cut at a "path" boundary once a
+ * unit is big enough.  Force a cut inside a path when a unit gets
+ * twice as big as intended, or carries twice its share of bytes
+ * (which is what happens with large blob families).  Every unit
+ * boundary a thief ends up starting at costs a window's worth of
+ * delta opportunities, so do not go much finer than that.
+ */
+static unsigned prepare_delta_units(struct object_entry **list,
+				    unsigned list_size, int window)
+{
+	unsigned target, nr_units = 0, alloc = 0, start = 0, i;
+	uint64_t total_bytes = 0, byte_budget, bytes = 0;
+
+	target = list_size / (delta_search_threads * 16);
+	if (target < 4 * window)
+		target = 4 * window;
+
+	for (i = 0; i < list_size; i++)
+		total_bytes += SIZE(list[i]);
+	byte_budget = total_bytes / (delta_search_threads * 16);
+
+	for (i = 0; i < list_size; i++) {
+		unsigned n = i - start;
+		int cut = 0;
+
+		if (n >= target && (!oe_name_hash(&to_pack, list[i]) ||
+				    oe_name_hash(&to_pack, list[i]) !=
+				    oe_name_hash(&to_pack, list[i - 1])))
+			cut = 1;
+		else if (n >= 2 * target ||
+			 (n > window && bytes > 2 * byte_budget))
+			cut = 1;
+
+		if (cut) {
+			ALLOC_GROW(delta_units, nr_units + 1, alloc);
+			delta_units[nr_units].list = list + start;
+			delta_units[nr_units].nr = n;
+			nr_units++;
+			start = i;
+			bytes = 0;
+		}
+		bytes += SIZE(list[i]);
+	}
+	if (start < list_size) {
+		ALLOC_GROW(delta_units, nr_units + 1, alloc);
+		delta_units[nr_units].list = list + start;
+		delta_units[nr_units].nr = list_size - start;
+		nr_units++;
+	}
+	return nr_units;
+}
+
 static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
 
-	progress_lock();
-	while (me->remaining) {
-		progress_unlock();
+	find_deltas(me);
+	me->done_ns = getnanotime();
+	return NULL;
+}
 
-		find_deltas(me->list, &me->remaining,
-			    me->window, me->depth, me->processed);
+static void trace2_delta_search_statistics(uint64_t end_ns, unsigned nr_units)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+	int i;
 
-		progress_lock();
-		me->working = 0;
-		pthread_cond_signal(&progress_cond);
-		progress_unlock();
+	if (!trace2_is_enabled())
+		return;
 
-		/*
-		 * We must not set ->data_ready before we wait on the
-		 * condition because the main thread may have set it to 1
-		 * before we get here. In order to be sure that new
-		 * work is available if we see 1 in ->data_ready, it
-		 * was initialized to 0 before this thread was spawned
-		 * and we reset it to 0 right away.
-		 */
-		pthread_mutex_lock(&me->mutex);
-		while (!me->data_ready)
-			pthread_cond_wait(&me->cond, &me->mutex);
-		me->data_ready = 0;
-		pthread_mutex_unlock(&me->mutex);
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "units", nr_units);
+	jw_object_inline_begin_array(&jw, "threads");
+	for (i = 0; i < nr_delta_workers; i++) {
+		struct thread_params *p = &delta_workers[i];
 
-		progress_lock();
+		jw_array_inline_begin_object(&jw);
+		jw_object_intmax(&jw, "objects", p->objects);
+		jw_object_intmax(&jw, "steals", p->steals);
+		jw_object_intmax(&jw, "busy_ns", p->done_ns - p->start_ns - p->idle_ns);
+		jw_object_intmax(&jw, "idle_ns", p->idle_ns + end_ns - p->done_ns);
+		jw_end(&jw);
 	}
-	progress_unlock();
-	/* leave ->working 1 so that this doesn't get more work assigned */
-	return NULL;
+	jw_end(&jw);
+	jw_end(&jw);
+
+	trace2_data_json("pack-objects", the_repository, "delta_search", &jw);
+
+	jw_release(&jw);
 }
 
 static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			   int window, int depth, unsigned *processed)
 {
-	struct thread_params *p;
-	int i, ret, active_threads = 0;
+	unsigned nr_units, per_worker;
+	int i, ret;
 
 	init_threaded_search();
 
 	if (delta_search_threads <= 1) {
-		find_deltas(list, &list_size, window, depth, processed);
+		struct delta_unit unit;
+		struct thread_params me;
+
+		memset(&me, 0, sizeof(me));
+		unit.list = list;
+		unit.nr = list_size;
+		delta_units = &unit;
+		me.window = window;
+		me.depth = depth;
+		me.processed = processed;
+		me.end_unit = 1;
+		pthread_mutex_init(&me.mutex, NULL);
+		find_deltas(&me);
+		pthread_mutex_destroy(&me.mutex);
+		delta_units = NULL;
 		cleanup_threaded_search();
 		return;
 	}
 	if (progress > pack_to_stdout)
 		fprintf_ln(stderr, _("Delta compression using up to %d threads"),
 			   delta_search_threads);
-	CALLOC_ARRAY(p, delta_search_threads);
 
-	/* Partition the work amongst work threads. */
-	for (i = 0; i < delta_search_threads; i++) {
-		unsigned sub_size = list_size / (delta_search_threads - i);
+	nr_units = prepare_delta_units(list, list_size, window);
+	nr_delta_workers = delta_search_threads;
+	CALLOC_ARRAY(delta_workers, nr_delta_workers);
 
-		/* don't use too small segments or no deltas will be found */
-		if (sub_size < 2*window && i+1 < delta_search_threads)
-			sub_size = 0;
+	/* Hand each worker a contiguous range of units. */
+	per_worker = DIV_ROUND_UP(nr_units, nr_delta_workers);
+	for (i = 0; i < nr_delta_workers; i++) {
+		struct thread_params *p = &delta_workers[i];
 
-		p[i].window = window;
-		p[i].depth = depth;
-		p[i].processed = processed;
-		p[i].working = 1;
-		p[i].data_ready = 0;
-
-		/* try to split chunks on "path" boundaries */
-		while (sub_size && sub_size < list_size &&
-		       list[sub_size]->hash &&
-		       list[sub_size]->hash == list[sub_size-1]->hash)
-			sub_size++;
-
-		p[i].list = list;
-		p[i].list_size = sub_size;
-		p[i].remaining = sub_size;
-
-		list += sub_size;
-		list_size -= sub_size;
+		p->window = window;
+		p->depth = depth;
+		p->processed = processed;
+		p->next_unit = st_mult(i, per_worker);
+		if (p->next_unit > nr_units)
+			p->next_unit = nr_units;
+		p->end_unit = p->next_unit + per_worker;
+		if (p->end_unit > nr_units)
+			p->end_unit = nr_units;
+		pthread_mutex_init(&p->mutex, NULL);
 	}
 
-	/* Start work threads. */
-	for (i = 0; i < delta_search_threads; i++) {
-		if (!p[i].list_size)
-			continue;
-		pthread_mutex_init(&p[i].mutex, NULL);
-		pthread_cond_init(&p[i].cond, NULL);
-		ret = pthread_create(&p[i].thread, NULL,
-				     threaded_find_deltas, &p[i]);
+	for (i = 0; i < nr_delta_workers; i++) {
+		struct thread_params *p = &delta_workers[i];
+
+		p->start_ns = getnanotime();
+		ret = pthread_create(&p->thread, NULL, threaded_find_deltas, p);
 		if (ret)
 			die(_("unable to create thread: %s"), strerror(ret));
-		active_threads++;
 	}
+	for (i = 0; i < nr_delta_workers; i++)
+		pthread_join(delta_workers[i].thread, NULL);
 
-	/*
-	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
-	 */
-	while (active_threads) {
-		struct thread_params *target = NULL;
-		struct thread_params *victim = NULL;
-		unsigned sub_size = 0;
-
-		progress_lock();
-		for (;;) {
-			for (i = 0; !target && i < delta_search_threads; i++)
-				if (!p[i].working)
-					target = &p[i];
-			if (target)
-				break;
-			pthread_cond_wait(&progress_cond, &progress_mutex);
-		}
+	trace2_delta_search_statistics(getnanotime(), nr_units);
 
-		for (i = 0; i < delta_search_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
-				victim = &p[i];
-		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
-			}
-			target->list = list;
-			victim->list_size -= sub_size;
-			victim->remaining -= sub_size;
-		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
-		target->working = 1;
-		progress_unlock();
-
-		pthread_mutex_lock(&target->mutex);
-		target->data_ready = 1;
-		pthread_cond_signal(&target->cond);
-		pthread_mutex_unlock(&target->mutex);
-
-		if (!sub_size) {
-			pthread_join(target->thread, NULL);
-			pthread_cond_destroy(&target->cond);
-			pthread_mutex_destroy(&target->mutex);
-			active_threads--;
-		}
-	}
+	for (i = 0; i < nr_delta_workers; i++)
+		pthread_mutex_destroy(&delta_workers[i].mutex);
+	FREE_AND_NULL(delta_workers);
+	nr_delta_workers = 0;
+	FREE_AND_NULL(delta_units);
 	cleanup_threaded_search();
-	free(p);
 }
 
 static int obj_is_packed(const struct object_id *oid)
@@ -3076,24 +3804,69 @@ static void prepare_pack(int window, int depth)
 			progress_state = start_progress(_("Compressing objects"),
 							nr_deltas);
 		QSORT(delta_list, n, type_size_sort);
+		if (delta_candidates)
+			load_delta_candidates();
+		if (delta_cand_files_nr) {
+			ALLOC_ARRAY(delta_list_pos, to_pack.nr_objects);
+			for (i = 0; i < to_pack.nr_objects; i++)
+				delta_list_pos[i] = DELTA_LIST_NONE;
+			for (i = 0; i < n; i++)
+				delta_list_pos[delta_list[i] - to_pack.objects] = i;
+			delta_list_base = delta_list;
+		}
 		ll_find_deltas(delta_list, n, window+1, depth, &nr_done);
 		stop_progress(&progress_state);
+		FREE_AND_NULL(delta_list_pos);
+		delta_list_base = NULL;
+		free_delta_candidates();
 		if (nr_done != nr_deltas)
 			die(_("inconsistency with delta count"));
 	}
 	free(delta_list);
 }
 
+/*
+ * Split --memory-limit between the delta cache, which gets at most a
+ * quarter of it, and the delta windows of all search threads, which
+ * share the rest.  Smaller explicit limits are kept.
+ */
+static void apply_memory_limit(void)
+{
+	unsigned long cache = pack_memory_limit / 4;
+	unsigned long windows = (pack_memory_limit - cache) /
+				(delta_search_threads > 1 ? delta_search_threads : 1);
+
+	if (!max_delta_cache_size || max_delta_cache_size > cache)
+		max_delta_cache_size = cache;
+	if (!window_memory_limit || window_memory_limit > windows)
+		window_memory_limit = windows;
+
+	if (packing_data_spill(&to_pack))
+		warning(_("cannot keep object data on disk on this platform"));
+}
+
 static int git_pack_config(const char *k, const char *v, void *cb)
 {
 	if (!strcmp(k, "pack.window")) {
 		window = git_config_int(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.namehashversion")) {
+		name_hash_version = git_config_int(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.memorylimit")) {
+		pack_memory_limit = git_config_ulong(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.windowmemory")) {
 		window_memory_limit = git_config_ulong(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.deltacandidates")) {
+		delta_candidates = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.depth")) {
 		depth = git_config_int(k, v);
 		return 0;
@@ -3112,6 +3885,12 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -3230,11 +4009,11 @@ static void show_object_pack_hint(struct object *object, const char *name,
 	 * included packs, and so doesn't have a non-zero hash field that you
 	 * would typically pick up during a reachability traversal.
 	 *
-	 * Make a best-effort attempt to fill in the ->hash and ->no_try_delta
+	 * Make a best-effort attempt to fill in the name hash and ->no_try_delta
 	 * here using a now in order to perhaps improve the delta selection
 	 * process.
 	 */
-	oe->hash = pack_name_hash(name);
+	oe_set_name_hash(&to_pack, oe, get_name_hash(name));
 	oe->no_try_delta = name && no_try_delta(name);
 
 	stdin_packs_hints_nr++;
@@ -3650,11 +4429,14 @@ static void loosen_unused_packed_objects(void)
 			die(_("cannot open pack index"));
 
 		for (i = 0; i < p->num_objects; i++) {
+			timestamp_t mtime;
+
 			nth_packed_object_id(&oid, p, i);
+			mtime = packed_object_mtime(p, i);
 			if (!packlist_find(&to_pack, &oid) &&
 			    !has_sha1_pack_kept_or_nonlocal(&oid) &&
-			    !loosened_object_can_be_discarded(&oid, p->mtime)) {
-				if (force_object_loose(&oid, p->mtime))
+			    !loosened_object_can_be_discarded(&oid, mtime)) {
+				if (force_object_loose(&oid, mtime))
 					die(_("unable to force loose object"));
 				loosened_objects_nr++;
 			}
@@ -3833,6 +4615,205 @@ static void get_object_list(int ac, const char **av)
 	oid_array_clear(&recent_objects);
 }
 
+static int cruft_object_can_be_discarded(const struct object_id *oid,
+					 timestamp_t mtime)
+{
+	if (!cruft_expiration)
+		return 0;
+	if (mtime > cruft_expiration)
+		return 0;
+	if (oid_array_lookup(&recent_objects, oid) >= 0)
+		return 0;
+	return 1;
+}
+
+/*
+ * Add an unreachable object to the cruft pack. An object may be found
+ * more than once (e.g., loose and in an older cruft pack); it keeps
+ * the most recent of the mtimes seen.
+ */
+static void add_cruft_object_entry(const struct object_id *oid,
+				   struct packed_git *pack, off_t offset,
+				   timestamp_t mtime)
+{
+	struct object_entry *entry;
+	enum object_type type;
+
+	display_progress(progress_state, ++nr_seen);
+
+	entry = packlist_find(&to_pack, oid);
+	if (entry) {
+		if (mtime > oe_cruft_mtime(&to_pack, entry))
+			oe_set_cruft_mtime(&to_pack, entry, mtime);
+		return;
+	}
+
+	if (cruft_object_can_be_discarded(oid, mtime))
+		return;
+	if (!want_object_in_pack(oid, 0, &pack, &offset))
+		return;
+
+	if (pack) {
+		struct object_info oi = OBJECT_INFO_INIT;
+
+		oi.typep = &type;
+		if (packed_object_info(the_repository, pack, offset, &oi) < 0)
+			die(_("could not get type of object %s in pack %s"),
+			    oid_to_hex(oid), pack->pack_name);
+	} else {
+		type = oid_object_info(the_repository, oid, NULL);
+		if (type < 0) {
+			warning(_("loose object %s could not be examined"),
+				oid_to_hex(oid));
+			return;
+		}
+	}
+
+	entry = create_object_entry(oid, type, 0, 0, 0, pack, offset);
+	oe_set_cruft_mtime(&to_pack, entry, mtime);
+}
+
+static int add_cruft_object_from_pack(const struct object_id *oid,
+				      struct packed_git *p,
+				      uint32_t pos,
+				      void *data)
+{
+	add_cruft_object_entry(oid, p, nth_packed_object_offset(p, pos),
+			       packed_object_mtime(p, pos));
+	return 0;
+}
+
+static int add_cruft_loose_object(const struct object_id *oid,
+				  const char *path, void *data)
+{
+	struct stat st;
+
+	if (lstat(path, &st) < 0) {
+		/* it may have been packed by a concurrent process */
+		if (errno == ENOENT)
+			return 0;
+		die_errno(_("unable to stat %s"), path);
+	}
+
+	add_cruft_object_entry(oid, NULL, 0, st.st_mtime);
+	return 0;
+}
+
+/*
+ * Fill recent_objects with the objects that are newer than the cruft
+ * expiration, or reachable from one that is; those must survive even
+ * if they are older themselves.
+ */
+static void record_recent_cruft_objects(void)
+{
+	struct rev_info revs;
+	struct packed_git *p;
+	struct object_id oid;
+	uint32_t i;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	revs.ignore_missing_links = 1;
+
+	/*
+	 * Objects in the packs we keep are reachable and stay around
+	 * anyway. Marking them as seen stops the walk from the recent
+	 * objects as soon as it reaches the reachable part of the graph.
+	 */
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		if (!p->pack_keep_in_core)
+			continue;
+		if (open_pack_index(p))
+			die(_("cannot open pack index"));
+		for (i = 0; i < p->num_objects; i++) {
+			nth_packed_object_id(&oid, p, i);
+			lookup_unknown_object(the_repository, &oid)->flags |= SEEN;
+		}
+	}
+
+	if (add_unseen_recent_objects_to_traversal(&revs, cruft_expiration))
+		die(_("unable to add recent objects"));
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	traverse_commit_list(&revs, record_recent_commit,
+			     record_recent_object, NULL);
+}
+
+/*
+ * Read the list of packs for --cruft from stdin. Objects in packs
+ * listed as "pack-<hash>.pack" are kept elsewhere (e.g., the pack of
+ * reachable objects just written) and are left out; unreachable
+ * objects in packs listed as "-pack-<hash>.pack", which are about to
+ * be deleted, and loose objects go into the cruft pack.
+ */
+static void read_cruft_objects(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list fresh_packs = STRING_LIST_INIT_DUP;
+	struct string_list discard_packs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct packed_git *p;
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		if (!buf.len)
+			continue;
+
+		if (*buf.buf == '-')
+			string_list_append(&discard_packs, buf.buf + 1);
+		else
+			string_list_append(&fresh_packs, buf.buf);
+	}
+
+	string_list_sort(&fresh_packs);
+	string_list_sort(&discard_packs);
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *pack_name = pack_basename(p);
+
+		item = string_list_lookup(&fresh_packs, pack_name);
+		if (!item)
+			item = string_list_lookup(&discard_packs, pack_name);
+
+		if (item)
+			item->util = p;
+	}
+
+	for_each_string_list_item(item, &fresh_packs) {
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		p->pack_keep_in_core = 1;
+	}
+	ignore_packed_keep_in_core = 1;
+
+	for_each_string_list_item(item, &discard_packs) {
+		if (!item->util)
+			die(_("could not find pack '%s'"), item->string);
+	}
+
+	if (cruft_expiration)
+		record_recent_cruft_objects();
+
+	QSORT(discard_packs.items, discard_packs.nr, pack_mtime_cmp);
+	for_each_string_list_item(item, &discard_packs) {
+		p = item->util;
+		if (open_pack_index(p))
+			die(_("cannot open pack index"));
+		for_each_object_in_pack(p, add_cruft_object_from_pack, NULL,
+					FOR_EACH_OBJECT_PACK_ORDER);
+	}
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      add_cruft_loose_object,
+				      NULL, NULL, NULL);
+
+	oid_array_clear(&recent_objects);
+	strbuf_release(&buf);
+	string_list_clear(&fresh_packs, 0);
+	string_list_clear(&discard_packs, 0);
+}
+
 static void add_extra_kept_packs(const struct string_list *names)
 {
 	struct packed_git *p;
@@ -3925,6 +4906,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			    N_("limit pack window by objects")),
 		OPT_MAGNITUDE(0, "window-memory", &window_memory_limit,
 			      N_("limit pack window by memory in addition to object limit")),
+		OPT_MAGNITUDE(0, "memory-limit", &pack_memory_limit,
+			      N_("limit memory used for delta search and keep cold object data on disk")),
 		OPT_INTEGER(0, "depth", &depth,
 			    N_("maximum length of delta chain allowed in the resulting pack")),
 		OPT_BOOL(0, "reuse-delta", &reuse_delta,
@@ -3964,6 +4947,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		OPT_CALLBACK_F(0, "unpack-unreachable", NULL, N_("time"),
 		  N_("unpack unreachable objects newer than <time>"),
 		  PARSE_OPT_OPTARG, option_parse_unpack_unreachable),
+		OPT_BOOL(0, "cruft", &cruft,
+			 N_("create a cruft pack from the packs listed on stdin")),
+		OPT_EXPIRY_DATE(0, "cruft-expiration", &cruft_expiration,
+				N_("expire cruft objects older than <time>")),
 		OPT_BOOL(0, "sparse", &sparse,
 			 N_("use the sparse reachability algorithm")),
 		OPT_BOOL(0, "thin", &thin,
@@ -3993,6 +4980,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		  option_parse_missing_action),
 		OPT_BOOL(0, "exclude-promisor-objects", &exclude_promisor_objects,
 			 N_("do not pack objects in promisor packfiles")),
+		OPT_INTEGER(0, "name-hash-version", &name_hash_version,
+			    N_("use the given name hash function to group delta candidates")),
 		OPT_BOOL(0, "delta-islands", &use_delta_islands,
 			 N_("respect islands during delta compression")),
 		OPT_STRING_LIST(0, "uri-protocol", &uri_protocols,
@@ -4083,11 +5072,26 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	else if (pack_compression_level < 0 || pack_compression_level > Z_BEST_COMPRESSION)
 		die(_("bad pack compression level %d"), pack_compression_level);
 
+	if (name_hash_version != 1 && name_hash_version != 2)
+		die(_("invalid --name-hash-version option: %d"),
+		    name_hash_version);
+	/*
+	 * A name-hash cache filled in with the full-path hash gets its own
+	 * flag, so that readers do not mix it up with the default one.
+	 */
+	if (name_hash_version == 2 &&
+	    (write_bitmap_options & BITMAP_OPT_HASH_CACHE)) {
+		write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
+		write_bitmap_options |= BITMAP_OPT_HASH_CACHE_V2;
+	}
+
 	if (!delta_search_threads)	/* --threads=0 means autodetect */
 		delta_search_threads = online_cpus();
 
 	if (!HAVE_THREADS && delta_search_threads != 1)
 		warning(_("no threads support, ignoring --threads"));
+	if (pack_memory_limit)
+		apply_memory_limit();
 	if (!pack_to_stdout && !pack_size_limit)
 		pack_size_limit = pack_size_limit_cfg;
 	if (pack_to_stdout && pack_size_limit)
@@ -4115,6 +5119,15 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (stdin_packs && use_internal_rev_list)
 		die(_("cannot use internal rev list with --stdin-packs"));
 
+	if (cruft) {
+		if (use_internal_rev_list)
+			die(_("cannot use internal rev list with --cruft"));
+		if (stdin_packs)
+			die(_("cannot use --stdin-packs with --cruft"));
+		if (pack_to_stdout)
+			die(_("cannot use --stdout with --cruft"));
+	}
+
 	/*
 	 * "soft" reasons not to use bitmaps - for on-disk repack by default we want
 	 *
@@ -4179,7 +5192,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		read_packs_list_from_stdin();
 		if (rev_list_unpacked)
 			add_unreachable_loose_objects();
-	} else if (!use_internal_rev_list)
+	} else if (cruft)
+		read_cruft_objects();
+	else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		get_object_list(rp.nr, rp.v);
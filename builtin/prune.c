@@ -10,6 +10,7 @@
 #include "object-store.h"
 #include "shallow.h"
 #include "config.h"
+#include "pack-bitmap.h"
 
 static const char * const prune_usage[] = {
 	N_("git prune [-n] [-v] [--progress] [--expire <time>] [--] [<head>...]"),
@@ -19,6 +20,7 @@ static int show_only;
 static int verbose;
 static timestamp_t expire;
 static int show_progress = -1;
+static struct bitmap_index *bitmap_git;
 
 static int prune_tmp_file(const char *fullpath)
 {
@@ -44,29 +46,19 @@ static void perform_reachability_traversal(struct rev_info *revs)
 
 	if (show_progress)
 		progress = start_delayed_progress(_("Checking connectivity"), 0);
-	mark_reachable_objects(revs, 1, expire, progress);
+	bitmap_git = mark_reachable_objects(revs, 1, expire, progress);
 	stop_progress(&progress);
 	initialized = 1;
 }
 
-static int is_object_reachable(const struct object_id *oid,
-			       struct rev_info *revs)
-{
-	struct object *obj;
-
-	perform_reachability_traversal(revs);
-
-	obj = lookup_object(the_repository, oid);
-	return obj && (obj->flags & SEEN);
-}
-
 static int prune_object(const struct object_id *oid, const char *fullpath,
 			void *data)
 {
 	struct rev_info *revs = data;
 	struct stat st;
 
-	if (is_object_reachable(oid, revs))
+	perform_reachability_traversal(revs);
+	if (is_object_reachable(bitmap_git, oid))
 		return 0;
 
 	if (lstat(fullpath, &st)) {
@@ -188,5 +180,6 @@ int cmd_prune(int argc, const char **argv, const char *prefix)
 		prune_shallow(show_only ? PRUNE_SHOW_ONLY : 0);
 	}
 
+	free_bitmap_index(bitmap_git);
 	return 0;
 }
@@ -0,0 +1,690 @@
+#include "builtin.h"
+#include "config.h"
+#include "parse-options.h"
+#include "simple-ipc.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "refs.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "revision.h"
+#include "dir.h"
+#include "wildmatch.h"
+#include "quote.h"
+#include "strvec.h"
+#include "run-command.h"
+
+static const char * const builtin_query__daemon_usage[] = {
+	N_("git query--daemon start [<options>]"),
+	N_("git query--daemon run [<options>]"),
+	N_("git query--daemon stop"),
+	N_("git query--daemon status"),
+	N_("git query--daemon send <command> [<arg>...]"),
+	NULL
+};
+
+#ifdef SUPPORTS_SIMPLE_IPC
+/*
+ * The daemon answers read-only queries about the repository it was
+ * started in, keeping the index, the references and the list of packs
+ * loaded between queries. See "PROTOCOL" in git-query--daemon(1).
+ */
+#define QUERY_PROTOCOL_VERSION 1
+
+static GIT_PATH_FUNC(query_ipc_path, "query--daemon.ipc")
+
+static int query__ipc_threads = 4;
+static int query__start_timeout_sec = 60;
+
+/*
+ * A file or directory whose changes invalidate part of what the daemon
+ * has loaded.
+ */
+struct watched_path {
+	char *path;
+	struct stat st;
+	time_t taken;
+	unsigned seen : 1;
+};
+
+/*
+ * Return 1 if `w` changed since the previous call (or cannot be told not
+ * to have changed), 0 otherwise. A path modified within the second its
+ * stat data was taken in counts as changed, as a second modification
+ * within the same tick could go unnoticed.
+ */
+static int watched_path_changed(struct watched_path *w)
+{
+	struct stat st;
+	int changed;
+
+	if (stat(w->path, &st))
+		memset(&st, 0, sizeof(st));
+
+	changed = !w->seen ||
+		st.st_ino != w->st.st_ino ||
+		st.st_size != w->st.st_size ||
+		st.st_mtime != w->st.st_mtime ||
+		ST_MTIME_NSEC(st) != ST_MTIME_NSEC(w->st) ||
+		st.st_ctime != w->st.st_ctime ||
+		ST_CTIME_NSEC(st) != ST_CTIME_NSEC(w->st) ||
+		w->st.st_mtime >= w->taken;
+
+	w->st = st;
+	w->taken = time(NULL);
+	w->seen = 1;
+	return changed;
+}
+
+struct query_daemon_state {
+	/* held while answering a query; they all share the_repository */
+	pthread_mutex_t lock;
+
+	struct watched_path index;
+	struct watched_path packs;
+	struct strbuf refs_fingerprint;
+
+	/* for tests and trace2: how often each part was reloaded */
+	int index_loads, refs_reloads, pack_reloads;
+};
+
+/*
+ * Make sure that what is loaded still reflects the repository on disk,
+ * reloading whatever another process changed since the last query.
+ */
+static void refresh_loaded_state(struct query_daemon_state *state)
+{
+	struct repository *r = the_repository;
+	struct strbuf fp = STRBUF_INIT;
+
+	if (watched_path_changed(&state->index)) {
+		discard_index(r->index);
+		repo_read_index(r);
+		state->index_loads++;
+	}
+
+	if (refs_fingerprint(get_main_ref_store(r), &fp) ||
+	    strbuf_cmp(&fp, &state->refs_fingerprint)) {
+		refs_clear_cache(get_main_ref_store(r));
+		strbuf_swap(&fp, &state->refs_fingerprint);
+		state->refs_reloads++;
+	}
+	strbuf_release(&fp);
+
+	if (watched_path_changed(&state->packs)) {
+		reprepare_packed_git(r);
+		state->pack_reloads++;
+	}
+}
+
+static int query_rev_parse(const char **args, struct strbuf *out,
+			   struct strbuf *err)
+{
+	struct object_id oid;
+
+	for (; *args; args++) {
+		if (repo_get_oid(the_repository, *args, &oid)) {
+			strbuf_addf(err, "unknown revision '%s'", *args);
+			return -1;
+		}
+		strbuf_addf(out, "%s\n", oid_to_hex(&oid));
+	}
+	return 0;
+}
+
+/*
+ * Patterns match like those of for-each-ref: either as a prefix that
+ * ends at a '/' or as a wildcard pattern.
+ */
+static int match_ref_pattern(const char **patterns, const char *refname)
+{
+	if (!*patterns)
+		return 1;
+	for (; *patterns; patterns++) {
+		const char *p = *patterns;
+		const char *rest;
+
+		if (skip_prefix(refname, p, &rest) &&
+		    (!*rest || *rest == '/' || ends_with(p, "/")))
+			return 1;
+		if (!wildmatch(p, refname, WM_PATHNAME))
+			return 1;
+	}
+	return 0;
+}
+
+struct for_each_ref_data {
+	const char **patterns;
+	struct strbuf *out;
+};
+
+static int query_one_ref(const char *refname, const struct object_id *oid,
+			 int flags, void *cb_data)
+{
+	struct for_each_ref_data *data = cb_data;
+	enum object_type type;
+
+	if (!match_ref_pattern(data->patterns, refname))
+		return 0;
+	type = oid_object_info(the_repository, oid, NULL);
+	if (type < 0)
+		return 0;
+	strbuf_addf(data->out, "%s %s\t%s\n", oid_to_hex(oid),
+		    type_name(type), refname);
+	return 0;
+}
+
+static int query_for_each_ref(const char **args, struct strbuf *out,
+			      struct strbuf *err)
+{
+	struct for_each_ref_data data = { args, out };
+
+	refs_for_each_ref(get_main_ref_store(the_repository), query_one_ref,
+			  &data);
+	return 0;
+}
+
+/*
+ * Like "cat-file --batch" and "cat-file --batch-check" respectively,
+ * with the objects given as arguments.
+ */
+static int query_objects(const char **args, struct strbuf *out,
+			 int want_contents)
+{
+	for (; *args; args++) {
+		struct object_id oid;
+		struct object_info oi = OBJECT_INFO_INIT;
+		enum object_type type;
+		unsigned long size;
+		void *contents = NULL;
+
+		oi.typep = &type;
+		oi.sizep = &size;
+		if (want_contents)
+			oi.contentp = &contents;
+		if (repo_get_oid(the_repository, *args, &oid) ||
+		    oid_object_info_extended(the_repository, &oid, &oi,
+					     OBJECT_INFO_LOOKUP_REPLACE) < 0) {
+			strbuf_addf(out, "%s missing\n", *args);
+			continue;
+		}
+		strbuf_addf(out, "%s %s %lu\n", oid_to_hex(&oid),
+			    type_name(type), size);
+		if (want_contents) {
+			strbuf_add(out, contents, size);
+			strbuf_addch(out, '\n');
+			free(contents);
+		}
+	}
+	return 0;
+}
+
+static int query_cat_file(const char **args, struct strbuf *out,
+			  struct strbuf *err)
+{
+	return query_objects(args, out, 1);
+}
+
+static int query_object_info(const char **args, struct strbuf *out,
+			     struct strbuf *err)
+{
+	return query_objects(args, out, 0);
+}
+
+struct status_change {
+	char index_status;
+	char worktree_status;
+};
+
+static struct status_change *status_change_for(struct string_list *changes,
+					       const char *path)
+{
+	struct string_list_item *item = string_list_insert(changes, path);
+
+	if (!item->util) {
+		struct status_change *c;
+		CALLOC_ARRAY(c, 1);
+		c->index_status = c->worktree_status = ' ';
+		item->util = c;
+	}
+	return item->util;
+}
+
+static void status_collect_index_cb(struct diff_queue_struct *q,
+				    struct diff_options *options,
+				    void *data)
+{
+	int i;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+		status_change_for(data, p->two->path)->index_status = p->status;
+	}
+}
+
+static void status_collect_worktree_cb(struct diff_queue_struct *q,
+				       struct diff_options *options,
+				       void *data)
+{
+	int i;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+		struct status_change *c = status_change_for(data, p->two->path);
+
+		if (p->status == DIFF_STATUS_UNMERGED)
+			c->index_status = DIFF_STATUS_UNMERGED;
+		c->worktree_status = p->status;
+	}
+}
+
+static void status_collect(struct string_list *changes, int initial)
+{
+	struct rev_info rev;
+	struct setup_revision_opt opt;
+
+	repo_init_revisions(the_repository, &rev, NULL);
+	memset(&opt, 0, sizeof(opt));
+	opt.def = initial ? empty_tree_oid_hex() : "HEAD";
+	setup_revisions(0, NULL, &rev, &opt);
+	rev.diffopt.flags.override_submodule_config = 1;
+	rev.diffopt.ita_invisible_in_index = 1;
+	rev.diffopt.output_format |= DIFF_FORMAT_CALLBACK;
+	rev.diffopt.format_callback = status_collect_index_cb;
+	rev.diffopt.format_callback_data = changes;
+	rev.diffopt.detect_rename = 0;
+	run_diff_index(&rev, 1);
+	object_array_clear(&rev.pending);
+
+	repo_init_revisions(the_repository, &rev, NULL);
+	setup_revisions(0, NULL, &rev, NULL);
+	rev.diffopt.ita_invisible_in_index = 1;
+	rev.diffopt.output_format |= DIFF_FORMAT_CALLBACK;
+	rev.diffopt.format_callback = status_collect_worktree_cb;
+	rev.diffopt.format_callback_data = changes;
+	rev.diffopt.detect_rename = 0;
+	run_diff_files(&rev, 0);
+}
+
+/*
+ * Like "status --porcelain --branch --no-renames", without the
+ * upstream of the branch.
+ */
+static int query_status(const char **args, struct strbuf *out,
+			struct strbuf *err)
+{
+	struct index_state *istate = the_repository->index;
+	struct string_list changes = STRING_LIST_INIT_DUP;
+	struct strbuf quoted = STRBUF_INIT;
+	struct pathspec pathspec = { 0 };
+	struct dir_struct dir;
+	struct object_id head;
+	const char *branch;
+	int initial, i;
+
+	if (is_bare_repository()) {
+		strbuf_addstr(err, "status needs a work tree");
+		return -1;
+	}
+
+	/*
+	 * The stat data of the loaded index is kept current, so that the
+	 * next query only looks at the contents of files touched since.
+	 */
+	refresh_index(istate, REFRESH_QUIET, NULL, NULL, NULL);
+
+	branch = resolve_ref_unsafe("HEAD", 0, &head, NULL);
+	initial = !branch || is_null_oid(&head);
+	if (branch && skip_prefix(branch, "refs/heads/", &branch))
+		strbuf_addf(out, initial ? "## No commits yet on %s\n" : "## %s\n",
+			    branch);
+	else
+		strbuf_addstr(out, "## HEAD (no branch)\n");
+
+	status_collect(&changes, initial);
+	for (i = 0; i < changes.nr; i++) {
+		struct status_change *c = changes.items[i].util;
+		quote_path(changes.items[i].string, NULL, &quoted,
+			   QUOTE_PATH_QUOTE_SP);
+		strbuf_addf(out, "%c%c %s\n", c->index_status,
+			    c->worktree_status, quoted.buf);
+	}
+	string_list_clear(&changes, 1);
+
+	dir_init(&dir);
+	dir.flags |= DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
+	dir.untracked = istate->untracked;
+	setup_standard_excludes(&dir);
+	fill_directory(&dir, istate, &pathspec);
+	for (i = 0; i < dir.nr; i++) {
+		struct dir_entry *ent = dir.entries[i];
+		if (!index_name_is_other(istate, ent->name, ent->len))
+			continue;
+		quote_path(ent->name, NULL, &quoted, QUOTE_PATH_QUOTE_SP);
+		strbuf_addf(out, "?? %s\n", quoted.buf);
+	}
+	dir_clear(&dir);
+	strbuf_release(&quoted);
+	return 0;
+}
+
+typedef int (*query_fn)(const char **args, struct strbuf *out,
+			struct strbuf *err);
+
+static int query_capabilities(const char **args, struct strbuf *out,
+			      struct strbuf *err);
+
+static struct {
+	const char *name;
+	query_fn fn;
+} queries[] = {
+	{ "capabilities", query_capabilities },
+	{ "rev-parse", query_rev_parse },
+	{ "for-each-ref", query_for_each_ref },
+	{ "cat-file", query_cat_file },
+	{ "object-info", query_object_info },
+	{ "status", query_status },
+};
+
+static int query_capabilities(const char **args, struct strbuf *out,
+			      struct strbuf *err)
+{
+	int i;
+
+	strbuf_addf(out, "version %d\n", QUERY_PROTOCOL_VERSION);
+	for (i = 0; i < ARRAY_SIZE(queries); i++)
+		strbuf_addf(out, "command %s\n", queries[i].name);
+	return 0;
+}
+
+/*
+ * A request is "v<version> <command>" followed by one argument per
+ * line; the answer is "ok" followed by the output of the command, or
+ * "error <message>".
+ */
+static void answer_request(struct query_daemon_state *state,
+			   const char *request, struct strbuf *answer)
+{
+	struct strbuf out = STRBUF_INIT, err = STRBUF_INIT;
+	struct strvec args = STRVEC_INIT;
+	struct string_list lines = STRING_LIST_INIT_DUP;
+	const char *command;
+	char *end;
+	long version;
+	int i;
+
+	string_list_split(&lines, request, '\n', -1);
+	if (lines.nr && !*lines.items[lines.nr - 1].string)
+		lines.nr--; /* the terminating newline */
+
+	if (!lines.nr || !skip_prefix(lines.items[0].string, "v", &command) ||
+	    (version = strtol(command, &end, 10)) <= 0 || *end != ' ') {
+		strbuf_addstr(answer, "error malformed request\n");
+		goto done;
+	}
+	if (version != QUERY_PROTOCOL_VERSION) {
+		strbuf_addf(answer, "error unsupported version %ld\n", version);
+		goto done;
+	}
+	command = end + 1;
+	for (i = 1; i < lines.nr; i++)
+		strvec_push(&args, lines.items[i].string);
+
+	for (i = 0; i < ARRAY_SIZE(queries); i++)
+		if (!strcmp(queries[i].name, command))
+			break;
+	if (i == ARRAY_SIZE(queries)) {
+		strbuf_addf(answer, "error unknown command '%s'\n", command);
+		goto done;
+	}
+
+	trace2_region_enter("query", command, the_repository);
+	pthread_mutex_lock(&state->lock);
+	refresh_loaded_state(state);
+	trace2_data_intmax("query", the_repository, "index-loads",
+			   state->index_loads);
+	trace2_data_intmax("query", the_repository, "refs-reloads",
+			   state->refs_reloads);
+	trace2_data_intmax("query", the_repository, "pack-reloads",
+			   state->pack_reloads);
+	if (queries[i].fn(args.v, &out, &err)) {
+		strbuf_addf(answer, "error %s\n", err.buf);
+	} else {
+		strbuf_addstr(answer, "ok\n");
+		strbuf_addbuf(answer, &out);
+	}
+	pthread_mutex_unlock(&state->lock);
+	trace2_region_leave("query", command, the_repository);
+
+done:
+	string_list_clear(&lines, 0);
+	strvec_clear(&args);
+	strbuf_release(&out);
+	strbuf_release(&err);
+}
+
+static ipc_server_application_cb handle_client;
+
+static int handle_client(void *data,
+			 const char *request, size_t request_len,
+			 ipc_server_reply_cb *reply,
+			 struct ipc_server_reply_data *reply_data)
+{
+	struct query_daemon_state *state = data;
+	struct strbuf answer = STRBUF_INIT;
+
+	if (request_len != strlen(request)) {
+		strbuf_addstr(&answer, "error malformed request\n");
+		reply(reply_data, answer.buf, answer.len);
+		strbuf_release(&answer);
+		return 0;
+	}
+
+	if (!strcmp(request, "quit"))
+		return SIMPLE_IPC_QUIT;
+
+	answer_request(state, request, &answer);
+	reply(reply_data, answer.buf, answer.len);
+	strbuf_release(&answer);
+	return 0;
+}
+
+static int query_run_daemon(void)
+{
+	struct query_daemon_state state = {
+		.refs_fingerprint = STRBUF_INIT,
+	};
+	struct ipc_server_opts ipc_opts = {
+		.nr_threads = query__ipc_threads,
+
+		/*
+		 * No other threads exist yet, so the IPC layer may
+		 * chdir() to create the socket.
+		 */
+		.uds_disallow_chdir = 0
+	};
+	int ret;
+
+	pthread_mutex_init(&state.lock, NULL);
+	state.index.path = xstrdup(the_repository->index_file);
+	state.packs.path = xstrfmt("%s/pack", get_object_directory());
+
+	/* load everything up front, so the first query is fast, too */
+	refresh_loaded_state(&state);
+	get_all_packs(the_repository);
+
+	ret = ipc_server_run(query_ipc_path(), &ipc_opts,
+			     handle_client, &state);
+	if (ret == -2)
+		ret = error(_("query--daemon is already running"));
+	else if (ret)
+		ret = error(_("could not start the IPC server"));
+
+	pthread_mutex_destroy(&state.lock);
+	free(state.index.path);
+	free(state.packs.path);
+	strbuf_release(&state.refs_fingerprint);
+	return ret;
+}
+
+static int try_to_run_foreground_daemon(void)
+{
+	if (ipc_get_active_state(query_ipc_path()) == IPC_STATE__LISTENING)
+		die(_("query--daemon is already running"));
+
+	return !!query_run_daemon();
+}
+
+static int try_to_start_background_daemon(void)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	time_t time_limit;
+
+	if (ipc_get_active_state(query_ipc_path()) == IPC_STATE__LISTENING)
+		die(_("query--daemon is already running"));
+
+	cp.git_cmd = 1;
+	cp.no_stdin = 1;
+	cp.no_stdout = 1;
+	cp.no_stderr = 1;
+	strvec_pushl(&cp.args, "query--daemon", "run", NULL);
+	strvec_pushf(&cp.args, "--ipc-threads=%d", query__ipc_threads);
+	if (start_command(&cp))
+		return error(_("could not spawn query--daemon in the background"));
+
+	/*
+	 * Wait until the daemon listens, so that "start" followed by
+	 * a query does not race; whoever answers on the socket is fine.
+	 */
+	time_limit = time(NULL) + query__start_timeout_sec;
+	while (ipc_get_active_state(query_ipc_path()) != IPC_STATE__LISTENING) {
+		int status;
+
+		if (waitpid(cp.pid, &status, WNOHANG) == cp.pid &&
+		    ipc_get_active_state(query_ipc_path()) != IPC_STATE__LISTENING)
+			return error(_("query--daemon failed to start"));
+		if (time(NULL) > time_limit)
+			return error(_("query--daemon not online yet"));
+		sleep_millisec(50);
+	}
+	return 0;
+}
+
+static int send_request(const char *request, struct strbuf *answer)
+{
+	struct ipc_client_connect_options options =
+		IPC_CLIENT_CONNECT_OPTIONS_INIT;
+
+	options.wait_if_busy = 1;
+	return ipc_client_send_command(query_ipc_path(), &options,
+				       request, strlen(request), answer);
+}
+
+static int do_as_client__send_stop(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+
+	if (ipc_get_active_state(query_ipc_path()) != IPC_STATE__LISTENING)
+		return error(_("query--daemon is not running"));
+	if (send_request("quit", &answer))
+		return -1;
+	strbuf_release(&answer);
+
+	while (ipc_get_active_state(query_ipc_path()) == IPC_STATE__LISTENING)
+		sleep_millisec(50);
+	return 0;
+}
+
+static int do_as_client__status(void)
+{
+	if (ipc_get_active_state(query_ipc_path()) == IPC_STATE__LISTENING) {
+		printf(_("The query daemon is running\n"));
+		return 0;
+	}
+	printf(_("The query daemon is not running\n"));
+	return 1;
+}
+
+static int do_as_client__send(int argc, const char **argv)
+{
+	struct strbuf request = STRBUF_INIT, answer = STRBUF_INIT;
+	const char *out;
+	int i, ret = 0;
+
+	if (argc < 1)
+		usage(_("git query--daemon send <command> [<arg>...]"));
+	strbuf_addf(&request, "v%d %s\n", QUERY_PROTOCOL_VERSION, argv[0]);
+	for (i = 1; i < argc; i++) {
+		if (strchr(argv[i], '\n'))
+			die(_("arguments cannot contain newlines"));
+		strbuf_addf(&request, "%s\n", argv[i]);
+	}
+
+	if (ipc_get_active_state(query_ipc_path()) != IPC_STATE__LISTENING)
+		ret = error(_("query--daemon is not running"));
+	else if (send_request(request.buf, &answer))
+		ret = -1;
+	else if (skip_prefix(answer.buf, "ok\n", &out))
+		fwrite(out, 1, answer.buf + answer.len - out, stdout);
+	else if (skip_prefix(answer.buf, "error ", &out))
+		ret = error("%.*s", (int)strcspn(out, "\n"), out);
+	else
+		ret = error(_("unexpected answer from query--daemon"));
+
+	strbuf_release(&request);
+	strbuf_release(&answer);
+	return ret;
+}
+
+int cmd_query__daemon(int argc, const char **argv, const char *prefix)
+{
+	const char *subcmd;
+	struct option options[] = {
+		OPT_INTEGER(0, "ipc-threads", &query__ipc_threads,
+			    N_("use <n> ipc worker threads")),
+		OPT_INTEGER(0, "start-timeout", &query__start_timeout_sec,
+			    N_("max seconds to wait for background daemon startup")),
+		OPT_END()
+	};
+
+	if (argc < 2 || (argc == 2 && !strcmp(argv[1], "-h")))
+		usage_with_options(builtin_query__daemon_usage, options);
+
+	git_config(git_default_config, NULL);
+
+	subcmd = argv[1];
+	if (!strcmp(subcmd, "send"))
+		return !!do_as_client__send(argc - 2, argv + 2);
+
+	argc = parse_options(argc - 1, argv + 1, prefix, options,
+			     builtin_query__daemon_usage, 0);
+	if (argc)
+		usage_with_options(builtin_query__daemon_usage, options);
+	if (query__ipc_threads < 1)
+		die(_("invalid 'ipc-threads' value (%d)"), query__ipc_threads);
+
+	if (!strcmp(subcmd, "start"))
+		return !!try_to_start_background_daemon();
+	if (!strcmp(subcmd, "run"))
+		return !!try_to_run_foreground_daemon();
+	if (!strcmp(subcmd, "stop"))
+		return !!do_as_client__send_stop();
+	if (!strcmp(subcmd, "status"))
+		return !!do_as_client__status();
+
+	die(_("Unhandled subcommand '%s'"), subcmd);
+}
+
+#else
+int cmd_query__daemon(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_query__daemon_usage, options);
+
+	die(_("query--daemon not supported on this platform"));
+}
+#endif
@@ -800,6 +800,14 @@ struct receive_hook_feed_state {
 	int skip_broken;
 	struct strbuf buf;
 	const struct string_list *push_options;
+
+	/*
+	 * If set, called while the hook runs, once it has been fed. Its
+	 * errors go to err_fd, which it takes over: a descriptor of the
+	 * hook's sideband muxer if there is one, or 0 for our own stderr.
+	 */
+	void (*concurrently)(void *, int err_fd);
+	void *concurrently_data;
 };
 
 typedef int (*feed_fn)(void *, const char **, size_t *);
@@ -809,6 +817,7 @@ static int run_and_feed_hook(const char *hook_name, feed_fn feed,
 	struct child_process proc = CHILD_PROCESS_INIT;
 	struct async muxer;
 	const char *argv[2];
+	int concurrent_err = 0;
 	int code;
 
 	argv[0] = find_hook(hook_name);
@@ -844,12 +853,21 @@ static int run_and_feed_hook(const char *hook_name, feed_fn feed,
 		if (code)
 			return code;
 		proc.err = muxer.in;
+		/*
+		 * start_command() closes proc.err; keep our own end so
+		 * that whatever runs concurrently shares the muxer
+		 * instead of racing it with writes of its own to fd 1.
+		 */
+		if (feed_state->concurrently)
+			concurrent_err = xdup(muxer.in);
 	}
 
 	prepare_push_cert_sha1(&proc);
 
 	code = start_command(&proc);
 	if (code) {
+		if (concurrent_err)
+			close(concurrent_err);
 		if (use_sideband)
 			finish_async(&muxer);
 		return code;
@@ -866,6 +884,9 @@ static int run_and_feed_hook(const char *hook_name, feed_fn feed,
 			break;
 	}
 	close(proc.in);
+	if (feed_state->concurrently)
+		feed_state->concurrently(feed_state->concurrently_data,
+					 concurrent_err);
 	if (use_sideband)
 		finish_async(&muxer);
 
@@ -919,7 +940,9 @@ static int feed_receive_hook(void *state_, const char **bufp, size_t *sizep)
 static int run_receive_hook(struct command *commands,
 			    const char *hook_name,
 			    int skip_broken,
-			    const struct string_list *push_options)
+			    const struct string_list *push_options,
+			    void (*concurrently)(void *, int),
+			    void *concurrently_data)
 {
 	struct receive_hook_feed_state state;
 	int status;
@@ -928,6 +951,8 @@ static int run_receive_hook(struct command *commands,
 	state.cmd = commands;
 	state.skip_broken = skip_broken;
 	state.report = NULL;
+	state.concurrently = concurrently;
+	state.concurrently_data = concurrently_data;
 	if (feed_receive_hook(&state, NULL, NULL))
 		return 0;
 	state.cmd = commands;
@@ -1913,25 +1938,21 @@ static void execute_commands_atomic(struct command *commands,
 	strbuf_release(&err);
 }
 
-static void execute_commands(struct command *commands,
-			     const char *unpacker_error,
-			     struct shallow_info *si,
-			     const struct string_list *push_options)
+struct connectivity_check {
+	struct command *commands;
+	struct shallow_info *si;
+	int done;
+};
+
+static void check_connectivity(void *data_, int err_fd)
 {
+	struct connectivity_check *check = data_;
 	struct check_connected_options opt = CHECK_CONNECTED_INIT;
-	struct command *cmd;
 	struct iterate_data data;
 	struct async muxer;
-	int err_fd = 0;
-	int run_proc_receive = 0;
-
-	if (unpacker_error) {
-		for (cmd = commands; cmd; cmd = cmd->next)
-			cmd->error_string = "unpacker error";
-		return;
-	}
+	int own_muxer = use_sideband && !err_fd;
 
-	if (use_sideband) {
+	if (own_muxer) {
 		memset(&muxer, 0, sizeof(muxer));
 		muxer.proc = copy_to_sideband;
 		muxer.in = -1;
@@ -1940,16 +1961,45 @@ static void execute_commands(struct command *commands,
 		/* ...else, continue without relaying sideband */
 	}
 
-	data.cmds = commands;
-	data.si = si;
+	data.cmds = check->commands;
+	data.si = check->si;
 	opt.err_fd = err_fd;
-	opt.progress = err_fd && !quiet;
+	/* Progress would be garbled by the output of a running hook. */
+	opt.progress = err_fd && !quiet && !find_hook("pre-receive");
 	opt.env = tmp_objdir_env(tmp_objdir);
 	if (check_connected(iterate_receive_command_list, &data, &opt))
-		set_connectivity_errors(commands, si);
+		set_connectivity_errors(check->commands, check->si);
 
-	if (use_sideband)
+	if (own_muxer)
 		finish_async(&muxer);
+	check->done = 1;
+}
+
+static void execute_commands(struct command *commands,
+			     const char *unpacker_error,
+			     struct shallow_info *si,
+			     const struct string_list *push_options)
+{
+	struct connectivity_check check = { commands, si };
+	struct command *cmd;
+	int run_proc_receive = 0;
+	int declined;
+
+	if (unpacker_error) {
+		for (cmd = commands; cmd; cmd = cmd->next)
+			cmd->error_string = "unpacker error";
+		return;
+	}
+
+	/*
+	 * The pre-receive hook is told about every command, whether it
+	 * passes the connectivity check or not, so there is no need to
+	 * wait for the check before starting the hook.
+	 */
+	declined = run_receive_hook(commands, "pre-receive", 0, push_options,
+				    check_connectivity, &check);
+	if (!check.done)
+		check_connectivity(&check, 0);
 
 	reject_updates_to_hidden(commands);
 
@@ -1969,7 +2019,7 @@ static void execute_commands(struct command *commands,
 		}
 	}
 
-	if (run_receive_hook(commands, "pre-receive", 0, push_options)) {
+	if (declined) {
 		for (cmd = commands; cmd; cmd = cmd->next) {
 			if (!cmd->error_string)
 				cmd->error_string = "pre-receive hook declined";
@@ -2212,7 +2262,7 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 		strvec_push(&child.args, alt_shallow_file);
 	}
 
-	tmp_objdir = tmp_objdir_create();
+	tmp_objdir = tmp_objdir_create("incoming");
 	if (!tmp_objdir) {
 		if (err_fd > 0)
 			close(err_fd);
@@ -2569,7 +2619,7 @@ int cmd_receive_pack(int argc, const char **argv, const char *prefix)
 		else if (report_status)
 			report(commands, unpack_status);
 		run_receive_hook(commands, "post-receive", 1,
-				 &push_options);
+				 &push_options, NULL, NULL);
 		run_update_post_hook(commands);
 		string_list_clear(&push_options, 0);
 		if (auto_gc) {
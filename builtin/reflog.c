@@ -10,6 +10,7 @@
 #include "diff.h"
 #include "revision.h"
 #include "reachable.h"
+#include "pack-bitmap.h"
 #include "worktree.h"
 
 /* NEEDSWORK: switch to using parse_options */
@@ -65,6 +66,12 @@ struct collect_reflog_cb {
 #define STUDYING	(1u<<11)
 #define REACHABLE	(1u<<12)
 
+/*
+ * The objects mark_reachable_objects() found with bitmaps, other than
+ * commits, which it does not mark SEEN.
+ */
+static struct bitmap_index *reachable_bitmap;
+
 static int tree_is_complete(const struct object_id *oid)
 {
 	struct tree_desc desc;
@@ -75,7 +82,8 @@ static int tree_is_complete(const struct object_id *oid)
 	tree = lookup_tree(the_repository, oid);
 	if (!tree)
 		return 0;
-	if (tree->object.flags & SEEN)
+	if ((tree->object.flags & SEEN) ||
+	    bitmap_has_oid_in_result(reachable_bitmap, oid))
 		return 1;
 	if (tree->object.flags & INCOMPLETE)
 		return 0;
@@ -607,7 +615,8 @@ static int cmd_reflog_expire(int argc, const char **argv, const char *prefix)
 		cb.cmd.revs.ignore_missing_links = 1;
 		if (flags & EXPIRE_REFLOGS_VERBOSE)
 			printf(_("Marking reachable objects..."));
-		mark_reachable_objects(&cb.cmd.revs, 0, 0, NULL);
+		reachable_bitmap = mark_reachable_objects(&cb.cmd.revs, 0, 0,
+							  NULL);
 		if (flags & EXPIRE_REFLOGS_VERBOSE)
 			putchar('\n');
 	}
@@ -654,6 +663,8 @@ static int cmd_reflog_expire(int argc, const char **argv, const char *prefix)
 					reflog_expiry_cleanup,
 					&cb);
 	}
+	free_bitmap_index(reachable_bitmap);
+	reachable_bitmap = NULL;
 	return status;
 }
 
@@ -15,11 +15,13 @@
 #include "promisor-remote.h"
 #include "shallow.h"
 #include "pack.h"
+#include "pack-geometry.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
 static int write_bitmaps = -1;
 static int use_delta_islands;
+static unsigned long geometric_max_objects;
 static char *packdir, *packtmp_name, *packtmp;
 
 static const char *const git_repack_usage[] = {
@@ -52,6 +54,10 @@ static int repack_config(const char *var, const char *value, void *cb)
 		use_delta_islands = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "repack.geometricmaxobjects")) {
+		geometric_max_objects = git_config_ulong(var, value);
+		return 0;
+	}
 	return git_default_config(var, value, cb);
 }
 
@@ -136,7 +142,7 @@ static void remove_redundant_pack(const char *dir_name, const char *base_name)
 	struct strbuf buf = STRBUF_INIT;
 	struct multi_pack_index *m = get_local_multi_pack_index(the_repository);
 	strbuf_addf(&buf, "%s.pack", base_name);
-	if (m && midx_contains_pack(m, buf.buf))
+	if (midx_chain_contains_pack(m, buf.buf))
 		clear_midx_file(the_repository);
 	strbuf_insertf(&buf, 0, "%s/", dir_name);
 	unlink_pack_path(buf.buf, 1);
@@ -212,6 +218,8 @@ static struct {
 	{".rev", 1},
 	{".bitmap", 1},
 	{".promisor", 1},
+	{".dcand", 1},
+	{".mtimes", 1},
 };
 
 static unsigned populate_pack_exts(char *name)
@@ -296,141 +304,63 @@ static void repack_promisor_objects(const struct pack_objects_args *args,
 
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
+#define PACK_CRUFT 4
 
-struct pack_geometry {
-	struct packed_git **pack;
-	uint32_t pack_nr, pack_alloc;
-	uint32_t split;
-};
-
-static uint32_t geometry_pack_weight(struct packed_git *p)
-{
-	if (open_pack_index(p))
-		die(_("cannot open index for %s"), p->pack_name);
-	return p->num_objects;
-}
-
-static int geometry_cmp(const void *va, const void *vb)
-{
-	uint32_t aw = geometry_pack_weight(*(struct packed_git **)va),
-		 bw = geometry_pack_weight(*(struct packed_git **)vb);
-
-	if (aw < bw)
-		return -1;
-	if (aw > bw)
-		return 1;
-	return 0;
-}
-
-static void init_pack_geometry(struct pack_geometry **geometry_p)
-{
-	struct packed_git *p;
-	struct pack_geometry *geometry;
-
-	*geometry_p = xcalloc(1, sizeof(struct pack_geometry));
-	geometry = *geometry_p;
-
-	for (p = get_all_packs(the_repository); p; p = p->next) {
-		if (!pack_kept_objects && p->pack_keep)
-			continue;
-
-		ALLOC_GROW(geometry->pack,
-			   geometry->pack_nr + 1,
-			   geometry->pack_alloc);
-
-		geometry->pack[geometry->pack_nr] = p;
-		geometry->pack_nr++;
-	}
-
-	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
-}
-
-static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+/*
+ * Write a cruft pack holding the unreachable objects of the packs that
+ * are about to be deleted, along with loose objects, and add its name
+ * to "names".
+ */
+static int write_cruft_pack(const struct pack_objects_args *args,
+			    const char *cruft_expiration,
+			    struct string_list *names,
+			    const struct string_list *existing_packs,
+			    const struct string_list *keep_pack_list)
 {
-	uint32_t i;
-	uint32_t split;
-	off_t total_size = 0;
-
-	if (!geometry->pack_nr) {
-		geometry->split = geometry->pack_nr;
-		return;
-	}
-
-	/*
-	 * First, count the number of packs (in descending order of size) which
-	 * already form a geometric progression.
-	 */
-	for (i = geometry->pack_nr - 1; i > 0; i--) {
-		struct packed_git *ours = geometry->pack[i];
-		struct packed_git *prev = geometry->pack[i - 1];
-
-		if (unsigned_mult_overflows(factor, geometry_pack_weight(prev)))
-			die(_("pack %s too large to consider in geometric "
-			      "progression"),
-			    prev->pack_name);
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct strbuf line = STRBUF_INIT;
+	struct string_list_item *item;
+	FILE *in, *out;
+	int ret;
 
-		if (geometry_pack_weight(ours) < factor * geometry_pack_weight(prev))
-			break;
-	}
+	prepare_pack_objects(&cmd, args);
 
-	split = i;
+	strvec_push(&cmd.args, "--cruft");
+	if (cruft_expiration)
+		strvec_pushf(&cmd.args, "--cruft-expiration=%s",
+			     cruft_expiration);
+	strvec_push(&cmd.args, "--honor-pack-keep");
+	for_each_string_list_item(item, keep_pack_list)
+		strvec_pushf(&cmd.args, "--keep-pack=%s", item->string);
+	strvec_push(&cmd.args, "--non-empty");
+	cmd.in = -1;
 
-	if (split) {
-		/*
-		 * Move the split one to the right, since the top element in the
-		 * last-compared pair can't be in the progression. Only do this
-		 * when we split in the middle of the array (otherwise if we got
-		 * to the end, then the split is in the right place).
-		 */
-		split++;
-	}
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
 
 	/*
-	 * Then, anything to the left of 'split' must be in a new pack. But,
-	 * creating that new pack may cause packs in the heavy half to no longer
-	 * form a geometric progression.
-	 *
-	 * Compute an expected size of the new pack, and then determine how many
-	 * packs in the heavy half need to be joined into it (if any) to restore
-	 * the geometric progression.
+	 * Everything in the packs we just wrote is reachable; anything
+	 * else in the packs we are about to delete, and any loose object,
+	 * is not.
 	 */
-	for (i = 0; i < split; i++) {
-		struct packed_git *p = geometry->pack[i];
+	in = xfdopen(cmd.in, "w");
+	for_each_string_list_item(item, names)
+		fprintf(in, "%s-%s.pack\n", packtmp_name, item->string);
+	for_each_string_list_item(item, existing_packs)
+		fprintf(in, "-%s.pack\n", item->string);
+	fclose(in);
 
-		if (unsigned_add_overflows(total_size, geometry_pack_weight(p)))
-			die(_("pack %s too large to roll up"), p->pack_name);
-		total_size += geometry_pack_weight(p);
-	}
-	for (i = split; i < geometry->pack_nr; i++) {
-		struct packed_git *ours = geometry->pack[i];
-
-		if (unsigned_mult_overflows(factor, total_size))
-			die(_("pack %s too large to roll up"), ours->pack_name);
-
-		if (geometry_pack_weight(ours) < factor * total_size) {
-			if (unsigned_add_overflows(total_size,
-						   geometry_pack_weight(ours)))
-				die(_("pack %s too large to roll up"),
-				    ours->pack_name);
-
-			split++;
-			total_size += geometry_pack_weight(ours);
-		} else
-			break;
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline_lf(&line, out) != EOF) {
+		if (line.len != the_hash_algo->hexsz)
+			die(_("repack: Expecting full hex object ID lines only from pack-objects."));
+		string_list_append(names, line.buf);
 	}
+	fclose(out);
+	strbuf_release(&line);
 
-	geometry->split = split;
-}
-
-static void clear_pack_geometry(struct pack_geometry *geometry)
-{
-	if (!geometry)
-		return;
-
-	free(geometry->pack);
-	geometry->pack_nr = 0;
-	geometry->pack_alloc = 0;
-	geometry->split = 0;
+	return finish_command(&cmd);
 }
 
 int cmd_repack(int argc, const char **argv, const char *prefix)
@@ -449,11 +379,16 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int pack_everything = 0;
 	int delete_redundant = 0;
 	const char *unpack_unreachable = NULL;
+	const char *cruft_expiration = NULL;
 	int keep_unreachable = 0;
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	int no_update_server_info = 0;
 	struct pack_objects_args po_args = {NULL};
 	int geometric_factor = 0;
+	struct multi_pack_index *m;
+	unsigned midx_flags = 0;
+	int refresh_midx = 0;
+	int midx_bitmap = 0;
 
 	struct option builtin_repack_options[] = {
 		OPT_BIT('a', NULL, &pack_everything,
@@ -461,6 +396,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		OPT_BIT('A', NULL, &pack_everything,
 				N_("same as -a, and turn unreachable objects loose"),
 				   LOOSEN_UNREACHABLE | ALL_INTO_ONE),
+		OPT_BIT(0, "cruft", &pack_everything,
+				N_("same as -a, and pack unreachable objects into a cruft pack"),
+				   PACK_CRUFT | ALL_INTO_ONE),
+		OPT_STRING(0, "cruft-expiration", &cruft_expiration, N_("approxidate"),
+				N_("with --cruft, expire objects older than this")),
 		OPT_BOOL('d', NULL, &delete_redundant,
 				N_("remove redundant packs, and run git-prune-packed")),
 		OPT_BOOL('f', NULL, &po_args.no_reuse_delta,
@@ -496,6 +436,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("do not repack this pack")),
 		OPT_INTEGER('g', "geometric", &geometric_factor,
 			    N_("find a geometric progression with factor <N>")),
+		OPT_MAGNITUDE(0, "geometric-max-objects", &geometric_max_objects,
+			      N_("roll up packs of at most <N> objects in total with --geometric")),
 		OPT_END()
 	};
 
@@ -511,13 +453,29 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (pack_everything & PACK_CRUFT) {
+		if (keep_unreachable ||
+		    unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE))
+			die(_("--cruft is incompatible with -A and --keep-unreachable"));
+	}
+
+	/*
+	 * A geometric repack leaves several packs behind, so a bitmap
+	 * can only cover all of them by way of the multi-pack-index.
+	 */
+	if (geometric_factor && write_bitmaps > 0) {
+		midx_bitmap = 1;
+		write_bitmaps = 0;
+	}
+
 	if (write_bitmaps < 0) {
 		if (!(pack_everything & ALL_INTO_ONE) ||
 		    !is_bare_repository())
 			write_bitmaps = 0;
 	}
 	if (pack_kept_objects < 0)
-		pack_kept_objects = write_bitmaps > 0;
+		pack_kept_objects = pack_kept_objects_default(write_bitmaps,
+							      geometric_factor);
 
 	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
 		die(_(incremental_bitmap_conflict_error));
@@ -525,8 +483,33 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (geometric_factor) {
 		if (pack_everything)
 			die(_("--geometric is incompatible with -A, -a"));
-		init_pack_geometry(&geometry);
-		split_pack_geometry(geometry, geometric_factor);
+		CALLOC_ARRAY(geometry, 1);
+		init_pack_geometry(geometry, the_repository, pack_kept_objects);
+		split_pack_geometry(geometry, geometric_factor,
+				    geometric_max_objects);
+
+		/*
+		 * Rolling up packs drops the multi-pack-index if it covers
+		 * any of them, and new packs are not in it anyway; write
+		 * a fresh one at the end so that readers keep using it.
+		 */
+		m = get_local_multi_pack_index(the_repository);
+		if (m) {
+			char *rev = get_midx_rev_filename(m);
+			char *bitmap = get_midx_bitmap_filename(m);
+
+			refresh_midx = 1;
+			if (file_exists(rev))
+				midx_flags |= MIDX_WRITE_REV_INDEX;
+			if (file_exists(bitmap))
+				midx_bitmap = 1;
+			free(rev);
+			free(bitmap);
+		}
+		if (midx_bitmap) {
+			refresh_midx = 1;
+			midx_flags |= MIDX_WRITE_BITMAP | MIDX_WRITE_REV_INDEX;
+		}
 	}
 
 	packdir = mkpathdup("%s/pack", get_object_directory());
@@ -635,6 +618,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (ret)
 		return ret;
 
+	if ((pack_everything & PACK_CRUFT) && delete_redundant) {
+		ret = write_cruft_pack(&po_args, cruft_expiration, &names,
+				       &existing_packs, &keep_pack_list);
+		if (ret)
+			return ret;
+	}
+
 	if (!names.nr && !po_args.quiet)
 		printf_ln(_("Nothing new to pack."));
 
@@ -725,13 +715,25 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		update_server_info(0);
 	remove_temporary_files();
 
-	if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
+	if (refresh_midx && (names.nr || midx_bitmap)) {
+		const char *preferred = NULL;
+
+		/*
+		 * Prefer the largest pack that survived the roll-up, so that
+		 * most objects can be reused verbatim from the bitmap.
+		 */
+		if (geometry && geometry->split < geometry->pack_nr)
+			preferred = pack_basename(geometry->pack[geometry->pack_nr - 1]);
+		write_midx_file(get_object_directory(), preferred, midx_flags);
+	}
+	else if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
 		write_midx_file(get_object_directory(), NULL, 0);
 
 	string_list_clear(&names, 0);
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
 	clear_pack_geometry(geometry);
+	free(geometry);
 	strbuf_release(&line);
 
 	return 0;
@@ -0,0 +1,217 @@
+/*
+ * "git replay" builtin command
+ */
+
+#include "builtin.h"
+#include "config.h"
+#include "commit.h"
+#include "khash.h"
+#include "merge-ort.h"
+#include "parse-options.h"
+#include "refs.h"
+#include "revision.h"
+#include "tree.h"
+
+static const char * const replay_usage[] = {
+	N_("git replay --onto <newbase> <revision-range>..."),
+	NULL
+};
+
+static char *get_author(const char *message)
+{
+	size_t len;
+	const char *a;
+
+	a = find_commit_header(message, "author", &len);
+	if (a)
+		return xmemdupz(a, len);
+
+	return NULL;
+}
+
+/*
+ * Write a commit like "based_on", with the same message and author,
+ * but with "tree" and "parent".
+ */
+static struct commit *create_commit(struct tree *tree,
+				    struct commit *based_on,
+				    struct commit *parent)
+{
+	struct object_id ret;
+	struct object *obj;
+	struct commit_list *parents = NULL;
+	char *author;
+	struct commit_extra_header *extra;
+	struct strbuf msg = STRBUF_INIT;
+	const char *out_enc = get_commit_output_encoding();
+	const char *message = logmsg_reencode(based_on, NULL, out_enc);
+	const char *orig_message = NULL;
+	const char *exclude_gpgsig[] = { "gpgsig", NULL };
+
+	commit_list_insert(parent, &parents);
+	extra = read_commit_extra_headers(based_on, exclude_gpgsig);
+	find_commit_subject(message, &orig_message);
+	strbuf_addstr(&msg, orig_message);
+	author = get_author(message);
+	reset_ident_date();
+	if (commit_tree_extended(msg.buf, msg.len, &tree->object.oid, parents,
+				 &ret, author, NULL, NULL, extra))
+		die(_("failed to write commit object"));
+	free(author);
+	free_commit_extra_headers(extra);
+	unuse_commit_buffer(based_on, message);
+	strbuf_release(&msg);
+
+	obj = parse_object(the_repository, &ret);
+	return (struct commit *)obj;
+}
+
+struct ref_to_update {
+	char *refname;
+	struct object_id old_oid;
+};
+
+/*
+ * Find the references among the positive revisions on the command
+ * line; they are what the replayed commits are for.
+ */
+static void find_refs_to_update(struct rev_info *revs,
+				struct ref_to_update **refs, int *nr)
+{
+	int i, alloc = 0;
+
+	*nr = 0;
+	for (i = 0; i < revs->cmdline.nr; i++) {
+		struct rev_cmdline_entry *e = &revs->cmdline.rev[i];
+		struct ref_to_update *ref;
+		struct object_id oid;
+		char *refname = NULL;
+
+		if (e->flags & UNINTERESTING)
+			continue;
+		if (dwim_ref(e->name, strlen(e->name), &oid, &refname, 0) != 1 ||
+		    !starts_with(refname, "refs/")) {
+			free(refname);
+			die(_("'%s' is not a reference"), e->name);
+		}
+
+		ALLOC_GROW(*refs, *nr + 1, alloc);
+		ref = &(*refs)[(*nr)++];
+		ref->refname = refname;
+		oidcpy(&ref->old_oid, &e->item->oid);
+	}
+	if (!*nr)
+		die(_("nothing to replay; give a reference to replay"));
+}
+
+int cmd_replay(int argc, const char **argv, const char *prefix)
+{
+	const char *onto_name = NULL;
+	struct commit *onto, *commit;
+	struct rev_info revs;
+	struct merge_options merge_opt;
+	struct merge_result result = { 0 };
+	struct ref_to_update *refs = NULL;
+	struct strbuf branch2 = STRBUF_INIT;
+	kh_oid_map_t *replayed;
+	int nr_refs, i, ret = 0;
+
+	struct option replay_options[] = {
+		OPT_STRING(0, "onto", &onto_name, N_("revision"),
+			   N_("replay onto the given commit")),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, replay_options, replay_usage,
+			     PARSE_OPT_KEEP_ARGV0 | PARSE_OPT_KEEP_UNKNOWN);
+	if (!onto_name || argc < 2)
+		usage_with_options(replay_usage, replay_options);
+
+	git_config(git_default_config, NULL);
+
+	onto = lookup_commit_reference_by_name(onto_name);
+	if (!onto)
+		die(_("could not parse as commit '%s'"), onto_name);
+
+	repo_init_revisions(the_repository, &revs, prefix);
+	if (setup_revisions(argc, argv, &revs, NULL) > 1)
+		die(_("unrecognized argument: %s"), argv[1]);
+	revs.reverse = 1;
+	revs.sort_order = REV_SORT_IN_GRAPH_ORDER;
+	revs.topo_order = 1;
+	find_refs_to_update(&revs, &refs, &nr_refs);
+
+	if (prepare_revision_walk(&revs) < 0)
+		die(_("error preparing revisions"));
+
+	init_merge_options(&merge_opt, the_repository);
+	merge_opt.show_rename_progress = 0;
+
+	/*
+	 * Each commit is replayed onto the replayed version of its parent,
+	 * or onto <newbase> if its parent is not being replayed.
+	 */
+	replayed = kh_init_oid_map();
+	while ((commit = get_revision(&revs))) {
+		struct commit *base, *parent;
+		khint_t pos;
+		int hashret;
+
+		if (!commit->parents)
+			die(_("cannot replay root commit %s"),
+			    oid_to_hex(&commit->object.oid));
+		if (commit->parents->next)
+			die(_("cannot replay merge commit %s"),
+			    oid_to_hex(&commit->object.oid));
+		base = commit->parents->item;
+
+		pos = kh_get_oid_map(replayed, base->object.oid);
+		parent = pos == kh_end(replayed) ? onto :
+			 kh_value(replayed, pos);
+
+		merge_opt.branch1 = onto_name;
+		strbuf_reset(&branch2);
+		strbuf_add_unique_abbrev(&branch2, &commit->object.oid,
+					 DEFAULT_ABBREV);
+		merge_opt.branch2 = branch2.buf;
+		merge_opt.ancestor = "parent";
+		merge_incore_nonrecursive(&merge_opt,
+					  get_commit_tree(base),
+					  get_commit_tree(parent),
+					  get_commit_tree(commit),
+					  &result);
+		merge_opt.ancestor = NULL;
+		if (result.clean < 0)
+			die(_("failure to merge"));
+		if (!result.clean) {
+			error(_("could not replay %s: conflicts"),
+			      oid_to_hex(&commit->object.oid));
+			ret = 1;
+			break;
+		}
+
+		pos = kh_put_oid_map(replayed, commit->object.oid, &hashret);
+		kh_value(replayed, pos) = create_commit(result.tree, commit,
+							parent);
+	}
+	if (result.priv)
+		merge_finalize(&merge_opt, &result);
+	strbuf_release(&branch2);
+
+	for (i = 0; i < nr_refs; i++) {
+		khint_t pos = kh_get_oid_map(replayed, refs[i].old_oid);
+		struct commit *new_tip;
+
+		if (!ret) {
+			new_tip = pos == kh_end(replayed) ? onto :
+				  kh_value(replayed, pos);
+			printf("update %s %s %s\n", refs[i].refname,
+			       oid_to_hex(&new_tip->object.oid),
+			       oid_to_hex(&refs[i].old_oid));
+		}
+		free(refs[i].refname);
+	}
+	free(refs);
+	kh_destroy_oid_map(replayed);
+	return ret;
+}
@@ -18,6 +18,7 @@
 #include "reflog-walk.h"
 #include "oidset.h"
 #include "packfile.h"
+#include "thread-utils.h"
 
 static const char rev_list_usage[] =
 "git rev-list [OPTION] <commit-id>... [ -- paths... ]\n"
@@ -53,6 +54,7 @@ static const char rev_list_usage[] =
 "    --abbrev-commit\n"
 "    --left-right\n"
 "    --count\n"
+"    --threads=<n>\n"
 "  special purpose:\n"
 "    --bisect\n"
 "    --bisect-vars\n"
@@ -81,16 +83,37 @@ static int arg_show_object_names = 1;
 #define DEFAULT_OIDSET_SIZE     (16*1024)
 
 static int show_disk_usage;
-static off_t total_disk_usage;
+static int show_disk_usage_by_type;
+static int traverse_threads;
+static struct object_disk_usage disk_usage[OBJ_TAG + 1];
 
-static off_t get_object_disk_usage(struct object *obj)
+static void add_object_disk_usage(struct object *obj)
 {
 	off_t size;
 	struct object_info oi = OBJECT_INFO_INIT;
 	oi.disk_sizep = &size;
 	if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
 		die(_("unable to get disk usage of %s"), oid_to_hex(&obj->oid));
-	return size;
+	if (obj->type <= OBJ_NONE || obj->type > OBJ_TAG)
+		BUG("unexpected type of %s", oid_to_hex(&obj->oid));
+	disk_usage[obj->type].count++;
+	disk_usage[obj->type].size += size;
+}
+
+static void print_disk_usage(void)
+{
+	enum object_type type;
+	off_t total = 0;
+
+	for (type = OBJ_COMMIT; type <= OBJ_TAG; type++) {
+		if (show_disk_usage_by_type)
+			printf("%s %"PRIu32" %"PRIuMAX"\n", type_name(type),
+			       disk_usage[type].count,
+			       (uintmax_t)disk_usage[type].size);
+		total += disk_usage[type].size;
+	}
+	if (!show_disk_usage_by_type)
+		printf("%"PRIuMAX"\n", (uintmax_t)total);
 }
 
 static void finish_commit(struct commit *commit);
@@ -102,7 +125,7 @@ static void show_commit(struct commit *commit, void *data)
 	display_progress(progress, ++progress_counter);
 
 	if (show_disk_usage)
-		total_disk_usage += get_object_disk_usage(&commit->object);
+		add_object_disk_usage(&commit->object);
 
 	if (info->flags & REV_LIST_QUIET) {
 		finish_commit(commit);
@@ -275,7 +298,7 @@ static void show_object(struct object *obj, const char *name, void *cb_data)
 		return;
 	display_progress(progress, ++progress_counter);
 	if (show_disk_usage)
-		total_disk_usage += get_object_disk_usage(obj);
+		add_object_disk_usage(obj);
 	if (info->flags & REV_LIST_QUIET)
 		return;
 
@@ -485,8 +508,8 @@ static int try_bitmap_disk_usage(struct rev_info *revs,
 	if (!bitmap_git)
 		return -1;
 
-	printf("%"PRIuMAX"\n",
-	       (uintmax_t)get_disk_usage_from_bitmap(bitmap_git, revs));
+	get_disk_usage_by_type_from_bitmap(bitmap_git, revs, disk_usage);
+	print_disk_usage();
 	return 0;
 }
 
@@ -629,10 +652,26 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 
 		if (!strcmp(arg, "--disk-usage")) {
 			show_disk_usage = 1;
+			show_disk_usage_by_type = 0;
+			info.flags |= REV_LIST_QUIET;
+			continue;
+		}
+		if (skip_prefix(arg, "--disk-usage=", &arg)) {
+			if (strcmp(arg, "by-type"))
+				die(_("invalid --disk-usage value: %s"), arg);
+			show_disk_usage = 1;
+			show_disk_usage_by_type = 1;
 			info.flags |= REV_LIST_QUIET;
 			continue;
 		}
 
+		if (skip_prefix(arg, "--threads=", &arg)) {
+			if (strtol_i(arg, 10, &traverse_threads) ||
+			    traverse_threads < 0)
+				die(_("invalid --threads value: %s"), arg);
+			continue;
+		}
+
 		usage(rev_list_usage);
 
 	}
@@ -663,6 +702,14 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	    (revs.left_right || revs.cherry_mark))
 		die(_("marked counting is incompatible with --objects"));
 
+	/*
+	 * When the objects are only checked or counted, the order they are
+	 * found in does not matter, so the trees can be walked in parallel.
+	 */
+	if (((info.flags & REV_LIST_QUIET) || revs.count) && !bisect_list)
+		revs.traverse_threads = traverse_threads ?
+					traverse_threads : online_cpus();
+
 	save_commit_buffer = (revs.verbose_header ||
 			      revs.grep_filter.pattern_list ||
 			      revs.grep_filter.header_list);
@@ -752,7 +799,7 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	}
 
 	if (show_disk_usage)
-		printf("%"PRIuMAX"\n", (uintmax_t)total_disk_usage);
+		print_disk_usage();
 
 	return 0;
 }
@@ -10,6 +10,7 @@
 #include "cache.h"
 #include "cache-tree.h"
 #include "lockfile.h"
+#include "object-store.h"
 #include "resolve-undo.h"
 #include "unpack-trees.h"
 #include "wt-status.h"
@@ -100,7 +101,8 @@ static int sparse_checkout_list(int argc, const char **argv)
 	return 0;
 }
 
-static int update_working_directory(struct pattern_list *pl)
+static int update_working_directory(struct pattern_list *pl,
+				    struct pattern_list *old_pl)
 {
 	enum update_sparsity_result result;
 	struct unpack_trees_options o;
@@ -121,6 +123,7 @@ static int update_working_directory(struct pattern_list *pl)
 	o.dst_index = r->index;
 	o.skip_sparse_checkout = 0;
 	o.pl = pl;
+	o.old_pl = old_pl;
 
 	setup_work_tree();
 
@@ -213,7 +216,72 @@ static void write_cone_to_file(FILE *fp, struct pattern_list *pl)
 	}
 }
 
-static int write_patterns_and_update(struct pattern_list *pl)
+/*
+ * "info/sparse-checkout.applied" records the checksum of the index and
+ * the hash of the sparse-checkout file right after the index was
+ * updated for that file. When both still match, the skip-worktree bits
+ * in the index are known to reflect the patterns in the file; an edit
+ * of the file, or anything else that rewrote the index, breaks that.
+ */
+static char *get_applied_filename(void)
+{
+	return git_pathdup("info/sparse-checkout.applied");
+}
+
+static int hash_sparse_checkout_file(struct object_id *oid)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *sparse_filename = get_sparse_checkout_filename();
+	int ret = -1;
+
+	if (strbuf_read_file(&buf, sparse_filename, 0) >= 0) {
+		hash_object_file(the_hash_algo, buf.buf, buf.len, "blob", oid);
+		ret = 0;
+	}
+	strbuf_release(&buf);
+	free(sparse_filename);
+	return ret;
+}
+
+static void record_applied_patterns(void)
+{
+	struct object_id oid;
+	const struct object_id *index_oid = &the_repository->index->oid;
+	char *applied_filename = get_applied_filename();
+
+	if (!is_null_oid(index_oid) && !hash_sparse_checkout_file(&oid))
+		write_file(applied_filename, "%s %s", oid_to_hex(index_oid),
+			   oid_to_hex(&oid));
+	else
+		unlink_or_warn(applied_filename);
+	free(applied_filename);
+}
+
+static int patterns_are_applied(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct object_id index_oid, oid;
+	char *applied_filename = get_applied_filename();
+	const char *p;
+	int ret = 0;
+
+	if (strbuf_read_file(&buf, applied_filename, 0) >= 0 &&
+	    !parse_oid_hex(buf.buf, &index_oid, &p) && *p++ == ' ' &&
+	    !parse_oid_hex(p, &oid, &p) && *p == '\n' &&
+	    !is_null_oid(&index_oid) &&
+	    oideq(&index_oid, &the_repository->index->oid)) {
+		struct object_id file_oid;
+
+		ret = !hash_sparse_checkout_file(&file_oid) &&
+		      oideq(&oid, &file_oid);
+	}
+	strbuf_release(&buf);
+	free(applied_filename);
+	return ret;
+}
+
+static int write_patterns_and_update(struct pattern_list *pl,
+				     struct pattern_list *old_pl)
 {
 	char *sparse_filename;
 	FILE *fp;
@@ -229,12 +297,12 @@ static int write_patterns_and_update(struct pattern_list *pl)
 	fd = hold_lock_file_for_update(&lk, sparse_filename,
 				      LOCK_DIE_ON_ERROR);
 
-	result = update_working_directory(pl);
+	result = update_working_directory(pl, old_pl);
 	if (result) {
 		rollback_lock_file(&lk);
 		free(sparse_filename);
 		clear_pattern_list(pl);
-		update_working_directory(NULL);
+		update_working_directory(NULL, NULL);
 		return result;
 	}
 
@@ -247,6 +315,7 @@ static int write_patterns_and_update(struct pattern_list *pl)
 
 	fflush(fp);
 	commit_lock_file(&lk);
+	record_applied_patterns();
 
 	free(sparse_filename);
 	clear_pattern_list(pl);
@@ -349,7 +418,7 @@ static int sparse_checkout_init(int argc, const char **argv)
 	/* If we already have a sparse-checkout file, use it. */
 	if (res >= 0) {
 		free(sparse_filename);
-		return update_working_directory(NULL);
+		return update_working_directory(NULL, NULL);
 	}
 
 	if (get_oid("HEAD", &oid)) {
@@ -372,7 +441,7 @@ static int sparse_checkout_init(int argc, const char **argv)
 	add_pattern(strbuf_detach(&pattern, NULL), empty_base, 0, &pl, 0);
 	pl.use_cone_patterns = init_opts.cone_mode;
 
-	return write_patterns_and_update(&pl);
+	return write_patterns_and_update(&pl, NULL);
 }
 
 static void insert_recursive_pattern(struct pattern_list *pl, struct strbuf *path)
@@ -492,25 +561,16 @@ enum modify_type {
 };
 
 static void add_patterns_cone_mode(int argc, const char **argv,
-				   struct pattern_list *pl)
+				   struct pattern_list *pl,
+				   struct pattern_list *existing)
 {
 	struct strbuf buffer = STRBUF_INIT;
 	struct pattern_entry *pe;
 	struct hashmap_iter iter;
-	struct pattern_list existing;
-	char *sparse_filename = get_sparse_checkout_filename();
 
 	add_patterns_from_input(pl, argc, argv);
 
-	memset(&existing, 0, sizeof(existing));
-	existing.use_cone_patterns = core_sparse_checkout_cone;
-
-	if (add_patterns_from_file_to_list(sparse_filename, "", 0,
-					   &existing, NULL, 0))
-		die(_("unable to load existing sparse-checkout patterns"));
-	free(sparse_filename);
-
-	hashmap_for_each_entry(&existing.recursive_hashmap, &iter, pe, ent) {
+	hashmap_for_each_entry(&existing->recursive_hashmap, &iter, pe, ent) {
 		if (!hashmap_contains_parent(&pl->recursive_hashmap,
 					pe->pattern, &buffer) ||
 		    !hashmap_contains_parent(&pl->parent_hashmap,
@@ -521,7 +581,6 @@ static void add_patterns_cone_mode(int argc, const char **argv,
 		}
 	}
 
-	clear_pattern_list(&existing);
 	strbuf_release(&buffer);
 }
 
@@ -541,11 +600,27 @@ static int modify_pattern_list(int argc, const char **argv, enum modify_type m)
 	int result;
 	int changed_config = 0;
 	struct pattern_list *pl = xcalloc(1, sizeof(*pl));
+	struct pattern_list existing;
+	int have_existing = 0;
+
+	memset(&existing, 0, sizeof(existing));
+	if (core_sparse_checkout_cone &&
+	    (m == ADD || core_apply_sparse_checkout)) {
+		char *sparse_filename = get_sparse_checkout_filename();
+
+		existing.use_cone_patterns = 1;
+		if (!add_patterns_from_file_to_list(sparse_filename, "", 0,
+						    &existing, NULL, 0))
+			have_existing = 1;
+		else if (m == ADD)
+			die(_("unable to load existing sparse-checkout patterns"));
+		free(sparse_filename);
+	}
 
 	switch (m) {
 	case ADD:
 		if (core_sparse_checkout_cone)
-			add_patterns_cone_mode(argc, argv, pl);
+			add_patterns_cone_mode(argc, argv, pl, &existing);
 		else
 			add_patterns_literal(argc, argv, pl);
 		break;
@@ -561,11 +636,19 @@ static int modify_pattern_list(int argc, const char **argv, enum modify_type m)
 		changed_config = 1;
 	}
 
-	result = write_patterns_and_update(pl);
+	/*
+	 * The working tree was last updated for the existing patterns
+	 * only if sparse-checkout was on and neither the file nor the
+	 * index changed since; otherwise look at every entry.
+	 */
+	result = write_patterns_and_update(pl, have_existing && !changed_config &&
+					   patterns_are_applied() ?
+					   &existing : NULL);
 
 	if (result && changed_config)
 		set_config(MODE_NO_PATTERNS);
 
+	clear_pattern_list(&existing);
 	clear_pattern_list(pl);
 	free(pl);
 	return result;
@@ -606,7 +689,7 @@ static int sparse_checkout_reapply(int argc, const char **argv)
 			     builtin_sparse_checkout_reapply_usage, 0);
 
 	repo_read_index(the_repository);
-	return update_working_directory(NULL);
+	return update_working_directory(NULL, NULL);
 }
 
 static char const * const builtin_sparse_checkout_disable_usage[] = {
@@ -640,7 +723,7 @@ static int sparse_checkout_disable(int argc, const char **argv)
 	prepare_repo_settings(the_repository);
 	the_repository->settings.sparse_index = 0;
 
-	if (update_working_directory(&pl))
+	if (update_working_directory(&pl, NULL))
 		die(_("error while refreshing working directory"));
 
 	clear_pattern_list(&pl);
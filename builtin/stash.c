@@ -7,11 +7,15 @@
 #include "cache-tree.h"
 #include "unpack-trees.h"
 #include "merge-recursive.h"
+#include "merge-ort.h"
+#include "merge-ort-wrappers.h"
 #include "strvec.h"
 #include "run-command.h"
 #include "dir.h"
 #include "entry.h"
 #include "rerere.h"
+#include "reset.h"
+#include "branch.h"
 #include "revision.h"
 #include "log-tree.h"
 #include "diffcore.h"
@@ -91,6 +95,7 @@ static const char * const git_stash_save_usage[] = {
 
 static const char ref_stash[] = "refs/stash";
 static struct strbuf stash_index_path = STRBUF_INIT;
+static int use_merge_ort = 1;
 
 /*
  * w_commit is set to the commit containing the working tree
@@ -299,18 +304,87 @@ static int apply_cached(struct strbuf *out)
 	return pipe_command(&cp, out->buf, out->len, NULL, 0, NULL, 0);
 }
 
-static int reset_head(void)
+static int merge_index_tree(struct stash_info *info,
+			    struct object_id *c_tree,
+			    struct object_id *index_tree)
 {
-	struct child_process cp = CHILD_PROCESS_INIT;
+	struct merge_options o;
+	struct merge_result result;
+	struct tree *b_tree = parse_tree_indirect(&info->b_tree);
+	struct tree *cur_tree = parse_tree_indirect(c_tree);
+	struct tree *i_tree = parse_tree_indirect(&info->i_tree);
+
+	if (!b_tree || !cur_tree || !i_tree)
+		return -1;
 
 	/*
-	 * Reset is overall quite simple, however there is no current public
-	 * API for resetting.
+	 * Bring the staged changes over to the current index in core:
+	 * unlike "diff-tree | apply --cached", this leaves the index
+	 * file alone until the stash has been merged.
 	 */
-	cp.git_cmd = 1;
-	strvec_push(&cp.args, "reset");
+	init_merge_options(&o, the_repository);
+	o.branch1 = "Index";
+	o.branch2 = "Stashed index";
+	o.ancestor = "stash base";
+	o.verbosity = 0;
+
+	memset(&result, 0, sizeof(result));
+	merge_incore_nonrecursive(&o, b_tree, cur_tree, i_tree, &result);
+	if (result.clean > 0)
+		oidcpy(index_tree, &result.tree->object.oid);
+	merge_finalize(&o, &result);
+	return result.clean > 0 ? 0 : -1;
+}
 
-	return run_command(&cp);
+static int reset_index_to_head(void)
+{
+	struct object_id head_tree;
+
+	if (get_oid_tree("HEAD^{tree}", &head_tree))
+		return error(_("could not read HEAD"));
+
+	if (reset_tree(&head_tree, 0, 1))
+		return -1;
+
+	/* Like "git reset", leave the unstaged changes refreshed. */
+	return refresh_and_write_cache(REFRESH_QUIET, 0, 0);
+}
+
+/*
+ * Bring the entry for `path` in `istate` up to date with the working
+ * tree, the way "update-index --add --remove --ignore-skip-worktree-entries"
+ * does.
+ */
+static int update_index_path(struct index_state *istate, const char *path)
+{
+	struct stat st;
+	struct object_id oid;
+	int len = strlen(path);
+	int pos = index_name_pos(istate, path, len);
+	const struct cache_entry *ce = pos < 0 ? NULL : istate->cache[pos];
+
+	/* the working tree version of these is assumed "good" */
+	if (ce && ce_skip_worktree(ce))
+		return 0;
+
+	if (has_symlink_leading_path(path, len))
+		return error(_("'%s' is beyond a symbolic link"), path);
+
+	if (lstat(path, &st)) {
+		if (errno != ENOENT && errno != ENOTDIR)
+			return error_errno(_("unable to stat '%s'"), path);
+		return remove_file_from_index(istate, path);
+	}
+
+	if (S_ISDIR(st.st_mode) && ce) {
+		if (!S_ISGITLINK(ce->ce_mode))
+			return remove_file_from_index(istate, path);
+		/* Do nothing to the index if there is no HEAD! */
+		if (resolve_gitlink_ref(path, "HEAD", &oid) < 0)
+			return 0;
+	}
+
+	return add_to_index(istate, path, &st, 0);
 }
 
 static void add_diff_to_buf(struct diff_queue_struct *q,
@@ -322,39 +396,47 @@ static void add_diff_to_buf(struct diff_queue_struct *q,
 	for (i = 0; i < q->nr; i++) {
 		strbuf_addstr(data, q->queue[i]->one->path);
 
-		/* NUL-terminate: will be fed to update-index -z */
+		/* NUL-terminate: the paths may contain newlines */
 		strbuf_addch(data, '\0');
 	}
 }
 
 static int restore_untracked(struct object_id *u_tree)
 {
-	int res;
-	struct child_process cp = CHILD_PROCESS_INIT;
+	struct index_state istate = { NULL };
+	struct unpack_trees_options opts;
+	struct checkout state = CHECKOUT_INIT;
+	struct tree_desc t;
+	struct tree *tree;
+	int i, res = 0;
 
 	/*
-	 * We need to run restore files from a given index, but without
-	 * affecting the current index, so we use GIT_INDEX_FILE with
-	 * run_command to fork processes that will not interfere.
+	 * Check the files out of a temporary index holding the untracked
+	 * tree, leaving the current index alone. As with "checkout-index
+	 * --all", files that are already there are not overwritten.
 	 */
-	cp.git_cmd = 1;
-	strvec_push(&cp.args, "read-tree");
-	strvec_push(&cp.args, oid_to_hex(u_tree));
-	strvec_pushf(&cp.env_array, "GIT_INDEX_FILE=%s",
-		     stash_index_path.buf);
-	if (run_command(&cp)) {
-		remove_path(stash_index_path.buf);
+	tree = parse_tree_indirect(u_tree);
+	if (!tree || parse_tree(tree))
+		return -1;
+	init_tree_desc(&t, tree->buffer, tree->size);
+
+	memset(&opts, 0, sizeof(opts));
+	opts.head_idx = 1;
+	opts.src_index = &istate;
+	opts.dst_index = &istate;
+	opts.merge = 1;
+	opts.fn = oneway_merge;
+	if (unpack_trees(1, &t, &opts)) {
+		discard_index(&istate);
 		return -1;
 	}
 
-	child_process_init(&cp);
-	cp.git_cmd = 1;
-	strvec_pushl(&cp.args, "checkout-index", "--all", NULL);
-	strvec_pushf(&cp.env_array, "GIT_INDEX_FILE=%s",
-		     stash_index_path.buf);
+	state.istate = &istate;
+	for (i = 0; i < istate.cache_nr; i++)
+		if (checkout_entry(istate.cache[i], &state, NULL, NULL) < 0)
+			res = -1;
 
-	res = run_command(&cp);
-	remove_path(stash_index_path.buf);
+	discard_index(&istate);
 	return res;
 }
 
@@ -495,6 +577,10 @@ static int do_apply_stash(const char *prefix, struct stash_info *info,
 		if (oideq(&info->b_tree, &info->i_tree) ||
 		    oideq(&c_tree, &info->i_tree)) {
 			has_index = 0;
+		} else if (use_merge_ort) {
+			if (merge_index_tree(info, &c_tree, &index_tree))
+				return error(_("conflicts in index. "
+					       "Try without --index."));
 		} else {
 			struct strbuf out = STRBUF_INIT;
 
@@ -515,7 +601,7 @@ static int do_apply_stash(const char *prefix, struct stash_info *info,
 			if (write_cache_as_tree(&index_tree, 0, NULL))
 				return error(_("could not save index tree"));
 
-			reset_head();
+			reset_index_to_head();
 			discard_cache();
 			read_cache();
 		}
@@ -540,8 +626,11 @@ static int do_apply_stash(const char *prefix, struct stash_info *info,
 
 	bases[0] = &info->b_tree;
 
-	ret = merge_recursive_generic(&o, &c_tree, &info->w_tree, 1, bases,
-				      &result);
+	if (use_merge_ort)
+		ret = merge_ort_generic(&o, &c_tree, &info->w_tree, bases[0]);
+	else
+		ret = merge_recursive_generic(&o, &c_tree, &info->w_tree, 1,
+					      bases, &result);
 	if (ret) {
 		rerere(0);
 
@@ -1002,7 +1091,7 @@ static int get_untracked_files(const struct pathspec *ps, int include_untracked,
 		struct dir_entry *ent = dir.entries[i];
 		found++;
 		strbuf_addstr(untracked_files, ent->name);
-		/* NUL-terminate: will be fed to update-index -z */
+		/* NUL-terminate: the paths may contain newlines */
 		strbuf_addch(untracked_files, '\0');
 	}
 
@@ -1082,27 +1171,23 @@ static int save_untracked_files(struct stash_info *info, struct strbuf *msg,
 {
 	int ret = 0;
 	struct strbuf untracked_msg = STRBUF_INIT;
-	struct child_process cp_upd_index = CHILD_PROCESS_INIT;
 	struct index_state istate = { NULL };
-
-	cp_upd_index.git_cmd = 1;
-	strvec_pushl(&cp_upd_index.args, "update-index", "-z", "--add",
-		     "--remove", "--stdin", NULL);
-	strvec_pushf(&cp_upd_index.env_array, "GIT_INDEX_FILE=%s",
-			 stash_index_path.buf);
+	const char *path;
 
 	strbuf_addf(&untracked_msg, "untracked files on %s\n", msg->buf);
-	if (pipe_command(&cp_upd_index, files.buf, files.len, NULL, 0,
-			 NULL, 0)) {
-		ret = -1;
-		goto done;
+	for (path = files.buf; path < files.buf + files.len;
+	     path += strlen(path) + 1) {
+		if (update_index_path(&istate, path)) {
+			ret = -1;
+			goto done;
+		}
 	}
 
-	if (write_index_as_tree(&info->u_tree, &istate, stash_index_path.buf, 0,
-				NULL)) {
+	if (cache_tree_update(&istate, 0)) {
 		ret = -1;
 		goto done;
 	}
+	oidcpy(&info->u_tree, &istate.cache_tree->oid);
 
 	if (commit_tree(untracked_msg.buf, untracked_msg.len,
 			&info->u_tree, NULL, &info->u_commit, NULL, NULL)) {
@@ -1113,7 +1198,6 @@ static int save_untracked_files(struct stash_info *info, struct strbuf *msg,
 done:
 	discard_index(&istate);
 	strbuf_release(&untracked_msg);
-	remove_path(stash_index_path.buf);
 	return ret;
 }
 
@@ -1181,22 +1265,14 @@ static int stash_patch(struct stash_info *info, const struct pathspec *ps,
 
 static int stash_working_tree(struct stash_info *info, const struct pathspec *ps)
 {
-	int ret = 0;
+	int i, ret = 0;
 	struct rev_info rev;
-	struct child_process cp_upd_index = CHILD_PROCESS_INIT;
 	struct strbuf diff_output = STRBUF_INIT;
-	struct index_state istate = { NULL };
+	const char *path;
 
 	init_revisions(&rev, NULL);
 	copy_pathspec(&rev.prune_data, ps);
 
-	set_alternate_index_output(stash_index_path.buf);
-	if (reset_tree(&info->i_tree, 0, 0)) {
-		ret = -1;
-		goto done;
-	}
-	set_alternate_index_output(NULL);
-
 	rev.diffopt.output_format = DIFF_FORMAT_CALLBACK;
 	rev.diffopt.format_callback = add_diff_to_buf;
 	rev.diffopt.format_callback_data = &diff_output;
@@ -1213,32 +1289,39 @@ static int stash_working_tree(struct stash_info *info, const struct pathspec *ps
 		goto done;
 	}
 
-	cp_upd_index.git_cmd = 1;
-	strvec_pushl(&cp_upd_index.args, "update-index",
-		     "--ignore-skip-worktree-entries",
-		     "-z", "--add", "--remove", "--stdin", NULL);
-	strvec_pushf(&cp_upd_index.env_array, "GIT_INDEX_FILE=%s",
-		     stash_index_path.buf);
-
-	if (pipe_command(&cp_upd_index, diff_output.buf, diff_output.len,
-			 NULL, 0, NULL, 0)) {
-		ret = -1;
-		goto done;
+	/*
+	 * The index in core is the one i_tree was written from; add the
+	 * changed files to it and take the tree without writing it out.
+	 * Intent-to-add entries are not in i_tree and are refused as
+	 * resetting to it would.
+	 */
+	for (i = 0; i < active_nr; i++) {
+		if (ce_intent_to_add(active_cache[i])) {
+			ret = error(_("Entry '%s' not uptodate. Cannot merge."),
+				    active_cache[i]->name);
+			goto done;
+		}
+	}
+	for (path = diff_output.buf; path < diff_output.buf + diff_output.len;
+	     path += strlen(path) + 1) {
+		if (update_index_path(&the_index, path)) {
+			ret = -1;
+			goto done;
+		}
 	}
 
-	if (write_index_as_tree(&info->w_tree, &istate, stash_index_path.buf, 0,
-				NULL)) {
+	if (cache_tree_update(&the_index, 0)) {
 		ret = -1;
 		goto done;
 	}
+	oidcpy(&info->w_tree, &the_index.cache_tree->oid);
 
 done:
-	discard_index(&istate);
+	discard_cache();
 	UNLEAK(rev);
 	object_array_clear(&rev.pending);
 	clear_pathspec(&rev.prune_data);
 	strbuf_release(&diff_output);
-	remove_path(stash_index_path.buf);
 	return ret;
 }
 
@@ -1518,14 +1601,16 @@ static int do_push_stash(const struct pathspec *ps, const char *stash_msg, int q
 				goto done;
 			}
 		} else {
-			struct child_process cp = CHILD_PROCESS_INIT;
-			cp.git_cmd = 1;
-			strvec_pushl(&cp.args, "reset", "--hard", "-q",
-				     "--no-recurse-submodules", NULL);
-			if (run_command(&cp)) {
+			/* What "git reset --hard -q" would do, in process */
+			if (reset_head(the_repository, NULL, "reset", NULL,
+				       RESET_HEAD_HARD | RESET_ORIG_HEAD, NULL,
+				       getenv(GIT_REFLOG_ACTION_ENVIRONMENT) ?
+				       NULL : "reset: moving to HEAD",
+				       "reset")) {
 				ret = -1;
 				goto done;
 			}
+			remove_branch_state(the_repository, 0);
 		}
 
 		if (keep_index == 1 && !is_null_oid(&info.i_tree)) {
@@ -1687,7 +1772,7 @@ static int save_stash(int argc, const char **argv, const char *prefix)
 int cmd_stash(int argc, const char **argv, const char *prefix)
 {
 	pid_t pid = getpid();
-	const char *index_file;
+	const char *index_file, *merge_algorithm;
 	struct strvec args = STRVEC_INIT;
 
 	struct option options[] = {
@@ -1696,6 +1781,10 @@ int cmd_stash(int argc, const char **argv, const char *prefix)
 
 	git_config(git_stash_config, NULL);
 
+	merge_algorithm = getenv("GIT_TEST_MERGE_ALGORITHM");
+	if (merge_algorithm && !strcmp(merge_algorithm, "recursive"))
+		use_merge_ort = 0;
+
 	if (use_legacy_stash ||
 	    !git_env_bool("GIT_TEST_STASH_USE_BUILTIN", -1))
 		warning(_("the stash.useBuiltin support has been removed!\n"
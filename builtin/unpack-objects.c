@@ -13,9 +13,11 @@
 #include "progress.h"
 #include "decorate.h"
 #include "fsck.h"
+#include "thread-utils.h"
+#include "bulk-checkin.h"
 
 static int dry_run, quiet, recover, has_errors, strict;
-static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict]";
+static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] [--threads=<n>]";
 
 /* We always read in 4kB chunks. */
 static unsigned char buffer[4096];
@@ -159,6 +161,7 @@ struct obj_info {
 	off_t offset;
 	struct object_id oid;
 	struct object *obj;
+	unsigned write_pending:1;
 };
 
 /* Remember to update object flag allocation in object.h */
@@ -168,6 +171,162 @@ struct obj_info {
 static struct obj_info *obj_list;
 static unsigned nr_objects;
 
+/*
+ * With more than one thread, the main thread keeps parsing the pack,
+ * resolving deltas and hashing the resulting objects, and hands the
+ * finished buffers to a pool of writers that deflate them into loose
+ * objects.  The queue is bounded so that we do not hold more than a
+ * handful of objects per writer in core.
+ */
+struct write_job {
+	unsigned nr;
+	enum object_type type;
+	void *buf;
+	unsigned long size;
+};
+
+static int nr_threads;
+static int threads_active;
+static pthread_t *writer_threads;
+static struct write_job *write_queue;
+static unsigned write_queue_alloc, write_queue_head, write_queue_nr;
+static unsigned write_pending_nr;
+static int write_queue_done;
+static pthread_mutex_t write_queue_mutex;
+static pthread_cond_t write_queue_cond;
+static pthread_cond_t write_done_cond;
+
+static void *writer_thread(void *data)
+{
+	pthread_mutex_lock(&write_queue_mutex);
+	for (;;) {
+		struct write_job job;
+
+		while (!write_queue_nr && !write_queue_done)
+			pthread_cond_wait(&write_queue_cond, &write_queue_mutex);
+		if (!write_queue_nr)
+			break;
+		job = write_queue[write_queue_head];
+		write_queue_head = (write_queue_head + 1) % write_queue_alloc;
+		write_queue_nr--;
+		pthread_cond_broadcast(&write_done_cond);
+		pthread_mutex_unlock(&write_queue_mutex);
+
+		if (write_loose_object_file(job.buf, job.size,
+					    type_name(job.type),
+					    &obj_list[job.nr].oid) < 0)
+			die("failed to write object %s",
+			    oid_to_hex(&obj_list[job.nr].oid));
+		free(job.buf);
+
+		pthread_mutex_lock(&write_queue_mutex);
+		obj_list[job.nr].write_pending = 0;
+		write_pending_nr--;
+		pthread_cond_broadcast(&write_done_cond);
+	}
+	pthread_mutex_unlock(&write_queue_mutex);
+	return NULL;
+}
+
+static void start_writers(void)
+{
+	int i;
+
+	write_queue_alloc = 2 * nr_threads;
+	CALLOC_ARRAY(write_queue, write_queue_alloc);
+	CALLOC_ARRAY(writer_threads, nr_threads);
+	pthread_mutex_init(&write_queue_mutex, NULL);
+	pthread_cond_init(&write_queue_cond, NULL);
+	pthread_cond_init(&write_done_cond, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&writer_threads[i], NULL,
+					 writer_thread, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	threads_active = 1;
+}
+
+static void stop_writers(void)
+{
+	int i;
+
+	if (!threads_active)
+		return;
+	pthread_mutex_lock(&write_queue_mutex);
+	write_queue_done = 1;
+	pthread_cond_broadcast(&write_queue_cond);
+	pthread_mutex_unlock(&write_queue_mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(writer_threads[i], NULL);
+	threads_active = 0;
+
+	pthread_cond_destroy(&write_done_cond);
+	pthread_cond_destroy(&write_queue_cond);
+	pthread_mutex_destroy(&write_queue_mutex);
+	FREE_AND_NULL(writer_threads);
+	FREE_AND_NULL(write_queue);
+}
+
+/*
+ * Write the nr-th object, whose name is already in obj_list, taking
+ * ownership of "buf".  The object is written synchronously unless the
+ * writer threads are running.
+ */
+static void queue_object_write(unsigned nr, enum object_type type,
+			       void *buf, unsigned long size)
+{
+	struct write_job *job;
+
+	if (freshen_object(&obj_list[nr].oid)) {
+		free(buf);
+		return;
+	}
+	if (!threads_active) {
+		if (write_loose_object_file(buf, size, type_name(type),
+					    &obj_list[nr].oid) < 0)
+			die("failed to write object");
+		free(buf);
+		return;
+	}
+
+	pthread_mutex_lock(&write_queue_mutex);
+	while (write_queue_nr == write_queue_alloc)
+		pthread_cond_wait(&write_done_cond, &write_queue_mutex);
+	job = &write_queue[(write_queue_head + write_queue_nr) % write_queue_alloc];
+	job->nr = nr;
+	job->type = type;
+	job->buf = buf;
+	job->size = size;
+	write_queue_nr++;
+	write_pending_nr++;
+	obj_list[nr].write_pending = 1;
+	pthread_cond_signal(&write_queue_cond);
+	pthread_mutex_unlock(&write_queue_mutex);
+}
+
+/* Wait until the nr-th object is readable from the object store. */
+static void wait_for_object_write(unsigned nr)
+{
+	if (!threads_active)
+		return;
+	pthread_mutex_lock(&write_queue_mutex);
+	while (obj_list[nr].write_pending)
+		pthread_cond_wait(&write_done_cond, &write_queue_mutex);
+	pthread_mutex_unlock(&write_queue_mutex);
+}
+
+/* Wait until every queued object is readable from the object store. */
+static void wait_for_all_writes(void)
+{
+	if (!threads_active)
+		return;
+	pthread_mutex_lock(&write_queue_mutex);
+	while (write_pending_nr)
+		pthread_cond_wait(&write_done_cond, &write_queue_mutex);
+	pthread_mutex_unlock(&write_queue_mutex);
+}
+
 /*
  * Called only from check_object() after it verified this object
  * is Ok.
@@ -243,19 +402,17 @@ static void write_object(unsigned nr, enum object_type type,
 			 void *buf, unsigned long size)
 {
 	if (!strict) {
-		if (write_object_file(buf, size, type_name(type),
-				      &obj_list[nr].oid) < 0)
-			die("failed to write object");
+		hash_object_file(the_hash_algo, buf, size, type_name(type),
+				 &obj_list[nr].oid);
 		added_object(nr, type, buf, size);
-		free(buf);
+		queue_object_write(nr, type, buf, size);
 		obj_list[nr].obj = NULL;
 	} else if (type == OBJ_BLOB) {
 		struct blob *blob;
-		if (write_object_file(buf, size, type_name(type),
-				      &obj_list[nr].oid) < 0)
-			die("failed to write object");
+		hash_object_file(the_hash_algo, buf, size, type_name(type),
+				 &obj_list[nr].oid);
 		added_object(nr, type, buf, size);
-		free(buf);
+		queue_object_write(nr, type, buf, size);
 
 		blob = lookup_blob(the_repository, &obj_list[nr].oid);
 		if (blob)
@@ -362,6 +519,9 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 			free(delta_data);
 			return;
 		}
+		if (threads_active && !has_object_file(&base_oid))
+			/* the base may be an earlier object still being written */
+			wait_for_all_writes();
 		if (has_object_file(&base_oid))
 			; /* Ok we have this one */
 		else if (resolve_against_held(nr, &base_oid,
@@ -412,6 +572,8 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 			} else {
 				oidcpy(&base_oid, &obj_list[mid].oid);
 				base_found = !is_null_oid(&base_oid);
+				if (base_found)
+					wait_for_object_write(mid);
 				break;
 			}
 		}
@@ -503,16 +665,37 @@ static void unpack_all(void)
 	if (!quiet)
 		progress = start_progress(_("Unpacking objects"), nr_objects);
 	CALLOC_ARRAY(obj_list, nr_objects);
+	if (!dry_run)
+		prepare_loose_object_bulk_checkin();
+	if (nr_threads > 1 && !dry_run && nr_objects > 1)
+		start_writers();
 	for (i = 0; i < nr_objects; i++) {
 		unpack_one(i);
 		display_progress(progress, i + 1);
 	}
+	stop_writers();
 	stop_progress(&progress);
 
 	if (delta_list)
 		die("unresolved deltas left after unpacking");
 }
 
+static int git_unpack_objects_config(const char *k, const char *v, void *cb)
+{
+	if (!strcmp(k, "pack.threads")) {
+		nr_threads = git_config_int(k, v);
+		if (nr_threads < 0)
+			die(_("invalid number of threads specified (%d)"),
+			    nr_threads);
+		if (!HAVE_THREADS && nr_threads != 1) {
+			warning(_("no threads support, ignoring %s"), k);
+			nr_threads = 1;
+		}
+		return 0;
+	}
+	return git_default_config(k, v, cb);
+}
+
 int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 {
 	int i;
@@ -520,7 +703,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 
 	read_replace_refs = 0;
 
-	git_config(git_default_config, NULL);
+	git_config(git_unpack_objects_config, NULL);
 
 	quiet = !isatty(2);
 
@@ -568,12 +751,34 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 				max_input_size = strtoumax(arg, NULL, 10);
 				continue;
 			}
+			if (skip_prefix(arg, "--threads=", &arg)) {
+				char *end;
+				nr_threads = strtoul(arg, &end, 0);
+				if (!*arg || *end || nr_threads < 0)
+					usage(unpack_usage);
+				if (!HAVE_THREADS && nr_threads != 1) {
+					warning(_("no threads support, ignoring %s"),
+						argv[i]);
+					nr_threads = 1;
+				}
+				continue;
+			}
 			usage(unpack_usage);
 		}
 
 		/* We don't take any non-flag arguments now.. Maybe some day */
 		usage(unpack_usage);
 	}
+	if (HAVE_THREADS && !nr_threads) {
+		/*
+		 * Writing loose objects is dominated by deflate and the
+		 * filesystem, neither of which scales far; stay modest.
+		 */
+		nr_threads = online_cpus();
+		if (nr_threads > 4)
+			nr_threads = 4;
+	}
+	plug_bulk_checkin();
 	the_hash_algo->init_fn(&ctx);
 	unpack_all();
 	the_hash_algo->update_fn(&ctx, buffer, offset);
@@ -586,6 +791,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 	if (!hasheq(fill(the_hash_algo->rawsz), oid.hash))
 		die("final sha1 did not match");
 	use(the_hash_algo->rawsz);
+	unplug_bulk_checkin();
 
 	/* Write the last part of the buffer to stdout */
 	while (len) {
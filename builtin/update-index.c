@@ -18,6 +18,7 @@
 #include "dir.h"
 #include "split-index.h"
 #include "fsmonitor.h"
+#include "bulk-checkin.h"
 
 /*
  * Default to not allowing changes to the list of files. The
@@ -36,6 +37,15 @@ static int mark_valid_only;
 static int mark_skip_worktree_only;
 static int mark_fsmonitor_only;
 static int ignore_skip_worktree_entries;
+
+/*
+ * The paths read with --stdin are hashed, and their objects written, a
+ * batch at a time by index_files_bulk_checkin(); add_one_path() picks
+ * up the result for the path being updated from here.
+ */
+#define STDIN_BATCH_SIZE 1024
+static struct bulk_checkin_file *prehashed;
+
 #define MARK_FLAG 1
 #define UNMARK_FLAG 2
 static struct strbuf mtime_dir = STRBUF_INIT;
@@ -268,6 +278,21 @@ static int process_lstat_error(const char *path, int err)
 	return error("lstat(\"%s\"): %s", path, strerror(err));
 }
 
+static int use_prehashed(const char *path, struct stat *st,
+			 struct object_id *oid)
+{
+	struct stat_data sd;
+
+	if (!prehashed || !prehashed->indexed || strcmp(prehashed->path, path))
+		return 0;
+	/* The file may have changed since it was hashed. */
+	fill_stat_data(&sd, &prehashed->st);
+	if (match_stat_data(&sd, st))
+		return 0;
+	oidcpy(oid, &prehashed->oid);
+	return 1;
+}
+
 static int add_one_path(const struct cache_entry *old, const char *path, int len, struct stat *st)
 {
 	int option;
@@ -284,7 +309,8 @@ static int add_one_path(const struct cache_entry *old, const char *path, int len
 	fill_stat_cache_info(&the_index, ce, st);
 	ce->ce_mode = ce_mode_from_stat(old, st->st_mode);
 
-	if (index_path(&the_index, &ce->oid, path, st,
+	if (!use_prehashed(path, st, &ce->oid) &&
+	    index_path(&the_index, &ce->oid, path, st,
 		       info_only ? 0 : HASH_WRITE_OBJECT)) {
 		discard_cache_entry(ce);
 		return -1;
@@ -491,6 +517,40 @@ static void update_one(const char *path)
 	report("add '%s'", path);
 }
 
+/*
+ * Decide which of the `nr` paths update_one() would hash a regular file
+ * for, without conversion, and have index_files_bulk_checkin() hash
+ * them all at once.
+ */
+static void prehash_paths(struct bulk_checkin_file *files, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		struct bulk_checkin_file *file = &files[i];
+		const struct cache_entry *ce;
+		int pos, len = strlen(file->path);
+
+		if (lstat(file->path, &file->st) < 0 ||
+		    !S_ISREG(file->st.st_mode) ||
+		    !verify_path(file->path, file->st.st_mode) ||
+		    has_symlink_leading_path(file->path, len) ||
+		    would_convert_to_git(&the_index, file->path))
+			goto skip;
+		pos = cache_name_pos(file->path, len);
+		ce = pos < 0 ? NULL : active_cache[pos];
+		if (!ce && !allow_add)
+			goto skip;
+		/* skip-worktree and up-to-date entries are left alone */
+		if (ce && (ce_skip_worktree(ce) || !ce_match_stat(ce, &file->st, 0)))
+			goto skip;
+		continue;
+	skip:
+		memset(&file->st, 0, sizeof(file->st));
+	}
+	index_files_bulk_checkin(files, nr, info_only ? 0 : HASH_WRITE_OBJECT);
+}
+
 static void read_index_info(int nul_term_line)
 {
 	const int hexsz = the_hash_algo->hexsz;
@@ -1150,22 +1210,46 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 	if (read_from_stdin) {
 		struct strbuf buf = STRBUF_INIT;
 		struct strbuf unquoted = STRBUF_INIT;
+		struct bulk_checkin_file *files;
+		size_t i, nr = 0;
+		int eof = 0;
 
 		setup_work_tree();
-		while (getline_fn(&buf, stdin) != EOF) {
-			char *p;
-			if (!nul_term_line && buf.buf[0] == '"') {
-				strbuf_reset(&unquoted);
-				if (unquote_c_style(&unquoted, buf.buf, NULL))
-					die("line is badly quoted");
-				strbuf_swap(&buf, &unquoted);
+		CALLOC_ARRAY(files, STDIN_BATCH_SIZE);
+		plug_bulk_checkin();
+		while (!eof) {
+			while (nr < STDIN_BATCH_SIZE) {
+				if (getline_fn(&buf, stdin) == EOF) {
+					eof = 1;
+					break;
+				}
+				if (!nul_term_line && buf.buf[0] == '"') {
+					strbuf_reset(&unquoted);
+					if (unquote_c_style(&unquoted, buf.buf, NULL))
+						die("line is badly quoted");
+					strbuf_swap(&buf, &unquoted);
+				}
+				memset(&files[nr], 0, sizeof(files[nr]));
+				files[nr++].path = prefix_path(prefix, prefix_length,
+							       buf.buf);
 			}
-			p = prefix_path(prefix, prefix_length, buf.buf);
-			update_one(p);
-			if (set_executable_bit)
-				chmod_path(set_executable_bit, p);
-			free(p);
+			if (nr && !mark_valid_only && !mark_skip_worktree_only &&
+			    !force_remove && !mark_fsmonitor_only)
+				prehash_paths(files, nr);
+			for (i = 0; i < nr; i++) {
+				const char *p = files[i].path;
+
+				prehashed = &files[i];
+				update_one(p);
+				if (set_executable_bit)
+					chmod_path(set_executable_bit, p);
+				prehashed = NULL;
+				free((char *)p);
+			}
+			nr = 0;
 		}
+		unplug_bulk_checkin();
+		free(files);
 		strbuf_release(&unquoted);
 		strbuf_release(&buf);
 	}
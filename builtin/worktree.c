@@ -13,6 +13,9 @@
 #include "utf8.h"
 #include "worktree.h"
 #include "quote.h"
+#include "lockfile.h"
+#include "pathspec.h"
+#include "tree.h"
 
 static const char * const worktree_usage[] = {
 	N_("git worktree add [<options>] <path> [<commit-ish>]"),
@@ -31,6 +34,7 @@ struct add_opts {
 	int quiet;
 	int checkout;
 	int keep_locked;
+	struct worktree *reuse_from;
 };
 
 static int show_only;
@@ -235,6 +239,143 @@ static void check_candidate_path(const char *path,
 		die(_("'%s' is a missing but already registered worktree;\nuse '%s -f' to override, or 'prune' or 'remove' to clear"), path, cmd);
 }
 
+struct reuse_files_data {
+	struct index_state *src;
+	unsigned char *reuse;
+};
+
+static int mark_reusable_entry(const struct object_id *oid,
+			       struct strbuf *base, const char *pathname,
+			       unsigned mode, void *context)
+{
+	struct reuse_files_data *data = context;
+	const struct cache_entry *ce;
+	size_t baselen = base->len;
+	int pos;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+	if (S_ISGITLINK(mode))
+		return 0;
+
+	strbuf_addstr(base, pathname);
+	pos = index_name_pos(data->src, base->buf, base->len);
+	strbuf_setlen(base, baselen);
+	if (pos < 0)
+		return 0;
+	ce = data->src->cache[pos];
+	if (ce->ce_mode == create_ce_mode(mode) && oideq(&ce->oid, oid))
+		data->reuse[pos] = 1;
+	return 0;
+}
+
+/*
+ * Seed the index of the new worktree at `path` with the entries of
+ * the index of `from` that match the tree of `commit` and whose files
+ * in `from` are unchanged, copying those files over, so that the
+ * "reset --hard" that populates the new worktree finds them up to date
+ * and only checks out the other paths.
+ *
+ * This is only an optimization: entries that cannot be reused, e.g.
+ * because they are racily clean in `from` or cannot be copied, are
+ * left for the checkout.
+ */
+static void reuse_worktree_files(struct worktree *from, const char *path,
+				 const char *git_dir, struct commit *commit)
+{
+	struct index_state src = { .repo = the_repository };
+	struct index_state dst = { .repo = the_repository };
+	struct reuse_files_data data = { &src };
+	struct pathspec pathspec = { 0 };
+	struct lock_file lock = LOCK_INIT;
+	struct strbuf src_path = STRBUF_INIT, dst_path = STRBUF_INIT;
+	struct strbuf index_path = STRBUF_INIT, link = STRBUF_INIT;
+	size_t src_len, dst_len;
+	unsigned int i;
+	int reused = 0;
+
+	/* the sparse-checkout patterns of the new worktree decide */
+	if (core_apply_sparse_checkout)
+		return;
+
+	strbuf_addf(&index_path, "%s/index", get_worktree_git_dir(from));
+	if (read_index_from(&src, index_path.buf,
+			    get_worktree_git_dir(from)) <= 0 ||
+	    src.sparse_index)
+		goto out;
+
+	CALLOC_ARRAY(data.reuse, src.cache_nr);
+	if (read_tree(the_repository, get_commit_tree(commit), &pathspec,
+		      mark_reusable_entry, &data))
+		goto out;
+
+	dst.version = src.version;
+	strbuf_addf(&src_path, "%s/", from->path);
+	src_len = src_path.len;
+	strbuf_addf(&dst_path, "%s/", path);
+	dst_len = dst_path.len;
+	for (i = 0; i < src.cache_nr; i++) {
+		const struct cache_entry *ce = src.cache[i];
+		struct cache_entry *new_ce;
+		struct stat st;
+
+		if (!data.reuse[i] || ce_skip_worktree(ce))
+			continue;
+
+		strbuf_setlen(&src_path, src_len);
+		strbuf_addstr(&src_path, ce->name);
+		if (lstat(src_path.buf, &st) ||
+		    ie_match_stat(&src, ce, &st,
+				  CE_MATCH_RACY_IS_DIRTY |
+				  CE_MATCH_IGNORE_VALID |
+				  CE_MATCH_IGNORE_FSMONITOR))
+			continue;
+
+		strbuf_setlen(&dst_path, dst_len);
+		strbuf_addstr(&dst_path, ce->name);
+		if (safe_create_leading_directories_no_share(dst_path.buf))
+			continue;
+		if (S_ISLNK(st.st_mode)) {
+			if (strbuf_readlink(&link, src_path.buf, st.st_size) ||
+			    symlink(link.buf, dst_path.buf))
+				continue;
+		} else if (copy_file(dst_path.buf, src_path.buf, st.st_mode)) {
+			unlink(dst_path.buf);
+			continue;
+		}
+		if (lstat(dst_path.buf, &st))
+			continue;
+
+		new_ce = make_cache_entry(&dst, ce->ce_mode, &ce->oid,
+					  ce->name, 0, 0);
+		fill_stat_cache_info(&dst, new_ce, &st);
+		/* do not let writing the index look at paths in our cwd */
+		ce_mark_uptodate(new_ce);
+		add_index_entry(&dst, new_ce,
+				ADD_CACHE_OK_TO_ADD | ADD_CACHE_JUST_APPEND);
+		reused++;
+	}
+
+	if (reused) {
+		strbuf_reset(&index_path);
+		strbuf_addf(&index_path, "%s/index", git_dir);
+		if (hold_lock_file_for_update(&lock, index_path.buf, 0) < 0 ||
+		    write_locked_index(&dst, &lock, COMMIT_LOCK))
+			warning(_("unable to reuse the files of '%s'"),
+				from->path);
+	}
+	trace2_data_intmax("worktree", the_repository, "add/reused", reused);
+
+out:
+	free(data.reuse);
+	discard_index(&src);
+	discard_index(&dst);
+	strbuf_release(&src_path);
+	strbuf_release(&dst_path);
+	strbuf_release(&index_path);
+	strbuf_release(&link);
+}
+
 static int add_worktree(const char *path, const char *refname,
 			const struct add_opts *opts)
 {
@@ -354,6 +495,9 @@ static int add_worktree(const char *path, const char *refname,
 		goto done;
 
 	if (opts->checkout) {
+		if (opts->reuse_from)
+			reuse_worktree_files(opts->reuse_from, path,
+					     sb_repo.buf, commit);
 		cp.argv = NULL;
 		strvec_clear(&cp.args);
 		strvec_pushl(&cp.args, "reset", "--hard", "--no-recurse-submodules", NULL);
@@ -475,6 +619,7 @@ static int add(int ac, const char **av, const char *prefix)
 	const char *branch;
 	const char *new_branch = NULL;
 	const char *opt_track = NULL;
+	const char *reuse_from = NULL;
 	struct option options[] = {
 		OPT__FORCE(&opts.force,
 			   N_("checkout <branch> even if already checked out in other worktree"),
@@ -486,6 +631,8 @@ static int add(int ac, const char **av, const char *prefix)
 		OPT_BOOL('d', "detach", &opts.detach, N_("detach HEAD at named commit")),
 		OPT_BOOL(0, "checkout", &opts.checkout, N_("populate the new working tree")),
 		OPT_BOOL(0, "lock", &opts.keep_locked, N_("keep the new working tree locked")),
+		OPT_STRING(0, "reuse-from", &reuse_from, N_("worktree"),
+			   N_("copy unchanged files from another working tree")),
 		OPT__QUIET(&opts.quiet, N_("suppress progress reporting")),
 		OPT_PASSTHRU(0, "track", &opt_track, NULL,
 			     N_("set up tracking mode (see git-branch(1))"),
@@ -502,6 +649,18 @@ static int add(int ac, const char **av, const char *prefix)
 		die(_("-b, -B, and --detach are mutually exclusive"));
 	if (ac < 1 || ac > 2)
 		usage_with_options(worktree_usage, options);
+	if (reuse_from) {
+		struct worktree **worktrees = get_worktrees();
+
+		if (!opts.checkout)
+			die(_("--reuse-from and --no-checkout cannot be used together"));
+		opts.reuse_from = find_worktree(worktrees, prefix, reuse_from);
+		if (!opts.reuse_from)
+			die(_("'%s' is not a working tree"), reuse_from);
+		if (opts.reuse_from->is_bare)
+			die(_("'%s' is a bare repository"), reuse_from);
+		UNLEAK(worktrees);
+	}
 
 	path = prefix_filename(prefix, av[0]);
 	branch = ac < 2 ? "HEAD" : av[1];
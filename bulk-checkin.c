@@ -9,6 +9,14 @@
 #include "strbuf.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "tempfile.h"
+#include "tmp-objdir.h"
+#include "oidset.h"
+#include "config.h"
+#include "thread-utils.h"
+#include "blob.h"
+
+static struct tmp_objdir *bulk_fsync_objdir;
 
 static struct bulk_checkin_state {
 	unsigned plugged:1;
@@ -21,6 +29,7 @@ static struct bulk_checkin_state {
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
+	struct oidset written_oids;
 } state;
 
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
@@ -33,7 +42,10 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 		return;
 
 	if (state->nr_written == 0) {
-		close(state->f->fd);
+		int fd = state->f->fd;
+
+		free_hashfile(state->f);
+		close(fd);
 		unlink(state->pack_tmp_name);
 		goto clear_exit;
 	} else if (state->nr_written == 1) {
@@ -55,6 +67,7 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 
 clear_exit:
 	free(state->written);
+	oidset_clear(&state->written_oids);
 	memset(state, 0, sizeof(*state));
 
 	strbuf_release(&packname);
@@ -64,19 +77,12 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 
 static int already_written(struct bulk_checkin_state *state, struct object_id *oid)
 {
-	int i;
-
 	/* The object may already exist in the repository */
 	if (has_object_file(oid))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (i = 0; i < state->nr_written; i++)
-		if (oideq(&state->written[i]->oid, oid))
-			return 1;
-
-	/* This is a new object we need to keep */
-	return 0;
+	/* ... or in the pack we are writing */
+	return oidset_contains(&state->written_oids, oid);
 }
 
 /*
@@ -171,6 +177,262 @@ static int stream_to_pack(struct bulk_checkin_state *state,
 	return 0;
 }
 
+/*
+ * Objects of at least two chunks are deflated by pack.threads threads,
+ * each chunk as a separate raw deflate stream that ends on a byte
+ * boundary (the last one with Z_FINISH, the others with Z_SYNC_FLUSH)
+ * and is primed with the last 32 KiB of the chunk before it, the way
+ * pigz does it. Concatenated behind a zlib header and followed by the
+ * Adler-32 of the whole object, they form one ordinary zlib stream.
+ */
+#define DEFLATE_CHUNK_SIZE (1024 * 1024)
+#define DEFLATE_DICT_SIZE (32 * 1024)
+
+struct deflate_chunk {
+	unsigned char *in;
+	size_t in_len;
+	const unsigned char *dict;
+	size_t dict_len;
+	int last;
+	struct strbuf out;
+};
+
+struct deflate_thread {
+	pthread_t thread;
+	pthread_mutex_t *mutex;
+	struct deflate_chunk *chunks;
+	int *next;
+	int nr;
+};
+
+static void deflate_chunk(struct deflate_chunk *chunk)
+{
+	git_zstream s;
+	int flush = chunk->last ? Z_FINISH : Z_SYNC_FLUSH;
+	int status;
+
+	git_deflate_init_raw(&s, pack_compression_level);
+	if (chunk->dict_len &&
+	    deflateSetDictionary(&s.z, chunk->dict, chunk->dict_len) != Z_OK)
+		die("unable to set deflate dictionary");
+	s.next_in = chunk->in;
+	s.avail_in = chunk->in_len;
+
+	strbuf_reset(&chunk->out);
+	strbuf_grow(&chunk->out, git_deflate_bound(&s, chunk->in_len) + 16);
+	do {
+		size_t len = chunk->out.len;
+
+		strbuf_grow(&chunk->out, 16384);
+		s.next_out = (unsigned char *)chunk->out.buf + len;
+		s.avail_out = strbuf_avail(&chunk->out);
+		status = git_deflate(&s, flush);
+		if (status != Z_OK && status != Z_BUF_ERROR &&
+		    status != Z_STREAM_END)
+			die("unexpected deflate failure: %d", status);
+		strbuf_setlen(&chunk->out,
+			      (char *)s.next_out - chunk->out.buf);
+	} while (chunk->last ? status != Z_STREAM_END : !s.avail_out);
+
+	/* all but the last stream are left unfinished on purpose */
+	if (chunk->last)
+		git_deflate_end(&s);
+	else
+		git_deflate_abort(&s);
+}
+
+static void *deflate_chunks_thread(void *data)
+{
+	struct deflate_thread *t = data;
+
+	trace2_thread_start("bulk_checkin_deflate");
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(t->mutex);
+		i = (*t->next)++;
+		pthread_mutex_unlock(t->mutex);
+		if (i >= t->nr)
+			break;
+		deflate_chunk(&t->chunks[i]);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void deflate_chunks(struct deflate_chunk *chunks, int nr,
+			   int nr_threads)
+{
+	struct deflate_thread *threads;
+	pthread_mutex_t mutex;
+	int i, next = 0;
+
+	if (nr_threads > nr)
+		nr_threads = nr;
+	if (nr_threads <= 1) {
+		for (i = 0; i < nr; i++)
+			deflate_chunk(&chunks[i]);
+		return;
+	}
+
+	pthread_mutex_init(&mutex, NULL);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err;
+
+		threads[i].mutex = &mutex;
+		threads[i].chunks = chunks;
+		threads[i].next = &next;
+		threads[i].nr = nr;
+		err = pthread_create(&threads[i].thread, NULL,
+				     deflate_chunks_thread, &threads[i]);
+		if (err)
+			die(_("unable to create deflate thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].thread, NULL))
+			die(_("unable to join thread"));
+	free(threads);
+	pthread_mutex_destroy(&mutex);
+}
+
+static int bulk_checkin_threads(void)
+{
+	int nr_threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+	if (git_config_get_int("pack.threads", &nr_threads) || nr_threads <= 0)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+static int write_to_pack(struct bulk_checkin_state *state,
+			 const void *buf, size_t len)
+{
+	/* would we bust the size limit? */
+	if (state->nr_written &&
+	    pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + len)
+		return -1;
+
+	hashwrite(state->f, buf, len);
+	state->offset += len;
+	return 0;
+}
+
+/*
+ * Like stream_to_pack() when the object is to be written, but deflating
+ * chunks of the object on several threads. The object is read and
+ * hashed a batch of chunks at a time, so that memory use does not grow
+ * with its size.
+ */
+static int stream_to_pack_threaded(struct bulk_checkin_state *state,
+				   git_hash_ctx *ctx, off_t *already_hashed_to,
+				   int fd, size_t size, enum object_type type,
+				   const char *path, int nr_threads)
+{
+	int batch = nr_threads * 4;
+	struct deflate_chunk *chunks;
+	unsigned char *dict;
+	size_t dict_len = 0;
+	unsigned char hdr[16];
+	unsigned hdrlen;
+	uLong adler = adler32(0, NULL, 0);
+	off_t offset = 0;
+	int i, ret = 0;
+
+	CALLOC_ARRAY(chunks, batch);
+	for (i = 0; i < batch; i++) {
+		chunks[i].in = xmalloc(DEFLATE_CHUNK_SIZE);
+		strbuf_init(&chunks[i].out, 0);
+	}
+	dict = xmalloc(DEFLATE_DICT_SIZE);
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr), type, size);
+	hdr[hdrlen++] = 0x78;
+	if (pack_compression_level >= 0 && pack_compression_level < 2)
+		hdr[hdrlen++] = 0x01;
+	else if (pack_compression_level >= 2 && pack_compression_level < 6)
+		hdr[hdrlen++] = 0x5e;
+	else if (pack_compression_level > 6)
+		hdr[hdrlen++] = 0xda;
+	else
+		hdr[hdrlen++] = 0x9c;
+	if (write_to_pack(state, hdr, hdrlen))
+		ret = -1;
+
+	while (!ret && size) {
+		int nr;
+
+		for (nr = 0; nr < batch && size; nr++) {
+			struct deflate_chunk *chunk = &chunks[nr];
+			size_t rsize = size < DEFLATE_CHUNK_SIZE ?
+				size : DEFLATE_CHUNK_SIZE;
+			ssize_t read_result = read_in_full(fd, chunk->in, rsize);
+
+			if (read_result < 0)
+				die_errno("failed to read from '%s'", path);
+			if (read_result != rsize)
+				die("failed to read %d bytes from '%s'",
+				    (int)rsize, path);
+			offset += rsize;
+			if (*already_hashed_to < offset) {
+				size_t hsize = offset - *already_hashed_to;
+				if (rsize < hsize)
+					hsize = rsize;
+				the_hash_algo->update_fn(ctx,
+							 chunk->in + rsize - hsize,
+							 hsize);
+				*already_hashed_to = offset;
+			}
+			adler = adler32(adler, chunk->in, rsize);
+			size -= rsize;
+
+			chunk->in_len = rsize;
+			chunk->last = !size;
+			if (nr) {
+				struct deflate_chunk *prev = &chunks[nr - 1];
+				chunk->dict_len = prev->in_len < DEFLATE_DICT_SIZE ?
+					prev->in_len : DEFLATE_DICT_SIZE;
+				chunk->dict = prev->in + prev->in_len - chunk->dict_len;
+			} else {
+				chunk->dict = dict;
+				chunk->dict_len = dict_len;
+			}
+		}
+
+		deflate_chunks(chunks, nr, nr_threads);
+
+		for (i = 0; i < nr; i++) {
+			if (write_to_pack(state, chunks[i].out.buf,
+					  chunks[i].out.len)) {
+				ret = -1;
+				break;
+			}
+		}
+
+		dict_len = chunks[nr - 1].in_len < DEFLATE_DICT_SIZE ?
+			chunks[nr - 1].in_len : DEFLATE_DICT_SIZE;
+		memcpy(dict, chunks[nr - 1].in + chunks[nr - 1].in_len - dict_len,
+		       dict_len);
+	}
+
+	if (!ret) {
+		put_be32(hdr, adler);
+		ret = write_to_pack(state, hdr, 4);
+	}
+
+	for (i = 0; i < batch; i++) {
+		free(chunks[i].in);
+		strbuf_release(&chunks[i].out);
+	}
+	free(chunks);
+	free(dict);
+	return ret;
+}
+
 /* Lazily create backing packfile for the state */
 static void prepare_to_stream(struct bulk_checkin_state *state,
 			      unsigned flags)
@@ -199,6 +461,7 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	unsigned header_len;
 	struct hashfile_checkpoint checkpoint = {0};
 	struct pack_idx_entry *idx = NULL;
+	int nr_threads = bulk_checkin_threads();
 
 	seekback = lseek(fd, 0, SEEK_CUR);
 	if (seekback == (off_t) -1)
@@ -222,8 +485,14 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 			idx->offset = state->offset;
 			crc32_begin(state->f);
 		}
-		if (!stream_to_pack(state, &ctx, &already_hashed_to,
-				    fd, size, type, path, flags))
+		if (idx && nr_threads > 1 && size >= 2 * DEFLATE_CHUNK_SIZE) {
+			if (!stream_to_pack_threaded(state, &ctx,
+						     &already_hashed_to, fd,
+						     size, type, path,
+						     nr_threads))
+				break;
+		} else if (!stream_to_pack(state, &ctx, &already_hashed_to,
+					   fd, size, type, path, flags))
 			break;
 		/*
 		 * Writing this object to the current pack will make
@@ -253,10 +522,329 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 			   state->nr_written + 1,
 			   state->alloc_written);
 		state->written[state->nr_written++] = idx;
+		oidset_insert(&state->written_oids, result_oid);
 	}
 	return 0;
 }
 
+/*
+ * Deflate the object `buf` into `out` as a pack entry, header included.
+ * This touches no shared state and may be called from several threads.
+ */
+static void deflate_to_entry(const void *buf, size_t size,
+			     enum object_type type, struct strbuf *out)
+{
+	git_zstream s;
+	unsigned char hdr[16];
+	unsigned hdrlen;
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr), type, size);
+	git_deflate_init(&s, pack_compression_level);
+	strbuf_reset(out);
+	strbuf_grow(out, hdrlen + git_deflate_bound(&s, size));
+	strbuf_add(out, hdr, hdrlen);
+	s.next_in = (unsigned char *)buf;
+	s.avail_in = size;
+	s.next_out = (unsigned char *)out->buf + hdrlen;
+	s.avail_out = strbuf_avail(out);
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	strbuf_setlen(out, hdrlen + s.total_out);
+}
+
+/*
+ * Write the pack entry `entry` of the object `oid`, starting a new pack
+ * when the current one would grow beyond pack.packSizeLimit.
+ */
+static void entry_to_pack(struct bulk_checkin_state *state,
+			  const struct object_id *oid,
+			  const struct strbuf *entry)
+{
+	struct pack_idx_entry *idx;
+
+	CALLOC_ARRAY(idx, 1);
+	while (1) {
+		prepare_to_stream(state, HASH_WRITE_OBJECT);
+		idx->offset = state->offset;
+		crc32_begin(state->f);
+		if (!write_to_pack(state, entry->buf, entry->len))
+			break;
+		/* Too big for this pack; start a new one. */
+		finish_bulk_checkin(state);
+	}
+	idx->crc32 = crc32_end(state->f);
+	oidcpy(&idx->oid, oid);
+	ALLOC_GROW(state->written, state->nr_written + 1, state->alloc_written);
+	state->written[state->nr_written++] = idx;
+	oidset_insert(&state->written_oids, oid);
+}
+
+void bulk_checkin_write_objects(const struct bulk_checkin_object *objs,
+				size_t nr)
+{
+	struct bulk_checkin_state pack = { 0 };
+	struct strbuf entry = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		const struct bulk_checkin_object *obj = &objs[i];
+
+		if (oidset_contains(&pack.written_oids, &obj->oid) ||
+		    has_object_file(&obj->oid))
+			continue;
+		deflate_to_entry(obj->buf, obj->len, obj->type, &entry);
+		entry_to_pack(&pack, &obj->oid, &entry);
+	}
+
+	finish_bulk_checkin(&pack);
+	strbuf_release(&entry);
+}
+
+/*
+ * Below this many new objects, index_files_bulk_checkin() writes loose
+ * objects rather than start a pack of its own.
+ */
+#define BULK_CHECKIN_PACK_MIN 100
+
+enum file_job_action {
+	FILE_JOB_DONE,
+	FILE_JOB_DEFLATE,
+	FILE_JOB_WRITE_LOOSE,
+};
+
+struct file_job {
+	struct bulk_checkin_file *file;
+	struct strbuf buf;
+	enum file_job_action action;
+	int failed;
+};
+
+/* Read and hash the file, unless it is no longer what the caller saw. */
+static void read_file_job(struct file_job *job)
+{
+	struct bulk_checkin_file *file = job->file;
+	struct stat_data sd;
+	struct stat st;
+	size_t size = xsize_t(file->st.st_size);
+	int fd;
+
+	fd = open(file->path, O_RDONLY);
+	if (fd < 0)
+		return;
+	fill_stat_data(&sd, &file->st);
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+	    match_stat_data(&sd, &st)) {
+		close(fd);
+		return;
+	}
+	strbuf_grow(&job->buf, size);
+	if (read_in_full(fd, job->buf.buf, size) == size) {
+		strbuf_setlen(&job->buf, size);
+		hash_object_file(the_hash_algo, job->buf.buf, job->buf.len,
+				 blob_type, &file->oid);
+		file->indexed = 1;
+	}
+	close(fd);
+}
+
+static void write_file_job(struct file_job *job)
+{
+	struct strbuf entry = STRBUF_INIT;
+
+	switch (job->action) {
+	case FILE_JOB_DONE:
+		break;
+	case FILE_JOB_DEFLATE:
+		deflate_to_entry(job->buf.buf, job->buf.len, OBJ_BLOB, &entry);
+		strbuf_swap(&job->buf, &entry);
+		break;
+	case FILE_JOB_WRITE_LOOSE:
+		if (write_loose_object_file(job->buf.buf, job->buf.len,
+					    blob_type, &job->file->oid))
+			job->failed = 1;
+		break;
+	}
+	strbuf_release(&entry);
+}
+
+struct file_thread {
+	pthread_t thread;
+	pthread_mutex_t *mutex;
+	struct file_job *jobs;
+	void (*fn)(struct file_job *);
+	size_t *next;
+	size_t nr;
+};
+
+static void *file_jobs_thread(void *data)
+{
+	struct file_thread *t = data;
+
+	trace2_thread_start("bulk_checkin_files");
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(t->mutex);
+		i = (*t->next)++;
+		pthread_mutex_unlock(t->mutex);
+		if (i >= t->nr)
+			break;
+		t->fn(&t->jobs[i]);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void run_file_jobs(struct file_job *jobs, size_t nr, int nr_threads,
+			  void (*fn)(struct file_job *))
+{
+	struct file_thread *threads;
+	pthread_mutex_t mutex;
+	size_t i, next = 0;
+
+	if (nr_threads > nr)
+		nr_threads = nr;
+	if (nr_threads <= 1) {
+		for (i = 0; i < nr; i++)
+			fn(&jobs[i]);
+		return;
+	}
+
+	pthread_mutex_init(&mutex, NULL);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err;
+
+		threads[i].mutex = &mutex;
+		threads[i].jobs = jobs;
+		threads[i].fn = fn;
+		threads[i].next = &next;
+		threads[i].nr = nr;
+		err = pthread_create(&threads[i].thread, NULL,
+				     file_jobs_thread, &threads[i]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].thread, NULL))
+			die(_("unable to join thread"));
+	free(threads);
+	pthread_mutex_destroy(&mutex);
+}
+
+void index_files_bulk_checkin(struct bulk_checkin_file *files, size_t nr,
+			      unsigned flags)
+{
+	struct file_job *jobs;
+	struct oidset seen = OIDSET_INIT;
+	int nr_threads = bulk_checkin_threads();
+	size_t i, nr_jobs = 0, nr_new = 0;
+
+	CALLOC_ARRAY(jobs, nr);
+	for (i = 0; i < nr; i++) {
+		struct bulk_checkin_file *file = &files[i];
+
+		file->indexed = 0;
+		if (!S_ISREG(file->st.st_mode) ||
+		    file->st.st_size > big_file_threshold)
+			continue;
+		jobs[nr_jobs].file = file;
+		strbuf_init(&jobs[nr_jobs].buf, 0);
+		nr_jobs++;
+	}
+
+	trace2_region_enter("bulk-checkin", "index_files", the_repository);
+	run_file_jobs(jobs, nr_jobs, nr_threads, read_file_job);
+	if (flags & HASH_WRITE_OBJECT) {
+		/*
+		 * Like write_object_file(), leave the objects we already
+		 * have alone but for their mtime.
+		 */
+		for (i = 0; i < nr_jobs; i++) {
+			struct object_id *oid = &jobs[i].file->oid;
+
+			if (!jobs[i].file->indexed ||
+			    oidset_insert(&seen, oid) ||
+			    oidset_contains(&state.written_oids, oid) ||
+			    freshen_object(oid))
+				continue;
+			jobs[i].action = FILE_JOB_DEFLATE;
+			nr_new++;
+		}
+		if (!state.f && nr_new < BULK_CHECKIN_PACK_MIN) {
+			prepare_loose_object_bulk_checkin();
+			for (i = 0; i < nr_jobs; i++)
+				if (jobs[i].action == FILE_JOB_DEFLATE)
+					jobs[i].action = FILE_JOB_WRITE_LOOSE;
+		}
+		run_file_jobs(jobs, nr_jobs, nr_threads, write_file_job);
+		for (i = 0; i < nr_jobs; i++) {
+			if (jobs[i].failed)
+				jobs[i].file->indexed = 0;
+			else if (jobs[i].action == FILE_JOB_DEFLATE)
+				entry_to_pack(&state, &jobs[i].file->oid,
+					      &jobs[i].buf);
+		}
+		if (!state.plugged)
+			finish_bulk_checkin(&state);
+	}
+	trace2_data_intmax("bulk-checkin", the_repository, "index_files/new",
+			   nr_new);
+	trace2_region_leave("bulk-checkin", "index_files", the_repository);
+
+	for (i = 0; i < nr_jobs; i++)
+		strbuf_release(&jobs[i].buf);
+	free(jobs);
+	oidset_clear(&seen);
+}
+
+/*
+ * Make the loose objects staged in bulk_fsync_objdir durable with a
+ * single hardware flush, then move them into the real object store.
+ */
+static void do_batch_fsync(void)
+{
+	struct strbuf temp_path = STRBUF_INIT;
+	struct tempfile *temp;
+
+	if (!bulk_fsync_objdir)
+		return;
+
+	/*
+	 * Every object was already written out to the device with
+	 * FSYNC_WRITEOUT_ONLY; fsync()ing any file on the same
+	 * filesystem now flushes the device's cache for all of them.
+	 */
+	strbuf_addf(&temp_path, "%s/bulk_fsync_XXXXXX", get_object_directory());
+	temp = xmks_tempfile(temp_path.buf);
+	fsync_or_die(get_tempfile_fd(temp), get_tempfile_path(temp));
+	delete_tempfile(&temp);
+	strbuf_release(&temp_path);
+
+	if (tmp_objdir_migrate(bulk_fsync_objdir))
+		die(_("unable to move staged objects into the object database"));
+	bulk_fsync_objdir = NULL;
+}
+
+void prepare_loose_object_bulk_checkin(void)
+{
+	if (!state.plugged || bulk_fsync_objdir ||
+	    !fsync_object_files || fsync_method != FSYNC_METHOD_BATCH)
+		return;
+
+	/* If we cannot stage objects, fsync each of them instead. */
+	bulk_fsync_objdir = tmp_objdir_create("bulk-fsync");
+	if (bulk_fsync_objdir)
+		tmp_objdir_replace_primary_odb(bulk_fsync_objdir);
+}
+
+void fsync_loose_object_bulk_checkin(int fd)
+{
+	if (!bulk_fsync_objdir || git_fsync(fd, FSYNC_WRITEOUT_ONLY) < 0)
+		fsync_or_die(fd, "loose object file");
+}
+
 int index_bulk_checkin(struct object_id *oid,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags)
@@ -278,4 +866,5 @@ void unplug_bulk_checkin(void)
 	state.plugged = 0;
 	if (state.f)
 		finish_bulk_checkin(&state);
+	do_batch_fsync();
 }
@@ -10,6 +10,67 @@ int index_bulk_checkin(struct object_id *oid,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags);
 
+/*
+ * With core.fsyncMethod=batch, loose objects written while the bulk
+ * checkin is plugged are staged in a temporary object directory and
+ * only made durable and moved into place by unplug_bulk_checkin().
+ *
+ * prepare_loose_object_bulk_checkin() sets up that directory and must
+ * be called from the main thread before any loose object is written;
+ * write_object_file() takes care of it.
+ * fsync_loose_object_bulk_checkin() is what writers of loose objects
+ * call instead of fsync() in batch mode.
+ */
+void prepare_loose_object_bulk_checkin(void);
+void fsync_loose_object_bulk_checkin(int fd);
+
+/*
+ * An object to be written by bulk_checkin_write_objects(), whose name has
+ * already been computed by the caller.
+ */
+struct bulk_checkin_object {
+	struct object_id oid;
+	enum object_type type;
+	const void *buf;
+	size_t len;
+};
+
+/*
+ * Write the `nr` objects of `objs` that the repository does not have yet
+ * into a single new pack (more if pack.packSizeLimit calls for it) and
+ * make them available, regardless of whether the bulk checkin is plugged.
+ */
+void bulk_checkin_write_objects(const struct bulk_checkin_object *objs,
+				size_t nr);
+
+/*
+ * A file to be hashed, and written, as a blob by index_files_bulk_checkin().
+ * `st` is what the caller got from lstat() or stat() on `path`; `oid` is
+ * only meaningful when `indexed` is set.
+ */
+struct bulk_checkin_file {
+	const char *path;
+	struct stat st;
+	struct object_id oid;
+	unsigned indexed:1;
+};
+
+/*
+ * Read and hash, on pack.threads threads, the `nr` files of `files` that
+ * `st` says are regular files no larger than core.bigFileThreshold, as
+ * blobs without any conversion; it is up to the caller to leave out the
+ * files that need one. With HASH_WRITE_OBJECT in `flags`, the objects
+ * the repository does not have yet are written too: deflated on the same
+ * threads into the bulk checkin pack if one is already being written or
+ * if there are enough of them to start one, as loose objects otherwise.
+ *
+ * Files that were left out, changed since `st` was taken, or could not
+ * be read or written do not get `indexed` set; the caller is expected to
+ * index them one at a time, e.g. with index_path().
+ */
+void index_files_bulk_checkin(struct bulk_checkin_file *files, size_t nr,
+			      unsigned flags);
+
 void plug_bulk_checkin(void);
 void unplug_bulk_checkin(void);
 
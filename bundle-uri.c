@@ -0,0 +1,522 @@
+#include "cache.h"
+#include "bundle-uri.h"
+#include "bundle.h"
+#include "config.h"
+#include "connect.h"
+#include "object-store.h"
+#include "pkt-line.h"
+#include "refs.h"
+#include "run-command.h"
+#include "strvec.h"
+#include "tempfile.h"
+#include "trace2.h"
+#include "version.h"
+
+void init_bundle_list(struct bundle_list *list)
+{
+	memset(list, 0, sizeof(*list));
+}
+
+void clear_bundle_list(struct bundle_list *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->nr; i++) {
+		struct remote_bundle_info *bundle = &list->items[i];
+
+		free(bundle->id);
+		free(bundle->uri);
+		free(bundle->file);
+		delete_tempfile(&bundle->download);
+	}
+	free(list->items);
+	free(list->base_uri);
+	init_bundle_list(list);
+}
+
+static struct remote_bundle_info *get_bundle(struct bundle_list *list,
+					     const char *id, size_t len)
+{
+	struct remote_bundle_info *bundle;
+	size_t i;
+
+	for (i = 0; i < list->nr; i++)
+		if (!strncmp(list->items[i].id, id, len) &&
+		    !list->items[i].id[len])
+			return &list->items[i];
+
+	ALLOC_GROW(list->items, list->nr + 1, list->alloc);
+	bundle = &list->items[list->nr++];
+	memset(bundle, 0, sizeof(*bundle));
+	bundle->id = xmemdupz(id, len);
+	return bundle;
+}
+
+/*
+ * Resolve `uri` relative to the list it appeared in, the same way a
+ * relative link is resolved against the page it is on.
+ */
+static char *resolve_uri(struct bundle_list *list, const char *uri)
+{
+	const char *slash;
+
+	if (!list->base_uri || strstr(uri, "://") || is_absolute_path(uri))
+		return xstrdup(uri);
+
+	slash = strrchr(list->base_uri, '/');
+	if (!slash)
+		return xstrdup(uri);
+	return xstrfmt("%.*s/%s", (int)(slash - list->base_uri),
+		       list->base_uri, uri);
+}
+
+static int bundle_list_update(struct bundle_list *list,
+			      const char *key, const char *value)
+{
+	struct remote_bundle_info *bundle;
+	const char *id, *name;
+	size_t id_len;
+
+	if (parse_config_key(key, "bundle", &id, &id_len, &name))
+		return 0;
+	if (!value)
+		return -1;
+
+	if (!id) {
+		if (!strcasecmp(name, "version")) {
+			if (strcmp(value, "1"))
+				return -1;
+			list->version = 1;
+		} else if (!strcasecmp(name, "mode")) {
+			if (!strcmp(value, "all"))
+				list->mode = BUNDLE_MODE_ALL;
+			else if (!strcmp(value, "any"))
+				list->mode = BUNDLE_MODE_ANY;
+			else
+				return -1;
+		} else if (!strcasecmp(name, "heuristic")) {
+			if (!strcmp(value, "creationToken"))
+				list->heuristic = BUNDLE_HEURISTIC_CREATIONTOKEN;
+		}
+		return 0;
+	}
+
+	bundle = get_bundle(list, id, id_len);
+	if (!strcasecmp(name, "uri")) {
+		free(bundle->uri);
+		bundle->uri = resolve_uri(list, value);
+	} else if (!strcasecmp(name, "creationToken")) {
+		char *end;
+
+		errno = 0;
+		bundle->creation_token = strtoumax(value, &end, 10);
+		if (errno || *end || end == value)
+			return -1;
+	}
+	return 0;
+}
+
+int bundle_uri_parse_line(struct bundle_list *list, const char *line)
+{
+	const char *equals = strchr(line, '=');
+	char *key;
+	int ret;
+
+	if (!equals || equals == line)
+		return -1;
+
+	key = xmemdupz(line, equals - line);
+	ret = bundle_list_update(list, key, equals + 1);
+	free(key);
+	return ret;
+}
+
+static int read_bundle_list_config(const char *key, const char *value,
+				   void *data)
+{
+	if (bundle_list_update(data, key, value))
+		warning(_("ignoring invalid bundle list entry '%s'"), key);
+	return 0;
+}
+
+static int is_http_uri(const char *uri)
+{
+	return starts_with(uri, "http://") || starts_with(uri, "https://");
+}
+
+/*
+ * The URI is sent to the remote helper on a line of its own, followed
+ * by a space and the path to download to, so it must not contain
+ * either.
+ */
+static int is_safe_uri(const char *uri)
+{
+	for (; *uri; uri++)
+		if (iscntrl(*uri) || *uri == ' ')
+			return 0;
+	return 1;
+}
+
+/*
+ * Make `bundle->file` name a local copy of the bundle. Local bundles are
+ * read where they are, if `allow_local` is set; for HTTP a remote helper
+ * is started in `cp` to download the bundle with its "get" command, and
+ * 1 is returned.
+ */
+static int start_download(struct repository *r,
+			  struct remote_bundle_info *bundle,
+			  struct child_process *cp, int allow_local)
+{
+	static unsigned int counter;
+	struct strbuf cmd = STRBUF_INIT;
+	const char *path;
+	int ret = 1;
+
+	if (!is_http_uri(bundle->uri)) {
+		if (!allow_local)
+			return error(_("ignoring non-HTTP bundle URI '%s' from a remote list"),
+				     bundle->uri);
+		if (!skip_prefix(bundle->uri, "file://", &path))
+			path = bundle->uri;
+		bundle->file = xstrdup(path);
+		return 0;
+	}
+	if (!is_safe_uri(bundle->uri))
+		return error(_("ignoring bundle URI with unsafe characters: '%s'"),
+			     bundle->uri);
+
+	bundle->file = xstrfmt("%s/tmp_bundle_%"PRIuMAX"_%u",
+			       r->objects->odb->path,
+			       (uintmax_t)getpid(), counter++);
+	bundle->download = register_tempfile(bundle->file);
+
+	cp->git_cmd = 1;
+	cp->in = -1;
+	cp->no_stdout = 1;
+	strvec_pushf(&cp->args, "remote-%.*s",
+		     (int)strcspn(bundle->uri, ":"), bundle->uri);
+	strvec_push(&cp->args, bundle->uri);
+	if (start_command(cp)) {
+		ret = error(_("could not start download of '%s'"),
+			    bundle->uri);
+		goto out;
+	}
+
+	strbuf_addf(&cmd, "get %s %s\n\n", bundle->uri, bundle->file);
+	if (write_in_full(cp->in, cmd.buf, cmd.len) < 0)
+		ret = error_errno(_("could not start download of '%s'"),
+				  bundle->uri);
+	close(cp->in);
+
+out:
+	strbuf_release(&cmd);
+	return ret;
+}
+
+static int finish_download(struct remote_bundle_info *bundle,
+			   struct child_process *cp)
+{
+	if (!finish_command(cp))
+		return 0;
+
+	unlink_or_warn(mkpath("%s.temp", bundle->file));
+	FREE_AND_NULL(bundle->file);
+	delete_tempfile(&bundle->download);
+	return error(_("failed to download bundle from '%s'"), bundle->uri);
+}
+
+static void download_bundles(struct repository *r,
+			     struct remote_bundle_info **bundles, size_t nr,
+			     int jobs, int allow_local)
+{
+	struct child_process *downloads;
+	int *running;
+	size_t started = 0, finished = 0;
+
+	CALLOC_ARRAY(downloads, nr);
+	CALLOC_ARRAY(running, nr);
+	while (finished < nr) {
+		while (started < nr && started - finished < jobs) {
+			child_process_init(&downloads[started]);
+			running[started] = start_download(r, bundles[started],
+							  &downloads[started],
+							  allow_local);
+			if (running[started] < 0)
+				FREE_AND_NULL(bundles[started]->file);
+			started++;
+		}
+
+		if (running[finished] > 0)
+			finish_download(bundles[finished], &downloads[finished]);
+		finished++;
+	}
+
+	free(running);
+	free(downloads);
+}
+
+static int has_prerequisites(struct repository *r,
+			     struct bundle_header *header)
+{
+	int i;
+
+	for (i = 0; i < header->prerequisites.nr; i++)
+		if (!repo_has_object_file(r, &header->prerequisites.list[i].oid))
+			return 0;
+	return 1;
+}
+
+/*
+ * Only branches are kept, and they are kept out of the way of the
+ * branches the fetch that follows is going to create.
+ */
+static void write_bundle_refs(struct repository *r,
+			      struct bundle_header *header)
+{
+	struct strbuf name = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < header->references.nr; i++) {
+		struct ref_list_entry *e = &header->references.list[i];
+		const char *branch;
+
+		if (!skip_prefix(e->name, "refs/heads/", &branch))
+			continue;
+
+		strbuf_reset(&name);
+		strbuf_addf(&name, "refs/bundles/%s", branch);
+		refs_update_ref(get_main_ref_store(r), "fetched bundle",
+				name.buf, &e->oid, NULL, 0,
+				UPDATE_REFS_MSG_ON_ERR);
+	}
+	strbuf_release(&name);
+}
+
+/*
+ * Return 0 if the bundle was unbundled, 1 if it has to wait for the
+ * bundles that provide its prerequisites, or -1 if it is unusable.
+ */
+static int unbundle_from_file(struct repository *r,
+			      struct remote_bundle_info *bundle)
+{
+	struct bundle_header header;
+	int fd, ret = 0;
+
+	memset(&header, 0, sizeof(header));
+	fd = read_bundle_header(bundle->file, &header);
+	if (fd < 0)
+		return -1;
+
+	if (!has_prerequisites(r, &header)) {
+		close(fd);
+		ret = 1;
+	} else if (unbundle(r, &header, fd, 0)) {
+		ret = -1;
+	} else {
+		write_bundle_refs(r, &header);
+		bundle->unbundled = 1;
+	}
+
+	bundle_header_release(&header);
+	return ret;
+}
+
+/*
+ * Unbundle what can be unbundled, over and over, until a pass makes no
+ * progress; a bundle may need the objects of a bundle that comes after
+ * it in the list.
+ */
+static size_t unbundle_all(struct repository *r,
+			   struct remote_bundle_info **bundles, size_t nr,
+			   uint64_t *max_token)
+{
+	size_t i, unbundled = 0;
+	int progress;
+
+	do {
+		progress = 0;
+		for (i = 0; i < nr; i++) {
+			struct remote_bundle_info *bundle = bundles[i];
+
+			if (!bundle->file || bundle->unbundled)
+				continue;
+
+			switch (unbundle_from_file(r, bundle)) {
+			case 0:
+				if (bundle->creation_token > *max_token)
+					*max_token = bundle->creation_token;
+				unbundled++;
+				progress = 1;
+				break;
+			case -1:
+				FREE_AND_NULL(bundle->file);
+				break;
+			}
+		}
+	} while (progress);
+
+	for (i = 0; i < nr; i++)
+		if (bundles[i]->file && !bundles[i]->unbundled)
+			warning(_("bundle '%s' is missing prerequisites"),
+				bundles[i]->uri);
+
+	return unbundled;
+}
+
+static int compare_creation_token(const void *va, const void *vb)
+{
+	const struct remote_bundle_info *a = *(const struct remote_bundle_info **)va;
+	const struct remote_bundle_info *b = *(const struct remote_bundle_info **)vb;
+
+	if (a->creation_token != b->creation_token)
+		return a->creation_token < b->creation_token ? -1 : 1;
+	return strcmp(a->id, b->id);
+}
+
+int fetch_bundle_list(struct repository *r, struct bundle_list *list,
+		      uint64_t *min_token)
+{
+	struct remote_bundle_info **todo;
+	uint64_t max_token = min_token ? *min_token : 0;
+	size_t i, nr = 0, unbundled = 0;
+	int jobs = 4;
+
+	repo_config_get_int(r, "fetch.bundlejobs", &jobs);
+	if (jobs < 1)
+		jobs = 1;
+
+	ALLOC_ARRAY(todo, list->nr);
+	for (i = 0; i < list->nr; i++) {
+		struct remote_bundle_info *bundle = &list->items[i];
+
+		if (!bundle->uri || bundle->unbundled)
+			continue;
+		if (min_token &&
+		    list->heuristic == BUNDLE_HEURISTIC_CREATIONTOKEN &&
+		    bundle->creation_token <= *min_token)
+			continue;
+		todo[nr++] = bundle;
+	}
+	if (list->heuristic == BUNDLE_HEURISTIC_CREATIONTOKEN)
+		QSORT(todo, nr, compare_creation_token);
+
+	trace2_region_enter("bundle-uri", "fetch", r);
+	if (list->mode == BUNDLE_MODE_ANY) {
+		for (i = 0; i < nr && !unbundled; i++) {
+			download_bundles(r, &todo[i], 1, 1, list->allow_local);
+			unbundled = unbundle_all(r, &todo[i], 1, &max_token);
+		}
+	} else {
+		download_bundles(r, todo, nr, jobs, list->allow_local);
+		unbundled = unbundle_all(r, todo, nr, &max_token);
+	}
+	trace2_data_intmax("bundle-uri", r, "unbundled", unbundled);
+	trace2_region_leave("bundle-uri", "fetch", r);
+
+	free(todo);
+	if (min_token)
+		*min_token = max_token;
+	return nr && !unbundled ? -1 : 0;
+}
+
+int fetch_bundle_uri(struct repository *r, const char *uri,
+		     uint64_t *min_token)
+{
+	struct bundle_list single, list;
+	struct remote_bundle_info *bundle;
+	struct config_options opts = {
+		.error_action = CONFIG_ERROR_ERROR,
+	};
+	int ret = -1;
+
+	init_bundle_list(&single);
+	init_bundle_list(&list);
+
+	bundle = get_bundle(&single, "", 0);
+	bundle->uri = xstrdup(uri);
+	download_bundles(r, &bundle, 1, 1, 1);
+	if (!bundle->file)
+		goto out;
+
+	if (is_bundle(bundle->file, 1)) {
+		uint64_t token = 0;
+
+		ret = unbundle_all(r, &bundle, 1, &token) ? 0 : -1;
+		goto out;
+	}
+
+	list.base_uri = xstrdup(uri);
+	/* a list downloaded over HTTP must not point at local files */
+	list.allow_local = !is_http_uri(uri);
+	if (git_config_from_file_with_options(read_bundle_list_config,
+					      bundle->file, &list, &opts) ||
+	    !list.version) {
+		error(_("'%s' is neither a bundle nor a bundle list"), uri);
+		goto out;
+	}
+	ret = fetch_bundle_list(r, &list, min_token);
+
+out:
+	clear_bundle_list(&list);
+	clear_bundle_list(&single);
+	return ret;
+}
+
+int get_remote_bundle_uri(int fd_out, struct packet_reader *reader,
+			  struct bundle_list *list, int stateless_rpc)
+{
+	const char *hash_name;
+
+	packet_write_fmt(fd_out, "command=bundle-uri\n");
+	if (server_supports_v2("agent", 0))
+		packet_write_fmt(fd_out, "agent=%s", git_user_agent_sanitized());
+	if (server_feature_v2("object-format", &hash_name))
+		packet_write_fmt(fd_out, "object-format=%s", hash_name);
+	packet_flush(fd_out);
+
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL) {
+		if (bundle_uri_parse_line(list, reader->line))
+			warning(_("ignoring invalid bundle-uri line '%s'"),
+				reader->line);
+	}
+
+	if (reader->status != PACKET_READ_FLUSH)
+		die(_("expected flush after bundle-uri listing"));
+
+	check_stateless_delimiter(stateless_rpc, reader,
+				  _("expected response end packet after bundle-uri listing"));
+	return 0;
+}
+
+int bundle_uri_advertise(struct repository *r, struct strbuf *value)
+{
+	int advertise = 0;
+
+	repo_config_get_bool(r, "uploadpack.advertisebundleuris", &advertise);
+	return advertise;
+}
+
+static int send_bundle_config(const char *key, const char *value,
+			      void *data)
+{
+	if (starts_with(key, "bundle.") && value)
+		packet_writer_write(data, "%s=%s", key, value);
+	return 0;
+}
+
+int bundle_uri_command(struct repository *r, struct strvec *keys,
+		       struct packet_reader *request)
+{
+	struct packet_writer writer;
+
+	packet_writer_init(&writer, 1);
+
+	while (packet_reader_read(request) == PACKET_READ_NORMAL)
+		die(_("bundle-uri: unexpected argument '%s'"), request->line);
+	if (request->status != PACKET_READ_FLUSH)
+		die(_("bundle-uri: expected flush after arguments"));
+
+	repo_config(r, send_bundle_config, &writer);
+	packet_flush(1);
+	return 0;
+}
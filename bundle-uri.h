@@ -0,0 +1,129 @@
+#ifndef BUNDLE_URI_H
+#define BUNDLE_URI_H
+
+struct packet_reader;
+struct repository;
+struct strbuf;
+struct strvec;
+struct tempfile;
+
+/*
+ * A single bundle that a bundle list points at. Its `id` is the
+ * `<id>` in the `bundle.<id>.*` keys that describe it.
+ */
+struct remote_bundle_info {
+	char *id;
+	char *uri;
+
+	/*
+	 * The order in which bundles are meant to be applied, when the
+	 * list uses the "creationToken" heuristic; 0 if not given.
+	 */
+	uint64_t creation_token;
+
+	/*
+	 * Where the bundle can be read from once it is downloaded, or
+	 * NULL. `download` is set when that is a temporary file.
+	 */
+	char *file;
+	struct tempfile *download;
+
+	unsigned unbundled : 1;
+};
+
+enum bundle_list_mode {
+	BUNDLE_MODE_NONE = 0,
+
+	/* Every bundle in the list is needed. */
+	BUNDLE_MODE_ALL,
+
+	/* The bundles are copies of each other; any one will do. */
+	BUNDLE_MODE_ANY,
+};
+
+enum bundle_list_heuristic {
+	BUNDLE_HEURISTIC_NONE = 0,
+	BUNDLE_HEURISTIC_CREATIONTOKEN,
+};
+
+/*
+ * A list of bundles, as advertised by the "bundle-uri" protocol v2
+ * command or found in a file that a bundle URI points at. Either way it
+ * is a set of `bundle.*` configuration keys:
+ *
+ *	bundle.version = 1
+ *	bundle.mode = all | any
+ *	bundle.heuristic = creationToken
+ *	bundle.<id>.uri = <uri>
+ *	bundle.<id>.creationToken = <token>
+ *
+ * Relative URIs are resolved against `base_uri`.
+ *
+ * Only "http://" and "https://" URIs are used, unless `allow_local` is
+ * set to also read local paths and "file://" URIs. That is only safe
+ * for lists that did not come from a remote, which could otherwise have
+ * private bundles on this machine unbundled and advertised back to it.
+ */
+struct bundle_list {
+	int version;
+	enum bundle_list_mode mode;
+	enum bundle_list_heuristic heuristic;
+	char *base_uri;
+	unsigned allow_local : 1;
+
+	struct remote_bundle_info *items;
+	size_t nr, alloc;
+};
+
+void init_bundle_list(struct bundle_list *list);
+void clear_bundle_list(struct bundle_list *list);
+
+/*
+ * Add one "<key>=<value>" line to `list`. Return 0 on success, or -1 if
+ * the line could not be understood. Unknown keys are ignored, so that
+ * servers may add new ones.
+ */
+int bundle_uri_parse_line(struct bundle_list *list, const char *line);
+
+/*
+ * Download the bundles in `list` and unbundle them into `r`, writing
+ * the branches they contain under `refs/bundles/` so that a later fetch
+ * negotiates only what the bundles did not already provide. Bundles are
+ * downloaded in parallel, up to `bundle.jobs` at a time.
+ *
+ * Bundles whose creation token is not larger than `*min_token` are
+ * skipped; on return `*min_token` holds the largest creation token that
+ * was unbundled. `min_token` may be NULL.
+ *
+ * Return 0 if the bundles were unbundled, or -1 if none of them could
+ * be. Bundles are an optimization, so failures are not fatal to the
+ * fetch that follows; they are reported as warnings.
+ */
+int fetch_bundle_list(struct repository *r, struct bundle_list *list,
+		      uint64_t *min_token);
+
+/*
+ * Download the bundle or bundle list at `uri` and apply it to `r` as
+ * fetch_bundle_list() does. `uri` may be a local path, or a "file://",
+ * "http://" or "https://" URL. A list found at an HTTP URL may only
+ * point at other HTTP URLs.
+ */
+int fetch_bundle_uri(struct repository *r, const char *uri,
+		     uint64_t *min_token);
+
+/*
+ * Ask a protocol v2 server for its bundle list with the "bundle-uri"
+ * command, adding what it advertises to `list`.
+ */
+int get_remote_bundle_uri(int fd_out, struct packet_reader *reader,
+			  struct bundle_list *list, int stateless_rpc);
+
+/*
+ * The server side of the "bundle-uri" command: send the `bundle.*`
+ * configuration of `r` when `uploadpack.advertiseBundleURIs` is set.
+ */
+int bundle_uri_advertise(struct repository *r, struct strbuf *value);
+int bundle_uri_command(struct repository *r, struct strvec *keys,
+		       struct packet_reader *request);
+
+#endif /* BUNDLE_URI_H */
@@ -32,6 +32,22 @@ static void add_to_ref_list(const struct object_id *oid, const char *name,
 	list->nr++;
 }
 
+static void release_ref_list(struct ref_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->nr; i++)
+		free(list->list[i].name);
+	FREE_AND_NULL(list->list);
+	list->nr = list->alloc = 0;
+}
+
+void bundle_header_release(struct bundle_header *header)
+{
+	release_ref_list(&header->prerequisites);
+	release_ref_list(&header->references);
+}
+
 static int parse_capability(struct bundle_header *header, const char *capability)
 {
 	const char *arg;
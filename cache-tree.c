@@ -7,6 +7,9 @@
 #include "replace-object.h"
 #include "promisor-remote.h"
 #include "sparse-index.h"
+#include "config.h"
+#include "bulk-checkin.h"
+#include "thread-utils.h"
 
 #ifndef DEBUG_CACHE_TREE
 #define DEBUG_CACHE_TREE 0
@@ -237,13 +240,23 @@ int cache_tree_fully_valid(struct cache_tree *it)
 	return 1;
 }
 
+/*
+ * Tree objects computed by a thread of update_subtrees_threaded(), to
+ * be written out once all threads are done.
+ */
+struct tree_batch {
+	struct bulk_checkin_object *objs;
+	size_t nr, alloc;
+};
+
 static int update_one(struct cache_tree *it,
 		      struct cache_entry **cache,
 		      int entries,
 		      const char *base,
 		      int baselen,
 		      int *skip_count,
-		      int flags)
+		      int flags,
+		      struct tree_batch *batch)
 {
 	struct strbuf buffer;
 	int missing_ok = flags & WRITE_TREE_MISSING_OK;
@@ -319,7 +332,7 @@ static int update_one(struct cache_tree *it,
 				    path,
 				    baselen + sublen + 1,
 				    &subskip,
-				    flags);
+				    flags, batch);
 		if (subcnt < 0)
 			return subcnt;
 		if (!subcnt)
@@ -377,13 +390,19 @@ static int update_one(struct cache_tree *it,
 			i++;
 		}
 
+		/*
+		 * With a batch, the subtrees we just computed are not
+		 * written yet.
+		 */
 		ce_missing_ok = mode == S_IFGITLINK || missing_ok ||
+			(sub && batch) ||
 			(has_promisor_remote() &&
 			 ce_skip_worktree(ce));
 		if (is_null_oid(oid) ||
 		    (!ce_missing_ok && !has_object_file(oid))) {
 			strbuf_release(&buffer);
-			if (expected_missing)
+			/* Leave the error to the serial pass. */
+			if (expected_missing || batch)
 				return -1;
 			return error("invalid object %06o %s for '%.*s'",
 				mode, oid_to_hex(oid), entlen+baselen, path);
@@ -436,6 +455,16 @@ static int update_one(struct cache_tree *it,
 	} else if (dryrun) {
 		hash_object_file(the_hash_algo, buffer.buf, buffer.len,
 				 tree_type, &it->oid);
+	} else if (batch) {
+		struct bulk_checkin_object *obj;
+
+		hash_object_file(the_hash_algo, buffer.buf, buffer.len,
+				 tree_type, &it->oid);
+		ALLOC_GROW(batch->objs, batch->nr + 1, batch->alloc);
+		obj = &batch->objs[batch->nr++];
+		oidcpy(&obj->oid, &it->oid);
+		obj->type = OBJ_TREE;
+		obj->buf = strbuf_detach(&buffer, &obj->len);
 	} else if (write_object_file(buffer.buf, buffer.len, tree_type,
 				     &it->oid)) {
 		strbuf_release(&buffer);
@@ -452,6 +481,195 @@ static int update_one(struct cache_tree *it,
 	return i;
 }
 
+/*
+ * Mostly randomly chosen: we want at least this many index entries
+ * in the subtrees to update for each thread we start.
+ */
+#define CACHE_TREE_THREAD_COST 5000
+
+/*
+ * Below this many new trees, loose objects are cheap enough; like
+ * transfer.unpackLimit, write a pack only for more.
+ */
+#define CACHE_TREE_PACK_MIN 100
+
+struct subtree_job {
+	struct cache_tree *it;
+	int pos, nr, baselen;
+};
+
+struct subtree_thread {
+	pthread_t pthread;
+	struct index_state *istate;
+	struct subtree_job *jobs;
+	int nr_jobs, *next_job;
+	pthread_mutex_t *mutex;
+	int flags;
+	struct tree_batch batch;
+};
+
+static void *update_subtrees_thread(void *_data)
+{
+	struct subtree_thread *t = _data;
+
+	trace2_thread_start("cache_tree_update");
+	while (1) {
+		struct subtree_job *job;
+		int skip;
+
+		pthread_mutex_lock(t->mutex);
+		job = *t->next_job < t->nr_jobs ? &t->jobs[(*t->next_job)++] : NULL;
+		pthread_mutex_unlock(t->mutex);
+		if (!job)
+			break;
+
+		/*
+		 * The serial pass redoes the subtrees we fail on, or whose
+		 * entry count does not tell how many index entries they span.
+		 */
+		if (update_one(job->it, t->istate->cache + job->pos, job->nr,
+			       t->istate->cache[job->pos]->name, job->baselen,
+			       &skip, t->flags, &t->batch) < 0 || skip)
+			job->it->entry_count = -1;
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void write_tree_batches(struct subtree_thread *threads, int nr_threads)
+{
+	struct tree_batch all = { 0 };
+	size_t i;
+	int t;
+
+	for (t = 0; t < nr_threads; t++) {
+		struct tree_batch *batch = &threads[t].batch;
+
+		ALLOC_GROW(all.objs, all.nr + batch->nr, all.alloc);
+		COPY_ARRAY(all.objs + all.nr, batch->objs, batch->nr);
+		all.nr += batch->nr;
+		free(batch->objs);
+	}
+
+	if (all.nr >= CACHE_TREE_PACK_MIN) {
+		bulk_checkin_write_objects(all.objs, all.nr);
+	} else {
+		for (i = 0; i < all.nr; i++) {
+			struct bulk_checkin_object *obj = &all.objs[i];
+
+			if (write_object_file(obj->buf, obj->len, tree_type,
+					      &obj->oid))
+				die(_("unable to write tree object %s"),
+				    oid_to_hex(&obj->oid));
+		}
+	}
+	trace2_data_intmax("cache_tree", the_repository, "threaded/trees",
+			   all.nr);
+
+	for (i = 0; i < all.nr; i++)
+		free((void *)all.objs[i].buf);
+	free(all.objs);
+}
+
+/*
+ * Compute the invalid top-level subtrees of the index in parallel, so
+ * that the serial update_one() of the root that follows finds them
+ * valid. The new tree objects are written all at once, in a pack if
+ * there are many of them.
+ */
+static void update_subtrees_threaded(struct index_state *istate, int flags)
+{
+	struct cache_tree *root = istate->cache_tree;
+	struct subtree_job *jobs = NULL;
+	struct subtree_thread *threads;
+	pthread_mutex_t mutex;
+	int nr_jobs = 0, alloc_jobs = 0, next_job = 0;
+	int nr_threads, work = 0, i, t;
+
+	if (!HAVE_THREADS || (flags & (WRITE_TREE_DRY_RUN | WRITE_TREE_REPAIR)) ||
+	    root->entry_count >= 0 ||
+	    git_config_get_index_threads(&nr_threads) || nr_threads == 1)
+		return;
+
+	i = 0;
+	while (i < istate->cache_nr) {
+		const char *name = istate->cache[i]->name;
+		const char *slash = strchr(name, '/');
+		struct cache_tree_sub *sub;
+		int sublen, end;
+
+		if (!slash) {
+			i++;
+			continue;
+		}
+		sublen = slash - name;
+		for (end = i + 1; end < istate->cache_nr; end++)
+			if (strncmp(istate->cache[end]->name, name, sublen + 1))
+				break;
+
+		sub = find_subtree(root, name, sublen, 1);
+		if (!sub->cache_tree)
+			sub->cache_tree = cache_tree();
+		if (sub->cache_tree->entry_count < 0) {
+			ALLOC_GROW(jobs, nr_jobs + 1, alloc_jobs);
+			jobs[nr_jobs].it = sub->cache_tree;
+			jobs[nr_jobs].pos = i;
+			jobs[nr_jobs].nr = end - i;
+			jobs[nr_jobs].baselen = sublen + 1;
+			nr_jobs++;
+			work += end - i;
+		}
+		i = end;
+	}
+
+	if (!nr_threads) {
+		nr_threads = work / CACHE_TREE_THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+	}
+	if (nr_threads > nr_jobs)
+		nr_threads = nr_jobs;
+	if (nr_threads < 2) {
+		free(jobs);
+		return;
+	}
+
+	trace2_region_enter("cache_tree", "update_subtrees", the_repository);
+	/* initialize what the threads would race for */
+	has_promisor_remote();
+	enable_obj_read_lock();
+	pthread_mutex_init(&mutex, NULL);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		struct subtree_thread *p = &threads[t];
+		int err;
+
+		p->istate = istate;
+		p->jobs = jobs;
+		p->nr_jobs = nr_jobs;
+		p->next_job = &next_job;
+		p->mutex = &mutex;
+		p->flags = flags;
+		err = pthread_create(&p->pthread, NULL, update_subtrees_thread, p);
+		if (err)
+			die(_("unable to create cache-tree thread: %s"),
+			    strerror(err));
+	}
+	for (t = 0; t < nr_threads; t++)
+		if (pthread_join(threads[t].pthread, NULL))
+			die("unable to join cache-tree thread");
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&mutex);
+
+	write_tree_batches(threads, nr_threads);
+	trace2_data_intmax("cache_tree", the_repository, "threaded/threads",
+			   nr_threads);
+	trace2_region_leave("cache_tree", "update_subtrees", the_repository);
+
+	free(threads);
+	free(jobs);
+}
+
 int cache_tree_update(struct index_state *istate, int flags)
 {
 	int skip, i;
@@ -461,15 +679,14 @@ int cache_tree_update(struct index_state *istate, int flags)
 	if (i)
 		return i;
 
-	ensure_full_index(istate);
-
 	if (!istate->cache_tree)
 		istate->cache_tree = cache_tree();
 
 	trace_performance_enter();
 	trace2_region_enter("cache_tree", "update", the_repository);
+	update_subtrees_threaded(istate, flags);
 	i = update_one(istate->cache_tree, istate->cache, istate->cache_nr,
-		       "", 0, &skip, flags);
+		       "", 0, &skip, flags, NULL);
 	trace2_region_leave("cache_tree", "update", the_repository);
 	trace_performance_leave("cache_tree_update");
 	if (i < 0)
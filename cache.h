@@ -34,6 +34,18 @@ void git_inflate_init_gzip_only(git_zstream *);
 void git_inflate_end(git_zstream *);
 int git_inflate(git_zstream *, int flush);
 
+/*
+ * Inflate the complete zlib stream found at the beginning of "in" (of
+ * which at most "in_len" bytes are available) into "out", which must
+ * be exactly as large as the inflated stream. Returns the number of
+ * input bytes the stream occupied, or -1 if the stream could not be
+ * inflated in one go: it is corrupt, its inflated size differs from
+ * "out_len", or it does not end within "in_len" bytes. No error is
+ * reported; callers fall back to git_inflate() for a diagnosis.
+ */
+ssize_t git_inflate_buffer(void *out, unsigned long out_len,
+			   const void *in, unsigned long in_len);
+
 void git_deflate_init(git_zstream *, int level);
 void git_deflate_init_gzip(git_zstream *, int level);
 void git_deflate_init_raw(git_zstream *, int level);
@@ -310,6 +322,7 @@ struct split_index;
 struct untracked_cache;
 struct progress;
 struct pattern_list;
+struct name_hash_lock;
 
 struct index_state {
 	struct cache_entry **cache;
@@ -334,6 +347,7 @@ struct index_state {
 		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
+	struct name_hash_lock *name_hash_lock;
 	struct object_id oid;
 	struct untracked_cache *untracked;
 	char *fsmonitor_last_update;
@@ -648,8 +662,11 @@ int path_inside_repo(const char *prefix, const char *path);
 
 int init_db(const char *git_dir, const char *real_git_dir,
 	    const char *template_dir, int hash_algo,
+	    enum ref_storage_format ref_storage_format,
 	    const char *initial_branch, unsigned int flags);
-void initialize_repository_version(int hash_algo, int reinit);
+void initialize_repository_version(int hash_algo,
+				   enum ref_storage_format ref_storage_format,
+				   int reinit);
 
 void sanitize_stdfds(void);
 int daemonize(void);
@@ -738,6 +755,18 @@ int do_read_index(struct index_state *istate, const char *path,
 		  int must_exist); /* for testting only! */
 int read_index_from(struct index_state *, const char *path,
 		    const char *gitdir);
+
+/*
+ * Like read_index_from(), but if the index has an offset table, only
+ * load the blocks of entries that may have names starting with the
+ * first `prefixlen` bytes of `prefix`; entries outside of these blocks
+ * are left out. The result must therefore not be written out. Falls
+ * back to reading the whole index if it has no offset table, or is a
+ * split or sparse index, or uses fsmonitor.
+ */
+int read_index_prefix_from(struct index_state *, const char *path,
+			   const char *gitdir,
+			   const char *prefix, size_t prefixlen);
 int is_index_unborn(struct index_state *);
 
 void ensure_full_index(struct index_state *istate);
@@ -788,6 +817,25 @@ int index_dir_exists(struct index_state *istate, const char *name, int namelen);
 void adjust_dirname_case(struct index_state *istate, char *name);
 struct cache_entry *index_file_exists(struct index_state *istate, const char *name, int namelen, int igncase);
 
+/*
+ * Look "name" up as a directory, like index_dir_exists(), and if it is
+ * none, as a file, like index_file_exists() with "igncase" set to
+ * "ignore_case", hashing it only once.
+ */
+struct cache_entry *index_dir_or_file_exists(struct index_state *istate,
+					     const char *name, int namelen,
+					     int *is_dir);
+
+/*
+ * Allow the name hash lookups above, add_name_hash() and
+ * remove_name_hash() to be called from several threads at once, until
+ * disable_name_hash_lock() is called. This expands a sparse index and
+ * initializes the name hash first; the index must not be changed in
+ * other ways meanwhile.
+ */
+void enable_name_hash_lock(struct index_state *istate);
+void disable_name_hash_lock(struct index_state *istate);
+
 /*
  * Searches for an entry defined by name and namelen in the given index.
  * If the return value is positive (including 0) it is the position of an
@@ -856,6 +904,7 @@ int chmod_index_entry(struct index_state *, struct cache_entry *ce, char flip);
 int ce_same_name(const struct cache_entry *a, const struct cache_entry *b);
 void set_object_name_for_intent_to_add_entry(struct cache_entry *ce);
 int index_name_is_other(struct index_state *, const char *, int);
+const struct object_id *blob_oid_from_index(struct index_state *, const char *);
 void *read_blob_data_from_index(struct index_state *, const char *, unsigned long *);
 
 /* do stat comparison even if CE_VALID is true */
@@ -954,6 +1003,9 @@ extern int pack_compression_level;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
+extern size_t tree_cache_limit;
+extern size_t pack_readahead_size;
+extern int core_loose_object_index;
 extern unsigned long big_file_threshold;
 extern unsigned long pack_size_limit_cfg;
 
@@ -977,6 +1029,23 @@ extern int read_replace_refs;
 extern char *git_replace_ref_base;
 
 extern int fsync_object_files;
+extern int fsync_ref_files;
+
+enum fsync_method {
+	FSYNC_METHOD_FSYNC,
+	FSYNC_METHOD_BATCH
+};
+
+extern enum fsync_method fsync_method;
+
+enum checksum_trust {
+	CHECKSUM_TRUST_VERIFIED,
+	CHECKSUM_TRUST_PARANOID
+};
+
+extern enum checksum_trust checksum_trust;
+extern unsigned long hashfile_buffer_size;
+extern int hashfile_write_thread;
 extern int core_preload_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
@@ -1053,6 +1122,7 @@ extern int grafts_replace_parents;
 #define GIT_REPO_VERSION_READ 1
 extern int repository_format_precious_objects;
 extern int repository_format_worktree_config;
+extern int repository_format_packed_refs_delta;
 
 /*
  * You _have_ to initialize a `struct repository_format` using
@@ -1065,6 +1135,8 @@ struct repository_format {
 	int worktree_config;
 	int is_bare;
 	int hash_algo;
+	enum ref_storage_format ref_storage_format;
+	int packed_refs_delta;
 	int sparse_index;
 	char *work_tree;
 	struct string_list unknown_extensions;
@@ -1081,6 +1153,7 @@ struct repository_format {
 	.version = -1, \
 	.is_bare = -1, \
 	.hash_algo = GIT_HASH_SHA1, \
+	.ref_storage_format = REF_STORAGE_FORMAT_FILES, \
 	.unknown_extensions = STRING_LIST_INIT_DUP, \
 	.v1_only_extensions = STRING_LIST_INIT_DUP, \
 }
@@ -1661,6 +1734,7 @@ int has_symlink_leading_path(const char *name, int len);
 int threaded_has_symlink_leading_path(struct cache_def *, const char *, int);
 int check_leading_path(const char *name, int len, int warn_on_lstat_err);
 int has_dirs_only_path(const char *name, int len, int prefix_len);
+int threaded_has_dirs_only_path(struct cache_def *, const char *, int, int);
 void invalidate_lstat_cache(void);
 void schedule_dir_for_removal(const char *name, int len);
 void remove_scheduled_dirs(void);
@@ -18,6 +18,10 @@ struct chunk_info {
 struct chunkfile {
 	struct hashfile *f;
 
+	/* the file whose table of contents was read, when reading */
+	const unsigned char *mfile;
+	size_t mfile_size;
+
 	struct chunk_info *chunks;
 	size_t chunks_nr;
 	size_t chunks_alloc;
@@ -102,6 +106,8 @@ int read_table_of_contents(struct chunkfile *cf,
 	const unsigned char *table_of_contents = mfile + toc_offset;
 
 	ALLOC_GROW(cf->chunks, toc_length, cf->chunks_alloc);
+	cf->mfile = mfile;
+	cf->mfile_size = mfile_size;
 
 	while (toc_length--) {
 		uint64_t chunk_offset, next_chunk_offset;
@@ -177,3 +183,106 @@ int read_chunk(struct chunkfile *cf,
 
 	return CHUNK_NOT_FOUND;
 }
+
+struct pair_chunk_data {
+	const unsigned char **p;
+	size_t expected_size;
+};
+
+static int pair_chunk_expect_fn(const unsigned char *chunk_start,
+				size_t chunk_size,
+				void *data)
+{
+	struct pair_chunk_data *pcd = data;
+
+	if (chunk_size != pcd->expected_size)
+		return CHUNK_WRONG_SIZE;
+	*pcd->p = chunk_start;
+	return 0;
+}
+
+int pair_chunk_expect(struct chunkfile *cf,
+		      uint32_t chunk_id,
+		      const unsigned char **p,
+		      size_t expected_size)
+{
+	struct pair_chunk_data pcd = {
+		.p = p,
+		.expected_size = expected_size,
+	};
+	return read_chunk(cf, chunk_id, pair_chunk_expect_fn, &pcd);
+}
+
+void advise_chunk_access(const void *start, size_t size,
+			 enum chunk_access access)
+{
+#ifdef HAVE_POSIX_MADVISE
+	uintptr_t page_size = getpagesize();
+	uintptr_t begin = (uintptr_t)start & ~(page_size - 1);
+	uintptr_t end = (uintptr_t)start + size;
+	int advice;
+
+	if (!size)
+		return;
+	switch (access) {
+	case CHUNK_ACCESS_RANDOM:
+		advice = POSIX_MADV_RANDOM;
+		break;
+	case CHUNK_ACCESS_SEQUENTIAL:
+		advice = POSIX_MADV_SEQUENTIAL;
+		break;
+	default:
+		advice = POSIX_MADV_NORMAL;
+		break;
+	}
+	/* this is only a hint; there is nothing to do if it is not taken */
+	posix_madvise((void *)begin, end - begin, advice);
+#endif
+}
+
+void advise_chunk(struct chunkfile *cf,
+		  uint32_t chunk_id,
+		  enum chunk_access access)
+{
+	int i;
+
+	for (i = 0; i < cf->chunks_nr; i++) {
+		if (cf->chunks[i].id == chunk_id) {
+			advise_chunk_access(cf->chunks[i].start,
+					    cf->chunks[i].size, access);
+			return;
+		}
+	}
+}
+
+void trace_chunkfile(struct chunkfile *cf, const char *category)
+{
+	struct strbuf key = STRBUF_INIT;
+	int i;
+
+	if (!trace2_is_enabled())
+		return;
+
+	trace2_data_intmax(category, the_repository, "load/size",
+			   cf->mfile_size);
+	trace2_data_intmax(category, the_repository, "load/chunks",
+			   cf->chunks_nr);
+	for (i = 0; i < cf->chunks_nr; i++) {
+		uint32_t id = cf->chunks[i].id;
+		int j;
+
+		strbuf_reset(&key);
+		strbuf_addstr(&key, "load/chunk/");
+		for (j = 24; j >= 0; j -= 8) {
+			unsigned char c = (id >> j) & 0xff;
+
+			if (isalnum(c))
+				strbuf_addch(&key, c);
+			else
+				strbuf_addf(&key, "%%%02x", c);
+		}
+		trace2_data_intmax(category, the_repository, key.buf,
+				   cf->chunks[i].size);
+	}
+	strbuf_release(&key);
+}
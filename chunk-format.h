@@ -51,6 +51,22 @@ int pair_chunk(struct chunkfile *cf,
 	       uint32_t chunk_id,
 	       const unsigned char **p);
 
+#define CHUNK_WRONG_SIZE (-3)
+
+/*
+ * Like pair_chunk(), but only if the chunk is exactly 'expected_size'
+ * bytes long, as the tables whose number of rows is known from another
+ * chunk are. Checking each chunk as it is paired is what lets readers
+ * use it without validating the whole file up front.
+ *
+ * Returns CHUNK_NOT_FOUND if the chunk does not exist, and
+ * CHUNK_WRONG_SIZE, leaving 'p' untouched, if it has another size.
+ */
+int pair_chunk_expect(struct chunkfile *cf,
+		      uint32_t chunk_id,
+		      const unsigned char **p,
+		      size_t expected_size);
+
 typedef int (*chunk_read_fn)(const unsigned char *chunk_start,
 			     size_t chunk_size, void *data);
 /*
@@ -65,4 +81,36 @@ int read_chunk(struct chunkfile *cf,
 	       chunk_read_fn fn,
 	       void *data);
 
+enum chunk_access {
+	CHUNK_ACCESS_NORMAL,
+	CHUNK_ACCESS_RANDOM,
+	CHUNK_ACCESS_SEQUENTIAL,
+};
+
+/*
+ * Tell the kernel how the 'size' bytes of a memory-mapped chunk at
+ * 'start' are going to be read, so that it only pages in what is
+ * needed: binary searches and lookups by position gain nothing from
+ * reading ahead around each page they touch, while scans of a whole
+ * chunk want it read ahead aggressively. This is only a hint, and it
+ * does nothing on platforms without posix_madvise().
+ */
+void advise_chunk_access(const void *start, size_t size,
+			 enum chunk_access access);
+
+/*
+ * The same, for the chunk 'chunk_id' of a chunkfile whose table of
+ * contents was read; does nothing if there is no such chunk.
+ */
+void advise_chunk(struct chunkfile *cf,
+		  uint32_t chunk_id,
+		  enum chunk_access access);
+
+/*
+ * Report to trace2, under 'category', the size of the file whose
+ * table of contents was read into 'cf', its number of chunks and
+ * the size of each chunk as "load/chunk/<id>".
+ */
+void trace_chunkfile(struct chunkfile *cf, const char *category);
+
 #endif
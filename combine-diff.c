@@ -185,15 +185,25 @@ static int match_string_spaces(const char *line1, int len1,
 
 enum coalesce_direction { MATCH, BASE, NEW };
 
+/*
+ * Beyond this many cells, the table to find the LCS of two lists of
+ * lost lines takes more memory than it is worth; the lines lost from
+ * the new parent are then shown next to, not merged with, those lost
+ * from the others.
+ */
+#define COALESCE_MAX_CELLS (64 * 1024 * 1024)
+
 /* Coalesce new lines into base by finding LCS */
 static struct lline *coalesce_lines(struct lline *base, int *lenbase,
 				    struct lline *newline, int lennew,
 				    unsigned long parent, long flags)
 {
-	int **lcs;
-	enum coalesce_direction **directions;
+	int *lcs, *lcs_prev;
+	unsigned char *directions = NULL;
+	struct lline **baseline, **newlines;
+	unsigned int *basehash = NULL, *newhash = NULL;
 	struct lline *baseend, *newend = NULL;
-	int i, j, origbaselen = *lenbase;
+	int i, j, width;
 
 	if (newline == NULL)
 		return base;
@@ -214,51 +224,96 @@ static struct lline *coalesce_lines(struct lline *base, int *lenbase,
 	 *   - Else if we have NEW, insert newend lline into base and
 	 *   consume newend
 	 */
-	CALLOC_ARRAY(lcs, st_add(origbaselen, 1));
-	CALLOC_ARRAY(directions, st_add(origbaselen, 1));
-	for (i = 0; i < origbaselen + 1; i++) {
-		CALLOC_ARRAY(lcs[i], st_add(lennew, 1));
-		CALLOC_ARRAY(directions[i], st_add(lennew, 1));
-		directions[i][0] = BASE;
+	ALLOC_ARRAY(baseline, st_add(*lenbase, 1));
+	ALLOC_ARRAY(newlines, st_add(lennew, 1));
+	for (i = 1, baseend = base; baseend; baseend = baseend->next)
+		baseline[i++] = baseend;
+	for (j = 1, newend = newline; newend; newend = newend->next)
+		newlines[j++] = newend;
+	i = *lenbase;
+	j = lennew;
+
+	/*
+	 * Reading the directions back from the end takes every match it
+	 * comes across, so lines both lost at the end are matched without
+	 * having to fill the table for them.
+	 */
+	while (i && j &&
+	       match_string_spaces(baseline[i]->line, baseline[i]->len,
+				   newlines[j]->line, newlines[j]->len, flags)) {
+		baseline[i]->parent_map |= 1<<parent;
+		i--;
+		j--;
 	}
-	for (j = 1; j < lennew + 1; j++)
-		directions[0][j] = NEW;
-
-	for (i = 1, baseend = base; i < origbaselen + 1; i++) {
-		for (j = 1, newend = newline; j < lennew + 1; j++) {
-			if (match_string_spaces(baseend->line, baseend->len,
-						newend->line, newend->len, flags)) {
-				lcs[i][j] = lcs[i - 1][j - 1] + 1;
-				directions[i][j] = MATCH;
-			} else if (lcs[i][j - 1] >= lcs[i - 1][j]) {
-				lcs[i][j] = lcs[i][j - 1];
-				directions[i][j] = NEW;
-			} else {
-				lcs[i][j] = lcs[i - 1][j];
-				directions[i][j] = BASE;
+
+	width = j + 1;
+	if (i && j && (size_t)(i + 1) * width <= COALESCE_MAX_CELLS) {
+		int bi, nj;
+
+		directions = xmalloc(st_mult(i + 1, width));
+		CALLOC_ARRAY(lcs, width);
+		CALLOC_ARRAY(lcs_prev, width);
+
+		/* Without whitespace flags, only equal lines can match. */
+		if (!(flags & XDF_WHITESPACE_FLAGS)) {
+			ALLOC_ARRAY(basehash, i + 1);
+			ALLOC_ARRAY(newhash, width);
+			for (bi = 1; bi <= i; bi++)
+				basehash[bi] = memhash(baseline[bi]->line,
+						       baseline[bi]->len);
+			for (nj = 1; nj <= j; nj++)
+				newhash[nj] = memhash(newlines[nj]->line,
+						      newlines[nj]->len);
+		}
+
+		for (nj = 0; nj <= j; nj++)
+			directions[nj] = NEW;
+		for (bi = 1; bi <= i; bi++) {
+			unsigned char *dir = directions + bi * width;
+			struct lline *b = baseline[bi];
+
+			SWAP(lcs, lcs_prev);
+			dir[0] = BASE;
+			for (nj = 1; nj <= j; nj++) {
+				struct lline *n = newlines[nj];
+
+				if ((!basehash || basehash[bi] == newhash[nj]) &&
+				    match_string_spaces(b->line, b->len,
+							n->line, n->len, flags)) {
+					lcs[nj] = lcs_prev[nj - 1] + 1;
+					dir[nj] = MATCH;
+				} else if (lcs[nj - 1] >= lcs_prev[nj]) {
+					lcs[nj] = lcs[nj - 1];
+					dir[nj] = NEW;
+				} else {
+					lcs[nj] = lcs_prev[nj];
+					dir[nj] = BASE;
+				}
 			}
-			if (newend->next)
-				newend = newend->next;
 		}
-		if (baseend->next)
-			baseend = baseend->next;
+		free(lcs);
+		free(lcs_prev);
+		free(basehash);
+		free(newhash);
 	}
 
-	for (i = 0; i < origbaselen + 1; i++)
-		free(lcs[i]);
-	free(lcs);
-
-	/* At this point, baseend and newend point to the end of each lists */
-	i--;
-	j--;
+	baseend = i ? baseline[i] : NULL;
+	newend = j ? newlines[j] : NULL;
 	while (i != 0 || j != 0) {
-		if (directions[i][j] == MATCH) {
+		enum coalesce_direction dir;
+
+		if (directions)
+			dir = directions[i * width + j];
+		else
+			dir = j ? NEW : BASE;
+
+		if (dir == MATCH) {
 			baseend->parent_map |= 1<<parent;
 			baseend = baseend->prev;
 			newend = newend->prev;
 			i--;
 			j--;
-		} else if (directions[i][j] == NEW) {
+		} else if (dir == NEW) {
 			struct lline *lline;
 
 			lline = newend;
@@ -302,9 +357,9 @@ static struct lline *coalesce_lines(struct lline *base, int *lenbase,
 		free(lline);
 	}
 
-	for (i = 0; i < origbaselen + 1; i++)
-		free(directions[i]);
 	free(directions);
+	free(baseline);
+	free(newlines);
 
 	return base;
 }
@@ -20,6 +20,8 @@
 #include "json-writer.h"
 #include "trace2.h"
 #include "chunk-format.h"
+#include "csum-file.h"
+#include "thread-utils.h"
 
 void git_test_write_commit_graph_or_die(void)
 {
@@ -45,6 +47,7 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
+#define GRAPH_CHUNKID_REACH_INDEX 0x524c424c /* "RLBL" */
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
 
@@ -221,7 +224,7 @@ static int commit_graph_compatible(struct repository *r)
 
 	if (read_replace_refs) {
 		prepare_replace_object(r);
-		if (hashmap_get_size(&r->objects->replace_map->map))
+		if (oidmap_get_size(r->objects->replace_map))
 			return 0;
 	}
 
@@ -313,6 +316,19 @@ static int graph_read_oid_lookup(const unsigned char *chunk_start,
 	return 0;
 }
 
+static int graph_read_reach_index(const unsigned char *chunk_start,
+				  size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+
+	if (chunk_size != st_mult(g->num_commits, 2 * sizeof(uint32_t))) {
+		warning(_("ignoring commit-graph reachability index of the wrong size"));
+		return 0;
+	}
+	g->chunk_reach_index = chunk_start;
+	return 0;
+}
+
 static int graph_read_bloom_data(const unsigned char *chunk_start,
 				  size_t chunk_size, void *data)
 {
@@ -333,6 +349,17 @@ static int graph_read_bloom_data(const unsigned char *chunk_start,
 	return 0;
 }
 
+static const uint32_t random_access_chunks[] = {
+	GRAPH_CHUNKID_OIDLOOKUP,
+	GRAPH_CHUNKID_DATA,
+	GRAPH_CHUNKID_GENERATION_DATA,
+	GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW,
+	GRAPH_CHUNKID_EXTRAEDGES,
+	GRAPH_CHUNKID_BLOOMINDEXES,
+	GRAPH_CHUNKID_BLOOMDATA,
+	GRAPH_CHUNKID_REACH_INDEX,
+};
+
 struct commit_graph *parse_commit_graph(struct repository *r,
 					void *graph_map, size_t graph_size)
 {
@@ -341,6 +368,7 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 	uint32_t graph_signature;
 	unsigned char graph_version, hash_version;
 	struct chunkfile *cf = NULL;
+	int i;
 
 	if (!graph_map)
 		return NULL;
@@ -394,28 +422,54 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 	if (read_table_of_contents(cf, graph->data, graph_size,
 				   GRAPH_HEADER_SIZE, graph->num_chunks))
 		goto free_and_return;
+	trace_chunkfile(cf, "commit-graph");
 
-	pair_chunk(cf, GRAPH_CHUNKID_OIDFANOUT,
-		   (const unsigned char **)&graph->chunk_oid_fanout);
+	if (pair_chunk_expect(cf, GRAPH_CHUNKID_OIDFANOUT,
+			      (const unsigned char **)&graph->chunk_oid_fanout,
+			      GRAPH_FANOUT_SIZE) == CHUNK_WRONG_SIZE) {
+		error(_("commit-graph OID fanout chunk is the wrong size"));
+		goto free_and_return;
+	}
 	read_chunk(cf, GRAPH_CHUNKID_OIDLOOKUP, graph_read_oid_lookup, graph);
-	pair_chunk(cf, GRAPH_CHUNKID_DATA, &graph->chunk_commit_data);
+	if (graph->chunk_oid_lookup &&
+	    pair_chunk_expect(cf, GRAPH_CHUNKID_DATA, &graph->chunk_commit_data,
+			      st_mult(graph->num_commits, GRAPH_DATA_WIDTH)) ==
+	    CHUNK_WRONG_SIZE) {
+		error(_("commit-graph commit data chunk is the wrong size"));
+		goto free_and_return;
+	}
 	pair_chunk(cf, GRAPH_CHUNKID_EXTRAEDGES, &graph->chunk_extra_edges);
 	pair_chunk(cf, GRAPH_CHUNKID_BASE, &graph->chunk_base_graphs);
+	read_chunk(cf, GRAPH_CHUNKID_REACH_INDEX, graph_read_reach_index, graph);
 
 	if (get_configured_generation_version(r) >= 2) {
-		pair_chunk(cf, GRAPH_CHUNKID_GENERATION_DATA,
-			&graph->chunk_generation_data);
+		if (pair_chunk_expect(cf, GRAPH_CHUNKID_GENERATION_DATA,
+				      &graph->chunk_generation_data,
+				      st_mult(graph->num_commits, sizeof(uint32_t))) ==
+		    CHUNK_WRONG_SIZE)
+			warning(_("ignoring commit-graph generation data of the wrong size"));
 		pair_chunk(cf, GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW,
 			&graph->chunk_generation_data_overflow);
 	}
 
 	if (r->settings.commit_graph_read_changed_paths) {
-		pair_chunk(cf, GRAPH_CHUNKID_BLOOMINDEXES,
-			   &graph->chunk_bloom_indexes);
+		if (pair_chunk_expect(cf, GRAPH_CHUNKID_BLOOMINDEXES,
+				      &graph->chunk_bloom_indexes,
+				      st_mult(graph->num_commits, sizeof(uint32_t))) ==
+		    CHUNK_WRONG_SIZE)
+			warning(_("ignoring commit-graph Bloom filter index of the wrong size"));
 		read_chunk(cf, GRAPH_CHUNKID_BLOOMDATA,
 			   graph_read_bloom_data, graph);
 	}
 
+	/*
+	 * All but the fanout are looked up by a binary search or by the
+	 * position it finds, so reading ahead around them only pages in
+	 * what the lookups will not touch.
+	 */
+	for (i = 0; i < ARRAY_SIZE(random_access_chunks); i++)
+		advise_chunk(cf, random_access_chunks[i], CHUNK_ACCESS_RANDOM);
+
 	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data) {
 		init_bloom_filters();
 	} else {
@@ -756,15 +810,32 @@ static struct commit_list **insert_parent_or_die(struct repository *r,
 {
 	struct commit *c;
 	struct object_id oid;
+	uint32_t lex_index;
 
 	if (pos >= g->num_commits + g->num_commits_in_base)
 		die("invalid parent position %"PRIu32, pos);
 
+	while (pos < g->num_commits_in_base)
+		g = g->base_graph;
+	lex_index = pos - g->num_commits_in_base;
+
+	/*
+	 * Parents are named by their position in the graph, so once a
+	 * position has been resolved we can skip re-reading its object
+	 * id and hashing it into the object table. This matters for
+	 * commits that are the parent of several others.
+	 */
+	if (g->commits_at && g->commits_at[lex_index])
+		return &commit_list_insert(g->commits_at[lex_index], pptr)->next;
+
 	load_oid_from_graph(g, pos, &oid);
 	c = lookup_commit(r, &oid);
 	if (!c)
 		die(_("could not find commit %s"), oid_to_hex(&oid));
 	commit_graph_data_at(c)->graph_pos = pos;
+	if (!g->commits_at)
+		CALLOC_ARRAY(g->commits_at, g->num_commits);
+	g->commits_at[lex_index] = c;
 	return &commit_list_insert(c, pptr)->next;
 }
 
@@ -831,6 +902,8 @@ static int fill_commit_in_graph(struct repository *r,
 
 	lex_index = pos - g->num_commits_in_base;
 	commit_data = g->chunk_commit_data + (g->hash_len + 16) * lex_index;
+	if (g->commits_at)
+		g->commits_at[lex_index] = item;
 
 	item->object.parsed = 1;
 
@@ -916,6 +989,36 @@ int parse_commit_in_graph(struct repository *r, struct commit *item)
 	return parse_commit_in_graph_one(r, r->objects->commit_graph, item);
 }
 
+struct commit *lookup_commit_in_graph(struct repository *r,
+				      const struct object_id *oid)
+{
+	struct commit_graph *g;
+	struct commit *commit;
+	uint32_t lex_index;
+
+	if (!prepare_commit_graph(r))
+		return NULL;
+
+	for (g = r->objects->commit_graph; g; g = g->base_graph)
+		if (bsearch_graph(g, (struct object_id *)oid, &lex_index))
+			break;
+	if (!g)
+		return NULL;
+	/* the graph may still list commits that were pruned since */
+	if (!repo_has_object_file(r, oid))
+		return NULL;
+
+	commit = lookup_commit(r, oid);
+	if (!commit)
+		return NULL;
+	if (commit->object.parsed)
+		return commit;
+	if (!fill_commit_in_graph(r, commit, r->objects->commit_graph,
+				  lex_index + g->num_commits_in_base))
+		return NULL;
+	return commit;
+}
+
 void load_commit_graph_info(struct repository *r, struct commit *item)
 {
 	uint32_t pos;
@@ -925,6 +1028,60 @@ void load_commit_graph_info(struct repository *r, struct commit *item)
 		fill_commit_graph_info(item, r->objects->commit_graph, pos);
 }
 
+/*
+ * The reachability index labels each commit of a graph layer with the
+ * interval [low, post] of a depth-first post-order walk over the
+ * parents within that layer: "post" is the commit's own rank, and
+ * "low" the lowest rank below it in the spanning tree the walk
+ * follows. Every ancestor is finished before its descendants, so a
+ * higher "post" cannot be reached, while a "post" inside the interval
+ * lies in the commit's own subtree and always is.
+ */
+static int reach_index_can_reach(struct commit_graph *g,
+				 uint32_t pos_a, uint32_t pos_b)
+{
+	const unsigned char *labels;
+	uint32_t low_a, post_a, post_b;
+
+	while (g && pos_a < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g)
+		return -1;
+
+	/* Lower layers hold all the ancestors of a commit in a layer. */
+	if (pos_b >= g->num_commits_in_base + g->num_commits)
+		return 0;
+	if (pos_b < g->num_commits_in_base || !g->chunk_reach_index)
+		return -1;
+
+	labels = g->chunk_reach_index;
+	low_a = get_be32(labels + 8 * (pos_a - g->num_commits_in_base));
+	post_a = get_be32(labels + 8 * (pos_a - g->num_commits_in_base) + 4);
+	post_b = get_be32(labels + 8 * (pos_b - g->num_commits_in_base) + 4);
+
+	if (post_b > post_a)
+		return 0;
+	if (low_a <= post_b)
+		return 1;
+	return -1;
+}
+
+int commit_graph_can_reach(struct repository *r,
+			   struct commit *a, struct commit *b)
+{
+	uint32_t pos_a, pos_b;
+
+	if (a == b)
+		return 1;
+	if (!prepare_commit_graph(r))
+		return -1;
+	if (!find_commit_in_graph(a, r->objects->commit_graph, &pos_a) ||
+	    !find_commit_in_graph(b, r->objects->commit_graph, &pos_b))
+		return -1;
+
+	return reach_index_can_reach(r->objects->commit_graph, pos_a, pos_b);
+}
+
 static struct tree *load_tree_for_commit(struct repository *r,
 					 struct commit_graph *g,
 					 struct commit *c)
@@ -996,7 +1153,8 @@ struct write_commit_graph_context {
 		 changed_paths:1,
 		 order_by_pack:1,
 		 write_generation_data:1,
-		 trust_generation_numbers:1;
+		 trust_generation_numbers:1,
+		 reach_index:1;
 
 	struct topo_level_slab *topo_levels;
 	const struct commit_graph_opts *opts;
@@ -1007,6 +1165,9 @@ struct write_commit_graph_context {
 	int count_bloom_filter_not_computed;
 	int count_bloom_filter_trunc_empty;
 	int count_bloom_filter_trunc_large;
+
+	/* the "low" and "post" labels of each commit, in list order */
+	uint32_t *reach_labels;
 };
 
 static int write_graph_chunk_fanout(struct hashfile *f,
@@ -1257,6 +1418,21 @@ static int write_graph_chunk_extra_edges(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_reach_index(struct hashfile *f,
+					 void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	size_t i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, ctx->reach_labels[2 * i]);
+		hashwrite_be32(f, ctx->reach_labels[2 * i + 1]);
+	}
+
+	return 0;
+}
+
 static int write_graph_chunk_bloom_indexes(struct hashfile *f,
 					   void *data)
 {
@@ -1319,6 +1495,118 @@ static int write_graph_chunk_bloom_data(struct hashfile *f,
 	return 0;
 }
 
+/* How many commits to read from the object database at a time */
+#define ODB_COMMITS_PER_BATCH 1024
+
+struct odb_commit_data {
+	/* the commit to read; nothing is read for the null oid */
+	struct object_id oid;
+
+	void *buffer;
+	unsigned long size;
+	enum object_type type;
+};
+
+struct odb_commit_batch {
+	struct repository *r;
+
+	/* the commits from position "start" of the caller's list on */
+	size_t start;
+	uint32_t nr;
+	struct odb_commit_data *commits;
+
+	/* Shared by all threads and guarded by "mutex". */
+	pthread_mutex_t mutex;
+	uint32_t next;
+};
+
+static void read_odb_commit(struct odb_commit_batch *b, uint32_t i)
+{
+	struct odb_commit_data *c = &b->commits[i];
+
+	if (is_null_oid(&c->oid))
+		return;
+	c->buffer = repo_read_object_file(b->r, &c->oid, &c->type, &c->size);
+}
+
+static void *read_odb_commits_thread(void *_data)
+{
+	struct odb_commit_batch *b = _data;
+
+	trace2_thread_start("commit-graph-read");
+	for (;;) {
+		uint32_t i;
+
+		pthread_mutex_lock(&b->mutex);
+		i = b->next++;
+		pthread_mutex_unlock(&b->mutex);
+		if (i >= b->nr)
+			break;
+
+		read_odb_commit(b, i);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Read the "nr" commits the caller put in the batch from the object
+ * database. Inflating them is what parsing a large number of commits
+ * spends its time on, so it is spread over threads; the parsing that
+ * needs the object hash table stays in the caller.
+ */
+static void read_odb_commits(struct odb_commit_batch *b, int nr_threads)
+{
+	pthread_t threads[ODB_COMMITS_PER_BATCH];
+	int t;
+
+	if (nr_threads == 1) {
+		uint32_t i;
+
+		for (i = 0; i < b->nr; i++)
+			read_odb_commit(b, i);
+		return;
+	}
+
+	pthread_mutex_init(&b->mutex, NULL);
+	b->next = 0;
+	for (t = 0; t < nr_threads; t++) {
+		int err = pthread_create(&threads[t], NULL,
+					 read_odb_commits_thread, b);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (t = 0; t < nr_threads; t++) {
+		int err = pthread_join(threads[t], NULL);
+		if (err)
+			die(_("unable to join thread: %s"), strerror(err));
+	}
+	pthread_mutex_destroy(&b->mutex);
+}
+
+/*
+ * Return how many threads to read commits with, given the configured
+ * number, and get the object store ready for them.
+ */
+static int start_odb_commit_threads(int nr_threads)
+{
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > ODB_COMMITS_PER_BATCH)
+		nr_threads = ODB_COMMITS_PER_BATCH;
+	if (!HAVE_THREADS || nr_threads < 1)
+		nr_threads = 1;
+	if (nr_threads > 1)
+		enable_obj_read_lock();
+	return nr_threads;
+}
+
+static void stop_odb_commit_threads(int nr_threads)
+{
+	if (nr_threads > 1)
+		disable_obj_read_lock();
+}
+
 static int add_packed_commits(const struct object_id *oid,
 			      struct packed_git *pack,
 			      uint32_t pos,
@@ -1356,12 +1644,74 @@ static void add_missing_parents(struct write_commit_graph_context *ctx, struct c
 	}
 }
 
+/*
+ * Parse "commit", the one at position "pos" of ctx->oids, without the
+ * commit-graph. When it is the first of a new batch, the commits of
+ * the batch are read from the object database on threads first.
+ */
+static int parse_listed_commit_no_graph(struct write_commit_graph_context *ctx,
+					struct odb_commit_batch *b,
+					int nr_threads, size_t pos,
+					struct commit *commit)
+{
+	struct odb_commit_data *c;
+	int ret;
+
+	if (nr_threads == 1)
+		return repo_parse_commit_no_graph(ctx->r, commit);
+
+	if (pos == b->start + b->nr) {
+		uint32_t j;
+
+		/*
+		 * When following the history of a few branches, the
+		 * list grows only a commit or two ahead of us, too
+		 * little to be worth starting threads for.
+		 */
+		if (ctx->oids.nr - pos < ODB_COMMITS_PER_BATCH) {
+			b->start = pos + 1;
+			b->nr = 0;
+			return repo_parse_commit_no_graph(ctx->r, commit);
+		}
+
+		b->start = pos;
+		b->nr = ODB_COMMITS_PER_BATCH;
+		for (j = 0; j < b->nr; j++) {
+			struct commit *next = lookup_commit(ctx->r,
+							    &ctx->oids.oid[pos + j]);
+
+			if (next && !next->object.parsed)
+				oidcpy(&b->commits[j].oid, &next->object.oid);
+			else
+				oidclr(&b->commits[j].oid);
+		}
+		read_odb_commits(b, nr_threads);
+	}
+
+	c = &b->commits[pos - b->start];
+	if (commit->object.parsed || !c->buffer || c->type != OBJ_COMMIT) {
+		/* let the usual code path report what went wrong */
+		FREE_AND_NULL(c->buffer);
+		return repo_parse_commit_no_graph(ctx->r, commit);
+	}
+
+	ret = parse_commit_buffer(ctx->r, commit, c->buffer, c->size, 0);
+	if (save_commit_buffer && !ret)
+		set_commit_buffer(ctx->r, commit, c->buffer, c->size);
+	else
+		free(c->buffer);
+	c->buffer = NULL;
+	return ret;
+}
+
 static void close_reachable(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct commit *commit;
 	enum commit_graph_split_flags flags = ctx->opts ?
 		ctx->opts->split_flags : COMMIT_GRAPH_SPLIT_UNSPECIFIED;
+	struct odb_commit_batch batch = { 0 };
+	int nr_threads;
 
 	if (ctx->report_progress)
 		ctx->progress = start_delayed_progress(
@@ -1380,6 +1730,18 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 	 * than the number of missing commits in the reachable
 	 * closure.
 	 */
+	/*
+	 * With a split graph, most commits are parsed from the graph
+	 * we already have; do not bother with threads for the rest.
+	 */
+	if (ctx->split)
+		nr_threads = 1;
+	else if (git_config_get_int("commitgraph.threads", &nr_threads))
+		nr_threads = 0;
+	nr_threads = start_odb_commit_threads(nr_threads);
+	CALLOC_ARRAY(batch.commits, ODB_COMMITS_PER_BATCH);
+	batch.r = ctx->r;
+
 	if (ctx->report_progress)
 		ctx->progress = start_delayed_progress(
 					_("Expanding reachable commits in commit graph"),
@@ -1395,10 +1757,13 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 			     commit_graph_position(commit) == COMMIT_NOT_FROM_GRAPH) ||
 			    flags == COMMIT_GRAPH_SPLIT_REPLACE)
 				add_missing_parents(ctx, commit);
-		} else if (!repo_parse_commit_no_graph(ctx->r, commit))
+		} else if (!parse_listed_commit_no_graph(ctx, &batch, nr_threads,
+							 i, commit))
 			add_missing_parents(ctx, commit);
 	}
 	stop_progress(&ctx->progress);
+	stop_odb_commit_threads(nr_threads);
+	free(batch.commits);
 
 	if (ctx->report_progress)
 		ctx->progress = start_delayed_progress(
@@ -1467,6 +1832,94 @@ static void compute_topological_levels(struct write_commit_graph_context *ctx)
 	stop_progress(&ctx->progress);
 }
 
+struct reach_index_frame {
+	size_t pos;
+	struct commit_list *parent;
+};
+
+static int reach_index_order_cmp(const void *va, const void *vb, void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	uint32_t a = *topo_level_slab_at(ctx->topo_levels,
+					 ctx->commits.list[*(const size_t *)va]);
+	uint32_t b = *topo_level_slab_at(ctx->topo_levels,
+					 ctx->commits.list[*(const size_t *)vb]);
+
+	/* start with the tips, so that the spanning trees are large */
+	if (a > b)
+		return -1;
+	if (a < b)
+		return 1;
+	return 0;
+}
+
+/*
+ * Label the commits of the new layer for the reachability index; see
+ * reach_index_can_reach() for what the labels mean. Parents in base
+ * layers are skipped: nothing below them can lead back into this one.
+ */
+static void compute_reach_index(struct write_commit_graph_context *ctx)
+{
+	struct reach_index_frame *stack;
+	size_t *order, i, nr;
+	char *visited;
+	uint32_t rank = 0;
+
+	ALLOC_ARRAY(ctx->reach_labels, st_mult(ctx->commits.nr, 2));
+	ALLOC_ARRAY(order, ctx->commits.nr);
+	ALLOC_ARRAY(stack, ctx->commits.nr);
+	CALLOC_ARRAY(visited, ctx->commits.nr);
+
+	for (i = 0; i < ctx->commits.nr; i++)
+		order[i] = i;
+	QSORT_S(order, ctx->commits.nr, reach_index_order_cmp, ctx);
+
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+					_("Computing commit graph reachability index"),
+					ctx->commits.nr);
+	for (i = 0; i < ctx->commits.nr; i++) {
+		if (visited[order[i]])
+			continue;
+
+		visited[order[i]] = 1;
+		ctx->reach_labels[2 * order[i]] = rank;
+		stack[0].pos = order[i];
+		stack[0].parent = ctx->commits.list[order[i]]->parents;
+		nr = 1;
+
+		while (nr) {
+			struct reach_index_frame *top = &stack[nr - 1];
+			int pos;
+
+			if (!top->parent) {
+				ctx->reach_labels[2 * top->pos + 1] = rank++;
+				display_progress(ctx->progress, rank);
+				nr--;
+				continue;
+			}
+
+			pos = oid_pos(&top->parent->item->object.oid,
+				      ctx->commits.list, ctx->commits.nr,
+				      commit_to_oid);
+			top->parent = top->parent->next;
+			if (pos < 0 || visited[pos])
+				continue;
+
+			visited[pos] = 1;
+			ctx->reach_labels[2 * pos] = rank;
+			stack[nr].pos = pos;
+			stack[nr].parent = ctx->commits.list[pos]->parents;
+			nr++;
+		}
+	}
+	stop_progress(&ctx->progress);
+
+	free(visited);
+	free(stack);
+	free(order);
+}
+
 static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 {
 	int i;
@@ -1549,15 +2002,14 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	int i;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
+	struct commit **to_compute;
+	enum bloom_filter_computed *computed;
+	int nr_to_compute = 0;
 	int max_new_filters;
+	int nr_threads;
 
 	init_bloom_filters();
 
-	if (ctx->report_progress)
-		progress = start_delayed_progress(
-			_("Computing commit changed paths Bloom filters"),
-			ctx->commits.nr);
-
 	ALLOC_ARRAY(sorted_commits, ctx->commits.nr);
 	COPY_ARRAY(sorted_commits, ctx->commits.list, ctx->commits.nr);
 
@@ -1569,32 +2021,63 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	/*
+	 * Load the filters that exist already and pick, in order, the
+	 * commits to compute one for; those are then computed together.
+	 */
+	ALLOC_ARRAY(to_compute, ctx->commits.nr);
 	for (i = 0; i < ctx->commits.nr; i++) {
-		enum bloom_filter_computed computed = 0;
 		struct commit *c = sorted_commits[i];
 		struct bloom_filter *filter = get_or_compute_bloom_filter(
 			ctx->r,
 			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
+			0,
 			ctx->bloom_settings,
-			&computed);
-		if (computed & BLOOM_COMPUTED) {
+			NULL);
+
+		if (!filter && ctx->count_bloom_filter_computed < max_new_filters) {
+			to_compute[nr_to_compute++] = c;
 			ctx->count_bloom_filter_computed++;
-			if (computed & BLOOM_TRUNC_EMPTY)
-				ctx->count_bloom_filter_trunc_empty++;
-			if (computed & BLOOM_TRUNC_LARGE)
-				ctx->count_bloom_filter_trunc_large++;
-		} else if (computed & BLOOM_NOT_COMPUTED)
-			ctx->count_bloom_filter_not_computed++;
+			continue;
+		}
+
+		ctx->count_bloom_filter_not_computed++;
+		ctx->total_bloom_filter_data_size += filter
+			? sizeof(unsigned char) * filter->len : 0;
+	}
+
+	if (git_config_get_int("commitgraph.threads", &nr_threads) ||
+	    !nr_threads)
+		nr_threads = online_cpus();
+
+	if (ctx->report_progress)
+		progress = start_delayed_progress(
+			_("Computing commit changed paths Bloom filters"),
+			nr_to_compute);
+
+	CALLOC_ARRAY(computed, nr_to_compute);
+	compute_commit_bloom_filters(ctx->r, to_compute, nr_to_compute,
+				     ctx->bloom_settings, nr_threads,
+				     progress, computed);
+
+	for (i = 0; i < nr_to_compute; i++) {
+		struct bloom_filter *filter = get_bloom_filter(ctx->r,
+							       to_compute[i]);
+
+		if (computed[i] & BLOOM_TRUNC_EMPTY)
+			ctx->count_bloom_filter_trunc_empty++;
+		if (computed[i] & BLOOM_TRUNC_LARGE)
+			ctx->count_bloom_filter_trunc_large++;
 		ctx->total_bloom_filter_data_size += filter
 			? sizeof(unsigned char) * filter->len : 0;
-		display_progress(progress, i + 1);
 	}
 
 	if (trace2_is_enabled())
 		trace2_bloom_filter_write_statistics(ctx);
 
 	free(sorted_commits);
+	free(to_compute);
+	free(computed);
 	stop_progress(&progress);
 }
 
@@ -1732,12 +2215,12 @@ static void copy_oids_to_commits(struct write_commit_graph_context *ctx)
 			_("Finding extra edges in commit graph"),
 			ctx->oids.nr);
 	oid_array_sort(&ctx->oids);
+	ALLOC_GROW(ctx->commits.list, ctx->oids.nr, ctx->commits.alloc);
 	for (i = 0; i < ctx->oids.nr; i = oid_array_next_unique(&ctx->oids, i)) {
 		unsigned int num_parents;
 
 		display_progress(ctx->progress, i + 1);
 
-		ALLOC_GROW(ctx->commits.list, ctx->commits.nr + 1, ctx->commits.alloc);
 		ctx->commits.list[ctx->commits.nr] = lookup_commit(ctx->r, &ctx->oids.oid[i]);
 
 		if (ctx->split && flags != COMMIT_GRAPH_SPLIT_REPLACE &&
@@ -1756,6 +2239,12 @@ static void copy_oids_to_commits(struct write_commit_graph_context *ctx)
 		ctx->commits.nr++;
 	}
 	stop_progress(&ctx->progress);
+
+	/*
+	 * From here on the commits stand for the object names; do not
+	 * keep both around while the rest of the graph is computed.
+	 */
+	oid_array_clear(&ctx->oids);
 }
 
 static int write_graph_chunk_base_1(struct hashfile *f,
@@ -1870,6 +2359,10 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 				+ ctx->total_bloom_filter_data_size,
 			  write_graph_chunk_bloom_data);
 	}
+	if (ctx->reach_index)
+		add_chunk(cf, GRAPH_CHUNKID_REACH_INDEX,
+			  st_mult(ctx->commits.nr, 2 * sizeof(uint32_t)),
+			  write_graph_chunk_reach_index);
 	if (ctx->num_commit_graphs_after > 1)
 		add_chunk(cf, GRAPH_CHUNKID_BASE,
 			  hashsz * (ctx->num_commit_graphs_after - 1),
@@ -1966,6 +2459,37 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	return 0;
 }
 
+/*
+ * Does the layer "g" lack data that this write would add, i.e. the
+ * generation data chunk, the reachability index, or the changed-path
+ * filter of one of its commits?
+ */
+static int graph_layer_is_outdated(struct write_commit_graph_context *ctx,
+				   struct commit_graph *g)
+{
+	if (get_configured_generation_version(ctx->r) == 2 &&
+	    !g->chunk_generation_data)
+		return 1;
+	if (ctx->reach_index && !g->chunk_reach_index)
+		return 1;
+	if (ctx->changed_paths &&
+	    ctx->r->settings.commit_graph_read_changed_paths) {
+		uint32_t i, prev = 0;
+
+		if (!g->chunk_bloom_indexes)
+			return 1;
+		for (i = 0; i < g->num_commits; i++) {
+			uint32_t end = get_be32(g->chunk_bloom_indexes + 4 * i);
+
+			/* an empty filter was not computed */
+			if (end == prev)
+				return 1;
+			prev = end;
+		}
+	}
+	return 0;
+}
+
 static void split_graph_merge_strategy(struct write_commit_graph_context *ctx)
 {
 	struct commit_graph *g;
@@ -2006,6 +2530,28 @@ static void split_graph_merge_strategy(struct write_commit_graph_context *ctx)
 		}
 	}
 
+	if (flags == COMMIT_GRAPH_SPLIT_UPGRADE) {
+		struct commit_graph *outdated = NULL, *p;
+
+		/*
+		 * Layers are named after their contents and list the
+		 * layers below them, so the lowest outdated layer can
+		 * only be upgraded along with everything above it.
+		 */
+		for (p = g; p && p->odb == ctx->odb; p = p->base_graph)
+			if (graph_layer_is_outdated(ctx, p))
+				outdated = p;
+
+		while (outdated) {
+			num_commits += g->num_commits;
+			if (g == outdated)
+				outdated = NULL;
+			g = g->base_graph;
+
+			ctx->num_commit_graphs_after--;
+		}
+	}
+
 	if (flags != COMMIT_GRAPH_SPLIT_REPLACE)
 		ctx->new_base_graph = g;
 	else if (ctx->num_commit_graphs_after != 1)
@@ -2058,6 +2604,12 @@ static void merge_commit_graph(struct write_commit_graph_context *ctx,
 
 	ALLOC_GROW(ctx->commits.list, ctx->commits.nr + g->num_commits, ctx->commits.alloc);
 
+	advise_chunk_access(g->chunk_oid_lookup,
+			    st_mult(g->num_commits, g->hash_len),
+			    CHUNK_ACCESS_SEQUENTIAL);
+	advise_chunk_access(g->chunk_commit_data,
+			    st_mult(g->num_commits, GRAPH_DATA_WIDTH),
+			    CHUNK_ACCESS_SEQUENTIAL);
 	for (i = 0; i < g->num_commits; i++) {
 		struct object_id oid;
 		struct commit *result;
@@ -2236,6 +2788,7 @@ int write_commit_graph(struct object_directory *odb,
 	uint32_t i;
 	int res = 0;
 	int replace = 0;
+	int upgrade = 0;
 	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
 	struct topo_level_slab topo_levels;
 
@@ -2293,6 +2846,16 @@ int write_commit_graph(struct object_directory *odb,
 		}
 	}
 
+	if (flags & COMMIT_GRAPH_WRITE_REACH_INDEX)
+		ctx->reach_index = 1;
+	if (!(flags & COMMIT_GRAPH_NO_WRITE_REACH_INDEX)) {
+		struct commit_graph *g = ctx->r->objects->commit_graph;
+
+		/* Keep an existing reachability index in the next graph */
+		if (g && g->chunk_reach_index)
+			ctx->reach_index = 1;
+	}
+
 	if (ctx->split) {
 		struct commit_graph *g = ctx->r->objects->commit_graph;
 
@@ -2312,14 +2875,20 @@ int write_commit_graph(struct object_directory *odb,
 			}
 		}
 
-		if (ctx->opts)
-			replace = ctx->opts->split_flags & COMMIT_GRAPH_SPLIT_REPLACE;
+		if (ctx->opts) {
+			replace = ctx->opts->split_flags == COMMIT_GRAPH_SPLIT_REPLACE;
+			upgrade = ctx->opts->split_flags == COMMIT_GRAPH_SPLIT_UPGRADE;
+		}
 	}
 
 	ctx->approx_nr_objects = approximate_object_count();
 
 	if (ctx->append && ctx->r->objects->commit_graph) {
 		struct commit_graph *g = ctx->r->objects->commit_graph;
+
+		advise_chunk_access(g->chunk_oid_lookup,
+				    st_mult(g->num_commits, g->hash_len),
+				    CHUNK_ACCESS_SEQUENTIAL);
 		for (i = 0; i < g->num_commits; i++) {
 			struct object_id oid;
 			oidread(&oid, g->chunk_oid_lookup + g->hash_len * i);
@@ -2353,7 +2922,7 @@ int write_commit_graph(struct object_directory *odb,
 		goto cleanup;
 	}
 
-	if (!ctx->commits.nr && !replace)
+	if (!ctx->commits.nr && !replace && !upgrade)
 		goto cleanup;
 
 	if (ctx->split) {
@@ -2361,6 +2930,10 @@ int write_commit_graph(struct object_directory *odb,
 
 		if (!replace)
 			merge_commit_graphs(ctx);
+
+		/* no new commits, and no layer to upgrade */
+		if (!ctx->commits.nr && upgrade)
+			goto cleanup;
 	} else
 		ctx->num_commit_graphs_after = 1;
 
@@ -2372,6 +2945,8 @@ int write_commit_graph(struct object_directory *odb,
 
 	if (ctx->changed_paths)
 		compute_bloom_filters(ctx);
+	if (ctx->reach_index)
+		compute_reach_index(ctx);
 
 	res = write_commit_graph_file(ctx);
 
@@ -2383,6 +2958,7 @@ int write_commit_graph(struct object_directory *odb,
 cleanup:
 	free(ctx->graph_name);
 	free(ctx->commits.list);
+	free(ctx->reach_labels);
 	oid_array_clear(&ctx->oids);
 	clear_topo_level_slab(&topo_levels);
 
@@ -2426,12 +3002,11 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 {
 	uint32_t i, cur_fanout_pos = 0;
 	struct object_id prev_oid, cur_oid;
-	unsigned char checksum[GIT_MAX_HEXSZ];
 	int generation_zero = 0;
-	struct hashfile *f;
-	int devnull;
 	struct progress *progress = NULL;
 	int local_error = 0;
+	struct odb_commit_batch batch = { 0 };
+	int nr_threads;
 
 	if (!g) {
 		graph_report("no commit-graph file loaded");
@@ -2442,11 +3017,9 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	if (verify_commit_graph_error)
 		return verify_commit_graph_error;
 
-	devnull = open("/dev/null", O_WRONLY);
-	f = hashfd(devnull, NULL);
-	hashwrite(f, g->data, g->data_len - g->hash_len);
-	finalize_hashfile(f, checksum, CSUM_CLOSE);
-	if (!hasheq(checksum, g->data + g->data_len - g->hash_len)) {
+	/* the checksum and the loop below go through all of the file */
+	advise_chunk_access(g->data, g->data_len, CHUNK_ACCESS_SEQUENTIAL);
+	if (!hashfile_checksum_valid(g->filename, g->data, g->data_len)) {
 		graph_report(_("the commit-graph file has incorrect checksum and is likely corrupt"));
 		verify_commit_graph_error = VERIFY_COMMIT_GRAPH_ERROR_HASH;
 	}
@@ -2495,18 +3068,44 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 		progress = start_progress(_("Verifying commits in commit graph"),
 					g->num_commits);
 
+	CALLOC_ARRAY(batch.commits, ODB_COMMITS_PER_BATCH);
+	batch.r = r;
+	if (git_config_get_int("pack.threads", &nr_threads))
+		nr_threads = 0;
+	nr_threads = start_odb_commit_threads(nr_threads);
+
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit, *odb_commit;
 		struct commit_list *graph_parents, *odb_parents;
+		struct odb_commit_data *odb_data;
 		timestamp_t max_generation = 0;
 		timestamp_t generation;
+		int parse_error;
+
+		if (i == batch.start + batch.nr) {
+			uint32_t j;
+
+			batch.start = i;
+			batch.nr = g->num_commits - i;
+			if (batch.nr > ODB_COMMITS_PER_BATCH)
+				batch.nr = ODB_COMMITS_PER_BATCH;
+			for (j = 0; j < batch.nr; j++)
+				oidread(&batch.commits[j].oid,
+					g->chunk_oid_lookup + g->hash_len * (i + j));
+			read_odb_commits(&batch, nr_threads);
+		}
+		odb_data = &batch.commits[i - batch.start];
 
 		display_progress(progress, i + 1);
 		oidread(&cur_oid, g->chunk_oid_lookup + g->hash_len * i);
 
 		graph_commit = lookup_commit(r, &cur_oid);
 		odb_commit = (struct commit *)create_object(r, &cur_oid, alloc_commit_node(r));
-		if (parse_commit_internal(odb_commit, 0, 0)) {
+		parse_error = !odb_data->buffer || odb_data->type != OBJ_COMMIT ||
+			parse_commit_buffer(r, odb_commit, odb_data->buffer,
+					    odb_data->size, 0);
+		FREE_AND_NULL(odb_data->buffer);
+		if (parse_error) {
 			graph_report(_("failed to parse commit %s from object database for commit-graph"),
 				     oid_to_hex(&cur_oid));
 			continue;
@@ -2538,6 +3137,13 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 					     oid_to_hex(&graph_parents->item->object.oid),
 					     oid_to_hex(&odb_parents->item->object.oid));
 
+			if (g->chunk_reach_index &&
+			    !reach_index_can_reach(g, commit_graph_position(graph_commit),
+						   commit_graph_position(graph_parents->item)))
+				graph_report(_("commit-graph reachability index for %s excludes its parent %s"),
+					     oid_to_hex(&cur_oid),
+					     oid_to_hex(&graph_parents->item->object.oid));
+
 			generation = commit_graph_generation(graph_parents->item);
 			if (generation > max_generation)
 				max_generation = generation;
@@ -2585,6 +3191,8 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 				     odb_commit->date);
 	}
 	stop_progress(&progress);
+	stop_odb_commit_threads(nr_threads);
+	free(batch.commits);
 
 	local_error = verify_commit_graph_error;
 
@@ -2604,6 +3212,7 @@ void free_commit_graph(struct commit_graph *g)
 	}
 	free(g->filename);
 	free(g->bloom_filter_settings);
+	free(g->commits_at);
 	free(g);
 }
 
@@ -40,6 +40,14 @@ int open_commit_graph(const char *graph_file, int *fd, struct stat *st);
  */
 int parse_commit_in_graph(struct repository *r, struct commit *item);
 
+/*
+ * Look up the commit with the given object name in the commit-graph,
+ * and return it parsed from there. Returns NULL if the commit-graph
+ * does not have it, or if the object is missing from the repository.
+ */
+struct commit *lookup_commit_in_graph(struct repository *r,
+				      const struct object_id *oid);
+
 /*
  * It is possible that we loaded commit contents from the commit buffer,
  * but we also want to ensure the commit-graph content is correctly
@@ -75,9 +83,16 @@ struct commit_graph {
 	const unsigned char *chunk_base_graphs;
 	const unsigned char *chunk_bloom_indexes;
 	const unsigned char *chunk_bloom_data;
+	const unsigned char *chunk_reach_index;
 
 	struct topo_level_slab *topo_levels;
 	struct bloom_filter_settings *bloom_filter_settings;
+
+	/*
+	 * Commits already looked up by their position in this layer,
+	 * indexed by lexicographic position. Allocated on first use.
+	 */
+	struct commit **commits_at;
 };
 
 struct commit_graph *load_commit_graph_one_fd_st(struct repository *r,
@@ -102,18 +117,30 @@ int corrected_commit_dates_enabled(struct repository *r);
 
 struct bloom_filter_settings *get_bloom_filter_settings(struct repository *r);
 
+/*
+ * Use the reachability index of the commit-graph to tell whether "a"
+ * can reach "b" (that is, whether "b" is an ancestor of or equal to
+ * "a") without walking. Returns 1 if it can, 0 if it cannot, and -1
+ * if the index cannot tell; callers must then walk.
+ */
+int commit_graph_can_reach(struct repository *r,
+			   struct commit *a, struct commit *b);
+
 enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_APPEND     = (1 << 0),
 	COMMIT_GRAPH_WRITE_PROGRESS   = (1 << 1),
 	COMMIT_GRAPH_WRITE_SPLIT      = (1 << 2),
 	COMMIT_GRAPH_WRITE_BLOOM_FILTERS = (1 << 3),
 	COMMIT_GRAPH_NO_WRITE_BLOOM_FILTERS = (1 << 4),
+	COMMIT_GRAPH_WRITE_REACH_INDEX = (1 << 5),
+	COMMIT_GRAPH_NO_WRITE_REACH_INDEX = (1 << 6),
 };
 
 enum commit_graph_split_flags {
 	COMMIT_GRAPH_SPLIT_UNSPECIFIED      = 0,
 	COMMIT_GRAPH_SPLIT_MERGE_PROHIBITED = 1,
-	COMMIT_GRAPH_SPLIT_REPLACE          = 2
+	COMMIT_GRAPH_SPLIT_REPLACE          = 2,
+	COMMIT_GRAPH_SPLIT_UPGRADE          = 3
 };
 
 struct commit_graph_opts {
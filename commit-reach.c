@@ -8,6 +8,7 @@
 #include "revision.h"
 #include "tag.h"
 #include "commit-reach.h"
+#include "ewah/ewok.h"
 
 /* Remember to update object flag allocation in object.h */
 #define PARENT1		(1u<<16)
@@ -438,6 +439,183 @@ struct commit_list *repo_get_merge_bases(struct repository *r,
 	return get_merge_bases_many_0(r, one, 1, &two, 1);
 }
 
+/*
+ * repo_get_merge_bases_batch() walks for up to this many pairs at
+ * once, giving each pair one bit in the masks below.
+ */
+#define MERGE_BASE_BATCH_MAX 64
+
+/*
+ * Per-commit state of the shared walk: bit i of each mask means what
+ * the PARENT1, PARENT2, STALE and RESULT object flags mean to
+ * paint_down_to_common() when it works on pair i alone.
+ */
+struct merge_base_batch_bits {
+	uint64_t parent1;
+	uint64_t parent2;
+	uint64_t stale;
+	uint64_t result;
+};
+
+define_commit_slab(merge_base_batch_slab, struct merge_base_batch_bits);
+
+static int batch_queue_has_nonstale(struct prio_queue *queue,
+				    struct merge_base_batch_slab *slab)
+{
+	int i;
+	for (i = 0; i < queue->nr; i++) {
+		struct commit *commit = queue->array[i].data;
+		struct merge_base_batch_bits *bits;
+
+		bits = merge_base_batch_slab_at(slab, commit);
+		if ((bits->parent1 | bits->parent2) & ~bits->stale)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Compute the merge bases of up to MERGE_BASE_BATCH_MAX pairs with a
+ * single walk. Returns -1 if a commit could not be parsed; result[] is
+ * then left empty for the caller to fill in another way.
+ */
+static int merge_bases_batch_1(struct repository *r,
+			       struct commit **one, struct commit **two,
+			       size_t nr, struct commit_list **result)
+{
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct merge_base_batch_slab slab;
+	struct merge_base_batch_bits *bits;
+	uint64_t wanted = 0;
+	size_t i;
+	int ret = 0;
+
+	if (!corrected_commit_dates_enabled(r))
+		queue.compare = compare_commits_by_commit_date;
+
+	init_merge_base_batch_slab(&slab);
+
+	for (i = 0; i < nr; i++) {
+		uint64_t bit = (uint64_t)1 << i;
+
+		if (one[i] == two[i]) {
+			commit_list_insert(one[i], &result[i]);
+			continue;
+		}
+		if (repo_parse_commit(r, one[i]) ||
+		    repo_parse_commit(r, two[i])) {
+			ret = -1;
+			goto cleanup;
+		}
+		wanted |= bit;
+		merge_base_batch_slab_at(&slab, one[i])->parent1 |= bit;
+		merge_base_batch_slab_at(&slab, two[i])->parent2 |= bit;
+		prio_queue_put(&queue, one[i]);
+		prio_queue_put(&queue, two[i]);
+	}
+
+	while (batch_queue_has_nonstale(&queue, &slab)) {
+		struct commit *commit = prio_queue_get(&queue);
+		struct commit_list *parents;
+		struct merge_base_batch_bits paint;
+		uint64_t found;
+
+		bits = merge_base_batch_slab_at(&slab, commit);
+		found = bits->parent1 & bits->parent2 & ~bits->stale;
+		if (found & ~bits->result) {
+			for (i = 0; i < nr; i++)
+				if ((found & ~bits->result) & ((uint64_t)1 << i))
+					commit_list_insert_by_date(commit, &result[i]);
+			bits->result |= found;
+		}
+		paint = *bits;
+		paint.stale |= found;
+
+		for (parents = commit->parents; parents; parents = parents->next) {
+			struct commit *p = parents->item;
+			struct merge_base_batch_bits *pbits;
+
+			pbits = merge_base_batch_slab_at(&slab, p);
+			if (!(paint.parent1 & ~pbits->parent1) &&
+			    !(paint.parent2 & ~pbits->parent2) &&
+			    !(paint.stale & ~pbits->stale))
+				continue;
+			if (repo_parse_commit(r, p)) {
+				ret = -1;
+				goto cleanup;
+			}
+			pbits->parent1 |= paint.parent1;
+			pbits->parent2 |= paint.parent2;
+			pbits->stale |= paint.stale;
+			prio_queue_put(&queue, p);
+		}
+	}
+
+	for (i = 0; i < nr; i++) {
+		uint64_t bit = (uint64_t)1 << i;
+		struct commit_list *list = result[i];
+		struct commit **rslt;
+		int cnt, j;
+
+		if (!(wanted & bit))
+			continue;
+
+		result[i] = NULL;
+		while (list) {
+			struct commit *commit = pop_commit(&list);
+			if (!(merge_base_batch_slab_at(&slab, commit)->stale & bit))
+				commit_list_insert_by_date(commit, &result[i]);
+		}
+		if (!result[i] || !result[i]->next)
+			continue;
+
+		/* There are more than one */
+		cnt = commit_list_count(result[i]);
+		CALLOC_ARRAY(rslt, cnt);
+		for (list = result[i], j = 0; list; list = list->next)
+			rslt[j++] = list->item;
+		free_commit_list(result[i]);
+
+		cnt = remove_redundant(r, rslt, cnt);
+		result[i] = NULL;
+		for (j = 0; j < cnt; j++)
+			commit_list_insert_by_date(rslt[j], &result[i]);
+		free(rslt);
+	}
+
+cleanup:
+	if (ret < 0) {
+		for (i = 0; i < nr; i++) {
+			free_commit_list(result[i]);
+			result[i] = NULL;
+		}
+	}
+	clear_prio_queue(&queue);
+	clear_merge_base_batch_slab(&slab);
+	return ret;
+}
+
+void repo_get_merge_bases_batch(struct repository *r,
+				struct commit **one, struct commit **two,
+				size_t nr, struct commit_list **result)
+{
+	size_t i, j;
+
+	for (i = 0; i < nr; i++)
+		result[i] = NULL;
+
+	for (i = 0; i < nr; i += MERGE_BASE_BATCH_MAX) {
+		size_t n = nr - i;
+
+		if (n > MERGE_BASE_BATCH_MAX)
+			n = MERGE_BASE_BATCH_MAX;
+		if (!merge_bases_batch_1(r, one + i, two + i, n, result + i))
+			continue;
+		for (j = i; j < i + n; j++)
+			result[j] = repo_get_merge_bases(r, one[j], two[j]);
+	}
+}
+
 /*
  * Is "commit" a descendant of one of the elements on the "with_commit" list?
  */
@@ -445,9 +623,22 @@ int repo_is_descendant_of(struct repository *r,
 			  struct commit *commit,
 			  struct commit_list *with_commit)
 {
+	struct commit_list *p;
+	int unknown = 0;
+
 	if (!with_commit)
 		return 1;
 
+	for (p = with_commit; p; p = p->next) {
+		int ret = commit_graph_can_reach(r, commit, p->item);
+		if (ret > 0)
+			return 1;
+		if (ret < 0)
+			unknown = 1;
+	}
+	if (!unknown)
+		return 0;
+
 	if (generation_numbers_enabled(the_repository)) {
 		struct commit_list *from_list = NULL;
 		int result;
@@ -475,9 +666,19 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 			     int nr_reference, struct commit **reference)
 {
 	struct commit_list *bases;
-	int ret = 0, i;
+	int ret = 0, i, unknown = 0;
 	timestamp_t generation, max_generation = GENERATION_NUMBER_ZERO;
 
+	for (i = 0; i < nr_reference; i++) {
+		int reach = commit_graph_can_reach(r, reference[i], commit);
+		if (reach > 0)
+			return 1;
+		if (reach < 0)
+			unknown = 1;
+	}
+	if (!unknown)
+		return 0;
+
 	if (repo_parse_commit(r, commit))
 		return ret;
 	for (i = 0; i < nr_reference; i++) {
@@ -628,6 +829,7 @@ static enum contains_result contains_test(struct commit *candidate,
 					  timestamp_t cutoff)
 {
 	enum contains_result *cached = contains_cache_at(cache, candidate);
+	int unknown = 0;
 
 	/* If we already have the answer cached, return that. */
 	if (*cached)
@@ -639,6 +841,22 @@ static enum contains_result contains_test(struct commit *candidate,
 		return CONTAINS_YES;
 	}
 
+	/* or can the reachability index tell? */
+	for (; want; want = want->next) {
+		int ret = commit_graph_can_reach(the_repository, candidate,
+						 want->item);
+		if (ret > 0) {
+			*cached = CONTAINS_YES;
+			return CONTAINS_YES;
+		}
+		if (ret < 0)
+			unknown = 1;
+	}
+	if (!unknown) {
+		*cached = CONTAINS_NO;
+		return CONTAINS_NO;
+	}
+
 	/* Otherwise, we don't know; prepare to recurse */
 	parse_commit_or_die(candidate);
 
@@ -942,3 +1160,194 @@ struct commit_list *get_reachable_subset(struct commit **from, int nr_from,
 
 	return found_commits;
 }
+
+define_commit_slab(walk_generation_slab, timestamp_t);
+
+static timestamp_t walk_generation(struct walk_generation_slab *gens,
+				   const struct commit *c)
+{
+	timestamp_t *gen = walk_generation_slab_peek(gens, c);
+
+	if (gen && *gen)
+		return *gen;
+	return commit_graph_generation(c);
+}
+
+static int compare_commits_by_walk_generation(const void *a_, const void *b_,
+					      void *data)
+{
+	const struct commit *a = a_, *b = b_;
+	timestamp_t generation_a = walk_generation(data, a);
+	timestamp_t generation_b = walk_generation(data, b);
+
+	/* newer commits first, as in compare_commits_by_gen_then_commit_date() */
+	if (generation_a < generation_b)
+		return 1;
+	if (generation_a > generation_b)
+		return -1;
+	if (a->date < b->date)
+		return 1;
+	if (a->date > b->date)
+		return -1;
+	return 0;
+}
+
+/*
+ * Give every commit reachable from 'commits' that the commit-graph
+ * does not cover a generation number that is consistent with the
+ * ones the commit-graph does have, so that the walk below never sees
+ * a commit before all of its descendants.
+ */
+static void compute_walk_generations(struct repository *r,
+				     struct walk_generation_slab *gens,
+				     struct commit **commits, size_t nr)
+{
+	int corrected = corrected_commit_dates_enabled(r);
+	struct commit_list *stack = NULL;
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		commit_list_insert(commits[i], &stack);
+		while (stack) {
+			struct commit *c = stack->item;
+			struct commit_list *p;
+			timestamp_t gen, max_gen = 0;
+			int all_parents_computed = 1;
+
+			if (*walk_generation_slab_at(gens, c)) {
+				pop_commit(&stack);
+				continue;
+			}
+
+			repo_parse_commit(r, c);
+			gen = commit_graph_generation(c);
+			if (gen != GENERATION_NUMBER_INFINITY &&
+			    gen != GENERATION_NUMBER_ZERO) {
+				*walk_generation_slab_at(gens, c) = gen;
+				pop_commit(&stack);
+				continue;
+			}
+
+			for (p = c->parents; p; p = p->next) {
+				gen = *walk_generation_slab_at(gens, p->item);
+				if (!gen) {
+					all_parents_computed = 0;
+					commit_list_insert(p->item, &stack);
+					break;
+				}
+				if (gen > max_gen)
+					max_gen = gen;
+			}
+			if (!all_parents_computed)
+				continue;
+
+			pop_commit(&stack);
+			if (corrected && c->date > max_gen)
+				max_gen = c->date - 1;
+			*walk_generation_slab_at(gens, c) = max_gen + 1;
+		}
+	}
+}
+
+define_commit_slab(bit_arrays, struct bitmap *);
+
+static struct bitmap *get_bit_array(struct bit_arrays *arrays,
+				    struct commit *c, size_t width)
+{
+	struct bitmap **bitmap = bit_arrays_at(arrays, c);
+	if (!*bitmap)
+		*bitmap = bitmap_word_alloc(width);
+	return *bitmap;
+}
+
+static void free_bit_array(struct bit_arrays *arrays, struct commit *c)
+{
+	struct bitmap **bitmap = bit_arrays_peek(arrays, c);
+	if (!bitmap || !*bitmap)
+		return;
+	bitmap_free(*bitmap);
+	*bitmap = NULL;
+}
+
+static void insert_no_dup(struct prio_queue *queue, struct commit *c)
+{
+	if (c->object.flags & PARENT2)
+		return;
+	prio_queue_put(queue, c);
+	c->object.flags |= PARENT2;
+}
+
+void ahead_behind(struct repository *r,
+		  struct commit **commits, size_t commits_nr,
+		  struct ahead_behind_count *counts, size_t counts_nr)
+{
+	struct walk_generation_slab gens;
+	struct bit_arrays arrays;
+	struct prio_queue queue = { compare_commits_by_walk_generation };
+	size_t width = DIV_ROUND_UP(commits_nr, BITS_IN_EWORD);
+	size_t i;
+
+	for (i = 0; i < counts_nr; i++) {
+		counts[i].ahead = 0;
+		counts[i].behind = 0;
+	}
+	if (!commits_nr || !counts_nr)
+		return;
+
+	init_walk_generation_slab(&gens);
+	init_bit_arrays(&arrays);
+	queue.cb_data = &gens;
+
+	compute_walk_generations(r, &gens, commits, commits_nr);
+
+	for (i = 0; i < commits_nr; i++) {
+		bitmap_set(get_bit_array(&arrays, commits[i], width), i);
+		insert_no_dup(&queue, commits[i]);
+	}
+
+	while (queue_has_nonstale(&queue)) {
+		struct commit *c = prio_queue_get(&queue);
+		struct bitmap *bitmap_c = get_bit_array(&arrays, c, width);
+		struct commit_list *p;
+
+		for (i = 0; i < counts_nr; i++) {
+			int from_tip = bitmap_get(bitmap_c, counts[i].tip_index);
+			int from_base = bitmap_get(bitmap_c, counts[i].base_index);
+
+			if (from_tip && !from_base)
+				counts[i].ahead++;
+			else if (from_base && !from_tip)
+				counts[i].behind++;
+		}
+
+		for (p = c->parents; p; p = p->next) {
+			struct bitmap *bitmap_p;
+
+			repo_parse_commit(r, p->item);
+			bitmap_p = get_bit_array(&arrays, p->item, width);
+			bitmap_or(bitmap_p, bitmap_c);
+
+			/*
+			 * A parent that every starting commit reaches adds
+			 * nothing to any count, and neither do its
+			 * ancestors: mark it STALE, so that the walk can
+			 * stop once the queue holds nothing else.
+			 */
+			if (bitmap_popcount(bitmap_p) == commits_nr)
+				p->item->object.flags |= STALE;
+
+			insert_no_dup(&queue, p->item);
+		}
+
+		free_bit_array(&arrays, c);
+	}
+
+	/* the stale commits left in the queue still hold their bitmaps */
+	for (i = 0; i < queue.nr; i++)
+		free_bit_array(&arrays, queue.array[i].data);
+
+	clear_commit_marks_many(commits_nr, commits, PARENT2 | STALE);
+	clear_prio_queue(&queue);
+	clear_bit_arrays(&arrays);
+	clear_walk_generation_slab(&gens);
+}
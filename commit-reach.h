@@ -19,6 +19,14 @@ struct commit_list *repo_get_merge_bases_many(struct repository *r,
 struct commit_list *repo_get_merge_bases_many_dirty(struct repository *r,
 						    struct commit *one, int n,
 						    struct commit **twos);
+/*
+ * Compute the merge bases of each pair (one[i], two[i]) into result[i],
+ * as repo_get_merge_bases() would, but walking the history shared by
+ * the pairs only once for many of them. Object flags are left alone.
+ */
+void repo_get_merge_bases_batch(struct repository *r,
+				struct commit **one, struct commit **two,
+				size_t nr, struct commit_list **result);
 #ifndef NO_THE_REPOSITORY_COMPATIBILITY_MACROS
 #define get_merge_bases(r1, r2)           repo_get_merge_bases(the_repository, r1, r2)
 #define get_merge_bases_many(one, n, two) repo_get_merge_bases_many(the_repository, one, n, two)
@@ -104,4 +112,40 @@ struct commit_list *get_reachable_subset(struct commit **from, int nr_from,
 					 struct commit **to, int nr_to,
 					 unsigned int reachable_flag);
 
+struct ahead_behind_count {
+	/*
+	 * As input, the *_index members indicate which positions in
+	 * the 'commits' array correspond to the tip and base of this
+	 * comparison.
+	 */
+	size_t tip_index;
+	size_t base_index;
+
+	/*
+	 * These values store the computed counts for each side of the
+	 * symmetric difference:
+	 *
+	 * 'ahead' stores the number of commits reachable from the tip
+	 * and not reachable from the base.
+	 *
+	 * 'behind' stores the number of commits reachable from the base
+	 * and not reachable from the tip.
+	 */
+	unsigned int ahead;
+	unsigned int behind;
+};
+
+/*
+ * Given an array of commits and an array of ahead_behind_count pairs,
+ * compute the ahead/behind counts for each pair, walking the history
+ * the pairs share only once. Uses the PARENT2 and STALE flags, which
+ * must not be set on entry and are cleared on return.
+ *
+ * Without a commit-graph the walk has to compute generation numbers
+ * for, and so visit, the entire history behind 'commits'.
+ */
+void ahead_behind(struct repository *r,
+		  struct commit **commits, size_t commits_nr,
+		  struct ahead_behind_count *counts, size_t counts_nr);
+
 #endif
@@ -14,7 +14,6 @@
 #include "mergesort.h"
 #include "commit-slab.h"
 #include "prio-queue.h"
-#include "hash-lookup.h"
 #include "wt-status.h"
 #include "advice.h"
 #include "refs.h"
@@ -105,47 +104,87 @@ static timestamp_t parse_commit_date(const char *buf, const char *tail)
 	return parse_timestamp(dateptr, NULL, 10);
 }
 
-static const struct object_id *commit_graft_oid_access(size_t index, const void *table)
-{
-	const struct commit_graft * const *commit_graft_table = table;
-	return &commit_graft_table[index]->oid;
-}
-
 int commit_graft_pos(struct repository *r, const struct object_id *oid)
 {
-	return oid_pos(oid, r->parsed_objects->grafts,
-		       r->parsed_objects->grafts_nr,
-		       commit_graft_oid_access);
+	uint32_t *pos = oidtable_get(&r->parsed_objects->graft_table, oid);
+
+	return pos ? *pos : -1;
 }
 
 int register_commit_graft(struct repository *r, struct commit_graft *graft,
 			  int ignore_dups)
 {
+	struct parsed_object_pool *o = r->parsed_objects;
 	int pos = commit_graft_pos(r, &graft->oid);
 
 	if (0 <= pos) {
 		if (ignore_dups)
 			free(graft);
 		else {
-			free(r->parsed_objects->grafts[pos]);
-			r->parsed_objects->grafts[pos] = graft;
+			free(o->grafts[pos]);
+			o->grafts[pos] = graft;
 		}
 		return 1;
 	}
-	pos = -pos - 1;
-	ALLOC_GROW(r->parsed_objects->grafts,
-		   r->parsed_objects->grafts_nr + 1,
-		   r->parsed_objects->grafts_alloc);
-	r->parsed_objects->grafts_nr++;
-	if (pos < r->parsed_objects->grafts_nr)
-		memmove(r->parsed_objects->grafts + pos + 1,
-			r->parsed_objects->grafts + pos,
-			(r->parsed_objects->grafts_nr - pos - 1) *
-			sizeof(*r->parsed_objects->grafts));
-	r->parsed_objects->grafts[pos] = graft;
+
+	/*
+	 * Append instead of inserting in order, which would make
+	 * reading a long shallow file quadratic.
+	 */
+	ALLOC_GROW(o->grafts, o->grafts_nr + 1, o->grafts_alloc);
+	if (o->grafts_nr &&
+	    oidcmp(&o->grafts[o->grafts_nr - 1]->oid, &graft->oid) > 0)
+		o->grafts_unsorted = 1;
+	o->grafts[o->grafts_nr] = graft;
+	*(uint32_t *)oidtable_put(&o->graft_table, &graft->oid, NULL) =
+		o->grafts_nr;
+	o->grafts_nr++;
 	return 0;
 }
 
+int unregister_commit_graft(struct repository *r, const struct object_id *oid)
+{
+	struct parsed_object_pool *o = r->parsed_objects;
+	int pos = commit_graft_pos(r, oid);
+
+	if (pos < 0)
+		return -1;
+	oidtable_remove(&o->graft_table, oid, NULL);
+	o->grafts_nr--;
+	if (pos < o->grafts_nr) {
+		/* fill the hole with the last graft */
+		o->grafts[pos] = o->grafts[o->grafts_nr];
+		*(uint32_t *)oidtable_get(&o->graft_table,
+					  &o->grafts[pos]->oid) = pos;
+		o->grafts_unsorted = 1;
+	}
+	return 0;
+}
+
+static int commit_graft_cmp(const void *a_, const void *b_)
+{
+	const struct commit_graft * const *a = a_, * const *b = b_;
+
+	return oidcmp(&(*a)->oid, &(*b)->oid);
+}
+
+static void sort_commit_grafts(struct parsed_object_pool *o)
+{
+	int i;
+
+	if (!o->grafts_unsorted)
+		return;
+	QSORT(o->grafts, o->grafts_nr, commit_graft_cmp);
+
+	/* the slots hold indices, which the sort has all invalidated */
+	oidtable_clear(&o->graft_table);
+	oidtable_reserve(&o->graft_table, o->grafts_nr);
+	for (i = 0; i < o->grafts_nr; i++)
+		*(uint32_t *)oidtable_put(&o->graft_table,
+					  &o->grafts[i]->oid, NULL) = i;
+	o->grafts_unsorted = 0;
+}
+
 struct commit_graft *read_graft_line(struct strbuf *line)
 {
 	/* The format is just "Commit Parent1 Parent2 ...\n" */
@@ -241,6 +280,8 @@ struct commit_graft *lookup_commit_graft(struct repository *r, const struct obje
 int for_each_commit_graft(each_commit_graft_fn fn, void *cb_data)
 {
 	int i, ret;
+
+	sort_commit_grafts(the_repository->parsed_objects);
 	for (i = ret = 0; i < the_repository->parsed_objects->grafts_nr && !ret; i++)
 		ret = fn(the_repository->parsed_objects->grafts[i], cb_data);
 	return ret;
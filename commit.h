@@ -243,9 +243,14 @@ struct commit_graft {
 typedef int (*each_commit_graft_fn)(const struct commit_graft *, void *);
 
 struct commit_graft *read_graft_line(struct strbuf *line);
-/* commit_graft_pos returns an index into r->parsed_objects->grafts. */
+/*
+ * commit_graft_pos returns an index into r->parsed_objects->grafts, or
+ * -1 if there is no graft for `oid`.
+ */
 int commit_graft_pos(struct repository *r, const struct object_id *oid);
 int register_commit_graft(struct repository *r, struct commit_graft *, int);
+/* Returns -1 if there is no graft for `oid`. */
+int unregister_commit_graft(struct repository *r, const struct object_id *oid);
 void prepare_commit_graft(struct repository *r);
 struct commit_graft *lookup_commit_graft(struct repository *r, const struct object_id *oid);
 
@@ -0,0 +1,50 @@
+#include "cache.h"
+#include "compat/bulk-lstat.h"
+
+#ifndef NO_FSTATAT
+
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+
+int bulk_lstat(struct bulk_lstat *bs, const char *path, struct stat *st)
+{
+	const char *slash = strrchr(path, '/');
+	size_t len = slash ? slash - path + 1 : 0;
+
+	if (!len)
+		return lstat(path, st);
+
+	if (bs->dir.len != len || memcmp(bs->dir.buf, path, len)) {
+		if (bs->fd >= 0)
+			close(bs->fd);
+		strbuf_reset(&bs->dir);
+		strbuf_add(&bs->dir, path, len);
+		bs->fd = open(bs->dir.buf, O_RDONLY | O_DIRECTORY);
+	}
+
+	/*
+	 * If we could not open the directory, let lstat() find out
+	 * why, so that the caller sees the same errno.
+	 */
+	if (bs->fd < 0)
+		return lstat(path, st);
+	return fstatat(bs->fd, path + len, st, AT_SYMLINK_NOFOLLOW);
+}
+
+#else
+
+int bulk_lstat(struct bulk_lstat *bs, const char *path, struct stat *st)
+{
+	return lstat(path, st);
+}
+
+#endif
+
+void bulk_lstat_release(struct bulk_lstat *bs)
+{
+	if (bs->fd >= 0)
+		close(bs->fd);
+	bs->fd = -1;
+	strbuf_release(&bs->dir);
+}
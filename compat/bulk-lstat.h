@@ -0,0 +1,26 @@
+#ifndef COMPAT_BULK_LSTAT_H
+#define COMPAT_BULK_LSTAT_H
+
+/*
+ * lstat() many paths, most of which share their directory with the
+ * previous one (like the entries of the index, in order).
+ *
+ * Every lstat() of "a/b/c/file" looks up "a", "a/b" and "a/b/c" again
+ * before it gets to "file".  Where the platform has fstatat(), we open
+ * each directory only once and look its entries up relative to it
+ * instead.  Elsewhere, this is just lstat().
+ */
+struct bulk_lstat {
+	struct strbuf dir; /* including the trailing slash */
+	int fd;
+};
+
+#define BULK_LSTAT_INIT { STRBUF_INIT, -1 }
+
+/* Like lstat(path, st). */
+int bulk_lstat(struct bulk_lstat *bs, const char *path, struct stat *st);
+
+/* Close the directory and release the memory held by `bs`. */
+void bulk_lstat_release(struct bulk_lstat *bs);
+
+#endif /* COMPAT_BULK_LSTAT_H */
@@ -0,0 +1,560 @@
+#include "cache.h"
+#include "config.h"
+#include "fsmonitor.h"
+#include "fsmonitor-fs-listen.h"
+#include "fsmonitor--daemon.h"
+#include <sys/inotify.h>
+#include <poll.h>
+
+/*
+ * inotify(7) only watches a single directory at a time, so we have to
+ * add a watch for every directory in the working directory and keep
+ * that set up to date as directories are created, deleted and moved
+ * around.  For the .git directory (or the external <gitdir>) we only
+ * care whether it goes away and about cookie files, so we watch it
+ * and its cookie directory, but nothing else below it.
+ *
+ * NEEDSWORK: fanotify(7) with FAN_REPORT_DFID_NAME could watch a
+ * whole filesystem with a single mark, but that requires
+ * CAP_SYS_ADMIN, which the daemon of an ordinary user does not have.
+ */
+
+#define WORKDIR_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+			IN_MOVED_FROM | IN_MOVED_TO | \
+			IN_DELETE_SELF | IN_MOVE_SELF)
+#define GITDIR_EVENTS (IN_DELETE_SELF | IN_MOVE_SELF)
+#define COOKIE_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+/*
+ * Large enough for many events at once; each event needs at least
+ * sizeof(struct inotify_event) + NAME_MAX + 1 bytes.
+ */
+#define EVENT_BUF_SIZE (64 * 1024)
+
+struct watch_entry {
+	struct hashmap_entry ent;
+	int wd;
+	char *path;
+};
+
+struct fsmonitor_daemon_backend_data
+{
+	int fd_inotify;
+	int fd_stop[2];
+
+	/* maps watch descriptors to the absolute path of their directory */
+	struct hashmap watches;
+
+	int wd_worktree;
+	int wd_gitdir;
+
+	enum shutdown_style {
+		SHUTDOWN_EVENT = 0,
+		FORCE_SHUTDOWN,
+		FORCE_ERROR_STOP,
+	} shutdown_style;
+};
+
+static int watch_entry_cmp(const void *unused_cmp_data,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *unused_keydata)
+{
+	const struct watch_entry *e1, *e2;
+
+	e1 = container_of(eptr, const struct watch_entry, ent);
+	e2 = container_of(entry_or_key, const struct watch_entry, ent);
+
+	return e1->wd != e2->wd;
+}
+
+static struct watch_entry *find_watch(struct fsmonitor_daemon_backend_data *data,
+				      int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+
+	return hashmap_get_entry(&data->watches, &key, ent, NULL);
+}
+
+static void forget_watch(struct fsmonitor_daemon_backend_data *data, int wd)
+{
+	struct watch_entry key, *e;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+
+	e = hashmap_remove_entry(&data->watches, &key, ent, NULL);
+	if (e) {
+		free(e->path);
+		free(e);
+	}
+}
+
+/*
+ * Watch the directory `path` for `mask`.  Return the watch descriptor,
+ * or -1 (with errno set) if the directory cannot be watched.
+ */
+static int add_watch(struct fsmonitor_daemon_backend_data *data,
+		     const char *path, uint32_t mask)
+{
+	struct watch_entry *e;
+	int wd;
+
+	wd = inotify_add_watch(data->fd_inotify, path,
+			       mask | IN_ONLYDIR | IN_DONT_FOLLOW |
+			       IN_EXCL_UNLINK);
+	if (wd < 0)
+		return -1;
+
+	/*
+	 * The kernel hands out the same descriptor again if the
+	 * directory is already watched, e.g. when it was moved.
+	 */
+	e = find_watch(data, wd);
+	if (e) {
+		free(e->path);
+	} else {
+		CALLOC_ARRAY(e, 1);
+		hashmap_entry_init(&e->ent, memhash(&wd, sizeof(wd)));
+		e->wd = wd;
+		hashmap_add(&data->watches, &e->ent);
+	}
+	e->path = xstrdup(path);
+
+	return wd;
+}
+
+static int report_watch_error(const char *path)
+{
+	if (errno == ENOSPC)
+		return error("Unable to watch '%s': too many watches "
+			     "(see fs.inotify.max_user_watches)", path);
+	return error_errno("Unable to watch '%s'", path);
+}
+
+static int add_subdir_watches(struct fsmonitor_daemon_state *state,
+			      struct strbuf *path);
+
+/*
+ * Watch the working directory `path` and all directories below it,
+ * except for ".git".  Directories that vanish while we do are not an
+ * error.
+ */
+static int add_watches_recursive(struct fsmonitor_daemon_state *state,
+				 struct strbuf *path)
+{
+	struct fsmonitor_daemon_backend_data *data = state->backend_data;
+
+	if (add_watch(data, path->buf, WORKDIR_EVENTS) < 0) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			return 0;
+		return report_watch_error(path->buf);
+	}
+
+	return add_subdir_watches(state, path);
+}
+
+static int add_subdir_watches(struct fsmonitor_daemon_state *state,
+			      struct strbuf *path)
+{
+	struct dirent *de;
+	size_t len = path->len;
+	DIR *dir;
+	int ret = 0;
+
+	dir = opendir(path->buf);
+	if (!dir)
+		return 0;
+
+	while (!ret && (de = readdir(dir))) {
+		struct stat st;
+		int is_dir;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+
+		strbuf_setlen(path, len);
+		strbuf_addch(path, '/');
+		strbuf_addstr(path, de->d_name);
+
+		if (DTYPE(de) != DT_UNKNOWN)
+			is_dir = DTYPE(de) == DT_DIR;
+		else
+			is_dir = !lstat(path->buf, &st) && S_ISDIR(st.st_mode);
+		if (!is_dir)
+			continue;
+
+		if (fsmonitor_classify_path_absolute(state, path->buf) !=
+		    IS_WORKDIR_PATH)
+			continue;
+
+		ret = add_watches_recursive(state, path);
+	}
+
+	closedir(dir);
+	strbuf_setlen(path, len);
+	return ret;
+}
+
+/*
+ * Stop watching `path` and everything below it, after it was moved
+ * away.  If it was moved within the working directory, the watches are
+ * added again when we see where it went.
+ */
+static void remove_watches_recursive(struct fsmonitor_daemon_backend_data *data,
+				     const char *path)
+{
+	struct hashmap_iter iter;
+	struct watch_entry *e;
+	int *stale = NULL;
+	size_t stale_nr = 0, stale_alloc = 0, i;
+	size_t len = strlen(path);
+
+	hashmap_for_each_entry(&data->watches, &iter, e, ent) {
+		if (e->wd == data->wd_worktree || e->wd == data->wd_gitdir)
+			continue;
+		if (!strncmp(e->path, path, len) &&
+		    (!e->path[len] || e->path[len] == '/')) {
+			ALLOC_GROW(stale, stale_nr + 1, stale_alloc);
+			stale[stale_nr++] = e->wd;
+		}
+	}
+
+	for (i = 0; i < stale_nr; i++) {
+		inotify_rm_watch(data->fd_inotify, stale[i]);
+		forget_watch(data, stale[i]);
+	}
+	free(stale);
+}
+
+static void add_path_to_batch(struct fsmonitor_daemon_state *state,
+			      struct fsmonitor_batch **batch,
+			      const char *path, int is_dir)
+{
+	struct strbuf rel = STRBUF_INIT;
+
+	strbuf_addstr(&rel, path + state->path_worktree_watch.len + 1);
+	/*
+	 * A trailing slash tells the client to invalidate everything
+	 * below the directory, which covers anything that was created
+	 * in a new directory before we started watching it.
+	 */
+	if (is_dir)
+		strbuf_addch(&rel, '/');
+
+	if (!*batch)
+		*batch = fsmonitor_batch__new();
+	fsmonitor_batch__add_path(*batch, rel.buf);
+
+	strbuf_release(&rel);
+}
+
+/*
+ * Handle the events in `buf`.  Return -1 if the daemon has to shut
+ * down, either because there was an error (in which case `shutdown_style`
+ * is set to FORCE_ERROR_STOP) or because the .git directory or the
+ * working directory went away.
+ */
+static int process_events(struct fsmonitor_daemon_state *state,
+			  const char *buf, ssize_t len,
+			  struct fsmonitor_batch **batch,
+			  struct string_list *cookie_list)
+{
+	struct fsmonitor_daemon_backend_data *data = state->backend_data;
+	struct strbuf path = STRBUF_INIT;
+	const char *p;
+	int ret = 0;
+
+	for (p = buf; !ret && p < buf + len;
+	     p += sizeof(struct inotify_event) +
+		     ((const struct inotify_event *)p)->len) {
+		const struct inotify_event *ev = (const void *)p;
+		const struct watch_entry *e;
+		int is_dir = !!(ev->mask & IN_ISDIR);
+
+		if (ev->mask & IN_Q_OVERFLOW) {
+			/*
+			 * The kernel dropped events, so we have lost
+			 * sync with the filesystem.  Flush the cached
+			 * data and the batch we were building, as with
+			 * dropped events on other platforms.
+			 */
+			trace_printf_key(&trace_fsmonitor, "event: overflow");
+
+			fsmonitor_force_resync(state);
+			fsmonitor_batch__pop(*batch);
+			*batch = NULL;
+			string_list_clear(cookie_list, 0);
+			continue;
+		}
+
+		if (ev->mask & IN_IGNORED) {
+			if (ev->wd == data->wd_worktree ||
+			    ev->wd == data->wd_gitdir) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: root watch removed");
+				ret = -1;
+				data->shutdown_style = FORCE_SHUTDOWN;
+			}
+			forget_watch(data, ev->wd);
+			continue;
+		}
+
+		e = find_watch(data, ev->wd);
+		if (!e)
+			continue;
+
+		if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+			/*
+			 * Other directories are reported by the event
+			 * on their parent directory.
+			 */
+			if (ev->wd == data->wd_worktree ||
+			    ev->wd == data->wd_gitdir) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: '%s' %s", e->path,
+						 (ev->mask & IN_DELETE_SELF) ?
+						 "removed" : "renamed");
+				ret = -1;
+				data->shutdown_style = FORCE_SHUTDOWN;
+			}
+			continue;
+		}
+
+		strbuf_reset(&path);
+		strbuf_addstr(&path, e->path);
+		if (ev->len) {
+			strbuf_addch(&path, '/');
+			strbuf_addstr(&path, ev->name);
+		}
+
+		switch (fsmonitor_classify_path_absolute(state, path.buf)) {
+
+		case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+		case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+			/* special case cookie files within .git or gitdir */
+
+			/* Use just the filename of the cookie file. */
+			if (ev->len)
+				string_list_append(cookie_list, ev->name);
+			break;
+
+		case IS_INSIDE_DOT_GIT:
+		case IS_INSIDE_GITDIR:
+			/* ignore all other paths inside of .git or gitdir */
+			break;
+
+		case IS_DOT_GIT:
+		case IS_GITDIR:
+			/*
+			 * If .git directory is deleted or renamed away,
+			 * we have to quit.
+			 */
+			if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: gitdir removed");
+				ret = -1;
+				data->shutdown_style = FORCE_SHUTDOWN;
+			}
+			break;
+
+		case IS_WORKDIR_PATH:
+			/* the root itself only changes its attributes */
+			if (!ev->len)
+				break;
+
+			add_path_to_batch(state, batch, path.buf, is_dir);
+
+			if (!is_dir)
+				break;
+			if (ev->mask & IN_MOVED_FROM)
+				remove_watches_recursive(data, path.buf);
+			if (ev->mask & (IN_CREATE | IN_MOVED_TO) &&
+			    add_watches_recursive(state, &path)) {
+				ret = -1;
+				data->shutdown_style = FORCE_ERROR_STOP;
+			}
+			break;
+
+		case IS_OUTSIDE_CONE:
+		default:
+			trace_printf_key(&trace_fsmonitor,
+					 "ignoring '%s'", path.buf);
+			break;
+		}
+	}
+
+	strbuf_release(&path);
+	return ret;
+}
+
+int fsmonitor_fs_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsmonitor_daemon_backend_data *data;
+	struct strbuf path = STRBUF_INIT;
+
+	CALLOC_ARRAY(data, 1);
+	state->backend_data = data;
+	hashmap_init(&data->watches, watch_entry_cmp, NULL, 0);
+	data->fd_stop[0] = data->fd_stop[1] = -1;
+	data->wd_worktree = data->wd_gitdir = -1;
+
+	data->fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd_inotify < 0) {
+		error_errno("Unable to initialize inotify");
+		goto failed;
+	}
+	if (pipe(data->fd_stop) < 0) {
+		error_errno("Unable to create pipe");
+		goto failed;
+	}
+
+	data->wd_worktree = add_watch(data, state->path_worktree_watch.buf,
+				      WORKDIR_EVENTS);
+	if (data->wd_worktree < 0) {
+		report_watch_error(state->path_worktree_watch.buf);
+		goto failed;
+	}
+	strbuf_addbuf(&path, &state->path_worktree_watch);
+	if (add_subdir_watches(state, &path))
+		goto failed;
+
+	data->wd_gitdir = add_watch(data, state->path_gitdir_watch.buf,
+				    GITDIR_EVENTS);
+	if (data->wd_gitdir < 0) {
+		report_watch_error(state->path_gitdir_watch.buf);
+		goto failed;
+	}
+
+	strbuf_reset(&path);
+	strbuf_addbuf(&path, &state->path_cookie_prefix);
+	strbuf_strip_suffix(&path, "/");
+	if (add_watch(data, path.buf, COOKIE_EVENTS) < 0) {
+		report_watch_error(path.buf);
+		goto failed;
+	}
+
+	strbuf_release(&path);
+	return 0;
+
+failed:
+	strbuf_release(&path);
+	fsmonitor_fs_listen__dtor(state);
+	return -1;
+}
+
+void fsmonitor_fs_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsmonitor_daemon_backend_data *data;
+	struct hashmap_iter iter;
+	struct watch_entry *e;
+
+	if (!state || !state->backend_data)
+		return;
+
+	data = state->backend_data;
+
+	hashmap_for_each_entry(&data->watches, &iter, e, ent)
+		free(e->path);
+	hashmap_clear_and_free(&data->watches, struct watch_entry, ent);
+
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_stop[0] >= 0)
+		close(data->fd_stop[0]);
+	if (data->fd_stop[1] >= 0)
+		close(data->fd_stop[1]);
+
+	FREE_AND_NULL(state->backend_data);
+}
+
+void fsmonitor_fs_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsmonitor_daemon_backend_data *data;
+
+	data = state->backend_data;
+	data->shutdown_style = SHUTDOWN_EVENT;
+
+	if (write(data->fd_stop[1], "", 1) < 0)
+		error_errno("Unable to stop the inotify listener");
+}
+
+void fsmonitor_fs_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsmonitor_daemon_backend_data *data;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	struct pollfd pfd[2];
+	char *buf;
+
+	data = state->backend_data;
+	/* struct inotify_event requires the alignment malloc() gives us */
+	buf = xmalloc(EVENT_BUF_SIZE);
+
+	pfd[0].fd = data->fd_inotify;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = data->fd_stop[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		struct fsmonitor_batch *batch = NULL;
+		int stop = 0;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno("poll failed");
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+
+		/*
+		 * Collect everything the kernel has for us into a single
+		 * batch before publishing it.
+		 */
+		while (!stop) {
+			ssize_t len = read(data->fd_inotify, buf, EVENT_BUF_SIZE);
+
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				error_errno("Unable to read inotify events");
+				data->shutdown_style = FORCE_ERROR_STOP;
+				stop = 1;
+				break;
+			}
+			if (process_events(state, buf, len, &batch,
+					   &cookie_list))
+				stop = 1;
+		}
+
+		if (stop) {
+			fsmonitor_batch__pop(batch);
+			string_list_clear(&cookie_list, 0);
+			break;
+		}
+
+		fsmonitor_publish(state, batch, &cookie_list);
+		string_list_clear(&cookie_list, 0);
+	}
+
+	free(buf);
+
+	switch (data->shutdown_style) {
+	case FORCE_ERROR_STOP:
+		state->error_code = -1;
+		/* fall thru */
+	case FORCE_SHUTDOWN:
+		ipc_server_stop_async(state->ipc_server_data);
+		/* fall thru */
+	case SHUTDOWN_EVENT:
+	default:
+		break;
+	}
+}
@@ -76,6 +76,39 @@ static struct key_value_info *current_config_kvi;
  */
 static enum config_scope current_parsing_scope;
 
+/*
+ * While repo_read_config() parses the config files, this records every
+ * file it looked at (whether it existed or not), so that a snapshot of
+ * the result can be checked against them later; see the "Config snapshot"
+ * section below.
+ */
+struct config_snapshot_source {
+	char *path;
+	int present;
+	struct stat st;
+};
+
+struct config_snapshot_sources {
+	struct config_snapshot_source *items;
+	size_t nr, alloc;
+};
+
+static struct config_snapshot_sources *snapshot_sources;
+
+static void snapshot_note_path(const char *path)
+{
+	struct config_snapshot_source *src;
+
+	if (!snapshot_sources)
+		return;
+
+	ALLOC_GROW(snapshot_sources->items, snapshot_sources->nr + 1,
+		   snapshot_sources->alloc);
+	src = &snapshot_sources->items[snapshot_sources->nr++];
+	src->path = xstrdup(path);
+	src->present = !stat(path, &src->st);
+}
+
 static int core_compression_seen;
 static int pack_compression_seen;
 static int zlib_compression_seen;
@@ -159,6 +192,7 @@ static int handle_path_include(const char *path, struct config_include_data *inc
 		path = buf.buf;
 	}
 
+	snapshot_note_path(path);
 	if (!access_or_die(path, R_OK, 0)) {
 		if (++inc->depth > MAX_INCLUDE_DEPTH)
 			die(_(include_depth_advice), MAX_INCLUDE_DEPTH, path,
@@ -300,8 +334,11 @@ static int include_condition_is_true(const struct config_options *opts,
 		return include_by_gitdir(opts, cond, cond_len, 0);
 	else if (skip_prefix_mem(cond, cond_len, "gitdir/i:", &cond, &cond_len))
 		return include_by_gitdir(opts, cond, cond_len, 1);
-	else if (skip_prefix_mem(cond, cond_len, "onbranch:", &cond, &cond_len))
+	else if (skip_prefix_mem(cond, cond_len, "onbranch:", &cond, &cond_len)) {
+		if (the_repository->gitdir)
+			snapshot_note_path(git_path("HEAD"));
 		return include_by_branch(cond, cond_len);
+	}
 
 	/* unknown conditionals are always false */
 	return 0;
@@ -1431,11 +1468,40 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.hashfilebuffersize")) {
+		hashfile_buffer_size = git_config_ulong(var, value);
+		if (hashfile_buffer_size < 4096)
+			hashfile_buffer_size = 4096;
+		if (hashfile_buffer_size > 64 * 1024 * 1024)
+			hashfile_buffer_size = 64 * 1024 * 1024;
+		return 0;
+	}
+
+	if (!strcmp(var, "core.hashfilewritethread")) {
+		hashfile_write_thread = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.deltabasecachelimit")) {
 		delta_base_cache_limit = git_config_ulong(var, value);
 		return 0;
 	}
 
+	if (!strcmp(var, "core.treecachelimit")) {
+		tree_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.packreadahead")) {
+		pack_readahead_size = git_config_ulong(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.looseobjectindex")) {
+		core_loose_object_index = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.autocrlf")) {
 		if (value && !strcasecmp(value, "input")) {
 			auto_crlf = AUTO_CRLF_INPUT;
@@ -1513,6 +1579,35 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.fsyncreffiles")) {
+		fsync_ref_files = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.fsyncmethod")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "fsync"))
+			fsync_method = FSYNC_METHOD_FSYNC;
+		else if (!strcmp(value, "batch"))
+			fsync_method = FSYNC_METHOD_BATCH;
+		else
+			warning(_("ignoring unknown core.fsyncMethod value '%s'"), value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.checksumtrust")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "verified"))
+			checksum_trust = CHECKSUM_TRUST_VERIFIED;
+		else if (!strcmp(value, "paranoid"))
+			checksum_trust = CHECKSUM_TRUST_PARANOID;
+		else
+			warning(_("ignoring unknown core.checksumTrust value '%s'"), value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.preloadindex")) {
 		core_preload_index = git_config_bool(var, value);
 		return 0;
@@ -1898,6 +1993,8 @@ static int do_git_config_sequence(const struct config_options *opts,
 		repo_config = NULL;
 
 	current_parsing_scope = CONFIG_SCOPE_SYSTEM;
+	if (git_config_system() && system_config)
+		snapshot_note_path(system_config);
 	if (git_config_system() && system_config &&
 	    !access_or_die(system_config, R_OK,
 			   opts->system_gently ? ACCESS_EACCES_OK : 0))
@@ -1906,13 +2003,19 @@ static int do_git_config_sequence(const struct config_options *opts,
 	current_parsing_scope = CONFIG_SCOPE_GLOBAL;
 	git_global_config(&user_config, &xdg_config);
 
+	if (xdg_config)
+		snapshot_note_path(xdg_config);
 	if (xdg_config && !access_or_die(xdg_config, R_OK, ACCESS_EACCES_OK))
 		ret += git_config_from_file(fn, xdg_config, data);
 
+	if (user_config)
+		snapshot_note_path(user_config);
 	if (user_config && !access_or_die(user_config, R_OK, ACCESS_EACCES_OK))
 		ret += git_config_from_file(fn, user_config, data);
 
 	current_parsing_scope = CONFIG_SCOPE_LOCAL;
+	if (!opts->ignore_repo && repo_config)
+		snapshot_note_path(repo_config);
 	if (!opts->ignore_repo && repo_config &&
 	    !access_or_die(repo_config, R_OK, 0))
 		ret += git_config_from_file(fn, repo_config, data);
@@ -1920,6 +2023,7 @@ static int do_git_config_sequence(const struct config_options *opts,
 	current_parsing_scope = CONFIG_SCOPE_WORKTREE;
 	if (!opts->ignore_worktree && repository_format_worktree_config) {
 		char *path = git_pathdup("config.worktree");
+		snapshot_note_path(path);
 		if (!access_or_die(path, R_OK, 0))
 			ret += git_config_from_file(fn, path, data);
 		free(path);
@@ -2057,12 +2161,13 @@ static struct config_set_element *configset_find_element(struct config_set *cs,
 	return found_entry;
 }
 
-static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+static void configset_add_value_kvi(struct config_set *cs, const char *key,
+				    const char *value,
+				    struct key_value_info *kv_info)
 {
 	struct config_set_element *e;
 	struct string_list_item *si;
 	struct configset_list_item *l_item;
-	struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
 
 	e = configset_find_element(cs, key);
 	/*
@@ -2082,6 +2187,12 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 	l_item = &cs->list.items[cs->list.nr++];
 	l_item->e = e;
 	l_item->value_index = e->value_list.nr - 1;
+	si->util = kv_info;
+}
+
+static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+{
+	struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
 
 	if (!cf)
 		BUG("configset_add_value has no source");
@@ -2096,7 +2207,7 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 		kv_info->origin_type = CONFIG_ORIGIN_CMDLINE;
 	}
 	kv_info->scope = current_parsing_scope;
-	si->util = kv_info;
+	configset_add_value_kvi(cs, key, value, kv_info);
 
 	return 0;
 }
@@ -2264,9 +2375,347 @@ int git_configset_get_pathname(struct config_set *cs, const char *key, const cha
 }
 
 /* Functions use to read configuration from a repository */
+/*
+ * Config snapshot
+ * ---------------
+ *
+ * With core.configSnapshot, repo_read_config() saves what it read from
+ * the config files to "$GIT_DIR/config-snapshot", and later processes
+ * load that instead of parsing the files again, as long as none of the
+ * files it was built from has changed. Values from the command line are
+ * never saved; they are always parsed and added on top.
+ *
+ * All numbers are in network byte order, and each string is stored as
+ * its length followed by its bytes and a NUL (a length of
+ * CONFIG_SNAPSHOT_NULL stands for a NULL string):
+ *
+ *   - the signature "CFGS" and CONFIG_SNAPSHOT_VERSION, 4 bytes each
+ *   - a string describing where config files are looked for
+ *   - the number of source files, and for each of them its path, whether
+ *     it existed (4 bytes), and if it did its device, inode, size, mtime
+ *     and ctime (8 bytes each, nanoseconds separately)
+ *   - the number of values, and for each of them the key, value and file
+ *     name as strings, followed by the line number, origin type and
+ *     scope (4 bytes each)
+ *   - a checksum of everything above
+ */
+#define CONFIG_SNAPSHOT_SIGNATURE 0x43464753 /* "CFGS" */
+#define CONFIG_SNAPSHOT_VERSION 1
+#define CONFIG_SNAPSHOT_NULL 0xffffffff
+
+static void snapshot_fingerprint(const struct config_options *opts,
+				 struct strbuf *out)
+{
+	char *system_config = git_system_config();
+	char *xdg_config = NULL;
+	char *user_config = NULL;
+	const char *home = getenv("HOME");
+
+	git_global_config(&user_config, &xdg_config);
+
+	strbuf_addf(out, "system %d %s\n", git_config_system(),
+		    system_config ? system_config : "");
+	strbuf_addf(out, "xdg %s\n", xdg_config ? xdg_config : "");
+	strbuf_addf(out, "global %s\n", user_config ? user_config : "");
+	strbuf_addf(out, "home %s\n", home ? home : "");
+	strbuf_addf(out, "gitdir %s\n", absolute_path(opts->git_dir));
+	strbuf_addf(out, "commondir %s\n", absolute_path(opts->commondir));
+	strbuf_addf(out, "worktree %d\n", repository_format_worktree_config);
+
+	free(system_config);
+	free(xdg_config);
+	free(user_config);
+}
+
+static void snapshot_add_be32(struct strbuf *sb, uint32_t value)
+{
+	value = htonl(value);
+	strbuf_add(sb, &value, sizeof(value));
+}
+
+static void snapshot_add_be64(struct strbuf *sb, uint64_t value)
+{
+	snapshot_add_be32(sb, value >> 32);
+	snapshot_add_be32(sb, value & 0xffffffff);
+}
+
+static void snapshot_add_string(struct strbuf *sb, const char *str)
+{
+	if (!str) {
+		snapshot_add_be32(sb, CONFIG_SNAPSHOT_NULL);
+		return;
+	}
+	snapshot_add_be32(sb, strlen(str));
+	strbuf_add(sb, str, strlen(str) + 1);
+}
+
+static void snapshot_add_stat(struct strbuf *sb, const struct stat *st)
+{
+	snapshot_add_be64(sb, st->st_dev);
+	snapshot_add_be64(sb, st->st_ino);
+	snapshot_add_be64(sb, st->st_size);
+	snapshot_add_be64(sb, st->st_mtime);
+	snapshot_add_be64(sb, ST_MTIME_NSEC(*st));
+	snapshot_add_be64(sb, st->st_ctime);
+	snapshot_add_be64(sb, ST_CTIME_NSEC(*st));
+}
+
+static void write_config_snapshot(const char *path, const char *fingerprint,
+				  const struct config_snapshot_sources *sources,
+				  const struct config_set *cs)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf sb = STRBUF_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	time_t now = time(NULL);
+	uint32_t nr = 0;
+	size_t i;
+
+	/*
+	 * A file that was changed in the same second as we read it could
+	 * change again without its stat data showing it; leave the
+	 * snapshot for a later process to write.
+	 */
+	for (i = 0; i < sources->nr; i++) {
+		const struct config_snapshot_source *src = &sources->items[i];
+		if (src->present && src->st.st_mtime >= now)
+			return;
+	}
+
+	snapshot_add_be32(&sb, CONFIG_SNAPSHOT_SIGNATURE);
+	snapshot_add_be32(&sb, CONFIG_SNAPSHOT_VERSION);
+	snapshot_add_string(&sb, fingerprint);
+
+	snapshot_add_be32(&sb, sources->nr);
+	for (i = 0; i < sources->nr; i++) {
+		const struct config_snapshot_source *src = &sources->items[i];
+
+		snapshot_add_string(&sb, src->path);
+		snapshot_add_be32(&sb, src->present);
+		if (src->present)
+			snapshot_add_stat(&sb, &src->st);
+	}
+
+	for (i = 0; i < cs->list.nr; i++) {
+		const struct configset_list_item *item = &cs->list.items[i];
+		const struct key_value_info *kvi =
+			item->e->value_list.items[item->value_index].util;
+		if (kvi->scope != CONFIG_SCOPE_COMMAND)
+			nr++;
+	}
+	snapshot_add_be32(&sb, nr);
+	for (i = 0; i < cs->list.nr; i++) {
+		const struct configset_list_item *item = &cs->list.items[i];
+		const struct string_list_item *value =
+			&item->e->value_list.items[item->value_index];
+		const struct key_value_info *kvi = value->util;
+
+		if (kvi->scope == CONFIG_SCOPE_COMMAND)
+			continue;
+		snapshot_add_string(&sb, item->e->key);
+		snapshot_add_string(&sb, value->string);
+		snapshot_add_string(&sb, kvi->filename);
+		snapshot_add_be32(&sb, kvi->linenr);
+		snapshot_add_be32(&sb, kvi->origin_type);
+		snapshot_add_be32(&sb, kvi->scope);
+	}
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, sb.buf, sb.len);
+	the_hash_algo->final_fn(hash, &ctx);
+	strbuf_add(&sb, hash, the_hash_algo->rawsz);
+
+	/*
+	 * The snapshot is only a cache; failing to write it (say, in a
+	 * repository we cannot write to) is not worth complaining about.
+	 */
+	if (hold_lock_file_for_update(&lk, path, 0) < 0)
+		goto out;
+	if (write_in_full(get_lock_file_fd(&lk), sb.buf, sb.len) < 0 ||
+	    commit_lock_file(&lk) < 0)
+		rollback_lock_file(&lk);
+out:
+	strbuf_release(&sb);
+}
+
+struct snapshot_reader {
+	const unsigned char *p, *end;
+	int corrupt;
+};
+
+static uint32_t snapshot_get_be32(struct snapshot_reader *r)
+{
+	uint32_t value;
+
+	if (r->corrupt || r->end - r->p < 4) {
+		r->corrupt = 1;
+		return 0;
+	}
+	value = get_be32(r->p);
+	r->p += 4;
+	return value;
+}
+
+static uint64_t snapshot_get_be64(struct snapshot_reader *r)
+{
+	uint64_t value = (uint64_t)snapshot_get_be32(r) << 32;
+	return value | snapshot_get_be32(r);
+}
+
+static const char *snapshot_get_string(struct snapshot_reader *r)
+{
+	uint32_t len = snapshot_get_be32(r);
+	const char *str;
+
+	if (r->corrupt || len == CONFIG_SNAPSHOT_NULL)
+		return NULL;
+	if (r->end - r->p <= len || r->p[len]) {
+		r->corrupt = 1;
+		return NULL;
+	}
+	str = (const char *)r->p;
+	r->p += len + 1;
+	return str;
+}
+
+/* Returns 1 if the file at "path" no longer matches what was recorded. */
+static int snapshot_source_changed(struct snapshot_reader *r, const char *path)
+{
+	struct stat st;
+	int present = snapshot_get_be32(r);
+
+	if (!path || r->corrupt)
+		return 1;
+	if (present != !stat(path, &st))
+		return 1;
+	if (!present)
+		return 0;
+
+	return snapshot_get_be64(r) != (uint64_t)st.st_dev ||
+	       snapshot_get_be64(r) != (uint64_t)st.st_ino ||
+	       snapshot_get_be64(r) != (uint64_t)st.st_size ||
+	       snapshot_get_be64(r) != (uint64_t)st.st_mtime ||
+	       snapshot_get_be64(r) != ST_MTIME_NSEC(st) ||
+	       snapshot_get_be64(r) != (uint64_t)st.st_ctime ||
+	       snapshot_get_be64(r) != ST_CTIME_NSEC(st) ||
+	       r->corrupt;
+}
+
+/*
+ * Load the snapshot at "path" into "cs". Returns 0 if it was loaded, -1
+ * if there is no snapshot, or 1 if it is out of date or unusable; "cs"
+ * may then hold some of its values and needs to be cleared.
+ */
+static int read_config_snapshot(const char *path, const char *fingerprint,
+				struct config_set *cs)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	struct snapshot_reader r = { 0 };
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	unsigned char *data;
+	const char *str;
+	struct stat st;
+	size_t len;
+	uint32_t i, nr;
+	int fd, ret = 1;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return 1;
+	}
+#ifndef GIT_WINDOWS_NATIVE
+	/* Only trust a snapshot that we could have written ourselves. */
+	if (st.st_uid != geteuid()) {
+		close(fd);
+		return 1;
+	}
+#endif
+	len = xsize_t(st.st_size);
+	if (len < 8 + rawsz) {
+		close(fd);
+		return 1;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, data, len - rawsz);
+	the_hash_algo->final_fn(hash, &ctx);
+	if (!hasheq(hash, data + len - rawsz))
+		goto out;
+
+	r.p = data;
+	r.end = data + len - rawsz;
+	if (snapshot_get_be32(&r) != CONFIG_SNAPSHOT_SIGNATURE ||
+	    snapshot_get_be32(&r) != CONFIG_SNAPSHOT_VERSION)
+		goto out;
+	str = snapshot_get_string(&r);
+	if (!str || strcmp(str, fingerprint))
+		goto out;
+
+	nr = snapshot_get_be32(&r);
+	for (i = 0; i < nr; i++)
+		if (snapshot_source_changed(&r, snapshot_get_string(&r)))
+			goto out;
+
+	nr = snapshot_get_be32(&r);
+	for (i = 0; i < nr && !r.corrupt; i++) {
+		struct key_value_info *kvi;
+		const char *key = snapshot_get_string(&r);
+		const char *value = snapshot_get_string(&r);
+		const char *filename = snapshot_get_string(&r);
+
+		CALLOC_ARRAY(kvi, 1);
+		kvi->filename = filename ? strintern(filename) : NULL;
+		kvi->linenr = (int)snapshot_get_be32(&r);
+		kvi->origin_type = snapshot_get_be32(&r);
+		kvi->scope = snapshot_get_be32(&r);
+		if (!key) {
+			free(kvi);
+			r.corrupt = 1;
+			break;
+		}
+		configset_add_value_kvi(cs, key, value, kvi);
+	}
+	if (!r.corrupt && r.p == r.end)
+		ret = 0;
+
+out:
+	munmap(data, len);
+	return ret;
+}
+
+static void configset_add_cmdline(struct config_set *cs,
+				  const struct config_options *opts)
+{
+	struct config_include_data inc = CONFIG_INCLUDE_INIT;
+	enum config_scope prev_parsing_scope = current_parsing_scope;
+
+	inc.fn = config_set_callback;
+	inc.data = cs;
+	inc.opts = opts;
+
+	current_parsing_scope = CONFIG_SCOPE_COMMAND;
+	if (git_config_from_parameters(git_config_include, &inc) < 0)
+		die(_("unable to parse command-line config"));
+	current_parsing_scope = prev_parsing_scope;
+}
+
 static void repo_read_config(struct repository *repo)
 {
 	struct config_options opts = { 0 };
+	struct config_snapshot_sources sources = { 0 };
+	struct config_snapshot_sources *prev_sources = snapshot_sources;
+	struct strbuf fingerprint = STRBUF_INIT;
+	char *snapshot = NULL;
+	const char *result = "none";
+	int ret = -1;
+	size_t i;
 
 	opts.respect_includes = 1;
 	opts.commondir = repo->commondir;
@@ -2279,6 +2728,29 @@ static void repo_read_config(struct repository *repo)
 
 	git_configset_init(repo->config);
 
+	trace2_region_enter("config", "read", NULL);
+
+	if (repo == the_repository && repo->gitdir) {
+		snapshot = repo_git_path(repo, "config-snapshot");
+		snapshot_fingerprint(&opts, &fingerprint);
+		ret = read_config_snapshot(snapshot, fingerprint.buf,
+					   repo->config);
+	}
+
+	if (!ret) {
+		configset_add_cmdline(repo->config, &opts);
+		result = "loaded";
+		goto out;
+	}
+
+	if (ret > 0) {
+		git_configset_clear(repo->config);
+		git_configset_init(repo->config);
+		result = "stale";
+	}
+
+	if (snapshot)
+		snapshot_sources = &sources;
 	if (config_with_options(config_set_callback, repo->config, NULL, &opts) < 0)
 		/*
 		 * config_with_options() normally returns only
@@ -2292,6 +2764,28 @@ static void repo_read_config(struct repository *repo)
 		 * immediately.
 		 */
 		die(_("unknown error occurred while reading the configuration files"));
+	snapshot_sources = prev_sources;
+
+	if (snapshot) {
+		const char *value;
+
+		if (!git_configset_get_value(repo->config, "core.configsnapshot", &value) &&
+		    git_parse_maybe_bool(value) > 0)
+			write_config_snapshot(snapshot, fingerprint.buf,
+					      &sources, repo->config);
+		else if (ret > 0)
+			unlink(snapshot);
+	}
+
+out:
+	trace2_data_string("config", NULL, "snapshot", result);
+	trace2_region_leave("config", "read", NULL);
+
+	for (i = 0; i < sources.nr; i++)
+		free(sources.items[i].path);
+	free(sources.items);
+	strbuf_release(&fingerprint);
+	free(snapshot);
 }
 
 static void git_config_check_init(struct repository *repo)
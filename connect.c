@@ -479,6 +479,7 @@ struct ref **get_remote_refs(int fd_out, struct packet_reader *reader,
 {
 	int i;
 	const char *hash_name;
+	struct strbuf req_buf = STRBUF_INIT;
 	struct strvec *ref_prefixes = transport_options ?
 		&transport_options->ref_prefixes : NULL;
 	char **unborn_head_target = transport_options ?
@@ -486,17 +487,17 @@ struct ref **get_remote_refs(int fd_out, struct packet_reader *reader,
 	*list = NULL;
 
 	if (server_supports_v2("ls-refs", 1))
-		packet_write_fmt(fd_out, "command=ls-refs\n");
+		packet_buf_write(&req_buf, "command=ls-refs\n");
 
 	if (server_supports_v2("agent", 0))
-		packet_write_fmt(fd_out, "agent=%s", git_user_agent_sanitized());
+		packet_buf_write(&req_buf, "agent=%s", git_user_agent_sanitized());
 
 	if (server_feature_v2("object-format", &hash_name)) {
 		int hash_algo = hash_algo_by_name(hash_name);
 		if (hash_algo == GIT_HASH_UNKNOWN)
 			die(_("unknown object format '%s' specified by server"), hash_name);
 		reader->hash_algo = &hash_algos[hash_algo];
-		packet_write_fmt(fd_out, "object-format=%s", reader->hash_algo->name);
+		packet_buf_write(&req_buf, "object-format=%s", reader->hash_algo->name);
 	} else {
 		reader->hash_algo = &hash_algos[GIT_HASH_SHA1];
 	}
@@ -504,21 +505,28 @@ struct ref **get_remote_refs(int fd_out, struct packet_reader *reader,
 	if (server_options && server_options->nr &&
 	    server_supports_v2("server-option", 1))
 		for (i = 0; i < server_options->nr; i++)
-			packet_write_fmt(fd_out, "server-option=%s",
+			packet_buf_write(&req_buf, "server-option=%s",
 					 server_options->items[i].string);
 
-	packet_delim(fd_out);
+	packet_buf_delim(&req_buf);
 	/* When pushing we don't want to request the peeled tags */
 	if (!for_push)
-		packet_write_fmt(fd_out, "peel\n");
-	packet_write_fmt(fd_out, "symrefs\n");
+		packet_buf_write(&req_buf, "peel\n");
+	packet_buf_write(&req_buf, "symrefs\n");
 	if (server_supports_feature("ls-refs", "unborn", 0))
-		packet_write_fmt(fd_out, "unborn\n");
+		packet_buf_write(&req_buf, "unborn\n");
 	for (i = 0; ref_prefixes && i < ref_prefixes->nr; i++) {
-		packet_write_fmt(fd_out, "ref-prefix %s\n",
+		packet_buf_write(&req_buf, "ref-prefix %s\n",
 				 ref_prefixes->v[i]);
 	}
-	packet_flush(fd_out);
+	packet_buf_flush(&req_buf);
+
+	/*
+	 * Send the request in one go, so that the server does not sit
+	 * waiting for the rest of it behind a delayed ack.
+	 */
+	write_or_die(fd_out, req_buf.buf, req_buf.len);
+	strbuf_release(&req_buf);
 
 	/* Process response from server */
 	while (packet_reader_read(reader) == PACKET_READ_NORMAL) {
@@ -6,6 +6,137 @@
 #include "transport.h"
 #include "packfile.h"
 #include "promisor-remote.h"
+#include "pack-bitmap.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree-walk.h"
+#include "shallow.h"
+#include "progress.h"
+#include "oidset.h"
+
+static int object_exists(struct repository *r, const struct object_id *oid)
+{
+	return !oid_object_info_extended(r, oid, NULL,
+					 OBJECT_INFO_QUICK |
+					 OBJECT_INFO_SKIP_FETCH_OBJECT);
+}
+
+/*
+ * Walk from "tips" until reaching objects in the bitmapped pack, which
+ * are known to be connected, and make sure everything on the way
+ * exists. This does not need to look at our refs at all, unlike
+ * "rev-list --not --all", which has to parse every one of them first.
+ *
+ * Return 1 if everything is connected, or 0 if that could not be shown,
+ * in which case rev-list has to have a look (and report what is wrong).
+ */
+static int connected_by_bitmap(struct repository *r,
+			       const struct oid_array *tips,
+			       struct check_connected_options *opt)
+{
+	struct bitmap_index *bitmap_git;
+	struct object_array queue = OBJECT_ARRAY_INIT;
+	struct oidset seen = OIDSET_INIT;
+	struct progress *progress = NULL;
+	uint64_t nr = 0;
+	int connected = 1;
+	size_t i;
+
+	if (opt->shallow_file || is_repository_shallow(r))
+		return 0;
+	bitmap_git = prepare_bitmap_git(r);
+	if (!bitmap_git)
+		return 0;
+
+	if (opt->progress)
+		progress = start_delayed_progress(_("Checking connectivity"), 0);
+
+	for (i = 0; connected && i < tips->nr; i++) {
+		struct object *obj = parse_object(r, &tips->oid[i]);
+
+		if (obj)
+			add_object_array(obj, NULL, &queue);
+		else
+			connected = 0;
+	}
+
+	while (connected && queue.nr) {
+		struct object *obj = object_array_pop(&queue);
+
+		if (oidset_insert(&seen, &obj->oid) ||
+		    bitmap_has_object(bitmap_git, &obj->oid))
+			continue;
+		display_progress(progress, ++nr);
+
+		if (obj->type == OBJ_TAG) {
+			struct tag *tag = (struct tag *)obj;
+
+			if (parse_tag(tag) || !tag->tagged)
+				connected = 0;
+			else
+				add_object_array(tag->tagged, NULL, &queue);
+		} else if (obj->type == OBJ_COMMIT) {
+			struct commit *commit = (struct commit *)obj;
+			struct commit_list *p;
+
+			if (repo_parse_commit_gently(r, commit, 1) < 0) {
+				connected = 0;
+				continue;
+			}
+			add_object_array(&repo_get_commit_tree(r, commit)->object,
+					 NULL, &queue);
+			for (p = commit->parents; p; p = p->next)
+				add_object_array(&p->item->object, NULL, &queue);
+		} else if (obj->type == OBJ_TREE) {
+			struct tree_desc desc;
+			struct name_entry entry;
+			enum object_type type;
+			unsigned long size;
+			/* Not parse_tree(); its buffer may have been freed. */
+			void *buf = repo_read_object_file(r, &obj->oid,
+							  &type, &size);
+
+			if (!buf || type != OBJ_TREE) {
+				free(buf);
+				connected = 0;
+				continue;
+			}
+			init_tree_desc(&desc, buf, size);
+			while (connected && tree_entry(&desc, &entry)) {
+				if (S_ISGITLINK(entry.mode))
+					continue;
+				if (S_ISDIR(entry.mode)) {
+					struct tree *sub = lookup_tree(r, &entry.oid);
+
+					if (sub)
+						add_object_array(&sub->object,
+								 NULL, &queue);
+					else
+						connected = 0;
+				} else if (!oidset_contains(&seen, &entry.oid) &&
+					   !bitmap_has_object(bitmap_git, &entry.oid)) {
+					oidset_insert(&seen, &entry.oid);
+					display_progress(progress, ++nr);
+					connected = object_exists(r, &entry.oid);
+				}
+			}
+			free(buf);
+		} else if (obj->type == OBJ_BLOB) {
+			connected = object_exists(r, &obj->oid);
+		} else {
+			connected = 0;
+		}
+	}
+
+	stop_progress(&progress);
+	if (connected)
+		trace2_data_intmax("connectivity", r, "bitmap-walked", nr);
+
+	object_array_clear(&queue);
+	oidset_clear(&seen);
+	free_bitmap_index(bitmap_git);
+	return connected;
+}
 
 /*
  * If we feed all the commits we want to verify to this command
@@ -28,7 +159,8 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	int err = 0;
 	struct packed_git *new_pack = NULL;
 	struct transport *transport;
-	size_t base_len;
+	size_t base_len, i;
+	struct oid_array tips = OID_ARRAY_INIT;
 
 	if (!opt)
 		opt = &defaults;
@@ -88,6 +220,30 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	}
 
 no_promisor_pack_found:
+	do {
+		/*
+		 * If index-pack already checked that:
+		 * - there are no dangling pointers in the new pack
+		 * - the pack is self contained
+		 * Then if the updated ref is in the new pack, then we
+		 * are sure the ref is good and not sending it to
+		 * rev-list for verification.
+		 */
+		if (new_pack && find_pack_entry_one(oid.hash, new_pack))
+			continue;
+
+		oid_array_append(&tips, &oid);
+	} while (!fn(cb_data, &oid));
+
+	if (!tips.nr ||
+	    (!has_promisor_remote() &&
+	     connected_by_bitmap(the_repository, &tips, opt))) {
+		if (opt->err_fd)
+			close(opt->err_fd);
+		oid_array_clear(&tips);
+		return 0;
+	}
+
 	if (opt->shallow_file) {
 		strvec_push(&rev_list.args, "--shallow-file");
 		strvec_push(&rev_list.args, opt->shallow_file);
@@ -116,28 +272,19 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	else
 		rev_list.no_stderr = opt->quiet;
 
-	if (start_command(&rev_list))
+	if (start_command(&rev_list)) {
+		oid_array_clear(&tips);
 		return error(_("Could not run 'git rev-list'"));
+	}
 
 	sigchain_push(SIGPIPE, SIG_IGN);
 
 	rev_list_in = xfdopen(rev_list.in, "w");
 
-	do {
-		/*
-		 * If index-pack already checked that:
-		 * - there are no dangling pointers in the new pack
-		 * - the pack is self contained
-		 * Then if the updated ref is in the new pack, then we
-		 * are sure the ref is good and not sending it to
-		 * rev-list for verification.
-		 */
-		if (new_pack && find_pack_entry_one(oid.hash, new_pack))
-			continue;
-
-		if (fprintf(rev_list_in, "%s\n", oid_to_hex(&oid)) < 0)
+	for (i = 0; i < tips.nr; i++)
+		if (fprintf(rev_list_in, "%s\n", oid_to_hex(&tips.oid[i])) < 0)
 			break;
-	} while (!fn(cb_data, &oid));
+	oid_array_clear(&tips);
 
 	if (ferror(rev_list_in) || fflush(rev_list_in)) {
 		if (errno != EPIPE && errno != EINVAL)
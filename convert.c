@@ -9,6 +9,7 @@
 #include "sub-process.h"
 #include "utf8.h"
 #include "ll-merge.h"
+#include "strmap.h"
 
 /*
  * convert.c - convert a file when checking it out and checking it in.
@@ -32,6 +33,50 @@ struct text_stat {
 	unsigned printable, nonprintable;
 };
 
+/*
+ * Returns the number of leading bytes in 'buf' that gather_stats()
+ * just counts as printable, i.e. neither control characters nor DEL.
+ * Text is mostly made of those, so look at them a block at a time.
+ */
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+
+static size_t count_plain_bytes(const char *buf, size_t size)
+{
+	const __m128i max_control = _mm_set1_epi8(31);
+	const __m128i del = _mm_set1_epi8(127);
+	size_t i;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, max_control), v);
+		unsigned int mask = _mm_movemask_epi8(
+			_mm_or_si128(control, _mm_cmpeq_epi8(v, del)));
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	for (; i < size; i++) {
+		unsigned char c = buf[i];
+		if (c < 32 || c == 127)
+			break;
+	}
+	return i;
+}
+#else
+static size_t count_plain_bytes(const char *buf, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		unsigned char c = buf[i];
+		if (c < 32 || c == 127)
+			break;
+	}
+	return i;
+}
+#endif
+
 static void gather_stats(const char *buf, unsigned long size, struct text_stat *stats)
 {
 	unsigned long i;
@@ -39,7 +84,15 @@ static void gather_stats(const char *buf, unsigned long size, struct text_stat *
 	memset(stats, 0, sizeof(*stats));
 
 	for (i = 0; i < size; i++) {
-		unsigned char c = buf[i];
+		unsigned char c;
+		size_t plain = count_plain_bytes(buf + i, size - i);
+
+		stats->printable += plain;
+		i += plain;
+		if (i == size)
+			break;
+
+		c = buf[i];
 		if (c == '\r') {
 			if (i+1 < size && buf[i+1] == '\n') {
 				stats->crlf++;
@@ -492,7 +545,8 @@ static int crlf_to_git(struct index_state *istate,
 {
 	struct text_stat stats;
 	char *dst;
-	int convert_crlf_into_lf;
+	const char *end;
+	int convert_crlf_into_lf, strip_any_cr;
 
 	if (crlf_action == CRLF_BINARY ||
 	    (src && !len))
@@ -505,6 +559,14 @@ static int crlf_to_git(struct index_state *istate,
 	if (!buf && !src)
 		return 1;
 
+	/*
+	 * Without CR there is nothing to convert and, unless we have to
+	 * warn about what a round trip would do, nothing else to look at.
+	 */
+	if (!(conv_flags & (CONV_EOL_RNDTRP_WARN | CONV_EOL_RNDTRP_DIE)) &&
+	    !memchr(src, '\r', len))
+		return 0;
+
 	gather_stats(src, len, &stats);
 	/* Optimization: No CRLF? Nothing to convert, regardless. */
 	convert_crlf_into_lf = !!stats.crlf;
@@ -552,23 +614,26 @@ static int crlf_to_git(struct index_state *istate,
 	if (strbuf_avail(buf) + buf->len < len)
 		strbuf_grow(buf, len - buf->len);
 	dst = buf->buf;
-	if (crlf_action == CRLF_AUTO || crlf_action == CRLF_AUTO_INPUT || crlf_action == CRLF_AUTO_CRLF) {
-		/*
-		 * If we guessed, we already know we rejected a file with
-		 * lone CR, and we can strip a CR without looking at what
-		 * follow it.
-		 */
-		do {
-			unsigned char c = *src++;
-			if (c != '\r')
-				*dst++ = c;
-		} while (--len);
-	} else {
-		do {
-			unsigned char c = *src++;
-			if (! (c == '\r' && (1 < len && *src == '\n')))
-				*dst++ = c;
-		} while (--len);
+	/*
+	 * If we guessed, we already know we rejected a file with lone
+	 * CR, and we can strip a CR without looking at what follow it.
+	 */
+	strip_any_cr = (crlf_action == CRLF_AUTO ||
+			crlf_action == CRLF_AUTO_INPUT ||
+			crlf_action == CRLF_AUTO_CRLF);
+	end = src + len;
+	for (;;) {
+		const char *cr = memchr(src, '\r', end - src);
+		size_t n = (cr ? cr : end) - src;
+
+		/* src and dst may be the same buffer */
+		memmove(dst, src, n);
+		dst += n;
+		if (!cr)
+			break;
+		src = cr + 1;
+		if (!strip_any_cr && !(src < end && *src == '\n'))
+			*dst++ = '\r';
 	}
 	strbuf_setlen(buf, dst - buf->buf);
 	return 1;
@@ -732,6 +797,7 @@ static int apply_single_file_filter(const char *path, const char *src, size_t le
 #define CAP_CLEAN    (1u<<0)
 #define CAP_SMUDGE   (1u<<1)
 #define CAP_DELAY    (1u<<2)
+#define CAP_PIPELINE (1u<<3)
 
 struct cmd2process {
 	struct subprocess_entry subprocess; /* must be the first member! */
@@ -748,6 +814,7 @@ static int start_multi_file_filter_fn(struct subprocess_entry *subprocess)
 		{ "clean",  CAP_CLEAN  },
 		{ "smudge", CAP_SMUDGE },
 		{ "delay",  CAP_DELAY  },
+		{ "pipeline", CAP_PIPELINE },
 		{ NULL, 0 }
 	};
 	struct cmd2process *entry = (struct cmd2process *)subprocess;
@@ -780,6 +847,235 @@ static void handle_filter_error(const struct strbuf *filter_status,
 	}
 }
 
+/*
+ * A process filter with the "pipeline" capability may be sent several
+ * "clean" requests before the first answer is read, and answers them
+ * in order.  When the caller announced the paths it is about to clean
+ * with start_clean_pipeline(), the requests for up to
+ * CLEAN_PIPELINE_BATCH of them are written by a separate thread, so
+ * that the filter works on the next files while we store the answers
+ * of the previous ones.
+ */
+#define CLEAN_PIPELINE_BATCH 64
+
+struct clean_pipeline {
+	struct string_list plan; /* paths to clean, in order */
+	struct strintmap plan_pos; /* path -> position in the plan */
+	size_t planned; /* the plan before this was sent or skipped */
+
+	/* the paths being sent, with their fd in util, and their writer */
+	struct string_list batch;
+	size_t answered;
+	struct async writer;
+	int writing;
+};
+
+/* process filter command -> struct clean_pipeline */
+static struct strmap clean_pipelines = STRMAP_INIT;
+
+static int write_clean_batch(int in, int out, void *data)
+{
+	struct clean_pipeline *pl = data;
+	struct strbuf header = STRBUF_INIT;
+	int err = 0;
+	size_t i;
+
+	for (i = 0; i < pl->batch.nr; i++) {
+		int fd = (int)(intptr_t)pl->batch.items[i].util;
+
+		if (!err) {
+			/* the static buffer of packet_write_fmt() is not ours */
+			strbuf_reset(&header);
+			packet_buf_write(&header, "command=clean\n");
+			packet_buf_write(&header, "pathname=%s\n",
+					 pl->batch.items[i].string);
+			packet_buf_flush(&header);
+			err = write_in_full(out, header.buf, header.len) < 0 ||
+			      write_packetized_from_fd_no_flush(fd, out) ||
+			      packet_flush_gently(out);
+		}
+		close(fd);
+	}
+	close(out);
+	strbuf_release(&header);
+	return err;
+}
+
+/*
+ * Open the files of the plan from 'pos' on, and start sending them.
+ * Files that cannot be opened are skipped; their callers will ask
+ * the filter themselves if they can read them after all.
+ */
+static void start_clean_batch(struct clean_pipeline *pl,
+			      struct cmd2process *entry, size_t pos)
+{
+	string_list_clear(&pl->batch, 0);
+	pl->answered = 0;
+
+	for (; pos < pl->plan.nr && pl->batch.nr < CLEAN_PIPELINE_BATCH; pos++) {
+		const char *path = pl->plan.items[pos].string;
+		int fd = open(path, O_RDONLY);
+
+		if (fd < 0)
+			continue;
+		string_list_append(&pl->batch, path)->util = (void *)(intptr_t)fd;
+	}
+	pl->planned = pos;
+	if (!pl->batch.nr)
+		return;
+
+	memset(&pl->writer, 0, sizeof(pl->writer));
+	pl->writer.proc = write_clean_batch;
+	pl->writer.data = pl;
+	pl->writer.out = dup(entry->subprocess.process.in);
+	if (pl->writer.out < 0) {
+		error_errno(_("cannot dup filter input"));
+		goto fail;
+	}
+
+	/* a write to a filter that died must not kill us */
+	sigchain_push(SIGPIPE, SIG_IGN);
+	if (start_async(&pl->writer)) {
+		sigchain_pop(SIGPIPE);
+		goto fail;
+	}
+	pl->writing = 1;
+	return;
+
+fail:
+	for (pos = 0; pos < pl->batch.nr; pos++)
+		close((int)(intptr_t)pl->batch.items[pos].util);
+	string_list_clear(&pl->batch, 0);
+}
+
+static int finish_clean_batch(struct clean_pipeline *pl)
+{
+	int err = 0;
+
+	if (pl->writing) {
+		err = finish_async(&pl->writer);
+		sigchain_pop(SIGPIPE);
+		pl->writing = 0;
+	}
+	string_list_clear(&pl->batch, 0);
+	pl->answered = 0;
+	return err;
+}
+
+static void free_clean_pipeline(const char *cmd, struct clean_pipeline *pl)
+{
+	finish_clean_batch(pl);
+	string_list_clear(&pl->plan, 0);
+	strintmap_clear(&pl->plan_pos);
+	strmap_remove(&clean_pipelines, cmd, 1);
+}
+
+/*
+ * Read the answer to the next request of the batch into 'dst', or
+ * throw it away if 'dst' is NULL.  Returns 1 if it was read, 0 if the
+ * filter could not clean that file, and -1 if it failed for good, in
+ * which case it was stopped and the pipeline freed.
+ */
+static int read_clean_answer(const char *cmd, struct clean_pipeline *pl,
+			     struct cmd2process *entry, struct strbuf *dst)
+{
+	struct child_process *process = &entry->subprocess.process;
+	struct strbuf nbuf = STRBUF_INIT;
+	struct strbuf filter_status = STRBUF_INIT;
+	int err;
+
+	pl->answered++;
+
+	err = subprocess_read_status(process->out, &filter_status);
+	if (!err)
+		err = strcmp(filter_status.buf, "success");
+	if (!err)
+		err = read_packetized_to_strbuf(process->out, &nbuf,
+						PACKET_READ_GENTLE_ON_EOF) < 0 ||
+		      subprocess_read_status(process->out, &filter_status) ||
+		      strcmp(filter_status.buf, "success");
+
+	if (!err) {
+		if (dst)
+			strbuf_swap(dst, &nbuf);
+	} else if (!strcmp(filter_status.buf, "error") ||
+		   !strcmp(filter_status.buf, "abort")) {
+		/* the answer was complete, only this file failed */
+		handle_filter_error(&filter_status, entry, CAP_CLEAN);
+	} else {
+		/* stop the writer before the filter goes away */
+		kill(process->pid, SIGTERM);
+		free_clean_pipeline(cmd, pl);
+		handle_filter_error(&filter_status, entry, CAP_CLEAN);
+		err = -1;
+	}
+	strbuf_release(&nbuf);
+	strbuf_release(&filter_status);
+	return err < 0 ? -1 : !err;
+}
+
+/*
+ * Discard the answers still in flight and stop sending, so that the
+ * filter can be asked something else.  Returns -1 if it failed.
+ */
+static int drain_clean_batch(const char *cmd, struct clean_pipeline *pl,
+			     struct cmd2process *entry)
+{
+	while (pl->answered < pl->batch.nr)
+		if (read_clean_answer(cmd, pl, entry, NULL) < 0)
+			return -1;
+	finish_clean_batch(pl);
+	return 0;
+}
+
+static int drain_clean_pipeline(const char *cmd, struct cmd2process *entry)
+{
+	struct clean_pipeline *pl = strmap_get(&clean_pipelines, cmd);
+
+	if (!pl || !pl->batch.nr)
+		return 0;
+	return drain_clean_batch(cmd, pl, entry);
+}
+
+/*
+ * Clean 'path' through the pipeline of 'cmd', if it is planned there.
+ * Returns -1 if it is not, and otherwise whether it was cleaned, like
+ * apply_multi_file_filter().
+ */
+static int apply_clean_pipeline(const char *cmd, struct cmd2process *entry,
+				const char *path, struct strbuf *dst)
+{
+	struct clean_pipeline *pl = strmap_get(&clean_pipelines, cmd);
+	size_t i;
+	int pos;
+
+	if (!pl)
+		return -1;
+
+	for (i = pl->answered; i < pl->batch.nr; i++)
+		if (!strcmp(pl->batch.items[i].string, path))
+			break;
+
+	if (i == pl->batch.nr) {
+		/* the answers in flight cannot be used either way */
+		if (drain_clean_batch(cmd, pl, entry) < 0)
+			return 0;
+		pos = strintmap_get(&pl->plan_pos, path);
+		if (pos < 0 || pos < pl->planned)
+			return -1;
+		start_clean_batch(pl, entry, pos);
+		if (!pl->batch.nr || strcmp(pl->batch.items[0].string, path))
+			return drain_clean_batch(cmd, pl, entry) < 0 ? 0 : -1;
+		i = 0;
+	}
+
+	/* skip the answers for files the caller did not ask about */
+	while (pl->answered < i)
+		if (read_clean_answer(cmd, pl, entry, NULL) < 0)
+			return 0;
+	return read_clean_answer(cmd, pl, entry, dst) > 0;
+}
+
 static int apply_multi_file_filter(const char *path, const char *src, size_t len,
 				   int fd, struct strbuf *dst, const char *cmd,
 				   const unsigned int wanted_capability,
@@ -818,6 +1114,15 @@ static int apply_multi_file_filter(const char *path, const char *src, size_t len
 	if (!(entry->supported_capabilities & wanted_capability))
 		return 0;
 
+	if ((wanted_capability & CAP_CLEAN) &&
+	    (entry->supported_capabilities & CAP_PIPELINE)) {
+		int ret = apply_clean_pipeline(cmd, entry, path, dst);
+		if (ret >= 0)
+			return ret;
+	} else if (drain_clean_pipeline(cmd, entry) < 0) {
+		return 0;
+	}
+
 	if (wanted_capability & CAP_CLEAN)
 		filter_type = "clean";
 	else if (wanted_capability & CAP_SMUDGE)
@@ -976,6 +1281,7 @@ static struct convert_driver {
 	const char *clean;
 	const char *process;
 	int required;
+	int parallel;
 } *user_convert, **user_convert_tail;
 
 static int apply_filter(const char *path, const char *src, size_t len,
@@ -1051,9 +1357,22 @@ static int read_convert_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp("parallel", key)) {
+		drv->parallel = git_config_bool(var, value);
+		return 0;
+	}
+
 	return 0;
 }
 
+static void read_convert_drivers(void)
+{
+	if (user_convert_tail)
+		return;
+	user_convert_tail = &user_convert;
+	git_config(read_convert_config, NULL);
+}
+
 static int count_ident(const char *cp, unsigned long size)
 {
 	/*
@@ -1063,10 +1382,12 @@ static int count_ident(const char *cp, unsigned long size)
 	char ch;
 
 	while (size) {
-		ch = *cp++;
-		size--;
-		if (ch != '$')
-			continue;
+		const char *dollar = memchr(cp, '$', size);
+
+		if (!dollar)
+			break;
+		size -= dollar + 1 - cp;
+		cp = dollar + 1;
 		if (size < 3)
 			break;
 		if (memcmp("Id", cp, 2))
@@ -1302,8 +1623,7 @@ void convert_attrs(struct index_state *istate,
 		check = attr_check_initl("crlf", "ident", "filter",
 					 "eol", "text", "working-tree-encoding",
 					 NULL);
-		user_convert_tail = &user_convert;
-		git_config(read_convert_config, NULL);
+		read_convert_drivers();
 	}
 
 	git_check_attr(istate, path, check);
@@ -1400,6 +1720,76 @@ const char *get_convert_attr_ascii(struct index_state *istate, const char *path)
 	return "";
 }
 
+int have_process_filters(void)
+{
+	struct convert_driver *drv;
+
+	read_convert_drivers();
+	for (drv = user_convert; drv; drv = drv->next)
+		if (drv->process && *drv->process)
+			return 1;
+	return 0;
+}
+
+void start_clean_pipeline(struct index_state *istate,
+			  const struct string_list *paths)
+{
+	size_t i;
+
+	if (!have_process_filters())
+		return;
+
+	for (i = 0; i < paths->nr; i++) {
+		const char *path = paths->items[i].string;
+		struct clean_pipeline *pl;
+		struct conv_attrs ca;
+
+		convert_attrs(istate, &ca, path);
+		if (!ca.drv || !ca.drv->process || !*ca.drv->process)
+			continue;
+		if (strlen(path) > LARGE_PACKET_DATA_MAX - strlen("pathname=\n"))
+			continue;
+
+		pl = strmap_get(&clean_pipelines, ca.drv->process);
+		if (!pl) {
+			CALLOC_ARRAY(pl, 1);
+			string_list_init(&pl->plan, 1);
+			strintmap_init(&pl->plan_pos, -1);
+			string_list_init(&pl->batch, 0);
+			strmap_put(&clean_pipelines, ca.drv->process, pl);
+		}
+		if (strintmap_contains(&pl->plan_pos, path))
+			continue;
+		strintmap_set(&pl->plan_pos, path, pl->plan.nr);
+		string_list_append(&pl->plan, path);
+	}
+}
+
+void finish_clean_pipeline(void)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct string_list cmds = STRING_LIST_INIT_DUP;
+	size_t i;
+
+	strmap_for_each_entry(&clean_pipelines, &iter, e)
+		string_list_append(&cmds, e->key);
+
+	for (i = 0; i < cmds.nr; i++) {
+		const char *cmd = cmds.items[i].string;
+		struct clean_pipeline *pl = strmap_get(&clean_pipelines, cmd);
+		struct cmd2process *entry = NULL;
+
+		if (subprocess_map_initialized)
+			entry = (struct cmd2process *)subprocess_find_entry(&subprocess_map, cmd);
+		if (entry && pl->answered < pl->batch.nr &&
+		    drain_clean_batch(cmd, pl, entry) < 0)
+			continue; /* already freed */
+		free_clean_pipeline(cmd, pl);
+	}
+	string_list_clear(&cmds, 0);
+}
+
 int convert_to_git(struct index_state *istate,
 		   const char *path, const char *src, size_t len,
 		   struct strbuf *dst, int conv_flags)
@@ -2015,6 +2405,28 @@ void clone_checkout_metadata(struct checkout_metadata *dst,
 		oidcpy(&dst->blob, blob);
 }
 
+const char *conv_attrs_filter_name(const struct conv_attrs *ca)
+{
+	return ca->drv ? ca->drv->name : NULL;
+}
+
+int conv_attrs_filter_is_parallel(const struct conv_attrs *ca)
+{
+	return ca->drv && ca->drv->parallel;
+}
+
+int conv_attrs_set_filter(struct conv_attrs *ca, const char *name)
+{
+	struct convert_driver *drv;
+
+	read_convert_drivers();
+	for (drv = user_convert; drv; drv = drv->next)
+		if (!strcmp(name, drv->name))
+			break;
+	ca->drv = drv;
+	return drv ? 0 : -1;
+}
+
 enum conv_attrs_classification classify_conv_attrs(const struct conv_attrs *ca)
 {
 	if (ca->drv) {
@@ -145,6 +145,22 @@ void convert_to_git_filter_fd(struct index_state *istate,
 int would_convert_to_git_filter_fd(struct index_state *istate,
 				   const char *path);
 
+/*
+ * Announce that the files at these paths are about to be converted
+ * with convert_to_git() or convert_to_git_filter_fd(), in this order,
+ * so that process filters with the "pipeline" capability can be sent
+ * several of them before the first one is needed.  Converting other
+ * files in between is allowed, but costs the requests in flight.
+ *
+ * finish_clean_pipeline() must be called after the last of them.
+ */
+void start_clean_pipeline(struct index_state *istate,
+			  const struct string_list *paths);
+void finish_clean_pipeline(void);
+
+/* Whether any filter.<driver>.process is configured. */
+int have_process_filters(void);
+
 /*
  * Initialize the checkout metadata with the given values.  Any argument may be
  * NULL if it is not applicable.  The treeish should be a commit if that is
@@ -233,4 +249,19 @@ enum conv_attrs_classification {
 enum conv_attrs_classification classify_conv_attrs(
 	const struct conv_attrs *ca);
 
+/* The name of the filter driver of `ca`, or NULL if it has none. */
+const char *conv_attrs_filter_name(const struct conv_attrs *ca);
+
+/*
+ * Whether the filter driver of `ca` may run as several instances at
+ * once (see `filter.<driver>.parallel`).
+ */
+int conv_attrs_filter_is_parallel(const struct conv_attrs *ca);
+
+/*
+ * Make the filter driver `name` that of `ca`. Return -1 and leave `ca`
+ * without a driver if there is no such driver.
+ */
+int conv_attrs_set_filter(struct conv_attrs *ca, const char *name);
+
 #endif /* CONVERT_H */
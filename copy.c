@@ -1,7 +1,37 @@
 #include "cache.h"
+#ifdef HAVE_FICLONE
+#include <linux/fs.h>
+#endif
+
+#define COPY_RANGE_SIZE (8 * 1024 * 1024)
+
+/*
+ * Let the kernel copy what is left of ifd, which saves the trip
+ * through user space and lets filesystems that can share or copy
+ * extents on their own do so. Return 0 when done, 1 when the rest has
+ * to be copied by hand, e.g. because the files are not on the same
+ * kind of filesystem or one of them is a pipe.
+ */
+static int copy_fd_range(int ifd, int ofd)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+	while (1) {
+		ssize_t len = copy_file_range(ifd, NULL, ofd, NULL,
+					      COPY_RANGE_SIZE, 0);
+		if (!len)
+			return 0;
+		if (len < 0)
+			return 1;
+	}
+#else
+	return 1;
+#endif
+}
 
 int copy_fd(int ifd, int ofd)
 {
+	if (!copy_fd_range(ifd, ofd))
+		return 0;
 	while (1) {
 		char buffer[8192];
 		ssize_t len = xread(ifd, buffer, sizeof(buffer));
@@ -39,7 +69,13 @@ int copy_file(const char *dst, const char *src, int mode)
 		close(fdi);
 		return fdo;
 	}
-	status = copy_fd(fdi, fdo);
+#ifdef HAVE_FICLONE
+	/* share the data with the source if the filesystem can */
+	if (!ioctl(fdo, FICLONE, fdi))
+		status = 0;
+	else
+#endif
+		status = copy_fd(fdi, fdo);
 	switch (status) {
 	case COPY_READ_ERROR:
 		error_errno("copy-fd: read returned");
@@ -10,18 +10,166 @@
 #include "cache.h"
 #include "progress.h"
 #include "csum-file.h"
+#include "lockfile.h"
+#include "strmap.h"
+#include "thread-utils.h"
+
+struct hashfile_writer {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int fd;
+
+	/* The buffer the thread is writing out, or NULL when it is idle. */
+	const unsigned char *pending;
+	unsigned int pending_len;
+
+	/* The buffer that is not being filled. */
+	unsigned char *spare;
+
+	/* Set to make the thread exit once it is idle. */
+	int done;
+
+	/* errno of a failed write, or -1 if the disk was full */
+	int err;
+};
+
+static void *hashfile_writer_thread(void *data)
+{
+	struct hashfile_writer *w = data;
+
+	pthread_mutex_lock(&w->mutex);
+	for (;;) {
+		const unsigned char *buf;
+		unsigned int count;
+
+		while (!w->pending && !w->done)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		if (!w->pending)
+			break;
+		buf = w->pending;
+		count = w->pending_len;
+		pthread_mutex_unlock(&w->mutex);
+
+		while (count) {
+			ssize_t ret = xwrite(w->fd, buf, count);
+			if (ret <= 0) {
+				pthread_mutex_lock(&w->mutex);
+				w->err = ret ? errno : -1;
+				pthread_mutex_unlock(&w->mutex);
+				break;
+			}
+			buf += ret;
+			count -= ret;
+		}
+
+		pthread_mutex_lock(&w->mutex);
+		w->pending = NULL;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	return NULL;
+}
+
+static void start_writer(struct hashfile *f)
+{
+	struct hashfile_writer *w;
+	int err;
+
+	CALLOC_ARRAY(w, 1);
+	w->fd = f->fd;
+	w->spare = xmalloc(f->buffer_len);
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	err = pthread_create(&w->thread, NULL, hashfile_writer_thread, w);
+	if (err) {
+		/* write synchronously instead */
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->mutex);
+		free(w->spare);
+		free(w);
+		return;
+	}
+	f->writer = w;
+}
+
+/*
+ * Wait until the writer thread is idle, and die if it failed to write
+ * out what it was given.
+ */
+static void wait_for_writer(struct hashfile *f)
+{
+	struct hashfile_writer *w = f->writer;
+	int err;
+
+	if (!w)
+		return;
+	pthread_mutex_lock(&w->mutex);
+	while (w->pending)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	err = w->err;
+	pthread_mutex_unlock(&w->mutex);
+
+	if (err < 0)
+		die("sha1 file '%s' write error. Out of diskspace", f->name);
+	if (err) {
+		errno = err;
+		die_errno("sha1 file '%s' write error", f->name);
+	}
+}
+
+static void stop_writer(struct hashfile *f)
+{
+	struct hashfile_writer *w = f->writer;
+
+	if (!w)
+		return;
+	wait_for_writer(f);
+	pthread_mutex_lock(&w->mutex);
+	w->done = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	pthread_join(w->thread, NULL);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+	free(w->spare);
+	free(w);
+	f->writer = NULL;
+}
+
+/*
+ * Hand the full buffer to the writer thread and continue with the
+ * other one.
+ */
+static void submit_to_writer(struct hashfile *f, unsigned int count)
+{
+	struct hashfile_writer *w = f->writer;
+	unsigned char *buf = f->buffer;
+
+	wait_for_writer(f);
+	f->buffer = w->spare;
+	w->spare = buf;
+
+	pthread_mutex_lock(&w->mutex);
+	w->pending = buf;
+	w->pending_len = count;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+
+	f->total += count;
+	display_throughput(f->tp, f->total);
+}
 
 static void flush(struct hashfile *f, const void *buf, unsigned int count)
 {
 	if (0 <= f->check_fd && count)  {
-		unsigned char check_buffer[8192];
-		ssize_t ret = read_in_full(f->check_fd, check_buffer, count);
+		ssize_t ret = read_in_full(f->check_fd, f->check_buffer, count);
 
 		if (ret < 0)
 			die_errno("%s: sha1 file read error", f->name);
 		if (ret != count)
 			die("%s: sha1 file truncated", f->name);
-		if (memcmp(buf, check_buffer, count))
+		if (memcmp(buf, f->check_buffer, count))
 			die("sha1 file '%s' validation error", f->name);
 	}
 
@@ -48,16 +196,31 @@ void hashflush(struct hashfile *f)
 
 	if (offset) {
 		the_hash_algo->update_fn(&f->ctx, f->buffer, offset);
-		flush(f, f->buffer, offset);
+		if (!f->writer && HAVE_THREADS && hashfile_write_thread &&
+		    f->check_fd < 0 && offset == f->buffer_len)
+			start_writer(f);
+		if (f->writer)
+			submit_to_writer(f, offset);
+		else
+			flush(f, f->buffer, offset);
 		f->offset = 0;
 	}
 }
 
+void free_hashfile(struct hashfile *f)
+{
+	stop_writer(f);
+	free(f->buffer);
+	free(f->check_buffer);
+	free(f);
+}
+
 int finalize_hashfile(struct hashfile *f, unsigned char *result, unsigned int flags)
 {
 	int fd;
 
 	hashflush(f);
+	stop_writer(f);
 	the_hash_algo->final_fn(f->buffer, &f->ctx);
 	if (result)
 		hashcpy(result, f->buffer);
@@ -82,25 +245,27 @@ int finalize_hashfile(struct hashfile *f, unsigned char *result, unsigned int fl
 		if (close(f->check_fd))
 			die_errno("%s: sha1 file error on close", f->name);
 	}
-	free(f);
+	free_hashfile(f);
 	return fd;
 }
 
 void hashwrite(struct hashfile *f, const void *buf, unsigned int count)
 {
 	while (count) {
-		unsigned left = sizeof(f->buffer) - f->offset;
+		unsigned left = f->buffer_len - f->offset;
 		unsigned nr = count > left ? left : count;
 
 		if (f->do_crc)
 			f->crc32 = crc32(f->crc32, buf, nr);
 
-		if (nr == sizeof(f->buffer)) {
+		if (nr == f->buffer_len && !f->writer) {
 			/*
 			 * Flush a full batch worth of data directly
 			 * from the input, skipping the memcpy() to
 			 * the hashfile's buffer. In this block,
-			 * f->offset is necessarily zero.
+			 * f->offset is necessarily zero. The writer
+			 * thread cannot be handed the caller's data,
+			 * which may change once we return.
 			 */
 			the_hash_algo->update_fn(&f->ctx, buf, nr);
 			flush(f, buf, nr);
@@ -121,9 +286,31 @@ void hashwrite(struct hashfile *f, const void *buf, unsigned int count)
 	}
 }
 
+static struct hashfile *hashfd_internal(int fd, const char *name,
+					struct progress *tp,
+					size_t buffer_len)
+{
+	struct hashfile *f = xmalloc(sizeof(*f));
+	f->fd = fd;
+	f->check_fd = -1;
+	f->offset = 0;
+	f->total = 0;
+	f->tp = tp;
+	f->name = name;
+	f->do_crc = 0;
+	the_hash_algo->init_fn(&f->ctx);
+
+	f->buffer_len = buffer_len;
+	f->buffer = xmalloc(buffer_len);
+	f->check_buffer = NULL;
+	f->writer = NULL;
+
+	return f;
+}
+
 struct hashfile *hashfd(int fd, const char *name)
 {
-	return hashfd_throughput(fd, name, NULL);
+	return hashfd_internal(fd, name, NULL, hashfile_buffer_size);
 }
 
 struct hashfile *hashfd_check(const char *name)
@@ -137,28 +324,26 @@ struct hashfile *hashfd_check(const char *name)
 	check = open(name, O_RDONLY);
 	if (check < 0)
 		die_errno("unable to open '%s'", name);
-	f = hashfd(sink, name);
+
+	/*
+	 * Every flush reads as much back from the file as it writes, so
+	 * a large buffer would only cost memory here.
+	 */
+	f = hashfd_internal(sink, name, NULL, 8 * 1024);
 	f->check_fd = check;
+	f->check_buffer = xmalloc(f->buffer_len);
 	return f;
 }
 
 struct hashfile *hashfd_throughput(int fd, const char *name, struct progress *tp)
 {
-	struct hashfile *f = xmalloc(sizeof(*f));
-	f->fd = fd;
-	f->check_fd = -1;
-	f->offset = 0;
-	f->total = 0;
-	f->tp = tp;
-	f->name = name;
-	f->do_crc = 0;
-	the_hash_algo->init_fn(&f->ctx);
-	return f;
+	return hashfd_internal(fd, name, tp, hashfile_buffer_size);
 }
 
 void hashfile_checkpoint(struct hashfile *f, struct hashfile_checkpoint *checkpoint)
 {
 	hashflush(f);
+	wait_for_writer(f);
 	checkpoint->offset = f->total;
 	the_hash_algo->clone_fn(&checkpoint->ctx, &f->ctx);
 }
@@ -167,6 +352,7 @@ int hashfile_truncate(struct hashfile *f, struct hashfile_checkpoint *checkpoint
 {
 	off_t offset = checkpoint->offset;
 
+	wait_for_writer(f);
 	if (ftruncate(f->fd, offset) ||
 	    lseek(f->fd, offset, SEEK_SET) != offset)
 		return -1;
@@ -187,3 +373,187 @@ uint32_t crc32_end(struct hashfile *f)
 	f->do_crc = 0;
 	return f->crc32;
 }
+
+/*
+ * Files whose trailing checksum we verified, remembered together with
+ * the stat data they had at the time, in "$GIT_COMMON_DIR/checksum-cache".
+ * Each line reads "<checksum> <ino> <size> <mtime-sec> <mtime-nsec> <path>".
+ */
+struct checksum_cache_entry {
+	struct object_id checksum;
+	uintmax_t ino;
+	uintmax_t size;
+	uintmax_t sec;
+	unsigned int nsec;
+};
+
+static struct strmap checksum_cache = STRMAP_INIT;
+static int checksum_cache_loaded;
+
+static void fill_checksum_cache_entry(struct checksum_cache_entry *e,
+				      const struct stat *st,
+				      const unsigned char *checksum)
+{
+	oidread(&e->checksum, checksum);
+	e->ino = st->st_ino;
+	e->size = st->st_size;
+	e->sec = st->st_mtime;
+	e->nsec = ST_MTIME_NSEC(*st);
+}
+
+static int checksum_cache_entry_eq(const struct checksum_cache_entry *a,
+				   const struct checksum_cache_entry *b)
+{
+	return oideq(&a->checksum, &b->checksum) &&
+		a->ino == b->ino && a->size == b->size &&
+		a->sec == b->sec && a->nsec == b->nsec;
+}
+
+static int parse_checksum_cache_field(const char **p, uintmax_t *value)
+{
+	char *end;
+
+	if (!isdigit(**p))
+		return -1;
+	errno = 0;
+	*value = strtoumax(*p, &end, 10);
+	if (errno || *end != ' ')
+		return -1;
+	*p = end + 1;
+	return 0;
+}
+
+static void load_checksum_cache(void)
+{
+	struct strbuf line = STRBUF_INIT;
+	FILE *fp;
+
+	if (checksum_cache_loaded)
+		return;
+	checksum_cache_loaded = 1;
+
+	fp = fopen(git_common_path("checksum-cache"), "r");
+	if (!fp)
+		return;
+	while (strbuf_getline_lf(&line, fp) != EOF) {
+		struct checksum_cache_entry *e = xcalloc(1, sizeof(*e));
+		uintmax_t nsec;
+		const char *p;
+
+		if (parse_oid_hex(line.buf, &e->checksum, &p) ||
+		    *p++ != ' ' ||
+		    parse_checksum_cache_field(&p, &e->ino) ||
+		    parse_checksum_cache_field(&p, &e->size) ||
+		    parse_checksum_cache_field(&p, &e->sec) ||
+		    parse_checksum_cache_field(&p, &nsec) ||
+		    !*p) {
+			free(e);
+			continue;
+		}
+		e->nsec = nsec;
+		free(strmap_put(&checksum_cache, p, e));
+	}
+	strbuf_release(&line);
+	fclose(fp);
+}
+
+static void write_checksum_cache(void)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct strmap_entry *ent;
+
+	if (hold_lock_file_for_update(&lk, git_common_path("checksum-cache"),
+				      0) < 0)
+		return;
+
+	strmap_for_each_entry(&checksum_cache, &iter, ent) {
+		const struct checksum_cache_entry *e = ent->value;
+		struct checksum_cache_entry cur;
+		struct stat st;
+
+		/* Forget files that went away or changed since. */
+		if (stat(ent->key, &st))
+			continue;
+		fill_checksum_cache_entry(&cur, &st, e->checksum.hash);
+		if (!checksum_cache_entry_eq(e, &cur))
+			continue;
+		strbuf_addf(&buf, "%s %"PRIuMAX" %"PRIuMAX" %"PRIuMAX" %u %s\n",
+			    oid_to_hex(&e->checksum), e->ino, e->size,
+			    e->sec, e->nsec, ent->key);
+	}
+
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0)
+		rollback_lock_file(&lk);
+	else
+		commit_lock_file(&lk);
+	strbuf_release(&buf);
+}
+
+int hashfile_checksum_trusted(const char *path, const unsigned char *checksum)
+{
+	struct checksum_cache_entry cur, *e;
+	struct stat st;
+	char *abspath;
+	int ret = 0;
+
+	if (checksum_trust == CHECKSUM_TRUST_PARANOID || !startup_info ||
+	    !startup_info->have_repository)
+		return 0;
+	if (stat(path, &st))
+		return 0;
+
+	load_checksum_cache();
+	abspath = absolute_pathdup(path);
+	e = strmap_get(&checksum_cache, abspath);
+	if (e) {
+		fill_checksum_cache_entry(&cur, &st, checksum);
+		ret = checksum_cache_entry_eq(e, &cur);
+	}
+	free(abspath);
+	return ret;
+}
+
+void hashfile_checksum_trust(const char *path, const unsigned char *checksum)
+{
+	struct checksum_cache_entry *e;
+	struct stat st;
+
+	if (checksum_trust == CHECKSUM_TRUST_PARANOID || !startup_info ||
+	    !startup_info->have_repository)
+		return;
+	if (stat(path, &st))
+		return;
+
+	load_checksum_cache();
+	e = xmalloc(sizeof(*e));
+	fill_checksum_cache_entry(e, &st, checksum);
+	free(strmap_put(&checksum_cache, absolute_path(path), e));
+	write_checksum_cache();
+}
+
+int hashfile_checksum_valid(const char *path,
+			    const unsigned char *data, size_t len)
+{
+	unsigned char hash[GIT_MAX_RAWSZ];
+	const unsigned char *checksum;
+	git_hash_ctx ctx;
+
+	if (len < the_hash_algo->rawsz)
+		return 0;
+	len -= the_hash_algo->rawsz;
+	checksum = data + len;
+
+	if (hashfile_checksum_trusted(path, checksum))
+		return 1;
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, data, len);
+	the_hash_algo->final_fn(hash, &ctx);
+	if (!hasheq(hash, checksum))
+		return 0;
+
+	hashfile_checksum_trust(path, checksum);
+	return 1;
+}
@@ -4,6 +4,7 @@
 #include "hash.h"
 
 struct progress;
+struct hashfile_writer;
 
 /* A SHA1-protected file */
 struct hashfile {
@@ -16,7 +17,16 @@ struct hashfile {
 	const char *name;
 	int do_crc;
 	uint32_t crc32;
-	unsigned char buffer[8192];
+	size_t buffer_len;
+	unsigned char *buffer;
+	unsigned char *check_buffer;
+
+	/*
+	 * Once a file outgrows its buffer, a thread writes out each full
+	 * buffer while the next one is filled and hashed (unless
+	 * core.hashfileWriteThread is false).
+	 */
+	struct hashfile_writer *writer;
 };
 
 /* Checkpoint */
@@ -37,11 +47,34 @@ struct hashfile *hashfd(int fd, const char *name);
 struct hashfile *hashfd_check(const char *name);
 struct hashfile *hashfd_throughput(int fd, const char *name, struct progress *tp);
 int finalize_hashfile(struct hashfile *, unsigned char *, unsigned int);
+/* Release a hashfile without finalizing it; its fd is left open. */
+void free_hashfile(struct hashfile *);
 void hashwrite(struct hashfile *, const void *, unsigned int);
 void hashflush(struct hashfile *f);
 void crc32_begin(struct hashfile *);
 uint32_t crc32_end(struct hashfile *);
 
+/*
+ * Verifying the trailing checksum of a large file means rehashing all of
+ * it. Unless core.checksumTrust is "paranoid", a file whose checksum was
+ * verified once is remembered along with its stat data, and not rehashed
+ * again until it changes.
+ *
+ * hashfile_checksum_trusted() returns 1 if the file at `path` was
+ * verified to end with `checksum` and has not changed since, and
+ * hashfile_checksum_trust() records that it was.
+ */
+int hashfile_checksum_trusted(const char *path, const unsigned char *checksum);
+void hashfile_checksum_trust(const char *path, const unsigned char *checksum);
+
+/*
+ * Returns 1 if the last hash-sized bytes of the `len` bytes at `data`,
+ * which are the contents of the file at `path`, are the checksum of
+ * everything before them, and 0 otherwise.
+ */
+int hashfile_checksum_valid(const char *path,
+			    const unsigned char *data, size_t len);
+
 /*
  * Returns the total number of bytes fed to the hashfile so far (including ones
  * that have not been written out to the descriptor yet).
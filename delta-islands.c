@@ -19,6 +19,7 @@
 #include "delta-islands.h"
 #include "oid-array.h"
 #include "config.h"
+#include "shallow.h"
 
 KHASH_INIT(str, const char *, void *, 1, kh_str_hash_func, kh_str_hash_equal)
 
@@ -26,6 +27,14 @@ static kh_oid_map_t *island_marks;
 static unsigned island_counter;
 static unsigned island_counter_core;
 
+/*
+ * Set when the marks were computed from reachability bitmaps, in which
+ * case every object reachable from an island is already fully marked and
+ * there is nothing left to propagate during the traversal.
+ */
+static int island_marks_complete;
+static int island_use_bitmaps = 1;
+
 static kh_str_t *remote_islands;
 
 struct remote_island {
@@ -161,13 +170,14 @@ static struct island_bitmap *create_or_get_island_marks(struct object *obj)
 	return kh_value(island_marks, pos);
 }
 
-static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+static void set_island_marks(const struct object_id *oid,
+			     struct island_bitmap *marks)
 {
 	struct island_bitmap *b;
 	khiter_t pos;
 	int hash_ret;
 
-	pos = kh_put_oid_map(island_marks, obj->oid, &hash_ret);
+	pos = kh_put_oid_map(island_marks, *oid, &hash_ret);
 	if (hash_ret) {
 		/*
 		 * We don't have one yet; make a copy-on-write of the
@@ -248,7 +258,7 @@ void resolve_tree_islands(struct repository *r,
 	int nr = 0;
 	int i;
 
-	if (!island_marks)
+	if (!island_marks || island_marks_complete)
 		return;
 
 	/*
@@ -300,7 +310,7 @@ void resolve_tree_islands(struct repository *r,
 			if (!obj)
 				continue;
 
-			set_island_marks(obj, root_marks);
+			set_island_marks(&obj->oid, root_marks);
 		}
 
 		free_tree_buffer(tree);
@@ -341,6 +351,11 @@ static int island_config_callback(const char *k, const char *v, void *cb)
 	if (!strcmp(k, "pack.islandcore"))
 		return git_config_string(&core_island_name, k, v);
 
+	if (!strcmp(k, "pack.usebitmaps")) {
+		island_use_bitmaps = git_config_bool(k, v);
+		return 0;
+	}
+
 	return 0;
 }
 
@@ -419,6 +434,161 @@ static struct remote_island *get_core_island(void)
 	return NULL;
 }
 
+#define island_bitmap_ptr_hash(p) ((khint_t)((uintptr_t)(p) >> 4))
+#define island_bitmap_ptr_equal(a, b) ((a) == (b))
+
+KHASH_INIT(island_split, struct island_bitmap *, struct island_bitmap *, 1,
+	   island_bitmap_ptr_hash, island_bitmap_ptr_equal)
+
+static void island_bitmap_unref(struct island_bitmap *b)
+{
+	if (b && !--b->refcount)
+		free(b);
+}
+
+/*
+ * Add island "island" to the marks of every object set in "reachable".
+ * Objects that had the same marks before end up sharing the same marks
+ * afterwards, so there are only as many distinct marks as there are
+ * distinct combinations of islands.
+ */
+static void add_island_from_bitmap(struct island_bitmap **marks,
+				   struct bitmap *reachable,
+				   uint32_t island)
+{
+	kh_island_split_t *split = kh_init_island_split();
+	size_t i;
+
+	for (i = 0; i < reachable->word_alloc; i++) {
+		eword_t word = reachable->words[i];
+		unsigned offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			struct island_bitmap *old, *new;
+			size_t pos;
+			khiter_t hash_pos;
+			int hash_ret;
+
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+			pos = i * BITS_IN_EWORD + offset;
+
+			old = marks[pos];
+			hash_pos = kh_put_island_split(split, old, &hash_ret);
+			if (hash_ret) {
+				new = island_bitmap_new(old);
+				island_bitmap_set(new, island);
+				new->refcount = 0;
+				kh_value(split, hash_pos) = new;
+			}
+			new = kh_value(split, hash_pos);
+
+			new->refcount++;
+			island_bitmap_unref(old);
+			marks[pos] = new;
+		}
+	}
+
+	kh_destroy_island_split(split);
+}
+
+struct saved_flags {
+	struct object *obj;
+	unsigned flags;
+};
+
+/*
+ * Compute the island marks of every object reachable from "list" using
+ * the reachability bitmaps, with one bitmap per island. Returns 0 if
+ * there are no bitmaps to use, in which case the marks are left to be
+ * propagated during the traversal as usual.
+ */
+static int mark_islands_from_bitmap(struct repository *r,
+				    struct remote_island **list,
+				    unsigned int island_count)
+{
+	struct bitmap_index *bitmap_git;
+	struct island_bitmap **marks = NULL;
+	struct saved_flags *saved = NULL;
+	size_t saved_nr = 0, saved_alloc = 0;
+	uint32_t marks_nr = 0, nr, marked = 0;
+	unsigned int i, j;
+
+	if (!island_use_bitmaps || is_repository_shallow(r) ||
+	    r->parsed_objects->grafts_nr)
+		return 0;
+
+	bitmap_git = prepare_bitmap_git(r);
+	if (!bitmap_git)
+		return 0;
+
+	/*
+	 * The walk for tips that are not covered by a bitmap must not be
+	 * confused by flags our caller has already set up (e.g., its
+	 * UNINTERESTING tips), so stash them for the duration.
+	 */
+	nr = get_max_object_index();
+	for (i = 0; i < nr; i++) {
+		struct object *obj = get_indexed_object(i);
+
+		if (!obj || !(obj->flags & ALL_REV_FLAGS))
+			continue;
+		ALLOC_GROW(saved, saved_nr + 1, saved_alloc);
+		saved[saved_nr].obj = obj;
+		saved[saved_nr].flags = obj->flags & ALL_REV_FLAGS;
+		saved_nr++;
+	}
+	clear_object_flags(ALL_REV_FLAGS);
+
+	for (i = 0; i < island_count; i++) {
+		struct object_list *tips = NULL;
+		struct bitmap *reachable;
+
+		for (j = 0; j < list[i]->oids.nr; j++) {
+			struct object *obj = parse_object(r, &list[i]->oids.oid[j]);
+			if (obj)
+				object_list_insert(obj, &tips);
+		}
+
+		reachable = bitmap_reachable_from(bitmap_git, r, tips);
+		object_list_free(&tips);
+		clear_object_flags(ALL_REV_FLAGS);
+
+		nr = bitmap_num_positions(bitmap_git);
+		if (nr > marks_nr) {
+			REALLOC_ARRAY(marks, nr);
+			memset(marks + marks_nr, 0,
+			       (nr - marks_nr) * sizeof(*marks));
+			marks_nr = nr;
+		}
+
+		add_island_from_bitmap(marks, reachable, i);
+		bitmap_free(reachable);
+	}
+
+	for (i = 0; i < saved_nr; i++)
+		saved[i].obj->flags |= saved[i].flags;
+	free(saved);
+
+	for (nr = 0; nr < marks_nr; nr++) {
+		struct object_id oid;
+
+		if (!marks[nr])
+			continue;
+
+		bitmap_position_to_oid(bitmap_git, nr, &oid);
+		set_island_marks(&oid, marks[nr]);
+		island_bitmap_unref(marks[nr]);
+		marked++;
+	}
+	trace2_data_intmax("delta-islands", r, "bitmap_marked_objects", marked);
+
+	free(marks);
+	free_bitmap_index(bitmap_git);
+	return 1;
+}
+
 static void deduplicate_islands(struct repository *r)
 {
 	struct remote_island *island, *core = NULL, **list;
@@ -451,6 +621,9 @@ static void deduplicate_islands(struct repository *r)
 		mark_remote_island_1(r, list[i], core && list[i]->hash == core->hash);
 	}
 
+	if (island_count)
+		island_marks_complete = mark_islands_from_bitmap(r, list, island_count);
+
 	free(list);
 }
 
@@ -469,16 +642,21 @@ void load_delta_islands(struct repository *r, int progress)
 
 void propagate_island_marks(struct commit *commit)
 {
-	khiter_t pos = kh_get_oid_map(island_marks, commit->object.oid);
+	khiter_t pos;
+
+	if (island_marks_complete)
+		return;
+
+	pos = kh_get_oid_map(island_marks, commit->object.oid);
 
 	if (pos < kh_end(island_marks)) {
 		struct commit_list *p;
 		struct island_bitmap *root_marks = kh_value(island_marks, pos);
 
 		parse_commit(commit);
-		set_island_marks(&get_commit_tree(commit)->object, root_marks);
+		set_island_marks(get_commit_tree_oid(commit), root_marks);
 		for (p = commit->parents; p; p = p->next)
-			set_island_marks(&p->item->object, root_marks);
+			set_island_marks(&p->item->object.oid, root_marks);
 	}
 }
 
@@ -314,6 +314,31 @@ unsigned long sizeof_delta_index(struct delta_index *index)
  */
 #define MAX_OP_SIZE	(5 + 5 + 1 + RABIN_WINDOW + 7)
 
+/*
+ * Return how many of the first "max" bytes of "a" and "b" are equal.
+ * Matches tend to be long, so compare a word at a time and only look
+ * at individual bytes in the word that differs; memcpy() keeps the
+ * loads safe for unaligned buffers and compiles down to plain loads.
+ */
+static inline size_t match_length(const unsigned char *a,
+				  const unsigned char *b, size_t max)
+{
+	size_t len = 0;
+
+	while (max - len >= sizeof(size_t)) {
+		size_t wa, wb;
+
+		memcpy(&wa, a + len, sizeof(wa));
+		memcpy(&wb, b + len, sizeof(wb));
+		if (wa != wb)
+			break;
+		len += sizeof(size_t);
+	}
+	while (len < max && a[len] == b[len])
+		len++;
+	return len;
+}
+
 void *
 create_delta(const struct delta_index *index,
 	     const void *trg_buf, unsigned long trg_size,
@@ -378,19 +403,18 @@ create_delta(const struct delta_index *index,
 			i = val & index->hash_mask;
 			for (entry = index->hash[i]; entry < index->hash[i+1]; entry++) {
 				const unsigned char *ref = entry->ptr;
-				const unsigned char *src = data;
 				unsigned int ref_size = ref_top - ref;
+				size_t len;
 				if (entry->val != val)
 					continue;
-				if (ref_size > top - src)
-					ref_size = top - src;
+				if (ref_size > top - data)
+					ref_size = top - data;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
-				if (msize < ref - entry->ptr) {
+				len = match_length(ref, data, ref_size);
+				if (msize < len) {
 					/* this is our best match so far */
-					msize = ref - entry->ptr;
+					msize = len;
 					moff = entry->ptr - ref_data;
 					if (msize >= 4096) /* good enough */
 						break;
@@ -2,6 +2,7 @@
  * Copyright (C) 2005 Junio C Hamano
  */
 #include "cache.h"
+#include "config.h"
 #include "quote.h"
 #include "commit.h"
 #include "diff.h"
@@ -14,6 +15,7 @@
 #include "dir.h"
 #include "fsmonitor.h"
 #include "commit-reach.h"
+#include "racy-cache.h"
 
 /*
  * diff-files
@@ -66,11 +68,16 @@ static int check_removed(const struct index_state *istate, const struct cache_en
  * option is set, the caller does not only want to know if a submodule is
  * modified at all but wants to know all the conditions that are met (new
  * commits, untracked content and/or modified content).
+ *
+ * If `defer` is given, a submodule whose work tree needs to be looked
+ * at is not looked at right away; instead `defer` is set up for
+ * get_submodules_status(), and `defer->path` left NULL otherwise.
  */
 static int match_stat_with_submodule(struct diff_options *diffopt,
 				     const struct cache_entry *ce,
 				     struct stat *st, unsigned ce_option,
-				     unsigned *dirty_submodule)
+				     unsigned *dirty_submodule,
+				     struct submodule_status *defer)
 {
 	int changed = ie_match_stat(diffopt->repo->index, ce, st, ce_option);
 	if (S_ISGITLINK(ce->ce_mode)) {
@@ -80,14 +87,80 @@ static int match_stat_with_submodule(struct diff_options *diffopt,
 		if (diffopt->flags.ignore_submodules)
 			changed = 0;
 		else if (!diffopt->flags.ignore_dirty_submodules &&
-			 (!changed || diffopt->flags.dirty_submodules))
-			*dirty_submodule = is_submodule_modified(ce->name,
-								 diffopt->flags.ignore_untracked_in_submodules);
+			 (!changed || diffopt->flags.dirty_submodules)) {
+			int ignore_untracked =
+				diffopt->flags.ignore_untracked_in_submodules;
+
+			if (defer) {
+				defer->path = ce->name;
+				defer->ignore_untracked = ignore_untracked;
+			} else {
+				*dirty_submodule = is_submodule_modified(ce->name,
+									 ignore_untracked);
+			}
+		}
 		diffopt->flags = orig_flags;
 	}
 	return changed;
 }
 
+/*
+ * A submodule whose work tree run_diff_files() looks at once it has
+ * gone through all the other entries, so that it can look at several
+ * at the same time.
+ */
+struct deferred_submodule {
+	struct cache_entry *ce;
+	unsigned int newmode;
+	int changed;
+};
+
+static void diff_deferred_submodules(struct rev_info *revs,
+				     struct submodule_status *submodules,
+				     size_t nr, int jobs)
+{
+	struct index_state *istate = revs->diffopt.repo->index;
+	size_t i;
+
+	trace2_region_enter_printf("diff", "submodule-status", revs->repo,
+				   "nr:%"PRIuMAX" max:%d", (uintmax_t)nr, jobs);
+	get_submodules_status(submodules, nr, jobs);
+	trace2_region_leave("diff", "submodule-status", revs->repo);
+
+	for (i = 0; i < nr; i++) {
+		struct deferred_submodule *d = submodules[i].util;
+		unsigned dirty_submodule = submodules[i].dirty_submodule;
+		struct cache_entry *ce = d->ce;
+
+		if (!d->changed && !dirty_submodule) {
+			ce_mark_uptodate(ce);
+			mark_fsmonitor_valid(istate, ce);
+			if (!revs->diffopt.flags.find_copies_harder)
+				continue;
+		}
+		diff_change(&revs->diffopt, ce->ce_mode, d->newmode,
+			    &ce->oid, d->changed ? null_oid() : &ce->oid,
+			    !is_null_oid(&ce->oid), !d->changed,
+			    ce->name, 0, dirty_submodule);
+	}
+
+	/* put the submodules back where they belong among the other paths */
+	diffcore_fix_diff_index();
+}
+
+/*
+ * How many submodules run_diff_files() may look at in parallel, from
+ * "submodule.diffJobs".
+ */
+static int submodule_diff_jobs(struct repository *r)
+{
+	int jobs = 1;
+
+	if (!repo_config_get_int(r, "submodule.diffjobs", &jobs) && jobs < 0)
+		die(_("negative values not allowed for submodule.diffJobs"));
+	return jobs ? jobs : online_cpus();
+}
+
 int run_diff_files(struct rev_info *revs, unsigned int option)
 {
 	int entries, i;
@@ -96,6 +169,9 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 			      ? CE_MATCH_RACY_IS_DIRTY : 0);
 	uint64_t start = getnanotime();
 	struct index_state *istate = revs->diffopt.repo->index;
+	int submodule_jobs = submodule_diff_jobs(revs->diffopt.repo);
+	struct submodule_status *submodules = NULL;
+	size_t submodules_nr = 0, submodules_alloc = 0;
 
 	diff_set_mnemonic_prefix(&revs->diffopt, "i/", "w/");
 
@@ -236,8 +312,32 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 				continue;
 			}
 
-			changed = match_stat_with_submodule(&revs->diffopt, ce, &st,
-							    ce_option, &dirty_submodule);
+			if (submodule_jobs > 1) {
+				struct submodule_status defer = { NULL };
+
+				changed = match_stat_with_submodule(&revs->diffopt,
+								    ce, &st, ce_option,
+								    &dirty_submodule,
+								    &defer);
+				if (defer.path) {
+					struct deferred_submodule *d;
+
+					CALLOC_ARRAY(d, 1);
+					d->ce = ce;
+					d->changed = changed;
+					d->newmode = ce_mode_from_stat(ce, st.st_mode);
+					defer.util = d;
+					ALLOC_GROW(submodules, submodules_nr + 1,
+						   submodules_alloc);
+					submodules[submodules_nr++] = defer;
+					continue;
+				}
+			} else {
+				changed = match_stat_with_submodule(&revs->diffopt,
+								    ce, &st, ce_option,
+								    &dirty_submodule,
+								    NULL);
+			}
 			newmode = ce_mode_from_stat(ce, st.st_mode);
 		}
 
@@ -257,6 +357,14 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 			    ce->name, 0, dirty_submodule);
 
 	}
+	if (submodules_nr) {
+		diff_deferred_submodules(revs, submodules, submodules_nr,
+					 submodule_jobs);
+		for (i = 0; i < submodules_nr; i++)
+			free(submodules[i].util);
+	}
+	free(submodules);
+	racy_cache_write(istate);
 	diffcore_std(&revs->diffopt);
 	diff_flush(&revs->diffopt);
 	trace_performance_since(start, "diff-files");
@@ -304,7 +412,7 @@ static int get_stat_data(const struct index_state *istate,
 			return -1;
 		}
 		changed = match_stat_with_submodule(diffopt, ce, &st,
-						    0, dirty_submodule);
+						    0, dirty_submodule, NULL);
 		if (changed) {
 			mode = ce_mode_from_stat(ce, st.st_mode);
 			oid = null_oid();
@@ -391,6 +499,26 @@ static int show_modified(struct rev_info *revs,
 	return 0;
 }
 
+/*
+ * A sparse directory entry stands for a whole tree, so compare the
+ * trees it covers path by path, limited to the paths we were asked
+ * about.
+ */
+static void diff_sparse_dir(struct rev_info *revs,
+			    const struct object_id *old_oid,
+			    const struct object_id *new_oid,
+			    const char *base)
+{
+	struct pathspec pathspec = revs->diffopt.pathspec;
+	unsigned recursive = revs->diffopt.flags.recursive;
+
+	revs->diffopt.pathspec = revs->prune_data;
+	revs->diffopt.flags.recursive = 1;
+	diff_tree_oid(old_oid, new_oid, base, &revs->diffopt);
+	revs->diffopt.flags.recursive = recursive;
+	revs->diffopt.pathspec = pathspec;
+}
+
 /*
  * This gets a mix of an existing index and a tree, one pathname entry
  * at a time. The index entry may be a single stage-0 one, but it could
@@ -435,7 +563,10 @@ static void do_oneway_diff(struct unpack_trees_options *o,
 	 * Something added to the tree?
 	 */
 	if (!tree) {
-		show_new_file(revs, idx, cached, match_missing);
+		if (S_ISSPARSEDIR(idx->ce_mode))
+			diff_sparse_dir(revs, NULL, &idx->oid, idx->name);
+		else
+			show_new_file(revs, idx, cached, match_missing);
 		return;
 	}
 
@@ -443,12 +574,20 @@ static void do_oneway_diff(struct unpack_trees_options *o,
 	 * Something removed from the tree?
 	 */
 	if (!idx) {
-		diff_index_show_file(revs, "-", tree, &tree->oid, 1,
-				     tree->ce_mode, 0);
+		if (S_ISSPARSEDIR(tree->ce_mode))
+			diff_sparse_dir(revs, &tree->oid, NULL, tree->name);
+		else
+			diff_index_show_file(revs, "-", tree, &tree->oid, 1,
+					     tree->ce_mode, 0);
 		return;
 	}
 
 	/* Show difference between old and new */
+	if (S_ISSPARSEDIR(idx->ce_mode) && S_ISSPARSEDIR(tree->ce_mode)) {
+		if (!oideq(&tree->oid, &idx->oid))
+			diff_sparse_dir(revs, &tree->oid, &idx->oid, idx->name);
+		return;
+	}
 	show_modified(revs, tree, idx, 1, cached, match_missing);
 }
 
@@ -483,7 +622,12 @@ static int oneway_diff(const struct cache_entry * const *src,
 	if (tree == o->df_conflict_entry)
 		tree = NULL;
 
-	if (ce_path_match(revs->diffopt.repo->index,
+	/*
+	 * Paths inside of a sparse directory are matched against the
+	 * pathspec as its trees are compared.
+	 */
+	if (S_ISSPARSEDIR((idx ? idx : tree)->ce_mode) ||
+	    ce_path_match(revs->diffopt.repo->index,
 			  idx ? idx : tree,
 			  &revs->prune_data, NULL)) {
 		do_oneway_diff(o, idx, tree);
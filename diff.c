@@ -26,6 +26,7 @@
 #include "parse-options.h"
 #include "help.h"
 #include "promisor-remote.h"
+#include "thread-utils.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -55,6 +56,26 @@ static struct diff_options default_diff_options;
 static long diff_algorithm;
 static unsigned ws_error_highlight_default = WSEH_NEW;
 
+/*
+ * While patches are generated on several threads (see
+ * diff_flush_patch_threaded()), this lock protects the attributes
+ * machinery, which is not thread-safe.
+ */
+static int diff_use_locks;
+static pthread_mutex_t diff_mutex;
+
+static inline void diff_lock(void)
+{
+	if (diff_use_locks)
+		pthread_mutex_lock(&diff_mutex);
+}
+
+static inline void diff_unlock(void)
+{
+	if (diff_use_locks)
+		pthread_mutex_unlock(&diff_mutex);
+}
+
 static char diff_colors[][COLOR_MAXLEN] = {
 	GIT_COLOR_RESET,
 	GIT_COLOR_NORMAL,	/* CONTEXT */
@@ -206,6 +227,8 @@ long parse_algorithm_value(const char *value)
 		return XDF_PATIENCE_DIFF;
 	else if (!strcasecmp(value, "histogram"))
 		return XDF_HISTOGRAM_DIFF;
+	else if (!strcasecmp(value, "bounded"))
+		return XDF_BOUNDED_DIFF;
 	/*
 	 * Please update $__git_diff_algorithms in git-completion.bash
 	 * when you add new algorithms.
@@ -1816,7 +1839,9 @@ static void emit_rewrite_diff(const char *name_a,
 
 	memset(&ecbdata, 0, sizeof(ecbdata));
 	ecbdata.color_diff = want_color(o->use_color);
+	diff_lock();
 	ecbdata.ws_rule = whitespace_rule(o->repo->index, name_b);
+	diff_unlock();
 	ecbdata.opt = o;
 	if (ecbdata.ws_rule & WS_BLANK_AT_EOF) {
 		mmfile_t mf1, mf2;
@@ -2213,8 +2238,11 @@ static void diff_filespec_load_driver(struct diff_filespec *one,
 	if (one->driver)
 		return;
 
-	if (S_ISREG(one->mode))
+	if (S_ISREG(one->mode)) {
+		diff_lock();
 		one->driver = userdiff_find_by_path(istate, one->path);
+		diff_unlock();
+	}
 
 	/* Fallback to default settings */
 	if (!one->driver)
@@ -2228,6 +2256,39 @@ static const char *userdiff_word_regex(struct diff_filespec *one,
 	return one->driver->word_regex;
 }
 
+/*
+ * The xdiff flags to diff `one` and `two` with, using the algorithm
+ * their diff driver asks for unless one was given on the command line.
+ */
+static long diff_xdl_opts(struct diff_options *o,
+			  struct diff_filespec *one,
+			  struct diff_filespec *two)
+{
+	const char *algorithm;
+	struct userdiff_driver *drv;
+	long value;
+
+	if (o->ignore_driver_algorithm)
+		return o->xdl_opts;
+
+	diff_filespec_load_driver(one, o->repo->index);
+	drv = one->driver;
+	if (!drv->algorithm) {
+		diff_filespec_load_driver(two, o->repo->index);
+		drv = two->driver;
+	}
+	algorithm = drv->algorithm;
+	if (!algorithm)
+		return o->xdl_opts;
+
+	value = parse_algorithm_value(algorithm);
+	if (value < 0)
+		die(_("unknown value for config 'diff.%s.algorithm': %s"),
+		    drv->name, algorithm);
+	return (o->xdl_opts & ~(XDF_NEED_MINIMAL | XDF_DIFF_ALGORITHM_MASK)) |
+		value;
+}
+
 static void init_diff_words_data(struct emit_callback *ecbdata,
 				 struct diff_options *orig_opts,
 				 struct diff_filespec *one,
@@ -3377,6 +3438,13 @@ int diff_filespec_is_binary(struct repository *r,
 	return one->is_binary;
 }
 
+int diff_filespec_binary_by_contents(struct repository *r,
+				     struct diff_filespec *one)
+{
+	diff_filespec_load_driver(one, r->index);
+	return one->driver->binary == -1;
+}
+
 static const struct userdiff_funcname *
 diff_funcname_pattern(struct diff_options *o, struct diff_filespec *one)
 {
@@ -3582,13 +3650,15 @@ static void builtin_diff(const char *name_a,
 			lbl[0] = NULL;
 		ecbdata.label_path = lbl;
 		ecbdata.color_diff = want_color(o->use_color);
+		diff_lock();
 		ecbdata.ws_rule = whitespace_rule(o->repo->index, name_b);
+		diff_unlock();
 		if (ecbdata.ws_rule & WS_BLANK_AT_EOF)
 			check_blank_at_eof(&mf1, &mf2, &ecbdata);
 		ecbdata.opt = o;
 		if (header.len && !o->flags.suppress_diff_headers)
 			ecbdata.header = &header;
-		xpp.flags = o->xdl_opts;
+		xpp.flags = diff_xdl_opts(o, one, two);
 		xpp.ignore_regex = o->ignore_regex;
 		xpp.ignore_regex_nr = o->ignore_regex_nr;
 		xpp.anchors = o->anchors;
@@ -3719,7 +3789,7 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 
 		memset(&xpp, 0, sizeof(xpp));
 		memset(&xecfg, 0, sizeof(xecfg));
-		xpp.flags = o->xdl_opts;
+		xpp.flags = diff_xdl_opts(o, one, two);
 		xpp.ignore_regex = o->ignore_regex;
 		xpp.ignore_regex_nr = o->ignore_regex_nr;
 		xpp.anchors = o->anchors;
@@ -3893,8 +3963,15 @@ static int reuse_worktree_file(struct index_state *istate,
 	 * objects however would tend to be slower as they need
 	 * to be individually opened and inflated.
 	 */
-	if (!FAST_WORKING_DIRECTORY && !want_file && has_object_pack(oid))
-		return 0;
+	if (!FAST_WORKING_DIRECTORY && !want_file) {
+		int in_pack;
+
+		obj_read_lock();
+		in_pack = has_object_pack(oid);
+		obj_read_unlock();
+		if (in_pack)
+			return 0;
+	}
 
 	/*
 	 * Similarly, if we'd have to convert the file contents anyway, that
@@ -3966,7 +4043,7 @@ int diff_populate_filespec(struct repository *r,
 {
 	int size_only = options ? options->check_size_only : 0;
 	int check_binary = options ? options->check_binary : 0;
-	int err = 0;
+	int err = 0, from_worktree;
 	int conv_flags = global_conv_flags_eol;
 	/*
 	 * demote FAIL to WARN to allow inspecting the situation
@@ -3989,8 +4066,12 @@ int diff_populate_filespec(struct repository *r,
 	if (S_ISGITLINK(s->mode))
 		return diff_populate_gitlink(s, size_only);
 
-	if (!s->oid_valid ||
-	    reuse_worktree_file(r->index, s->path, &s->oid, 0)) {
+	diff_lock();
+	from_worktree = !s->oid_valid ||
+		reuse_worktree_file(r->index, s->path, &s->oid, 0);
+	diff_unlock();
+
+	if (from_worktree) {
 		struct strbuf buf = STRBUF_INIT;
 		struct stat st;
 		int fd;
@@ -4367,9 +4448,12 @@ static void fill_metainfo(struct strbuf *msg,
 			     diff_filespec_is_binary(o->repo, two)))
 				abbrev = hexsz;
 		}
+		/* this also protects the buffers of diff_abbrev_oid() */
+		obj_read_lock();
 		strbuf_addf(msg, "%s%sindex %s..%s", line_prefix, set,
 			    diff_abbrev_oid(&one->oid, abbrev),
 			    diff_abbrev_oid(&two->oid, abbrev));
+		obj_read_unlock();
 		if (one->mode == two->mode)
 			strbuf_addf(msg, " %06o", one->mode);
 		strbuf_addf(msg, "%s\n", reset);
@@ -4394,7 +4478,9 @@ static void run_diff_cmd(const char *pgm,
 	if (o->flags.allow_external) {
 		struct userdiff_driver *drv;
 
+		diff_lock();
 		drv = userdiff_find_by_path(o->repo->index, attr_path);
+		diff_unlock();
 		if (drv && drv->external)
 			pgm = drv->external;
 	}
@@ -4936,6 +5022,7 @@ static int diff_opt_anchored(const struct option *opt,
 
 	BUG_ON_OPT_NEG(unset);
 	options->xdl_opts = DIFF_WITH_ALG(options, PATIENCE_DIFF);
+	options->ignore_driver_algorithm = 1;
 	ALLOC_GROW(options->anchors, options->anchors_nr + 1,
 		   options->anchors_alloc);
 	options->anchors[options->anchors_nr++] = xstrdup(arg);
@@ -5066,12 +5153,26 @@ static int diff_opt_diff_algorithm(const struct option *opt,
 	BUG_ON_OPT_NEG(unset);
 	if (value < 0)
 		return error(_("option diff-algorithm accepts \"myers\", "
-			       "\"minimal\", \"patience\" and \"histogram\""));
+			       "\"minimal\", \"patience\", \"histogram\" "
+			       "and \"bounded\""));
 
 	/* clear out previous settings */
 	DIFF_XDL_CLR(options, NEED_MINIMAL);
 	options->xdl_opts &= ~XDF_DIFF_ALGORITHM_MASK;
 	options->xdl_opts |= value;
+	options->ignore_driver_algorithm = 1;
+	return 0;
+}
+
+static int diff_opt_histogram(const struct option *opt,
+			      const char *arg, int unset)
+{
+	struct diff_options *options = opt->value;
+
+	BUG_ON_OPT_NEG(unset);
+	BUG_ON_OPT_ARG(arg);
+	options->xdl_opts = DIFF_WITH_ALG(options, HISTOGRAM_DIFF);
+	options->ignore_driver_algorithm = 1;
 	return 0;
 }
 
@@ -5205,6 +5306,7 @@ static int diff_opt_patience(const struct option *opt,
 	BUG_ON_OPT_NEG(unset);
 	BUG_ON_OPT_ARG(arg);
 	options->xdl_opts = DIFF_WITH_ALG(options, PATIENCE_DIFF);
+	options->ignore_driver_algorithm = 1;
 	/*
 	 * Both --patience and --anchored use PATIENCE_DIFF
 	 * internally, so remove any anchors previously
@@ -5543,9 +5645,10 @@ static void prep_parse_options(struct diff_options *options)
 			       N_("generate diff using the \"patience diff\" algorithm"),
 			       PARSE_OPT_NONEG | PARSE_OPT_NOARG,
 			       diff_opt_patience),
-		OPT_BITOP(0, "histogram", &options->xdl_opts,
-			  N_("generate diff using the \"histogram diff\" algorithm"),
-			  XDF_HISTOGRAM_DIFF, XDF_DIFF_ALGORITHM_MASK),
+		OPT_CALLBACK_F(0, "histogram", options, NULL,
+			       N_("generate diff using the \"histogram diff\" algorithm"),
+			       PARSE_OPT_NONEG | PARSE_OPT_NOARG,
+			       diff_opt_histogram),
 		OPT_CALLBACK_F(0, "diff-algorithm", options, N_("<algorithm>"),
 			       N_("choose a diff algorithm"),
 			       PARSE_OPT_NONEG, diff_opt_diff_algorithm),
@@ -6306,9 +6409,229 @@ void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc)
 		warning(_(rename_limit_advice), varname, needed);
 }
 
-static void diff_flush_patch_all_file_pairs(struct diff_options *o)
+static int diff_threads(struct diff_options *o)
+{
+	int nr_threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	nr_threads = git_env_ulong("GIT_TEST_DIFF_THREADS", 0);
+	if (nr_threads)
+		return nr_threads;
+
+	if (repo_config_get_int(o->repo, "diff.threads", &nr_threads))
+		nr_threads = 1;
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    nr_threads, "diff.threads");
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+/*
+ * Can the patch of "p" be generated on a thread? Only if both sides
+ * are read from the object database, nobody else looks at them, and
+ * neither an external diff nor a textconv command has to be run.
+ * This loads the diff drivers of both sides, so that the thread does
+ * not have to.
+ */
+static int diff_pair_can_be_threaded(struct diff_options *o,
+				     struct diff_filepair *p)
+{
+	struct diff_filespec *specs[2];
+	struct userdiff_driver *drv;
+	int i;
+
+	if (DIFF_PAIR_UNMERGED(p))
+		return 0;
+
+	specs[0] = p->one;
+	specs[1] = p->two;
+	for (i = 0; i < ARRAY_SIZE(specs); i++) {
+		struct diff_filespec *s = specs[i];
+
+		if (s->count > 1)
+			return 0;
+		if (DIFF_FILE_VALID(s) &&
+		    (!s->oid_valid || !(S_ISREG(s->mode) || S_ISLNK(s->mode)) ||
+		     reuse_worktree_file(o->repo->index, s->path, &s->oid, 0)))
+			return 0;
+		diff_filespec_load_driver(s, o->repo->index);
+		if (o->flags.allow_textconv && s->driver->textconv)
+			return 0;
+	}
+
+	if (o->flags.allow_external) {
+		if (external_diff())
+			return 0;
+		drv = userdiff_find_by_path(o->repo->index, p->one->path);
+		if (drv && drv->external)
+			return 0;
+	}
+	return 1;
+}
+
+struct patch_job {
+	struct diff_filepair *p;
+	unsigned threaded : 1;
+
+	/* What the thread emitted for "p", to be replayed in queue order. */
+	struct emitted_diff_symbols esm;
+	int found_changes;
+};
+
+struct patch_thread_data {
+	pthread_t pthread;
+	struct diff_options *o;
+	struct patch_job *jobs;
+	int nr;
+
+	/* Shared by all threads and guarded by "mutex". */
+	pthread_mutex_t *mutex;
+	int *next;
+};
+
+static void *patch_thread(void *_data)
+{
+	struct patch_thread_data *d = _data;
+
+	trace2_thread_start("diff-worker");
+	for (;;) {
+		struct diff_options opt;
+		struct patch_job *job;
+		int i;
+
+		pthread_mutex_lock(d->mutex);
+		i = (*d->next)++;
+		pthread_mutex_unlock(d->mutex);
+		if (i >= d->nr)
+			break;
+
+		job = &d->jobs[i];
+		if (!job->threaded)
+			continue;
+		memcpy(&opt, d->o, sizeof(opt));
+		opt.emitted_symbols = &job->esm;
+		opt.found_changes = 0;
+		diff_flush_patch(job->p, &opt);
+		job->found_changes = opt.found_changes;
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void emit_patch_job(struct diff_options *o, struct patch_job *job)
 {
 	int i;
+
+	if (!job->threaded) {
+		diff_flush_patch(job->p, o);
+		return;
+	}
+
+	for (i = 0; i < job->esm.nr; i++) {
+		struct emitted_diff_symbol *e = &job->esm.buf[i];
+
+		if (o->emitted_symbols) {
+			/* hand the line over to the caller's buffer */
+			ALLOC_GROW(o->emitted_symbols->buf,
+				   o->emitted_symbols->nr + 1,
+				   o->emitted_symbols->alloc);
+			o->emitted_symbols->buf[o->emitted_symbols->nr++] = *e;
+		} else {
+			emit_diff_symbol_from_struct(o, e);
+			free((void *)e->line);
+		}
+	}
+	free(job->esm.buf);
+	if (job->found_changes)
+		o->found_changes = 1;
+}
+
+/*
+ * Generate the patches of the queued pairs in batches, each on
+ * "nr_threads" threads that buffer what they emit, and emit them in
+ * queue order. The pairs that cannot be handled on a thread are done
+ * when it is their turn to be emitted, while no thread runs.
+ */
+#define DIFF_PATCH_BATCH_PER_THREAD 32
+
+static void diff_flush_patch_threaded(struct diff_options *o, int nr_threads)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	struct patch_thread_data *data;
+	struct patch_job *jobs;
+	pthread_mutex_t mutex;
+	int batch = nr_threads * DIFF_PATCH_BATCH_PER_THREAD;
+	int start, end, next, i, err;
+
+	trace2_data_intmax("diff", o->repo, "patch/threads", nr_threads);
+
+	/* resolve lazily initialized state before the threads need it */
+	want_color(o->use_color);
+	external_diff();
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_mutex_init(&diff_mutex, NULL);
+	enable_obj_read_lock();
+	CALLOC_ARRAY(jobs, batch);
+	CALLOC_ARRAY(data, nr_threads);
+
+	for (start = 0; start < q->nr; start = end) {
+		int nr = 0, threaded = 0;
+
+		for (end = start; end < q->nr && nr < batch; end++) {
+			struct diff_filepair *p = q->queue[end];
+			struct patch_job *job = &jobs[nr];
+
+			if (!check_pair_status(p))
+				continue;
+			memset(job, 0, sizeof(*job));
+			job->p = p;
+			job->threaded = diff_pair_can_be_threaded(o, p);
+			threaded += job->threaded;
+			nr++;
+		}
+
+		if (threaded) {
+			next = 0;
+			diff_use_locks = 1;
+			for (i = 0; i < nr_threads; i++) {
+				struct patch_thread_data *d = &data[i];
+
+				d->o = o;
+				d->jobs = jobs;
+				d->nr = nr;
+				d->mutex = &mutex;
+				d->next = &next;
+				err = pthread_create(&d->pthread, NULL,
+						     patch_thread, d);
+				if (err)
+					die(_("unable to create diff thread: %s"),
+					    strerror(err));
+			}
+			for (i = 0; i < nr_threads; i++)
+				if (pthread_join(data[i].pthread, NULL))
+					die("unable to join diff thread");
+			diff_use_locks = 0;
+		}
+
+		for (i = 0; i < nr; i++)
+			emit_patch_job(o, &jobs[i]);
+	}
+
+	free(data);
+	free(jobs);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&diff_mutex);
+	pthread_mutex_destroy(&mutex);
+}
+
+static void diff_flush_patch_all_file_pairs(struct diff_options *o)
+{
+	int i, nr_threads;
 	static struct emitted_diff_symbols esm = EMITTED_DIFF_SYMBOLS_INIT;
 	struct diff_queue_struct *q = &diff_queued_diff;
 
@@ -6318,10 +6641,16 @@ static void diff_flush_patch_all_file_pairs(struct diff_options *o)
 	if (o->color_moved)
 		o->emitted_symbols = &esm;
 
-	for (i = 0; i < q->nr; i++) {
-		struct diff_filepair *p = q->queue[i];
-		if (check_pair_status(p))
-			diff_flush_patch(p, o);
+	nr_threads = diff_threads(o);
+	if (nr_threads > 1 && q->nr > 1 && !o->output_prefix &&
+	    !has_promisor_remote()) {
+		diff_flush_patch_threaded(o, nr_threads);
+	} else {
+		for (i = 0; i < q->nr; i++) {
+			struct diff_filepair *p = q->queue[i];
+			if (check_pair_status(p))
+				diff_flush_patch(p, o);
+		}
 	}
 
 	if (o->emitted_symbols) {
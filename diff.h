@@ -334,6 +334,8 @@ struct diff_options {
 	int prefix_length;
 	const char *stat_sep;
 	int xdl_opts;
+	/* The algorithm was chosen on the command line, not by the driver. */
+	unsigned ignore_driver_algorithm;
 
 	/* see Documentation/diff-options.txt */
 	char **anchors;
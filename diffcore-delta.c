@@ -163,6 +163,53 @@ static struct spanhash_top *hash_chars(struct repository *r,
 	return hash;
 }
 
+void diffcore_prepare_count_data(struct repository *r,
+				 struct diff_filespec *spec)
+{
+	if (!spec->cnt_data)
+		spec->cnt_data = hash_chars(r, spec);
+}
+
+static uint64_t splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+int diffcore_minhash(const void *cnt_data, uint32_t *sketch, int nr)
+{
+	const struct spanhash_top *top = cnt_data;
+	const struct spanhash *s;
+	uint64_t mult[DIFFCORE_MINHASH_MAX], add[DIFFCORE_MINHASH_MAX];
+	uint64_t state = 0;
+	int i;
+
+	if (nr > DIFFCORE_MINHASH_MAX)
+		BUG("too many MinHash functions requested: %d", nr);
+
+	/*
+	 * The i-th hash function is the multiply-shift hash of the
+	 * span hash, with the same parameters for every file.
+	 */
+	for (i = 0; i < nr; i++) {
+		mult[i] = splitmix64(&state) | 1;
+		add[i] = splitmix64(&state);
+		sketch[i] = UINT32_MAX;
+	}
+
+	/* The spans are sorted and the unused slots come last. */
+	for (s = top->data; s < top->data + (1 << top->alloc_log2) && s->cnt; s++)
+		for (i = 0; i < nr; i++) {
+			uint32_t h = (mult[i] * s->hashval + add[i]) >> 32;
+			if (h < sketch[i])
+				sketch[i] = h;
+		}
+	return s != top->data;
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
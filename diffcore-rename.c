@@ -3,13 +3,17 @@
  * Copyright (C) 2005 Junio C Hamano
  */
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "object-store.h"
 #include "hashmap.h"
 #include "progress.h"
 #include "promisor-remote.h"
+#include "rename-cache.h"
+#include "replace-object.h"
 #include "strmap.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -122,11 +126,46 @@ static void prefetch(void *prefetch_options)
 	oid_array_clear(&to_fetch);
 }
 
+/* The smallest combined size of a pair to keep in the rename cache. */
+#define RENAME_CACHE_MIN_SIZE 4096
+
+/*
+ * The score of a pair only depends on the two blobs, unless attributes
+ * decide whether they are binary (which changes how their lines are
+ * counted) or one of them is replaced. Only such pairs are cached.
+ */
+static int rename_cacheable(struct repository *r, struct diff_filespec *spec)
+{
+	return S_ISREG(spec->mode) && spec->oid_valid &&
+	       lookup_replace_object(r, &spec->oid) == &spec->oid &&
+	       diff_filespec_binary_by_contents(r, spec);
+}
+
+/*
+ * We would not consider edits that change the file size so
+ * drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src_size, dst_size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation would not have a
+ * divide-by-zero issue.
+ */
+static int sizes_too_different(unsigned long src_size, unsigned long dst_size,
+			       int minimum_score)
+{
+	unsigned long max_size = src_size > dst_size ? src_size : dst_size;
+	unsigned long delta_size = max_size - (src_size < dst_size ?
+					       src_size : dst_size);
+
+	return max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE;
+}
+
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
 			       int minimum_score,
-			       int skip_unmodified)
+			       int skip_unmodified,
+			       int use_cache)
 {
 	/* src points at a file that existed in the original tree (or
 	 * optionally a file in the destination tree) and dst points
@@ -141,7 +180,7 @@ static int estimate_similarity(struct repository *r,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
+	unsigned long max_size, src_copied, literal_added;
 	int score;
 	struct diff_populate_filespec_options dpf_options = {
 		.check_size_only = 1
@@ -176,20 +215,17 @@ static int estimate_similarity(struct repository *r,
 	    diff_populate_filespec(r, dst, &dpf_options))
 		return 0;
 
+	if (sizes_too_different(src->size, dst->size, minimum_score))
+		return 0;
 	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
 
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
-		return 0;
+	/* Small files are compared faster than the cache could be searched. */
+	use_cache = use_cache &&
+		src->size + dst->size >= RENAME_CACHE_MIN_SIZE &&
+		rename_cache_enabled(r) &&
+		rename_cacheable(r, src) && rename_cacheable(r, dst);
+	if (use_cache && !rename_cache_get(r, &src->oid, &dst->oid, &score))
+		return score;
 
 	dpf_options.check_size_only = 0;
 
@@ -210,6 +246,8 @@ static int estimate_similarity(struct repository *r,
 		score = 0; /* should not happen */
 	else
 		score = (int)(src_copied * MAX_SCORE / max_size);
+	if (use_cache)
+		rename_cache_put(r, &src->oid, &dst->oid, score);
 	return score;
 }
 
@@ -941,7 +979,7 @@ static int find_basename_matches(struct diff_options *options,
 			one = rename_src[src_index].p->one;
 			two = rename_dst[dst_index].p->two;
 			score = estimate_similarity(options->repo, one, two,
-						    minimum_score, skip_unmodified);
+						    minimum_score, skip_unmodified, 1);
 
 			/* If sufficiently similar, record as rename pair */
 			if (score < minimum_score)
@@ -983,6 +1021,567 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * MinHash sketches of the rename candidates let us find, for each
+ * destination, the sources that are likely to be similar to it
+ * without scoring all of them: we split each sketch into
+ * RENAME_SKETCH_BANDS bands of RENAME_SKETCH_ROWS values, and only
+ * score the sources that have at least one band equal to that of the
+ * destination. With 16 bands of 2 values, a pair that has a third of
+ * its spans in common is found with a probability of 85%, one with
+ * half of them with 99%, and one with a twentieth of them with 4%.
+ */
+#define RENAME_SKETCH_BANDS 16
+#define RENAME_SKETCH_ROWS 2
+
+struct sketch_band_entry {
+	unsigned int hash;
+	int src;
+};
+
+struct rename_sketch_index {
+	/* For each band, the sources sorted by the hash of that band. */
+	struct sketch_band_entry *band[RENAME_SKETCH_BANDS];
+	int nr;
+};
+
+/* A score computed on a thread, to be put into the rename cache later. */
+struct rename_new_score {
+	int dst, src, score;
+};
+
+/*
+ * A list of rename sources to score, and scratch space to build it,
+ * as well as the scores to put into the rename cache once the threads
+ * are done.
+ */
+struct rename_candidates {
+	int *src;
+	int nr, alloc;
+	/* seen[j] is the destination (plus one) rename_src[j] was added for */
+	int *seen;
+
+	struct rename_new_score *new_score;
+	int new_nr, new_alloc;
+};
+
+/* What is needed to score the rename sources against a destination. */
+struct rename_scoring {
+	struct diff_options *options;
+	int minimum_score;
+	int skip_unmodified;
+	int want_copies;
+
+	/*
+	 * If set, prepare_count_data() has been run for all candidates,
+	 * and scoring neither populates nor frees any filespec; it can
+	 * then run on several threads, each on its own destination.
+	 */
+	int prepared;
+
+	/* If set, only score the sources this suggests. */
+	const struct rename_sketch_index *index;
+
+	/*
+	 * With the rename cache and prepared candidates, whether the
+	 * pairs of each source and destination may be cached (see
+	 * rename_cacheable()). The sizes of all regular candidates are
+	 * known then.
+	 */
+	unsigned char *src_cacheable, *dst_cacheable;
+};
+
+static int sketch_of(struct diff_filespec *spec, unsigned int *band_hash)
+{
+	uint32_t sketch[RENAME_SKETCH_BANDS * RENAME_SKETCH_ROWS];
+	int b;
+
+	if (!spec->cnt_data ||
+	    !diffcore_minhash(spec->cnt_data, sketch, ARRAY_SIZE(sketch)))
+		return 0;
+	for (b = 0; b < RENAME_SKETCH_BANDS; b++)
+		band_hash[b] = memhash(sketch + b * RENAME_SKETCH_ROWS,
+				       sizeof(*sketch) * RENAME_SKETCH_ROWS);
+	return 1;
+}
+
+static int sketch_band_entry_cmp(const void *a_, const void *b_)
+{
+	const struct sketch_band_entry *a = a_, *b = b_;
+
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	return a->src - b->src;
+}
+
+static void build_sketch_index(struct rename_sketch_index *index,
+			       int skip_unmodified)
+{
+	unsigned int band_hash[RENAME_SKETCH_BANDS];
+	int b, j;
+
+	index->nr = 0;
+	for (b = 0; b < RENAME_SKETCH_BANDS; b++)
+		ALLOC_ARRAY(index->band[b], rename_src_nr);
+
+	for (j = 0; j < rename_src_nr; j++) {
+		if (skip_unmodified && diff_unmodified_pair(rename_src[j].p))
+			continue;
+		if (!sketch_of(rename_src[j].p->one, band_hash))
+			continue;
+		for (b = 0; b < RENAME_SKETCH_BANDS; b++) {
+			index->band[b][index->nr].hash = band_hash[b];
+			index->band[b][index->nr].src = j;
+		}
+		index->nr++;
+	}
+
+	for (b = 0; b < RENAME_SKETCH_BANDS; b++)
+		QSORT(index->band[b], index->nr, sketch_band_entry_cmp);
+}
+
+static void clear_sketch_index(struct rename_sketch_index *index)
+{
+	int b;
+
+	for (b = 0; b < RENAME_SKETCH_BANDS; b++)
+		FREE_AND_NULL(index->band[b]);
+	index->nr = 0;
+}
+
+static int src_index_cmp(const void *a_, const void *b_)
+{
+	const int *a = a_, *b = b_;
+
+	return *a - *b;
+}
+
+/*
+ * Collect the sources that share a band with the destination
+ * rename_dst[dst] into "cand", in the order of rename_src.
+ */
+static void find_sketch_candidates(const struct rename_sketch_index *index,
+				   int dst, struct rename_candidates *cand)
+{
+	unsigned int band_hash[RENAME_SKETCH_BANDS];
+	int b;
+
+	cand->nr = 0;
+	if (!sketch_of(rename_dst[dst].p->two, band_hash))
+		return;
+
+	for (b = 0; b < RENAME_SKETCH_BANDS; b++) {
+		const struct sketch_band_entry *band = index->band[b];
+		int lo = 0, hi = index->nr;
+
+		while (lo < hi) {
+			int mi = lo + (hi - lo) / 2;
+
+			if (band[mi].hash < band_hash[b])
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		for (; lo < index->nr && band[lo].hash == band_hash[b]; lo++) {
+			int src = band[lo].src;
+
+			if (cand->seen[src] == dst + 1)
+				continue;
+			cand->seen[src] = dst + 1;
+			ALLOC_GROW(cand->src, cand->nr + 1, cand->alloc);
+			cand->src[cand->nr++] = src;
+		}
+	}
+	QSORT(cand->src, cand->nr, src_index_cmp);
+}
+
+static void init_rename_candidates(struct rename_candidates *cand)
+{
+	memset(cand, 0, sizeof(*cand));
+	CALLOC_ARRAY(cand->seen, rename_src_nr);
+}
+
+static void clear_rename_candidates(struct rename_candidates *cand)
+{
+	free(cand->src);
+	free(cand->seen);
+	free(cand->new_score);
+}
+
+static int pair_cacheable(const struct rename_scoring *rs, int dst, int src)
+{
+	struct diff_filespec *one = rename_src[src].p->one;
+	struct diff_filespec *two = rename_dst[dst].p->two;
+
+	return rs->src_cacheable &&
+	       rs->src_cacheable[src] && rs->dst_cacheable[dst] &&
+	       one->size + two->size >= RENAME_CACHE_MIN_SIZE;
+}
+
+/*
+ * Look up the score of a pair of prepared candidates. This only reads
+ * the rename cache, so it is safe on several threads.
+ */
+static int get_cached_score(const struct rename_scoring *rs,
+			    int dst, int src, int *score)
+{
+	if (!pair_cacheable(rs, dst, src))
+		return -1;
+	return rename_cache_get(rs->options->repo,
+				&rename_src[src].p->one->oid,
+				&rename_dst[dst].p->two->oid, score);
+}
+
+static void put_new_scores(const struct rename_scoring *rs,
+			   struct rename_candidates *cand)
+{
+	int i;
+
+	for (i = 0; i < cand->new_nr; i++) {
+		const struct rename_new_score *n = &cand->new_score[i];
+
+		rename_cache_put(rs->options->repo,
+				 &rename_src[n->src].p->one->oid,
+				 &rename_dst[n->dst].p->two->oid, n->score);
+	}
+	cand->new_nr = 0;
+}
+
+static void score_rename_source(const struct rename_scoring *rs,
+				struct diff_score *m, int dst, int src,
+				struct rename_candidates *cand)
+{
+	struct diff_filespec *one = rename_src[src].p->one;
+	struct diff_filespec *two = rename_dst[dst].p->two;
+	struct diff_score this_src;
+	int score;
+
+	assert(!one->rename_used || rs->want_copies || break_idx);
+
+	if (rs->skip_unmodified &&
+	    diff_unmodified_pair(rename_src[src].p))
+		return;
+
+	if (!rs->prepared) {
+		this_src.score = estimate_similarity(rs->options->repo,
+						     one, two,
+						     rs->minimum_score,
+						     rs->skip_unmodified, 1);
+	} else if (pair_cacheable(rs, dst, src) &&
+		   sizes_too_different(one->size, two->size,
+				       rs->minimum_score)) {
+		this_src.score = 0;
+	} else if (!get_cached_score(rs, dst, src, &score)) {
+		this_src.score = score;
+	} else if (!one->cnt_data || !two->cnt_data) {
+		this_src.score = 0;
+	} else {
+		this_src.score = estimate_similarity(rs->options->repo,
+						     one, two,
+						     rs->minimum_score,
+						     rs->skip_unmodified, 0);
+		if (pair_cacheable(rs, dst, src)) {
+			struct rename_new_score *n;
+
+			ALLOC_GROW(cand->new_score, cand->new_nr + 1,
+				   cand->new_alloc);
+			n = &cand->new_score[cand->new_nr++];
+			n->dst = dst;
+			n->src = src;
+			n->score = this_src.score;
+		}
+	}
+	this_src.name_score = basename_same(one, two);
+	this_src.dst = dst;
+	this_src.src = src;
+	record_if_better(m, &this_src);
+	/*
+	 * Once we run estimate_similarity,
+	 * We do not need the text anymore.
+	 */
+	if (!rs->prepared) {
+		diff_free_filespec_blob(one);
+		diff_free_filespec_blob(two);
+	}
+}
+
+/*
+ * Score the rename sources against the destination rename_dst[dst] and
+ * keep the best NUM_CANDIDATE_PER_DST of them in "m". "cand" is the
+ * scratch space of the calling thread.
+ */
+static void score_rename_sources(const struct rename_scoring *rs,
+				 struct diff_score *m, int dst,
+				 struct rename_candidates *cand)
+{
+	int j;
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	if (rs->index) {
+		find_sketch_candidates(rs->index, dst, cand);
+		for (j = 0; j < cand->nr; j++)
+			score_rename_source(rs, m, dst, cand->src[j], cand);
+	} else {
+		for (j = 0; j < rename_src_nr; j++)
+			score_rename_source(rs, m, dst, j, cand);
+	}
+}
+
+/*
+ * Set a minimum number of src/dst pairs that we will score per thread
+ * and use that to decide how many threads to run (up to the number
+ * of CPUs, or diff.renameThreads).
+ */
+#define RENAME_THREAD_COST (5000)
+
+static int rename_threads(struct diff_options *options,
+			  int num_destinations, int num_sources)
+{
+	uint64_t pairs = (uint64_t)num_destinations * num_sources;
+	int nr_threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	nr_threads = git_env_ulong("GIT_TEST_RENAME_THREADS", 0);
+	if (nr_threads)
+		return nr_threads;
+
+	if (repo_config_get_int(options->repo, "diff.renamethreads", &nr_threads))
+		nr_threads = 0;
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    nr_threads, "diff.renameThreads");
+	if (!nr_threads)
+		nr_threads = online_cpus();
+
+	if (pairs < 2 * RENAME_THREAD_COST)
+		return 1;
+	if (pairs < (uint64_t)nr_threads * RENAME_THREAD_COST)
+		nr_threads = pairs / RENAME_THREAD_COST;
+	return nr_threads;
+}
+
+/*
+ * Compute the "cnt_data" of a rename candidate, so that the threads do
+ * not have to populate it (which reads objects and attributes). If that
+ * fails, or the file is not a regular one, it cannot be scored anyway.
+ */
+static void prepare_count_data(struct repository *r,
+			       struct diff_filespec *spec,
+			       int skip_unmodified)
+{
+	struct diff_populate_filespec_options dpf_options = { 0 };
+	struct prefetch_options prefetch_options = {r, skip_unmodified};
+
+	if (!S_ISREG(spec->mode) || spec->cnt_data)
+		return;
+
+	if (r == the_repository && has_promisor_remote()) {
+		dpf_options.missing_object_cb = prefetch;
+		dpf_options.missing_object_data = &prefetch_options;
+	}
+	if (diff_populate_filespec(r, spec, &dpf_options))
+		return;
+	diffcore_prepare_count_data(r, spec);
+	diff_free_filespec_blob(spec);
+}
+
+/*
+ * With the rename cache, find out which candidates may have their
+ * pairs cached, filling in their sizes on the way. This reads
+ * attributes and replace refs, so it must be done before the threads
+ * start.
+ */
+static void init_rename_cacheable(struct rename_scoring *rs,
+				  const int *dsts, int dst_nr)
+{
+	struct repository *r = rs->options->repo;
+	struct diff_populate_filespec_options dpf_options = {
+		.check_size_only = 1
+	};
+	struct prefetch_options prefetch_options = {r, rs->skip_unmodified};
+	int i;
+
+	if (!rename_cache_enabled(r))
+		return;
+	if (r == the_repository && has_promisor_remote()) {
+		dpf_options.missing_object_cb = prefetch;
+		dpf_options.missing_object_data = &prefetch_options;
+	}
+
+	CALLOC_ARRAY(rs->src_cacheable, rename_src_nr);
+	CALLOC_ARRAY(rs->dst_cacheable, rename_dst_nr);
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (rs->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[i].p))
+			continue;
+		rs->src_cacheable[i] = rename_cacheable(r, one) &&
+			!diff_populate_filespec(r, one, &dpf_options);
+	}
+	for (i = 0; i < dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[dsts[i]].p->two;
+
+		rs->dst_cacheable[dsts[i]] = rename_cacheable(r, two) &&
+			!diff_populate_filespec(r, two, &dpf_options);
+	}
+}
+
+/*
+ * Prepare the candidates for scoring on threads or with sketches.
+ * Without sketches, every pair is scored, so a candidate all of whose
+ * pairs are found in the rename cache (or differ too much in size)
+ * does not need to be read at all.
+ */
+static void prepare_rename_candidates(const struct rename_scoring *rs,
+				      const int *dsts, int dst_nr,
+				      int use_sketches)
+{
+	struct repository *r = rs->options->repo;
+	unsigned char *src_needed = NULL, *dst_needed = NULL;
+	int i, j, nr = 0;
+
+	if (rs->src_cacheable && !use_sketches) {
+		CALLOC_ARRAY(src_needed, rename_src_nr);
+		CALLOC_ARRAY(dst_needed, dst_nr);
+		for (i = 0; i < dst_nr; i++) {
+			struct diff_filespec *two = rename_dst[dsts[i]].p->two;
+
+			for (j = 0; j < rename_src_nr; j++) {
+				struct diff_filespec *one = rename_src[j].p->one;
+				int score;
+
+				if ((src_needed[j] && dst_needed[i]) ||
+				    (rs->skip_unmodified &&
+				     diff_unmodified_pair(rename_src[j].p)))
+					continue;
+				if (rs->src_cacheable[j] &&
+				    rs->dst_cacheable[dsts[i]] &&
+				    (sizes_too_different(one->size, two->size,
+							 rs->minimum_score) ||
+				     !get_cached_score(rs, dsts[i], j, &score)))
+					continue;
+				src_needed[j] = dst_needed[i] = 1;
+			}
+		}
+	}
+
+	for (i = 0; i < rename_src_nr; i++)
+		if ((!rs->skip_unmodified ||
+		     !diff_unmodified_pair(rename_src[i].p)) &&
+		    (!src_needed || src_needed[i])) {
+			prepare_count_data(r, rename_src[i].p->one,
+					   rs->skip_unmodified);
+			nr++;
+		}
+	for (i = 0; i < dst_nr; i++)
+		if (!dst_needed || dst_needed[i]) {
+			prepare_count_data(r, rename_dst[dsts[i]].p->two,
+					   rs->skip_unmodified);
+			nr++;
+		}
+	trace2_data_intmax("diff", r, "rename/prepared", nr);
+	free(src_needed);
+	free(dst_needed);
+}
+
+struct rename_thread_data {
+	pthread_t pthread;
+	const struct rename_scoring *rs;
+	struct diff_score *mx;
+	const int *dsts;
+	int dst_nr;
+	struct rename_candidates cand;
+
+	/* Shared by all threads and guarded by "mutex". */
+	pthread_mutex_t *mutex;
+	int *next;
+	struct progress *progress;
+	uint64_t *progress_cnt;
+};
+
+static void *rename_thread(void *_data)
+{
+	struct rename_thread_data *d = _data;
+
+	trace2_thread_start("rename-worker");
+	for (;;) {
+		int row;
+
+		pthread_mutex_lock(d->mutex);
+		row = (*d->next)++;
+		pthread_mutex_unlock(d->mutex);
+		if (row >= d->dst_nr)
+			break;
+
+		score_rename_sources(d->rs, &d->mx[row * NUM_CANDIDATE_PER_DST],
+				     d->dsts[row], &d->cand);
+
+		pthread_mutex_lock(d->mutex);
+		*d->progress_cnt += rename_src_nr;
+		display_progress(d->progress, *d->progress_cnt);
+		pthread_mutex_unlock(d->mutex);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Score the rename sources against the destinations "dsts" (indices into
+ * rename_dst) on "nr_threads" threads, which take the next destination
+ * whenever they are done with one.
+ */
+static void score_renames_threaded(const struct rename_scoring *rs,
+				   struct diff_score *mx,
+				   const int *dsts, int dst_nr,
+				   int nr_threads, struct progress *progress)
+{
+	struct rename_thread_data *data;
+	pthread_mutex_t mutex;
+	uint64_t progress_cnt = 0;
+	int next = 0;
+	int i, err;
+
+	if (!rs->prepared)
+		BUG("rename candidates must be prepared for threads");
+
+	trace2_data_intmax("diff", rs->options->repo, "rename/threads",
+			   nr_threads);
+	pthread_mutex_init(&mutex, NULL);
+	CALLOC_ARRAY(data, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		struct rename_thread_data *d = &data[i];
+
+		d->rs = rs;
+		d->mx = mx;
+		d->dsts = dsts;
+		d->dst_nr = dst_nr;
+		d->mutex = &mutex;
+		d->next = &next;
+		d->progress = progress;
+		d->progress_cnt = &progress_cnt;
+		init_rename_candidates(&d->cand);
+
+		err = pthread_create(&d->pthread, NULL, rename_thread, d);
+		if (err)
+			die(_("unable to create rename thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join rename thread");
+		put_new_scores(rs, &data[i].cand);
+		clear_rename_candidates(&data[i].cand);
+	}
+
+	pthread_mutex_destroy(&mutex);
+	free(data);
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
@@ -1254,8 +1853,11 @@ void diffcore_rename_extended(struct diff_options *options,
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
-	int num_destinations, dst_cnt;
+	int i, rename_count, skip_unmodified = 0;
+	int num_destinations, dst_cnt, nr_threads, *dsts;
+	int use_sketches = 0;
+	struct rename_scoring rs;
+	struct rename_sketch_index sketch_index = { { NULL } };
 	int num_sources, want_copies;
 	struct progress *progress = NULL;
 	struct dir_rename_info info;
@@ -1403,7 +2005,15 @@ void diffcore_rename_extended(struct diff_options *options,
 	switch (too_many_rename_candidates(num_destinations, num_sources,
 					   options)) {
 	case 1:
-		goto cleanup;
+		/*
+		 * Rather than giving up, score only the candidates that
+		 * their sketches suggest, if we are allowed to.
+		 */
+		if (repo_config_get_bool(options->repo, "diff.renamesketches",
+					 &use_sketches) || !use_sketches)
+			goto cleanup;
+		options->needed_rename_limit = 0;
+		break;
 	case 2:
 		options->degraded_cc_to_c = 1;
 		skip_unmodified = 1;
@@ -1420,46 +2030,52 @@ void diffcore_rename_extended(struct diff_options *options,
 	}
 
 	CALLOC_ARRAY(mx, st_mult(NUM_CANDIDATE_PER_DST, num_destinations));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].p->two;
-		struct diff_score *m;
-
-		if (rename_dst[i].is_rename)
-			continue; /* exact or basename match already handled */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			assert(!one->rename_used || want_copies || break_idx);
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
+	ALLOC_ARRAY(dsts, num_destinations);
+	for (dst_cnt = i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].is_rename)
+			dsts[dst_cnt++] = i;
+
+	rs.options = options;
+	rs.minimum_score = minimum_score;
+	rs.skip_unmodified = skip_unmodified;
+	rs.want_copies = want_copies;
+	rs.prepared = 0;
+	rs.index = NULL;
+	rs.src_cacheable = rs.dst_cacheable = NULL;
+
+	nr_threads = rename_threads(options, num_destinations, num_sources);
+	if (nr_threads > 1 || use_sketches) {
+		init_rename_cacheable(&rs, dsts, dst_cnt);
+		prepare_rename_candidates(&rs, dsts, dst_cnt, use_sketches);
+		rs.prepared = 1;
+	}
+	if (use_sketches) {
+		trace2_region_enter("diff", "sketch index", options->repo);
+		build_sketch_index(&sketch_index, skip_unmodified);
+		rs.index = &sketch_index;
+		trace2_region_leave("diff", "sketch index", options->repo);
+	}
 
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     skip_unmodified);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
+	if (nr_threads > 1) {
+		score_renames_threaded(&rs, mx, dsts, dst_cnt,
+				       nr_threads, progress);
+	} else {
+		struct rename_candidates cand;
+
+		init_rename_candidates(&cand);
+		for (i = 0; i < dst_cnt; i++) {
+			score_rename_sources(&rs, &mx[i * NUM_CANDIDATE_PER_DST],
+					     dsts[i], &cand);
+			display_progress(progress,
+					 (uint64_t)(i + 1) * (uint64_t)num_sources);
 		}
-		dst_cnt++;
-		display_progress(progress,
-				 (uint64_t)dst_cnt * (uint64_t)num_sources);
+		put_new_scores(&rs, &cand);
+		clear_rename_candidates(&cand);
 	}
+	clear_sketch_index(&sketch_index);
+	free(rs.src_cacheable);
+	free(rs.dst_cacheable);
+	free(dsts);
 	stop_progress(&progress);
 
 	/* cost matrix sorted by most to least similar pair */
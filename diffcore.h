@@ -90,6 +90,12 @@ void diff_free_filespec_data(struct diff_filespec *);
 void diff_free_filespec_blob(struct diff_filespec *);
 int diff_filespec_is_binary(struct repository *, struct diff_filespec *);
 
+/*
+ * Whether diff_filespec_is_binary() decides by the contents of the file
+ * alone, rather than by its attributes.
+ */
+int diff_filespec_binary_by_contents(struct repository *, struct diff_filespec *);
+
 /**
  * This records a pair of `struct diff_filespec`; the filespec for a file in
  * the "old" set (i.e. preimage) is called `one`, and the filespec for a file
@@ -212,6 +218,25 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/*
+ * Compute what diffcore_count_changes() needs to know about "spec"
+ * into "spec->cnt_data", unless it is there already. The data of
+ * "spec" must have been populated.
+ */
+void diffcore_prepare_count_data(struct repository *r,
+				 struct diff_filespec *spec);
+
+/*
+ * Compute a MinHash sketch of the set of spans recorded in "cnt_data"
+ * (as filled in by diffcore_prepare_count_data()) into the first "nr"
+ * elements of "sketch". As these use the same hash functions for all
+ * files, the fraction of equal elements in the sketches of two files
+ * estimates how many spans the two have in common. Return 0 if there
+ * are no spans at all.
+ */
+#define DIFFCORE_MINHASH_MAX 64
+int diffcore_minhash(const void *cnt_data, uint32_t *sketch, int nr);
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
@@ -18,6 +18,7 @@
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
 #include "submodule-config.h"
+#include "thread-utils.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -37,6 +38,9 @@ enum path_treatment {
  */
 struct cached_dir {
 	DIR *fdir;
+	struct dir_listing *listing;
+	int listing_nr;
+	size_t listing_pos;
 	struct untracked_cache_dir *untracked;
 	int nr_files;
 	int nr_dirs;
@@ -421,6 +425,78 @@ static int match_pathspec_item(struct index_state *istate,
 	return 0;
 }
 
+/*
+ * do_match_pathspec() is meant to ONLY be called by
+ * match_pathspec_with_flags(); calling it directly risks pathspecs
+ * like ':!unwanted_path' being ignored.
+ *
+ * Given a name and a list of pathspecs, returns the nature of the
+ * closest (i.e. most specific) match of the name to any of the
+ * pathspecs.
+ *
+ * The caller typically calls this multiple times with the same
+ * pathspec and seen[] array but with different name/namelen
+ * (e.g. entries from the index) and is interested in seeing if and
+ * how each pathspec matches all the names it calls this function
+ * with.  A mark is left in the seen[] array for each pathspec element
+ * indicating the closest type of match that element achieved, so if
+ * seen[n] remains zero after multiple invocations, that means the nth
+ * pathspec did not match any names, which could indicate that the
+ * user mistyped the nth pathspec.
+ */
+struct match_pathspec_data {
+	struct index_state *istate;
+	const struct pathspec *ps;
+	const char *name;
+	int namelen;
+	int prefix;
+	char *seen;
+	unsigned flags;
+	int retval;
+};
+
+/*
+ * Match the i-th item of the pathspec, for do_match_pathspec(), with the
+ * prefix already cut off the name.
+ */
+static void match_one_pathspec_item(int i, void *data_)
+{
+	struct match_pathspec_data *data = data_;
+	const struct pathspec *ps = data->ps;
+	const char *name = data->name;
+	char *seen = data->seen;
+	int how;
+
+	if (seen && seen[i] == MATCHED_EXACTLY)
+		return;
+	/*
+	 * Make exclude patterns optional and never report
+	 * "pathspec ':(exclude)foo' matches no files"
+	 */
+	if (seen && ps->items[i].magic & PATHSPEC_EXCLUDE)
+		seen[i] = MATCHED_FNMATCH;
+	how = match_pathspec_item(data->istate, ps->items+i, data->prefix, name,
+				  data->namelen, data->flags);
+	if (ps->recursive &&
+	    (ps->magic & PATHSPEC_MAXDEPTH) &&
+	    ps->max_depth != -1 &&
+	    how && how != MATCHED_FNMATCH) {
+		int len = ps->items[i].len;
+		if (name[len] == '/')
+			len++;
+		if (within_depth(name+len, data->namelen-len, 0, ps->max_depth))
+			how = MATCHED_EXACTLY;
+		else
+			how = 0;
+	}
+	if (how) {
+		if (data->retval < how)
+			data->retval = how;
+		if (seen && seen[i] < how)
+			seen[i] = how;
+	}
+}
+
 /*
  * do_match_pathspec() is meant to ONLY be called by
  * match_pathspec_with_flags(); calling it directly risks pathspecs
@@ -446,7 +522,8 @@ static int do_match_pathspec(struct index_state *istate,
 			     int prefix, char *seen,
 			     unsigned flags)
 {
-	int i, retval = 0, exclude = flags & DO_MATCH_EXCLUDE;
+	int i, exclude = flags & DO_MATCH_EXCLUDE;
+	struct match_pathspec_data data;
 
 	GUARD_PATHSPEC(ps,
 		       PATHSPEC_FROMTOP |
@@ -469,46 +546,32 @@ static int do_match_pathspec(struct index_state *istate,
 			return 0;
 	}
 
-	name += prefix;
-	namelen -= prefix;
+	data.istate = istate;
+	data.ps = ps;
+	data.name = name + prefix;
+	data.namelen = namelen - prefix;
+	data.prefix = prefix;
+	data.seen = seen;
+	data.flags = flags;
+	data.retval = 0;
 
-	for (i = ps->nr - 1; i >= 0; i--) {
-		int how;
+	/*
+	 * Names can be leading directories of the items they match
+	 * with DO_MATCH_LEADING_PATHSPEC, which the candidates do not
+	 * account for.
+	 */
+	if (!exclude && !(flags & DO_MATCH_LEADING_PATHSPEC) &&
+	    !for_each_pathspec_candidate(ps, name, namelen, prefix,
+					 match_one_pathspec_item, &data))
+		return data.retval;
 
+	for (i = ps->nr - 1; i >= 0; i--) {
 		if ((!exclude &&   ps->items[i].magic & PATHSPEC_EXCLUDE) ||
 		    ( exclude && !(ps->items[i].magic & PATHSPEC_EXCLUDE)))
 			continue;
-
-		if (seen && seen[i] == MATCHED_EXACTLY)
-			continue;
-		/*
-		 * Make exclude patterns optional and never report
-		 * "pathspec ':(exclude)foo' matches no files"
-		 */
-		if (seen && ps->items[i].magic & PATHSPEC_EXCLUDE)
-			seen[i] = MATCHED_FNMATCH;
-		how = match_pathspec_item(istate, ps->items+i, prefix, name,
-					  namelen, flags);
-		if (ps->recursive &&
-		    (ps->magic & PATHSPEC_MAXDEPTH) &&
-		    ps->max_depth != -1 &&
-		    how && how != MATCHED_FNMATCH) {
-			int len = ps->items[i].len;
-			if (name[len] == '/')
-				len++;
-			if (within_depth(name+len, namelen-len, 0, ps->max_depth))
-				how = MATCHED_EXACTLY;
-			else
-				how = 0;
-		}
-		if (how) {
-			if (retval < how)
-				retval = how;
-			if (seen && seen[i] < how)
-				seen[i] = how;
-		}
+		match_one_pathspec_item(i, &data);
 	}
-	return retval;
+	return data.retval;
 }
 
 static int match_pathspec_with_flags(struct index_state *istate,
@@ -920,6 +983,13 @@ static int read_skip_worktree_file_from_index(struct index_state *istate,
 	return do_read_blob(&istate->cache[pos]->oid, oid_stat, size_out, data_out);
 }
 
+struct literal_pattern_entry {
+	struct hashmap_entry ent;
+	int pos; /* in pattern_list.patterns */
+	size_t len;
+	char name[FLEX_ARRAY];
+};
+
 /*
  * Frees memory within pl which was allocated for exclude patterns and
  * the file buffer.  Does not free pl itself.
@@ -934,6 +1004,9 @@ void clear_pattern_list(struct pattern_list *pl)
 	free(pl->filebuf);
 	hashmap_clear_and_free(&pl->recursive_hashmap, struct pattern_entry, ent);
 	hashmap_clear_and_free(&pl->parent_hashmap, struct pattern_entry, ent);
+	hashmap_clear_and_free(&pl->basename_hashmap, struct literal_pattern_entry, ent);
+	hashmap_clear_and_free(&pl->pathname_hashmap, struct literal_pattern_entry, ent);
+	free(pl->other_pos);
 
 	memset(pl, 0, sizeof(*pl));
 }
@@ -1349,6 +1422,150 @@ int match_pathname(const char *pathname, int pathlen,
 				 WM_PATHNAME) == 0;
 }
 
+static int pattern_matches(struct path_pattern *pattern,
+			   const char *pathname, int pathlen,
+			   const char *basename, int *dtype,
+			   struct index_state *istate)
+{
+	const char *exclude = pattern->pattern;
+	int prefix = pattern->nowildcardlen;
+
+	if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
+		*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (pattern->flags & PATTERN_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      exclude, prefix, pattern->patternlen,
+				      pattern->flags);
+
+	assert(pattern->baselen == 0 ||
+	       pattern->base[pattern->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      pattern->base,
+			      pattern->baselen ? pattern->baselen - 1 : 0,
+			      exclude, prefix, pattern->patternlen,
+			      pattern->flags);
+}
+
+/*
+ * Lists with fewer patterns than this are scanned linearly; indexing
+ * them would cost more than it saves.
+ */
+#define PATTERN_INDEX_MIN_NR 32
+
+struct literal_pattern_key {
+	const char *name;
+	size_t len;
+};
+
+static unsigned int literal_pattern_hash(const char *name, size_t len)
+{
+	return ignore_case ? memihash(name, len) : memhash(name, len);
+}
+
+static int literal_pattern_cmp(const void *unused_cmp_data,
+			       const struct hashmap_entry *eptr,
+			       const struct hashmap_entry *entry_or_key,
+			       const void *keydata)
+{
+	const struct literal_pattern_entry *e1, *e2;
+	const struct literal_pattern_key *key = keydata;
+
+	e1 = container_of(eptr, const struct literal_pattern_entry, ent);
+	if (!key) {
+		e2 = container_of(entry_or_key,
+				  const struct literal_pattern_entry, ent);
+		return e1->len != e2->len || fspathncmp(e1->name, e2->name, e1->len);
+	}
+	return e1->len != key->len || fspathncmp(e1->name, key->name, e1->len);
+}
+
+static void add_literal_pattern(struct hashmap *map, int pos,
+				const char *base, int baselen,
+				const char *name, int namelen)
+{
+	struct literal_pattern_entry *e;
+
+	if (!map->cmpfn)
+		hashmap_init(map, literal_pattern_cmp, NULL, 0);
+
+	e = xcalloc(1, st_add3(sizeof(*e), baselen, namelen + 1));
+	memcpy(e->name, base, baselen);
+	memcpy(e->name + baselen, name, namelen);
+	e->len = baselen + namelen;
+	e->pos = pos;
+	hashmap_entry_init(&e->ent, literal_pattern_hash(e->name, e->len));
+	hashmap_add(map, &e->ent);
+}
+
+/*
+ * Sort the patterns added to `pl` since the last time into the
+ * hashmaps or the list of other patterns.
+ */
+static void index_patterns(struct pattern_list *pl)
+{
+	for (; pl->indexed_nr < pl->nr; pl->indexed_nr++) {
+		int pos = pl->indexed_nr;
+		struct path_pattern *pattern = pl->patterns[pos];
+		const char *name = pattern->pattern;
+		int namelen = pattern->patternlen;
+
+		if (pattern->nowildcardlen != namelen) {
+			ALLOC_GROW(pl->other_pos, pl->other_nr + 1,
+				   pl->other_alloc);
+			pl->other_pos[pl->other_nr++] = pos;
+		} else if (pattern->flags & PATTERN_FLAG_NODIR) {
+			add_literal_pattern(&pl->basename_hashmap, pos,
+					    "", 0, name, namelen);
+		} else {
+			/* match_pathname() compares base + pattern */
+			if (*name == '/') {
+				name++;
+				namelen--;
+			}
+			add_literal_pattern(&pl->pathname_hashmap, pos,
+					    pattern->base, pattern->baselen,
+					    name, namelen);
+		}
+	}
+}
+
+/*
+ * Return the position of the last pattern in `map` that matches
+ * `name`, or -1 if none does.
+ */
+static int last_matching_literal(struct hashmap *map,
+				 const char *name, int namelen,
+				 const char *pathname, int pathlen, int *dtype,
+				 struct pattern_list *pl,
+				 struct index_state *istate)
+{
+	struct literal_pattern_key key = { name, namelen };
+	struct literal_pattern_entry *e;
+	int last = -1;
+
+	if (!map->cmpfn)
+		return -1;
+
+	e = hashmap_get_entry_from_hash(map, literal_pattern_hash(name, namelen),
+					&key, struct literal_pattern_entry, ent);
+	for (; e; e = hashmap_get_next_entry(map, e, ent)) {
+		if (e->pos <= last)
+			continue;
+		if (pl->patterns[e->pos]->flags & PATTERN_FLAG_MUSTBEDIR) {
+			*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
+			if (*dtype != DT_DIR)
+				continue;
+		}
+		last = e->pos;
+	}
+	return last;
+}
+
 /*
  * Scan the given exclude list in reverse to see whether pathname
  * should be ignored.  The first match (i.e. the last on the list), if
@@ -1362,46 +1579,38 @@ static struct path_pattern *last_matching_pattern_from_list(const char *pathname
 						       struct pattern_list *pl,
 						       struct index_state *istate)
 {
-	struct path_pattern *res = NULL; /* undecided */
-	int i;
+	int i, last;
 
 	if (!pl->nr)
 		return NULL;	/* undefined */
 
-	for (i = pl->nr - 1; 0 <= i; i--) {
-		struct path_pattern *pattern = pl->patterns[i];
-		const char *exclude = pattern->pattern;
-		int prefix = pattern->nowildcardlen;
-
-		if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
-			*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
-
-		if (pattern->flags & PATTERN_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, pattern->patternlen,
-					   pattern->flags)) {
-				res = pattern;
-				break;
-			}
-			continue;
-		}
-
-		assert(pattern->baselen == 0 ||
-		       pattern->base[pattern->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   pattern->base,
-				   pattern->baselen ? pattern->baselen - 1 : 0,
-				   exclude, prefix, pattern->patternlen,
-				   pattern->flags)) {
-			res = pattern;
-			break;
-		}
+	if (pl->nr < PATTERN_INDEX_MIN_NR) {
+		for (i = pl->nr - 1; 0 <= i; i--)
+			if (pattern_matches(pl->patterns[i], pathname, pathlen,
+					    basename, dtype, istate))
+				return pl->patterns[i];
+		return NULL;
 	}
-	return res;
+
+	/*
+	 * Find the last pattern without wildcards that matches, then
+	 * only try the patterns with wildcards that come after it.
+	 */
+	index_patterns(pl);
+	last = last_matching_literal(&pl->basename_hashmap,
+				     basename, pathlen - (basename - pathname),
+				     pathname, pathlen, dtype, pl, istate);
+	i = last_matching_literal(&pl->pathname_hashmap, pathname, pathlen,
+				  pathname, pathlen, dtype, pl, istate);
+	if (last < i)
+		last = i;
+
+	for (i = pl->other_nr - 1; 0 <= i && last < pl->other_pos[i]; i--)
+		if (pattern_matches(pl->patterns[pl->other_pos[i]],
+				    pathname, pathlen, basename, dtype, istate))
+			return pl->patterns[pl->other_pos[i]];
+
+	return last < 0 ? NULL : pl->patterns[last];
 }
 
 /*
@@ -1733,11 +1942,11 @@ static enum exist_status directory_exists_in_index_icase(struct index_state *ist
 							 const char *dirname, int len)
 {
 	struct cache_entry *ce;
+	int is_dir;
 
-	if (index_dir_exists(istate, dirname, len))
+	ce = index_dir_or_file_exists(istate, dirname, len, &is_dir);
+	if (is_dir)
 		return index_directory;
-
-	ce = index_file_exists(istate, dirname, len, ignore_case);
 	if (ce && S_ISGITLINK(ce->ce_mode))
 		return index_gitdir;
 
@@ -2316,6 +2525,211 @@ static void add_untracked(struct untracked_cache_dir *dir, const char *name)
 	dir->untracked[dir->untracked_nr++] = xstrdup(name);
 }
 
+/*
+ * Without a usable untracked cache, every tracked directory has to be
+ * read.  On file systems with high latencies (like NFS), it pays to
+ * read them on several threads up front, like preload_index() does
+ * for the lstat() calls on tracked files; the traversal then picks up
+ * the listings instead of calling opendir() and readdir() itself.
+ *
+ * Mostly randomly chosen limits: at most 20 threads, each of which
+ * should have at least 100 directories to read to be worth starting.
+ */
+#define READAHEAD_MAX_PARALLEL (20)
+#define READAHEAD_THREAD_COST (100)
+
+struct dir_listing {
+	struct hashmap_entry ent;
+
+	/* Set if we could read the directory. */
+	int ok;
+
+	/* The names we read, each followed by a NUL, and their d_type. */
+	struct strbuf names;
+	unsigned char *d_types;
+	int nr, alloc;
+
+	/* With a trailing slash, or empty for the top-level directory. */
+	size_t len;
+	char path[FLEX_ARRAY];
+};
+
+struct dir_readahead {
+	struct hashmap map;
+	struct dir_listing **listings;
+	int nr, alloc;
+};
+
+struct readahead_thread_data {
+	pthread_t pthread;
+	struct dir_listing **listings;
+	int nr;
+};
+
+static int dir_listing_cmp(const void *unused_cmp_data,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata)
+{
+	const struct dir_listing *l1, *l2;
+	const struct strbuf *key = keydata;
+
+	l1 = container_of(eptr, const struct dir_listing, ent);
+	if (key)
+		return l1->len != key->len || memcmp(l1->path, key->buf, key->len);
+	l2 = container_of(entry_or_key, const struct dir_listing, ent);
+	return l1->len != l2->len || memcmp(l1->path, l2->path, l1->len);
+}
+
+static void add_dir_listing(struct dir_readahead *ra,
+			    const char *path, size_t len)
+{
+	struct dir_listing *l;
+
+	FLEX_ALLOC_MEM(l, path, path, len);
+	l->len = len;
+	strbuf_init(&l->names, 0);
+	hashmap_entry_init(&l->ent, memhash(path, len));
+	hashmap_add(&ra->map, &l->ent);
+	ALLOC_GROW(ra->listings, ra->nr + 1, ra->alloc);
+	ra->listings[ra->nr++] = l;
+}
+
+static void read_dir_listing(struct dir_listing *l)
+{
+	DIR *fdir = opendir(l->len ? l->path : ".");
+	struct dirent *de;
+
+	/* Leave it to the traversal to complain. */
+	if (!fdir)
+		return;
+	while ((de = readdir_skip_dot_and_dotdot(fdir))) {
+		ALLOC_GROW(l->d_types, l->nr + 1, l->alloc);
+		l->d_types[l->nr++] = DTYPE(de);
+		strbuf_add(&l->names, de->d_name, strlen(de->d_name) + 1);
+	}
+	closedir(fdir);
+	l->ok = 1;
+}
+
+static void *readahead_thread(void *_data)
+{
+	struct readahead_thread_data *p = _data;
+	int i;
+
+	for (i = 0; i < p->nr; i++)
+		read_dir_listing(p->listings[i]);
+	return NULL;
+}
+
+static void stop_readahead(struct dir_struct *dir)
+{
+	struct dir_readahead *ra = dir->readahead;
+	int i;
+
+	if (!ra)
+		return;
+	for (i = 0; i < ra->nr; i++) {
+		strbuf_release(&ra->listings[i]->names);
+		free(ra->listings[i]->d_types);
+	}
+	hashmap_clear_and_free(&ra->map, struct dir_listing, ent);
+	free(ra->listings);
+	FREE_AND_NULL(dir->readahead);
+}
+
+/*
+ * Collect the directories below `base` that contain tracked files
+ * and read them in parallel.
+ */
+static void start_readahead(struct dir_struct *dir,
+			    struct index_state *istate,
+			    const char *base, int baselen)
+{
+	struct readahead_thread_data data[READAHEAD_MAX_PARALLEL];
+	struct dir_readahead *ra;
+	const char *prev = NULL;
+	int threads, i, work, offset;
+
+	if (!HAVE_THREADS || !core_preload_index || dir->untracked)
+		return;
+
+	ra = xcalloc(1, sizeof(*ra));
+	hashmap_init(&ra->map, dir_listing_cmp, NULL, 0);
+	add_dir_listing(ra, base, baselen);
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+		const char *slash;
+
+		if (ce_skip_worktree(ce) ||
+		    strncmp(ce->name, base, baselen))
+			continue;
+
+		/*
+		 * The index is sorted, so we have seen the leading
+		 * directories this entry shares with the previous one.
+		 */
+		for (slash = strchr(ce->name + baselen, '/'); slash;
+		     slash = strchr(slash + 1, '/')) {
+			size_t len = slash - ce->name + 1;
+
+			if (prev && !strncmp(prev, ce->name, len))
+				continue;
+			add_dir_listing(ra, ce->name, len);
+		}
+		prev = ce->name;
+	}
+
+	threads = ra->nr / READAHEAD_THREAD_COST;
+	if (ra->nr > 1 && threads < 2 &&
+	    git_env_bool("GIT_TEST_PRELOAD_INDEX", 0))
+		threads = 2;
+	if (threads < 2) {
+		dir->readahead = ra;
+		stop_readahead(dir);
+		return;
+	}
+	if (threads > READAHEAD_MAX_PARALLEL)
+		threads = READAHEAD_MAX_PARALLEL;
+
+	trace2_region_enter("dir", "readahead", istate->repo);
+	offset = 0;
+	work = DIV_ROUND_UP(ra->nr, threads);
+	memset(&data, 0, sizeof(data));
+	for (i = 0; i < threads; i++) {
+		struct readahead_thread_data *p = data + i;
+		int err;
+
+		p->listings = ra->listings + offset;
+		p->nr = offset + work <= ra->nr ? work : ra->nr - offset;
+		offset += p->nr;
+		err = pthread_create(&p->pthread, NULL, readahead_thread, p);
+		if (err)
+			die(_("unable to create threaded readdir: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join threaded readdir");
+
+	trace2_data_intmax("dir", istate->repo, "readahead/directories", ra->nr);
+	trace2_region_leave("dir", "readahead", istate->repo);
+	dir->readahead = ra;
+}
+
+static struct dir_listing *find_dir_listing(struct dir_struct *dir,
+					    struct strbuf *path)
+{
+	struct dir_listing *l;
+
+	if (!dir->readahead)
+		return NULL;
+	l = hashmap_get_entry_from_hash(&dir->readahead->map,
+					memhash(path->buf, path->len), path,
+					struct dir_listing, ent);
+	return l && l->ok ? l : NULL;
+}
+
 static int valid_cached_dir(struct dir_struct *dir,
 			    struct untracked_cache_dir *untracked,
 			    struct index_state *istate,
@@ -2377,15 +2791,18 @@ static int open_cached_dir(struct cached_dir *cdir,
 	cdir->untracked = untracked;
 	if (valid_cached_dir(dir, untracked, istate, path, check_only))
 		return 0;
-	c_path = path->len ? path->buf : ".";
-	cdir->fdir = opendir(c_path);
-	if (!cdir->fdir)
-		warning_errno(_("could not open directory '%s'"), c_path);
+	cdir->listing = find_dir_listing(dir, path);
+	if (!cdir->listing) {
+		c_path = path->len ? path->buf : ".";
+		cdir->fdir = opendir(c_path);
+		if (!cdir->fdir)
+			warning_errno(_("could not open directory '%s'"), c_path);
+	}
 	if (dir->untracked) {
 		invalidate_directory(dir->untracked, untracked);
 		dir->untracked->dir_opened++;
 	}
-	if (!cdir->fdir)
+	if (!cdir->fdir && !cdir->listing)
 		return -1;
 	return 0;
 }
@@ -2405,6 +2822,19 @@ static int read_cached_dir(struct cached_dir *cdir)
 		cdir->d_type = DTYPE(de);
 		return 0;
 	}
+	if (cdir->listing) {
+		struct dir_listing *l = cdir->listing;
+
+		if (cdir->listing_nr == l->nr) {
+			cdir->d_name = NULL;
+			cdir->d_type = DT_UNKNOWN;
+			return -1;
+		}
+		cdir->d_name = l->names.buf + cdir->listing_pos;
+		cdir->d_type = l->d_types[cdir->listing_nr++];
+		cdir->listing_pos += strlen(cdir->d_name) + 1;
+		return 0;
+	}
 	while (cdir->nr_dirs < cdir->untracked->dirs_nr) {
 		struct untracked_cache_dir *d = cdir->untracked->dirs[cdir->nr_dirs];
 		if (!d->recurse) {
@@ -2463,7 +2893,7 @@ static void add_path_to_appropriate_result_list(struct dir_struct *dir,
 		if (dir->flags & DIR_SHOW_IGNORED)
 			break;
 		dir_add_name(dir, istate, path->buf, path->len);
-		if (cdir->fdir)
+		if (cdir->fdir || cdir->listing)
 			add_untracked(untracked, path->buf + baselen);
 		break;
 
@@ -2568,7 +2998,7 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 
 			/* abort early if maximum state has been reached */
 			if (dir_state == path_untracked) {
-				if (cdir.fdir)
+				if (cdir.fdir || cdir.listing)
 					add_untracked(untracked, path.buf + baselen);
 				break;
 			}
@@ -2888,8 +3318,11 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
-	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
+	if (!len || treat_leading_path(dir, istate, path, len, pathspec)) {
+		start_readahead(dir, istate, path, len);
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+		stop_readahead(dir);
+	}
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
@@ -2899,9 +3332,19 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 	if (dir->untracked) {
 		static int force_untracked_cache = -1;
 
-		if (force_untracked_cache < 0)
+		if (force_untracked_cache < 0) {
+			struct repository *r = istate->repo ? istate->repo : the_repository;
+
+			/*
+			 * A cache shared with the FSMonitor daemon is only
+			 * worth as much as what was last written.
+			 */
+			prepare_repo_settings(r);
 			force_untracked_cache =
-				git_env_bool("GIT_FORCE_UNTRACKED_CACHE", 0);
+				git_env_bool("GIT_FORCE_UNTRACKED_CACHE", 0) ||
+				(r->settings.use_builtin_fsmonitor > 0 &&
+				 r->settings.fsmonitor_untracked_cache > 0);
+		}
 		if (force_untracked_cache &&
 			dir->untracked == istate->untracked &&
 		    (dir->untracked->dir_opened ||
@@ -115,6 +115,20 @@ struct pattern_list {
 	 * Used to check single-level parents of blobs.
 	 */
 	struct hashmap parent_hashmap;
+
+	/*
+	 * Once the list is long enough, the patterns without wildcards
+	 * are looked up by the basename (or, if they contain a slash,
+	 * the full pathname) they match in these hashmaps, rather than
+	 * tried one after the other.  `other_pos` lists the positions
+	 * of the remaining patterns.  All of them cover the first
+	 * `indexed_nr` patterns.
+	 */
+	struct hashmap basename_hashmap;
+	struct hashmap pathname_hashmap;
+	int *other_pos;
+	int other_nr, other_alloc;
+	int indexed_nr;
 };
 
 /*
@@ -340,6 +354,9 @@ struct dir_struct {
 	/* Stats about the traversal */
 	unsigned visited_paths;
 	unsigned visited_directories;
+
+	/* Listings of tracked directories read in parallel, if any */
+	struct dir_readahead *readahead;
 };
 
 struct dirent *readdir_skip_dot_and_dotdot(DIR *dirp);
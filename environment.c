@@ -34,6 +34,7 @@ int warn_on_object_refname_ambiguity = 1;
 int ref_paranoia = -1;
 int repository_format_precious_objects;
 int repository_format_worktree_config;
+int repository_format_packed_refs_delta;
 const char *git_commit_encoding;
 const char *git_log_output_encoding;
 char *apply_default_whitespace;
@@ -44,9 +45,17 @@ int zlib_compression_level = Z_BEST_SPEED;
 int core_compression_level;
 int pack_compression_level = Z_DEFAULT_COMPRESSION;
 int fsync_object_files;
+int fsync_ref_files;
+enum fsync_method fsync_method = FSYNC_METHOD_FSYNC;
+enum checksum_trust checksum_trust = CHECKSUM_TRUST_VERIFIED;
+unsigned long hashfile_buffer_size = 128 * 1024;
+int hashfile_write_thread = 1;
 size_t packed_git_window_size = DEFAULT_PACKED_GIT_WINDOW_SIZE;
 size_t packed_git_limit = DEFAULT_PACKED_GIT_LIMIT;
 size_t delta_base_cache_limit = 96 * 1024 * 1024;
+size_t tree_cache_limit;
+size_t pack_readahead_size;
+int core_loose_object_index;
 unsigned long big_file_threshold = 512 * 1024 * 1024;
 int pager_use_color = 1;
 const char *editor_program;
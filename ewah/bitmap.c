@@ -105,13 +105,18 @@ struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
 	struct bitmap *bitmap = bitmap_new();
 	struct ewah_iterator it;
 	eword_t blowup;
-	size_t i = 0;
+	size_t i = 0, len;
 
 	ewah_iterator_init(&it, ewah);
 
-	while (ewah_iterator_next(&blowup, &it)) {
-		ALLOC_GROW(bitmap->words, i + 1, bitmap->word_alloc);
-		bitmap->words[i++] = blowup;
+	while (ewah_iterator_next_run(&blowup, &len, &it)) {
+		ALLOC_GROW(bitmap->words, st_add(i, len), bitmap->word_alloc);
+		if (len == 1)
+			bitmap->words[i] = blowup;
+		else
+			memset(bitmap->words + i, blowup ? 0xff : 0,
+			       st_mult(len, sizeof(eword_t)));
+		i += len;
 	}
 
 	bitmap->word_alloc = i;
@@ -142,7 +147,7 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
 	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
+	size_t i = 0, len;
 	struct ewah_iterator it;
 	eword_t word;
 
@@ -155,8 +160,13 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 
 	ewah_iterator_init(&it, other);
 
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	while (ewah_iterator_next_run(&word, &len, &it)) {
+		if (len == 1)
+			self->words[i] |= word;
+		else if (word)
+			memset(self->words + i, 0xff, st_mult(len, sizeof(eword_t)));
+		i += len;
+	}
 }
 
 size_t bitmap_popcount(struct bitmap *self)
@@ -357,6 +357,36 @@ int ewah_iterator_next(eword_t *next, struct ewah_iterator *it)
 	return 1;
 }
 
+int ewah_iterator_next_run(eword_t *next, size_t *len,
+			   struct ewah_iterator *it)
+{
+	if (it->pointer >= it->buffer_size)
+		return 0;
+
+	if (it->compressed < it->rl) {
+		*len = it->rl - it->compressed;
+		it->compressed = it->rl;
+		*next = it->b ? (eword_t)(~0) : 0;
+	} else {
+		assert(it->literals < it->lw);
+
+		it->literals++;
+		it->pointer++;
+
+		assert(it->pointer < it->buffer_size);
+
+		*len = 1;
+		*next = it->buffer[it->pointer];
+	}
+
+	if (it->compressed == it->rl && it->literals == it->lw) {
+		if (++it->pointer < it->buffer_size)
+			read_new_rlw(it);
+	}
+
+	return 1;
+}
+
 void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
 {
 	it->buffer = parent->buffer;
@@ -148,6 +148,17 @@ void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
  */
 int ewah_iterator_next(eword_t *next, struct ewah_iterator *it);
 
+/**
+ * Like ewah_iterator_next(), but yield a whole run of identical words
+ * at once: the next `*len` words of the bitmap are all equal to `*next`.
+ * A run is either a stretch of compressed words or one literal word, so
+ * callers can skip empty stretches without expanding them.
+ *
+ * Return: true if a run was yield, false if there are no words left
+ */
+int ewah_iterator_next_run(eword_t *next, size_t *len,
+			   struct ewah_iterator *it);
+
 void ewah_xor(
 	struct ewah_bitmap *ewah_i,
 	struct ewah_bitmap *ewah_j,
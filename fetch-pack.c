@@ -38,6 +38,7 @@ static int transfer_fsck_objects = -1;
 static int agent_supported;
 static int server_supports_filtering;
 static int advertise_sid;
+static int packfile_uri_jobs = 4;
 static struct shallow_lock shallow_lock;
 static const char *alternate_shallow_file;
 static struct fsck_options fsck_options = FSCK_OPTIONS_MISSING_GITMODULES;
@@ -1536,6 +1537,63 @@ static void do_check_stateless_delimiter(int stateless_rpc,
 				  _("git fetch-pack: expected response end packet"));
 }
 
+static void start_packfile_uri_download(struct child_process *cmd,
+					const char *hash_and_uri,
+					const struct strvec *index_pack_args)
+{
+	int j;
+	const char *uri = hash_and_uri + the_hash_algo->hexsz + 1;
+
+	child_process_init(cmd);
+	strvec_push(&cmd->args, "http-fetch");
+	strvec_pushf(&cmd->args, "--packfile=%.*s",
+		     (int) the_hash_algo->hexsz, hash_and_uri);
+	for (j = 0; j < index_pack_args->nr; j++)
+		strvec_pushf(&cmd->args, "--index-pack-arg=%s",
+			     index_pack_args->v[j]);
+	strvec_push(&cmd->args, uri);
+	cmd->git_cmd = 1;
+	cmd->no_stdin = 1;
+	cmd->out = -1;
+	if (start_command(cmd))
+		die("fetch-pack: unable to spawn http-fetch");
+}
+
+static void finish_packfile_uri_download(struct child_process *cmd,
+					 const char *hash_and_uri,
+					 struct string_list *pack_lockfiles)
+{
+	char packname[GIT_MAX_HEXSZ + 1];
+	const char *uri = hash_and_uri + the_hash_algo->hexsz + 1;
+
+	if (read_in_full(cmd->out, packname, 5) < 0 ||
+	    memcmp(packname, "keep\t", 5))
+		die("fetch-pack: expected keep then TAB at start of http-fetch output");
+
+	if (read_in_full(cmd->out, packname,
+			 the_hash_algo->hexsz + 1) < 0 ||
+	    packname[the_hash_algo->hexsz] != '\n')
+		die("fetch-pack: expected hash then LF at end of http-fetch output");
+
+	packname[the_hash_algo->hexsz] = '\0';
+
+	parse_gitmodules_oids(cmd->out, &fsck_options.gitmodules_found);
+
+	close(cmd->out);
+
+	if (finish_command(cmd))
+		die("fetch-pack: unable to finish http-fetch");
+
+	if (memcmp(hash_and_uri, packname, the_hash_algo->hexsz))
+		die("fetch-pack: pack downloaded from %s does not match expected hash %.*s",
+		    uri, (int) the_hash_algo->hexsz, hash_and_uri);
+
+	string_list_append_nodup(pack_lockfiles,
+				 xstrfmt("%s/pack/pack-%s.keep",
+					 get_object_directory(),
+					 packname));
+}
+
 static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 				    int fd[2],
 				    const struct ref *orig_ref,
@@ -1557,8 +1615,9 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 	struct object_id common_oid;
 	int received_ready = 0;
 	struct string_list packfile_uris = STRING_LIST_INIT_DUP;
-	int i;
+	int i, started = 0;
 	struct strvec index_pack_args = STRVEC_INIT;
+	struct child_process *downloads;
 
 	negotiator = &negotiator_alloc;
 	fetch_negotiator_init(r, negotiator);
@@ -1660,56 +1719,19 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 		}
 	}
 
+	CALLOC_ARRAY(downloads, packfile_uris.nr);
 	for (i = 0; i < packfile_uris.nr; i++) {
-		int j;
-		struct child_process cmd = CHILD_PROCESS_INIT;
-		char packname[GIT_MAX_HEXSZ + 1];
-		const char *uri = packfile_uris.items[i].string +
-			the_hash_algo->hexsz + 1;
-
-		strvec_push(&cmd.args, "http-fetch");
-		strvec_pushf(&cmd.args, "--packfile=%.*s",
-			     (int) the_hash_algo->hexsz,
-			     packfile_uris.items[i].string);
-		for (j = 0; j < index_pack_args.nr; j++)
-			strvec_pushf(&cmd.args, "--index-pack-arg=%s",
-				     index_pack_args.v[j]);
-		strvec_push(&cmd.args, uri);
-		cmd.git_cmd = 1;
-		cmd.no_stdin = 1;
-		cmd.out = -1;
-		if (start_command(&cmd))
-			die("fetch-pack: unable to spawn http-fetch");
-
-		if (read_in_full(cmd.out, packname, 5) < 0 ||
-		    memcmp(packname, "keep\t", 5))
-			die("fetch-pack: expected keep then TAB at start of http-fetch output");
-
-		if (read_in_full(cmd.out, packname,
-				 the_hash_algo->hexsz + 1) < 0 ||
-		    packname[the_hash_algo->hexsz] != '\n')
-			die("fetch-pack: expected hash then LF at end of http-fetch output");
-
-		packname[the_hash_algo->hexsz] = '\0';
-
-		parse_gitmodules_oids(cmd.out, &fsck_options.gitmodules_found);
-
-		close(cmd.out);
-
-		if (finish_command(&cmd))
-			die("fetch-pack: unable to finish http-fetch");
-
-		if (memcmp(packfile_uris.items[i].string, packname,
-			   the_hash_algo->hexsz))
-			die("fetch-pack: pack downloaded from %s does not match expected hash %.*s",
-			    uri, (int) the_hash_algo->hexsz,
-			    packfile_uris.items[i].string);
-
-		string_list_append_nodup(pack_lockfiles,
-					 xstrfmt("%s/pack/pack-%s.keep",
-						 get_object_directory(),
-						 packname));
-	}
+		/* Keep up to packfile_uri_jobs downloads going at a time. */
+		for (; started < packfile_uris.nr &&
+		       started < i + packfile_uri_jobs; started++)
+			start_packfile_uri_download(&downloads[started],
+						    packfile_uris.items[started].string,
+						    &index_pack_args);
+		finish_packfile_uri_download(&downloads[i],
+					     packfile_uris.items[i].string,
+					     pack_lockfiles);
+	}
+	free(downloads);
 	string_list_clear(&packfile_uris, 0);
 	strvec_clear(&index_pack_args);
 
@@ -1756,6 +1778,9 @@ static void fetch_pack_config(void)
 	git_config_get_bool("fetch.fsckobjects", &fetch_fsck_objects);
 	git_config_get_bool("transfer.fsckobjects", &transfer_fsck_objects);
 	git_config_get_bool("transfer.advertisesid", &advertise_sid);
+	git_config_get_int("fetch.packfileurijobs", &packfile_uri_jobs);
+	if (packfile_uri_jobs < 1)
+		packfile_uri_jobs = 1;
 	if (!uri_protocols.nr) {
 		char *str;
 
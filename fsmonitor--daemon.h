@@ -50,6 +50,12 @@ struct fsmonitor_daemon_state {
 	int cookie_seq;
 	struct hashmap cookies;
 
+	/*
+	 * The last untracked cache a client shared with us: its
+	 * token, a NUL and its "UNTR" index extension data.
+	 */
+	struct strbuf untracked_snapshot;
+
 	int error_code;
 	struct fsmonitor_daemon_backend_data *backend_data;
 
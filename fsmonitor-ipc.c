@@ -142,6 +142,31 @@ int fsmonitor_ipc__send_command(const char *command,
 	return 0;
 }
 
+int fsmonitor_ipc__send_message(const char *message, size_t message_len,
+				struct strbuf *answer)
+{
+	struct ipc_client_connection *connection = NULL;
+	struct ipc_client_connect_options options
+		= IPC_CLIENT_CONNECT_OPTIONS_INIT;
+	int ret;
+
+	strbuf_reset(answer);
+
+	options.wait_if_busy = 1;
+	options.wait_if_not_found = 0;
+
+	if (ipc_client_try_connect(fsmonitor_ipc__get_path(), &options,
+				   &connection) != IPC_STATE__LISTENING)
+		return -1;
+
+	ret = ipc_client_send_command_to_connection(connection,
+						    message, message_len,
+						    answer);
+	ipc_client_close_connection(connection);
+
+	return ret;
+}
+
 #else
 
 /*
@@ -176,4 +201,10 @@ int fsmonitor_ipc__send_command(const char *command,
 	return -1;
 }
 
+int fsmonitor_ipc__send_message(const char *message, size_t message_len,
+				struct strbuf *answer)
+{
+	return -1;
+}
+
 #endif
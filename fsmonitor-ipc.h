@@ -45,4 +45,13 @@ int fsmonitor_ipc__send_query(const char *since_token,
 int fsmonitor_ipc__send_command(const char *command,
 				struct strbuf *answer);
 
+/*
+ * Like fsmonitor_ipc__send_command(), but `message` may contain NULs
+ * and it is not an error if no daemon is running.
+ *
+ * Returns -1 on error or if no daemon is available; 0 on success.
+ */
+int fsmonitor_ipc__send_message(const char *message, size_t message_len,
+				struct strbuf *answer);
+
 #endif /* FSMONITOR_IPC_H */
@@ -458,6 +458,109 @@ void refresh_fsmonitor(struct index_state *istate)
 	istate->fsmonitor_last_update = strbuf_detach(&last_update_token, NULL);
 }
 
+static int share_untracked_cache(struct index_state *istate)
+{
+	struct repository *r = istate->repo ? istate->repo : the_repository;
+
+	prepare_repo_settings(r);
+	return r->settings.use_builtin_fsmonitor > 0 &&
+		r->settings.fsmonitor_untracked_cache > 0;
+}
+
+void fsmonitor_share_untracked_cache(struct index_state *istate,
+				     const struct strbuf *untracked_ext)
+{
+	struct strbuf message = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+
+	if (!(istate->cache_changed & UNTRACKED_CHANGED) ||
+	    !istate->fsmonitor_last_update ||
+	    !starts_with(istate->fsmonitor_last_update, "builtin:") ||
+	    !share_untracked_cache(istate))
+		return;
+
+	strbuf_addstr(&message, "untracked-put");
+	strbuf_addch(&message, '\0');
+	strbuf_addstr(&message, istate->fsmonitor_last_update);
+	strbuf_addch(&message, '\0');
+	strbuf_addbuf(&message, untracked_ext);
+
+	trace_printf_key(&trace_fsmonitor, "share untracked cache at '%s'",
+			 istate->fsmonitor_last_update);
+	fsmonitor_ipc__send_message(message.buf, message.len, &answer);
+
+	strbuf_release(&message);
+	strbuf_release(&answer);
+}
+
+int fsmonitor_restore_untracked_cache(struct index_state *istate)
+{
+	const char *command = "untracked-get";
+	struct strbuf snapshot = STRBUF_INIT;
+	struct strbuf changes = STRBUF_INIT;
+	struct untracked_cache *uc = NULL;
+	size_t token_len, bol, i;
+	int count = 0;
+
+	if (istate->untracked || !share_untracked_cache(istate))
+		return -1;
+
+	if (fsmonitor_ipc__send_message(command, strlen(command), &snapshot))
+		goto fail;
+	token_len = strnlen(snapshot.buf, snapshot.len);
+	if (!token_len || token_len == snapshot.len)
+		goto fail;
+	uc = read_untracked_extension(snapshot.buf + token_len + 1,
+				      snapshot.len - token_len - 1);
+	if (!uc)
+		goto fail;
+
+	/*
+	 * The cache was up to date as of its token, so everything the
+	 * daemon saw change since then has to be looked at again,
+	 * just like refresh_fsmonitor() does for the index's own token.
+	 * If the daemon cannot tell (it was restarted or lost sync), we
+	 * are better off starting from scratch.
+	 */
+	if (fsmonitor_ipc__send_query(snapshot.buf, &changes) ||
+	    fsmonitor_is_trivial_response(&changes))
+		goto fail;
+
+	istate->untracked = uc;
+	istate->cache_changed |= UNTRACKED_CHANGED;
+
+	bol = strnlen(changes.buf, changes.len) + 1;
+	for (i = bol; i < changes.len; i++) {
+		char *name = changes.buf + bol;
+		size_t len = i - bol;
+
+		if (changes.buf[i] != '\0')
+			continue;
+		bol = i + 1;
+		if (!len)
+			continue;
+		/* Need to remove the / from the path for the untracked cache */
+		if (name[len - 1] == '/')
+			name[len - 1] = '\0';
+		untracked_cache_invalidate_path(istate, name, 0);
+		count++;
+	}
+
+	trace_printf_key(&trace_fsmonitor,
+			 "restored untracked cache from '%s', %d changed paths",
+			 snapshot.buf, count);
+	strbuf_release(&snapshot);
+	strbuf_release(&changes);
+	return 0;
+
+fail:
+	if (uc)
+		free_untracked_cache(uc);
+	strbuf_release(&snapshot);
+	strbuf_release(&changes);
+	return -1;
+}
+
 /*
  * The caller wants to turn on FSMonitor.  And when the caller writes
  * the index to disk, a FSMonitor extension should be included.  This
@@ -49,6 +49,23 @@ void refresh_fsmonitor(struct index_state *istate);
  */
 int fsmonitor_is_trivial_response(const struct strbuf *query_result);
 
+/*
+ * With `core.fsmonitorUntrackedCache`, hand the untracked cache we are
+ * about to write into the index (in `untracked_ext`, the "UNTR"
+ * extension data) to the built-in FSMonitor daemon, if it changed.
+ */
+void fsmonitor_share_untracked_cache(struct index_state *istate,
+				     const struct strbuf *untracked_ext);
+
+/*
+ * With `core.fsmonitorUntrackedCache`, set up the untracked cache of an
+ * index that has none from the one last shared with the built-in
+ * FSMonitor daemon, and invalidate what changed since.
+ *
+ * Returns 0 if the cache was restored; -1 otherwise.
+ */
+int fsmonitor_restore_untracked_cache(struct index_state *istate);
+
 /*
  * Check if refresh_fsmonitor has been called at least once.
  * refresh_fsmonitor is idempotent. Returns true if fsmonitor is
@@ -68,7 +85,7 @@ static inline int is_fsmonitor_refreshed(const struct index_state *istate)
 static inline void mark_fsmonitor_valid(struct index_state *istate, struct cache_entry *ce)
 {
 	if (core_fsmonitor && !(ce->ce_flags & CE_FSMONITOR_VALID)) {
-		istate->cache_changed = 1;
+		istate->cache_changed |= FSMONITOR_CHANGED;
 		ce->ce_flags |= CE_FSMONITOR_VALID;
 		trace_printf_key(&trace_fsmonitor, "mark_fsmonitor_clean '%s'", ce->name);
 	}
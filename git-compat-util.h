@@ -909,6 +909,20 @@ char *xgetcwd(void);
 FILE *fopen_for_writing(const char *path);
 FILE *fopen_or_warn(const char *path, const char *mode);
 
+enum fsync_action {
+	/* Start writing back dirty pages, without waiting for the device. */
+	FSYNC_WRITEOUT_ONLY,
+	/* Flush data and metadata all the way to stable storage. */
+	FSYNC_HARDWARE_FLUSH
+};
+
+/*
+ * Issue a full hardware flush or just the writeout of dirty data for
+ * "fd".  Returns -1 with errno set to ENOSYS when the platform cannot
+ * do the requested action on its own.
+ */
+int git_fsync(int fd, enum fsync_action action);
+
 /*
  * Like strncmp, but only return zero if s is NUL-terminated and exactly len
  * characters long.  If it is not, consider it greater than t.
@@ -1,7 +1,9 @@
 #include "builtin.h"
 #include "config.h"
+#include "dir.h"
 #include "exec-cmd.h"
 #include "help.h"
+#include "json-writer.h"
 #include "run-command.h"
 #include "alias.h"
 #include "shallow.h"
@@ -17,6 +19,15 @@
 #define SUPPORT_SUPER_PREFIX	(1<<4)
 #define DELAY_PAGER_CONFIG	(1<<5)
 #define NO_PARSEOPT		(1<<6) /* parse-options is not used */
+/*
+ * run_command() may call the builtin in the calling process instead of
+ * spawning "git": it leaves no global state behind that would affect
+ * its caller or a later call, and does not mind finding the repository
+ * and config already set up. It must also report its failures by
+ * returning rather than by die()ing, which would take the caller down
+ * with it; only running out of memory and the like may still die.
+ */
+#define RUN_IN_PROCESS		(1<<7)
 
 struct cmd_struct {
 	const char *cmd;
@@ -549,7 +560,7 @@ static struct cmd_struct commands[] = {
 	{ "ls-tree", cmd_ls_tree, RUN_SETUP },
 	{ "mailinfo", cmd_mailinfo, RUN_SETUP_GENTLY | NO_PARSEOPT },
 	{ "mailsplit", cmd_mailsplit, NO_PARSEOPT },
-	{ "maintenance", cmd_maintenance, RUN_SETUP | NO_PARSEOPT },
+	{ "maintenance", cmd_maintenance, RUN_SETUP_GENTLY | NO_PARSEOPT },
 	{ "merge", cmd_merge, RUN_SETUP | NEED_WORK_TREE },
 	{ "merge-base", cmd_merge_base, RUN_SETUP },
 	{ "merge-file", cmd_merge_file, RUN_SETUP_GENTLY },
@@ -559,7 +570,7 @@ static struct cmd_struct commands[] = {
 	{ "merge-recursive-ours", cmd_merge_recursive, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
 	{ "merge-recursive-theirs", cmd_merge_recursive, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
 	{ "merge-subtree", cmd_merge_recursive, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
-	{ "merge-tree", cmd_merge_tree, RUN_SETUP | NO_PARSEOPT },
+	{ "merge-tree", cmd_merge_tree, RUN_SETUP },
 	{ "mktag", cmd_mktag, RUN_SETUP | NO_PARSEOPT },
 	{ "mktree", cmd_mktree, RUN_SETUP },
 	{ "multi-pack-index", cmd_multi_pack_index, RUN_SETUP_GENTLY },
@@ -568,13 +579,14 @@ static struct cmd_struct commands[] = {
 	{ "notes", cmd_notes, RUN_SETUP },
 	{ "pack-objects", cmd_pack_objects, RUN_SETUP },
 	{ "pack-redundant", cmd_pack_redundant, RUN_SETUP | NO_PARSEOPT },
-	{ "pack-refs", cmd_pack_refs, RUN_SETUP },
+	{ "pack-refs", cmd_pack_refs, RUN_SETUP | RUN_IN_PROCESS },
 	{ "patch-id", cmd_patch_id, RUN_SETUP_GENTLY | NO_PARSEOPT },
 	{ "pickaxe", cmd_blame, RUN_SETUP },
 	{ "prune", cmd_prune, RUN_SETUP },
 	{ "prune-packed", cmd_prune_packed, RUN_SETUP },
 	{ "pull", cmd_pull, RUN_SETUP | NEED_WORK_TREE },
 	{ "push", cmd_push, RUN_SETUP },
+	{ "query--daemon", cmd_query__daemon, RUN_SETUP },
 	{ "range-diff", cmd_range_diff, RUN_SETUP | USE_PAGER },
 	{ "read-tree", cmd_read_tree, RUN_SETUP | SUPPORT_SUPER_PREFIX},
 	{ "rebase", cmd_rebase, RUN_SETUP | NEED_WORK_TREE },
@@ -586,6 +598,7 @@ static struct cmd_struct commands[] = {
 	{ "remote-fd", cmd_remote_fd, NO_PARSEOPT },
 	{ "repack", cmd_repack, RUN_SETUP },
 	{ "replace", cmd_replace, RUN_SETUP },
+	{ "replay", cmd_replay, RUN_SETUP },
 	{ "rerere", cmd_rerere, RUN_SETUP },
 	{ "reset", cmd_reset, RUN_SETUP },
 	{ "restore", cmd_restore, RUN_SETUP | NEED_WORK_TREE },
@@ -642,6 +655,72 @@ int is_builtin(const char *s)
 	return !!get_builtin(s);
 }
 
+/*
+ * A child would find the repository we have set up only if it starts
+ * at the top of it, where setup_git_directory() left us.
+ */
+static int at_top_of_repository(void)
+{
+	struct strbuf cwd = STRBUF_INIT, top = STRBUF_INIT;
+	const char *dir = get_git_work_tree();
+	int ret;
+
+	if (!dir)
+		dir = get_git_dir();
+	ret = strbuf_realpath(&cwd, ".", 0) &&
+	      strbuf_realpath(&top, dir, 0) &&
+	      !fspathcmp(cwd.buf, top.buf);
+
+	strbuf_release(&cwd);
+	strbuf_release(&top);
+	return ret;
+}
+
+/*
+ * The routine that run_command() calls to run a git command in this
+ * process rather than spawning one; see set_run_in_process_routine().
+ */
+static int run_builtin_in_process(const char **argv, int *status)
+{
+	struct cmd_struct *p = get_builtin(argv[0]);
+	struct strvec args = STRVEC_INIT;
+	struct json_writer jw = JSON_WRITER_INIT;
+	const char **copy;
+	int i;
+
+	if (!p || !(p->option & RUN_IN_PROCESS))
+		return 0;
+	if ((p->option & RUN_SETUP) &&
+	    (!startup_info->have_repository || !at_top_of_repository()))
+		return 0;
+
+	/* the builtin may shuffle its argv, so give it a copy to play with */
+	strvec_pushv(&args, argv);
+	ALLOC_ARRAY(copy, args.nr + 1);
+	COPY_ARRAY(copy, args.v, args.nr + 1);
+
+	trace_argv_printf(args.v, "trace: built-in: git");
+	if (trace2_is_enabled()) {
+		/* spelled like the argv of a "child_start" event */
+		jw_array_begin(&jw, 0);
+		jw_array_string(&jw, "git");
+		for (i = 0; i < args.nr; i++)
+			jw_array_string(&jw, args.v[i]);
+		jw_end(&jw);
+		trace2_data_json("run_command", the_repository, "argv", &jw);
+		jw_release(&jw);
+	}
+	trace2_region_enter_printf("run_command", "in_process", the_repository,
+				   "%s", p->cmd);
+	*status = p->fn(args.nr, copy, NULL) & 0xff;
+	trace2_region_leave_printf("run_command", "in_process", the_repository,
+				   "%s", p->cmd);
+
+	free(copy);
+	strvec_clear(&args);
+	return 1;
+}
+
 static void list_builtins(struct string_list *out, unsigned int exclude_option)
 {
 	int i;
@@ -867,6 +946,7 @@ int cmd_main(int argc, const char **argv)
 	}
 
 	trace_command_performance(argv);
+	set_run_in_process_routine(run_builtin_in_process);
 
 	/*
 	 * "git-xxxx" is the same as "git xxxx", but we obviously:
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-slab.h"
 #include "color.h"
 #include "graph.h"
 #include "revision.h"
@@ -81,6 +82,8 @@ static void graph_show_line_prefix(const struct diff_options *diffopt)
 
 static const char **column_colors;
 static unsigned short column_colors_max;
+/* the lengths of the escape sequences in column_colors */
+static size_t *column_color_lens;
 
 static void parse_graph_colors_config(struct strvec *colors, const char *string)
 {
@@ -104,13 +107,13 @@ static void parse_graph_colors_config(struct strvec *colors, const char *string)
 
 void graph_set_column_colors(const char **colors, unsigned short colors_max)
 {
+	int i;
+
 	column_colors = colors;
 	column_colors_max = colors_max;
-}
-
-static const char *column_get_color_code(unsigned short color)
-{
-	return column_colors[color];
+	REALLOC_ARRAY(column_color_lens, colors_max + 1);
+	for (i = 0; i <= colors_max; i++)
+		column_color_lens[i] = strlen(colors[i]);
 }
 
 struct graph_line {
@@ -138,19 +141,30 @@ static inline void graph_line_addstr(struct graph_line *line, const char *s)
 
 static inline void graph_line_addcolor(struct graph_line *line, unsigned short color)
 {
-	strbuf_addstr(line->buf, column_get_color_code(color));
+	strbuf_add(line->buf, column_colors[color], column_color_lens[color]);
 }
 
 static void graph_line_write_column(struct graph_line *line, const struct column *c,
 				    char col_char)
 {
-	if (c->color < column_colors_max)
+	if (c->color < column_colors_max) {
+		strbuf_grow(line->buf, column_color_lens[c->color] + 1 +
+			    column_color_lens[column_colors_max]);
 		graph_line_addcolor(line, c->color);
+	}
 	graph_line_addch(line, col_char);
 	if (c->color < column_colors_max)
 		graph_line_addcolor(line, column_colors_max);
 }
 
+/*
+ * The position of each commit in the columns or new_columns array it
+ * was last put into, so that finding the column of a commit does not
+ * need a scan of all of them. It may be stale; it is only trusted if
+ * the column it points at is the commit's.
+ */
+define_commit_slab(graph_column_slab, int);
+
 struct git_graph {
 	/*
 	 * The commit currently being processed
@@ -309,6 +323,10 @@ struct git_graph {
 	 * stored as an index into the array column_colors.
 	 */
 	unsigned short default_column_color;
+	/*
+	 * The index of each commit in columns or new_columns.
+	 */
+	struct graph_column_slab column_index;
 };
 
 static struct strbuf *diff_output_prefix_callback(struct diff_options *opt, void *data)
@@ -390,6 +408,7 @@ struct git_graph *graph_init(struct rev_info *opt)
 	ALLOC_ARRAY(graph->new_columns, graph->column_capacity);
 	ALLOC_ARRAY(graph->mapping, 2 * graph->column_capacity);
 	ALLOC_ARRAY(graph->old_mapping, 2 * graph->column_capacity);
+	init_graph_column_slab(&graph->column_index);
 
 	/*
 	 * The diff output prefix callback, with this we can make
@@ -507,26 +526,35 @@ static void graph_increment_column_color(struct git_graph *graph)
 		column_colors_max;
 }
 
-static unsigned short graph_find_commit_color(const struct git_graph *graph,
-					      const struct commit *commit)
+/*
+ * Return the index of `commit` in `columns` if it is there, -1 otherwise.
+ */
+static int graph_find_column(struct git_graph *graph,
+			     const struct column *columns, int num_columns,
+			     struct commit *commit)
+{
+	int *i = graph_column_slab_peek(&graph->column_index, commit);
+
+	if (i && *i < num_columns && columns[*i].commit == commit)
+		return *i;
+	return -1;
+}
+
+static unsigned short graph_find_commit_color(struct git_graph *graph,
+					      struct commit *commit)
 {
-	int i;
-	for (i = 0; i < graph->num_columns; i++) {
-		if (graph->columns[i].commit == commit)
-			return graph->columns[i].color;
-	}
+	int i = graph_find_column(graph, graph->columns, graph->num_columns,
+				  commit);
+	if (i >= 0)
+		return graph->columns[i].color;
 	return graph_get_current_column_color(graph);
 }
 
 static int graph_find_new_column_by_commit(struct git_graph *graph,
 					   struct commit *commit)
 {
-	int i;
-	for (i = 0; i < graph->num_new_columns; i++) {
-		if (graph->new_columns[i].commit == commit)
-			return i;
-	}
-	return -1;
+	return graph_find_column(graph, graph->new_columns,
+				 graph->num_new_columns, commit);
 }
 
 static void graph_insert_into_new_columns(struct git_graph *graph,
@@ -544,6 +572,7 @@ static void graph_insert_into_new_columns(struct git_graph *graph,
 		i = graph->num_new_columns++;
 		graph->new_columns[i].commit = commit;
 		graph->new_columns[i].color = graph_find_commit_color(graph, commit);
+		*graph_column_slab_at(&graph->column_index, commit) = i;
 	}
 
 	if (graph->num_parents > 1 && idx > -1 && graph->merge_layout == -1) {
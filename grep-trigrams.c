@@ -0,0 +1,762 @@
+#include "cache.h"
+#include "repository.h"
+#include "config.h"
+#include "lockfile.h"
+#include "object-store.h"
+#include "progress.h"
+#include "commit.h"
+#include "revision.h"
+#include "utf8.h"
+#include "grep.h"
+#include "grep-trigrams.h"
+
+/*
+ * Both "grep-trigrams" (for blobs) and "commit-trigrams" (for commits)
+ * in "$GIT_DIR/objects/info" are written in the same format. The file
+ * starts with a header
+ *
+ *   4-byte signature "GTRI"
+ *   4-byte version number (1)
+ *   4-byte hash format id
+ *   4-byte number of objects
+ *
+ * which is followed by a table of the objects, sorted by name:
+ *
+ *   name of the object (the_hash_algo->rawsz bytes)
+ *   8-byte offset of its trigram bitmap
+ *
+ * and then by the bitmaps themselves. The bitmap of an object runs from
+ * its offset (counted from the end of the table) to the offset of the
+ * next one, or to the end of the file for the last object. Its size in
+ * bits is zero (no trigrams at all) or a power of two; the trigram
+ * with hash "h" sets bit "h % size", counting from the most significant
+ * bit of the first byte.
+ *
+ * All numbers are in network byte order.
+ */
+
+#define GREP_TRIGRAMS_SIGNATURE 0x47545249 /* "GTRI" */
+#define GREP_TRIGRAMS_VERSION 1
+#define GREP_TRIGRAMS_HEADER_SIZE 16
+
+/*
+ * A bitmap gets at least this many bits per trigram it holds, which
+ * gives a blob lacking a trigram a chance of one in eight or less to
+ * have its bit set anyway. Bitmaps are never larger than 64KB though.
+ */
+#define BITS_PER_TRIGRAM 8
+#define BITMAP_MIN_BITS 64
+#define BITMAP_MAX_BITS (1 << 19)
+
+struct grep_trigrams {
+	const unsigned char *map;
+	size_t map_size;
+	const unsigned char *table;
+	const unsigned char *data;
+	size_t data_size;
+	uint32_t nr;
+};
+
+static size_t table_entry_size(void)
+{
+	return the_hash_algo->rawsz + 8;
+}
+
+struct trigram_index_type {
+	const char *name; /* of the file in "$GIT_DIR/objects/info" */
+	const char *malformed;
+	const char *progress_title;
+	int (*bitmap)(struct repository *r, const struct object_id *oid,
+		      struct strbuf *out);
+};
+
+static int load_grep_trigrams(struct repository *r,
+			      const struct trigram_index_type *type,
+			      struct grep_trigrams *t)
+{
+	char *path = xstrfmt("%s/info/%s", r->objects->odb->path, type->name);
+	struct stat st;
+	size_t size, table_size;
+	void *map;
+	int fd;
+
+	memset(t, 0, sizeof(*t));
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 ||
+	    (size = xsize_t(st.st_size)) < GREP_TRIGRAMS_HEADER_SIZE) {
+		close(fd);
+		return -1;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	table_size = st_mult(get_be32((unsigned char *)map + 12),
+			     table_entry_size());
+	if (get_be32((unsigned char *)map) != GREP_TRIGRAMS_SIGNATURE ||
+	    get_be32((unsigned char *)map + 4) != GREP_TRIGRAMS_VERSION ||
+	    get_be32((unsigned char *)map + 8) != the_hash_algo->format_id ||
+	    size - GREP_TRIGRAMS_HEADER_SIZE < table_size) {
+		warning("%s", _(type->malformed));
+		munmap(map, size);
+		return -1;
+	}
+
+	t->map = map;
+	t->map_size = size;
+	t->nr = get_be32(t->map + 12);
+	t->table = t->map + GREP_TRIGRAMS_HEADER_SIZE;
+	t->data = t->table + table_size;
+	t->data_size = size - GREP_TRIGRAMS_HEADER_SIZE - table_size;
+	return 0;
+}
+
+static void unload_grep_trigrams(struct grep_trigrams *t)
+{
+	if (t->map)
+		munmap((void *)t->map, t->map_size);
+	memset(t, 0, sizeof(*t));
+}
+
+/*
+ * Find the bitmap of `oid`. Return 0 and fill `bitmap` and `size` (in
+ * bytes) if it is there and sane.
+ */
+static int find_bitmap(const struct grep_trigrams *t,
+		       const struct object_id *oid,
+		       const unsigned char **bitmap, size_t *size)
+{
+	size_t esz = table_entry_size();
+	uint32_t lo = 0, hi = t->nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *p = t->table + mi * esz;
+		int cmp = hashcmp(p, oid->hash);
+		uint64_t start, end;
+
+		if (cmp < 0) {
+			lo = mi + 1;
+			continue;
+		} else if (cmp > 0) {
+			hi = mi;
+			continue;
+		}
+
+		start = get_be64(p + the_hash_algo->rawsz);
+		if (mi + 1 < t->nr)
+			end = get_be64(p + esz + the_hash_algo->rawsz);
+		else
+			end = t->data_size;
+		if (start > end || end > t->data_size ||
+		    ((end - start) & (end - start - 1)))
+			return -1;
+		*bitmap = t->data + start;
+		*size = end - start;
+		return 0;
+	}
+	return -1;
+}
+
+static inline uint32_t trigram_hash(unsigned char a, unsigned char b,
+				    unsigned char c)
+{
+	uint32_t h = (a | (b << 8) | ((uint32_t)c << 16)) * 0x9e3779b1;
+
+	return h ^ (h >> 15);
+}
+
+static inline void set_bit(unsigned char *bitmap, size_t nbits, uint32_t h)
+{
+	h &= nbits - 1;
+	bitmap[h >> 3] |= 0x80 >> (h & 7);
+}
+
+static inline int test_bit(const unsigned char *bitmap, size_t nbits,
+			   uint32_t h)
+{
+	h &= nbits - 1;
+	return bitmap[h >> 3] & (0x80 >> (h & 7));
+}
+
+/*
+ * Compute the bitmap of the trigrams of `buf`, which do not span lines,
+ * and append it to `out`.
+ */
+static void add_bitmap(struct strbuf *out, const char *buf, size_t len)
+{
+	unsigned char *bitmap;
+	size_t nbits = BITMAP_MIN_BITS, nr = 0, i;
+
+	if (len < 3)
+		return; /* no trigrams at all */
+
+	/*
+	 * A blob cannot have more distinct trigrams than bytes, so start
+	 * with a bitmap large enough for all of them, then fold it in
+	 * halves (bit "h % (n / 2)" is set if bit "h % n" or bit
+	 * "h % n + n / 2" is) as long as it keeps enough bits per trigram.
+	 */
+	while (nbits < BITMAP_MAX_BITS && nbits < len * BITS_PER_TRIGRAM * 2)
+		nbits <<= 1;
+	bitmap = xcalloc(1, nbits / 8);
+	for (i = 0; i + 2 < len; i++) {
+		unsigned char a = buf[i], b = buf[i + 1], c = buf[i + 2];
+
+		if (c == '\n') {
+			i += 2;
+			continue;
+		}
+		if (b == '\n') {
+			i++;
+			continue;
+		}
+		if (a == '\n')
+			continue;
+		set_bit(bitmap, nbits, trigram_hash(tolower(a), tolower(b),
+						    tolower(c)));
+	}
+
+	for (i = 0; i < nbits / 8; i++) {
+		unsigned char byte = bitmap[i];
+
+		while (byte) {
+			byte &= byte - 1;
+			nr++;
+		}
+	}
+	while (nbits > BITMAP_MIN_BITS && nbits / 2 >= nr * BITS_PER_TRIGRAM) {
+		nbits /= 2;
+		for (i = 0; i < nbits / 8; i++)
+			bitmap[i] |= bitmap[i + nbits / 8];
+	}
+
+	strbuf_add(out, bitmap, nr ? nbits / 8 : 0);
+	free(bitmap);
+}
+
+static int blob_bitmap(struct repository *r, const struct object_id *oid,
+		       struct strbuf *out)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	oi.typep = &type;
+	oi.sizep = &size;
+	/* do not fetch missing blobs of a partial clone just for this */
+	if (oid_object_info_extended(r, oid, &oi, OBJECT_INFO_FOR_PREFETCH) < 0 ||
+	    type != OBJ_BLOB || size > big_file_threshold)
+		return -1;
+	buf = repo_read_object_file(r, oid, &type, &size);
+	if (!buf)
+		return -1;
+	add_bitmap(out, buf, size);
+	free(buf);
+	return 0;
+}
+
+/*
+ * "log --grep" searches the message reencoded to the output encoding,
+ * which only leaves it alone if both are UTF-8. Only index commits
+ * whose message is in UTF-8; commit_trigram_filter_prepare() is only
+ * called when the output encoding is UTF-8, too.
+ */
+static int commit_bitmap(struct repository *r, const struct object_id *oid,
+			 struct strbuf *out)
+{
+	enum object_type type;
+	unsigned long size;
+	const char *encoding;
+	size_t encoding_len;
+	char *buf;
+	int ret = -1;
+
+	buf = repo_read_object_file(r, oid, &type, &size);
+	if (!buf)
+		return -1;
+	if (type != OBJ_COMMIT)
+		goto out;
+	encoding = find_commit_header(buf, "encoding", &encoding_len);
+	if (encoding) {
+		char *name = xmemdupz(encoding, encoding_len);
+		int utf8 = is_encoding_utf8(name);
+
+		free(name);
+		if (!utf8)
+			goto out;
+	}
+	add_bitmap(out, buf, size);
+	ret = 0;
+out:
+	free(buf);
+	return ret;
+}
+
+static const struct trigram_index_type blob_trigrams = {
+	.name = "grep-trigrams",
+	.malformed = N_("ignoring malformed grep trigram index"),
+	.progress_title = N_("Indexing trigrams of blobs"),
+	.bitmap = blob_bitmap,
+};
+
+static const struct trigram_index_type commit_trigrams = {
+	.name = "commit-trigrams",
+	.malformed = N_("ignoring malformed commit trigram index"),
+	.progress_title = N_("Indexing trigrams of commits"),
+	.bitmap = commit_bitmap,
+};
+
+/*
+ * Write the index of `type` for the sorted `oids`, reusing the bitmaps
+ * of the objects the current one knows.
+ */
+static int write_trigrams(struct repository *r,
+			  const struct trigram_index_type *type,
+			  const struct oid_array *oids, int show_progress)
+{
+	struct grep_trigrams old;
+	struct strbuf table = STRBUF_INIT, data = STRBUF_INIT;
+	struct progress *progress = NULL;
+	struct lock_file lk = LOCK_INIT;
+	unsigned char header[GREP_TRIGRAMS_HEADER_SIZE];
+	size_t i, nr = 0, nr_new = 0;
+	char *path;
+	int fd, ret = 0;
+
+	load_grep_trigrams(r, type, &old);
+	if (show_progress)
+		progress = start_delayed_progress(_(type->progress_title),
+						  oids->nr);
+	for (i = 0; i < oids->nr; i++) {
+		const struct object_id *oid = &oids->oid[i];
+		const unsigned char *bitmap;
+		size_t size;
+		unsigned char offset[8];
+
+		display_progress(progress, i + 1);
+		if (i && oideq(oid, &oids->oid[i - 1]))
+			continue;
+		if (!find_bitmap(&old, oid, &bitmap, &size)) {
+			put_be64(offset, data.len);
+			strbuf_add(&data, bitmap, size);
+		} else {
+			put_be64(offset, data.len);
+			if (type->bitmap(r, oid, &data) < 0)
+				continue;
+			nr_new++;
+		}
+		strbuf_add(&table, oid->hash, the_hash_algo->rawsz);
+		strbuf_add(&table, offset, sizeof(offset));
+		nr++;
+	}
+	stop_progress(&progress);
+
+	/* nothing learned and nothing forgotten */
+	if (old.map && !nr_new && nr == old.nr)
+		goto out;
+
+	put_be32(header, GREP_TRIGRAMS_SIGNATURE);
+	put_be32(header + 4, GREP_TRIGRAMS_VERSION);
+	put_be32(header + 8, the_hash_algo->format_id);
+	put_be32(header + 12, nr);
+
+	path = xstrfmt("%s/info/%s", r->objects->odb->path, type->name);
+	if (safe_create_leading_directories(path) < 0) {
+		ret = error(_("unable to create leading directories of %s"),
+			    path);
+	} else if ((fd = hold_lock_file_for_update(&lk, path, 0)) < 0) {
+		ret = error_errno(_("unable to lock '%s'"), path);
+	} else if (write_in_full(fd, header, sizeof(header)) < 0 ||
+		   write_in_full(fd, table.buf, table.len) < 0 ||
+		   write_in_full(fd, data.buf, data.len) < 0) {
+		ret = error_errno(_("unable to write '%s'"), path);
+		rollback_lock_file(&lk);
+	} else {
+		unload_grep_trigrams(&old);
+		if (commit_lock_file(&lk) < 0)
+			ret = error_errno(_("unable to write '%s'"), path);
+	}
+	free(path);
+
+out:
+	unload_grep_trigrams(&old);
+	strbuf_release(&table);
+	strbuf_release(&data);
+	return ret;
+}
+
+int write_grep_trigrams(struct repository *r, int show_progress)
+{
+	struct oid_array blobs = OID_ARRAY_INIT;
+	size_t i;
+	int ret;
+
+	if (repo_read_index(r) < 0)
+		return error(_("index file corrupt"));
+	for (i = 0; i < r->index->cache_nr; i++) {
+		const struct cache_entry *ce = r->index->cache[i];
+
+		if (S_ISREG(ce->ce_mode) && !ce_intent_to_add(ce))
+			oid_array_append(&blobs, &ce->oid);
+	}
+	oid_array_sort(&blobs);
+
+	ret = write_trigrams(r, &blob_trigrams, &blobs, show_progress);
+	oid_array_clear(&blobs);
+	return ret;
+}
+
+int write_commit_trigrams(struct repository *r, int show_progress)
+{
+	struct oid_array commits = OID_ARRAY_INIT;
+	struct rev_info revs;
+	struct commit *commit;
+	const char *argv[] = { "rev-list", "--all", NULL };
+	int ret;
+
+	repo_init_revisions(r, &revs, NULL);
+	setup_revisions(ARRAY_SIZE(argv) - 1, argv, &revs, NULL);
+	if (prepare_revision_walk(&revs))
+		return error(_("revision walk setup failed"));
+	while ((commit = get_revision(&revs)))
+		oid_array_append(&commits, &commit->object.oid);
+	oid_array_sort(&commits);
+
+	ret = write_trigrams(r, &commit_trigrams, &commits, show_progress);
+	oid_array_clear(&commits);
+	return ret;
+}
+
+/*
+ * The trigrams every line matching one pattern must contain. The
+ * patterns of a filter come in groups, at least one pattern of each of
+ * which must match for an object to be searched.
+ */
+struct pattern_trigrams {
+	uint32_t *hash;
+	size_t nr, alloc;
+	unsigned group;
+};
+
+struct grep_trigram_filter {
+	struct repository *repo;
+	const char *trace_category;
+	struct grep_trigrams index;
+	struct pattern_trigrams *pats;
+	size_t nr, alloc;
+	unsigned long skipped;
+};
+
+/*
+ * Under "-i", a letter may also match a non-ASCII character that folds
+ * to it in some locales (e.g. U+212A KELVIN SIGN), which the index
+ * would not know as that letter. Do not count on those.
+ */
+static int icase_unsafe(unsigned char c)
+{
+	c = tolower(c);
+	return !isascii(c) || c == 'i' || c == 'k' || c == 's';
+}
+
+static void add_literal(struct pattern_trigrams *t, const char *s,
+			size_t len, int ignore_case)
+{
+	size_t i;
+
+	for (i = 0; i + 2 < len; i++) {
+		unsigned char a = s[i], b = s[i + 1], c = s[i + 2];
+
+		if (ignore_case &&
+		    (icase_unsafe(a) || icase_unsafe(b) || icase_unsafe(c)))
+			continue;
+		ALLOC_GROW(t->hash, t->nr + 1, t->alloc);
+		t->hash[t->nr++] = trigram_hash(tolower(a), tolower(b),
+						tolower(c));
+	}
+}
+
+/*
+ * Collect the literal runs of a basic or extended regular expression
+ * that any match must contain: those outside of groups and bracket
+ * expressions, without the character a quantifier applies to. Give up
+ * (and collect nothing) on alternations, which make all of them
+ * optional. Anything unusual just ends the current run, which can only
+ * make us collect less than we could.
+ */
+static void add_regex_literals(struct pattern_trigrams *t, const char *pat,
+			       size_t len, int extended, int ignore_case)
+{
+	struct strbuf run = STRBUF_INIT;
+	size_t i, nr = t->nr;
+	int depth = 0;
+
+	for (i = 0; i < len; i++) {
+		unsigned char c = pat[i];
+		int quantifier = 0, literal = 0;
+
+		if (c == '\\' && i + 1 < len) {
+			c = pat[++i];
+			if (c == '|')
+				goto alternation;
+			else if (!extended && c == '(')
+				depth++;
+			else if (!extended && c == ')')
+				depth--;
+			else if (!extended && (c == '{' || c == '+' || c == '?'))
+				quantifier = 1;
+			else if (isascii(c) && !isalnum(c) &&
+				 !strchr("<>`'", c))
+				literal = 1;
+		} else if (c == '[') {
+			/* skip the bracket expression */
+			if (i + 1 < len && pat[i + 1] == '^')
+				i++;
+			if (i + 1 < len && pat[i + 1] == ']')
+				i++;
+			while (++i < len && pat[i] != ']') {
+				char delim;
+
+				/* "[:alpha:]", "[.-.]" and "[=a=]" */
+				if (pat[i] != '[' || i + 1 == len ||
+				    !strchr(":.=", pat[i + 1]))
+					continue;
+				delim = pat[i + 1];
+				for (i += 2; i + 1 < len; i++)
+					if (pat[i] == delim && pat[i + 1] == ']')
+						break;
+				i++;
+			}
+		} else if (extended && c == '|') {
+			goto alternation;
+		} else if (extended && c == '(') {
+			depth++;
+		} else if (extended && c == ')') {
+			depth--;
+		} else if (c == '*' ||
+			   (extended && (c == '+' || c == '?' || c == '{'))) {
+			quantifier = 1;
+		} else if (isascii(c) && !strchr(".^$", c)) {
+			literal = 1;
+		}
+
+		if (literal) {
+			if (!depth)
+				strbuf_addch(&run, c);
+			continue;
+		}
+		if (quantifier && run.len)
+			strbuf_setlen(&run, run.len - 1);
+		if (quantifier && c == '{') {
+			/* skip the interval, up to "}" or "\}" */
+			while (++i < len && pat[i] != '}')
+				;
+		}
+		add_literal(t, run.buf, run.len, ignore_case);
+		strbuf_reset(&run);
+	}
+	add_literal(t, run.buf, run.len, ignore_case);
+	strbuf_release(&run);
+	return;
+
+alternation:
+	t->nr = nr;
+	strbuf_release(&run);
+}
+
+static int is_fixed(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (is_regex_special(s[i]))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Add the patterns of `list` as group `group` of the filter: all of
+ * them if `field` is negative, those on the header `field` otherwise.
+ * Add none if one of them has no trigram, as it could match anywhere.
+ */
+static void add_group(struct grep_trigram_filter *filter,
+		      const struct grep_opt *opt, const struct grep_pat *list,
+		      int field, unsigned group)
+{
+	const struct grep_pat *p;
+	size_t nr = filter->nr;
+
+	for (p = list; p; p = p->next) {
+		struct pattern_trigrams *t;
+
+		switch (p->token) {
+		case GREP_PATTERN:
+		case GREP_PATTERN_BODY:
+			if (field >= 0)
+				continue;
+			break;
+		case GREP_PATTERN_HEAD:
+			if (field < 0)
+				goto drop;
+			if (p->field != field)
+				continue;
+			break;
+		case GREP_AND:
+		case GREP_OR:
+		case GREP_OPEN_PAREN:
+		case GREP_CLOSE_PAREN:
+			/*
+			 * Without a "--not", a line only matches when one
+			 * of the patterns does, so an object none of them
+			 * can match can still be skipped.
+			 */
+			continue;
+		default:
+			goto drop;
+		}
+
+		ALLOC_GROW(filter->pats, filter->nr + 1, filter->alloc);
+		t = &filter->pats[filter->nr++];
+		memset(t, 0, sizeof(*t));
+		t->group = group;
+		if (opt->fixed || is_fixed(p->pattern, p->patternlen))
+			add_literal(t, p->pattern, p->patternlen,
+				    opt->ignore_case);
+		else if (!opt->pcre2)
+			add_regex_literals(t, p->pattern, p->patternlen,
+					   opt->extended_regexp_option,
+					   opt->ignore_case);
+		if (!t->nr)
+			goto drop;
+	}
+	return;
+
+drop:
+	while (filter->nr > nr)
+		free(filter->pats[--filter->nr].hash);
+}
+
+struct grep_trigram_filter *grep_trigram_filter_prepare(struct repository *r,
+							  const struct grep_opt *opt)
+{
+	struct grep_trigram_filter *filter;
+	int enabled = 0;
+
+	if (repo_config_get_bool(r, "grep.trigramindex", &enabled) || !enabled)
+		return NULL;
+	/*
+	 * Skipping a blob must be the same as finding no match in it,
+	 * and what is searched must be the blob itself.
+	 */
+	if (opt->invert || opt->unmatch_name_only || opt->allow_textconv ||
+	    !opt->pattern_list)
+		return NULL;
+
+	CALLOC_ARRAY(filter, 1);
+	filter->repo = r;
+	filter->trace_category = "grep";
+	add_group(filter, opt, opt->pattern_list, -1, 0);
+	if (!filter->nr ||
+	    load_grep_trigrams(r, &blob_trigrams, &filter->index) < 0)
+		goto give_up;
+	return filter;
+
+give_up:
+	grep_trigram_filter_free(filter);
+	return NULL;
+}
+
+struct grep_trigram_filter *commit_trigram_filter_prepare(struct repository *r,
+							   const struct grep_opt *opt,
+							   unsigned flags)
+{
+	struct grep_trigram_filter *filter;
+	int enabled = 1;
+
+	repo_config_get_bool(r, "core.committrigramindex", &enabled);
+	if (!enabled)
+		return NULL;
+
+	/*
+	 * The message patterns and the patterns of each header field
+	 * must all match (see compile_grep_patterns()), so a commit can
+	 * be skipped if the patterns of any of these groups cannot. The
+	 * reflog line is never in the index, so its patterns are not used.
+	 */
+	CALLOC_ARRAY(filter, 1);
+	filter->repo = r;
+	filter->trace_category = "revision";
+	if (!(flags & COMMIT_TRIGRAMS_EXTENDED_MESSAGE))
+		add_group(filter, opt, opt->pattern_list, -1, 0);
+	if (!(flags & COMMIT_TRIGRAMS_REWRITTEN_IDENTS)) {
+		add_group(filter, opt, opt->header_list,
+			  GREP_HEADER_AUTHOR, 1);
+		add_group(filter, opt, opt->header_list,
+			  GREP_HEADER_COMMITTER, 2);
+	}
+	if (!filter->nr ||
+	    load_grep_trigrams(r, &commit_trigrams, &filter->index) < 0)
+		goto give_up;
+	return filter;
+
+give_up:
+	grep_trigram_filter_free(filter);
+	return NULL;
+}
+
+static int may_match(const unsigned char *bitmap, size_t size,
+		     const struct pattern_trigrams *t)
+{
+	size_t i;
+
+	if (!size)
+		return 0;
+	for (i = 0; i < t->nr; i++)
+		if (!test_bit(bitmap, size * 8, t->hash[i]))
+			return 0;
+	return 1;
+}
+
+int grep_trigram_filter_skip(struct grep_trigram_filter *filter,
+			     const struct object_id *oid)
+{
+	const unsigned char *bitmap;
+	size_t size, i, j;
+
+	if (find_bitmap(&filter->index, oid, &bitmap, &size))
+		return 0;
+	for (i = 0; i < filter->nr; i = j) {
+		int possible = 0;
+
+		for (j = i; j < filter->nr &&
+			    filter->pats[j].group == filter->pats[i].group; j++)
+			if (!possible &&
+			    may_match(bitmap, size, &filter->pats[j]))
+				possible = 1;
+		if (!possible) {
+			filter->skipped++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void grep_trigram_filter_free(struct grep_trigram_filter *filter)
+{
+	size_t i;
+
+	if (!filter)
+		return;
+	if (filter->index.map)
+		trace2_data_intmax(filter->trace_category, filter->repo,
+				   "trigrams/skipped", filter->skipped);
+	for (i = 0; i < filter->nr; i++)
+		free(filter->pats[i].hash);
+	free(filter->pats);
+	unload_grep_trigrams(&filter->index);
+	free(filter);
+}
@@ -0,0 +1,70 @@
+#ifndef GREP_TRIGRAMS_H
+#define GREP_TRIGRAMS_H
+
+struct repository;
+struct grep_opt;
+struct object_id;
+
+/*
+ * The grep trigram index in "$GIT_DIR/objects/info/grep-trigrams"
+ * records, for each blob it knows about, which trigrams (runs of
+ * three bytes, folded to lowercase) appear in its lines. As it is
+ * keyed by the names of the blobs, it stays valid whatever is checked
+ * out or committed; blobs it does not know about are simply searched.
+ *
+ * With `grep.trigramIndex` set, "git grep" uses it to skip the blobs
+ * of the index or of a tree that lack a trigram every match of the
+ * patterns needs. The "grep-trigrams" maintenance task keeps it up to
+ * date with the blobs of the index.
+ *
+ * The commit trigram index in "$GIT_DIR/objects/info/commit-trigrams"
+ * does the same for the commits reachable from any ref, written by the
+ * "commit-trigrams" maintenance task, so that the revision walk does
+ * not read the commits that cannot match "--grep", "--author" or
+ * "--committer". It is used unless `core.commitTrigramIndex` is false.
+ */
+
+/*
+ * Write the index for the blobs of the index of `r`, reusing what is
+ * already known about them. Return 0 on success.
+ */
+int write_grep_trigrams(struct repository *r, int show_progress);
+
+/*
+ * Write the commit index for the commits reachable from any ref of
+ * `r`, reusing what is already known about them. Return 0 on success.
+ */
+int write_commit_trigrams(struct repository *r, int show_progress);
+
+struct grep_trigram_filter;
+
+/*
+ * Prepare to filter the blobs searched for the patterns of
+ * `opt`. Return NULL if `grep.trigramIndex` is not set, if there is no
+ * index, or if the patterns are such that no blob could be skipped.
+ */
+struct grep_trigram_filter *grep_trigram_filter_prepare(struct repository *r,
+							  const struct grep_opt *opt);
+
+/* The author and committer lines are not searched as they are. */
+#define COMMIT_TRIGRAMS_REWRITTEN_IDENTS (1 << 0)
+/* Something, like notes, is appended to the messages searched. */
+#define COMMIT_TRIGRAMS_EXTENDED_MESSAGE (1 << 1)
+
+/*
+ * Prepare to filter the commits searched for the message and header
+ * patterns of `opt`, when the output encoding is UTF-8. Return
+ * NULL if `core.commitTrigramIndex` is false, if there is no index, or
+ * if no commit could be skipped.
+ */
+struct grep_trigram_filter *commit_trigram_filter_prepare(struct repository *r,
+							   const struct grep_opt *opt,
+							   unsigned flags);
+
+/* Return 1 if the object `oid` cannot match the patterns of the filter. */
+int grep_trigram_filter_skip(struct grep_trigram_filter *filter,
+			     const struct object_id *oid);
+
+void grep_trigram_filter_free(struct grep_trigram_filter *filter);
+
+#endif /* GREP_TRIGRAMS_H */
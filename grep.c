@@ -1420,13 +1420,23 @@ static int should_lookahead(struct grep_opt *opt)
 {
 	struct grep_pat *p;
 
-	if (opt->extended)
-		return 0; /* punt for too complex stuff */
-	if (opt->invert)
+	if (opt->invert || opt->header_list)
 		return 0;
 	for (p = opt->pattern_list; p; p = p->next) {
-		if (p->token != GREP_PATTERN)
+		switch (p->token) {
+		case GREP_PATTERN:
+		case GREP_AND:
+		case GREP_OR:
+		case GREP_OPEN_PAREN:
+		case GREP_CLOSE_PAREN:
+			/*
+			 * Without a "--not", a line can only match the
+			 * expression if one of its atoms hits the line.
+			 */
+			break;
+		default:
 			return 0; /* punt for "header only" and stuff */
+		}
 	}
 	return 1;
 }
@@ -1438,34 +1448,45 @@ static int look_ahead(struct grep_opt *opt,
 {
 	unsigned lno = *lno_p;
 	char *bol = *bol_p;
+	char *eob = bol + *left_p;
 	struct grep_pat *p;
-	char *sp, *last_bol;
-	regoff_t earliest = -1;
+	char *sp, *last_bol = eob;
 
 	for (p = opt->pattern_list; p; p = p->next) {
-		int hit;
-		regmatch_t m;
-
-		hit = patmatch(p, bol, bol + *left_p, &m, 0);
-		if (!hit || m.rm_so < 0 || m.rm_eo < 0)
+		if (p->token != GREP_PATTERN)
 			continue;
-		if (earliest < 0 || m.rm_so < earliest)
-			earliest = m.rm_so;
+		/*
+		 * The line of a hit found by an earlier call that starts
+		 * at or after bol is still the first one to hit from bol
+		 * on; only search again once the lines up to it have
+		 * been consumed. The end of the buffer stands for "no
+		 * more hits".
+		 */
+		if (!p->next_hit || p->next_hit < bol) {
+			regmatch_t m;
+
+			if (patmatch(p, bol, eob, &m, 0) &&
+			    m.rm_so >= 0 && m.rm_eo >= 0) {
+				sp = bol + m.rm_so;
+				while (bol < sp && sp[-1] != '\n')
+					sp--; /* find the beginning of the line */
+				p->next_hit = sp;
+			} else {
+				p->next_hit = eob;
+			}
+		}
+		if (p->next_hit < last_bol)
+			last_bol = p->next_hit;
 	}
 
-	if (earliest < 0) {
-		*bol_p = bol + *left_p;
+	if (last_bol == eob) {
+		*bol_p = eob;
 		*left_p = 0;
 		return 1;
 	}
-	for (sp = bol + earliest; bol < sp && sp[-1] != '\n'; sp--)
-		; /* find the beginning of the line */
-	last_bol = sp;
 
-	for (sp = bol; sp < last_bol; sp++) {
-		if (*sp == '\n')
-			lno++;
-	}
+	for (sp = bol; (sp = memchr(sp, '\n', last_bol - sp)); sp++)
+		lno++;
 	*left_p -= last_bol - bol;
 	*bol_p = last_bol;
 	*lno_p = lno;
@@ -1621,6 +1642,13 @@ static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int colle
 	if (fill_textconv_grep(opt->repo, textconv, gs) < 0)
 		return 0;
 
+	if (try_lookahead) {
+		struct grep_pat *p;
+
+		for (p = opt->pattern_list; p; p = p->next)
+			p->next_hit = NULL;
+	}
+
 	bol = gs->buf;
 	left = gs->size;
 	while (left) {
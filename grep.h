@@ -79,6 +79,8 @@ struct grep_pat {
 	pcre2_general_context *pcre2_general_context;
 	const uint8_t *pcre2_tables;
 	uint32_t pcre2_jit_on;
+	/* the line where look_ahead() last saw this pattern hit */
+	char *next_hit;
 	unsigned fixed:1;
 	unsigned is_fixed:1;
 	unsigned ignore_case:1;
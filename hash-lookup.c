@@ -100,14 +100,58 @@ int oid_pos(const struct object_id *oid, const void *table, size_t nr,
 	return index_pos_to_insert_pos(lo);
 }
 
+/*
+ * Below this many candidates, a plain binary search touches about as
+ * many cache lines as interpolating would, and costs no divisions.
+ */
+#define INTERPOLATION_MIN 16
+
+/* Give up on interpolating after that many probes, in case of skew. */
+#define INTERPOLATION_MAX_PROBES 4
+
 int bsearch_hash(const unsigned char *hash, const uint32_t *fanout_nbo,
 		 const unsigned char *table, size_t stride, uint32_t *result)
 {
 	uint32_t hi, lo;
+	uint64_t lov, hiv, key;
+	int probes = 0;
 
 	hi = ntohl(fanout_nbo[*hash]);
 	lo = ((*hash == 0x0) ? 0 : ntohl(fanout_nbo[*hash - 1]));
 
+	/*
+	 * All the hashes between lo and hi share their first byte, and
+	 * the bytes after it are uniformly distributed, so the position
+	 * of the target can be guessed from the next four bytes the same
+	 * way oid_pos() does it. Each probe keeps the invariants of the
+	 * binary search and narrows the bounds the next guess is made
+	 * from; for tables of hashes, a couple of probes usually land
+	 * within a few entries of the target instead of the dozen or so
+	 * halvings a binary search needs.
+	 */
+	key = get_be32(hash + 1);
+	lov = 0;
+	hiv = (uint64_t)1 << 32;
+	while (hi - lo >= INTERPOLATION_MIN &&
+	       probes++ < INTERPOLATION_MAX_PROBES) {
+		uint32_t mi = lo + (hi - lo) * (key - lov) / (hiv - lov + 1);
+		const unsigned char *entry = table + mi * stride;
+		int cmp = hashcmp(entry, hash);
+
+		if (!cmp) {
+			if (result)
+				*result = mi;
+			return 1;
+		}
+		if (cmp > 0) {
+			hi = mi;
+			hiv = get_be32(entry + 1);
+		} else {
+			lo = mi + 1;
+			lov = get_be32(entry + 1);
+		}
+	}
+
 	while (lo < hi) {
 		unsigned mi = lo + (hi - lo) / 2;
 		int cmp = hashcmp(table + mi * stride, hash);
@@ -56,18 +56,25 @@ static void fetch_single_packfile(struct object_id *packfile_hash,
 	preq = new_direct_http_pack_request(packfile_hash->hash, xstrdup(url));
 	if (preq == NULL)
 		die("couldn't create http pack request");
-	preq->slot->results = &results;
 	preq->index_pack_args = index_pack_args;
 	preq->preserve_index_pack_stdout = 1;
+	if (stream_http_pack_request(preq))
+		die("Unable to start index-pack for %s", preq->url);
 
-	if (start_active_slot(preq->slot)) {
+	for (;;) {
+		preq->slot->results = &results;
+		if (!start_active_slot(preq->slot))
+			die("Unable to start request");
 		run_active_slot(preq->slot);
-		if (results.curl_result != CURLE_OK) {
+		if (results.curl_result == CURLE_OK)
+			break;
+
+		/* Pick up where we left off as long as the pack keeps coming. */
+		if (retry_http_pack_request(preq))
 			die("Unable to get pack file %s\n%s", preq->url,
 			    curl_errorstr);
-		}
-	} else {
-		die("Unable to start request");
+		warning("retrying transfer of %s: %s", preq->url,
+			curl_errorstr);
 	}
 
 	if ((ret = finish_http_pack_request(preq)))
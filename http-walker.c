@@ -43,12 +43,14 @@ struct alternates_request {
 struct walker_data {
 	const char *url;
 	int got_alternates;
+	int tried_indices;
 	struct alt_base *alt;
 };
 
 static LIST_HEAD(object_queue_head);
 
 static void fetch_alternates(struct walker *walker, const char *base);
+static int fetch_indices(struct walker *walker, struct alt_base *repo);
 
 static void process_object_response(void *callback_data);
 
@@ -153,6 +155,19 @@ static void prefetch(struct walker *walker, unsigned char *sha1)
 	struct object_request *newreq;
 	struct walker_data *data = walker->data;
 
+	/*
+	 * Learn what the packs of the repository have before asking for
+	 * the first object, so that the objects in them are fetched with
+	 * their pack instead of each being asked for as a loose object
+	 * first, only to get a 404.
+	 */
+	if (!data->tried_indices) {
+		data->tried_indices = 1;
+		fetch_indices(walker, data->alt);
+	}
+	if (find_sha1_pack(sha1, data->alt->packs))
+		return;
+
 	newreq = xmalloc(sizeof(*newreq));
 	newreq->walker = walker;
 	oidread(&newreq->oid, sha1);
@@ -482,19 +497,27 @@ static void abort_object_request(struct object_request *obj_req)
 	release_object_request(obj_req);
 }
 
-static int fetch_object(struct walker *walker, unsigned char *hash)
+static struct object_request *find_object_request(const unsigned char *hash)
 {
-	char *hex = hash_to_hex(hash);
-	int ret = 0;
-	struct object_request *obj_req = NULL;
-	struct http_object_request *req;
 	struct list_head *pos, *head = &object_queue_head;
 
 	list_for_each(pos, head) {
-		obj_req = list_entry(pos, struct object_request, node);
+		struct object_request *obj_req =
+			list_entry(pos, struct object_request, node);
+
 		if (hasheq(obj_req->oid.hash, hash))
-			break;
+			return obj_req;
 	}
+	return NULL;
+}
+
+static int fetch_object(struct walker *walker, unsigned char *hash)
+{
+	char *hex = hash_to_hex(hash);
+	int ret = 0;
+	struct object_request *obj_req = find_object_request(hash);
+	struct http_object_request *req;
+
 	if (obj_req == NULL)
 		return error("Couldn't find request for %s in the queue", hex);
 
@@ -562,8 +585,21 @@ static int fetch(struct walker *walker, unsigned char *hash)
 	struct walker_data *data = walker->data;
 	struct alt_base *altbase = data->alt;
 
-	if (!fetch_object(walker, hash))
-		return 0;
+	/*
+	 * prefetch() does not ask for the objects in the packs of the
+	 * repository as loose objects; they may have come with another
+	 * object of their pack already.
+	 */
+	if (find_object_request(hash)) {
+		if (!fetch_object(walker, hash))
+			return 0;
+	} else {
+		struct object_id oid;
+
+		oidread(&oid, hash);
+		if (has_object_file(&oid))
+			return 0;
+	}
 	while (altbase) {
 		if (!http_fetch_pack(walker, altbase, hash))
 			return 0;
@@ -615,6 +651,7 @@ struct walker *get_http_walker(const char *url)
 	data->alt->packs = NULL;
 	data->alt->next = NULL;
 	data->got_alternates = -1;
+	data->tried_indices = 0;
 
 	walker->corrupt_object_found = 0;
 	walker->fetch = fetch;
@@ -49,6 +49,7 @@ char curl_errorstr[CURL_ERROR_SIZE];
 static int curl_ssl_verify = -1;
 static int curl_ssl_try;
 static const char *curl_http_version = NULL;
+static int curl_early_data;
 static const char *ssl_cert;
 static const char *ssl_cipherlist;
 static const char *ssl_version;
@@ -352,6 +353,11 @@ static int http_options(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp("http.earlydata", var)) {
+		curl_early_data = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp("http.schannelusesslcainfo", var)) {
 		http_schannel_use_ssl_cainfo = git_config_bool(var, value);
 		return 0;
@@ -854,7 +860,13 @@ static int get_curl_http_version_opt(const char *version_string, long *opt)
 		long opt_token;
 	} choice[] = {
 		{ "HTTP/1.1", CURL_HTTP_VERSION_1_1 },
-		{ "HTTP/2", CURL_HTTP_VERSION_2 }
+		{ "HTTP/2", CURL_HTTP_VERSION_2 },
+#if LIBCURL_VERSION_NUM >= 0x073100
+		{ "HTTP/2-prior-knowledge", CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE },
+#endif
+#if LIBCURL_VERSION_NUM >= 0x074200
+		{ "HTTP/3", CURL_HTTP_VERSION_3 },
+#endif
 	};
 
 	for (i = 0; i < ARRAY_SIZE(choice); i++) {
@@ -873,6 +885,7 @@ static int get_curl_http_version_opt(const char *version_string, long *opt)
 static CURL *get_curl_handle(void)
 {
 	CURL *result = curl_easy_init();
+	long ssl_options = 0;
 
 	if (!result)
 		die("curl_easy_init failed");
@@ -897,6 +910,15 @@ static CURL *get_curl_handle(void)
     }
 #endif
 
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/*
+	 * Wait for a connection that can be multiplexed instead of opening
+	 * a new one next to it, so that all requests share one connection
+	 * (and one TLS handshake) when the server speaks HTTP/2.
+	 */
+	curl_easy_setopt(result, CURLOPT_PIPEWAIT, 1L);
+#endif
+
 #if LIBCURL_VERSION_NUM >= 0x070907
 	curl_easy_setopt(result, CURLOPT_NETRC, CURL_NETRC_OPTIONAL);
 #endif
@@ -923,12 +945,26 @@ static CURL *get_curl_handle(void)
 	if (http_ssl_backend && !strcmp("schannel", http_ssl_backend) &&
 	    http_schannel_check_revoke_mode) {
 #if LIBCURL_VERSION_NUM >= 0x072c00
-		curl_easy_setopt(result, CURLOPT_SSL_OPTIONS, http_schannel_check_revoke_mode);
+		ssl_options |= http_schannel_check_revoke_mode;
 #else
 		warning(_("CURLSSLOPT_NO_REVOKE not supported with cURL < 7.44.0"));
 #endif
 	}
 
+	if (curl_early_data) {
+#ifdef CURLSSLOPT_EARLYDATA
+		ssl_options |= CURLSSLOPT_EARLYDATA;
+#else
+		warning(_("http.earlyData is not supported with cURL < 8.11.0"));
+		curl_early_data = 0;
+#endif
+	}
+
+#if LIBCURL_VERSION_NUM >= 0x072c00
+	if (ssl_options)
+		curl_easy_setopt(result, CURLOPT_SSL_OPTIONS, ssl_options);
+#endif
+
 	if (http_proactive_auth)
 		init_curl_http_auth(result);
 
@@ -1192,6 +1228,10 @@ void http_init(struct remote *remote, const char *url, int proactive_auth)
 	curlm = curl_multi_init();
 	if (!curlm)
 		die("curl_multi_init failed");
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/* Run concurrent requests as streams of a single HTTP/2 connection. */
+	curl_multi_setopt(curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 #endif
 
 	if (getenv("GIT_SSL_NO_VERIFY"))
@@ -2121,8 +2161,8 @@ int http_get_strbuf(const char *url,
  * If a previous interrupted download is detected (i.e. a previous temporary
  * file is still around) the download is resumed.
  */
-static int http_get_file(const char *url, const char *filename,
-			 struct http_get_options *options)
+int http_get_file(const char *url, const char *filename,
+		  struct http_get_options *options)
 {
 	int ret;
 	struct strbuf tmpfile = STRBUF_INIT;
@@ -2280,6 +2320,11 @@ void release_http_pack_request(struct http_pack_request *preq)
 		fclose(preq->packfile);
 		preq->packfile = NULL;
 	}
+	if (preq->index_pack) {
+		close(preq->index_pack->in);
+		finish_command(preq->index_pack);
+		FREE_AND_NULL(preq->index_pack);
+	}
 	preq->slot = NULL;
 	strbuf_release(&preq->tmpfile);
 	free(preq->url);
@@ -2289,6 +2334,59 @@ void release_http_pack_request(struct http_pack_request *preq)
 static const char *default_index_pack_args[] =
 	{"index-pack", "--stdin", NULL};
 
+static struct child_process *prepare_index_pack(struct http_pack_request *preq)
+{
+	struct child_process *ip = xmalloc(sizeof(*ip));
+
+	child_process_init(ip);
+	ip->git_cmd = 1;
+	ip->argv = preq->index_pack_args ? preq->index_pack_args
+					 : default_index_pack_args;
+
+	if (preq->preserve_index_pack_stdout)
+		ip->out = 0;
+	else
+		ip->no_stdout = 1;
+	return ip;
+}
+
+int stream_http_pack_request(struct http_pack_request *preq)
+{
+	struct child_process *ip = prepare_index_pack(preq);
+	int tmpfile_fd;
+
+	ip->in = -1;
+	if (start_command(ip)) {
+		free(ip);
+		return -1;
+	}
+	preq->index_pack = ip;
+
+	/* Whatever an earlier attempt left behind goes in first. */
+	fflush(preq->packfile);
+	tmpfile_fd = xopen(preq->tmpfile.buf, O_RDONLY);
+	if (copy_fd(tmpfile_fd, ip->in) < 0) {
+		close(tmpfile_fd);
+		return -1;
+	}
+	close(tmpfile_fd);
+	return 0;
+}
+
+static int finish_streamed_pack(struct http_pack_request *preq)
+{
+	struct child_process *ip = preq->index_pack;
+	int ret;
+
+	preq->index_pack = NULL;
+	close(ip->in);
+	ret = finish_command(ip) ? -1 : 0;
+	free(ip);
+
+	unlink(preq->tmpfile.buf);
+	return ret;
+}
+
 int finish_http_pack_request(struct http_pack_request *preq)
 {
 	struct child_process ip = CHILD_PROCESS_INIT;
@@ -2298,6 +2396,9 @@ int finish_http_pack_request(struct http_pack_request *preq)
 	fclose(preq->packfile);
 	preq->packfile = NULL;
 
+	if (preq->index_pack)
+		return finish_streamed_pack(preq);
+
 	tmpfile_fd = xopen(preq->tmpfile.buf, O_RDONLY);
 
 	ip.git_cmd = 1;
@@ -2345,28 +2446,38 @@ struct http_pack_request *new_http_pack_request(
 					    strbuf_detach(&buf, NULL));
 }
 
-struct http_pack_request *new_direct_http_pack_request(
-	const unsigned char *packed_git_hash, char *url)
+static size_t fwrite_pack(char *ptr, size_t eltsize, size_t nmemb,
+			  void *data)
 {
-	off_t prev_posn = 0;
-	struct http_pack_request *preq;
-
-	CALLOC_ARRAY(preq, 1);
-	strbuf_init(&preq->tmpfile, 0);
+	struct http_pack_request *preq = data;
+	size_t size = eltsize * nmemb;
 
-	preq->url = url;
+	/*
+	 * A server that ignores our Range header sends the whole pack
+	 * again, which must not be appended to the part we already have.
+	 */
+	if (preq->range_start) {
+		long http_code = 0;
 
-	strbuf_addf(&preq->tmpfile, "%s.temp", sha1_pack_name(packed_git_hash));
-	preq->packfile = fopen(preq->tmpfile.buf, "a");
-	if (!preq->packfile) {
-		error("Unable to open local file %s for pack",
-		      preq->tmpfile.buf);
-		goto abort;
+		curl_easy_getinfo(preq->slot->curl, CURLINFO_HTTP_CODE,
+				  &http_code);
+		if (http_code != 206)
+			return 0;
 	}
 
+	if (fwrite(ptr, 1, size, preq->packfile) != size)
+		return 0;
+	if (preq->index_pack &&
+	    write_in_full(preq->index_pack->in, ptr, size) < 0)
+		return 0;
+	return nmemb;
+}
+
+static void prepare_pack_slot(struct http_pack_request *preq)
+{
 	preq->slot = get_active_slot();
-	curl_easy_setopt(preq->slot->curl, CURLOPT_FILE, preq->packfile);
-	curl_easy_setopt(preq->slot->curl, CURLOPT_WRITEFUNCTION, fwrite);
+	curl_easy_setopt(preq->slot->curl, CURLOPT_FILE, preq);
+	curl_easy_setopt(preq->slot->curl, CURLOPT_WRITEFUNCTION, fwrite_pack);
 	curl_easy_setopt(preq->slot->curl, CURLOPT_URL, preq->url);
 	curl_easy_setopt(preq->slot->curl, CURLOPT_HTTPHEADER,
 		no_pragma_header);
@@ -2375,16 +2486,47 @@ struct http_pack_request *new_direct_http_pack_request(
 	 * If there is data present from a previous transfer attempt,
 	 * resume where it left off
 	 */
-	prev_posn = ftello(preq->packfile);
-	if (prev_posn>0) {
+	preq->range_start = ftello(preq->packfile);
+	if (preq->range_start > 0) {
 		if (http_is_verbose)
 			fprintf(stderr,
 				"Resuming fetch of pack %s at byte %"PRIuMAX"\n",
-				hash_to_hex(packed_git_hash),
-				(uintmax_t)prev_posn);
-		http_opt_request_remainder(preq->slot->curl, prev_posn);
+				preq->url, (uintmax_t)preq->range_start);
+		http_opt_request_remainder(preq->slot->curl, preq->range_start);
+	} else {
+		preq->range_start = 0;
+	}
+}
+
+int retry_http_pack_request(struct http_pack_request *preq)
+{
+	off_t posn = ftello(preq->packfile);
+
+	if (posn <= preq->range_start)
+		return -1;
+	prepare_pack_slot(preq);
+	return 0;
+}
+
+struct http_pack_request *new_direct_http_pack_request(
+	const unsigned char *packed_git_hash, char *url)
+{
+	struct http_pack_request *preq;
+
+	CALLOC_ARRAY(preq, 1);
+	strbuf_init(&preq->tmpfile, 0);
+
+	preq->url = url;
+
+	strbuf_addf(&preq->tmpfile, "%s.temp", sha1_pack_name(packed_git_hash));
+	preq->packfile = fopen(preq->tmpfile.buf, "a");
+	if (!preq->packfile) {
+		error("Unable to open local file %s for pack",
+		      preq->tmpfile.buf);
+		goto abort;
 	}
 
+	prepare_pack_slot(preq);
 	return preq;
 
 abort:
@@ -208,6 +208,13 @@ struct http_get_options {
  */
 int http_get_strbuf(const char *url, struct strbuf *result, struct http_get_options *options);
 
+/*
+ * Downloads a URL into the given file, resuming from "<filename>.temp"
+ * if an earlier download was interrupted.
+ */
+int http_get_file(const char *url, const char *filename,
+		  struct http_get_options *options);
+
 int http_fetch_ref(const char *base, struct ref *ref);
 
 /* Helpers for fetching packs */
@@ -228,6 +235,12 @@ struct http_pack_request {
 	FILE *packfile;
 	struct strbuf tmpfile;
 	struct active_request_slot *slot;
+
+	/* Where in the pack the current transfer started. */
+	off_t range_start;
+
+	/* index-pack reading the pack as it arrives, if streaming. */
+	struct child_process *index_pack;
 };
 
 struct http_pack_request *new_http_pack_request(
@@ -235,6 +248,21 @@ struct http_pack_request *new_http_pack_request(
 struct http_pack_request *new_direct_http_pack_request(
 	const unsigned char *packed_git_hash, char *url);
 int finish_http_pack_request(struct http_pack_request *preq);
+
+/*
+ * Start index-pack before the transfer and feed it the pack as it
+ * arrives, so that it is done soon after the last byte is received
+ * instead of starting only then. Call this before starting preq->slot.
+ */
+int stream_http_pack_request(struct http_pack_request *preq);
+
+/*
+ * After a transfer that failed partway through, set up a new
+ * preq->slot asking for the rest of the pack. Return -1 if nothing was
+ * received by the failed attempt, in which case another one is unlikely
+ * to fare better.
+ */
+int retry_http_pack_request(struct http_pack_request *preq);
 void release_http_pack_request(struct http_pack_request *preq);
 
 /*
@@ -310,6 +310,8 @@ static void line_log_data_insert(struct line_log_data **list,
 
 struct collect_diff_cbdata {
 	struct diff_ranges *diff;
+	/* lines trimmed off the start of both files */
+	long skipped;
 };
 
 static int collect_diff_cb(long start_a, long count_a,
@@ -318,6 +320,8 @@ static int collect_diff_cb(long start_a, long count_a,
 {
 	struct collect_diff_cbdata *d = data;
 
+	start_a += d->skipped;
+	start_b += d->skipped;
 	if (count_a >= 0)
 		range_set_append(&d->diff->parent, start_a, start_a + count_a);
 	if (count_b >= 0)
@@ -326,9 +330,42 @@ static int collect_diff_cb(long start_a, long count_a,
 	return 0;
 }
 
+/*
+ * Trim down common lines at the start of the buffers, like xdi_diff()
+ * does at their end, so that a change at the end of a large file does
+ * not make us hash all of it.  Returns the number of lines trimmed.
+ */
+static long trim_common_head(mmfile_t *a, mmfile_t *b)
+{
+	const int blk = 1024;
+	long trimmed = 0, lines = 0;
+	long smaller = (a->size < b->size) ? a->size : b->size;
+	const char *p, *end;
+
+	while (blk + trimmed <= smaller &&
+	       !memcmp(a->ptr + trimmed, b->ptr + trimmed, blk))
+		trimmed += blk;
+
+	/* end on a complete line */
+	while (trimmed && a->ptr[trimmed - 1] != '\n')
+		trimmed--;
+
+	for (p = a->ptr, end = a->ptr + trimmed;
+	     (p = memchr(p, '\n', end - p));
+	     p++)
+		lines++;
+
+	a->ptr += trimmed;
+	a->size -= trimmed;
+	b->ptr += trimmed;
+	b->size -= trimmed;
+	return lines;
+}
+
 static int collect_diff(mmfile_t *parent, mmfile_t *target, struct diff_ranges *out)
 {
 	struct collect_diff_cbdata cbdata = {NULL};
+	mmfile_t a = *parent, b = *target;
 	xpparam_t xpp;
 	xdemitconf_t xecfg;
 	xdemitcb_t ecb;
@@ -338,10 +375,11 @@ static int collect_diff(mmfile_t *parent, mmfile_t *target, struct diff_ranges *
 	xecfg.ctxlen = xecfg.interhunkctxlen = 0;
 
 	cbdata.diff = out;
+	cbdata.skipped = trim_common_head(&a, &b);
 	xecfg.hunk_func = collect_diff_cb;
 	memset(&ecb, 0, sizeof(ecb));
 	ecb.priv = &cbdata;
-	return xdi_diff(parent, target, &xpp, &xecfg, &ecb);
+	return xdi_diff(&a, &b, &xpp, &xecfg, &ecb);
 }
 
 /*
@@ -12,6 +12,9 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "trace.h"
+#include "trace2.h"
+#include "thread-utils.h"
+#include "oidset.h"
 
 struct traversal_context {
 	struct rev_info *revs;
@@ -334,13 +337,361 @@ static void add_pending_tree(struct rev_info *revs, struct tree *tree)
 	add_pending_object(revs, &tree->object, "");
 }
 
+/*
+ * The parallel tree walk keeps its own record of the objects it has
+ * seen: the parsed-object table is not safe to use from several
+ * threads. The set is split into shards, each behind its own lock,
+ * keyed by the last byte of the hash: oidset's own hashing uses the
+ * first four bytes for the bucket and the fifth for the tag it checks
+ * before comparing whole object ids, and keys sharing either would
+ * crowd into the same slots or all match the same tag.
+ */
+#define WALK_SEEN_SHARDS 256
+
+struct walk_seen_shard {
+	pthread_mutex_t mutex;
+	struct oidset set;
+};
+
+struct walk_tree_item {
+	struct object_id oid;
+	struct object_id parent;
+	char *path;
+};
+
+struct walk_output {
+	struct object_id oid;
+	struct object_id parent;
+	enum object_type type;
+	char *path;
+};
+
+struct parallel_walk {
+	struct traversal_context *ctx;
+	struct walk_seen_shard *seen;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t output_cond;
+
+	struct walk_tree_item *work;
+	size_t work_nr, work_alloc;
+	int active;
+
+	struct walk_output *output;
+	size_t output_nr, output_alloc;
+};
+
+/* Returns 1 if 'oid' was not in the set yet. */
+static int walk_seen_insert(struct parallel_walk *walk,
+			    const struct object_id *oid)
+{
+	struct walk_seen_shard *shard =
+		&walk->seen[oid->hash[the_hash_algo->rawsz - 1]];
+	int seen;
+
+	pthread_mutex_lock(&shard->mutex);
+	seen = oidset_insert(&shard->set, oid);
+	pthread_mutex_unlock(&shard->mutex);
+	return !seen;
+}
+
+static char *walk_child_path(const char *base, const char *name)
+{
+	if (!*base)
+		return xstrdup(name);
+	return xstrfmt("%s/%s", base, name);
+}
+
+static void walk_one_tree(struct parallel_walk *walk,
+			  struct walk_tree_item *item,
+			  struct walk_tree_item **work, size_t *work_nr,
+			  size_t *work_alloc, struct walk_output **out,
+			  size_t *out_nr, size_t *out_alloc)
+{
+	struct rev_info *revs = walk->ctx->revs;
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	buf = repo_read_object_file(revs->repo, &item->oid, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die("bad tree object %s", oid_to_hex(&item->oid));
+
+	ALLOC_GROW(*out, *out_nr + 1, *out_alloc);
+	oidcpy(&(*out)[*out_nr].oid, &item->oid);
+	oidcpy(&(*out)[*out_nr].parent, &item->parent);
+	(*out)[*out_nr].type = OBJ_TREE;
+	(*out)[*out_nr].path = item->path;
+	(*out_nr)++;
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		struct walk_output *o;
+
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		if (S_ISDIR(entry.mode)) {
+			if (!walk_seen_insert(walk, &entry.oid))
+				continue;
+			ALLOC_GROW(*work, *work_nr + 1, *work_alloc);
+			oidcpy(&(*work)[*work_nr].oid, &entry.oid);
+			oidcpy(&(*work)[*work_nr].parent, &item->oid);
+			(*work)[*work_nr].path = walk_child_path(item->path,
+								 entry.path);
+			(*work_nr)++;
+			continue;
+		}
+		if (!revs->blob_objects || !walk_seen_insert(walk, &entry.oid))
+			continue;
+		ALLOC_GROW(*out, *out_nr + 1, *out_alloc);
+		o = &(*out)[(*out_nr)++];
+		oidcpy(&o->oid, &entry.oid);
+		oidcpy(&o->parent, &item->oid);
+		o->type = OBJ_BLOB;
+		o->path = walk_child_path(item->path, entry.path);
+	}
+	free(buf);
+}
+
+static void *walk_thread_proc(void *data)
+{
+	struct parallel_walk *walk = data;
+	struct walk_tree_item *work = NULL;
+	struct walk_output *out = NULL;
+	size_t work_nr = 0, work_alloc = 0, out_nr = 0, out_alloc = 0;
+
+	pthread_mutex_lock(&walk->mutex);
+	for (;;) {
+		struct walk_tree_item item;
+		size_t i;
+
+		while (!walk->work_nr && walk->active)
+			pthread_cond_wait(&walk->work_cond, &walk->mutex);
+		if (!walk->work_nr)
+			break;
+		item = walk->work[--walk->work_nr];
+		walk->active++;
+		pthread_mutex_unlock(&walk->mutex);
+
+		walk_one_tree(walk, &item, &work, &work_nr, &work_alloc,
+			      &out, &out_nr, &out_alloc);
+
+		pthread_mutex_lock(&walk->mutex);
+		ALLOC_GROW(walk->work, walk->work_nr + work_nr, walk->work_alloc);
+		for (i = 0; i < work_nr; i++)
+			walk->work[walk->work_nr++] = work[i];
+		ALLOC_GROW(walk->output, walk->output_nr + out_nr,
+			   walk->output_alloc);
+		for (i = 0; i < out_nr; i++)
+			walk->output[walk->output_nr++] = out[i];
+		walk->active--;
+		if (work_nr || !walk->active)
+			pthread_cond_broadcast(&walk->work_cond);
+		pthread_cond_signal(&walk->output_cond);
+		work_nr = out_nr = 0;
+	}
+	pthread_mutex_unlock(&walk->mutex);
+
+	free(work);
+	free(out);
+	return NULL;
+}
+
+static void show_walk_output(struct traversal_context *ctx,
+			     struct walk_output *o)
+{
+	struct object *obj;
+
+	if (o->type == OBJ_TREE) {
+		struct tree *t = lookup_tree(ctx->revs->repo, &o->oid);
+		if (!t)
+			die(_("entry '%s' in tree %s has tree mode, "
+			      "but is not a tree"),
+			    o->path, oid_to_hex(&o->parent));
+		obj = &t->object;
+	} else {
+		struct blob *b = lookup_blob(ctx->revs->repo, &o->oid);
+		if (!b)
+			die(_("entry '%s' in tree %s has blob mode, "
+			      "but is not a blob"),
+			    o->path, oid_to_hex(&o->parent));
+		obj = &b->object;
+	}
+	if (!is_null_oid(&o->parent))
+		obj->flags |= NOT_USER_GIVEN;
+	obj->flags |= SEEN;
+	ctx->show_object(obj, o->path, ctx->show_data);
+	free(o->path);
+}
+
+/*
+ * Give each thread at least this many root trees, so that starting it
+ * is worth it.
+ */
+#define WALK_TREES_PER_THREAD 16
+
+static int tree_walk_threads(struct traversal_context *ctx)
+{
+	struct rev_info *revs = ctx->revs;
+	int nr_threads = revs->traverse_threads;
+	unsigned int i, nr_trees = 0;
+
+	if (!HAVE_THREADS || nr_threads <= 1 ||
+	    !revs->tree_objects || ctx->filter ||
+	    revs->diffopt.pathspec.nr ||
+	    revs->tree_blobs_in_commit_order ||
+	    revs->exclude_promisor_objects ||
+	    revs->ignore_missing_links ||
+	    revs->do_not_die_on_missing_tree)
+		return 1;
+
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->type == OBJ_TREE)
+			nr_trees++;
+	if (nr_threads > nr_trees / WALK_TREES_PER_THREAD)
+		nr_threads = nr_trees / WALK_TREES_PER_THREAD;
+	return nr_threads;
+}
+
+/*
+ * Like traverse_trees_and_blobs(), but read the trees with several
+ * threads. The threads find the objects that have not been seen yet;
+ * this thread turns them into objects and shows them, in whatever
+ * order they are found.
+ */
+static void traverse_trees_and_blobs_parallel(struct traversal_context *ctx,
+					      struct strbuf *base,
+					      int nr_threads)
+{
+	struct parallel_walk walk = { 0 };
+	struct walk_output *out = NULL;
+	size_t out_nr = 0, out_alloc = 0;
+	pthread_t *threads;
+	unsigned int i;
+	int t;
+
+	trace2_region_enter("list-objects", "parallel-tree-walk",
+			    ctx->revs->repo);
+	trace2_data_intmax("list-objects", ctx->revs->repo,
+			   "parallel-tree-walk/threads", nr_threads);
+
+	walk.ctx = ctx;
+	CALLOC_ARRAY(walk.seen, WALK_SEEN_SHARDS);
+	for (t = 0; t < WALK_SEEN_SHARDS; t++) {
+		pthread_mutex_init(&walk.seen[t].mutex, NULL);
+		oidset_init(&walk.seen[t].set, 0);
+	}
+
+	/* what the serial walk would skip because of its object flags */
+	for (i = 0; i < get_max_object_index(); i++) {
+		struct object *obj = get_indexed_object(i);
+		if (obj && (obj->flags & (UNINTERESTING | SEEN)))
+			walk_seen_insert(&walk, &obj->oid);
+	}
+
+	for (i = 0; i < ctx->revs->pending.nr; i++) {
+		struct object_array_entry *pending = ctx->revs->pending.objects + i;
+		struct object *obj = pending->item;
+		const char *path = pending->path ? pending->path : "";
+
+		if (obj->flags & (UNINTERESTING | SEEN))
+			continue;
+		if (obj->type == OBJ_TAG) {
+			process_tag(ctx, (struct tag *)obj, pending->name);
+			continue;
+		}
+		if (obj->type == OBJ_BLOB) {
+			process_blob(ctx, (struct blob *)obj, base, path);
+			walk_seen_insert(&walk, &obj->oid);
+			continue;
+		}
+		if (obj->type != OBJ_TREE)
+			die("unknown pending object %s (%s)",
+			    oid_to_hex(&obj->oid), pending->name);
+		if (!walk_seen_insert(&walk, &obj->oid))
+			continue;
+		ALLOC_GROW(walk.work, walk.work_nr + 1, walk.work_alloc);
+		oidcpy(&walk.work[walk.work_nr].oid, &obj->oid);
+		oidclr(&walk.work[walk.work_nr].parent);
+		walk.work[walk.work_nr].path = xstrdup(path);
+		walk.work_nr++;
+	}
+	object_array_clear(&ctx->revs->pending);
+
+	pthread_mutex_init(&walk.mutex, NULL);
+	pthread_cond_init(&walk.work_cond, NULL);
+	pthread_cond_init(&walk.output_cond, NULL);
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		int err = pthread_create(&threads[t], NULL, walk_thread_proc,
+					 &walk);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	pthread_mutex_lock(&walk.mutex);
+	for (;;) {
+		size_t j;
+
+		while (!walk.output_nr && (walk.work_nr || walk.active))
+			pthread_cond_wait(&walk.output_cond, &walk.mutex);
+		if (!walk.output_nr)
+			break;
+		SWAP(walk.output, out);
+		SWAP(walk.output_nr, out_nr);
+		SWAP(walk.output_alloc, out_alloc);
+		pthread_mutex_unlock(&walk.mutex);
+
+		for (j = 0; j < out_nr; j++)
+			show_walk_output(ctx, &out[j]);
+		out_nr = 0;
+
+		pthread_mutex_lock(&walk.mutex);
+	}
+	pthread_mutex_unlock(&walk.mutex);
+
+	for (t = 0; t < nr_threads; t++) {
+		int err = pthread_join(threads[t], NULL);
+		if (err)
+			die(_("unable to join thread: %s"), strerror(err));
+	}
+	free(threads);
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&walk.output_cond);
+	pthread_cond_destroy(&walk.work_cond);
+	pthread_mutex_destroy(&walk.mutex);
+	for (t = 0; t < WALK_SEEN_SHARDS; t++) {
+		oidset_clear(&walk.seen[t].set);
+		pthread_mutex_destroy(&walk.seen[t].mutex);
+	}
+	free(walk.seen);
+	free(walk.work);
+	free(walk.output);
+	free(out);
+
+	trace2_region_leave("list-objects", "parallel-tree-walk",
+			    ctx->revs->repo);
+}
+
 static void traverse_trees_and_blobs(struct traversal_context *ctx,
 				     struct strbuf *base)
 {
-	int i;
+	int i, nr_threads;
 
 	assert(base->len == 0);
 
+	nr_threads = tree_walk_threads(ctx);
+	if (nr_threads > 1) {
+		traverse_trees_and_blobs_parallel(ctx, base, nr_threads);
+		return;
+	}
+
 	for (i = 0; i < ctx->revs->pending.nr; i++) {
 		struct object_array_entry *pending = ctx->revs->pending.objects + i;
 		struct object *obj = pending->item;
@@ -367,7 +718,6 @@ static void traverse_trees_and_blobs(struct traversal_context *ctx,
 	}
 	object_array_clear(&ctx->revs->pending);
 }
-
 static void do_traverse(struct traversal_context *ctx)
 {
 	struct commit *commit;
@@ -360,29 +360,15 @@ static void normalize_file(mmfile_t *mm, const char *path, struct index_state *i
 	}
 }
 
-int ll_merge(mmbuffer_t *result_buf,
-	     const char *path,
-	     mmfile_t *ancestor, const char *ancestor_label,
-	     mmfile_t *ours, const char *our_label,
-	     mmfile_t *theirs, const char *their_label,
-	     struct index_state *istate,
-	     const struct ll_merge_options *opts)
+static const struct ll_merge_driver *find_driver_for_path(
+		struct index_state *istate, const char *path,
+		const struct ll_merge_options *opts, int *marker_size_out)
 {
 	struct attr_check *check = load_merge_attributes();
-	static const struct ll_merge_options default_opts;
 	const char *ll_driver_name = NULL;
 	int marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
 	const struct ll_merge_driver *driver;
 
-	if (!opts)
-		opts = &default_opts;
-
-	if (opts->renormalize) {
-		normalize_file(ancestor, path, istate);
-		normalize_file(ours, path, istate);
-		normalize_file(theirs, path, istate);
-	}
-
 	git_check_attr(istate, path, check);
 	ll_driver_name = check->items[0].value;
 	if (check->items[1].value) {
@@ -399,11 +385,80 @@ int ll_merge(mmbuffer_t *result_buf,
 	if (opts->extra_marker_size) {
 		marker_size += opts->extra_marker_size;
 	}
+	*marker_size_out = marker_size;
+	return driver;
+}
+
+int ll_merge(mmbuffer_t *result_buf,
+	     const char *path,
+	     mmfile_t *ancestor, const char *ancestor_label,
+	     mmfile_t *ours, const char *our_label,
+	     mmfile_t *theirs, const char *their_label,
+	     struct index_state *istate,
+	     const struct ll_merge_options *opts)
+{
+	static const struct ll_merge_options default_opts;
+	const struct ll_merge_driver *driver;
+	int marker_size;
+
+	if (!opts)
+		opts = &default_opts;
+
+	if (opts->renormalize) {
+		normalize_file(ancestor, path, istate);
+		normalize_file(ours, path, istate);
+		normalize_file(theirs, path, istate);
+	}
+
+	driver = find_driver_for_path(istate, path, opts, &marker_size);
 	return driver->fn(driver, result_buf, path, ancestor, ancestor_label,
 			  ours, our_label, theirs, their_label,
 			  opts, marker_size);
 }
 
+int ll_merge_prepare(struct ll_merge_prepared *prep,
+		     const char *path,
+		     struct index_state *istate,
+		     const struct ll_merge_options *opts)
+{
+	const struct ll_merge_driver *driver;
+
+	if (opts->renormalize)
+		return -1;
+	driver = find_driver_for_path(istate, path, opts, &prep->marker_size);
+	if (driver != &ll_merge_drv[LL_TEXT_MERGE] &&
+	    driver != &ll_merge_drv[LL_UNION_MERGE])
+		return -1;
+	prep->driver = driver;
+	return 0;
+}
+
+int ll_merge_prepared(const struct ll_merge_prepared *prep,
+		      mmbuffer_t *result_buf,
+		      const char *path,
+		      mmfile_t *ancestor, const char *ancestor_label,
+		      mmfile_t *ours, const char *our_label,
+		      mmfile_t *theirs, const char *their_label,
+		      const struct ll_merge_options *opts)
+{
+	/* the binary merge this would fall back to warns */
+	if (!opts->virtual_ancestor && !opts->variant &&
+	    (ancestor->size > MAX_XDIFF_SIZE ||
+	     ours->size > MAX_XDIFF_SIZE ||
+	     theirs->size > MAX_XDIFF_SIZE ||
+	     buffer_is_binary(ancestor->ptr, ancestor->size) ||
+	     buffer_is_binary(ours->ptr, ours->size) ||
+	     buffer_is_binary(theirs->ptr, theirs->size))) {
+		result_buf->ptr = NULL;
+		result_buf->size = 0;
+		return -1;
+	}
+	return prep->driver->fn(prep->driver, result_buf, path,
+				ancestor, ancestor_label,
+				ours, our_label, theirs, their_label,
+				opts, prep->marker_size);
+}
+
 int ll_merge_marker_size(struct index_state *istate, const char *path)
 {
 	static struct attr_check *check;
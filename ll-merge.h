@@ -41,6 +41,7 @@
 
 
 struct index_state;
+struct ll_merge_driver;
 
 /**
  * This describes the set of options the calling program wants to affect
@@ -96,6 +97,36 @@ int ll_merge(mmbuffer_t *result_buf,
 	     struct index_state *istate,
 	     const struct ll_merge_options *opts);
 
+/*
+ * ll_merge() looks up the attributes of the path and may run a merge
+ * driver of the user's, neither of which can be done on several threads
+ * at once. To merge on threads, call ll_merge_prepare() first, which
+ * does the lookup and returns 0 if the path is merged by one of the
+ * builtin text merges. ll_merge_prepared() can then merge it on any
+ * thread. It returns -1 without producing a result when the files
+ * would need a merge that has to warn, e.g. because they are binary,
+ * in which case the caller has to use ll_merge() instead.
+ *
+ * Renormalization cannot be prepared.
+ */
+struct ll_merge_prepared {
+	const struct ll_merge_driver *driver;
+	int marker_size;
+};
+
+int ll_merge_prepare(struct ll_merge_prepared *prep,
+		     const char *path,
+		     struct index_state *istate,
+		     const struct ll_merge_options *opts);
+
+int ll_merge_prepared(const struct ll_merge_prepared *prep,
+		      mmbuffer_t *result_buf,
+		      const char *path,
+		      mmfile_t *ancestor, const char *ancestor_label,
+		      mmfile_t *ours, const char *our_label,
+		      mmfile_t *theirs, const char *their_label,
+		      const struct ll_merge_options *opts);
+
 int ll_merge_marker_size(struct index_state *istate, const char *path);
 void reset_merge_attributes(void);
 
@@ -6,6 +6,7 @@
 #include "ls-refs.h"
 #include "pkt-line.h"
 #include "config.h"
+#include "advertised-refs.h"
 
 static int config_read;
 static int advertise_unborn;
@@ -66,8 +67,24 @@ struct ls_refs_data {
 	unsigned symrefs;
 	struct strvec prefixes;
 	unsigned unborn : 1;
+
+	/* advertisement lines not written out yet */
+	struct strbuf buf;
 };
 
+/*
+ * Queue one line of the advertisement, writing out what has been
+ * queued so far once there is enough of it to be worth a write.
+ */
+static void send_line(struct ls_refs_data *data, const char *line, size_t len)
+{
+	packet_buf_write_len(&data->buf, line, len);
+	if (data->buf.len >= LARGE_PACKET_MAX) {
+		write_or_die(1, data->buf.buf, data->buf.len);
+		strbuf_reset(&data->buf);
+	}
+}
+
 static int send_ref(const char *refname, const struct object_id *oid,
 		    int flag, void *cb_data)
 {
@@ -105,12 +122,38 @@ static int send_ref(const char *refname, const struct object_id *oid,
 	}
 
 	strbuf_addch(&refline, '\n');
-	packet_write(1, refline.buf, refline.len);
+	send_line(data, refline.buf, refline.len);
 
 	strbuf_release(&refline);
 	return 0;
 }
 
+static void send_advertised_ref(const struct advertised_ref *ref,
+				void *cb_data)
+{
+	struct ls_refs_data *data = cb_data;
+	struct strbuf refline = STRBUF_INIT;
+
+	if (ref_is_hidden(ref->refname, ref->refname))
+		return;
+
+	if (data->peel && data->symrefs) {
+		/* the cache has the line just as we would send it */
+		send_line(data, ref->line, ref->line_len);
+		return;
+	}
+
+	strbuf_addf(&refline, "%s %s", oid_to_hex(&ref->oid), ref->refname);
+	if (data->symrefs && ref->symref_target)
+		strbuf_addf(&refline, " symref-target:%s", ref->symref_target);
+	if (data->peel && ref->has_peeled)
+		strbuf_addf(&refline, " peeled:%s", oid_to_hex(&ref->peeled));
+	strbuf_addch(&refline, '\n');
+	send_line(data, refline.buf, refline.len);
+
+	strbuf_release(&refline);
+}
+
 static void send_possibly_unborn_head(struct ls_refs_data *data)
 {
 	struct strbuf namespaced = STRBUF_INIT;
@@ -145,6 +188,7 @@ int ls_refs(struct repository *r, struct strvec *keys,
 
 	memset(&data, 0, sizeof(data));
 	strvec_init(&data.prefixes);
+	strbuf_init(&data.buf, 0);
 
 	ensure_config_read();
 	git_config(ls_refs_config, NULL);
@@ -169,9 +213,14 @@ int ls_refs(struct repository *r, struct strvec *keys,
 	send_possibly_unborn_head(&data);
 	if (!data.prefixes.nr)
 		strvec_push(&data.prefixes, "");
-	for_each_fullref_in_prefixes(get_git_namespace(), data.prefixes.v,
-				     send_ref, &data, 0);
-	packet_flush(1);
+	if (for_each_advertised_ref(r, data.prefixes.v,
+				    send_advertised_ref, &data))
+		for_each_fullref_in_prefixes(get_git_namespace(),
+					     data.prefixes.v,
+					     send_ref, &data, 0);
+	packet_buf_flush(&data.buf);
+	write_or_die(1, data.buf.buf, data.buf.len);
+	strbuf_release(&data.buf);
 	strvec_clear(&data.prefixes);
 	return 0;
 }
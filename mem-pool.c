@@ -4,6 +4,7 @@
 
 #include "cache.h"
 #include "mem-pool.h"
+#include "trace2.h"
 
 static struct trace_key trace_mem_pool = TRACE_KEY_INIT(MEMPOOL);
 #define BLOCK_GROWTH_SIZE (1024 * 1024 - sizeof(struct mp_block))
@@ -48,12 +49,19 @@ void mem_pool_init(struct mem_pool *pool, size_t initial_size)
 		pool, (uintmax_t)initial_size);
 }
 
+static size_t mem_pool_unused(struct mem_pool *pool)
+{
+	if (!pool->mp_block)
+		return 0;
+	return pool->mp_block->end - pool->mp_block->next_free;
+}
+
 void mem_pool_discard(struct mem_pool *pool, int invalidate_memory)
 {
 	struct mp_block *block, *block_to_free;
 
 	trace_printf_key(&trace_mem_pool, "mem_pool (%p): discard (%"PRIuMAX") unused\n",
-		pool, (uintmax_t)(pool->mp_block->end - pool->mp_block->next_free));
+		pool, (uintmax_t)mem_pool_unused(pool));
 	block = pool->mp_block;
 	while (block)
 	{
@@ -138,17 +146,17 @@ void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src)
 {
 	struct mp_block *p;
 
-	/* Append the blocks from src to dst */
+	/*
+	 * Put the blocks from src right after the block dst allocates
+	 * from, so that the cost depends only on the size of src.
+	 */
 	if (dst->mp_block && src->mp_block) {
-		/*
-		 * src and dst have blocks, append
-		 * blocks from src to dst.
-		 */
-		p = dst->mp_block;
+		p = src->mp_block;
 		while (p->next_block)
 			p = p->next_block;
 
-		p->next_block = src->mp_block;
+		p->next_block = dst->mp_block->next_block;
+		dst->mp_block->next_block = src->mp_block;
 	} else if (src->mp_block) {
 		/*
 		 * src has blocks, dst is empty.
@@ -162,3 +170,55 @@ void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src)
 	src->pool_alloc = 0;
 	src->mp_block = NULL;
 }
+
+void mem_pool_shared_init(struct mem_pool_shared *shared, struct mem_pool *pool)
+{
+	memset(shared, 0, sizeof(*shared));
+	shared->pool = pool;
+	pthread_mutex_init(&shared->mutex, NULL);
+}
+
+void mem_pool_hand_off(struct mem_pool_shared *shared, struct mem_pool *arena)
+{
+	size_t nr_blocks = 0;
+	struct mp_block *p;
+
+	for (p = arena->mp_block; p; p = p->next_block)
+		nr_blocks++;
+
+	pthread_mutex_lock(&shared->mutex);
+	shared->nr_arenas++;
+	shared->nr_blocks += nr_blocks;
+	shared->arena_alloc += arena->pool_alloc;
+	shared->arena_unused += mem_pool_unused(arena);
+	mem_pool_combine(shared->pool, arena);
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+void *mem_pool_shared_alloc(struct mem_pool_shared *shared, size_t len)
+{
+	void *r;
+
+	pthread_mutex_lock(&shared->mutex);
+	r = mem_pool_alloc(shared->pool, len);
+	pthread_mutex_unlock(&shared->mutex);
+	return r;
+}
+
+void mem_pool_shared_release(struct mem_pool_shared *shared)
+{
+	trace_printf_key(&trace_mem_pool,
+			 "mem_pool (%p): %u arenas handed off (%"PRIuMAX") blocks "
+			 "(%"PRIuMAX") allocated (%"PRIuMAX") unused\n",
+			 shared->pool, shared->nr_arenas,
+			 (uintmax_t)shared->nr_blocks,
+			 (uintmax_t)shared->arena_alloc,
+			 (uintmax_t)shared->arena_unused);
+	trace2_data_intmax("mem_pool", NULL, "shared/arenas", shared->nr_arenas);
+	trace2_data_intmax("mem_pool", NULL, "shared/blocks", shared->nr_blocks);
+	trace2_data_intmax("mem_pool", NULL, "shared/alloc", shared->arena_alloc);
+	trace2_data_intmax("mem_pool", NULL, "shared/unused", shared->arena_unused);
+
+	pthread_mutex_destroy(&shared->mutex);
+	shared->pool = NULL;
+}
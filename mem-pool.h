@@ -1,6 +1,8 @@
 #ifndef MEM_POOL_H
 #define MEM_POOL_H
 
+#include "thread-utils.h"
+
 struct mp_block {
 	struct mp_block *next_block;
 	char *next_free;
@@ -60,4 +62,55 @@ void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src);
  */
 int mem_pool_contains(struct mem_pool *pool, void *mem);
 
+/*
+ * A mem_pool is not thread-safe. For threads to allocate memory that
+ * ends up in one pool, each thread allocates from its own pool (an
+ * "arena"), and hands its blocks off to a shared pool when it is done:
+ *
+ *	struct mem_pool_shared shared;
+ *
+ *	mem_pool_shared_init(&shared, &pool);
+ *	... then, in each thread:
+ *		struct mem_pool arena;
+ *
+ *		mem_pool_init(&arena, 0);
+ *		... allocate from &arena ...
+ *		mem_pool_hand_off(&shared, &arena);
+ *	... and once the threads are joined:
+ *	mem_pool_shared_release(&shared);
+ *
+ * after which `pool` owns all the memory the threads allocated, which
+ * is freed in bulk by `mem_pool_discard`. The arenas need no discarding.
+ */
+struct mem_pool_shared {
+	struct mem_pool *pool;
+	pthread_mutex_t mutex;
+
+	/* Statistics about the arenas that were handed off. */
+	unsigned int nr_arenas;
+	size_t nr_blocks;
+	size_t arena_alloc;
+	size_t arena_unused;
+};
+
+void mem_pool_shared_init(struct mem_pool_shared *shared, struct mem_pool *pool);
+
+/*
+ * Move the memory of `arena` to the shared pool. This may be called from
+ * any thread.
+ */
+void mem_pool_hand_off(struct mem_pool_shared *shared, struct mem_pool *arena);
+
+/*
+ * Allocate memory directly from the shared pool, for threads that only
+ * need a little of it. This may be called from any thread.
+ */
+void *mem_pool_shared_alloc(struct mem_pool_shared *shared, size_t len);
+
+/*
+ * Report the statistics of the shared pool and release its resources.
+ * The pool it was initialized with is left alone.
+ */
+void mem_pool_shared_release(struct mem_pool_shared *shared);
+
 #endif
@@ -3,6 +3,8 @@
 #include "merge-ort-wrappers.h"
 
 #include "commit.h"
+#include "lockfile.h"
+#include "tree.h"
 
 static int unclean(struct merge_options *opt, struct tree *head)
 {
@@ -60,3 +62,40 @@ int merge_ort_recursive(struct merge_options *opt,
 
 	return tmp.clean;
 }
+
+int merge_ort_generic(struct merge_options *opt,
+		      const struct object_id *head,
+		      const struct object_id *merge,
+		      const struct object_id *merge_base)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct tree *head_tree = parse_tree_indirect(head);
+	struct tree *next_tree = parse_tree_indirect(merge);
+	struct tree *base_tree = parse_tree_indirect(merge_base);
+	struct merge_result result;
+
+	if (!head_tree || !next_tree || !base_tree)
+		return error(_("could not parse the trees to merge"));
+
+	repo_hold_locked_index(opt->repo, &lock, LOCK_DIE_ON_ERROR);
+	if (unclean(opt, head_tree)) {
+		rollback_lock_file(&lock);
+		return -1;
+	}
+
+	opt->ancestor = "constructed merge base";
+	memset(&result, 0, sizeof(result));
+	merge_incore_nonrecursive(opt, base_tree, head_tree, next_tree,
+				  &result);
+	merge_switch_to_result(opt, head_tree, &result, 1, 1);
+	if (result.clean < 0) {
+		rollback_lock_file(&lock);
+		return result.clean;
+	}
+
+	if (write_locked_index(opt->repo->index, &lock,
+			       COMMIT_LOCK | SKIP_IF_UNCHANGED))
+		return error(_("unable to write index"));
+
+	return result.clean ? 0 : 1;
+}
@@ -22,4 +22,17 @@ int merge_ort_recursive(struct merge_options *opt,
 			struct commit_list *ancestors,
 			struct commit **result);
 
+/*
+ * rename-detecting three-way merge of the trees `head` and `merge`
+ * with `merge_base` as their common ancestor, updating the index and
+ * the working tree and writing the index. The arguments may name any
+ * tree-ish. Wrapper mimicking the old merge_recursive_generic()
+ * function for a single merge base; returns 0 for a clean merge, 1
+ * when there are conflicts and a negative value on error.
+ */
+int merge_ort_generic(struct merge_options *opt,
+		      const struct object_id *head,
+		      const struct object_id *merge,
+		      const struct object_id *merge_base);
+
 #endif
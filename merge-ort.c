@@ -23,15 +23,18 @@
 #include "cache-tree.h"
 #include "commit.h"
 #include "commit-reach.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "dir.h"
 #include "entry.h"
 #include "ll-merge.h"
 #include "object-store.h"
+#include "promisor-remote.h"
 #include "revision.h"
 #include "strmap.h"
 #include "submodule.h"
+#include "thread-utils.h"
 #include "tree.h"
 #include "unpack-trees.h"
 #include "xdiff-interface.h"
@@ -245,6 +248,15 @@ struct merge_options_internal {
 
 	/* call_depth: recursion level counter for merging merge bases */
 	int call_depth;
+
+	/*
+	 * premerged: content merges done ahead of time on threads
+	 *
+	 * While process_entries() runs with several threads, this maps
+	 * paths to the premerge_job that merged their contents, for
+	 * handle_content_merge() to pick up.  NULL otherwise.
+	 */
+	struct strmap *premerged;
 };
 
 struct version_info {
@@ -1259,6 +1271,38 @@ static void initialize_attr_index(struct merge_options *opt)
 	}
 }
 
+static void init_ll_merge_options(struct merge_options *opt,
+				  const int extra_marker_size,
+				  struct ll_merge_options *ll_opts)
+{
+	memset(ll_opts, 0, sizeof(*ll_opts));
+	ll_opts->renormalize = opt->renormalize;
+	ll_opts->extra_marker_size = extra_marker_size;
+	ll_opts->xdl_opts = opt->xdl_opts;
+
+	if (opt->priv->call_depth) {
+		ll_opts->virtual_ancestor = 1;
+		ll_opts->variant = 0;
+	} else {
+		switch (opt->recursive_variant) {
+		case MERGE_VARIANT_OURS:
+			ll_opts->variant = XDL_MERGE_FAVOR_OURS;
+			break;
+		case MERGE_VARIANT_THEIRS:
+			ll_opts->variant = XDL_MERGE_FAVOR_THEIRS;
+			break;
+		default:
+			ll_opts->variant = 0;
+			break;
+		}
+	}
+}
+
+/*
+ * With "prep" from ll_merge_prepare(), this can run on a thread; it
+ * then returns -1 without a result if ll_merge() has to be used after
+ * all.
+ */
 static int merge_3way(struct merge_options *opt,
 		      const char *path,
 		      const struct object_id *o,
@@ -1266,36 +1310,18 @@ static int merge_3way(struct merge_options *opt,
 		      const struct object_id *b,
 		      const char *pathnames[3],
 		      const int extra_marker_size,
+		      const struct ll_merge_prepared *prep,
 		      mmbuffer_t *result_buf)
 {
 	mmfile_t orig, src1, src2;
-	struct ll_merge_options ll_opts = {0};
+	struct ll_merge_options ll_opts;
 	char *base, *name1, *name2;
 	int merge_status;
 
-	if (!opt->priv->attr_index.initialized)
+	if (!prep && !opt->priv->attr_index.initialized)
 		initialize_attr_index(opt);
 
-	ll_opts.renormalize = opt->renormalize;
-	ll_opts.extra_marker_size = extra_marker_size;
-	ll_opts.xdl_opts = opt->xdl_opts;
-
-	if (opt->priv->call_depth) {
-		ll_opts.virtual_ancestor = 1;
-		ll_opts.variant = 0;
-	} else {
-		switch (opt->recursive_variant) {
-		case MERGE_VARIANT_OURS:
-			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
-			break;
-		case MERGE_VARIANT_THEIRS:
-			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
-			break;
-		default:
-			ll_opts.variant = 0;
-			break;
-		}
-	}
+	init_ll_merge_options(opt, extra_marker_size, &ll_opts);
 
 	assert(pathnames[0] && pathnames[1] && pathnames[2] && opt->ancestor);
 	if (pathnames[0] == pathnames[1] && pathnames[1] == pathnames[2]) {
@@ -1312,9 +1338,14 @@ static int merge_3way(struct merge_options *opt,
 	read_mmblob(&src1, a);
 	read_mmblob(&src2, b);
 
-	merge_status = ll_merge(result_buf, path, &orig, base,
-				&src1, name1, &src2, name2,
-				&opt->priv->attr_index, &ll_opts);
+	if (prep)
+		merge_status = ll_merge_prepared(prep, result_buf, path,
+						 &orig, base, &src1, name1,
+						 &src2, name2, &ll_opts);
+	else
+		merge_status = ll_merge(result_buf, path, &orig, base,
+					&src1, name1, &src2, name2,
+					&opt->priv->attr_index, &ll_opts);
 
 	free(base);
 	free(name1);
@@ -1325,6 +1356,50 @@ static int merge_3way(struct merge_options *opt,
 	return merge_status;
 }
 
+/*
+ * A three-way content merge that process_entries() had done on a thread
+ * before process_entry() needed it.
+ */
+struct premerge_job {
+	const char *path;
+
+	/* the inputs, for handle_content_merge() to check */
+	struct object_id o, a, b;
+	const char **pathnames;
+	int extra_marker_size;
+	struct ll_merge_prepared prep;
+
+	/* the outputs of merge_3way() */
+	int status;
+	mmbuffer_t result;
+};
+
+/*
+ * Return the premerged job for merging "o", "a" and "b" at "path" the
+ * way handle_content_merge() is about to, if there is one.
+ */
+static struct premerge_job *take_premerged(struct merge_options *opt,
+					   const char *path,
+					   const struct object_id *o,
+					   const struct object_id *a,
+					   const struct object_id *b,
+					   const char *pathnames[3],
+					   const int extra_marker_size)
+{
+	struct premerge_job *job;
+
+	if (!opt->priv->premerged)
+		return NULL;
+	job = strmap_get(opt->priv->premerged, path);
+	if (!job || job->status < 0 ||
+	    !oideq(&job->o, o) || !oideq(&job->a, a) || !oideq(&job->b, b) ||
+	    job->pathnames != pathnames ||
+	    job->extra_marker_size != extra_marker_size)
+		return NULL;
+	strmap_remove(opt->priv->premerged, path, 0);
+	return job;
+}
+
 static int handle_content_merge(struct merge_options *opt,
 				const char *path,
 				const struct version_info *o,
@@ -1398,18 +1473,29 @@ static int handle_content_merge(struct merge_options *opt,
 		mmbuffer_t result_buf;
 		int ret = 0, merge_status;
 		int two_way;
+		const struct object_id *base_oid;
+		struct premerge_job *premerged;
 
 		/*
 		 * If 'o' is different type, treat it as null so we do a
 		 * two-way merge.
 		 */
 		two_way = ((S_IFMT & o->mode) != (S_IFMT & a->mode));
-
-		merge_status = merge_3way(opt, path,
-					  two_way ? null_oid() : &o->oid,
-					  &a->oid, &b->oid,
-					  pathnames, extra_marker_size,
-					  &result_buf);
+		base_oid = two_way ? null_oid() : &o->oid;
+
+		premerged = take_premerged(opt, path, base_oid,
+					   &a->oid, &b->oid,
+					   pathnames, extra_marker_size);
+		if (premerged) {
+			merge_status = premerged->status;
+			result_buf = premerged->result;
+			premerged->result.ptr = NULL;
+		} else {
+			merge_status = merge_3way(opt, path, base_oid,
+						  &a->oid, &b->oid,
+						  pathnames, extra_marker_size,
+						  NULL, &result_buf);
+		}
 
 		if ((merge_status < 0) || !result_buf.ptr)
 			ret = err(opt, _("Failed to execute internal merge"));
@@ -3225,9 +3311,192 @@ static void process_entry(struct merge_options *opt,
 	record_entry_for_tree(dir_metadata, path, &ci->merged);
 }
 
+/*
+ * The three-way content merges of different paths do not depend on
+ * each other, so with several threads, process_entries() has the
+ * upcoming ones done on threads a batch at a time. It still writes the
+ * results and handles the conflicts itself in path order, so that the
+ * outcome is the same as without threads.
+ */
+#define PREMERGE_BATCH_PER_THREAD 32
+
+struct premerge_batch {
+	int nr_threads;
+
+	/* plist entries before this one have not been looked at yet */
+	int unscanned;
+
+	struct premerge_job *jobs;
+	int nr;
+	struct strmap premerged;
+};
+
+struct premerge_thread_data {
+	pthread_t pthread;
+	struct merge_options *opt;
+	struct premerge_batch *batch;
+
+	/* Shared by all threads and guarded by "mutex". */
+	pthread_mutex_t *mutex;
+	int *next;
+};
+
+static int merge_threads(struct merge_options *opt)
+{
+	int nr_threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	nr_threads = git_env_ulong("GIT_TEST_MERGE_THREADS", 0);
+	if (nr_threads)
+		return nr_threads;
+
+	if (repo_config_get_int(opt->repo, "merge.threads", &nr_threads))
+		nr_threads = 1;
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    nr_threads, "merge.threads");
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+/*
+ * Will process_entry() do a three-way merge of two regular files with
+ * different contents for "mi"? Keep this in sync with process_entry()
+ * and handle_content_merge().
+ */
+static int needs_content_merge(struct merged_info *mi)
+{
+	struct conflict_info *ci;
+	struct version_info *o, *a, *b;
+
+	if (mi->clean)
+		return 0;
+	ci = (struct conflict_info *)mi;
+	if (ci->dirmask || ci->df_conflict || ci->match_mask ||
+	    ci->filemask < 6)
+		return 0;
+
+	o = &ci->stages[0];
+	a = &ci->stages[1];
+	b = &ci->stages[2];
+	return S_ISREG(a->mode) && S_ISREG(b->mode) &&
+	       !oideq(&a->oid, &b->oid) && !oideq(&a->oid, &o->oid) &&
+	       !oideq(&b->oid, &o->oid);
+}
+
+static void *premerge_thread(void *_data)
+{
+	struct premerge_thread_data *d = _data;
+
+	trace2_thread_start("merge-worker");
+	for (;;) {
+		struct premerge_job *job;
+		int i;
+
+		pthread_mutex_lock(d->mutex);
+		i = (*d->next)++;
+		pthread_mutex_unlock(d->mutex);
+		if (i >= d->batch->nr)
+			break;
+
+		job = &d->batch->jobs[i];
+		job->status = merge_3way(d->opt, job->path, &job->o,
+					 &job->a, &job->b, job->pathnames,
+					 job->extra_marker_size, &job->prep,
+					 &job->result);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static void release_premerge_jobs(struct premerge_batch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->nr; i++)
+		free(batch->jobs[i].result.ptr);
+	batch->nr = 0;
+	strmap_partial_clear(&batch->premerged, 0);
+}
+
+/*
+ * Merge the contents of the next batch of paths that need it, starting
+ * with plist->items[pos] and going backwards the way process_entries()
+ * does.
+ */
+static void premerge_contents(struct merge_options *opt,
+			      struct string_list *plist, int pos,
+			      struct premerge_batch *batch)
+{
+	int max = batch->nr_threads * PREMERGE_BATCH_PER_THREAD;
+	struct premerge_thread_data *data;
+	struct ll_merge_options ll_opts;
+	pthread_mutex_t mutex;
+	int next = 0, i, err;
+
+	release_premerge_jobs(batch);
+	if (!opt->priv->attr_index.initialized)
+		initialize_attr_index(opt);
+	init_ll_merge_options(opt, opt->priv->call_depth * 2, &ll_opts);
+
+	for (; pos >= 0 && batch->nr < max; pos--) {
+		struct string_list_item *entry = &plist->items[pos];
+		struct conflict_info *ci = entry->util;
+		struct premerge_job *job = &batch->jobs[batch->nr];
+		int two_way;
+
+		if (!needs_content_merge(entry->util))
+			continue;
+		memset(job, 0, sizeof(*job));
+		if (ll_merge_prepare(&job->prep, entry->string,
+				     &opt->priv->attr_index, &ll_opts))
+			continue;
+
+		two_way = ((S_IFMT & ci->stages[0].mode) !=
+			   (S_IFMT & ci->stages[1].mode));
+		job->path = entry->string;
+		oidcpy(&job->o, two_way ? null_oid() : &ci->stages[0].oid);
+		oidcpy(&job->a, &ci->stages[1].oid);
+		oidcpy(&job->b, &ci->stages[2].oid);
+		job->pathnames = ci->pathnames;
+		job->extra_marker_size = opt->priv->call_depth * 2;
+		strmap_put(&batch->premerged, job->path, job);
+		batch->nr++;
+	}
+	batch->unscanned = pos + 1;
+	if (!batch->nr)
+		return;
+
+	pthread_mutex_init(&mutex, NULL);
+	enable_obj_read_lock();
+	CALLOC_ARRAY(data, batch->nr_threads);
+	for (i = 0; i < batch->nr_threads; i++) {
+		struct premerge_thread_data *d = &data[i];
+
+		d->opt = opt;
+		d->batch = batch;
+		d->mutex = &mutex;
+		d->next = &next;
+		err = pthread_create(&d->pthread, NULL, premerge_thread, d);
+		if (err)
+			die(_("unable to create merge thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < batch->nr_threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join merge thread");
+	free(data);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&mutex);
+}
+
 static void process_entries(struct merge_options *opt,
 			    struct object_id *result_oid)
 {
+	struct premerge_batch premerge = { 0 };
 	struct hashmap_iter iter;
 	struct strmap_entry *e;
 	struct string_list plist = STRING_LIST_INIT_NODUP;
@@ -3261,6 +3530,17 @@ static void process_entries(struct merge_options *opt,
 
 	trace2_region_leave("merge", "process_entries setup", opt->repo);
 
+	premerge.nr_threads = merge_threads(opt);
+	if (premerge.nr_threads > 1 && !has_promisor_remote()) {
+		trace2_data_intmax("merge", opt->repo, "content-merge/threads",
+				   premerge.nr_threads);
+		premerge.unscanned = plist.nr;
+		CALLOC_ARRAY(premerge.jobs, premerge.nr_threads *
+					    PREMERGE_BATCH_PER_THREAD);
+		strmap_init_with_options(&premerge.premerged, NULL, 0);
+		opt->priv->premerged = &premerge.premerged;
+	}
+
 	/*
 	 * Iterate over the items in reverse order, so we can handle paths
 	 * below a directory before needing to handle the directory itself.
@@ -3286,11 +3566,25 @@ static void process_entries(struct merge_options *opt,
 			record_entry_for_tree(&dir_metadata, path, mi);
 		else {
 			struct conflict_info *ci = (struct conflict_info *)mi;
+
+			if (opt->priv->premerged &&
+			    entry - plist.items < premerge.unscanned &&
+			    needs_content_merge(mi))
+				premerge_contents(opt, &plist,
+						  entry - plist.items,
+						  &premerge);
 			process_entry(opt, path, ci, &dir_metadata);
 		}
 	}
 	trace2_region_leave("merge", "processing", opt->repo);
 
+	if (opt->priv->premerged) {
+		release_premerge_jobs(&premerge);
+		strmap_clear(&premerge.premerged, 0);
+		free(premerge.jobs);
+		opt->priv->premerged = NULL;
+	}
+
 	trace2_region_enter("merge", "process_entries cleanup", opt->repo);
 	if (dir_metadata.offsets.nr != 1 ||
 	    (uintptr_t)dir_metadata.offsets.items[0].util != 0) {
@@ -3478,6 +3772,45 @@ static int record_conflicted_index_entries(struct merge_options *opt)
 	return errs;
 }
 
+static int stage_info_cmp(const void *va, const void *vb)
+{
+	const struct string_list_item *a = va, *b = vb;
+	const struct stage_info *sa = a->util, *sb = b->util;
+	int cmp = strcmp(a->string, b->string);
+
+	return cmp ? cmp : sa->stage - sb->stage;
+}
+
+void merge_get_conflicted_files(struct merge_result *result,
+				struct string_list *conflicted_files)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct merge_options_internal *opti = result->priv;
+
+	strmap_for_each_entry(&opti->conflicted, &iter, e) {
+		const char *path = e->key;
+		struct conflict_info *ci = e->value;
+		int i;
+
+		VERIFY_CI(ci);
+
+		for (i = MERGE_BASE; i <= MERGE_SIDE2; i++) {
+			struct stage_info *si;
+
+			if (!(ci->filemask & (1ul << i)))
+				continue;
+
+			si = xmalloc(sizeof(*si));
+			si->stage = i + 1;
+			si->mode = ci->stages[i].mode;
+			oidcpy(&si->oid, &ci->stages[i].oid);
+			string_list_append(conflicted_files, path)->util = si;
+		}
+	}
+	QSORT(conflicted_files->items, conflicted_files->nr, stage_info_cmp);
+}
+
 void merge_switch_to_result(struct merge_options *opt,
 			    struct tree *head,
 			    struct merge_result *result,
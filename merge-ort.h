@@ -5,6 +5,7 @@
 
 struct commit;
 struct tree;
+struct string_list;
 
 struct merge_result {
 	/*
@@ -68,6 +69,22 @@ void merge_switch_to_result(struct merge_options *opt,
 			    int update_worktree_and_index,
 			    int display_update_msgs);
 
+/* A higher order stage of a conflicted path, as it would go in the index */
+struct stage_info {
+	struct object_id oid;
+	int mode;
+	int stage;
+};
+
+/*
+ * Add an item for each higher order stage of each conflicted path of an
+ * unclean merge to conflicted_files, in the order the index would have
+ * them, with the stage_info in its util field. The caller must free the
+ * utils, e.g. using string_list_clear(conflicted_files, 1).
+ */
+void merge_get_conflicted_files(struct merge_result *result,
+				struct string_list *conflicted_files);
+
 /* Do needed cleanup when not calling merge_switch_to_result() */
 void merge_finalize(struct merge_options *opt,
 		    struct merge_result *result);
@@ -13,6 +13,12 @@
 #include "repository.h"
 #include "chunk-format.h"
 #include "pack.h"
+#include "pack-bitmap.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "refs.h"
+#include "prio-queue.h"
+#include "thread-utils.h"
 
 #define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
 #define MIDX_VERSION 1
@@ -29,6 +35,7 @@
 #define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
 #define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+#define MIDX_CHUNKID_REVINDEX 0x52494458 /* "RIDX" */
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
 #define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
@@ -36,6 +43,8 @@
 
 #define PACK_EXPIRED UINT_MAX
 
+#define MIDX_SPLIT_SIZE_MULT 2
+
 static uint8_t oid_version(void)
 {
 	switch (hash_algo_by_ptr(the_hash_algo)) {
@@ -48,7 +57,7 @@ static uint8_t oid_version(void)
 	}
 }
 
-static const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
 {
 	return m->data + m->data_len - the_hash_algo->rawsz;
 }
@@ -58,26 +67,46 @@ static char *get_midx_filename(const char *object_dir)
 	return xstrfmt("%s/pack/multi-pack-index", object_dir);
 }
 
+static char *get_midx_chain_dirname(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d", object_dir);
+}
+
+static char *get_midx_chain_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d/multi-pack-index-chain",
+		       object_dir);
+}
+
+static char *get_midx_layer_filename(const char *object_dir,
+				     const char *hash_hex)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d/multi-pack-index-%s.midx",
+		       object_dir, hash_hex);
+}
+
 char *get_midx_rev_filename(struct multi_pack_index *m)
 {
 	return xstrfmt("%s/pack/multi-pack-index-%s.rev",
 		       m->object_dir, hash_to_hex(get_midx_checksum(m)));
 }
 
-static int midx_read_oid_fanout(const unsigned char *chunk_start,
-				size_t chunk_size, void *data)
+char *get_midx_bitmap_filename(struct multi_pack_index *m)
 {
-	struct multi_pack_index *m = data;
-	m->chunk_oid_fanout = (uint32_t *)chunk_start;
-
-	if (chunk_size != 4 * 256) {
-		error(_("multi-pack-index OID fanout is of the wrong size"));
-		return 1;
-	}
-	return 0;
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap",
+		       m->object_dir, hash_to_hex(get_midx_checksum(m)));
 }
 
-struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+static const uint32_t random_access_chunks[] = {
+	MIDX_CHUNKID_OIDLOOKUP,
+	MIDX_CHUNKID_OBJECTOFFSETS,
+	MIDX_CHUNKID_LARGEOFFSETS,
+	MIDX_CHUNKID_REVINDEX,
+};
+
+static struct multi_pack_index *load_multi_pack_index_one(const char *object_dir,
+							  const char *midx_name,
+							  int local)
 {
 	struct multi_pack_index *m = NULL;
 	int fd;
@@ -85,7 +114,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	size_t midx_size;
 	void *midx_map = NULL;
 	uint32_t hash_version;
-	char *midx_name = get_midx_filename(object_dir);
 	uint32_t i;
 	const char *cur_pack_name;
 	struct chunkfile *cf = NULL;
@@ -106,8 +134,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 		goto cleanup_fail;
 	}
 
-	FREE_AND_NULL(midx_name);
-
 	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
 
@@ -143,19 +169,48 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	if (read_table_of_contents(cf, m->data, midx_size,
 				   MIDX_HEADER_SIZE, m->num_chunks))
 		goto cleanup_fail;
+	trace_chunkfile(cf, "midx");
 
 	if (pair_chunk(cf, MIDX_CHUNKID_PACKNAMES, &m->chunk_pack_names) == CHUNK_NOT_FOUND)
 		die(_("multi-pack-index missing required pack-name chunk"));
-	if (read_chunk(cf, MIDX_CHUNKID_OIDFANOUT, midx_read_oid_fanout, m) == CHUNK_NOT_FOUND)
+	switch (pair_chunk_expect(cf, MIDX_CHUNKID_OIDFANOUT,
+				  (const unsigned char **)&m->chunk_oid_fanout,
+				  MIDX_CHUNK_FANOUT_SIZE)) {
+	case CHUNK_NOT_FOUND:
 		die(_("multi-pack-index missing required OID fanout chunk"));
-	if (pair_chunk(cf, MIDX_CHUNKID_OIDLOOKUP, &m->chunk_oid_lookup) == CHUNK_NOT_FOUND)
+	case CHUNK_WRONG_SIZE:
+		error(_("multi-pack-index OID fanout is of the wrong size"));
+		goto cleanup_fail;
+	}
+	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
+
+	switch (pair_chunk_expect(cf, MIDX_CHUNKID_OIDLOOKUP, &m->chunk_oid_lookup,
+				  st_mult(m->num_objects, m->hash_len))) {
+	case CHUNK_NOT_FOUND:
 		die(_("multi-pack-index missing required OID lookup chunk"));
-	if (pair_chunk(cf, MIDX_CHUNKID_OBJECTOFFSETS, &m->chunk_object_offsets) == CHUNK_NOT_FOUND)
+	case CHUNK_WRONG_SIZE:
+		error(_("multi-pack-index OID lookup chunk is the wrong size"));
+		goto cleanup_fail;
+	}
+	switch (pair_chunk_expect(cf, MIDX_CHUNKID_OBJECTOFFSETS,
+				  &m->chunk_object_offsets,
+				  st_mult(m->num_objects, MIDX_CHUNK_OFFSET_WIDTH))) {
+	case CHUNK_NOT_FOUND:
 		die(_("multi-pack-index missing required object offsets chunk"));
+	case CHUNK_WRONG_SIZE:
+		error(_("multi-pack-index object offsets chunk is the wrong size"));
+		goto cleanup_fail;
+	}
 
 	pair_chunk(cf, MIDX_CHUNKID_LARGEOFFSETS, &m->chunk_large_offsets);
+	if (pair_chunk_expect(cf, MIDX_CHUNKID_REVINDEX, &m->chunk_revindex,
+			      st_mult(m->num_objects, sizeof(uint32_t))) ==
+	    CHUNK_WRONG_SIZE)
+		warning(_("ignoring multi-pack-index reverse index of the wrong size"));
 
-	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
+	/* lookups only need the pages they land on */
+	for (i = 0; i < ARRAY_SIZE(random_access_chunks); i++)
+		advise_chunk(cf, random_access_chunks[i], CHUNK_ACCESS_RANDOM);
 
 	CALLOC_ARRAY(m->pack_names, m->num_packs);
 	CALLOC_ARRAY(m->packs, m->num_packs);
@@ -175,12 +230,12 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	trace2_data_intmax("midx", the_repository, "load/num_packs", m->num_packs);
 	trace2_data_intmax("midx", the_repository, "load/num_objects", m->num_objects);
 
+	free_chunkfile(cf);
 	return m;
 
 cleanup_fail:
 	free(m);
-	free(midx_name);
-	free(cf);
+	free_chunkfile(cf);
 	if (midx_map)
 		munmap(midx_map, midx_size);
 	if (0 <= fd)
@@ -188,6 +243,71 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	return NULL;
 }
 
+/*
+ * Load the layers named in the multi-pack-index chain, base first, and
+ * return the top one. Loading stops at the first layer that cannot be
+ * read; the packs of the layers above it are then found on their own.
+ */
+static struct multi_pack_index *load_multi_pack_index_chain(const char *object_dir,
+							    int local)
+{
+	char *chain_name = get_midx_chain_filename(object_dir);
+	struct multi_pack_index *m = NULL;
+	struct strbuf line = STRBUF_INIT;
+	FILE *fp;
+
+	fp = fopen(chain_name, "r");
+	free(chain_name);
+	if (!fp)
+		return NULL;
+
+	while (strbuf_getline_lf(&line, fp) != EOF) {
+		struct multi_pack_index *layer;
+		struct object_id oid;
+		char *layer_name;
+
+		if (get_oid_hex(line.buf, &oid) || line.buf[the_hash_algo->hexsz]) {
+			warning(_("invalid multi-pack-index chain: line '%s' not a hash"),
+				line.buf);
+			break;
+		}
+
+		layer_name = get_midx_layer_filename(object_dir, line.buf);
+		layer = load_multi_pack_index_one(object_dir, layer_name, local);
+		free(layer_name);
+
+		if (layer && !hasheq(get_midx_checksum(layer), oid.hash)) {
+			close_midx(layer);
+			FREE_AND_NULL(layer);
+		}
+		if (!layer) {
+			warning(_("unable to find all multi-pack-index layers"));
+			break;
+		}
+
+		layer->base_midx = m;
+		layer->in_chain = 1;
+		m = layer;
+	}
+
+	strbuf_release(&line);
+	fclose(fp);
+	return m;
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	char *midx_name = get_midx_filename(object_dir);
+	struct multi_pack_index *m;
+
+	m = load_multi_pack_index_one(object_dir, midx_name, local);
+	free(midx_name);
+
+	if (!m)
+		m = load_multi_pack_index_chain(object_dir, local);
+	return m;
+}
+
 void close_midx(struct multi_pack_index *m)
 {
 	uint32_t i;
@@ -276,23 +396,50 @@ uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 			(off_t)pos * MIDX_CHUNK_OFFSET_WIDTH);
 }
 
-static int nth_midxed_pack_entry(struct repository *r,
-				 struct multi_pack_index *m,
-				 struct pack_entry *e,
-				 uint32_t pos)
+/*
+ * Return the pack holding the object at "pos", or NULL if that pack is
+ * gone or the object is known to be bad in it. Only the presence of the
+ * .pack file is checked; neither it nor its .idx is opened.
+ */
+static struct packed_git *nth_midxed_pack_unopened(struct repository *r,
+						   struct multi_pack_index *m,
+						   uint32_t pos)
 {
 	uint32_t pack_int_id;
 	struct packed_git *p;
 
 	if (pos >= m->num_objects)
-		return 0;
+		return NULL;
 
 	pack_int_id = nth_midxed_pack_int_id(m, pos);
 
 	if (prepare_midx_pack(r, m, pack_int_id))
-		return 0;
+		return NULL;
 	p = m->packs[pack_int_id];
 
+	if (p->num_bad_objects) {
+		uint32_t i;
+		struct object_id oid;
+		nth_midxed_object_oid(&oid, m, pos);
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (hasheq(oid.hash,
+				   p->bad_object_sha1 + the_hash_algo->rawsz * i))
+				return NULL;
+	}
+
+	return p;
+}
+
+static int nth_midxed_pack_entry(struct repository *r,
+				 struct multi_pack_index *m,
+				 struct pack_entry *e,
+				 uint32_t pos)
+{
+	struct packed_git *p = nth_midxed_pack_unopened(r, m, pos);
+
+	if (!p)
+		return 0;
+
 	/*
 	* We are about to tell the caller where they can locate the
 	* requested object.  We better make sure the packfile is
@@ -303,16 +450,6 @@ static int nth_midxed_pack_entry(struct repository *r,
 	if (!is_pack_valid(p))
 		return 0;
 
-	if (p->num_bad_objects) {
-		uint32_t i;
-		struct object_id oid;
-		nth_midxed_object_oid(&oid, m, pos);
-		for (i = 0; i < p->num_bad_objects; i++)
-			if (hasheq(oid.hash,
-				   p->bad_object_sha1 + the_hash_algo->rawsz * i))
-				return 0;
-	}
-
 	e->offset = nth_midxed_offset(m, pos);
 	e->p = p;
 
@@ -332,6 +469,18 @@ int fill_midx_entry(struct repository * r,
 	return nth_midxed_pack_entry(r, m, e, pos);
 }
 
+int midx_has_object(struct repository *r,
+		    const struct object_id *oid,
+		    struct multi_pack_index *m)
+{
+	uint32_t pos;
+
+	if (!bsearch_midx(oid, m, &pos))
+		return 0;
+
+	return !!nth_midxed_pack_unopened(r, m, pos);
+}
+
 /* Match "foo.idx" against either "foo.pack" _or_ "foo.idx". */
 static int cmp_idx_or_pack_name(const char *idx_or_pack_name,
 				const char *idx_name)
@@ -387,6 +536,16 @@ int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
 	return 0;
 }
 
+int midx_chain_contains_pack(struct multi_pack_index *m,
+			     const char *idx_or_pack_name)
+{
+	for (; m; m = m->base_midx) {
+		if (midx_contains_pack(m, idx_or_pack_name))
+			return 1;
+	}
+	return 0;
+}
+
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local)
 {
 	struct multi_pack_index *m;
@@ -404,8 +563,14 @@ int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, i
 
 	if (m) {
 		struct multi_pack_index *mp = r->objects->multi_pack_index;
+		struct multi_pack_index *last = m;
+
+		/* keep the layers of a chain together, top layer first */
+		for (; last->base_midx; last = last->base_midx)
+			last->next = last->base_midx;
+
 		if (mp) {
-			m->next = mp->next;
+			last->next = mp->next;
 			mp->next = m;
 		} else
 			r->objects->multi_pack_index = m;
@@ -456,6 +621,7 @@ struct write_midx_context {
 	uint32_t nr;
 	uint32_t alloc;
 	struct multi_pack_index *m;
+	struct multi_pack_index *base_midx;
 	struct progress *progress;
 	unsigned pack_paths_checked;
 
@@ -468,8 +634,39 @@ struct write_midx_context {
 	uint32_t num_large_offsets;
 
 	int preferred_pack_idx;
+	int nr_threads;
 };
 
+static void add_pack_info(struct write_midx_context *ctx,
+			  const char *full_path, size_t full_path_len,
+			  const char *file_name)
+{
+	ALLOC_GROW(ctx->info, ctx->nr + 1, ctx->alloc);
+
+	ctx->info[ctx->nr].p = add_packed_git(full_path,
+					      full_path_len,
+					      0);
+
+	if (!ctx->info[ctx->nr].p) {
+		warning(_("failed to add packfile '%s'"),
+			full_path);
+		return;
+	}
+
+	if (open_pack_index(ctx->info[ctx->nr].p)) {
+		warning(_("failed to open pack-index '%s'"),
+			full_path);
+		close_pack(ctx->info[ctx->nr].p);
+		FREE_AND_NULL(ctx->info[ctx->nr].p);
+		return;
+	}
+
+	ctx->info[ctx->nr].pack_name = xstrdup(file_name);
+	ctx->info[ctx->nr].orig_pack_int_id = ctx->nr;
+	ctx->info[ctx->nr].expired = 0;
+	ctx->nr++;
+}
+
 static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 			     const char *file_name, void *data)
 {
@@ -479,31 +676,10 @@ static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 		display_progress(ctx->progress, ++ctx->pack_paths_checked);
 		if (ctx->m && midx_contains_pack(ctx->m, file_name))
 			return;
-
-		ALLOC_GROW(ctx->info, ctx->nr + 1, ctx->alloc);
-
-		ctx->info[ctx->nr].p = add_packed_git(full_path,
-						      full_path_len,
-						      0);
-
-		if (!ctx->info[ctx->nr].p) {
-			warning(_("failed to add packfile '%s'"),
-				full_path);
-			return;
-		}
-
-		if (open_pack_index(ctx->info[ctx->nr].p)) {
-			warning(_("failed to open pack-index '%s'"),
-				full_path);
-			close_pack(ctx->info[ctx->nr].p);
-			FREE_AND_NULL(ctx->info[ctx->nr].p);
+		if (midx_chain_contains_pack(ctx->base_midx, file_name))
 			return;
-		}
 
-		ctx->info[ctx->nr].pack_name = xstrdup(file_name);
-		ctx->info[ctx->nr].orig_pack_int_id = ctx->nr;
-		ctx->info[ctx->nr].expired = 0;
-		ctx->nr++;
+		add_pack_info(ctx, full_path, full_path_len, file_name);
 	}
 }
 
@@ -571,105 +747,224 @@ static void fill_pack_entry(uint32_t pack_int_id,
 }
 
 /*
- * It is possible to artificially get into a state where there are many
- * duplicate copies of objects. That can create high memory pressure if
- * we are to create a list of all objects before de-duplication. To reduce
- * this memory pressure without a significant performance drop, automatically
- * group objects by the first byte of their object id. Use the IDX fanout
- * tables to group the data, copy to a local array, then sort.
- *
- * Copy only the de-duplicated entries (selected by most-recent modified time
- * of a packfile containing the object).
+ * One sorted run of objects fed into the merge in get_sorted_entries():
+ * either the objects of one pack, or those of the MIDX being rewritten.
+ */
+struct midx_merge_source {
+	struct pack_midx_entry entry;
+	struct multi_pack_index *m;
+	struct packed_git *p;
+	uint32_t pack_int_id;
+	int preferred_pack;
+	uint32_t cur, end;
+};
+
+static void midx_merge_source_fill(struct midx_merge_source *s)
+{
+	if (s->m) {
+		nth_midxed_pack_midx_entry(s->m, &s->entry, s->cur);
+		s->entry.preferred = s->entry.pack_int_id == s->preferred_pack;
+	} else
+		fill_pack_entry(s->pack_int_id, s->p, s->cur, &s->entry,
+				s->pack_int_id == s->preferred_pack);
+}
+
+static int midx_merge_source_cmp(const void *va, const void *vb,
+				 void *unused)
+{
+	const struct midx_merge_source *a = va, *b = vb;
+	return midx_oid_compare(&a->entry, &b->entry);
+}
+
+struct sorted_entries_data {
+	pthread_t pthread;
+	struct multi_pack_index *m;
+	struct pack_info *info;
+	uint32_t nr_packs;
+	int preferred_pack;
+
+	/* the fanout buckets to merge, [fanout_start, fanout_end) */
+	uint32_t fanout_start, fanout_end;
+
+	struct pack_midx_entry *entries;
+	uint32_t nr, alloc;
+};
+
+/*
+ * Merge the objects of the given fanout buckets from all sources. The
+ * queue yields the copies of an object in midx_oid_compare() order, so
+ * the one to keep comes out first and the rest are dropped.
+ */
+static void *merge_sorted_entries(void *_data)
+{
+	struct sorted_entries_data *d = _data;
+	struct prio_queue queue = { midx_merge_source_cmp };
+	struct midx_merge_source *sources;
+	uint32_t start_pack = d->m ? d->m->num_packs : 0;
+	uint32_t i, nr_sources = 0;
+
+	ALLOC_ARRAY(sources, d->nr_packs - start_pack + 1);
+
+	if (d->m) {
+		struct midx_merge_source *s = &sources[nr_sources];
+
+		s->m = d->m;
+		s->p = NULL;
+		s->preferred_pack = d->preferred_pack;
+		s->cur = d->fanout_start ?
+			ntohl(d->m->chunk_oid_fanout[d->fanout_start - 1]) : 0;
+		s->end = ntohl(d->m->chunk_oid_fanout[d->fanout_end - 1]);
+		if (s->cur < s->end)
+			nr_sources++;
+	}
+	for (i = start_pack; i < d->nr_packs; i++) {
+		struct midx_merge_source *s = &sources[nr_sources];
+
+		s->m = NULL;
+		s->p = d->info[i].p;
+		s->pack_int_id = i;
+		s->preferred_pack = d->preferred_pack;
+		s->cur = d->fanout_start ?
+			get_pack_fanout(s->p, d->fanout_start - 1) : 0;
+		s->end = get_pack_fanout(s->p, d->fanout_end - 1);
+		if (s->cur < s->end)
+			nr_sources++;
+	}
+
+	for (i = 0; i < nr_sources; i++) {
+		midx_merge_source_fill(&sources[i]);
+		prio_queue_put(&queue, &sources[i]);
+	}
+
+	while (queue.nr) {
+		struct midx_merge_source *s = prio_queue_get(&queue);
+
+		if (!d->nr || !oideq(&d->entries[d->nr - 1].oid, &s->entry.oid)) {
+			ALLOC_GROW(d->entries, d->nr + 1, d->alloc);
+			d->entries[d->nr++] = s->entry;
+		}
+
+		if (++s->cur < s->end) {
+			midx_merge_source_fill(s);
+			prio_queue_put(&queue, s);
+		}
+	}
+
+	clear_prio_queue(&queue);
+	free(sources);
+	return NULL;
+}
+
+/*
+ * Give each thread at least this many objects, so that starting it is
+ * worth it.
+ */
+#define SORTED_ENTRIES_PER_THREAD 4096
+
+/*
+ * The .idx files and the existing MIDX are each sorted by object id
+ * already, so merge them through a priority queue instead of collecting
+ * and sorting every copy of every object. Only the de-duplicated entries
+ * are stored (the copy in the preferred pack, otherwise the one from the
+ * most recently modified pack). With more than one thread, each merges
+ * a contiguous range of fanout buckets holding about the same number of
+ * objects, and the results are concatenated.
  */
 static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 						  struct pack_info *info,
 						  uint32_t nr_packs,
 						  uint32_t *nr_objects,
-						  int preferred_pack)
+						  int preferred_pack,
+						  int nr_threads)
 {
-	uint32_t cur_fanout, cur_pack, cur_object;
-	uint32_t alloc_fanout, alloc_objects, total_objects = 0;
-	struct pack_midx_entry *entries_by_fanout = NULL;
-	struct pack_midx_entry *deduplicated_entries = NULL;
 	uint32_t start_pack = m ? m->num_packs : 0;
-
-	for (cur_pack = start_pack; cur_pack < nr_packs; cur_pack++)
-		total_objects += info[cur_pack].p->num_objects;
-
-	/*
-	 * As we de-duplicate by fanout value, we expect the fanout
-	 * slices to be evenly distributed, with some noise. Hence,
-	 * allocate slightly more than one 256th.
-	 */
-	alloc_objects = alloc_fanout = total_objects > 3200 ? total_objects / 200 : 16;
-
-	ALLOC_ARRAY(entries_by_fanout, alloc_fanout);
-	ALLOC_ARRAY(deduplicated_entries, alloc_objects);
-	*nr_objects = 0;
+	uint64_t bucket_objects[256] = { 0 };
+	uint64_t total_objects = 0, seen = 0;
+	struct sorted_entries_data *data;
+	struct pack_midx_entry *entries;
+	uint32_t cur_pack, cur_fanout, pos;
+	int i;
 
 	for (cur_fanout = 0; cur_fanout < 256; cur_fanout++) {
-		uint32_t nr_fanout = 0;
+		uint32_t start = 0, end;
 
 		if (m) {
-			uint32_t start = 0, end;
-
 			if (cur_fanout)
 				start = ntohl(m->chunk_oid_fanout[cur_fanout - 1]);
 			end = ntohl(m->chunk_oid_fanout[cur_fanout]);
-
-			for (cur_object = start; cur_object < end; cur_object++) {
-				ALLOC_GROW(entries_by_fanout, nr_fanout + 1, alloc_fanout);
-				nth_midxed_pack_midx_entry(m,
-							   &entries_by_fanout[nr_fanout],
-							   cur_object);
-				if (nth_midxed_pack_int_id(m, cur_object) == preferred_pack)
-					entries_by_fanout[nr_fanout].preferred = 1;
-				else
-					entries_by_fanout[nr_fanout].preferred = 0;
-				nr_fanout++;
-			}
+			bucket_objects[cur_fanout] += end - start;
 		}
-
 		for (cur_pack = start_pack; cur_pack < nr_packs; cur_pack++) {
-			uint32_t start = 0, end;
-			int preferred = cur_pack == preferred_pack;
+			struct packed_git *p = info[cur_pack].p;
 
-			if (cur_fanout)
-				start = get_pack_fanout(info[cur_pack].p, cur_fanout - 1);
-			end = get_pack_fanout(info[cur_pack].p, cur_fanout);
-
-			for (cur_object = start; cur_object < end; cur_object++) {
-				ALLOC_GROW(entries_by_fanout, nr_fanout + 1, alloc_fanout);
-				fill_pack_entry(cur_pack,
-						info[cur_pack].p,
-						cur_object,
-						&entries_by_fanout[nr_fanout],
-						preferred);
-				nr_fanout++;
-			}
+			start = cur_fanout ? get_pack_fanout(p, cur_fanout - 1) : 0;
+			end = get_pack_fanout(p, cur_fanout);
+			bucket_objects[cur_fanout] += end - start;
 		}
+		total_objects += bucket_objects[cur_fanout];
+	}
 
-		QSORT(entries_by_fanout, nr_fanout, midx_oid_compare);
+	if (nr_threads > total_objects / SORTED_ENTRIES_PER_THREAD)
+		nr_threads = total_objects / SORTED_ENTRIES_PER_THREAD;
+	if (nr_threads > 256)
+		nr_threads = 256;
+	if (!HAVE_THREADS || nr_threads < 1)
+		nr_threads = 1;
+
+	CALLOC_ARRAY(data, nr_threads);
+	cur_fanout = 0;
+	for (i = 0; i < nr_threads; i++) {
+		uint64_t target = total_objects * (i + 1) / nr_threads;
+
+		data[i].m = m;
+		data[i].info = info;
+		data[i].nr_packs = nr_packs;
+		data[i].preferred_pack = preferred_pack;
+		data[i].fanout_start = cur_fanout;
+
+		/* leave at least one bucket for each of the other threads */
+		do {
+			seen += bucket_objects[cur_fanout++];
+		} while (cur_fanout < 256 - (nr_threads - 1 - i) && seen < target);
+		if (i == nr_threads - 1)
+			cur_fanout = 256;
+		data[i].fanout_end = cur_fanout;
+	}
 
-		/*
-		 * The batch is now sorted by OID and then mtime (descending).
-		 * Take only the first duplicate.
-		 */
-		for (cur_object = 0; cur_object < nr_fanout; cur_object++) {
-			if (cur_object && oideq(&entries_by_fanout[cur_object - 1].oid,
-						&entries_by_fanout[cur_object].oid))
-				continue;
-
-			ALLOC_GROW(deduplicated_entries, *nr_objects + 1, alloc_objects);
-			memcpy(&deduplicated_entries[*nr_objects],
-			       &entries_by_fanout[cur_object],
-			       sizeof(struct pack_midx_entry));
-			(*nr_objects)++;
+	if (nr_threads == 1)
+		merge_sorted_entries(&data[0]);
+	else {
+		trace2_region_enter("midx", "get_sorted_entries", the_repository);
+		for (i = 0; i < nr_threads; i++) {
+			int err = pthread_create(&data[i].pthread, NULL,
+						 merge_sorted_entries, &data[i]);
+			if (err)
+				die(_("unable to create thread: %s"), strerror(err));
 		}
+		for (i = 0; i < nr_threads; i++) {
+			int err = pthread_join(data[i].pthread, NULL);
+			if (err)
+				die(_("unable to join thread: %s"), strerror(err));
+		}
+		trace2_data_intmax("midx", the_repository,
+				   "sorted_entries_threads", nr_threads);
+		trace2_region_leave("midx", "get_sorted_entries", the_repository);
 	}
 
-	free(entries_by_fanout);
-	return deduplicated_entries;
+	*nr_objects = 0;
+	for (i = 0; i < nr_threads; i++)
+		*nr_objects += data[i].nr;
+
+	entries = data[0].entries;
+	REALLOC_ARRAY(entries, *nr_objects);
+	pos = data[0].nr;
+	for (i = 1; i < nr_threads; i++) {
+		COPY_ARRAY(entries + pos, data[i].entries, data[i].nr);
+		pos += data[i].nr;
+		free(data[i].entries);
+	}
+	free(data);
+	return entries;
 }
 
 static int write_midx_pack_names(struct hashfile *f, void *data)
@@ -818,6 +1113,18 @@ static int write_midx_large_offsets(struct hashfile *f,
 	return 0;
 }
 
+static int write_midx_revindex(struct hashfile *f,
+			       void *data)
+{
+	struct write_midx_context *ctx = data;
+	uint32_t i;
+
+	for (i = 0; i < ctx->entries_nr; i++)
+		hashwrite_be32(f, ctx->pack_order[i]);
+
+	return 0;
+}
+
 struct midx_pack_order_data {
 	uint32_t nr;
 	uint32_t pack;
@@ -882,20 +1189,377 @@ static void write_midx_reverse_index(char *midx_name, unsigned char *midx_hash,
 	strbuf_release(&buf);
 }
 
+static const struct object_id *bitmap_oid_access(size_t pos, const void *table)
+{
+	const struct pack_midx_entry *entries = table;
+	return &entries[pos].oid;
+}
+
+struct bitmap_commit_cb {
+	struct commit **commits;
+	size_t commits_nr, commits_alloc;
+
+	struct write_midx_context *ctx;
+
+	/* if non-NULL, fill in the name hash of the objects we see */
+	struct packing_data *pdata;
+	int name_hash_version;
+};
+
+static void bitmap_show_commit(struct commit *commit, void *_data)
+{
+	struct bitmap_commit_cb *data = _data;
+
+	if (oid_pos(&commit->object.oid, data->ctx->entries,
+		    data->ctx->entries_nr, bitmap_oid_access) < 0)
+		return;
+
+	ALLOC_GROW(data->commits, data->commits_nr + 1, data->commits_alloc);
+	data->commits[data->commits_nr++] = commit;
+}
+
+static void bitmap_show_object(struct object *obj, const char *name,
+			       void *_data)
+{
+	struct bitmap_commit_cb *data = _data;
+	struct object_entry *entry = packlist_find(data->pdata, &obj->oid);
+
+	/* like pack-objects, keep the name we first found the object at */
+	if (!entry || oe_name_hash(data->pdata, entry))
+		return;
+
+	if (data->name_hash_version == 2)
+		oe_set_name_hash(data->pdata, entry, pack_full_name_hash(name));
+	else
+		oe_set_name_hash(data->pdata, entry, pack_name_hash(name));
+}
+
+static int add_ref_to_pending(const char *refname,
+			      const struct object_id *oid,
+			      int flags, void *cb_data)
+{
+	struct rev_info *revs = cb_data;
+	struct object_id peeled;
+	struct object *object;
+
+	if ((flags & REF_ISSYMREF) && (flags & REF_ISBROKEN)) {
+		warning(_("symbolic ref is dangling: %s"), refname);
+		return 0;
+	}
+
+	if (!peel_iterated_oid(oid, &peeled))
+		oid = &peeled;
+
+	object = parse_object(revs->repo, oid);
+	if (!object) {
+		warning(_("unable to parse object %s for ref %s, "
+			  "leaving it out of the multi-pack bitmap"),
+			oid_to_hex(oid), refname);
+		return 0;
+	}
+	if (object->type != OBJ_COMMIT)
+		return 0;
+
+	if (bitmap_is_preferred_refname(revs->repo, refname))
+		object->flags |= NEEDS_BITMAP;
+
+	add_pending_object(revs, object, "");
+	return 0;
+}
+
+/*
+ * Collect the commits reachable from any ref that are in the MIDX, as
+ * the candidates to receive a bitmap. If "pdata" is given, trees and
+ * blobs are walked too, to record the name hash of every object in it.
+ */
+static struct commit **find_commits_for_midx_bitmap(uint32_t *nr,
+						    struct write_midx_context *ctx,
+						    struct packing_data *pdata,
+						    int name_hash_version)
+{
+	struct rev_info revs;
+	struct bitmap_commit_cb cb = { 0 };
+
+	cb.ctx = ctx;
+	cb.pdata = pdata;
+	cb.name_hash_version = name_hash_version;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	if (pdata) {
+		revs.tree_objects = 1;
+		revs.blob_objects = 1;
+	}
+	for_each_ref(add_ref_to_pending, &revs);
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+
+	traverse_commit_list(&revs, bitmap_show_commit,
+			     pdata ? bitmap_show_object : NULL, &cb);
+	reset_revision_walk();
+
+	*nr = cb.commits_nr;
+	return cb.commits;
+}
+
+static int write_midx_bitmap(char *midx_name, unsigned char *midx_hash,
+			     struct write_midx_context *ctx,
+			     unsigned flags)
+{
+	struct packing_data pdata;
+	struct pack_idx_entry **index;
+	struct commit **commits;
+	uint32_t i, commits_nr;
+	uint16_t options = 0;
+	int lookup_table = 0;
+	int hash_cache = 1;
+	int name_hash_version = 1;
+	int ret = 0;
+	char *bitmap_name = xstrfmt("%s-%s.bitmap", midx_name,
+				    hash_to_hex(midx_hash));
+
+	/*
+	 * The bitmap positions are the objects in MIDX pack order, which
+	 * is the order they are added to "pdata".
+	 */
+	memset(&pdata, 0, sizeof(pdata));
+	prepare_packing_data(the_repository, &pdata);
+	for (i = 0; i < ctx->entries_nr; i++)
+		packlist_alloc(&pdata, &ctx->entries[ctx->pack_order[i]].oid);
+
+	git_config_get_bool("pack.writebitmaphashcache", &hash_cache);
+	git_config_get_int("pack.namehashversion", &name_hash_version);
+	if (hash_cache)
+		options |= name_hash_version == 2 ?
+			BITMAP_OPT_HASH_CACHE_V2 : BITMAP_OPT_HASH_CACHE;
+
+	commits = find_commits_for_midx_bitmap(&commits_nr, ctx,
+					       hash_cache ? &pdata : NULL,
+					       name_hash_version);
+
+	ALLOC_ARRAY(index, pdata.nr_objects);
+	for (i = 0; i < pdata.nr_objects; i++)
+		index[i] = &pdata.objects[i].idx;
+
+	bitmap_writer_show_progress(flags & MIDX_PROGRESS);
+	bitmap_writer_set_threads(ctx->nr_threads);
+	bitmap_writer_build_type_index(&pdata, index, pdata.nr_objects);
+
+	/*
+	 * bitmap_writer_finish() wants the objects in name order, which is
+	 * the order of ctx->entries. This is the same reordering that
+	 * write_idx_file() does to a pack's objects between building the
+	 * type index and finishing its bitmap.
+	 */
+	for (i = 0; i < pdata.nr_objects; i++)
+		index[ctx->pack_order[i]] = &pdata.objects[i].idx;
+
+	bitmap_writer_select_commits(commits, commits_nr, -1);
+	if (bitmap_writer_build(&pdata) < 0) {
+		warning(_("could not write multi-pack bitmap"));
+		ret = -1;
+		goto cleanup;
+	}
+
+	bitmap_writer_set_checksum(midx_hash);
+	if (!git_config_get_bool("pack.writebitmaplookuptable", &lookup_table) &&
+	    lookup_table)
+		options |= BITMAP_OPT_LOOKUP_TABLE;
+	bitmap_writer_finish(index, pdata.nr_objects, bitmap_name, options);
+
+cleanup:
+	free(commits);
+	free(index);
+	free(bitmap_name);
+	clear_packing_data(&pdata);
+	return ret;
+}
+
 static void clear_midx_files_ext(struct repository *r, const char *ext,
 				 unsigned char *keep_hash);
 
+/*
+ * Packs carried over from the existing MIDX are not opened by
+ * add_pack_to_midx(); open one on demand.
+ */
+static struct packed_git *pack_info_open(struct write_midx_context *ctx,
+					 struct pack_info *info)
+{
+	if (!info->p) {
+		struct strbuf path = STRBUF_INIT;
+
+		strbuf_addf(&path, "%s/pack/%s", ctx->m->object_dir,
+			    info->pack_name);
+		info->p = add_packed_git(path.buf, path.len, 0);
+		strbuf_release(&path);
+	}
+	if (!info->p || open_pack_index(info->p))
+		return NULL;
+	return info->p;
+}
+
+/*
+ * Pick the pack whose objects a multi-pack bitmap can reuse verbatim
+ * when the caller did not name one: the oldest non-empty pack, which is
+ * usually also the largest.
+ */
+static int midx_default_preferred_pack(struct write_midx_context *ctx)
+{
+	struct packed_git *oldest = NULL;
+	int ret = -1;
+	uint32_t i;
+
+	for (i = 0; i < ctx->nr; i++) {
+		struct packed_git *p = pack_info_open(ctx, &ctx->info[i]);
+
+		if (!p || !p->num_objects)
+			continue;
+		if (!oldest || p->mtime < oldest->mtime) {
+			oldest = p;
+			ret = i;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Fold the top layers of the chain into the one that is about to be
+ * written for as long as the layer below holds no more than
+ * MIDX_SPLIT_SIZE_MULT times as many objects as the new one. The layer
+ * sizes then grow geometrically towards the base, as with a split
+ * commit-graph, and adding a pack rewrites an amount of the index that
+ * is proportional to its own size, amortized.
+ */
+static void merge_midx_layers(struct write_midx_context *ctx)
+{
+	struct strbuf path = STRBUF_INIT;
+	uint64_t num_objects = 0;
+	uint32_t i;
+
+	for (i = 0; i < ctx->nr; i++)
+		num_objects += ctx->info[i].p->num_objects;
+
+	while (ctx->base_midx &&
+	       ctx->base_midx->num_objects <= MIDX_SPLIT_SIZE_MULT * num_objects) {
+		struct multi_pack_index *layer = ctx->base_midx;
+
+		for (i = 0; i < layer->num_packs; i++) {
+			strbuf_reset(&path);
+			strbuf_addf(&path, "%s/pack/%s", layer->object_dir,
+				    layer->pack_names[i]);
+			add_pack_info(ctx, path.buf, path.len,
+				      layer->pack_names[i]);
+		}
+
+		num_objects += layer->num_objects;
+		ctx->base_midx = layer->base_midx;
+	}
+
+	strbuf_release(&path);
+}
+
+/*
+ * Move the layer written to "layer_tmp" into place and record it in the
+ * chain on top of "base", the part of "chain" that was not merged into
+ * it. A flat MIDX that survives as the base is moved into the chain
+ * directory first.
+ */
+static int write_midx_chain(const char *object_dir,
+			    struct multi_pack_index *chain,
+			    struct multi_pack_index *base,
+			    struct lock_file *lk,
+			    const char *layer_tmp,
+			    const unsigned char *midx_hash)
+{
+	struct multi_pack_index **layers = NULL;
+	struct multi_pack_index *m;
+	size_t nr = 0, alloc = 0, i;
+	char *layer_name;
+	FILE *fp;
+	int ret = 0;
+
+	for (m = base; m; m = m->base_midx) {
+		ALLOC_GROW(layers, nr + 1, alloc);
+		layers[nr++] = m;
+	}
+
+	if (base && !base->in_chain) {
+		char *midx_name = get_midx_filename(object_dir);
+
+		layer_name = get_midx_layer_filename(object_dir,
+				hash_to_hex(get_midx_checksum(base)));
+		if (rename(midx_name, layer_name))
+			ret = error_errno(_("unable to move %s into the multi-pack-index chain"),
+					  midx_name);
+		free(midx_name);
+		free(layer_name);
+		if (ret)
+			goto out;
+	}
+
+	layer_name = get_midx_layer_filename(object_dir, hash_to_hex(midx_hash));
+	if (rename(layer_tmp, layer_name))
+		ret = error_errno(_("unable to rename temporary multi-pack-index layer"));
+	free(layer_name);
+	if (ret)
+		goto out;
+
+	fp = fdopen_lock_file(lk, "w");
+	if (!fp) {
+		ret = error_errno(_("unable to open multi-pack-index chain file"));
+		goto out;
+	}
+	for (i = nr; i > 0; i--)
+		fprintf(fp, "%s\n", hash_to_hex(get_midx_checksum(layers[i - 1])));
+	fprintf(fp, "%s\n", hash_to_hex(midx_hash));
+
+	if (commit_lock_file(lk)) {
+		ret = error_errno(_("unable to write multi-pack-index chain file"));
+		goto out;
+	}
+
+	/* the layers that were merged into the new one are not needed */
+	for (m = chain; m != base; m = m->base_midx) {
+		char *name;
+
+		if (m->in_chain)
+			name = get_midx_layer_filename(object_dir,
+					hash_to_hex(get_midx_checksum(m)));
+		else
+			name = get_midx_filename(object_dir);
+		unlink_or_warn(name);
+		free(name);
+	}
+
+out:
+	free(layers);
+	return ret;
+}
+
+static void clear_midx_chain(const char *object_dir)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	strbuf_addf(&path, "%s/pack/multi-pack-index.d", object_dir);
+	if (is_directory(path.buf) && remove_dir_recursively(&path, 0))
+		die_errno(_("failed to remove %s"), path.buf);
+	strbuf_release(&path);
+}
+
 static int write_midx_internal(const char *object_dir, struct multi_pack_index *m,
 			       struct string_list *packs_to_drop,
 			       const char *preferred_pack_name,
 			       unsigned flags)
 {
 	char *midx_name;
+	char *layer_tmp = NULL;
 	unsigned char midx_hash[GIT_MAX_RAWSZ];
 	uint32_t i;
 	struct hashfile *f = NULL;
 	struct lock_file lk;
 	struct write_midx_context ctx = { 0 };
+	struct multi_pack_index *chain = NULL;
 	int pack_name_concat_len = 0;
 	int dropped_packs = 0;
 	int result = 0;
@@ -906,7 +1570,12 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		die_errno(_("unable to create leading directories of %s"),
 			  midx_name);
 
-	if (m)
+	if (flags & MIDX_WRITE_INCREMENTAL) {
+		/* a layer carries neither a reverse index nor a bitmap */
+		flags &= ~(MIDX_WRITE_REV_INDEX | MIDX_WRITE_BITMAP);
+		chain = load_multi_pack_index(object_dir, 1);
+		ctx.base_midx = chain;
+	} else if (m)
 		ctx.m = m;
 	else
 		ctx.m = load_multi_pack_index(object_dir, 1);
@@ -937,9 +1606,36 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &ctx);
 	stop_progress(&ctx.progress);
 
-	if (ctx.m && ctx.nr == ctx.m->num_packs && !packs_to_drop)
+	if (flags & MIDX_WRITE_BITMAP)
+		flags |= MIDX_WRITE_REV_INDEX;
+
+	if (ctx.base_midx && !ctx.nr)
 		goto cleanup;
 
+	if (ctx.m && !ctx.m->in_chain &&
+	    ctx.nr == ctx.m->num_packs && !packs_to_drop) {
+		int up_to_date = 1;
+
+		/*
+		 * The MIDX itself is current, but we may still have to
+		 * write the bitmap that was asked for.
+		 */
+		if (flags & MIDX_WRITE_BITMAP) {
+			char *bitmap_name = get_midx_bitmap_filename(ctx.m);
+			char *rev_name = get_midx_rev_filename(ctx.m);
+
+			up_to_date = file_exists(bitmap_name) &&
+				     file_exists(rev_name);
+			free(bitmap_name);
+			free(rev_name);
+		}
+		if (up_to_date)
+			goto cleanup;
+	}
+
+	if (flags & MIDX_WRITE_INCREMENTAL)
+		merge_midx_layers(&ctx);
+
 	ctx.preferred_pack_idx = -1;
 	if (preferred_pack_name) {
 		for (i = 0; i < ctx.nr; i++) {
@@ -950,9 +1646,27 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 			}
 		}
 	}
+	if (flags & MIDX_WRITE_BITMAP) {
+		if (ctx.preferred_pack_idx >= 0) {
+			struct packed_git *p =
+				pack_info_open(&ctx, &ctx.info[ctx.preferred_pack_idx]);
+
+			if (!p || !p->num_objects) {
+				error(_("cannot select preferred pack %s with no objects"),
+				      preferred_pack_name);
+				result = 1;
+				goto cleanup;
+			}
+		} else
+			ctx.preferred_pack_idx = midx_default_preferred_pack(&ctx);
+	}
+
+	if (git_config_get_int("pack.threads", &ctx.nr_threads) ||
+	    !ctx.nr_threads)
+		ctx.nr_threads = online_cpus();
 
 	ctx.entries = get_sorted_entries(ctx.m, ctx.info, ctx.nr, &ctx.entries_nr,
-					 ctx.preferred_pack_idx);
+					 ctx.preferred_pack_idx, ctx.nr_threads);
 
 	ctx.large_offsets_needed = 0;
 	for (i = 0; i < ctx.entries_nr; i++) {
@@ -1035,8 +1749,28 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
 					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
 
-	hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
-	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	if (flags & MIDX_WRITE_INCREMENTAL) {
+		char *chain_name = get_midx_chain_filename(object_dir);
+		char *chain_dir = get_midx_chain_dirname(object_dir);
+		int fd;
+
+		if (safe_create_leading_directories(chain_name))
+			die_errno(_("unable to create leading directories of %s"),
+				  chain_name);
+		hold_lock_file_for_update(&lk, chain_name, LOCK_DIE_ON_ERROR);
+
+		layer_tmp = xstrfmt("%s/tmp_midx_XXXXXX", chain_dir);
+		fd = git_mkstemp_mode(layer_tmp, 0444);
+		if (fd < 0)
+			die_errno(_("unable to create temporary multi-pack-index layer"));
+		f = hashfd(fd, layer_tmp);
+
+		free(chain_name);
+		free(chain_dir);
+	} else {
+		hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
+		f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	}
 
 	if (ctx.m)
 		close_midx(ctx.m);
@@ -1047,6 +1781,15 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		goto cleanup;
 	}
 
+	/*
+	 * The pseudo-pack order depends on the preferred pack, which the
+	 * other chunks do not record. Store it in the MIDX so that its
+	 * checksum, and with it the names of the .rev and .bitmap files,
+	 * changes whenever the order does.
+	 */
+	if (flags & MIDX_WRITE_REV_INDEX)
+		ctx.pack_order = midx_pack_order(&ctx);
+
 	cf = init_chunkfile(f);
 
 	add_chunk(cf, MIDX_CHUNKID_PACKNAMES, pack_name_concat_len,
@@ -1065,20 +1808,42 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 			(size_t)ctx.num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH,
 			write_midx_large_offsets);
 
+	if (flags & MIDX_WRITE_REV_INDEX)
+		add_chunk(cf, MIDX_CHUNKID_REVINDEX,
+			  st_mult(ctx.entries_nr, sizeof(uint32_t)),
+			  write_midx_revindex);
+
 	write_midx_header(f, get_num_chunks(cf), ctx.nr - dropped_packs);
 	write_chunkfile(cf, &ctx);
 
-	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM |
+			  ((flags & MIDX_WRITE_INCREMENTAL) ? CSUM_CLOSE : 0));
 	free_chunkfile(cf);
 
-	if (flags & MIDX_WRITE_REV_INDEX)
-		ctx.pack_order = midx_pack_order(&ctx);
+	if (flags & MIDX_WRITE_INCREMENTAL) {
+		if (write_midx_chain(object_dir, chain, ctx.base_midx, &lk,
+				     layer_tmp, midx_hash))
+			result = 1;
+		else
+			FREE_AND_NULL(layer_tmp);
+		clear_midx_files_ext(the_repository, ".rev", NULL);
+		clear_midx_files_ext(the_repository, ".bitmap", NULL);
+		goto cleanup;
+	}
 
 	if (flags & MIDX_WRITE_REV_INDEX)
 		write_midx_reverse_index(midx_name, midx_hash, &ctx);
+	if ((flags & MIDX_WRITE_BITMAP) &&
+	    write_midx_bitmap(midx_name, midx_hash, &ctx, flags) < 0) {
+		/* keep the MIDX itself; only drop any stale bitmap */
+		flags &= ~MIDX_WRITE_BITMAP;
+	}
 	clear_midx_files_ext(the_repository, ".rev", midx_hash);
+	clear_midx_files_ext(the_repository, ".bitmap",
+			     (flags & MIDX_WRITE_BITMAP) ? midx_hash : NULL);
 
 	commit_lock_file(&lk);
+	clear_midx_chain(object_dir);
 
 cleanup:
 	for (i = 0; i < ctx.nr; i++) {
@@ -1094,6 +1859,12 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	free(ctx.pack_perm);
 	free(ctx.pack_order);
 	free(midx_name);
+	if (layer_tmp) {
+		unlink_or_warn(layer_tmp);
+		free(layer_tmp);
+	}
+	for (; chain; chain = chain->base_midx)
+		close_midx(chain);
 	return result;
 }
 
@@ -1156,6 +1927,8 @@ void clear_midx_file(struct repository *r)
 		die(_("failed to clear multi-pack-index at %s"), midx);
 
 	clear_midx_files_ext(r, ".rev", NULL);
+	clear_midx_files_ext(r, ".bitmap", NULL);
+	clear_midx_chain(r->objects->odb->path);
 
 	free(midx);
 }
@@ -1198,25 +1971,183 @@ static int compare_pair_pos_vs_id(const void *_a, const void *_b)
 			display_progress(progress, _n); \
 	} while (0)
 
-int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags)
+struct verify_offsets_data {
+	pthread_t pthread;
+	struct repository *r;
+	struct multi_pack_index *m;
+	struct pair_pos_vs_id *pairs;
+
+	/* the objects of pack "i" are pairs[group[i]] to pairs[group[i + 1]] */
+	uint32_t *group;
+	uint32_t nr_groups;
+
+	/* Shared by all threads and guarded by "mutex". */
+	pthread_mutex_t *mutex;
+	uint32_t *next;
+	uint32_t *done;
+	struct progress *progress;
+};
+
+static void verify_offsets_in_pack(struct verify_offsets_data *d, uint32_t g)
+{
+	struct multi_pack_index *m = d->m;
+	struct pair_pos_vs_id *pairs = d->pairs;
+	uint32_t i, pack_int_id = pairs[d->group[g]].pack_int_id;
+
+	for (i = d->group[g]; i < d->group[g + 1]; i++) {
+		struct object_id oid;
+		struct pack_entry e;
+		off_t m_offset, p_offset;
+		int ok;
+
+		nth_midxed_object_oid(&oid, m, pairs[i].pos);
+
+		/* these may open the pack and its index */
+		obj_read_lock();
+		ok = fill_midx_entry(d->r, &oid, &e, m);
+		if (ok && open_pack_index(e.p)) {
+			obj_read_unlock();
+			pthread_mutex_lock(d->mutex);
+			midx_report(_("failed to load pack-index for packfile %s"),
+				    e.p->pack_name);
+			pthread_mutex_unlock(d->mutex);
+			break;
+		}
+		obj_read_unlock();
+
+		if (!ok) {
+			pthread_mutex_lock(d->mutex);
+			midx_report(_("failed to load pack entry for oid[%d] = %s"),
+				    pairs[i].pos, oid_to_hex(&oid));
+			pthread_mutex_unlock(d->mutex);
+			continue;
+		}
+
+		m_offset = e.offset;
+		p_offset = find_pack_entry_one(oid.hash, e.p);
+
+		pthread_mutex_lock(d->mutex);
+		if (m_offset != p_offset)
+			midx_report(_("incorrect object offset for oid[%d] = %s: %"PRIx64" != %"PRIx64),
+				    pairs[i].pos, oid_to_hex(&oid), m_offset, p_offset);
+		midx_display_sparse_progress(d->progress, ++*d->done);
+		pthread_mutex_unlock(d->mutex);
+	}
+
+	obj_read_lock();
+	if (m->packs[pack_int_id]) {
+		close_pack_fd(m->packs[pack_int_id]);
+		close_pack_index(m->packs[pack_int_id]);
+	}
+	obj_read_unlock();
+}
+
+static void *verify_offsets_thread(void *_data)
+{
+	struct verify_offsets_data *d = _data;
+
+	trace2_thread_start("midx-verify");
+	for (;;) {
+		uint32_t g;
+
+		pthread_mutex_lock(d->mutex);
+		g = (*d->next)++;
+		pthread_mutex_unlock(d->mutex);
+		if (g >= d->nr_groups)
+			break;
+
+		verify_offsets_in_pack(d, g);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Check the offset of each object against the index of its pack. The
+ * objects are sorted by pack, and the packs are handed out to the
+ * threads (pack.threads) one at a time, so that each pack is only open
+ * in one of them and closed as soon as it is done.
+ */
+static void verify_midx_offsets(struct repository *r,
+				struct multi_pack_index *m,
+				struct pair_pos_vs_id *pairs,
+				struct progress *progress)
+{
+	struct verify_offsets_data *data;
+	pthread_mutex_t mutex;
+	uint32_t *group, nr_groups = 0, next = 0, done = 0, i;
+	int nr_threads, t;
+
+	ALLOC_ARRAY(group, m->num_objects + 1);
+	for (i = 0; i < m->num_objects; i++)
+		if (!i || pairs[i - 1].pack_int_id != pairs[i].pack_int_id)
+			group[nr_groups++] = i;
+	group[nr_groups] = m->num_objects;
+
+	if (git_config_get_int("pack.threads", &nr_threads) || !nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > nr_groups)
+		nr_threads = nr_groups;
+	if (!HAVE_THREADS || nr_threads < 1)
+		nr_threads = 1;
+
+	pthread_mutex_init(&mutex, NULL);
+	CALLOC_ARRAY(data, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		data[t].r = r;
+		data[t].m = m;
+		data[t].pairs = pairs;
+		data[t].group = group;
+		data[t].nr_groups = nr_groups;
+		data[t].mutex = &mutex;
+		data[t].next = &next;
+		data[t].done = &done;
+		data[t].progress = progress;
+	}
+
+	if (nr_threads == 1) {
+		for (i = 0; i < nr_groups; i++)
+			verify_offsets_in_pack(&data[0], i);
+	} else {
+		enable_obj_read_lock();
+		for (t = 0; t < nr_threads; t++) {
+			int err = pthread_create(&data[t].pthread, NULL,
+						 verify_offsets_thread, &data[t]);
+			if (err)
+				die(_("unable to create thread: %s"), strerror(err));
+		}
+		for (t = 0; t < nr_threads; t++) {
+			int err = pthread_join(data[t].pthread, NULL);
+			if (err)
+				die(_("unable to join thread: %s"), strerror(err));
+		}
+		disable_obj_read_lock();
+		trace2_data_intmax("midx", r, "verify_threads", nr_threads);
+	}
+
+	free(data);
+	free(group);
+	pthread_mutex_destroy(&mutex);
+}
+
+static int verify_midx_layer(struct repository *r, struct multi_pack_index *m,
+			     unsigned flags)
 {
 	struct pair_pos_vs_id *pairs = NULL;
 	uint32_t i;
 	struct progress *progress = NULL;
-	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
-	verify_midx_error = 0;
+	char *midx_name;
 
-	if (!m) {
-		int result = 0;
-		struct stat sb;
-		char *filename = get_midx_filename(object_dir);
-		if (!stat(filename, &sb)) {
-			error(_("multi-pack-index file exists, but failed to parse"));
-			result = 1;
-		}
-		free(filename);
-		return result;
-	}
+	if (m->in_chain)
+		midx_name = get_midx_layer_filename(m->object_dir,
+					hash_to_hex(get_midx_checksum(m)));
+	else
+		midx_name = get_midx_filename(m->object_dir);
+	/* the checksum and the checks below go through all of the file */
+	advise_chunk_access(m->data, m->data_len, CHUNK_ACCESS_SEQUENTIAL);
+	if (!hashfile_checksum_valid(midx_name, m->data, m->data_len))
+		midx_report(_("incorrect checksum"));
+	free(midx_name);
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_delayed_progress(_("Looking for referenced packfiles"),
@@ -1285,53 +2216,62 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_sparse_progress(_("Verifying object offsets"), m->num_objects);
-	for (i = 0; i < m->num_objects; i++) {
-		struct object_id oid;
-		struct pack_entry e;
-		off_t m_offset, p_offset;
+	verify_midx_offsets(r, m, pairs, progress);
+	stop_progress(&progress);
 
-		if (i > 0 && pairs[i-1].pack_int_id != pairs[i].pack_int_id &&
-		    m->packs[pairs[i-1].pack_int_id])
-		{
-			close_pack_fd(m->packs[pairs[i-1].pack_int_id]);
-			close_pack_index(m->packs[pairs[i-1].pack_int_id]);
-		}
+	free(pairs);
 
-		nth_midxed_object_oid(&oid, m, pairs[i].pos);
+	return verify_midx_error;
+}
 
-		if (!fill_midx_entry(r, &oid, &e, m)) {
-			midx_report(_("failed to load pack entry for oid[%d] = %s"),
-				    pairs[i].pos, oid_to_hex(&oid));
-			continue;
-		}
+int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	verify_midx_error = 0;
 
-		if (open_pack_index(e.p)) {
-			midx_report(_("failed to load pack-index for packfile %s"),
-				    e.p->pack_name);
-			break;
+	if (!m) {
+		int result = 0;
+		struct stat sb;
+		char *filename = get_midx_filename(object_dir);
+		char *chain_name = get_midx_chain_filename(object_dir);
+		if (!stat(filename, &sb) || !stat(chain_name, &sb)) {
+			error(_("multi-pack-index file exists, but failed to parse"));
+			result = 1;
 		}
+		free(filename);
+		free(chain_name);
+		return result;
+	}
 
-		m_offset = e.offset;
-		p_offset = find_pack_entry_one(oid.hash, e.p);
+	for (; m; m = m->base_midx)
+		verify_midx_layer(r, m, flags);
 
-		if (m_offset != p_offset)
-			midx_report(_("incorrect object offset for oid[%d] = %s: %"PRIx64" != %"PRIx64),
-				    pairs[i].pos, oid_to_hex(&oid), m_offset, p_offset);
+	return verify_midx_error;
+}
 
-		midx_display_sparse_progress(progress, i + 1);
-	}
-	stop_progress(&progress);
+/*
+ * Expiring and repacking rewrite a single MIDX; collapse a chain into
+ * one before either looks at it.
+ */
+static struct multi_pack_index *load_flat_midx(const char *object_dir,
+					       unsigned flags)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
 
-	free(pairs);
+	if (!m || !m->in_chain)
+		return m;
 
-	return verify_midx_error;
+	if (write_midx_internal(object_dir, m, NULL, NULL,
+				flags & MIDX_PROGRESS))
+		return NULL;
+	return load_multi_pack_index(object_dir, 1);
 }
 
 int expire_midx_packs(struct repository *r, const char *object_dir, unsigned flags)
 {
 	uint32_t i, *count, result = 0;
 	struct string_list packs_to_drop = STRING_LIST_INIT_DUP;
-	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	struct multi_pack_index *m = load_flat_midx(object_dir, flags);
 	struct progress *progress = NULL;
 
 	if (!m)
@@ -1495,7 +2435,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 	struct child_process cmd = CHILD_PROCESS_INIT;
 	FILE *cmd_in;
 	struct strbuf base_name = STRBUF_INIT;
-	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	struct multi_pack_index *m = load_flat_midx(object_dir, flags);
 
 	/*
 	 * When updating the default for these configuration
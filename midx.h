@@ -12,6 +12,13 @@ struct repository;
 struct multi_pack_index {
 	struct multi_pack_index *next;
 
+	/*
+	 * The layer below this one when the MIDX was loaded from a
+	 * multi-pack-index chain; each pack is indexed by exactly one
+	 * layer.
+	 */
+	struct multi_pack_index *base_midx;
+
 	const unsigned char *data;
 	size_t data_len;
 
@@ -27,12 +34,14 @@ struct multi_pack_index {
 	uint32_t num_objects;
 
 	int local;
+	unsigned in_chain : 1;
 
 	const unsigned char *chunk_pack_names;
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_object_offsets;
 	const unsigned char *chunk_large_offsets;
+	const unsigned char *chunk_revindex;
 
 	const char **pack_names;
 	struct packed_git **packs;
@@ -41,8 +50,12 @@ struct multi_pack_index {
 
 #define MIDX_PROGRESS     (1 << 0)
 #define MIDX_WRITE_REV_INDEX (1 << 1)
+#define MIDX_WRITE_BITMAP (1 << 2)
+#define MIDX_WRITE_INCREMENTAL (1 << 3)
 
+const unsigned char *get_midx_checksum(struct multi_pack_index *m);
 char *get_midx_rev_filename(struct multi_pack_index *m);
+char *get_midx_bitmap_filename(struct multi_pack_index *m);
 
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id);
@@ -53,7 +66,14 @@ struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n);
 int fill_midx_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e, struct multi_pack_index *m);
+/*
+ * Like fill_midx_entry(), but only says whether the object is there; its
+ * pack is not opened until somebody reads from it.
+ */
+int midx_has_object(struct repository *r, const struct object_id *oid, struct multi_pack_index *m);
 int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name);
+/* Like midx_contains_pack(), but also looks at the layers below "m". */
+int midx_chain_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name);
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
 
 int write_midx_file(const char *object_dir, const char *preferred_pack_name, unsigned flags);
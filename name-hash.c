@@ -33,6 +33,68 @@ static int dir_entry_cmp(const void *unused_cmp_data,
 			name ? name : e2->name, e1->namelen);
 }
 
+/*
+ * While enable_name_hash_lock() is in effect, lookups and updates may
+ * come from several threads. Like the threaded initialization below,
+ * we guard "all chains mod n" of each hashmap by the same mutex
+ * rather than locking the whole table, which requires that the
+ * hashmaps are not rehashed meanwhile.
+ *
+ * Lookups take the mutex of the chain they search. Updates take the
+ * mutex of each chain they modify. Updates of "istate->dir_hash" are
+ * serialized by "dir_update" in addition, as they have to follow the
+ * parent pointers of the directory entries and may free them; as only
+ * locked lookups may look at them, a lookup can not see an entry that
+ * is being freed.
+ */
+#define NAME_HASH_MAX_MUTEX (32)
+
+struct name_hash_lock {
+	pthread_mutex_t name_mutex[NAME_HASH_MAX_MUTEX];
+	pthread_mutex_t dir_mutex[NAME_HASH_MAX_MUTEX];
+	pthread_mutex_t dir_update;
+};
+
+static void lock_name_chain(struct index_state *istate, unsigned int hash)
+{
+	if (istate->name_hash_lock)
+		pthread_mutex_lock(&istate->name_hash_lock->name_mutex[
+			hashmap_bucket(&istate->name_hash, hash) % NAME_HASH_MAX_MUTEX]);
+}
+
+static void unlock_name_chain(struct index_state *istate, unsigned int hash)
+{
+	if (istate->name_hash_lock)
+		pthread_mutex_unlock(&istate->name_hash_lock->name_mutex[
+			hashmap_bucket(&istate->name_hash, hash) % NAME_HASH_MAX_MUTEX]);
+}
+
+static void lock_dir_chain(struct index_state *istate, unsigned int hash)
+{
+	if (istate->name_hash_lock)
+		pthread_mutex_lock(&istate->name_hash_lock->dir_mutex[
+			hashmap_bucket(&istate->dir_hash, hash) % NAME_HASH_MAX_MUTEX]);
+}
+
+static void unlock_dir_chain(struct index_state *istate, unsigned int hash)
+{
+	if (istate->name_hash_lock)
+		pthread_mutex_unlock(&istate->name_hash_lock->dir_mutex[
+			hashmap_bucket(&istate->dir_hash, hash) % NAME_HASH_MAX_MUTEX]);
+}
+
+static void lock_dir_update(struct index_state *istate)
+{
+	if (istate->name_hash_lock)
+		pthread_mutex_lock(&istate->name_hash_lock->dir_update);
+}
+
+static void unlock_dir_update(struct index_state *istate)
+{
+	if (istate->name_hash_lock)
+		pthread_mutex_unlock(&istate->name_hash_lock->dir_update);
+}
+
 static struct dir_entry *find_dir_entry__hash(struct index_state *istate,
 		const char *name, unsigned int namelen, unsigned int hash)
 {
@@ -42,12 +104,6 @@ static struct dir_entry *find_dir_entry__hash(struct index_state *istate,
 	return hashmap_get_entry(&istate->dir_hash, &key, ent, name);
 }
 
-static struct dir_entry *find_dir_entry(struct index_state *istate,
-		const char *name, unsigned int namelen)
-{
-	return find_dir_entry__hash(istate, name, namelen, memihash(name, namelen));
-}
-
 static struct dir_entry *hash_dir_entry(struct index_state *istate,
 		struct cache_entry *ce, int namelen)
 {
@@ -59,6 +115,7 @@ static struct dir_entry *hash_dir_entry(struct index_state *istate,
 	 * in index_state.name_hash (as ordinary cache_entries).
 	 */
 	struct dir_entry *dir;
+	unsigned int hash;
 
 	/* get length of parent directory */
 	while (namelen > 0 && !is_dir_sep(ce->name[namelen - 1]))
@@ -67,17 +124,25 @@ static struct dir_entry *hash_dir_entry(struct index_state *istate,
 		return NULL;
 	namelen--;
 
-	/* lookup existing entry for that directory */
-	dir = find_dir_entry(istate, ce->name, namelen);
+	/*
+	 * Lookup existing entry for that directory. The caller holds
+	 * "dir_update", so nobody else changes "istate->dir_hash".
+	 */
+	hash = memihash(ce->name, namelen);
+	dir = find_dir_entry__hash(istate, ce->name, namelen, hash);
 	if (!dir) {
-		/* not found, create it and add to hash table */
+		/*
+		 * Not found, create it and add it to the hash table,
+		 * after adding missing parent directories recursively.
+		 */
 		FLEX_ALLOC_MEM(dir, name, ce->name, namelen);
-		hashmap_entry_init(&dir->ent, memihash(ce->name, namelen));
+		hashmap_entry_init(&dir->ent, hash);
 		dir->namelen = namelen;
-		hashmap_add(&istate->dir_hash, &dir->ent);
-
-		/* recursively add missing parent directories */
 		dir->parent = hash_dir_entry(istate, ce, namelen);
+
+		lock_dir_chain(istate, hash);
+		hashmap_add(&istate->dir_hash, &dir->ent);
+		unlock_dir_chain(istate, hash);
 	}
 	return dir;
 }
@@ -85,9 +150,21 @@ static struct dir_entry *hash_dir_entry(struct index_state *istate,
 static void add_dir_entry(struct index_state *istate, struct cache_entry *ce)
 {
 	/* Add reference to the directory entry (and parents if 0). */
-	struct dir_entry *dir = hash_dir_entry(istate, ce, ce_namelen(ce));
-	while (dir && !(dir->nr++))
+	struct dir_entry *dir;
+
+	lock_dir_update(istate);
+	dir = hash_dir_entry(istate, ce, ce_namelen(ce));
+	while (dir) {
+		int nr;
+
+		lock_dir_chain(istate, dir->ent.hash);
+		nr = dir->nr++;
+		unlock_dir_chain(istate, dir->ent.hash);
+		if (nr)
+			break;
 		dir = dir->parent;
+	}
+	unlock_dir_update(istate);
 }
 
 static void remove_dir_entry(struct index_state *istate, struct cache_entry *ce)
@@ -96,13 +173,25 @@ static void remove_dir_entry(struct index_state *istate, struct cache_entry *ce)
 	 * Release reference to the directory entry. If 0, remove and continue
 	 * with parent directory.
 	 */
-	struct dir_entry *dir = hash_dir_entry(istate, ce, ce_namelen(ce));
-	while (dir && !(--dir->nr)) {
+	struct dir_entry *dir;
+
+	lock_dir_update(istate);
+	dir = hash_dir_entry(istate, ce, ce_namelen(ce));
+	while (dir) {
 		struct dir_entry *parent = dir->parent;
-		hashmap_remove(&istate->dir_hash, &dir->ent, NULL);
+		int nr;
+
+		lock_dir_chain(istate, dir->ent.hash);
+		nr = --dir->nr;
+		if (!nr)
+			hashmap_remove(&istate->dir_hash, &dir->ent, NULL);
+		unlock_dir_chain(istate, dir->ent.hash);
+		if (nr)
+			break;
 		free(dir);
 		dir = parent;
 	}
+	unlock_dir_update(istate);
 }
 
 static void hash_index_entry(struct index_state *istate, struct cache_entry *ce)
@@ -112,8 +201,12 @@ static void hash_index_entry(struct index_state *istate, struct cache_entry *ce)
 	ce->ce_flags |= CE_HASHED;
 
 	if (!S_ISSPARSEDIR(ce->ce_mode)) {
-		hashmap_entry_init(&ce->ent, memihash(ce->name, ce_namelen(ce)));
+		unsigned int hash = memihash(ce->name, ce_namelen(ce));
+
+		hashmap_entry_init(&ce->ent, hash);
+		lock_name_chain(istate, hash);
 		hashmap_add(&istate->name_hash, &ce->ent);
+		unlock_name_chain(istate, hash);
 	}
 
 	if (ignore_case)
@@ -637,7 +730,11 @@ void remove_name_hash(struct index_state *istate, struct cache_entry *ce)
 	if (!istate->name_hash_initialized || !(ce->ce_flags & CE_HASHED))
 		return;
 	ce->ce_flags &= ~CE_HASHED;
-	hashmap_remove(&istate->name_hash, &ce->ent, ce);
+	if (!S_ISSPARSEDIR(ce->ce_mode)) {
+		lock_name_chain(istate, ce->ent.hash);
+		hashmap_remove(&istate->name_hash, &ce->ent, ce);
+		unlock_name_chain(istate, ce->ent.hash);
+	}
 
 	if (ignore_case)
 		remove_dir_entry(istate, ce);
@@ -679,20 +776,51 @@ static int same_name(const struct cache_entry *ce, const char *name, int namelen
 	return slow_same_name(name, namelen, ce->name, len);
 }
 
-int index_dir_exists(struct index_state *istate, const char *name, int namelen)
+static int index_dir_exists__hash(struct index_state *istate,
+				  const char *name, int namelen,
+				  unsigned int hash)
 {
 	struct dir_entry *dir;
+	int exists;
 
+	lock_dir_chain(istate, hash);
+	dir = find_dir_entry__hash(istate, name, namelen, hash);
+	exists = dir && dir->nr;
+	unlock_dir_chain(istate, hash);
+	return exists;
+}
+
+static struct cache_entry *index_file_exists__hash(struct index_state *istate,
+						   const char *name, int namelen,
+						   int icase, unsigned int hash)
+{
+	struct cache_entry *ce;
+
+	lock_name_chain(istate, hash);
+	ce = hashmap_get_entry_from_hash(&istate->name_hash, hash, NULL,
+					 struct cache_entry, ent);
+	hashmap_for_each_entry_from(&istate->name_hash, ce, ent) {
+		if (same_name(ce, name, namelen, icase))
+			break;
+	}
+	unlock_name_chain(istate, hash);
+	return ce;
+}
+
+int index_dir_exists(struct index_state *istate, const char *name, int namelen)
+{
 	lazy_init_name_hash(istate);
 	expand_to_path(istate, name, namelen, 0);
-	dir = find_dir_entry(istate, name, namelen);
-	return dir && dir->nr;
+	return index_dir_exists__hash(istate, name, namelen,
+				      memihash(name, namelen));
 }
 
 void adjust_dirname_case(struct index_state *istate, char *name)
 {
 	const char *startPtr = name;
 	const char *ptr = startPtr;
+	const char *hashed = name;
+	unsigned int hash = 0;
 
 	lazy_init_name_hash(istate);
 	expand_to_path(istate, name, strlen(name), 0);
@@ -703,11 +831,25 @@ void adjust_dirname_case(struct index_state *istate, char *name)
 		if (*ptr == '/') {
 			struct dir_entry *dir;
 
-			dir = find_dir_entry(istate, name, ptr - name);
+			/*
+			 * Extend the hash of the previous prefix instead
+			 * of hashing the whole prefix again; folding the
+			 * case of the part we copy below does not change
+			 * it.
+			 */
+			if (hashed == name)
+				hash = memihash(name, ptr - name);
+			else
+				hash = memihash_cont(hash, hashed, ptr - hashed);
+			hashed = ptr;
+
+			lock_dir_chain(istate, hash);
+			dir = find_dir_entry__hash(istate, name, ptr - name, hash);
 			if (dir) {
 				memcpy((void *)startPtr, dir->name + (startPtr - name), ptr - startPtr);
 				startPtr = ptr + 1;
 			}
+			unlock_dir_chain(istate, hash);
 			ptr++;
 		}
 	}
@@ -715,23 +857,80 @@ void adjust_dirname_case(struct index_state *istate, char *name)
 
 struct cache_entry *index_file_exists(struct index_state *istate, const char *name, int namelen, int icase)
 {
-	struct cache_entry *ce;
 	unsigned int hash = memihash(name, namelen);
 
 	lazy_init_name_hash(istate);
 	expand_to_path(istate, name, namelen, icase);
+	return index_file_exists__hash(istate, name, namelen, icase, hash);
+}
 
-	ce = hashmap_get_entry_from_hash(&istate->name_hash, hash, NULL,
-					 struct cache_entry, ent);
-	hashmap_for_each_entry_from(&istate->name_hash, ce, ent) {
-		if (same_name(ce, name, namelen, icase))
-			return ce;
+struct cache_entry *index_dir_or_file_exists(struct index_state *istate,
+					     const char *name, int namelen,
+					     int *is_dir)
+{
+	/* Both hash tables use the same (case-folded) hash. */
+	unsigned int hash = memihash(name, namelen);
+
+	lazy_init_name_hash(istate);
+	expand_to_path(istate, name, namelen, ignore_case);
+	*is_dir = index_dir_exists__hash(istate, name, namelen, hash);
+	if (*is_dir)
+		return NULL;
+	return index_file_exists__hash(istate, name, namelen, ignore_case, hash);
+}
+
+void enable_name_hash_lock(struct index_state *istate)
+{
+	struct name_hash_lock *lock;
+	int j;
+
+	if (istate->name_hash_lock)
+		BUG("name hash lock is already enabled");
+	if (!HAVE_THREADS)
+		return;
+
+	/*
+	 * Expanding a sparse index and initializing the hash tables
+	 * change the index, so do both before any thread can look.
+	 */
+	ensure_full_index(istate);
+	lazy_init_name_hash(istate);
+
+	hashmap_disable_item_counting(&istate->name_hash);
+	hashmap_disable_item_counting(&istate->dir_hash);
+
+	CALLOC_ARRAY(lock, 1);
+	for (j = 0; j < NAME_HASH_MAX_MUTEX; j++) {
+		pthread_mutex_init(&lock->name_mutex[j], NULL);
+		pthread_mutex_init(&lock->dir_mutex[j], NULL);
 	}
-	return NULL;
+	pthread_mutex_init(&lock->dir_update, NULL);
+	istate->name_hash_lock = lock;
+}
+
+void disable_name_hash_lock(struct index_state *istate)
+{
+	struct name_hash_lock *lock = istate->name_hash_lock;
+	int j;
+
+	if (!lock)
+		return;
+	istate->name_hash_lock = NULL;
+
+	for (j = 0; j < NAME_HASH_MAX_MUTEX; j++) {
+		pthread_mutex_destroy(&lock->name_mutex[j]);
+		pthread_mutex_destroy(&lock->dir_mutex[j]);
+	}
+	pthread_mutex_destroy(&lock->dir_update);
+	free(lock);
+
+	hashmap_enable_item_counting(&istate->name_hash);
+	hashmap_enable_item_counting(&istate->dir_hash);
 }
 
 void free_name_hash(struct index_state *istate)
 {
+	disable_name_hash_lock(istate);
 	if (!istate->name_hash_initialized)
 		return;
 	istate->name_hash_initialized = 0;
@@ -0,0 +1,334 @@
+#include "cache.h"
+#include "repository.h"
+#include "lockfile.h"
+#include "object-store.h"
+#include "mem-pool.h"
+#include "refs.h"
+#include "commit.h"
+#include "tree.h"
+#include "oidset.h"
+#include "pathspec.h"
+#include "dir.h"
+#include "string-list.h"
+#include "notes.h"
+#include "notes-index.h"
+
+/*
+ * The file starts with a header
+ *
+ *   4-byte signature "NIDX"
+ *   4-byte version number (1)
+ *   4-byte hash format id
+ *   4-byte number of notes
+ *
+ * which is followed, like in a pack index, by a fanout table of 256
+ * 4-byte entries, the Nth of which is the number of annotated objects
+ * whose first byte is N or less, then by the names of the annotated
+ * objects, sorted, and then by the names of their notes, in the same
+ * order.
+ *
+ * All numbers are in network byte order.
+ */
+
+#define NOTES_INDEX_SIGNATURE 0x4e494458 /* "NIDX" */
+#define NOTES_INDEX_VERSION 1
+#define NOTES_INDEX_HEADER_SIZE 16
+#define NOTES_INDEX_FANOUT_SIZE (256 * 4)
+
+struct notes_index {
+	const unsigned char *map;
+	size_t map_size;
+	const unsigned char *fanout;
+	const unsigned char *objects;
+	const unsigned char *notes;
+	uint32_t nr;
+
+	/* the notes handed out by notes_index_find() */
+	struct mem_pool found;
+};
+
+static char *notes_index_dir(struct repository *r)
+{
+	return xstrfmt("%s/info/notes-index", r->objects->odb->path);
+}
+
+static char *notes_index_path(struct repository *r,
+			      const struct object_id *oid)
+{
+	return xstrfmt("%s/info/notes-index/%s", r->objects->odb->path,
+		       oid_to_hex(oid));
+}
+
+struct notes_index *load_notes_index(struct repository *r,
+				     const struct object_id *oid)
+{
+	char *path = notes_index_path(r, oid);
+	struct notes_index *index;
+	struct stat st;
+	size_t size;
+	const unsigned char *map;
+	uint32_t nr;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		free(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		free(path);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < NOTES_INDEX_HEADER_SIZE + NOTES_INDEX_FANOUT_SIZE) {
+		warning(_("ignoring malformed notes index '%s'"), path);
+		close(fd);
+		free(path);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	nr = get_be32(map + 12);
+	if (get_be32(map) != NOTES_INDEX_SIGNATURE ||
+	    get_be32(map + 4) != NOTES_INDEX_VERSION ||
+	    get_be32(map + 8) != the_hash_algo->format_id ||
+	    size != NOTES_INDEX_HEADER_SIZE + NOTES_INDEX_FANOUT_SIZE +
+		    st_mult(st_mult(nr, the_hash_algo->rawsz), 2) ||
+	    get_be32(map + NOTES_INDEX_HEADER_SIZE + 255 * 4) != nr) {
+		warning(_("ignoring malformed notes index '%s'"), path);
+		munmap((void *)map, size);
+		free(path);
+		return NULL;
+	}
+	free(path);
+
+	CALLOC_ARRAY(index, 1);
+	index->map = map;
+	index->map_size = size;
+	index->nr = nr;
+	index->fanout = map + NOTES_INDEX_HEADER_SIZE;
+	index->objects = index->fanout + NOTES_INDEX_FANOUT_SIZE;
+	index->notes = index->objects + st_mult(nr, the_hash_algo->rawsz);
+	mem_pool_init(&index->found, 0);
+	return index;
+}
+
+const struct object_id *notes_index_find(struct notes_index *index,
+					 const struct object_id *oid)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	uint32_t lo, hi;
+	unsigned char first = oid->hash[0];
+
+	lo = first ? get_be32(index->fanout + (first - 1) * 4) : 0;
+	hi = get_be32(index->fanout + first * 4);
+	if (hi > index->nr || lo > hi)
+		return NULL;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(index->objects + st_mult(mi, rawsz),
+				  oid->hash);
+
+		if (cmp < 0) {
+			lo = mi + 1;
+		} else if (cmp > 0) {
+			hi = mi;
+		} else {
+			struct object_id *note;
+
+			note = mem_pool_alloc(&index->found, sizeof(*note));
+			oidread(note, index->notes + st_mult(mi, rawsz));
+			return note;
+		}
+	}
+	return NULL;
+}
+
+void free_notes_index(struct notes_index *index)
+{
+	if (!index)
+		return;
+	munmap((void *)index->map, index->map_size);
+	mem_pool_discard(&index->found, 0);
+	free(index);
+}
+
+struct index_entry {
+	struct object_id object;
+	struct object_id note;
+};
+
+struct collect_notes_data {
+	struct index_entry *entries;
+	size_t nr, alloc;
+};
+
+static int collect_note(const struct object_id *object_oid,
+			const struct object_id *note_oid,
+			char *note_path, void *cb_data)
+{
+	struct collect_notes_data *data = cb_data;
+
+	ALLOC_GROW(data->entries, data->nr + 1, data->alloc);
+	oidcpy(&data->entries[data->nr].object, object_oid);
+	oidcpy(&data->entries[data->nr].note, note_oid);
+	data->nr++;
+	return 0;
+}
+
+static int index_entry_cmp(const void *a_, const void *b_)
+{
+	const struct index_entry *a = a_, *b = b_;
+
+	return oidcmp(&a->object, &b->object);
+}
+
+static int collect_blob(const struct object_id *oid, struct strbuf *base,
+			const char *path, unsigned int mode, void *context)
+{
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+	oidset_insert(context, oid);
+	return 0;
+}
+
+/*
+ * A notes tree can hold two notes for one object at different fanout
+ * levels, which reading it concatenates into a new blob that nothing
+ * refers to. Such a blob could be pruned under the index.
+ */
+static int has_combined_notes(struct repository *r,
+			      const struct object_id *oid,
+			      const struct collect_notes_data *data)
+{
+	struct oidset blobs = OIDSET_INIT;
+	struct pathspec pathspec = { 0 };
+	struct tree *tree = parse_tree_indirect(oid);
+	size_t i;
+	int ret = 0;
+
+	if (!tree || read_tree(r, tree, &pathspec, collect_blob, &blobs))
+		ret = 1;
+	for (i = 0; !ret && i < data->nr; i++)
+		if (!oidset_contains(&blobs, &data->entries[i].note))
+			ret = 1;
+	oidset_clear(&blobs);
+	return ret;
+}
+
+static int write_notes_index(struct repository *r, const char *refname,
+			     const struct object_id *oid)
+{
+	struct notes_tree t = { NULL };
+	struct collect_notes_data data = { NULL };
+	struct lock_file lk = LOCK_INIT;
+	unsigned char header[NOTES_INDEX_HEADER_SIZE];
+	unsigned char fanout[NOTES_INDEX_FANOUT_SIZE];
+	struct strbuf buf = STRBUF_INIT;
+	size_t i, rawsz = the_hash_algo->rawsz;
+	uint32_t count[256] = { 0 }, total = 0;
+	char *path;
+	int fd, ret = 0;
+
+	init_notes(&t, refname, NULL, 0);
+	for_each_note(&t, 0, collect_note, &data);
+	free_notes(&t);
+	if (has_combined_notes(r, oid, &data))
+		goto out;
+	QSORT(data.entries, data.nr, index_entry_cmp);
+
+	put_be32(header, NOTES_INDEX_SIGNATURE);
+	put_be32(header + 4, NOTES_INDEX_VERSION);
+	put_be32(header + 8, the_hash_algo->format_id);
+	put_be32(header + 12, data.nr);
+
+	for (i = 0; i < data.nr; i++)
+		count[data.entries[i].object.hash[0]]++;
+	for (i = 0; i < 256; i++) {
+		total += count[i];
+		put_be32(fanout + i * 4, total);
+	}
+
+	strbuf_add(&buf, header, sizeof(header));
+	strbuf_add(&buf, fanout, sizeof(fanout));
+	for (i = 0; i < data.nr; i++)
+		strbuf_add(&buf, data.entries[i].object.hash, rawsz);
+	for (i = 0; i < data.nr; i++)
+		strbuf_add(&buf, data.entries[i].note.hash, rawsz);
+
+	path = notes_index_path(r, oid);
+	if (safe_create_leading_directories(path) < 0)
+		ret = error(_("unable to create leading directories of %s"),
+			    path);
+	else if ((fd = hold_lock_file_for_update(&lk, path, 0)) < 0)
+		ret = error_errno(_("unable to lock '%s'"), path);
+	else if (write_in_full(fd, buf.buf, buf.len) < 0) {
+		ret = error_errno(_("unable to write '%s'"), path);
+		rollback_lock_file(&lk);
+	} else if (commit_lock_file(&lk) < 0)
+		ret = error_errno(_("unable to write '%s'"), path);
+	free(path);
+
+out:
+	free(data.entries);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static int add_notes_ref(const char *refname, const struct object_id *oid,
+			 int flags, void *cb_data)
+{
+	struct string_list *refs = cb_data;
+
+	if (lookup_commit_reference_gently(the_repository, oid, 1))
+		string_list_append(refs, refname)->util = oiddup(oid);
+	return 0;
+}
+
+int write_notes_indexes(struct repository *r)
+{
+	struct string_list refs = STRING_LIST_INIT_DUP;
+	struct string_list keep = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	char *dir_path;
+	DIR *dir;
+	struct dirent *de;
+	int ret = 0;
+
+	for_each_fullref_in("refs/notes/", add_notes_ref, &refs, 0);
+	for_each_string_list_item(item, &refs) {
+		struct object_id *oid = item->util;
+		char *path = notes_index_path(r, oid);
+
+		string_list_append(&keep, oid_to_hex(oid));
+		if (!file_exists(path) && write_notes_index(r, item->string, oid))
+			ret = -1;
+		free(path);
+	}
+	string_list_sort(&keep);
+
+	dir_path = notes_index_dir(r);
+	dir = opendir(dir_path);
+	while (dir && (de = readdir(dir))) {
+		char *path;
+
+		if (is_dot_or_dotdot(de->d_name) ||
+		    ends_with(de->d_name, LOCK_SUFFIX) ||
+		    string_list_has_string(&keep, de->d_name))
+			continue;
+		path = xstrfmt("%s/%s", dir_path, de->d_name);
+		if (unlink(path) && errno != ENOENT)
+			ret = error_errno(_("unable to remove '%s'"), path);
+		free(path);
+	}
+	if (dir)
+		closedir(dir);
+	free(dir_path);
+
+	string_list_clear(&keep, 0);
+	string_list_clear(&refs, 1);
+	return ret;
+}
@@ -0,0 +1,42 @@
+#ifndef NOTES_INDEX_H
+#define NOTES_INDEX_H
+
+struct repository;
+struct object_id;
+
+/*
+ * A notes index in "$GIT_DIR/objects/info/notes-index/<commit>" is a
+ * flat table, sorted like a pack index, of the annotated objects and
+ * their notes in the notes tree of <commit>. As it is keyed by the
+ * commit, an index never goes stale: when a notes ref moves, there is
+ * simply no index for its new commit until one is written.
+ *
+ * With `notes.useIndex` (the default), init_notes() attaches the index
+ * of the commit it reads, if there is one, and get_note() looks notes
+ * up in it instead of unpacking fanout subtrees, until the notes tree
+ * is modified. The "notes-index" maintenance task writes the indexes
+ * for the tips of refs/notes/ and removes the others.
+ */
+
+struct notes_index;
+
+/* Return the index of the notes commit `oid`, or NULL if there is none. */
+struct notes_index *load_notes_index(struct repository *r,
+				     const struct object_id *oid);
+
+/*
+ * Return the note attached to `oid`, or NULL if there is none. The
+ * result is valid until the index is freed.
+ */
+const struct object_id *notes_index_find(struct notes_index *index,
+					 const struct object_id *oid);
+
+void free_notes_index(struct notes_index *index);
+
+/*
+ * Write the indexes of the tips of refs/notes/ that do not have one
+ * yet, and remove those of other commits. Return 0 on success.
+ */
+int write_notes_indexes(struct repository *r);
+
+#endif /* NOTES_INDEX_H */
@@ -9,6 +9,7 @@
 #include "tree-walk.h"
 #include "string-list.h"
 #include "refs.h"
+#include "notes-index.h"
 
 /*
  * Use a non-balancing simple 16-tree structure with struct int_node as
@@ -998,6 +999,7 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 	struct object_id oid, object_oid;
 	unsigned short mode;
 	struct leaf_node root_tree;
+	int use_index;
 
 	if (!t)
 		t = &default_notes_tree;
@@ -1015,6 +1017,7 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 	t->ref = xstrdup_or_null(notes_ref);
 	t->update_ref = (flags & NOTES_INIT_WRITABLE) ? t->ref : NULL;
 	t->combine_notes = combine_notes;
+	t->index = NULL;
 	t->initialized = 1;
 	t->dirty = 0;
 
@@ -1030,6 +1033,11 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 	oidclr(&root_tree.key_oid);
 	oidcpy(&root_tree.val_oid, &oid);
 	load_subtree(t, &root_tree, t->root, 0);
+
+	if (!repo_config_get_bool(the_repository, "notes.useindex", &use_index) &&
+	    !use_index)
+		return;
+	t->index = load_notes_index(the_repository, &object_oid);
 }
 
 struct notes_tree **load_notes_trees(struct string_list *refs, int flags)
@@ -1154,6 +1162,8 @@ const struct object_id *get_note(struct notes_tree *t,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	if (t->index && !t->dirty)
+		return notes_index_find(t->index, oid);
 	found = note_tree_find(t, t->root, 0, oid->hash);
 	return found ? &found->val_oid : NULL;
 }
@@ -1229,6 +1239,7 @@ void free_notes(struct notes_tree *t)
 		free(t->first_non_note);
 		t->first_non_note = t->prev_non_note;
 	}
+	free_notes_index(t->index);
 	free(t->ref);
 	memset(t, 0, sizeof(struct notes_tree));
 }
@@ -3,6 +3,7 @@
 
 #include "string-list.h"
 
+struct notes_index;
 struct object_id;
 struct strbuf;
 
@@ -51,6 +52,7 @@ int combine_notes_cat_sort_uniq(struct object_id *cur_oid,
 extern struct notes_tree {
 	struct int_node *root;
 	struct non_note *first_non_note, *prev_non_note;
+	struct notes_index *index;
 	char *ref;
 	char *update_ref;
 	combine_notes_fn combine_notes;
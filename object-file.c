@@ -32,6 +32,7 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "promisor-remote.h"
+#include "oidmap.h"
 
 /* The maximum size for an object header. */
 #define MAX_HEADER_LEN 32
@@ -741,6 +742,37 @@ void add_to_alternates_memory(const char *reference)
 			     '\n', NULL, 0);
 }
 
+struct object_directory *set_temporary_primary_odb(const char *dir)
+{
+	struct object_directory *new_odb;
+
+	/*
+	 * Make sure alternates are initialized, or else our entry may be
+	 * overwritten when they are.
+	 */
+	prepare_alt_odb(the_repository);
+
+	CALLOC_ARRAY(new_odb, 1);
+	new_odb->path = xstrdup(dir);
+	new_odb->next = the_repository->objects->odb;
+	the_repository->objects->odb = new_odb;
+	return new_odb->next;
+}
+
+void restore_primary_odb(struct object_directory *restore_odb, const char *old_path)
+{
+	struct object_directory *cur_odb = the_repository->objects->odb;
+
+	if (strcmp(old_path, cur_odb->path))
+		BUG("expected %s as primary object store; found %s",
+		    old_path, cur_odb->path);
+	if (cur_odb->next != restore_odb)
+		BUG("we expect the old primary object store to be the first alternate");
+
+	the_repository->objects->odb = restore_odb;
+	free_object_directory(cur_odb);
+}
+
 /*
  * Compute the exact path an alternate is at and returns it. In case of
  * error NULL is returned and the human readable error is added to `err`
@@ -1512,6 +1544,19 @@ void disable_obj_read_lock(void)
 
 int fetch_if_missing = 1;
 
+/*
+ * Look "oid" up in the packs. A NULL "e" means that the caller only wants
+ * to know whether the object is there, which spares opening packs that a
+ * multi-pack-index can answer for.
+ */
+static int find_packed(struct repository *r, const struct object_id *oid,
+		       struct pack_entry *e)
+{
+	if (!e)
+		return has_pack_entry(r, oid);
+	return find_pack_entry(r, oid, e);
+}
+
 static int do_oid_object_info_extended(struct repository *r,
 				       const struct object_id *oid,
 				       struct object_info *oi, unsigned flags)
@@ -1552,7 +1597,7 @@ static int do_oid_object_info_extended(struct repository *r,
 	}
 
 	while (1) {
-		if (find_pack_entry(r, real, &e))
+		if (find_packed(r, real, oi == &blank_oi ? NULL : &e))
 			break;
 
 		if (flags & OBJECT_INFO_IGNORE_LOOSE)
@@ -1565,7 +1610,7 @@ static int do_oid_object_info_extended(struct repository *r,
 		/* Not a loose object; someone else may have just packed it. */
 		if (!(flags & OBJECT_INFO_QUICK)) {
 			reprepare_packed_git(r);
-			if (find_pack_entry(r, real, &e))
+			if (find_packed(r, real, oi == &blank_oi ? NULL : &e))
 				break;
 		}
 
@@ -1612,6 +1657,19 @@ int oid_object_info_extended(struct repository *r, const struct object_id *oid,
 			     struct object_info *oi, unsigned flags)
 {
 	int ret;
+
+	/*
+	 * With threaded readers, a bare existence check can usually be
+	 * answered from the pack snapshot without holding obj_read_mutex
+	 * while searching.
+	 */
+	if (obj_read_use_lock && !oi && !(flags & OBJECT_INFO_LOOKUP_REPLACE)) {
+		struct pack_entry e;
+
+		if (find_pack_entry_concurrent(r, oid, &e))
+			return 0;
+	}
+
 	obj_read_lock();
 	ret = do_oid_object_info_extended(r, oid, oi, flags);
 	obj_read_unlock();
@@ -1635,18 +1693,110 @@ int oid_object_info(struct repository *r,
 	return type;
 }
 
+/*
+ * Trees read recently, so that walks that come back to the same trees
+ * (a diff of each commit against its parent reads most trees twice,
+ * unpack_trees() and merges read the same trees of the bases again)
+ * do not inflate them and resolve their deltas every time.  As a tree
+ * is named by its contents, one cache serves all repositories.  The
+ * least recently used trees are dropped once the cache holds more than
+ * core.treeCacheLimit bytes.  Protected by obj_read_lock().
+ */
+struct tree_cache_entry {
+	struct oidmap_entry ent;
+	struct list_head lru;
+	unsigned long size;
+	char buf[FLEX_ARRAY];
+};
+
+static struct oidmap tree_cache = OIDMAP_INIT;
+static LIST_HEAD(tree_cache_lru);
+static size_t tree_cache_size;
+
+static void *tree_cache_get(const struct object_id *oid, unsigned long *size)
+{
+	struct tree_cache_entry *e = oidmap_get(&tree_cache, oid);
+
+	if (!e)
+		return NULL;
+	list_del(&e->lru);
+	list_add_tail(&e->lru, &tree_cache_lru);
+	*size = e->size;
+	return xmemdupz(e->buf, e->size);
+}
+
+static void tree_cache_put(const struct object_id *oid,
+			   const void *buf, unsigned long size)
+{
+	struct tree_cache_entry *e;
+
+	if (size > tree_cache_limit / 4 || oidmap_get(&tree_cache, oid))
+		return;
+
+	while (tree_cache_size + size > tree_cache_limit &&
+	       !list_empty(&tree_cache_lru)) {
+		struct tree_cache_entry *old =
+			list_first_entry(&tree_cache_lru,
+					 struct tree_cache_entry, lru);
+		list_del(&old->lru);
+		oidmap_remove(&tree_cache, &old->ent.oid);
+		tree_cache_size -= old->size;
+		free(old);
+	}
+
+	FLEX_ALLOC_MEM(e, buf, buf, size);
+	oidcpy(&e->ent.oid, oid);
+	e->size = size;
+	list_add_tail(&e->lru, &tree_cache_lru);
+	oidmap_put(&tree_cache, e);
+	tree_cache_size += size;
+}
+
 static void *read_object(struct repository *r,
 			 const struct object_id *oid, enum object_type *type,
 			 unsigned long *size)
 {
 	struct object_info oi = OBJECT_INFO_INIT;
+	enum object_type obj_type;
 	void *content;
-	oi.typep = type;
+	oi.typep = &obj_type;
 	oi.sizep = size;
 	oi.contentp = &content;
 
+	if (tree_cache_limit) {
+		obj_read_lock();
+		content = tree_cache_get(oid, size);
+		obj_read_unlock();
+		if (content) {
+			trace2_counter_add(TRACE2_COUNTER_ID_TREE_CACHE_HIT, 1);
+			trace2_counter_add(TRACE2_COUNTER_ID_OBJECT_READ_TREE, 1);
+			if (type)
+				*type = OBJ_TREE;
+			return content;
+		}
+	}
+
 	if (oid_object_info_extended(r, oid, &oi, 0) < 0)
 		return NULL;
+	if (obj_type >= OBJ_COMMIT && obj_type <= OBJ_TAG)
+		trace2_counter_add(TRACE2_COUNTER_ID_OBJECT_READ_COMMIT +
+				   (obj_type - OBJ_COMMIT), 1);
+	if (obj_type == OBJ_TREE && tree_cache_limit) {
+		trace2_counter_add(TRACE2_COUNTER_ID_TREE_CACHE_MISS, 1);
+		/*
+		 * A delta is usually resolved against a base still in the
+		 * delta base cache, which costs about as much as copying it
+		 * out of this cache would; keep only what had to be inflated.
+		 */
+		if (oi.whence == OI_LOOSE ||
+		    (oi.whence == OI_PACKED && !oi.u.packed.is_delta)) {
+			obj_read_lock();
+			tree_cache_put(oid, content, *size);
+			obj_read_unlock();
+		}
+	}
+	if (type)
+		*type = obj_type;
 	return content;
 }
 
@@ -1842,8 +1992,12 @@ int hash_object_file(const struct git_hash_algo *algo, const void *buf,
 /* Finalize a file on disk, and close it. */
 static void close_loose_object(int fd)
 {
-	if (fsync_object_files)
-		fsync_or_die(fd, "loose object file");
+	if (fsync_object_files) {
+		if (fsync_method == FSYNC_METHOD_BATCH)
+			fsync_loose_object_bulk_checkin(fd);
+		else
+			fsync_or_die(fd, "loose object file");
+	}
 	if (close(fd) != 0)
 		die_errno(_("error when closing loose object file"));
 }
@@ -1902,17 +2056,18 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 	git_zstream stream;
 	git_hash_ctx c;
 	struct object_id parano_oid;
-	static struct strbuf tmp_file = STRBUF_INIT;
-	static struct strbuf filename = STRBUF_INIT;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
 
 	loose_object_path(the_repository, &filename, oid);
 
 	fd = create_tmpfile(&tmp_file, filename.buf);
 	if (fd < 0) {
 		if (errno == EACCES)
-			return error(_("insufficient permission for adding an object to repository database %s"), get_object_directory());
+			ret = error(_("insufficient permission for adding an object to repository database %s"), get_object_directory());
 		else
-			return error_errno(_("unable to create temporary file"));
+			ret = error_errno(_("unable to create temporary file"));
+		goto out;
 	}
 
 	/* Set it up */
@@ -1963,7 +2118,11 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 			warning_errno(_("failed utime() on %s"), tmp_file.buf);
 	}
 
-	return finalize_object_file(tmp_file.buf, filename.buf);
+	ret = finalize_object_file(tmp_file.buf, filename.buf);
+out:
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+	return ret;
 }
 
 static int freshen_loose_object(const struct object_id *oid)
@@ -1984,6 +2143,21 @@ static int freshen_packed_object(const struct object_id *oid)
 	return 1;
 }
 
+int freshen_object(const struct object_id *oid)
+{
+	return freshen_packed_object(oid) || freshen_loose_object(oid);
+}
+
+int write_loose_object_file(const void *buf, unsigned long len,
+			    const char *type, const struct object_id *oid)
+{
+	char hdr[MAX_HEADER_LEN];
+	int hdrlen;
+
+	hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX , type, (uintmax_t)len) + 1;
+	return write_loose_object(oid, hdr, hdrlen, buf, len, 0);
+}
+
 int write_object_file(const void *buf, unsigned long len, const char *type,
 		      struct object_id *oid)
 {
@@ -1997,6 +2171,7 @@ int write_object_file(const void *buf, unsigned long len, const char *type,
 				  &hdrlen);
 	if (freshen_packed_object(oid) || freshen_loose_object(oid))
 		return 0;
+	prepare_loose_object_bulk_checkin();
 	return write_loose_object(oid, hdr, hdrlen, buf, len, 0);
 }
 
@@ -2017,6 +2192,7 @@ int hash_object_file_literally(const void *buf, unsigned long len,
 		goto cleanup;
 	if (freshen_packed_object(oid) || freshen_loose_object(oid))
 		goto cleanup;
+	prepare_loose_object_bulk_checkin();
 	status = write_loose_object(oid, header, hdrlen, buf, len, 0);
 
 cleanup:
@@ -2447,27 +2623,166 @@ static int append_loose_object(const struct object_id *oid, const char *path,
 	return 0;
 }
 
+/*
+ * The loose object index (core.looseObjectIndex) records, for each
+ * "objects/xx" fanout directory, the sorted names of the loose objects
+ * it contained together with the directory's mtime. As long as the
+ * directory's mtime is unchanged, loading the cache for that fanout
+ * directory is a single read instead of a readdir(3) scan and a sort.
+ *
+ * Each fanout directory has its own file, "info/loose-index/xx":
+ *
+ *   4-byte signature "LOOS"
+ *   4-byte version (1)
+ *   4-byte hash function id
+ *   8-byte directory mtime (seconds)
+ *   4-byte directory mtime (nanoseconds)
+ *   4-byte number of objects
+ *   the object names, sorted
+ *   trailing checksum of all of the above
+ */
+#define LOOSE_INDEX_SIGNATURE 0x4c4f4f53 /* "LOOS" */
+#define LOOSE_INDEX_VERSION 1
+#define LOOSE_INDEX_HEADER_SIZE 28
+
+static void loose_index_path(struct strbuf *buf, struct object_directory *odb,
+			     int subdir_nr)
+{
+	strbuf_addf(buf, "%s/info/loose-index/%02x", odb->path, subdir_nr);
+}
+
+static int read_loose_index(struct object_directory *odb, int subdir_nr,
+			    const struct stat *dir_st, struct oid_array *out)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	const unsigned char *p;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	size_t rawsz = the_hash_algo->rawsz;
+	uint32_t nr, i;
+	int ret = -1;
+
+	loose_index_path(&path, odb, subdir_nr);
+	if (strbuf_read_file(&buf, path.buf, 0) < 0)
+		goto out;
+	if (buf.len < LOOSE_INDEX_HEADER_SIZE + rawsz)
+		goto out;
+
+	p = (const unsigned char *)buf.buf;
+	nr = get_be32(p + 24);
+	if (get_be32(p) != LOOSE_INDEX_SIGNATURE ||
+	    get_be32(p + 4) != LOOSE_INDEX_VERSION ||
+	    get_be32(p + 8) != the_hash_algo->format_id ||
+	    get_be64(p + 12) != (uint64_t)dir_st->st_mtime ||
+	    get_be32(p + 20) != ST_MTIME_NSEC(*dir_st) ||
+	    buf.len != st_add(LOOSE_INDEX_HEADER_SIZE + rawsz,
+			      st_mult(nr, rawsz)))
+		goto out;
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, p, buf.len - rawsz);
+	the_hash_algo->final_fn(hash, &ctx);
+	if (!hasheq(hash, p + buf.len - rawsz))
+		goto out;
+
+	ALLOC_GROW(out->oid, out->nr + nr, out->alloc);
+	for (i = 0; i < nr; i++)
+		oidread(&out->oid[out->nr++],
+			p + LOOSE_INDEX_HEADER_SIZE + st_mult(i, rawsz));
+	out->sorted = 1;
+	ret = 0;
+
+out:
+	strbuf_release(&path);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static void write_loose_index(struct object_directory *odb, int subdir_nr,
+			      const struct stat *dir_st, struct oid_array *oids)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	unsigned char hdr[LOOSE_INDEX_HEADER_SIZE];
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	size_t i;
+
+	/*
+	 * A directory modified within the current second could be
+	 * modified again without its mtime changing; do not record it.
+	 */
+	if (dir_st->st_mtime >= time(NULL) - 1)
+		return;
+
+	oid_array_sort(oids);
+	put_be32(hdr, LOOSE_INDEX_SIGNATURE);
+	put_be32(hdr + 4, LOOSE_INDEX_VERSION);
+	put_be32(hdr + 8, the_hash_algo->format_id);
+	put_be64(hdr + 12, dir_st->st_mtime);
+	put_be32(hdr + 20, ST_MTIME_NSEC(*dir_st));
+	put_be32(hdr + 24, oids->nr);
+	strbuf_add(&buf, hdr, sizeof(hdr));
+	for (i = 0; i < oids->nr; i++)
+		strbuf_add(&buf, oids->oid[i].hash, the_hash_algo->rawsz);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, buf.buf, buf.len);
+	the_hash_algo->final_fn(hash, &ctx);
+	strbuf_add(&buf, hash, the_hash_algo->rawsz);
+
+	loose_index_path(&path, odb, subdir_nr);
+	if (safe_create_leading_directories(path.buf) ||
+	    hold_lock_file_for_update(&lk, path.buf, 0) < 0)
+		goto out;
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0) {
+		rollback_lock_file(&lk);
+		goto out;
+	}
+	commit_lock_file(&lk);
+
+out:
+	strbuf_release(&path);
+	strbuf_release(&buf);
+}
+
 struct oid_array *odb_loose_cache(struct object_directory *odb,
 				  const struct object_id *oid)
 {
 	int subdir_nr = oid->hash[0];
 	struct strbuf buf = STRBUF_INIT;
+	struct oid_array *cache;
+	struct stat st;
+	int have_st;
 
 	if (subdir_nr < 0 ||
 	    subdir_nr >= ARRAY_SIZE(odb->loose_objects_subdir_seen))
 		BUG("subdir_nr out of range");
 
+	cache = &odb->loose_objects_cache[subdir_nr];
 	if (odb->loose_objects_subdir_seen[subdir_nr])
-		return &odb->loose_objects_cache[subdir_nr];
+		return cache;
+
+	strbuf_addf(&buf, "%s/%02x", odb->path, subdir_nr);
+	have_st = core_loose_object_index && !stat(buf.buf, &st);
+	if (have_st && !read_loose_index(odb, subdir_nr, &st, cache)) {
+		odb->loose_objects_subdir_seen[subdir_nr] = 1;
+		strbuf_release(&buf);
+		return cache;
+	}
 
+	strbuf_reset(&buf);
 	strbuf_addstr(&buf, odb->path);
 	for_each_file_in_obj_subdir(subdir_nr, &buf,
 				    append_loose_object,
-				    NULL, NULL,
-				    &odb->loose_objects_cache[subdir_nr]);
+				    NULL, NULL, cache);
 	odb->loose_objects_subdir_seen[subdir_nr] = 1;
+	if (have_st)
+		write_loose_index(odb, subdir_nr, &st, cache);
 	strbuf_release(&buf);
-	return &odb->loose_objects_cache[subdir_nr];
+	return cache;
 }
 
 void odb_clear_loose_cache(struct object_directory *odb)
@@ -660,10 +660,122 @@ static void find_abbrev_len_packed(struct min_abbrev_data *mad)
 	struct multi_pack_index *m;
 	struct packed_git *p;
 
-	for (m = get_multi_pack_index(mad->repo); m; m = m->next)
+	for (m = get_multi_pack_index(mad->repo); m; m = m->next) {
 		find_abbrev_len_for_midx(m, mad);
-	for (p = get_packed_git(mad->repo); p; p = p->next)
+		mad->repo->objects->packed_abbrev_searches++;
+	}
+	for (p = get_packed_git(mad->repo); p; p = p->next) {
 		find_abbrev_len_for_pack(p, mad);
+		if (!p->multi_pack_index)
+			mad->repo->objects->packed_abbrev_searches++;
+	}
+}
+
+static void collect_packed_byte(struct repository *r, unsigned char byte,
+				struct oid_array *oids)
+{
+	struct multi_pack_index *m;
+	struct packed_git *p;
+	struct object_id start, oid;
+	uint32_t i;
+
+	oidclr(&start);
+	start.hash[0] = byte;
+
+	for (m = get_multi_pack_index(r); m; m = m->next) {
+		bsearch_midx(&start, m, &i);
+		for (; i < m->num_objects; i++) {
+			nth_midxed_object_oid(&oid, m, i);
+			if (oid.hash[0] != byte)
+				break;
+			oid_array_append(oids, &oid);
+		}
+	}
+	for (p = get_packed_git(r); p; p = p->next) {
+		if (p->multi_pack_index || open_pack_index(p))
+			continue;
+		bsearch_pack(&start, p, &i);
+		for (; i < p->num_objects; i++) {
+			if (nth_packed_object_id(&oid, p, i) ||
+			    oid.hash[0] != byte)
+				break;
+			oid_array_append(oids, &oid);
+		}
+	}
+}
+
+/* One more than the number of leading hex digits "a" and "b" share. */
+static unsigned char abbrev_len_between(const struct object_id *a,
+					const struct object_id *b)
+{
+	unsigned i = 0, rawsz = the_hash_algo->rawsz;
+
+	while (i < rawsz && a->hash[i] == b->hash[i])
+		i++;
+	if (i < rawsz && !((a->hash[i] ^ b->hash[i]) & 0xf0))
+		return 2 * i + 2;
+	return 2 * i + 1;
+}
+
+/*
+ * For each first byte of an object name, how many hex digits a packed
+ * object starting with that byte needs at most to be unique among the
+ * packed objects: its name is closest to one of its two neighbours in
+ * the merged, sorted list of all packed objects, so it is enough to
+ * look at each pair of neighbours once.
+ */
+static unsigned char *build_packed_abbrev_len(struct repository *r)
+{
+	unsigned char *len = xcalloc(256, 1);
+	struct oid_array oids = OID_ARRAY_INIT;
+	struct object_id prev;
+	int have_prev = 0;
+	unsigned byte;
+	size_t i;
+
+	for (byte = 0; byte < 256; byte++) {
+		collect_packed_byte(r, byte, &oids);
+		oid_array_sort(&oids);
+		for (i = 0; i < oids.nr; i++) {
+			const struct object_id *oid = &oids.oid[i];
+			unsigned char need;
+
+			if (have_prev && oideq(&prev, oid))
+				continue;
+			if (have_prev) {
+				need = abbrev_len_between(&prev, oid);
+				if (len[prev.hash[0]] < need)
+					len[prev.hash[0]] = need;
+				if (len[byte] < need)
+					len[byte] = need;
+			}
+			oidcpy(&prev, oid);
+			have_prev = 1;
+		}
+		oid_array_clear(&oids);
+	}
+	return len;
+}
+
+/*
+ * Whether "len" hex digits of "oid" are known to be unique among the
+ * packed objects without searching each pack for its neighbours.
+ * Building the table looks at every packed object once, so it is only
+ * done after searching the packs has already cost about as much.
+ */
+static int packed_abbrev_is_unique(struct repository *r,
+				   const struct object_id *oid, int len)
+{
+	struct raw_object_store *o = r->objects;
+
+	if (!o->packed_abbrev_len) {
+		if (o->packed_abbrev_searches * 16 <
+		    repo_approximate_object_count(r))
+			return 0;
+		o->packed_abbrev_len = build_packed_abbrev_len(r);
+	}
+	return len >= o->packed_abbrev_len[oid->hash[0]] &&
+	       has_pack_entry(r, oid);
 }
 
 int repo_find_unique_abbrev_r(struct repository *r, char *hex,
@@ -706,7 +818,8 @@ int repo_find_unique_abbrev_r(struct repository *r, char *hex,
 	mad.hex = hex;
 	mad.oid = oid;
 
-	find_abbrev_len_packed(&mad);
+	if (!packed_abbrev_is_unique(r, oid, len))
+		find_abbrev_len_packed(&mad);
 
 	if (init_object_disambiguation(r, hex, mad.cur_len, &ds) < 0)
 		return -1;
@@ -903,9 +1016,10 @@ static int get_oid_basic(struct repository *r, const char *str, int len,
 				return -1;
 			}
 		}
+		/* the count is only reported for @{N} and costs a full read */
 		if (read_ref_at(get_main_ref_store(r),
 				real_ref, flags, at_time, nth, oid, NULL,
-				&co_time, &co_tz, &co_cnt)) {
+				&co_time, &co_tz, at_time ? NULL : &co_cnt)) {
 			if (!len) {
 				if (!skip_prefix(real_ref, "refs/heads/", &str))
 					str = "HEAD";
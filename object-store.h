@@ -50,6 +50,20 @@ void add_to_alternates_file(const char *dir);
  */
 void add_to_alternates_memory(const char *dir);
 
+/*
+ * Replace the current writable object directory with the specified temporary
+ * object directory; returns the former primary object directory.
+ */
+struct object_directory *set_temporary_primary_odb(const char *dir);
+
+/*
+ * Restore a previous primary object directory, which was replaced by
+ * set_temporary_primary_odb() with "old_path".
+ */
+void restore_primary_odb(struct object_directory *restore_odb, const char *old_path);
+
+void free_object_directory(struct object_directory *odb);
+
 /*
  * Populate and return the loose object cache array corresponding to the
  * given object ID.
@@ -76,18 +90,28 @@ struct packed_git {
 	time_t mtime;
 	int pack_fd;
 	int index;              /* for builtin/pack-objects.c */
+	/* range most recently passed to the OS by pack_readahead() */
+	off_t readahead_start, readahead_end;
 	unsigned pack_local:1,
 		 pack_keep:1,
 		 pack_keep_in_core:1,
 		 freshened:1,
 		 do_not_close:1,
 		 pack_promisor:1,
-		 multi_pack_index:1;
+		 multi_pack_index:1,
+		 is_cruft:1;
 	unsigned char hash[GIT_MAX_RAWSZ];
 	struct revindex_entry *revindex;
 	const uint32_t *revindex_data;
 	const uint32_t *revindex_map;
 	size_t revindex_size;
+	/*
+	 * mtimes_map points at the beginning of the memory mapped region of
+	 * this pack's corresponding .mtimes file, and mtimes_size is the size
+	 * of that .mtimes file
+	 */
+	const uint32_t *mtimes_map;
+	size_t mtimes_size;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 };
@@ -153,6 +177,14 @@ struct raw_object_store {
 	/* A most-recently-used ordered version of the packed_git list. */
 	struct list_head packed_git_mru;
 
+	/*
+	 * A read-only copy of the packed_git list, taken when the pack
+	 * list is (re)prepared and found to differ from the last copy,
+	 * for searches that run without obj_read_mutex. A superseded
+	 * snapshot is freed once no search holds it any more.
+	 */
+	struct packed_git_snapshot *packed_git_snapshot;
+
 	struct {
 		struct packed_git **packs;
 		unsigned flags;
@@ -172,6 +204,15 @@ struct raw_object_store {
 	unsigned long approximate_object_count;
 	unsigned approximate_object_count_valid : 1;
 
+	/*
+	 * The longest abbreviation needed by a packed object, by the first
+	 * byte of its name, and the number of per-pack searches for
+	 * abbreviations done before it was worth building; see
+	 * object-name.c.
+	 */
+	unsigned char *packed_abbrev_len;
+	unsigned long packed_abbrev_searches;
+
 	/*
 	 * Whether packed_git has already been populated with this repository's
 	 * packs.
@@ -179,6 +220,13 @@ struct raw_object_store {
 	unsigned packed_git_initialized : 1;
 };
 
+struct packed_git_snapshot {
+	/* searches using it; protected by obj_read_mutex */
+	unsigned refs;
+	size_t nr;
+	struct packed_git *packs[FLEX_ARRAY];
+};
+
 struct raw_object_store *raw_object_store_new(void);
 void raw_object_store_clear(struct raw_object_store *o);
 
@@ -217,6 +265,24 @@ int hash_object_file(const struct git_hash_algo *algo, const void *buf,
 int write_object_file(const void *buf, unsigned long len,
 		      const char *type, struct object_id *oid);
 
+/*
+ * Write "buf" as a loose object named "oid", which the caller must
+ * have computed with hash_object_file(). Unlike write_object_file(),
+ * this does not check whether the object already exists (see
+ * freshen_object()), and it does not touch any state shared with the
+ * object reading machinery, so it may be called from several threads
+ * at once.  Callers that plugged the bulk checkin must call
+ * prepare_loose_object_bulk_checkin() themselves first.
+ */
+int write_loose_object_file(const void *buf, unsigned long len,
+			    const char *type, const struct object_id *oid);
+
+/*
+ * Return 1 and update the mtime of the object if it already exists in
+ * the object store, 0 otherwise.
+ */
+int freshen_object(const struct object_id *oid);
+
 int hash_object_file_literally(const void *buf, unsigned long len,
 			       const char *type, struct object_id *oid,
 			       unsigned flags);
@@ -12,12 +12,18 @@
 
 unsigned int get_max_object_index(void)
 {
-	return the_repository->parsed_objects->obj_hash_size;
+	return the_repository->parsed_objects->obj_hash.capacity;
+}
+
+static struct object *obj_hash_at(struct parsed_object_pool *o, size_t idx)
+{
+	uint32_t *slot = oidtable_slot(&o->obj_hash, idx);
+	return slot ? alloc_node_at(o, *slot) : NULL;
 }
 
 struct object *get_indexed_object(unsigned int idx)
 {
-	return the_repository->parsed_objects->obj_hash[idx];
+	return obj_hash_at(the_repository->parsed_objects, idx);
 }
 
 static const char *object_type_strings[] = {
@@ -53,107 +59,28 @@ int type_from_string_gently(const char *str, ssize_t len, int gentle)
 	die(_("invalid object type \"%s\""), str);
 }
 
-/*
- * Return a numerical hash value between 0 and n-1 for the object with
- * the specified sha1.  n must be a power of 2.  Please note that the
- * return value is *not* consistent across computer architectures.
- */
-static unsigned int hash_obj(const struct object_id *oid, unsigned int n)
-{
-	return oidhash(oid) & (n - 1);
-}
-
-/*
- * Insert obj into the hash table hash, which has length size (which
- * must be a power of 2).  On collisions, simply overflow to the next
- * empty bucket.
- */
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
-{
-	unsigned int j = hash_obj(&obj->oid, size);
-
-	while (hash[j]) {
-		j++;
-		if (j >= size)
-			j = 0;
-	}
-	hash[j] = obj;
-}
-
 /*
  * Look up the record for the given sha1 in the hash map stored in
  * obj_hash.  Return NULL if it was not found.
  */
 struct object *lookup_object(struct repository *r, const struct object_id *oid)
 {
-	unsigned int i, first;
-	struct object *obj;
-
-	if (!r->parsed_objects->obj_hash)
-		return NULL;
-
-	first = i = hash_obj(oid, r->parsed_objects->obj_hash_size);
-	while ((obj = r->parsed_objects->obj_hash[i]) != NULL) {
-		if (oideq(oid, &obj->oid))
-			break;
-		i++;
-		if (i == r->parsed_objects->obj_hash_size)
-			i = 0;
-	}
-	if (obj && i != first) {
-		/*
-		 * Move object to where we started to look for it so
-		 * that we do not need to walk the hash table the next
-		 * time we look for it.
-		 */
-		SWAP(r->parsed_objects->obj_hash[i],
-		     r->parsed_objects->obj_hash[first]);
-	}
-	return obj;
-}
-
-/*
- * Increase the size of the hash map stored in obj_hash to the next
- * power of 2 (but at least 32).  Copy the existing values to the new
- * hash map.
- */
-static void grow_object_hash(struct repository *r)
-{
-	int i;
-	/*
-	 * Note that this size must always be power-of-2 to match hash_obj
-	 * above.
-	 */
-	int new_hash_size = r->parsed_objects->obj_hash_size < 32 ? 32 : 2 * r->parsed_objects->obj_hash_size;
-	struct object **new_hash;
+	uint32_t *slot = oidtable_get(&r->parsed_objects->obj_hash, oid);
 
-	CALLOC_ARRAY(new_hash, new_hash_size);
-	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = r->parsed_objects->obj_hash[i];
-
-		if (!obj)
-			continue;
-		insert_obj_hash(obj, new_hash, new_hash_size);
-	}
-	free(r->parsed_objects->obj_hash);
-	r->parsed_objects->obj_hash = new_hash;
-	r->parsed_objects->obj_hash_size = new_hash_size;
+	return slot ? alloc_node_at(r->parsed_objects, *slot) : NULL;
 }
 
 void *create_object(struct repository *r, const struct object_id *oid, void *o)
 {
 	struct object *obj = o;
+	uint32_t *slot;
 
 	obj->parsed = 0;
 	obj->flags = 0;
 	oidcpy(&obj->oid, oid);
 
-	if (r->parsed_objects->obj_hash_size - 1 <= r->parsed_objects->nr_objs * 2)
-		grow_object_hash(r);
-
-	insert_obj_hash(obj, r->parsed_objects->obj_hash,
-			r->parsed_objects->obj_hash_size);
-	r->parsed_objects->nr_objs++;
+	slot = oidtable_put(&r->parsed_objects->obj_hash, oid, NULL);
+	*slot = alloc_node_index(r->parsed_objects, obj);
 	return obj;
 }
 
@@ -447,8 +374,8 @@ void clear_object_flags(unsigned flags)
 {
 	int i;
 
-	for (i=0; i < the_repository->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = the_repository->parsed_objects->obj_hash[i];
+	for (i=0; i < the_repository->parsed_objects->obj_hash.capacity; i++) {
+		struct object *obj = obj_hash_at(the_repository->parsed_objects, i);
 		if (obj)
 			obj->flags &= ~flags;
 	}
@@ -458,17 +385,36 @@ void repo_clear_commit_marks(struct repository *r, unsigned int flags)
 {
 	int i;
 
-	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = r->parsed_objects->obj_hash[i];
+	for (i = 0; i < r->parsed_objects->obj_hash.capacity; i++) {
+		struct object *obj = obj_hash_at(r->parsed_objects, i);
 		if (obj && obj->type == OBJ_COMMIT)
 			obj->flags &= ~flags;
 	}
 }
 
+static const struct object_id *obj_hash_key(const void *data, const void *slot)
+{
+	const struct object *obj = alloc_node_at(data, *(const uint32_t *)slot);
+	return &obj->oid;
+}
+
+static const struct object_id *graft_table_key(const void *data,
+					       const void *slot)
+{
+	const struct parsed_object_pool *o = data;
+	return &o->grafts[*(const uint32_t *)slot]->oid;
+}
+
 struct parsed_object_pool *parsed_object_pool_new(void)
 {
 	struct parsed_object_pool *o = xmalloc(sizeof(*o));
+	struct oidtable obj_hash = OIDTABLE_INIT_FN(uint32_t, obj_hash_key, o);
+	struct oidtable graft_table =
+		OIDTABLE_INIT_FN(uint32_t, graft_table_key, o);
+
 	memset(o, 0, sizeof(*o));
+	o->obj_hash = obj_hash;
+	o->graft_table = graft_table;
 
 	o->blob_state = allocate_alloc_state();
 	o->tree_state = allocate_alloc_state();
@@ -495,7 +441,7 @@ struct raw_object_store *raw_object_store_new(void)
 	return o;
 }
 
-static void free_object_directory(struct object_directory *odb)
+void free_object_directory(struct object_directory *odb)
 {
 	free(odb->path);
 	odb_clear_loose_cache(odb);
@@ -530,8 +476,10 @@ void raw_object_store_clear(struct raw_object_store *o)
 	o->loaded_alternates = 0;
 
 	INIT_LIST_HEAD(&o->packed_git_mru);
+	FREE_AND_NULL(o->packed_git_snapshot);
 	close_object_store(o);
 	o->packed_git = NULL;
+	FREE_AND_NULL(o->packed_abbrev_len);
 
 	hashmap_clear(&o->pack_map);
 }
@@ -547,8 +495,8 @@ void parsed_object_pool_clear(struct parsed_object_pool *o)
 	 */
 	unsigned i;
 
-	for (i = 0; i < o->obj_hash_size; i++) {
-		struct object *obj = o->obj_hash[i];
+	for (i = 0; i < o->obj_hash.capacity; i++) {
+		struct object *obj = obj_hash_at(o, i);
 
 		if (!obj)
 			continue;
@@ -561,8 +509,8 @@ void parsed_object_pool_clear(struct parsed_object_pool *o)
 			release_tag_memory((struct tag*)obj);
 	}
 
-	FREE_AND_NULL(o->obj_hash);
-	o->obj_hash_size = 0;
+	oidtable_clear(&o->obj_hash);
+	oidtable_clear(&o->graft_table);
 
 	free_commit_buffer_slab(o->buffer_slab);
 	o->buffer_slab = NULL;
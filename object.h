@@ -2,12 +2,16 @@
 #define OBJECT_H
 
 #include "cache.h"
+#include "oidtable.h"
 
 struct buffer_slab;
 
 struct parsed_object_pool {
-	struct object **obj_hash;
-	int nr_objs, obj_hash_size;
+	/*
+	 * Every object we know of, keyed by their oid. The slots hold
+	 * the 32-bit indices of alloc_node_index(), not pointers.
+	 */
+	struct oidtable obj_hash;
 
 	/* TODO: migrate alloc_states to mem-pool? */
 	struct alloc_state *blob_state;
@@ -16,9 +20,15 @@ struct parsed_object_pool {
 	struct alloc_state *tag_state;
 	struct alloc_state *object_state;
 
-	/* parent substitutions from .git/info/grafts and .git/shallow */
+	/*
+	 * Parent substitutions from .git/info/grafts and .git/shallow, in
+	 * the order they were registered until for_each_commit_graft()
+	 * sorts them, and a table of their indices keyed by oid.
+	 */
 	struct commit_graft **grafts;
 	int grafts_alloc, grafts_nr;
+	int grafts_unsorted;
+	struct oidtable graft_table;
 
 	int is_shallow;
 	struct stat_validity *shallow_stat;
@@ -62,6 +72,7 @@ struct object_array {
  * revision.h:               0---------10         15             23------26
  * fetch-pack.c:             01    67
  * negotiator/default.c:       2--5
+ * negotiator/generation.c:    2--5
  * walker.c:                 0-2
  * upload-pack.c:                4       11-----14  16-----19
  * builtin/blame.c:                        12-13
@@ -1,61 +1,65 @@
 #include "cache.h"
 #include "oidmap.h"
 
-static int oidmap_neq(const void *hashmap_cmp_fn_data,
-		      const struct hashmap_entry *e1,
-		      const struct hashmap_entry *e2,
-		      const void *keydata)
+static void oidmap_setup(struct oidmap *map)
 {
-	const struct oidmap_entry *a, *b;
-
-	a = container_of(e1, const struct oidmap_entry, internal_entry);
-	b = container_of(e2, const struct oidmap_entry, internal_entry);
-
-	if (keydata)
-		return !oideq(&a->oid, (const struct object_id *) keydata);
-	return !oideq(&a->oid, &b->oid);
+	if (!map->map.slot_size) {
+		struct oidtable blank = OIDTABLE_INIT_PTR(struct oidmap_entry, oid);
+		map->map = blank;
+	}
 }
 
 void oidmap_init(struct oidmap *map, size_t initial_size)
 {
-	hashmap_init(&map->map, oidmap_neq, NULL, initial_size);
+	memset(map, 0, sizeof(*map));
+	oidmap_setup(map);
+	if (initial_size)
+		oidtable_reserve(&map->map, initial_size);
 }
 
 void oidmap_free(struct oidmap *map, int free_entries)
 {
+	size_t i;
+
 	if (!map)
 		return;
 
-	/* TODO: make oidmap itself not depend on struct layouts */
-	hashmap_clear_(&map->map, free_entries ? 0 : -1);
+	if (free_entries) {
+		for (i = 0; i < map->map.capacity; i++) {
+			void **slot = oidtable_slot(&map->map, i);
+			if (slot)
+				free(*slot);
+		}
+	}
+	oidtable_clear(&map->map);
 }
 
 void *oidmap_get(const struct oidmap *map, const struct object_id *key)
 {
-	if (!map->map.cmpfn)
-		return NULL;
+	void **slot = oidtable_get(&map->map, key);
 
-	return hashmap_get_from_hash(&map->map, oidhash(key), key);
+	return slot ? *slot : NULL;
 }
 
 void *oidmap_remove(struct oidmap *map, const struct object_id *key)
 {
-	struct hashmap_entry entry;
+	void *entry;
 
-	if (!map->map.cmpfn)
-		oidmap_init(map, 0);
-
-	hashmap_entry_init(&entry, oidhash(key));
-	return hashmap_remove(&map->map, &entry, key);
+	oidmap_setup(map);
+	if (!oidtable_remove(&map->map, key, &entry))
+		return NULL;
+	return entry;
 }
 
 void *oidmap_put(struct oidmap *map, void *entry)
 {
 	struct oidmap_entry *to_put = entry;
+	void **slot, *old;
+	int found;
 
-	if (!map->map.cmpfn)
-		oidmap_init(map, 0);
-
-	hashmap_entry_init(&to_put->internal_entry, oidhash(&to_put->oid));
-	return hashmap_put(&map->map, &to_put->internal_entry);
+	oidmap_setup(map);
+	slot = oidtable_put(&map->map, &to_put->oid, &found);
+	old = found ? *slot : NULL;
+	*slot = entry;
+	return old;
 }
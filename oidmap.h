@@ -2,24 +2,21 @@
 #define OIDMAP_H
 
 #include "cache.h"
-#include "hashmap.h"
+#include "oidtable.h"
 
 /*
  * struct oidmap_entry is a structure representing an entry in the hash table,
  * which must be used as first member of user data structures.
  *
- * Users should set the oid field. oidmap_put() will populate the
- * internal_entry field.
+ * Users should set the oid field. The map holds pointers to the entries,
+ * which are not copied.
  */
 struct oidmap_entry {
-	/* For internal use only */
-	struct hashmap_entry internal_entry;
-
 	struct object_id oid;
 };
 
 struct oidmap {
-	struct hashmap map;
+	struct oidtable map;
 };
 
 #define OIDMAP_INIT { { NULL } }
@@ -52,9 +49,6 @@ void *oidmap_get(const struct oidmap *map,
 /*
  * Adds or replaces an oidmap entry.
  *
- * ((struct oidmap_entry *) entry)->internal_entry will be populated by this
- * function.
- *
  * Returns the replaced entry, or NULL if not found (i.e. the entry was added).
  */
 void *oidmap_put(struct oidmap *map, void *entry);
@@ -67,19 +61,34 @@ void *oidmap_put(struct oidmap *map, void *entry);
 void *oidmap_remove(struct oidmap *map, const struct object_id *key);
 
 
+/*
+ * Returns the number of entries in the map.
+ */
+static inline size_t oidmap_get_size(const struct oidmap *map)
+{
+	return map->map.nr;
+}
+
 struct oidmap_iter {
-	struct hashmap_iter h_iter;
+	struct oidtable *map;
+	size_t pos;
 };
 
 static inline void oidmap_iter_init(struct oidmap *map, struct oidmap_iter *iter)
 {
-	hashmap_iter_init(&map->map, &iter->h_iter);
+	iter->map = &map->map;
+	iter->pos = 0;
 }
 
 static inline void *oidmap_iter_next(struct oidmap_iter *iter)
 {
-	/* TODO: this API could be reworked to do compile-time type checks */
-	return (void *)hashmap_iter_next(&iter->h_iter);
+	while (iter->pos < iter->map->capacity) {
+		void **slot = oidtable_slot(iter->map, iter->pos++);
+		if (slot)
+			/* TODO: this API could be reworked to do compile-time type checks */
+			return *slot;
+	}
+	return NULL;
 }
 
 static inline void *oidmap_iter_first(struct oidmap *map,
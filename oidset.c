@@ -5,40 +5,35 @@ void oidset_init(struct oidset *set, size_t initial_size)
 {
 	memset(&set->set, 0, sizeof(set->set));
 	if (initial_size)
-		kh_resize_oid_set(&set->set, initial_size);
+		oidtable_reserve(&set->set, initial_size);
 }
 
 int oidset_contains(const struct oidset *set, const struct object_id *oid)
 {
-	khiter_t pos = kh_get_oid_set(&set->set, *oid);
-	return pos != kh_end(&set->set);
+	return !!oidtable_get(&set->set, oid);
 }
 
 int oidset_insert(struct oidset *set, const struct object_id *oid)
 {
-	int added;
-	kh_put_oid_set(&set->set, *oid, &added);
-	return !added;
+	int found;
+	oidtable_put(&set->set, oid, &found);
+	return found;
 }
 
 int oidset_remove(struct oidset *set, const struct object_id *oid)
 {
-	khiter_t pos = kh_get_oid_set(&set->set, *oid);
-	if (pos == kh_end(&set->set))
-		return 0;
-	kh_del_oid_set(&set->set, pos);
-	return 1;
+	return oidtable_remove(&set->set, oid, NULL);
 }
 
 void oidset_clear(struct oidset *set)
 {
-	kh_release_oid_set(&set->set);
+	oidtable_clear(&set->set);
 	oidset_init(set, 0);
 }
 
 int oidset_size(struct oidset *set)
 {
-	return kh_size(&set->set);
+	return set->set.nr;
 }
 
 void oidset_parse_file(struct oidset *set, const char *path)
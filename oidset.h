@@ -1,7 +1,7 @@
 #ifndef OIDSET_H
 #define OIDSET_H
 
-#include "khash.h"
+#include "oidtable.h"
 
 /**
  * This API is similar to oid-array, in that it maintains a set of object ids
@@ -19,7 +19,7 @@
  * A single oidset; should be zero-initialized (or use OIDSET_INIT).
  */
 struct oidset {
-	kh_oid_set_t set;
+	struct oidtable set;
 };
 
 #define OIDSET_INIT { { 0 } }
@@ -83,22 +83,23 @@ void oidset_parse_file_carefully(struct oidset *set, const char *path,
 				 oidset_parse_tweak_fn fn, void *cbdata);
 
 struct oidset_iter {
-	kh_oid_set_t *set;
-	khiter_t iter;
+	struct oidtable *set;
+	size_t iter;
 };
 
 static inline void oidset_iter_init(struct oidset *set,
 				    struct oidset_iter *iter)
 {
 	iter->set = &set->set;
-	iter->iter = kh_begin(iter->set);
+	iter->iter = 0;
 }
 
 static inline struct object_id *oidset_iter_next(struct oidset_iter *iter)
 {
-	for (; iter->iter != kh_end(iter->set); iter->iter++) {
-		if (kh_exist(iter->set, iter->iter))
-			return &kh_key(iter->set, iter->iter++);
+	while (iter->iter < iter->set->capacity) {
+		struct object_id *oid = oidtable_slot(iter->set, iter->iter++);
+		if (oid)
+			return oid;
 	}
 	return NULL;
 }
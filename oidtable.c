@@ -0,0 +1,296 @@
+#include "cache.h"
+#include "oidtable.h"
+
+/*
+ * Control words: a full slot holds the low 7 bits of its key's hash
+ * ("h2"), so only the two special values have their high bit set.
+ */
+#define CTRL_EMPTY ((unsigned char)0x80)
+#define CTRL_DELETED ((unsigned char)0xfe)
+
+#define MIN_CAPACITY 16
+
+/*
+ * Looking at a group of control words returns a bitmask with bit i set
+ * for each matching word i of the group.
+ */
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+
+#define GROUP_WIDTH 16
+
+static inline unsigned int group_match(const unsigned char *ctrl,
+				       unsigned char h2)
+{
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+
+static inline unsigned int group_match_free(const unsigned char *ctrl)
+{
+	/* CTRL_EMPTY and CTRL_DELETED are the words with the high bit set */
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+
+static inline int mask_lowest(unsigned int mask)
+{
+	return __builtin_ctz(mask);
+}
+#else
+#define GROUP_WIDTH 8
+
+static inline unsigned int group_match(const unsigned char *ctrl,
+				       unsigned char h2)
+{
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; i < GROUP_WIDTH; i++)
+		if (ctrl[i] == h2)
+			mask |= 1u << i;
+	return mask;
+}
+
+static inline unsigned int group_match_free(const unsigned char *ctrl)
+{
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; i < GROUP_WIDTH; i++)
+		if (ctrl[i] & 0x80)
+			mask |= 1u << i;
+	return mask;
+}
+
+static inline int mask_lowest(unsigned int mask)
+{
+	int i = 0;
+
+	while (!(mask & 1)) {
+		mask >>= 1;
+		i++;
+	}
+	return i;
+}
+#endif
+
+static inline unsigned int group_match_empty(const unsigned char *ctrl)
+{
+	return group_match(ctrl, CTRL_EMPTY);
+}
+
+/*
+ * Object ids are already uniformly distributed, so the first bytes
+ * choose the group to start probing at, and the next byte gives h2.
+ */
+static inline size_t hash_h1(const struct object_id *oid)
+{
+	return oidhash(oid);
+}
+
+static inline unsigned char hash_h2(const struct object_id *oid)
+{
+	return oid->hash[sizeof(unsigned int)] & 0x7f;
+}
+
+static void setup_layout(struct oidtable *t)
+{
+	/* a zero-initialized table is a set of object ids */
+	if (!t->slot_size)
+		t->slot_size = sizeof(struct object_id);
+}
+
+static inline const struct object_id *slot_key(const struct oidtable *t,
+					       const char *slot)
+{
+	if (t->key_fn)
+		return t->key_fn(t->key_data, slot);
+	if (t->indirect)
+		slot = *(const char **)slot;
+	return (const struct object_id *)(slot + t->key_offset);
+}
+
+/*
+ * Groups are probed in triangular order, which visits each of them once
+ * when the number of groups is a power of two.
+ */
+#define for_each_probed_group(t, oid, pos, step) \
+	for (pos = (hash_h1(oid) * GROUP_WIDTH) & ((t)->capacity - 1), step = 0; \
+	     step < (t)->capacity; \
+	     step += GROUP_WIDTH, pos = (pos + step) & ((t)->capacity - 1))
+
+/*
+ * Return the index of the slot holding `oid`, or -1. If `free_slot` is
+ * not NULL, it is set to where `oid` would be added when not found.
+ */
+static ssize_t find_slot(const struct oidtable *t, const struct object_id *oid,
+			 ssize_t *free_slot)
+{
+	unsigned char h2 = hash_h2(oid);
+	size_t pos, step;
+
+	if (free_slot)
+		*free_slot = -1;
+	if (!t->capacity)
+		return -1;
+
+	for_each_probed_group(t, oid, pos, step) {
+		unsigned int mask = group_match(t->ctrl + pos, h2);
+
+		while (mask) {
+			size_t i = pos + mask_lowest(mask);
+			if (oideq(slot_key(t, t->slots + i * t->slot_size), oid))
+				return i;
+			mask &= mask - 1;
+		}
+
+		if (free_slot && *free_slot < 0) {
+			mask = group_match_free(t->ctrl + pos);
+			if (mask)
+				*free_slot = pos + mask_lowest(mask);
+		}
+		if (group_match_empty(t->ctrl + pos))
+			break;
+	}
+	return -1;
+}
+
+static size_t find_free_slot(const struct oidtable *t,
+			     const struct object_id *oid)
+{
+	size_t pos, step;
+
+	for_each_probed_group(t, oid, pos, step) {
+		unsigned int mask = group_match_free(t->ctrl + pos);
+		if (mask)
+			return pos + mask_lowest(mask);
+	}
+	BUG("oidtable has no free slot");
+}
+
+static size_t max_load(size_t capacity)
+{
+	return capacity - capacity / 8;
+}
+
+static void resize(struct oidtable *t, size_t capacity)
+{
+	unsigned char *old_ctrl = t->ctrl;
+	char *old_slots = t->slots;
+	size_t old_capacity = t->capacity;
+	size_t i;
+
+	t->capacity = capacity;
+	t->ctrl = xmalloc(capacity);
+	memset(t->ctrl, CTRL_EMPTY, capacity);
+	t->slots = xmalloc(st_mult(capacity, t->slot_size));
+	t->growth_left = max_load(capacity) - t->nr;
+
+	for (i = 0; i < old_capacity; i++) {
+		const char *slot = old_slots + i * t->slot_size;
+		const struct object_id *oid;
+		size_t j;
+
+		if (old_ctrl[i] & 0x80)
+			continue;
+		oid = slot_key(t, slot);
+		j = find_free_slot(t, oid);
+		t->ctrl[j] = hash_h2(oid);
+		memcpy(t->slots + j * t->slot_size, slot, t->slot_size);
+	}
+
+	free(old_ctrl);
+	free(old_slots);
+}
+
+void oidtable_reserve(struct oidtable *t, size_t nr)
+{
+	size_t capacity = MIN_CAPACITY;
+
+	setup_layout(t);
+	while (max_load(capacity) < nr)
+		capacity *= 2;
+	if (capacity > t->capacity)
+		resize(t, capacity);
+}
+
+void oidtable_clear(struct oidtable *t)
+{
+	FREE_AND_NULL(t->ctrl);
+	FREE_AND_NULL(t->slots);
+	t->nr = t->capacity = t->growth_left = 0;
+}
+
+void *oidtable_get(const struct oidtable *t, const struct object_id *oid)
+{
+	ssize_t i = find_slot(t, oid, NULL);
+
+	if (i < 0)
+		return NULL;
+	return t->slots + i * t->slot_size;
+}
+
+void *oidtable_put(struct oidtable *t, const struct object_id *oid, int *found)
+{
+	ssize_t free_slot;
+	ssize_t i = find_slot(t, oid, &free_slot);
+	char *slot;
+
+	if (found)
+		*found = i >= 0;
+	if (i >= 0)
+		return t->slots + i * t->slot_size;
+
+	setup_layout(t);
+	i = free_slot;
+	if (i < 0 || (t->ctrl[i] == CTRL_EMPTY && !t->growth_left)) {
+		/*
+		 * Out of empty slots: grow, unless most of the used ones
+		 * are deleted, in which case rehashing in place is enough.
+		 */
+		if (!t->capacity)
+			resize(t, MIN_CAPACITY);
+		else if (t->nr >= max_load(t->capacity) / 2)
+			resize(t, t->capacity * 2);
+		else
+			resize(t, t->capacity);
+		i = find_free_slot(t, oid);
+	}
+
+	if (t->ctrl[i] == CTRL_EMPTY)
+		t->growth_left--;
+	t->ctrl[i] = hash_h2(oid);
+	t->nr++;
+
+	slot = t->slots + i * t->slot_size;
+	memset(slot, 0, t->slot_size);
+	if (!t->indirect && !t->key_fn)
+		oidcpy((struct object_id *)(slot + t->key_offset), oid);
+	return slot;
+}
+
+int oidtable_remove(struct oidtable *t, const struct object_id *oid, void *out)
+{
+	ssize_t i = find_slot(t, oid, NULL);
+	size_t group;
+
+	if (i < 0)
+		return 0;
+	if (out)
+		memcpy(out, t->slots + i * t->slot_size, t->slot_size);
+
+	/*
+	 * A slot can go back to being empty if its group still has
+	 * another empty slot, as then no probe can have gone past the
+	 * group on account of it being full.
+	 */
+	group = i & ~(size_t)(GROUP_WIDTH - 1);
+	if (group_match_empty(t->ctrl + group)) {
+		t->ctrl[i] = CTRL_EMPTY;
+		t->growth_left++;
+	} else {
+		t->ctrl[i] = CTRL_DELETED;
+	}
+	t->nr--;
+	return 1;
+}
@@ -0,0 +1,112 @@
+#ifndef OIDTABLE_H
+#define OIDTABLE_H
+
+#include "hash.h"
+
+/**
+ * An open-addressing hash table keyed by object id, laid out like the
+ * "Swiss tables" of abseil and hashbrown: next to the array of slots is
+ * an array of one-byte control words, each of which says whether its slot
+ * is empty, deleted, or full, and for full slots holds 7 bits of the
+ * key's hash. A lookup reads a whole group of control words at a time
+ * (with SSE2, when available) and only looks at the keys of the slots
+ * whose control word matches; there are no chains to follow, and keys
+ * are compared with oideq() rather than through a callback.
+ *
+ * The slots are `slot_size` bytes each, and the table treats them as
+ * opaque except for the key, which is found:
+ *
+ *   - at `key_offset` in the slot, for tables set up with OIDTABLE_INIT() (or
+ *     zero-initialized, which gives a table whose slots are just a
+ *     `struct object_id`), or
+ *
+ *   - at `key_offset` in the struct that the slot points to, for tables set up with
+ *     OIDTABLE_INIT_PTR(), whose slots are pointers, or
+ *
+ *   - wherever `key_fn` says, for tables set up with OIDTABLE_INIT_FN(),
+ *     whose slots can be anything that identifies an entry, e.g. an
+ *     index into an array. Only slots whose control word matches are
+ *     looked at, and 7 bits of hash leave 1 in 128 of the others to
+ *     match by accident, so a lookup calls `key_fn` about once (and a
+ *     lookup of a missing key, hardly ever). Growing the table calls
+ *     it once for every entry.
+ */
+typedef const struct object_id *(*oidtable_key_fn)(const void *key_data,
+						     const void *slot);
+
+struct oidtable {
+	unsigned char *ctrl;
+	char *slots;
+	size_t nr, capacity, growth_left;
+
+	size_t slot_size;
+	size_t key_offset;
+	unsigned indirect : 1;
+	oidtable_key_fn key_fn;
+	const void *key_data;
+};
+
+#define OIDTABLE_INIT(type, member) { \
+	.slot_size = sizeof(type), \
+	.key_offset = offsetof(type, member), \
+}
+
+#define OIDTABLE_INIT_PTR(type, member) { \
+	.slot_size = sizeof(type *), \
+	.key_offset = offsetof(type, member), \
+	.indirect = 1, \
+}
+
+#define OIDTABLE_INIT_FN(type, fn, data) { \
+	.slot_size = sizeof(type), \
+	.key_fn = (fn), \
+	.key_data = (data), \
+}
+
+/**
+ * Make room for at least `nr` entries without further allocations.
+ */
+void oidtable_reserve(struct oidtable *t, size_t nr);
+
+/**
+ * Free the memory used by the table, leaving it empty. The layout given
+ * at initialization is kept.
+ */
+void oidtable_clear(struct oidtable *t);
+
+/**
+ * Return the slot for `oid`, or NULL if there is none.
+ */
+void *oidtable_get(const struct oidtable *t, const struct object_id *oid);
+
+/**
+ * Return the slot for `oid`, adding one if there is none, and set
+ * `*found` (if not NULL) to whether it was already there. A new slot is
+ * zeroed; for a table with keys in its slots the key is filled in,
+ * while otherwise the caller must store a pointer (or whatever `key_fn`
+ * expects) that leads to `oid`.
+ *
+ * The returned pointer is valid until the next call that adds to the
+ * table.
+ */
+void *oidtable_put(struct oidtable *t, const struct object_id *oid, int *found);
+
+/**
+ * Remove the slot for `oid`, copying it to `out` first if `out` is not
+ * NULL. Return 1 if there was such a slot, 0 otherwise.
+ */
+int oidtable_remove(struct oidtable *t, const struct object_id *oid, void *out);
+
+/**
+ * The table can be iterated over by calling oidtable_slot() for each
+ * index below `t->capacity`; it returns NULL for indices without an
+ * entry. Entries may be removed while iterating, but not added.
+ */
+static inline void *oidtable_slot(const struct oidtable *t, size_t i)
+{
+	if (t->ctrl[i] & 0x80)
+		return NULL;
+	return t->slots + i * t->slot_size;
+}
+
+#endif /* OIDTABLE_H */
@@ -35,18 +35,42 @@ struct bitmap_writer {
 	struct bitmapped_commit *selected;
 	unsigned int selected_nr, selected_alloc;
 
+	/* the bitmap we are replacing, if any; see writer_old_bitmap() */
+	struct bitmap_index *old_bitmap;
+	unsigned old_bitmap_loaded:1;
+
 	struct progress *progress;
 	int show_progress;
+	int nr_threads;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
 };
 
 static struct bitmap_writer writer;
 
+/*
+ * The existing bitmap of the repository, opened once for both selecting
+ * commits and building their bitmaps, so that commits which already had
+ * a bitmap can keep it; their old bitmap only needs remapping.
+ */
+static struct bitmap_index *writer_old_bitmap(struct repository *r)
+{
+	if (!writer.old_bitmap_loaded) {
+		writer.old_bitmap = prepare_bitmap_git(r);
+		writer.old_bitmap_loaded = 1;
+	}
+	return writer.old_bitmap;
+}
+
 void bitmap_writer_show_progress(int show)
 {
 	writer.show_progress = show;
 }
 
+void bitmap_writer_set_threads(int nr_threads)
+{
+	writer.nr_threads = nr_threads;
+}
+
 /**
  * Build the initial type index for the packfile
  */
@@ -60,7 +84,7 @@ void bitmap_writer_build_type_index(struct packing_data *to_pack,
 	writer.trees = ewah_new();
 	writer.blobs = ewah_new();
 	writer.tags = ewah_new();
-	ALLOC_ARRAY(to_pack->in_pack_pos, to_pack->nr_objects);
+	prepare_in_pack_pos(to_pack);
 
 	for (i = 0; i < index_nr; ++i) {
 		struct object_entry *entry = (struct object_entry *)index[i];
@@ -125,56 +149,138 @@ static inline void push_bitmapped_commit(struct commit *commit)
 	writer.selected_nr++;
 }
 
-static uint32_t find_object_pos(const struct object_id *oid)
+static uint32_t find_object_pos(const struct object_id *oid, int *found)
 {
 	struct object_entry *entry = packlist_find(writer.to_pack, oid);
 
 	if (!entry) {
-		die("Failed to write bitmap index. Packfile doesn't have full closure "
-			"(object %s is missing)", oid_to_hex(oid));
+		if (*found)
+			error("Failed to write bitmap index. Packfile doesn't have full closure "
+			      "(object %s is missing)", oid_to_hex(oid));
+		*found = 0;
+		return 0;
 	}
 
 	return oe_in_pack_pos(writer.to_pack, entry);
 }
 
-static void compute_xor_offsets(void)
+/*
+ * Find which of the preceding selected commits, if any, the bitmap of
+ * "next" is best XOR'ed against. This only reads the bitmaps of other
+ * commits, so it can run for several commits at once; the ewah pool is
+ * not thread-safe, though, and is only used when "pooled" is set.
+ */
+static struct ewah_bitmap *xor_candidate_new(int pooled)
 {
-	static const int MAX_XOR_OFFSET_SEARCH = 10;
+	return pooled ? ewah_pool_new() : ewah_new();
+}
 
-	int i, next = 0;
+static void xor_candidate_free(struct ewah_bitmap *bitmap, int pooled)
+{
+	if (pooled)
+		ewah_pool_free(bitmap);
+	else
+		ewah_free(bitmap);
+}
 
-	while (next < writer.selected_nr) {
-		struct bitmapped_commit *stored = &writer.selected[next];
+static void compute_xor_offset(int next, int pooled)
+{
+	static const int MAX_XOR_OFFSET_SEARCH = 10;
 
-		int best_offset = 0;
-		struct ewah_bitmap *best_bitmap = stored->bitmap;
-		struct ewah_bitmap *test_xor;
+	struct bitmapped_commit *stored = &writer.selected[next];
+	int i, best_offset = 0;
+	struct ewah_bitmap *best_bitmap = stored->bitmap;
+	struct ewah_bitmap *test_xor;
 
-		for (i = 1; i <= MAX_XOR_OFFSET_SEARCH; ++i) {
-			int curr = next - i;
+	for (i = 1; i <= MAX_XOR_OFFSET_SEARCH; ++i) {
+		int curr = next - i;
 
-			if (curr < 0)
-				break;
+		if (curr < 0)
+			break;
 
-			test_xor = ewah_pool_new();
-			ewah_xor(writer.selected[curr].bitmap, stored->bitmap, test_xor);
+		test_xor = xor_candidate_new(pooled);
+		ewah_xor(writer.selected[curr].bitmap, stored->bitmap, test_xor);
 
-			if (test_xor->buffer_size < best_bitmap->buffer_size) {
-				if (best_bitmap != stored->bitmap)
-					ewah_pool_free(best_bitmap);
+		if (test_xor->buffer_size < best_bitmap->buffer_size) {
+			if (best_bitmap != stored->bitmap)
+				xor_candidate_free(best_bitmap, pooled);
 
-				best_bitmap = test_xor;
-				best_offset = i;
-			} else {
-				ewah_pool_free(test_xor);
-			}
+			best_bitmap = test_xor;
+			best_offset = i;
+		} else {
+			xor_candidate_free(test_xor, pooled);
 		}
+	}
+
+	stored->xor_offset = best_offset;
+	stored->write_as = best_bitmap;
+}
+
+/*
+ * Give each thread at least this many commits, so that starting it
+ * is worth it.
+ */
+#define XOR_OFFSETS_PER_THREAD 32
+
+struct xor_offsets_thread_data {
+	pthread_t pthread;
+	int start, end;
+};
+
+static void *xor_offsets_thread_proc(void *_data)
+{
+	struct xor_offsets_thread_data *d = _data;
+	int i;
+
+	for (i = d->start; i < d->end; i++)
+		compute_xor_offset(i, 0);
+	return NULL;
+}
+
+static void compute_xor_offsets(void)
+{
+	struct xor_offsets_thread_data *data;
+	int nr_threads = writer.nr_threads;
+	int i, nr_each;
+
+	if (nr_threads > writer.selected_nr / XOR_OFFSETS_PER_THREAD)
+		nr_threads = writer.selected_nr / XOR_OFFSETS_PER_THREAD;
+
+	if (!HAVE_THREADS || nr_threads <= 1) {
+		for (i = 0; i < writer.selected_nr; i++)
+			compute_xor_offset(i, 1);
+		return;
+	}
+
+	trace2_region_enter("pack-bitmap-write", "compute_xor_offsets",
+			    the_repository);
+
+	nr_each = DIV_ROUND_UP(writer.selected_nr, nr_threads);
+	CALLOC_ARRAY(data, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err;
 
-		stored->xor_offset = best_offset;
-		stored->write_as = best_bitmap;
+		data[i].start = i * nr_each;
+		data[i].end = data[i].start + nr_each;
+		if (data[i].end > writer.selected_nr)
+			data[i].end = writer.selected_nr;
 
-		next++;
+		err = pthread_create(&data[i].pthread, NULL,
+				     xor_offsets_thread_proc, &data[i]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_join(data[i].pthread, NULL);
+		if (err)
+			die(_("unable to join thread: %s"), strerror(err));
 	}
+	free(data);
+
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "xor_offsets_threads", nr_threads);
+	trace2_region_leave("pack-bitmap-write", "compute_xor_offsets",
+			    the_repository);
 }
 
 struct bb_commit {
@@ -202,7 +308,7 @@ static void bitmap_builder_init(struct bitmap_builder *bb,
 	struct commit *commit;
 	struct commit_list *reusable = NULL;
 	struct commit_list *r;
-	unsigned int i, num_maximal = 0;
+	unsigned int i, num_maximal = 0, num_reused = 0;
 
 	memset(bb, 0, sizeof(*bb));
 	init_bb_data(&bb->data);
@@ -259,6 +365,8 @@ static void bitmap_builder_init(struct bitmap_builder *bb,
 			 * to avoid allocating a position in the commit mask.
 			 */
 			commit_list_insert(commit, &reusable);
+			if (c_ent->selected)
+				num_reused++;
 			goto next;
 		}
 
@@ -320,6 +428,8 @@ static void bitmap_builder_init(struct bitmap_builder *bb,
 			   "num_selected_commits", writer->selected_nr);
 	trace2_data_intmax("pack-bitmap-write", the_repository,
 			   "num_maximal_commits", num_maximal);
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "num_reused_bitmaps", num_reused);
 
 	free_commit_list(reusable);
 }
@@ -331,9 +441,10 @@ static void bitmap_builder_clear(struct bitmap_builder *bb)
 	bb->commits_nr = bb->commits_alloc = 0;
 }
 
-static void fill_bitmap_tree(struct bitmap *bitmap,
-			     struct tree *tree)
+static int fill_bitmap_tree(struct bitmap *bitmap,
+			    struct tree *tree)
 {
+	int found = 1;
 	uint32_t pos;
 	struct tree_desc desc;
 	struct name_entry entry;
@@ -342,9 +453,11 @@ static void fill_bitmap_tree(struct bitmap *bitmap,
 	 * If our bit is already set, then there is nothing to do. Both this
 	 * tree and all of its children will be set.
 	 */
-	pos = find_object_pos(&tree->object.oid);
+	pos = find_object_pos(&tree->object.oid, &found);
+	if (!found)
+		return -1;
 	if (bitmap_get(bitmap, pos))
-		return;
+		return 0;
 	bitmap_set(bitmap, pos);
 
 	if (parse_tree(tree) < 0)
@@ -355,28 +468,37 @@ static void fill_bitmap_tree(struct bitmap *bitmap,
 	while (tree_entry(&desc, &entry)) {
 		switch (object_type(entry.mode)) {
 		case OBJ_TREE:
-			fill_bitmap_tree(bitmap,
-					 lookup_tree(the_repository, &entry.oid));
+			if (fill_bitmap_tree(bitmap,
+					     lookup_tree(the_repository, &entry.oid)) < 0)
+				found = 0;
 			break;
 		case OBJ_BLOB:
-			bitmap_set(bitmap, find_object_pos(&entry.oid));
+			pos = find_object_pos(&entry.oid, &found);
+			if (found)
+				bitmap_set(bitmap, pos);
 			break;
 		default:
 			/* Gitlink, etc; not reachable */
 			break;
 		}
+		if (!found)
+			break;
 	}
 
 	free_tree_buffer(tree);
+	return found ? 0 : -1;
 }
 
-static void fill_bitmap_commit(struct bb_commit *ent,
-			       struct commit *commit,
-			       struct prio_queue *queue,
-			       struct prio_queue *tree_queue,
-			       struct bitmap_index *old_bitmap,
-			       const uint32_t *mapping)
+static int fill_bitmap_commit(struct bb_commit *ent,
+			      struct commit *commit,
+			      struct prio_queue *queue,
+			      struct prio_queue *tree_queue,
+			      struct bitmap_index *old_bitmap,
+			      const uint32_t *mapping)
 {
+	int found = 1;
+	uint32_t pos;
+
 	if (!ent->bitmap)
 		ent->bitmap = bitmap_new();
 
@@ -401,11 +523,16 @@ static void fill_bitmap_commit(struct bb_commit *ent,
 		 * Mark ourselves and queue our tree. The commit
 		 * walk ensures we cover all parents.
 		 */
-		bitmap_set(ent->bitmap, find_object_pos(&c->object.oid));
+		pos = find_object_pos(&c->object.oid, &found);
+		if (!found)
+			return -1;
+		bitmap_set(ent->bitmap, pos);
 		prio_queue_put(tree_queue, get_commit_tree(c));
 
 		for (p = c->parents; p; p = p->next) {
-			int pos = find_object_pos(&p->item->object.oid);
+			pos = find_object_pos(&p->item->object.oid, &found);
+			if (!found)
+				return -1;
 			if (!bitmap_get(ent->bitmap, pos)) {
 				bitmap_set(ent->bitmap, pos);
 				prio_queue_put(queue, p->item);
@@ -413,8 +540,11 @@ static void fill_bitmap_commit(struct bb_commit *ent,
 		}
 	}
 
-	while (tree_queue->nr)
-		fill_bitmap_tree(ent->bitmap, prio_queue_get(tree_queue));
+	while (tree_queue->nr) {
+		if (fill_bitmap_tree(ent->bitmap, prio_queue_get(tree_queue)) < 0)
+			return -1;
+	}
+	return 0;
 }
 
 static void store_selected(struct bb_commit *ent, struct commit *commit)
@@ -432,11 +562,12 @@ static void store_selected(struct bb_commit *ent, struct commit *commit)
 	kh_value(writer.bitmaps, hash_pos) = stored;
 }
 
-void bitmap_writer_build(struct packing_data *to_pack)
+int bitmap_writer_build(struct packing_data *to_pack)
 {
 	struct bitmap_builder bb;
 	size_t i;
 	int nr_stored = 0; /* for progress */
+	int ret = 0;
 	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
 	struct prio_queue tree_queue = { NULL };
 	struct bitmap_index *old_bitmap;
@@ -450,7 +581,7 @@ void bitmap_writer_build(struct packing_data *to_pack)
 	trace2_region_enter("pack-bitmap-write", "building_bitmaps_total",
 			    the_repository);
 
-	old_bitmap = prepare_bitmap_git(to_pack->repo);
+	old_bitmap = writer_old_bitmap(to_pack->repo);
 	if (old_bitmap)
 		mapping = create_bitmap_mapping(old_bitmap, to_pack);
 	else
@@ -463,8 +594,11 @@ void bitmap_writer_build(struct packing_data *to_pack)
 		struct commit *child;
 		int reused = 0;
 
-		fill_bitmap_commit(ent, commit, &queue, &tree_queue,
-				   old_bitmap, mapping);
+		if (fill_bitmap_commit(ent, commit, &queue, &tree_queue,
+				       old_bitmap, mapping) < 0) {
+			ret = -1;
+			break;
+		}
 
 		if (ent->selected) {
 			store_selected(ent, commit);
@@ -493,13 +627,18 @@ void bitmap_writer_build(struct packing_data *to_pack)
 	clear_prio_queue(&tree_queue);
 	bitmap_builder_clear(&bb);
 	free(mapping);
+	free_bitmap_index(old_bitmap);
+	writer.old_bitmap = NULL;
+	writer.old_bitmap_loaded = 0;
 
 	trace2_region_leave("pack-bitmap-write", "building_bitmaps_total",
 			    the_repository);
 
 	stop_progress(&writer.progress);
 
-	compute_xor_offsets();
+	if (!ret)
+		compute_xor_offsets();
+	return ret;
 }
 
 /**
@@ -540,6 +679,7 @@ void bitmap_writer_select_commits(struct commit **indexed_commits,
 				  unsigned int indexed_commits_nr,
 				  int max_bitmaps)
 {
+	struct bitmap_index *old_bitmap;
 	unsigned int i = 0, j, next;
 
 	QSORT(indexed_commits, indexed_commits_nr, date_compare);
@@ -553,8 +693,11 @@ void bitmap_writer_select_commits(struct commit **indexed_commits,
 		return;
 	}
 
+	old_bitmap = writer_old_bitmap(the_repository);
+
 	for (;;) {
 		struct commit *chosen = NULL;
+		int chosen_has_bitmap = 0;
 
 		next = next_commit_index(i);
 
@@ -579,6 +722,19 @@ void bitmap_writer_select_commits(struct commit **indexed_commits,
 					break;
 				}
 
+				/*
+				 * A commit that already has a bitmap is the
+				 * cheapest one to pick, and picking it keeps
+				 * the selection stable between repacks.
+				 */
+				if (chosen_has_bitmap)
+					continue;
+				if (old_bitmap && bitmap_for_commit(old_bitmap, cm)) {
+					chosen = cm;
+					chosen_has_bitmap = 1;
+					continue;
+				}
+
 				if (cm->parents && cm->parents->next)
 					chosen = cm;
 			}
@@ -618,7 +774,8 @@ static const struct object_id *oid_access(size_t pos, const void *table)
 
 static void write_selected_commits_v1(struct hashfile *f,
 				      struct pack_idx_entry **index,
-				      uint32_t index_nr)
+				      uint32_t index_nr,
+				      off_t *offsets)
 {
 	int i;
 
@@ -630,6 +787,10 @@ static void write_selected_commits_v1(struct hashfile *f,
 
 		if (commit_pos < 0)
 			BUG("trying to write commit not in index");
+		stored->commit_pos = commit_pos;
+
+		if (offsets)
+			offsets[i] = hashfile_total(f);
 
 		hashwrite_be32(f, commit_pos);
 		hashwrite_u8(f, stored->xor_offset);
@@ -639,6 +800,52 @@ static void write_selected_commits_v1(struct hashfile *f,
 	}
 }
 
+static int table_cmp(const void *_va, const void *_vb, void *_data)
+{
+	uint32_t a = writer.selected[*(uint32_t *)_va].commit_pos;
+	uint32_t b = writer.selected[*(uint32_t *)_vb].commit_pos;
+
+	if (a > b)
+		return 1;
+	else if (a < b)
+		return -1;
+	return 0;
+}
+
+/*
+ * Write one row per selected commit, sorted by commit position, so that
+ * readers can find and parse a single bitmap without loading them all.
+ */
+static void write_lookup_table(struct hashfile *f, off_t *offsets)
+{
+	uint32_t *table, *table_inv;
+	uint32_t i;
+
+	ALLOC_ARRAY(table, writer.selected_nr);
+	ALLOC_ARRAY(table_inv, writer.selected_nr);
+
+	for (i = 0; i < writer.selected_nr; i++)
+		table[i] = i;
+	QSORT_S(table, writer.selected_nr, table_cmp, NULL);
+	for (i = 0; i < writer.selected_nr; i++)
+		table_inv[table[i]] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *selected = &writer.selected[table[i]];
+		uint32_t xor_row = BITMAP_LOOKUP_NO_XOR;
+
+		if (selected->xor_offset)
+			xor_row = table_inv[table[i] - selected->xor_offset];
+
+		hashwrite_be32(f, selected->commit_pos);
+		hashwrite_be64(f, offsets[table[i]]);
+		hashwrite_be32(f, xor_row);
+	}
+
+	free(table);
+	free(table_inv);
+}
+
 static void write_hash_cache(struct hashfile *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -647,7 +854,7 @@ static void write_hash_cache(struct hashfile *f,
 
 	for (i = 0; i < index_nr; ++i) {
 		struct object_entry *entry = (struct object_entry *)index[i];
-		hashwrite_be32(f, entry->hash);
+		hashwrite_be32(f, oe_name_hash(writer.to_pack, entry));
 	}
 }
 
@@ -665,6 +872,7 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct strbuf tmp_file = STRBUF_INIT;
 	struct hashfile *f;
+	off_t *offsets = NULL;
 
 	struct bitmap_disk_header header;
 
@@ -683,9 +891,15 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.trees);
 	dump_bitmap(f, writer.blobs);
 	dump_bitmap(f, writer.tags);
-	write_selected_commits_v1(f, index, index_nr);
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		CALLOC_ARRAY(offsets, writer.selected_nr);
+
+	write_selected_commits_v1(f, index, index_nr, offsets);
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f, offsets);
 
-	if (options & BITMAP_OPT_HASH_CACHE)
+	if (options & (BITMAP_OPT_HASH_CACHE | BITMAP_OPT_HASH_CACHE_V2))
 		write_hash_cache(f, index, index_nr);
 
 	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
@@ -696,5 +910,6 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	if (rename(tmp_file.buf, filename))
 		die_errno("unable to rename temporary bitmap file to '%s'", filename);
 
+	free(offsets);
 	strbuf_release(&tmp_file);
 }
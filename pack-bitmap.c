@@ -14,6 +14,7 @@
 #include "object-store.h"
 #include "list-objects-filter-options.h"
 #include "config.h"
+#include "midx.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -35,8 +36,14 @@ struct stored_bitmap {
  * the active bitmap index is the largest one.
  */
 struct bitmap_index {
-	/* Packfile to which this bitmap index belongs to */
+	/*
+	 * The packfile or multi-pack index (MIDX) to which this bitmap
+	 * index belongs. Only one of these is set; for a MIDX, bit
+	 * positions follow the MIDX's pseudo-pack order (see
+	 * Documentation/technical/pack-format.txt).
+	 */
 	struct packed_git *pack;
+	struct multi_pack_index *midx;
 
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
@@ -68,8 +75,18 @@ struct bitmap_index {
 	/* Number of bitmapped commits */
 	uint32_t entry_count;
 
-	/* If not NULL, this is a name-hash cache pointing into map. */
+	/*
+	 * If not NULL, this is a name-hash cache pointing into map, filled
+	 * in with the function of "name_hash_version" (see pack-objects.h).
+	 */
 	uint32_t *hashes;
+	int name_hash_version;
+
+	/*
+	 * If not NULL, this is the commit lookup table pointing into map;
+	 * commit bitmaps are then only read when they are asked for.
+	 */
+	const unsigned char *table_lookup;
 
 	/*
 	 * Extended index.
@@ -95,6 +112,13 @@ struct bitmap_index {
 	unsigned int version;
 };
 
+static uint32_t bitmap_num_objects(struct bitmap_index *index)
+{
+	if (index->midx)
+		return index->midx->num_objects;
+	return index->pack->num_objects;
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
@@ -154,19 +178,30 @@ static int load_bitmap_header(struct bitmap_index *index)
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
-		size_t cache_size = st_mult(index->pack->num_objects, sizeof(uint32_t));
+		size_t cache_size = st_mult(bitmap_num_objects(index), sizeof(uint32_t));
 		unsigned char *index_end = index->map + index->map_size - the_hash_algo->rawsz;
 
 		if ((flags & BITMAP_OPT_FULL_DAG) == 0)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
-		if (flags & BITMAP_OPT_HASH_CACHE) {
+		if (flags & (BITMAP_OPT_HASH_CACHE | BITMAP_OPT_HASH_CACHE_V2)) {
 			if (cache_size > index_end - index->map - header_size)
 				return error("corrupted bitmap index file (too short to fit hash cache)");
 			index->hashes = (void *)(index_end - cache_size);
 			index_end -= cache_size;
 		}
+		index->name_hash_version =
+			(flags & BITMAP_OPT_HASH_CACHE_V2) ? 2 : 1;
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			size_t table_size = st_mult(ntohl(header->entry_count),
+						    BITMAP_LOOKUP_TABLE_ROW_WIDTH);
+			if (table_size > index_end - index->map - header_size)
+				return error("corrupted bitmap index file (too short to fit lookup table)");
+			index->table_lookup = index_end - table_size;
+			index_end -= table_size;
+		}
 	}
 
 	index->entry_count = ntohl(header->entry_count);
@@ -216,6 +251,19 @@ static inline uint8_t read_u8(const unsigned char *buffer, size_t *pos)
 	return buffer[(*pos)++];
 }
 
+static int nth_bitmap_object_oid(struct bitmap_index *index,
+				 struct object_id *oid,
+				 uint32_t n)
+{
+	if (index->midx) {
+		if (n >= index->midx->num_objects)
+			return -1;
+		nth_midxed_object_oid(oid, index->midx, n);
+		return 0;
+	}
+	return nth_packed_object_id(oid, index->pack, n);
+}
+
 #define MAX_XOR_OFFSET 160
 
 static int load_bitmap_entries_v1(struct bitmap_index *index)
@@ -237,7 +285,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		if (nth_packed_object_id(&oid, index->pack, commit_idx_pos) < 0)
+		if (nth_bitmap_object_oid(index, &oid, commit_idx_pos) < 0)
 			return error("corrupt ewah bitmap: commit index %u out of range",
 				     (unsigned)commit_idx_pos);
 
@@ -271,6 +319,58 @@ static char *pack_bitmap_filename(struct packed_git *p)
 	return xstrfmt("%.*s.bitmap", (int)len, p->pack_name);
 }
 
+static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
+			      struct multi_pack_index *midx)
+{
+	struct bitmap_disk_header *header;
+	struct stat st;
+	char *bitmap_name;
+	int fd;
+
+	bitmap_name = get_midx_bitmap_filename(midx);
+	fd = git_open(bitmap_name);
+	free(bitmap_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	if (bitmap_git->pack || bitmap_git->midx) {
+		warning("ignoring extra bitmap file for multi-pack index in %s",
+			midx->object_dir);
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git->midx = midx;
+	bitmap_git->map_size = xsize_t(st.st_size);
+	bitmap_git->map = xmmap(NULL, bitmap_git->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git->map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(bitmap_git) < 0)
+		goto cleanup;
+
+	header = (struct bitmap_disk_header *)bitmap_git->map;
+	if (!hasheq(get_midx_checksum(midx), header->checksum)) {
+		error("checksum doesn't match in MIDX and bitmap");
+		goto cleanup;
+	}
+
+	return 0;
+
+cleanup:
+	munmap(bitmap_git->map, bitmap_git->map_size);
+	bitmap_git->map = NULL;
+	bitmap_git->map_size = 0;
+	bitmap_git->midx = NULL;
+	return -1;
+}
+
 static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git *packfile)
 {
 	int fd;
@@ -292,7 +392,7 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 		return -1;
 	}
 
-	if (bitmap_git->pack) {
+	if (bitmap_git->pack || bitmap_git->midx) {
 		warning("ignoring extra bitmap file: %s", packfile->pack_name);
 		close(fd);
 		return -1;
@@ -314,13 +414,24 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 	return 0;
 }
 
-static int load_pack_bitmap(struct bitmap_index *bitmap_git)
+static int load_bitmap(struct bitmap_index *bitmap_git)
 {
 	assert(bitmap_git->map);
 
 	bitmap_git->bitmaps = kh_init_oid_map();
 	bitmap_git->ext_index.positions = kh_init_oid_pos();
-	if (load_pack_revindex(bitmap_git->pack))
+	if (bitmap_git->midx) {
+		uint32_t i;
+
+		if (load_midx_revindex(bitmap_git->midx)) {
+			warning("multi-pack bitmap is missing required reverse index");
+			goto failed;
+		}
+		for (i = 0; i < bitmap_git->midx->num_packs; i++) {
+			if (prepare_midx_pack(the_repository, bitmap_git->midx, i))
+				goto failed;
+		}
+	} else if (load_pack_revindex(bitmap_git->pack))
 		goto failed;
 
 	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
@@ -329,7 +440,8 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(bitmap_git) < 0)
+	if (!bitmap_git->table_lookup &&
+	    load_bitmap_entries_v1(bitmap_git) < 0)
 		goto failed;
 
 	return 0;
@@ -364,11 +476,37 @@ static int open_pack_bitmap(struct repository *r,
 	return ret;
 }
 
+static int open_midx_bitmap(struct repository *r,
+			    struct bitmap_index *bitmap_git)
+{
+	struct multi_pack_index *midx;
+
+	assert(!bitmap_git->map);
+
+	for (midx = get_multi_pack_index(r); midx; midx = midx->next) {
+		if (!open_midx_bitmap_1(bitmap_git, midx))
+			return 0;
+	}
+	return -1;
+}
+
+/*
+ * A MIDX bitmap covers all of the packs in the MIDX, so prefer it over
+ * the bitmap of a single pack when both exist.
+ */
+static int open_bitmap(struct repository *r,
+		       struct bitmap_index *bitmap_git)
+{
+	if (!open_midx_bitmap(r, bitmap_git))
+		return 0;
+	return open_pack_bitmap(r, bitmap_git);
+}
+
 struct bitmap_index *prepare_bitmap_git(struct repository *r)
 {
 	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 
-	if (!open_pack_bitmap(r, bitmap_git) && !load_pack_bitmap(bitmap_git))
+	if (!open_bitmap(r, bitmap_git) && !load_bitmap(bitmap_git))
 		return bitmap_git;
 
 	free_bitmap_index(bitmap_git);
@@ -381,14 +519,149 @@ struct include_data {
 	struct bitmap *seen;
 };
 
+static inline const unsigned char *lookup_table_row(struct bitmap_index *index,
+						     uint32_t row)
+{
+	return index->table_lookup + st_mult(row, BITMAP_LOOKUP_TABLE_ROW_WIDTH);
+}
+
+/*
+ * Find the row of the lookup table for the commit at index position
+ * "commit_pos", or return -1 if it was not bitmapped.
+ */
+static int lookup_table_find_row(struct bitmap_index *index,
+				 uint32_t commit_pos, uint32_t *row)
+{
+	uint32_t lo = 0, hi = index->entry_count;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t pos = get_be32(lookup_table_row(index, mi));
+
+		if (pos == commit_pos) {
+			*row = mi;
+			return 0;
+		}
+		if (pos < commit_pos)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -1;
+}
+
+/*
+ * Read the bitmap in the given row of the lookup table, along with the
+ * not yet loaded part of its XOR chain, and store them.
+ */
+static struct stored_bitmap *lazy_bitmap_for_row(struct bitmap_index *index,
+						 uint32_t row)
+{
+	struct stored_bitmap *xor_bitmap = NULL;
+	uint32_t *chain = NULL;
+	size_t chain_nr = 0, chain_alloc = 0;
+
+	for (;;) {
+		const unsigned char *p = lookup_table_row(index, row);
+		uint32_t xor_row = get_be32(p + 12);
+		struct object_id oid;
+		khiter_t hash_pos;
+
+		if (nth_bitmap_object_oid(index, &oid, get_be32(p)) < 0) {
+			error("corrupt lookup table: commit index %u out of range",
+			      (unsigned)get_be32(p));
+			goto fail;
+		}
+		hash_pos = kh_get_oid_map(index->bitmaps, oid);
+		if (hash_pos < kh_end(index->bitmaps)) {
+			xor_bitmap = kh_value(index->bitmaps, hash_pos);
+			break;
+		}
+
+		if (chain_nr >= index->entry_count) {
+			error("corrupt lookup table: XOR chain too long");
+			goto fail;
+		}
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = row;
+
+		if (xor_row == BITMAP_LOOKUP_NO_XOR)
+			break;
+		if (xor_row >= index->entry_count) {
+			error("corrupt lookup table: XOR row %u out of range",
+			      (unsigned)xor_row);
+			goto fail;
+		}
+		row = xor_row;
+	}
+
+	while (chain_nr) {
+		const unsigned char *p = lookup_table_row(index, chain[--chain_nr]);
+		uint32_t commit_pos = get_be32(p);
+		uint64_t offset = get_be64(p + 4);
+		struct ewah_bitmap *bitmap;
+		struct object_id oid;
+		int flags;
+
+		if (offset > index->map_size - 6 ||
+		    get_be32(index->map + offset) != commit_pos) {
+			error("corrupt lookup table: bad offset for commit index %u",
+			      (unsigned)commit_pos);
+			goto fail;
+		}
+		nth_bitmap_object_oid(index, &oid, commit_pos);
+
+		index->map_pos = offset + 5;
+		flags = read_u8(index->map, &index->map_pos);
+		bitmap = read_bitmap_1(index);
+		if (!bitmap)
+			goto fail;
+
+		xor_bitmap = store_bitmap(index, bitmap, &oid, xor_bitmap, flags);
+		if (!xor_bitmap)
+			goto fail;
+	}
+
+	free(chain);
+	return xor_bitmap;
+
+fail:
+	free(chain);
+	return NULL;
+}
+
+static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *index,
+						    struct commit *commit)
+{
+	uint32_t commit_pos, row;
+	int found;
+
+	if (index->midx)
+		found = bsearch_midx(&commit->object.oid, index->midx, &commit_pos);
+	else
+		found = bsearch_pack(&commit->object.oid, index->pack, &commit_pos);
+	if (!found || lookup_table_find_row(index, commit_pos, &row) < 0)
+		return NULL;
+
+	return lazy_bitmap_for_row(index, row);
+}
+
 struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
 				      struct commit *commit)
 {
+	struct stored_bitmap *stored;
 	khiter_t hash_pos = kh_get_oid_map(bitmap_git->bitmaps,
 					   commit->object.oid);
-	if (hash_pos >= kh_end(bitmap_git->bitmaps))
+	if (hash_pos < kh_end(bitmap_git->bitmaps))
+		stored = kh_value(bitmap_git->bitmaps, hash_pos);
+	else if (bitmap_git->table_lookup)
+		stored = lazy_bitmap_for_commit(bitmap_git, commit);
+	else
+		stored = NULL;
+
+	if (!stored)
 		return NULL;
-	return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+	return lookup_stored_bitmap(stored);
 }
 
 static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
@@ -399,7 +672,7 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git->pack->num_objects;
+		return bitmap_pos + bitmap_num_objects(bitmap_git);
 	}
 
 	return -1;
@@ -418,10 +691,28 @@ static inline int bitmap_position_packfile(struct bitmap_index *bitmap_git,
 	return pos;
 }
 
+static inline int bitmap_position_midx(struct bitmap_index *bitmap_git,
+				       const struct object_id *oid)
+{
+	uint32_t want, got;
+
+	if (!bsearch_midx(oid, bitmap_git->midx, &want))
+		return -1;
+
+	if (midx_to_pack_pos(bitmap_git->midx, want, &got) < 0)
+		return -1;
+	return got;
+}
+
 static int bitmap_position(struct bitmap_index *bitmap_git,
 			   const struct object_id *oid)
 {
-	int pos = bitmap_position_packfile(bitmap_git, oid);
+	int pos;
+
+	if (bitmap_git->midx)
+		pos = bitmap_position_midx(bitmap_git, oid);
+	else
+		pos = bitmap_position_packfile(bitmap_git, oid);
 	return (pos >= 0) ? pos : bitmap_position_extended(bitmap_git, oid);
 }
 
@@ -444,14 +735,18 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 
 		bitmap_pos = eindex->count;
 		eindex->objects[eindex->count] = object;
-		eindex->hashes[eindex->count] = pack_name_hash(name);
+		/* match the hashes we hand out for bitmapped objects */
+		if (bitmap_git->name_hash_version == 2)
+			eindex->hashes[eindex->count] = pack_full_name_hash(name);
+		else
+			eindex->hashes[eindex->count] = pack_name_hash(name);
 		kh_value(eindex->positions, hash_pos) = bitmap_pos;
 		eindex->count++;
 	} else {
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git->pack->num_objects;
+	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -650,7 +945,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git->pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -663,10 +958,49 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	}
 }
 
-static void init_type_iterator(struct ewah_iterator *it,
+/*
+ * Iterates over the words of a type bitmap like an ewah_iterator, but
+ * skips over runs of empty words without expanding them one by one.
+ */
+struct type_iterator {
+	struct ewah_iterator it;
+	eword_t word;
+	size_t left; /* words of "word" left in the current run */
+};
+
+/*
+ * Yield the next non-empty word of the type bitmap. On entry, "*pos" is
+ * the position of the next word to look at; it is advanced past any
+ * empty words that were skipped, so that on return it is the position
+ * of the word stored in "*next".
+ */
+static int type_iterator_next(eword_t *next, size_t *pos,
+			      struct type_iterator *t)
+{
+	for (;;) {
+		if (!t->left &&
+		    !ewah_iterator_next_run(&t->word, &t->left, &t->it))
+			return 0;
+		if (t->word)
+			break;
+		*pos += t->left;
+		t->left = 0;
+	}
+
+	t->left--;
+	*next = t->word;
+	return 1;
+}
+
+static void init_type_iterator(struct type_iterator *t,
 			       struct bitmap_index *bitmap_git,
 			       enum object_type type)
 {
+	struct ewah_iterator *it = &t->it;
+
+	t->word = 0;
+	t->left = 0;
+
 	switch (type) {
 	case OBJ_COMMIT:
 		ewah_iterator_init(it, bitmap_git->commits);
@@ -698,15 +1032,15 @@ static void show_objects_for_type(
 	size_t i = 0;
 	uint32_t offset;
 
-	struct ewah_iterator it;
+	struct type_iterator it;
 	eword_t filter;
 
 	struct bitmap *objects = bitmap_git->result;
 
 	init_type_iterator(&it, bitmap_git, object_type);
 
-	for (i = 0; i < objects->word_alloc &&
-			ewah_iterator_next(&filter, &it); i++) {
+	for (i = 0; type_iterator_next(&filter, &i, &it) &&
+			i < objects->word_alloc; i++) {
 		eword_t word = objects->words[i] & filter;
 		size_t pos = (i * BITS_IN_EWORD);
 
@@ -714,6 +1048,7 @@ static void show_objects_for_type(
 			continue;
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			struct packed_git *pack;
 			struct object_id oid;
 			uint32_t hash = 0, index_pos;
 			off_t ofs;
@@ -723,14 +1058,24 @@ static void show_objects_for_type(
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			index_pos = pack_pos_to_index(bitmap_git->pack, pos + offset);
-			ofs = pack_pos_to_offset(bitmap_git->pack, pos + offset);
-			nth_packed_object_id(&oid, bitmap_git->pack, index_pos);
+			if (bitmap_git->midx) {
+				struct multi_pack_index *m = bitmap_git->midx;
+
+				index_pos = pack_pos_to_midx(m, pos + offset);
+				ofs = nth_midxed_offset(m, index_pos);
+				nth_midxed_object_oid(&oid, m, index_pos);
+				pack = m->packs[nth_midxed_pack_int_id(m, index_pos)];
+			} else {
+				pack = bitmap_git->pack;
+				index_pos = pack_pos_to_index(pack, pos + offset);
+				ofs = pack_pos_to_offset(pack, pos + offset);
+				nth_packed_object_id(&oid, pack, index_pos);
+			}
 
 			if (bitmap_git->hashes)
 				hash = get_be32(bitmap_git->hashes + index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git->pack, ofs);
+			show_reach(&oid, object_type, 0, hash, pack, ofs);
 		}
 	}
 }
@@ -742,7 +1087,11 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
+		if (bitmap_git->midx) {
+			uint32_t pos;
+			if (bsearch_midx(&object->oid, bitmap_git->midx, &pos))
+				return 1;
+		} else if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
 			return 1;
 	}
 
@@ -772,33 +1121,29 @@ static struct bitmap *find_tip_objects(struct bitmap_index *bitmap_git,
 	return result;
 }
 
-static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
-				       struct object_list *tip_objects,
-				       struct bitmap *to_filter,
-				       enum object_type type)
+/*
+ * Remove every object of the given type from "to_filter", except for
+ * those that are set in "keep".
+ */
+static void filter_bitmap_exclude_type_except(struct bitmap_index *bitmap_git,
+					      struct bitmap *keep,
+					      struct bitmap *to_filter,
+					      enum object_type type)
 {
 	struct eindex *eindex = &bitmap_git->ext_index;
-	struct bitmap *tips;
-	struct ewah_iterator it;
+	struct type_iterator it;
 	eword_t mask;
-	uint32_t i;
-
-	/*
-	 * The non-bitmap version of this filter never removes
-	 * objects which the other side specifically asked for,
-	 * so we must match that behavior.
-	 */
-	tips = find_tip_objects(bitmap_git, tip_objects, type);
+	size_t i;
 
 	/*
 	 * We can use the blob type-bitmap to work in whole words
 	 * for the objects that are actually in the bitmapped packfile.
 	 */
 	for (i = 0, init_type_iterator(&it, bitmap_git, type);
-	     i < to_filter->word_alloc && ewah_iterator_next(&mask, &it);
+	     type_iterator_next(&mask, &i, &it) && i < to_filter->word_alloc;
 	     i++) {
-		if (i < tips->word_alloc)
-			mask &= ~tips->words[i];
+		if (i < keep->word_alloc)
+			mask &= ~keep->words[i];
 		to_filter->words[i] &= ~mask;
 	}
 
@@ -808,13 +1153,28 @@ static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
 	 * individually.
 	 */
 	for (i = 0; i < eindex->count; i++) {
-		uint32_t pos = i + bitmap_git->pack->num_objects;
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
 		if (eindex->objects[i]->type == type &&
 		    bitmap_get(to_filter, pos) &&
-		    !bitmap_get(tips, pos))
+		    !bitmap_get(keep, pos))
 			bitmap_unset(to_filter, pos);
 	}
+}
 
+static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
+				       struct object_list *tip_objects,
+				       struct bitmap *to_filter,
+				       enum object_type type)
+{
+	struct bitmap *tips;
+
+	/*
+	 * The non-bitmap version of this filter never removes
+	 * objects which the other side specifically asked for,
+	 * so we must match that behavior.
+	 */
+	tips = find_tip_objects(bitmap_git, tip_objects, type);
+	filter_bitmap_exclude_type_except(bitmap_git, tips, to_filter, type);
 	bitmap_free(tips);
 }
 
@@ -829,23 +1189,34 @@ static void filter_bitmap_blob_none(struct bitmap_index *bitmap_git,
 static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
 				     uint32_t pos)
 {
-	struct packed_git *pack = bitmap_git->pack;
 	unsigned long size;
 	struct object_info oi = OBJECT_INFO_INIT;
 
 	oi.sizep = &size;
 
-	if (pos < pack->num_objects) {
-		off_t ofs = pack_pos_to_offset(pack, pos);
+	if (pos < bitmap_num_objects(bitmap_git)) {
+		struct packed_git *pack;
+		off_t ofs;
+
+		if (bitmap_git->midx) {
+			struct multi_pack_index *m = bitmap_git->midx;
+			uint32_t midx_pos = pack_pos_to_midx(m, pos);
+
+			pack = m->packs[nth_midxed_pack_int_id(m, midx_pos)];
+			ofs = nth_midxed_offset(m, midx_pos);
+		} else {
+			pack = bitmap_git->pack;
+			ofs = pack_pos_to_offset(pack, pos);
+		}
+
 		if (packed_object_info(the_repository, pack, ofs, &oi) < 0) {
 			struct object_id oid;
-			nth_packed_object_id(&oid, pack,
-					     pack_pos_to_index(pack, pos));
+			bitmap_position_to_oid(bitmap_git, pos, &oid);
 			die(_("unable to get size of %s"), oid_to_hex(&oid));
 		}
 	} else {
 		struct eindex *eindex = &bitmap_git->ext_index;
-		struct object *obj = eindex->objects[pos - pack->num_objects];
+		struct object *obj = eindex->objects[pos - bitmap_num_objects(bitmap_git)];
 		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
 			die(_("unable to get size of %s"), oid_to_hex(&obj->oid));
 	}
@@ -860,14 +1231,14 @@ static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
 {
 	struct eindex *eindex = &bitmap_git->ext_index;
 	struct bitmap *tips;
-	struct ewah_iterator it;
+	struct type_iterator it;
 	eword_t mask;
-	uint32_t i;
+	size_t i;
 
 	tips = find_tip_objects(bitmap_git, tip_objects, OBJ_BLOB);
 
 	for (i = 0, init_type_iterator(&it, bitmap_git, OBJ_BLOB);
-	     i < to_filter->word_alloc && ewah_iterator_next(&mask, &it);
+	     type_iterator_next(&mask, &i, &it) && i < to_filter->word_alloc;
 	     i++) {
 		eword_t word = to_filter->words[i] & mask;
 		unsigned offset;
@@ -887,7 +1258,7 @@ static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
 	}
 
 	for (i = 0; i < eindex->count; i++) {
-		uint32_t pos = i + bitmap_git->pack->num_objects;
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
 		if (eindex->objects[i]->type == OBJ_BLOB &&
 		    bitmap_get(to_filter, pos) &&
 		    !bitmap_get(tips, pos) &&
@@ -898,13 +1269,195 @@ static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
 	bitmap_free(tips);
 }
 
+struct tree_level {
+	struct tree **trees;
+	size_t nr, alloc;
+};
+
+/*
+ * Queue "tree" to be looked at on the next level, unless it was already
+ * queued at this or a shallower depth, or is not in "to_filter" (in which
+ * case it was reachable from the "haves", and so is everything below it).
+ */
+static void tree_level_add(struct bitmap_index *bitmap_git,
+			   struct tree_level *level,
+			   struct bitmap *to_filter,
+			   struct bitmap *seen,
+			   struct tree *tree)
+{
+	int pos = bitmap_position(bitmap_git, &tree->object.oid);
+
+	if (pos < 0 || !bitmap_get(to_filter, pos) || bitmap_get(seen, pos))
+		return;
+	bitmap_set(seen, pos);
+
+	ALLOC_GROW(level->trees, level->nr + 1, level->alloc);
+	level->trees[level->nr++] = tree;
+}
+
+static void tree_level_add_commit(struct bitmap_index *bitmap_git,
+				  struct tree_level *level,
+				  struct bitmap *to_filter,
+				  struct bitmap *seen,
+				  uint32_t pos)
+{
+	struct object_id oid;
+	struct commit *commit;
+
+	bitmap_position_to_oid(bitmap_git, pos, &oid);
+	commit = lookup_commit(the_repository, &oid);
+	if (!commit || parse_commit(commit))
+		die(_("unable to parse commit %s"), oid_to_hex(&oid));
+	tree_level_add(bitmap_git, level, to_filter, seen,
+		       get_commit_tree(commit));
+}
+
+/*
+ * Mark the blobs in "tree" in "keep", and queue its subtrees onto "next".
+ */
+static void tree_level_add_entries(struct bitmap_index *bitmap_git,
+				   struct tree_level *next,
+				   struct bitmap *to_filter,
+				   struct bitmap *seen,
+				   struct bitmap *keep,
+				   struct tree *tree)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+
+	if (parse_tree(tree) < 0)
+		die(_("bad tree object %s"), oid_to_hex(&tree->object.oid));
+
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		int pos;
+
+		switch (object_type(entry.mode)) {
+		case OBJ_TREE:
+			tree_level_add(bitmap_git, next, to_filter, seen,
+				       lookup_tree(the_repository, &entry.oid));
+			break;
+		case OBJ_BLOB:
+			pos = bitmap_position(bitmap_git, &entry.oid);
+			if (pos >= 0)
+				bitmap_set(keep, pos);
+			break;
+		default:
+			/* Gitlink, etc; not reachable */
+			break;
+		}
+	}
+
+	free_tree_buffer(tree);
+}
+
+/*
+ * Omit trees and blobs that are "limit" or more levels below the root
+ * tree of every commit in "to_filter". Only the top "limit" levels of
+ * trees are read, one level at a time, so that every tree is found at
+ * its shallowest depth first.
+ */
+static void filter_bitmap_tree_depth_limit(struct bitmap_index *bitmap_git,
+					   struct object_list *tip_objects,
+					   struct bitmap *to_filter,
+					   unsigned long limit)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct tree_level level = { 0 }, next = { 0 };
+	struct bitmap *keep, *seen;
+	struct object_list *p;
+	struct type_iterator it;
+	unsigned long depth;
+	eword_t mask;
+	size_t i;
+
+	keep = find_tip_objects(bitmap_git, tip_objects, OBJ_BLOB);
+	seen = bitmap_new();
+
+	/*
+	 * Like the non-bitmap traversal, a tree asked for by name is shown
+	 * without counting it as a level, so its entries are at depth 0.
+	 */
+	for (p = tip_objects; p; p = p->next) {
+		struct tree *tree;
+		int pos;
+
+		if (p->item->type != OBJ_TREE)
+			continue;
+		tree = (struct tree *)p->item;
+		pos = bitmap_position(bitmap_git, &tree->object.oid);
+		if (pos < 0 || bitmap_get(seen, pos))
+			continue;
+		bitmap_set(seen, pos);
+		bitmap_set(keep, pos);
+		tree_level_add_entries(bitmap_git, &level, to_filter, seen,
+				       keep, tree);
+	}
+
+	for (i = 0, init_type_iterator(&it, bitmap_git, OBJ_COMMIT);
+	     type_iterator_next(&mask, &i, &it) && i < to_filter->word_alloc;
+	     i++) {
+		eword_t word = to_filter->words[i] & mask;
+		unsigned offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+			tree_level_add_commit(bitmap_git, &level, to_filter,
+					      seen, i * BITS_IN_EWORD + offset);
+		}
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
+		if (eindex->objects[i]->type == OBJ_COMMIT &&
+		    bitmap_get(to_filter, pos))
+			tree_level_add_commit(bitmap_git, &level, to_filter,
+					      seen, pos);
+	}
+
+	for (depth = 0; level.nr; depth++) {
+		struct tree_level tmp;
+
+		for (i = 0; i < level.nr; i++) {
+			struct tree *tree = level.trees[i];
+
+			bitmap_set(keep, bitmap_position(bitmap_git,
+							 &tree->object.oid));
+
+			/* its entries are at depth + 1 */
+			if (depth + 1 < limit)
+				tree_level_add_entries(bitmap_git, &next,
+						       to_filter, seen, keep,
+						       tree);
+		}
+
+		tmp = level;
+		level = next;
+		next = tmp;
+		next.nr = 0;
+	}
+
+	filter_bitmap_exclude_type_except(bitmap_git, keep, to_filter, OBJ_TREE);
+	filter_bitmap_exclude_type_except(bitmap_git, keep, to_filter, OBJ_BLOB);
+
+	free(level.trees);
+	free(next.trees);
+	bitmap_free(keep);
+	bitmap_free(seen);
+}
+
 static void filter_bitmap_tree_depth(struct bitmap_index *bitmap_git,
 				     struct object_list *tip_objects,
 				     struct bitmap *to_filter,
 				     unsigned long limit)
 {
-	if (limit)
-		BUG("filter_bitmap_tree_depth given non-zero limit");
+	if (limit) {
+		filter_bitmap_tree_depth_limit(bitmap_git, tip_objects,
+					       to_filter, limit);
+		return;
+	}
 
 	filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
 				   OBJ_TREE);
@@ -953,8 +1506,7 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 		return 0;
 	}
 
-	if (filter->choice == LOFC_TREE_DEPTH &&
-	    filter->tree_exclude_depth == 0) {
+	if (filter->choice == LOFC_TREE_DEPTH) {
 		if (bitmap_git)
 			filter_bitmap_tree_depth(bitmap_git, tip_objects,
 						 to_filter,
@@ -1017,7 +1569,7 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	/* try to open a bitmapped pack, but don't parse it yet
 	 * because we may not need to use it */
 	CALLOC_ARRAY(bitmap_git, 1);
-	if (open_pack_bitmap(revs->repo, bitmap_git) < 0)
+	if (open_bitmap(revs->repo, bitmap_git) < 0)
 		goto cleanup;
 
 	for (i = 0; i < revs->pending.nr; ++i) {
@@ -1061,7 +1613,7 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	 * from disk. this is the point of no return; after this the rev_list
 	 * becomes invalidated and we must perform the revwalk through bitmaps
 	 */
-	if (load_pack_bitmap(bitmap_git) < 0)
+	if (load_bitmap(bitmap_git) < 0)
 		goto cleanup;
 
 	object_array_clear(&revs->pending);
@@ -1104,7 +1656,14 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	return NULL;
 }
 
-static void try_partial_reuse(struct bitmap_index *bitmap_git,
+/*
+ * Check whether the object at bitmap position "pos" can be reused
+ * verbatim from "pack". For a MIDX bitmap, "pack" is the preferred pack,
+ * whose objects are all chosen by the MIDX and come first in its
+ * pseudo-pack order, so that their bitmap positions are also their
+ * positions in the pack.
+ */
+static void try_partial_reuse(struct packed_git *pack,
 			      size_t pos,
 			      struct bitmap *reuse,
 			      struct pack_window **w_curs)
@@ -1113,11 +1672,11 @@ static void try_partial_reuse(struct bitmap_index *bitmap_git,
 	enum object_type type;
 	unsigned long size;
 
-	if (pos >= bitmap_git->pack->num_objects)
+	if (pos >= pack->num_objects)
 		return; /* not actually in the pack */
 
-	offset = header = pack_pos_to_offset(bitmap_git->pack, pos);
-	type = unpack_object_header(bitmap_git->pack, w_curs, &offset, &size);
+	offset = header = pack_pos_to_offset(pack, pos);
+	type = unpack_object_header(pack, w_curs, &offset, &size);
 	if (type < 0)
 		return; /* broken packfile, punt */
 
@@ -1133,11 +1692,11 @@ static void try_partial_reuse(struct bitmap_index *bitmap_git,
 		 * and the normal slow path will complain about it in
 		 * more detail.
 		 */
-		base_offset = get_delta_base(bitmap_git->pack, w_curs,
+		base_offset = get_delta_base(pack, w_curs,
 					     &offset, type, header);
 		if (!base_offset)
 			return;
-		if (offset_to_pack_pos(bitmap_git->pack, base_offset, &base_pos) < 0)
+		if (offset_to_pack_pos(pack, base_offset, &base_pos) < 0)
 			return;
 
 		/*
@@ -1170,12 +1729,26 @@ static void try_partial_reuse(struct bitmap_index *bitmap_git,
 	bitmap_set(reuse, pos);
 }
 
+static struct packed_git *midx_preferred_pack(struct bitmap_index *bitmap_git)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	struct packed_git *pack;
+
+	if (!m->num_objects)
+		return NULL;
+	pack = m->packs[nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0))];
+	if (open_pack_index(pack) || load_pack_revindex(pack))
+		return NULL;
+	return pack;
+}
+
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 				       struct packed_git **packfile_out,
 				       uint32_t *entries,
 				       struct bitmap **reuse_out)
 {
 	struct bitmap *result = bitmap_git->result;
+	struct packed_git *pack;
 	struct bitmap *reuse;
 	struct pack_window *w_curs = NULL;
 	size_t i = 0;
@@ -1183,12 +1756,19 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 
 	assert(result);
 
+	if (bitmap_git->midx)
+		pack = midx_preferred_pack(bitmap_git);
+	else
+		pack = bitmap_git->pack;
+	if (!pack)
+		return -1;
+
 	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
 		i++;
 
 	/* Don't mark objects not in the packfile */
-	if (i > bitmap_git->pack->num_objects / BITS_IN_EWORD)
-		i = bitmap_git->pack->num_objects / BITS_IN_EWORD;
+	if (i > pack->num_objects / BITS_IN_EWORD)
+		i = pack->num_objects / BITS_IN_EWORD;
 
 	reuse = bitmap_word_alloc(i);
 	memset(reuse->words, 0xFF, i * sizeof(eword_t));
@@ -1197,12 +1777,15 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 		eword_t word = result->words[i];
 		size_t pos = (i * BITS_IN_EWORD);
 
+		if (pos >= pack->num_objects)
+			break;
+
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			if ((word >> offset) == 0)
 				break;
 
 			offset += ewah_bit_ctz64(word >> offset);
-			try_partial_reuse(bitmap_git, pos + offset, reuse, &w_curs);
+			try_partial_reuse(pack, pos + offset, reuse, &w_curs);
 		}
 	}
 
@@ -1219,7 +1802,7 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	 * need to be handled separately.
 	 */
 	bitmap_and_not(result, reuse);
-	*packfile_out = bitmap_git->pack;
+	*packfile_out = pack;
 	*reuse_out = reuse;
 	return 0;
 }
@@ -1259,20 +1842,22 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 	struct bitmap *objects = bitmap_git->result;
 	struct eindex *eindex = &bitmap_git->ext_index;
 
-	uint32_t i = 0, count = 0;
-	struct ewah_iterator it;
+	uint32_t count = 0;
+	size_t i = 0;
+	struct type_iterator it;
 	eword_t filter;
 
 	init_type_iterator(&it, bitmap_git, type);
 
-	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i++] & filter;
+	for (i = 0; type_iterator_next(&filter, &i, &it) &&
+			i < objects->word_alloc; i++) {
+		eword_t word = objects->words[i] & filter;
 		count += ewah_bit_popcount64(word);
 	}
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git->pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			count++;
 	}
 
@@ -1399,6 +1984,15 @@ int test_bitmap_commits(struct repository *r)
 	if (!bitmap_git)
 		die("failed to load bitmap indexes");
 
+	if (bitmap_git->table_lookup) {
+		uint32_t i;
+
+		for (i = 0; i < bitmap_git->entry_count; i++) {
+			if (!lazy_bitmap_for_row(bitmap_git, i))
+				die("failed to load bitmap for row %u", (unsigned)i);
+		}
+	}
+
 	kh_foreach(bitmap_git->bitmaps, oid, value, {
 		printf("%s\n", oid_to_hex(&oid));
 	});
@@ -1408,33 +2002,61 @@ int test_bitmap_commits(struct repository *r)
 	return 0;
 }
 
+int test_bitmap_hashes(struct repository *r)
+{
+	struct bitmap_index *bitmap_git = prepare_bitmap_git(r);
+	struct object_id oid;
+	uint32_t i, num_objects;
+
+	if (!bitmap_git)
+		die("failed to load bitmap indexes");
+
+	num_objects = bitmap_num_objects(bitmap_git);
+	for (i = 0; bitmap_git->hashes && i < num_objects; i++) {
+		nth_bitmap_object_oid(bitmap_git, &oid, i);
+		printf("%s %"PRIu32"\n", oid_to_hex(&oid),
+		       get_be32(bitmap_git->hashes + i));
+	}
+
+	free_bitmap_index(bitmap_git);
+
+	return 0;
+}
+
 int rebuild_bitmap(const uint32_t *reposition,
 		   struct ewah_bitmap *source,
 		   struct bitmap *dest)
 {
-	uint32_t pos = 0;
+	size_t pos = 0, len;
 	struct ewah_iterator it;
 	eword_t word;
 
 	ewah_iterator_init(&it, source);
 
-	while (ewah_iterator_next(&word, &it)) {
+	while (ewah_iterator_next_run(&word, &len, &it)) {
 		uint32_t offset, bit_pos;
 
-		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
-			if ((word >> offset) == 0)
-				break;
+		if (!word) {
+			pos += st_mult(len, BITS_IN_EWORD);
+			continue;
+		}
 
-			offset += ewah_bit_ctz64(word >> offset);
+		for (; len; len--) {
+			for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+				if ((word >> offset) == 0)
+					break;
 
-			bit_pos = reposition[pos + offset];
-			if (bit_pos > 0)
-				bitmap_set(dest, bit_pos - 1);
-			else /* can't reuse, we don't have the object */
-				return -1;
-		}
+				offset += ewah_bit_ctz64(word >> offset);
 
-		pos += BITS_IN_EWORD;
+				bit_pos = reposition[pos + offset];
+				if (bit_pos > 0)
+					bitmap_set(dest, bit_pos - 1);
+				else /* can't reuse, we don't have the object */
+					return -1;
+			}
+
+			pos += BITS_IN_EWORD;
+		}
 	}
 	return 0;
 }
@@ -1445,15 +2067,14 @@ uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
 	uint32_t i, num_objects;
 	uint32_t *reposition;
 
-	num_objects = bitmap_git->pack->num_objects;
+	num_objects = bitmap_num_objects(bitmap_git);
 	CALLOC_ARRAY(reposition, num_objects);
 
 	for (i = 0; i < num_objects; ++i) {
 		struct object_id oid;
 		struct object_entry *oe;
 
-		nth_packed_object_id(&oid, bitmap_git->pack,
-				     pack_pos_to_index(bitmap_git->pack, i));
+		bitmap_position_to_oid(bitmap_git, i, &oid);
 		oe = packlist_find(mapping, &oid);
 
 		if (oe)
@@ -1489,19 +2110,76 @@ int bitmap_has_oid_in_uninteresting(struct bitmap_index *bitmap_git,
 		bitmap_walk_contains(bitmap_git, bitmap_git->haves, oid);
 }
 
+int bitmap_has_oid_in_result(struct bitmap_index *bitmap_git,
+			     const struct object_id *oid)
+{
+	return bitmap_git &&
+		bitmap_walk_contains(bitmap_git, bitmap_git->result, oid);
+}
+
+struct bitmap *bitmap_reachable_from(struct bitmap_index *bitmap_git,
+				     struct repository *r,
+				     struct object_list *tips)
+{
+	struct rev_info revs;
+	struct list_objects_filter_options no_filter;
+	struct bitmap *result;
+
+	repo_init_revisions(r, &revs, NULL);
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	revs.tag_objects = 1;
+	memset(&no_filter, 0, sizeof(no_filter));
+
+	result = find_objects(bitmap_git, &revs, tips, NULL, &no_filter);
+	reset_revision_walk();
+	object_array_clear(&revs.pending);
+
+	return result ? result : bitmap_new();
+}
+
+int bitmap_has_object(struct bitmap_index *bitmap_git,
+		      const struct object_id *oid)
+{
+	if (bitmap_git->midx)
+		return bitmap_position_midx(bitmap_git, oid) >= 0;
+	return bitmap_position_packfile(bitmap_git, oid) >= 0;
+}
+
+uint32_t bitmap_num_positions(struct bitmap_index *bitmap_git)
+{
+	return bitmap_num_objects(bitmap_git) + bitmap_git->ext_index.count;
+}
+
+void bitmap_position_to_oid(struct bitmap_index *bitmap_git, uint32_t pos,
+			    struct object_id *oid)
+{
+	uint32_t nr = bitmap_num_objects(bitmap_git);
+
+	if (pos < nr && bitmap_git->midx)
+		nth_midxed_object_oid(oid, bitmap_git->midx,
+				      pack_pos_to_midx(bitmap_git->midx, pos));
+	else if (pos < nr)
+		nth_packed_object_id(oid, bitmap_git->pack,
+				     pack_pos_to_index(bitmap_git->pack, pos));
+	else if (pos - nr < bitmap_git->ext_index.count)
+		oidcpy(oid, &bitmap_git->ext_index.objects[pos - nr]->oid);
+	else
+		BUG("bitmap position %"PRIu32" out of range", pos);
+}
+
 static off_t get_disk_usage_for_type(struct bitmap_index *bitmap_git,
 				     enum object_type object_type)
 {
 	struct bitmap *result = bitmap_git->result;
-	struct packed_git *pack = bitmap_git->pack;
 	off_t total = 0;
-	struct ewah_iterator it;
+	struct type_iterator it;
 	eword_t filter;
 	size_t i;
 
 	init_type_iterator(&it, bitmap_git, object_type);
-	for (i = 0; i < result->word_alloc &&
-			ewah_iterator_next(&filter, &it); i++) {
+	for (i = 0; type_iterator_next(&filter, &i, &it) &&
+			i < result->word_alloc; i++) {
 		eword_t word = result->words[i] & filter;
 		size_t base = (i * BITS_IN_EWORD);
 		unsigned offset;
@@ -1517,20 +2195,39 @@ static off_t get_disk_usage_for_type(struct bitmap_index *bitmap_git,
 
 			offset += ewah_bit_ctz64(word >> offset);
 			pos = base + offset;
-			total += pack_pos_to_offset(pack, pos + 1) -
-				 pack_pos_to_offset(pack, pos);
+
+			if (bitmap_git->midx) {
+				struct multi_pack_index *m = bitmap_git->midx;
+				uint32_t midx_pos = pack_pos_to_midx(m, pos);
+				struct packed_git *pack;
+				struct object_id oid;
+				uint32_t pack_pos;
+				off_t ofs;
+
+				pack = m->packs[nth_midxed_pack_int_id(m, midx_pos)];
+				ofs = nth_midxed_offset(m, midx_pos);
+				if (offset_to_pack_pos(pack, ofs, &pack_pos) < 0)
+					die(_("could not find %s in pack %s"),
+					    oid_to_hex(nth_midxed_object_oid(&oid, m, midx_pos)),
+					    pack->pack_name);
+				total += pack_pos_to_offset(pack, pack_pos + 1) - ofs;
+			} else {
+				struct packed_git *pack = bitmap_git->pack;
+
+				total += pack_pos_to_offset(pack, pos + 1) -
+					 pack_pos_to_offset(pack, pos);
+			}
 		}
 	}
 
 	return total;
 }
 
-static off_t get_disk_usage_for_extended(struct bitmap_index *bitmap_git)
+static void get_disk_usage_for_extended(struct bitmap_index *bitmap_git,
+					struct object_disk_usage *usage)
 {
 	struct bitmap *result = bitmap_git->result;
-	struct packed_git *pack = bitmap_git->pack;
 	struct eindex *eindex = &bitmap_git->ext_index;
-	off_t total = 0;
 	struct object_info oi = OBJECT_INFO_INIT;
 	off_t object_size;
 	size_t i;
@@ -1540,33 +2237,51 @@ static off_t get_disk_usage_for_extended(struct bitmap_index *bitmap_git)
 	for (i = 0; i < eindex->count; i++) {
 		struct object *obj = eindex->objects[i];
 
-		if (!bitmap_get(result, pack->num_objects + i))
+		if (!bitmap_get(result, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
 			die(_("unable to get disk usage of %s"),
 			    oid_to_hex(&obj->oid));
 
-		total += object_size;
+		if (obj->type <= OBJ_NONE || obj->type > OBJ_TAG)
+			BUG("unexpected type of %s in bitmap result",
+			    oid_to_hex(&obj->oid));
+		usage[obj->type].size += object_size;
 	}
-	return total;
+}
+
+void get_disk_usage_by_type_from_bitmap(struct bitmap_index *bitmap_git,
+					struct rev_info *revs,
+					struct object_disk_usage *usage)
+{
+	enum object_type type;
+
+	for (type = OBJ_COMMIT; type <= OBJ_TAG; type++) {
+		usage[type].count = 0;
+		usage[type].size = 0;
+		if ((type == OBJ_TREE && !revs->tree_objects) ||
+		    (type == OBJ_BLOB && !revs->blob_objects) ||
+		    (type == OBJ_TAG && !revs->tag_objects))
+			continue;
+		/* this counts the objects outside of the pack, too */
+		usage[type].count = count_object_type(bitmap_git, type);
+		usage[type].size = get_disk_usage_for_type(bitmap_git, type);
+	}
+
+	get_disk_usage_for_extended(bitmap_git, usage);
 }
 
 off_t get_disk_usage_from_bitmap(struct bitmap_index *bitmap_git,
 				 struct rev_info *revs)
 {
+	struct object_disk_usage usage[OBJ_TAG + 1];
+	enum object_type type;
 	off_t total = 0;
 
-	total += get_disk_usage_for_type(bitmap_git, OBJ_COMMIT);
-	if (revs->tree_objects)
-		total += get_disk_usage_for_type(bitmap_git, OBJ_TREE);
-	if (revs->blob_objects)
-		total += get_disk_usage_for_type(bitmap_git, OBJ_BLOB);
-	if (revs->tag_objects)
-		total += get_disk_usage_for_type(bitmap_git, OBJ_TAG);
-
-	total += get_disk_usage_for_extended(bitmap_git);
-
+	get_disk_usage_by_type_from_bitmap(bitmap_git, revs, usage);
+	for (type = OBJ_COMMIT; type <= OBJ_TAG; type++)
+		total += usage[type].size;
 	return total;
 }
 
@@ -1574,3 +2289,19 @@ const struct string_list *bitmap_preferred_tips(struct repository *r)
 {
 	return repo_config_get_value_multi(r, "pack.preferbitmaptips");
 }
+
+int bitmap_is_preferred_refname(struct repository *r, const char *refname)
+{
+	const struct string_list *preferred_tips = bitmap_preferred_tips(r);
+	struct string_list_item *item;
+
+	if (!preferred_tips)
+		return 0;
+
+	for_each_string_list_item(item, preferred_tips) {
+		if (starts_with(refname, item->string))
+			return 1;
+	}
+
+	return 0;
+}
@@ -8,6 +8,7 @@
 #include "string-list.h"
 
 struct commit;
+struct object_list;
 struct repository;
 struct rev_info;
 struct list_objects_filter_options;
@@ -27,8 +28,18 @@ struct bitmap_disk_header {
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
+	BITMAP_OPT_HASH_CACHE_V2 = 32,
 };
 
+/*
+ * Each row of the lookup table is a commit position (4 bytes), the offset
+ * of its entry in the bitmap file (8 bytes), and the row of its XOR base
+ * (4 bytes), or BITMAP_LOOKUP_NO_XOR.
+ */
+#define BITMAP_LOOKUP_TABLE_ROW_WIDTH 16
+#define BITMAP_LOOKUP_NO_XOR 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -51,6 +62,7 @@ void traverse_bitmap_commit_list(struct bitmap_index *,
 				 show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
 int test_bitmap_commits(struct repository *r);
+int test_bitmap_hashes(struct repository *r);
 struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 					 struct list_objects_filter_options *filter,
 					 int filter_provided_objects);
@@ -71,9 +83,51 @@ int bitmap_walk_contains(struct bitmap_index *,
  */
 int bitmap_has_oid_in_uninteresting(struct bitmap_index *, const struct object_id *oid);
 
+/*
+ * Likewise, but see if the object was reachable from the objects the
+ * walk wanted.
+ */
+int bitmap_has_oid_in_result(struct bitmap_index *, const struct object_id *oid);
+
+/*
+ * Return a bitmap of every object reachable from "tips", using the stored
+ * bitmaps where there are some and walking from the tips that are not
+ * covered by them. Objects found by the walk are appended to the extended
+ * index, so bitmap_num_positions() may grow with each call. The caller
+ * must free the result with bitmap_free().
+ */
+struct bitmap *bitmap_reachable_from(struct bitmap_index *,
+				     struct repository *r,
+				     struct object_list *tips);
+/*
+ * Return 1 if "oid" is in the pack (or multi-pack index) covered by the
+ * bitmaps. Bitmaps are only written when everything reachable from the
+ * objects in there is in there too, so such an object is known to be
+ * fully connected.
+ */
+int bitmap_has_object(struct bitmap_index *, const struct object_id *oid);
+uint32_t bitmap_num_positions(struct bitmap_index *);
+void bitmap_position_to_oid(struct bitmap_index *, uint32_t pos,
+			    struct object_id *oid);
+
 off_t get_disk_usage_from_bitmap(struct bitmap_index *, struct rev_info *);
 
+struct object_disk_usage {
+	uint32_t count;
+	off_t size;
+};
+
+/*
+ * Fill usage[OBJ_COMMIT] to usage[OBJ_TAG] with the number of objects
+ * of each type in the result of the bitmap walk and the bytes they use
+ * on disk, without looking at the packed objects themselves.
+ */
+void get_disk_usage_by_type_from_bitmap(struct bitmap_index *,
+					struct rev_info *,
+					struct object_disk_usage *usage);
+
 void bitmap_writer_show_progress(int show);
+void bitmap_writer_set_threads(int nr_threads);
 void bitmap_writer_set_checksum(unsigned char *sha1);
 void bitmap_writer_build_type_index(struct packing_data *to_pack,
 				    struct pack_idx_entry **index,
@@ -87,12 +141,13 @@ struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
 				      struct commit *commit);
 void bitmap_writer_select_commits(struct commit **indexed_commits,
 		unsigned int indexed_commits_nr, int max_bitmaps);
-void bitmap_writer_build(struct packing_data *to_pack);
+int bitmap_writer_build(struct packing_data *to_pack);
 void bitmap_writer_finish(struct pack_idx_entry **index,
 			  uint32_t index_nr,
 			  const char *filename,
 			  uint16_t options);
 
 const struct string_list *bitmap_preferred_tips(struct repository *r);
+int bitmap_is_preferred_refname(struct repository *r, const char *refname);
 
 #endif
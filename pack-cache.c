@@ -0,0 +1,180 @@
+#include "cache.h"
+#include "config.h"
+#include "pack-cache.h"
+#include "repository.h"
+#include "tempfile.h"
+#include "trace2.h"
+
+#define TMP_PREFIX "tmp_pack_"
+
+int pack_cache_init(struct pack_cache *cache, struct repository *r)
+{
+	int enabled = 0;
+
+	if (repo_config_get_bool(r, "uploadpack.packcache", &enabled) ||
+	    !enabled)
+		return -1;
+
+	cache->repo = r;
+	cache->dir = repo_git_path(r, "pack-cache");
+	cache->max_size = 1024 * 1024 * 1024;
+	cache->max_age = 3600;
+	repo_config_get_ulong(r, "uploadpack.packcachesize", &cache->max_size);
+	repo_config_get_ulong(r, "uploadpack.packcachemaxage", &cache->max_age);
+	return 0;
+}
+
+void pack_cache_release(struct pack_cache *cache)
+{
+	FREE_AND_NULL(cache->dir);
+}
+
+static int is_expired(struct pack_cache *cache, const struct stat *st)
+{
+	time_t now = time(NULL);
+
+	return now > st->st_mtime &&
+	       (unsigned long)(now - st->st_mtime) > cache->max_age;
+}
+
+static char *cached_pack_path(struct pack_cache *cache,
+			      const struct object_id *key)
+{
+	return xstrfmt("%s/%s.pack", cache->dir, oid_to_hex(key));
+}
+
+int pack_cache_open(struct pack_cache *cache, const struct object_id *key)
+{
+	char *path = cached_pack_path(cache, key);
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd >= 0 && (fstat(fd, &st) || is_expired(cache, &st))) {
+		close(fd);
+		fd = -1;
+	}
+	/* Keep the pack from being evicted before others that are unused. */
+	if (fd >= 0)
+		utime(path, NULL);
+
+	free(path);
+	return fd;
+}
+
+struct tempfile *pack_cache_create(struct pack_cache *cache)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct tempfile *tmp = NULL;
+
+	if (mkdir(cache->dir, 0777) && errno != EEXIST)
+		return NULL;
+	if (adjust_shared_perm(cache->dir))
+		return NULL;
+
+	strbuf_addf(&path, "%s/" TMP_PREFIX "XXXXXX", cache->dir);
+	tmp = mks_tempfile_m(path.buf, 0444);
+	if (tmp && adjust_shared_perm(get_tempfile_path(tmp)))
+		delete_tempfile(&tmp);
+
+	strbuf_release(&path);
+	return tmp;
+}
+
+struct cached_pack {
+	char *path;
+	off_t size;
+	time_t mtime;
+};
+
+static int compare_recently_used(const void *va, const void *vb)
+{
+	const struct cached_pack *a = va, *b = vb;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+	return strcmp(a->path, b->path);
+}
+
+static void evict(struct pack_cache *cache)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct cached_pack *packs = NULL;
+	size_t nr = 0, alloc = 0, i, baselen;
+	uintmax_t total = 0;
+	intmax_t evicted = 0;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(cache->dir);
+	if (!dir)
+		return;
+
+	strbuf_addf(&path, "%s/", cache->dir);
+	baselen = path.len;
+	while ((de = readdir(dir))) {
+		int in_progress = starts_with(de->d_name, TMP_PREFIX);
+		struct stat st;
+
+		if (!in_progress && !ends_with(de->d_name, ".pack"))
+			continue;
+
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		if (lstat(path.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+
+		/*
+		 * A temporary file this old was left behind by an
+		 * upload-pack that died.
+		 */
+		if (is_expired(cache, &st)) {
+			if (!unlink(path.buf))
+				evicted++;
+			continue;
+		}
+		if (in_progress)
+			continue;
+
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].path = xstrdup(path.buf);
+		packs[nr].size = st.st_size;
+		packs[nr].mtime = st.st_mtime;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(packs, nr, compare_recently_used);
+	for (i = 0; i < nr; i++) {
+		total += packs[i].size;
+		if (total > cache->max_size && !unlink(packs[i].path))
+			evicted++;
+		free(packs[i].path);
+	}
+
+	if (evicted)
+		trace2_data_intmax("pack-cache", cache->repo, "evicted",
+				   evicted);
+
+	free(packs);
+	strbuf_release(&path);
+}
+
+void pack_cache_store(struct pack_cache *cache, struct tempfile **tmp,
+		      const struct object_id *key)
+{
+	struct stat st;
+
+	if (fstat(get_tempfile_fd(*tmp), &st) ||
+	    (uintmax_t)st.st_size > cache->max_size) {
+		delete_tempfile(tmp);
+	} else {
+		char *path = cached_pack_path(cache, key);
+
+		/* The cache is best effort; the client already has its pack. */
+		rename_tempfile(tmp, path);
+		free(path);
+	}
+
+	evict(cache);
+}
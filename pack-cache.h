@@ -0,0 +1,56 @@
+#ifndef PACK_CACHE_H
+#define PACK_CACHE_H
+
+#include "hash.h"
+
+struct repository;
+struct tempfile;
+
+/*
+ * A directory of packs that upload-pack has sent before, named after a
+ * hash of everything that went into making them, so that an identical
+ * request can be answered without running pack-objects again.
+ */
+struct pack_cache {
+	struct repository *repo;
+	char *dir;
+
+	/* The most the cached packs may take up together, in bytes. */
+	unsigned long max_size;
+
+	/* How long a pack is kept after it was last sent, in seconds. */
+	unsigned long max_age;
+};
+
+/*
+ * Set up `cache` for the repository `r`. Return 0 if
+ * `uploadpack.packCache` is enabled, or -1 if it is not, in which case
+ * `cache` must not be used.
+ */
+int pack_cache_init(struct pack_cache *cache, struct repository *r);
+
+void pack_cache_release(struct pack_cache *cache);
+
+/*
+ * Open the pack stored under `key` for reading and mark it as recently
+ * used. Return the file descriptor, or -1 if there is no such pack or
+ * it has expired.
+ */
+int pack_cache_open(struct pack_cache *cache, const struct object_id *key);
+
+/*
+ * Create a temporary file in the cache directory for a pack to be
+ * written into, or return NULL if that is not possible.
+ */
+struct tempfile *pack_cache_create(struct pack_cache *cache);
+
+/*
+ * Move the pack written to `*tmp` into place as `key`, or throw it away
+ * if it is larger than the cache may hold. `*tmp` is released either
+ * way. Then evict the least recently used packs until the cache fits
+ * into `max_size` again.
+ */
+void pack_cache_store(struct pack_cache *cache, struct tempfile **tmp,
+		      const struct object_id *key);
+
+#endif /* PACK_CACHE_H */
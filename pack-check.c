@@ -5,6 +5,8 @@
 #include "progress.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "csum-file.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -44,18 +46,250 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+struct verify_result {
+	struct object_id oid;
+	enum object_type type;
+	unsigned long size;
+	void *data;
+	unsigned crc_mismatch : 1,
+		 unpack_failed : 1,
+		 corrupt : 1,
+		 done : 1;
+};
+
+/*
+ * Check the object at entries[i] against the pack index: its CRC, that
+ * it can be unpacked and that it hashes to its name. The unpacked data
+ * is left in "res" for report_object(). This does not touch any state
+ * but the object store's, so it can run in several threads at once.
+ */
+static void check_object(struct repository *r, struct packed_git *p,
+			 struct pack_window **w_curs,
+			 const struct idx_entry *entries, uint32_t i,
+			 struct verify_result *res)
+{
+	off_t curpos;
+	int data_valid;
+
+	memset(res, 0, sizeof(*res));
+
+	obj_read_lock();
+	if (nth_packed_object_id(&res->oid, p, entries[i].nr) < 0)
+		BUG("unable to get oid of object %lu from %s",
+		    (unsigned long)entries[i].nr, p->pack_name);
+
+	if (p->index_version > 1) {
+		off_t offset = entries[i].offset;
+		off_t len = entries[i+1].offset - offset;
+		unsigned int nr = entries[i].nr;
+		if (check_pack_crc(p, w_curs, offset, len, nr))
+			res->crc_mismatch = 1;
+	}
+
+	curpos = entries[i].offset;
+	res->type = unpack_object_header(p, w_curs, &curpos, &res->size);
+	unuse_pack(w_curs);
+
+	if (res->type == OBJ_BLOB && big_file_threshold <= res->size) {
+		/*
+		 * Let check_object_signature() check it with
+		 * the streaming interface; no point slurping
+		 * the data in-core only to discard.
+		 */
+		res->data = NULL;
+		data_valid = 0;
+	} else {
+		res->data = unpack_entry(r, p, entries[i].offset,
+					 &res->type, &res->size);
+		data_valid = 1;
+	}
+
+	if (data_valid && !res->data) {
+		res->unpack_failed = 1;
+		obj_read_unlock();
+		return;
+	}
+	/* Streaming reads the object store; hashing a buffer does not. */
+	if (data_valid)
+		obj_read_unlock();
+	if (check_object_signature(r, &res->oid, res->data, res->size,
+				   type_name(res->type)))
+		res->corrupt = 1;
+	if (!data_valid)
+		obj_read_unlock();
+}
+
+/*
+ * Report the problems check_object() found with entries[i] and hand the
+ * object to "fn". This is always called in pack order, from one thread.
+ */
+static int report_object(struct repository *r, struct packed_git *p,
+			 const struct idx_entry *entries, uint32_t i,
+			 struct verify_result *res, verify_fn fn)
+{
+	int err = 0;
+
+	if (res->crc_mismatch)
+		err = error("index CRC mismatch for object %s "
+			    "from %s at offset %"PRIuMAX"",
+			    oid_to_hex(&res->oid),
+			    p->pack_name, (uintmax_t)entries[i].offset);
+
+	if (res->unpack_failed)
+		err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+			    oid_to_hex(&res->oid), p->pack_name,
+			    (uintmax_t)entries[i].offset);
+	else if (res->corrupt)
+		err = error("packed %s from %s is corrupt",
+			    oid_to_hex(&res->oid), p->pack_name);
+	else if (fn) {
+		int eaten = 0;
+
+		obj_read_lock();
+		err |= fn(&res->oid, res->type, res->size, res->data, &eaten);
+		obj_read_unlock();
+		if (eaten)
+			res->data = NULL;
+	}
+	FREE_AND_NULL(res->data);
+	return err;
+}
+
+/*
+ * Inflating and hashing the objects of a large pack dominates the cost of
+ * verifying it, so spread check_object() over several threads. Each takes
+ * the next object in pack order; the results go through a ring of
+ * VERIFY_WINDOW slots per thread, which the calling thread drains in order
+ * with report_object(), so that "fn" sees the objects in the same order
+ * and from the same thread as without threads.
+ */
+#define VERIFY_OBJECTS_PER_THREAD 256
+#define VERIFY_WINDOW 64
+
+struct verify_parallel {
+	struct repository *r;
+	struct packed_git *p;
+	const struct idx_entry *entries;
+	uint32_t nr_objects;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct verify_result *ring;
+	uint32_t ring_size;
+	uint32_t next;
+	uint32_t reported;
+};
+
+static void *verify_thread_proc(void *data)
+{
+	struct verify_parallel *v = data;
+	struct pack_window *w_curs = NULL;
+
+	pthread_mutex_lock(&v->mutex);
+	for (;;) {
+		struct verify_result res;
+		uint32_t i;
+
+		while (v->next < v->nr_objects &&
+		       v->next - v->reported >= v->ring_size)
+			pthread_cond_wait(&v->work_cond, &v->mutex);
+		if (v->next >= v->nr_objects)
+			break;
+		i = v->next++;
+		pthread_mutex_unlock(&v->mutex);
+
+		check_object(v->r, v->p, &w_curs, v->entries, i, &res);
+		res.done = 1;
+
+		pthread_mutex_lock(&v->mutex);
+		v->ring[i % v->ring_size] = res;
+		pthread_cond_signal(&v->done_cond);
+	}
+	pthread_mutex_unlock(&v->mutex);
+
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return NULL;
+}
+
+static int verify_objects_parallel(struct repository *r, struct packed_git *p,
+				   const struct idx_entry *entries,
+				   verify_fn fn, struct progress *progress,
+				   uint32_t base_count, int nr_threads)
+{
+	struct verify_parallel v = {
+		.r = r,
+		.p = p,
+		.entries = entries,
+		.nr_objects = p->num_objects,
+	};
+	pthread_t *threads;
+	uint32_t i;
+	int t, err = 0;
+
+	v.ring_size = nr_threads * VERIFY_WINDOW;
+	CALLOC_ARRAY(v.ring, v.ring_size);
+	pthread_mutex_init(&v.mutex, NULL);
+	pthread_cond_init(&v.work_cond, NULL);
+	pthread_cond_init(&v.done_cond, NULL);
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		int ret = pthread_create(&threads[t], NULL, verify_thread_proc,
+					 &v);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+
+	for (i = 0; i < v.nr_objects; i++) {
+		struct verify_result *slot = &v.ring[i % v.ring_size];
+		struct verify_result res;
+
+		pthread_mutex_lock(&v.mutex);
+		while (!slot->done)
+			pthread_cond_wait(&v.done_cond, &v.mutex);
+		res = *slot;
+		slot->done = 0;
+		v.reported++;
+		pthread_cond_signal(&v.work_cond);
+		pthread_mutex_unlock(&v.mutex);
+
+		err |= report_object(r, p, entries, i, &res, fn);
+		if (((base_count + i) & 1023) == 0)
+			display_progress(progress, base_count + i);
+	}
+
+	for (t = 0; t < nr_threads; t++) {
+		int ret = pthread_join(threads[t], NULL);
+		if (ret)
+			die(_("unable to join thread: %s"), strerror(ret));
+	}
+	free(threads);
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&v.done_cond);
+	pthread_cond_destroy(&v.work_cond);
+	pthread_mutex_destroy(&v.mutex);
+	free(v.ring);
+	return err;
+}
+
 static int verify_packfile(struct repository *r,
 			   struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
 	off_t index_size = p->index_size;
 	const unsigned char *index_base = p->index_data;
 	git_hash_ctx ctx;
-	unsigned char hash[GIT_MAX_RAWSZ], *pack_sig;
-	off_t offset = 0, pack_sig_ofs = 0;
+	unsigned char hash[GIT_MAX_RAWSZ], pack_sig[GIT_MAX_RAWSZ];
+	off_t offset = 0, pack_sig_ofs;
 	uint32_t nr_objects, i;
 	int err = 0;
 	struct idx_entry *entries;
@@ -63,22 +297,26 @@ static int verify_packfile(struct repository *r,
 	if (!is_pack_valid(p))
 		return error("packfile %s cannot be accessed", p->pack_name);
 
-	r->hash_algo->init_fn(&ctx);
-	do {
-		unsigned long remaining;
-		unsigned char *in = use_pack(p, w_curs, offset, &remaining);
-		offset += remaining;
-		if (!pack_sig_ofs)
-			pack_sig_ofs = p->pack_size - r->hash_algo->rawsz;
-		if (offset > pack_sig_ofs)
-			remaining -= (unsigned int)(offset - pack_sig_ofs);
-		r->hash_algo->update_fn(&ctx, in, remaining);
-	} while (offset < pack_sig_ofs);
-	r->hash_algo->final_fn(hash, &ctx);
-	pack_sig = use_pack(p, w_curs, pack_sig_ofs, NULL);
-	if (!hasheq(hash, pack_sig))
-		err = error("%s pack checksum mismatch",
-			    p->pack_name);
+	pack_sig_ofs = p->pack_size - r->hash_algo->rawsz;
+	hashcpy(pack_sig, use_pack(p, w_curs, pack_sig_ofs, NULL));
+	unuse_pack(w_curs);
+	if (!hashfile_checksum_trusted(p->pack_name, pack_sig)) {
+		r->hash_algo->init_fn(&ctx);
+		do {
+			unsigned long remaining;
+			unsigned char *in = use_pack(p, w_curs, offset, &remaining);
+			offset += remaining;
+			if (offset > pack_sig_ofs)
+				remaining -= (unsigned int)(offset - pack_sig_ofs);
+			r->hash_algo->update_fn(&ctx, in, remaining);
+		} while (offset < pack_sig_ofs);
+		r->hash_algo->final_fn(hash, &ctx);
+		if (!hasheq(hash, pack_sig))
+			err = error("%s pack checksum mismatch",
+				    p->pack_name);
+		else
+			hashfile_checksum_trust(p->pack_name, pack_sig);
+	}
 	if (!hasheq(index_base + index_size - r->hash_algo->hexsz, pack_sig))
 		err = error("%s pack checksum does not match its index",
 			    p->pack_name);
@@ -98,65 +336,23 @@ static int verify_packfile(struct repository *r,
 	}
 	QSORT(entries, nr_objects, compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		struct object_id oid;
-		enum object_type type;
-		unsigned long size;
-		off_t curpos;
-		int data_valid;
-
-		if (nth_packed_object_id(&oid, p, entries[i].nr) < 0)
-			BUG("unable to get oid of object %lu from %s",
-			    (unsigned long)entries[i].nr, p->pack_name);
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    oid_to_hex(&oid),
-					    p->pack_name, (uintmax_t)offset);
-		}
-
-		curpos = entries[i].offset;
-		type = unpack_object_header(p, w_curs, &curpos, &size);
-		unuse_pack(w_curs);
-
-		if (type == OBJ_BLOB && big_file_threshold <= size) {
-			/*
-			 * Let check_object_signature() check it with
-			 * the streaming interface; no point slurping
-			 * the data in-core only to discard.
-			 */
-			data = NULL;
-			data_valid = 0;
-		} else {
-			data = unpack_entry(r, p, entries[i].offset, &type, &size);
-			data_valid = 1;
-		}
+	if (HAVE_THREADS && nr_threads > 1 &&
+	    nr_objects >= 2 * VERIFY_OBJECTS_PER_THREAD) {
+		if (nr_threads > nr_objects / VERIFY_OBJECTS_PER_THREAD)
+			nr_threads = nr_objects / VERIFY_OBJECTS_PER_THREAD;
+		err |= verify_objects_parallel(r, p, entries, fn, progress,
+					       base_count, nr_threads);
+	} else {
+		for (i = 0; i < nr_objects; i++) {
+			struct verify_result res;
 
-		if (data_valid && !data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    oid_to_hex(&oid), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (check_object_signature(r, &oid, data, size, type_name(type)))
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(&oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
+			check_object(r, p, w_curs, entries, i, &res);
+			err |= report_object(r, p, entries, i, &res, fn);
+			if (((base_count + i) & 1023) == 0)
+				display_progress(progress, base_count + i);
 		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
-
 	}
-	display_progress(progress, base_count + i);
+	display_progress(progress, base_count + nr_objects);
 	free(entries);
 
 	return err;
@@ -164,29 +360,26 @@ static int verify_packfile(struct repository *r,
 
 int verify_pack_index(struct packed_git *p)
 {
+	char *idx_name;
 	size_t len;
-	const unsigned char *index_base;
-	git_hash_ctx ctx;
-	unsigned char hash[GIT_MAX_RAWSZ];
 	int err = 0;
 
 	if (open_pack_index(p))
 		return error("packfile %s index not opened", p->pack_name);
-	index_base = p->index_data;
-	len = p->index_size - the_hash_algo->rawsz;
 
 	/* Verify SHA1 sum of the index file */
-	the_hash_algo->init_fn(&ctx);
-	the_hash_algo->update_fn(&ctx, index_base, len);
-	the_hash_algo->final_fn(hash, &ctx);
-	if (!hasheq(hash, index_base + len))
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	idx_name = xstrfmt("%.*s.idx", (int)len, p->pack_name);
+	if (!hashfile_checksum_valid(idx_name, p->index_data, p->index_size))
 		err = error("Packfile index for %s hash mismatch",
 			    p->pack_name);
+	free(idx_name);
 	return err;
 }
 
 int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count, int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -195,7 +388,8 @@ int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count,
+			       nr_threads);
 	unuse_pack(&w_curs);
 
 	return err;
@@ -0,0 +1,176 @@
+#include "cache.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "pack-geometry.h"
+
+static uint32_t geometry_pack_weight(struct packed_git *p)
+{
+	if (open_pack_index(p))
+		die(_("cannot open index for %s"), p->pack_name);
+	return p->num_objects;
+}
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	uint32_t aw = geometry_pack_weight(*(struct packed_git **)va),
+		 bw = geometry_pack_weight(*(struct packed_git **)vb);
+
+	if (aw < bw)
+		return -1;
+	if (aw > bw)
+		return 1;
+	return 0;
+}
+
+void init_pack_geometry(struct pack_geometry *geometry, struct repository *r,
+			int pack_kept_objects)
+{
+	struct packed_git *p;
+
+	memset(geometry, 0, sizeof(*geometry));
+	for (p = get_all_packs(r); p; p = p->next) {
+		if (!pack_kept_objects && p->pack_keep)
+			continue;
+		/*
+		 * Rolling up a cruft pack would give its unreachable
+		 * objects the mtime of the new pack.
+		 */
+		if (p->is_cruft)
+			continue;
+
+		ALLOC_GROW(geometry->pack,
+			   geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+
+		geometry->pack[geometry->pack_nr] = p;
+		geometry->pack_nr++;
+	}
+
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+}
+
+static void find_pack_geometry_split(struct pack_geometry *geometry, int factor)
+{
+	uint32_t i;
+	uint32_t split;
+	off_t total_size = 0;
+
+	if (!geometry->pack_nr) {
+		geometry->split = geometry->pack_nr;
+		return;
+	}
+
+	/*
+	 * First, count the number of packs (in descending order of size) which
+	 * already form a geometric progression.
+	 */
+	for (i = geometry->pack_nr - 1; i > 0; i--) {
+		struct packed_git *ours = geometry->pack[i];
+		struct packed_git *prev = geometry->pack[i - 1];
+
+		if (unsigned_mult_overflows(factor, geometry_pack_weight(prev)))
+			die(_("pack %s too large to consider in geometric "
+			      "progression"),
+			    prev->pack_name);
+
+		if (geometry_pack_weight(ours) < factor * geometry_pack_weight(prev))
+			break;
+	}
+
+	split = i;
+
+	if (split) {
+		/*
+		 * Move the split one to the right, since the top element in the
+		 * last-compared pair can't be in the progression. Only do this
+		 * when we split in the middle of the array (otherwise if we got
+		 * to the end, then the split is in the right place).
+		 */
+		split++;
+	}
+
+	/*
+	 * Then, anything to the left of 'split' must be in a new pack. But,
+	 * creating that new pack may cause packs in the heavy half to no longer
+	 * form a geometric progression.
+	 *
+	 * Compute an expected size of the new pack, and then determine how many
+	 * packs in the heavy half need to be joined into it (if any) to restore
+	 * the geometric progression.
+	 */
+	for (i = 0; i < split; i++) {
+		struct packed_git *p = geometry->pack[i];
+
+		if (unsigned_add_overflows(total_size, geometry_pack_weight(p)))
+			die(_("pack %s too large to roll up"), p->pack_name);
+		total_size += geometry_pack_weight(p);
+	}
+	for (i = split; i < geometry->pack_nr; i++) {
+		struct packed_git *ours = geometry->pack[i];
+
+		if (unsigned_mult_overflows(factor, total_size))
+			die(_("pack %s too large to roll up"), ours->pack_name);
+
+		if (geometry_pack_weight(ours) < factor * total_size) {
+			if (unsigned_add_overflows(total_size,
+						   geometry_pack_weight(ours)))
+				die(_("pack %s too large to roll up"),
+				    ours->pack_name);
+
+			split++;
+			total_size += geometry_pack_weight(ours);
+		} else
+			break;
+	}
+
+	geometry->split = split;
+}
+
+/*
+ * Bound the work of one run: roll up only as many of the smallest
+ * packs as fit into "max_objects".  The progression may be left
+ * unfinished; the next run picks up where this one stopped.
+ */
+static void limit_pack_geometry(struct pack_geometry *geometry,
+				unsigned long max_objects)
+{
+	uint64_t total = 0;
+	uint32_t i;
+
+	for (i = 0; i < geometry->split; i++) {
+		total += geometry_pack_weight(geometry->pack[i]);
+		if (total > max_objects)
+			break;
+	}
+	/* rolling up a single pack would only rewrite it */
+	geometry->split = i < 2 ? 0 : i;
+}
+
+void split_pack_geometry(struct pack_geometry *geometry, int factor,
+			 unsigned long max_objects)
+{
+	find_pack_geometry_split(geometry, factor);
+	if (max_objects)
+		limit_pack_geometry(geometry, max_objects);
+}
+
+void clear_pack_geometry(struct pack_geometry *geometry)
+{
+	if (!geometry)
+		return;
+
+	free(geometry->pack);
+	geometry->pack_nr = 0;
+	geometry->pack_alloc = 0;
+	geometry->split = 0;
+}
+
+int pack_kept_objects_default(int write_bitmaps, int geometric)
+{
+	/*
+	 * A single-pack bitmap needs every object in that pack. A
+	 * geometric repack writes its bitmap through the multi-pack-index
+	 * instead, which covers the kept packs as they are.
+	 */
+	return write_bitmaps > 0 && !geometric;
+}
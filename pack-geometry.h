@@ -0,0 +1,45 @@
+#ifndef PACK_GEOMETRY_H
+#define PACK_GEOMETRY_H
+
+struct packed_git;
+struct repository;
+
+/*
+ * The packs of a repository, sorted by their number of objects, and
+ * where "git repack --geometric" splits them: the packs before `split`
+ * are to be rolled up into one, so that the result and the packs after
+ * `split` form a geometric progression.
+ */
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	uint32_t split;
+};
+
+/*
+ * Collect the packs of `r`, leaving out cruft packs, and kept packs
+ * unless `pack_kept_objects` is set.
+ */
+void init_pack_geometry(struct pack_geometry *geometry, struct repository *r,
+			int pack_kept_objects);
+
+/*
+ * Find the split that restores a geometric progression with the given
+ * factor. With a non-zero `max_objects`, only as many of the smallest
+ * packs are rolled up as fit into that many objects, which may leave
+ * the progression for a later run to finish. The split is either 0,
+ * when there is nothing to roll up, or at least 2.
+ */
+void split_pack_geometry(struct pack_geometry *geometry, int factor,
+			 unsigned long max_objects);
+
+void clear_pack_geometry(struct pack_geometry *geometry);
+
+/*
+ * The default of repack.packKeptObjects for a repack that writes a
+ * pack bitmap if `write_bitmaps` is positive, and is geometric if
+ * `geometric` is set.
+ */
+int pack_kept_objects_default(int write_bitmaps, int geometric);
+
+#endif /* PACK_GEOMETRY_H */
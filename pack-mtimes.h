@@ -0,0 +1,30 @@
+#ifndef PACK_MTIMES_H
+#define PACK_MTIMES_H
+
+#include "git-compat-util.h"
+
+#define MTIMES_SIGNATURE 0x4d544d45 /* "MTME" */
+#define MTIMES_VERSION 1
+
+struct packed_git;
+
+/*
+ * Loads the .mtimes file corresponding to "p", if any, returning zero
+ * on success.
+ */
+int load_pack_mtimes(struct packed_git *p);
+
+/* Returns the object's mtime, given its index position in "p". */
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos);
+
+/*
+ * Returns the mtime of the object at index position "pos" in "p": the
+ * recorded one if "p" is a cruft pack, or that of the pack itself.
+ * Dies if the .mtimes file of a cruft pack cannot be loaded.
+ */
+timestamp_t packed_object_mtime(struct packed_git *p, uint32_t pos);
+
+/* Returns the filename of the .mtimes file belonging to "p". */
+char *pack_mtimes_filename(struct packed_git *p);
+
+#endif
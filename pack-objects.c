@@ -130,6 +130,103 @@ void oe_map_new_pack(struct packing_data *pack)
 	FREE_AND_NULL(pack->in_pack_by_idx);
 }
 
+struct spill_map {
+	void *map;
+	size_t size;
+	int fd;
+};
+
+struct packing_spill {
+	struct spill_map *maps;
+	size_t nr, alloc;
+};
+
+int packing_data_spill(struct packing_data *pdata)
+{
+#ifdef NO_MMAP
+	return -1;
+#else
+	if (pdata->nr_alloc)
+		BUG("packing_data_spill() called after packlist_alloc()");
+	if (!pdata->spill)
+		CALLOC_ARRAY(pdata->spill, 1);
+	return 0;
+#endif
+}
+
+/*
+ * Return NULL if no spill file can be created, e.g. in a repository
+ * that is served read-only.
+ */
+static struct spill_map *new_spill_map(struct packing_spill *spill)
+{
+	struct strbuf tmpname = STRBUF_INIT;
+	struct spill_map *m;
+	int fd;
+
+	git_path_buf(&tmpname, "objects/pack/tmp_spill_XXXXXX");
+	fd = git_mkstemp_mode(tmpname.buf, 0600);
+	if (fd < 0) {
+		strbuf_release(&tmpname);
+		return NULL;
+	}
+	/* nobody else needs to see it; any leftover is cleaned up by prune */
+	unlink(tmpname.buf);
+	strbuf_release(&tmpname);
+
+	ALLOC_GROW(spill->maps, spill->nr + 1, spill->alloc);
+	m = &spill->maps[spill->nr++];
+	m->map = NULL;
+	m->size = 0;
+	m->fd = fd;
+	return m;
+}
+
+static struct spill_map *find_spill_map(struct packing_data *pdata, void *p)
+{
+	size_t i;
+
+	for (i = 0; p && i < pdata->spill->nr; i++)
+		if (pdata->spill->maps[i].map == p)
+			return &pdata->spill->maps[i];
+	return NULL;
+}
+
+/*
+ * Resize an array that may be spilled to disk. Unlike xrealloc(), any
+ * new space of a spilled array is zero'd. An array whose spill file
+ * cannot be created stays on the heap.
+ */
+static void *realloc_cold(struct packing_data *pdata, void *p, size_t size)
+{
+	struct spill_map *m;
+
+	if (!pdata->spill)
+		return xrealloc(p, size);
+
+	m = find_spill_map(pdata, p);
+	if (!m && !p)
+		m = new_spill_map(pdata->spill);
+	if (!m)
+		return xrealloc(p, size);
+
+	if (ftruncate(m->fd, size) < 0)
+		die_errno(_("unable to grow spill file to %"PRIuMAX" bytes"),
+			  (uintmax_t)size);
+	if (m->map)
+		munmap(m->map, m->size);
+	m->map = xmmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+	m->size = size;
+	return m->map;
+}
+
+void prepare_in_pack_pos(struct packing_data *pdata)
+{
+	pdata->in_pack_pos = realloc_cold(pdata, pdata->in_pack_pos,
+					  st_mult(sizeof(*pdata->in_pack_pos),
+						  pdata->nr_alloc));
+}
+
 /* assume pdata is already zero'd by caller */
 void prepare_packing_data(struct repository *r, struct packing_data *pdata)
 {
@@ -151,6 +248,46 @@ void prepare_packing_data(struct repository *r, struct packing_data *pdata)
 	init_recursive_mutex(&pdata->odb_lock);
 }
 
+static void free_cold(struct packing_data *pdata, void *p)
+{
+	/* spilled arrays are unmapped along with their files */
+	if (!pdata->spill || !find_spill_map(pdata, p))
+		free(p);
+}
+
+void clear_packing_data(struct packing_data *pdata)
+{
+	free(pdata->objects);
+	free(pdata->index);
+	free_cold(pdata, pdata->in_pack_pos);
+	free_cold(pdata, pdata->name_hash);
+	free_cold(pdata, pdata->delta_sibling);
+	free(pdata->delta_size);
+	free(pdata->cruft_mtime);
+	free(pdata->in_pack_by_idx);
+	free(pdata->in_pack);
+	free(pdata->ext_bases);
+	free(pdata->tree_depth);
+	free(pdata->layer);
+
+	if (pdata->spill) {
+		size_t i;
+
+		for (i = 0; i < pdata->spill->nr; i++) {
+			struct spill_map *m = &pdata->spill->maps[i];
+
+			if (m->map)
+				munmap(m->map, m->size);
+			close(m->fd);
+		}
+		free(pdata->spill->maps);
+		free(pdata->spill);
+	}
+
+	pthread_mutex_destroy(&pdata->odb_lock);
+	memset(pdata, 0, sizeof(*pdata));
+}
+
 struct object_entry *packlist_alloc(struct packing_data *pdata,
 				    const struct object_id *oid)
 {
@@ -162,6 +299,15 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 
 		if (!pdata->in_pack_by_idx)
 			REALLOC_ARRAY(pdata->in_pack, pdata->nr_alloc);
+
+		pdata->name_hash = realloc_cold(pdata, pdata->name_hash,
+						st_mult(sizeof(*pdata->name_hash),
+							pdata->nr_alloc));
+		pdata->delta_sibling = realloc_cold(pdata, pdata->delta_sibling,
+						    st_mult(sizeof(*pdata->delta_sibling),
+							    pdata->nr_alloc));
+		if (pdata->in_pack_pos)
+			prepare_in_pack_pos(pdata);
 		if (pdata->delta_size)
 			REALLOC_ARRAY(pdata->delta_size, pdata->nr_alloc);
 
@@ -170,6 +316,9 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 
 		if (pdata->layer)
 			REALLOC_ARRAY(pdata->layer, pdata->nr_alloc);
+
+		if (pdata->cruft_mtime)
+			REALLOC_ARRAY(pdata->cruft_mtime, pdata->nr_alloc);
 	}
 
 	new_entry = pdata->objects + pdata->nr_objects++;
@@ -192,12 +341,18 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 	if (pdata->in_pack)
 		pdata->in_pack[pdata->nr_objects - 1] = NULL;
 
+	pdata->name_hash[pdata->nr_objects - 1] = 0;
+	pdata->delta_sibling[pdata->nr_objects - 1] = 0;
+
 	if (pdata->tree_depth)
 		pdata->tree_depth[pdata->nr_objects - 1] = 0;
 
 	if (pdata->layer)
 		pdata->layer[pdata->nr_objects - 1] = 0;
 
+	if (pdata->cruft_mtime)
+		pdata->cruft_mtime[pdata->nr_objects - 1] = 0;
+
 	return new_entry;
 }
 
@@ -52,9 +52,9 @@ enum dfs_state {
  * delta is reused, "size" is the uncompressed _delta_ size, not the
  * canonical one after the delta has been applied.
  *
- * "hash" contains a path name hash which is used for sorting the
- * delta list and also during delta searching. Once prepare_pack()
- * returns it's no longer needed.
+ * The path name hash, used for sorting the delta list and for the
+ * bitmap hash cache, is not stored here but in the name_hash[] array
+ * of struct packing_data; see oe_name_hash().
  *
  * source pack info
  * ----------------
@@ -73,7 +73,10 @@ enum dfs_state {
  *
  * delta_child and delta_sibling are last needed in
  * compute_write_order(). "delta" and "delta_size" must remain valid
- * at object writing phase in case the delta is not cached.
+ * at object writing phase in case the delta is not cached. Like the
+ * name hash, delta_sibling lives in a separate array of struct
+ * packing_data: it is only ever set for objects in the packing list
+ * (never for external bases) and is rarely looked at.
  *
  * If a delta is cached in memory and is compressed, delta_data points
  * to the data and z_delta_size contains the compressed size. If it's
@@ -88,14 +91,10 @@ struct object_entry {
 	struct pack_idx_entry idx;
 	void *delta_data;	/* cached delta (uncompressed) */
 	off_t in_pack_offset;
-	uint32_t hash;			/* name hint hash */
 	unsigned size_:OE_SIZE_BITS;
 	unsigned size_valid:1;
 	uint32_t delta_idx;	/* delta base object */
 	uint32_t delta_child_idx; /* deltified objects who bases me */
-	uint32_t delta_sibling_idx; /* other deltified objects who
-				     * uses the same base as me
-				     */
 	unsigned delta_size_:OE_DELTA_SIZE_BITS; /* delta data size (uncompressed) */
 	unsigned delta_size_valid:1;
 	unsigned char in_pack_header_size;
@@ -120,11 +119,11 @@ struct object_entry {
 	/*
 	 * pahole results on 64-bit linux (gcc and clang)
 	 *
-	 *   size: 80, bit_padding: 9 bits
+	 *   size: 88, bit_padding: 8 bits, padding: 4 bytes
 	 *
 	 * and on 32-bit (gcc)
 	 *
-	 *   size: 76, bit_padding: 9 bits
+	 *   size: 84, bit_padding: 8 bits
 	 */
 };
 
@@ -139,6 +138,26 @@ struct packing_data {
 	unsigned int *in_pack_pos;
 	unsigned long *delta_size;
 
+	/*
+	 * Cold per-object fields kept out of struct object_entry, in
+	 * arrays indexed like in_pack_pos[]: the name hash, and the
+	 * delta_sibling link (index + 1, or 0).
+	 */
+	uint32_t *name_hash;
+	uint32_t *delta_sibling;
+
+	/* for cruft packs, the mtime of each object; allocated on demand */
+	uint32_t *cruft_mtime;
+
+	/*
+	 * If non-NULL, name_hash[], delta_sibling[] and in_pack_pos[]
+	 * are not allocated on the heap but mapped from unlinked
+	 * temporary files in the object directory, so that the kernel
+	 * can write them out under memory pressure; see
+	 * packing_data_spill().
+	 */
+	struct packing_spill *spill;
+
 	/*
 	 * Only one of these can be non-NULL and they have different
 	 * sizes. if in_pack_by_idx is allocated, oe_in_pack() returns
@@ -172,6 +191,19 @@ struct packing_data {
 
 void prepare_packing_data(struct repository *r, struct packing_data *pdata);
 
+/* Release everything prepare_packing_data() and packlist_alloc() allocated. */
+void clear_packing_data(struct packing_data *pdata);
+
+/*
+ * Keep the cold per-object arrays of "pdata" in memory-mapped
+ * temporary files rather than on the heap. Must be called before the
+ * first packlist_alloc(). Returns -1 if this platform cannot do that.
+ */
+int packing_data_spill(struct packing_data *pdata);
+
+/* Allocate in_pack_pos[] for all objects currently in "pdata". */
+void prepare_in_pack_pos(struct packing_data *pdata);
+
 /* Protect access to object database */
 static inline void packing_data_lock(struct packing_data *pdata)
 {
@@ -208,6 +240,34 @@ static inline uint32_t pack_name_hash(const char *name)
 	return hash;
 }
 
+/*
+ * Like pack_name_hash(), but the directories leading up to the last
+ * path component are mixed into the low bits, so that unrelated files
+ * with the same name ("Makefile", "index.js") stop sharing a hash
+ * while all versions of one path still do. The top bits still come
+ * from the last component alone, which keeps similarly named files
+ * sorting close together.
+ */
+static inline uint32_t pack_full_name_hash(const char *name)
+{
+	uint32_t c, hash = 0, base = 0;
+
+	if (!name)
+		return 0;
+
+	while ((c = *name++) != 0) {
+		if (isspace(c))
+			continue;
+		if (c == '/') {
+			base = (base >> 6) ^ hash;
+			hash = 0;
+			continue;
+		}
+		hash = (hash >> 2) + (c << 24);
+	}
+	return (base >> 6) ^ hash;
+}
+
 static inline enum object_type oe_type(const struct object_entry *e)
 {
 	return e->type_valid ? e->type_ : OBJ_BAD;
@@ -223,6 +283,36 @@ static inline void oe_set_type(struct object_entry *e,
 	e->type_ = (unsigned)type;
 }
 
+static inline uint32_t oe_name_hash(const struct packing_data *pack,
+				    const struct object_entry *e)
+{
+	return pack->name_hash[e - pack->objects];
+}
+
+static inline void oe_set_name_hash(struct packing_data *pack,
+				    const struct object_entry *e,
+				    uint32_t hash)
+{
+	pack->name_hash[e - pack->objects] = hash;
+}
+
+static inline uint32_t oe_cruft_mtime(const struct packing_data *pack,
+				      const struct object_entry *e)
+{
+	if (!pack->cruft_mtime)
+		return 0;
+	return pack->cruft_mtime[e - pack->objects];
+}
+
+static inline void oe_set_cruft_mtime(struct packing_data *pack,
+				      const struct object_entry *e,
+				      uint32_t mtime)
+{
+	if (!pack->cruft_mtime)
+		CALLOC_ARRAY(pack->cruft_mtime, pack->nr_alloc);
+	pack->cruft_mtime[e - pack->objects] = mtime;
+}
+
 static inline unsigned int oe_in_pack_pos(const struct packing_data *pack,
 					  const struct object_entry *e)
 {
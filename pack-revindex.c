@@ -4,6 +4,7 @@
 #include "packfile.h"
 #include "config.h"
 #include "midx.h"
+#include "pack.h"
 
 struct revindex_entry {
 	off_t offset;
@@ -122,6 +123,26 @@ static void sort_revindex(struct revindex_entry *entries, unsigned n, off_t max)
 #undef DIGIT_SIZE
 }
 
+void sort_pack_order(uint32_t *pack_order, struct pack_idx_entry **objects,
+		     uint32_t nr)
+{
+	struct revindex_entry *entries;
+	off_t max = 0;
+	uint32_t i;
+
+	ALLOC_ARRAY(entries, nr);
+	for (i = 0; i < nr; i++) {
+		entries[i].offset = objects[i]->offset;
+		entries[i].nr = i;
+		if (max < entries[i].offset)
+			max = entries[i].offset;
+	}
+	sort_revindex(entries, nr, max);
+	for (i = 0; i < nr; i++)
+		pack_order[i] = entries[i].nr;
+	free(entries);
+}
+
 /*
  * Ordered list of offsets of objects in the pack.
  */
@@ -301,6 +322,11 @@ int load_midx_revindex(struct multi_pack_index *m)
 	if (m->revindex_data)
 		return 0;
 
+	if (m->chunk_revindex) {
+		m->revindex_data = (const uint32_t *)m->chunk_revindex;
+		return 0;
+	}
+
 	revindex_name = get_midx_rev_filename(m);
 
 	ret = load_revindex_from_disk(revindex_name,
@@ -319,9 +345,14 @@ int load_midx_revindex(struct multi_pack_index *m)
 
 int close_midx_revindex(struct multi_pack_index *m)
 {
-	if (!m || !m->revindex_map)
+	if (!m)
 		return 0;
 
+	if (!m->revindex_map) {
+		m->revindex_data = NULL;
+		return 0;
+	}
+
 	munmap((void*)m->revindex_map, m->revindex_len);
 
 	m->revindex_map = NULL;
@@ -39,6 +39,7 @@
 
 struct packed_git;
 struct multi_pack_index;
+struct pack_idx_entry;
 
 /*
  * load_pack_revindex populates the revindex's internal data-structures for the
@@ -49,6 +50,14 @@ struct multi_pack_index;
  */
 int load_pack_revindex(struct packed_git *p);
 
+/*
+ * Fill "pack_order" with the positions in "objects" of its "nr" entries,
+ * sorted by their offsets, i.e. with the contents of a '.rev' file for
+ * the index whose entries they are.
+ */
+void sort_pack_order(uint32_t *pack_order, struct pack_idx_entry **objects,
+		     uint32_t nr);
+
 /*
  * load_midx_revindex loads the '.rev' file corresponding to the given
  * multi-pack index by mmap-ing it and assigning pointers in the
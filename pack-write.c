@@ -2,6 +2,7 @@
 #include "pack.h"
 #include "csum-file.h"
 #include "remote.h"
+#include "pack-mtimes.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -167,20 +168,6 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	return index_name;
 }
 
-static int pack_order_cmp(const void *va, const void *vb, void *ctx)
-{
-	struct pack_idx_entry **objects = ctx;
-
-	off_t oa = objects[*(uint32_t*)va]->offset;
-	off_t ob = objects[*(uint32_t*)vb]->offset;
-
-	if (oa < ob)
-		return -1;
-	if (oa > ob)
-		return 1;
-	return 0;
-}
-
 static void write_rev_header(struct hashfile *f)
 {
 	uint32_t oid_version;
@@ -221,13 +208,10 @@ const char *write_rev_file(const char *rev_name,
 			   unsigned flags)
 {
 	uint32_t *pack_order;
-	uint32_t i;
 	const char *ret;
 
 	ALLOC_ARRAY(pack_order, nr_objects);
-	for (i = 0; i < nr_objects; i++)
-		pack_order[i] = i;
-	QSORT_S(pack_order, nr_objects, pack_order_cmp, objects);
+	sort_pack_order(pack_order, objects, nr_objects);
 
 	ret = write_rev_file_order(rev_name, pack_order, nr_objects, hash,
 				   flags);
@@ -288,6 +272,40 @@ const char *write_rev_file_order(const char *rev_name,
 	return rev_name;
 }
 
+static void write_mtimes_header(struct hashfile *f)
+{
+	hashwrite_be32(f, MTIMES_SIGNATURE);
+	hashwrite_be32(f, MTIMES_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(the_hash_algo));
+}
+
+const char *write_mtimes_file(const uint32_t *mtimes,
+			      uint32_t nr_objects,
+			      const unsigned char *hash)
+{
+	struct strbuf tmp_file = STRBUF_INIT;
+	const char *mtimes_name;
+	struct hashfile *f;
+	uint32_t i;
+	int fd;
+
+	fd = odb_mkstemp(&tmp_file, "pack/tmp_mtimes_XXXXXX");
+	mtimes_name = strbuf_detach(&tmp_file, NULL);
+	f = hashfd(fd, mtimes_name);
+
+	write_mtimes_header(f);
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, mtimes[i]);
+	hashwrite(f, hash, the_hash_algo->rawsz);
+
+	if (adjust_shared_perm(mtimes_name) < 0)
+		die(_("failed to make %s readable"), mtimes_name);
+
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+
+	return mtimes_name;
+}
+
 off_t write_pack_header(struct hashfile *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -17,6 +17,7 @@
 #include "midx.h"
 #include "commit-graph.h"
 #include "promisor-remote.h"
+#include "json-writer.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *hash,
@@ -49,6 +50,18 @@ static unsigned int pack_max_fds;
 static size_t peak_pack_mapped;
 static size_t pack_mapped;
 
+/*
+ * Window reuse statistics: a cursor hit means the caller's cursor
+ * already covered the offset, a window hit means another mapped window
+ * of the pack did; otherwise a new window had to be mapped (counted in
+ * pack_mmap_calls). Evictions count windows unmapped to honor
+ * core.packedGitLimit.
+ */
+static unsigned int pack_cursor_hits;
+static unsigned int pack_window_hits;
+static unsigned int pack_window_evictions;
+static int pack_window_atexit_registered;
+
 #define SZ_FMT PRIuMAX
 static inline uintmax_t sz_fmt(size_t s) { return s; }
 
@@ -64,15 +77,41 @@ void pack_report(void)
 	fprintf(stderr,
 		"pack_report: pack_used_ctr            = %10u\n"
 		"pack_report: pack_mmap_calls          = %10u\n"
+		"pack_report: pack_cursor_hits         = %10u\n"
+		"pack_report: pack_window_hits         = %10u\n"
+		"pack_report: pack_window_evictions    = %10u\n"
 		"pack_report: pack_open_windows        = %10u / %10u\n"
 		"pack_report: pack_mapped              = "
 			"%10" SZ_FMT " / %10" SZ_FMT "\n",
 		pack_used_ctr,
 		pack_mmap_calls,
+		pack_cursor_hits,
+		pack_window_hits,
+		pack_window_evictions,
 		pack_open_windows, peak_pack_open_windows,
 		sz_fmt(pack_mapped), sz_fmt(peak_pack_mapped));
 }
 
+static void trace2_pack_window_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "window_size", packed_git_window_size);
+	jw_object_intmax(&jw, "limit", packed_git_limit);
+	jw_object_intmax(&jw, "cursor_hits", pack_cursor_hits);
+	jw_object_intmax(&jw, "window_hits", pack_window_hits);
+	jw_object_intmax(&jw, "misses", pack_mmap_calls);
+	jw_object_intmax(&jw, "evictions", pack_window_evictions);
+	jw_object_intmax(&jw, "peak_open_windows", peak_pack_open_windows);
+	jw_object_intmax(&jw, "peak_mapped", peak_pack_mapped);
+	jw_end(&jw);
+
+	trace2_data_json("pack", the_repository, "window_statistics", &jw);
+
+	jw_release(&jw);
+}
+
 /*
  * Open and mmap the index file at path, perform a couple of
  * consistency checks, then record its information to p.  Return 0 on
@@ -283,6 +322,7 @@ static int unuse_one_window(struct packed_git *current)
 			lru_p->windows = lru_w->next;
 		free(lru_w);
 		pack_open_windows--;
+		pack_window_evictions++;
 		return 1;
 	}
 	return 0;
@@ -333,12 +373,22 @@ void close_pack_revindex(struct packed_git *p) {
 	p->revindex_data = NULL;
 }
 
+static void close_pack_mtimes(struct packed_git *p)
+{
+	if (!p->mtimes_map)
+		return;
+
+	munmap((void *)p->mtimes_map, p->mtimes_size);
+	p->mtimes_map = NULL;
+}
+
 void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
 	close_pack_fd(p);
 	close_pack_index(p);
 	close_pack_revindex(p);
+	close_pack_mtimes(p);
 }
 
 void close_object_store(struct raw_object_store *o)
@@ -361,7 +411,8 @@ void close_object_store(struct raw_object_store *o)
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".pack", ".idx", ".rev", ".keep", ".bitmap", ".promisor"};
+	static const char *exts[] = {".pack", ".idx", ".rev", ".keep", ".bitmap",
+				     ".promisor", ".dcand", ".mtimes"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -586,10 +637,17 @@ static int open_packed_git_1(struct packed_git *p)
 
 static int open_packed_git(struct packed_git *p)
 {
-	if (!open_packed_git_1(p))
-		return 0;
-	close_pack_fd(p);
-	return -1;
+	int ret = 0;
+
+	trace2_region_enter_printf("pack", "open_packed_git", the_repository,
+				   "%s", p->pack_name);
+	if (open_packed_git_1(p)) {
+		close_pack_fd(p);
+		ret = -1;
+	}
+	trace2_region_leave_printf("pack", "open_packed_git", the_repository,
+				   "%s", p->pack_name);
+	return ret;
 }
 
 static int in_window(struct pack_window *win, off_t offset)
@@ -624,14 +682,23 @@ unsigned char *use_pack(struct packed_git *p,
 	if (offset < 0)
 		die(_("offset before end of packfile (broken .idx?)"));
 
-	if (!win || !in_window(win, offset)) {
+	if (trace2_is_enabled() && !pack_window_atexit_registered) {
+		atexit(trace2_pack_window_statistics_atexit);
+		pack_window_atexit_registered = 1;
+	}
+
+	if (win && in_window(win, offset)) {
+		pack_cursor_hits++;
+	} else {
 		if (win)
 			win->inuse_cnt--;
 		for (win = p->windows; win; win = win->next) {
 			if (in_window(win, offset))
 				break;
 		}
-		if (!win) {
+		if (win) {
+			pack_window_hits++;
+		} else {
 			size_t window_align = packed_git_window_size / 2;
 			off_t len;
 
@@ -648,9 +715,11 @@ unsigned char *use_pack(struct packed_git *p,
 			while (packed_git_limit < pack_mapped
 				&& unuse_one_window(p))
 				; /* nothing */
+			trace2_timer_start(TRACE2_TIMER_ID_PACK_WINDOW_MAP);
 			win->base = xmmap_gently(NULL, win->len,
 				PROT_READ, MAP_PRIVATE,
 				p->pack_fd, win->offset);
+			trace2_timer_stop(TRACE2_TIMER_ID_PACK_WINDOW_MAP);
 			if (win->base == MAP_FAILED)
 				die_errno("packfile %s cannot be mapped",
 					  p->pack_name);
@@ -658,6 +727,7 @@ unsigned char *use_pack(struct packed_git *p,
 				&& !p->do_not_close)
 				close_pack_fd(p);
 			pack_mmap_calls++;
+			trace2_counter_add(TRACE2_COUNTER_ID_PACK_WINDOW_MISS, 1);
 			pack_open_windows++;
 			if (pack_mapped > peak_pack_mapped)
 				peak_pack_mapped = pack_mapped;
@@ -678,6 +748,34 @@ unsigned char *use_pack(struct packed_git *p,
 	return win->base + offset;
 }
 
+void pack_readahead(struct packed_git *p, off_t offset)
+{
+#ifdef HAVE_POSIX_FADVISE
+	off_t len;
+
+	if (!pack_readahead_size || p->pack_fd < 0)
+		return;
+	if (offset < 0 || offset >= p->pack_size)
+		return;
+
+	/*
+	 * Sequential readers stay inside the range we asked for last time;
+	 * only extend it once they have consumed half of it.
+	 */
+	if (p->readahead_start <= offset &&
+	    offset + (off_t)(pack_readahead_size / 2) < p->readahead_end)
+		return;
+
+	len = p->pack_size - offset;
+	if (len > pack_readahead_size)
+		len = pack_readahead_size;
+	if (posix_fadvise(p->pack_fd, offset, len, POSIX_FADV_WILLNEED))
+		return;
+	p->readahead_start = offset;
+	p->readahead_end = offset + len;
+#endif
+}
+
 void unuse_pack(struct pack_window **w_cursor)
 {
 	struct pack_window *w = *w_cursor;
@@ -716,6 +814,10 @@ struct packed_git *add_packed_git(const char *path, size_t path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_promisor = 1;
 
+	xsnprintf(p->pack_name + path_len, alloc - path_len, ".mtimes");
+	if (!access(p->pack_name, F_OK))
+		p->is_cruft = 1;
+
 	xsnprintf(p->pack_name + path_len, alloc - path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -744,6 +846,8 @@ void install_packed_git(struct repository *r, struct packed_git *pack)
 
 	hashmap_entry_init(&pack->packmap_ent, strhash(pack->pack_name));
 	hashmap_add(&r->objects->pack_map, &pack->packmap_ent);
+	if (!pack->multi_pack_index)
+		FREE_AND_NULL(r->objects->packed_abbrev_len);
 }
 
 void (*report_garbage)(unsigned seen_bits, const char *path);
@@ -839,7 +943,7 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	size_t base_len = full_name_len;
 
 	if (strip_suffix_mem(full_name, &base_len, ".idx") &&
-	    !(data->m && midx_contains_pack(data->m, file_name))) {
+	    !midx_chain_contains_pack(data->m, file_name)) {
 		struct hashmap_entry hent;
 		char *pack_name = xstrfmt("%.*s.pack", (int)base_len, full_name);
 		unsigned int hash = strhash(pack_name);
@@ -857,7 +961,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (!report_garbage)
 		return;
 
-	if (!strcmp(file_name, "multi-pack-index"))
+	if (!strcmp(file_name, "multi-pack-index") ||
+	    !strcmp(file_name, "multi-pack-index.d"))
 		return;
 	if (starts_with(file_name, "multi-pack-index") &&
 	    ends_with(file_name, ".rev"))
@@ -867,7 +972,9 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	    ends_with(file_name, ".pack") ||
 	    ends_with(file_name, ".bitmap") ||
 	    ends_with(file_name, ".keep") ||
-	    ends_with(file_name, ".promisor"))
+	    ends_with(file_name, ".promisor") ||
+	    ends_with(file_name, ".dcand") ||
+	    ends_with(file_name, ".mtimes"))
 		string_list_append(data->garbage, full_name);
 	else
 		report_garbage(PACKDIR_FILE_GARBAGE, full_name);
@@ -969,6 +1076,40 @@ static void rearrange_packed_git(struct repository *r)
 		set_next_packed_git, sort_pack);
 }
 
+static int snapshot_is_current(struct packed_git_snapshot *snap,
+			       struct packed_git *p)
+{
+	size_t i;
+
+	for (i = 0; i < snap->nr; i++, p = p->next)
+		if (snap->packs[i] != p)
+			return 0;
+	return !p;
+}
+
+static void prepare_packed_git_snapshot(struct repository *r)
+{
+	struct packed_git_snapshot *snap, *old = r->objects->packed_git_snapshot;
+	struct packed_git *p;
+	size_t nr = 0;
+
+	if (old && snapshot_is_current(old, r->objects->packed_git))
+		return;
+
+	for (p = r->objects->packed_git; p; p = p->next)
+		nr++;
+
+	snap = xcalloc(1, st_add(sizeof(*snap),
+				 st_mult(nr, sizeof(*snap->packs))));
+	for (p = r->objects->packed_git; p; p = p->next)
+		snap->packs[snap->nr++] = p;
+
+	r->objects->packed_git_snapshot = snap;
+	/* otherwise the last search to let go of it frees it */
+	if (old && !old->refs)
+		free(old);
+}
+
 static void prepare_packed_git_mru(struct repository *r)
 {
 	struct packed_git *p;
@@ -977,6 +1118,8 @@ static void prepare_packed_git_mru(struct repository *r)
 
 	for (p = r->objects->packed_git; p; p = p->next)
 		list_add_tail(&p->mru, &r->objects->packed_git_mru);
+
+	prepare_packed_git_snapshot(r);
 }
 
 static void prepare_packed_git(struct repository *r)
@@ -1007,6 +1150,7 @@ void reprepare_packed_git(struct repository *r)
 		odb_clear_loose_cache(odb);
 
 	r->objects->approximate_object_count_valid = 0;
+	FREE_AND_NULL(r->objects->packed_abbrev_len);
 	r->objects->packed_git_initialized = 0;
 	prepare_packed_git(r);
 	obj_read_unlock();
@@ -1434,6 +1578,27 @@ static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
 	free(ent);
 }
 
+/*
+ * Detach the cached base at "base_offset" and hand its data over to the
+ * caller, or return NULL if it is not in the cache.
+ */
+static void *take_delta_base_cache_entry(struct packed_git *p, off_t base_offset,
+					 enum object_type *type,
+					 unsigned long *size)
+{
+	struct delta_base_cache_entry *ent;
+	void *data;
+
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (!ent)
+		return NULL;
+	*type = ent->type;
+	*size = ent->size;
+	data = ent->data;
+	detach_delta_base_cache_entry(ent);
+	return data;
+}
+
 static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 				   off_t base_offset, unsigned long *base_size,
 				   enum object_type *type)
@@ -1444,6 +1609,7 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 	if (!ent)
 		return unpack_entry(r, p, base_offset, type, base_size);
 
+	trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT, 1);
 	if (type)
 		*type = ent->type;
 	if (base_size)
@@ -1596,6 +1762,19 @@ int packed_object_info(struct repository *r, struct packed_git *p,
 	return type;
 }
 
+/*
+ * Can a zlib stream inflating to "size" bytes be expected to end within
+ * "avail" bytes? This is zlib's compressBound(), which a stream only
+ * exceeds if its encoder went out of its way to waste space.
+ */
+static int fits_in_window(unsigned long size, unsigned long avail)
+{
+	unsigned long bound;
+
+	bound = size + (size >> 12) + (size >> 14) + (size >> 25) + 13;
+	return bound > size && avail >= bound;
+}
+
 static void *unpack_compressed_entry(struct packed_git *p,
 				    struct pack_window **w_curs,
 				    off_t curpos,
@@ -1604,10 +1783,32 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	int st;
 	git_zstream stream;
 	unsigned char *buffer, *in;
+	unsigned long avail;
+	ssize_t used;
 
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+	/*
+	 * Most entries lie entirely within the current window and can be
+	 * inflated in one go, which git_inflate_buffer() may do with a
+	 * faster backend than streaming zlib. Its work would be lost on an
+	 * entry that does not fit, so those are streamed right away. The
+	 * window stays mapped while unlocked, for the reason explained in
+	 * get_size_from_delta().
+	 */
+	in = use_pack(p, w_curs, curpos, &avail);
+	if (fits_in_window(size, avail)) {
+		obj_read_unlock();
+		trace2_timer_start(TRACE2_TIMER_ID_PACK_INFLATE);
+		used = git_inflate_buffer(buffer, size, in, avail);
+		trace2_timer_stop(TRACE2_TIMER_ID_PACK_INFLATE);
+		obj_read_lock();
+		if (used >= 0)
+			return buffer;
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -1623,7 +1824,9 @@ static void *unpack_compressed_entry(struct packed_git *p,
 		 * get_size_from_delta() to see how this is done.
 		 */
 		obj_read_unlock();
+		trace2_timer_start(TRACE2_TIMER_ID_PACK_INFLATE);
 		st = git_inflate(&stream, Z_FINISH);
+		trace2_timer_stop(TRACE2_TIMER_ID_PACK_INFLATE);
 		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
@@ -1692,17 +1895,14 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (ent) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+
+		data = take_delta_base_cache_entry(p, curpos, &type, &size);
+		if (data) {
+			trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT, 1);
 			base_from_cache = 1;
 			break;
 		}
+		trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISS, 1);
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
 			uint32_t pack_pos, index_pos;
@@ -2066,6 +2266,154 @@ int find_pack_entry(struct repository *r, const struct object_id *oid, struct pa
 	return 0;
 }
 
+int has_pack_entry(struct repository *r, const struct object_id *oid)
+{
+	struct list_head *pos;
+	struct multi_pack_index *m;
+	struct pack_entry e;
+
+	prepare_packed_git(r);
+	if (!r->objects->packed_git && !r->objects->multi_pack_index)
+		return 0;
+
+	for (m = r->objects->multi_pack_index; m; m = m->next) {
+		if (midx_has_object(r, oid, m))
+			return 1;
+	}
+
+	list_for_each(pos, &r->objects->packed_git_mru) {
+		struct packed_git *p = list_entry(pos, struct packed_git, mru);
+		if (!p->multi_pack_index && fill_pack_entry(oid, &e, p)) {
+			list_move(&p->mru, &r->objects->packed_git_mru);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * A pack may be consulted without obj_read_mutex only if nothing needs
+ * to be opened, remapped or rechecked to answer from it.
+ */
+static int pack_usable_concurrently(struct packed_git *p)
+{
+	return p && p->index_data && p->pack_fd != -1 && !p->num_bad_objects;
+}
+
+int find_pack_entry_concurrent(struct repository *r, const struct object_id *oid,
+			       struct pack_entry *e)
+{
+	struct packed_git_snapshot *snap;
+	struct multi_pack_index *m;
+	size_t i;
+	int found = 0;
+
+	/*
+	 * Pin the current snapshot, so that a concurrent reprepare does
+	 * not free it under us. Only the search itself runs unlocked.
+	 */
+	obj_read_lock();
+	prepare_packed_git(r);
+	snap = r->objects->packed_git_snapshot;
+	if (snap)
+		snap->refs++;
+	m = r->objects->multi_pack_index;
+	obj_read_unlock();
+
+	for (; m; m = m->next) {
+		struct packed_git *p;
+		uint32_t pos;
+
+		if (!bsearch_midx(oid, m, &pos))
+			continue;
+		/*
+		 * The midx alone answers for its objects, as long as
+		 * somebody has already looked for their pack on disk.
+		 */
+		p = m->packs[nth_midxed_pack_int_id(m, pos)];
+		if (!p || p->num_bad_objects)
+			goto out;
+		e->offset = nth_midxed_offset(m, pos);
+		e->p = p;
+		found = 1;
+		goto out;
+	}
+
+	for (i = 0; snap && i < snap->nr; i++) {
+		struct packed_git *p = snap->packs[i];
+		off_t offset;
+
+		if (p->multi_pack_index || !pack_usable_concurrently(p))
+			continue;
+		offset = find_pack_entry_one(oid->hash, p);
+		if (offset) {
+			e->offset = offset;
+			e->p = p;
+			found = 1;
+			break;
+		}
+	}
+
+out:
+	if (snap) {
+		obj_read_lock();
+		if (!--snap->refs && snap != r->objects->packed_git_snapshot)
+			free(snap);
+		obj_read_unlock();
+	}
+	return found;
+}
+
+struct pack_order_entry {
+	struct packed_git *p;
+	off_t offset;
+	size_t pos;
+};
+
+static int pack_order_cmp(const void *va, const void *vb)
+{
+	const struct pack_order_entry *a = va, *b = vb;
+
+	/* objects that are not packed sort last */
+	if (!a->p != !b->p)
+		return a->p ? -1 : 1;
+	if (a->p != b->p)
+		return (uintptr_t)a->p < (uintptr_t)b->p ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	if (a->pos != b->pos)
+		return a->pos < b->pos ? -1 : 1;
+	return 0;
+}
+
+void sort_oids_in_pack_order(struct repository *r,
+			     const struct object_id *oids, size_t nr,
+			     size_t *order)
+{
+	struct pack_order_entry *entries;
+	size_t i;
+
+	ALLOC_ARRAY(entries, nr);
+	for (i = 0; i < nr; i++) {
+		struct pack_entry e;
+
+		if (find_pack_entry(r, &oids[i], &e)) {
+			entries[i].p = e.p;
+			entries[i].offset = e.offset;
+		} else {
+			entries[i].p = NULL;
+			entries[i].offset = 0;
+		}
+		entries[i].pos = i;
+	}
+
+	QSORT(entries, nr, pack_order_cmp);
+
+	for (i = 0; i < nr; i++)
+		order[i] = entries[i].pos;
+	free(entries);
+}
+
 static void maybe_invalidate_kept_pack_cache(struct repository *r,
 					     unsigned flags)
 {
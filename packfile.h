@@ -94,6 +94,16 @@ void close_pack_revindex(struct packed_git *);
 void close_pack(struct packed_git *);
 void close_object_store(struct raw_object_store *o);
 void unuse_pack(struct pack_window **);
+
+/*
+ * Tell the operating system that pack "p" is about to be read from
+ * "offset" onwards, so that up to core.packReadahead bytes can be
+ * fetched in the background. Callers that know their access order
+ * should call this before each object they are going to read; hints
+ * for ranges that were already requested are not repeated. A no-op
+ * unless core.packReadahead is set and the pack is open.
+ */
+void pack_readahead(struct packed_git *p, off_t offset);
 void clear_delta_base_cache(void);
 struct packed_git *add_packed_git(const char *path, size_t path_len, int local);
 
@@ -170,6 +180,38 @@ const struct packed_git *has_packed_and_bad(struct repository *r, const unsigned
  * return true and store its location to e.
  */
 int find_pack_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e);
+
+/*
+ * Like find_pack_entry(), for callers that only want to know whether the
+ * object is packed. Objects named by a multi-pack-index are answered from
+ * the midx without opening their pack or its .idx.
+ */
+int has_pack_entry(struct repository *r, const struct object_id *oid);
+
+/*
+ * Like find_pack_entry(), but safe to call from several threads at once
+ * without holding obj_read_mutex for the search; the lock is only taken
+ * briefly to pin the snapshot of the pack list that is searched, and to
+ * let go of it. Only packs whose index and packfile are already open
+ * (or, for a multi-pack-index, whose pack has been looked up) are
+ * consulted, and the MRU list is not reordered. A miss does not mean the
+ * object is absent; callers fall back to find_pack_entry(). Packs must
+ * not be closed while concurrent lookups are in flight.
+ */
+int find_pack_entry_concurrent(struct repository *r, const struct object_id *oid, struct pack_entry *e);
+/*
+ * Fill "order" with a permutation of 0..nr-1 that visits "oids" in the
+ * order their bodies are stored on disk: grouped by pack and sorted by
+ * offset within each pack (i.e., pack .rev order). Objects that are not
+ * found in any pack come last, in their original relative order.
+ * Reading objects in this order keeps pack access sequential and lets
+ * delta bases be served from the delta base cache; callers that read
+ * them can also ask for readahead (see pack_readahead()).
+ */
+void sort_oids_in_pack_order(struct repository *r,
+			     const struct object_id *oids, size_t nr,
+			     size_t *order);
+
 int find_kept_pack_entry(struct repository *r, const struct object_id *oid, unsigned flags, struct pack_entry *e);
 
 int has_object_pack(const struct object_id *oid);
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "entry.h"
+#include "object-store.h"
 #include "parallel-checkout.h"
 #include "pkt-line.h"
 #include "progress.h"
@@ -19,6 +20,7 @@ struct parallel_checkout {
 	enum pc_status status;
 	struct parallel_checkout_item *items; /* The parallel checkout queue. */
 	size_t nr, alloc;
+	unsigned has_filters : 1; /* Does any item need a filter driver? */
 	struct progress *progress;
 	unsigned int *progress_cnt;
 };
@@ -79,6 +81,7 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 					     const struct conv_attrs *ca)
 {
 	enum conv_attrs_classification c;
+	const char *filter_name;
 	size_t packed_item_size;
 
 	/*
@@ -90,8 +93,10 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 	if (!S_ISREG(ce->ce_mode))
 		return 0;
 
+	filter_name = conv_attrs_filter_name(ca);
 	packed_item_size = sizeof(struct pc_item_fixed_portion) + ce->ce_namelen +
-		(ca->working_tree_encoding ? strlen(ca->working_tree_encoding) : 0);
+		(ca->working_tree_encoding ? strlen(ca->working_tree_encoding) : 0) +
+		(filter_name ? strlen(filter_name) : 0);
 
 	/*
 	 * The amount of data we send to the workers per checkout item is
@@ -112,9 +117,9 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 		 * It would be safe to allow concurrent instances of
 		 * single-file smudge filters, like rot13, but we should not
 		 * assume that all filters are parallel-process safe. So we
-		 * don't allow this.
+		 * only do this for the drivers that say they are.
 		 */
-		return 0;
+		return conv_attrs_filter_is_parallel(ca);
 
 	case CA_CLASS_INCORE_PROCESS:
 		/*
@@ -132,8 +137,13 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 		 * probably have to designate a single process to interact with
 		 * the filter and send all the necessary data to it, for each
 		 * entry.
+		 *
+		 * Unless the driver says that it can have several instances
+		 * running at once. Then each checkout--worker process starts
+		 * its own, and the entries are neither delayed nor serialized
+		 * through a single process.
 		 */
-		return 0;
+		return conv_attrs_filter_is_parallel(ca);
 
 	case CA_CLASS_STREAMABLE:
 		return 1;
@@ -160,6 +170,8 @@ int enqueue_checkout(struct cache_entry *ce, struct conv_attrs *ca)
 	pc_item->status = PC_ITEM_PENDING;
 	pc_item->id = parallel_checkout.nr;
 	parallel_checkout.nr++;
+	if (ca->drv)
+		parallel_checkout.has_filters = 1;
 
 	return 0;
 }
@@ -255,11 +267,12 @@ static int reset_fd(int fd, const char *path)
 }
 
 static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
-			       const char *path)
+			       const char *path, struct checkout *state)
 {
 	int ret;
 	struct stream_filter *filter;
 	struct strbuf buf = STRBUF_INIT;
+	struct checkout_metadata meta;
 	char *blob;
 	unsigned long size;
 	ssize_t wrote;
@@ -285,12 +298,12 @@ static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
 
 	/*
 	 * checkout metadata is used to give context for external process
-	 * filters. Files requiring such filters are not eligible for parallel
-	 * checkout, so pass NULL. Note: if that changes, the metadata must also
-	 * be passed from the main process to the workers.
+	 * filters. The workers get it from the main process on their
+	 * command line.
 	 */
+	clone_checkout_metadata(&meta, &state->meta, &pc_item->ce->oid);
 	ret = convert_to_working_tree_ca(&pc_item->ca, pc_item->ce->name,
-					 blob, size, &buf, NULL);
+					 blob, size, &buf, &meta);
 
 	if (ret) {
 		size_t newsize;
@@ -320,7 +333,7 @@ static int close_and_clear(int *fd)
 }
 
 void write_pc_item(struct parallel_checkout_item *pc_item,
-		   struct checkout *state)
+		   struct checkout *state, struct cache_def *cache)
 {
 	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
 	int fd = -1, fstat_done = 0;
@@ -338,8 +351,9 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 	 * a symlink (checked out after we enqueued this entry for parallel
 	 * checkout). Thus, we must check the leading dirs again.
 	 */
-	if (dir_sep && !has_dirs_only_path(path.buf, dir_sep - path.buf,
-					   state->base_dir_len)) {
+	if (dir_sep && !threaded_has_dirs_only_path(cache, path.buf,
+						    dir_sep - path.buf,
+						    state->base_dir_len)) {
 		pc_item->status = PC_ITEM_COLLIDED;
 		trace2_data_string("pcheckout", NULL, "collision/dirname", path.buf);
 		goto out;
@@ -366,7 +380,7 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 		goto out;
 	}
 
-	if (write_pc_item_to_fd(pc_item, fd, path.buf)) {
+	if (write_pc_item_to_fd(pc_item, fd, path.buf, state)) {
 		/* Error was already reported. */
 		pc_item->status = PC_ITEM_FAILED;
 		close_and_clear(&fd);
@@ -400,16 +414,18 @@ static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 	char *data, *variant;
 	struct pc_item_fixed_portion *fixed_portion;
 	const char *working_tree_encoding = pc_item->ca.working_tree_encoding;
+	const char *filter_name = conv_attrs_filter_name(&pc_item->ca);
 	size_t name_len = pc_item->ce->ce_namelen;
 	size_t working_tree_encoding_len = working_tree_encoding ?
 					   strlen(working_tree_encoding) : 0;
+	size_t filter_name_len = filter_name ? strlen(filter_name) : 0;
 
 	/*
 	 * Any changes in the calculation of the message size must also be made
 	 * in is_eligible_for_parallel_checkout().
 	 */
 	len_data = sizeof(struct pc_item_fixed_portion) + name_len +
-		   working_tree_encoding_len;
+		   working_tree_encoding_len + filter_name_len;
 
 	data = xcalloc(1, len_data);
 
@@ -420,6 +436,7 @@ static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 	fixed_portion->ident = pc_item->ca.ident;
 	fixed_portion->name_len = name_len;
 	fixed_portion->working_tree_encoding_len = working_tree_encoding_len;
+	fixed_portion->filter_name_len = filter_name_len;
 	/*
 	 * We use hashcpy() instead of oidcpy() because the hash[] positions
 	 * after `the_hash_algo->rawsz` might not be initialized. And Valgrind
@@ -434,6 +451,10 @@ static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 		memcpy(variant, working_tree_encoding, working_tree_encoding_len);
 		variant += working_tree_encoding_len;
 	}
+	if (filter_name_len) {
+		memcpy(variant, filter_name, filter_name_len);
+		variant += filter_name_len;
+	}
 	memcpy(variant, pc_item->ce->name, name_len);
 
 	packet_write(fd, data, len_data);
@@ -470,6 +491,12 @@ static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
 		strvec_push(&cp->args, "checkout--worker");
 		if (state->base_dir_len)
 			strvec_pushf(&cp->args, "--prefix=%s", state->base_dir);
+		if (state->meta.refname)
+			strvec_pushf(&cp->args, "--refname=%s",
+				     state->meta.refname);
+		if (!is_null_oid(&state->meta.treeish))
+			strvec_pushf(&cp->args, "--treeish=%s",
+				     oid_to_hex(&state->meta.treeish));
 		if (start_command(cp))
 			die("failed to spawn checkout worker");
 	}
@@ -631,16 +658,107 @@ static void gather_results_from_workers(struct pc_worker *workers,
 	free(pfds);
 }
 
+struct pc_thread {
+	pthread_t pthread;
+	struct checkout *state;
+	size_t start, nr;
+	pthread_mutex_t *progress_mutex;
+};
+
+static void *checkout_thread(void *_data)
+{
+	struct pc_thread *t = _data;
+	struct cache_def cache = CACHE_DEF_INIT;
+	size_t i;
+
+	trace2_thread_start("checkout-worker");
+
+	for (i = t->start; i < t->start + t->nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+		write_pc_item(pc_item, t->state, &cache);
+		if (pc_item->status != PC_ITEM_COLLIDED) {
+			pthread_mutex_lock(t->progress_mutex);
+			advance_progress_meter();
+			pthread_mutex_unlock(t->progress_mutex);
+		}
+	}
+
+	cache_def_clear(&cache);
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Unlike checkout--worker processes, the threads share our object store,
+ * so there is nothing to send them but the range of items to write.
+ */
+static void write_items_in_threads(struct checkout *state, int num_workers)
+{
+	struct pc_thread *threads;
+	pthread_mutex_t progress_mutex;
+	int i, workers_with_one_extra_item;
+	size_t base_batch_size, batch_beginning = 0;
+
+	CALLOC_ARRAY(threads, num_workers);
+	pthread_mutex_init(&progress_mutex, NULL);
+	enable_obj_read_lock();
+
+	base_batch_size = parallel_checkout.nr / num_workers;
+	workers_with_one_extra_item = parallel_checkout.nr % num_workers;
+
+	for (i = 0; i < num_workers; i++) {
+		struct pc_thread *t = &threads[i];
+		int err;
+
+		t->state = state;
+		t->start = batch_beginning;
+		t->nr = base_batch_size;
+		t->progress_mutex = &progress_mutex;
+		/* distribute the extra work evenly */
+		if (i < workers_with_one_extra_item)
+			t->nr++;
+		batch_beginning += t->nr;
+
+		err = pthread_create(&t->pthread, NULL, checkout_thread, t);
+		if (err)
+			die(_("unable to create checkout thread: %s"),
+			    strerror(err));
+	}
+
+	for (i = 0; i < num_workers; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die("unable to join checkout thread");
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&progress_mutex);
+	free(threads);
+}
+
 static void write_items_sequentially(struct checkout *state)
 {
+	struct cache_def cache = CACHE_DEF_INIT;
 	size_t i;
 
 	for (i = 0; i < parallel_checkout.nr; i++) {
 		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
-		write_pc_item(pc_item, state);
+		write_pc_item(pc_item, state, &cache);
 		if (pc_item->status != PC_ITEM_COLLIDED)
 			advance_progress_meter();
 	}
+
+	cache_def_clear(&cache);
+}
+
+static int use_worker_threads(void)
+{
+	const char *value;
+
+	if (git_config_get_string_tmp("checkout.workertype", &value) ||
+	    !strcmp(value, "thread"))
+		return HAVE_THREADS;
+	if (!strcmp(value, "process"))
+		return 0;
+	die(_("invalid value for '%s': '%s'"), "checkout.workerType", value);
 }
 
 int run_parallel_checkout(struct checkout *state, int num_workers, int threshold,
@@ -660,6 +778,14 @@ int run_parallel_checkout(struct checkout *state, int num_workers, int threshold
 
 	if (num_workers <= 1 || parallel_checkout.nr < threshold) {
 		write_items_sequentially(state);
+	} else if (use_worker_threads() && !parallel_checkout.has_filters) {
+		/*
+		 * Filter drivers are external processes, and a
+		 * long-running one speaks to us through a single pipe.
+		 * Workers that have to use them are processes, so that
+		 * each can run instances of its own.
+		 */
+		write_items_in_threads(state, num_workers);
 	} else {
 		struct pc_worker *workers = setup_workers(state, num_workers);
 		gather_results_from_workers(workers, num_workers);
@@ -3,6 +3,7 @@
 
 #include "convert.h"
 
+struct cache_def;
 struct cache_entry;
 struct checkout;
 struct progress;
@@ -37,7 +38,8 @@ size_t pc_queue_size(void);
 /*
  * Write all the queued entries, returning 0 on success. If the number of
  * entries is smaller than the specified threshold, the operation is performed
- * sequentially.
+ * sequentially. Otherwise, it is spread among `num_workers` threads or, if
+ * `checkout.workerType` is "process", checkout--worker processes.
  */
 int run_parallel_checkout(struct checkout *state, int num_workers, int threshold,
 			  struct progress *progress, unsigned int *progress_cnt);
@@ -76,9 +78,9 @@ struct parallel_checkout_item {
 
 /*
  * The fixed-size portion of `struct parallel_checkout_item` that is sent to the
- * workers. Following this will be 2 strings: ca.working_tree_encoding and
- * ce.name; These are NOT null terminated, since we have the size in the fixed
- * portion.
+ * workers. Following this will be 3 strings: ca.working_tree_encoding, the
+ * name of ca.drv and ce.name; These are NOT null terminated, since we have the
+ * size in the fixed portion.
  *
  * Note that not all fields of conv_attrs and cache_entry are passed, only the
  * ones that will be required by the workers to smudge and write the entry.
@@ -90,6 +92,7 @@ struct pc_item_fixed_portion {
 	enum convert_crlf_action crlf_action;
 	int ident;
 	size_t working_tree_encoding_len;
+	size_t filter_name_len;
 	size_t name_len;
 };
 
@@ -105,7 +108,12 @@ struct pc_item_result {
 
 #define PC_ITEM_RESULT_BASE_SIZE offsetof(struct pc_item_result, st)
 
+/*
+ * Write `pc_item` to the working tree, recording the outcome in its status.
+ * `cache` remembers which leading directories are known to exist; each
+ * worker (process or thread) must use its own.
+ */
 void write_pc_item(struct parallel_checkout_item *pc_item,
-		   struct checkout *state);
+		   struct checkout *state, struct cache_def *cache);
 
 #endif /* PARALLEL_CHECKOUT_H */
@@ -0,0 +1,270 @@
+#include "cache.h"
+#include "repository.h"
+#include "lockfile.h"
+#include "object-store.h"
+#include "commit.h"
+#include "diff.h"
+#include "revision.h"
+#include "progress.h"
+#include "patch-ids.h"
+#include "patch-id-cache.h"
+
+/*
+ * The file starts with a header
+ *
+ *   4-byte signature "PIDC"
+ *   4-byte version number (1)
+ *   4-byte hash format id
+ *   4-byte xdl_opts of the diff options the ids were computed with
+ *   4-byte number of commits
+ *
+ * which is followed by a fanout table of 256 4-byte entries, the Nth
+ * of which is the number of commits whose first byte is N or less,
+ * then by the names of the commits, sorted, then by their header-only
+ * patch ids and then by their full patch ids, in the same order.
+ *
+ * All numbers are in network byte order.
+ */
+
+#define PATCH_ID_CACHE_SIGNATURE 0x50494443 /* "PIDC" */
+#define PATCH_ID_CACHE_VERSION 1
+#define PATCH_ID_CACHE_HEADER_SIZE 20
+#define PATCH_ID_CACHE_FANOUT_SIZE (256 * 4)
+
+struct patch_id_cache {
+	const unsigned char *map;
+	size_t map_size;
+	const unsigned char *fanout;
+	const unsigned char *commits;
+	const unsigned char *header_ids;
+	const unsigned char *full_ids;
+	uint32_t nr;
+};
+
+static char *patch_id_cache_path(struct repository *r)
+{
+	return xstrfmt("%s/info/patch-ids", r->objects->odb->path);
+}
+
+/* Only the options init_patch_ids() leaves to the configuration vary. */
+static int cacheable_options(const struct diff_options *options)
+{
+	return !options->pathspec.nr && !options->orderfile;
+}
+
+struct patch_id_cache *load_patch_id_cache(struct repository *r,
+					   const struct diff_options *options)
+{
+	char *path;
+	struct patch_id_cache *cache;
+	struct stat st;
+	size_t size;
+	const unsigned char *map;
+	uint32_t nr;
+	int fd;
+
+	if (!cacheable_options(options))
+		return NULL;
+
+	path = patch_id_cache_path(r);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		free(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		free(path);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < PATCH_ID_CACHE_HEADER_SIZE + PATCH_ID_CACHE_FANOUT_SIZE) {
+		warning(_("ignoring malformed patch-id cache '%s'"), path);
+		close(fd);
+		free(path);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	nr = get_be32(map + 16);
+	if (get_be32(map) != PATCH_ID_CACHE_SIGNATURE ||
+	    get_be32(map + 4) != PATCH_ID_CACHE_VERSION ||
+	    get_be32(map + 8) != the_hash_algo->format_id ||
+	    size != PATCH_ID_CACHE_HEADER_SIZE + PATCH_ID_CACHE_FANOUT_SIZE +
+		    st_mult(st_mult(nr, the_hash_algo->rawsz), 3) ||
+	    get_be32(map + PATCH_ID_CACHE_HEADER_SIZE + 255 * 4) != nr) {
+		warning(_("ignoring malformed patch-id cache '%s'"), path);
+		munmap((void *)map, size);
+		free(path);
+		return NULL;
+	}
+	free(path);
+
+	if (get_be32(map + 12) != (uint32_t)options->xdl_opts) {
+		munmap((void *)map, size);
+		return NULL;
+	}
+
+	CALLOC_ARRAY(cache, 1);
+	cache->map = map;
+	cache->map_size = size;
+	cache->nr = nr;
+	cache->fanout = map + PATCH_ID_CACHE_HEADER_SIZE;
+	cache->commits = cache->fanout + PATCH_ID_CACHE_FANOUT_SIZE;
+	cache->header_ids = cache->commits + st_mult(nr, the_hash_algo->rawsz);
+	cache->full_ids = cache->header_ids + st_mult(nr, the_hash_algo->rawsz);
+	return cache;
+}
+
+int patch_id_cache_find(struct patch_id_cache *cache,
+			const struct object_id *commit, int header_only,
+			struct object_id *patch_id)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	uint32_t lo, hi;
+	unsigned char first = commit->hash[0];
+
+	lo = first ? get_be32(cache->fanout + (first - 1) * 4) : 0;
+	hi = get_be32(cache->fanout + first * 4);
+	if (hi > cache->nr || lo > hi)
+		return 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(cache->commits + st_mult(mi, rawsz),
+				  commit->hash);
+
+		if (cmp < 0) {
+			lo = mi + 1;
+		} else if (cmp > 0) {
+			hi = mi;
+		} else {
+			const unsigned char *ids = header_only ?
+				cache->header_ids : cache->full_ids;
+
+			oidread(patch_id, ids + st_mult(mi, rawsz));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void free_patch_id_cache(struct patch_id_cache *cache)
+{
+	if (!cache)
+		return;
+	munmap((void *)cache->map, cache->map_size);
+	free(cache);
+}
+
+struct patch_id_entry {
+	struct object_id commit;
+	struct object_id header_id;
+	struct object_id full_id;
+};
+
+static int cache_entry_cmp(const void *a_, const void *b_)
+{
+	const struct patch_id_entry *a = a_, *b = b_;
+
+	return oidcmp(&a->commit, &b->commit);
+}
+
+int write_patch_id_cache(struct repository *r, int show_progress)
+{
+	struct patch_ids ids;
+	struct patch_id_cache *old;
+	struct rev_info revs;
+	struct commit *commit;
+	struct patch_id_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i, rawsz = the_hash_algo->rawsz;
+	unsigned char header[PATCH_ID_CACHE_HEADER_SIZE];
+	unsigned char fanout[PATCH_ID_CACHE_FANOUT_SIZE];
+	uint32_t count[256] = { 0 }, total = 0;
+	struct progress *progress = NULL;
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	const char *argv[] = {
+		"rev-list", "--branches", "--remotes", "--no-merges", NULL
+	};
+	char *path;
+	int fd, ret = 0;
+
+	/* the ids are those of the sets patch-ids.h builds */
+	init_patch_ids(r, &ids);
+	old = ids.cache ? ids.cache : load_patch_id_cache(r, &ids.diffopts);
+	ids.cache = NULL;
+
+	repo_init_revisions(r, &revs, NULL);
+	setup_revisions(ARRAY_SIZE(argv) - 1, argv, &revs, NULL);
+	if (prepare_revision_walk(&revs)) {
+		ret = error(_("revision walk setup failed"));
+		goto out;
+	}
+
+	if (show_progress)
+		progress = start_delayed_progress(_("Computing patch ids"), 0);
+	while ((commit = get_revision(&revs))) {
+		struct patch_id_entry *e;
+
+		ALLOC_GROW(entries, nr + 1, alloc);
+		e = &entries[nr];
+		oidcpy(&e->commit, &commit->object.oid);
+		if (!old ||
+		    !patch_id_cache_find(old, &e->commit, 1, &e->header_id) ||
+		    !patch_id_cache_find(old, &e->commit, 0, &e->full_id)) {
+			if (commit_patch_id(commit, &ids.diffopts,
+					    &e->header_id, 1, 0) ||
+			    commit_patch_id(commit, &ids.diffopts,
+					    &e->full_id, 0, 0))
+				continue;
+		}
+		nr++;
+		display_progress(progress, nr);
+	}
+	stop_progress(&progress);
+	QSORT(entries, nr, cache_entry_cmp);
+
+	put_be32(header, PATCH_ID_CACHE_SIGNATURE);
+	put_be32(header + 4, PATCH_ID_CACHE_VERSION);
+	put_be32(header + 8, the_hash_algo->format_id);
+	put_be32(header + 12, ids.diffopts.xdl_opts);
+	put_be32(header + 16, nr);
+
+	for (i = 0; i < nr; i++)
+		count[entries[i].commit.hash[0]]++;
+	for (i = 0; i < 256; i++) {
+		total += count[i];
+		put_be32(fanout + i * 4, total);
+	}
+
+	strbuf_add(&buf, header, sizeof(header));
+	strbuf_add(&buf, fanout, sizeof(fanout));
+	for (i = 0; i < nr; i++)
+		strbuf_add(&buf, entries[i].commit.hash, rawsz);
+	for (i = 0; i < nr; i++)
+		strbuf_add(&buf, entries[i].header_id.hash, rawsz);
+	for (i = 0; i < nr; i++)
+		strbuf_add(&buf, entries[i].full_id.hash, rawsz);
+
+	path = patch_id_cache_path(r);
+	if (safe_create_leading_directories(path) < 0)
+		ret = error(_("unable to create leading directories of %s"),
+			    path);
+	else if ((fd = hold_lock_file_for_update(&lk, path, 0)) < 0)
+		ret = error_errno(_("unable to lock '%s'"), path);
+	else if (write_in_full(fd, buf.buf, buf.len) < 0) {
+		ret = error_errno(_("unable to write '%s'"), path);
+		rollback_lock_file(&lk);
+	} else if (commit_lock_file(&lk) < 0)
+		ret = error_errno(_("unable to write '%s'"), path);
+	free(path);
+
+out:
+	free_patch_id_cache(old);
+	free_patch_ids(&ids);
+	free(entries);
+	strbuf_release(&buf);
+	return ret;
+}
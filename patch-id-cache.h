@@ -0,0 +1,50 @@
+#ifndef PATCH_ID_CACHE_H
+#define PATCH_ID_CACHE_H
+
+struct repository;
+struct object_id;
+struct diff_options;
+
+/*
+ * The patch-id cache in "$GIT_DIR/objects/info/patch-ids" records, for
+ * non-merge commits reachable from branches and remote-tracking
+ * branches, the patch ids that the patch_ids sets of patch-ids.h
+ * compute: the one of the diff headers only, used to bucket commits,
+ * and the one of the full diff. It is written by the "patch-ids"
+ * maintenance task, which only diffs the commits the cache does not
+ * have yet, and is read, unless `core.patchIdCache` is false, by
+ * init_patch_ids() so that `git cherry`, `--cherry-pick` and
+ * `format-patch --ignore-if-in-upstream` do not have to diff the
+ * commits it covers.
+ *
+ * Patch ids depend on the diff options, so the cache records the
+ * options it was written with and is not used with others.
+ */
+
+struct patch_id_cache;
+
+/*
+ * Return the cache of the repository if there is one that was written
+ * with diff options matching `options`, or NULL.
+ */
+struct patch_id_cache *load_patch_id_cache(struct repository *r,
+					   const struct diff_options *options);
+
+/*
+ * Look the patch id of `commit` up, the one of its diff headers if
+ * `header_only` is set. Return 1 and fill `patch_id` if it is there,
+ * 0 otherwise.
+ */
+int patch_id_cache_find(struct patch_id_cache *cache,
+			const struct object_id *commit, int header_only,
+			struct object_id *patch_id);
+
+void free_patch_id_cache(struct patch_id_cache *cache);
+
+/*
+ * Add the patch ids of the commits that are not in the cache yet and
+ * rewrite it. Return 0 on success.
+ */
+int write_patch_id_cache(struct repository *r, int show_progress);
+
+#endif /* PATCH_ID_CACHE_H */
@@ -1,8 +1,10 @@
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "commit.h"
 #include "hash-lookup.h"
 #include "patch-ids.h"
+#include "patch-id-cache.h"
 
 static int patch_id_defined(struct commit *commit)
 {
@@ -25,6 +27,17 @@ int commit_patch_id(struct commit *commit, struct diff_options *options,
 	return diff_flush_patch_id(options, oid, diff_header_only, stable);
 }
 
+static int cached_patch_id(struct commit *commit, struct patch_ids *ids,
+			   struct object_id *oid, int diff_header_only)
+{
+	if (ids->cache && !ids->diffopts.pathspec.nr &&
+	    patch_id_cache_find(ids->cache, &commit->object.oid,
+				diff_header_only, oid))
+		return 0;
+	return commit_patch_id(commit, &ids->diffopts, oid,
+			       diff_header_only, 0);
+}
+
 /*
  * When we cannot load the full patch-id for both commits for whatever
  * reason, the function returns -1 (i.e. return error(...)). Despite
@@ -41,18 +54,18 @@ static int patch_id_neq(const void *cmpfn_data,
 			const void *unused_keydata)
 {
 	/* NEEDSWORK: const correctness? */
-	struct diff_options *opt = (void *)cmpfn_data;
+	struct patch_ids *ids = (void *)cmpfn_data;
 	struct patch_id *a, *b;
 
 	a = container_of(eptr, struct patch_id, ent);
 	b = container_of(entry_or_key, struct patch_id, ent);
 
 	if (is_null_oid(&a->patch_id) &&
-	    commit_patch_id(a->commit, opt, &a->patch_id, 0, 0))
+	    cached_patch_id(a->commit, ids, &a->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&a->commit->object.oid));
 	if (is_null_oid(&b->patch_id) &&
-	    commit_patch_id(b->commit, opt, &b->patch_id, 0, 0))
+	    cached_patch_id(b->commit, ids, &b->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&b->commit->object.oid));
 	return !oideq(&a->patch_id, &b->patch_id);
@@ -60,18 +73,26 @@ static int patch_id_neq(const void *cmpfn_data,
 
 int init_patch_ids(struct repository *r, struct patch_ids *ids)
 {
+	int use_cache = 1;
+
 	memset(ids, 0, sizeof(*ids));
 	repo_diff_setup(r, &ids->diffopts);
 	ids->diffopts.detect_rename = 0;
 	ids->diffopts.flags.recursive = 1;
 	diff_setup_done(&ids->diffopts);
-	hashmap_init(&ids->patches, patch_id_neq, &ids->diffopts, 256);
+	hashmap_init(&ids->patches, patch_id_neq, ids, 256);
+
+	repo_config_get_bool(r, "core.patchidcache", &use_cache);
+	if (use_cache)
+		ids->cache = load_patch_id_cache(r, &ids->diffopts);
 	return 0;
 }
 
 int free_patch_ids(struct patch_ids *ids)
 {
 	hashmap_clear_and_free(&ids->patches, struct patch_id, ent);
+	free_patch_id_cache(ids->cache);
+	ids->cache = NULL;
 	return 0;
 }
 
@@ -82,7 +103,7 @@ static int init_patch_id_entry(struct patch_id *patch,
 	struct object_id header_only_patch_id;
 
 	patch->commit = commit;
-	if (commit_patch_id(commit, &ids->diffopts, &header_only_patch_id, 1, 0))
+	if (cached_patch_id(commit, ids, &header_only_patch_id, 1))
 		return -1;
 
 	hashmap_entry_init(&patch->ent, oidhash(&header_only_patch_id));
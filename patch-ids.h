@@ -7,6 +7,7 @@
 struct commit;
 struct object_id;
 struct repository;
+struct patch_id_cache;
 
 struct patch_id {
 	struct hashmap_entry ent;
@@ -17,6 +18,9 @@ struct patch_id {
 struct patch_ids {
 	struct hashmap patches;
 	struct diff_options diffopts;
+
+	/* ids computed ahead of time, see patch-id-cache.h */
+	struct patch_id_cache *cache;
 };
 
 int commit_patch_id(struct commit *commit, struct diff_options *options,
@@ -5,6 +5,7 @@
 #include "attr.h"
 #include "strvec.h"
 #include "quote.h"
+#include "hashmap.h"
 
 /*
  * Finds which of the given pathspecs match items in the index.
@@ -37,8 +38,12 @@ void add_pathspec_matches_against_index(const struct pathspec *pathspec,
 			num_unmatched++;
 	if (!num_unmatched)
 		return;
-	/* TODO: audit for interaction with sparse-index. */
-	ensure_full_index(istate);
+	/*
+	 * Sparse directories are skip-worktree, so they only need to be
+	 * expanded if skip-worktree entries are to be matched, too.
+	 */
+	if (sw_action != PS_IGNORE_SKIP_WORKTREE)
+		ensure_full_index(istate);
 	for (i = 0; i < istate->cache_nr; i++) {
 		const struct cache_entry *ce = istate->cache[i];
 		if (sw_action == PS_IGNORE_SKIP_WORKTREE && ce_skip_worktree(ce))
@@ -553,6 +558,177 @@ static void NORETURN unsupported_magic(const char *pattern,
 	    pattern, sb.buf);
 }
 
+/*
+ * Below this many items, trying them all is as fast as looking up the
+ * leading directories of each path.
+ */
+#define PATHSPEC_MATCHER_MIN_ITEMS 8
+
+struct pathspec_dir {
+	struct hashmap_entry ent;
+	const char *path;
+	int len;
+	int *items;
+	int nr, alloc;
+};
+
+struct pathspec_matcher {
+	/* the filed items, by leading directory */
+	struct hashmap dirs;
+
+	/* the items that are candidates for every path */
+	int *always;
+	int always_nr, always_alloc;
+
+	/* the leading bytes all the filed items have in common */
+	const char *common;
+	int common_len;
+};
+
+static int pathspec_dir_cmp(const void *cmp_data,
+			    const struct hashmap_entry *eptr,
+			    const struct hashmap_entry *entry_or_key,
+			    const void *keydata)
+{
+	const struct pathspec_dir *a, *b;
+
+	a = container_of(eptr, const struct pathspec_dir, ent);
+	b = container_of(entry_or_key, const struct pathspec_dir, ent);
+	return a->len != b->len || memcmp(a->path, b->path, a->len);
+}
+
+static struct pathspec_dir *find_pathspec_dir(struct pathspec_matcher *m,
+					      const char *path, int len)
+{
+	struct pathspec_dir key;
+
+	hashmap_entry_init(&key.ent, memhash(path, len));
+	key.path = path;
+	key.len = len;
+	return hashmap_get_entry(&m->dirs, &key, ent, NULL);
+}
+
+/*
+ * Return how many bytes of the match of "item" a path has to start
+ * with a leading directory of, or 0 if there is no such directory.
+ *
+ * Whether compared literally or as a pattern, the part of the match
+ * before the first wildcard has to be a prefix of the path, so the
+ * path has to be in the leading directory of that part. When there is
+ * no wildcard, the match (without its trailing slash) has to be the
+ * path or one of its leading directories.
+ */
+static int pathspec_item_dir_len(const struct pathspec_item *item)
+{
+	int len = item->len;
+
+	if (item->nowildcard_len < len) {
+		len = item->nowildcard_len;
+		while (len && item->match[len - 1] != '/')
+			len--;
+	}
+	if (len && item->match[len - 1] == '/')
+		len--;
+	return len;
+}
+
+static void compile_pathspec(struct pathspec *pathspec)
+{
+	struct pathspec_matcher *m;
+	int i;
+
+	if (pathspec->nr < PATHSPEC_MATCHER_MIN_ITEMS)
+		return;
+
+	CALLOC_ARRAY(m, 1);
+	hashmap_init(&m->dirs, pathspec_dir_cmp, NULL, 0);
+	for (i = 0; i < pathspec->nr; i++) {
+		const struct pathspec_item *item = &pathspec->items[i];
+		struct pathspec_dir *dir;
+		int len, common_len;
+
+		if (item->magic & PATHSPEC_EXCLUDE)
+			continue;
+		len = pathspec_item_dir_len(item);
+		if (!len || (item->magic & PATHSPEC_ICASE)) {
+			ALLOC_GROW(m->always, m->always_nr + 1, m->always_alloc);
+			m->always[m->always_nr++] = i;
+			continue;
+		}
+
+		if (!m->common) {
+			m->common = item->match;
+			m->common_len = item->len;
+		}
+		for (common_len = 0;
+		     common_len < m->common_len && common_len < item->len &&
+		     m->common[common_len] == item->match[common_len];
+		     common_len++)
+			; /* nothing */
+		m->common_len = common_len;
+
+		dir = find_pathspec_dir(m, item->match, len);
+		if (!dir) {
+			CALLOC_ARRAY(dir, 1);
+			hashmap_entry_init(&dir->ent, memhash(item->match, len));
+			dir->path = item->match;
+			dir->len = len;
+			hashmap_add(&m->dirs, &dir->ent);
+		}
+		ALLOC_GROW(dir->items, dir->nr + 1, dir->alloc);
+		dir->items[dir->nr++] = i;
+	}
+	pathspec->matcher = m;
+}
+
+static void free_pathspec_matcher(struct pathspec_matcher *m)
+{
+	struct hashmap_iter iter;
+	struct pathspec_dir *dir;
+
+	if (!m)
+		return;
+	hashmap_for_each_entry(&m->dirs, &iter, dir, ent)
+		free(dir->items);
+	hashmap_clear_and_free(&m->dirs, struct pathspec_dir, ent);
+	free(m->always);
+	free(m);
+}
+
+int for_each_pathspec_candidate(const struct pathspec *ps,
+				const char *name, int namelen, int prefix,
+				void (*fn)(int item, void *data), void *data)
+{
+	struct pathspec_matcher *m = ps->matcher;
+	struct pathspec_dir *dir;
+	int i, len;
+
+	if (!m)
+		return -1;
+	if (m->common &&
+	    (prefix > m->common_len || memcmp(name, m->common, prefix)))
+		return -1;
+
+	for (i = 0; i < m->always_nr; i++)
+		fn(m->always[i], data);
+	if (!hashmap_get_size(&m->dirs))
+		return 0;
+
+	len = namelen;
+	if (len && name[len - 1] == '/')
+		len--;
+	for (i = 1; i <= len; i++) {
+		int j;
+
+		if (i < len && name[i] != '/')
+			continue;
+		dir = find_pathspec_dir(m, name, i);
+		for (j = 0; dir && j < dir->nr; j++)
+			fn(dir->items[j], data);
+	}
+	return 0;
+}
+
 void parse_pathspec(struct pathspec *pathspec,
 		    unsigned magic_mask, unsigned flags,
 		    const char *prefix, const char **argv)
@@ -639,6 +815,8 @@ void parse_pathspec(struct pathspec *pathspec,
 			BUG("PATHSPEC_MAXDEPTH_VALID and PATHSPEC_KEEP_ORDER are incompatible");
 		QSORT(pathspec->items, pathspec->nr, pathspec_item_cmp);
 	}
+
+	compile_pathspec(pathspec);
 }
 
 void parse_pathspec_file(struct pathspec *pathspec, unsigned magic_mask,
@@ -701,6 +879,9 @@ void copy_pathspec(struct pathspec *dst, const struct pathspec *src)
 
 		d->attr_check = attr_check_dup(s->attr_check);
 	}
+
+	dst->matcher = NULL;
+	compile_pathspec(dst);
 }
 
 void clear_pathspec(struct pathspec *pathspec)
@@ -721,6 +902,8 @@ void clear_pathspec(struct pathspec *pathspec)
 
 	FREE_AND_NULL(pathspec->items);
 	pathspec->nr = 0;
+	free_pathspec_matcher(pathspec->matcher);
+	pathspec->matcher = NULL;
 }
 
 int match_pathspec_attrs(struct index_state *istate,
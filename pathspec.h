@@ -27,6 +27,8 @@ struct index_state;
  * In memory, a pathspec set is represented by "struct pathspec" and is
  * prepared by parse_pathspec().
  */
+struct pathspec_matcher;
+
 struct pathspec {
 	int nr;
 	unsigned int has_wildcard:1;
@@ -53,6 +55,9 @@ struct pathspec {
 		} *attr_match;
 		struct attr_check *attr_check;
 	} *items;
+
+	/* see for_each_pathspec_candidate() */
+	struct pathspec_matcher *matcher;
 };
 
 #define GUARD_PATHSPEC(ps, mask) \
@@ -129,6 +134,24 @@ void parse_pathspec_file(struct pathspec *pathspec,
 			 int nul_term_line);
 
 void copy_pathspec(struct pathspec *dst, const struct pathspec *src);
+
+/*
+ * Call fn() with the position of each non-exclude item of the pathspec
+ * that may match "name" as match_pathspec() does it, skipping items
+ * that certainly do not, and return 0. The first "prefix" bytes of
+ * "name" are those common to the items, as in match_pathspec().
+ *
+ * With enough items, parse_pathspec() files the items without magic
+ * that needs them tried against every path by their leading directory,
+ * so that only the items filed under the leading directories of "name"
+ * (and the others) are candidates, whatever the number of items. When
+ * it did not, or "name" does not start with the "prefix" bytes the
+ * items have in common, nothing is called and -1 is returned; the
+ * caller has to try all the items instead.
+ */
+int for_each_pathspec_candidate(const struct pathspec *ps,
+				const char *name, int namelen, int prefix,
+				void (*fn)(int item, void *data), void *data);
 void clear_pathspec(struct pathspec *);
 
 static inline int ps_strncmp(const struct pathspec_item *item,
@@ -9,6 +9,7 @@
 #include "progress.h"
 #include "thread-utils.h"
 #include "repository.h"
+#include "compat/bulk-lstat.h"
 
 struct fscache *fscache;
 
@@ -43,6 +44,7 @@ static void *preload_thread(void *_data)
 	struct index_state *index = p->index;
 	struct cache_entry **cep = index->cache + p->offset;
 	struct cache_def cache = CACHE_DEF_INIT;
+	struct bulk_lstat bs = BULK_LSTAT_INIT;
 
 	nr = p->nr;
 	if (nr + p->offset > index->cache_nr)
@@ -78,7 +80,8 @@ static void *preload_thread(void *_data)
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
 		p->t2_nr_lstat++;
-		if (lstat(ce->name, &st))
+		trace2_counter_add(TRACE2_COUNTER_ID_INDEX_LSTAT, 1);
+		if (bulk_lstat(&bs, ce->name, &st))
 			continue;
 		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
 			continue;
@@ -92,6 +95,7 @@ static void *preload_thread(void *_data)
 		display_progress(pd->progress, pd->n + last_nr);
 		pthread_mutex_unlock(&pd->mutex);
 	}
+	bulk_lstat_release(&bs);
 	cache_def_clear(&cache);
 	merge_fscache(fscache);
 	return NULL;
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "utf8.h"
 #include "diff.h"
 #include "revision.h"
@@ -1238,6 +1239,32 @@ static size_t parse_describe_args(const char *start, struct strvec *args)
 	return arg - start;
 }
 
+/*
+ * The commit-graph has the committer timestamp but not its time zone,
+ * so only the date formats that do not show the time zone of the
+ * committer can be taken from there.
+ */
+static size_t format_graph_committer_date(struct strbuf *sb, char part,
+					  timestamp_t date,
+					  const struct date_mode *dmode)
+{
+	switch (part) {
+	case 't':	/* date, UNIX timestamp */
+		strbuf_addf(sb, "%"PRItime, date);
+		return 2;
+	case 'r':	/* date, relative */
+		strbuf_addstr(sb, show_date(date, 0, DATE_MODE(RELATIVE)));
+		return 2;
+	case 'd':	/* date */
+		if (dmode->type != DATE_RELATIVE &&
+		    dmode->type != DATE_UNIX && !dmode->local)
+			return 0;
+		strbuf_addstr(sb, show_date(date, 0, dmode));
+		return 2;
+	}
+	return 0;
+}
+
 static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 				const char *placeholder,
 				void *context)
@@ -1498,6 +1525,21 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 		return 2;
 	}
 
+	/*
+	 * A commit parsed from the commit-graph already knows its
+	 * committer timestamp, so that formats like "%H %P %ct" or
+	 * "%h %cr", all a history graph needs, never read the commit
+	 * object.
+	 */
+	if (placeholder[0] == 'c' && !c->commit_header_parsed &&
+	    commit->date && !date_overflows(commit->date) &&
+	    commit_graph_position(commit) != COMMIT_NOT_FROM_GRAPH) {
+		res = format_graph_committer_date(sb, placeholder[1], commit->date,
+						  &c->pretty_ctx->date_mode);
+		if (res)
+			return res;
+	}
+
 	/* For the rest we have to parse the commit header. */
 	if (!c->commit_header_parsed) {
 		msg = c->message =
@@ -4,9 +4,13 @@
 #include "config.h"
 #include "transport.h"
 #include "strvec.h"
+#include "oidset.h"
 
 static char *repository_format_partial_clone;
 
+/* objects to fetch along with the next batch, see promisor_remote_hint() */
+static struct oidset hints = OIDSET_INIT;
+
 void set_repository_format_partial_clone(char *partial_clone)
 {
 	repository_format_partial_clone = xstrdup_or_null(partial_clone);
@@ -222,9 +226,9 @@ static int remove_fetched_oids(struct repository *repo,
 	return remaining_nr;
 }
 
-int promisor_remote_get_direct(struct repository *repo,
-			       const struct object_id *oids,
-			       int oid_nr)
+static int fetch_from_promisors(struct repository *repo,
+				const struct object_id *oids,
+				int oid_nr)
 {
 	struct promisor_remote *r;
 	struct object_id *remaining_oids = (struct object_id *)oids;
@@ -232,11 +236,6 @@ int promisor_remote_get_direct(struct repository *repo,
 	int to_free = 0;
 	int res = -1;
 
-	if (oid_nr == 0)
-		return 0;
-
-	promisor_remote_init();
-
 	for (r = promisors; r; r = r->next) {
 		if (fetch_objects(r->name, remaining_oids, remaining_nr) < 0) {
 			if (remaining_nr == 1)
@@ -257,3 +256,65 @@ int promisor_remote_get_direct(struct repository *repo,
 
 	return res;
 }
+
+void promisor_remote_hint(const struct object_id *oid)
+{
+	oidset_insert(&hints, oid);
+}
+
+/*
+ * Fetch "oids" together with the hinted objects that are still missing.
+ * Return 0 if that worked; the caller then has nothing left to do.
+ */
+static int fetch_with_hints(struct repository *repo,
+			    const struct object_id *oids,
+			    int oid_nr)
+{
+	struct oid_array batch = OID_ARRAY_INIT;
+	struct oidset requested = OIDSET_INIT;
+	struct oidset_iter iter;
+	const struct object_id *oid;
+	int i, res = -1;
+
+	for (i = 0; i < oid_nr; i++) {
+		oidset_insert(&requested, &oids[i]);
+		oid_array_append(&batch, &oids[i]);
+	}
+	oidset_iter_init(&hints, &iter);
+	while ((oid = oidset_iter_next(&iter))) {
+		if (oidset_contains(&requested, oid) ||
+		    !oid_object_info_extended(repo, oid, NULL,
+					      OBJECT_INFO_FOR_PREFETCH))
+			continue;
+		oid_array_append(&batch, oid);
+	}
+	oidset_clear(&hints);
+
+	/*
+	 * A hint that the remote cannot serve must not make the fetch
+	 * of what was asked for fail; the caller retries without them.
+	 */
+	if (batch.nr > oid_nr) {
+		trace2_data_intmax("promisor", repo, "fetch/hinted",
+				   batch.nr - oid_nr);
+		res = fetch_from_promisors(repo, batch.oid, batch.nr);
+	}
+
+	oid_array_clear(&batch);
+	oidset_clear(&requested);
+	return res;
+}
+
+int promisor_remote_get_direct(struct repository *repo,
+			       const struct object_id *oids,
+			       int oid_nr)
+{
+	if (oid_nr == 0)
+		return 0;
+
+	promisor_remote_init();
+
+	if (oidset_size(&hints) && !fetch_with_hints(repo, oids, oid_nr))
+		return 0;
+	return fetch_from_promisors(repo, oids, oid_nr);
+}
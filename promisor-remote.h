@@ -32,6 +32,16 @@ int promisor_remote_get_direct(struct repository *repo,
 			       const struct object_id *oids,
 			       int oid_nr);
 
+/*
+ * Tell the lazy fetching machinery that the object is likely to be
+ * needed soon. Nothing is fetched yet; the next time objects have to be
+ * fetched from promisor remotes, the hinted objects that are still
+ * missing are fetched along with them in the same request, so that
+ * callers that read many objects one at a time (e.g., "git blame")
+ * cause a few batched fetches instead of one per object.
+ */
+void promisor_remote_hint(const struct object_id *oid);
+
 /*
  * This should be used only once from setup.c to set the value we got
  * from the extensions.partialclone config option.
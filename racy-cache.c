@@ -0,0 +1,275 @@
+#include "cache.h"
+#include "repository.h"
+#include "config.h"
+#include "convert.h"
+#include "lockfile.h"
+#include "strmap.h"
+#include "racy-cache.h"
+
+/*
+ * The file starts with a header
+ *
+ *   4-byte signature "RACY"
+ *   4-byte version number (1)
+ *   4-byte hash format id
+ *   4-byte number of entries
+ *
+ * which is followed by the entries, sorted by path:
+ *
+ *   ctime seconds, ctime nanoseconds, mtime seconds, mtime nanoseconds,
+ *   dev, ino, uid, gid and size of the file, 4 bytes each
+ *   name of the blob (the_hash_algo->rawsz bytes)
+ *   NUL-terminated path
+ *
+ * All numbers are in network byte order. The mtime of the file itself
+ * is the timestamp the entries are checked against for raciness.
+ */
+
+#define RACY_CACHE_SIGNATURE 0x52414359 /* "RACY" */
+#define RACY_CACHE_VERSION 1
+#define RACY_CACHE_HEADER_SIZE 16
+#define RACY_CACHE_STAT_SIZE 36
+
+struct racy_entry {
+	struct stat_data sd;
+	struct object_id oid;
+	unsigned used : 1;
+};
+
+static struct racy_cache {
+	int initialized;
+	int enabled;
+	struct strmap entries;
+	unsigned hits, added;
+} cache;
+
+static char *cache_path(struct repository *r)
+{
+	return repo_git_path(r, "index.racy");
+}
+
+static int is_racy(const struct cache_time *ts, const struct stat_data *sd)
+{
+#ifdef USE_NSEC
+	return ts->sec < sd->sd_mtime.sec ||
+	       (ts->sec == sd->sd_mtime.sec && ts->nsec <= sd->sd_mtime.nsec);
+#else
+	return ts->sec <= sd->sd_mtime.sec;
+#endif
+}
+
+static const unsigned char *decode_stat_data(struct stat_data *sd,
+					     const unsigned char *p)
+{
+	sd->sd_ctime.sec = get_be32(p);
+	sd->sd_ctime.nsec = get_be32(p + 4);
+	sd->sd_mtime.sec = get_be32(p + 8);
+	sd->sd_mtime.nsec = get_be32(p + 12);
+	sd->sd_dev = get_be32(p + 16);
+	sd->sd_ino = get_be32(p + 20);
+	sd->sd_uid = get_be32(p + 24);
+	sd->sd_gid = get_be32(p + 28);
+	sd->sd_size = get_be32(p + 32);
+	return p + RACY_CACHE_STAT_SIZE;
+}
+
+static void encode_stat_data(struct strbuf *out, const struct stat_data *sd)
+{
+	unsigned char buf[RACY_CACHE_STAT_SIZE];
+
+	put_be32(buf, sd->sd_ctime.sec);
+	put_be32(buf + 4, sd->sd_ctime.nsec);
+	put_be32(buf + 8, sd->sd_mtime.sec);
+	put_be32(buf + 12, sd->sd_mtime.nsec);
+	put_be32(buf + 16, sd->sd_dev);
+	put_be32(buf + 20, sd->sd_ino);
+	put_be32(buf + 24, sd->sd_uid);
+	put_be32(buf + 28, sd->sd_gid);
+	put_be32(buf + 32, sd->sd_size);
+	strbuf_add(out, buf, sizeof(buf));
+}
+
+static int parse_cache(const unsigned char *p, size_t size,
+		       const struct cache_time *ts)
+{
+	const unsigned char *end = p + size;
+	size_t rawsz = the_hash_algo->rawsz;
+	uint32_t nr, i;
+
+	if (size < RACY_CACHE_HEADER_SIZE ||
+	    get_be32(p) != RACY_CACHE_SIGNATURE ||
+	    get_be32(p + 4) != RACY_CACHE_VERSION ||
+	    get_be32(p + 8) != the_hash_algo->format_id)
+		return -1;
+	nr = get_be32(p + 12);
+	p += RACY_CACHE_HEADER_SIZE;
+
+	for (i = 0; i < nr; i++) {
+		struct racy_entry *e;
+		struct stat_data sd;
+		const unsigned char *name;
+
+		if ((size_t)(end - p) < RACY_CACHE_STAT_SIZE + rawsz + 1)
+			return -1;
+		p = decode_stat_data(&sd, p);
+		name = p + rawsz;
+		if (!memchr(name, '\0', end - name))
+			return -1;
+
+		/* modified while or after the cache was written? */
+		if (!is_racy(ts, &sd)) {
+			CALLOC_ARRAY(e, 1);
+			e->sd = sd;
+			oidread(&e->oid, p);
+			free(strmap_put(&cache.entries, (const char *)name, e));
+		}
+		p = name + strlen((const char *)name) + 1;
+	}
+	return p == end ? 0 : -1;
+}
+
+static void read_cache(struct repository *r)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct cache_time ts;
+	struct stat st;
+	char *path;
+	int fd;
+
+	path = cache_path(r);
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) < 0 ||
+	    strbuf_read(&buf, fd, xsize_t(st.st_size)) < 0) {
+		close(fd);
+		strbuf_release(&buf);
+		return;
+	}
+	close(fd);
+
+	ts.sec = st.st_mtime;
+	ts.nsec = ST_MTIME_NSEC(st);
+	if (parse_cache((const unsigned char *)buf.buf, buf.len, &ts) < 0) {
+		warning(_("ignoring malformed racy cache"));
+		strmap_partial_clear(&cache.entries, 1);
+	}
+	strbuf_release(&buf);
+}
+
+int racy_cache_usable(struct index_state *istate,
+		      const struct cache_entry *ce, struct stat *st)
+{
+	if (istate->repo != the_repository || !S_ISREG(st->st_mode))
+		return 0;
+
+	if (!cache.initialized) {
+		cache.initialized = 1;
+		strmap_init(&cache.entries);
+		repo_config_get_bool(the_repository, "index.racycache",
+				     &cache.enabled);
+		if (cache.enabled)
+			read_cache(the_repository);
+	}
+	return cache.enabled && !would_convert_to_git(istate, ce->name);
+}
+
+int racy_cache_lookup(struct index_state *istate,
+		      const struct cache_entry *ce, struct stat *st)
+{
+	struct racy_entry *e = strmap_get(&cache.entries, ce->name);
+
+	if (!e || !oideq(&e->oid, &ce->oid) || match_stat_data(&e->sd, st))
+		return 0;
+	e->used = 1;
+	cache.hits++;
+	return 1;
+}
+
+void racy_cache_add(struct index_state *istate,
+		    const struct cache_entry *ce, struct stat *st)
+{
+	struct racy_entry *e = strmap_get(&cache.entries, ce->name);
+
+	if (!e) {
+		CALLOC_ARRAY(e, 1);
+		strmap_put(&cache.entries, ce->name, e);
+	}
+	fill_stat_data(&e->sd, st);
+	oidcpy(&e->oid, &ce->oid);
+	e->used = 1;
+	cache.added++;
+}
+
+static int entry_cmp(const void *va, const void *vb)
+{
+	const struct strmap_entry *a = *(const struct strmap_entry **)va;
+	const struct strmap_entry *b = *(const struct strmap_entry **)vb;
+
+	return strcmp(a->key, b->key);
+}
+
+static void write_cache(struct repository *r)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf out = STRBUF_INIT;
+	struct strmap_entry **used, *entry;
+	struct hashmap_iter iter;
+	unsigned char header[RACY_CACHE_HEADER_SIZE];
+	size_t nr = 0, i;
+	char *path;
+	int fd;
+
+	ALLOC_ARRAY(used, strmap_get_size(&cache.entries));
+	strmap_for_each_entry(&cache.entries, &iter, entry) {
+		const struct racy_entry *e = entry->value;
+
+		/* drop the entries of files that no longer need them */
+		if (e->used)
+			used[nr++] = entry;
+	}
+	QSORT(used, nr, entry_cmp);
+
+	put_be32(header, RACY_CACHE_SIGNATURE);
+	put_be32(header + 4, RACY_CACHE_VERSION);
+	put_be32(header + 8, the_hash_algo->format_id);
+	put_be32(header + 12, nr);
+	strbuf_add(&out, header, sizeof(header));
+	for (i = 0; i < nr; i++) {
+		const struct racy_entry *e = used[i]->value;
+
+		encode_stat_data(&out, &e->sd);
+		strbuf_add(&out, e->oid.hash, the_hash_algo->rawsz);
+		strbuf_add(&out, used[i]->key, strlen(used[i]->key) + 1);
+	}
+
+	path = cache_path(r);
+	fd = hold_lock_file_for_update(&lk, path, 0);
+	if (fd >= 0 &&
+	    (write_in_full(fd, out.buf, out.len) < 0 ||
+	     commit_lock_file(&lk) < 0))
+		rollback_lock_file(&lk);
+
+	free(path);
+	free(used);
+	strbuf_release(&out);
+}
+
+void racy_cache_write(struct index_state *istate)
+{
+	if (!cache.initialized)
+		return;
+
+	if (cache.hits || cache.added) {
+		trace2_data_intmax("index", the_repository, "racy-cache/hits",
+				   cache.hits);
+		trace2_data_intmax("index", the_repository, "racy-cache/added",
+				   cache.added);
+	}
+	if (cache.added && use_optional_locks())
+		write_cache(the_repository);
+
+	strmap_clear(&cache.entries, 1);
+	memset(&cache, 0, sizeof(cache));
+}
@@ -0,0 +1,52 @@
+#ifndef RACY_CACHE_H
+#define RACY_CACHE_H
+
+struct index_state;
+struct cache_entry;
+struct stat;
+
+/*
+ * Index entries whose files were modified no earlier than the index was
+ * written are "racily clean": their stat data cannot tell whether the
+ * file changed since, so their contents are compared every time they
+ * are looked at, until the index is written again (see
+ * Documentation/technical/racy-git.txt). Commands that do not write
+ * the index, like "git diff-files" or "git update-index --refresh"
+ * with nothing to update, keep paying for that.
+ *
+ * When `index.racyCache` is set, the outcome of such a comparison is
+ * remembered in "$GIT_DIR/index.racy": the stat data of the file and
+ * the name of the blob its contents hash to. A later comparison is
+ * skipped if the file still has the same stat data (including its
+ * inode), the index entry still names the same blob, and the file was
+ * not modified in the same timestamp granularity the cache was written
+ * in, which would make the recorded stat data racy in turn.
+ *
+ * Files that are converted when added (see gitattributes(5)) are never
+ * remembered, as changing the attributes changes what they hash to.
+ * None of this is thread-safe.
+ */
+
+/*
+ * Can the comparison of the contents of `ce` with the file described
+ * by `st` use the cache?
+ */
+int racy_cache_usable(struct index_state *istate,
+		      const struct cache_entry *ce, struct stat *st);
+
+/* Is `ce` known to match the contents of the file described by `st`? */
+int racy_cache_lookup(struct index_state *istate,
+		      const struct cache_entry *ce, struct stat *st);
+
+/* Remember that `ce` matches the contents of the file described by `st`. */
+void racy_cache_add(struct index_state *istate,
+		    const struct cache_entry *ce, struct stat *st);
+
+/*
+ * Write out the entries looked up or added since the cache was read if
+ * any were added, and release it. Failing to write is not an error, as
+ * the cache is only an optimization.
+ */
+void racy_cache_write(struct index_state *istate);
+
+#endif /* RACY_CACHE_H */
@@ -12,6 +12,8 @@
 #include "userdiff.h"
 #include "apply.h"
 #include "revision.h"
+#include "config.h"
+#include "thread-utils.h"
 
 struct patch_util {
 	/* For the search for an exact match */
@@ -20,6 +22,8 @@ struct patch_util {
 
 	int i, shown;
 	int diffsize;
+	/* the number of lines of "diff" */
+	int diff_lines;
 	size_t diff_offset;
 	/* the index of the matching item in the other branch, or -1 */
 	int matching;
@@ -307,31 +311,169 @@ static int diffsize(const char *a, const char *b)
 	return COST_MAX;
 }
 
+struct cost_matrix {
+	struct string_list *a, *b;
+	int *cost;
+	int n, creation_factor;
+};
+
+static void fill_cost_row(struct cost_matrix *m, int i)
+{
+	struct patch_util *a_util = m->a->items[i].util;
+	int j, c;
+
+	for (j = 0; j < m->b->nr; j++) {
+		struct patch_util *b_util = m->b->items[j].util;
+
+		if (a_util->matching == j)
+			c = 0;
+		else if (a_util->matching < 0 && b_util->matching < 0) {
+			int a_cost = a_util->diffsize * m->creation_factor / 100;
+			int b_cost = b_util->diffsize * m->creation_factor / 100;
+
+			/*
+			 * The diff has at least as many lines as the
+			 * patches differ in length. If that is more than
+			 * dropping one patch and creating the other would
+			 * cost, the pair cannot be in the assignment.
+			 */
+			if (abs(a_util->diff_lines - b_util->diff_lines) >
+			    a_cost + b_cost)
+				c = COST_MAX;
+			else
+				c = diffsize(a_util->diff, b_util->diff);
+		} else
+			c = COST_MAX;
+		m->cost[i + m->n * j] = c;
+	}
+}
+
+struct cost_thread_data {
+	pthread_t pthread;
+	struct cost_matrix *matrix;
+
+	/* Shared by all threads and guarded by "mutex". */
+	pthread_mutex_t *mutex;
+	int *next;
+};
+
+static void *cost_thread(void *_data)
+{
+	struct cost_thread_data *d = _data;
+
+	trace2_thread_start("range-diff-worker");
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(d->mutex);
+		i = (*d->next)++;
+		pthread_mutex_unlock(d->mutex);
+		if (i >= d->matrix->a->nr)
+			break;
+
+		fill_cost_row(d->matrix, i);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static int range_diff_threads(void)
+{
+	int nr_threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	nr_threads = git_env_ulong("GIT_TEST_RANGE_DIFF_THREADS", 0);
+	if (nr_threads)
+		return nr_threads;
+
+	if (git_config_get_int("rangediff.threads", &nr_threads))
+		nr_threads = 0;
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    nr_threads, "rangeDiff.threads");
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+static void fill_cost_rows(struct cost_matrix *m)
+{
+	int nr_threads = range_diff_threads();
+	struct cost_thread_data *data;
+	pthread_mutex_t mutex;
+	int next = 0, i, err;
+
+	if (nr_threads > m->a->nr)
+		nr_threads = m->a->nr;
+	if (nr_threads <= 1) {
+		for (i = 0; i < m->a->nr; i++)
+			fill_cost_row(m, i);
+		return;
+	}
+
+	pthread_mutex_init(&mutex, NULL);
+	CALLOC_ARRAY(data, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		struct cost_thread_data *d = &data[i];
+
+		d->matrix = m;
+		d->mutex = &mutex;
+		d->next = &next;
+		err = pthread_create(&d->pthread, NULL, cost_thread, d);
+		if (err)
+			die(_("unable to create range-diff thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join range-diff thread");
+	free(data);
+	pthread_mutex_destroy(&mutex);
+}
+
+static int count_lines(const char *p)
+{
+	int nr = 0;
+
+	while ((p = strchr(p, '\n'))) {
+		nr++;
+		p++;
+	}
+	return nr;
+}
+
 static void get_correspondences(struct string_list *a, struct string_list *b,
 				int creation_factor)
 {
 	int n = a->nr + b->nr;
 	int *cost, c, *a2b, *b2a;
 	int i, j;
+	struct cost_matrix matrix;
 
 	ALLOC_ARRAY(cost, st_mult(n, n));
 	ALLOC_ARRAY(a2b, n);
 	ALLOC_ARRAY(b2a, n);
 
 	for (i = 0; i < a->nr; i++) {
-		struct patch_util *a_util = a->items[i].util;
+		struct patch_util *util = a->items[i].util;
+		util->diff_lines = count_lines(util->diff);
+	}
+	for (j = 0; j < b->nr; j++) {
+		struct patch_util *util = b->items[j].util;
+		util->diff_lines = count_lines(util->diff);
+	}
 
-		for (j = 0; j < b->nr; j++) {
-			struct patch_util *b_util = b->items[j].util;
+	matrix.a = a;
+	matrix.b = b;
+	matrix.cost = cost;
+	matrix.n = n;
+	matrix.creation_factor = creation_factor;
+	fill_cost_rows(&matrix);
 
-			if (a_util->matching == j)
-				c = 0;
-			else if (a_util->matching < 0 && b_util->matching < 0)
-				c = diffsize(a_util->diff, b_util->diff);
-			else
-				c = COST_MAX;
-			cost[i + n * j] = c;
-		}
+	for (i = 0; i < a->nr; i++) {
+		struct patch_util *a_util = a->items[i].util;
 
 		c = a_util->matching < 0 ?
 			a_util->diffsize * creation_factor / 100 : COST_MAX;
@@ -13,6 +13,7 @@
 #include "worktree.h"
 #include "object-store.h"
 #include "pack-bitmap.h"
+#include "pack-mtimes.h"
 
 struct connectivity_progress {
 	struct progress *progress;
@@ -60,6 +61,7 @@ static void mark_commit(struct commit *c, void *data)
 struct recent_data {
 	struct rev_info *revs;
 	timestamp_t timestamp;
+	struct bitmap_index *bitmap_git;
 };
 
 static void add_recent_object(const struct object_id *oid,
@@ -109,9 +111,9 @@ static int add_recent_loose(const struct object_id *oid,
 			    const char *path, void *data)
 {
 	struct stat st;
-	struct object *obj = lookup_object(the_repository, oid);
+	struct recent_data *rd = data;
 
-	if (obj && obj->flags & SEEN)
+	if (is_object_reachable(rd->bitmap_git, oid))
 		return 0;
 
 	if (stat(path, &st) < 0) {
@@ -134,22 +136,23 @@ static int add_recent_packed(const struct object_id *oid,
 			     struct packed_git *p, uint32_t pos,
 			     void *data)
 {
-	struct object *obj = lookup_object(the_repository, oid);
+	struct recent_data *rd = data;
 
-	if (obj && obj->flags & SEEN)
+	if (is_object_reachable(rd->bitmap_git, oid))
 		return 0;
-	add_recent_object(oid, p->mtime, data);
+	add_recent_object(oid, packed_object_mtime(p, pos), data);
 	return 0;
 }
 
-int add_unseen_recent_objects_to_traversal(struct rev_info *revs,
-					   timestamp_t timestamp)
+static int add_recent_objects(struct rev_info *revs, timestamp_t timestamp,
+			      struct bitmap_index *bitmap_git)
 {
 	struct recent_data data;
 	int r;
 
 	data.revs = revs;
 	data.timestamp = timestamp;
+	data.bitmap_git = bitmap_git;
 
 	r = for_each_loose_object(add_recent_loose, &data,
 				  FOR_EACH_OBJECT_LOCAL_ONLY);
@@ -159,6 +162,22 @@ int add_unseen_recent_objects_to_traversal(struct rev_info *revs,
 				      FOR_EACH_OBJECT_LOCAL_ONLY);
 }
 
+int add_unseen_recent_objects_to_traversal(struct rev_info *revs,
+					   timestamp_t timestamp)
+{
+	return add_recent_objects(revs, timestamp, NULL);
+}
+
+int is_object_reachable(struct bitmap_index *bitmap_git,
+			const struct object_id *oid)
+{
+	struct object *obj = lookup_object(the_repository, oid);
+
+	if (obj && obj->flags & SEEN)
+		return 1;
+	return bitmap_has_oid_in_result(bitmap_git, oid);
+}
+
 static void *lookup_object_by_type(struct repository *r,
 				   const struct object_id *oid,
 				   enum object_type type)
@@ -192,8 +211,10 @@ static int mark_object_seen(const struct object_id *oid,
 	return 0;
 }
 
-void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
-			    timestamp_t mark_recent, struct progress *progress)
+struct bitmap_index *mark_reachable_objects(struct rev_info *revs,
+					    int mark_reflog,
+					    timestamp_t mark_recent,
+					    struct progress *progress)
 {
 	struct connectivity_progress cp;
 	struct bitmap_index *bitmap_git;
@@ -225,8 +246,20 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 
 	bitmap_git = prepare_bitmap_walk(revs, NULL, 0);
 	if (bitmap_git) {
+		/*
+		 * Only give the commits an object struct and a SEEN flag:
+		 * shallow pruning looks at them, and the walk from recent
+		 * objects below stops at them. Everything else is looked
+		 * up in the bitmap, which is much cheaper than creating
+		 * an object for each of the trees and blobs.
+		 */
+		revs->tag_objects = 0;
+		revs->blob_objects = 0;
+		revs->tree_objects = 0;
 		traverse_bitmap_commit_list(bitmap_git, revs, mark_object_seen);
-		free_bitmap_index(bitmap_git);
+		revs->tag_objects = 1;
+		revs->blob_objects = 1;
+		revs->tree_objects = 1;
 	} else {
 		if (prepare_revision_walk(revs))
 			die("revision walk setup failed");
@@ -235,7 +268,7 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 
 	if (mark_recent) {
 		revs->ignore_missing_links = 1;
-		if (add_unseen_recent_objects_to_traversal(revs, mark_recent))
+		if (add_recent_objects(revs, mark_recent, bitmap_git))
 			die("unable to mark recent objects");
 		if (prepare_revision_walk(revs))
 			die("revision walk setup failed");
@@ -243,4 +276,5 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 	}
 
 	display_progress(cp.progress, cp.count);
+	return bitmap_git;
 }
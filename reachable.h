@@ -3,10 +3,32 @@
 
 struct progress;
 struct rev_info;
+struct bitmap_index;
+struct object_id;
 
 int add_unseen_recent_objects_to_traversal(struct rev_info *revs,
 					   timestamp_t timestamp);
-void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
-			    timestamp_t mark_recent, struct progress *);
+
+/*
+ * Mark the objects reachable from refs, the index and, if "mark_reflog"
+ * is set, reflogs as SEEN, along with those reachable from objects
+ * newer than "mark_recent" if it is not zero.
+ *
+ * When reachability bitmaps can answer for the tips, only the commits
+ * they find are marked; the trees, blobs and tags stay in the returned
+ * bitmap walk, which is_object_reachable() consults and the caller must
+ * release with free_bitmap_index(). Otherwise NULL is returned.
+ */
+struct bitmap_index *mark_reachable_objects(struct rev_info *revs,
+					    int mark_reflog,
+					    timestamp_t mark_recent,
+					    struct progress *);
+
+/*
+ * Whether mark_reachable_objects() found "oid" to be reachable, given
+ * the bitmap walk it returned.
+ */
+int is_object_reachable(struct bitmap_index *bitmap_git,
+			const struct object_id *oid);
 
 #endif
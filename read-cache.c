@@ -26,6 +26,9 @@
 #include "thread-utils.h"
 #include "progress.h"
 #include "sparse-index.h"
+#include "ewah/ewok.h"
+#include "csum-file.h"
+#include "racy-cache.h"
 
 /* Mask for the name length in ce_flags in the on-disk index */
 
@@ -292,6 +295,26 @@ static int ce_modified_check_fs(struct index_state *istate,
 	return 0;
 }
 
+/*
+ * Like ce_modified_check_fs(), but skip comparing the contents of
+ * files that the racy cache knows to match already.
+ */
+static int ce_modified_check_fs_cached(struct index_state *istate,
+				       const struct cache_entry *ce,
+				       struct stat *st)
+{
+	int changed;
+
+	if (!racy_cache_usable(istate, ce, st))
+		return ce_modified_check_fs(istate, ce, st);
+	if (racy_cache_lookup(istate, ce, st))
+		return 0;
+	changed = ce_modified_check_fs(istate, ce, st);
+	if (!changed)
+		racy_cache_add(istate, ce, st);
+	return changed;
+}
+
 static int ce_match_stat_basic(const struct cache_entry *ce, struct stat *st)
 {
 	unsigned int changed = 0;
@@ -421,7 +444,7 @@ int ie_match_stat(struct index_state *istate,
 		if (assume_racy_is_modified)
 			changed |= DATA_CHANGED;
 		else
-			changed |= ce_modified_check_fs(istate, ce, st);
+			changed |= ce_modified_check_fs_cached(istate, ce, st);
 	}
 
 	return changed;
@@ -472,7 +495,7 @@ int ie_modified(struct index_state *istate,
 	    (S_ISGITLINK(ce->ce_mode) || ce->ce_stat_data.sd_size != 0))
 		return changed;
 
-	changed_fs = ce_modified_check_fs(istate, ce, st);
+	changed_fs = ce_modified_check_fs_cached(istate, ce, st);
 	if (changed_fs)
 		return changed | changed_fs;
 	return 0;
@@ -1459,6 +1482,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 
 	if (t2_did_lstat)
 		*t2_did_lstat = 1;
+	trace2_counter_add(TRACE2_COUNTER_ID_INDEX_LSTAT, 1);
 	if (lstat(ce->name, &st) < 0) {
 		if (ignore_missing && errno == ENOENT)
 			return ce;
@@ -1596,8 +1620,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	 */
 	preload_index(istate, pathspec, 0);
 	trace2_region_enter("index", "refresh", NULL);
-	/* TODO: audit for interaction with sparse-index. */
-	ensure_full_index(istate);
+
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce, *new_entry;
 		int cache_errno = 0;
@@ -1612,6 +1635,13 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 		if (ignore_skip_worktree && ce_skip_worktree(ce))
 			continue;
 
+		/*
+		 * A sparse directory has no stat() information to update,
+		 * as it is not in the worktree.
+		 */
+		if (S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+
 		if (pathspec && !ce_path_match(istate, ce, pathspec, seen))
 			filtered = 1;
 
@@ -1675,6 +1705,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	trace2_data_intmax("index", NULL, "refresh/sum_lstat", t2_sum_lstat);
 	trace2_data_intmax("index", NULL, "refresh/sum_scan", t2_sum_scan);
 	trace2_region_leave("index", "refresh", NULL);
+	racy_cache_write(istate);
 	if (progress) {
 		display_progress(progress, istate->cache_nr);
 		stop_progress(&progress);
@@ -1769,10 +1800,9 @@ int verify_index_checksum;
 /* Allow fsck to force verification of the cache entry order. */
 int verify_ce_order;
 
-static int verify_hdr(const struct cache_header *hdr, unsigned long size)
+static int verify_hdr(const char *path, const struct cache_header *hdr,
+		      unsigned long size)
 {
-	git_hash_ctx c;
-	unsigned char hash[GIT_MAX_RAWSZ];
 	int hdr_version;
 
 	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
@@ -1784,10 +1814,12 @@ static int verify_hdr(const struct cache_header *hdr, unsigned long size)
 	if (!verify_index_checksum)
 		return 0;
 
-	the_hash_algo->init_fn(&c);
-	the_hash_algo->update_fn(&c, hdr, size - the_hash_algo->rawsz);
-	the_hash_algo->final_fn(hash, &c);
-	if (!hasheq(hash, (unsigned char *)hdr + size - the_hash_algo->rawsz))
+	/* written with index.skipHash */
+	if (hasheq((unsigned char *)hdr + size - the_hash_algo->rawsz,
+		    null_oid()->hash))
+		return 0;
+
+	if (!hashfile_checksum_valid(path, (const unsigned char *)hdr, size))
 		return error(_("bad index file sha1 signature"));
 	return 0;
 }
@@ -1906,8 +1938,6 @@ static struct cache_entry *create_from_disk(struct mem_pool *ce_mem_pool,
 	ce->ce_namelen = len;
 	ce->index = 0;
 	oidread(&ce->oid, ondisk->data);
-	memcpy(ce->name, name, len);
-	ce->name[len] = '\0';
 
 	if (expand_name_field) {
 		if (copy_len)
@@ -1957,8 +1987,10 @@ static void tweak_untracked_cache(struct index_state *istate)
 		return;
 	}
 
-	if (r->settings.core_untracked_cache == UNTRACKED_CACHE_WRITE)
+	if (r->settings.core_untracked_cache == UNTRACKED_CACHE_WRITE) {
+		fsmonitor_restore_untracked_cache(istate);
 		add_untracked_cache(istate);
+	}
 }
 
 static void tweak_split_index(struct index_state *istate)
@@ -2100,6 +2132,83 @@ static unsigned long load_all_cache_entries(struct index_state *istate,
 	return consumed;
 }
 
+/*
+ * Return the name of the first entry of an offset table block. As
+ * prefix compression starts over with each block, it is stored in
+ * full even in index v4.
+ */
+static const char *block_first_name(struct index_state *istate,
+				    const char *mmap,
+				    const struct index_entry_offset *block)
+{
+	const struct ondisk_cache_entry *ondisk =
+		(const struct ondisk_cache_entry *)(mmap + block->offset);
+	const unsigned char *flagsp = ondisk->data + the_hash_algo->rawsz;
+	const unsigned char *name = flagsp + sizeof(uint16_t);
+
+	if (get_be16(flagsp) & CE_EXTENDED)
+		name += sizeof(uint16_t);
+	if (istate->version == 4)
+		decode_varint(&name);
+	return (const char *)name;
+}
+
+/*
+ * Load only the blocks of the offset table that may hold entries whose
+ * names start with the first `prefixlen` bytes of `prefix`. As entries
+ * are sorted, these blocks are adjacent. Return the number of bytes of
+ * the index that were consumed.
+ */
+static unsigned long load_cache_entries_with_prefix(struct index_state *istate,
+			const char *mmap, size_t mmap_size,
+			struct index_entry_offset_table *ieot,
+			const char *prefix, size_t prefixlen)
+{
+	int i, first, last;
+	unsigned int nr = 0;
+	unsigned long consumed = 0;
+
+	/*
+	 * Skip the blocks whose entries all sort before the prefix, that
+	 * is the blocks followed by one that starts at or before it.
+	 */
+	for (first = 0; first + 1 < ieot->nr; first++) {
+		const char *next = block_first_name(istate, mmap,
+						    &ieot->entries[first + 1]);
+		int cmp = strncmp(next, prefix, prefixlen);
+
+		if (cmp > 0 || (!cmp && next[prefixlen]))
+			break;
+	}
+
+	/* and stop at the first one that starts after it */
+	for (last = first; last < ieot->nr; last++) {
+		if (strncmp(block_first_name(istate, mmap, &ieot->entries[last]),
+			    prefix, prefixlen) > 0 && last > first)
+			break;
+		nr += ieot->entries[last].nr;
+	}
+
+	istate->cache_nr = nr;
+
+	istate->ce_mem_pool = xmalloc(sizeof(*istate->ce_mem_pool));
+	if (istate->version == 4)
+		mem_pool_init(istate->ce_mem_pool,
+			      estimate_cache_size_from_compressed(nr));
+	else
+		mem_pool_init(istate->ce_mem_pool,
+			      estimate_cache_size(mmap_size, nr));
+
+	nr = 0;
+	for (i = first; i < last; i++) {
+		consumed += load_cache_entry_block(istate, istate->ce_mem_pool,
+				nr, ieot->entries[i].nr, mmap,
+				ieot->entries[i].offset, NULL);
+		nr += ieot->entries[i].nr;
+	}
+	return consumed;
+}
+
 /*
  * Mostly randomly chosen maximum thread counts: we
  * cap the parallelism to online_cpus() threads, and we want
@@ -2113,9 +2222,10 @@ struct load_cache_entries_thread_data
 {
 	pthread_t pthread;
 	struct index_state *istate;
-	struct mem_pool *ce_mem_pool;
+	struct mem_pool_shared *shared;
 	int offset;
 	const char *mmap;
+	size_t mmap_size;
 	struct index_entry_offset_table *ieot;
 	int ieot_start;		/* starting index into the ieot array */
 	int ieot_blocks;	/* count of ieot entries to process */
@@ -2129,14 +2239,25 @@ struct load_cache_entries_thread_data
 static void *load_cache_entries_thread(void *_data)
 {
 	struct load_cache_entries_thread_data *p = _data;
-	int i;
+	struct mem_pool ce_mem_pool;
+	int i, nr = 0;
+
+	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++)
+		nr += p->ieot->entries[i].nr;
+	if (p->istate->version == 4)
+		mem_pool_init(&ce_mem_pool, estimate_cache_size_from_compressed(nr));
+	else
+		mem_pool_init(&ce_mem_pool, estimate_cache_size(p->mmap_size, nr));
 
 	/* iterate across all ieot blocks assigned to this thread */
 	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
-		p->consumed += load_cache_entry_block(p->istate, p->ce_mem_pool,
+		p->consumed += load_cache_entry_block(p->istate, &ce_mem_pool,
 			p->offset, p->ieot->entries[i].nr, p->mmap, p->ieot->entries[i].offset, NULL);
 		p->offset += p->ieot->entries[i].nr;
 	}
+
+	/* the entries are the index's now, and so is their memory */
+	mem_pool_hand_off(p->shared, &ce_mem_pool);
 	return NULL;
 }
 
@@ -2145,6 +2266,7 @@ static unsigned long load_cache_entries_threaded(struct index_state *istate, con
 {
 	int i, offset, ieot_blocks, ieot_start, err;
 	struct load_cache_entries_thread_data *data;
+	struct mem_pool_shared shared;
 	unsigned long consumed = 0;
 
 	/* a little sanity checking */
@@ -2153,6 +2275,7 @@ static unsigned long load_cache_entries_threaded(struct index_state *istate, con
 
 	istate->ce_mem_pool = xmalloc(sizeof(*istate->ce_mem_pool));
 	mem_pool_init(istate->ce_mem_pool, 0);
+	mem_pool_shared_init(&shared, istate->ce_mem_pool);
 
 	/* ensure we have no more threads than we have blocks to process */
 	if (nr_threads > ieot->nr)
@@ -2163,31 +2286,20 @@ static unsigned long load_cache_entries_threaded(struct index_state *istate, con
 	ieot_blocks = DIV_ROUND_UP(ieot->nr, nr_threads);
 	for (i = 0; i < nr_threads; i++) {
 		struct load_cache_entries_thread_data *p = &data[i];
-		int nr, j;
+		int j;
 
 		if (ieot_start + ieot_blocks > ieot->nr)
 			ieot_blocks = ieot->nr - ieot_start;
 
 		p->istate = istate;
+		p->shared = &shared;
 		p->offset = offset;
 		p->mmap = mmap;
+		p->mmap_size = mmap_size;
 		p->ieot = ieot;
 		p->ieot_start = ieot_start;
 		p->ieot_blocks = ieot_blocks;
 
-		/* create a mem_pool for each thread */
-		nr = 0;
-		for (j = p->ieot_start; j < p->ieot_start + p->ieot_blocks; j++)
-			nr += p->ieot->entries[j].nr;
-		p->ce_mem_pool = xmalloc(sizeof(*istate->ce_mem_pool));
-		if (istate->version == 4) {
-			mem_pool_init(p->ce_mem_pool,
-				estimate_cache_size_from_compressed(nr));
-		} else {
-			mem_pool_init(p->ce_mem_pool,
-				estimate_cache_size(mmap_size, nr));
-		}
-
 		err = pthread_create(&p->pthread, NULL, load_cache_entries_thread, p);
 		if (err)
 			die(_("unable to create load_cache_entries thread: %s"), strerror(err));
@@ -2204,17 +2316,23 @@ static unsigned long load_cache_entries_threaded(struct index_state *istate, con
 		err = pthread_join(p->pthread, NULL);
 		if (err)
 			die(_("unable to join load_cache_entries thread: %s"), strerror(err));
-		mem_pool_combine(istate->ce_mem_pool, p->ce_mem_pool);
 		consumed += p->consumed;
 	}
 
+	mem_pool_shared_release(&shared);
 	free(data);
 
 	return consumed;
 }
 
 /* remember to discard_cache() before reading a different cache! */
-int do_read_index(struct index_state *istate, const char *path, int must_exist)
+/*
+ * Read the index at `path`. If `prefix` is given, only load the blocks
+ * of entries that may start with it, or return -1 without reading
+ * anything if the index cannot be read that way.
+ */
+static int do_read_index_1(struct index_state *istate, const char *path,
+			   int must_exist, const char *prefix, size_t prefixlen)
 {
 	int fd;
 	struct stat st;
@@ -2252,9 +2370,20 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	close(fd);
 
 	hdr = (const struct cache_header *)mmap;
-	if (verify_hdr(hdr, mmap_size) < 0)
+	if (verify_hdr(path, hdr, mmap_size) < 0)
 		goto unmap;
 
+	if (prefix) {
+		extension_offset = read_eoie_extension(mmap, mmap_size);
+		if (extension_offset)
+			ieot = read_ieot_extension(mmap, mmap_size,
+						   extension_offset);
+		if (!ieot) {
+			munmap((void *)mmap, mmap_size);
+			return -1;
+		}
+	}
+
 	oidread(&istate->oid, (const unsigned char *)hdr + mmap_size - the_hash_algo->rawsz);
 	istate->version = ntohl(hdr->hdr_version);
 	istate->cache_nr = ntohl(hdr->hdr_entries);
@@ -2279,7 +2408,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 			nr_threads = cpus;
 	}
 
-	if (!HAVE_THREADS)
+	if (!HAVE_THREADS || prefix)
 		nr_threads = 1;
 
 	if (nr_threads > 1) {
@@ -2303,7 +2432,11 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	if (extension_offset && nr_threads > 1)
 		ieot = read_ieot_extension(mmap, mmap_size, extension_offset);
 
-	if (ieot) {
+	if (prefix) {
+		src_offset += load_cache_entries_with_prefix(istate, mmap, mmap_size,
+							     ieot, prefix, prefixlen);
+		free(ieot);
+	} else if (ieot) {
 		src_offset += load_cache_entries_threaded(istate, mmap, mmap_size, nr_threads, ieot);
 		free(ieot);
 	} else {
@@ -2314,7 +2447,10 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
 	/* if we created a thread, join it otherwise load the extensions on the primary thread */
-	if (extension_offset) {
+	if (prefix) {
+		p.src_offset = extension_offset;
+		load_index_extensions(&p);
+	} else if (extension_offset) {
 		int ret = pthread_join(p.pthread, NULL);
 		if (ret)
 			die(_("unable to join load_index_extensions thread: %s"), strerror(ret));
@@ -2324,6 +2460,20 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	}
 	munmap((void *)mmap, mmap_size);
 
+	/*
+	 * The entries of a split or sparse index, and the fsmonitor
+	 * bitmap, cannot be made sense of without all of the others.
+	 */
+	if (prefix &&
+	    (istate->split_index || istate->sparse_index ||
+	     istate->fsmonitor_last_update)) {
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+		istate->sparse_index = 0;
+		discard_index(istate);
+		return -1;
+	}
+
 	/*
 	 * TODO trace2: replace "the_repository" with the actual repo instance
 	 * that is associated with the given "istate".
@@ -2346,6 +2496,11 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	die(_("index file corrupt"));
 }
 
+int do_read_index(struct index_state *istate, const char *path, int must_exist)
+{
+	return do_read_index_1(istate, path, must_exist, NULL, 0);
+}
+
 /*
  * Signal that the shared index is used by updating its mtime.
  *
@@ -2414,6 +2569,31 @@ int read_index_from(struct index_state *istate, const char *path,
 	return ret;
 }
 
+int read_index_prefix_from(struct index_state *istate, const char *path,
+			   const char *gitdir,
+			   const char *prefix, size_t prefixlen)
+{
+	int ret;
+
+	if (istate->initialized)
+		return istate->cache_nr;
+	if (!prefixlen)
+		return read_index_from(istate, path, gitdir);
+
+	trace2_region_enter_printf("index", "do_read_index", the_repository,
+				   "%s", path);
+	trace_performance_enter();
+	ret = do_read_index_1(istate, path, 0, prefix, prefixlen);
+	trace_performance_leave("read cache %s", path);
+	trace2_region_leave_printf("index", "do_read_index", the_repository,
+				   "%s", path);
+	if (ret < 0)
+		return read_index_from(istate, path, gitdir);
+
+	check_ce_order(istate);
+	return ret;
+}
+
 int is_index_unborn(struct index_state *istate)
 {
 	return (!istate->cache_nr && !istate->timestamp.sec);
@@ -2542,7 +2722,8 @@ static int ce_write_flush(git_hash_ctx *context, int fd)
 {
 	unsigned int buffered = write_buffer_len;
 	if (buffered) {
-		the_hash_algo->update_fn(context, write_buffer, buffered);
+		if (context)
+			the_hash_algo->update_fn(context, write_buffer, buffered);
 		if (write_in_full(fd, write_buffer, buffered) < 0)
 			return -1;
 		write_buffer_len = 0;
@@ -2591,7 +2772,8 @@ static int ce_flush(git_hash_ctx *context, int fd, unsigned char *hash)
 
 	if (left) {
 		write_buffer_len = 0;
-		the_hash_algo->update_fn(context, write_buffer, left);
+		if (context)
+			the_hash_algo->update_fn(context, write_buffer, left);
 	}
 
 	/* Flush first if not enough space for hash signature */
@@ -2601,8 +2783,11 @@ static int ce_flush(git_hash_ctx *context, int fd, unsigned char *hash)
 		left = 0;
 	}
 
-	/* Append the hash signature at the end */
-	the_hash_algo->final_fn(write_buffer + left, context);
+	/* Append the hash signature at the end, or all zeroes without one */
+	if (context)
+		the_hash_algo->final_fn(write_buffer + left, context);
+	else
+		hashclr(write_buffer + left);
 	hashcpy(hash, write_buffer + left);
 	left += the_hash_algo->rawsz;
 	return (write_in_full(fd, write_buffer, left) < 0) ? -1 : 0;
@@ -2686,11 +2871,11 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
-			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
+static void ce_encode_entry(struct strbuf *out, struct cache_entry *ce,
+			    struct strbuf *previous_name,
+			    struct ondisk_cache_entry *ondisk)
 {
 	int size;
-	int result;
 	unsigned int saved_namelen;
 	int stripped_name = 0;
 	static unsigned char padding[8] = { 0x00 };
@@ -2706,11 +2891,9 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		result = ce_write(c, fd, ondisk, size);
-		if (!result)
-			result = ce_write(c, fd, ce->name, len);
-		if (!result)
-			result = ce_write(c, fd, padding, align_padding_size(size, len));
+		strbuf_add(out, ondisk, size);
+		strbuf_add(out, ce->name, len);
+		strbuf_add(out, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
@@ -2724,13 +2907,10 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		result = ce_write(c, fd, ondisk, size);
-		if (!result)
-			result = ce_write(c, fd, to_remove_vi, prefix_size);
-		if (!result)
-			result = ce_write(c, fd, ce->name + common, ce_namelen(ce) - common);
-		if (!result)
-			result = ce_write(c, fd, padding, 1);
+		strbuf_add(out, ondisk, size);
+		strbuf_add(out, to_remove_vi, prefix_size);
+		strbuf_add(out, ce->name + common, ce_namelen(ce) - common);
+		strbuf_add(out, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2739,8 +2919,137 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 		ce->ce_namelen = saved_namelen;
 		ce->ce_flags &= ~CE_STRIP_NAME;
 	}
+}
 
-	return result;
+static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
+			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
+{
+	static struct strbuf sb = STRBUF_INIT;
+
+	strbuf_reset(&sb);
+	ce_encode_entry(&sb, ce, previous_name, ondisk);
+	return ce_write(c, fd, sb.buf, sb.len);
+}
+
+/*
+ * With an offset table, every block of entries can be decoded on its
+ * own, and so it can be encoded on its own as well. The encoding is
+ * then done by threads that each take a run of blocks, while the
+ * blocks are written out and hashed, which has to happen in order, as
+ * soon as the thread that encoded them is done.
+ */
+struct encode_entries_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	int start, end;		/* range of cache entries */
+	int ieot_entries;	/* number of cache entries per block */
+	int nr_blocks;
+	struct strbuf *blocks;	/* the encoded blocks */
+	int *nr;		/* the number of entries in each block */
+};
+
+static void *encode_entries_thread(void *_data)
+{
+	struct encode_entries_thread_data *p = _data;
+	struct cache_entry **cache = p->istate->cache;
+	int version4 = p->istate->version == 4;
+	struct strbuf previous_name = STRBUF_INIT;
+	struct ondisk_cache_entry ondisk;
+	int i;
+
+	for (i = p->start; i < p->end; i++) {
+		int block = (i - p->start) / p->ieot_entries;
+
+		/*
+		 * Just like the serial writer, start each block of a
+		 * version 4 index by stripping all of the previous name.
+		 */
+		if (version4 && !((i - p->start) % p->ieot_entries)) {
+			int prev = i;
+
+			strbuf_reset(&previous_name);
+			while (prev-- > 0) {
+				if (cache[prev]->ce_flags & CE_REMOVE)
+					continue;
+				strbuf_addchars(&previous_name, '\0',
+						ce_namelen(cache[prev]));
+				break;
+			}
+		}
+		if (cache[i]->ce_flags & CE_REMOVE)
+			continue;
+		ce_encode_entry(&p->blocks[block], cache[i],
+				version4 ? &previous_name : NULL, &ondisk);
+		p->nr[block]++;
+	}
+	strbuf_release(&previous_name);
+	return NULL;
+}
+
+static int write_entries_threaded(struct index_state *istate,
+				  git_hash_ctx *c, int fd, int nr_threads,
+				  int ieot_entries,
+				  struct index_entry_offset_table *ieot,
+				  off_t offset)
+{
+	int nr_blocks = DIV_ROUND_UP(istate->cache_nr, ieot_entries);
+	int blocks_per_thread, i, j, err = 0;
+	struct encode_entries_thread_data *data;
+
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > nr_blocks)
+		nr_threads = nr_blocks;
+	blocks_per_thread = DIV_ROUND_UP(nr_blocks, nr_threads);
+	nr_threads = DIV_ROUND_UP(nr_blocks, blocks_per_thread);
+	CALLOC_ARRAY(data, nr_threads);
+
+	for (i = 0; i < nr_threads; i++) {
+		struct encode_entries_thread_data *p = &data[i];
+
+		p->istate = istate;
+		p->ieot_entries = ieot_entries;
+		p->start = i * blocks_per_thread * ieot_entries;
+		p->end = p->start + blocks_per_thread * ieot_entries;
+		if (p->end > istate->cache_nr)
+			p->end = istate->cache_nr;
+		p->nr_blocks = DIV_ROUND_UP(p->end - p->start, ieot_entries);
+		CALLOC_ARRAY(p->blocks, p->nr_blocks);
+		for (j = 0; j < p->nr_blocks; j++)
+			strbuf_init(&p->blocks[j], 0);
+		CALLOC_ARRAY(p->nr, p->nr_blocks);
+
+		err = pthread_create(&p->pthread, NULL, encode_entries_thread, p);
+		if (err)
+			die(_("unable to create encode_entries thread: %s"), strerror(err));
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		struct encode_entries_thread_data *p = &data[i];
+
+		err = pthread_join(p->pthread, NULL);
+		if (err)
+			die(_("unable to join encode_entries thread: %s"), strerror(err));
+
+		for (j = 0; j < p->nr_blocks; j++) {
+			struct strbuf *block = &p->blocks[j];
+
+			/* blocks of removed entries only are left out */
+			if (p->nr[j] && !err) {
+				ieot->entries[ieot->nr].nr = p->nr[j];
+				ieot->entries[ieot->nr].offset = offset;
+				ieot->nr++;
+				offset += block->len;
+				if (ce_write(c, fd, block->buf, block->len) < 0)
+					err = -1;
+			}
+			strbuf_release(block);
+		}
+		free(p->blocks);
+		free(p->nr);
+	}
+	free(data);
+	return err;
 }
 
 /*
@@ -2774,6 +3083,15 @@ static int verify_index_from(const struct index_state *istate, const char *path)
 	if (!hasheq(istate->oid.hash, hash))
 		goto out;
 
+	/*
+	 * An index written with index.skipHash has no checksum to tell
+	 * whether somebody else replaced it; go by its mtime instead.
+	 */
+	if (is_null_oid(&istate->oid) &&
+	    (st.st_mtime != istate->timestamp.sec ||
+	     ST_MTIME_NSEC(st) != istate->timestamp.nsec))
+		goto out;
+
 	close(fd);
 	return 1;
 
@@ -2841,6 +3159,36 @@ static int record_ieot(void)
 	return !git_config_get_index_threads(&val) && val != 1;
 }
 
+/*
+ * Smudge `ce` if it is racily clean, and complain if it has a null
+ * object name; return -1 if it must not be written.
+ */
+static int prepare_entry_for_write(struct index_state *istate,
+				   struct cache_entry *ce,
+				   int *drop_cache_tree)
+{
+	int err = 0;
+
+	if (ce->ce_flags & CE_REMOVE)
+		return 0;
+	if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+		ce_smudge_racily_clean_entry(istate, ce);
+	if (is_null_oid(&ce->oid)) {
+		static const char msg[] = "cache entry has null sha1: %s";
+		static int allow = -1;
+
+		if (allow < 0)
+			allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
+		if (allow)
+			warning(msg, ce->name);
+		else
+			err = error(msg, ce->name);
+
+		*drop_cache_tree = 1;
+	}
+	return err;
+}
+
 /*
  * On success, `tempfile` is closed. If it is the temporary file
  * of a `struct lock_file`, we will therefore effectively perform
@@ -2853,7 +3201,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 {
 	uint64_t start = getnanotime();
 	int newfd = tempfile->fd;
-	git_hash_ctx c, eoie_c;
+	git_hash_ctx ctx, *c = &ctx, eoie_c;
 	struct cache_header hdr;
 	int i, err = 0, removed, extended, hdr_version;
 	struct cache_entry **cache = istate->cache;
@@ -2895,8 +3243,17 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	hdr.hdr_version = htonl(hdr_version);
 	hdr.hdr_entries = htonl(entries - removed);
 
-	the_hash_algo->init_fn(&c);
-	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
+	/*
+	 * With index.skipHash, do not compute the trailing checksum at
+	 * all. A shared index, the only kind written without extensions,
+	 * is named after its checksum and cannot go without one, though.
+	 */
+	prepare_repo_settings(the_repository);
+	if (the_repository->settings.index_skip_hash && !strip_extensions)
+		c = NULL;
+	else
+		the_hash_algo->init_fn(c);
+	if (ce_write(c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
 	if (!HAVE_THREADS || git_config_get_index_threads(&nr_threads))
@@ -2941,50 +3298,49 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	nr = 0;
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 
-	for (i = 0; i < entries; i++) {
-		struct cache_entry *ce = cache[i];
-		if (ce->ce_flags & CE_REMOVE)
-			continue;
-		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
-			ce_smudge_racily_clean_entry(istate, ce);
-		if (is_null_oid(&ce->oid)) {
-			static const char msg[] = "cache entry has null sha1: %s";
-			static int allow = -1;
-
-			if (allow < 0)
-				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
-			if (allow)
-				warning(msg, ce->name);
-			else
-				err = error(msg, ce->name);
-
-			drop_cache_tree = 1;
-		}
-		if (ieot && i && (i % ieot_entries == 0)) {
-			ieot->entries[ieot->nr].nr = nr;
-			ieot->entries[ieot->nr].offset = offset;
-			ieot->nr++;
-			/*
-			 * If we have a V4 index, set the first byte to an invalid
-			 * character to ensure there is nothing common with the previous
-			 * entry
-			 */
-			if (previous_name)
-				previous_name->buf[0] = 0;
-			nr = 0;
-			offset = lseek(newfd, 0, SEEK_CUR);
-			if (offset < 0) {
-				free(ieot);
-				return -1;
+	/*
+	 * The entries of a split index may have their names stripped,
+	 * which the threaded encoder does not know how to deal with.
+	 */
+	if (ieot && !istate->split_index) {
+		for (i = 0; !err && i < entries; i++)
+			err = prepare_entry_for_write(istate, cache[i],
+						      &drop_cache_tree);
+		if (!err)
+			err = write_entries_threaded(istate, c, newfd, nr_threads,
+						     ieot_entries, ieot, offset);
+	} else {
+		for (i = 0; i < entries; i++) {
+			struct cache_entry *ce = cache[i];
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			err = prepare_entry_for_write(istate, ce, &drop_cache_tree);
+			if (ieot && i && (i % ieot_entries == 0)) {
+				ieot->entries[ieot->nr].nr = nr;
+				ieot->entries[ieot->nr].offset = offset;
+				ieot->nr++;
+				/*
+				 * If we have a V4 index, set the first byte to an invalid
+				 * character to ensure there is nothing common with the previous
+				 * entry
+				 */
+				if (previous_name)
+					previous_name->buf[0] = 0;
+				nr = 0;
+				offset = lseek(newfd, 0, SEEK_CUR);
+				if (offset < 0) {
+					free(ieot);
+					return -1;
+				}
+				offset += write_buffer_len;
 			}
-			offset += write_buffer_len;
-		}
-		if (ce_write_entry(&c, newfd, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
-			err = -1;
+			if (ce_write_entry(c, newfd, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
+				err = -1;
 
-		if (err)
-			break;
-		nr++;
+			if (err)
+				break;
+			nr++;
+		}
 	}
 	if (ieot && nr) {
 		ieot->entries[ieot->nr].nr = nr;
@@ -3018,8 +3374,8 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_ieot_extension(&sb, ieot);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_INDEXENTRYOFFSETTABLE, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		err = write_index_ext_header(c, &eoie_c, newfd, CACHE_EXT_INDEXENTRYOFFSETTABLE, sb.len) < 0
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		free(ieot);
 		if (err)
@@ -3031,9 +3387,9 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_LINK,
+			write_index_ext_header(c, &eoie_c, newfd, CACHE_EXT_LINK,
 					       sb.len) < 0 ||
-			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+			ce_write(c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
@@ -3042,8 +3398,8 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		err = write_index_ext_header(c, &eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
@@ -3052,9 +3408,9 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(c, &eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
 					     sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
@@ -3063,9 +3419,11 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_untracked_extension(&sb, istate->untracked);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_UNTRACKED,
+		err = write_index_ext_header(c, &eoie_c, newfd, CACHE_EXT_UNTRACKED,
 					     sb.len) < 0 ||
-			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+			ce_write(c, newfd, sb.buf, sb.len) < 0;
+		if (!err)
+			fsmonitor_share_untracked_cache(istate, &sb);
 		strbuf_release(&sb);
 		if (err)
 			return -1;
@@ -3074,14 +3432,14 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_fsmonitor_extension(&sb, istate);
-		err = write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_FSMONITOR, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		err = write_index_ext_header(c, &eoie_c, newfd, CACHE_EXT_FSMONITOR, sb.len) < 0
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
 	}
 	if (istate->sparse_index) {
-		if (write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
+		if (write_index_ext_header(c, &eoie_c, newfd, CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
 			return -1;
 	}
 
@@ -3095,14 +3453,14 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_eoie_extension(&sb, &eoie_c, offset);
-		err = write_index_ext_header(&c, NULL, newfd, CACHE_EXT_ENDOFINDEXENTRIES, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		err = write_index_ext_header(c, NULL, newfd, CACHE_EXT_ENDOFINDEXENTRIES, sb.len) < 0
+			|| ce_write(c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
 	}
 
-	if (ce_flush(&c, newfd, istate->oid.hash))
+	if (ce_flush(c, newfd, istate->oid.hash))
 		return -1;
 	if (close_tempfile_gently(tempfile)) {
 		error(_("could not close '%s'"), get_tempfile_path(tempfile));
@@ -3456,13 +3814,14 @@ int index_name_is_other(struct index_state *istate, const char *name,
 	return 1;
 }
 
-void *read_blob_data_from_index(struct index_state *istate,
-				const char *path, unsigned long *size)
+/*
+ * The object name of the blob at 'path' in the index, or NULL.  In the
+ * middle of a merge, this is the one in stage #2 (ours).
+ */
+const struct object_id *blob_oid_from_index(struct index_state *istate,
+					    const char *path)
 {
 	int pos, len;
-	unsigned long sz;
-	enum object_type type;
-	void *data;
 
 	len = strlen(path);
 	pos = index_name_pos(istate, path, len);
@@ -3481,7 +3840,20 @@ void *read_blob_data_from_index(struct index_state *istate,
 	}
 	if (pos < 0)
 		return NULL;
-	data = read_object_file(&istate->cache[pos]->oid, &type, &sz);
+	return &istate->cache[pos]->oid;
+}
+
+void *read_blob_data_from_index(struct index_state *istate,
+				const char *path, unsigned long *size)
+{
+	const struct object_id *oid = blob_oid_from_index(istate, path);
+	unsigned long sz;
+	enum object_type type;
+	void *data;
+
+	if (!oid)
+		return NULL;
+	data = read_object_file(oid, &type, &sz);
 	if (!data || type != OBJ_BLOB) {
 		free(data);
 		return NULL;
@@ -4,6 +4,7 @@
 #include "refs.h"
 #include "wildmatch.h"
 #include "object-store.h"
+#include "replace-object.h"
 #include "repository.h"
 #include "commit.h"
 #include "remote.h"
@@ -23,6 +24,7 @@
 #include "worktree.h"
 #include "hashmap.h"
 #include "strvec.h"
+#include "ref-object-cache.h"
 
 static struct ref_msg {
 	const char *gone;
@@ -151,6 +153,10 @@ static struct used_atom {
 		} email_option;
 		struct refname_atom refname;
 		char *head;
+		struct {
+			const char *base;
+			size_t index;
+		} ahead_behind;
 	} u;
 } *used_atom;
 static int used_atom_cnt, need_tagged, need_symref;
@@ -494,6 +500,16 @@ static int head_atom_parser(const struct ref_format *format, struct used_atom *a
 	return 0;
 }
 
+static int ahead_behind_atom_parser(const struct ref_format *format,
+				    struct used_atom *atom,
+				    const char *arg, struct strbuf *err)
+{
+	if (!arg || !*arg)
+		return strbuf_addf_ret(err, -1, _("expected format: %%(ahead-behind:<committish>)"));
+	atom->u.ahead_behind.base = arg;
+	return 0;
+}
+
 static struct {
 	const char *name;
 	info_source source;
@@ -542,6 +558,7 @@ static struct {
 	{ "if", SOURCE_NONE, FIELD_STR, if_atom_parser },
 	{ "then", SOURCE_NONE },
 	{ "else", SOURCE_NONE },
+	{ "ahead-behind", SOURCE_NONE, FIELD_STR, ahead_behind_atom_parser },
 	/*
 	 * Please update $__git_ref_fieldlist in git-completion.bash
 	 * when you add new atoms
@@ -568,6 +585,8 @@ struct atom_value {
 		       struct strbuf *err);
 	uintmax_t value; /* used for sorting when not FIELD_STR */
 	struct used_atom *atom;
+	/* only "value" was filled, from the commit-graph */
+	unsigned int from_graph : 1;
 };
 
 /*
@@ -1117,12 +1136,33 @@ static char *copy_subject(const char *buf, unsigned long len)
 	return strbuf_detach(&sb, NULL);
 }
 
-static void grab_date(const char *buf, struct atom_value *v, const char *atomname)
+/*
+ * Parse the date of the ident line `buf` (as returned by
+ * find_wholine()). Return -1 if there is no valid date.
+ */
+static int parse_ident_date(const char *buf, timestamp_t *timestamp, long *tz)
 {
 	const char *eoemail = strstr(buf, "> ");
 	char *zone;
-	timestamp_t timestamp;
-	long tz;
+
+	if (!eoemail)
+		return -1;
+	*timestamp = parse_timestamp(eoemail + 2, &zone, 10);
+	if (*timestamp == TIME_MAX)
+		return -1;
+	*tz = strtol(zone, NULL, 10);
+	if ((*tz == LONG_MIN || *tz == LONG_MAX) && errno == ERANGE)
+		return -1;
+	return 0;
+}
+
+/*
+ * Fill `v` with `timestamp` in the format asked for by the date atom
+ * `atomname`, or with nothing if `timestamp` is NULL.
+ */
+static void fill_date(struct atom_value *v, const char *atomname,
+		      const timestamp_t *timestamp, long tz)
+{
 	struct date_mode date_mode = { DATE_NORMAL };
 	const char *formatp;
 
@@ -1138,20 +1178,24 @@ static void grab_date(const char *buf, struct atom_value *v, const char *atomnam
 		parse_date_format(formatp, &date_mode);
 	}
 
-	if (!eoemail)
-		goto bad;
-	timestamp = parse_timestamp(eoemail + 2, &zone, 10);
-	if (timestamp == TIME_MAX)
-		goto bad;
-	tz = strtol(zone, NULL, 10);
-	if ((tz == LONG_MIN || tz == LONG_MAX) && errno == ERANGE)
-		goto bad;
-	v->s = xstrdup(show_date(timestamp, tz, &date_mode));
-	v->value = timestamp;
-	return;
- bad:
-	v->s = xstrdup("");
-	v->value = 0;
+	if (!timestamp) {
+		v->s = xstrdup("");
+		v->value = 0;
+		return;
+	}
+	v->s = xstrdup(show_date(*timestamp, tz, &date_mode));
+	v->value = *timestamp;
+}
+
+static void grab_date(const char *buf, struct atom_value *v, const char *atomname)
+{
+	timestamp_t timestamp;
+	long tz;
+
+	if (parse_ident_date(buf, &timestamp, &tz))
+		fill_date(v, atomname, NULL, 0);
+	else
+		fill_date(v, atomname, &timestamp, tz);
 }
 
 /* See grab_values */
@@ -1668,10 +1712,219 @@ static char *get_worktree_path(const struct used_atom *atom, const struct ref_ar
 	return xstrdup(lookup_result->wt->path);
 }
 
+/*
+ * Can all atoms that need to look at objects be filled in from a
+ * struct ref_object_summary?
+ */
+static int summary_covers_atoms(void)
+{
+	int i;
+
+	for (i = 0; i < used_atom_cnt; i++) {
+		const char *name = used_atom[i].name;
+
+		if (used_atom[i].source == SOURCE_NONE)
+			continue;
+		if (*name == '*')
+			name++;
+		if (!strcmp(name, "objecttype") ||
+		    starts_with(name, "objectname") ||
+		    starts_with(name, "taggerdate") ||
+		    starts_with(name, "committerdate") ||
+		    starts_with(name, "creatordate"))
+			continue;
+		return 0;
+	}
+	return 1;
+}
+
+static int summarize_object(const struct object_id *oid,
+			    struct ref_object_summary *summary)
+{
+	enum object_type type;
+	unsigned long size;
+	const char *wholine = NULL;
+	timestamp_t timestamp;
+	long tz;
+	char *buf;
+	int ret = 0;
+
+	buf = read_object_file(oid, &type, &size);
+	if (!buf)
+		return -1;
+
+	memset(summary, 0, sizeof(*summary));
+	summary->type = type;
+	if (type == OBJ_TAG) {
+		struct tag *tag = lookup_tag(the_repository, oid);
+
+		if (!tag || parse_tag_buffer(the_repository, tag, buf, size) ||
+		    !tag->tagged)
+			ret = -1;
+		else
+			oidcpy(&summary->tagged, &tag->tagged->oid);
+		wholine = find_wholine("tagger", 6, buf);
+	} else if (type == OBJ_COMMIT) {
+		wholine = find_wholine("committer", 9, buf);
+	}
+
+	if (!ret && wholine && !parse_ident_date(wholine, &timestamp, &tz)) {
+		if (tz < INT_MIN || tz > INT_MAX) {
+			ret = -1; /* not worth representing */
+		} else {
+			summary->has_date = 1;
+			summary->date = timestamp;
+			summary->tz = tz;
+		}
+	}
+
+	free(buf);
+	return ret;
+}
+
+static int get_object_summary(const struct object_id *oid,
+			      struct ref_object_summary *summary)
+{
+	if (!oideq(lookup_replace_object(the_repository, oid), oid))
+		return -1;
+	if (!ref_object_cache_get(the_repository, oid, summary))
+		return 0;
+	if (summarize_object(oid, summary))
+		return -1;
+	ref_object_cache_put(the_repository, oid, summary);
+	return 0;
+}
+
+/* See grab_values */
+static void grab_summary_values(struct atom_value *val, int deref,
+				const struct object_id *oid,
+				const struct ref_object_summary *summary)
+{
+	int i;
+
+	for (i = 0; i < used_atom_cnt; i++) {
+		const char *name = used_atom[i].name;
+		struct atom_value *v = &val[i];
+		int has_date;
+
+		if (!!deref != (*name == '*'))
+			continue;
+		if (deref)
+			name++;
+
+		if (!strcmp(name, "objecttype")) {
+			v->s = xstrdup(type_name(summary->type));
+			continue;
+		} else if (starts_with(name, "objectname")) {
+			if (deref)
+				grab_oid(name, "objectname", oid, v, &used_atom[i]);
+			continue;
+		} else if (starts_with(name, "taggerdate")) {
+			has_date = summary->type == OBJ_TAG;
+		} else if (starts_with(name, "committerdate")) {
+			has_date = summary->type == OBJ_COMMIT;
+		} else if (starts_with(name, "creatordate")) {
+			has_date = summary->type == OBJ_TAG ||
+				   summary->type == OBJ_COMMIT;
+		} else {
+			continue;
+		}
+
+		if (has_date)
+			fill_date(v, name,
+				  summary->has_date ? &summary->date : NULL,
+				  summary->tz);
+	}
+}
+
+/*
+ * Fill in the values that need object data from the ref object cache
+ * (see core.refObjectCache), which avoids reading the objects at all
+ * once they are in there. Return -1 if the cache cannot be used for
+ * this ref, leaving the values alone.
+ */
+static int populate_value_from_summary(struct ref_array_item *ref)
+{
+	static int enabled = -1;
+	struct ref_object_summary summary, tagged;
+	int deref;
+
+	if (enabled < 0)
+		enabled = ref_object_cache_enabled(the_repository);
+	if (!enabled || !summary_covers_atoms())
+		return -1;
+
+	if (get_object_summary(&ref->objectname, &summary))
+		return -1;
+	deref = need_tagged && summary.type == OBJ_TAG;
+	if (deref && get_object_summary(&summary.tagged, &tagged))
+		return -1;
+
+	grab_summary_values(ref->value, 0, &ref->objectname, &summary);
+	if (deref)
+		grab_summary_values(ref->value, 1, &summary.tagged, &tagged);
+	return 0;
+}
+
+static int graph_covers_atoms(void)
+{
+	int i;
+
+	for (i = 0; i < used_atom_cnt; i++) {
+		const char *name = used_atom[i].name;
+
+		/* a commit has nothing to dereference */
+		if (used_atom[i].source == SOURCE_NONE || *name == '*')
+			continue;
+		if (starts_with(name, "committerdate") ||
+		    starts_with(name, "creatordate"))
+			continue;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Sorting by committerdate or creatordate only needs the committer
+ * timestamp, which the commit-graph has for the commits in it. When
+ * these are the only atoms that need object data, fill their values
+ * from there. The graph does not know the time zone, so the strings
+ * are left empty and marked, and get_ref_atom_value() reads the object
+ * after all if a string is asked for. Return -1 if the commit-graph
+ * cannot be used for this ref, leaving the values alone.
+ */
+static int populate_value_from_graph(struct ref_array_item *ref)
+{
+	struct commit *commit;
+	int i;
+
+	if (!graph_covers_atoms())
+		return -1;
+	if (!oideq(lookup_replace_object(the_repository, &ref->objectname),
+		   &ref->objectname))
+		return -1;
+	commit = lookup_commit_in_graph(the_repository, &ref->objectname);
+	if (!commit)
+		return -1;
+
+	for (i = 0; i < used_atom_cnt; i++) {
+		struct atom_value *v = &ref->value[i];
+
+		if (used_atom[i].source == SOURCE_NONE ||
+		    *used_atom[i].name == '*')
+			continue;
+		v->s = xstrdup("");
+		v->value = commit->date;
+		v->from_graph = 1;
+	}
+	return 0;
+}
+
 /*
  * Parse the object referred by ref, and grab needed value.
  */
-static int populate_value(struct ref_array_item *ref, struct strbuf *err)
+static int populate_value(struct ref_array_item *ref, int use_graph,
+			  struct strbuf *err)
 {
 	struct object *obj;
 	int i;
@@ -1797,6 +2050,16 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 			v->handler = else_atom_handler;
 			v->s = xstrdup("");
 			continue;
+		} else if (starts_with(name, "ahead-behind:")) {
+			struct ahead_behind_count *count = NULL;
+
+			if (ref->counts)
+				count = ref->counts[atom->u.ahead_behind.index];
+			if (count)
+				v->s = xstrfmt("%u %u", count->ahead, count->behind);
+			else
+				v->s = xstrdup("");
+			continue;
 		} else
 			continue;
 
@@ -1820,6 +2083,10 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 	    !memcmp(&oi_deref.info, &empty, sizeof(empty)))
 		return 0;
 
+	if (use_graph && !populate_value_from_graph(ref))
+		return 0;
+	if (!populate_value_from_summary(ref))
+		return 0;
 
 	oi.oid = ref->objectname;
 	if (get_object(ref, 0, &obj, &oi, err))
@@ -1847,15 +2114,28 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 	return get_object(ref, 1, &obj, &oi_deref, err);
 }
 
+static void free_ref_values(struct ref_array_item *ref)
+{
+	int i;
+
+	for (i = 0; i < used_atom_cnt; i++)
+		free((char *)ref->value[i].s);
+	FREE_AND_NULL(ref->value);
+}
+
 /*
  * Given a ref, return the value for the atom.  This lazily gets value
- * out of the object by calling populate value.
+ * out of the object by calling populate value.  Unless want_string is
+ * set, only the value used for sorting is needed.
  */
 static int get_ref_atom_value(struct ref_array_item *ref, int atom,
-			      struct atom_value **v, struct strbuf *err)
+			      int want_string, struct atom_value **v,
+			      struct strbuf *err)
 {
+	if (ref->value && want_string && ref->value[atom].from_graph)
+		free_ref_values(ref);
 	if (!ref->value) {
-		if (populate_value(ref, err))
+		if (populate_value(ref, !want_string, err))
 			return -1;
 		fill_missing_values(ref->value);
 	}
@@ -2140,12 +2420,9 @@ static int ref_filter_handler(const char *refname, const struct object_id *oid,
 static void free_array_item(struct ref_array_item *item)
 {
 	free((char *)item->symref);
-	if (item->value) {
-		int i;
-		for (i = 0; i < used_atom_cnt; i++)
-			free((char *)item->value[i].s);
-		free(item->value);
-	}
+	free(item->counts);
+	if (item->value)
+		free_ref_values(item);
 	free(item);
 }
 
@@ -2158,12 +2435,16 @@ void ref_array_clear(struct ref_array *array)
 		free_array_item(array->items[i]);
 	FREE_AND_NULL(array->items);
 	array->nr = array->alloc = 0;
+	FREE_AND_NULL(array->counts);
+	array->counts_nr = 0;
 
 	for (i = 0; i < used_atom_cnt; i++)
 		free((char *)used_atom[i].name);
 	FREE_AND_NULL(used_atom);
 	used_atom_cnt = 0;
 
+	ref_object_cache_write(the_repository);
+
 	if (ref_to_worktree_map.worktrees) {
 		hashmap_clear_and_free(&(ref_to_worktree_map.map),
 					struct ref_to_worktree_entry, ent);
@@ -2172,8 +2453,85 @@ void ref_array_clear(struct ref_array *array)
 	}
 }
 
+void filter_ahead_behind(struct repository *r, struct ref_array *array)
+{
+	struct commit **commits;
+	size_t commits_nr = 0, bases_nr = 0, j;
+	int i;
+
+	for (i = 0; i < used_atom_cnt; i++)
+		if (starts_with(used_atom[i].name, "ahead-behind:"))
+			used_atom[i].u.ahead_behind.index = bases_nr++;
+	if (!bases_nr || !array->nr)
+		return;
+
+	ALLOC_ARRAY(commits, st_add(bases_nr, array->nr));
+	for (i = 0; i < used_atom_cnt; i++) {
+		const char *base = used_atom[i].u.ahead_behind.base;
+		struct commit *c;
+
+		if (!starts_with(used_atom[i].name, "ahead-behind:"))
+			continue;
+		c = lookup_commit_reference_by_name(base);
+		if (!c)
+			die(_("failed to find '%s'"), base);
+		commits[commits_nr++] = c;
+	}
+
+	FREE_AND_NULL(array->counts);
+	ALLOC_ARRAY(array->counts, st_mult(bases_nr, array->nr));
+	array->counts_nr = 0;
+	for (i = 0; i < array->nr; i++) {
+		struct ref_array_item *item = array->items[i];
+		struct commit *c;
+
+		c = lookup_commit_reference_gently(r, &item->objectname, 1);
+		if (!c)
+			continue;
+
+		FREE_AND_NULL(item->counts);
+		CALLOC_ARRAY(item->counts, bases_nr);
+		for (j = 0; j < bases_nr; j++) {
+			struct ahead_behind_count *count;
+
+			count = &array->counts[array->counts_nr++];
+			count->tip_index = commits_nr;
+			count->base_index = j;
+			item->counts[j] = count;
+		}
+		commits[commits_nr++] = c;
+	}
+
+	ahead_behind(r, commits, commits_nr, array->counts, array->counts_nr);
+	free(commits);
+}
+
 #define EXCLUDE_REACHED 0
 #define INCLUDE_REACHED 1
+/*
+ * Ask the reachability index of the commit-graph whether "commit" is
+ * reachable from any of "check_reachable": returns 1 or 0, or -1 when
+ * it cannot tell.
+ */
+static int reach_index_is_reached(struct commit *commit,
+				  struct commit_list *check_reachable)
+{
+	int ret = 0;
+
+	for (; check_reachable; check_reachable = check_reachable->next) {
+		switch (commit_graph_can_reach(the_repository,
+					       check_reachable->item, commit)) {
+		case 1:
+			return 1;
+		case 0:
+			break;
+		default:
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
 static void reach_filter(struct ref_array *array,
 			 struct commit_list *check_reachable,
 			 int include_reached)
@@ -2182,10 +2540,33 @@ static void reach_filter(struct ref_array *array,
 	int i, old_nr;
 	struct commit **to_clear;
 	struct commit_list *cr;
+	int *reached;
 
 	if (!check_reachable)
 		return;
 
+	ALLOC_ARRAY(reached, array->nr);
+	for (i = 0; i < array->nr; i++) {
+		reached[i] = reach_index_is_reached(array->items[i]->commit,
+						    check_reachable);
+		if (reached[i] < 0)
+			break;
+	}
+	if (i == array->nr) {
+		old_nr = array->nr;
+		array->nr = 0;
+		for (i = 0; i < old_nr; i++) {
+			if (reached[i] == include_reached)
+				array->items[array->nr++] = array->items[i];
+			else
+				free_array_item(array->items[i]);
+		}
+		free(reached);
+		free_commit_list(check_reachable);
+		return;
+	}
+	free(reached);
+
 	CALLOC_ARRAY(to_clear, array->nr);
 
 	repo_init_revisions(the_repository, &revs, NULL);
@@ -2303,11 +2684,13 @@ static int cmp_ref_sorting(struct ref_sorting *s, struct ref_array_item *a, stru
 	int cmp;
 	int cmp_detached_head = 0;
 	cmp_type cmp_type = used_atom[s->atom].type;
+	int want_string = cmp_type == FIELD_STR ||
+			  (s->sort_flags & REF_SORTING_VERSION);
 	struct strbuf err = STRBUF_INIT;
 
-	if (get_ref_atom_value(a, s->atom, &va, &err))
+	if (get_ref_atom_value(a, s->atom, want_string, &va, &err))
 		die("%s", err.buf);
-	if (get_ref_atom_value(b, s->atom, &vb, &err))
+	if (get_ref_atom_value(b, s->atom, want_string, &vb, &err))
 		die("%s", err.buf);
 	strbuf_release(&err);
 	if (s->sort_flags & REF_SORTING_DETACHED_HEAD_FIRST &&
@@ -2408,7 +2791,7 @@ int format_ref_array_item(struct ref_array_item *info,
 		if (cp < sp)
 			append_literal(cp, sp, &state);
 		pos = parse_ref_filter_atom(format, sp + 2, ep, error_buf);
-		if (pos < 0 || get_ref_atom_value(info, pos, &atomv, error_buf) ||
+		if (pos < 0 || get_ref_atom_value(info, pos, 1, &atomv, error_buf) ||
 		    atomv->handler(atomv, &state, error_buf)) {
 			pop_stack_element(&state.stack);
 			return -1;
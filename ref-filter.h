@@ -24,6 +24,7 @@
 #define FILTER_REFS_KIND_MASK      (FILTER_REFS_ALL | FILTER_REFS_DETACHED_HEAD)
 
 struct atom_value;
+struct ahead_behind_count;
 
 struct ref_sorting {
 	struct ref_sorting *next;
@@ -43,6 +44,7 @@ struct ref_array_item {
 	const char *symref;
 	struct commit *commit;
 	struct atom_value *value;
+	struct ahead_behind_count **counts;
 	char refname[FLEX_ARRAY];
 };
 
@@ -50,6 +52,9 @@ struct ref_array {
 	int nr, alloc;
 	struct ref_array_item **items;
 	struct rev_info *revs;
+
+	struct ahead_behind_count *counts;
+	size_t counts_nr;
 };
 
 struct ref_filter {
@@ -106,6 +111,13 @@ struct ref_format {
  * filtered refs in the ref_array structure.
  */
 int filter_refs(struct ref_array *array, struct ref_filter *filter, unsigned int type);
+/*
+ * Compute the counts for every %(ahead-behind:<base>) atom of the
+ * current format for all refs in the array at once. Must be called
+ * after filter_refs() and before anything formats or sorts the refs,
+ * or those atoms expand to empty strings.
+ */
+void filter_ahead_behind(struct repository *r, struct ref_array *array);
 /*  Clear all memory allocated to ref_array */
 void ref_array_clear(struct ref_array *array);
 /*  Used to verify if the given format is correct and to parse out the used atoms */
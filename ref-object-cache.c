@@ -0,0 +1,267 @@
+#include "cache.h"
+#include "repository.h"
+#include "config.h"
+#include "lockfile.h"
+#include "oidmap.h"
+#include "ref-object-cache.h"
+
+/*
+ * The file starts with a header
+ *
+ *   4-byte signature "ROCA"
+ *   4-byte version number (1)
+ *   4-byte hash format id
+ *   4-byte number of entries
+ *
+ * which is followed by the entries, sorted by object name:
+ *
+ *   object name (the_hash_algo->rawsz bytes)
+ *   1-byte object type
+ *   1-byte flag telling whether there is a date, 2 bytes of padding
+ *   4-byte timezone offset (as with ident dates, e.g. -130 for -0130)
+ *   8-byte date
+ *   name of the tagged object (the_hash_algo->rawsz bytes)
+ *
+ * All numbers are in network byte order.
+ */
+
+#define REF_OBJECT_CACHE_SIGNATURE 0x524f4341 /* "ROCA" */
+#define REF_OBJECT_CACHE_VERSION 1
+#define REF_OBJECT_CACHE_HEADER_SIZE 16
+
+struct new_summary {
+	struct oidmap_entry entry;
+	struct ref_object_summary summary;
+};
+
+static struct ref_object_cache {
+	int initialized;
+
+	/* The entries read from the file, if any. */
+	const unsigned char *map;
+	size_t map_size;
+	const unsigned char *entries;
+	uint32_t nr;
+
+	/* Summaries put since, to be written out. */
+	struct oidmap added;
+} cache;
+
+static size_t entry_size(void)
+{
+	return 2 * the_hash_algo->rawsz + 16;
+}
+
+static char *cache_path(struct repository *r)
+{
+	return repo_git_path(r, "ref-object-cache");
+}
+
+int ref_object_cache_enabled(struct repository *r)
+{
+	int enabled = 0;
+
+	repo_config_get_bool(r, "core.refobjectcache", &enabled);
+	return enabled;
+}
+
+static void read_cache(struct repository *r)
+{
+	char *path;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	if (cache.initialized)
+		return;
+	cache.initialized = 1;
+	oidmap_init(&cache.added, 0);
+
+	path = cache_path(r);
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) < 0 ||
+	    (size = xsize_t(st.st_size)) < REF_OBJECT_CACHE_HEADER_SIZE) {
+		close(fd);
+		return;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32((unsigned char *)map) != REF_OBJECT_CACHE_SIGNATURE ||
+	    get_be32((unsigned char *)map + 4) != REF_OBJECT_CACHE_VERSION ||
+	    get_be32((unsigned char *)map + 8) != the_hash_algo->format_id ||
+	    (size - REF_OBJECT_CACHE_HEADER_SIZE) / entry_size() !=
+	    get_be32((unsigned char *)map + 12) ||
+	    (size - REF_OBJECT_CACHE_HEADER_SIZE) % entry_size()) {
+		warning(_("ignoring malformed ref object cache"));
+		munmap(map, size);
+		return;
+	}
+
+	cache.map = map;
+	cache.map_size = size;
+	cache.entries = cache.map + REF_OBJECT_CACHE_HEADER_SIZE;
+	cache.nr = get_be32(cache.map + 12);
+}
+
+static void decode_entry(const unsigned char *p,
+			 struct ref_object_summary *summary)
+{
+	const unsigned char *fields = p + the_hash_algo->rawsz;
+
+	summary->type = fields[0];
+	summary->has_date = !!fields[1];
+	summary->tz = (int32_t)get_be32(fields + 4);
+	summary->date = get_be64(fields + 8);
+	oidread(&summary->tagged, fields + 16);
+}
+
+static void encode_entry(struct strbuf *out, const struct object_id *oid,
+			 const struct ref_object_summary *summary)
+{
+	unsigned char fields[16];
+
+	fields[0] = summary->type;
+	fields[1] = summary->has_date;
+	fields[2] = 0;
+	fields[3] = 0;
+	put_be32(fields + 4, (uint32_t)summary->tz);
+	put_be64(fields + 8, summary->date);
+
+	strbuf_add(out, oid->hash, the_hash_algo->rawsz);
+	strbuf_add(out, fields, sizeof(fields));
+	strbuf_add(out, summary->tagged.hash, the_hash_algo->rawsz);
+}
+
+static const unsigned char *find_entry(const struct object_id *oid)
+{
+	size_t esz = entry_size();
+	uint32_t lo = 0, hi = cache.nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *p = cache.entries + mi * esz;
+		int cmp = hashcmp(oid->hash, p);
+
+		if (!cmp)
+			return p;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return NULL;
+}
+
+int ref_object_cache_get(struct repository *r, const struct object_id *oid,
+			 struct ref_object_summary *summary)
+{
+	const struct new_summary *added;
+	const unsigned char *p;
+
+	read_cache(r);
+	p = find_entry(oid);
+	if (p) {
+		decode_entry(p, summary);
+		return 0;
+	}
+	added = oidmap_get(&cache.added, oid);
+	if (added) {
+		*summary = added->summary;
+		return 0;
+	}
+	return -1;
+}
+
+void ref_object_cache_put(struct repository *r, const struct object_id *oid,
+			  const struct ref_object_summary *summary)
+{
+	struct new_summary *added;
+
+	read_cache(r);
+	if (find_entry(oid) || oidmap_get(&cache.added, oid))
+		return;
+	added = xcalloc(1, sizeof(*added));
+	oidcpy(&added->entry.oid, oid);
+	added->summary = *summary;
+	oidmap_put(&cache.added, added);
+}
+
+static int new_summary_cmp(const void *va, const void *vb)
+{
+	const struct new_summary *a = *(const struct new_summary **)va;
+	const struct new_summary *b = *(const struct new_summary **)vb;
+
+	return oidcmp(&a->entry.oid, &b->entry.oid);
+}
+
+static void write_cache(struct repository *r)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf out = STRBUF_INIT;
+	struct new_summary **added, *e;
+	struct oidmap_iter iter;
+	size_t esz = entry_size();
+	size_t nr_added = 0, i = 0, j = 0, nr;
+	unsigned char header[REF_OBJECT_CACHE_HEADER_SIZE];
+	char *path;
+	int fd;
+
+	ALLOC_ARRAY(added, oidmap_get_size(&cache.added));
+	oidmap_iter_init(&cache.added, &iter);
+	while ((e = oidmap_iter_next(&iter)))
+		added[nr_added++] = e;
+	QSORT(added, nr_added, new_summary_cmp);
+
+	nr = cache.nr + nr_added;
+	put_be32(header, REF_OBJECT_CACHE_SIGNATURE);
+	put_be32(header + 4, REF_OBJECT_CACHE_VERSION);
+	put_be32(header + 8, the_hash_algo->format_id);
+	put_be32(header + 12, nr);
+	strbuf_grow(&out, REF_OBJECT_CACHE_HEADER_SIZE + nr * esz);
+	strbuf_add(&out, header, sizeof(header));
+
+	/* merge the new entries into the old ones */
+	while (i < cache.nr || j < nr_added) {
+		const unsigned char *p = cache.entries + i * esz;
+
+		if (j == nr_added ||
+		    (i < cache.nr && hashcmp(p, added[j]->entry.oid.hash) < 0)) {
+			strbuf_add(&out, p, esz);
+			i++;
+		} else {
+			encode_entry(&out, &added[j]->entry.oid,
+				     &added[j]->summary);
+			j++;
+		}
+	}
+
+	path = cache_path(r);
+	fd = hold_lock_file_for_update(&lk, path, 0);
+	if (fd >= 0 &&
+	    (write_in_full(fd, out.buf, out.len) < 0 ||
+	     commit_lock_file(&lk) < 0))
+		rollback_lock_file(&lk);
+
+	free(path);
+	free(added);
+	strbuf_release(&out);
+}
+
+void ref_object_cache_write(struct repository *r)
+{
+	if (!cache.initialized)
+		return;
+
+	if (oidmap_get_size(&cache.added))
+		write_cache(r);
+
+	if (cache.map)
+		munmap((void *)cache.map, cache.map_size);
+	oidmap_free(&cache.added, 1);
+	memset(&cache, 0, sizeof(cache));
+}
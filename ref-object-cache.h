@@ -0,0 +1,50 @@
+#ifndef REF_OBJECT_CACHE_H
+#define REF_OBJECT_CACHE_H
+
+#include "object.h"
+
+struct repository;
+
+/*
+ * What ref-filter needs to know about the object a ref points at for
+ * the common atoms "objecttype", "*objectname" and the tagger,
+ * committer and creator dates, without reading the object.
+ */
+struct ref_object_summary {
+	enum object_type type;
+
+	/* For a tag, the object it points at. */
+	struct object_id tagged;
+
+	/* The tagger date of a tag, or the committer date of a commit. */
+	unsigned has_date : 1;
+	timestamp_t date;
+	int tz;
+};
+
+/*
+ * The cache lives in "$GIT_DIR/ref-object-cache" and maps object names
+ * to their summaries. As objects never change, its entries never go
+ * stale; summaries of objects that are subject to replacement (see
+ * git-replace(1)) must not be stored or looked up.
+ */
+
+/* Is `core.refObjectCache` enabled? */
+int ref_object_cache_enabled(struct repository *r);
+
+/* Look up `oid`. Return 0 and fill `summary` if it was found. */
+int ref_object_cache_get(struct repository *r, const struct object_id *oid,
+			 struct ref_object_summary *summary);
+
+/* Remember `summary` for `oid`, to be written by ref_object_cache_write(). */
+void ref_object_cache_put(struct repository *r, const struct object_id *oid,
+			  const struct ref_object_summary *summary);
+
+/*
+ * Write out the summaries added since the cache was read, if any, and
+ * release it. Failing to write is not an error, as the cache is only
+ * an optimization.
+ */
+void ref_object_cache_write(struct repository *r);
+
+#endif /* REF_OBJECT_CACHE_H */
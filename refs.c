@@ -22,7 +22,7 @@
 /*
  * List of all available backends
  */
-static struct ref_storage_be *refs_backends = &refs_be_files;
+static struct ref_storage_be *refs_backends = &refs_be_reftable;
 
 static struct ref_storage_be *find_ref_storage_backend(const char *name)
 {
@@ -38,6 +38,27 @@ int ref_storage_backend_exists(const char *name)
 	return find_ref_storage_backend(name) != NULL;
 }
 
+enum ref_storage_format ref_storage_format_by_name(const char *name)
+{
+	if (!strcmp(name, "files"))
+		return REF_STORAGE_FORMAT_FILES;
+	if (!strcmp(name, "reftable"))
+		return REF_STORAGE_FORMAT_REFTABLE;
+	return REF_STORAGE_FORMAT_UNKNOWN;
+}
+
+const char *ref_storage_format_to_name(enum ref_storage_format format)
+{
+	switch (format) {
+	case REF_STORAGE_FORMAT_FILES:
+		return "files";
+	case REF_STORAGE_FORMAT_REFTABLE:
+		return "reftable";
+	default:
+		BUG("unknown ref storage format %d", format);
+	}
+}
+
 /*
  * How to handle various characters in refnames:
  * 0: An acceptable character for refs
@@ -985,7 +1006,17 @@ int read_ref_at(struct ref_store *refs, const char *refname,
 		return 0;
 	}
 
-	refs_for_each_reflog_ent_reverse(refs, refname, read_ref_at_ent, &cb);
+	/*
+	 * Unless the caller wants to know how many entries are newer,
+	 * the ones after the first one that is newer than at_time do
+	 * not matter.
+	 */
+	if (cb.cnt < 0 && !cutoff_cnt)
+		refs_for_each_reflog_ent_reverse_at(refs, refname, at_time,
+						    read_ref_at_ent, &cb);
+	else
+		refs_for_each_reflog_ent_reverse(refs, refname,
+						 read_ref_at_ent, &cb);
 
 	if (!cb.reccnt) {
 		if (flags & GET_OID_QUIETLY)
@@ -1876,9 +1907,10 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
  * gitdir.
  */
 static struct ref_store *ref_store_init(const char *gitdir,
+					enum ref_storage_format format,
 					unsigned int flags)
 {
-	const char *be_name = "files";
+	const char *be_name = ref_storage_format_to_name(format);
 	struct ref_storage_be *be = find_ref_storage_backend(be_name);
 	struct ref_store *refs;
 
@@ -1897,7 +1929,8 @@ struct ref_store *get_main_ref_store(struct repository *r)
 	if (!r->gitdir)
 		BUG("attempting to get main_ref_store outside of repository");
 
-	r->refs_private = ref_store_init(r->gitdir, REF_STORE_ALL_CAPS);
+	r->refs_private = ref_store_init(r->gitdir, r->ref_storage_format,
+					 REF_STORE_ALL_CAPS);
 	r->refs_private = maybe_debug_wrap_ref_store(r->gitdir, r->refs_private);
 	return r->refs_private;
 }
@@ -1923,6 +1956,7 @@ static void register_ref_store_map(struct hashmap *map,
 
 struct ref_store *get_submodule_ref_store(const char *submodule)
 {
+	struct repository_format format = REPOSITORY_FORMAT_INIT;
 	struct strbuf submodule_sb = STRBUF_INIT;
 	struct ref_store *refs;
 	char *to_free = NULL;
@@ -1952,9 +1986,18 @@ struct ref_store *get_submodule_ref_store(const char *submodule)
 	if (submodule_to_gitdir(&submodule_sb, submodule))
 		goto done;
 
+	/*
+	 * The submodule may use another ref storage format than the
+	 * superproject; its own configuration says which one.
+	 */
+	strbuf_addstr(&submodule_sb, "/config");
+	read_repository_format(&format, submodule_sb.buf);
+	strbuf_setlen(&submodule_sb, submodule_sb.len - strlen("/config"));
+
 	/* assume that add_submodule_odb() has been called */
-	refs = ref_store_init(submodule_sb.buf,
+	refs = ref_store_init(submodule_sb.buf, format.ref_storage_format,
 			      REF_STORE_READ | REF_STORE_ODB);
+	clear_repository_format(&format);
 	register_ref_store_map(&submodule_ref_stores, "submodule",
 			       refs, submodule);
 
@@ -1980,9 +2023,11 @@ struct ref_store *get_worktree_ref_store(const struct worktree *wt)
 
 	if (wt->id)
 		refs = ref_store_init(git_common_path("worktrees/%s", wt->id),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 	else
 		refs = ref_store_init(get_git_common_dir(),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 
 	if (refs)
@@ -2003,6 +2048,47 @@ int refs_pack_refs(struct ref_store *refs, unsigned int flags)
 	return refs->be->pack_refs(refs, flags);
 }
 
+int refs_fingerprint(struct ref_store *refs, struct strbuf *out)
+{
+	/*
+	 * Only trust timestamps from before we started looking: a later
+	 * change could land within the same tick and go unnoticed.
+	 */
+	time_t since = time(NULL);
+	int ret;
+
+	strbuf_reset(out);
+	strbuf_addf(out, "%s\n", refs->be->name);
+	ret = refs->be->fingerprint(refs, since, out);
+	if (ret)
+		strbuf_reset(out);
+	return ret;
+}
+
+void refs_clear_cache(struct ref_store *refs)
+{
+	refs->be->clear_cache(refs);
+}
+
+int fingerprint_path(struct strbuf *out, const char *path, time_t since)
+{
+	struct stat st;
+
+	if (lstat(path, &st)) {
+		if (errno != ENOENT)
+			return -1;
+		strbuf_addf(out, "%s missing\n", path);
+		return 0;
+	}
+	if (st.st_mtime >= since)
+		return -1;
+	strbuf_addf(out, "%s %"PRIuMAX" %"PRIuMAX" %"PRIuMAX".%u %"PRIuMAX".%u\n",
+		    path, (uintmax_t)st.st_ino, (uintmax_t)st.st_size,
+		    (uintmax_t)st.st_mtime, (unsigned)ST_MTIME_NSEC(st),
+		    (uintmax_t)st.st_ctime, (unsigned)ST_CTIME_NSEC(st));
+	return 0;
+}
+
 int peel_iterated_oid(const struct object_id *base, struct object_id *peeled)
 {
 	if (current_ref_iter &&
@@ -2316,6 +2402,19 @@ int refs_for_each_reflog_ent_reverse(struct ref_store *refs,
 						     fn, cb_data);
 }
 
+int refs_for_each_reflog_ent_reverse_at(struct ref_store *refs,
+					const char *refname,
+					timestamp_t at_time,
+					each_reflog_ent_fn fn,
+					void *cb_data)
+{
+	if (!refs->be->for_each_reflog_ent_reverse_at)
+		return refs->be->for_each_reflog_ent_reverse(refs, refname,
+							     fn, cb_data);
+	return refs->be->for_each_reflog_ent_reverse_at(refs, refname, at_time,
+							fn, cb_data);
+}
+
 int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn,
 				void *cb_data)
 {
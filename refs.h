@@ -412,6 +412,21 @@ void warn_dangling_symrefs(FILE *fp, const char *msg_fmt,
  */
 int refs_pack_refs(struct ref_store *refs, unsigned int flags);
 
+/*
+ * Write to `out` a fingerprint of the current state of the references
+ * in `refs`: if it is the same at two points in time, no reference
+ * changed in between. Return -1 if the store cannot provide one right
+ * now, e.g. because it was just modified.
+ */
+int refs_fingerprint(struct ref_store *refs, struct strbuf *out);
+
+/*
+ * Drop what `refs` has cached about its references, e.g. after
+ * refs_fingerprint() says that they changed. Long-running processes
+ * use this to see updates made by others.
+ */
+void refs_clear_cache(struct ref_store *refs);
+
 /*
  * Setup reflog before using. Fill in err and return -1 on failure.
  */
@@ -481,6 +496,20 @@ int refs_for_each_reflog_ent_reverse(struct ref_store *refs,
 				     each_reflog_ent_fn fn,
 				     void *cb_data);
 
+/*
+ * Youngest entry first, but starting with the oldest entry whose
+ * timestamp is after `at_time` (or the youngest entry if there is no
+ * such entry): this is where a reverse walk looking for the entry in
+ * effect at `at_time` has to start, and a backend that can seek to it
+ * by time does not read the newer entries. Other backends show them
+ * all, like refs_for_each_reflog_ent_reverse().
+ */
+int refs_for_each_reflog_ent_reverse_at(struct ref_store *refs,
+					const char *refname,
+					timestamp_t at_time,
+					each_reflog_ent_fn fn,
+					void *cb_data);
+
 /*
  * Iterate over reflog entries in the log for `refname` in the main ref store.
  */
@@ -838,6 +867,13 @@ int reflog_expire(const char *refname, const struct object_id *oid,
 
 int ref_storage_backend_exists(const char *name);
 
+/*
+ * Map the name of a reference storage format ("files", "reftable") to
+ * the format and back. Unknown names yield REF_STORAGE_FORMAT_UNKNOWN.
+ */
+enum ref_storage_format ref_storage_format_by_name(const char *name);
+const char *ref_storage_format_to_name(enum ref_storage_format format);
+
 struct ref_store *get_main_ref_store(struct repository *r);
 
 /**
@@ -259,6 +259,22 @@ static int debug_read_raw_ref(struct ref_store *ref_store, const char *refname,
 	return res;
 }
 
+static int debug_fingerprint(struct ref_store *ref_store, time_t since,
+			     struct strbuf *out)
+{
+	struct debug_ref_store *drefs = (struct debug_ref_store *)ref_store;
+	int res = drefs->refs->be->fingerprint(drefs->refs, since, out);
+	trace_printf_key(&trace_refs, "fingerprint: %d\n", res);
+	return res;
+}
+
+static void debug_clear_cache(struct ref_store *ref_store)
+{
+	struct debug_ref_store *drefs = (struct debug_ref_store *)ref_store;
+	drefs->refs->be->clear_cache(drefs->refs);
+	trace_printf_key(&trace_refs, "clear_cache\n");
+}
+
 static struct ref_iterator *
 debug_reflog_iterator_begin(struct ref_store *ref_store)
 {
@@ -330,6 +346,25 @@ static int debug_for_each_reflog_ent_reverse(struct ref_store *ref_store,
 	return res;
 }
 
+static int debug_for_each_reflog_ent_reverse_at(struct ref_store *ref_store,
+						const char *refname,
+						timestamp_t at_time,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct debug_ref_store *drefs = (struct debug_ref_store *)ref_store;
+	struct debug_reflog dbg = {
+		.refname = refname,
+		.fn = fn,
+		.cb_data = cb_data,
+	};
+	int res = refs_for_each_reflog_ent_reverse_at(
+		drefs->refs, refname, at_time, &debug_print_reflog_ent, &dbg);
+	trace_printf_key(&trace_refs, "for_each_reflog_reverse_at: %s: %"PRItime": %d\n",
+			 refname, at_time, res);
+	return res;
+}
+
 static int debug_reflog_exists(struct ref_store *ref_store, const char *refname)
 {
 	struct debug_ref_store *drefs = (struct debug_ref_store *)ref_store;
@@ -431,6 +466,8 @@ struct ref_storage_be refs_be_debug = {
 
 	debug_ref_iterator_begin,
 	debug_read_raw_ref,
+	debug_fingerprint,
+	debug_clear_cache,
 
 	debug_reflog_iterator_begin,
 	debug_for_each_reflog_ent,
@@ -439,4 +476,5 @@ struct ref_storage_be refs_be_debug = {
 	debug_create_reflog,
 	debug_delete_reflog,
 	debug_reflog_expire,
+	debug_for_each_reflog_ent_reverse_at,
 };
@@ -10,6 +10,7 @@
 #include "../object.h"
 #include "../dir.h"
 #include "../chdir-notify.h"
+#include "../thread-utils.h"
 #include "worktree.h"
 
 /*
@@ -50,6 +51,12 @@
  */
 #define REF_DELETED_RMDIR (1 << 9)
 
+/*
+ * Used as a flag in ref_update::flags when the new value of the
+ * reference is written to packed-refs instead of its loose file.
+ */
+#define REF_VIA_PACKED (1 << 10)
+
 struct ref_lock {
 	char *ref_name;
 	struct lock_file lk;
@@ -232,10 +239,148 @@ static void add_per_worktree_entries_to_dir(struct ref_dir *dir, const char *dir
 	}
 }
 
+/*
+ * Add the loose reference `refname` to `dir`. `oid` and `flag` hold
+ * its value if the caller has already read it; otherwise (if
+ * `have_value` is zero) resolve it here.
+ */
+static void add_loose_ref_entry(struct files_ref_store *refs,
+				struct ref_dir *dir, const char *refname,
+				struct object_id *oid, int flag,
+				int have_value)
+{
+	if (!have_value &&
+	    !refs_resolve_ref_unsafe(&refs->base, refname,
+				     RESOLVE_REF_READING, oid, &flag)) {
+		oidclr(oid);
+		flag |= REF_ISBROKEN;
+	} else if (is_null_oid(oid)) {
+		/*
+		 * It is so astronomically unlikely
+		 * that null_oid is the OID of an
+		 * actual object that we consider its
+		 * appearance in a loose reference
+		 * file to be repo corruption
+		 * (probably due to a software bug).
+		 */
+		flag |= REF_ISBROKEN;
+	}
+
+	if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+		if (!refname_is_safe(refname))
+			die("loose refname is dangerous: %s", refname);
+		oidclr(oid);
+		flag |= REF_BAD_NAME | REF_ISBROKEN;
+	}
+	add_entry_to_dir(dir, create_ref_entry(refname, oid, flag));
+}
+
+/*
+ * Reading a directory full of loose refs is dominated by the
+ * open/read/close of each file, so with enough of them the reads are
+ * spread over several threads. Each thread gets at least this many
+ * files.
+ */
+#define LOOSE_REF_THREAD_COST 256
+
+struct loose_ref_contents {
+	struct strbuf buf;
+	int ok;
+};
+
+struct loose_ref_reader {
+	const char *dirpath;
+	const struct string_list *names;
+	struct loose_ref_contents *contents;
+	size_t begin, end;
+};
+
+static void *read_loose_ref_range(void *data)
+{
+	struct loose_ref_reader *reader = data;
+	struct strbuf path = STRBUF_INIT;
+	size_t i;
+
+	strbuf_addstr(&path, reader->dirpath);
+	for (i = reader->begin; i < reader->end; i++) {
+		struct loose_ref_contents *c = &reader->contents[i];
+
+		strbuf_addstr(&path, reader->names->items[i].string);
+		c->ok = strbuf_read_file(&c->buf, path.buf, 256) >= 0;
+		strbuf_rtrim(&c->buf);
+		strbuf_setlen(&path, strlen(reader->dirpath));
+	}
+	strbuf_release(&path);
+	return NULL;
+}
+
+/*
+ * Read the files `names` in the directory `dirpath` (which ends with
+ * a slash) into `contents`, an array of the same size; files that
+ * cannot be read have `ok` unset. Only raw file contents are read
+ * here, so that this can run in threads that do not touch the ref
+ * store.
+ */
+static void read_loose_ref_files(const char *dirpath,
+				 const struct string_list *names,
+				 struct loose_ref_contents *contents)
+{
+	struct loose_ref_reader *readers;
+	pthread_t *threads;
+	int nr_threads = git_env_ulong("GIT_TEST_LOOSE_REF_THREADS", 0);
+	int t;
+
+	if (!nr_threads) {
+		nr_threads = online_cpus();
+		if (names->nr < nr_threads * LOOSE_REF_THREAD_COST)
+			nr_threads = names->nr / LOOSE_REF_THREAD_COST;
+	}
+	if (nr_threads > names->nr)
+		nr_threads = names->nr;
+	if (!HAVE_THREADS || nr_threads <= 1) {
+		struct loose_ref_reader reader = {
+			dirpath, names, contents, 0, names->nr
+		};
+
+		read_loose_ref_range(&reader);
+		return;
+	}
+
+	CALLOC_ARRAY(readers, nr_threads);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		struct loose_ref_reader *reader = &readers[t];
+		int err;
+
+		reader->dirpath = dirpath;
+		reader->names = names;
+		reader->contents = contents;
+		reader->begin = names->nr * t / nr_threads;
+		reader->end = names->nr * (t + 1) / nr_threads;
+		err = pthread_create(&threads[t], NULL,
+				     read_loose_ref_range, reader);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (t = 0; t < nr_threads; t++) {
+		int err = pthread_join(threads[t], NULL);
+
+		if (err)
+			die(_("unable to join thread: %s"), strerror(err));
+	}
+	free(threads);
+	free(readers);
+}
+
 /*
  * Read the loose references from the namespace dirname into dir
  * (without recursing).  dirname must end with '/'.  dir must be the
  * directory entry corresponding to dirname.
+ *
+ * Plain files, as reported by readdir(), are read up front (see
+ * read_loose_ref_files()) and parsed here. Anything that does not
+ * parse as a simple object name, and anything readdir() cannot tell
+ * the type of, goes through refs_resolve_ref_unsafe() instead.
  */
 static void loose_fill_ref_dir(struct ref_store *ref_store,
 			       struct ref_dir *dir, const char *dirname)
@@ -247,7 +392,10 @@ static void loose_fill_ref_dir(struct ref_store *ref_store,
 	int dirnamelen = strlen(dirname);
 	struct strbuf refname;
 	struct strbuf path = STRBUF_INIT;
-	size_t path_baselen;
+	struct strbuf referent = STRBUF_INIT;
+	struct string_list files = STRING_LIST_INIT_DUP;
+	struct loose_ref_contents *contents;
+	size_t path_baselen, i;
 
 	files_ref_path(refs, &path, dirname);
 	path_baselen = path.len;
@@ -264,56 +412,55 @@ static void loose_fill_ref_dir(struct ref_store *ref_store,
 	while ((de = readdir(d)) != NULL) {
 		struct object_id oid;
 		struct stat st;
-		int flag;
 
 		if (de->d_name[0] == '.')
 			continue;
 		if (ends_with(de->d_name, ".lock"))
 			continue;
+		if (DTYPE(de) == DT_REG) {
+			string_list_append(&files, de->d_name);
+			continue;
+		}
 		strbuf_addstr(&refname, de->d_name);
 		strbuf_addstr(&path, de->d_name);
-		if (stat(path.buf, &st) < 0) {
+		if (DTYPE(de) != DT_DIR && stat(path.buf, &st) < 0) {
 			; /* silently ignore */
-		} else if (S_ISDIR(st.st_mode)) {
+		} else if (DTYPE(de) == DT_DIR || S_ISDIR(st.st_mode)) {
 			strbuf_addch(&refname, '/');
 			add_entry_to_dir(dir,
 					 create_dir_entry(dir->cache, refname.buf,
 							  refname.len, 1));
 		} else {
-			if (!refs_resolve_ref_unsafe(&refs->base,
-						     refname.buf,
-						     RESOLVE_REF_READING,
-						     &oid, &flag)) {
-				oidclr(&oid);
-				flag |= REF_ISBROKEN;
-			} else if (is_null_oid(&oid)) {
-				/*
-				 * It is so astronomically unlikely
-				 * that null_oid is the OID of an
-				 * actual object that we consider its
-				 * appearance in a loose reference
-				 * file to be repo corruption
-				 * (probably due to a software bug).
-				 */
-				flag |= REF_ISBROKEN;
-			}
-
-			if (check_refname_format(refname.buf,
-						 REFNAME_ALLOW_ONELEVEL)) {
-				if (!refname_is_safe(refname.buf))
-					die("loose refname is dangerous: %s", refname.buf);
-				oidclr(&oid);
-				flag |= REF_BAD_NAME | REF_ISBROKEN;
-			}
-			add_entry_to_dir(dir,
-					 create_ref_entry(refname.buf, &oid, flag));
+			add_loose_ref_entry(refs, dir, refname.buf, &oid, 0, 0);
 		}
 		strbuf_setlen(&refname, dirnamelen);
 		strbuf_setlen(&path, path_baselen);
 	}
+	closedir(d);
+
+	CALLOC_ARRAY(contents, files.nr);
+	read_loose_ref_files(path.buf, &files, contents);
+	for (i = 0; i < files.nr; i++) {
+		struct loose_ref_contents *c = &contents[i];
+		struct object_id oid;
+		unsigned int type = 0;
+		int have_value;
+
+		strbuf_addstr(&refname, files.items[i].string);
+		have_value = c->ok &&
+			!parse_loose_ref_contents(c->buf.buf, &oid,
+						  &referent, &type) &&
+			!(type & REF_ISSYMREF);
+		add_loose_ref_entry(refs, dir, refname.buf, &oid, 0,
+				    have_value);
+		strbuf_setlen(&refname, dirnamelen);
+		strbuf_release(&c->buf);
+	}
+	free(contents);
+	string_list_clear(&files, 0);
+	strbuf_release(&referent);
 	strbuf_release(&refname);
 	strbuf_release(&path);
-	closedir(d);
 
 	add_per_worktree_entries_to_dir(dir, dirname);
 }
@@ -466,6 +613,81 @@ static int files_read_raw_ref(struct ref_store *ref_store,
 	return ret;
 }
 
+/*
+ * Fingerprint the directory `path` and, recursively, those below it.
+ * Writing a loose reference renames its lockfile into place, so any
+ * change to the loose references shows up in the stat data of the
+ * directory that holds them.
+ */
+static int fingerprint_loose_dir(struct strbuf *path, time_t since,
+				 struct strbuf *out)
+{
+	size_t baselen = path->len;
+	DIR *d;
+	struct dirent *de;
+	int ret;
+
+	ret = fingerprint_path(out, path->buf, since);
+	if (ret)
+		return ret;
+
+	d = opendir(path->buf);
+	if (!d)
+		return errno == ENOENT ? 0 : -1;
+	while (!ret && (de = readdir(d)) != NULL) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(de->d_name) || DTYPE(de) == DT_REG)
+			continue;
+		strbuf_addch(path, '/');
+		strbuf_addstr(path, de->d_name);
+		if (DTYPE(de) == DT_DIR ||
+		    (DTYPE(de) == DT_UNKNOWN && !lstat(path->buf, &st) &&
+		     S_ISDIR(st.st_mode)))
+			ret = fingerprint_loose_dir(path, since, out);
+		strbuf_setlen(path, baselen);
+	}
+	closedir(d);
+	return ret;
+}
+
+static int files_fingerprint(struct ref_store *ref_store, time_t since,
+			     struct strbuf *out)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ, "fingerprint");
+	struct strbuf path = STRBUF_INIT;
+	int ret;
+
+	ret = refs->packed_ref_store->be->fingerprint(refs->packed_ref_store,
+						       since, out);
+	if (!ret) {
+		strbuf_addf(&path, "%s/HEAD", refs->base.gitdir);
+		ret = fingerprint_path(out, path.buf, since);
+	}
+	if (!ret) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/refs", refs->gitcommondir);
+		ret = fingerprint_loose_dir(&path, since, out);
+	}
+	if (!ret && strcmp(refs->base.gitdir, refs->gitcommondir)) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/refs", refs->base.gitdir);
+		ret = fingerprint_loose_dir(&path, since, out);
+	}
+	strbuf_release(&path);
+	return ret;
+}
+
+static void files_clear_cache(struct ref_store *ref_store)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ, "clear_cache");
+
+	clear_loose_ref_cache(refs);
+	refs->packed_ref_store->be->clear_cache(refs->packed_ref_store);
+}
+
 int parse_loose_ref_contents(const char *buf, struct object_id *oid,
 			     struct strbuf *referent, unsigned int *type)
 {
@@ -1148,12 +1370,20 @@ static int files_pack_refs(struct ref_store *ref_store, unsigned int flags)
 	struct ref_to_prune *refs_to_prune = NULL;
 	struct strbuf err = STRBUF_INIT;
 	struct ref_transaction *transaction;
+	int ret = 0;
 
+	/*
+	 * Errors are returned rather than died on, as "git maintenance"
+	 * runs "git pack-refs" in-process (see RUN_IN_PROCESS in git.c).
+	 */
 	transaction = ref_store_transaction_begin(refs->packed_ref_store, &err);
 	if (!transaction)
 		return -1;
 
-	packed_refs_lock(refs->packed_ref_store, LOCK_DIE_ON_ERROR, &err);
+	if (packed_refs_lock(refs->packed_ref_store, 0, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
 
 	iter = cache_ref_iterator_begin(get_loose_ref_cache(refs), NULL, 0);
 	while ((ok = ref_iterator_advance(iter)) == ITER_OK) {
@@ -1172,9 +1402,12 @@ static int files_pack_refs(struct ref_store *ref_store, unsigned int flags)
 		 */
 		if (ref_transaction_update(transaction, iter->refname,
 					   iter->oid, NULL,
-					   REF_NO_DEREF, NULL, &err))
-			die("failure preparing to create packed reference %s: %s",
-			    iter->refname, err.buf);
+					   REF_NO_DEREF, NULL, &err)) {
+			ret = error("failure preparing to create packed reference %s: %s",
+				    iter->refname, err.buf);
+			ref_iterator_abort(iter);
+			goto unlock;
+		}
 
 		/* Schedule the loose reference for pruning if requested. */
 		if ((flags & PACK_REFS_PRUNE)) {
@@ -1185,19 +1418,36 @@ static int files_pack_refs(struct ref_store *ref_store, unsigned int flags)
 			refs_to_prune = n;
 		}
 	}
-	if (ok != ITER_DONE)
-		die("error while iterating over references");
+	if (ok != ITER_DONE) {
+		ret = error("error while iterating over references");
+		goto unlock;
+	}
 
-	if (ref_transaction_commit(transaction, &err))
-		die("unable to write new packed-refs: %s", err.buf);
+	if (ref_transaction_commit(transaction, &err)) {
+		ret = error("unable to write new packed-refs: %s", err.buf);
+		goto unlock;
+	}
 
-	ref_transaction_free(transaction);
+	if (refs_pack_refs(refs->packed_ref_store, flags)) {
+		ret = error("unable to write new packed-refs");
+		goto unlock;
+	}
 
 	packed_refs_unlock(refs->packed_ref_store);
-
 	prune_refs(refs, &refs_to_prune);
+	goto out;
+
+unlock:
+	packed_refs_unlock(refs->packed_ref_store);
+	while (refs_to_prune) {
+		struct ref_to_prune *n = refs_to_prune->next;
+		free(refs_to_prune);
+		refs_to_prune = n;
+	}
+out:
+	ref_transaction_free(transaction);
 	strbuf_release(&err);
-	return 0;
+	return ret;
 }
 
 static int files_delete_refs(struct ref_store *ref_store, const char *msg,
@@ -1495,11 +1745,57 @@ static int close_ref_gently(struct ref_lock *lock)
 	return 0;
 }
 
+/*
+ * Number of lockfiles that were only handed to the kernel for
+ * writeout because of core.fsyncMethod=batch, and that still need a
+ * flush of the device cache before they are renamed into place.
+ */
+static int unflushed_ref_writes;
+
+static int fsync_ref_lockfile(struct ref_lock *lock)
+{
+	int fd = get_lock_file_fd(&lock->lk);
+
+	if (fsync_method == FSYNC_METHOD_BATCH &&
+	    git_fsync(fd, FSYNC_WRITEOUT_ONLY) >= 0) {
+		unflushed_ref_writes++;
+		return 0;
+	}
+	return git_fsync(fd, FSYNC_HARDWARE_FLUSH);
+}
+
+/*
+ * Make all lockfiles written so far durable with a single fsync() of
+ * a scratch file next to `path`, which flushes the device's cache for
+ * everything already written out on the same filesystem.
+ */
+static void flush_ref_writes(const char *path)
+{
+	struct strbuf temp_path = STRBUF_INIT;
+	struct tempfile *temp;
+	const char *slash;
+
+	if (!unflushed_ref_writes)
+		return;
+
+	slash = strrchr(path, '/');
+	if (slash)
+		strbuf_add(&temp_path, path, slash - path + 1);
+	strbuf_addstr(&temp_path, "fsync_XXXXXX");
+	temp = xmks_tempfile(temp_path.buf);
+	fsync_or_die(get_tempfile_fd(temp), get_tempfile_path(temp));
+	delete_tempfile(&temp);
+	strbuf_release(&temp_path);
+	unflushed_ref_writes = 0;
+}
+
 static int commit_ref(struct ref_lock *lock)
 {
 	char *path = get_locked_file_path(&lock->lk);
 	struct stat st;
 
+	flush_ref_writes(path);
+
 	if (!lstat(path, &st) && S_ISDIR(st.st_mode)) {
 		/*
 		 * There is a directory at the path we want to rename
@@ -1708,6 +2004,7 @@ static int write_ref_to_lockfile(struct ref_lock *lock,
 	fd = get_lock_file_fd(&lock->lk);
 	if (write_in_full(fd, oid_to_hex(oid), the_hash_algo->hexsz) < 0 ||
 	    write_in_full(fd, &term, 1) < 0 ||
+	    (fsync_ref_files && fsync_ref_lockfile(lock) < 0) ||
 	    close_ref_gently(lock) < 0) {
 		strbuf_addf(err,
 			    "couldn't write '%s'", get_lock_file_path(&lock->lk));
@@ -1929,30 +2226,16 @@ static char *find_beginning_of_line(char *bob, char *scan)
 	return scan;
 }
 
-static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
-					     const char *refname,
-					     each_reflog_ent_fn fn,
-					     void *cb_data)
+/*
+ * Show the entries of the reflog in `logfp` that end at or before `pos`,
+ * which must be the end of an entry, youngest first.
+ */
+static int show_reflog_ents_reverse(FILE *logfp, long pos, const char *refname,
+				    each_reflog_ent_fn fn, void *cb_data)
 {
-	struct files_ref_store *refs =
-		files_downcast(ref_store, REF_STORE_READ,
-			       "for_each_reflog_ent_reverse");
 	struct strbuf sb = STRBUF_INIT;
-	FILE *logfp;
-	long pos;
 	int ret = 0, at_tail = 1;
 
-	files_reflog_path(refs, &sb, refname);
-	logfp = fopen(sb.buf, "r");
-	strbuf_release(&sb);
-	if (!logfp)
-		return -1;
-
-	/* Jump to the end */
-	if (fseek(logfp, 0, SEEK_END) < 0)
-		ret = error("cannot seek back reflog for %s: %s",
-			    refname, strerror(errno));
-	pos = ftell(logfp);
 	while (!ret && 0 < pos) {
 		int cnt;
 		size_t nread;
@@ -2038,11 +2321,164 @@ static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
 	if (!ret && sb.len)
 		BUG("reverse reflog parser had leftover data");
 
+	strbuf_release(&sb);
+	return ret;
+}
+
+static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+					     const char *refname,
+					     each_reflog_ent_fn fn,
+					     void *cb_data)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse");
+	struct strbuf sb = STRBUF_INIT;
+	FILE *logfp;
+	int ret;
+
+	files_reflog_path(refs, &sb, refname);
+	logfp = fopen(sb.buf, "r");
+	strbuf_release(&sb);
+	if (!logfp)
+		return -1;
+
+	/* Jump to the end */
+	if (fseek(logfp, 0, SEEK_END) < 0)
+		ret = error("cannot seek back reflog for %s: %s",
+			    refname, strerror(errno));
+	else
+		ret = show_reflog_ents_reverse(logfp, ftell(logfp), refname,
+					       fn, cb_data);
+
 	fclose(logfp);
+	return ret;
+}
+
+/*
+ * Return the offset of the first entry that starts at or after `pos`,
+ * or the size of the file if there is none, or -1 on error.
+ */
+static long reflog_next_ent(FILE *logfp, long pos)
+{
+	int c;
+
+	if (!pos)
+		return 0;
+	if (fseek(logfp, pos - 1, SEEK_SET) < 0)
+		return -1;
+	while ((c = getc(logfp)) != EOF && c != '\n')
+		; /* keep scanning forward */
+	if (ferror(logfp))
+		return -1;
+	return ftell(logfp);
+}
+
+/*
+ * Read the entry at `pos` into `sb` and return its timestamp, or 0 if
+ * it cannot be read or parsed.
+ */
+static timestamp_t reflog_ent_timestamp(FILE *logfp, long pos,
+					struct strbuf *sb)
+{
+	struct object_id oid;
+	const char *p;
+	char *email_end;
+
+	if (fseek(logfp, pos, SEEK_SET) < 0 ||
+	    strbuf_getwholeline(sb, logfp, '\n') ||
+	    sb->buf[sb->len - 1] != '\n')
+		return 0;
+	p = sb->buf;
+	if (parse_oid_hex(p, &oid, &p) || *p++ != ' ' ||
+	    parse_oid_hex(p, &oid, &p) || *p++ != ' ' ||
+	    !(email_end = strchr(p, '>')) || email_end[1] != ' ')
+		return 0;
+	return parse_timestamp(email_end + 2, NULL, 10);
+}
+
+/*
+ * Find the end of the oldest entry of the reflog in `logfp`, which is
+ * `size` bytes long, whose timestamp is after `at_time` by bisecting
+ * the file, which assumes that the timestamps do not decrease from one
+ * entry to the next, as they do not when the entries are appended as
+ * the ref is updated. Return `size` if there is no such entry, or -1
+ * if an entry cannot be parsed.
+ */
+static long reflog_end_after(FILE *logfp, long size, timestamp_t at_time)
+{
+	struct strbuf sb = STRBUF_INIT;
+	long lo = 0, hi = size, ret = -1;
+
+	/*
+	 * The entries that start before lo are at or before at_time, the
+	 * ones that start at or after hi are after it.
+	 */
+	while (lo < hi) {
+		long mid = lo + (hi - lo) / 2;
+		long pos = reflog_next_ent(logfp, mid);
+		timestamp_t timestamp;
+
+		if (pos < 0)
+			goto out;
+		if (pos >= hi) {
+			/* no entry starts in [mid, hi) */
+			hi = mid;
+			continue;
+		}
+		timestamp = reflog_ent_timestamp(logfp, pos, &sb);
+		if (!timestamp)
+			goto out;
+		if (timestamp <= at_time)
+			lo = pos + sb.len;
+		else
+			hi = pos;
+	}
+
+	/* lo is now the start of the entry we are looking for */
+	if (lo >= size)
+		ret = size;
+	else if (reflog_ent_timestamp(logfp, lo, &sb))
+		ret = lo + sb.len;
+out:
 	strbuf_release(&sb);
 	return ret;
 }
 
+static int files_for_each_reflog_ent_reverse_at(struct ref_store *ref_store,
+						const char *refname,
+						timestamp_t at_time,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse_at");
+	struct strbuf sb = STRBUF_INIT;
+	FILE *logfp;
+	long size, end;
+	int ret;
+
+	files_reflog_path(refs, &sb, refname);
+	logfp = fopen(sb.buf, "r");
+	strbuf_release(&sb);
+	if (!logfp)
+		return -1;
+
+	if (fseek(logfp, 0, SEEK_END) < 0 || (size = ftell(logfp)) < 0) {
+		ret = error("cannot seek back reflog for %s: %s",
+			    refname, strerror(errno));
+		goto out;
+	}
+	end = reflog_end_after(logfp, size, at_time);
+	if (end < 0)
+		end = size; /* show everything and let the caller sort it out */
+	ret = show_reflog_ents_reverse(logfp, end, refname, fn, cb_data);
+out:
+	fclose(logfp);
+	return ret;
+}
+
 static int files_for_each_reflog_ent(struct ref_store *ref_store,
 				     const char *refname,
 				     each_reflog_ent_fn fn, void *cb_data)
@@ -2577,6 +3013,48 @@ static void files_transaction_cleanup(struct files_ref_store *refs,
 	transaction->state = REF_TRANSACTION_CLOSED;
 }
 
+/*
+ * Return true if this transaction has enough updates that writing
+ * those without a reflog directly to packed-refs, with one
+ * lockfile and one rename, beats renaming a lockfile for each of
+ * them (see core.packedRefsThreshold).
+ */
+static int want_packed_updates(struct ref_transaction *transaction)
+{
+	static int threshold_configured;
+	static int threshold;
+
+	if (!threshold_configured) {
+		git_config_get_int("core.packedrefsthreshold", &threshold);
+		threshold_configured = 1;
+	}
+	return threshold > 0 && transaction->nr >= threshold;
+}
+
+/*
+ * Return true if `update`, whose new value has been written to its
+ * lockfile, can be recorded in packed-refs instead: it sets a normal,
+ * non-symbolic reference that has no reflog to append to.
+ */
+static int can_update_packed(struct files_ref_store *refs,
+			     struct ref_update *update)
+{
+	struct strbuf sb = STRBUF_INIT;
+	int ret;
+
+	if (!(update->flags & REF_NEEDS_COMMIT) ||
+	    update->flags & (REF_LOG_ONLY | REF_FORCE_CREATE_REFLOG) ||
+	    update->type & REF_ISSYMREF ||
+	    ref_type(update->refname) != REF_TYPE_NORMAL ||
+	    should_autocreate_reflog(update->refname))
+		return 0;
+
+	files_reflog_path(refs, &sb, update->refname);
+	ret = access(sb.buf, F_OK) && errno == ENOENT;
+	strbuf_release(&sb);
+	return ret;
+}
+
 static int files_transaction_prepare(struct ref_store *ref_store,
 				     struct ref_transaction *transaction,
 				     struct strbuf *err)
@@ -2591,12 +3069,15 @@ static int files_transaction_prepare(struct ref_store *ref_store,
 	int head_type;
 	struct files_transaction_backend_data *backend_data;
 	struct ref_transaction *packed_transaction = NULL;
+	int pack_updates;
 
 	assert(err);
 
 	if (!transaction->nr)
 		goto cleanup;
 
+	pack_updates = want_packed_updates(transaction);
+
 	CALLOC_ARRAY(backend_data, 1);
 	transaction->backend_data = backend_data;
 
@@ -2672,12 +3153,24 @@ static int files_transaction_prepare(struct ref_store *ref_store,
 		if (ret)
 			goto cleanup;
 
-		if (update->flags & REF_DELETING &&
-		    !(update->flags & REF_LOG_ONLY) &&
-		    !(update->flags & REF_IS_PRUNING)) {
+		if (pack_updates && can_update_packed(refs, update)) {
+			/*
+			 * Write the new value to packed-refs along
+			 * with the other updates, and drop the loose
+			 * reference once that has been committed. The
+			 * lock is kept until then.
+			 */
+			update->flags &= ~REF_NEEDS_COMMIT;
+			update->flags |= REF_VIA_PACKED;
+		}
+
+		if ((update->flags & REF_DELETING &&
+		     !(update->flags & REF_LOG_ONLY) &&
+		     !(update->flags & REF_IS_PRUNING)) ||
+		    update->flags & REF_VIA_PACKED) {
 			/*
-			 * This reference has to be deleted from
-			 * packed-refs if it exists there.
+			 * This reference has to be deleted from, or
+			 * written to, packed-refs.
 			 */
 			if (!packed_transaction) {
 				packed_transaction = ref_store_transaction_begin(
@@ -2850,8 +3343,9 @@ static int files_transaction_finish(struct ref_store *ref_store,
 		struct ref_update *update = transaction->updates[i];
 		struct ref_lock *lock = update->backend_data;
 
-		if (update->flags & REF_DELETING &&
-		    !(update->flags & REF_LOG_ONLY)) {
+		if ((update->flags & REF_DELETING &&
+		     !(update->flags & REF_LOG_ONLY)) ||
+		    update->flags & REF_VIA_PACKED) {
 			update->flags |= REF_DELETED_RMDIR;
 			if (!(update->type & REF_ISPACKED) ||
 			    update->type & REF_ISSYMREF) {
@@ -3005,6 +3499,7 @@ struct expire_reflog_cb {
 	void *policy_cb;
 	FILE *newlog;
 	struct object_id last_kept_oid;
+	unsigned changed : 1;
 };
 
 static int expire_reflog_ent(struct object_id *ooid, struct object_id *noid,
@@ -3014,11 +3509,15 @@ static int expire_reflog_ent(struct object_id *ooid, struct object_id *noid,
 	struct expire_reflog_cb *cb = cb_data;
 	struct expire_reflog_policy_cb *policy_cb = cb->policy_cb;
 
-	if (cb->flags & EXPIRE_REFLOGS_REWRITE)
+	if (cb->flags & EXPIRE_REFLOGS_REWRITE) {
+		if (!oideq(ooid, &cb->last_kept_oid))
+			cb->changed = 1;
 		ooid = &cb->last_kept_oid;
+	}
 
 	if ((*cb->should_prune_fn)(ooid, noid, email, timestamp, tz,
 				   message, policy_cb)) {
+		cb->changed = 1;
 		if (!cb->newlog)
 			printf("would prune %s", message);
 		else if (cb->flags & EXPIRE_REFLOGS_VERBOSE)
@@ -3117,9 +3616,17 @@ static int files_reflog_expire(struct ref_store *ref_store,
 		 */
 		int update = (flags & EXPIRE_REFLOGS_UPDATE_REF) &&
 			!(type & REF_ISSYMREF) &&
-			!is_null_oid(&cb.last_kept_oid);
+			!is_null_oid(&cb.last_kept_oid) &&
+			!oideq(&cb.last_kept_oid, &lock->old_oid);
 
-		if (close_lock_file_gently(&reflog_lock)) {
+		if (!cb.changed && !update) {
+			/*
+			 * Nothing was pruned, so leave the reflog alone
+			 * rather than replacing it with an identical copy;
+			 * with many refs, most expiries are like that.
+			 */
+			rollback_lock_file(&reflog_lock);
+		} else if (close_lock_file_gently(&reflog_lock)) {
 			status |= error("couldn't write %s: %s", log_file,
 					strerror(errno));
 			rollback_lock_file(&reflog_lock);
@@ -3187,6 +3694,8 @@ struct ref_storage_be refs_be_files = {
 
 	files_ref_iterator_begin,
 	files_read_raw_ref,
+	files_fingerprint,
+	files_clear_cache,
 
 	files_reflog_iterator_begin,
 	files_for_each_reflog_ent,
@@ -3194,5 +3703,6 @@ struct ref_storage_be refs_be_files = {
 	files_reflog_exists,
 	files_create_reflog,
 	files_delete_reflog,
-	files_reflog_expire
+	files_reflog_expire,
+	files_for_each_reflog_ent_reverse_at
 };
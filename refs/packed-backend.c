@@ -68,6 +68,12 @@ struct snapshot {
 	/* Is the `packed-refs` file currently mmapped? */
 	int mmapped;
 
+	/*
+	 * Was this snapshot read from the `packed-refs.delta` file
+	 * rather than from `packed-refs` itself?
+	 */
+	int is_delta;
+
 	/*
 	 * The contents of the `packed-refs` file:
 	 *
@@ -106,6 +112,16 @@ struct snapshot {
 	 * replaced since we read it.
 	 */
 	struct stat_validity validity;
+
+	/*
+	 * For a snapshot of `packed-refs`, the snapshot of the
+	 * `packed-refs.delta` file that was read along with it (and
+	 * which is freed with it). Its records take precedence over
+	 * ours; a record whose value is the null object name is a
+	 * "tombstone" that deletes our record of the same name. If
+	 * there is no delta file, this snapshot is empty.
+	 */
+	struct snapshot *delta;
 };
 
 /*
@@ -131,6 +147,9 @@ struct packed_ref_store {
 	/* The path of the "packed-refs" file: */
 	char *path;
 
+	/* The path of the "packed-refs.delta" file: */
+	char *delta_path;
+
 	/*
 	 * A snapshot of the values read from the `packed-refs` file,
 	 * if it might still be current; otherwise, NULL.
@@ -151,6 +170,12 @@ struct packed_ref_store {
 	struct tempfile *tempfile;
 };
 
+static const char *snapshot_path(struct snapshot *snapshot)
+{
+	return snapshot->is_delta ?
+		snapshot->refs->delta_path : snapshot->refs->path;
+}
+
 /*
  * Increment the reference count of `*snapshot`.
  */
@@ -169,7 +194,7 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
 	if (snapshot->mmapped) {
 		if (munmap(snapshot->buf, snapshot->eof - snapshot->buf))
 			die_errno("error ummapping packed-refs file %s",
-				  snapshot->refs->path);
+				  snapshot_path(snapshot));
 		snapshot->mmapped = 0;
 	} else {
 		free(snapshot->buf);
@@ -186,6 +211,8 @@ static int release_snapshot(struct snapshot *snapshot)
 	if (!--snapshot->referrers) {
 		stat_validity_clear(&snapshot->validity);
 		clear_snapshot_buffer(snapshot);
+		if (snapshot->delta)
+			release_snapshot(snapshot->delta);
 		free(snapshot);
 		return 1;
 	} else {
@@ -205,6 +232,8 @@ struct ref_store *packed_ref_store_create(const char *path,
 
 	refs->path = xstrdup(path);
 	chdir_notify_reparent("packed-refs", &refs->path);
+	refs->delta_path = xstrfmt("%s.delta", path);
+	chdir_notify_reparent("packed-refs.delta", &refs->delta_path);
 
 	return ref_store;
 }
@@ -346,7 +375,7 @@ static void sort_snapshot(struct snapshot *snapshot)
 			/* The safety check should prevent this. */
 			BUG("unterminated line found in packed-refs");
 		if (eol - pos < the_hash_algo->hexsz + 2)
-			die_invalid_line(snapshot->refs->path,
+			die_invalid_line(snapshot_path(snapshot),
 					 pos, eof - pos);
 		eol++;
 		if (eol < eof && *eol == '^') {
@@ -458,7 +487,7 @@ static void verify_buffer_safe(struct snapshot *snapshot)
 
 	last_line = find_start_of_record(start, eof - 1);
 	if (*(eof - 1) != '\n' || eof - last_line < the_hash_algo->hexsz + 2)
-		die_invalid_line(snapshot->refs->path,
+		die_invalid_line(snapshot_path(snapshot),
 				 last_line, eof - last_line);
 }
 
@@ -472,12 +501,13 @@ static void verify_buffer_safe(struct snapshot *snapshot)
  */
 static int load_contents(struct snapshot *snapshot)
 {
+	const char *path = snapshot_path(snapshot);
 	int fd;
 	struct stat st;
 	size_t size;
 	ssize_t bytes_read;
 
-	fd = open(snapshot->refs->path, O_RDONLY);
+	fd = open(path, O_RDONLY);
 	if (fd < 0) {
 		if (errno == ENOENT) {
 			/*
@@ -489,14 +519,14 @@ static int load_contents(struct snapshot *snapshot)
 			 */
 			return 0;
 		} else {
-			die_errno("couldn't read %s", snapshot->refs->path);
+			die_errno("couldn't read %s", path);
 		}
 	}
 
 	stat_validity_update(&snapshot->validity, fd);
 
 	if (fstat(fd, &st) < 0)
-		die_errno("couldn't stat %s", snapshot->refs->path);
+		die_errno("couldn't stat %s", path);
 	size = xsize_t(st.st_size);
 
 	if (!size) {
@@ -506,7 +536,7 @@ static int load_contents(struct snapshot *snapshot)
 		snapshot->buf = xmalloc(size);
 		bytes_read = read_in_full(fd, snapshot->buf, size);
 		if (bytes_read < 0 || bytes_read != size)
-			die_errno("couldn't read %s", snapshot->refs->path);
+			die_errno("couldn't read %s", path);
 		snapshot->mmapped = 0;
 	} else {
 		snapshot->buf = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
@@ -582,8 +612,9 @@ static const char *find_reference_location(struct snapshot *snapshot,
 }
 
 /*
- * Create a newly-allocated `snapshot` of the `packed-refs` file in
- * its current state and return it. The return value will already have
+ * Create a newly-allocated `snapshot` of the `packed-refs` file (or,
+ * if `is_delta` is set, of the `packed-refs.delta` file) in its
+ * current state and return it. The return value will already have
  * its reference count incremented.
  *
  * A comment line of the form "# pack-refs with: " may contain zero or
@@ -614,12 +645,14 @@ static const char *find_reference_location(struct snapshot *snapshot,
  *
  *      The references in this file are known to be sorted by refname.
  */
-static struct snapshot *create_snapshot(struct packed_ref_store *refs)
+static struct snapshot *read_snapshot(struct packed_ref_store *refs,
+				      int is_delta)
 {
 	struct snapshot *snapshot = xcalloc(1, sizeof(*snapshot));
 	int sorted = 0;
 
 	snapshot->refs = refs;
+	snapshot->is_delta = is_delta;
 	acquire_snapshot(snapshot);
 	snapshot->peeled = PEELED_NONE;
 
@@ -634,14 +667,14 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 		eol = memchr(snapshot->buf, '\n',
 			     snapshot->eof - snapshot->buf);
 		if (!eol)
-			die_unterminated_line(refs->path,
+			die_unterminated_line(snapshot_path(snapshot),
 					      snapshot->buf,
 					      snapshot->eof - snapshot->buf);
 
 		tmp = xmemdupz(snapshot->buf, eol - snapshot->buf);
 
 		if (!skip_prefix(tmp, "# pack-refs with:", (const char **)&p))
-			die_invalid_line(refs->path,
+			die_invalid_line(snapshot_path(snapshot),
 					 snapshot->buf,
 					 snapshot->eof - snapshot->buf);
 
@@ -693,14 +726,34 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 	return snapshot;
 }
 
+/*
+ * Create a snapshot of `packed-refs` along with its delta.
+ *
+ * The delta is read first. A full rewrite of `packed-refs` replaces
+ * that file before it removes the delta, so whichever delta we see,
+ * the `packed-refs` we read afterwards has at least the records that
+ * the delta was written on top of.
+ */
+static struct snapshot *create_snapshot(struct packed_ref_store *refs)
+{
+	struct snapshot *delta = read_snapshot(refs, 1);
+	struct snapshot *snapshot = read_snapshot(refs, 0);
+
+	snapshot->delta = delta;
+	return snapshot;
+}
+
 /*
  * Check that `refs->snapshot` (if present) still reflects the
- * contents of the `packed-refs` file. If not, clear the snapshot.
+ * contents of the `packed-refs` and `packed-refs.delta` files. If
+ * not, clear the snapshot.
  */
 static void validate_snapshot(struct packed_ref_store *refs)
 {
 	if (refs->snapshot &&
-	    !stat_validity_check(&refs->snapshot->validity, refs->path))
+	    (!stat_validity_check(&refs->snapshot->validity, refs->path) ||
+	     !stat_validity_check(&refs->snapshot->delta->validity,
+				  refs->delta_path)))
 		clear_snapshot(refs);
 }
 
@@ -724,6 +777,32 @@ static struct snapshot *get_snapshot(struct packed_ref_store *refs)
 	return refs->snapshot;
 }
 
+/*
+ * Look up `refname` in `snapshot` and its delta, and store its value
+ * in `oid`. Return 0 if it is a packed reference, or -1 if it is not
+ * (including when the delta has a tombstone for it).
+ */
+static int find_packed_ref(struct snapshot *snapshot, const char *refname,
+			   struct object_id *oid)
+{
+	struct snapshot *found = snapshot->delta;
+	const char *rec = find_reference_location(found, refname, 1);
+
+	if (!rec) {
+		found = snapshot;
+		rec = find_reference_location(found, refname, 1);
+		if (!rec)
+			return -1;
+	}
+
+	if (get_oid_hex(rec, oid))
+		die_invalid_line(snapshot_path(found), rec, found->eof - rec);
+
+	if (found->is_delta && is_null_oid(oid))
+		return -1;
+	return 0;
+}
+
 static int packed_read_raw_ref(struct ref_store *ref_store,
 			       const char *refname, struct object_id *oid,
 			       struct strbuf *referent, unsigned int *type)
@@ -731,25 +810,39 @@ static int packed_read_raw_ref(struct ref_store *ref_store,
 	struct packed_ref_store *refs =
 		packed_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
 	struct snapshot *snapshot = get_snapshot(refs);
-	const char *rec;
 
 	*type = 0;
 
-	rec = find_reference_location(snapshot, refname, 1);
-
-	if (!rec) {
+	if (find_packed_ref(snapshot, refname, oid)) {
 		/* refname is not a packed reference. */
 		errno = ENOENT;
 		return -1;
 	}
 
-	if (get_oid_hex(rec, oid))
-		die_invalid_line(refs->path, rec, snapshot->eof - rec);
-
 	*type = REF_ISPACKED;
 	return 0;
 }
 
+static int packed_fingerprint(struct ref_store *ref_store, time_t since,
+			      struct strbuf *out)
+{
+	struct packed_ref_store *refs =
+		packed_downcast(ref_store, REF_STORE_READ, "fingerprint");
+
+	if (fingerprint_path(out, refs->path, since) ||
+	    fingerprint_path(out, refs->delta_path, since))
+		return -1;
+	return 0;
+}
+
+static void packed_clear_cache(struct ref_store *ref_store)
+{
+	struct packed_ref_store *refs =
+		packed_downcast(ref_store, REF_STORE_READ, "clear_cache");
+
+	clear_snapshot(refs);
+}
+
 /*
  * This value is set in `base.flags` if the peeled value of the
  * current reference is known. In that case, `peeled` contains the
@@ -759,7 +852,8 @@ static int packed_read_raw_ref(struct ref_store *ref_store,
 #define REF_KNOWS_PEELED 0x40
 
 /*
- * An iterator over a snapshot of a `packed-refs` file.
+ * An iterator over a snapshot of a `packed-refs` file, merged with
+ * the snapshot of its delta.
  */
 struct packed_ref_iterator {
 	struct ref_iterator base;
@@ -772,6 +866,9 @@ struct packed_ref_iterator {
 	/* The end of the part of the buffer that will be iterated over: */
 	const char *eof;
 
+	/* The same two positions in the buffer of the delta snapshot: */
+	const char *delta_pos, *delta_eof;
+
 	/* Scratch space for current values: */
 	struct object_id oid, peeled;
 	struct strbuf refname_buf;
@@ -780,33 +877,29 @@ struct packed_ref_iterator {
 };
 
 /*
- * Move the iterator to the next record in the snapshot, without
- * respect for whether the record is actually required by the current
- * iteration. Adjust the fields in `iter` and return `ITER_OK` or
- * `ITER_DONE`. This function does not free the iterator in the case
- * of `ITER_DONE`.
+ * Parse the record at `*posp` in `snapshot` into the fields in `iter`
+ * and move `*posp` past it. Return 1 if the record is a tombstone in
+ * a delta snapshot, or 0 otherwise.
  */
-static int next_record(struct packed_ref_iterator *iter)
+static int read_record(struct packed_ref_iterator *iter,
+		       struct snapshot *snapshot,
+		       const char **posp, const char *eof)
 {
-	const char *p = iter->pos, *eol;
+	const char *pos = *posp, *p = pos, *eol;
+	int tombstone;
 
 	strbuf_reset(&iter->refname_buf);
-
-	if (iter->pos == iter->eof)
-		return ITER_DONE;
-
 	iter->base.flags = REF_ISPACKED;
 
-	if (iter->eof - p < the_hash_algo->hexsz + 2 ||
+	if (eof - p < the_hash_algo->hexsz + 2 ||
 	    parse_oid_hex(p, &iter->oid, &p) ||
 	    !isspace(*p++))
-		die_invalid_line(iter->snapshot->refs->path,
-				 iter->pos, iter->eof - iter->pos);
+		die_invalid_line(snapshot_path(snapshot), pos, eof - pos);
+	tombstone = snapshot->is_delta && is_null_oid(&iter->oid);
 
-	eol = memchr(p, '\n', iter->eof - p);
+	eol = memchr(p, '\n', eof - p);
 	if (!eol)
-		die_unterminated_line(iter->snapshot->refs->path,
-				      iter->pos, iter->eof - iter->pos);
+		die_unterminated_line(snapshot_path(snapshot), pos, eof - pos);
 
 	strbuf_add(&iter->refname_buf, p, eol - p);
 	iter->base.refname = iter->refname_buf.buf;
@@ -818,21 +911,21 @@ static int next_record(struct packed_ref_iterator *iter)
 		oidclr(&iter->oid);
 		iter->base.flags |= REF_BAD_NAME | REF_ISBROKEN;
 	}
-	if (iter->snapshot->peeled == PEELED_FULLY ||
-	    (iter->snapshot->peeled == PEELED_TAGS &&
+	if (snapshot->peeled == PEELED_FULLY ||
+	    (snapshot->peeled == PEELED_TAGS &&
 	     starts_with(iter->base.refname, "refs/tags/")))
 		iter->base.flags |= REF_KNOWS_PEELED;
 
-	iter->pos = eol + 1;
+	pos = eol + 1;
 
-	if (iter->pos < iter->eof && *iter->pos == '^') {
-		p = iter->pos + 1;
-		if (iter->eof - p < the_hash_algo->hexsz + 1 ||
+	if (pos < eof && *pos == '^') {
+		p = pos + 1;
+		if (eof - p < the_hash_algo->hexsz + 1 ||
 		    parse_oid_hex(p, &iter->peeled, &p) ||
 		    *p++ != '\n')
-			die_invalid_line(iter->snapshot->refs->path,
-					 iter->pos, iter->eof - iter->pos);
-		iter->pos = p;
+			die_invalid_line(snapshot_path(snapshot),
+					 pos, eof - pos);
+		pos = p;
 
 		/*
 		 * Regardless of what the file header said, we
@@ -849,7 +942,49 @@ static int next_record(struct packed_ref_iterator *iter)
 		oidclr(&iter->peeled);
 	}
 
-	return ITER_OK;
+	*posp = pos;
+	return tombstone;
+}
+
+/*
+ * Move the iterator to the next record in the snapshot and its
+ * delta, without respect for whether the record is actually required
+ * by the current iteration. A record in the delta hides the record of
+ * the same name in the snapshot, and a tombstone hides both. Adjust
+ * the fields in `iter` and return `ITER_OK` or `ITER_DONE`. This
+ * function does not free the iterator in the case of `ITER_DONE`.
+ */
+static int next_record(struct packed_ref_iterator *iter)
+{
+	for (;;) {
+		int cmp;
+
+		if (iter->delta_pos == iter->delta_eof) {
+			cmp = -1;
+		} else if (iter->pos == iter->eof) {
+			cmp = +1;
+		} else {
+			struct snapshot_record r1 = { iter->pos };
+			struct snapshot_record r2 = { iter->delta_pos };
+
+			cmp = cmp_packed_ref_records(&r1, &r2);
+		}
+
+		if (cmp < 0) {
+			if (iter->pos == iter->eof) {
+				strbuf_reset(&iter->refname_buf);
+				return ITER_DONE;
+			}
+			read_record(iter, iter->snapshot, &iter->pos, iter->eof);
+			return ITER_OK;
+		}
+
+		if (!cmp)
+			iter->pos = find_end_of_record(iter->pos, iter->eof);
+		if (!read_record(iter, iter->snapshot->delta,
+				 &iter->delta_pos, iter->delta_eof))
+			return ITER_OK;
+	}
 }
 
 static int packed_ref_iterator_advance(struct ref_iterator *ref_iterator)
@@ -911,34 +1046,31 @@ static struct ref_iterator_vtable packed_ref_iterator_vtable = {
 	packed_ref_iterator_abort
 };
 
-static struct ref_iterator *packed_ref_iterator_begin(
-		struct ref_store *ref_store,
+/*
+ * Iterate over the records of `snapshot` merged with those of its
+ * delta, if it has one. Iterating over a delta snapshot itself yields
+ * its tombstones, as references whose value is the null object name.
+ */
+static struct ref_iterator *snapshot_ref_iterator_begin(
+		struct snapshot *snapshot,
 		const char *prefix, unsigned int flags)
 {
-	struct packed_ref_store *refs;
-	struct snapshot *snapshot;
-	const char *start;
+	struct snapshot *delta = snapshot->delta;
+	const char *start, *delta_start = NULL;
 	struct packed_ref_iterator *iter;
 	struct ref_iterator *ref_iterator;
-	unsigned int required_flags = REF_STORE_READ;
 
-	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
-		required_flags |= REF_STORE_ODB;
-	refs = packed_downcast(ref_store, required_flags, "ref_iterator_begin");
-
-	/*
-	 * Note that `get_snapshot()` internally checks whether the
-	 * snapshot is up to date with what is on disk, and re-reads
-	 * it if not.
-	 */
-	snapshot = get_snapshot(refs);
-
-	if (prefix && *prefix)
+	if (prefix && *prefix) {
 		start = find_reference_location(snapshot, prefix, 0);
-	else
+		if (delta)
+			delta_start = find_reference_location(delta, prefix, 0);
+	} else {
 		start = snapshot->start;
+		if (delta)
+			delta_start = delta->start;
+	}
 
-	if (start == snapshot->eof)
+	if (start == snapshot->eof && (!delta || delta_start == delta->eof))
 		return empty_ref_iterator_begin();
 
 	CALLOC_ARRAY(iter, 1);
@@ -950,6 +1082,10 @@ static struct ref_iterator *packed_ref_iterator_begin(
 
 	iter->pos = start;
 	iter->eof = snapshot->eof;
+	if (delta) {
+		iter->delta_pos = delta_start;
+		iter->delta_eof = delta->eof;
+	}
 	strbuf_init(&iter->refname_buf, 0);
 
 	iter->base.oid = &iter->oid;
@@ -963,6 +1099,25 @@ static struct ref_iterator *packed_ref_iterator_begin(
 	return ref_iterator;
 }
 
+static struct ref_iterator *packed_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct packed_ref_store *refs;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = packed_downcast(ref_store, required_flags, "ref_iterator_begin");
+
+	/*
+	 * Note that `get_snapshot()` internally checks whether the
+	 * snapshot is up to date with what is on disk, and re-reads
+	 * it if not.
+	 */
+	return snapshot_ref_iterator_begin(get_snapshot(refs), prefix, flags);
+}
+
 /*
  * Write an entry to the packed-refs file for the specified refname.
  * If peeled is non-NULL, write it as the entry's peeled value. On
@@ -1078,6 +1233,50 @@ static int packed_init_db(struct ref_store *ref_store, struct strbuf *err)
 	return 0;
 }
 
+/*
+ * Check the old values that the `updates` expect against the current
+ * snapshot. On a mismatch, write an error message to `err` and return
+ * a nonzero value.
+ */
+static int check_old_values(struct snapshot *snapshot,
+			    struct string_list *updates,
+			    struct strbuf *err)
+{
+	size_t i;
+
+	for (i = 0; i < updates->nr; i++) {
+		struct ref_update *update = updates->items[i].util;
+		struct object_id oid;
+
+		if (!(update->flags & REF_HAVE_OLD))
+			continue;
+
+		if (!find_packed_ref(snapshot, update->refname, &oid)) {
+			if (is_null_oid(&update->old_oid)) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "reference already exists",
+					    update->refname);
+				return -1;
+			} else if (!oideq(&update->old_oid, &oid)) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "is at %s but expected %s",
+					    update->refname,
+					    oid_to_hex(&oid),
+					    oid_to_hex(&update->old_oid));
+				return -1;
+			}
+		} else if (!is_null_oid(&update->old_oid)) {
+			strbuf_addf(err, "cannot update ref '%s': "
+				    "reference is missing but expected %s",
+				    update->refname,
+				    oid_to_hex(&update->old_oid));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Write the packed refs from the current snapshot to the packed-refs
  * tempfile, incorporating any changes from `updates`. `updates` must
@@ -1085,13 +1284,20 @@ static int packed_init_db(struct ref_store *ref_store, struct strbuf *err)
  * values are `struct ref_update *`. On error, rollback the tempfile,
  * write an error message to `err`, and return a nonzero value.
  *
+ * If `delta` is set, write only a new `packed-refs.delta` instead:
+ * the records of the current delta with `updates` applied, using a
+ * tombstone for each deleted reference that `packed-refs` still has.
+ * Otherwise fold the delta in.
+ *
  * The packfile must be locked before calling this function and will
  * remain locked when it is done.
  */
 static int write_with_updates(struct packed_ref_store *refs,
 			      struct string_list *updates,
+			      int delta,
 			      struct strbuf *err)
 {
+	struct snapshot *snapshot = get_snapshot(refs);
 	struct ref_iterator *iter = NULL;
 	size_t i;
 	int ok;
@@ -1102,12 +1308,18 @@ static int write_with_updates(struct packed_ref_store *refs,
 	if (!is_lock_file_locked(&refs->lock))
 		BUG("write_with_updates() called while unlocked");
 
+	if (check_old_values(snapshot, updates, err))
+		return -1;
+
 	/*
 	 * If packed-refs is a symlink, we want to overwrite the
 	 * symlinked-to file, not the symlink itself. Also, put the
 	 * staging file next to it:
 	 */
-	packed_refs_path = get_locked_file_path(&refs->lock);
+	if (delta)
+		packed_refs_path = xstrdup(refs->delta_path);
+	else
+		packed_refs_path = get_locked_file_path(&refs->lock);
 	strbuf_addf(&sb, "%s.new", packed_refs_path);
 	free(packed_refs_path);
 	refs->tempfile = create_tempfile(sb.buf);
@@ -1136,8 +1348,8 @@ static int write_with_updates(struct packed_ref_store *refs,
 	 * list of refs is exhausted, set iter to NULL. When the list
 	 * of updates is exhausted, leave i set to updates->nr.
 	 */
-	iter = packed_ref_iterator_begin(&refs->base, "",
-					 DO_FOR_EACH_INCLUDE_BROKEN);
+	iter = snapshot_ref_iterator_begin(delta ? snapshot->delta : snapshot,
+					   "", DO_FOR_EACH_INCLUDE_BROKEN);
 	if ((ok = ref_iterator_advance(iter)) != ITER_OK)
 		iter = NULL;
 
@@ -1161,26 +1373,9 @@ static int write_with_updates(struct packed_ref_store *refs,
 		if (!cmp) {
 			/*
 			 * There is both an old value and an update
-			 * for this reference. Check the old value if
-			 * necessary:
+			 * for this reference. Figure out what to use
+			 * for the new value:
 			 */
-			if ((update->flags & REF_HAVE_OLD)) {
-				if (is_null_oid(&update->old_oid)) {
-					strbuf_addf(err, "cannot update ref '%s': "
-						    "reference already exists",
-						    update->refname);
-					goto error;
-				} else if (!oideq(&update->old_oid, iter->oid)) {
-					strbuf_addf(err, "cannot update ref '%s': "
-						    "is at %s but expected %s",
-						    update->refname,
-						    oid_to_hex(iter->oid),
-						    oid_to_hex(&update->old_oid));
-					goto error;
-				}
-			}
-
-			/* Now figure out what to use for the new value: */
 			if ((update->flags & REF_HAVE_NEW)) {
 				/*
 				 * The update takes precedence. Skip
@@ -1198,24 +1393,10 @@ static int write_with_updates(struct packed_ref_store *refs,
 				i++;
 				cmp = -1;
 			}
-		} else if (cmp > 0) {
-			/*
-			 * There is no old value but there is an
-			 * update for this reference. Make sure that
-			 * the update didn't expect an existing value:
-			 */
-			if ((update->flags & REF_HAVE_OLD) &&
-			    !is_null_oid(&update->old_oid)) {
-				strbuf_addf(err, "cannot update ref '%s': "
-					    "reference is missing but expected %s",
-					    update->refname,
-					    oid_to_hex(&update->old_oid));
-				goto error;
-			}
 		}
 
 		if (cmp < 0) {
-			/* Pass the old reference through. */
+			/* Pass the old reference (or tombstone) through. */
 
 			struct object_id peeled;
 			int peel_error = ref_iterator_peel(iter, &peeled);
@@ -1231,10 +1412,16 @@ static int write_with_updates(struct packed_ref_store *refs,
 			/*
 			 * The update wants to delete the reference,
 			 * and the reference either didn't exist or we
-			 * have already skipped it. So we're done with
-			 * the update (and don't have to write
-			 * anything).
+			 * have already skipped it. Unless the delta
+			 * has to hide the one in `packed-refs`, we're
+			 * done with the update (and don't have to
+			 * write anything).
 			 */
+			if (delta &&
+			    find_reference_location(snapshot, update->refname, 1) &&
+			    write_packed_entry(out, update->refname,
+					       null_oid(), NULL))
+				goto write_error;
 			i++;
 		} else {
 			struct object_id peeled;
@@ -1256,6 +1443,13 @@ static int write_with_updates(struct packed_ref_store *refs,
 		goto error;
 	}
 
+	if (fsync_ref_files) {
+		if (fflush(out))
+			goto write_error;
+		fsync_or_die(get_tempfile_fd(refs->tempfile),
+			     get_tempfile_path(refs->tempfile));
+	}
+
 	if (close_tempfile_gently(refs->tempfile)) {
 		strbuf_addf(err, "error closing file %s: %s",
 			    get_tempfile_path(refs->tempfile),
@@ -1279,6 +1473,38 @@ static int write_with_updates(struct packed_ref_store *refs,
 	return -1;
 }
 
+/*
+ * Decide whether a transaction with `updates` should only write a new
+ * `packed-refs.delta` rather than rewrite `packed-refs` in full.
+ *
+ * That is only done when `extensions.packedRefsDelta` allows it, and as
+ * long as the delta stays small next to `packed-refs`; once it would
+ * grow past an eighth of its size, the delta is folded back in. A
+ * transaction without updates always rewrites in full, as callers use
+ * it to get `packed-refs` sorted and peeled.
+ */
+static int want_delta(struct packed_ref_store *refs,
+		      struct string_list *updates)
+{
+	struct snapshot *snapshot = get_snapshot(refs);
+	size_t base_size, delta_size;
+	size_t i;
+
+	if (!repository_format_packed_refs_delta ||
+	    !updates->nr || !snapshot->buf)
+		return 0;
+
+	base_size = snapshot->eof - snapshot->start;
+	delta_size = snapshot->delta->buf ?
+		snapshot->delta->eof - snapshot->delta->start : 0;
+	for (i = 0; i < updates->nr; i++)
+		/* an estimate: name, value and peeled value */
+		delta_size += strlen(updates->items[i].string) +
+			2 * the_hash_algo->hexsz + 4;
+
+	return delta_size <= base_size / 8;
+}
+
 int is_packed_transaction_needed(struct ref_store *ref_store,
 				 struct ref_transaction *transaction)
 {
@@ -1313,10 +1539,10 @@ int is_packed_transaction_needed(struct ref_store *ref_store,
 	 *    is identical to the current packed value of the
 	 *    reference.
 	 *
-	 * Neither of these cases will come up in the current code,
-	 * because the only caller of this function passes to it a
-	 * transaction that only includes `delete` updates with no
-	 * `old_id`. Even if that ever changes, false positives only
+	 * The first case will not come up in the current code,
+	 * because the only caller of this function never passes it
+	 * updates with an `old_id`, and the second is rare enough not
+	 * to be worth looking for. In any case, false positives only
 	 * cause an optimization to be missed; they do not affect
 	 * correctness.
 	 */
@@ -1377,6 +1603,9 @@ struct packed_transaction_backend_data {
 	/* True iff the transaction owns the packed-refs lock. */
 	int own_lock;
 
+	/* True iff the tempfile holds a new packed-refs.delta. */
+	int delta;
+
 	struct string_list updates;
 };
 
@@ -1452,7 +1681,8 @@ static int packed_transaction_prepare(struct ref_store *ref_store,
 		data->own_lock = 1;
 	}
 
-	if (write_with_updates(refs, &data->updates, err))
+	data->delta = want_delta(refs, &data->updates);
+	if (write_with_updates(refs, &data->updates, data->delta, err))
 		goto failure;
 
 	transaction->state = REF_TRANSACTION_PREPARED;
@@ -1484,15 +1714,30 @@ static int packed_transaction_finish(struct ref_store *ref_store,
 			ref_store,
 			REF_STORE_READ | REF_STORE_WRITE | REF_STORE_ODB,
 			"ref_transaction_finish");
+	struct packed_transaction_backend_data *data = transaction->backend_data;
 	int ret = TRANSACTION_GENERIC_ERROR;
 	char *packed_refs_path;
 
 	clear_snapshot(refs);
 
-	packed_refs_path = get_locked_file_path(&refs->lock);
+	if (data->delta)
+		packed_refs_path = xstrdup(refs->delta_path);
+	else
+		packed_refs_path = get_locked_file_path(&refs->lock);
 	if (rename_tempfile(&refs->tempfile, packed_refs_path)) {
 		strbuf_addf(err, "error replacing %s: %s",
-			    refs->path, strerror(errno));
+			    packed_refs_path, strerror(errno));
+		goto cleanup;
+	}
+
+	/*
+	 * The new packed-refs has everything the delta had, so it can
+	 * go now. Readers look at the delta first, so they never see
+	 * the old packed-refs without it.
+	 */
+	if (!data->delta && unlink(refs->delta_path) && errno != ENOENT) {
+		strbuf_addf(err, "error removing %s: %s",
+			    refs->delta_path, strerror(errno));
 		goto cleanup;
 	}
 
@@ -1562,12 +1807,32 @@ static int packed_delete_refs(struct ref_store *ref_store, const char *msg,
 
 static int packed_pack_refs(struct ref_store *ref_store, unsigned int flags)
 {
+	struct packed_ref_store *refs =
+		packed_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				"pack_refs");
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
 	/*
 	 * Packed refs are already packed. It might be that loose refs
 	 * are packed *into* a packed refs store, but that is done by
-	 * updating the packed references via a transaction.
+	 * updating the packed references via a transaction. All that
+	 * is left to do here is to fold a delta into `packed-refs`,
+	 * which an empty transaction does.
 	 */
-	return 0;
+	if (!get_snapshot(refs)->delta->buf)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction ||
+	    ref_transaction_commit(transaction, &err))
+		ret = error(_("unable to fold %s: %s"),
+			    refs->delta_path, err.buf);
+
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
 }
 
 static int packed_create_symref(struct ref_store *ref_store,
@@ -1659,6 +1924,8 @@ struct ref_storage_be refs_be_packed = {
 
 	packed_ref_iterator_begin,
 	packed_read_raw_ref,
+	packed_fingerprint,
+	packed_clear_cache,
 
 	packed_reflog_iterator_begin,
 	packed_for_each_reflog_ent,
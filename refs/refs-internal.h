@@ -585,6 +585,11 @@ typedef int for_each_reflog_ent_reverse_fn(struct ref_store *ref_store,
 					   const char *refname,
 					   each_reflog_ent_fn fn,
 					   void *cb_data);
+typedef int for_each_reflog_ent_reverse_at_fn(struct ref_store *ref_store,
+					      const char *refname,
+					      timestamp_t at_time,
+					      each_reflog_ent_fn fn,
+					      void *cb_data);
 typedef int reflog_exists_fn(struct ref_store *ref_store, const char *refname);
 typedef int create_reflog_fn(struct ref_store *ref_store, const char *refname,
 			     int force_create, struct strbuf *err);
@@ -639,6 +644,23 @@ typedef int read_raw_ref_fn(struct ref_store *ref_store,
 			    const char *refname, struct object_id *oid,
 			    struct strbuf *referent, unsigned int *type);
 
+/*
+ * Append to `out` a description of the state of the reference store
+ * that changes whenever any of its references might have changed,
+ * typically the stat data of the files and directories holding them.
+ * Return 0 on success, or -1 if no trustworthy description can be
+ * given, e.g. because some of those files were modified so recently
+ * (at or after `since`) that another modification could go unnoticed.
+ */
+typedef int fingerprint_fn(struct ref_store *ref_store, time_t since,
+			   struct strbuf *out);
+
+/*
+ * Forget whatever the store remembers about its references, so that
+ * later reads see changes made by other processes.
+ */
+typedef void clear_cache_fn(struct ref_store *ref_store);
+
 struct ref_storage_be {
 	struct ref_storage_be *next;
 	const char *name;
@@ -658,6 +680,8 @@ struct ref_storage_be {
 
 	ref_iterator_begin_fn *iterator_begin;
 	read_raw_ref_fn *read_raw_ref;
+	fingerprint_fn *fingerprint;
+	clear_cache_fn *clear_cache;
 
 	reflog_iterator_begin_fn *reflog_iterator_begin;
 	for_each_reflog_ent_fn *for_each_reflog_ent;
@@ -666,10 +690,21 @@ struct ref_storage_be {
 	create_reflog_fn *create_reflog;
 	delete_reflog_fn *delete_reflog;
 	reflog_expire_fn *reflog_expire;
+
+	/* optional; see refs_for_each_reflog_ent_reverse_at() */
+	for_each_reflog_ent_reverse_at_fn *for_each_reflog_ent_reverse_at;
 };
 
+/*
+ * Append the stat data of `path` (or a note that it is missing) to
+ * `out`, for use by implementations of fingerprint_fn. Return -1 if it
+ * cannot be stat'ed or was modified at or after `since`.
+ */
+int fingerprint_path(struct strbuf *out, const char *path, time_t since);
+
 extern struct ref_storage_be refs_be_files;
 extern struct ref_storage_be refs_be_packed;
+extern struct ref_storage_be refs_be_reftable;
 
 /*
  * A representation of the reference store for the main repository or
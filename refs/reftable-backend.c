@@ -0,0 +1,2021 @@
+#include "../cache.h"
+#include "../chdir-notify.h"
+#include "../config.h"
+#include "../dir.h"
+#include "../object.h"
+#include "../refs.h"
+#include "../strmap.h"
+#include "../worktree.h"
+#include "../reftable/reftable.h"
+#include "refs-internal.h"
+
+/*
+ * Flags used in ref_update::flags while a transaction is prepared,
+ * with the same meaning as in the files backend.
+ */
+#define REF_IS_PRUNING (1 << 4)
+#define REF_DELETING (1 << 5)
+#define REF_NEEDS_COMMIT (1 << 6)
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	/*
+	 * The stack in the common directory holds the shared refs and
+	 * the per-worktree refs of the main worktree. A store for a
+	 * linked worktree keeps the per-worktree refs of that worktree
+	 * in its own stack.
+	 */
+	struct reftable_stack *main_stack;
+	struct reftable_stack *worktree_stack;
+
+	/* Stacks of other worktrees, by worktree id, opened on demand. */
+	struct strmap worktree_stacks;
+
+	char *gitcommondir;
+	struct reftable_write_options write_options;
+};
+
+static int reftable_be_config(const char *var, const char *value, void *cb)
+{
+	struct reftable_write_options *opts = cb;
+
+	if (!strcmp(var, "reftable.blocksize")) {
+		unsigned long block_size = git_config_ulong(var, value);
+		if (block_size > 16777215)
+			die(_("reftable block size cannot exceed 16MB"));
+		opts->block_size = block_size;
+	} else if (!strcmp(var, "reftable.autocompaction")) {
+		opts->disable_auto_compact = !git_config_bool(var, value);
+	} else if (!strcmp(var, "reftable.locktimeout")) {
+		opts->lock_timeout_ms = git_config_int(var, value);
+	}
+	return 0;
+}
+
+static struct reftable_stack *open_stack(struct reftable_ref_store *refs,
+					 const char *dir)
+{
+	struct reftable_stack *stack;
+	/* the stack outlives any chdir(), so it gets an absolute path */
+	char *path = absolute_pathdup(dir);
+	int ret;
+
+	ret = reftable_new_stack(&stack, path, &refs->write_options);
+	if (ret)
+		die(_("unable to open reftable stack '%s': %s"), path,
+		    reftable_error_str(ret));
+	free(path);
+	return stack;
+}
+
+static struct ref_store *reftable_be_init(const char *gitdir,
+					  unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	ref_store->gitdir = xstrdup(gitdir);
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+	strmap_init(&refs->worktree_stacks);
+
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+
+	refs->write_options.block_size = REFTABLE_DEFAULT_BLOCK_SIZE;
+	refs->write_options.restart_interval = REFTABLE_DEFAULT_RESTART_INTERVAL;
+	refs->write_options.hash_id = the_hash_algo->format_id;
+	refs->write_options.lock_timeout_ms = 1000;
+	git_config(reftable_be_config, &refs->write_options);
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	refs->main_stack = open_stack(refs, sb.buf);
+
+	if (strcmp(gitdir, refs->gitcommondir)) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/reftable", gitdir);
+		if (!mkdir(sb.buf, 0777))
+			adjust_shared_perm(sb.buf);
+		refs->worktree_stack = open_stack(refs, sb.buf);
+	}
+	strbuf_release(&sb);
+
+	chdir_notify_reparent("reftable-backend $GIT_DIR", &refs->base.gitdir);
+	chdir_notify_reparent("reftable-backend $GIT_COMMONDIR",
+			      &refs->gitcommondir);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store, or if it lacks one of the required_flags.
+ */
+static struct reftable_ref_store *reftable_be_downcast(struct ref_store *ref_store,
+						       unsigned int required_flags,
+						       const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+static struct reftable_stack *other_worktree_stack(struct reftable_ref_store *refs,
+						   const char *id, int id_len)
+{
+	struct reftable_stack *stack;
+	char *name = xmemdupz(id, id_len);
+	char *dir;
+
+	stack = strmap_get(&refs->worktree_stacks, name);
+	if (stack) {
+		free(name);
+		return stack;
+	}
+
+	dir = xstrfmt("%s/worktrees/%s/reftable", refs->gitcommondir, name);
+	if (!mkdir(dir, 0777))
+		adjust_shared_perm(dir);
+	stack = open_stack(refs, dir);
+	strmap_put(&refs->worktree_stacks, name, stack);
+	free(dir);
+	free(name);
+	return stack;
+}
+
+/*
+ * Return the stack that `refname` lives in, and set `*name` to the
+ * name of the ref within that stack: "main-worktree/HEAD" is "HEAD" in
+ * the main stack.
+ */
+static struct reftable_stack *stack_for(struct reftable_ref_store *refs,
+					const char *refname, const char **name)
+{
+	const char *id;
+	int id_len;
+
+	*name = refname;
+	switch (ref_type(refname)) {
+	case REF_TYPE_PER_WORKTREE:
+	case REF_TYPE_PSEUDOREF:
+		if (refs->worktree_stack)
+			return refs->worktree_stack;
+		return refs->main_stack;
+	case REF_TYPE_MAIN_PSEUDOREF:
+	case REF_TYPE_OTHER_PSEUDOREF:
+		if (parse_worktree_ref(refname, &id, &id_len, name))
+			BUG("refname %s is not a other-worktree ref", refname);
+		if (!id)
+			return refs->main_stack;
+		return other_worktree_stack(refs, id, id_len);
+	case REF_TYPE_NORMAL:
+		return refs->main_stack;
+	default:
+		BUG("unknown ref type %d of ref %s",
+		    ref_type(refname), refname);
+	}
+}
+
+static int should_write_log(struct ref_store *refs, const char *refname,
+			    unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	if ((flags & REF_FORCE_CREATE_REFLOG) ||
+	    should_autocreate_reflog(refname))
+		return 1;
+	return refs_reflog_exists(refs, refname);
+}
+
+/* Fill in the committer of a new log record from git_committer_info(). */
+static void fill_log_committer(struct reftable_log_record *log)
+{
+	const char *info = git_committer_info(0);
+	struct ident_split ident;
+	int tz, sign = 1;
+
+	if (split_ident_line(&ident, info, strlen(info)) ||
+	    !ident.date_begin || !ident.tz_begin)
+		BUG("unable to parse committer info '%s'", info);
+
+	log->name = xmemdupz(ident.name_begin,
+			     ident.name_end - ident.name_begin);
+	log->email = xmemdupz(ident.mail_begin,
+			      ident.mail_end - ident.mail_begin);
+	log->time = parse_timestamp(ident.date_begin, NULL, 10);
+
+	/* the table stores the offset in minutes rather than as HHMM */
+	tz = strtol(ident.tz_begin, NULL, 10);
+	if (tz < 0) {
+		sign = -1;
+		tz = -tz;
+	}
+	log->tz_offset = sign * (tz / 100 * 60 + tz % 100);
+}
+
+static void dup_log_record(struct reftable_log_record *dst,
+			   const struct reftable_log_record *src,
+			   const char *refname)
+{
+	*dst = *src;
+	dst->refname = xstrdup(refname);
+	dst->name = xstrdup_or_null(src->name);
+	dst->email = xstrdup_or_null(src->email);
+	dst->message = xstrdup_or_null(src->message);
+}
+
+static void add_log_tombstone(struct reftable_log_record **logs,
+			      size_t *nr, size_t *alloc,
+			      const char *refname, uint64_t update_index)
+{
+	struct reftable_log_record *log;
+
+	ALLOC_GROW(*logs, *nr + 1, *alloc);
+	log = &(*logs)[(*nr)++];
+	memset(log, 0, sizeof(*log));
+	log->refname = xstrdup(refname);
+	log->update_index = update_index;
+	log->value_type = REFTABLE_LOG_DELETION;
+}
+
+static int ref_record_cmp(const void *a_, const void *b_)
+{
+	const struct reftable_ref_record *a = a_, *b = b_;
+	return strcmp(a->refname, b->refname);
+}
+
+/* Log records go by refname, and then newest first. */
+static int log_record_cmp(const void *a_, const void *b_)
+{
+	const struct reftable_log_record *a = a_, *b = b_;
+	int cmp = strcmp(a->refname, b->refname);
+
+	if (cmp)
+		return cmp;
+	return a->update_index < b->update_index ? 1 :
+	       a->update_index > b->update_index ? -1 : 0;
+}
+
+/*
+ * The records of a new table, collected up front so that they can be
+ * sorted and so that the table limits are known before writing.
+ */
+struct table_records {
+	struct reftable_ref_record *refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_log_record *logs;
+	size_t logs_nr, logs_alloc;
+	uint64_t min_update_index, max_update_index;
+};
+
+static void table_records_release(struct table_records *recs)
+{
+	size_t i;
+
+	for (i = 0; i < recs->refs_nr; i++)
+		reftable_ref_record_release(&recs->refs[i]);
+	for (i = 0; i < recs->logs_nr; i++)
+		reftable_log_record_release(&recs->logs[i]);
+	free(recs->refs);
+	free(recs->logs);
+	memset(recs, 0, sizeof(*recs));
+}
+
+static struct reftable_ref_record *add_ref_record(struct table_records *recs,
+						  const char *refname,
+						  uint64_t update_index)
+{
+	struct reftable_ref_record *ref;
+
+	ALLOC_GROW(recs->refs, recs->refs_nr + 1, recs->refs_alloc);
+	ref = &recs->refs[recs->refs_nr++];
+	memset(ref, 0, sizeof(*ref));
+	ref->refname = xstrdup(refname);
+	ref->update_index = update_index;
+	return ref;
+}
+
+static struct reftable_log_record *add_log_record(struct table_records *recs,
+						  const char *refname,
+						  uint64_t update_index)
+{
+	struct reftable_log_record *log;
+
+	ALLOC_GROW(recs->logs, recs->logs_nr + 1, recs->logs_alloc);
+	log = &recs->logs[recs->logs_nr++];
+	memset(log, 0, sizeof(*log));
+	log->refname = xstrdup(refname);
+	log->update_index = update_index;
+	log->value_type = REFTABLE_LOG_UPDATE;
+	return log;
+}
+
+/* Set the value of a new ref record, peeling tags along the way. */
+static void set_ref_value(struct reftable_ref_record *ref,
+			  const struct object_id *oid)
+{
+	struct object_id peeled;
+
+	memcpy(ref->value, oid->hash, the_hash_algo->rawsz);
+	if (peel_object(oid, &peeled) == PEEL_PEELED) {
+		ref->value_type = REFTABLE_REF_VAL2;
+		memcpy(ref->peeled, peeled.hash, the_hash_algo->rawsz);
+	} else {
+		ref->value_type = REFTABLE_REF_VAL1;
+	}
+}
+
+/* Add tombstones for all log entries of `refname` in `stack`. */
+static int add_log_tombstones(struct table_records *recs,
+			      struct reftable_stack *stack,
+			      const char *refname)
+{
+	struct reftable_merged_table *mt = reftable_stack_merged_table(stack);
+	struct reftable_iterator it = REFTABLE_ITERATOR_INIT;
+	struct reftable_log_record log = { 0 };
+	int ret;
+
+	ret = reftable_merged_table_seek_log(mt, &it, refname);
+	while (!ret && !(ret = reftable_iterator_next_log(&it, &log))) {
+		if (strcmp(log.refname, refname))
+			break;
+		add_log_tombstone(&recs->logs, &recs->logs_nr,
+				  &recs->logs_alloc, refname, log.update_index);
+		if (log.update_index < recs->min_update_index)
+			recs->min_update_index = log.update_index;
+	}
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	return ret < 0 ? ret : 0;
+}
+
+static int write_table_records(struct reftable_writer *writer, void *cb_data)
+{
+	struct table_records *recs = cb_data;
+	size_t i;
+	int ret = 0;
+
+	QSORT(recs->refs, recs->refs_nr, ref_record_cmp);
+	QSORT(recs->logs, recs->logs_nr, log_record_cmp);
+
+	reftable_writer_set_limits(writer, recs->min_update_index,
+				   recs->max_update_index);
+	for (i = 0; !ret && i < recs->refs_nr; i++)
+		ret = reftable_writer_add_ref(writer, &recs->refs[i]);
+	for (i = 0; !ret && i < recs->logs_nr; i++)
+		ret = reftable_writer_add_log(writer, &recs->logs[i]);
+	return ret;
+}
+
+/* Write `recs` as a new table of `stack` and free them. */
+static int add_table_records(struct reftable_stack *stack,
+			     struct table_records *recs)
+{
+	int ret = 0;
+
+	if (recs->refs_nr || recs->logs_nr)
+		ret = reftable_stack_add(stack, write_table_records, recs);
+	table_records_release(recs);
+	return ret;
+}
+
+static int reftable_be_read_raw_ref(struct ref_store *ref_store,
+				    const char *refname, struct object_id *oid,
+				    struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct reftable_ref_record ref = { 0 };
+	int ret;
+
+	ret = reftable_stack_reload(stack);
+	if (!ret)
+		ret = reftable_stack_read_ref(stack, refname, &ref);
+	if (ret) {
+		if (ret > 0)
+			errno = ENOENT;
+		else if (ret != REFTABLE_IO_ERROR)
+			errno = EINVAL;
+		return -1;
+	}
+
+	if (ref.value_type == REFTABLE_REF_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addstr(referent, ref.target);
+		*type |= REF_ISSYMREF;
+	} else {
+		oidread(oid, ref.value);
+	}
+	reftable_ref_record_release(&ref);
+	return 0;
+}
+
+static int reftable_be_fingerprint(struct ref_store *ref_store, time_t since,
+				   struct strbuf *out)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "fingerprint");
+	struct strbuf sb = STRBUF_INIT;
+	int ret;
+
+	/* Every update replaces "tables.list" of the stack it touches. */
+	strbuf_addf(&sb, "%s/reftable/tables.list", refs->gitcommondir);
+	ret = fingerprint_path(out, sb.buf, since);
+	if (!ret && refs->worktree_stack) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/reftable/tables.list", refs->base.gitdir);
+		ret = fingerprint_path(out, sb.buf, since);
+	}
+	strbuf_release(&sb);
+	return ret;
+}
+
+static void reftable_be_clear_cache(struct ref_store *ref_store)
+{
+	/* the stacks are reloaded every time they are read */
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+	struct reftable_ref_store *refs;
+	struct reftable_iterator iter;
+	struct reftable_ref_record ref;
+	struct object_id oid;
+	char *prefix;
+	unsigned int flags;
+	/* the per-worktree refs in this stack belong to another worktree */
+	int skip_per_worktree;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ret;
+
+	while (!(ret = reftable_iterator_next_ref(&iter->iter, &iter->ref))) {
+		const char *refname = iter->ref.refname;
+		int flags = 0;
+
+		if (!starts_with(refname, iter->prefix)) {
+			ret = 1;
+			break;
+		}
+		if (iter->skip_per_worktree &&
+		    ref_type(refname) == REF_TYPE_PER_WORKTREE)
+			continue;
+		if (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY &&
+		    ref_type(refname) != REF_TYPE_PER_WORKTREE)
+			continue;
+
+		if (iter->ref.value_type == REFTABLE_REF_SYMREF) {
+			if (!refs_resolve_ref_unsafe(&iter->refs->base, refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, &flags)) {
+				oidclr(&iter->oid);
+				flags |= REF_ISBROKEN;
+			}
+		} else {
+			oidread(&iter->oid, iter->ref.value);
+		}
+
+		if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(refname))
+				die(_("refname is dangerous: %s"), refname);
+			oidclr(&iter->oid);
+			flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid, flags))
+			continue;
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ret < 0)
+		error(_("unable to read references: %s"),
+		      reftable_error_str(ret));
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE || ret < 0)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->ref.value_type == REFTABLE_REF_VAL2) {
+		oidread(peeled, iter->ref.peeled);
+		return 0;
+	}
+	return !!peel_object(&iter->oid, peeled);
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_iterator_destroy(&iter->iter);
+	reftable_ref_record_release(&iter->ref);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *ref_iterator_for_stack(struct reftable_ref_store *refs,
+						   struct reftable_stack *stack,
+						   const char *prefix,
+						   unsigned int flags,
+						   int skip_per_worktree)
+{
+	struct reftable_ref_iterator *iter;
+	int ret;
+
+	/*
+	 * Only refs below "refs/" are iterated over; the pseudorefs
+	 * and HEAD that live in the same tables are not.
+	 */
+	if (!prefix || starts_with("refs/", prefix))
+		prefix = "refs/";
+	else if (!starts_with(prefix, "refs/"))
+		return empty_ref_iterator_begin();
+
+	ret = reftable_stack_reload(stack);
+	if (ret) {
+		error(_("unable to read references: %s"),
+		      reftable_error_str(ret));
+		return empty_ref_iterator_begin();
+	}
+
+	CALLOC_ARRAY(iter, 1);
+	base_ref_iterator_init(&iter->base, &reftable_ref_iterator_vtable, 1);
+	iter->refs = refs;
+	iter->prefix = xstrdup(prefix);
+	iter->flags = flags;
+	iter->skip_per_worktree = skip_per_worktree;
+
+	ret = reftable_merged_table_seek_ref(reftable_stack_merged_table(stack),
+					     &iter->iter, prefix);
+	if (ret) {
+		error(_("unable to read references: %s"),
+		      reftable_error_str(ret));
+		reftable_ref_iterator_abort(&iter->base);
+		return empty_ref_iterator_begin();
+	}
+	return &iter->base;
+}
+
+static struct ref_iterator *reftable_be_iterator_begin(struct ref_store *ref_store,
+						       const char *prefix,
+						       unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	struct ref_iterator *main_iter, *worktree_iter;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = reftable_be_downcast(ref_store, required_flags,
+				    "ref_iterator_begin");
+
+	main_iter = ref_iterator_for_stack(refs, refs->main_stack, prefix,
+					   flags, !!refs->worktree_stack);
+	if (!refs->worktree_stack)
+		return main_iter;
+
+	worktree_iter = ref_iterator_for_stack(refs, refs->worktree_stack,
+					       prefix, flags, 0);
+	return overlay_ref_iterator_begin(worktree_iter, main_iter);
+}
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+	struct reftable_ref_store *refs;
+	struct reftable_merged_table *mt;
+	struct reftable_iterator iter;
+	struct reftable_log_record log;
+	struct object_id oid;
+	struct strbuf next;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+	int ret = 0;
+
+	for (;;) {
+		int flags;
+
+		/*
+		 * We only want each refname once, so skip all other
+		 * entries of the previous one by seeking past them.
+		 */
+		if (iter->log.refname) {
+			strbuf_reset(&iter->next);
+			strbuf_addf(&iter->next, "%s\001", iter->log.refname);
+			reftable_iterator_destroy(&iter->iter);
+			ret = reftable_merged_table_seek_log(iter->mt, &iter->iter,
+							     iter->next.buf);
+		}
+		if (!ret)
+			ret = reftable_iterator_next_log(&iter->iter, &iter->log);
+		if (ret)
+			break;
+
+		if (refs_read_ref_full(&iter->refs->base, iter->log.refname,
+				       0, &iter->oid, &flags)) {
+			error("bad ref for %s", iter->log.refname);
+			continue;
+		}
+
+		iter->base.refname = iter->log.refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ret < 0)
+		error(_("unable to read reflogs: %s"), reftable_error_str(ret));
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE || ret < 0)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	reftable_iterator_destroy(&iter->iter);
+	reftable_log_record_release(&iter->log);
+	reftable_merged_table_decref(iter->mt);
+	strbuf_release(&iter->next);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+static struct ref_iterator *reflog_iterator_for_stack(struct reftable_ref_store *refs,
+						      struct reftable_stack *stack)
+{
+	struct reftable_reflog_iterator *iter;
+	int ret;
+
+	ret = reftable_stack_reload(stack);
+	if (ret) {
+		error(_("unable to read reflogs: %s"), reftable_error_str(ret));
+		return empty_ref_iterator_begin();
+	}
+
+	CALLOC_ARRAY(iter, 1);
+	base_ref_iterator_init(&iter->base, &reftable_reflog_iterator_vtable, 1);
+	iter->refs = refs;
+	strbuf_init(&iter->next, 0);
+	/* keep our view of the tables alive across reloads */
+	iter->mt = reftable_stack_merged_table(stack);
+	reftable_merged_table_incref(iter->mt);
+
+	ret = reftable_merged_table_seek_log(iter->mt, &iter->iter, "");
+	if (ret) {
+		error(_("unable to read reflogs: %s"), reftable_error_str(ret));
+		reftable_reflog_iterator_abort(&iter->base);
+		return empty_ref_iterator_begin();
+	}
+	return &iter->base;
+}
+
+static enum iterator_selection reflog_iterator_select(
+	struct ref_iterator *iter_worktree,
+	struct ref_iterator *iter_common,
+	void *cb_data)
+{
+	if (iter_worktree) {
+		return ITER_SELECT_0;
+	} else if (iter_common) {
+		if (ref_type(iter_common->refname) == REF_TYPE_NORMAL)
+			return ITER_SELECT_1;
+
+		/*
+		 * The main stack contains the main worktree's
+		 * per-worktree refs, which should be ignored.
+		 */
+		return ITER_SKIP_1;
+	} else
+		return ITER_DONE;
+}
+
+static struct ref_iterator *reftable_be_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ,
+				     "reflog_iterator_begin");
+
+	if (!refs->worktree_stack)
+		return reflog_iterator_for_stack(refs, refs->main_stack);
+
+	return merge_ref_iterator_begin(
+		0, reflog_iterator_for_stack(refs, refs->worktree_stack),
+		reflog_iterator_for_stack(refs, refs->main_stack),
+		reflog_iterator_select, refs);
+}
+
+/* A log record marking an existing, but empty, reflog. */
+static int is_log_marker(const struct reftable_log_record *log)
+{
+	return hasheq(log->old_hash, null_oid()->hash) &&
+	       hasheq(log->new_hash, null_oid()->hash);
+}
+
+static int yield_log_record(const struct reftable_log_record *log,
+			    each_reflog_ent_fn fn, void *cb_data)
+{
+	struct object_id old_oid, new_oid;
+	struct strbuf ident = STRBUF_INIT, message = STRBUF_INIT;
+	int tz = log->tz_offset, sign = 1;
+	int ret;
+
+	oidread(&old_oid, log->old_hash);
+	oidread(&new_oid, log->new_hash);
+	strbuf_addf(&ident, "%s <%s>", log->name ? log->name : "",
+		    log->email ? log->email : "");
+	strbuf_addf(&message, "%s\n", log->message ? log->message : "");
+	if (tz < 0) {
+		sign = -1;
+		tz = -tz;
+	}
+	tz = sign * (tz / 60 * 100 + tz % 60);
+
+	ret = fn(&old_oid, &new_oid, ident.buf, log->time, tz,
+		 message.buf, cb_data);
+	strbuf_release(&ident);
+	strbuf_release(&message);
+	return ret;
+}
+
+/*
+ * Read the log records of `refname`, newest first. Returns 1 if the
+ * ref has no reflog.
+ */
+static int read_log_records(struct reftable_stack *stack, const char *refname,
+			    struct reftable_log_record **out, size_t *nr)
+{
+	struct reftable_merged_table *mt;
+	struct reftable_iterator it = REFTABLE_ITERATOR_INIT;
+	struct reftable_log_record log = { 0 };
+	size_t alloc = 0;
+	int ret;
+
+	*out = NULL;
+	*nr = 0;
+	ret = reftable_stack_reload(stack);
+	if (ret)
+		return ret;
+	mt = reftable_stack_merged_table(stack);
+	ret = reftable_merged_table_seek_log(mt, &it, refname);
+	while (!ret && !(ret = reftable_iterator_next_log(&it, &log))) {
+		if (strcmp(log.refname, refname))
+			break;
+		ALLOC_GROW(*out, *nr + 1, alloc);
+		(*out)[(*nr)++] = log;
+		memset(&log, 0, sizeof(log));
+	}
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	if (ret < 0)
+		return ret;
+	return *nr ? 0 : 1;
+}
+
+static void free_log_records(struct reftable_log_record *logs, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		reftable_log_record_release(&logs[i]);
+	free(logs);
+}
+
+static int iterate_reflog(struct ref_store *ref_store, const char *refname,
+			  each_reflog_ent_fn fn, void *cb_data, int reverse)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ,
+				     "for_each_reflog_ent");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct reftable_log_record *logs;
+	size_t i, nr;
+	int ret;
+
+	ret = read_log_records(stack, refname, &logs, &nr);
+	if (ret) {
+		if (ret < 0)
+			error(_("unable to read reflog for '%s': %s"),
+			      refname, reftable_error_str(ret));
+		return -1;
+	}
+
+	for (i = 0; !ret && i < nr; i++) {
+		const struct reftable_log_record *log =
+			&logs[reverse ? i : nr - 1 - i];
+
+		if (!is_log_marker(log))
+			ret = yield_log_record(log, fn, cb_data);
+	}
+	free_log_records(logs, nr);
+	return ret;
+}
+
+static int reftable_be_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						   const char *refname,
+						   each_reflog_ent_fn fn,
+						   void *cb_data)
+{
+	return iterate_reflog(ref_store, refname, fn, cb_data, 1);
+}
+
+static int reftable_be_for_each_reflog_ent(struct ref_store *ref_store,
+					   const char *refname,
+					   each_reflog_ent_fn fn,
+					   void *cb_data)
+{
+	return iterate_reflog(ref_store, refname, fn, cb_data, 0);
+}
+
+static int reftable_be_reflog_exists(struct ref_store *ref_store,
+				     const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct reftable_iterator it = REFTABLE_ITERATOR_INIT;
+	struct reftable_log_record log = { 0 };
+	int ret;
+
+	ret = reftable_stack_reload(stack);
+	if (!ret)
+		ret = reftable_merged_table_seek_log(reftable_stack_merged_table(stack),
+						     &it, refname);
+	if (!ret)
+		ret = reftable_iterator_next_log(&it, &log);
+	if (!ret)
+		ret = !!strcmp(log.refname, refname);
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	return !ret;
+}
+
+static int reftable_be_create_reflog(struct ref_store *ref_store,
+				     const char *refname, int force_create,
+				     struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	const char *name;
+	struct reftable_stack *stack = stack_for(refs, refname, &name);
+	struct table_records recs = { 0 };
+	struct reftable_log_record *log;
+	uint64_t ts;
+	int ret;
+
+	if (!force_create && !should_autocreate_reflog(refname))
+		return 0;
+	if (refs_reflog_exists(ref_store, refname))
+		return 0;
+
+	ret = reftable_stack_reload(stack);
+	if (!ret) {
+		ts = reftable_stack_next_update_index(stack);
+		recs.min_update_index = recs.max_update_index = ts;
+		log = add_log_record(&recs, name, ts);
+		fill_log_committer(log);
+		log->message = xstrdup("");
+		ret = add_table_records(stack, &recs);
+	}
+	if (ret) {
+		strbuf_addf(err, _("unable to create reflog for '%s': %s"),
+			    refname, reftable_error_str(ret));
+		return -1;
+	}
+	return 0;
+}
+
+static int reftable_be_delete_reflog(struct ref_store *ref_store,
+				     const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct reftable_stack *stack = stack_for(refs, refname, &refname);
+	struct table_records recs = { 0 };
+	int ret;
+
+	ret = reftable_stack_reload(stack);
+	if (!ret) {
+		recs.min_update_index = recs.max_update_index =
+			reftable_stack_next_update_index(stack);
+		ret = add_log_tombstones(&recs, stack, refname);
+	}
+	if (!ret)
+		ret = add_table_records(stack, &recs);
+	else
+		table_records_release(&recs);
+	if (ret)
+		return error(_("unable to delete reflog for '%s': %s"),
+			     refname, reftable_error_str(ret));
+	return 0;
+}
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_IS_PRUNING) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Split it into a REF_LOG_ONLY update of the symref
+ * and a new, separate update for the referent.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+/*
+ * Check whether the REF_HAVE_OLD and old_oid values stored in update
+ * are consistent with oid, which is the reference's current value. If
+ * everything is OK, return 0; otherwise, write an error message to
+ * err and return -1.
+ */
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+/* The addition of a transaction to one of the stacks. */
+struct transaction_stack {
+	struct reftable_stack *stack;
+	struct reftable_addition *addition;
+};
+
+struct reftable_transaction_data {
+	struct transaction_stack *stacks;
+	size_t stacks_nr, stacks_alloc;
+};
+
+/*
+ * The per-update state of a prepared transaction: the value the ref
+ * had under the lock, for the reflog.
+ */
+struct reftable_update {
+	struct object_id old_oid;
+};
+
+static int transaction_stack_for(struct reftable_transaction_data *data,
+				 struct reftable_stack *stack,
+				 struct strbuf *err)
+{
+	struct transaction_stack *ts;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < data->stacks_nr; i++)
+		if (data->stacks[i].stack == stack)
+			return 0;
+
+	ALLOC_GROW(data->stacks, data->stacks_nr + 1, data->stacks_alloc);
+	ts = &data->stacks[data->stacks_nr];
+	ts->stack = stack;
+	ret = reftable_stack_new_addition(&ts->addition, stack);
+	if (ret) {
+		if (ret == REFTABLE_LOCK_ERROR)
+			strbuf_addstr(err, _("cannot lock references"));
+		else
+			strbuf_addf(err, _("unable to lock references: %s"),
+				    reftable_error_str(ret));
+		return -1;
+	}
+	data->stacks_nr++;
+	return 0;
+}
+
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++)
+		FREE_AND_NULL(transaction->updates[i]->backend_data);
+
+	if (data) {
+		for (i = 0; i < data->stacks_nr; i++)
+			reftable_addition_destroy(data->stacks[i].addition);
+		free(data->stacks);
+		free(data);
+		transaction->backend_data = NULL;
+	}
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+/*
+ * Prepare for carrying out update: read the reference under the lock
+ * of its stack, check its old value, split symref and HEAD updates
+ * like the files backend does and check that new values are valid.
+ */
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  struct strbuf *err)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	int mustexist = (update->flags & REF_HAVE_OLD) &&
+		!is_null_oid(&update->old_oid);
+	struct reftable_ref_record ref = { 0 };
+	struct reftable_update *u;
+	struct reftable_stack *stack;
+	const char *name;
+	int ret;
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			return ret;
+	}
+
+	stack = stack_for(refs, update->refname, &name);
+	if (transaction_stack_for(data, stack, err))
+		return TRANSACTION_GENERIC_ERROR;
+
+	CALLOC_ARRAY(u, 1);
+	update->backend_data = u;
+
+	ret = reftable_stack_read_ref(stack, name, &ref);
+	if (ret < 0) {
+		strbuf_addf(err, "cannot lock ref '%s': %s",
+			    original_update_refname(update),
+			    reftable_error_str(ret));
+		return TRANSACTION_GENERIC_ERROR;
+	}
+	if (ret) {
+		if (mustexist) {
+			strbuf_addf(err, "cannot lock ref '%s': "
+				    "unable to resolve reference '%s'",
+				    original_update_refname(update),
+				    update->refname);
+			return TRANSACTION_GENERIC_ERROR;
+		}
+		if (!(update->flags & REF_DELETING)) {
+			struct strbuf conflict = STRBUF_INIT;
+
+			if (refs_verify_refname_available(&refs->base,
+							  update->refname,
+							  affected_refnames,
+							  NULL, &conflict)) {
+				strbuf_addf(err, "cannot lock ref '%s': %s",
+					    original_update_refname(update),
+					    conflict.buf);
+				strbuf_release(&conflict);
+				return TRANSACTION_NAME_CONFLICT;
+			}
+		}
+	}
+
+	if (!ret && ref.value_type == REFTABLE_REF_SYMREF) {
+		char *referent = xstrdup(ref.target);
+
+		update->type |= REF_ISSYMREF;
+		reftable_ref_record_release(&ref);
+		if (update->flags & REF_NO_DEREF) {
+			/*
+			 * We won't be reading the referent as part of
+			 * the transaction, so we have to read it here
+			 * to record and possibly check old_oid:
+			 */
+			if (refs_read_ref_full(&refs->base, referent, 0,
+					       &u->old_oid, NULL)) {
+				if (update->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(update));
+					ret = TRANSACTION_GENERIC_ERROR;
+				} else {
+					ret = 0;
+				}
+			} else if (check_old_oid(update, &u->old_oid, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+			} else {
+				ret = 0;
+			}
+		} else {
+			ret = split_symref_update(update, referent, transaction,
+						  affected_refnames, err);
+		}
+		free(referent);
+		if (ret)
+			return ret;
+	} else {
+		struct ref_update *parent_update;
+
+		if (!ret)
+			oidread(&u->old_oid, ref.value);
+		reftable_ref_record_release(&ref);
+		if (check_old_oid(update, &u->old_oid, err))
+			return TRANSACTION_GENERIC_ERROR;
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update) {
+			struct reftable_update *parent = parent_update->backend_data;
+			oidcpy(&parent->old_oid, &u->old_oid);
+		}
+	}
+
+	if ((update->flags & REF_HAVE_NEW) &&
+	    !(update->flags & REF_DELETING) &&
+	    !(update->flags & REF_LOG_ONLY)) {
+		struct object *o;
+
+		if (!(update->type & REF_ISSYMREF) &&
+		    oideq(&u->old_oid, &update->new_oid)) {
+			/*
+			 * The reference already has the desired
+			 * value, so we don't need to write it.
+			 */
+			return 0;
+		}
+
+		o = parse_object(the_repository, &update->new_oid);
+		if (!o) {
+			strbuf_addf(err, "cannot update ref '%s': "
+				    "trying to write ref '%s' with nonexistent object %s",
+				    update->refname, update->refname,
+				    oid_to_hex(&update->new_oid));
+			return TRANSACTION_GENERIC_ERROR;
+		}
+		if (o->type != OBJ_COMMIT && is_branch(update->refname)) {
+			strbuf_addf(err, "cannot update ref '%s': "
+				    "trying to write non-commit object %s to branch '%s'",
+				    update->refname, oid_to_hex(&update->new_oid),
+				    update->refname);
+			return TRANSACTION_GENERIC_ERROR;
+		}
+		update->flags |= REF_NEEDS_COMMIT;
+	}
+	return 0;
+}
+
+static int reftable_be_transaction_prepare(struct ref_store *ref_store,
+					   struct ref_transaction *transaction,
+					   struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE,
+				     "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	transaction->backend_data =
+		xcalloc(1, sizeof(struct reftable_transaction_data));
+
+	/*
+	 * Fail if a refname appears more than once in the
+	 * transaction, or if any of the updates use REF_IS_PRUNING
+	 * without REF_NO_DEREF.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, update->refname);
+
+		if ((update->flags & REF_IS_PRUNING) &&
+		    !(update->flags & REF_NO_DEREF))
+			BUG("REF_IS_PRUNING set without REF_NO_DEREF");
+		item->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * As in the files backend, a direct update of the branch that
+	 * HEAD points to is logged in the reflog of HEAD, too.
+	 */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/*
+	 * Lock the stacks of all refs, verify old values and check
+	 * new ones. Note that prepare_update() might append more
+	 * updates to the transaction.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_update(refs, transaction->updates[i],
+				     transaction, head_ref,
+				     &affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+/* Collect the records that the updates to `stack` write. */
+static int transaction_records(struct reftable_ref_store *refs,
+			       struct ref_transaction *transaction,
+			       struct reftable_stack *stack,
+			       struct table_records *recs)
+{
+	uint64_t ts = reftable_stack_next_update_index(stack);
+	size_t i;
+	int ret = 0;
+
+	recs->min_update_index = recs->max_update_index = ts;
+	for (i = 0; !ret && i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update *u = update->backend_data;
+		const char *name;
+
+		if (stack_for(refs, update->refname, &name) != stack)
+			continue;
+
+		if ((update->flags & (REF_NEEDS_COMMIT | REF_LOG_ONLY)) &&
+		    should_write_log(&refs->base, update->refname,
+				     update->flags)) {
+			struct reftable_log_record *log =
+				add_log_record(recs, name, ts);
+
+			memcpy(log->old_hash, u->old_oid.hash,
+			       the_hash_algo->rawsz);
+			memcpy(log->new_hash, update->new_oid.hash,
+			       the_hash_algo->rawsz);
+			fill_log_committer(log);
+			log->message = xstrdup(update->msg ? update->msg : "");
+		}
+
+		if (update->flags & REF_LOG_ONLY)
+			continue;
+
+		if (update->flags & REF_DELETING) {
+			add_ref_record(recs, name, ts);
+			if (!(update->flags & REF_IS_PRUNING))
+				ret = add_log_tombstones(recs, stack, name);
+		} else if (update->flags & REF_NEEDS_COMMIT) {
+			set_ref_value(add_ref_record(recs, name, ts),
+				      &update->new_oid);
+		}
+	}
+	return ret;
+}
+
+static int reftable_be_transaction_finish(struct ref_store *ref_store,
+					  struct ref_transaction *transaction,
+					  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, 0, "ref_transaction_finish");
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!data)
+		goto cleanup;
+
+	for (i = 0; !ret && i < data->stacks_nr; i++) {
+		struct transaction_stack *ts = &data->stacks[i];
+		struct table_records recs = { 0 };
+
+		ret = transaction_records(refs, transaction, ts->stack, &recs);
+		if (!ret && (recs.refs_nr || recs.logs_nr))
+			ret = reftable_addition_add(ts->addition,
+						    write_table_records, &recs);
+		table_records_release(&recs);
+	}
+	for (i = 0; !ret && i < data->stacks_nr; i++)
+		ret = reftable_addition_commit(data->stacks[i].addition);
+
+	if (ret) {
+		strbuf_addf(err, _("unable to write references: %s"),
+			    reftable_error_str(ret));
+		ret = TRANSACTION_GENERIC_ERROR;
+	}
+
+cleanup:
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_be_transaction_abort(struct ref_store *ref_store,
+					 struct ref_transaction *transaction,
+					 struct strbuf *err)
+{
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int reftable_be_initial_transaction_commit(struct ref_store *ref_store,
+						  struct ref_transaction *transaction,
+						  struct strbuf *err)
+{
+	int ret = reftable_be_transaction_prepare(ref_store, transaction, err);
+
+	if (ret)
+		return ret;
+	return reftable_be_transaction_finish(ref_store, transaction, err);
+}
+
+static int reftable_be_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				     "pack_refs");
+	int ret;
+
+	ret = reftable_stack_compact_all(refs->main_stack);
+	if (!ret && refs->worktree_stack)
+		ret = reftable_stack_compact_all(refs->worktree_stack);
+	if (ret)
+		return error(_("unable to compact references: %s"),
+			     reftable_error_str(ret));
+	return 0;
+}
+
+struct write_symref_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_stack *stack;
+	const char *refname;
+	const char *name;
+	const char *target;
+	const char *logmsg;
+};
+
+static int write_symref_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_symref_arg *arg = cb_data;
+	struct table_records recs = { 0 };
+	struct reftable_ref_record *ref;
+	struct object_id old_oid, new_oid;
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	int ret;
+
+	recs.min_update_index = recs.max_update_index = ts;
+	ref = add_ref_record(&recs, arg->name, ts);
+	ref->value_type = REFTABLE_REF_SYMREF;
+	ref->target = xstrdup(arg->target);
+
+	if (arg->logmsg &&
+	    !refs_read_ref_full(&arg->refs->base, arg->target,
+				RESOLVE_REF_READING, &new_oid, NULL) &&
+	    should_write_log(&arg->refs->base, arg->refname, 0)) {
+		struct reftable_log_record *log =
+			add_log_record(&recs, arg->name, ts);
+
+		if (!refs_resolve_ref_unsafe(&arg->refs->base, arg->refname,
+					     RESOLVE_REF_NO_RECURSE,
+					     &old_oid, NULL))
+			oidclr(&old_oid);
+		memcpy(log->old_hash, old_oid.hash, the_hash_algo->rawsz);
+		memcpy(log->new_hash, new_oid.hash, the_hash_algo->rawsz);
+		fill_log_committer(log);
+		log->message = xstrdup(arg->logmsg);
+	}
+
+	ret = write_table_records(writer, &recs);
+	table_records_release(&recs);
+	return ret;
+}
+
+static int reftable_be_create_symref(struct ref_store *ref_store,
+				     const char *refname,
+				     const char *target,
+				     const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct write_symref_arg arg = { 0 };
+	struct strbuf err = STRBUF_INIT;
+	int ret;
+
+	if (refs_verify_refname_available(&refs->base, refname, NULL, NULL, &err)) {
+		error("%s", err.buf);
+		strbuf_release(&err);
+		return -1;
+	}
+
+	arg.refs = refs;
+	arg.refname = refname;
+	arg.stack = stack_for(refs, refname, &arg.name);
+	arg.target = target;
+	arg.logmsg = logmsg;
+
+	ret = reftable_stack_add(arg.stack, write_symref_table, &arg);
+	if (ret)
+		return error(_("unable to write symref for %s: %s"),
+			     refname, reftable_error_str(ret));
+	return 0;
+}
+
+static int reftable_be_delete_refs(struct ref_store *ref_store, const char *msg,
+				   struct string_list *refnames, unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	int i, ret = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		goto error;
+
+	for (i = 0; i < refnames->nr; i++) {
+		const char *refname = refnames->items[i].string;
+
+		if (ref_transaction_delete(transaction, refname, NULL,
+					   flags, msg, &err)) {
+			ref_transaction_free(transaction);
+			goto error;
+		}
+	}
+
+	ret = ref_transaction_commit(transaction, &err);
+	ref_transaction_free(transaction);
+	if (!ret)
+		return 0;
+
+error:
+	if (refnames->nr == 1)
+		error(_("could not delete reference %s: %s"),
+		      refnames->items[0].string, err.buf);
+	else
+		error(_("could not delete references: %s"), err.buf);
+
+	strbuf_release(&err);
+	return -1;
+}
+
+struct write_copy_arg {
+	struct reftable_ref_store *refs;
+	struct reftable_stack *stack;
+	const char *oldname;
+	const char *newname;
+	const char *newrefname;
+	const char *logmsg;
+	int delete_old;
+};
+
+static int write_copy_table(struct reftable_writer *writer, void *cb_data)
+{
+	struct write_copy_arg *arg = cb_data;
+	struct table_records recs = { 0 };
+	struct reftable_ref_record old_ref = { 0 };
+	struct reftable_ref_record *ref;
+	struct reftable_log_record *old_logs = NULL, *new_logs = NULL, *log;
+	size_t old_nr = 0, new_nr = 0, i, j;
+	uint64_t ts = reftable_stack_next_update_index(arg->stack);
+	int same = !strcmp(arg->oldname, arg->newname);
+	int ret;
+
+	ret = reftable_stack_read_ref(arg->stack, arg->oldname, &old_ref);
+	if (ret)
+		return ret < 0 ? ret : REFTABLE_API_ERROR;
+	if (old_ref.value_type == REFTABLE_REF_SYMREF) {
+		ret = REFTABLE_API_ERROR;
+		goto out;
+	}
+
+	recs.min_update_index = recs.max_update_index = ts;
+
+	if (arg->delete_old && !same)
+		add_ref_record(&recs, arg->oldname, ts);
+	ref = add_ref_record(&recs, arg->newname, ts);
+	ref->value_type = old_ref.value_type;
+	memcpy(ref->value, old_ref.value, sizeof(ref->value));
+	memcpy(ref->peeled, old_ref.peeled, sizeof(ref->peeled));
+
+	/*
+	 * The new ref takes over the reflog of the old one, replacing
+	 * whatever reflog it had before. A ref renamed or copied onto
+	 * itself keeps its reflog as it is.
+	 */
+	ret = read_log_records(arg->stack, arg->oldname, &old_logs, &old_nr);
+	if (!same && ret >= 0)
+		ret = read_log_records(arg->stack, arg->newname,
+				       &new_logs, &new_nr);
+	if (ret < 0)
+		goto out;
+	ret = 0;
+
+	for (i = 0; !same && i < new_nr; i++) {
+		for (j = 0; j < old_nr; j++)
+			if (old_logs[j].update_index == new_logs[i].update_index)
+				break;
+		if (j < old_nr)
+			continue;
+		add_log_tombstone(&recs.logs, &recs.logs_nr, &recs.logs_alloc,
+				  arg->newname, new_logs[i].update_index);
+	}
+	for (i = 0; !same && i < old_nr; i++) {
+		ALLOC_GROW(recs.logs, recs.logs_nr + 1, recs.logs_alloc);
+		dup_log_record(&recs.logs[recs.logs_nr++], &old_logs[i],
+			       arg->newname);
+		if (arg->delete_old)
+			add_log_tombstone(&recs.logs, &recs.logs_nr,
+					  &recs.logs_alloc, arg->oldname,
+					  old_logs[i].update_index);
+	}
+	for (i = 0; i < recs.logs_nr; i++)
+		if (recs.logs[i].update_index < recs.min_update_index)
+			recs.min_update_index = recs.logs[i].update_index;
+
+	if (old_nr || should_write_log(&arg->refs->base, arg->newrefname, 0)) {
+		log = add_log_record(&recs, arg->newname, ts);
+		memcpy(log->old_hash, old_ref.value, the_hash_algo->rawsz);
+		memcpy(log->new_hash, old_ref.value, the_hash_algo->rawsz);
+		fill_log_committer(log);
+		log->message = xstrdup(arg->logmsg ? arg->logmsg : "");
+	}
+
+	ret = write_table_records(writer, &recs);
+
+out:
+	reftable_ref_record_release(&old_ref);
+	free_log_records(old_logs, old_nr);
+	free_log_records(new_logs, new_nr);
+	table_records_release(&recs);
+	return ret;
+}
+
+static int reftable_be_copy_or_rename_ref(struct ref_store *ref_store,
+					  const char *oldrefname,
+					  const char *newrefname,
+					  const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct write_copy_arg arg = { 0 };
+	struct object_id orig_oid;
+	int flag = 0, ret;
+
+	if (!refs_resolve_ref_unsafe(&refs->base, oldrefname,
+				     RESOLVE_REF_READING | RESOLVE_REF_NO_RECURSE,
+				     &orig_oid, &flag))
+		return error("refname %s not found", oldrefname);
+
+	if (flag & REF_ISSYMREF) {
+		if (copy)
+			return error("refname %s is a symbolic ref, copying it is not supported",
+				     oldrefname);
+		else
+			return error("refname %s is a symbolic ref, renaming it is not supported",
+				     oldrefname);
+	}
+	if (copy) {
+		struct strbuf err = STRBUF_INIT;
+
+		/* unlike a rename, a copy keeps the old ref in the way */
+		if (refs_verify_refname_available(&refs->base, newrefname,
+						  NULL, NULL, &err)) {
+			error("%s", err.buf);
+			strbuf_release(&err);
+			return 1;
+		}
+	} else if (!refs_rename_ref_available(&refs->base, oldrefname,
+					      newrefname)) {
+		return 1;
+	}
+
+	arg.refs = refs;
+	arg.stack = stack_for(refs, newrefname, &arg.newname);
+	if (stack_for(refs, oldrefname, &arg.oldname) != arg.stack) {
+		if (copy)
+			return error(_("cannot copy '%s' to '%s' across worktrees"),
+				     oldrefname, newrefname);
+		else
+			return error(_("cannot rename '%s' to '%s' across worktrees"),
+				     oldrefname, newrefname);
+	}
+	arg.newrefname = newrefname;
+	arg.logmsg = logmsg;
+	arg.delete_old = !copy;
+
+	ret = reftable_stack_add(arg.stack, write_copy_table, &arg);
+	if (ret) {
+		if (copy)
+			error("unable to copy '%s' to '%s': %s", oldrefname,
+			      newrefname, reftable_error_str(ret));
+		else
+			error("unable to rename '%s' to '%s': %s", oldrefname,
+			      newrefname, reftable_error_str(ret));
+		return 1;
+	}
+	return 0;
+}
+
+static int reftable_be_rename_ref(struct ref_store *ref_store,
+				  const char *oldrefname, const char *newrefname,
+				  const char *logmsg)
+{
+	return reftable_be_copy_or_rename_ref(ref_store, oldrefname,
+					      newrefname, logmsg, 0);
+}
+
+static int reftable_be_copy_ref(struct ref_store *ref_store,
+				const char *oldrefname, const char *newrefname,
+				const char *logmsg)
+{
+	return reftable_be_copy_or_rename_ref(ref_store, oldrefname,
+					      newrefname, logmsg, 1);
+}
+
+struct expire_reflog_cb {
+	unsigned int flags;
+	reflog_expiry_should_prune_fn *should_prune_fn;
+	void *policy_cb;
+	struct object_id last_kept_oid;
+};
+
+static int reftable_be_reflog_expire(struct ref_store *ref_store,
+				     const char *refname,
+				     const struct object_id *oid,
+				     unsigned int flags,
+				     reflog_expiry_prepare_fn prepare_fn,
+				     reflog_expiry_should_prune_fn should_prune_fn,
+				     reflog_expiry_cleanup_fn cleanup_fn,
+				     void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	const char *name;
+	struct reftable_stack *stack = stack_for(refs, refname, &name);
+	struct reftable_addition *addition = NULL;
+	struct reftable_log_record *logs = NULL;
+	struct reftable_ref_record ref = { 0 };
+	struct table_records recs = { 0 };
+	struct object_id last_kept_oid;
+	size_t i, nr = 0, kept = 0;
+	uint64_t ts;
+	int ret;
+
+	/*
+	 * Holding the lock of the stack keeps both the reflog and the
+	 * ref itself stable while we look at them.
+	 */
+	ret = reftable_stack_new_addition(&addition, stack);
+	if (ret) {
+		error("cannot lock ref '%s': %s", refname,
+		      reftable_error_str(ret));
+		return -1;
+	}
+
+	ret = read_log_records(stack, name, &logs, &nr);
+	if (ret) {
+		reftable_addition_destroy(addition);
+		return ret < 0 ? -1 : 0;
+	}
+
+	ts = reftable_stack_next_update_index(stack);
+	recs.min_update_index = recs.max_update_index = ts;
+	oidclr(&last_kept_oid);
+
+	(*prepare_fn)(refname, oid, policy_cb_data);
+	/* the callbacks expect the oldest entry first */
+	for (i = nr; i--; ) {
+		struct reftable_log_record *log = &logs[i];
+		struct object_id old_oid, new_oid;
+		struct strbuf ident = STRBUF_INIT, message = STRBUF_INIT;
+		int tz = log->tz_offset, sign = 1, prune;
+
+		if (is_log_marker(log))
+			continue;
+
+		oidread(&old_oid, log->old_hash);
+		oidread(&new_oid, log->new_hash);
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			oidcpy(&old_oid, &last_kept_oid);
+		strbuf_addf(&ident, "%s <%s>", log->name ? log->name : "",
+			    log->email ? log->email : "");
+		strbuf_addf(&message, "%s\n", log->message ? log->message : "");
+		if (tz < 0) {
+			sign = -1;
+			tz = -tz;
+		}
+		tz = sign * (tz / 60 * 100 + tz % 60);
+
+		prune = (*should_prune_fn)(&old_oid, &new_oid, ident.buf,
+					   log->time, tz, message.buf,
+					   policy_cb_data);
+		if (prune) {
+			if (flags & EXPIRE_REFLOGS_DRY_RUN)
+				printf("would prune %s", message.buf);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", message.buf);
+			add_log_tombstone(&recs.logs, &recs.logs_nr,
+					  &recs.logs_alloc, name,
+					  log->update_index);
+		} else {
+			if (!hasheq(log->old_hash, old_oid.hash)) {
+				struct reftable_log_record *rewritten;
+
+				ALLOC_GROW(recs.logs, recs.logs_nr + 1,
+					   recs.logs_alloc);
+				rewritten = &recs.logs[recs.logs_nr++];
+				dup_log_record(rewritten, log, name);
+				memcpy(rewritten->old_hash, old_oid.hash,
+				       the_hash_algo->rawsz);
+			}
+			if (!(flags & EXPIRE_REFLOGS_DRY_RUN))
+				oidcpy(&last_kept_oid, &new_oid);
+			kept++;
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", message.buf);
+		}
+		if (log->update_index < recs.min_update_index)
+			recs.min_update_index = log->update_index;
+		strbuf_release(&ident);
+		strbuf_release(&message);
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	if (flags & EXPIRE_REFLOGS_DRY_RUN)
+		goto out;
+
+	/* an expired reflog still exists, it is just empty */
+	if (!kept && recs.logs_nr) {
+		struct reftable_log_record *marker =
+			add_log_record(&recs, name, ts);
+		fill_log_committer(marker);
+		marker->message = xstrdup("");
+	}
+
+	/*
+	 * It doesn't make sense to adjust a reference pointed to by a
+	 * symbolic ref based on expiring entries in the symbolic
+	 * reference's reflog. Nor can we update a reference if there
+	 * are no remaining reflog entries.
+	 */
+	if ((flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+	    !is_null_oid(&last_kept_oid) &&
+	    !reftable_stack_read_ref(stack, name, &ref) &&
+	    ref.value_type != REFTABLE_REF_SYMREF &&
+	    !hasheq(ref.value, last_kept_oid.hash))
+		set_ref_value(add_ref_record(&recs, name, ts), &last_kept_oid);
+
+	/* nothing was pruned or rewritten; leave the stack alone */
+	if (!recs.logs_nr && !recs.refs_nr)
+		goto out;
+
+	ret = reftable_addition_add(addition, write_table_records, &recs);
+	if (!ret)
+		ret = reftable_addition_commit(addition);
+	if (ret)
+		ret = error(_("unable to write reflog '%s': %s"), refname,
+			    reftable_error_str(ret));
+
+out:
+	reftable_ref_record_release(&ref);
+	table_records_release(&recs);
+	free_log_records(logs, nr);
+	reftable_addition_destroy(addition);
+	return ret;
+}
+
+static int reftable_be_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_be_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	safe_create_dir(sb.buf, 1);
+
+	/*
+	 * HEAD and refs/heads are only there so that the directory is
+	 * recognized as a repository, and so that older versions of Git
+	 * that do not know about reftables cannot write loose refs.
+	 */
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/HEAD", refs->base.gitdir);
+	if (access(sb.buf, F_OK)) {
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+		adjust_shared_perm(sb.buf);
+	}
+
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/refs/heads", refs->gitcommondir);
+	if (access(sb.buf, F_OK)) {
+		write_file(sb.buf, "this repository uses the reftable format");
+		adjust_shared_perm(sb.buf);
+	}
+
+	strbuf_release(&sb);
+	return 0;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	&refs_be_files,
+	"reftable",
+	reftable_be_init,
+	reftable_be_init_db,
+	reftable_be_transaction_prepare,
+	reftable_be_transaction_finish,
+	reftable_be_transaction_abort,
+	reftable_be_initial_transaction_commit,
+
+	reftable_be_pack_refs,
+	reftable_be_create_symref,
+	reftable_be_delete_refs,
+	reftable_be_rename_ref,
+	reftable_be_copy_ref,
+
+	reftable_be_iterator_begin,
+	reftable_be_read_raw_ref,
+	reftable_be_fingerprint,
+	reftable_be_clear_cache,
+
+	reftable_be_reflog_iterator_begin,
+	reftable_be_for_each_reflog_ent,
+	reftable_be_for_each_reflog_ent_reverse,
+	reftable_be_reflog_exists,
+	reftable_be_create_reflog,
+	reftable_be_delete_reflog,
+	reftable_be_reflog_expire
+};
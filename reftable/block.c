@@ -0,0 +1,270 @@
+#include "cache.h"
+#include "block.h"
+
+void block_writer_init(struct block_writer *bw, uint8_t type,
+		       uint32_t block_size, uint32_t header_off,
+		       int hash_size, uint16_t restart_interval)
+{
+	memset(bw, 0, sizeof(*bw));
+	strbuf_init(&bw->buf, block_size);
+	strbuf_init(&bw->last_key, 0);
+	strbuf_init(&bw->scratch, 0);
+	bw->type = type;
+	bw->block_size = block_size;
+	bw->header_off = header_off;
+	bw->hash_size = hash_size;
+	bw->restart_interval = restart_interval;
+
+	/* room for the file header and the block header */
+	strbuf_addchars(&bw->buf, 0, header_off + 4);
+	bw->buf.buf[header_off] = type;
+}
+
+int block_writer_add(struct block_writer *bw, const struct reftable_record *rec)
+{
+	static const struct strbuf empty = STRBUF_INIT;
+	int restart = !(bw->entries % bw->restart_interval);
+	size_t needed;
+
+	if (restart && bw->restart_nr == 0xffff)
+		return 1;
+
+	strbuf_reset(&bw->scratch);
+	reftable_record_encode(rec, restart ? &empty : &bw->last_key,
+			       &bw->scratch, bw->hash_size);
+
+	needed = bw->buf.len + bw->scratch.len +
+		3 * (bw->restart_nr + restart) + 2;
+	if (needed > bw->block_size)
+		return 1;
+
+	if (restart) {
+		ALLOC_GROW(bw->restarts, bw->restart_nr + 1, bw->restart_alloc);
+		bw->restarts[bw->restart_nr++] = bw->buf.len;
+	}
+	strbuf_addbuf(&bw->buf, &bw->scratch);
+	reftable_record_key(rec, &bw->last_key);
+	bw->entries++;
+	return 0;
+}
+
+static int deflate_log_block(struct block_writer *bw)
+{
+	size_t start = bw->header_off + 4;
+	size_t raw = bw->buf.len - start;
+	struct strbuf out = STRBUF_INIT;
+	git_zstream s;
+	int ret;
+
+	git_deflate_init(&s, Z_BEST_COMPRESSION);
+	strbuf_add(&out, bw->buf.buf, start);
+	strbuf_grow(&out, git_deflate_bound(&s, raw));
+
+	s.next_in = (unsigned char *)bw->buf.buf + start;
+	s.avail_in = raw;
+	s.next_out = (unsigned char *)out.buf + start;
+	s.avail_out = out.alloc - start - 1;
+	ret = git_deflate(&s, Z_FINISH);
+	git_deflate_end(&s);
+	if (ret != Z_STREAM_END) {
+		strbuf_release(&out);
+		return REFTABLE_API_ERROR;
+	}
+	strbuf_setlen(&out, start + s.total_out);
+	strbuf_swap(&bw->buf, &out);
+	strbuf_release(&out);
+	return 0;
+}
+
+int block_writer_finish(struct block_writer *bw)
+{
+	unsigned char b[3];
+	size_t i;
+
+	for (i = 0; i < bw->restart_nr; i++) {
+		put_be24(b, bw->restarts[i]);
+		strbuf_add(&bw->buf, b, 3);
+	}
+	put_be16(b, bw->restart_nr);
+	strbuf_add(&bw->buf, b, 2);
+	put_be24((unsigned char *)bw->buf.buf + bw->header_off + 1, bw->buf.len);
+
+	if (bw->type == BLOCK_TYPE_LOG)
+		return deflate_log_block(bw);
+	return 0;
+}
+
+void block_writer_release(struct block_writer *bw)
+{
+	strbuf_release(&bw->buf);
+	strbuf_release(&bw->last_key);
+	strbuf_release(&bw->scratch);
+	FREE_AND_NULL(bw->restarts);
+	bw->restart_nr = bw->restart_alloc = 0;
+}
+
+static int inflate_log_block(struct block_reader *br, const unsigned char *data,
+			     size_t avail)
+{
+	size_t start = br->header_off + 4;
+	git_zstream s;
+	int ret;
+
+	br->inflated = xmalloc(br->block_len);
+	memcpy(br->inflated, data, start);
+
+	memset(&s, 0, sizeof(s));
+	git_inflate_init(&s);
+	s.next_in = (unsigned char *)data + start;
+	s.avail_in = avail - start;
+	s.next_out = br->inflated + start;
+	s.avail_out = br->block_len - start;
+	ret = git_inflate(&s, Z_FINISH);
+	git_inflate_end(&s);
+	if (ret != Z_STREAM_END || s.total_out != br->block_len - start)
+		return REFTABLE_FORMAT_ERROR;
+
+	br->data = br->inflated;
+	br->full_block_size = start + s.total_in;
+	return 0;
+}
+
+int block_reader_init(struct block_reader *br, const unsigned char *data,
+		      size_t avail, uint32_t header_off,
+		      uint32_t table_block_size, int hash_size)
+{
+	uint8_t type;
+
+	memset(br, 0, sizeof(*br));
+	if (avail < header_off + 4)
+		return 1;
+	type = data[header_off];
+	if (type != BLOCK_TYPE_REF && type != BLOCK_TYPE_OBJ &&
+	    type != BLOCK_TYPE_LOG && type != BLOCK_TYPE_INDEX)
+		return 1;
+
+	br->type = type;
+	br->header_off = header_off;
+	br->hash_size = hash_size;
+	br->block_len = get_be24(data + header_off + 1);
+	if (br->block_len < header_off + 4 + 2)
+		return REFTABLE_FORMAT_ERROR;
+
+	if (type == BLOCK_TYPE_LOG) {
+		int ret = inflate_log_block(br, data, avail);
+		if (ret) {
+			block_reader_release(br);
+			return ret;
+		}
+	} else {
+		if (br->block_len > avail)
+			return REFTABLE_FORMAT_ERROR;
+		br->data = data;
+		br->full_block_size = br->block_len;
+		if (table_block_size > br->block_len)
+			br->full_block_size = table_block_size < avail ?
+				table_block_size : avail;
+	}
+
+	br->restart_count = get_be16(br->data + br->block_len - 2);
+	if (!br->restart_count ||
+	    3 * br->restart_count + 2 > br->block_len - header_off - 4) {
+		block_reader_release(br);
+		return REFTABLE_FORMAT_ERROR;
+	}
+	br->restart_off = br->block_len - 2 - 3 * br->restart_count;
+	return 0;
+}
+
+void block_reader_release(struct block_reader *br)
+{
+	FREE_AND_NULL(br->inflated);
+	br->data = NULL;
+}
+
+void block_iter_start(struct block_iter *it, const struct block_reader *br)
+{
+	it->br = br;
+	it->next_off = br->header_off + 4;
+	strbuf_reset(&it->last_key);
+}
+
+int block_iter_has_next(const struct block_iter *it)
+{
+	return it->br && it->next_off < it->br->restart_off;
+}
+
+int block_iter_next(struct block_iter *it, struct reftable_record *rec)
+{
+	const struct block_reader *br = it->br;
+	int n;
+
+	if (!block_iter_has_next(it))
+		return 1;
+	n = reftable_record_decode(rec, &it->last_key, br->data + it->next_off,
+				   br->restart_off - it->next_off,
+				   br->hash_size);
+	if (n <= 0)
+		return REFTABLE_FORMAT_ERROR;
+	it->next_off += n;
+	return 0;
+}
+
+static uint32_t restart_offset(const struct block_reader *br, size_t i)
+{
+	return get_be24(br->data + br->restart_off + 3 * i);
+}
+
+int block_iter_seek(struct block_iter *it, const struct strbuf *want)
+{
+	const struct block_reader *br = it->br;
+	struct reftable_record rec;
+	size_t lo = 0, hi = br->restart_count;
+	uint8_t extra;
+	int ret = 0;
+
+	/* find the first restart point whose key is > want */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		uint32_t off = restart_offset(br, mid);
+
+		strbuf_reset(&it->scratch);
+		if (off >= br->restart_off ||
+		    reftable_decode_key(&it->scratch, &extra, br->data + off,
+					br->restart_off - off) < 0)
+			return REFTABLE_FORMAT_ERROR;
+		if (strbuf_cmp(&it->scratch, want) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	/* and scan forward from the one before it */
+	it->next_off = lo ? restart_offset(br, lo - 1) : br->header_off + 4;
+	strbuf_reset(&it->last_key);
+
+	reftable_record_init(&rec, br->type);
+	for (;;) {
+		uint32_t off = it->next_off;
+
+		strbuf_reset(&it->scratch);
+		strbuf_addbuf(&it->scratch, &it->last_key);
+		ret = block_iter_next(it, &rec);
+		if (ret)
+			break;
+		if (strbuf_cmp(&it->last_key, want) >= 0) {
+			it->next_off = off;
+			strbuf_swap(&it->last_key, &it->scratch);
+			break;
+		}
+	}
+	reftable_record_release(&rec);
+	return ret < 0 ? ret : 0;
+}
+
+void block_iter_release(struct block_iter *it)
+{
+	strbuf_release(&it->last_key);
+	strbuf_release(&it->scratch);
+	it->br = NULL;
+}
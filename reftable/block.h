@@ -0,0 +1,86 @@
+#ifndef REFTABLE_BLOCK_H
+#define REFTABLE_BLOCK_H
+
+#include "record.h"
+
+/*
+ * Builds a single block. The first block of a table shares its space
+ * with the file header, which occupies the first `header_off` bytes
+ * of `buf`; offsets in the restart table count from the start of
+ * `buf` in either case.
+ */
+struct block_writer {
+	struct strbuf buf;
+	uint32_t block_size;
+	uint32_t header_off;
+	uint8_t type;
+	int hash_size;
+	uint16_t restart_interval;
+
+	uint32_t *restarts;
+	size_t restart_nr, restart_alloc;
+	size_t entries;
+	struct strbuf last_key;
+	struct strbuf scratch;
+};
+
+void block_writer_init(struct block_writer *bw, uint8_t type,
+		       uint32_t block_size, uint32_t header_off,
+		       int hash_size, uint16_t restart_interval);
+
+/*
+ * Add a record, returning 0 on success and 1 if the block is full.
+ */
+int block_writer_add(struct block_writer *bw, const struct reftable_record *rec);
+
+/*
+ * Append the restart table and fill in the block header. Log blocks
+ * are deflated. The finished block is left in `bw->buf`.
+ */
+int block_writer_finish(struct block_writer *bw);
+
+void block_writer_release(struct block_writer *bw);
+
+struct block_reader {
+	uint8_t type;
+	uint32_t header_off;
+	const unsigned char *data;
+	unsigned char *inflated;
+	uint32_t block_len;
+	uint32_t restart_off;
+	uint16_t restart_count;
+	/* bytes the block occupies in the file, including padding */
+	uint32_t full_block_size;
+	int hash_size;
+};
+
+/*
+ * Parse the block starting at `data`, with `avail` bytes left before
+ * the footer. Returns 1 if there is no block there.
+ */
+int block_reader_init(struct block_reader *br, const unsigned char *data,
+		      size_t avail, uint32_t header_off,
+		      uint32_t table_block_size, int hash_size);
+void block_reader_release(struct block_reader *br);
+
+struct block_iter {
+	const struct block_reader *br;
+	uint32_t next_off;
+	struct strbuf last_key;
+	struct strbuf scratch;
+};
+
+#define BLOCK_ITER_INIT { .last_key = STRBUF_INIT, .scratch = STRBUF_INIT }
+
+void block_iter_start(struct block_iter *it, const struct block_reader *br);
+int block_iter_next(struct block_iter *it, struct reftable_record *rec);
+
+/* Position the iterator before the first record whose key is >= `want`. */
+int block_iter_seek(struct block_iter *it, const struct strbuf *want);
+
+/* Whether the iterator has records left. */
+int block_iter_has_next(const struct block_iter *it);
+
+void block_iter_release(struct block_iter *it);
+
+#endif /* REFTABLE_BLOCK_H */
@@ -0,0 +1,82 @@
+#include "cache.h"
+#include "iter.h"
+
+static int empty_iterator_next(void *iter_arg, struct reftable_record *rec)
+{
+	return 1;
+}
+
+static void empty_iterator_close(void *iter_arg)
+{
+}
+
+static const struct reftable_iterator_vtable empty_vtable = {
+	.next = empty_iterator_next,
+	.close = empty_iterator_close,
+};
+
+void iterator_set_empty(struct reftable_iterator *it)
+{
+	it->ops = &empty_vtable;
+	it->iter_arg = NULL;
+}
+
+int iterator_next(struct reftable_iterator *it, struct reftable_record *rec)
+{
+	if (!it->ops)
+		return 1;
+	return it->ops->next(it->iter_arg, rec);
+}
+
+void reftable_iterator_destroy(struct reftable_iterator *it)
+{
+	if (!it->ops)
+		return;
+	it->ops->close(it->iter_arg);
+	it->ops = NULL;
+	it->iter_arg = NULL;
+}
+
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *ref)
+{
+	struct reftable_record rec = { .type = BLOCK_TYPE_REF };
+	int ret;
+
+	rec.u.ref = *ref;
+	ret = iterator_next(it, &rec);
+	*ref = rec.u.ref;
+	return ret;
+}
+
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *log)
+{
+	struct reftable_record rec = { .type = BLOCK_TYPE_LOG };
+	int ret;
+
+	rec.u.log = *log;
+	ret = iterator_next(it, &rec);
+	*log = rec.u.log;
+	return ret;
+}
+
+const char *reftable_error_str(int err)
+{
+	switch (err) {
+	case REFTABLE_IO_ERROR:
+		return strerror(errno);
+	case REFTABLE_FORMAT_ERROR:
+		return _("corrupt reftable file");
+	case REFTABLE_LOCK_ERROR:
+		return _("reftable stack is locked");
+	case REFTABLE_API_ERROR:
+		return _("invalid use of the reftable API");
+	case REFTABLE_ENTRY_TOO_BIG:
+		return _("reftable entry does not fit in a block");
+	case REFTABLE_OUTDATED_ERROR:
+		return _("reftable stack changed concurrently");
+	default:
+		return _("unknown reftable error");
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef REFTABLE_ITER_H
+#define REFTABLE_ITER_H
+
+#include "record.h"
+
+struct reftable_iterator_vtable {
+	/* Return 0 and fill in `rec`, 1 at the end, or a negative error. */
+	int (*next)(void *iter_arg, struct reftable_record *rec);
+	void (*close)(void *iter_arg);
+};
+
+/* Make `it` an iterator over nothing. */
+void iterator_set_empty(struct reftable_iterator *it);
+
+int iterator_next(struct reftable_iterator *it, struct reftable_record *rec);
+
+#endif /* REFTABLE_ITER_H */
@@ -0,0 +1,341 @@
+#include "cache.h"
+#include "prio-queue.h"
+#include "string-list.h"
+#include "merged.h"
+#include "reader.h"
+
+struct reftable_merged_table *reftable_merged_table_new(struct reftable_reader **readers,
+							size_t nr, uint32_t hash_id)
+{
+	struct reftable_merged_table *mt = xcalloc(1, sizeof(*mt));
+	int algo = hash_algo_by_id(hash_id);
+	size_t i;
+
+	if (algo == GIT_HASH_UNKNOWN)
+		BUG("unknown hash id %08x for reftable", hash_id);
+	ALLOC_ARRAY(mt->readers, nr);
+	for (i = 0; i < nr; i++) {
+		reftable_reader_incref(readers[i]);
+		mt->readers[i] = readers[i];
+	}
+	mt->nr = nr;
+	mt->hash_id = hash_id;
+	mt->hash_size = hash_algos[algo].rawsz;
+	mt->suppress_deletions = 1;
+	mt->refcount = 1;
+	return mt;
+}
+
+void reftable_merged_table_incref(struct reftable_merged_table *mt)
+{
+	mt->refcount++;
+}
+
+void reftable_merged_table_decref(struct reftable_merged_table *mt)
+{
+	size_t i;
+
+	if (!mt || --mt->refcount)
+		return;
+	for (i = 0; i < mt->nr; i++)
+		reftable_reader_decref(mt->readers[i]);
+	free(mt->readers);
+	free(mt);
+}
+
+/* The next record of one of the tables, with its key. */
+struct merged_entry {
+	size_t index;
+	struct reftable_record rec;
+	struct strbuf key;
+};
+
+struct merged_iter {
+	struct reftable_merged_table *mt;
+	struct reftable_iterator *subs;
+	struct merged_entry *entries;
+	size_t nr;
+	struct prio_queue pq;
+	struct strbuf key;
+	int suppress_deletions;
+};
+
+/* Smallest key first; for equal keys, the newest table first. */
+static int merged_entry_cmp(const void *a_, const void *b_, void *cb_data)
+{
+	const struct merged_entry *a = a_, *b = b_;
+	int cmp = strbuf_cmp(&a->key, &b->key);
+
+	if (cmp)
+		return cmp;
+	return a->index < b->index ? 1 : a->index > b->index ? -1 : 0;
+}
+
+static int merged_iter_advance(struct merged_iter *mi, struct merged_entry *e)
+{
+	int ret = iterator_next(&mi->subs[e->index], &e->rec);
+
+	if (ret)
+		return ret < 0 ? ret : 0;
+	reftable_record_key(&e->rec, &e->key);
+	prio_queue_put(&mi->pq, e);
+	return 0;
+}
+
+static int merged_iter_next(void *iter_arg, struct reftable_record *rec)
+{
+	struct merged_iter *mi = iter_arg;
+
+	for (;;) {
+		struct merged_entry *e = prio_queue_get(&mi->pq), *top;
+		int ret;
+
+		if (!e)
+			return 1;
+		strbuf_swap(&mi->key, &e->key);
+		reftable_record_swap(rec, &e->rec);
+		ret = merged_iter_advance(mi, e);
+		if (ret)
+			return ret;
+
+		/* older tables' records for the same key are shadowed */
+		while ((top = prio_queue_peek(&mi->pq)) &&
+		       !strbuf_cmp(&top->key, &mi->key)) {
+			prio_queue_get(&mi->pq);
+			ret = merged_iter_advance(mi, top);
+			if (ret)
+				return ret;
+		}
+
+		if (mi->suppress_deletions && reftable_record_is_deletion(rec))
+			continue;
+		return 0;
+	}
+}
+
+static void merged_iter_close(void *iter_arg)
+{
+	struct merged_iter *mi = iter_arg;
+	size_t i;
+
+	for (i = 0; i < mi->nr; i++) {
+		reftable_iterator_destroy(&mi->subs[i]);
+		reftable_record_release(&mi->entries[i].rec);
+		strbuf_release(&mi->entries[i].key);
+	}
+	free(mi->subs);
+	free(mi->entries);
+	clear_prio_queue(&mi->pq);
+	strbuf_release(&mi->key);
+	reftable_merged_table_decref(mi->mt);
+	free(mi);
+}
+
+static const struct reftable_iterator_vtable merged_iter_vtable = {
+	.next = merged_iter_next,
+	.close = merged_iter_close,
+};
+
+int merged_table_seek(struct reftable_merged_table *mt,
+		      struct reftable_iterator *it,
+		      uint8_t type, const struct strbuf *key)
+{
+	struct merged_iter *mi = xcalloc(1, sizeof(*mi));
+	size_t i;
+	int ret = 0;
+
+	reftable_merged_table_incref(mt);
+	mi->mt = mt;
+	mi->nr = mt->nr;
+	mi->suppress_deletions = mt->suppress_deletions;
+	mi->pq.compare = merged_entry_cmp;
+	strbuf_init(&mi->key, 0);
+	CALLOC_ARRAY(mi->subs, mt->nr);
+	CALLOC_ARRAY(mi->entries, mt->nr);
+
+	for (i = 0; i < mt->nr; i++) {
+		struct merged_entry *e = &mi->entries[i];
+
+		e->index = i;
+		reftable_record_init(&e->rec, type);
+		strbuf_init(&e->key, 0);
+	}
+	for (i = 0; !ret && i < mt->nr; i++) {
+		ret = reader_seek(mt->readers[i], &mi->subs[i], type, key);
+		if (!ret)
+			ret = merged_iter_advance(mi, &mi->entries[i]);
+	}
+	if (ret) {
+		merged_iter_close(mi);
+		return ret;
+	}
+
+	it->ops = &merged_iter_vtable;
+	it->iter_arg = mi;
+	return 0;
+}
+
+int reftable_merged_table_seek_ref(struct reftable_merged_table *mt,
+				   struct reftable_iterator *it,
+				   const char *name)
+{
+	struct strbuf key = STRBUF_INIT;
+	int ret;
+
+	strbuf_addstr(&key, name);
+	ret = merged_table_seek(mt, it, BLOCK_TYPE_REF, &key);
+	strbuf_release(&key);
+	return ret;
+}
+
+int reftable_merged_table_seek_log_at(struct reftable_merged_table *mt,
+				      struct reftable_iterator *it,
+				      const char *name, uint64_t update_index)
+{
+	struct strbuf key = STRBUF_INIT;
+	int ret;
+
+	reftable_log_key(&key, name, update_index);
+	ret = merged_table_seek(mt, it, BLOCK_TYPE_LOG, &key);
+	strbuf_release(&key);
+	return ret;
+}
+
+int reftable_merged_table_seek_log(struct reftable_merged_table *mt,
+				   struct reftable_iterator *it,
+				   const char *name)
+{
+	return reftable_merged_table_seek_log_at(mt, it, name, UINT64_MAX);
+}
+
+/*
+ * Look the ref up in each table, newest first, instead of merging all
+ * of them: the first table that mentions it has the answer.
+ */
+int reftable_merged_table_read_ref(struct reftable_merged_table *mt,
+				   const char *name,
+				   struct reftable_ref_record *ref)
+{
+	struct strbuf key = STRBUF_INIT;
+	size_t i;
+	int ret = 1;
+
+	strbuf_addstr(&key, name);
+	for (i = mt->nr; i--; ) {
+		struct reftable_iterator it = REFTABLE_ITERATOR_INIT;
+
+		ret = reader_seek(mt->readers[i], &it, BLOCK_TYPE_REF, &key);
+		if (!ret)
+			ret = reftable_iterator_next_ref(&it, ref);
+		reftable_iterator_destroy(&it);
+		if (ret < 0)
+			break;
+		if (!ret && !strcmp(ref->refname, name)) {
+			if (ref->value_type == REFTABLE_REF_DELETION)
+				ret = 1;
+			break;
+		}
+		ret = 1;
+	}
+	strbuf_release(&key);
+	if (ret)
+		reftable_ref_record_release(ref);
+	return ret;
+}
+
+/* Iterates over a list of refs computed up front. */
+struct list_iter {
+	struct reftable_ref_record *refs;
+	size_t nr, cur;
+};
+
+static int list_iter_next(void *iter_arg, struct reftable_record *rec)
+{
+	struct list_iter *li = iter_arg;
+
+	if (li->cur >= li->nr)
+		return 1;
+	reftable_ref_record_release(&rec->u.ref);
+	rec->u.ref = li->refs[li->cur];
+	memset(&li->refs[li->cur], 0, sizeof(li->refs[li->cur]));
+	li->cur++;
+	return 0;
+}
+
+static void list_iter_close(void *iter_arg)
+{
+	struct list_iter *li = iter_arg;
+	size_t i;
+
+	for (i = 0; i < li->nr; i++)
+		reftable_ref_record_release(&li->refs[i]);
+	free(li->refs);
+	free(li);
+}
+
+static const struct reftable_iterator_vtable list_iter_vtable = {
+	.next = list_iter_next,
+	.close = list_iter_close,
+};
+
+/*
+ * Every table names the refs it has that point at `oid`, but a newer
+ * table may have changed or deleted them since, so each candidate is
+ * looked up again in the merged view.
+ */
+int reftable_merged_table_refs_for(struct reftable_merged_table *mt,
+				   struct reftable_iterator *it,
+				   const unsigned char *oid)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct reftable_ref_record ref = { 0 };
+	struct list_iter *li;
+	size_t i, alloc = 0;
+	int ret = 0;
+
+	for (i = 0; !ret && i < mt->nr; i++) {
+		struct reftable_iterator sub = REFTABLE_ITERATOR_INIT;
+
+		ret = reader_refs_for(mt->readers[i], &sub, oid);
+		while (!ret && !(ret = reftable_iterator_next_ref(&sub, &ref)))
+			string_list_insert(&names, ref.refname);
+		reftable_iterator_destroy(&sub);
+		if (ret > 0)
+			ret = 0;
+	}
+	reftable_ref_record_release(&ref);
+	if (ret) {
+		string_list_clear(&names, 0);
+		return ret;
+	}
+
+	CALLOC_ARRAY(li, 1);
+	for (i = 0; i < names.nr; i++) {
+		ret = reftable_merged_table_read_ref(mt, names.items[i].string,
+						     &ref);
+		if (ret < 0)
+			break;
+		if (ret > 0)
+			continue;
+		ret = 0;
+		if (ref.value_type == REFTABLE_REF_SYMREF ||
+		    (memcmp(ref.value, oid, mt->hash_size) &&
+		     (ref.value_type != REFTABLE_REF_VAL2 ||
+		      memcmp(ref.peeled, oid, mt->hash_size)))) {
+			reftable_ref_record_release(&ref);
+			continue;
+		}
+		ALLOC_GROW(li->refs, li->nr + 1, alloc);
+		li->refs[li->nr++] = ref;
+		memset(&ref, 0, sizeof(ref));
+	}
+	string_list_clear(&names, 0);
+	if (ret < 0) {
+		list_iter_close(li);
+		return ret;
+	}
+
+	it->ops = &list_iter_vtable;
+	it->iter_arg = li;
+	return 0;
+}
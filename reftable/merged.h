@@ -0,0 +1,25 @@
+#ifndef REFTABLE_MERGED_H
+#define REFTABLE_MERGED_H
+
+#include "iter.h"
+
+struct reftable_merged_table {
+	/* oldest first */
+	struct reftable_reader **readers;
+	size_t nr;
+	uint32_t hash_id;
+	int hash_size;
+	/* hide deleted refs and log entries from iterators */
+	int suppress_deletions;
+	int refcount;
+};
+
+/*
+ * Position `it` at the first record of the given type whose key is
+ * >= `key`, across all tables.
+ */
+int merged_table_seek(struct reftable_merged_table *mt,
+		      struct reftable_iterator *it,
+		      uint8_t type, const struct strbuf *key);
+
+#endif /* REFTABLE_MERGED_H */
@@ -0,0 +1,473 @@
+#include "cache.h"
+#include "reader.h"
+
+static int parse_header(const unsigned char *p, size_t len, int *version,
+			uint32_t *block_size, uint64_t *min, uint64_t *max,
+			uint32_t *hash_id)
+{
+	if (len < HEADER_SIZE_V1 || memcmp(p, "REFT", 4))
+		return REFTABLE_FORMAT_ERROR;
+	*version = p[4];
+	if (*version != 1 && *version != 2)
+		return REFTABLE_FORMAT_ERROR;
+	if (len < header_size(*version))
+		return REFTABLE_FORMAT_ERROR;
+	*block_size = get_be24(p + 5);
+	*min = get_be64(p + 8);
+	*max = get_be64(p + 16);
+	*hash_id = *version == 1 ? REFTABLE_SHA1_ID : get_be32(p + 24);
+	return 0;
+}
+
+static int parse_footer(struct reftable_reader *r)
+{
+	const unsigned char *p;
+	int hsize = header_size(r->version);
+	int fsize = footer_size(r->version);
+	uint64_t obj;
+
+	if (r->size < hsize + fsize)
+		return REFTABLE_FORMAT_ERROR;
+	p = r->data + r->size - fsize;
+	if (memcmp(p, r->data, hsize))
+		return REFTABLE_FORMAT_ERROR;
+	if (crc32(0, p, fsize - 4) != get_be32(p + fsize - 4))
+		return REFTABLE_FORMAT_ERROR;
+	p += hsize;
+
+	r->ref.index_offset = get_be64(p);
+	obj = get_be64(p + 8);
+	r->obj.offset = obj >> 5;
+	r->obj_id_len = obj & 0x1f;
+	r->obj.index_offset = get_be64(p + 16);
+	r->log.offset = get_be64(p + 24);
+	r->log.index_offset = get_be64(p + 32);
+
+	/*
+	 * The first block follows the file header; it tells whether
+	 * there are refs, and whether a log section at offset 0 exists.
+	 */
+	if (r->size > hsize + fsize) {
+		uint8_t first = r->data[hsize];
+		r->ref.present = first == BLOCK_TYPE_REF;
+		r->log.present = r->log.offset || first == BLOCK_TYPE_LOG;
+	}
+	r->obj.present = !!r->obj.offset;
+	return 0;
+}
+
+int reftable_reader_open(struct reftable_reader **out, const char *path)
+{
+	struct reftable_reader *r;
+	struct stat st;
+	void *map;
+	int fd, ret, algo;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return REFTABLE_IO_ERROR;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return REFTABLE_IO_ERROR;
+	}
+	if (st.st_size < HEADER_SIZE_V1 + FOOTER_SIZE_V1) {
+		close(fd);
+		return REFTABLE_FORMAT_ERROR;
+	}
+	map = xmmap_gently(NULL, xsize_t(st.st_size), PROT_READ, MAP_PRIVATE,
+			   fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return REFTABLE_IO_ERROR;
+
+	CALLOC_ARRAY(r, 1);
+	r->data = map;
+	r->size = xsize_t(st.st_size);
+	r->path = xstrdup(path);
+	r->name = xstrdup(find_last_dir_sep(path) ?
+			  find_last_dir_sep(path) + 1 : path);
+	r->refcount = 1;
+
+	ret = parse_header(r->data, r->size, &r->version, &r->block_size,
+			   &r->min_update_index, &r->max_update_index,
+			   &r->hash_id);
+	if (!ret)
+		ret = parse_footer(r);
+	if (!ret) {
+		algo = hash_algo_by_id(r->hash_id);
+		if (algo == GIT_HASH_UNKNOWN)
+			ret = REFTABLE_FORMAT_ERROR;
+		else
+			r->hash_size = hash_algos[algo].rawsz;
+	}
+	if (ret) {
+		reftable_reader_decref(r);
+		return ret;
+	}
+	*out = r;
+	return 0;
+}
+
+void reftable_reader_incref(struct reftable_reader *r)
+{
+	r->refcount++;
+}
+
+void reftable_reader_decref(struct reftable_reader *r)
+{
+	if (!r || --r->refcount)
+		return;
+	munmap((void *)r->data, r->size);
+	free(r->name);
+	free(r->path);
+	free(r);
+}
+
+const char *reftable_reader_name(struct reftable_reader *r)
+{
+	return r->name;
+}
+
+uint64_t reftable_reader_min_update_index(struct reftable_reader *r)
+{
+	return r->min_update_index;
+}
+
+uint64_t reftable_reader_max_update_index(struct reftable_reader *r)
+{
+	return r->max_update_index;
+}
+
+uint32_t reftable_reader_hash_id(struct reftable_reader *r)
+{
+	return r->hash_id;
+}
+
+uint64_t reftable_reader_size(struct reftable_reader *r)
+{
+	return r->size;
+}
+
+static struct reftable_section *reader_section(struct reftable_reader *r,
+					       uint8_t type)
+{
+	switch (type) {
+	case BLOCK_TYPE_REF:
+		return &r->ref;
+	case BLOCK_TYPE_OBJ:
+		return &r->obj;
+	case BLOCK_TYPE_LOG:
+		return &r->log;
+	default:
+		BUG("no reftable section for block type '%c'", type);
+	}
+}
+
+/*
+ * Load the block at `off`. Returns 1 if there is no block there, or
+ * if `want_type` is non-zero and the block is of another type.
+ */
+static int reader_init_block(struct reftable_reader *r, struct block_reader *br,
+			     uint64_t off, uint8_t want_type)
+{
+	size_t limit = r->size - footer_size(r->version);
+	int ret;
+
+	if (off >= limit)
+		return 1;
+	ret = block_reader_init(br, r->data + off, limit - off,
+				off ? 0 : header_size(r->version),
+				r->block_size, r->hash_size);
+	if (ret)
+		return ret;
+	if (want_type && br->type != want_type) {
+		block_reader_release(br);
+		return 1;
+	}
+	return 0;
+}
+
+/* Iterates over the records of one section of a table. */
+struct table_iter {
+	struct reftable_reader *r;
+	uint8_t type;
+	uint64_t block_off;
+	struct block_reader br;
+	struct block_iter bi;
+	int finished;
+};
+
+static struct table_iter *table_iter_new(struct reftable_reader *r,
+					 uint8_t type)
+{
+	struct table_iter *ti = xcalloc(1, sizeof(*ti));
+	struct block_iter bi = BLOCK_ITER_INIT;
+
+	reftable_reader_incref(r);
+	ti->r = r;
+	ti->type = type;
+	ti->bi = bi;
+	ti->finished = 1;
+	return ti;
+}
+
+/* Start iterating at the beginning of the block at `off`. */
+static int table_iter_seek_block(struct table_iter *ti, uint64_t off)
+{
+	int ret;
+
+	block_reader_release(&ti->br);
+	ret = reader_init_block(ti->r, &ti->br, off, ti->type);
+	if (ret) {
+		ti->finished = 1;
+		return ret;
+	}
+	ti->block_off = off;
+	ti->finished = 0;
+	block_iter_start(&ti->bi, &ti->br);
+	return 0;
+}
+
+static int table_iter_next_in_block(struct table_iter *ti,
+				    struct reftable_record *rec)
+{
+	int ret = block_iter_next(&ti->bi, rec);
+
+	if (!ret && rec->type == BLOCK_TYPE_REF)
+		rec->u.ref.update_index += ti->r->min_update_index;
+	return ret;
+}
+
+static int table_iter_next(void *iter_arg, struct reftable_record *rec)
+{
+	struct table_iter *ti = iter_arg;
+
+	while (!ti->finished) {
+		int ret = table_iter_next_in_block(ti, rec);
+		if (ret <= 0)
+			return ret;
+		ret = table_iter_seek_block(ti, ti->block_off +
+					    ti->br.full_block_size);
+		if (ret < 0)
+			return ret;
+	}
+	return 1;
+}
+
+static void table_iter_free(struct table_iter *ti)
+{
+	block_reader_release(&ti->br);
+	block_iter_release(&ti->bi);
+	reftable_reader_decref(ti->r);
+	free(ti);
+}
+
+static void table_iter_close(void *iter_arg)
+{
+	table_iter_free(iter_arg);
+}
+
+static const struct reftable_iterator_vtable table_iter_vtable = {
+	.next = table_iter_next,
+	.close = table_iter_close,
+};
+
+/*
+ * Walk down the index of a section, if it has one, to the block that
+ * holds the first key >= `key`, and position `ti` there.
+ */
+static int table_iter_seek(struct table_iter *ti, const struct strbuf *key)
+{
+	struct reftable_section *sec = reader_section(ti->r, ti->type);
+	uint64_t off = sec->offset;
+	int ret;
+
+	if (sec->index_offset) {
+		struct reftable_record idx;
+		struct block_reader br;
+		struct block_iter bi = BLOCK_ITER_INIT;
+
+		reftable_record_init(&idx, BLOCK_TYPE_INDEX);
+		off = sec->index_offset;
+		for (;;) {
+			ret = reader_init_block(ti->r, &br, off, 0);
+			if (ret)
+				break;
+			if (br.type != BLOCK_TYPE_INDEX) {
+				block_reader_release(&br);
+				break;
+			}
+			block_iter_start(&bi, &br);
+			ret = block_iter_seek(&bi, key);
+			if (!ret)
+				ret = block_iter_next(&bi, &idx);
+			block_reader_release(&br);
+			if (ret)
+				break;
+			off = idx.u.idx.offset;
+		}
+		block_iter_release(&bi);
+		reftable_record_release(&idx);
+		if (ret > 0) {
+			/* every key in the section is smaller */
+			ti->finished = 1;
+			return 0;
+		}
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = table_iter_seek_block(ti, off);
+	if (ret)
+		return ret < 0 ? ret : 0;
+	return block_iter_seek(&ti->bi, key);
+}
+
+int reader_seek(struct reftable_reader *r, struct reftable_iterator *it,
+		uint8_t type, const struct strbuf *key)
+{
+	struct table_iter *ti;
+	int ret;
+
+	if (!reader_section(r, type)->present) {
+		iterator_set_empty(it);
+		return 0;
+	}
+
+	ti = table_iter_new(r, type);
+	ret = table_iter_seek(ti, key);
+	if (ret < 0) {
+		table_iter_free(ti);
+		return ret;
+	}
+	it->ops = &table_iter_vtable;
+	it->iter_arg = ti;
+	return 0;
+}
+
+/*
+ * Yields the refs pointing at `oid`, either from the ref blocks listed
+ * in its obj record, or by scanning the whole ref section.
+ */
+struct filtering_iter {
+	struct table_iter *ti;
+	unsigned char oid[GIT_MAX_RAWSZ];
+	uint64_t *offsets;
+	size_t offset_nr, offset_cur;
+};
+
+static int filtering_iter_next(void *iter_arg, struct reftable_record *rec)
+{
+	struct filtering_iter *fi = iter_arg;
+	struct table_iter *ti = fi->ti;
+	int hash_size = ti->r->hash_size;
+	int ret;
+
+	for (;;) {
+		struct reftable_ref_record *ref = &rec->u.ref;
+
+		if (fi->offsets) {
+			ret = ti->finished ? 1 : table_iter_next_in_block(ti, rec);
+			if (ret > 0) {
+				if (fi->offset_cur >= fi->offset_nr)
+					return 1;
+				ret = table_iter_seek_block(ti,
+							    fi->offsets[fi->offset_cur++]);
+				if (ret)
+					return ret < 0 ? ret : REFTABLE_FORMAT_ERROR;
+				continue;
+			}
+		} else {
+			ret = table_iter_next(ti, rec);
+		}
+		if (ret)
+			return ret;
+
+		if ((ref->value_type == REFTABLE_REF_VAL1 ||
+		     ref->value_type == REFTABLE_REF_VAL2) &&
+		    !memcmp(ref->value, fi->oid, hash_size))
+			return 0;
+		if (ref->value_type == REFTABLE_REF_VAL2 &&
+		    !memcmp(ref->peeled, fi->oid, hash_size))
+			return 0;
+	}
+}
+
+static void filtering_iter_close(void *iter_arg)
+{
+	struct filtering_iter *fi = iter_arg;
+
+	table_iter_free(fi->ti);
+	free(fi->offsets);
+	free(fi);
+}
+
+static const struct reftable_iterator_vtable filtering_iter_vtable = {
+	.next = filtering_iter_next,
+	.close = filtering_iter_close,
+};
+
+int reader_refs_for(struct reftable_reader *r, struct reftable_iterator *it,
+		    const unsigned char *oid)
+{
+	struct filtering_iter *fi;
+	struct strbuf key = STRBUF_INIT;
+	int ret;
+
+	if (!r->ref.present) {
+		iterator_set_empty(it);
+		return 0;
+	}
+
+	CALLOC_ARRAY(fi, 1);
+	memcpy(fi->oid, oid, r->hash_size);
+	fi->ti = table_iter_new(r, BLOCK_TYPE_REF);
+
+	if (r->obj.present && r->obj_id_len) {
+		struct table_iter *obj_ti = table_iter_new(r, BLOCK_TYPE_OBJ);
+		struct reftable_record obj;
+
+		reftable_record_init(&obj, BLOCK_TYPE_OBJ);
+		strbuf_add(&key, oid, r->obj_id_len);
+		ret = table_iter_seek(obj_ti, &key);
+		if (!ret)
+			ret = table_iter_next(obj_ti, &obj);
+		table_iter_free(obj_ti);
+		if (ret < 0) {
+			reftable_record_release(&obj);
+			goto fail;
+		}
+		if (ret > 0 || obj.u.obj.hash_prefix_len != r->obj_id_len ||
+		    memcmp(obj.u.obj.hash_prefix, oid, r->obj_id_len)) {
+			/* no ref in this table points at it */
+			reftable_record_release(&obj);
+			filtering_iter_close(fi);
+			strbuf_release(&key);
+			iterator_set_empty(it);
+			return 0;
+		}
+		if (obj.u.obj.offset_len) {
+			fi->offsets = obj.u.obj.offsets;
+			fi->offset_nr = obj.u.obj.offset_len;
+			obj.u.obj.offsets = NULL;
+		}
+		reftable_record_release(&obj);
+	}
+
+	if (!fi->offsets) {
+		strbuf_reset(&key);
+		ret = table_iter_seek(fi->ti, &key);
+		if (ret < 0)
+			goto fail;
+	}
+
+	strbuf_release(&key);
+	it->ops = &filtering_iter_vtable;
+	it->iter_arg = fi;
+	return 0;
+
+fail:
+	strbuf_release(&key);
+	filtering_iter_close(fi);
+	return ret;
+}
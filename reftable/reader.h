@@ -0,0 +1,62 @@
+#ifndef REFTABLE_READER_H
+#define REFTABLE_READER_H
+
+#include "block.h"
+#include "iter.h"
+
+#define HEADER_SIZE_V1 24
+#define HEADER_SIZE_V2 28
+#define FOOTER_SIZE_V1 (HEADER_SIZE_V1 + 44)
+#define FOOTER_SIZE_V2 (HEADER_SIZE_V2 + 44)
+
+static inline int header_size(int version)
+{
+	return version == 1 ? HEADER_SIZE_V1 : HEADER_SIZE_V2;
+}
+
+static inline int footer_size(int version)
+{
+	return version == 1 ? FOOTER_SIZE_V1 : FOOTER_SIZE_V2;
+}
+
+struct reftable_section {
+	int present;
+	uint64_t offset;
+	uint64_t index_offset;
+};
+
+struct reftable_reader {
+	char *name;
+	char *path;
+	const unsigned char *data;
+	size_t size;
+	int version;
+	uint32_t hash_id;
+	int hash_size;
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	struct reftable_section ref;
+	struct reftable_section obj;
+	struct reftable_section log;
+	int obj_id_len;
+
+	int refcount;
+};
+
+/*
+ * Position `it` at the first record of the given type whose key is
+ * >= `key`.
+ */
+int reader_seek(struct reftable_reader *r, struct reftable_iterator *it,
+		uint8_t type, const struct strbuf *key);
+
+/*
+ * Iterate over the refs of this table that point at `oid` or peel to
+ * it. Refs come out in refname order.
+ */
+int reader_refs_for(struct reftable_reader *r, struct reftable_iterator *it,
+		    const unsigned char *oid);
+
+#endif /* REFTABLE_READER_H */
@@ -0,0 +1,405 @@
+#include "cache.h"
+#include "record.h"
+
+int put_var_int(struct strbuf *out, uint64_t value)
+{
+	unsigned char varint[10];
+	unsigned pos = sizeof(varint) - 1;
+
+	varint[pos] = value & 0x7f;
+	while (value >>= 7)
+		varint[--pos] = 0x80 | (--value & 0x7f);
+	strbuf_add(out, varint + pos, sizeof(varint) - pos);
+	return sizeof(varint) - pos;
+}
+
+int get_var_int(const unsigned char *buf, size_t len, uint64_t *value)
+{
+	size_t pos = 0;
+	uint64_t val;
+
+	if (!len)
+		return -1;
+	val = buf[pos] & 0x7f;
+	while (buf[pos] & 0x80) {
+		if (++pos >= len || val >= (UINT64_MAX >> 7))
+			return -1;
+		val = ((val + 1) << 7) | (buf[pos] & 0x7f);
+	}
+	*value = val;
+	return pos + 1;
+}
+
+void reftable_ref_record_release(struct reftable_ref_record *ref)
+{
+	free(ref->refname);
+	free(ref->target);
+	memset(ref, 0, sizeof(*ref));
+}
+
+void reftable_log_record_release(struct reftable_log_record *log)
+{
+	free(log->refname);
+	free(log->name);
+	free(log->email);
+	free(log->message);
+	memset(log, 0, sizeof(*log));
+}
+
+void reftable_record_init(struct reftable_record *rec, uint8_t type)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->type = type;
+	if (type == BLOCK_TYPE_INDEX)
+		strbuf_init(&rec->u.idx.last_key, 0);
+}
+
+void reftable_record_release(struct reftable_record *rec)
+{
+	switch (rec->type) {
+	case BLOCK_TYPE_REF:
+		reftable_ref_record_release(&rec->u.ref);
+		break;
+	case BLOCK_TYPE_LOG:
+		reftable_log_record_release(&rec->u.log);
+		break;
+	case BLOCK_TYPE_INDEX:
+		strbuf_release(&rec->u.idx.last_key);
+		break;
+	case BLOCK_TYPE_OBJ:
+		free(rec->u.obj.hash_prefix);
+		free(rec->u.obj.offsets);
+		memset(&rec->u.obj, 0, sizeof(rec->u.obj));
+		break;
+	default:
+		BUG("unknown reftable record type '%c'", rec->type);
+	}
+}
+
+void reftable_record_swap(struct reftable_record *a, struct reftable_record *b)
+{
+	struct reftable_record tmp;
+
+	if (a->type != b->type)
+		BUG("swapping reftable records of different types");
+	tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+void reftable_log_key(struct strbuf *key, const char *refname,
+		      uint64_t update_index)
+{
+	unsigned char ts[8];
+
+	strbuf_reset(key);
+	strbuf_addstr(key, refname);
+	strbuf_addch(key, '\0');
+	put_be64(ts, ~update_index);
+	strbuf_add(key, ts, sizeof(ts));
+}
+
+void reftable_record_key(const struct reftable_record *rec, struct strbuf *key)
+{
+	switch (rec->type) {
+	case BLOCK_TYPE_REF:
+		strbuf_reset(key);
+		strbuf_addstr(key, rec->u.ref.refname);
+		break;
+	case BLOCK_TYPE_LOG:
+		reftable_log_key(key, rec->u.log.refname,
+				 rec->u.log.update_index);
+		break;
+	case BLOCK_TYPE_INDEX:
+		strbuf_reset(key);
+		strbuf_addbuf(key, &rec->u.idx.last_key);
+		break;
+	case BLOCK_TYPE_OBJ:
+		strbuf_reset(key);
+		strbuf_add(key, rec->u.obj.hash_prefix,
+			   rec->u.obj.hash_prefix_len);
+		break;
+	default:
+		BUG("unknown reftable record type '%c'", rec->type);
+	}
+}
+
+int reftable_record_is_deletion(const struct reftable_record *rec)
+{
+	switch (rec->type) {
+	case BLOCK_TYPE_REF:
+		return rec->u.ref.value_type == REFTABLE_REF_DELETION;
+	case BLOCK_TYPE_LOG:
+		return rec->u.log.value_type == REFTABLE_LOG_DELETION;
+	default:
+		return 0;
+	}
+}
+
+static uint8_t record_extra(const struct reftable_record *rec)
+{
+	switch (rec->type) {
+	case BLOCK_TYPE_REF:
+		return rec->u.ref.value_type;
+	case BLOCK_TYPE_LOG:
+		return rec->u.log.value_type;
+	case BLOCK_TYPE_OBJ:
+		if (rec->u.obj.offset_len && rec->u.obj.offset_len < 8)
+			return rec->u.obj.offset_len;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static void put_string(struct strbuf *out, const char *s)
+{
+	size_t len = s ? strlen(s) : 0;
+
+	put_var_int(out, len);
+	strbuf_add(out, s, len);
+}
+
+static void encode_value(const struct reftable_record *rec,
+			 struct strbuf *out, int hash_size)
+{
+	const struct reftable_ref_record *ref = &rec->u.ref;
+	const struct reftable_log_record *log = &rec->u.log;
+	const struct reftable_obj_record *obj = &rec->u.obj;
+	unsigned char tz[2];
+	size_t i;
+
+	switch (rec->type) {
+	case BLOCK_TYPE_REF:
+		put_var_int(out, ref->update_index);
+		switch (ref->value_type) {
+		case REFTABLE_REF_SYMREF:
+			put_string(out, ref->target);
+			break;
+		case REFTABLE_REF_VAL2:
+			strbuf_add(out, ref->value, hash_size);
+			strbuf_add(out, ref->peeled, hash_size);
+			break;
+		case REFTABLE_REF_VAL1:
+			strbuf_add(out, ref->value, hash_size);
+			break;
+		case REFTABLE_REF_DELETION:
+			break;
+		}
+		break;
+	case BLOCK_TYPE_LOG:
+		if (log->value_type == REFTABLE_LOG_DELETION)
+			break;
+		strbuf_add(out, log->old_hash, hash_size);
+		strbuf_add(out, log->new_hash, hash_size);
+		put_string(out, log->name);
+		put_string(out, log->email);
+		put_var_int(out, log->time);
+		put_be16(tz, (uint16_t)log->tz_offset);
+		strbuf_add(out, tz, sizeof(tz));
+		put_string(out, log->message);
+		break;
+	case BLOCK_TYPE_INDEX:
+		put_var_int(out, rec->u.idx.offset);
+		break;
+	case BLOCK_TYPE_OBJ:
+		if (!record_extra(rec))
+			put_var_int(out, obj->offset_len);
+		for (i = 0; i < obj->offset_len; i++)
+			put_var_int(out, i ? obj->offsets[i] - obj->offsets[i - 1]
+				    : obj->offsets[0]);
+		break;
+	default:
+		BUG("unknown reftable record type '%c'", rec->type);
+	}
+}
+
+void reftable_record_encode(const struct reftable_record *rec,
+			    const struct strbuf *last_key,
+			    struct strbuf *out, int hash_size)
+{
+	struct strbuf key = STRBUF_INIT;
+	size_t prefix = 0;
+
+	reftable_record_key(rec, &key);
+	while (prefix < last_key->len && prefix < key.len &&
+	       last_key->buf[prefix] == key.buf[prefix])
+		prefix++;
+
+	put_var_int(out, prefix);
+	put_var_int(out, ((uint64_t)(key.len - prefix) << 3) | record_extra(rec));
+	strbuf_add(out, key.buf + prefix, key.len - prefix);
+	encode_value(rec, out, hash_size);
+	strbuf_release(&key);
+}
+
+int reftable_decode_key(struct strbuf *key, uint8_t *extra,
+			const unsigned char *buf, size_t len)
+{
+	uint64_t prefix, suffix;
+	size_t pos = 0;
+	int n;
+
+	n = get_var_int(buf, len, &prefix);
+	if (n < 0 || prefix > key->len)
+		return REFTABLE_FORMAT_ERROR;
+	pos += n;
+
+	n = get_var_int(buf + pos, len - pos, &suffix);
+	if (n < 0)
+		return REFTABLE_FORMAT_ERROR;
+	pos += n;
+
+	*extra = suffix & 0x7;
+	suffix >>= 3;
+	if (suffix > len - pos)
+		return REFTABLE_FORMAT_ERROR;
+
+	strbuf_setlen(key, prefix);
+	strbuf_add(key, buf + pos, suffix);
+	return pos + suffix;
+}
+
+static int get_string(char **out, const unsigned char *buf, size_t len)
+{
+	uint64_t slen;
+	int n = get_var_int(buf, len, &slen);
+
+	if (n < 0 || slen > len - n)
+		return -1;
+	free(*out);
+	*out = xmemdupz(buf + n, slen);
+	return n + slen;
+}
+
+static int decode_value(struct reftable_record *rec, const struct strbuf *key,
+			uint8_t extra, const unsigned char *buf, size_t len,
+			int hash_size)
+{
+	struct reftable_ref_record *ref = &rec->u.ref;
+	struct reftable_log_record *log = &rec->u.log;
+	struct reftable_obj_record *obj = &rec->u.obj;
+	size_t pos = 0;
+	uint64_t count, val;
+	int n;
+	size_t i;
+
+	switch (rec->type) {
+	case BLOCK_TYPE_REF:
+		free(ref->refname);
+		ref->refname = xmemdupz(key->buf, key->len);
+		FREE_AND_NULL(ref->target);
+		if (extra > REFTABLE_REF_SYMREF)
+			return -1;
+		ref->value_type = extra;
+		n = get_var_int(buf, len, &ref->update_index);
+		if (n < 0)
+			return -1;
+		pos += n;
+		switch (ref->value_type) {
+		case REFTABLE_REF_SYMREF:
+			n = get_string(&ref->target, buf + pos, len - pos);
+			if (n < 0)
+				return -1;
+			pos += n;
+			break;
+		case REFTABLE_REF_VAL2:
+			if (len - pos < 2 * hash_size)
+				return -1;
+			memcpy(ref->value, buf + pos, hash_size);
+			memcpy(ref->peeled, buf + pos + hash_size, hash_size);
+			pos += 2 * hash_size;
+			break;
+		case REFTABLE_REF_VAL1:
+			if (len - pos < hash_size)
+				return -1;
+			memcpy(ref->value, buf + pos, hash_size);
+			pos += hash_size;
+			break;
+		case REFTABLE_REF_DELETION:
+			break;
+		}
+		return pos;
+
+	case BLOCK_TYPE_LOG:
+		if (key->len < 9 || key->buf[key->len - 9] ||
+		    memchr(key->buf, '\0', key->len - 9))
+			return -1;
+		free(log->refname);
+		log->refname = xmemdupz(key->buf, key->len - 9);
+		log->update_index = ~get_be64(key->buf + key->len - 8);
+		if (extra > REFTABLE_LOG_UPDATE)
+			return -1;
+		log->value_type = extra;
+		if (log->value_type == REFTABLE_LOG_DELETION)
+			return 0;
+		if (len < 2 * hash_size)
+			return -1;
+		memcpy(log->old_hash, buf, hash_size);
+		memcpy(log->new_hash, buf + hash_size, hash_size);
+		pos = 2 * hash_size;
+		if ((n = get_string(&log->name, buf + pos, len - pos)) < 0)
+			return -1;
+		pos += n;
+		if ((n = get_string(&log->email, buf + pos, len - pos)) < 0)
+			return -1;
+		pos += n;
+		if ((n = get_var_int(buf + pos, len - pos, &log->time)) < 0)
+			return -1;
+		pos += n;
+		if (len - pos < 2)
+			return -1;
+		log->tz_offset = (int16_t)get_be16(buf + pos);
+		pos += 2;
+		if ((n = get_string(&log->message, buf + pos, len - pos)) < 0)
+			return -1;
+		return pos + n;
+
+	case BLOCK_TYPE_INDEX:
+		strbuf_reset(&rec->u.idx.last_key);
+		strbuf_addbuf(&rec->u.idx.last_key, key);
+		n = get_var_int(buf, len, &rec->u.idx.offset);
+		return n;
+
+	case BLOCK_TYPE_OBJ:
+		free(obj->hash_prefix);
+		obj->hash_prefix = xmemdupz(key->buf, key->len);
+		obj->hash_prefix_len = key->len;
+		count = extra;
+		if (!count) {
+			if ((n = get_var_int(buf, len, &count)) < 0)
+				return -1;
+			pos += n;
+		}
+		if (count > len - pos)
+			return -1;
+		obj->offset_len = count;
+		REALLOC_ARRAY(obj->offsets, count);
+		for (i = 0; i < count; i++) {
+			if ((n = get_var_int(buf + pos, len - pos, &val)) < 0)
+				return -1;
+			pos += n;
+			obj->offsets[i] = i ? obj->offsets[i - 1] + val : val;
+		}
+		return pos;
+
+	default:
+		BUG("unknown reftable record type '%c'", rec->type);
+	}
+}
+
+int reftable_record_decode(struct reftable_record *rec, struct strbuf *key,
+			   const unsigned char *buf, size_t len,
+			   int hash_size)
+{
+	uint8_t extra;
+	int n, m;
+
+	n = reftable_decode_key(key, &extra, buf, len);
+	if (n < 0)
+		return n;
+	m = decode_value(rec, key, extra, buf + n, len - n, hash_size);
+	if (m < 0)
+		return REFTABLE_FORMAT_ERROR;
+	return n + m;
+}
@@ -0,0 +1,98 @@
+#ifndef REFTABLE_RECORD_H
+#define REFTABLE_RECORD_H
+
+#include "reftable.h"
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_OBJ 'o'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+static inline uint32_t get_be24(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | (uint32_t)p[2];
+}
+
+static inline void put_be24(unsigned char *p, uint32_t value)
+{
+	p[0] = (value >> 16) & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	p[2] = value & 0xff;
+}
+
+static inline void put_be16(unsigned char *p, uint16_t value)
+{
+	p[0] = (value >> 8) & 0xff;
+	p[1] = value & 0xff;
+}
+
+/*
+ * Varints use the ofs-delta encoding of pack files. get_var_int()
+ * returns the number of bytes consumed, or -1 if the buffer ends in
+ * the middle of the number or the value overflows.
+ */
+int put_var_int(struct strbuf *out, uint64_t value);
+int get_var_int(const unsigned char *buf, size_t len, uint64_t *value);
+
+/* The last key of another block and where that block starts. */
+struct reftable_index_record {
+	struct strbuf last_key;
+	uint64_t offset;
+};
+
+/* Ref blocks holding refs to objects with the given name prefix. */
+struct reftable_obj_record {
+	unsigned char *hash_prefix;
+	size_t hash_prefix_len;
+	uint64_t *offsets;
+	size_t offset_len;
+};
+
+struct reftable_record {
+	uint8_t type;
+	union {
+		struct reftable_ref_record ref;
+		struct reftable_log_record log;
+		struct reftable_index_record idx;
+		struct reftable_obj_record obj;
+	} u;
+};
+
+void reftable_record_init(struct reftable_record *rec, uint8_t type);
+void reftable_record_release(struct reftable_record *rec);
+
+/* The sort key: refname, log key, obj prefix or index key. */
+void reftable_record_key(const struct reftable_record *rec, struct strbuf *key);
+
+/* Build the key of the log entry of `refname` at `update_index`. */
+void reftable_log_key(struct strbuf *key, const char *refname,
+		      uint64_t update_index);
+
+int reftable_record_is_deletion(const struct reftable_record *rec);
+
+/*
+ * Append a record to `out`, prefix-compressing its key against
+ * `last_key`. Ref records carry their update_index relative to the
+ * table's minimum, which the caller must have subtracted.
+ */
+void reftable_record_encode(const struct reftable_record *rec,
+			    const struct strbuf *last_key,
+			    struct strbuf *out, int hash_size);
+
+/*
+ * Decode the record starting at `buf`, given the key of the previous
+ * record in `key`, which is updated. Returns the number of bytes
+ * consumed, or REFTABLE_FORMAT_ERROR.
+ */
+int reftable_record_decode(struct reftable_record *rec, struct strbuf *key,
+			   const unsigned char *buf, size_t len,
+			   int hash_size);
+
+/* Decode only the key of the record at `buf`; see above. */
+int reftable_decode_key(struct strbuf *key, uint8_t *extra,
+			const unsigned char *buf, size_t len);
+
+/* Exchange the contents of two records of the same type. */
+void reftable_record_swap(struct reftable_record *a, struct reftable_record *b);
+
+#endif /* REFTABLE_RECORD_H */
@@ -0,0 +1,238 @@
+#ifndef REFTABLE_H
+#define REFTABLE_H
+
+/*
+ * A reftable stores refs and reflogs in immutable, block-based sorted
+ * tables; see Documentation/technical/reftable.txt for the file format.
+ * A repository keeps a stack of such tables in $GIT_DIR/reftable,
+ * listed oldest first in "tables.list". Updates append a new table to
+ * the stack, and compaction merges adjacent tables so that the stack
+ * stays logarithmic in the number of updates.
+ */
+
+/*
+ * Return values. Iterators additionally return 1 when they are
+ * exhausted, and lookups return 1 when the entry does not exist.
+ */
+#define REFTABLE_IO_ERROR	-2 /* see errno */
+#define REFTABLE_FORMAT_ERROR	-3 /* the table is corrupt */
+#define REFTABLE_LOCK_ERROR	-4 /* tables.list.lock is held elsewhere */
+#define REFTABLE_API_ERROR	-5 /* misuse, e.g. records out of order */
+#define REFTABLE_ENTRY_TOO_BIG	-6 /* a record does not fit in a block */
+#define REFTABLE_OUTDATED_ERROR	-7 /* tables.list changed under us */
+
+const char *reftable_error_str(int err);
+
+#define REFTABLE_DEFAULT_BLOCK_SIZE 4096
+#define REFTABLE_DEFAULT_RESTART_INTERVAL 16
+
+/* The format_id of SHA-1, the default object hash. */
+#define REFTABLE_SHA1_ID 0x73686131
+
+enum reftable_ref_value_type {
+	REFTABLE_REF_DELETION = 0, /* tombstone */
+	REFTABLE_REF_VAL1 = 1, /* one object name */
+	REFTABLE_REF_VAL2 = 2, /* object name and its peeled value */
+	REFTABLE_REF_SYMREF = 3, /* symbolic reference */
+};
+
+struct reftable_ref_record {
+	char *refname;
+	uint64_t update_index;
+	enum reftable_ref_value_type value_type;
+	unsigned char value[GIT_MAX_RAWSZ];
+	unsigned char peeled[GIT_MAX_RAWSZ];
+	char *target;
+};
+
+void reftable_ref_record_release(struct reftable_ref_record *ref);
+
+enum reftable_log_value_type {
+	REFTABLE_LOG_DELETION = 0,
+	REFTABLE_LOG_UPDATE = 1,
+};
+
+struct reftable_log_record {
+	char *refname;
+	uint64_t update_index;
+	enum reftable_log_value_type value_type;
+	unsigned char old_hash[GIT_MAX_RAWSZ];
+	unsigned char new_hash[GIT_MAX_RAWSZ];
+	char *name;
+	char *email;
+	uint64_t time;
+	int16_t tz_offset; /* minutes east of UTC */
+	char *message;
+};
+
+void reftable_log_record_release(struct reftable_log_record *log);
+
+/*
+ * Iterate over refs or logs. The `next` functions return 0 and fill in
+ * the record, 1 at the end of the iteration, or a negative error.
+ */
+struct reftable_iterator {
+	const struct reftable_iterator_vtable *ops;
+	void *iter_arg;
+};
+
+#define REFTABLE_ITERATOR_INIT { NULL }
+
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *ref);
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *log);
+void reftable_iterator_destroy(struct reftable_iterator *it);
+
+struct reftable_write_options {
+	/* Size of the ref blocks; defaults to 4096. */
+	uint32_t block_size;
+
+	/* Records between two restart points; defaults to 16. */
+	uint16_t restart_interval;
+
+	/* The format_id of the object hash; defaults to SHA-1. */
+	uint32_t hash_id;
+
+	/* Do not write the object-to-ref index. */
+	unsigned skip_index_objects : 1;
+
+	/* Do not compact the stack after adding a table. */
+	unsigned disable_auto_compact : 1;
+
+	/* How long to wait for tables.list.lock, in milliseconds. */
+	long lock_timeout_ms;
+};
+
+/*
+ * Write a single table to `fd`. All refs must be added before any
+ * log, refs in refname order and logs in key order (refname, then
+ * decreasing update_index).
+ */
+struct reftable_writer;
+
+struct reftable_writer *reftable_writer_new(int fd,
+					    const struct reftable_write_options *opts);
+void reftable_writer_set_limits(struct reftable_writer *w,
+				uint64_t min_update_index,
+				uint64_t max_update_index);
+int reftable_writer_add_ref(struct reftable_writer *w,
+			    const struct reftable_ref_record *ref);
+int reftable_writer_add_log(struct reftable_writer *w,
+			    const struct reftable_log_record *log);
+/* Flush the last blocks, the indexes and the footer. */
+int reftable_writer_close(struct reftable_writer *w);
+/* Number of records added so far. */
+size_t reftable_writer_records(struct reftable_writer *w);
+void reftable_writer_free(struct reftable_writer *w);
+
+/* A single table on disk. Readers are reference counted. */
+struct reftable_reader;
+
+int reftable_reader_open(struct reftable_reader **out, const char *path);
+void reftable_reader_incref(struct reftable_reader *r);
+void reftable_reader_decref(struct reftable_reader *r);
+const char *reftable_reader_name(struct reftable_reader *r);
+uint64_t reftable_reader_min_update_index(struct reftable_reader *r);
+uint64_t reftable_reader_max_update_index(struct reftable_reader *r);
+uint32_t reftable_reader_hash_id(struct reftable_reader *r);
+uint64_t reftable_reader_size(struct reftable_reader *r);
+
+/*
+ * A view over several tables, the last one winning for refs or log
+ * entries that appear in more than one of them. Deletions are hidden.
+ */
+struct reftable_merged_table;
+
+struct reftable_merged_table *reftable_merged_table_new(struct reftable_reader **readers,
+							size_t nr, uint32_t hash_id);
+void reftable_merged_table_incref(struct reftable_merged_table *mt);
+void reftable_merged_table_decref(struct reftable_merged_table *mt);
+
+/* Position `it` at the first ref whose name is >= `name`. */
+int reftable_merged_table_seek_ref(struct reftable_merged_table *mt,
+				   struct reftable_iterator *it,
+				   const char *name);
+
+/*
+ * Position `it` at the newest log entry of `name`, or at the first
+ * entry of the first ref after it.
+ */
+int reftable_merged_table_seek_log(struct reftable_merged_table *mt,
+				   struct reftable_iterator *it,
+				   const char *name);
+
+/* Like seek_log, but start at the entry for `update_index` or older. */
+int reftable_merged_table_seek_log_at(struct reftable_merged_table *mt,
+				      struct reftable_iterator *it,
+				      const char *name, uint64_t update_index);
+
+/* Look up a single ref. Returns 1 if it does not exist. */
+int reftable_merged_table_read_ref(struct reftable_merged_table *mt,
+				   const char *name,
+				   struct reftable_ref_record *ref);
+
+/*
+ * Iterate over the refs whose value or peeled value is `oid`, using
+ * the object index of the tables that have one. The refs come out in
+ * no particular order.
+ */
+int reftable_merged_table_refs_for(struct reftable_merged_table *mt,
+				   struct reftable_iterator *it,
+				   const unsigned char *oid);
+
+/* The stack of tables in a reftable directory. */
+struct reftable_stack;
+
+int reftable_new_stack(struct reftable_stack **out, const char *dir,
+		       const struct reftable_write_options *opts);
+void reftable_stack_destroy(struct reftable_stack *st);
+
+/* Re-read tables.list if it changed on disk. */
+int reftable_stack_reload(struct reftable_stack *st);
+
+/* The current view; valid until the next reload. */
+struct reftable_merged_table *reftable_stack_merged_table(struct reftable_stack *st);
+
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *ref);
+
+/* The update_index that the next table added to the stack uses. */
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st);
+
+/*
+ * An addition locks the stack, writes one or more new tables and
+ * publishes them together in reftable_addition_commit(). While the
+ * addition is held, the stack reflects the state of the repository
+ * under the lock.
+ */
+struct reftable_addition;
+
+int reftable_stack_new_addition(struct reftable_addition **out,
+				struct reftable_stack *st);
+int reftable_addition_add(struct reftable_addition *add,
+			  int (*write_table)(struct reftable_writer *wr, void *arg),
+			  void *arg);
+int reftable_addition_commit(struct reftable_addition *add);
+void reftable_addition_destroy(struct reftable_addition *add);
+
+/* Convenience wrapper for an addition with a single table. */
+int reftable_stack_add(struct reftable_stack *st,
+		       int (*write_table)(struct reftable_writer *wr, void *arg),
+		       void *arg);
+
+/*
+ * Merge all tables into one, dropping deleted refs and log entries.
+ */
+int reftable_stack_compact_all(struct reftable_stack *st);
+
+/*
+ * Merge the newest tables as needed so that the sizes of the tables
+ * form a geometric sequence with factor 2, oldest and largest first.
+ */
+int reftable_stack_auto_compact(struct reftable_stack *st);
+
+/* Number of tables in the stack. */
+size_t reftable_stack_tables(struct reftable_stack *st);
+
+#endif /* REFTABLE_H */
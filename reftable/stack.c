@@ -0,0 +1,553 @@
+#include "cache.h"
+#include "lockfile.h"
+#include "tempfile.h"
+#include "string-list.h"
+#include "merged.h"
+#include "reader.h"
+#include "writer.h"
+
+struct reftable_stack {
+	char *dir;
+	char *list_file;
+	struct reftable_write_options opts;
+
+	/* oldest first, in the order of tables.list */
+	struct reftable_reader **readers;
+	size_t nr;
+	struct reftable_merged_table *merged;
+
+	struct stat_validity list_validity;
+};
+
+int reftable_new_stack(struct reftable_stack **out, const char *dir,
+		       const struct reftable_write_options *opts)
+{
+	struct reftable_stack *st = xcalloc(1, sizeof(*st));
+	int ret;
+
+	st->dir = xstrdup(dir);
+	st->list_file = xstrfmt("%s/tables.list", dir);
+	if (opts)
+		st->opts = *opts;
+	if (!st->opts.hash_id)
+		st->opts.hash_id = REFTABLE_SHA1_ID;
+	st->merged = reftable_merged_table_new(NULL, 0, st->opts.hash_id);
+
+	ret = reftable_stack_reload(st);
+	if (ret) {
+		reftable_stack_destroy(st);
+		return ret;
+	}
+	*out = st;
+	return 0;
+}
+
+static void stack_clear_readers(struct reftable_stack *st)
+{
+	size_t i;
+
+	for (i = 0; i < st->nr; i++)
+		reftable_reader_decref(st->readers[i]);
+	FREE_AND_NULL(st->readers);
+	st->nr = 0;
+}
+
+void reftable_stack_destroy(struct reftable_stack *st)
+{
+	if (!st)
+		return;
+	stack_clear_readers(st);
+	reftable_merged_table_decref(st->merged);
+	stat_validity_clear(&st->list_validity);
+	free(st->dir);
+	free(st->list_file);
+	free(st);
+}
+
+/*
+ * Read the table names from tables.list. A missing file is an empty
+ * stack. If `fd_out` is given, the open file is left there so that
+ * the caller can record its stat data.
+ */
+static int read_table_names(struct reftable_stack *st, struct string_list *names,
+			    int *fd_out)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int fd = open(st->list_file, O_RDONLY);
+
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+		return REFTABLE_IO_ERROR;
+	}
+	if (strbuf_read(&buf, fd, 0) < 0) {
+		close(fd);
+		strbuf_release(&buf);
+		return REFTABLE_IO_ERROR;
+	}
+	string_list_split(names, buf.buf, '\n', -1);
+	if (names->nr && !*names->items[names->nr - 1].string)
+		names->nr--;
+	strbuf_release(&buf);
+
+	if (fd_out)
+		*fd_out = fd;
+	else
+		close(fd);
+	return 0;
+}
+
+/*
+ * Open the tables listed in `names`, reusing the readers we already
+ * have. Fails with REFTABLE_IO_ERROR and errno set to ENOENT if a
+ * table was removed by a concurrent compaction.
+ */
+static int stack_reload_once(struct reftable_stack *st,
+			     const struct string_list *names)
+{
+	struct reftable_reader **readers;
+	struct reftable_merged_table *merged;
+	size_t i, j, nr = 0;
+	int ret = 0;
+
+	ALLOC_ARRAY(readers, names->nr);
+	for (i = 0; i < names->nr; i++) {
+		const char *name = names->items[i].string;
+		struct reftable_reader *r = NULL;
+
+		for (j = 0; j < st->nr; j++) {
+			if (!strcmp(reftable_reader_name(st->readers[j]), name)) {
+				r = st->readers[j];
+				reftable_reader_incref(r);
+				break;
+			}
+		}
+		if (!r) {
+			char *path = xstrfmt("%s/%s", st->dir, name);
+			ret = reftable_reader_open(&r, path);
+			free(path);
+			if (ret)
+				break;
+		}
+		readers[nr++] = r;
+		if (reftable_reader_hash_id(r) != st->opts.hash_id) {
+			ret = REFTABLE_FORMAT_ERROR;
+			break;
+		}
+	}
+
+	if (ret) {
+		int saved_errno = errno;
+		for (i = 0; i < nr; i++)
+			reftable_reader_decref(readers[i]);
+		free(readers);
+		errno = saved_errno;
+		return ret;
+	}
+
+	merged = reftable_merged_table_new(readers, nr, st->opts.hash_id);
+	stack_clear_readers(st);
+	st->readers = readers;
+	st->nr = nr;
+	reftable_merged_table_decref(st->merged);
+	st->merged = merged;
+	return 0;
+}
+
+static int stack_reload(struct reftable_stack *st, int force)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct string_list retry = STRING_LIST_INIT_DUP;
+	int ret, fd = -1;
+
+	if (!force && stat_validity_check(&st->list_validity, st->list_file))
+		return 0;
+
+	ret = read_table_names(st, &names, &fd);
+	while (!ret) {
+		size_t i;
+
+		ret = stack_reload_once(st, &names);
+		if (ret != REFTABLE_IO_ERROR || errno != ENOENT)
+			break;
+
+		/*
+		 * A table went away under us. That is only expected if
+		 * tables.list was rewritten in the meantime.
+		 */
+		string_list_clear(&retry, 0);
+		ret = read_table_names(st, &retry, NULL);
+		if (ret)
+			break;
+		for (i = 0; i < names.nr && i < retry.nr; i++)
+			if (strcmp(names.items[i].string, retry.items[i].string))
+				break;
+		if (i == names.nr && i == retry.nr) {
+			ret = REFTABLE_FORMAT_ERROR;
+			break;
+		}
+		string_list_clear(&names, 0);
+		SWAP(names, retry);
+		if (fd >= 0)
+			close(fd);
+		fd = open(st->list_file, O_RDONLY);
+	}
+
+	if (!ret) {
+		if (fd >= 0)
+			stat_validity_update(&st->list_validity, fd);
+		else
+			stat_validity_clear(&st->list_validity);
+	}
+	if (fd >= 0)
+		close(fd);
+	string_list_clear(&names, 0);
+	string_list_clear(&retry, 0);
+	return ret;
+}
+
+int reftable_stack_reload(struct reftable_stack *st)
+{
+	return stack_reload(st, 0);
+}
+
+struct reftable_merged_table *reftable_stack_merged_table(struct reftable_stack *st)
+{
+	return st->merged;
+}
+
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *ref)
+{
+	return reftable_merged_table_read_ref(st->merged, refname, ref);
+}
+
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st)
+{
+	if (!st->nr)
+		return 1;
+	return reftable_reader_max_update_index(st->readers[st->nr - 1]) + 1;
+}
+
+size_t reftable_stack_tables(struct reftable_stack *st)
+{
+	return st->nr;
+}
+
+static int stack_lock(struct reftable_stack *st, struct lock_file *lock,
+		      long timeout_ms)
+{
+	if (hold_lock_file_for_update_timeout(lock, st->list_file, 0,
+					      timeout_ms) < 0)
+		return errno == EEXIST ? REFTABLE_LOCK_ERROR : REFTABLE_IO_ERROR;
+	/* we own tables.list now: make sure we see its latest version */
+	return stack_reload(st, 1);
+}
+
+/*
+ * Write a table with the given callback into a temporary file, and
+ * rename it to its final name, which is returned in `name`.
+ */
+static int stack_write_table(struct reftable_stack *st,
+			     uint64_t min_update_index,
+			     uint64_t max_update_index,
+			     int (*write_table)(struct reftable_writer *wr, void *arg),
+			     void *arg, struct strbuf *name)
+{
+	static unsigned counter;
+	struct strbuf path = STRBUF_INIT;
+	struct reftable_writer *wr;
+	struct tempfile *tmp;
+	uint64_t min, max;
+	int ret;
+
+	strbuf_addf(&path, "%s/tmp_table_XXXXXX", st->dir);
+	tmp = mks_tempfile_m(path.buf, 0666);
+	if (!tmp) {
+		strbuf_release(&path);
+		return REFTABLE_IO_ERROR;
+	}
+
+	wr = reftable_writer_new(get_tempfile_fd(tmp), &st->opts);
+	reftable_writer_set_limits(wr, min_update_index, max_update_index);
+	ret = write_table(wr, arg);
+	if (!ret)
+		ret = reftable_writer_close(wr);
+	writer_get_limits(wr, &min, &max);
+	reftable_writer_free(wr);
+	if (!ret && close_tempfile_gently(tmp) < 0)
+		ret = REFTABLE_IO_ERROR;
+	if (ret) {
+		delete_tempfile(&tmp);
+		strbuf_release(&path);
+		return ret;
+	}
+
+	strbuf_reset(name);
+	strbuf_addf(name, "0x%012"PRIx64"-0x%012"PRIx64"-%08x.ref", min, max,
+		    (unsigned)(getpid() * 1000003u + counter++) ^ (unsigned)time(NULL));
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/%s", st->dir, name->buf);
+	if (rename_tempfile(&tmp, path.buf) < 0)
+		ret = REFTABLE_IO_ERROR;
+	else
+		adjust_shared_perm(path.buf);
+	strbuf_release(&path);
+	return ret;
+}
+
+static void unlink_tables(struct reftable_stack *st,
+			  const struct string_list *names)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < names->nr; i++) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", st->dir, names->items[i].string);
+		unlink_or_warn(path.buf);
+	}
+	strbuf_release(&path);
+}
+
+/* Replace the contents of the locked tables.list with `names`. */
+static int stack_commit_list(struct reftable_stack *st, struct lock_file *lock,
+			     const struct string_list *names)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < names->nr; i++)
+		strbuf_addf(&buf, "%s\n", names->items[i].string);
+	if (write_in_full(get_lock_file_fd(lock), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(lock) < 0)
+		ret = REFTABLE_IO_ERROR;
+	strbuf_release(&buf);
+	if (!ret)
+		ret = stack_reload(st, 1);
+	return ret;
+}
+
+struct reftable_addition {
+	struct reftable_stack *st;
+	struct lock_file lock;
+	struct string_list new_tables;
+	uint64_t next_update_index;
+};
+
+int reftable_stack_new_addition(struct reftable_addition **out,
+				struct reftable_stack *st)
+{
+	struct reftable_addition *add = xcalloc(1, sizeof(*add));
+	int ret;
+
+	add->st = st;
+	string_list_init(&add->new_tables, 1);
+	ret = stack_lock(st, &add->lock, st->opts.lock_timeout_ms);
+	if (ret) {
+		reftable_addition_destroy(add);
+		return ret;
+	}
+	add->next_update_index = reftable_stack_next_update_index(st);
+	*out = add;
+	return 0;
+}
+
+int reftable_addition_add(struct reftable_addition *add,
+			  int (*write_table)(struct reftable_writer *wr, void *arg),
+			  void *arg)
+{
+	struct strbuf name = STRBUF_INIT;
+	uint64_t idx = add->next_update_index;
+	int ret;
+
+	ret = stack_write_table(add->st, idx, idx, write_table, arg, &name);
+	if (!ret) {
+		string_list_append(&add->new_tables, name.buf);
+		add->next_update_index++;
+	}
+	strbuf_release(&name);
+	return ret;
+}
+
+int reftable_addition_commit(struct reftable_addition *add)
+{
+	struct reftable_stack *st = add->st;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	size_t i;
+	int ret;
+
+	if (!add->new_tables.nr) {
+		rollback_lock_file(&add->lock);
+		return 0;
+	}
+
+	for (i = 0; i < st->nr; i++)
+		string_list_append(&names, reftable_reader_name(st->readers[i]));
+	for (i = 0; i < add->new_tables.nr; i++)
+		string_list_append(&names, add->new_tables.items[i].string);
+	ret = stack_commit_list(st, &add->lock, &names);
+	string_list_clear(&names, 0);
+	if (ret)
+		return ret;
+
+	/* the tables belong to the stack now */
+	string_list_clear(&add->new_tables, 0);
+	if (!st->opts.disable_auto_compact)
+		reftable_stack_auto_compact(st);
+	return 0;
+}
+
+void reftable_addition_destroy(struct reftable_addition *add)
+{
+	if (!add)
+		return;
+	unlink_tables(add->st, &add->new_tables);
+	string_list_clear(&add->new_tables, 0);
+	rollback_lock_file(&add->lock);
+	free(add);
+}
+
+int reftable_stack_add(struct reftable_stack *st,
+		       int (*write_table)(struct reftable_writer *wr, void *arg),
+		       void *arg)
+{
+	struct reftable_addition *add = NULL;
+	int ret;
+
+	ret = reftable_stack_new_addition(&add, st);
+	if (!ret)
+		ret = reftable_addition_add(add, write_table, arg);
+	if (!ret)
+		ret = reftable_addition_commit(add);
+	reftable_addition_destroy(add);
+	return ret;
+}
+
+static int write_merged_table(struct reftable_writer *wr, void *arg)
+{
+	struct reftable_merged_table *mt = arg;
+	struct reftable_iterator it = REFTABLE_ITERATOR_INIT;
+	struct strbuf key = STRBUF_INIT;
+	struct reftable_record rec;
+	int ret;
+
+	reftable_record_init(&rec, BLOCK_TYPE_REF);
+	ret = merged_table_seek(mt, &it, BLOCK_TYPE_REF, &key);
+	while (!ret && !(ret = iterator_next(&it, &rec)))
+		ret = reftable_writer_add_ref(wr, &rec.u.ref);
+	reftable_iterator_destroy(&it);
+	reftable_record_release(&rec);
+	if (ret < 0)
+		goto out;
+
+	reftable_record_init(&rec, BLOCK_TYPE_LOG);
+	ret = merged_table_seek(mt, &it, BLOCK_TYPE_LOG, &key);
+	while (!ret && !(ret = iterator_next(&it, &rec)))
+		ret = reftable_writer_add_log(wr, &rec.u.log);
+	reftable_iterator_destroy(&it);
+	reftable_record_release(&rec);
+out:
+	strbuf_release(&key);
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Merge the tables first..last, inclusive, into one. The caller holds
+ * the lock on tables.list, and keeps holding it while the new table
+ * is written, so that the stack cannot change under us.
+ */
+static int stack_compact_range(struct reftable_stack *st,
+			       struct lock_file *lock,
+			       size_t first, size_t last)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct string_list old = STRING_LIST_INIT_DUP;
+	struct reftable_merged_table *mt;
+	struct strbuf name = STRBUF_INIT;
+	size_t i;
+	int ret;
+
+	mt = reftable_merged_table_new(st->readers + first, last - first + 1,
+				       st->opts.hash_id);
+	/* tombstones below the merged range still have to shadow it */
+	mt->suppress_deletions = !first;
+	ret = stack_write_table(st,
+				reftable_reader_min_update_index(st->readers[first]),
+				reftable_reader_max_update_index(st->readers[last]),
+				write_merged_table, mt, &name);
+	reftable_merged_table_decref(mt);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < st->nr; i++) {
+		const char *table = reftable_reader_name(st->readers[i]);
+
+		if (i < first || i > last)
+			string_list_append(&names, table);
+		else
+			string_list_append(&old, table);
+		if (i == last)
+			string_list_append(&names, name.buf);
+	}
+	ret = stack_commit_list(st, lock, &names);
+	if (ret) {
+		string_list_clear(&old, 0);
+		string_list_append(&old, name.buf);
+	}
+	/* readers that still have the old tables mapped keep them */
+	unlink_tables(st, &old);
+
+out:
+	string_list_clear(&names, 0);
+	string_list_clear(&old, 0);
+	strbuf_release(&name);
+	return ret;
+}
+
+int reftable_stack_compact_all(struct reftable_stack *st)
+{
+	struct lock_file lock = LOCK_INIT;
+	int ret;
+
+	ret = stack_lock(st, &lock, st->opts.lock_timeout_ms);
+	if (!ret && st->nr > 1)
+		ret = stack_compact_range(st, &lock, 0, st->nr - 1);
+	rollback_lock_file(&lock);
+	return ret;
+}
+
+int reftable_stack_auto_compact(struct reftable_stack *st)
+{
+	struct lock_file lock = LOCK_INIT;
+	uint64_t sum;
+	size_t first;
+	int ret;
+
+	/* somebody else is busy with the stack; leave it to them */
+	ret = stack_lock(st, &lock, 0);
+	if (ret) {
+		rollback_lock_file(&lock);
+		return ret == REFTABLE_LOCK_ERROR ? 0 : ret;
+	}
+
+	/*
+	 * Starting from the newest table, fold in older tables for as
+	 * long as they are not at least twice as large as the tables
+	 * folded so far.
+	 */
+	if (st->nr > 1) {
+		first = st->nr - 1;
+		sum = reftable_reader_size(st->readers[first]);
+		while (first &&
+		       reftable_reader_size(st->readers[first - 1]) < 2 * sum) {
+			first--;
+			sum += reftable_reader_size(st->readers[first]);
+		}
+		if (first < st->nr - 1)
+			ret = stack_compact_range(st, &lock, first, st->nr - 1);
+	}
+	rollback_lock_file(&lock);
+	return ret;
+}
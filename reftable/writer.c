@@ -0,0 +1,436 @@
+#include "cache.h"
+#include "block.h"
+#include "reader.h"
+#include "writer.h"
+
+struct obj_entry {
+	unsigned char hash[GIT_MAX_RAWSZ];
+	uint64_t offset;
+};
+
+struct reftable_writer {
+	int fd;
+	struct reftable_write_options opts;
+	int version;
+	int hash_size;
+	uint64_t min_update_index, max_update_index;
+
+	/* file offset of the next block */
+	uint64_t next;
+	/* the section being written: 0, or a block type */
+	uint8_t section;
+	struct strbuf last_key;
+
+	struct block_writer bw;
+	int bw_active;
+
+	/* last key and offset of the blocks of the current section */
+	struct reftable_index_record *index;
+	size_t index_nr, index_alloc;
+
+	/* object names of the refs, for the obj section */
+	struct obj_entry *objs;
+	size_t objs_nr, objs_alloc;
+
+	uint64_t ref_index_off, obj_off, obj_index_off, log_off, log_index_off;
+	int obj_id_len;
+	size_t ref_blocks;
+	size_t records;
+	int closed;
+};
+
+struct reftable_writer *reftable_writer_new(int fd,
+					    const struct reftable_write_options *opts)
+{
+	struct reftable_writer *w = xcalloc(1, sizeof(*w));
+	int algo;
+
+	w->fd = fd;
+	if (opts)
+		w->opts = *opts;
+	if (!w->opts.block_size)
+		w->opts.block_size = REFTABLE_DEFAULT_BLOCK_SIZE;
+	if (!w->opts.restart_interval)
+		w->opts.restart_interval = REFTABLE_DEFAULT_RESTART_INTERVAL;
+	if (!w->opts.hash_id)
+		w->opts.hash_id = REFTABLE_SHA1_ID;
+
+	algo = hash_algo_by_id(w->opts.hash_id);
+	if (algo == GIT_HASH_UNKNOWN)
+		BUG("unknown hash id %08x for reftable", w->opts.hash_id);
+	w->hash_size = hash_algos[algo].rawsz;
+	w->version = w->opts.hash_id == REFTABLE_SHA1_ID ? 1 : 2;
+	strbuf_init(&w->last_key, 0);
+	return w;
+}
+
+void reftable_writer_set_limits(struct reftable_writer *w,
+				uint64_t min_update_index,
+				uint64_t max_update_index)
+{
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+}
+
+void writer_get_limits(struct reftable_writer *w, uint64_t *min, uint64_t *max)
+{
+	*min = w->min_update_index;
+	*max = w->max_update_index;
+}
+
+size_t reftable_writer_records(struct reftable_writer *w)
+{
+	return w->records;
+}
+
+static void write_header(struct reftable_writer *w, unsigned char *dest)
+{
+	memcpy(dest, "REFT", 4);
+	dest[4] = w->version;
+	/* blocks are not aligned, so there is no block size to record */
+	put_be24(dest + 5, 0);
+	put_be64(dest + 8, w->min_update_index);
+	put_be64(dest + 16, w->max_update_index);
+	if (w->version == 2)
+		put_be32(dest + 24, w->opts.hash_id);
+}
+
+static int writer_write(struct reftable_writer *w, const void *buf, size_t len)
+{
+	if (write_in_full(w->fd, buf, len) < 0)
+		return REFTABLE_IO_ERROR;
+	w->next += len;
+	return 0;
+}
+
+static int writer_flush_block(struct reftable_writer *w)
+{
+	struct reftable_index_record *idx;
+	int ret;
+
+	if (!w->bw_active)
+		return 0;
+	w->bw_active = 0;
+	if (!w->bw.entries) {
+		block_writer_release(&w->bw);
+		return 0;
+	}
+
+	ret = block_writer_finish(&w->bw);
+	if (ret)
+		goto out;
+	if (!w->next)
+		write_header(w, (unsigned char *)w->bw.buf.buf);
+
+	ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+	idx = &w->index[w->index_nr++];
+	strbuf_init(&idx->last_key, 0);
+	strbuf_addbuf(&idx->last_key, &w->bw.last_key);
+	idx->offset = w->next;
+
+	if (w->bw.type == BLOCK_TYPE_REF)
+		w->ref_blocks++;
+	ret = writer_write(w, w->bw.buf.buf, w->bw.buf.len);
+out:
+	block_writer_release(&w->bw);
+	return ret;
+}
+
+static int writer_add_record(struct reftable_writer *w,
+			     const struct reftable_record *rec)
+{
+	int ret;
+
+	if (w->bw_active && w->bw.type != rec->type) {
+		ret = writer_flush_block(w);
+		if (ret)
+			return ret;
+	}
+	if (!w->bw_active) {
+		block_writer_init(&w->bw, rec->type, w->opts.block_size,
+				  w->next ? 0 : header_size(w->version),
+				  w->hash_size, w->opts.restart_interval);
+		w->bw_active = 1;
+	}
+
+	if (!block_writer_add(&w->bw, rec))
+		return 0;
+	if (!w->bw.entries)
+		return REFTABLE_ENTRY_TOO_BIG;
+
+	ret = writer_flush_block(w);
+	if (ret)
+		return ret;
+	return writer_add_record(w, rec);
+}
+
+static void clear_index(struct reftable_writer *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->index_nr; i++)
+		strbuf_release(&w->index[i].last_key);
+	FREE_AND_NULL(w->index);
+	w->index_nr = w->index_alloc = 0;
+}
+
+/*
+ * Flush the last block of a section and, if the section spans more
+ * than one block, write an index over it. Index blocks are themselves
+ * indexed until a single root block remains.
+ */
+static int writer_finish_section(struct reftable_writer *w, uint64_t *index_off)
+{
+	int ret = writer_flush_block(w);
+
+	*index_off = 0;
+	while (!ret && w->index_nr > 1) {
+		struct reftable_index_record *level = w->index;
+		size_t i, nr = w->index_nr;
+		struct reftable_record rec = { .type = BLOCK_TYPE_INDEX };
+
+		w->index = NULL;
+		w->index_nr = w->index_alloc = 0;
+		for (i = 0; !ret && i < nr; i++) {
+			rec.u.idx = level[i];
+			ret = writer_add_record(w, &rec);
+		}
+		if (!ret)
+			ret = writer_flush_block(w);
+		if (!ret)
+			*index_off = w->index[0].offset;
+
+		for (i = 0; i < nr; i++)
+			strbuf_release(&level[i].last_key);
+		free(level);
+	}
+	clear_index(w);
+	return ret;
+}
+
+static int obj_entry_cmp(const void *a_, const void *b_)
+{
+	const struct obj_entry *a = a_, *b = b_;
+	int cmp = memcmp(a->hash, b->hash, GIT_MAX_RAWSZ);
+
+	if (cmp)
+		return cmp;
+	return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+static size_t common_prefix(const unsigned char *a, const unsigned char *b,
+			    size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len && a[i] == b[i]; i++)
+		;
+	return i;
+}
+
+/*
+ * Write the object-to-ref index: for every object name, abbreviated
+ * to the shortest length that is unique within this table, the
+ * positions of the ref blocks that hold refs pointing at it.
+ */
+static int writer_write_obj_section(struct reftable_writer *w)
+{
+	struct reftable_record rec = { .type = BLOCK_TYPE_OBJ };
+	size_t i, j, len = 2;
+	int ret = 0;
+
+	QSORT(w->objs, w->objs_nr, obj_entry_cmp);
+	for (i = 1; i < w->objs_nr; i++) {
+		size_t common = common_prefix(w->objs[i - 1].hash,
+					      w->objs[i].hash, w->hash_size);
+		if (common < w->hash_size && common + 1 > len)
+			len = common + 1;
+	}
+	w->obj_id_len = len;
+	w->obj_off = w->next;
+
+	for (i = 0; !ret && i < w->objs_nr; i = j) {
+		struct reftable_obj_record *obj = &rec.u.obj;
+
+		obj->hash_prefix = w->objs[i].hash;
+		obj->hash_prefix_len = len;
+		obj->offset_len = 0;
+		for (j = i; j < w->objs_nr &&
+			    !memcmp(w->objs[j].hash, w->objs[i].hash, w->hash_size);
+		     j++) {
+			if (obj->offset_len &&
+			    obj->offsets[obj->offset_len - 1] == w->objs[j].offset)
+				continue;
+			REALLOC_ARRAY(obj->offsets, obj->offset_len + 1);
+			obj->offsets[obj->offset_len++] = w->objs[j].offset;
+		}
+
+		ret = writer_add_record(w, &rec);
+		if (ret == REFTABLE_ENTRY_TOO_BIG) {
+			/* too many refs; readers have to scan all of them */
+			obj->offset_len = 0;
+			ret = writer_add_record(w, &rec);
+		}
+		FREE_AND_NULL(obj->offsets);
+	}
+	if (!ret)
+		ret = writer_finish_section(w, &w->obj_index_off);
+	return ret;
+}
+
+static int writer_finish_refs(struct reftable_writer *w)
+{
+	int ret = writer_finish_section(w, &w->ref_index_off);
+
+	if (!ret && w->ref_blocks > 1 && !w->opts.skip_index_objects &&
+	    w->objs_nr)
+		ret = writer_write_obj_section(w);
+	FREE_AND_NULL(w->objs);
+	w->objs_nr = w->objs_alloc = 0;
+	return ret;
+}
+
+static int writer_check_key(struct reftable_writer *w,
+			    const struct reftable_record *rec)
+{
+	struct strbuf key = STRBUF_INIT;
+	int ret = 0;
+
+	reftable_record_key(rec, &key);
+	if (w->section == rec->type && strbuf_cmp(&w->last_key, &key) >= 0)
+		ret = REFTABLE_API_ERROR;
+	strbuf_swap(&w->last_key, &key);
+	strbuf_release(&key);
+	return ret;
+}
+
+static void add_obj(struct reftable_writer *w, const unsigned char *hash)
+{
+	ALLOC_GROW(w->objs, w->objs_nr + 1, w->objs_alloc);
+	memset(w->objs[w->objs_nr].hash, 0, GIT_MAX_RAWSZ);
+	memcpy(w->objs[w->objs_nr].hash, hash, w->hash_size);
+	/* the block the ref went into starts at w->next */
+	w->objs[w->objs_nr].offset = w->next;
+	w->objs_nr++;
+}
+
+int reftable_writer_add_ref(struct reftable_writer *w,
+			    const struct reftable_ref_record *ref)
+{
+	struct reftable_record rec = { .type = BLOCK_TYPE_REF };
+	int ret;
+
+	if (w->closed || (w->section && w->section != BLOCK_TYPE_REF) ||
+	    !ref->refname ||
+	    ref->update_index < w->min_update_index ||
+	    ref->update_index > w->max_update_index)
+		return REFTABLE_API_ERROR;
+	rec.u.ref = *ref;
+	ret = writer_check_key(w, &rec);
+	if (ret)
+		return ret;
+	w->section = BLOCK_TYPE_REF;
+
+	rec.u.ref.update_index -= w->min_update_index;
+	ret = writer_add_record(w, &rec);
+	if (ret)
+		return ret;
+
+	if (!w->opts.skip_index_objects) {
+		if (ref->value_type == REFTABLE_REF_VAL1 ||
+		    ref->value_type == REFTABLE_REF_VAL2)
+			add_obj(w, ref->value);
+		if (ref->value_type == REFTABLE_REF_VAL2)
+			add_obj(w, ref->peeled);
+	}
+	w->records++;
+	return 0;
+}
+
+int reftable_writer_add_log(struct reftable_writer *w,
+			    const struct reftable_log_record *log)
+{
+	struct reftable_record rec = { .type = BLOCK_TYPE_LOG };
+	int ret;
+
+	if (w->closed || !log->refname ||
+	    log->update_index < w->min_update_index ||
+	    log->update_index > w->max_update_index)
+		return REFTABLE_API_ERROR;
+
+	if (w->section == BLOCK_TYPE_REF) {
+		ret = writer_finish_refs(w);
+		if (ret)
+			return ret;
+	}
+	rec.u.log = *log;
+	ret = writer_check_key(w, &rec);
+	if (ret)
+		return ret;
+	if (w->section != BLOCK_TYPE_LOG) {
+		w->section = BLOCK_TYPE_LOG;
+		w->log_off = w->next;
+	}
+
+	ret = writer_add_record(w, &rec);
+	if (ret)
+		return ret;
+	w->records++;
+	return 0;
+}
+
+int reftable_writer_close(struct reftable_writer *w)
+{
+	unsigned char footer[FOOTER_SIZE_V2];
+	unsigned char *p = footer;
+	int hsize = header_size(w->version);
+	int ret = 0;
+
+	if (w->closed)
+		return REFTABLE_API_ERROR;
+	w->closed = 1;
+
+	if (w->section == BLOCK_TYPE_REF)
+		ret = writer_finish_refs(w);
+	else if (w->section == BLOCK_TYPE_LOG)
+		ret = writer_finish_section(w, &w->log_index_off);
+	if (ret)
+		return ret;
+
+	if (!w->next) {
+		/* an empty table is a header followed by the footer */
+		write_header(w, footer);
+		ret = writer_write(w, footer, hsize);
+		if (ret)
+			return ret;
+	}
+
+	write_header(w, p);
+	p += hsize;
+	put_be64(p, w->ref_index_off);
+	p += 8;
+	put_be64(p, (w->obj_off << 5) | w->obj_id_len);
+	p += 8;
+	put_be64(p, w->obj_index_off);
+	p += 8;
+	put_be64(p, w->log_off);
+	p += 8;
+	put_be64(p, w->log_index_off);
+	p += 8;
+	put_be32(p, crc32(0, footer, p - footer));
+	p += 4;
+
+	return writer_write(w, footer, p - footer);
+}
+
+void reftable_writer_free(struct reftable_writer *w)
+{
+	if (!w)
+		return;
+	if (w->bw_active)
+		block_writer_release(&w->bw);
+	clear_index(w);
+	free(w->objs);
+	strbuf_release(&w->last_key);
+	free(w);
+}
@@ -0,0 +1,9 @@
+#ifndef REFTABLE_WRITER_H
+#define REFTABLE_WRITER_H
+
+#include "reftable.h"
+
+/* The update index range of the table being written. */
+void writer_get_limits(struct reftable_writer *w, uint64_t *min, uint64_t *max);
+
+#endif /* REFTABLE_WRITER_H */
@@ -1392,6 +1392,24 @@ static void parse_push(struct strbuf *buf)
 	strvec_clear(&specs);
 }
 
+static void parse_get(const char *arg)
+{
+	struct strbuf url = STRBUF_INIT;
+	const char *path = strchr(arg, ' ');
+
+	if (!path)
+		die(_("remote-curl: get requires a URL and a path"));
+	strbuf_add(&url, arg, path - arg);
+	path++;
+
+	if (http_get_file(url.buf, path, NULL) != HTTP_OK)
+		die(_("failed to download file at URL '%s'"), url.buf);
+
+	printf("\n");
+	fflush(stdout);
+	strbuf_release(&url);
+}
+
 static int stateless_connect(const char *service_name)
 {
 	struct discovery *discover;
@@ -1552,8 +1570,11 @@ int cmd_main(int argc, const char **argv)
 			printf("push\n");
 			printf("check-connectivity\n");
 			printf("object-format\n");
+			printf("get\n");
 			printf("\n");
 			fflush(stdout);
+		} else if (skip_prefix(buf.buf, "get ", &arg)) {
+			parse_get(arg);
 		} else if (skip_prefix(buf.buf, "stateless-connect ", &arg)) {
 			if (!stateless_connect(arg))
 				break;
@@ -0,0 +1,322 @@
+#include "cache.h"
+#include "repository.h"
+#include "config.h"
+#include "lockfile.h"
+#include "object-store.h"
+#include "hashmap.h"
+#include "rename-cache.h"
+
+/*
+ * The file starts with a header
+ *
+ *   4-byte signature "RNCA"
+ *   4-byte version number (1)
+ *   4-byte hash format id
+ *   4-byte number of entries
+ *
+ * which is followed by the entries, sorted by the names of the two
+ * blobs:
+ *
+ *   name of the source blob (the_hash_algo->rawsz bytes)
+ *   name of the destination blob (the_hash_algo->rawsz bytes)
+ *   4-byte score
+ *
+ * All numbers are in network byte order.
+ */
+
+#define RENAME_CACHE_SIGNATURE 0x524e4341 /* "RNCA" */
+#define RENAME_CACHE_VERSION 1
+#define RENAME_CACHE_HEADER_SIZE 16
+
+enum rename_cache_mode {
+	RENAME_CACHE_OFF = 0,
+	RENAME_CACHE_MEMORY,
+	RENAME_CACHE_FILE,
+};
+
+struct new_score {
+	struct hashmap_entry ent;
+	struct object_id src;
+	struct object_id dst;
+	int score;
+};
+
+static struct rename_cache {
+	int initialized;
+	enum rename_cache_mode mode;
+
+	/* The entries read from the file, if any. */
+	const unsigned char *map;
+	size_t map_size;
+	const unsigned char *entries;
+	uint32_t nr;
+
+	/* Scores put since, to be written out. */
+	struct hashmap added;
+} cache;
+
+static size_t entry_size(void)
+{
+	return 2 * the_hash_algo->rawsz + 4;
+}
+
+static char *cache_path(struct repository *r)
+{
+	return xstrfmt("%s/info/rename-cache", r->objects->odb->path);
+}
+
+static int new_score_cmp(const void *unused_cmp_data,
+			 const struct hashmap_entry *eptr,
+			 const struct hashmap_entry *entry_or_key,
+			 const void *unused_keydata)
+{
+	const struct new_score *a, *b;
+
+	a = container_of(eptr, const struct new_score, ent);
+	b = container_of(entry_or_key, const struct new_score, ent);
+	return !oideq(&a->src, &b->src) || !oideq(&a->dst, &b->dst);
+}
+
+static unsigned int pair_hash(const struct object_id *src,
+			      const struct object_id *dst)
+{
+	return oidhash(src) ^ oidhash(dst);
+}
+
+static enum rename_cache_mode read_mode(struct repository *r)
+{
+	const char *value;
+
+	if (repo_config_get_string_tmp(r, "diff.renamecache", &value))
+		return RENAME_CACHE_OFF;
+	if (!strcasecmp(value, "memory"))
+		return RENAME_CACHE_MEMORY;
+	switch (git_parse_maybe_bool(value)) {
+	case 0:
+		return RENAME_CACHE_OFF;
+	case 1:
+		return RENAME_CACHE_FILE;
+	default:
+		die(_("invalid value for '%s': '%s'"), "diff.renameCache", value);
+	}
+}
+
+static void write_cache(struct repository *r);
+
+static void write_cache_atexit(void)
+{
+	write_cache(the_repository);
+}
+
+static void read_cache(struct repository *r)
+{
+	char *path;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	if (cache.initialized)
+		return;
+	cache.initialized = 1;
+	hashmap_init(&cache.added, new_score_cmp, NULL, 0);
+	cache.mode = read_mode(r);
+	if (cache.mode != RENAME_CACHE_FILE)
+		return;
+	atexit(write_cache_atexit);
+
+	path = cache_path(r);
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) < 0 ||
+	    (size = xsize_t(st.st_size)) < RENAME_CACHE_HEADER_SIZE) {
+		close(fd);
+		return;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32((unsigned char *)map) != RENAME_CACHE_SIGNATURE ||
+	    get_be32((unsigned char *)map + 4) != RENAME_CACHE_VERSION ||
+	    get_be32((unsigned char *)map + 8) != the_hash_algo->format_id ||
+	    (size - RENAME_CACHE_HEADER_SIZE) / entry_size() !=
+	    get_be32((unsigned char *)map + 12) ||
+	    (size - RENAME_CACHE_HEADER_SIZE) % entry_size()) {
+		warning(_("ignoring malformed rename cache"));
+		munmap(map, size);
+		return;
+	}
+
+	cache.map = map;
+	cache.map_size = size;
+	cache.entries = cache.map + RENAME_CACHE_HEADER_SIZE;
+	cache.nr = get_be32(cache.map + 12);
+}
+
+int rename_cache_enabled(struct repository *r)
+{
+	if (r != the_repository)
+		return 0;
+	read_cache(r);
+	return cache.mode != RENAME_CACHE_OFF;
+}
+
+static int cmp_entry(const unsigned char *p, const struct object_id *src,
+		     const struct object_id *dst)
+{
+	int cmp = hashcmp(p, src->hash);
+
+	if (cmp)
+		return cmp;
+	return hashcmp(p + the_hash_algo->rawsz, dst->hash);
+}
+
+static const unsigned char *find_entry(const struct object_id *src,
+				       const struct object_id *dst)
+{
+	size_t esz = entry_size();
+	uint32_t lo = 0, hi = cache.nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *p = cache.entries + mi * esz;
+		int cmp = cmp_entry(p, src, dst);
+
+		if (!cmp)
+			return p;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+static struct new_score *find_added(const struct object_id *src,
+				    const struct object_id *dst)
+{
+	struct new_score key;
+
+	hashmap_entry_init(&key.ent, pair_hash(src, dst));
+	oidcpy(&key.src, src);
+	oidcpy(&key.dst, dst);
+	return hashmap_get_entry(&cache.added, &key, ent, NULL);
+}
+
+int rename_cache_get(struct repository *r,
+		     const struct object_id *src, const struct object_id *dst,
+		     int *score)
+{
+	const struct new_score *added;
+	const unsigned char *p;
+
+	if (!rename_cache_enabled(r))
+		return -1;
+	p = find_entry(src, dst);
+	if (p) {
+		*score = get_be32(p + 2 * the_hash_algo->rawsz);
+		return 0;
+	}
+	added = find_added(src, dst);
+	if (added) {
+		*score = added->score;
+		return 0;
+	}
+	return -1;
+}
+
+void rename_cache_put(struct repository *r,
+		      const struct object_id *src, const struct object_id *dst,
+		      int score)
+{
+	struct new_score *added;
+
+	if (!rename_cache_enabled(r))
+		return;
+	if (find_entry(src, dst) || find_added(src, dst))
+		return;
+	added = xcalloc(1, sizeof(*added));
+	hashmap_entry_init(&added->ent, pair_hash(src, dst));
+	oidcpy(&added->src, src);
+	oidcpy(&added->dst, dst);
+	added->score = score;
+	hashmap_add(&cache.added, &added->ent);
+}
+
+static int new_score_sort_cmp(const void *va, const void *vb)
+{
+	const struct new_score *a = *(const struct new_score **)va;
+	const struct new_score *b = *(const struct new_score **)vb;
+	int cmp = oidcmp(&a->src, &b->src);
+
+	return cmp ? cmp : oidcmp(&a->dst, &b->dst);
+}
+
+/*
+ * Write out the scores added since the cache was read, merged with the
+ * ones read. Failing to do so is not an error, as the cache is only an
+ * optimization.
+ */
+static void write_cache(struct repository *r)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf out = STRBUF_INIT;
+	struct new_score **added, *e;
+	struct hashmap_iter iter;
+	size_t esz = entry_size();
+	size_t nr_added = 0, i = 0, j = 0, nr;
+	unsigned char header[RENAME_CACHE_HEADER_SIZE];
+	char *path;
+	int fd;
+
+	if (!hashmap_get_size(&cache.added))
+		return;
+
+	ALLOC_ARRAY(added, hashmap_get_size(&cache.added));
+	hashmap_for_each_entry(&cache.added, &iter, e, ent)
+		added[nr_added++] = e;
+	QSORT(added, nr_added, new_score_sort_cmp);
+
+	nr = cache.nr + nr_added;
+	put_be32(header, RENAME_CACHE_SIGNATURE);
+	put_be32(header + 4, RENAME_CACHE_VERSION);
+	put_be32(header + 8, the_hash_algo->format_id);
+	put_be32(header + 12, nr);
+	strbuf_grow(&out, RENAME_CACHE_HEADER_SIZE + nr * esz);
+	strbuf_add(&out, header, sizeof(header));
+
+	/* merge the new entries into the old ones */
+	while (i < cache.nr || j < nr_added) {
+		const unsigned char *p = cache.entries + i * esz;
+
+		if (j == nr_added ||
+		    (i < cache.nr &&
+		     cmp_entry(p, &added[j]->src, &added[j]->dst) < 0)) {
+			strbuf_add(&out, p, esz);
+			i++;
+		} else {
+			unsigned char score[4];
+
+			put_be32(score, added[j]->score);
+			strbuf_add(&out, added[j]->src.hash, the_hash_algo->rawsz);
+			strbuf_add(&out, added[j]->dst.hash, the_hash_algo->rawsz);
+			strbuf_add(&out, score, sizeof(score));
+			j++;
+		}
+	}
+
+	path = cache_path(r);
+	if (safe_create_leading_directories(path) >= 0) {
+		fd = hold_lock_file_for_update(&lk, path, 0);
+		if (fd >= 0 &&
+		    (write_in_full(fd, out.buf, out.len) < 0 ||
+		     commit_lock_file(&lk) < 0))
+			rollback_lock_file(&lk);
+	}
+
+	free(path);
+	free(added);
+	strbuf_release(&out);
+}
@@ -0,0 +1,38 @@
+#ifndef RENAME_CACHE_H
+#define RENAME_CACHE_H
+
+#include "hash.h"
+
+struct repository;
+
+/*
+ * The rename cache remembers the similarity score (between 0 and
+ * MAX_SCORE) that inexact rename detection computed for a pair of
+ * blobs, so that it does not have to read and compare them again.
+ *
+ * With `diff.renameCache` set to "memory", the scores are only kept
+ * for the rest of the process, which helps commands like rebase that
+ * detect renames in many similar diffs. If it is set to true, they
+ * are also kept in "$GIT_DIR/objects/info/rename-cache" across
+ * processes; the ones added are written out when the process exits.
+ *
+ * The caller must only look up and put scores that depend on nothing
+ * but the contents of the two blobs. Once rename_cache_enabled() has
+ * returned true, rename_cache_get() may be called on several threads
+ * at once, as long as rename_cache_put() is not.
+ */
+
+/* Is `diff.renameCache` set for `r`? */
+int rename_cache_enabled(struct repository *r);
+
+/* Look up the pair. Return 0 and fill `score` if it was found. */
+int rename_cache_get(struct repository *r,
+		     const struct object_id *src, const struct object_id *dst,
+		     int *score);
+
+/* Remember the score of the pair. */
+void rename_cache_put(struct repository *r,
+		      const struct object_id *src, const struct object_id *dst,
+		      int score);
+
+#endif /* RENAME_CACHE_H */
@@ -29,6 +29,8 @@ void prepare_repo_settings(struct repository *r)
 
 	if (!repo_config_get_int(r, "index.version", &value))
 		r->settings.index_version = value;
+	if (!repo_config_get_bool(r, "index.skiphash", &value))
+		r->settings.index_skip_hash = value;
 	if (!repo_config_get_maybe_bool(r, "core.untrackedcache", &value)) {
 		if (value == 0)
 			r->settings.core_untracked_cache = UNTRACKED_CACHE_REMOVE;
@@ -44,6 +46,8 @@ void prepare_repo_settings(struct repository *r)
 	if (!repo_config_get_string(r, "fetch.negotiationalgorithm", &strval)) {
 		if (!strcasecmp(strval, "skipping"))
 			r->settings.fetch_negotiation_algorithm = FETCH_NEGOTIATION_SKIPPING;
+		else if (!strcasecmp(strval, "generation"))
+			r->settings.fetch_negotiation_algorithm = FETCH_NEGOTIATION_GENERATION;
 		else if (!strcasecmp(strval, "noop"))
 			r->settings.fetch_negotiation_algorithm = FETCH_NEGOTIATION_NOOP;
 		else
@@ -61,13 +65,19 @@ void prepare_repo_settings(struct repository *r)
 
 	if (!repo_config_get_bool(r, "core.usebuiltinfsmonitor", &value) && value)
 		r->settings.use_builtin_fsmonitor = 1;
+	if (!repo_config_get_bool(r, "core.fsmonitoruntrackedcache", &value))
+		r->settings.fsmonitor_untracked_cache = value;
+	UPDATE_DEFAULT_BOOL(r->settings.fsmonitor_untracked_cache, 0);
 
 	if (!repo_config_get_bool(r, "feature.manyfiles", &value) && value) {
 		feature_many_files = 1;
 		UPDATE_DEFAULT_BOOL(r->settings.index_version, 4);
+		UPDATE_DEFAULT_BOOL(r->settings.index_skip_hash, 1);
 		UPDATE_DEFAULT_BOOL(r->settings.core_untracked_cache, UNTRACKED_CACHE_WRITE);
 	}
 
+	UPDATE_DEFAULT_BOOL(r->settings.index_skip_hash, 0);
+
 	if (!repo_config_get_bool(r, "fetch.writecommitgraph", &value))
 		r->settings.fetch_write_commit_graph = value;
 	UPDATE_DEFAULT_BOOL(r->settings.fetch_write_commit_graph, 0);
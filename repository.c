@@ -26,6 +26,7 @@ void initialize_the_repository(void)
 	the_repo.parsed_objects = parsed_object_pool_new();
 
 	repo_set_hash_algo(&the_repo, GIT_HASH_SHA1);
+	repo_set_ref_storage_format(&the_repo, REF_STORAGE_FORMAT_FILES);
 }
 
 static void expand_base_dir(char **out, const char *in,
@@ -92,6 +93,12 @@ void repo_set_hash_algo(struct repository *repo, int hash_algo)
 	repo->hash_algo = &hash_algos[hash_algo];
 }
 
+void repo_set_ref_storage_format(struct repository *repo,
+				 enum ref_storage_format format)
+{
+	repo->ref_storage_format = format;
+}
+
 /*
  * Attempt to resolve and set the provided 'gitdir' for repository 'repo'.
  * Return 0 upon success and a non-zero value upon failure.
@@ -171,6 +178,7 @@ int repo_init(struct repository *repo,
 		goto error;
 
 	repo_set_hash_algo(repo, format.hash_algo);
+	repo_set_ref_storage_format(repo, format.ref_storage_format);
 
 	if (worktree)
 		repo_set_worktree(repo, worktree);
@@ -260,10 +268,8 @@ void repo_clear(struct repository *repo)
 	}
 }
 
-int repo_read_index(struct repository *repo)
+static struct index_state *repo_index(struct repository *repo)
 {
-	int res;
-
 	if (!repo->index)
 		CALLOC_ARRAY(repo->index, 1);
 
@@ -273,7 +279,29 @@ int repo_read_index(struct repository *repo)
 	else if (repo->index->repo != repo)
 		BUG("repo's index should point back at itself");
 
-	res = read_index_from(repo->index, repo->index_file, repo->gitdir);
+	return repo->index;
+}
+
+int repo_read_index(struct repository *repo)
+{
+	int res;
+
+	res = read_index_from(repo_index(repo), repo->index_file, repo->gitdir);
+
+	prepare_repo_settings(repo);
+	if (repo->settings.command_requires_full_index)
+		ensure_full_index(repo->index);
+
+	return res;
+}
+
+int repo_read_index_prefix(struct repository *repo,
+			   const char *prefix, size_t prefixlen)
+{
+	int res;
+
+	res = read_index_prefix_from(repo_index(repo), repo->index_file,
+				     repo->gitdir, prefix, prefixlen);
 
 	prepare_repo_settings(repo);
 	if (repo->settings.command_requires_full_index)
@@ -5,6 +5,12 @@
 
 struct config_set;
 struct git_hash_algo;
+
+enum ref_storage_format {
+	REF_STORAGE_FORMAT_UNKNOWN,
+	REF_STORAGE_FORMAT_FILES,
+	REF_STORAGE_FORMAT_REFTABLE,
+};
 struct index_state;
 struct lock_file;
 struct pathspec;
@@ -24,12 +30,14 @@ enum fetch_negotiation_setting {
 	FETCH_NEGOTIATION_DEFAULT = 1,
 	FETCH_NEGOTIATION_SKIPPING = 2,
 	FETCH_NEGOTIATION_NOOP = 3,
+	FETCH_NEGOTIATION_GENERATION = 4,
 };
 
 struct repo_settings {
 	int initialized;
 
 	int use_builtin_fsmonitor;
+	int fsmonitor_untracked_cache;
 
 	int core_commit_graph;
 	int commit_graph_read_changed_paths;
@@ -37,6 +45,7 @@ struct repo_settings {
 	int fetch_write_commit_graph;
 
 	int index_version;
+	int index_skip_hash;
 	enum untracked_cache_setting core_untracked_cache;
 
 	int pack_use_sparse;
@@ -135,6 +144,9 @@ struct repository {
 	/* Repository's current hash algorithm, as serialized on disk. */
 	const struct git_hash_algo *hash_algo;
 
+	/* Repository's reference storage format, as serialized on disk. */
+	enum ref_storage_format ref_storage_format;
+
 	/* A unique-id for tracing purposes. */
 	int trace2_repo_id;
 
@@ -165,6 +177,8 @@ void repo_set_gitdir(struct repository *repo, const char *root,
 		     const struct set_gitdir_args *extra_args);
 void repo_set_worktree(struct repository *repo, const char *path);
 void repo_set_hash_algo(struct repository *repo, int algo);
+void repo_set_ref_storage_format(struct repository *repo,
+				 enum ref_storage_format format);
 void initialize_the_repository(void);
 int repo_init(struct repository *r, const char *gitdir, const char *worktree);
 
@@ -189,6 +203,14 @@ void repo_clear(struct repository *repo);
  * populated then the number of entries will simply be returned.
  */
 int repo_read_index(struct repository *repo);
+
+/*
+ * Like repo_read_index(), but may leave out the entries whose names do
+ * not start with the first `prefixlen` bytes of `prefix`; see
+ * read_index_prefix_from(). For read-only commands only.
+ */
+int repo_read_index_prefix(struct repository *repo,
+			   const char *prefix, size_t prefixlen);
 int repo_hold_locked_index(struct repository *repo,
 			   struct lock_file *lf,
 			   int flags);
@@ -152,6 +152,264 @@ static struct rerere_dir *find_rerere_dir(const char *hex)
 	return rr_dir;
 }
 
+/*
+ * With rerere.packed, "git rerere gc" moves the conflicts that are
+ * not being resolved into a packed store of two files, instead of a
+ * directory per conflict.
+ *
+ * "rr-cache/packed" holds the records. It starts with a header
+ *
+ *   4-byte signature "RRPK"
+ *   4-byte version number (1)
+ *   4-byte hash format id
+ *
+ * followed by records, which are only ever appended, of
+ *
+ *   conflict ID (the_hash_algo->rawsz bytes)
+ *   4-byte variant
+ *   4-byte length of the preimage
+ *   4-byte length of the postimage, or 0xffffffff if there is none
+ *   the preimage and the postimage
+ *
+ * "rr-cache/packed.idx" lists the records that are still live:
+ *
+ *   4-byte signature "RRPI"
+ *   4-byte version number (1)
+ *   4-byte hash format id
+ *   4-byte number of entries
+ *
+ * followed by the entries, sorted by conflict ID and variant, of
+ *
+ *   conflict ID
+ *   4-byte variant
+ *   8-byte time the preimage was recorded
+ *   8-byte time the postimage was last used, or 0
+ *   8-byte offset of the record in "rr-cache/packed"
+ *
+ * All numbers are in network byte order.
+ *
+ * A conflict is either packed or loose. When a packed conflict is met
+ * again, its records are unpacked into its directory, together with an
+ * "unpacked" file. That file keeps the directory even when it has no
+ * variants left, so that "gc" knows that the records are stale.
+ */
+#define PACKED_RERERE_SIGNATURE 0x5252504b /* "RRPK" */
+#define PACKED_RERERE_IDX_SIGNATURE 0x52525049 /* "RRPI" */
+#define PACKED_RERERE_VERSION 1
+#define PACKED_RERERE_HEADER_SIZE 12
+#define PACKED_RERERE_IDX_HEADER_SIZE 16
+#define PACKED_RERERE_NO_POSTIMAGE 0xffffffff
+
+static GIT_PATH_FUNC(git_path_packed_rerere, "rr-cache/packed")
+static GIT_PATH_FUNC(git_path_packed_rerere_idx, "rr-cache/packed.idx")
+
+static struct packed_rerere {
+	int loaded;
+	const unsigned char *idx;
+	size_t idx_size;
+	const unsigned char *data;
+	size_t data_size;
+	uint32_t nr;
+} packed_rerere;
+
+static size_t packed_rerere_entry_size(void)
+{
+	return the_hash_algo->rawsz + 28;
+}
+
+static const unsigned char *packed_rerere_entry(uint32_t i)
+{
+	return packed_rerere.idx + PACKED_RERERE_IDX_HEADER_SIZE +
+		st_mult(i, packed_rerere_entry_size());
+}
+
+static const unsigned char *map_packed_rerere_file(const char *path,
+						   size_t *size)
+{
+	struct stat st;
+	void *map;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	*size = xsize_t(st.st_size);
+	map = xmmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return map;
+}
+
+static void unload_packed_rerere(void)
+{
+	if (packed_rerere.idx)
+		munmap((void *)packed_rerere.idx, packed_rerere.idx_size);
+	if (packed_rerere.data)
+		munmap((void *)packed_rerere.data, packed_rerere.data_size);
+	memset(&packed_rerere, 0, sizeof(packed_rerere));
+}
+
+/* Return 1 if there is a usable packed store. */
+static int load_packed_rerere(void)
+{
+	struct packed_rerere *p = &packed_rerere;
+
+	if (p->loaded)
+		return !!p->idx;
+	p->loaded = 1;
+
+	p->idx = map_packed_rerere_file(git_path_packed_rerere_idx(),
+					&p->idx_size);
+	if (!p->idx)
+		return 0;
+	p->data = map_packed_rerere_file(git_path_packed_rerere(),
+					 &p->data_size);
+	if (p->idx_size < PACKED_RERERE_IDX_HEADER_SIZE ||
+	    get_be32(p->idx) != PACKED_RERERE_IDX_SIGNATURE ||
+	    get_be32(p->idx + 4) != PACKED_RERERE_VERSION ||
+	    get_be32(p->idx + 8) != the_hash_algo->format_id ||
+	    p->idx_size != PACKED_RERERE_IDX_HEADER_SIZE +
+			   st_mult(get_be32(p->idx + 12),
+				   packed_rerere_entry_size()) ||
+	    !p->data || p->data_size < PACKED_RERERE_HEADER_SIZE ||
+	    get_be32(p->data) != PACKED_RERERE_SIGNATURE ||
+	    get_be32(p->data + 4) != PACKED_RERERE_VERSION ||
+	    get_be32(p->data + 8) != the_hash_algo->format_id) {
+		warning(_("ignoring malformed packed rerere store"));
+		unload_packed_rerere();
+		p->loaded = 1;
+		return 0;
+	}
+	p->nr = get_be32(p->idx + 12);
+	return 1;
+}
+
+/* Return the position of the first entry for "hash". */
+static uint32_t packed_rerere_lookup(const unsigned char *hash)
+{
+	uint32_t lo = 0, hi = packed_rerere.nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+
+		if (hashcmp(packed_rerere_entry(mi), hash) < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+/*
+ * Find the record of entry "i". Return its size, and point "pre" and
+ * "post" (NULL if there is no postimage) at its images, or return 0
+ * if it does not match the entry.
+ */
+static size_t packed_rerere_record(uint32_t i,
+				   const char **pre, size_t *pre_len,
+				   const char **post, size_t *post_len)
+{
+	const unsigned char *entry = packed_rerere_entry(i);
+	size_t rawsz = the_hash_algo->rawsz;
+	uint64_t offset = get_be64(entry + rawsz + 20);
+	const unsigned char *rec;
+	size_t avail, size = rawsz + 12;
+
+	if (offset < PACKED_RERERE_HEADER_SIZE ||
+	    offset > packed_rerere.data_size ||
+	    (avail = packed_rerere.data_size - offset) < size)
+		return 0;
+	rec = packed_rerere.data + offset;
+	if (!hasheq(rec, entry) ||
+	    get_be32(rec + rawsz) != get_be32(entry + rawsz))
+		return 0;
+
+	*pre_len = get_be32(rec + rawsz + 4);
+	*post_len = get_be32(rec + rawsz + 8);
+	*pre = (const char *)rec + size;
+	size += *pre_len;
+	if (*post_len == PACKED_RERERE_NO_POSTIMAGE) {
+		*post = NULL;
+		*post_len = 0;
+	} else {
+		*post = (const char *)rec + size;
+		size += *post_len;
+	}
+	return size <= avail ? size : 0;
+}
+
+static void write_rr_image(const char *path, const char *buf, size_t len,
+			   timestamp_t mtime)
+{
+	struct utimbuf times;
+
+	write_file_buf(path, buf, len);
+	times.actime = times.modtime = mtime;
+	if (utime(path, &times) < 0)
+		warning_errno(_("failed utime() on '%s'"), path);
+}
+
+/*
+ * Bring the packed records of a conflict that has no variants in its
+ * directory back into it.
+ */
+static void unpack_rerere_dir(struct rerere_dir *rr_dir)
+{
+	struct object_id oid;
+	struct rerere_id id;
+	const char *marker;
+	uint32_t i;
+	int fd;
+
+	for (i = 0; i < rr_dir->status_nr; i++)
+		if (rr_dir->status[i])
+			return;
+	if (!load_packed_rerere() || get_oid_hex(rr_dir->name, &oid))
+		return;
+	i = packed_rerere_lookup(oid.hash);
+	if (i >= packed_rerere.nr || !hasheq(packed_rerere_entry(i), oid.hash))
+		return;
+	marker = git_path("rr-cache/%s/unpacked", rr_dir->name);
+	if (file_exists(marker))
+		return;
+
+	id.collection = rr_dir;
+	if (mkdir_in_gitdir(rerere_path(&id, NULL)) ||
+	    (fd = open(marker, O_CREAT | O_WRONLY, 0666)) < 0) {
+		warning_errno(_("could not unpack rerere records of %s"),
+			      rr_dir->name);
+		return;
+	}
+	close(fd);
+
+	for (; i < packed_rerere.nr; i++) {
+		const unsigned char *entry = packed_rerere_entry(i);
+		size_t rawsz = the_hash_algo->rawsz;
+		const char *pre, *post;
+		size_t pre_len, post_len;
+
+		if (!hasheq(entry, oid.hash))
+			break;
+		if (!packed_rerere_record(i, &pre, &pre_len, &post, &post_len))
+			continue;
+		if (get_be32(entry + rawsz) > INT_MAX)
+			continue;
+		id.variant = get_be32(entry + rawsz);
+		fit_variant(rr_dir, id.variant);
+		write_rr_image(rerere_path(&id, "preimage"), pre, pre_len,
+			       get_be64(entry + rawsz + 4));
+		rr_dir->status[id.variant] |= RR_HAS_PREIMAGE;
+		if (post) {
+			write_rr_image(rerere_path(&id, "postimage"),
+				       post, post_len,
+				       get_be64(entry + rawsz + 12));
+			rr_dir->status[id.variant] |= RR_HAS_POSTIMAGE;
+		}
+	}
+}
+
 static int has_rerere_resolution(const struct rerere_id *id)
 {
 	const int both = RR_HAS_POSTIMAGE|RR_HAS_PREIMAGE;
@@ -166,6 +424,7 @@ static struct rerere_id *new_rerere_id_hex(char *hex)
 {
 	struct rerere_id *id = xmalloc(sizeof(*id));
 	id->collection = find_rerere_dir(hex);
+	unpack_rerere_dir(id->collection);
 	id->variant = -1; /* not known yet */
 	return id;
 }
@@ -1170,12 +1429,269 @@ static int is_rr_cache_dirname(const char *path)
 	return !parse_oid_hex(path, &oid, &end) && !*end;
 }
 
+struct packed_rerere_entry {
+	unsigned char hash[GIT_MAX_RAWSZ];
+	uint32_t variant;
+	timestamp_t created, last_used;
+	uint64_t offset;
+	/* a kept record in the old store, or NULL for a new one */
+	const char *rec;
+	size_t rec_len;
+};
+
+struct packed_rerere_update {
+	struct packed_rerere_entry *entries;
+	size_t nr, alloc;
+	/* the new records, which "offset" of new entries point into */
+	struct strbuf records;
+	int changed;
+};
+
+static struct packed_rerere_entry *add_packed_rerere_entry(
+		struct packed_rerere_update *u, const unsigned char *hash,
+		uint32_t variant, timestamp_t created, timestamp_t last_used)
+{
+	struct packed_rerere_entry *e;
+
+	ALLOC_GROW(u->entries, u->nr + 1, u->alloc);
+	e = &u->entries[u->nr++];
+	memset(e, 0, sizeof(*e));
+	memcpy(e->hash, hash, the_hash_algo->rawsz);
+	e->variant = variant;
+	e->created = created;
+	e->last_used = last_used;
+	return e;
+}
+
+/* Keep the packed records that are neither stale nor expired. */
+static void keep_packed_rerere(struct packed_rerere_update *u,
+			       struct strset *loose,
+			       timestamp_t cutoff_resolve,
+			       timestamp_t cutoff_noresolve)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	uint32_t i;
+
+	for (i = 0; i < packed_rerere.nr; i++) {
+		const unsigned char *entry = packed_rerere_entry(i);
+		timestamp_t created = get_be64(entry + rawsz + 4);
+		timestamp_t last_used = get_be64(entry + rawsz + 12);
+		struct packed_rerere_entry *e;
+		const char *pre, *post;
+		size_t pre_len, post_len, rec_len;
+
+		rec_len = packed_rerere_record(i, &pre, &pre_len,
+					       &post, &post_len);
+		/* the same rules as prune_one() */
+		if (!rec_len ||
+		    strset_contains(loose, hash_to_hex(entry)) ||
+		    (last_used ? last_used < cutoff_resolve :
+		     created && created < cutoff_noresolve)) {
+			u->changed = 1;
+			continue;
+		}
+		e = add_packed_rerere_entry(u, entry, get_be32(entry + rawsz),
+					    created, last_used);
+		e->offset = get_be64(entry + rawsz + 20);
+		e->rec = (const char *)packed_rerere.data + e->offset;
+		e->rec_len = rec_len;
+	}
+}
+
+/*
+ * Add the variants of a loose conflict to the new records. Return -1
+ * and add nothing if some cannot be packed.
+ */
+static int pack_rerere_dir(struct packed_rerere_update *u,
+			   struct rerere_dir *rr_dir)
+{
+	struct strbuf pre = STRBUF_INIT, post = STRBUF_INIT;
+	size_t nr = u->nr, len = u->records.len;
+	struct object_id oid;
+	struct rerere_id id;
+	unsigned char buf[12];
+	int ret = 0;
+
+	if (get_oid_hex(rr_dir->name, &oid))
+		return -1;
+	id.collection = rr_dir;
+	for (id.variant = 0; !ret && id.variant < rr_dir->status_nr; id.variant++) {
+		unsigned char status = rr_dir->status[id.variant];
+		struct packed_rerere_entry *e;
+
+		if (!status)
+			continue;
+		strbuf_reset(&pre);
+		strbuf_reset(&post);
+		if (!(status & RR_HAS_PREIMAGE) ||
+		    strbuf_read_file(&pre, rerere_path(&id, "preimage"), 0) < 0 ||
+		    ((status & RR_HAS_POSTIMAGE) &&
+		     strbuf_read_file(&post, rerere_path(&id, "postimage"), 0) < 0) ||
+		    pre.len >= PACKED_RERERE_NO_POSTIMAGE ||
+		    post.len >= PACKED_RERERE_NO_POSTIMAGE) {
+			ret = -1;
+			break;
+		}
+
+		e = add_packed_rerere_entry(u, oid.hash, id.variant,
+					    rerere_created_at(&id),
+					    rerere_last_used_at(&id));
+		e->offset = u->records.len;
+		put_be32(buf, id.variant);
+		put_be32(buf + 4, pre.len);
+		put_be32(buf + 8, (status & RR_HAS_POSTIMAGE) ?
+			 post.len : PACKED_RERERE_NO_POSTIMAGE);
+		strbuf_add(&u->records, oid.hash, the_hash_algo->rawsz);
+		strbuf_add(&u->records, buf, sizeof(buf));
+		strbuf_addbuf(&u->records, &pre);
+		strbuf_addbuf(&u->records, &post);
+	}
+	strbuf_release(&pre);
+	strbuf_release(&post);
+
+	if (ret) {
+		u->nr = nr;
+		strbuf_setlen(&u->records, len);
+	} else {
+		u->changed = 1;
+	}
+	return ret;
+}
+
+static int packed_rerere_entry_cmp(const void *a_, const void *b_)
+{
+	const struct packed_rerere_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->hash, b->hash);
+
+	if (cmp)
+		return cmp;
+	return a->variant < b->variant ? -1 : a->variant > b->variant;
+}
+
+/*
+ * Write the new records, appending them to "rr-cache/packed" unless
+ * more than half of it would be dead, and then the new index.
+ */
+static int write_packed_rerere(struct packed_rerere_update *u)
+{
+	struct lock_file data_lock = LOCK_INIT, idx_lock = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	size_t rawsz = the_hash_algo->rawsz;
+	size_t i, kept = 0, base;
+	unsigned char header[PACKED_RERERE_IDX_HEADER_SIZE];
+	int fd, ret = 0;
+
+	for (i = 0; i < u->nr; i++)
+		kept += u->entries[i].rec_len;
+
+	put_be32(header, PACKED_RERERE_SIGNATURE);
+	put_be32(header + 4, PACKED_RERERE_VERSION);
+	put_be32(header + 8, the_hash_algo->format_id);
+
+	if (!packed_rerere.data ||
+	    packed_rerere.data_size - PACKED_RERERE_HEADER_SIZE - kept > kept) {
+		/* start over with the live records only */
+		strbuf_add(&buf, header, PACKED_RERERE_HEADER_SIZE);
+		for (i = 0; i < u->nr; i++) {
+			struct packed_rerere_entry *e = &u->entries[i];
+
+			if (e->rec) {
+				e->offset = buf.len;
+				strbuf_add(&buf, e->rec, e->rec_len);
+			}
+		}
+		base = buf.len;
+		strbuf_addbuf(&buf, &u->records);
+
+		fd = hold_lock_file_for_update(&data_lock,
+					       git_path_packed_rerere(), 0);
+		if (fd < 0) {
+			ret = error_errno(_("unable to lock '%s'"),
+					  git_path_packed_rerere());
+			goto out;
+		}
+		if (write_in_full(fd, buf.buf, buf.len) < 0 ||
+		    commit_lock_file(&data_lock) < 0) {
+			ret = error_errno(_("unable to write '%s'"),
+					  git_path_packed_rerere());
+			rollback_lock_file(&data_lock);
+			goto out;
+		}
+	} else {
+		struct stat st;
+
+		fd = open(git_path_packed_rerere(), O_WRONLY | O_APPEND);
+		if (fd < 0 || fstat(fd, &st) < 0 ||
+		    write_in_full(fd, u->records.buf, u->records.len) < 0 ||
+		    close(fd) < 0) {
+			ret = error_errno(_("unable to write '%s'"),
+					  git_path_packed_rerere());
+			goto out;
+		}
+		base = xsize_t(st.st_size);
+	}
+
+	for (i = 0; i < u->nr; i++)
+		if (!u->entries[i].rec)
+			u->entries[i].offset += base;
+	QSORT(u->entries, u->nr, packed_rerere_entry_cmp);
+
+	strbuf_reset(&buf);
+	put_be32(header, PACKED_RERERE_IDX_SIGNATURE);
+	put_be32(header + 12, u->nr);
+	strbuf_add(&buf, header, sizeof(header));
+	for (i = 0; i < u->nr; i++) {
+		struct packed_rerere_entry *e = &u->entries[i];
+		unsigned char entry[28];
+
+		put_be32(entry, e->variant);
+		put_be64(entry + 4, e->created);
+		put_be64(entry + 12, e->last_used);
+		put_be64(entry + 20, e->offset);
+		strbuf_add(&buf, e->hash, rawsz);
+		strbuf_add(&buf, entry, sizeof(entry));
+	}
+
+	fd = hold_lock_file_for_update(&idx_lock, git_path_packed_rerere_idx(), 0);
+	if (fd < 0)
+		ret = error_errno(_("unable to lock '%s'"),
+				  git_path_packed_rerere_idx());
+	else if (write_in_full(fd, buf.buf, buf.len) < 0 ||
+		 commit_lock_file(&idx_lock) < 0) {
+		ret = error_errno(_("unable to write '%s'"),
+				  git_path_packed_rerere_idx());
+		rollback_lock_file(&idx_lock);
+	}
+
+out:
+	strbuf_release(&buf);
+	return ret;
+}
+
+/* Remove the files of a loose conflict that has been packed or pruned. */
+static void remove_rerere_dir(const char *name)
+{
+	struct rerere_dir *rr_dir = find_rerere_dir(name);
+	struct rerere_id id;
+
+	id.collection = rr_dir;
+	for (id.variant = 0; id.variant < rr_dir->status_nr; id.variant++)
+		if (rr_dir->status[id.variant])
+			unlink_rr_item(&id);
+	unlink_or_warn(git_path("rr-cache/%s/unpacked", name));
+	rmdir(git_path("rr-cache/%s", name));
+}
+
 void rerere_gc(struct repository *r, struct string_list *rr)
 {
 	struct string_list to_remove = STRING_LIST_INIT_DUP;
+	struct string_list to_pack = STRING_LIST_INIT_DUP;
+	struct string_list packed = STRING_LIST_INIT_DUP;
+	struct strset loose = STRSET_INIT, in_progress = STRSET_INIT;
+	struct packed_rerere_update update = { NULL };
 	DIR *dir;
 	struct dirent *e;
-	int i;
+	int i, pack = 0, written = 1;
 	timestamp_t now = time(NULL);
 	timestamp_t cutoff_noresolve = now - 15 * 86400;
 	timestamp_t cutoff_resolve = now - 60 * 86400;
@@ -1185,7 +1701,16 @@ void rerere_gc(struct repository *r, struct string_list *rr)
 
 	git_config_get_expiry_in_days("gc.rerereresolved", &cutoff_resolve, now);
 	git_config_get_expiry_in_days("gc.rerereunresolved", &cutoff_noresolve, now);
+	git_config_get_bool("rerere.packed", &pack);
 	git_config(git_default_config, NULL);
+	for (i = 0; i < rr->nr; i++) {
+		struct rerere_id *id = rr->items[i].util;
+
+		if (id)
+			strset_add(&in_progress, rerere_id_hex(id));
+	}
+	strbuf_init(&update.records, 0);
+
 	dir = opendir(git_path("rr-cache"));
 	if (!dir)
 		die_errno(_("unable to open rr-cache directory"));
@@ -1200,6 +1725,15 @@ void rerere_gc(struct repository *r, struct string_list *rr)
 
 		rr_dir = find_rerere_dir(e->d_name);
 
+		/* ... noting which ones have stale packed records, ... */
+		now_empty = !file_exists(git_path("rr-cache/%s/unpacked",
+						  e->d_name));
+		for (id.variant = 0; id.variant < rr_dir->status_nr; id.variant++)
+			if (rr_dir->status[id.variant])
+				now_empty = 0;
+		if (!now_empty)
+			strset_add(&loose, e->d_name);
+
 		now_empty = 1;
 		for (id.variant = 0, id.collection = rr_dir;
 		     id.variant < id.collection->status_nr;
@@ -1210,12 +1744,45 @@ void rerere_gc(struct repository *r, struct string_list *rr)
 		}
 		if (now_empty)
 			string_list_append(&to_remove, e->d_name);
+		else if (pack && !strset_contains(&in_progress, e->d_name))
+			string_list_append(&to_pack, e->d_name);
 	}
 	closedir(dir);
 
-	/* ... and then remove the empty directories */
-	for (i = 0; i < to_remove.nr; i++)
-		rmdir(git_path("rr-cache/%s", to_remove.items[i].string));
+	/* ... packing the others if asked to ... */
+	if (load_packed_rerere())
+		keep_packed_rerere(&update, &loose,
+				   cutoff_resolve, cutoff_noresolve);
+	for (i = 0; i < to_pack.nr; i++) {
+		const char *name = to_pack.items[i].string;
+
+		if (!pack_rerere_dir(&update, find_rerere_dir(name)))
+			string_list_append(&packed, name);
+	}
+	if (update.changed)
+		written = !write_packed_rerere(&update);
+	unload_packed_rerere();
+
+	/*
+	 * ... and then remove the empty directories, keeping those that
+	 * mark packed records as stale unless the index dropped them.
+	 */
+	for (i = 0; i < to_remove.nr; i++) {
+		const char *name = to_remove.items[i].string;
+
+		if (written)
+			unlink_or_warn(git_path("rr-cache/%s/unpacked", name));
+		rmdir(git_path("rr-cache/%s", name));
+	}
+	for (i = 0; written && i < packed.nr; i++)
+		remove_rerere_dir(packed.items[i].string);
+
+	free(update.entries);
+	strbuf_release(&update.records);
+	strset_clear(&loose);
+	strset_clear(&in_progress);
+	string_list_clear(&packed, 0);
+	string_list_clear(&to_pack, 0);
 	string_list_clear(&to_remove, 0);
 	rollback_lock_file(&write_lock);
 }
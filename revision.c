@@ -32,6 +32,7 @@
 #include "utf8.h"
 #include "bloom.h"
 #include "json-writer.h"
+#include "grep-trigrams.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -623,49 +624,47 @@ static void file_change(struct diff_options *options,
 	options->flags.has_changes = 1;
 }
 
-static int bloom_filter_atexit_registered;
-static unsigned int count_bloom_filter_maybe;
-static unsigned int count_bloom_filter_definitely_not;
-static unsigned int count_bloom_filter_false_positive;
-static unsigned int count_bloom_filter_not_present;
-
-static void trace2_bloom_filter_statistics_atexit(void)
+static int forbid_bloom_filters(struct pathspec *spec)
 {
-	struct json_writer jw = JSON_WRITER_INIT;
-
-	jw_object_begin(&jw, 0);
-	jw_object_intmax(&jw, "filter_not_present", count_bloom_filter_not_present);
-	jw_object_intmax(&jw, "maybe", count_bloom_filter_maybe);
-	jw_object_intmax(&jw, "definitely_not", count_bloom_filter_definitely_not);
-	jw_object_intmax(&jw, "false_positive", count_bloom_filter_false_positive);
-	jw_end(&jw);
+	int i;
 
-	trace2_data_json("bloom", the_repository, "statistics", &jw);
+	if (spec->magic & ~(PATHSPEC_LITERAL | PATHSPEC_GLOB))
+		return 1;
+	for (i = 0; i < spec->nr; i++)
+		if (spec->items[i].magic & ~(PATHSPEC_LITERAL | PATHSPEC_GLOB))
+			return 1;
 
-	jw_release(&jw);
+	return 0;
 }
 
-static int forbid_bloom_filters(struct pathspec *spec)
+/*
+ * Only the literal leading directories of a pathspec item with
+ * wildcards can be looked up; every path it matches is below them.
+ * Returns NULL if there is nothing literal to look up.
+ */
+static struct bloom_keyvec *pathspec_item_to_bloom_keyvec(const struct pathspec_item *pi,
+							  const struct bloom_filter_settings *settings)
 {
-	if (spec->has_wildcard)
-		return 1;
-	if (spec->nr > 1)
-		return 1;
-	if (spec->magic & ~PATHSPEC_LITERAL)
-		return 1;
-	if (spec->nr && (spec->items[0].magic & ~PATHSPEC_LITERAL))
-		return 1;
+	size_t len = pi->nowildcard_len;
 
-	return 0;
+	if (len < pi->len)
+		while (len && pi->match[len - 1] != '/')
+			len--;
+
+	/* remove single trailing slash from path, if needed */
+	if (len && pi->match[len - 1] == '/')
+		len--;
+
+	if (!len)
+		return NULL;
+
+	return bloom_keyvec_new(pi->match, len, settings);
 }
 
 static void prepare_to_use_bloom_filter(struct rev_info *revs)
 {
-	struct pathspec_item *pi;
-	char *path_alloc = NULL;
-	const char *path, *p;
-	size_t len;
-	int path_component_nr = 1;
+	struct pathspec *spec = &revs->pruning.pathspec;
+	int i;
 
 	if (!revs->commits)
 		return;
@@ -679,66 +678,35 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	if (!revs->bloom_filter_settings)
 		return;
 
-	if (!revs->pruning.pathspec.nr)
+	if (!spec->nr)
 		return;
 
-	pi = &revs->pruning.pathspec.items[0];
-
-	/* remove single trailing slash from path, if needed */
-	if (pi->len > 0 && pi->match[pi->len - 1] == '/') {
-		path_alloc = xmemdupz(pi->match, pi->len - 1);
-		path = path_alloc;
-	} else
-		path = pi->match;
-
-	len = strlen(path);
-	if (!len) {
-		revs->bloom_filter_settings = NULL;
-		free(path_alloc);
-		return;
-	}
-
-	p = path;
-	while (*p) {
-		/*
-		 * At this point, the path is normalized to use Unix-style
-		 * path separators. This is required due to how the
-		 * changed-path Bloom filters store the paths.
-		 */
-		if (*p == '/')
-			path_component_nr++;
-		p++;
-	}
-
-	revs->bloom_keys_nr = path_component_nr;
-	ALLOC_ARRAY(revs->bloom_keys, revs->bloom_keys_nr);
-
-	fill_bloom_key(path, len, &revs->bloom_keys[0],
-		       revs->bloom_filter_settings);
-	path_component_nr = 1;
-
-	p = path + len - 1;
-	while (p > path) {
-		if (*p == '/')
-			fill_bloom_key(path, p - path,
-				       &revs->bloom_keys[path_component_nr++],
-				       revs->bloom_filter_settings);
-		p--;
-	}
-
-	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
-		atexit(trace2_bloom_filter_statistics_atexit);
-		bloom_filter_atexit_registered = 1;
+	CALLOC_ARRAY(revs->bloom_keyvecs, spec->nr);
+	for (i = 0; i < spec->nr; i++) {
+		struct bloom_keyvec *vec;
+
+		vec = pathspec_item_to_bloom_keyvec(&spec->items[i],
+						    revs->bloom_filter_settings);
+		if (!vec) {
+			/* this item could match any path */
+			while (revs->bloom_keyvecs_nr)
+				bloom_keyvec_free(revs->bloom_keyvecs[--revs->bloom_keyvecs_nr]);
+			FREE_AND_NULL(revs->bloom_keyvecs);
+			revs->bloom_filter_settings = NULL;
+			return;
+		}
+		revs->bloom_keyvecs[revs->bloom_keyvecs_nr++] = vec;
 	}
 
-	free(path_alloc);
+	/* how the filters did is reported by the "bloom" trace2 counters */
+	trace2_data_intmax("bloom", revs->repo, "keyvecs", revs->bloom_keyvecs_nr);
 }
 
 static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 						 struct commit *commit)
 {
 	struct bloom_filter *filter;
-	int result = 1, j;
+	int result = 0, j;
 
 	if (!revs->repo->objects->commit_graph)
 		return -1;
@@ -749,20 +717,25 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 	filter = get_bloom_filter(revs->repo, commit);
 
 	if (!filter) {
-		count_bloom_filter_not_present++;
+		trace2_counter_add(TRACE2_COUNTER_ID_BLOOM_FILTER_NOT_PRESENT, 1);
 		return -1;
 	}
 
-	for (j = 0; result && j < revs->bloom_keys_nr; j++) {
-		result = bloom_filter_contains(filter,
-					       &revs->bloom_keys[j],
-					       revs->bloom_filter_settings);
+	/*
+	 * The commit may touch the pathspec if it may touch any of its
+	 * items; a "maybe" is settled by the full pathspec match in the
+	 * tree diff.
+	 */
+	for (j = 0; !result && j < revs->bloom_keyvecs_nr; j++) {
+		result = bloom_filter_contains_vec(filter,
+						   revs->bloom_keyvecs[j],
+						   revs->bloom_filter_settings);
 	}
 
 	if (result)
-		count_bloom_filter_maybe++;
+		trace2_counter_add(TRACE2_COUNTER_ID_BLOOM_FILTER_MAYBE, 1);
 	else
-		count_bloom_filter_definitely_not++;
+		trace2_counter_add(TRACE2_COUNTER_ID_BLOOM_FILTER_DEFINITELY_NOT, 1);
 
 	return result;
 }
@@ -797,7 +770,7 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	if (revs->bloom_keys_nr && !nth_parent) {
+	if (revs->bloom_keyvecs_nr && !nth_parent) {
 		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
 
 		if (bloom_ret == 0)
@@ -808,9 +781,9 @@ static int rev_compare_tree(struct rev_info *revs,
 	revs->pruning.flags.has_changes = 0;
 	diff_tree_oid(&t1->object.oid, &t2->object.oid, "", &revs->pruning);
 
-	if (!nth_parent)
+	if (revs->bloom_keyvecs_nr && !nth_parent)
 		if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
-			count_bloom_filter_false_positive++;
+			trace2_counter_add(TRACE2_COUNTER_ID_BLOOM_FILTER_FALSE_POSITIVE, 1);
 
 	return tree_difference;
 }
@@ -2222,7 +2195,6 @@ static int handle_revision_opt(struct rev_info *revs, int argc, const char **arg
 	} else if (!strcmp(arg, "--ancestry-path")) {
 		revs->ancestry_path = 1;
 		revs->simplify_history = 0;
-		revs->limited = 1;
 	} else if (!strcmp(arg, "-g") || !strcmp(arg, "--walk-reflogs")) {
 		init_reflog_walk(&revs->reflog_info);
 	} else if (!strcmp(arg, "--default")) {
@@ -2855,6 +2827,16 @@ int setup_revisions(int argc, const char **argv, struct rev_info *revs, struct s
 				      &revs->prune_data);
 	}
 
+	/*
+	 * The topo walk can filter --ancestry-path as it goes, but only
+	 * limit_list() knows how to handle --first-parent and the
+	 * TREESAME updates that marking commits UNINTERESTING can cause.
+	 */
+	if (revs->ancestry_path &&
+	    (!revs->topo_order || revs->first_parent_only ||
+	     limiting_can_increase_treesame(revs)))
+		revs->limited = 1;
+
 	diff_merges_setup_revs(revs);
 
 	revs->diffopt.abbrev = revs->abbrev;
@@ -3283,6 +3265,14 @@ static int mark_uninteresting(const struct object_id *oid,
 
 define_commit_slab(indegree_slab, int);
 define_commit_slab(author_date_slab, timestamp_t);
+define_commit_slab(ancestry_path_slab, int);
+
+enum ancestry_path_state {
+	ANCESTRY_PATH_UNKNOWN = 0,
+	ANCESTRY_PATH_WALKING,
+	ANCESTRY_PATH_ON,
+	ANCESTRY_PATH_OFF,
+};
 
 struct topo_walk_info {
 	timestamp_t min_generation;
@@ -3291,12 +3281,19 @@ struct topo_walk_info {
 	struct prio_queue topo_queue;
 	struct indegree_slab indegree;
 	struct author_date_slab author_date;
+
+	/* only used for --ancestry-path */
+	struct commit_list *bottoms;
+	int independent_bottoms;
+	timestamp_t min_bottom_generation;
+	struct ancestry_path_slab ancestry_path;
 };
 
 static int topo_walk_atexit_registered;
 static unsigned int count_explore_walked;
 static unsigned int count_indegree_walked;
 static unsigned int count_topo_walked;
+static unsigned int count_ancestry_path_walked;
 
 static void trace2_topo_walk_statistics_atexit(void)
 {
@@ -3306,6 +3303,8 @@ static void trace2_topo_walk_statistics_atexit(void)
 	jw_object_intmax(&jw, "count_explore_walked", count_explore_walked);
 	jw_object_intmax(&jw, "count_indegree_walked", count_indegree_walked);
 	jw_object_intmax(&jw, "count_topo_walked", count_topo_walked);
+	jw_object_intmax(&jw, "count_ancestry_path_walked",
+			 count_ancestry_path_walked);
 	jw_end(&jw);
 
 	trace2_data_json("topo_walk", the_repository, "statistics", &jw);
@@ -3416,6 +3415,8 @@ static void reset_topo_walk(struct rev_info *revs)
 	clear_prio_queue(&info->topo_queue);
 	clear_indegree_slab(&info->indegree);
 	clear_author_date_slab(&info->author_date);
+	clear_ancestry_path_slab(&info->ancestry_path);
+	free_commit_list(info->bottoms);
 
 	FREE_AND_NULL(revs->topo_walk_info);
 }
@@ -3454,6 +3455,8 @@ static void init_topo_walk(struct rev_info *revs)
 	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
 
 	info->min_generation = GENERATION_NUMBER_INFINITY;
+	info->min_bottom_generation = GENERATION_NUMBER_INFINITY;
+	init_ancestry_path_slab(&info->ancestry_path);
 	for (list = revs->commits; list; list = list->next) {
 		struct commit *c = list->item;
 		timestamp_t generation;
@@ -3465,7 +3468,19 @@ static void init_topo_walk(struct rev_info *revs)
 		test_flag_and_insert(&info->indegree_queue, c, TOPO_WALK_INDEGREE);
 
 		generation = commit_graph_generation(c);
-		if (generation < info->min_generation)
+		if (c->object.flags & BOTTOM) {
+			if (generation < info->min_bottom_generation)
+				info->min_bottom_generation = generation;
+		}
+
+		/*
+		 * Uninteresting tips are explored as the walk reaches
+		 * their generation; counting in-degrees down to them
+		 * up front would delay the first commit of a range
+		 * until the whole range had been walked.
+		 */
+		if (!(c->object.flags & UNINTERESTING) &&
+		    generation < info->min_generation)
 			info->min_generation = generation;
 
 		*(indegree_slab_at(&info->indegree, c)) = 1;
@@ -3473,6 +3488,18 @@ static void init_topo_walk(struct rev_info *revs)
 		if (revs->sort_order == REV_SORT_BY_AUTHOR_DATE)
 			record_author_date(&info->author_date, c);
 	}
+	if (revs->ancestry_path) {
+		struct commit_list *reduced;
+
+		info->bottoms = collect_bottom_commits(revs->commits);
+		if (!info->bottoms)
+			die("--ancestry-path given but there are no bottom commits");
+		reduced = reduce_heads(info->bottoms);
+		info->independent_bottoms = commit_list_count(reduced) ==
+					    commit_list_count(info->bottoms);
+		free_commit_list(reduced);
+	}
+
 	compute_indegrees_to_depth(revs, info->min_generation);
 
 	for (list = revs->commits; list; list = list->next) {
@@ -3509,6 +3536,135 @@ static struct commit *next_topo_commit(struct rev_info *revs)
 	return c;
 }
 
+/*
+ * Parents have lower generation numbers than their children, so a
+ * commit can only reach a bottom commit of lower generation. Commits
+ * outside the commit-graph have no useful generation and must be
+ * walked.
+ */
+static int can_reach_bottom(struct topo_walk_info *info, struct commit *c)
+{
+	timestamp_t generation = commit_graph_generation(c);
+
+	return generation == GENERATION_NUMBER_INFINITY ||
+	       generation > info->min_bottom_generation;
+}
+
+/*
+ * Ask the reachability index of the commit-graph whether "c" reaches
+ * one of the bottom commits: ANCESTRY_PATH_ON or ANCESTRY_PATH_OFF if
+ * it can tell for every bottom, ANCESTRY_PATH_UNKNOWN otherwise.
+ */
+static int ancestry_path_from_index(struct rev_info *revs,
+				    struct topo_walk_info *info,
+				    struct commit *c)
+{
+	struct commit_list *b;
+	int result = ANCESTRY_PATH_OFF;
+
+	for (b = info->bottoms; b; b = b->next) {
+		int reach = commit_graph_can_reach(revs->repo, c, b->item);
+		if (reach > 0)
+			return ANCESTRY_PATH_ON;
+		if (reach < 0)
+			result = ANCESTRY_PATH_UNKNOWN;
+	}
+	return result;
+}
+
+/*
+ * Decide whether "commit" belongs in the output of --ancestry-path,
+ * i.e. whether it can reach one of the bottom commits through
+ * interesting commits only, the same rule limit_to_ancestry() applies
+ * after the fact. Answers are remembered per commit, so the whole walk
+ * visits each commit above the lowest bottom at most once. Commits
+ * found to be off the path are marked UNINTERESTING, which is what
+ * limit_to_ancestry() would have done and keeps parent rewriting from
+ * pointing at them.
+ *
+ * When no bottom can reach another one, a commit reachable from a
+ * bottom can never lead to a bottom itself, so any path to a bottom
+ * only crosses interesting commits. The answer then does not depend on
+ * UNINTERESTING bits that the walk has not propagated yet, and both
+ * the reachability index and an unbounded depth-first search can be
+ * trusted. Otherwise each commit is explored down to its own
+ * generation before its bit is looked at.
+ */
+static int on_ancestry_path(struct rev_info *revs, struct commit *commit)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit_list *stack = NULL;
+	int *state = ancestry_path_slab_at(&info->ancestry_path, commit);
+
+	if (*state == ANCESTRY_PATH_ON || *state == ANCESTRY_PATH_OFF)
+		return *state == ANCESTRY_PATH_ON;
+
+	commit_list_insert(commit, &stack);
+	while (stack) {
+		struct commit *c = stack->item;
+		struct commit *next = NULL;
+		struct commit_list *p;
+		int result = ANCESTRY_PATH_OFF;
+
+		state = ancestry_path_slab_at(&info->ancestry_path, c);
+		if (*state == ANCESTRY_PATH_ON || *state == ANCESTRY_PATH_OFF) {
+			pop_commit(&stack);
+			continue;
+		}
+
+		if (*state == ANCESTRY_PATH_UNKNOWN) {
+			*state = ANCESTRY_PATH_WALKING;
+			count_ancestry_path_walked++;
+
+			if (repo_parse_commit_gently(revs->repo, c, 1) < 0)
+				result = ANCESTRY_PATH_OFF;
+			else if (c->object.flags & BOTTOM)
+				result = ANCESTRY_PATH_ON;
+			else {
+				/* make sure the UNINTERESTING bit of "c" is final */
+				if (!info->independent_bottoms)
+					explore_to_depth(revs, commit_graph_generation(c));
+
+				if ((c->object.flags & UNINTERESTING) ||
+				    !can_reach_bottom(info, c))
+					result = ANCESTRY_PATH_OFF;
+				else if (info->independent_bottoms)
+					result = ancestry_path_from_index(revs, info, c);
+				else
+					result = ANCESTRY_PATH_UNKNOWN;
+			}
+		} else
+			result = ANCESTRY_PATH_UNKNOWN;
+
+		if (result == ANCESTRY_PATH_UNKNOWN) {
+			/* "c" is on the path if any of its parents is */
+			result = ANCESTRY_PATH_OFF;
+			for (p = c->parents; p; p = p->next) {
+				int s = *ancestry_path_slab_at(&info->ancestry_path,
+							       p->item);
+				if (s == ANCESTRY_PATH_ON) {
+					result = ANCESTRY_PATH_ON;
+					break;
+				}
+				if (s == ANCESTRY_PATH_UNKNOWN && !next)
+					next = p->item;
+			}
+			if (result != ANCESTRY_PATH_ON && next) {
+				commit_list_insert(next, &stack);
+				continue;
+			}
+		}
+
+		*state = result;
+		if (result == ANCESTRY_PATH_OFF)
+			c->object.flags |= UNINTERESTING;
+		pop_commit(&stack);
+	}
+
+	state = ancestry_path_slab_at(&info->ancestry_path, commit);
+	return *state == ANCESTRY_PATH_ON;
+}
+
 static void expand_topo_walk(struct rev_info *revs, struct commit *commit)
 {
 	struct commit_list *p;
@@ -3549,6 +3705,40 @@ static void expand_topo_walk(struct rev_info *revs, struct commit *commit)
 	}
 }
 
+static int trigram_atexit_registered;
+static unsigned long count_trigram_skipped;
+
+static void trace2_trigram_statistics_atexit(void)
+{
+	trace2_data_intmax("revision", the_repository, "trigrams/skipped",
+			   count_trigram_skipped);
+}
+
+static void prepare_to_use_trigram_filter(struct rev_info *revs)
+{
+	unsigned flags = 0;
+
+	if (revs->trigram_filter ||
+	    (!revs->grep_filter.pattern_list && !revs->grep_filter.header_list) ||
+	    !is_encoding_utf8(get_log_output_encoding()))
+		return;
+
+	/* see commit_match() for what is searched besides the commit */
+	if (revs->mailmap)
+		flags |= COMMIT_TRIGRAMS_REWRITTEN_IDENTS;
+	if (revs->show_notes)
+		flags |= COMMIT_TRIGRAMS_EXTENDED_MESSAGE;
+	revs->trigram_filter = commit_trigram_filter_prepare(revs->repo,
+							     &revs->grep_filter,
+							     flags);
+
+	if (revs->trigram_filter && trace2_is_enabled() &&
+	    !trigram_atexit_registered) {
+		atexit(trace2_trigram_statistics_atexit);
+		trigram_atexit_registered = 1;
+	}
+}
+
 int prepare_revision_walk(struct rev_info *revs)
 {
 	int i;
@@ -3583,6 +3773,7 @@ int prepare_revision_walk(struct rev_info *revs)
 
 	if (!revs->reflog_info)
 		prepare_to_use_bloom_filter(revs);
+	prepare_to_use_trigram_filter(revs);
 	if (revs->no_walk != REVISION_WALK_NO_WALK_UNSORTED)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
@@ -3617,6 +3808,8 @@ static enum rewrite_result rewrite_one_1(struct rev_info *revs,
 {
 	for (;;) {
 		struct commit *p = *pp;
+		if (revs->ancestry_path && revs->topo_walk_info)
+			on_ancestry_path(revs, p);
 		if (!revs->limited)
 			if (process_parents(revs, p, NULL, queue) < 0)
 				return rewrite_one_error;
@@ -3733,6 +3926,12 @@ static int commit_match(struct commit *commit, struct rev_info *opt)
 	if (!opt->grep_filter.pattern_list && !opt->grep_filter.header_list)
 		return 1;
 
+	if (opt->trigram_filter &&
+	    grep_trigram_filter_skip(opt->trigram_filter, &commit->object.oid)) {
+		count_trigram_skipped++;
+		return opt->invert_grep;
+	}
+
 	/* Prepend "fake" headers as needed */
 	if (opt->grep_filter.use_reflog_filter) {
 		strbuf_addstr(&buf, "reflog ");
@@ -3999,8 +4198,11 @@ static struct commit *get_revision_1(struct rev_info *revs)
 
 			if (revs->reflog_info)
 				try_to_simplify_commit(revs, commit);
-			else if (revs->topo_walk_info)
+			else if (revs->topo_walk_info) {
+				if (revs->ancestry_path)
+					on_ancestry_path(revs, commit);
 				expand_topo_walk(revs, commit);
+			}
 			else if (process_parents(revs, commit, &revs->commits, NULL) < 0) {
 				if (!revs->ignore_missing_links)
 					die("Failed to traverse parents of commit %s",
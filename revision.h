@@ -57,8 +57,9 @@ struct repository;
 struct rev_info;
 struct string_list;
 struct saved_parents;
-struct bloom_key;
+struct bloom_keyvec;
 struct bloom_filter_settings;
+struct grep_trigram_filter;
 define_shared_commit_slab(revision_sources, char *);
 
 struct rev_cmdline_info {
@@ -182,6 +183,14 @@ struct rev_info {
 			/* for internal use only */
 			exclude_promisor_objects:1;
 
+	/*
+	 * With more than one, traverse_commit_list() may walk trees with
+	 * this many threads, so that trees and blobs are shown in no
+	 * particular order. Only set it when the order of the show_object
+	 * calls does not matter.
+	 */
+	int traverse_threads;
+
 	/* Diff flags */
 	unsigned int	diff:1,
 			full_diff:1,
@@ -250,6 +259,8 @@ struct rev_info {
 	struct grep_opt	grep_filter;
 	/* Negate the match of grep_filter */
 	int invert_grep;
+	/* Commits that cannot match grep_filter, see grep-trigrams.h */
+	struct grep_trigram_filter *trigram_filter;
 
 	/* Display history graph */
 	struct git_graph *graph;
@@ -306,9 +317,9 @@ struct rev_info {
 	struct topo_walk_info *topo_walk_info;
 
 	/* Commit graph bloom filter fields */
-	/* The bloom filter key(s) for the pathspec */
-	struct bloom_key *bloom_keys;
-	int bloom_keys_nr;
+	/* The bloom filter keys for each item of the pathspec */
+	struct bloom_keyvec **bloom_keyvecs;
+	int bloom_keyvecs_nr;
 
 	/*
 	 * The bloom filter settings used to generate the key.
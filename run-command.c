@@ -1004,6 +1004,113 @@ int finish_command_in_signal(struct child_process *cmd)
 	return ret;
 }
 
+static void NORETURN forked_die_fn(const char *err, va_list params)
+{
+	vreportf("fatal: ", err, params);
+	_exit(128);
+}
+
+int start_forked_command(struct child_process *cmd,
+			 int (*fn)(int argc, const char **argv, void *data),
+			 void *data)
+{
+	int fdin[2], fdout[2], fderr[2];
+
+	if (pipe(fdin) < 0)
+		return -1;
+	if (pipe(fdout) < 0) {
+		close_pair(fdin);
+		return -1;
+	}
+	if (pipe(fderr) < 0) {
+		close_pair(fdin);
+		close_pair(fdout);
+		return -1;
+	}
+
+	fflush(NULL);
+	cmd->pid = fork();
+	if (!cmd->pid) {
+		int ret;
+
+		dup2(fdin[0], 0);
+		dup2(fdout[1], 1);
+		dup2(fderr[1], 2);
+		close_pair(fdin);
+		close_pair(fdout);
+		close_pair(fderr);
+
+		/*
+		 * The atexit handlers, trace2's among them, belong to the
+		 * parent, which runs them when it exits itself; leave
+		 * without them, on die() too.
+		 */
+		set_die_routine(forked_die_fn);
+		ret = fn(cmd->args.nr, cmd->args.v, data);
+		fflush(NULL);
+		_exit(ret);
+	}
+
+	close(fdin[0]);
+	close(fdout[1]);
+	close(fderr[1]);
+	if (cmd->pid < 0) {
+		close(fdin[1]);
+		close(fdout[0]);
+		close(fderr[0]);
+		return -1;
+	}
+	if (cmd->clean_on_exit)
+		mark_child_for_cleanup(cmd->pid, cmd);
+
+	cmd->argv = cmd->args.v;
+	cmd->trace2_child_class = "fork";
+	trace2_child_start(cmd);
+
+	cmd->in = fdin[1];
+	cmd->out = fdout[0];
+	cmd->err = fderr[0];
+	return 0;
+}
+
+
+static run_in_process_fn run_in_process;
+
+void set_run_in_process_routine(run_in_process_fn fn)
+{
+	run_in_process = fn;
+}
+
+/*
+ * Give the routine set by set_run_in_process_routine() a chance to run
+ * the git command "cmd" in this process. Only commands that would run
+ * exactly where we are do qualify: with our stdio, working directory
+ * and environment.
+ */
+static int maybe_run_in_process(struct child_process *cmd, int *status)
+{
+	const char **argv = cmd->argv ? cmd->argv : cmd->args.v;
+
+	if (!run_in_process || !cmd->git_cmd || cmd->use_shell || !argv[0])
+		return 0;
+	if (cmd->in || cmd->out || cmd->err ||
+	    cmd->no_stdin || cmd->no_stdout || cmd->no_stderr ||
+	    cmd->stdout_to_stderr)
+		return 0;
+	if (cmd->dir || cmd->env || cmd->env_array.nr)
+		return 0;
+	if (!git_env_bool("GIT_TEST_IN_PROCESS_BUILTINS", 1))
+		return 0;
+
+	fflush(NULL);
+	if (!run_in_process(argv, status))
+		return 0;
+	fflush(NULL);
+
+	child_process_clear(cmd);
+	invalidate_lstat_cache();
+	return 1;
+}
 
 int run_command(struct child_process *cmd)
 {
@@ -1012,6 +1119,9 @@ int run_command(struct child_process *cmd)
 	if (cmd->out < 0 || cmd->err < 0)
 		BUG("run_command with a pipe can cause deadlock");
 
+	if (maybe_run_in_process(cmd, &code))
+		return code;
+
 	code = start_command(cmd);
 	if (code)
 		return code;
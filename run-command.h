@@ -194,6 +194,25 @@ int finish_command(struct child_process *);
 
 int finish_command_in_signal(struct child_process *);
 
+/**
+ * Like start_command() with `in`, `out` and `err` set to -1, but
+ * instead of running a program, fork and call `fn` with the arguments
+ * in `cmd->args` in the child, which exits with its return value. The
+ * child inherits everything this process has read, so it does not
+ * have to start from scratch as an exec'd git would. Only
+ * `clean_on_exit` is looked at among the other fields of `cmd`.
+ *
+ * The child leaves with _exit(), also when it dies, so that the
+ * atexit handlers of this process, like the one that ends its trace2
+ * session, are not run twice. Wait for it with finish_command().
+ *
+ * Returns -1 without starting anything if the pipes or the child
+ * cannot be created, e.g. where fork() is not available.
+ */
+int start_forked_command(struct child_process *cmd,
+			 int (*fn)(int argc, const char **argv, void *data),
+			 void *data);
+
 /**
  * A convenience function that encapsulates a sequence of
  * start_command() followed by finish_command(). Takes a pointer
@@ -201,6 +220,19 @@ int finish_command_in_signal(struct child_process *);
  */
 int run_command(struct child_process *);
 
+/**
+ * The git program sets a routine that run_command() calls for git
+ * commands (with `.git_cmd`) that would inherit our stdio, working
+ * directory and environment, i.e. that would see the same repository
+ * the same way we do. If the routine returns 1 it has run the command
+ * in this process and stored its exit code in `*status`, and no child
+ * is spawned; otherwise, run_command() starts a child as usual.
+ *
+ * Set GIT_TEST_IN_PROCESS_BUILTINS=0 to always spawn.
+ */
+typedef int (*run_in_process_fn)(const char **argv, int *status);
+void set_run_in_process_routine(run_in_process_fn fn);
+
 /*
  * Returns the path to the hook file, or NULL if the hook is missing
  * or disabled. Note that this points to static storage that will be
@@ -206,6 +206,11 @@ static int git_sequencer_config(const char *k, const char *v, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(k, "rebase.inmemory")) {
+		opts->in_memory = git_config_bool(k, v);
+		return 0;
+	}
+
 	if (!opts->default_strategy && !strcmp(k, "pull.twohead")) {
 		int ret = git_config_string((const char**)&opts->default_strategy, k, v);
 		if (ret == 0) {
@@ -3253,18 +3258,16 @@ int sequencer_skip(struct repository *r, struct replay_opts *opts)
 	return -1;
 }
 
-static int save_todo(struct todo_list *todo_list, struct replay_opts *opts)
+/*
+ * Write the commands from "next" on as the todo list, and for rebase -i
+ * append those from "first_done" up to "next" to "done".
+ */
+static int save_todo_from(struct todo_list *todo_list,
+			  struct replay_opts *opts, int first_done, int next)
 {
 	struct lock_file todo_lock = LOCK_INIT;
 	const char *todo_path = get_todo_path(opts);
-	int next = todo_list->current, offset, fd;
-
-	/*
-	 * rebase -i writes "git-rebase-todo" without the currently executing
-	 * command, appending it to "done" instead.
-	 */
-	if (is_rebase_i(opts))
-		next++;
+	int offset, fd;
 
 	fd = hold_lock_file_for_update(&todo_lock, todo_path, 0);
 	if (fd < 0)
@@ -3276,15 +3279,16 @@ static int save_todo(struct todo_list *todo_list, struct replay_opts *opts)
 	if (commit_lock_file(&todo_lock) < 0)
 		return error(_("failed to finalize '%s'"), todo_path);
 
-	if (is_rebase_i(opts) && next > 0) {
+	if (is_rebase_i(opts) && first_done < next) {
 		const char *done = rebase_path_done();
 		int fd = open(done, O_CREAT | O_WRONLY | O_APPEND, 0666);
 		int ret = 0;
 
 		if (fd < 0)
 			return 0;
-		if (write_in_full(fd, get_item_line(todo_list, next - 1),
-				  get_item_line_length(todo_list, next - 1))
+		offset = get_item_line_offset(todo_list, first_done);
+		if (write_in_full(fd, todo_list->buf.buf + offset,
+				  get_item_line_offset(todo_list, next) - offset)
 		    < 0)
 			ret = error_errno(_("could not write to '%s'"), done);
 		if (close(fd) < 0)
@@ -3294,6 +3298,20 @@ static int save_todo(struct todo_list *todo_list, struct replay_opts *opts)
 	return 0;
 }
 
+static int save_todo(struct todo_list *todo_list, struct replay_opts *opts)
+{
+	int next = todo_list->current;
+
+	/*
+	 * rebase -i writes "git-rebase-todo" without the currently executing
+	 * command, appending it to "done" instead.
+	 */
+	if (is_rebase_i(opts))
+		next++;
+
+	return save_todo_from(todo_list, opts, next > 0 ? next - 1 : 0, next);
+}
+
 static int save_opts(struct replay_opts *opts)
 {
 	const char *opts_file = git_path_opts_file();
@@ -4266,10 +4284,248 @@ N_("Could not execute the todo command\n"
 "    git rebase --edit-todo\n"
 "    git rebase --continue\n");
 
+/*
+ * With rebase.inMemory, a run of plain picks that merge cleanly is made
+ * in memory: merge-ort merges them without touching the index or the
+ * working tree, and their commits are written, but HEAD, the index, the
+ * working tree and the todo list are only brought up to date at a
+ * checkpoint. That is before any other command, every
+ * DEFERRED_PICKS_CHECKPOINT picks, and at the end. A pick that does not
+ * merge cleanly or becomes empty is made again the usual way after a
+ * checkpoint, so that it stops exactly as it would have.
+ */
+#define DEFERRED_PICKS_CHECKPOINT 100
+
+struct deferred_pick {
+	struct object_id picked;
+	struct object_id old_head, new_head;
+	char *reflog_msg;
+};
+
+struct deferred_picks {
+	int enabled;
+
+	/* what HEAD, the index and the working tree are at */
+	struct commit *orig_head;
+	/* what HEAD will be at after the picks */
+	struct commit *head;
+	/* the first todo item that has not been saved */
+	int first;
+
+	struct deferred_pick *picks;
+	int nr, alloc;
+
+	struct merge_options merge_opt;
+	struct merge_result result;
+};
+
+static void init_deferred_picks(struct repository *r,
+				struct replay_opts *opts,
+				struct deferred_picks *d)
+{
+	int i;
+
+	memset(d, 0, sizeof(*d));
+	d->enabled = is_rebase_i(opts) &&
+		git_env_bool("GIT_TEST_REBASE_IN_MEMORY", opts->in_memory) &&
+		opts->strategy && !strcmp(opts->strategy, "ort") &&
+		!opts->no_commit && !opts->signoff && !opts->record_origin &&
+		!should_edit(opts) && !opts->committer_date_is_author_date &&
+		!opts->ignore_date &&
+		!find_hook("prepare-commit-msg") && !find_hook("post-commit");
+	if (!d->enabled)
+		return;
+
+	init_merge_options(&d->merge_opt, r);
+	d->merge_opt.buffer_output = 2;
+	d->merge_opt.show_rename_progress = 1;
+	for (i = 0; i < opts->xopts_nr; i++)
+		parse_merge_opt(&d->merge_opt, opts->xopts[i]);
+}
+
+static int can_defer_pick(struct todo_list *todo_list,
+			  struct todo_item *item,
+			  struct deferred_picks *d)
+{
+	if (!d->enabled)
+		return 0;
+	if (is_noop(item->command))
+		return d->nr > 0;
+	return item->command == TODO_PICK &&
+		item->commit->parents && !item->commit->parents->next &&
+		!is_fixup(peek_command(todo_list, 1));
+}
+
+/*
+ * Make the pick "item" in memory. Return 1 if it has to be made the
+ * usual way instead.
+ */
+static int defer_pick(struct repository *r, struct replay_opts *opts,
+		      struct todo_list *todo_list, struct todo_item *item,
+		      struct deferred_picks *d)
+{
+	struct commit *commit = item->commit, *parent;
+	struct commit_message msg = { NULL, NULL, NULL, NULL };
+	struct strbuf msgbuf = STRBUF_INIT, reflog_msg = STRBUF_INIT;
+	struct deferred_pick *pick;
+	struct object_id new_head;
+	char *author = NULL;
+	int ret = 1;
+
+	if (is_noop(item->command))
+		return 0;
+
+	if (!d->nr) {
+		struct object_id head;
+
+		if (get_oid("HEAD", &head) ||
+		    (opts->have_squash_onto &&
+		     oideq(&head, &opts->squash_onto)) ||
+		    !(d->orig_head = lookup_commit_reference(r, &head)))
+			return 1; /* root commits are made the usual way */
+		repo_read_index(r);
+		if (index_differs_from(r, "HEAD", NULL, 0))
+			return 1; /* let do_pick_commit() complain */
+		d->head = d->orig_head;
+		d->first = todo_list->current;
+	}
+
+	parent = commit->parents->item;
+	if (parse_commit(parent) || get_message(commit, &msg))
+		goto out;
+
+	if (opts->allow_ff && oideq(&parent->object.oid, &d->head->object.oid)) {
+		oidcpy(&new_head, &commit->object.oid);
+		strbuf_addf(&reflog_msg, _("%s: fast-forward"),
+			    _(action_name(opts)));
+	} else {
+		struct commit_list *parents = NULL;
+		const char *body;
+
+		/* allow_empty() decides what to do with those */
+		if (oideq(get_commit_tree_oid(commit),
+			  get_commit_tree_oid(parent)))
+			goto out;
+
+		d->merge_opt.ancestor = msg.parent_label;
+		d->merge_opt.branch1 = "HEAD";
+		d->merge_opt.branch2 = msg.label;
+		merge_incore_nonrecursive(&d->merge_opt,
+					  get_commit_tree(parent),
+					  get_commit_tree(d->head),
+					  get_commit_tree(commit),
+					  &d->result);
+		if (d->result.clean <= 0 ||
+		    oideq(&d->result.tree->object.oid,
+			  get_commit_tree_oid(d->head)))
+			goto out;
+
+		author = get_author(msg.message);
+		if (!author)
+			goto out;
+		if (find_commit_subject(msg.message, &body))
+			strbuf_addstr(&msgbuf, body);
+		if (opts->default_msg_cleanup != COMMIT_MSG_CLEANUP_NONE)
+			strbuf_stripspace(&msgbuf, opts->default_msg_cleanup ==
+						   COMMIT_MSG_CLEANUP_ALL);
+
+		commit_list_insert(d->head, &parents);
+		reset_ident_date();
+		if (commit_tree_extended(msgbuf.buf, msgbuf.len,
+					 &d->result.tree->object.oid, parents,
+					 &new_head, author, NULL,
+					 opts->gpg_sign, NULL))
+			goto out;
+
+		/* as update_head_with_reflog() would write it */
+		strbuf_addf(&reflog_msg, "%s: %.*s",
+			    reflog_message(opts, command_to_string(item->command),
+					   NULL),
+			    (int)strcspn(msgbuf.buf, "\n"), msgbuf.buf);
+	}
+
+	ALLOC_GROW(d->picks, d->nr + 1, d->alloc);
+	pick = &d->picks[d->nr++];
+	oidcpy(&pick->picked, &commit->object.oid);
+	oidcpy(&pick->old_head, &d->head->object.oid);
+	oidcpy(&pick->new_head, &new_head);
+	pick->reflog_msg = strbuf_detach(&reflog_msg, NULL);
+
+	d->head = lookup_commit(r, &new_head);
+	if (!d->head || parse_commit(d->head))
+		die(_("could not parse newly created commit"));
+	ret = 0;
+
+out:
+	free_message(commit, &msg);
+	free(author);
+	strbuf_release(&msgbuf);
+	strbuf_release(&reflog_msg);
+	return ret;
+}
+
+/*
+ * Bring HEAD, the index, the working tree and the state of the rebase
+ * up to date with the picks made in memory.
+ */
+static int flush_deferred_picks(struct repository *r,
+				struct replay_opts *opts,
+				struct todo_list *todo_list,
+				struct deferred_picks *d)
+{
+	FILE *out;
+	int i, ret = 0;
+
+	if (d->result.priv) {
+		merge_finalize(&d->merge_opt, &d->result);
+		d->result.priv = NULL;
+	}
+	if (!d->nr)
+		return 0;
+
+	repo_read_index(r);
+	if (checkout_fast_forward(r, &d->orig_head->object.oid,
+				  &d->head->object.oid, 1)) {
+		ret = -1; /* the callee should have complained already */
+		goto cleanup;
+	}
+
+	for (i = 0; i < d->nr; i++) {
+		struct deferred_pick *pick = &d->picks[i];
+
+		if (update_ref(pick->reflog_msg, "HEAD", &pick->new_head,
+			       &pick->old_head, 0, UPDATE_REFS_MSG_ON_ERR)) {
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	update_abort_safety_file();
+
+	out = fopen_or_warn(rebase_path_rewritten_list(), "a");
+	if (out) {
+		for (i = 0; i < d->nr; i++)
+			fprintf(out, "%s %s\n",
+				oid_to_hex(&d->picks[i].picked),
+				oid_to_hex(&d->picks[i].new_head));
+		fclose(out);
+	}
+
+	write_file(rebase_path_msgnum(), "%d", todo_list->done_nr);
+	if (save_todo_from(todo_list, opts, d->first, todo_list->current))
+		ret = -1;
+
+cleanup:
+	for (i = 0; i < d->nr; i++)
+		free(d->picks[i].reflog_msg);
+	d->nr = 0;
+	return ret;
+}
+
 static int pick_commits(struct repository *r,
 			struct todo_list *todo_list,
 			struct replay_opts *opts)
 {
+	struct deferred_picks deferred;
 	int res = 0, reschedule = 0;
 	char *prev_reflog_action;
 
@@ -4283,12 +4539,33 @@ static int pick_commits(struct repository *r,
 			 opts->ignore_date));
 	if (read_and_refresh_cache(r, opts))
 		return -1;
+	init_deferred_picks(r, opts, &deferred);
 
 	while (todo_list->current < todo_list->nr) {
 		struct todo_item *item = todo_list->items + todo_list->current;
 		const char *arg = todo_item_get_arg(todo_list, item);
 		int check_todo = 0;
 
+		if (can_defer_pick(todo_list, item, &deferred) &&
+		    !defer_pick(r, opts, todo_list, item, &deferred)) {
+			if (item->command != TODO_COMMENT) {
+				todo_list->done_nr++;
+				if (!opts->quiet)
+					fprintf(stderr, _("Rebasing (%d/%d)%s"),
+						todo_list->done_nr,
+						todo_list->total_nr,
+						opts->verbose ? "\n" : "\r");
+			}
+			todo_list->current++;
+			if (deferred.nr >= DEFERRED_PICKS_CHECKPOINT &&
+			    flush_deferred_picks(r, opts, todo_list, &deferred))
+				return -1;
+			continue;
+		}
+		/* anything else, or a pick that did not work out in memory */
+		if (flush_deferred_picks(r, opts, todo_list, &deferred))
+			return -1;
+
 		if (save_todo(todo_list, opts))
 			return -1;
 		if (is_rebase_i(opts)) {
@@ -4454,6 +4731,9 @@ static int pick_commits(struct repository *r,
 		if (res)
 			return res;
 	}
+	if (flush_deferred_picks(r, opts, todo_list, &deferred))
+		return -1;
+	free(deferred.picks);
 
 	if (is_rebase_i(opts)) {
 		struct strbuf head_ref = STRBUF_INIT, buf = STRBUF_INIT;
@@ -4,6 +4,7 @@
 #include "pkt-line.h"
 #include "version.h"
 #include "strvec.h"
+#include "bundle-uri.h"
 #include "ls-refs.h"
 #include "protocol-caps.h"
 #include "serve.h"
@@ -80,6 +81,7 @@ static struct protocol_capability capabilities[] = {
 	{ "object-format", object_format_advertise, NULL },
 	{ "session-id", session_id_advertise, NULL },
 	{ "object-info", always_advertise, cap_object_info },
+	{ "bundle-uri", bundle_uri_advertise, bundle_uri_command },
 };
 
 static void advertise_capabilities(void)
@@ -1712,6 +1712,43 @@ static void sha1_recompression_step(uint32_t step, uint32_t ihvin[5], uint32_t i
 
 
 
+#ifdef SHA1DC_CUSTOM_HW_COMPRESSION
+/*
+   SHA1DC_CUSTOM_HW_AVAILABLE() tells whether the CPU has instructions for
+   the SHA-1 compression function, and SHA1DC_CUSTOM_HW_COMPRESSION(ihv, m, W)
+   uses them to compress one block, storing the expanded message in W.
+   They cannot record the intermediate states that the collision check
+   needs, so their result is only kept for blocks whose expanded message
+   fails the unavoidable bitconditions of every disturbance vector; those
+   cannot be part of a known collision attack.
+*/
+int SHA1DC_CUSTOM_HW_AVAILABLE(void);
+void SHA1DC_CUSTOM_HW_COMPRESSION(uint32_t ihv[5], const uint32_t m[16], uint32_t W[80]);
+
+static int sha1_process_hw(SHA1_CTX* ctx, const uint32_t block[16])
+{
+	uint32_t ubc_dv_mask[DVMASKSIZE] = { 0xFFFFFFFF };
+
+	if (ctx->detect_coll && !ctx->ubc_check)
+		return 0;
+
+	SHA1DC_CUSTOM_HW_COMPRESSION(ctx->ihv, block, ctx->m1);
+	if (!ctx->detect_coll)
+		return 1;
+
+	ubc_check(ctx->m1, ubc_dv_mask);
+	if (ubc_dv_mask[0] == 0)
+		return 1;
+
+	ctx->ihv[0] = ctx->ihv1[0];
+	ctx->ihv[1] = ctx->ihv1[1];
+	ctx->ihv[2] = ctx->ihv1[2];
+	ctx->ihv[3] = ctx->ihv1[3];
+	ctx->ihv[4] = ctx->ihv1[4];
+	return 0;
+}
+#endif
+
 static void sha1_process(SHA1_CTX* ctx, const uint32_t block[16])
 {
 	unsigned i, j;
@@ -1724,6 +1761,11 @@ static void sha1_process(SHA1_CTX* ctx, const uint32_t block[16])
 	ctx->ihv1[3] = ctx->ihv[3];
 	ctx->ihv1[4] = ctx->ihv[4];
 
+#ifdef SHA1DC_CUSTOM_HW_COMPRESSION
+	if (SHA1DC_CUSTOM_HW_AVAILABLE() && sha1_process_hw(ctx, block))
+		return;
+#endif
+
 	sha1_compression_states(ctx->ihv, block, ctx->m1, ctx->states);
 
 	if (ctx->detect_coll)
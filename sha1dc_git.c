@@ -36,3 +36,106 @@ void git_SHA1DCUpdate(SHA1_CTX *ctx, const void *vdata, unsigned long len)
 	}
 	SHA1DCUpdate(ctx, data, len);
 }
+
+#ifdef SHA1DC_HW_SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+
+/*
+ * Whether the CPU has the SHA extensions, and the SSSE3 and SSE4.1
+ * instructions used to shuffle the message and state around them.
+ */
+int git_SHA1DCHWAvailable(void)
+{
+	static int available = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (available >= 0)
+		return available;
+
+	available = 0;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+	    (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+	    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+	    (ebx & bit_SHA))
+		available = 1;
+	return available;
+}
+
+/*
+ * Four rounds of SHA-1, starting at round 4 * `i`, which also advance the
+ * message schedule: `m0` holds the words for these rounds, `m1`, `m2`
+ * and `m3` those for the next ones, and "msg2", "msg1" and "xor" say
+ * whether words for later rounds still need to be computed from `m0`.
+ * The words are also stored in `W`, for the collision check.
+ */
+#define SHA1_ROUNDS4(i, e, e_next, m0, m1, m2, m3, f, msg2, msg1, xor) \
+	do { \
+		_mm_storeu_si128((__m128i *)(W + 4 * (i)), \
+				 _mm_shuffle_epi32(m0, 0x1b)); \
+		e = _mm_sha1nexte_epu32(e, m0); \
+		e_next = abcd; \
+		if (msg2) \
+			m1 = _mm_sha1msg2_epu32(m1, m0); \
+		abcd = _mm_sha1rnds4_epu32(abcd, e, f); \
+		if (msg1) \
+			m3 = _mm_sha1msg1_epu32(m3, m0); \
+		if (xor) \
+			m2 = _mm_xor_si128(m2, m0); \
+	} while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void git_SHA1DCHWCompress(uint32_t ihv[5], const uint32_t m[16],
+			  uint32_t W[80])
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	const __m128i *block = (const __m128i *)m;
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)ihv), 0x1b);
+	e0 = _mm_set_epi32(ihv[4], 0, 0, 0);
+	abcd_save = abcd;
+	e0_save = e0;
+
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128(block + 0), bswap);
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128(block + 1), bswap);
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128(block + 2), bswap);
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128(block + 3), bswap);
+
+	/* Rounds 0-3 add the first words directly. */
+	_mm_storeu_si128((__m128i *)W, _mm_shuffle_epi32(m0, 0x1b));
+	e0 = _mm_add_epi32(e0, m0);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+	SHA1_ROUNDS4(1, e1, e0, m1, m2, m3, m0, 0, 0, 1, 0);
+	SHA1_ROUNDS4(2, e0, e1, m2, m3, m0, m1, 0, 0, 1, 1);
+	SHA1_ROUNDS4(3, e1, e0, m3, m0, m1, m2, 0, 1, 1, 1);
+	SHA1_ROUNDS4(4, e0, e1, m0, m1, m2, m3, 0, 1, 1, 1);
+
+	SHA1_ROUNDS4(5, e1, e0, m1, m2, m3, m0, 1, 1, 1, 1);
+	SHA1_ROUNDS4(6, e0, e1, m2, m3, m0, m1, 1, 1, 1, 1);
+	SHA1_ROUNDS4(7, e1, e0, m3, m0, m1, m2, 1, 1, 1, 1);
+	SHA1_ROUNDS4(8, e0, e1, m0, m1, m2, m3, 1, 1, 1, 1);
+	SHA1_ROUNDS4(9, e1, e0, m1, m2, m3, m0, 1, 1, 1, 1);
+
+	SHA1_ROUNDS4(10, e0, e1, m2, m3, m0, m1, 2, 1, 1, 1);
+	SHA1_ROUNDS4(11, e1, e0, m3, m0, m1, m2, 2, 1, 1, 1);
+	SHA1_ROUNDS4(12, e0, e1, m0, m1, m2, m3, 2, 1, 1, 1);
+	SHA1_ROUNDS4(13, e1, e0, m1, m2, m3, m0, 2, 1, 1, 1);
+	SHA1_ROUNDS4(14, e0, e1, m2, m3, m0, m1, 2, 1, 1, 1);
+
+	SHA1_ROUNDS4(15, e1, e0, m3, m0, m1, m2, 3, 1, 1, 1);
+	SHA1_ROUNDS4(16, e0, e1, m0, m1, m2, m3, 3, 1, 1, 1);
+	SHA1_ROUNDS4(17, e1, e0, m1, m2, m3, m0, 3, 1, 0, 1);
+	SHA1_ROUNDS4(18, e0, e1, m2, m3, m0, m1, 3, 1, 0, 0);
+	SHA1_ROUNDS4(19, e1, e0, m3, m0, m1, m2, 3, 0, 0, 0);
+
+	e0 = _mm_sha1nexte_epu32(e0, e0_save);
+	abcd = _mm_shuffle_epi32(_mm_add_epi32(abcd, abcd_save), 0x1b);
+	_mm_storeu_si128((__m128i *)ihv, abcd);
+	ihv[4] = _mm_extract_epi32(e0, 3);
+}
+#endif
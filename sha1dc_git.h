@@ -17,6 +17,12 @@ void git_SHA1DCInit(SHA1_CTX *);
 void git_SHA1DCFinal(unsigned char [20], SHA1_CTX *);
 void git_SHA1DCUpdate(SHA1_CTX *ctx, const void *data, unsigned long len);
 
+#ifdef SHA1DC_HW_SHA_NI
+int git_SHA1DCHWAvailable(void);
+void git_SHA1DCHWCompress(uint32_t ihv[5], const uint32_t m[16],
+			  uint32_t W[80]);
+#endif
+
 #define platform_SHA_CTX SHA1_CTX
 #define platform_SHA1_Init git_SHA1DCInit
 #define platform_SHA1_Update git_SHA1DCUpdate
@@ -148,6 +148,135 @@ static void blk_SHA256_Transform(blk_SHA256_CTX *ctx, const unsigned char *buf)
 		ctx->state[i] += S[i];
 }
 
+#ifdef SHA256_BLK_SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+
+static int have_sha_ni(void)
+{
+	static int available = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (available >= 0)
+		return available;
+
+	available = 0;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+	    (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+	    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+	    (ebx & bit_SHA))
+		available = 1;
+	return available;
+}
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/*
+ * Rounds 4 * `i` to 4 * `i` + 3, using the message words in `m0`. The
+ * message schedule keeps the following words in `m1`, `m2` and `m3`;
+ * "msg2" and "msg1" say whether words for later rounds still need to be
+ * computed from `m0`.
+ */
+#define SHA256_ROUNDS4(i, m0, m1, m3, msg2, msg1) \
+	do { \
+		msg = _mm_add_epi32(m0, _mm_loadu_si128((const __m128i *)&K[4 * (i)])); \
+		state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+		if (msg2) { \
+			m1 = _mm_add_epi32(m1, _mm_alignr_epi8(m0, m3, 4)); \
+			m1 = _mm_sha256msg2_epu32(m1, m0); \
+		} \
+		msg = _mm_shuffle_epi32(msg, 0x0e); \
+		state0 = _mm_sha256rnds2_epu32(state0, state1, msg); \
+		if (msg1) \
+			m3 = _mm_sha256msg1_epu32(m3, m0); \
+	} while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void blk_SHA256_Transform_sha_ni(blk_SHA256_CTX *ctx,
+					const unsigned char *buf,
+					size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					     0x0405060700010203ULL);
+	__m128i state0, state1, abef_save, cdgh_save, msg, tmp;
+	__m128i m0, m1, m2, m3;
+
+	/* The instructions want the state as ABEF and CDGH. */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&ctx->state[0]), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&ctx->state[4]), 0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; blocks; blocks--, buf += 64) {
+		abef_save = state0;
+		cdgh_save = state1;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 0)), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 48)), bswap);
+
+		SHA256_ROUNDS4(0, m0, m1, m3, 0, 0);
+		SHA256_ROUNDS4(1, m1, m2, m0, 0, 1);
+		SHA256_ROUNDS4(2, m2, m3, m1, 0, 1);
+		SHA256_ROUNDS4(3, m3, m0, m2, 1, 1);
+		SHA256_ROUNDS4(4, m0, m1, m3, 1, 1);
+		SHA256_ROUNDS4(5, m1, m2, m0, 1, 1);
+		SHA256_ROUNDS4(6, m2, m3, m1, 1, 1);
+		SHA256_ROUNDS4(7, m3, m0, m2, 1, 1);
+		SHA256_ROUNDS4(8, m0, m1, m3, 1, 1);
+		SHA256_ROUNDS4(9, m1, m2, m0, 1, 1);
+		SHA256_ROUNDS4(10, m2, m3, m1, 1, 1);
+		SHA256_ROUNDS4(11, m3, m0, m2, 1, 1);
+		SHA256_ROUNDS4(12, m0, m1, m3, 1, 1);
+		SHA256_ROUNDS4(13, m1, m2, m0, 1, 0);
+		SHA256_ROUNDS4(14, m2, m3, m1, 1, 0);
+		SHA256_ROUNDS4(15, m3, m0, m2, 0, 0);
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *)&ctx->state[0], state0);
+	_mm_storeu_si128((__m128i *)&ctx->state[4], state1);
+}
+#endif
+
+static void blk_SHA256_Transform_blocks(blk_SHA256_CTX *ctx,
+					const unsigned char *buf,
+					size_t blocks)
+{
+#ifdef SHA256_BLK_SHA_NI
+	if (have_sha_ni()) {
+		blk_SHA256_Transform_sha_ni(ctx, buf, blocks);
+		return;
+	}
+#endif
+	for (; blocks; blocks--, buf += 64)
+		blk_SHA256_Transform(ctx, buf);
+}
+
 void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, size_t len)
 {
 	unsigned int len_buf = ctx->size & 63;
@@ -165,12 +294,12 @@ void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, size_t len)
 		data = ((const char *)data + left);
 		if (len_buf)
 			return;
-		blk_SHA256_Transform(ctx, ctx->buf);
+		blk_SHA256_Transform_blocks(ctx, ctx->buf, 1);
 	}
-	while (len >= 64) {
-		blk_SHA256_Transform(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		blk_SHA256_Transform_blocks(ctx, data, len / 64);
+		data = ((const char *)data + (len & ~(size_t)63));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->buf, data, len);
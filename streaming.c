@@ -277,8 +277,14 @@ static ssize_t read_istream_pack_non_delta(struct git_istream *st, char *buf,
 		struct pack_window *window = NULL;
 		unsigned char *mapped;
 
+		/*
+		 * The window stays mapped while we hold it, so only
+		 * getting and releasing it needs obj_read_mutex.
+		 */
+		obj_read_lock();
 		mapped = use_pack(st->u.in_pack.pack, &window,
 				  st->u.in_pack.pos, &st->z.avail_in);
+		obj_read_unlock();
 
 		st->z.next_out = (unsigned char *)buf + total_read;
 		st->z.avail_out = sz - total_read;
@@ -287,7 +293,9 @@ static ssize_t read_istream_pack_non_delta(struct git_istream *st, char *buf,
 
 		st->u.in_pack.pos += st->z.next_in - mapped;
 		total_read = st->z.next_out - (unsigned char *)buf;
+		obj_read_lock();
 		unuse_pack(&window);
+		obj_read_unlock();
 
 		if (status == Z_STREAM_END) {
 			git_inflate_end(&st->z);
@@ -448,21 +456,26 @@ struct git_istream *open_istream(struct repository *r,
 {
 	struct git_istream *st = xmalloc(sizeof(*st));
 	const struct object_id *real = lookup_replace_object(r, oid);
-	int ret = istream_source(st, r, real, type);
+	int ret;
+
+	/*
+	 * Reading from an opened stream is safe to do in parallel with
+	 * other object reads, but finding and opening the object is not.
+	 */
+	obj_read_lock();
+	ret = istream_source(st, r, real, type);
+	if (!ret && st->open(st, r, real, type))
+		ret = open_istream_incore(st, r, real, type);
+	obj_read_unlock();
 
 	if (ret) {
 		free(st);
 		return NULL;
 	}
-
-	if (st->open(st, r, real, type)) {
-		if (open_istream_incore(st, r, real, type)) {
-			free(st);
-			return NULL;
-		}
-	}
-	if (filter) {
-		/* Add "&& !is_null_stream_filter(filter)" for performance */
+	if (filter && is_null_stream_filter(filter)) {
+		/* nothing to convert; let readers see the raw stream */
+		free_stream_filter(filter);
+	} else if (filter) {
 		struct git_istream *nst = attach_stream_filter(st, filter);
 		if (!nst) {
 			close_istream(st);
@@ -475,6 +488,62 @@ struct git_istream *open_istream(struct repository *r,
 	return st;
 }
 
+#define STREAM_HOLE_CHUNK (1024 * 16)
+
+static int is_hole_chunk(const char *buf, size_t len)
+{
+	size_t i;
+
+	if (len != STREAM_HOLE_CHUNK)
+		return 0;
+	for (i = 0; i < len; i++)
+		if (buf[i])
+			return 0;
+	return 1;
+}
+
+/*
+ * Write "len" bytes from "buf" to "fd". When "can_seek" is set, whole
+ * chunks of zeros are not written but accumulated in "*kept", to be
+ * skipped over with lseek() so that the file ends up sparse. Adjacent
+ * chunks of data are written with a single write.
+ */
+static int write_sparse(int fd, const char *buf, size_t len,
+			int can_seek, ssize_t *kept)
+{
+	while (len) {
+		size_t run = 0;
+
+		while (can_seek && len >= STREAM_HOLE_CHUNK &&
+		       is_hole_chunk(buf, STREAM_HOLE_CHUNK)) {
+			*kept += STREAM_HOLE_CHUNK;
+			buf += STREAM_HOLE_CHUNK;
+			len -= STREAM_HOLE_CHUNK;
+		}
+		if (!len)
+			break;
+
+		while (run < len) {
+			size_t n = len - run;
+
+			if (n > STREAM_HOLE_CHUNK)
+				n = STREAM_HOLE_CHUNK;
+			if (can_seek && is_hole_chunk(buf + run, n))
+				break;
+			run += n;
+		}
+
+		if (*kept && lseek(fd, *kept, SEEK_CUR) == (off_t) -1)
+			return -1;
+		*kept = 0;
+		if (write_in_full(fd, buf, run) < 0)
+			return -1;
+		buf += run;
+		len -= run;
+	}
+	return 0;
+}
+
 int stream_blob_to_fd(int fd, const struct object_id *oid, struct stream_filter *filter,
 		      int can_seek)
 {
@@ -492,33 +561,27 @@ int stream_blob_to_fd(int fd, const struct object_id *oid, struct stream_filter
 	}
 	if (type != OBJ_BLOB)
 		goto close_and_exit;
-	for (;;) {
-		char buf[1024 * 16];
-		ssize_t wrote, holeto;
-		ssize_t readlen = read_istream(st, buf, sizeof(buf));
 
-		if (readlen < 0)
+	if (st->read == read_istream_incore) {
+		/*
+		 * The whole blob is already in memory; write it out
+		 * directly instead of copying it through a buffer.
+		 */
+		if (write_sparse(fd, st->u.incore.buf, st->size,
+				 can_seek, &kept))
 			goto close_and_exit;
-		if (!readlen)
-			break;
-		if (can_seek && sizeof(buf) == readlen) {
-			for (holeto = 0; holeto < readlen; holeto++)
-				if (buf[holeto])
-					break;
-			if (readlen == holeto) {
-				kept += holeto;
-				continue;
-			}
+	} else {
+		for (;;) {
+			char buf[STREAM_HOLE_CHUNK * 4];
+			ssize_t readlen = read_istream(st, buf, sizeof(buf));
+
+			if (readlen < 0)
+				goto close_and_exit;
+			if (!readlen)
+				break;
+			if (write_sparse(fd, buf, readlen, can_seek, &kept))
+				goto close_and_exit;
 		}
-
-		if (kept && lseek(fd, kept, SEEK_CUR) == (off_t) -1)
-			goto close_and_exit;
-		else
-			kept = 0;
-		wrote = write_in_full(fd, buf, readlen);
-
-		if (wrote < 0)
-			goto close_and_exit;
 	}
 	if (kept && (lseek(fd, kept - 1, SEEK_CUR) == (off_t) -1 ||
 		     xwrite(fd, "", 1) != 1))
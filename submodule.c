@@ -1660,14 +1660,16 @@ int fetch_populated_submodules(struct repository *r,
 	return spf.result;
 }
 
-unsigned is_submodule_modified(const char *path, int ignore_untracked)
+/*
+ * Start "git status" in the submodule at `path`. Return 1 without
+ * starting anything if the submodule is not checked out, and thus
+ * cannot be modified.
+ */
+static int start_submodule_status(struct child_process *cp, const char *path,
+				  int ignore_untracked)
 {
-	struct child_process cp = CHILD_PROCESS_INIT;
 	struct strbuf buf = STRBUF_INIT;
-	FILE *fp;
-	unsigned dirty_submodule = 0;
 	const char *git_dir;
-	int ignore_cp_exit_code = 0;
 
 	strbuf_addf(&buf, "%s/.git", path);
 	git_dir = read_gitfile(buf.buf);
@@ -1678,23 +1680,33 @@ unsigned is_submodule_modified(const char *path, int ignore_untracked)
 			die(_("'%s' not recognized as a git repository"), git_dir);
 		strbuf_release(&buf);
 		/* The submodule is not checked out, so it is not modified */
-		return 0;
+		return 1;
 	}
-	strbuf_reset(&buf);
+	strbuf_release(&buf);
 
-	strvec_pushl(&cp.args, "status", "--porcelain=2", NULL);
+	strvec_pushl(&cp->args, "status", "--porcelain=2", NULL);
 	if (ignore_untracked)
-		strvec_push(&cp.args, "-uno");
-
-	prepare_submodule_repo_env(&cp.env_array);
-	cp.git_cmd = 1;
-	cp.no_stdin = 1;
-	cp.out = -1;
-	cp.dir = path;
-	if (start_command(&cp))
+		strvec_push(&cp->args, "-uno");
+
+	prepare_submodule_repo_env(&cp->env_array);
+	cp->git_cmd = 1;
+	cp->no_stdin = 1;
+	cp->out = -1;
+	cp->dir = path;
+	if (start_command(cp))
 		die(_("Could not run 'git status --porcelain=2' in submodule %s"), path);
+	return 0;
+}
 
-	fp = xfdopen(cp.out, "r");
+static unsigned finish_submodule_status(struct child_process *cp,
+					const char *path, int ignore_untracked)
+{
+	struct strbuf buf = STRBUF_INIT;
+	FILE *fp;
+	unsigned dirty_submodule = 0;
+	int ignore_cp_exit_code = 0;
+
+	fp = xfdopen(cp->out, "r");
 	while (strbuf_getwholeline(&buf, fp, '\n') != EOF) {
 		/* regular untracked files */
 		if (buf.buf[0] == '?')
@@ -1732,13 +1744,63 @@ unsigned is_submodule_modified(const char *path, int ignore_untracked)
 	}
 	fclose(fp);
 
-	if (finish_command(&cp) && !ignore_cp_exit_code)
+	if (finish_command(cp) && !ignore_cp_exit_code)
 		die(_("'git status --porcelain=2' failed in submodule %s"), path);
 
 	strbuf_release(&buf);
 	return dirty_submodule;
 }
 
+unsigned is_submodule_modified(const char *path, int ignore_untracked)
+{
+	struct submodule_status status = {
+		.path = path,
+		.ignore_untracked = ignore_untracked,
+	};
+
+	get_submodules_status(&status, 1, 1);
+	return status.dirty_submodule;
+}
+
+void get_submodules_status(struct submodule_status *submodules, size_t nr,
+			   int max_jobs)
+{
+	struct child_process *cp;
+	size_t started = 0, finished = 0;
+
+	if (max_jobs < 1)
+		max_jobs = online_cpus();
+	if (!nr)
+		return;
+
+	/*
+	 * Keep up to `max_jobs` children running, and read their
+	 * output in the order they were started; the ones behind the
+	 * oldest keep working while it is being read.
+	 */
+	ALLOC_ARRAY(cp, nr);
+	while (finished < nr) {
+		while (started < nr && started - finished < max_jobs) {
+			struct submodule_status *s = &submodules[started];
+
+			child_process_init(&cp[started]);
+			s->dirty_submodule = 0;
+			s->started = !start_submodule_status(&cp[started],
+							     s->path,
+							     s->ignore_untracked);
+			started++;
+		}
+
+		if (submodules[finished].started)
+			submodules[finished].dirty_submodule =
+				finish_submodule_status(&cp[finished],
+							submodules[finished].path,
+							submodules[finished].ignore_untracked);
+		finished++;
+	}
+	free(cp);
+}
+
 int submodule_uses_gitfile(const char *path)
 {
 	struct child_process cp = CHILD_PROCESS_INIT;
@@ -90,6 +90,33 @@ int fetch_populated_submodules(struct repository *r,
 			       int default_option,
 			       int quiet, int max_parallel_jobs);
 unsigned is_submodule_modified(const char *path, int ignore_untracked);
+
+/*
+ * The state of a submodule's work tree, as found by
+ * get_submodules_status().
+ */
+struct submodule_status {
+	const char *path;
+	int ignore_untracked;
+
+	/* DIRTY_SUBMODULE_* flags, filled in by get_submodules_status() */
+	unsigned dirty_submodule;
+
+	/* for the use of the caller */
+	void *util;
+
+	/* private */
+	unsigned started : 1;
+};
+
+/*
+ * Find out, like is_submodule_modified(), whether each of the `nr`
+ * `submodules` is modified, running "git status" in up to `max_jobs`
+ * of them at a time (or a number that suits the machine, if less than
+ * one).
+ */
+void get_submodules_status(struct submodule_status *submodules, size_t nr,
+			   int max_jobs);
 int submodule_uses_gitfile(const char *path);
 
 #define SUBMODULE_REMOVAL_DIE_ON_ERROR (1<<0)
@@ -0,0 +1,784 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "delta.h"
+#include "ewah/ewok.h"
+#include "json-writer.h"
+#include "mergesort.h"
+#include "midx.h"
+#include "object-store.h"
+#include "oidset.h"
+#include "oidtable.h"
+#include "packfile.h"
+#include "parse-options.h"
+#include "prio-queue.h"
+#include "strmap.h"
+#include "wildmatch.h"
+#include "xdiff/xinclude.h"
+
+/*
+ * Microbenchmarks of the data structures and kernels that hot paths are
+ * built on. Each benchmark builds an input of size "n" (scaled with
+ * --scale) and brackets the code it measures with bench_start() and
+ * bench_stop(), so that setting up and tearing down is not timed. It is
+ * run --repeat times, and each run gives one sample.
+ *
+ * Inputs come from a generator that is reseeded before each run, so all
+ * runs, and runs of different builds, see the same data.
+ */
+struct bench_run {
+	size_t n;
+	uint64_t start_ns;
+	uint64_t elapsed_ns;
+	const char *skipped;
+};
+
+static void bench_start(struct bench_run *run)
+{
+	run->start_ns = getnanotime();
+}
+
+static void bench_stop(struct bench_run *run)
+{
+	run->elapsed_ns += getnanotime() - run->start_ns;
+}
+
+static uint64_t bench_state;
+
+static void bench_srand(void)
+{
+	bench_state = 88172645463325252ull;
+}
+
+/* xorshift64* */
+static uint32_t bench_rand(void)
+{
+	bench_state ^= bench_state >> 12;
+	bench_state ^= bench_state << 25;
+	bench_state ^= bench_state >> 27;
+	return (bench_state * 2685821657736338717ull) >> 32;
+}
+
+static struct object_id *random_oids(size_t n)
+{
+	struct object_id *oids;
+	size_t i, j;
+
+	CALLOC_ARRAY(oids, n);
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < the_hash_algo->rawsz; j++)
+			oids[i].hash[j] = bench_rand();
+		oids[i].algo = hash_algo_by_ptr(the_hash_algo);
+	}
+	return oids;
+}
+
+static char **random_strings(size_t n)
+{
+	char **strings;
+	size_t i;
+
+	ALLOC_ARRAY(strings, n);
+	for (i = 0; i < n; i++)
+		strings[i] = xstrfmt("refs/heads/topic-%08x", bench_rand());
+	return strings;
+}
+
+static void free_strings(char **strings, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		free(strings[i]);
+	free(strings);
+}
+
+/*
+ * A text of about `len` bytes in lines of 10 to 70 characters, and a
+ * copy of it with about one line in 64 changed, as a source and target
+ * for deltas and diffs.
+ */
+static void random_texts(struct strbuf *old, struct strbuf *new, size_t len)
+{
+	while (old->len < len) {
+		size_t width = 10 + bench_rand() % 60;
+		size_t start = old->len;
+
+		while (old->len - start < width)
+			strbuf_addch(old, 'a' + bench_rand() % 26);
+		strbuf_addch(old, '\n');
+
+		if (bench_rand() % 64) {
+			strbuf_add(new, old->buf + start, old->len - start);
+		} else {
+			strbuf_addf(new, "changed %u\n", bench_rand());
+		}
+	}
+}
+
+static void bench_strmap_put(struct bench_run *run)
+{
+	struct strmap map = STRMAP_INIT;
+	char **keys = random_strings(run->n);
+	size_t i;
+
+	bench_start(run);
+	for (i = 0; i < run->n; i++)
+		strmap_put(&map, keys[i], keys[i]);
+	bench_stop(run);
+
+	strmap_clear(&map, 0);
+	free_strings(keys, run->n);
+}
+
+static void bench_strmap_get(struct bench_run *run)
+{
+	struct strmap map = STRMAP_INIT;
+	char **keys = random_strings(run->n);
+	size_t i, found = 0;
+
+	for (i = 0; i < run->n; i += 2)
+		strmap_put(&map, keys[i], keys[i]);
+
+	bench_start(run);
+	for (i = 0; i < run->n; i++)
+		found += !!strmap_get(&map, keys[i]);
+	bench_stop(run);
+
+	if (found != (run->n + 1) / 2)
+		BUG("strmap lost entries");
+	strmap_clear(&map, 0);
+	free_strings(keys, run->n);
+}
+
+static void bench_oidset_insert(struct bench_run *run)
+{
+	struct oidset set = OIDSET_INIT;
+	struct object_id *oids = random_oids(run->n);
+	size_t i;
+
+	bench_start(run);
+	for (i = 0; i < run->n; i++)
+		oidset_insert(&set, &oids[i]);
+	bench_stop(run);
+
+	oidset_clear(&set);
+	free(oids);
+}
+
+static void bench_oidset_contains(struct bench_run *run)
+{
+	struct oidset set = OIDSET_INIT;
+	struct object_id *oids = random_oids(run->n);
+	size_t i, found = 0;
+
+	for (i = 0; i < run->n; i += 2)
+		oidset_insert(&set, &oids[i]);
+
+	bench_start(run);
+	for (i = 0; i < run->n; i++)
+		found += oidset_contains(&set, &oids[i]);
+	bench_stop(run);
+
+	if (found != (run->n + 1) / 2)
+		BUG("oidset lost entries");
+	oidset_clear(&set);
+	free(oids);
+}
+
+static void bench_oidtable_put(struct bench_run *run)
+{
+	struct oidtable table = { 0 };
+	struct object_id *oids = random_oids(run->n);
+	size_t i;
+
+	bench_start(run);
+	for (i = 0; i < run->n; i++)
+		oidtable_put(&table, &oids[i], NULL);
+	bench_stop(run);
+
+	oidtable_clear(&table);
+	free(oids);
+}
+
+static void bench_oidtable_get(struct bench_run *run)
+{
+	struct oidtable table = { 0 };
+	struct object_id *oids = random_oids(run->n);
+	size_t i, found = 0;
+
+	for (i = 0; i < run->n; i += 2)
+		oidtable_put(&table, &oids[i], NULL);
+
+	bench_start(run);
+	for (i = 0; i < run->n; i++)
+		found += !!oidtable_get(&table, &oids[i]);
+	bench_stop(run);
+
+	if (found != (run->n + 1) / 2)
+		BUG("oidtable lost entries");
+	oidtable_clear(&table);
+	free(oids);
+}
+
+static int compare_u32(const void *va, const void *vb, void *data)
+{
+	uint32_t a = *(const uint32_t *)va, b = *(const uint32_t *)vb;
+	return a < b ? -1 : a > b;
+}
+
+static void bench_prio_queue(struct bench_run *run)
+{
+	struct prio_queue queue = { compare_u32 };
+	uint32_t *values;
+	size_t i;
+
+	ALLOC_ARRAY(values, run->n);
+	for (i = 0; i < run->n; i++)
+		values[i] = bench_rand();
+
+	bench_start(run);
+	for (i = 0; i < run->n; i++)
+		prio_queue_put(&queue, &values[i]);
+	while (prio_queue_get(&queue))
+		; /* drain */
+	bench_stop(run);
+
+	clear_prio_queue(&queue);
+	free(values);
+}
+
+struct bench_node {
+	uint32_t value;
+	struct bench_node *next;
+};
+
+static void *bench_node_get_next(const void *a)
+{
+	return ((const struct bench_node *)a)->next;
+}
+
+static void bench_node_set_next(void *a, void *b)
+{
+	((struct bench_node *)a)->next = b;
+}
+
+static int bench_node_compare(const void *va, const void *vb)
+{
+	const struct bench_node *a = va, *b = vb;
+	return a->value < b->value ? -1 : a->value > b->value;
+}
+
+static void bench_mergesort(struct bench_run *run)
+{
+	struct bench_node *nodes, *list = NULL;
+	size_t i;
+
+	ALLOC_ARRAY(nodes, run->n);
+	for (i = 0; i < run->n; i++) {
+		nodes[i].value = bench_rand();
+		nodes[i].next = list;
+		list = &nodes[i];
+	}
+
+	bench_start(run);
+	list = llist_mergesort(list, bench_node_get_next, bench_node_set_next,
+			       bench_node_compare);
+	bench_stop(run);
+
+	free(nodes);
+}
+
+/* A bitmap with about one bit in `density` set, in runs of up to 64. */
+static struct ewah_bitmap *random_ewah(size_t n, unsigned density)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	size_t pos = 0;
+
+	for (;;) {
+		size_t run_len = 1 + bench_rand() % 64;
+
+		pos += bench_rand() % (2 * density * run_len);
+		if (pos + run_len >= n)
+			break;
+		while (run_len--)
+			ewah_set(ewah, pos++);
+	}
+	return ewah;
+}
+
+static void bench_ewah_set(struct bench_run *run)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	size_t *bits, nr = 0, pos = 0, i;
+
+	ALLOC_ARRAY(bits, run->n);
+	while ((pos += 1 + bench_rand() % 32) < run->n)
+		bits[nr++] = pos;
+
+	bench_start(run);
+	for (i = 0; i < nr; i++)
+		ewah_set(ewah, bits[i]);
+	bench_stop(run);
+
+	ewah_free(ewah);
+	free(bits);
+}
+
+static void bench_ewah_or(struct bench_run *run)
+{
+	struct ewah_bitmap *a = random_ewah(run->n, 4);
+	struct ewah_bitmap *b = random_ewah(run->n, 16);
+	struct bitmap *result = ewah_to_bitmap(a);
+
+	bench_start(run);
+	bitmap_or_ewah(result, b);
+	bench_stop(run);
+
+	bitmap_free(result);
+	ewah_free(a);
+	ewah_free(b);
+}
+
+static void bench_ewah_iterate(struct bench_run *run)
+{
+	struct ewah_bitmap *ewah = random_ewah(run->n, 4);
+	struct ewah_iterator it;
+	eword_t word;
+	size_t bits = 0;
+
+	bench_start(run);
+	ewah_iterator_init(&it, ewah);
+	while (ewah_iterator_next(&word, &it))
+		bits += ewah_bit_popcount64(word);
+	bench_stop(run);
+
+	if (bits > run->n)
+		BUG("ewah iterator found too many bits");
+	ewah_free(ewah);
+}
+
+static void bench_delta_create(struct bench_run *run)
+{
+	struct strbuf old = STRBUF_INIT, new = STRBUF_INIT;
+	unsigned long size;
+	void *delta;
+
+	random_texts(&old, &new, run->n);
+
+	bench_start(run);
+	delta = diff_delta(old.buf, old.len, new.buf, new.len, &size, 0);
+	bench_stop(run);
+
+	if (!delta)
+		BUG("diff_delta failed");
+	free(delta);
+	strbuf_release(&old);
+	strbuf_release(&new);
+}
+
+static void bench_delta_apply(struct bench_run *run)
+{
+	struct strbuf old = STRBUF_INIT, new = STRBUF_INIT;
+	unsigned long delta_size, size;
+	void *delta, *result;
+
+	random_texts(&old, &new, run->n);
+	delta = diff_delta(old.buf, old.len, new.buf, new.len, &delta_size, 0);
+	if (!delta)
+		BUG("diff_delta failed");
+
+	bench_start(run);
+	result = patch_delta(old.buf, old.len, delta, delta_size, &size);
+	bench_stop(run);
+
+	if (!result || size != new.len)
+		BUG("patch_delta failed");
+	free(result);
+	free(delta);
+	strbuf_release(&old);
+	strbuf_release(&new);
+}
+
+static void bench_xdiff_prepare(struct bench_run *run)
+{
+	struct strbuf old = STRBUF_INIT, new = STRBUF_INIT;
+	mmfile_t mf1, mf2;
+	xpparam_t xpp;
+	xdfenv_t env;
+
+	random_texts(&old, &new, run->n);
+	mf1.ptr = old.buf;
+	mf1.size = old.len;
+	mf2.ptr = new.buf;
+	mf2.size = new.len;
+	memset(&xpp, 0, sizeof(xpp));
+
+	bench_start(run);
+	if (xdl_prepare_env(&mf1, &mf2, &xpp, &env) < 0)
+		die("xdl_prepare_env failed");
+	bench_stop(run);
+
+	xdl_free_env(&env);
+	strbuf_release(&old);
+	strbuf_release(&new);
+}
+
+static void deflate_text(struct strbuf *text, struct strbuf *out)
+{
+	git_zstream stream;
+	int status;
+
+	git_deflate_init(&stream, Z_DEFAULT_COMPRESSION);
+	strbuf_grow(out, git_deflate_bound(&stream, text->len));
+	stream.next_in = (unsigned char *)text->buf;
+	stream.avail_in = text->len;
+	stream.next_out = (unsigned char *)out->buf;
+	stream.avail_out = out->alloc;
+	status = git_deflate(&stream, Z_FINISH);
+	if (status != Z_STREAM_END)
+		die("deflate failed (%d)", status);
+	strbuf_setlen(out, stream.total_out);
+	git_deflate_end(&stream);
+}
+
+static void bench_zlib_deflate(struct bench_run *run)
+{
+	struct strbuf text = STRBUF_INIT, unused = STRBUF_INIT;
+	struct strbuf out = STRBUF_INIT;
+
+	random_texts(&text, &unused, run->n);
+
+	bench_start(run);
+	deflate_text(&text, &out);
+	bench_stop(run);
+
+	strbuf_release(&text);
+	strbuf_release(&unused);
+	strbuf_release(&out);
+}
+
+static void bench_zlib_inflate(struct bench_run *run)
+{
+	struct strbuf text = STRBUF_INIT, unused = STRBUF_INIT;
+	struct strbuf deflated = STRBUF_INIT;
+	char *out;
+	ssize_t used;
+
+	random_texts(&text, &unused, run->n);
+	deflate_text(&text, &deflated);
+	out = xmalloc(text.len);
+
+	bench_start(run);
+	used = git_inflate_buffer(out, text.len, deflated.buf, deflated.len);
+	bench_stop(run);
+
+	if (used != deflated.len || memcmp(out, text.buf, text.len))
+		BUG("inflate failed");
+	free(out);
+	strbuf_release(&text);
+	strbuf_release(&unused);
+	strbuf_release(&deflated);
+}
+
+static void bench_pack_bsearch(struct bench_run *run)
+{
+	struct packed_git *p, *largest = NULL;
+	struct object_id *oids;
+	uint32_t pos;
+	size_t i;
+
+	if (!startup_info->have_repository) {
+		run->skipped = "not in a repository";
+		return;
+	}
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		if (open_pack_index(p))
+			continue;
+		if (!largest || p->num_objects > largest->num_objects)
+			largest = p;
+	}
+	if (!largest || !largest->num_objects) {
+		run->skipped = "no packs";
+		return;
+	}
+
+	ALLOC_ARRAY(oids, run->n);
+	for (i = 0; i < run->n; i++)
+		nth_packed_object_id(&oids[i], largest,
+				     bench_rand() % largest->num_objects);
+
+	bench_start(run);
+	for (i = 0; i < run->n; i++)
+		if (!bsearch_pack(&oids[i], largest, &pos))
+			BUG("object missing from its pack");
+	bench_stop(run);
+
+	free(oids);
+}
+
+static void bench_midx_bsearch(struct bench_run *run)
+{
+	struct multi_pack_index *m;
+	struct object_id *oids;
+	uint32_t pos;
+	size_t i;
+
+	if (!startup_info->have_repository) {
+		run->skipped = "not in a repository";
+		return;
+	}
+	m = get_multi_pack_index(the_repository);
+	if (!m || !m->num_objects) {
+		run->skipped = "no multi-pack-index";
+		return;
+	}
+
+	ALLOC_ARRAY(oids, run->n);
+	for (i = 0; i < run->n; i++)
+		nth_midxed_object_oid(&oids[i], m, bench_rand() % m->num_objects);
+
+	bench_start(run);
+	for (i = 0; i < run->n; i++)
+		if (!bsearch_midx(&oids[i], m, &pos))
+			BUG("object missing from the multi-pack-index");
+	bench_stop(run);
+
+	free(oids);
+}
+
+struct bench {
+	const char *name;
+	void (*fn)(struct bench_run *);
+	size_t n;
+	const char *description;
+};
+
+/* clang-format off */
+static struct bench benches[] = {
+	{ "strmap/put",        bench_strmap_put,      100000,  "insert <n> strings" },
+	{ "strmap/get",        bench_strmap_get,      100000,  "look up <n> strings, half present" },
+	{ "oidset/insert",     bench_oidset_insert,   100000,  "insert <n> object ids" },
+	{ "oidset/contains",   bench_oidset_contains, 100000,  "look up <n> object ids, half present" },
+	{ "oidtable/put",      bench_oidtable_put,    100000,  "insert <n> object ids" },
+	{ "oidtable/get",      bench_oidtable_get,    100000,  "look up <n> object ids, half present" },
+	{ "prio-queue",        bench_prio_queue,      100000,  "put and get <n> integers" },
+	{ "mergesort",         bench_mergesort,       100000,  "sort a list of <n> integers" },
+	{ "ewah/set",          bench_ewah_set,        1000000, "set bits of a <n>-bit bitmap" },
+	{ "ewah/or",           bench_ewah_or,         1000000, "or two <n>-bit bitmaps" },
+	{ "ewah/iterate",      bench_ewah_iterate,    1000000, "iterate a <n>-bit bitmap" },
+	{ "delta/create",      bench_delta_create,    1000000, "delta <n> bytes of text" },
+	{ "delta/apply",       bench_delta_apply,     1000000, "apply a delta to <n> bytes of text" },
+	{ "xdiff/prepare",     bench_xdiff_prepare,   1000000, "prepare to diff <n> bytes of text" },
+	{ "zlib/deflate",      bench_zlib_deflate,    1000000, "deflate <n> bytes of text" },
+	{ "zlib/inflate",      bench_zlib_inflate,    1000000, "inflate <n> bytes of text" },
+	{ "pack/bsearch",      bench_pack_bsearch,    100000,  "find <n> objects in a pack index" },
+	{ "midx/bsearch",      bench_midx_bsearch,    100000,  "find <n> objects in a multi-pack-index" },
+};
+/* clang-format on */
+
+static int compare_doubles(const void *va, const void *vb)
+{
+	double a = *(const double *)va, b = *(const double *)vb;
+	return a < b ? -1 : a > b;
+}
+
+/* Newton's method, as we do not link with libm */
+static double square_root(double x)
+{
+	double r = x;
+	int i;
+
+	if (x <= 0)
+		return 0;
+	for (i = 0; i < 100; i++)
+		r = (r + x / r) / 2;
+	return r;
+}
+
+struct bench_result {
+	size_t n;
+	const char *skipped;
+	double *samples; /* in seconds, sorted */
+	int nr;
+	double mean, stddev;
+};
+
+static size_t scaled_size(struct bench *b, double scale)
+{
+	size_t n = b->n * scale;
+	return n ? n : 1;
+}
+
+static void run_bench(struct bench *b, double scale, int repeat,
+		      struct bench_result *res)
+{
+	int i;
+
+	res->n = scaled_size(b, scale);
+	res->skipped = NULL;
+	res->nr = 0;
+	res->mean = res->stddev = 0;
+	ALLOC_ARRAY(res->samples, repeat);
+
+	for (i = 0; i < repeat; i++) {
+		struct bench_run run = { res->n };
+
+		bench_srand();
+		b->fn(&run);
+		if (run.skipped) {
+			res->skipped = run.skipped;
+			return;
+		}
+		res->samples[res->nr++] = run.elapsed_ns / 1000000000.0;
+	}
+
+	QSORT(res->samples, res->nr, compare_doubles);
+	for (i = 0; i < res->nr; i++)
+		res->mean += res->samples[i] / res->nr;
+	for (i = 0; i < res->nr && res->nr > 1; i++)
+		res->stddev += (res->samples[i] - res->mean) *
+			       (res->samples[i] - res->mean) / (res->nr - 1);
+	res->stddev = square_root(res->stddev);
+}
+
+static double median(struct bench_result *res)
+{
+	int mid = res->nr / 2;
+
+	if (res->nr % 2)
+		return res->samples[mid];
+	return (res->samples[mid - 1] + res->samples[mid]) / 2;
+}
+
+static char *describe(struct bench *b, size_t n)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *p = strstr(b->description, "<n>");
+
+	strbuf_add(&buf, b->description, p - b->description);
+	strbuf_addf(&buf, "%"PRIuMAX"%s", (uintmax_t)n, p + 3);
+	return strbuf_detach(&buf, NULL);
+}
+
+/*
+ * The same layout as "aggregate.perl --json" in t/perf, so that the same
+ * tools can read both.
+ */
+static void add_json_result(struct json_writer *jw, struct bench *b, int nr,
+			    struct bench_result *res, const char *label)
+{
+	char *descr = describe(b, res->n);
+	char *number = xstrfmt("bench.%d", nr);
+	int i;
+
+	jw_array_inline_begin_object(jw);
+	jw_object_string(jw, "test", b->name);
+	jw_object_string(jw, "number", number);
+	jw_object_string(jw, "description", descr);
+	jw_object_inline_begin_array(jw, "results");
+	jw_array_inline_begin_object(jw);
+	jw_object_string(jw, "dir", label);
+	if (res->skipped) {
+		jw_object_true(jw, "missing");
+		jw_object_string(jw, "reason", res->skipped);
+	} else {
+		jw_object_inline_begin_array(jw, "samples");
+		for (i = 0; i < res->nr; i++)
+			jw_array_double(jw, 9, res->samples[i]);
+		jw_end(jw);
+		jw_object_double(jw, "min", 9, res->samples[0]);
+		jw_object_double(jw, "median", 9, median(res));
+		jw_object_double(jw, "mean", 9, res->mean);
+		jw_object_double(jw, "stddev", 9, res->stddev);
+	}
+	jw_end(jw);
+	jw_end(jw);
+	jw_end(jw);
+
+	free(number);
+	free(descr);
+}
+
+static void print_result(struct bench *b, struct bench_result *res)
+{
+	char *descr = describe(b, res->n);
+
+	if (res->skipped)
+		printf("%-16s %-42s skipped: %s\n", b->name, descr, res->skipped);
+	else
+		printf("%-16s %-42s %10.6f (min %.6f, stddev %.6f)\n", b->name,
+		       descr, median(res), res->samples[0], res->stddev);
+	free(descr);
+}
+
+static const char * const bench_usage[] = {
+	N_("test-tool bench [<options>] [<pattern>...]"),
+	NULL
+};
+
+int cmd__bench(int argc, const char **argv)
+{
+	int repeat = 5, json = 0, list = 0, nongit;
+	const char *scale_arg = NULL, *label = "this tree";
+	double scale = 1;
+	struct json_writer jw = JSON_WRITER_INIT;
+	struct option options[] = {
+		OPT_INTEGER(0, "repeat", &repeat, "number of runs of each benchmark"),
+		OPT_STRING(0, "scale", &scale_arg, "factor", "scale the input sizes"),
+		OPT_BOOL(0, "json", &json, "print results as JSON"),
+		OPT_STRING(0, "label", &label, "name", "name of this build in the JSON output"),
+		OPT_BOOL(0, "list", &list, "list the benchmarks"),
+		OPT_END()
+	};
+	int i, j, nr = 0;
+
+	setup_git_directory_gently(&nongit);
+
+	argc = parse_options(argc, argv, NULL, options, bench_usage, 0);
+	if (scale_arg) {
+		char *end;
+		scale = strtod(scale_arg, &end);
+		if (*end || scale <= 0)
+			die("invalid --scale: %s", scale_arg);
+	}
+	if (repeat < 1)
+		die("--repeat must be positive");
+
+	if (json)
+		jw_array_begin(&jw, 1);
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		struct bench *b = &benches[i];
+		struct bench_result res;
+
+		if (argc) {
+			for (j = 0; j < argc; j++)
+				if (!wildmatch(argv[j], b->name, 0))
+					break;
+			if (j == argc)
+				continue;
+		}
+		nr++;
+
+		if (list) {
+			char *descr = describe(b, scaled_size(b, scale));
+			printf("%s: %s\n", b->name, descr);
+			free(descr);
+			continue;
+		}
+
+		run_bench(b, scale, repeat, &res);
+		if (json)
+			add_json_result(&jw, b, nr, &res, label);
+		else
+			print_result(b, &res);
+		free(res.samples);
+	}
+
+	if (json) {
+		jw_end(&jw);
+		printf("%s\n", jw.json.buf);
+		jw_release(&jw);
+	}
+	return 0;
+}
@@ -1,6 +1,7 @@
 #include "test-tool.h"
-#include "git-compat-util.h"
+#include "cache.h"
 #include "hashmap.h"
+#include "oidtable.h"
 #include "strbuf.h"
 
 struct test_entry
@@ -53,6 +54,7 @@ static struct test_entry *alloc_test_entry(unsigned int hash,
 #define HASH_METHOD_X2 4
 #define TEST_SPARSE 8
 #define TEST_ADD 16
+#define TEST_OIDTABLE 32
 #define TEST_SIZE 100000
 
 static unsigned int hash(unsigned int method, unsigned int i, const char *key)
@@ -134,6 +136,97 @@ static void perf_hashmap(unsigned int method, unsigned int rounds)
 	}
 }
 
+struct test_oid_entry {
+	struct hashmap_entry ent;
+	struct object_id oid;
+};
+
+static int test_oid_entry_cmp(const void *cmp_data,
+			      const struct hashmap_entry *eptr,
+			      const struct hashmap_entry *entry_or_key,
+			      const void *keydata)
+{
+	const struct test_oid_entry *e1, *e2;
+
+	e1 = container_of(eptr, const struct test_oid_entry, ent);
+	e2 = container_of(entry_or_key, const struct test_oid_entry, ent);
+
+	return !oideq(&e1->oid, keydata ? keydata : &e2->oid);
+}
+
+static void add_oid_entries(unsigned int method, struct hashmap *map,
+			    struct oidtable *table,
+			    struct test_oid_entry *entries, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		if (method & TEST_OIDTABLE) {
+			struct test_oid_entry **slot;
+
+			slot = oidtable_put(table, &entries[i].oid, NULL);
+			*slot = &entries[i];
+		} else {
+			hashmap_add(map, &entries[i].ent);
+		}
+	}
+}
+
+/*
+ * Test performance of object id lookups, as done for obj_hash, with
+ * hashmap.[ch] or (with TEST_OIDTABLE in method) oidtable.[ch]
+ * Usage: time echo "perfoidmap method rounds" | test-tool hashmap
+ */
+static void perf_oidmap(unsigned int method, unsigned int rounds)
+{
+	struct hashmap map;
+	struct oidtable table = OIDTABLE_INIT_PTR(struct test_oid_entry, oid);
+	struct test_oid_entry *entries;
+	unsigned int i, j;
+
+	ALLOC_ARRAY(entries, TEST_SIZE);
+	for (i = 0; i < TEST_SIZE; i++) {
+		git_hash_ctx ctx;
+
+		the_hash_algo->init_fn(&ctx);
+		the_hash_algo->update_fn(&ctx, &i, sizeof(i));
+		the_hash_algo->final_oid_fn(&entries[i].oid, &ctx);
+		hashmap_entry_init(&entries[i].ent, oidhash(&entries[i].oid));
+	}
+
+	if (method & TEST_ADD) {
+		/* test adding to the map */
+		for (j = 0; j < rounds; j++) {
+			hashmap_init(&map, test_oid_entry_cmp, NULL, 0);
+			add_oid_entries(method, &map, &table, entries, TEST_SIZE);
+			hashmap_clear(&map);
+			oidtable_clear(&table);
+		}
+	} else {
+		/* test map lookups */
+		hashmap_init(&map, test_oid_entry_cmp, NULL, 0);
+
+		/* fill the map (sparsely if specified) */
+		add_oid_entries(method, &map, &table, entries,
+				(method & TEST_SPARSE) ? TEST_SIZE / 10 : TEST_SIZE);
+
+		for (j = 0; j < rounds; j++) {
+			for (i = 0; i < TEST_SIZE; i++) {
+				if (method & TEST_OIDTABLE)
+					oidtable_get(&table, &entries[i].oid);
+				else
+					hashmap_get_from_hash(&map,
+							      oidhash(&entries[i].oid),
+							      &entries[i].oid);
+			}
+		}
+
+		hashmap_clear(&map);
+		oidtable_clear(&table);
+	}
+	free(entries);
+}
+
 #define DELIM " \t\r\n"
 
 /*
@@ -147,6 +240,7 @@ static void perf_hashmap(unsigned int method, unsigned int rounds)
  * size -> tablesize numentries
  *
  * perfhashmap method rounds -> test hashmap.[ch] performance
+ * perfoidmap method rounds -> test object id lookup performance
  */
 int cmd__hashmap(int argc, const char **argv)
 {
@@ -253,6 +347,10 @@ int cmd__hashmap(int argc, const char **argv)
 
 			perf_hashmap(atoi(p1), atoi(p2));
 
+		} else if (!strcmp("perfoidmap", cmd) && p1 && p2) {
+
+			perf_oidmap(atoi(p1), atoi(p2));
+
 		} else {
 
 			printf("Unknown command %s\n", cmd);
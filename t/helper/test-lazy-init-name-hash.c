@@ -1,6 +1,7 @@
 #include "test-tool.h"
 #include "cache.h"
 #include "parse-options.h"
+#include "thread-utils.h"
 
 static int single;
 static int multi;
@@ -9,6 +10,7 @@ static int dump;
 static int perf;
 static int analyze;
 static int analyze_step;
+static int lookup;
 
 /*
  * Dump the contents of the "dir" and "name" hash tables to stdout.
@@ -181,6 +183,92 @@ static void analyze_run(void)
 	}
 }
 
+struct lookup_thread_data {
+	pthread_t pthread;
+	int k_start;
+	int k_end;
+};
+
+/*
+ * Look up each index entry in [k_start, k_end) and each of its leading
+ * directories, the way status does with core.ignoreCase.
+ */
+static void *lookup_thread_proc(void *_data)
+{
+	struct lookup_thread_data *d = _data;
+	int k;
+
+	for (k = d->k_start; k < d->k_end; k++) {
+		struct cache_entry *ce = the_index.cache[k];
+		const char *slash;
+
+		if (index_file_exists(&the_index, ce->name, ce_namelen(ce), 1) != ce)
+			die("'%s' not found in name hash", ce->name);
+		for (slash = strchr(ce->name, '/'); slash;
+		     slash = strchr(slash + 1, '/'))
+			if (!index_dir_exists(&the_index, ce->name, slash - ce->name))
+				die("'%.*s' not found in dir hash",
+				    (int)(slash - ce->name), ce->name);
+	}
+	return NULL;
+}
+
+/*
+ * Look up all names "count" times, either in this thread without
+ * locking or concurrently from "nr_threads" threads, and report on
+ * the time taken.
+ */
+static uint64_t time_lookups(int nr_threads)
+{
+	struct lookup_thread_data *td;
+	uint64_t t1, t2;
+	uint64_t sum = 0;
+	int i, t, nr_each;
+
+	CALLOC_ARRAY(td, nr_threads);
+	for (i = 0; i < count; i++) {
+		read_cache();
+		test_lazy_init_name_hash(&the_index, 1);
+		if (nr_threads > 1)
+			enable_name_hash_lock(&the_index);
+		nr_each = DIV_ROUND_UP(the_index.cache_nr, nr_threads);
+
+		t1 = getnanotime();
+		for (t = 0; t < nr_threads; t++) {
+			td[t].k_start = t * nr_each;
+			td[t].k_end = (t + 1) * nr_each;
+			if (td[t].k_start > the_index.cache_nr)
+				td[t].k_start = the_index.cache_nr;
+			if (td[t].k_end > the_index.cache_nr)
+				td[t].k_end = the_index.cache_nr;
+			if (nr_threads == 1)
+				lookup_thread_proc(&td[t]);
+			else if (pthread_create(&td[t].pthread, NULL,
+						lookup_thread_proc, &td[t]))
+				die("unable to create lookup thread");
+		}
+		for (t = 0; nr_threads > 1 && t < nr_threads; t++)
+			if (pthread_join(td[t].pthread, NULL))
+				die("unable to join lookup thread");
+		t2 = getnanotime();
+
+		sum += (t2 - t1);
+		printf("%f %d lookup %d\n",
+		       ((double)(t2 - t1))/1000000000,
+		       the_index.cache_nr, nr_threads);
+		fflush(stdout);
+
+		disable_name_hash_lock(&the_index);
+		discard_cache();
+	}
+	free(td);
+
+	if (count > 1)
+		printf("avg %f lookup %d\n",
+		       (double)(sum / count)/1000000000, nr_threads);
+	return sum / count;
+}
+
 int cmd__lazy_init_name_hash(int argc, const char **argv)
 {
 	const char *usage[] = {
@@ -189,6 +277,7 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		"test-tool lazy-init-name-hash -a a [--step s] [-c c]",
 		"test-tool lazy-init-name-hash (-s | -m) [-c c]",
 		"test-tool lazy-init-name-hash -s -m [-c c]",
+		"test-tool lazy-init-name-hash -l l [-c c]",
 		NULL
 	};
 	struct option options[] = {
@@ -199,6 +288,7 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		OPT_BOOL('p', "perf", &perf, "compare single vs multi"),
 		OPT_INTEGER('a', "analyze", &analyze, "analyze different multi sizes"),
 		OPT_INTEGER(0, "step", &analyze_step, "analyze step factor"),
+		OPT_INTEGER('l', "lookup", &lookup, "look up all names from l threads"),
 		OPT_END(),
 	};
 	const char *prefix;
@@ -214,8 +304,8 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 	ignore_case = 1;
 
 	if (dump) {
-		if (perf || analyze > 0)
-			die("cannot combine dump, perf, or analyze");
+		if (perf || analyze > 0 || lookup)
+			die("cannot combine dump, perf, analyze, or lookup");
 		if (count > 1)
 			die("count not valid with dump");
 		if (single && multi)
@@ -227,8 +317,8 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 	}
 
 	if (perf) {
-		if (analyze > 0)
-			die("cannot combine dump, perf, or analyze");
+		if (analyze > 0 || lookup)
+			die("cannot combine dump, perf, analyze, or lookup");
 		if (single || multi)
 			die("cannot use single or multi with perf");
 		avg_single = time_runs(0);
@@ -239,6 +329,8 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 	}
 
 	if (analyze) {
+		if (lookup)
+			die("cannot combine dump, perf, analyze, or lookup");
 		if (analyze < 500)
 			die("analyze must be at least 500");
 		if (!analyze_step)
@@ -249,6 +341,15 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		return 0;
 	}
 
+	if (lookup) {
+		if (single || multi)
+			die("cannot use single or multi with lookup");
+		if (lookup > 1 && !HAVE_THREADS)
+			die("lookup threads are not supported");
+		time_lookups(lookup);
+		return 0;
+	}
+
 	if (!single && !multi)
 		die("require either -s or -m or both");
 
@@ -0,0 +1,138 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "reftable/reftable.h"
+#include "reftable/merged.h"
+
+static const char *reftable_usage =
+	"test-tool reftable (dump-table <table> | dump-stack <dir> | refs-for <dir> <oid>)";
+
+static void print_ref(const struct reftable_ref_record *ref)
+{
+	printf("ref %s %"PRIu64" ", ref->refname, ref->update_index);
+	switch (ref->value_type) {
+	case REFTABLE_REF_DELETION:
+		printf("deleted\n");
+		break;
+	case REFTABLE_REF_VAL1:
+		printf("%s\n", hash_to_hex(ref->value));
+		break;
+	case REFTABLE_REF_VAL2:
+		printf("%s", hash_to_hex(ref->value));
+		printf(" %s\n", hash_to_hex(ref->peeled));
+		break;
+	case REFTABLE_REF_SYMREF:
+		printf("symref %s\n", ref->target);
+		break;
+	}
+}
+
+static void print_log(const struct reftable_log_record *log)
+{
+	printf("log %s %"PRIu64" ", log->refname, log->update_index);
+	if (log->value_type == REFTABLE_LOG_DELETION) {
+		printf("deleted\n");
+		return;
+	}
+	printf("%s", hash_to_hex(log->old_hash));
+	printf(" %s %s <%s> %"PRIu64" %d\t%s\n", hash_to_hex(log->new_hash),
+	       log->name, log->email, log->time, log->tz_offset, log->message);
+}
+
+static int dump_merged_table(struct reftable_merged_table *mt)
+{
+	struct reftable_iterator it = REFTABLE_ITERATOR_INIT;
+	struct reftable_ref_record ref = { 0 };
+	struct reftable_log_record log = { 0 };
+	int ret;
+
+	ret = reftable_merged_table_seek_ref(mt, &it, "");
+	while (!ret && !(ret = reftable_iterator_next_ref(&it, &ref)))
+		print_ref(&ref);
+	reftable_iterator_destroy(&it);
+	reftable_ref_record_release(&ref);
+	if (ret < 0)
+		return ret;
+
+	ret = reftable_merged_table_seek_log(mt, &it, "");
+	while (!ret && !(ret = reftable_iterator_next_log(&it, &log)))
+		print_log(&log);
+	reftable_iterator_destroy(&it);
+	reftable_log_record_release(&log);
+	return ret < 0 ? ret : 0;
+}
+
+static int dump_table(const char *path)
+{
+	struct reftable_reader *r;
+	struct reftable_merged_table *mt;
+	int ret;
+
+	ret = reftable_reader_open(&r, path);
+	if (ret)
+		return ret;
+	mt = reftable_merged_table_new(&r, 1, reftable_reader_hash_id(r));
+	/* show the table as it is, tombstones included */
+	mt->suppress_deletions = 0;
+	printf("update_index %"PRIu64"..%"PRIu64"\n",
+	       reftable_reader_min_update_index(r),
+	       reftable_reader_max_update_index(r));
+	ret = dump_merged_table(mt);
+	reftable_merged_table_decref(mt);
+	reftable_reader_decref(r);
+	return ret;
+}
+
+static int dump_stack(const char *dir)
+{
+	struct reftable_stack *st;
+	int ret;
+
+	ret = reftable_new_stack(&st, dir, NULL);
+	if (ret)
+		return ret;
+	printf("tables %"PRIuMAX"\n", (uintmax_t)reftable_stack_tables(st));
+	ret = dump_merged_table(reftable_stack_merged_table(st));
+	reftable_stack_destroy(st);
+	return ret;
+}
+
+static int refs_for(const char *dir, const char *hex)
+{
+	struct reftable_stack *st;
+	struct reftable_iterator it = REFTABLE_ITERATOR_INIT;
+	struct reftable_ref_record ref = { 0 };
+	struct object_id oid;
+	int ret;
+
+	if (get_oid_hex(hex, &oid))
+		die("not an object name: %s", hex);
+	ret = reftable_new_stack(&st, dir, NULL);
+	if (ret)
+		return ret;
+	ret = reftable_merged_table_refs_for(reftable_stack_merged_table(st),
+					     &it, oid.hash);
+	while (!ret && !(ret = reftable_iterator_next_ref(&it, &ref)))
+		printf("%s\n", ref.refname);
+	reftable_iterator_destroy(&it);
+	reftable_ref_record_release(&ref);
+	reftable_stack_destroy(st);
+	return ret < 0 ? ret : 0;
+}
+
+int cmd__reftable(int argc, const char **argv)
+{
+	int ret;
+
+	if (argc == 3 && !strcmp(argv[1], "dump-table"))
+		ret = dump_table(argv[2]);
+	else if (argc == 3 && !strcmp(argv[1], "dump-stack"))
+		ret = dump_stack(argv[2]);
+	else if (argc == 4 && !strcmp(argv[1], "refs-for"))
+		ret = refs_for(argv[2], argv[3]);
+	else
+		usage(reftable_usage);
+
+	if (ret)
+		die("%s", reftable_error_str(ret));
+	return 0;
+}
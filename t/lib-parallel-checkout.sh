@@ -13,6 +13,14 @@ set_checkout_config () {
 	test_config_global checkout.thresholdForParallelism $2
 }
 
+# Count the checkout workers, be they processes or threads, started in the
+# event trace $1
+count_checkout_workers () {
+	grep -e "\"event\":\"child_start\".*\"checkout--worker\"" \
+	     -e "\"event\":\"thread_start\".*:checkout-worker\"" "$1" |
+	wc -l
+}
+
 # Run "${@:2}" and check that $1 checkout workers were used
 test_checkout_workers () {
 	if test $# -lt 2
@@ -25,9 +33,9 @@ test_checkout_workers () {
 
 	local trace_file=trace-test-checkout-workers &&
 	rm -f "$trace_file" &&
-	GIT_TRACE2="$(pwd)/$trace_file" "$@" 2>&8 &&
+	GIT_TRACE2_EVENT="$(pwd)/$trace_file" "$@" 2>&8 &&
 
-	local workers=$(grep "child_start\[..*\] git checkout--worker" "$trace_file" | wc -l) &&
+	local workers=$(count_checkout_workers "$trace_file") &&
 	test $workers -eq $expected_workers &&
 	rm "$trace_file"
 } 8>&2 2>&4
@@ -53,4 +53,12 @@ test_perf REPO_BIG_ENOUGH_FOR_MULTI "multi-threaded, $desc" "
 	test-tool lazy-init-name-hash --multi --count=$count
 "
 
+test_perf "lookups, $desc" "
+	test-tool lazy-init-name-hash --lookup=1 --count=$count
+"
+
+test_perf "concurrent lookups, $desc" "
+	test-tool lazy-init-name-hash --lookup=$(test-tool online-cpus) --count=$count
+"
+
 test_done
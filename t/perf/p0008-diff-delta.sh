@@ -0,0 +1,32 @@
+#!/bin/sh
+
+test_description='diff_delta() performance on large, similar buffers'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	test-tool genrandom base 8388608 >base &&
+	{
+		test_copy_bytes 4194304 <base &&
+		test-tool genrandom middle 4096 &&
+		tail -c +4198401 base &&
+		test-tool genrandom tail 4096
+	} >similar &&
+	test-tool genrandom other 8388608 >other
+'
+
+test_perf 'diff_delta of mostly identical buffers' '
+	test-tool delta -d base similar delta.similar
+'
+
+test_perf 'diff_delta of unrelated buffers' '
+	test-tool delta -d base other delta.other
+'
+
+test_expect_success 'delta round-trips' '
+	test-tool delta -p base delta.similar actual &&
+	test_cmp_bin similar actual
+'
+
+test_done
@@ -0,0 +1,26 @@
+#!/bin/sh
+
+test_description='Tests object id hash table performance'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# See t/helper/test-hashmap.c for the methods: 16 adds entries, 0 looks
+# them up and 8 looks up entries that are mostly missing; 32 uses an
+# oidtable instead of a hashmap.
+for method in 16 0 8
+do
+	test_perf "hashmap, method $method" "
+		echo perfoidmap $method 100 | test-tool hashmap
+	"
+
+	test_perf "oidtable, method $method" "
+		echo perfoidmap $((method + 32)) 100 | test-tool hashmap
+	"
+done
+
+test_perf 'rev-list --all --objects' '
+	git rev-list --all --objects >/dev/null
+'
+
+test_done
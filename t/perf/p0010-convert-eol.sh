@@ -0,0 +1,43 @@
+#!/bin/sh
+
+test_description='Tests performance of end-of-line conversion'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	# 16MB of source-like text with LF and with CRLF line endings
+	for i in $(test_seq 64)
+	do
+		echo "	if (foo($i) && bar->baz[$i] != NULL)  /* comment $i */"
+	done >chunk &&
+	for i in $(test_seq 4096)
+	do
+		cat chunk || return 1
+	done >lf.txt &&
+	sed "s/\$/Q/" lf.txt | tr Q "\015" >crlf.txt &&
+	git add lf.txt crlf.txt &&
+	git commit -q -m files
+'
+
+test_perf 'ls-files --eol' '
+	git ls-files --eol >/dev/null
+'
+
+test_perf 'hash-object, autocrlf, LF file' '
+	git -c core.autocrlf=true -c core.safecrlf=false hash-object lf.txt
+'
+
+test_perf 'hash-object, autocrlf, CRLF file' '
+	git -c core.autocrlf=true -c core.safecrlf=false hash-object crlf.txt
+'
+
+test_perf 'hash-object, autocrlf with safecrlf warnings, LF file' '
+	git -c core.autocrlf=true hash-object lf.txt 2>/dev/null
+'
+
+test_perf 'cat-file --filters, autocrlf' '
+	git -c core.autocrlf=true cat-file --filters HEAD:lf.txt >/dev/null
+'
+
+test_done
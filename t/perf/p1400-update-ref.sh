@@ -14,7 +14,15 @@ test_expect_success "setup" '
 		printf "start\ncreate refs/heads/%d PRE\ncommit\n" $i &&
 		printf "start\nupdate refs/heads/%d POST PRE\ncommit\n" $i &&
 		printf "start\ndelete refs/heads/%d POST\ncommit\n" $i
-	done >instructions
+	done >instructions &&
+	for i in $(test_seq 5000)
+	do
+		printf "create refs/batch/%d PRE\n" $i
+	done >create-batch &&
+	for i in $(test_seq 5000)
+	do
+		printf "delete refs/batch/%d\n" $i
+	done >delete-batch
 '
 
 test_perf "update-ref" '
@@ -30,4 +38,25 @@ test_perf "update-ref --stdin" '
 	git update-ref --stdin <instructions >/dev/null
 '
 
+test_perf "update-ref --stdin, one transaction" '
+	git update-ref --stdin <create-batch &&
+	git update-ref --stdin <delete-batch
+'
+
+test_perf "update-ref --stdin, one transaction, fsync" '
+	git -c core.fsyncRefFiles=true update-ref --stdin <create-batch &&
+	git update-ref --stdin <delete-batch
+'
+
+test_perf "update-ref --stdin, one transaction, batched fsync" '
+	git -c core.fsyncRefFiles=true -c core.fsyncMethod=batch \
+		update-ref --stdin <create-batch &&
+	git update-ref --stdin <delete-batch
+'
+
+test_perf "update-ref --stdin, one transaction, via packed-refs" '
+	git -c core.packedRefsThreshold=100 update-ref --stdin <create-batch &&
+	git update-ref --stdin <delete-batch
+'
+
 test_done
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+test_description="Test untracked file scans with long .gitignore files"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+test_checkout_worktree
+
+# Generated .gitignore files tend to list many build products by name,
+# with a few globs and negations mixed in.
+test_expect_success 'setup long exclude list and untracked files' '
+	for i in $(test_seq 1 5000)
+	do
+		echo "generated-$i.out" &&
+		echo "/build-output-$i/" || return $?
+	done >.git/info/exclude &&
+	cat >>.git/info/exclude <<-\EOF &&
+	*.o
+	!keep.o
+	*~
+	EOF
+	mkdir -p untracked_files &&
+	for i in $(test_seq 1 2000)
+	do
+		>untracked_files/file-$i.c &&
+		>untracked_files/generated-$i.out || return $?
+	done
+'
+
+test_perf 'status --ignored' '
+	git status --ignored --porcelain >/dev/null
+'
+
+test_perf 'ls-files -o --exclude-standard' '
+	git ls-files -o --exclude-standard >/dev/null
+'
+
+test_done
@@ -0,0 +1,30 @@
+#!/bin/sh
+
+test_description='performance of the combined diff of a merge rewriting a file'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+# Make a merge of two branches that changed different lines of a file
+# of 8000 lines, resolved by rewriting the whole file, so that the
+# lines both parents lost have to be coalesced.
+test_expect_success 'create merge' '
+	test_seq 8000 | sed "s/^/a/" >file &&
+	git add file &&
+	git commit -q -m base &&
+	git checkout -q -b side &&
+	test_seq 8000 | awk "{ print (\$1 % 10 ? \"a\" : \"b\") \$1 }" >file &&
+	git commit -q -a -m side &&
+	git checkout -q - &&
+	test_seq 8000 | awk "{ print (\$1 % 7 ? \"a\" : \"d\") \$1 }" >file &&
+	git commit -q -a -m main &&
+	git merge -q -s ours -m merge side &&
+	test_seq 8000 | sed "s/^/c/" >file &&
+	git commit -q -a --amend -m merge
+'
+
+test_perf 'show --cc' '
+	git show --cc >/dev/null
+'
+
+test_done
@@ -0,0 +1,47 @@
+#!/bin/sh
+
+test_description='performance of log --graph with many concurrent lanes'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+# Make $1 branches off a root commit and grow each of them by $2 commits,
+# one branch after the other, so that showing them in date order keeps
+# all of them open as separate lanes of the graph.
+create_lanes () {
+	perl -le '
+		my ($lanes, $depth) = @ARGV;
+		my $time = 1000000000;
+		print "commit refs/heads/root";
+		print "mark :1";
+		print "committer nobody <nobody\@example.com> ", $time++, " +0000";
+		print "data 4";
+		print "root";
+		for my $i (1..$depth) {
+			for my $lane (1..$lanes) {
+				print "commit refs/heads/lane$lane";
+				print "committer nobody <nobody\@example.com> ",
+					$time++, " +0000";
+				print "data <<EOF";
+				print "lane $lane commit $i";
+				print "EOF";
+				print "from :1" if $i == 1;
+			}
+		}
+	' "$@" |
+	git fast-import --quiet
+}
+
+test_expect_success 'create history with 250 lanes' '
+	create_lanes 250 40
+'
+
+test_perf 'log --graph --date-order --all' '
+	git log --graph --date-order --oneline --all >/dev/null
+'
+
+test_perf 'log --graph --date-order --all with colors' '
+	git log --graph --date-order --oneline --all --color=always >/dev/null
+'
+
+test_done
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+test_description='fetch negotiation round trips with many local refs
+
+The client last fetched a while ago. Since then, it has created topic
+branches of its own and has many tags pointing into the older history,
+which are all tips that a negotiator may send as "have" lines. Compare
+how many haves and rounds each fetch.negotiationAlgorithm needs.
+'
+. ./perf-lib.sh
+
+test_expect_success 'create server and client' '
+	git init server &&
+	test_commit_bulk -C server --message="base %s" 2000 &&
+	git clone --bare --no-local server client.git &&
+	git -C client.git config remote.origin.fetch \
+		"+refs/heads/*:refs/remotes/origin/*" &&
+	git -C client.git fetch origin &&
+
+	# tags pointing into the older history
+	git -C client.git rev-list --first-parent HEAD~10 |
+	sed -n "s,.*,create refs/tags/old-& &,p" |
+	head -n 500 |
+	git -C client.git update-ref --stdin &&
+
+	# topic branches with local commits that are newer than anything
+	# on the server
+	for i in $(test_seq 20)
+	do
+		git -C client.git update-ref refs/heads/topic-$i \
+			HEAD~$((i * 50)) &&
+		test_commit_bulk -C client.git --ref=refs/heads/topic-$i \
+			--message="topic-$i %s" 5 || return 1
+	done &&
+
+	test_commit_bulk -C server --message="new %s" 100 &&
+	git -C client.git commit-graph write --reachable
+'
+
+for algorithm in default skipping generation
+do
+	test_expect_success "fetch with $algorithm" '
+		rm -rf fetch.git trace &&
+		cp -R client.git fetch.git &&
+		GIT_TRACE_PACKET="$(pwd)/trace" \
+			git -C fetch.git -c protocol.version=2 \
+			-c fetch.negotiationAlgorithm=$algorithm fetch \
+			--upload-pack "unset GIT_TRACE_PACKET; git-upload-pack" \
+			origin
+	'
+
+	test_size "haves ($algorithm)" '
+		grep -c "fetch> have" trace
+	'
+
+	test_size "rounds ($algorithm)" '
+		grep -c "fetch> command=fetch" trace
+	'
+done
+
+test_done
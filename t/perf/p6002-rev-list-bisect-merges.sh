@@ -0,0 +1,48 @@
+#!/bin/sh
+
+test_description='performance of finding the bisection in merge-heavy history'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+# Make $1 merges of a side branch of two commits into a main line.
+create_merges () {
+	perl -le '
+		my $time = 1000000000;
+		my ($mark, $main) = (0);
+		sub commit {
+			my ($ref, $msg, $from, $merge) = @_;
+			print "commit refs/heads/$ref";
+			print "mark :", ++$mark;
+			print "committer nobody <nobody\@example.com> ",
+				$time++, " +0000";
+			print "data <<EOF";
+			print $msg;
+			print "EOF";
+			print "from :$from" if defined $from;
+			print "merge :$merge" if defined $merge;
+			return $mark;
+		}
+		for my $i (1..$ARGV[0]) {
+			my $side = commit("side", "side $i", $main);
+			$side = commit("side", "side $i again", $side);
+			my $m = commit("main", "main $i", $main);
+			$main = commit("main", "merge $i", $m, $side);
+		}
+	' "$@" |
+	git fast-import --quiet
+}
+
+test_expect_success 'create history with 8000 merges' '
+	create_merges 8000
+'
+
+test_perf 'rev-list --bisect' '
+	git rev-list --bisect main >/dev/null
+'
+
+test_perf 'rev-list --bisect-all' '
+	git rev-list --bisect-all main >/dev/null
+'
+
+test_done
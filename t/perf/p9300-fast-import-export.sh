@@ -20,4 +20,32 @@ test_perf 'import (no-blobs)' '
 	git fast-import --force <export
 '
 
+# With blobs, most of the import is spent deltifying and deflating them,
+# which fast-import spreads over pack.threads threads.
+test_expect_success 'export (with blobs)' '
+	git fast-export --reencode=yes HEAD >export-blobs
+'
+
+test_expect_success 'set up thread-counting tests' '
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads"
+		t=$((t / 2))
+	done
+'
+
+for t in $threads
+do
+	THREADS=$t
+	export THREADS
+	test_perf "import (with blobs, $t threads)" '
+		rm -rf import.git &&
+		git init --bare import.git &&
+		git -C import.git -c pack.threads=$THREADS \
+			fast-import <export-blobs
+	'
+done
+
 test_done
@@ -153,11 +153,52 @@ immediate=t
 case "$(uname -s)" in Darwin) GTIME="${GTIME:-gtime}";; esac
 GTIME="${GTIME:-/usr/bin/time}"
 
+# Pin the timed runs to the given CPUs, so that they are not migrated
+# between cores (or onto slower ones) in the middle of a measurement.
+perf_taskset_=
+if test -n "$GIT_PERF_CPU"
+then
+	command -v taskset >/dev/null ||
+	error "GIT_PERF_CPU needs taskset(1)"
+	perf_taskset_="taskset -c $GIT_PERF_CPU"
+fi
+
+case "${GIT_PERF_CACHE:-}" in
+''|warm|cold)
+	;;
+*)
+	error "GIT_PERF_CACHE must be 'warm' or 'cold', not '$GIT_PERF_CACHE'"
+	;;
+esac
+
+# In "cold" mode the caches are dropped before each timed run, while in
+# "warm" mode the test is run once without timing it to fill them.
+test_perf_prepare_cache_ () {
+	case "$GIT_PERF_CACHE" in
+	cold)
+		test-tool drop-caches ||
+		error "cannot drop caches for GIT_PERF_CACHE=cold"
+		;;
+	esac
+}
+
+test_perf_warm_up_ () {
+	test "$GIT_PERF_CACHE" = warm || return 0
+	say >&3 "warming up: $1"
+	(
+		i=warmup &&
+		perf_trace2_= &&
+		test_run_perf_ "$1"
+	) || return 1
+	rm -f test_time.warmup
+}
+
 test_run_perf_ () {
 	test_cleanup=:
 	test_export_="test_cleanup"
 	export test_cleanup test_export_
-	"$GTIME" -f "%E %U %S" -o test_time.$i "$SHELL" -c '
+	GIT_TRACE2_EVENT=$perf_trace2_ \
+	$perf_taskset_ "$GTIME" -f "%E %U %S" -o test_time.$i "$SHELL" -c '
 . '"$TEST_DIRECTORY"/test-lib-functions.sh'
 test_export () {
 	test_export_="$test_export_ $*"
@@ -209,8 +250,21 @@ test_perf_ () {
 	else
 		echo "perf $test_count - $1:"
 	fi
+	rm -f test_time.* test_trace2.*
+	if ! test_perf_warm_up_ "$2"
+	then
+		test -z "$verbose" && echo
+		test_failure_ "$@"
+	fi
 	for i in $(test_seq 1 $GIT_PERF_REPEAT_COUNT); do
 		say >&3 "running: $2"
+		perf_trace2_=
+		if test_bool_env GIT_PERF_TRACE2_COUNTERS false
+		then
+			perf_trace2_="$(pwd)/test_trace2.$i"
+			: >"$perf_trace2_"
+		fi
+		test_perf_prepare_cache_
 		if test_run_perf_ "$2"
 		then
 			if test -z "$verbose"; then
@@ -230,6 +284,12 @@ test_perf_ () {
 		test_ok_ "$1"
 	fi
 	"$TEST_DIRECTORY"/perf/min_time.perl test_time.* >"$base".result
+	cat test_time.* >"$base".times
+	if test_bool_env GIT_PERF_TRACE2_COUNTERS false
+	then
+		"$TEST_DIRECTORY"/perf/trace2_counters.perl test_trace2.* \
+			>"$base".counters
+	fi
 }
 
 test_perf () {
@@ -269,6 +269,54 @@ EOF
 	test_must_be_empty err
 '
 
+test_expect_success 'later patterns win whatever their shape' '
+	cat >.gitattributes <<-\EOF &&
+	*.c foo=ext
+	x/* foo=dir
+	y.c foo=name
+	*c foo=suffix
+	x/y.c foo=path
+	/y.c foo=rooted
+	*.tar.gz foo=tgz
+	*.gz foo=gz
+	EOF
+	cat >expect <<-\EOF &&
+	y.c: foo: rooted
+	a/y.c: foo: suffix
+	x/y.c: foo: path
+	x/z.c: foo: suffix
+	x/z.h: foo: dir
+	x/Y.C: foo: dir
+	a.tar.gz: foo: gz
+	a.gz: foo: gz
+	a.tgz: foo: unspecified
+	EOF
+	git check-attr --stdin foo <<-\EOF >actual &&
+	y.c
+	a/y.c
+	x/y.c
+	x/z.c
+	x/z.h
+	x/Y.C
+	a.tar.gz
+	a.gz
+	a.tgz
+	EOF
+	test_cmp expect actual &&
+
+	cat >expect <<-\EOF &&
+	x/Y.C: foo: path
+	A.Tar.GZ: foo: gz
+	X/z.H: foo: dir
+	EOF
+	git -c core.ignorecase=1 check-attr --stdin foo <<-\EOF >actual &&
+	x/Y.C
+	A.Tar.GZ
+	X/z.H
+	EOF
+	test_cmp expect actual
+'
+
 test_expect_success 'using --git-dir and --work-tree' '
 	mkdir unreal real &&
 	git init real &&
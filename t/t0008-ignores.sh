@@ -865,6 +865,44 @@ test_expect_success 'info/exclude trumps core.excludesfile' '
 	test_cmp expect actual
 '
 
+test_expect_success 'last match wins in long pattern lists' '
+	test_when_finished "rm -rf long-ignore build sub" &&
+	test_seq 40 | sed -e "s/^/filler/" >long-ignore &&
+	cat >>long-ignore <<-\EOF &&
+	*.log
+	!keep.log
+	build/
+	/top-only
+	sub/anchored
+	one.txt
+	*.txt
+	!two.txt
+	filler7
+	EOF
+	mkdir build sub &&
+	>sub/build &&
+	cat >expect <<-\EOF &&
+	long-ignore:41:*.log	a.log
+	long-ignore:42:!keep.log	keep.log
+	long-ignore:47:*.txt	one.txt
+	long-ignore:48:!two.txt	two.txt
+	::	three
+	long-ignore:44:/top-only	top-only
+	::	sub/top-only
+	long-ignore:45:sub/anchored	sub/anchored
+	::	x/sub/anchored
+	long-ignore:43:build/	build
+	::	sub/build
+	long-ignore:49:filler7	filler7
+	long-ignore:49:filler7	sub/filler7
+	long-ignore:3:filler3	filler3
+	EOF
+	cut -f 2 expect >paths &&
+	git -c core.excludesFile=long-ignore \
+		check-ignore -v -n --stdin <paths >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success SYMLINKS 'set up ignore file for symlink tests' '
 	echo "*" >ignore &&
 	rm -f .gitignore .git/info/exclude
@@ -30,4 +30,53 @@ do
 
 done
 
+# Make "a" and "b" racily clean: they were modified (a minute ago) no
+# earlier than the index was written (a little more than that ago).
+test_expect_success 'setup racy cache' '
+	rm -f .git/index &&
+	git config index.racyCache true &&
+	echo a >a &&
+	echo b >b &&
+	test-tool chmtime =-60 a b &&
+	git update-index --add a b &&
+	test-tool chmtime =-70 .git/index
+'
+
+test_expect_success 'racily clean files are remembered' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git diff-files >actual &&
+	test_must_be_empty actual &&
+	grep "\"key\":\"racy-cache/added\",\"value\":\"2\"" trace.event &&
+	test_path_is_file .git/index.racy
+'
+
+test_expect_success 'remembered files are not compared again' '
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git diff-files >actual &&
+	test_must_be_empty actual &&
+	grep "\"key\":\"racy-cache/hits\",\"value\":\"2\"" trace.event &&
+	grep "\"key\":\"racy-cache/added\",\"value\":\"0\"" trace.event
+'
+
+test_expect_success 'files modified as the cache was written are compared' '
+	test-tool chmtime =$(test-tool chmtime --get a) .git/index.racy &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git diff-files >actual &&
+	test_must_be_empty actual &&
+	grep "\"key\":\"racy-cache/hits\",\"value\":\"0\"" trace.event
+'
+
+test_expect_success 'a malformed racy cache is ignored' '
+	echo garbage >.git/index.racy &&
+	git diff-files >actual 2>err &&
+	test_must_be_empty actual &&
+	test_i18ngrep "ignoring malformed racy cache" err
+'
+
+test_expect_success 'modified files are still reported' '
+	echo c >a &&
+	git diff-files --name-only >actual &&
+	echo a >expect &&
+	test_cmp expect actual
+'
+
 test_done
@@ -107,4 +107,29 @@ test_expect_success 'iterate' '
 	test_cmp expect actual
 '
 
+test_expect_success 'many entries, with removals' '
+	awk -v sz=$(test_oid hexsz) "BEGIN {
+		for (i = 0; i < 3000; i++) {
+			oid = \"\"
+			for (k = 0; k < sz / 8; k++)
+				oid = oid sprintf(\"%08x\", (i * 2654435761) % 4294967296)
+			print oid
+		}
+	}" >oids &&
+
+	awk "{ print \"put\", \$1, NR }" oids >input &&
+	awk "NR % 2 { print \"remove\", \$1 }" oids >>input &&
+	awk "NR % 3 == 1 { print \"put\", \$1, NR }" oids >>input &&
+	awk "{ print \"get\", \$1 }" oids >>input &&
+	test-tool oidmap <input >actual &&
+
+	{
+		awk "{ print \"NULL\" }" oids &&
+		awk "NR % 2 { print NR }" oids &&
+		awk "NR % 3 == 1 { print (NR % 2 ? \"NULL\" : NR) }" oids &&
+		awk "{ print (NR % 2 && NR % 3 != 1 ? \"NULL\" : NR) }" oids
+	} >expect &&
+	test_cmp expect actual
+'
+
 test_done
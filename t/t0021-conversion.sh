@@ -843,6 +843,89 @@ test_expect_success PERL 'process filter abort stops processing of all further f
 	)
 '
 
+test_expect_success PERL 'process filter with pipeline capability' '
+	test_config_global filter.protocol.process "rot13-filter.pl debug.log clean smudge pipeline" &&
+	rm -rf repo &&
+	mkdir repo &&
+	(
+		cd repo &&
+		git init &&
+
+		echo "*.r filter=protocol" >.gitattributes &&
+		git add .gitattributes &&
+
+		# more files than are sent at once
+		for i in $(test_seq 100 199)
+		do
+			echo "file $i" >$i.o &&
+			cp $i.o $i.r || return 1
+		done &&
+		test-tool chmtime =-100 *.r &&
+		filter_git add *.r &&
+		echo START >expected.log &&
+		echo "init handshake complete" >>expected.log &&
+		for i in $(test_seq 100 199)
+		do
+			echo "IN: clean $i.r 9 [OK] -- OUT: 9 . [OK]" || return 1
+		done >>expected.log &&
+		echo STOP >>expected.log &&
+		test_cmp_count expected.log debug.log &&
+		for i in $(test_seq 100 199)
+		do
+			test_cmp_committed_rot13 $i.o $i.r || return 1
+		done &&
+
+		# only the files that changed are sent
+		echo "file 1xx" >120.o &&
+		cp 120.o 120.r &&
+		echo "file 1yy" >175.o &&
+		cp 175.o 175.r &&
+		filter_git add -u &&
+		cat >expected.log <<-\EOF &&
+			START
+			init handshake complete
+			IN: clean 120.r 9 [OK] -- OUT: 9 . [OK]
+			IN: clean 175.r 9 [OK] -- OUT: 9 . [OK]
+			STOP
+		EOF
+		test_cmp_count expected.log debug.log &&
+		test_cmp_committed_rot13 120.o 120.r &&
+		test_cmp_committed_rot13 175.o 175.r
+	)
+'
+
+test_expect_success PERL 'process filter with pipeline capability: error and abort' '
+	test_config_global filter.protocol.process "rot13-filter.pl debug.log clean smudge pipeline" &&
+	rm -rf repo &&
+	mkdir repo &&
+	(
+		cd repo &&
+		git init &&
+
+		echo "*.r filter=protocol" >.gitattributes &&
+
+		cp "$TEST_ROOT/test.o" a.r &&
+		echo "this will cause an error" >error.r &&
+		cp "$TEST_ROOT/test2.o" f.r &&
+		git add . &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test.o" a.r &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test2.o" f.r &&
+		git cat-file blob :error.r >actual &&
+		test_cmp error.r actual &&
+
+		cp "$TEST_ROOT/test.o" aa.r &&
+		echo "error this blob and all future blobs" >abort.r &&
+		cp "$TEST_ROOT/test2.o" g.r &&
+		git add . &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test.o" aa.r &&
+		for f in abort.r g.r
+		do
+			git cat-file blob :$f >actual &&
+			test_cmp $f actual || return 1
+		done
+	)
+'
+
 test_expect_success PERL 'invalid process filter must fail (and not hang!)' '
 	test_config_global filter.protocol.process cat &&
 	test_config_global filter.protocol.required true &&
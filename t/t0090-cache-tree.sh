@@ -276,4 +276,29 @@ test_expect_success 'switching trees does not invalidate shared index' '
 	)
 '
 
+test_expect_success 'subtrees can be updated in parallel' '
+	git init parallel &&
+	(
+		cd parallel &&
+		blob=$(echo content | git hash-object -w --stdin) &&
+		for i in $(test_seq 1 60)
+		do
+			printf "100644 %s\tdir$i/a\n" $blob &&
+			printf "100644 %s\tdir$i/sub/$i\n" $blob || return 1
+		done >entries &&
+		printf "100644 %s\ttop\n" $blob >>entries &&
+		git update-index --index-info <entries &&
+		GIT_TEST_INDEX_THREADS=1 git write-tree >expect &&
+
+		git read-tree --empty &&
+		git update-index --index-info <entries &&
+		GIT_TRACE2_PERF="$(pwd)/trace" GIT_TEST_INDEX_THREADS=2 \
+			git write-tree >actual &&
+		test_cmp expect actual &&
+		grep "threaded/threads:2" trace &&
+		grep "threaded/trees:120" trace &&
+		test-tool dump-cache-tree >/dev/null
+	)
+'
+
 test_done
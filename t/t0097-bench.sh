@@ -0,0 +1,48 @@
+#!/bin/sh
+
+test_description='test-tool bench'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git repack -ad &&
+	git multi-pack-index write
+'
+
+test_expect_success 'all benchmarks run' '
+	test-tool bench --list >list &&
+	test-tool bench --scale=0.001 --repeat=2 >out &&
+	test_line_count = $(wc -l <list) out &&
+	! grep skipped out
+'
+
+test_expect_success 'patterns select benchmarks' '
+	test-tool bench --list "oid*" "mergesort" >actual &&
+	cat >expect <<-\EOF &&
+	oidset/insert: insert 100000 object ids
+	oidset/contains: look up 100000 object ids, half present
+	oidtable/put: insert 100000 object ids
+	oidtable/get: look up 100000 object ids, half present
+	mergesort: sort a list of 100000 integers
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'benchmarks on a repository are skipped outside of one' '
+	nongit test-tool bench --scale=0.001 --repeat=1 "pack/*" >out &&
+	grep "^pack/bsearch .*skipped: not in a repository" out
+'
+
+test_expect_success 'JSON output has one sample per run' '
+	test-tool bench --json --label=test --scale=0.001 --repeat=3 \
+		mergesort >out &&
+	grep "\"test\": \"mergesort\"" out &&
+	grep "\"dir\": \"test\"" out &&
+	sed -n "/\"samples\"/,/]/p" out >samples &&
+	test $(grep -c "^ *[0-9]" samples) = 3 &&
+	grep "\"median\": " out
+'
+
+test_done
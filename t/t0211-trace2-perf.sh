@@ -150,6 +150,48 @@ test_expect_success 'perf stream, child processes' '
 	test_cmp expect actual
 '
 
+# Timers and counters are summed up over threads and reported at exit.
+# The times vary from run to run, so only check that the expected
+# lines are there.
+
+test_expect_success 'stopwatch timer, perf stream' '
+	test_when_finished "rm trace.perf actual" &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" test-tool trace2 008timer 5 10 &&
+	perl "$TEST_DIRECTORY/t0211/scrub_perf.perl" <trace.perf >actual &&
+	grep "d0|main|timer||||test|name:test1 intervals:5 total:" actual &&
+	! grep th_timer actual
+'
+
+test_expect_success PTHREADS 'stopwatch timer in threads, perf stream' '
+	test_when_finished "rm trace.perf actual per-thread" &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		test-tool trace2 009timer_threaded 5 10 3 &&
+	perl "$TEST_DIRECTORY/t0211/scrub_perf.perl" <trace.perf >actual &&
+	grep "d0|th0[1-3]:ut_009|th_timer||||test|name:test2 intervals:5 total:" \
+		actual >per-thread &&
+	test_line_count = 3 per-thread &&
+	grep "d0|main|timer||||test|name:test2 intervals:15 total:" actual
+'
+
+test_expect_success 'counter, perf stream' '
+	test_when_finished "rm trace.perf actual" &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" test-tool trace2 010counter 2 3 5 &&
+	perl "$TEST_DIRECTORY/t0211/scrub_perf.perl" <trace.perf >actual &&
+	grep "d0|main|counter||||test|name:test1 value:10" actual &&
+	! grep th_counter actual
+'
+
+test_expect_success PTHREADS 'counter in threads, perf stream' '
+	test_when_finished "rm trace.perf actual per-thread" &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		test-tool trace2 011counter_threaded 5 10 3 &&
+	perl "$TEST_DIRECTORY/t0211/scrub_perf.perl" <trace.perf >actual &&
+	grep "d0|th0[1-3]:ut_011|th_counter||||test|name:test2 value:15" \
+		actual >per-thread &&
+	test_line_count = 3 per-thread &&
+	grep "d0|main|counter||||test|name:test2 value:45" actual
+'
+
 sane_unset GIT_TRACE2_PERF_BRIEF
 
 # Now test without environment variables and get all Trace2 settings
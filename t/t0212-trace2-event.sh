@@ -302,6 +302,45 @@ test_expect_success JSON_PP 'using global config, event stream, error event' '
 	test_cmp expect actual
 '
 
+test_expect_success 'timer event' '
+	test_when_finished "rm trace.event" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" test-tool trace2 008timer 5 10 &&
+	grep "\"event\":\"timer\",.*\"category\":\"test\",\"name\":\"test1\",\"intervals\":5,\"t_total\":" trace.event &&
+	! grep "\"event\":\"th_timer\"" trace.event
+'
+
+test_expect_success PTHREADS 'counter events from several threads' '
+	test_when_finished "rm trace.event per-thread" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		test-tool trace2 011counter_threaded 5 10 3 &&
+	grep "\"event\":\"th_counter\",.*\"name\":\"test2\",\"count\":15}" \
+		trace.event >per-thread &&
+	test_line_count = 3 per-thread &&
+	grep "\"event\":\"counter\",.*\"thread\":\"main\",.*\"name\":\"test2\",\"count\":45}" \
+		trace.event
+'
+
+test_expect_success 'object reads are counted by type' '
+	test_when_finished "rm trace.event" &&
+	test_commit counted &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git cat-file -p HEAD^{tree} >/dev/null &&
+	grep "\"category\":\"object\",\"name\":\"read_tree\",\"count\":1}" \
+		trace.event
+'
+
+test_expect_success 'trees read again come from the tree cache if enabled' '
+	test_when_finished "rm trace.event" &&
+	test_commit cached &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c core.treeCacheLimit=32m log --raw -2 >/dev/null &&
+	grep "\"category\":\"object\",\"name\":\"tree_cache_hit\",\"count\":1}" \
+		trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git log --raw -2 >/dev/null &&
+	test "$(grep -c tree_cache_hit trace.event)" = 1
+'
+
 test_expect_success 'discard traces when there are too many files' '
 	mkdir trace_target_dir &&
 	test_when_finished "rm -r trace_target_dir" &&
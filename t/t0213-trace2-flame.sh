@@ -0,0 +1,71 @@
+#!/bin/sh
+
+test_description='test trace2 facility (flame target)'
+
+. ./test-lib.sh
+
+# Turn off any inherited trace2 settings for this test.
+sane_unset GIT_TRACE2 GIT_TRACE2_PERF GIT_TRACE2_EVENT
+sane_unset GIT_TRACE2_FLAME GIT_TRACE2_FLAME_SAMPLE
+sane_unset GIT_TRACE2_BRIEF
+sane_unset GIT_TRACE2_CONFIG_PARAMS
+
+# Print the stacks of the collapsed-stack output without their values,
+# after checking that each line has one.
+stacks () {
+	grep -v " [0-9][0-9]*\$" "$1" && return 1
+	sed "s/ [0-9]*\$//" "$1"
+}
+
+test_expect_success 'regions are written as nested stacks' '
+	test_when_finished "rm -f trace.flame" &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" test-tool trace2 012region 10 &&
+	stacks trace.flame >actual &&
+	cat >expect <<-\EOF &&
+	trace2;main
+	trace2;main;test:outer
+	trace2;main;test:outer;test:inner
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'the value of a stack excludes its nested regions' '
+	test_when_finished "rm -f trace.flame" &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" test-tool trace2 012region 100 &&
+	outer=$(sed -n "s/^trace2;main;test:outer //p" trace.flame) &&
+	inner=$(sed -n "s/^trace2;main;test:outer;test:inner //p" trace.flame) &&
+	test $outer -ge 100000 &&
+	test $outer -lt 200000 &&
+	test $inner -ge 100000
+'
+
+test_expect_success 'output from several processes can be concatenated' '
+	test_when_finished "rm -rf trace.flame repo" &&
+	git init repo &&
+	test_commit -C repo one &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" git -C repo status &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" test-tool trace2 012region 1 &&
+	grep "^status;main;index:do_read_index [0-9]" trace.flame &&
+	grep "^trace2;main;test:outer [0-9]" trace.flame
+'
+
+test_expect_success PTHREADS 'threads of the same kind share their stacks' '
+	test_when_finished "rm -f trace.flame" &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" \
+		test-tool trace2 009timer_threaded 2 1 3 &&
+	grep "^trace2;ut_009 [0-9]" trace.flame >actual &&
+	test_line_count = 1 actual
+'
+
+test_expect_success !MINGW 'sampling counts CPU samples instead of time' '
+	test_when_finished "rm -f trace.flame" &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" GIT_TRACE2_FLAME_SAMPLE=1000 \
+		test-tool trace2 012region 200 &&
+	stacks trace.flame >actual &&
+	grep "^trace2;main;test:outer;test:inner\$" actual &&
+	total=$(sed "s/.* //" trace.flame | awk "{ s += \$1 } END { print s }") &&
+	test $total -gt 0 &&
+	test $total -lt 5000
+'
+
+test_done
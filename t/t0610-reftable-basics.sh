@@ -0,0 +1,243 @@
+#!/bin/sh
+
+test_description='reftable ref storage format'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+GIT_TEST_DEFAULT_REF_FORMAT=reftable
+export GIT_TEST_DEFAULT_REF_FORMAT
+
+. ./test-lib.sh
+
+test_expect_success 'init --ref-format=reftable' '
+	git init --ref-format=reftable fmt &&
+	test_path_is_file fmt/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C fmt config extensions.refstorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C fmt config core.repositoryformatversion >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init --ref-format=files overrides the environment' '
+	git init --ref-format=files files &&
+	test_path_is_dir files/.git/refs/heads &&
+	test_path_is_missing files/.git/reftable &&
+	test_must_fail git -C files config extensions.refstorage
+'
+
+test_expect_success 'GIT_DEFAULT_REF_FORMAT picks the format' '
+	git init env &&
+	test_path_is_file env/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C env config extensions.refstorage >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown ref format is rejected' '
+	test_must_fail git init --ref-format=bogus bogus 2>err &&
+	test_i18ngrep "unknown ref storage format" err
+'
+
+test_expect_success 'reinit with a different format fails' '
+	test_must_fail git init --ref-format=files fmt 2>err &&
+	test_i18ngrep "reinitialize" err &&
+	git init --ref-format=reftable fmt
+'
+
+test_expect_success 'setup' '
+	test_commit A &&
+	test_commit B &&
+	git branch topic A &&
+	git tag -a -m annotated annotated B
+'
+
+test_expect_success 'refs are read back' '
+	git rev-parse A >expect &&
+	git rev-parse refs/heads/topic >actual &&
+	test_cmp expect actual &&
+	cat >expect <<-EOF &&
+	$(git rev-parse B) commit	refs/heads/main
+	$(git rev-parse A) commit	refs/heads/topic
+	$(git rev-parse A) commit	refs/tags/A
+	$(git rev-parse B) commit	refs/tags/B
+	$(git rev-parse annotated) tag	refs/tags/annotated
+	EOF
+	git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'peeled tags are stored' '
+	git pack-refs &&
+	git show-ref -d annotated >actual &&
+	cat >expect <<-EOF &&
+	$(git rev-parse annotated) refs/tags/annotated
+	$(git rev-parse B) refs/tags/annotated^{}
+	EOF
+	test_cmp expect actual &&
+	test-tool reftable dump-stack .git/reftable >dump &&
+	grep "^ref refs/tags/annotated [0-9]* $(git rev-parse annotated) $(git rev-parse B)\$" dump
+'
+
+test_expect_success 'symrefs' '
+	echo refs/heads/main >expect &&
+	git symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	git symbolic-ref refs/heads/sym refs/heads/topic &&
+	git rev-parse topic >expect &&
+	git rev-parse sym >actual &&
+	test_cmp expect actual &&
+	git symbolic-ref -d refs/heads/sym &&
+	test_must_fail git rev-parse --verify -q refs/heads/sym
+'
+
+test_expect_success 'd/f conflicts are rejected' '
+	test_must_fail git branch topic/sub &&
+	test_must_fail git branch -c topic topic/sub &&
+	test_must_fail git symbolic-ref refs/heads/topic/sub refs/heads/main &&
+	test_must_fail git update-ref refs/tags refs/heads/main
+'
+
+test_expect_success 'reflogs' '
+	cat >expect <<-EOF &&
+	main@{0} commit: B
+	main@{1} commit (initial): A
+	EOF
+	git log -g --format="%gd %gs" main >actual &&
+	test_cmp expect actual &&
+	git reflog exists refs/heads/main &&
+	test_must_fail git reflog exists refs/heads/nosuch
+'
+
+test_expect_success 'update-ref with --create-reflog' '
+	git update-ref --create-reflog refs/test/logged A &&
+	git reflog exists refs/test/logged &&
+	git update-ref --no-create-reflog refs/test/unlogged A &&
+	test_must_fail git reflog exists refs/test/unlogged
+'
+
+test_expect_success 'deleting a ref deletes its reflog' '
+	git branch -f doomed B &&
+	git reflog exists refs/heads/doomed &&
+	git branch -D doomed &&
+	test_must_fail git rev-parse --verify -q refs/heads/doomed &&
+	test_must_fail git reflog exists refs/heads/doomed
+'
+
+test_expect_success 'transactions are atomic' '
+	git rev-parse topic >expect &&
+	test_must_fail git update-ref --stdin <<-EOF &&
+	update refs/heads/topic $(git rev-parse B)
+	create refs/heads/main $(git rev-parse A)
+	EOF
+	git rev-parse topic >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rename and copy branches' '
+	git branch -m topic renamed &&
+	test_must_fail git rev-parse --verify -q refs/heads/topic &&
+	git reflog exists refs/heads/renamed &&
+	git branch -c renamed copied &&
+	git rev-parse renamed >expect &&
+	git rev-parse copied >actual &&
+	test_cmp expect actual &&
+	git reflog exists refs/heads/renamed &&
+	git reflog exists refs/heads/copied &&
+	git branch -M renamed renamed &&
+	git branch -m renamed topic &&
+	git branch -D copied
+'
+
+test_expect_success 'reflog expire' '
+	git reflog expire --expire=all refs/heads/main &&
+	git log -g --format=%gs main >actual &&
+	test_must_be_empty actual &&
+	git reflog exists refs/heads/main
+'
+
+test_expect_success 'reflog expire without anything to prune adds no table' '
+	cp .git/reftable/tables.list expect &&
+	git reflog expire --expire=never --expire-unreachable=never \
+		--updateref --all &&
+	test_cmp expect .git/reftable/tables.list
+'
+
+test_expect_success 'pack-refs compacts the stack' '
+	git pack-refs &&
+	test-tool reftable dump-stack .git/reftable >dump &&
+	head -n 1 dump >actual &&
+	echo "tables 1" >expect &&
+	test_cmp expect actual &&
+	test_line_count = 1 .git/reftable/tables.list
+'
+
+test_expect_success 'auto-compaction keeps the stack short' '
+	for i in $(test_seq 32)
+	do
+		git update-ref refs/heads/many-$i A || return 1
+	done &&
+	test_line_count -lt 6 .git/reftable/tables.list
+'
+
+test_expect_success 'reftable.autoCompaction=false leaves the stack alone' '
+	git pack-refs &&
+	for i in $(test_seq 4)
+	do
+		git -c reftable.autoCompaction=false update-ref -d refs/heads/many-$i ||
+		return 1
+	done &&
+	test_line_count = 5 .git/reftable/tables.list
+'
+
+test_expect_success 'dump-table shows tombstones' '
+	table=$(tail -n 1 .git/reftable/tables.list) &&
+	test-tool reftable dump-table .git/reftable/$table >dump &&
+	grep "^ref refs/heads/many-4 [0-9]* deleted\$" dump
+'
+
+test_expect_success 'refs-for finds the refs pointing at an object' '
+	git pack-refs &&
+	test-tool reftable refs-for .git/reftable $(git rev-parse annotated) >actual &&
+	echo refs/tags/annotated >expect &&
+	test_cmp expect actual &&
+	test-tool reftable refs-for .git/reftable $(git rev-parse B) >actual &&
+	grep -x refs/heads/main actual &&
+	grep -x refs/tags/B actual &&
+	grep -x refs/tags/annotated actual
+'
+
+test_expect_success 'worktrees have their own HEAD' '
+	git worktree add --detach wt A &&
+	git rev-parse A >expect &&
+	git -C wt rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git rev-parse B >expect &&
+	git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	test_path_is_file .git/worktrees/wt/reftable/tables.list &&
+	git rev-parse main >expect &&
+	git -C wt rev-parse main >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fsck and gc leave refs intact' '
+	git for-each-ref >expect &&
+	git fsck &&
+	git gc &&
+	git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone creates a reftable repository' '
+	git clone . cloned &&
+	echo reftable >expect &&
+	git -C cloned config extensions.refstorage >actual &&
+	test_cmp expect actual &&
+	git rev-parse main >expect &&
+	git -C cloned rev-parse origin/main >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -586,4 +586,55 @@ test_expect_success 'cat-file --unordered works' '
 	test_cmp expect actual
 '
 
+test_expect_success 'setup objects for --batch-size' '
+	git init batch-size &&
+	(
+		cd batch-size &&
+		for i in 1 2 3 4 5
+		do
+			test_seq 1 $((i * 100)) >file &&
+			git add file &&
+			git commit -qm "commit $i" || return 1
+		done &&
+		git repack -adf &&
+		echo loose | git hash-object -w --stdin >../loose-oid &&
+		{
+			git rev-list --objects --all | sed "s/ /	/" &&
+			cat ../loose-oid &&
+			echo $ZERO_OID &&
+			echo HEAD~2:file &&
+			echo HEAD:does-not-exist
+		} >../batch-input
+	)
+'
+
+for size in 1 2 7 100
+do
+	test_expect_success "--batch --batch-size=$size matches --batch" '
+		git -C batch-size cat-file --batch="%(objectname) %(rest)" \
+			<batch-input >expect &&
+		git -C batch-size cat-file --batch="%(objectname) %(rest)" \
+			--batch-size=$size <batch-input >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success '--batch-check --batch-size matches --batch-check' '
+	git -C batch-size cat-file --batch-check <batch-input >expect &&
+	git -C batch-size cat-file --batch-check --batch-size=3 \
+		<batch-input >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-size is incompatible with --batch-all-objects' '
+	test_must_fail git -C batch-size cat-file --batch \
+		--batch-all-objects --batch-size=2
+'
+
+test_expect_success '--batch-size must not be negative' '
+	test_must_fail git -C batch-size cat-file --batch \
+		--batch-size=-1 </dev/null 2>err &&
+	test_i18ngrep "must be non-negative" err
+'
+
 test_done
@@ -199,6 +199,32 @@ for args in "-w --stdin-paths" "--stdin-paths -w"; do
 	pop_repo
 done
 
+test_expect_success 'many paths on stdin are written to one pack' '
+	test_when_finished "rm -rf many" &&
+	git init many &&
+	(
+		cd many &&
+		for i in $(test_seq 150)
+		do
+			echo "content $i" >file$i || return 1
+		done &&
+		echo "content 1" >same &&
+		echo "crlf text" >.gitattributes &&
+		printf "converted\r\n" >crlf &&
+		ls file* same crlf >paths &&
+		for f in $(cat paths)
+		do
+			git hash-object $f || return 1
+		done >expect &&
+		git hash-object -w --stdin-paths <paths >actual &&
+		test_cmp expect actual &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 1 packs &&
+		git cat-file --batch-check <expect >objects &&
+		! grep missing objects
+	)
+'
+
 test_expect_success 'too-short tree' '
 	echo abc >malformed-tree &&
 	test_must_fail git hash-object -t tree malformed-tree 2>err &&
@@ -40,6 +40,16 @@ large -c pack.compression=0
 small -c pack.compression=9
 EOF
 
+test_expect_success 'add a large file with threads' '
+	test_when_finished "rm -f .git/objects/pack/pack-*.* .git/index" &&
+	git -c pack.threads=4 -c pack.compression=9 add huge &&
+	sz=$(test_file_size .git/objects/pack/pack-*.pack) &&
+	test "$sz" -le 100000 &&
+	GIT_ALLOC_LIMIT=0 git cat-file blob :huge >actual &&
+	test_cmp huge actual &&
+	GIT_ALLOC_LIMIT=0 git verify-pack .git/objects/pack/pack-*.idx
+'
+
 test_expect_success 'add a large file or two' '
 	git add large1 huge large2 &&
 	# make sure we got a single packfile and no loose objects
@@ -208,4 +218,24 @@ test_expect_success 'fsck large blobs' '
 	test_must_be_empty err
 '
 
+test_expect_success 'checkout writes blobs with runs of zeros correctly' '
+	{
+		echo head &&
+		test-tool genzeros 65536 &&
+		echo middle &&
+		test-tool genzeros 40000 &&
+		echo tail &&
+		test-tool genzeros 32768
+	} >zeros &&
+	git add zeros &&
+	cp zeros zeros.expect &&
+	rm zeros &&
+	git checkout -- zeros &&
+	test_cmp_bin zeros.expect zeros &&
+	git -c core.bigFileThreshold=1k add zeros &&
+	rm zeros &&
+	git -c core.bigFileThreshold=1k checkout -- zeros &&
+	test_cmp_bin zeros.expect zeros
+'
+
 test_done
@@ -0,0 +1,72 @@
+#!/bin/sh
+
+test_description='loose object index (core.looseObjectIndex)'
+. ./test-lib.sh
+
+# Print the fanout directory of object "$1", relative to the objects dir.
+fanout () {
+	echo "$1" | cut -c1-2
+}
+
+test_expect_success 'setup' '
+	git config core.looseObjectIndex true &&
+	oid=$(echo one | git hash-object -w --stdin) &&
+	dir=$(fanout $oid) &&
+	test-tool chmtime =-10 .git/objects/$dir
+'
+
+test_expect_success 'abbreviated lookup writes the index' '
+	abbrev=$(echo $oid | cut -c1-7) &&
+	git rev-parse --verify $abbrev >actual &&
+	echo $oid >expect &&
+	test_cmp expect actual &&
+	test_path_is_file .git/objects/info/loose-index/$dir
+'
+
+test_expect_success 'index is trusted while the directory mtime is unchanged' '
+	mtime=$(test-tool chmtime --get .git/objects/$dir) &&
+	i=0 &&
+	while hidden=$(echo "hidden $i" | git hash-object --stdin) &&
+	      test "$(fanout $hidden)" != "$dir"
+	do
+		i=$((i + 1)) || return 1
+	done &&
+	echo "hidden $i" | git hash-object -w --stdin &&
+	test-tool chmtime =$mtime .git/objects/$dir &&
+	git rev-parse --verify $abbrev >actual &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify "$(echo $hidden | cut -c1-7)" &&
+	git -c core.looseObjectIndex=false rev-parse --verify \
+		"$(echo $hidden | cut -c1-7)"
+'
+
+test_expect_success 'index is ignored once the directory changes' '
+	# find a second object that shares the fanout directory
+	i=0 &&
+	while other=$(echo "two $i" | git hash-object --stdin) &&
+	      test "$(fanout $other)" != "$dir"
+	do
+		i=$((i + 1)) || return 1
+	done &&
+	echo "two $i" | git hash-object -w --stdin &&
+	git rev-parse --verify "$(echo $other | cut -c1-7)" >actual &&
+	echo $other >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'corrupt index is ignored' '
+	test-tool chmtime =-10 .git/objects/$dir &&
+	git rev-parse --verify $abbrev &&
+	echo garbage >.git/objects/info/loose-index/$dir &&
+	git rev-parse --verify $abbrev >actual &&
+	echo $oid >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index is not written without core.looseObjectIndex' '
+	rm -rf .git/objects/info/loose-index &&
+	git -c core.looseObjectIndex=false rev-parse --verify $abbrev &&
+	test_path_is_missing .git/objects/info/loose-index
+'
+
+test_done
@@ -313,6 +313,36 @@ test_expect_success 'cone mode: add parent path' '
 	check_files repo a deep folder1
 '
 
+test_expect_success 'cone mode: set and add look only at what changed' '
+	git -C repo sparse-checkout set deep/deeper1 folder1 &&
+	for args in "add deep/deeper2" "set deep/deeper1/deepest" \
+		"add deep" "set folder2 deep/deeper2" "add folder1 folder2"
+	do
+		GIT_TRACE2_EVENT="$(pwd)/trace" git -C repo \
+			sparse-checkout $args &&
+		git -C repo ls-files -t >expect &&
+		git -C repo sparse-checkout reapply &&
+		git -C repo ls-files -t >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	test_region unpack_trees mark_cone_changes trace &&
+	check_files repo a deep folder1 folder2 &&
+	check_files repo/deep a deeper2
+'
+
+test_expect_success 'cone mode: add after editing the sparse-checkout file' '
+	git -C repo sparse-checkout set folder1 &&
+	cat >repo/.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	/folder2/
+	EOF
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C repo sparse-checkout add deep &&
+	! test_region unpack_trees mark_cone_changes trace &&
+	check_files repo a deep folder2
+'
+
 test_expect_success 'not-up-to-date does not block rest of sparsification' '
 	test_when_finished git -C repo sparse-checkout disable &&
 	test_when_finished git -C repo reset --hard &&
@@ -409,8 +409,47 @@ test_expect_success 'sparse-index is expanded and converted back' '
 
 	rm trace2.txt &&
 	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" GIT_TRACE2_EVENT_NESTING=10 \
-		git -C sparse-index -c core.fsmonitor="" status -uno &&
+		git -C sparse-index -c core.fsmonitor="" ls-files &&
 	test_region index ensure_full_index trace2.txt
 '
 
+ensure_not_expanded () {
+	rm -f trace2.txt &&
+	echo >>sparse-index/untracked.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" GIT_TRACE2_EVENT_NESTING=10 \
+		git -C sparse-index "$@" &&
+	test_region ! index ensure_full_index trace2.txt
+}
+
+test_expect_success 'sparse-index is not expanded' '
+	init_repos &&
+
+	ensure_not_expanded status &&
+	ensure_not_expanded status -uno &&
+	ensure_not_expanded status --porcelain=v2 -- folder1/a &&
+	ensure_not_expanded commit --allow-empty -m empty &&
+	echo >>sparse-index/a &&
+	ensure_not_expanded commit -a -m a &&
+	echo >>sparse-index/deep/a &&
+	ensure_not_expanded add deep/a &&
+	ensure_not_expanded commit -m deep &&
+	echo >>sparse-index/deep/deeper1/a &&
+	ensure_not_expanded add -A &&
+	ensure_not_expanded add . &&
+	ensure_not_expanded add --refresh . &&
+	ensure_not_expanded commit -m deeper
+'
+
+test_expect_success 'status compares sparse directories' '
+	init_repos &&
+
+	# the index differs from HEAD inside of a sparse directory
+	test_all_match git reset --soft update-folder1 &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git status --porcelain=v2 -- folder1 &&
+	test_all_match git status --porcelain=v2 -- folder2 &&
+	test_all_match git commit -m "revert folder1" &&
+	test_all_match git diff HEAD~1 --stat
+'
+
 test_done
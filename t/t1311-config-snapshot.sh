@@ -0,0 +1,102 @@
+#!/bin/sh
+
+test_description='config snapshot in $GIT_DIR/config-snapshot'
+
+. ./test-lib.sh
+
+# Snapshots are not written while their source files are "racy", so make
+# them look old.
+age_config () {
+	test-tool chmtime =-10 .git/config "$@"
+}
+
+read_config () {
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool config iterate >actual
+}
+
+expect_snapshot () {
+	grep "\"key\":\"snapshot\",\"value\":\"$1\"" trace
+}
+
+test_expect_success 'setup' '
+	cat >included <<-\EOF &&
+	[foo]
+		bar = included
+	EOF
+	git config include.path "$(pwd)/included" &&
+	git config foo.baz one &&
+	git config --add foo.baz two &&
+	age_config included
+'
+
+test_expect_success 'no snapshot without core.configSnapshot' '
+	read_config &&
+	expect_snapshot none &&
+	test_path_is_missing .git/config-snapshot
+'
+
+test_expect_success 'snapshot is written, then loaded' '
+	git config core.configSnapshot true &&
+	age_config &&
+	read_config &&
+	expect_snapshot none &&
+	test_path_is_file .git/config-snapshot &&
+	mv actual expect &&
+	read_config &&
+	expect_snapshot loaded &&
+	test_cmp expect actual
+'
+
+test_expect_success 'command-line values are added on top of a snapshot' '
+	GIT_CONFIG_COUNT=1 GIT_CONFIG_KEY_0=foo.bar GIT_CONFIG_VALUE_0=cmdline \
+		test-tool config get_value foo.bar >actual &&
+	echo cmdline >expect &&
+	test_cmp expect actual &&
+	test-tool config get_value foo.bar >actual &&
+	echo included >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'changing an included file makes the snapshot stale' '
+	echo "	bar = changed" >>included &&
+	age_config included &&
+	read_config &&
+	expect_snapshot stale &&
+	read_config &&
+	expect_snapshot loaded &&
+	test-tool config get_value foo.bar >actual &&
+	echo changed >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a file that appears makes the snapshot stale' '
+	test_when_finished "rm -f \"$HOME/.gitconfig\"" &&
+	echo "[foo] global = yes" >"$HOME/.gitconfig" &&
+	read_config &&
+	expect_snapshot stale &&
+	test-tool config get_value foo.global >actual &&
+	echo yes >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a corrupt snapshot is not used' '
+	age_config &&
+	read_config &&
+	echo garbage >>.git/config-snapshot &&
+	read_config &&
+	expect_snapshot stale &&
+	test-tool config get_value foo.bar >actual &&
+	echo changed >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'disabling core.configSnapshot removes the snapshot' '
+	git config core.configSnapshot false &&
+	age_config &&
+	read_config &&
+	expect_snapshot stale &&
+	test_path_is_missing .git/config-snapshot
+'
+
+test_done
@@ -1607,4 +1607,64 @@ test_expect_success 'directory not created deleting packed ref' '
 	test_path_is_missing .git/refs/heads/d1
 '
 
+
+test_expect_success REFFILES 'core.packedRefsThreshold writes large transactions to packed-refs' '
+	test_config core.logAllRefUpdates true &&
+	git update-ref refs/batch/loose $A &&
+	git update-ref --create-reflog refs/batch/logged $A &&
+	cat >stdin <<-EOF &&
+	update refs/batch/loose $B $A
+	update refs/batch/logged $B $A
+	create refs/batch/new $B
+	create refs/heads/batch-branch $B
+	EOF
+	git -c core.packedRefsThreshold=4 update-ref --stdin <stdin &&
+	for ref in batch/loose batch/logged batch/new heads/batch-branch
+	do
+		echo "$B" >expect &&
+		git rev-parse refs/$ref >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	grep "refs/batch/loose$" .git/packed-refs &&
+	grep "refs/batch/new$" .git/packed-refs &&
+	test_path_is_missing .git/refs/batch/loose &&
+	test_path_is_missing .git/refs/batch/new &&
+	test_path_is_file .git/refs/batch/logged &&
+	test_path_is_file .git/refs/heads/batch-branch &&
+	git reflog exists refs/heads/batch-branch
+'
+
+test_expect_success REFFILES 'core.packedRefsThreshold keeps small transactions loose' '
+	git -c core.packedRefsThreshold=4 update-ref refs/batch/single $A &&
+	test_path_is_file .git/refs/batch/single
+'
+
+test_expect_success REFFILES 'core.packedRefsThreshold checks old values' '
+	cat >stdin <<-EOF &&
+	update refs/batch/loose $A $A
+	update refs/batch/new $A $B
+	EOF
+	test_must_fail git -c core.packedRefsThreshold=1 update-ref --stdin <stdin &&
+	echo "$B" >expect &&
+	git rev-parse refs/batch/loose >actual &&
+	test_cmp expect actual &&
+	git rev-parse refs/batch/new >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.fsyncRefFiles' '
+	git -c core.fsyncRefFiles=true update-ref refs/heads/fsynced $A &&
+	git -c core.fsyncRefFiles=true -c core.fsyncMethod=batch \
+		update-ref --stdin <<-EOF &&
+	update refs/heads/fsynced $B $A
+	create refs/heads/fsynced-2 $B
+	EOF
+	git -c core.fsyncRefFiles=true pack-refs --all &&
+	echo "$B" >expect &&
+	git rev-parse refs/heads/fsynced >actual &&
+	test_cmp expect actual &&
+	git rev-parse refs/heads/fsynced-2 >actual &&
+	test_cmp expect actual
+'
+
 test_done
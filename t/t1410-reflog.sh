@@ -184,6 +184,24 @@ test_expect_success '--stale-fix handles missing objects generously' '
 	git reflog expire --stale-fix
 '
 
+test_expect_success '--stale-fix keeps complete entries with bitmaps' '
+	test_when_finished "rm -rf stale-bitmaps" &&
+	git init stale-bitmaps &&
+	(
+		cd stale-bitmaps &&
+		test_commit one &&
+		test_commit two &&
+		test_commit three &&
+		git reset --hard HEAD^ &&
+		git repack -adb &&
+		git reflog main >before &&
+		git reflog expire --stale-fix --expire=never \
+			--expire-unreachable=never --all &&
+		git reflog main >after &&
+		test_cmp before after
+	)
+'
+
 test_expect_success 'prune and fsck' '
 
 	git prune &&
@@ -420,4 +438,73 @@ test_expect_success 'expire with multiple worktrees' '
 	)
 '
 
+test_expect_success REFFILES 'reflog expire leaves unchanged reflogs alone' '
+	git init untouched &&
+	(
+		cd untouched &&
+		test_commit one &&
+		test_commit two &&
+		test-tool chmtime =-600 .git/logs/refs/heads/main .git/logs/HEAD &&
+		test-tool chmtime --get .git/logs/refs/heads/main >expect &&
+		git reflog expire --expire=never --expire-unreachable=never \
+			--updateref --all &&
+		test-tool chmtime --get .git/logs/refs/heads/main >actual &&
+		test_cmp expect actual &&
+		test_line_count = 2 .git/logs/refs/heads/main &&
+
+		git reflog expire --expire=now refs/heads/main &&
+		test-tool chmtime --get .git/logs/refs/heads/main >actual &&
+		! test_cmp expect actual &&
+		test_must_be_empty .git/logs/refs/heads/main
+	)
+'
+
+# Write a reflog for refs/heads/main that switches between $1 and $2
+# every 100 seconds, 500 times, ending at $1.
+write_long_reflog () {
+	perl -e '
+		my ($a, $b, $zero) = @ARGV;
+		my $who = "C O Mitter <c\@example.com>";
+		print "$zero $a $who 1000000000 +0000\tinit\n";
+		for my $i (1..500) {
+			my ($o, $n) = $i % 2 ? ($a, $b) : ($b, $a);
+			my $t = 1000000000 + 100 * $i;
+			print "$o $n $who $t +0000\tentry $i\n";
+		}
+	' "$1" "$2" $ZERO_OID >.git/logs/refs/heads/main
+}
+
+test_expect_success REFFILES '@{date} in a long reflog reads only the entries it needs' '
+	test_when_finished "rm -rf long" &&
+	git init long &&
+	(
+		cd long &&
+		test_commit A &&
+		test_commit B &&
+		A=$(git rev-parse A) &&
+		B=$(git rev-parse B) &&
+		git update-ref refs/heads/main $A &&
+		write_long_reflog $A $B &&
+
+		# entry 301 is in effect at 1000030150
+		GIT_TRACE_REFS="$(pwd)/trace" \
+			git rev-parse "main@{1000030150}" >actual &&
+		echo $B >expect &&
+		test_cmp expect actual &&
+		grep "reflog_ent refs/heads/main" trace >visited &&
+		test_line_count = 2 visited &&
+
+		git rev-parse "main@{1000030100}" >actual &&
+		test_cmp expect actual &&
+		git rev-parse "main@{1000030099}" >actual &&
+		echo $A >expect &&
+		test_cmp expect actual &&
+		git rev-parse "main@{1000050100}" >actual &&
+		test_cmp expect actual &&
+		git rev-parse "main@{999999999}" >actual 2>err &&
+		test_cmp expect actual &&
+		test_i18ngrep "only goes back to" err
+	)
+'
+
 test_done
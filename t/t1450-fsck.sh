@@ -703,6 +703,28 @@ test_expect_success 'fsck errors in packed objects' '
 	! grep corrupt out
 '
 
+test_expect_success 'fsck --threads reports packed objects as without threads' '
+	git init threaded &&
+	(
+		cd threaded &&
+		mkdir blobs &&
+		for i in $(test_seq 1000)
+		do
+			echo $i >blobs/$i || return 1
+		done &&
+		(cd blobs && ls) | sed "s,^,blobs/," |
+			git hash-object -w --stdin-paths >objects &&
+		git hash-object -t commit -w ../one >>objects &&
+		git hash-object -t commit -w ../two >>objects &&
+		git pack-objects .git/objects/pack/pack <objects &&
+		git prune-packed &&
+		test_must_fail git fsck --threads=1 >expect 2>&1 &&
+		test_i18ngrep "bad name" expect &&
+		test_must_fail git fsck --threads=4 >actual 2>&1 &&
+		test_cmp expect actual
+	)
+'
+
 test_expect_success 'fsck fails on corrupt packfile' '
 	hsh=$(git commit-tree -m mycommit HEAD^{tree}) &&
 	pack=$(echo $hsh | git pack-objects .git/objects/pack/pack) &&
@@ -865,4 +887,23 @@ test_expect_success 'detect corrupt index file in fsck' '
 	test_i18ngrep "bad index file" errors
 '
 
+# Change a byte that only the index checksum covers, keeping the stat
+# data of the index, and verify that only a paranoid fsck notices.
+test_expect_success 'fsck trusts an index checksum it verified before' '
+	git init trust &&
+	(
+		cd trust &&
+		test_commit one &&
+		git fsck --cache &&
+		grep "/\.git/index\$" .git/checksum-cache &&
+		cp -p .git/index index.orig &&
+		printf "\377" | dd of=.git/index bs=1 seek=12 conv=notrunc &&
+		touch -r index.orig .git/index &&
+		git fsck --cache &&
+		test_must_fail git -c core.checksumTrust=paranoid \
+			fsck --cache 2>errors &&
+		test_i18ngrep "bad index file" errors
+	)
+'
+
 test_done
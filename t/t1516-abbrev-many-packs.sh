@@ -0,0 +1,95 @@
+#!/bin/sh
+
+test_description='abbreviated object names with objects in many packs'
+
+. ./test-lib.sh
+
+# Make commits $2..$3 on top of "main", each changing one file, as one
+# pack if $1 is "pack", or as loose objects otherwise.
+make_commits () {
+	perl -le '
+		my ($from, $to) = @ARGV;
+		for my $i ($from..$to) {
+			print "commit refs/heads/main";
+			print "committer nobody <nobody\@example.com> ",
+				1000000000 + $i, " +0000";
+			print "data <<EOF";
+			print "commit $i";
+			print "EOF";
+			print "from refs/heads/main^0" if $i == $from && $i > 1;
+			print "M 644 inline file";
+			print "data <<EOF";
+			print "content $i";
+			print "EOF";
+		}
+	' $2 $3 >input &&
+	if test "$1" = pack
+	then
+		git -c fastimport.unpackLimit=0 fast-import --quiet <input
+	else
+		git -c fastimport.unpackLimit=100000 fast-import --quiet <input
+	fi
+}
+
+# Show the shortest unique abbreviation, of at least $1 hex digits, of
+# each object name read from the standard input, among all objects.
+expect_abbrev () {
+	git cat-file --batch-all-objects --batch-check="%(objectname)" >all &&
+	perl -e '
+		my $min = shift;
+		open my $fh, "<", shift or die;
+		my @all = sort map { chomp; $_ } <$fh>;
+		sub common {
+			my ($a, $b) = @_;
+			my $i = 0;
+			$i++ while $i < length($a) && substr($a, $i, 1) eq substr($b, $i, 1);
+			return $i;
+		}
+		my %len;
+		for my $i (0..$#all) {
+			my $need = $min;
+			for my $j ($i - 1, $i + 1) {
+				next if $j < 0 || $j > $#all;
+				my $n = common($all[$i], $all[$j]) + 1;
+				$need = $n if $n > $need;
+			}
+			$len{$all[$i]} = $need;
+		}
+		while (<STDIN>) {
+			chomp;
+			print substr($_, 0, $len{$_}), "\n";
+		}
+	' "$1" all
+}
+
+test_expect_success 'setup' '
+	make_commits pack 1 300 &&
+	make_commits pack 301 600 &&
+	make_commits pack 601 900 &&
+	make_commits loose 901 1000 &&
+	make_commits pack 1001 1300 &&
+	make_commits loose 1301 1400
+'
+
+test_expect_success 'log --abbrev=4 shows the shortest unique names' '
+	git log --format=%H main | expect_abbrev 4 >expect &&
+	git log --format=%h --abbrev=4 main >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'log --abbrev=4 with a multi-pack-index' '
+	git multi-pack-index write &&
+	test_when_finished "rm -f .git/objects/pack/multi-pack-index" &&
+	git log --format=%H main | expect_abbrev 4 >expect &&
+	git log --format=%h --abbrev=4 main >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'log --raw --abbrev=4 shows the shortest unique names' '
+	git log --format= --raw --no-abbrev main | cut -d" " -f4 >oids &&
+	expect_abbrev 4 <oids >expect &&
+	git log --format= --raw --abbrev=4 main | cut -d" " -f4 >actual &&
+	test_cmp expect actual
+'
+
+test_done
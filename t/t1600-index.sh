@@ -97,4 +97,82 @@ test_expect_success 'index version config precedence' '
 	test_index_version 0 true 2 2
 '
 
+null_trailer () {
+	test $(tail -c $(test_oid rawsz) "$1" | tr -d "\000" | wc -c) = 0
+}
+
+test_expect_success 'index.skipHash writes a null trailing checksum' '
+	git init skip-hash &&
+	(
+		cd skip-hash &&
+		test_commit one &&
+		echo two >two.t &&
+		git -c index.skipHash=true add two.t &&
+		null_trailer .git/index &&
+		git fsck &&
+		git ls-files >actual &&
+		printf "one.t\ntwo.t\n" >expect &&
+		test_cmp expect actual &&
+
+		git -c index.skipHash=false update-index --index-version=3 &&
+		! null_trailer .git/index &&
+		git -c feature.manyFiles=true update-index --index-version=2 &&
+		null_trailer .git/index &&
+		git fsck
+	)
+'
+
+test_expect_success 'index.skipHash keeps the checksum of a shared index' '
+	git init skip-hash-split &&
+	(
+		cd skip-hash-split &&
+		test_commit one &&
+		git -c index.skipHash=true update-index --split-index &&
+		null_trailer .git/index &&
+		! null_trailer .git/sharedindex.* &&
+		echo two >two.t &&
+		git -c index.skipHash=true add two.t &&
+		git ls-files >actual &&
+		printf "one.t\ntwo.t\n" >expect &&
+		test_cmp expect actual &&
+		git fsck
+	)
+'
+
+test_expect_success 'index written by several threads reads back' '
+	git init threaded-write &&
+	for d in a b c d e
+	do
+		mkdir threaded-write/$d &&
+		for f in 1 2 3 4 5 6 7
+		do
+			echo $d$f >threaded-write/$d/file$f || return 1
+		done || return 1
+	done &&
+	git -C threaded-write add . &&
+	git -C threaded-write ls-files -s >expect &&
+	grep -v c/file3 expect >expect.rm &&
+
+	for version in 2 4
+	do
+		rm threaded-write/.git/index &&
+		git -C threaded-write -c index.version=$version \
+			-c index.threads=4 add . &&
+		git -C threaded-write -c index.threads=1 ls-files -s >actual &&
+		test_cmp expect actual &&
+		git -C threaded-write -c index.threads=4 rm -q --cached c/file3 &&
+		git -C threaded-write -c index.threads=1 ls-files -s >actual &&
+		test_cmp expect.rm actual &&
+		git -C threaded-write fsck || return 1
+	done
+'
+
+test_expect_success 'threads reading the index hand off their memory pools' '
+	git -C threaded-write -c index.threads=4 add . &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C threaded-write -c index.threads=4 ls-files -s >actual &&
+	test_cmp expect actual &&
+	grep "\"category\":\"mem_pool\",\"key\":\"shared/arenas\"" trace
+'
+
 test_done
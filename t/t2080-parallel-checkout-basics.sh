@@ -226,4 +226,34 @@ test_expect_success SYMLINKS 'parallel checkout checks for symlinks in leading d
 	)
 '
 
+test_expect_success 'checkout.workerType selects threads or processes' '
+	set_checkout_config 2 0 &&
+	git init worker-type &&
+	(
+		cd worker-type &&
+		test_commit A &&
+		test_commit B &&
+		rm A.t B.t &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace-thread" \
+			git -c checkout.workerType=thread checkout . &&
+		grep "\"event\":\"thread_start\".*:checkout-worker\"" trace-thread >threads &&
+		test_line_count = 2 threads &&
+		! grep "checkout--worker" trace-thread &&
+		rm A.t B.t &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace-process" \
+			git -c checkout.workerType=process checkout . &&
+		grep "\"event\":\"child_start\".*\"checkout--worker\"" trace-process >processes &&
+		test_line_count = 2 processes &&
+		! grep ":checkout-worker\"" trace-process &&
+		test_path_is_file A.t &&
+		test_path_is_file B.t &&
+
+		rm A.t B.t &&
+		test_must_fail git -c checkout.workerType=bogus checkout . 2>err &&
+		test_i18ngrep "invalid value for .checkout.workerType." err
+	)
+'
+
 test_done
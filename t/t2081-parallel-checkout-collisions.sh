@@ -35,7 +35,7 @@ test_expect_success CASE_INSENSITIVE_FS 'setup' '
 
 test_workers_in_event_trace ()
 {
-	test $1 -eq $(grep ".event.:.child_start..*checkout--worker" $2 | wc -l)
+	test $1 -eq $(count_checkout_workers $2)
 }
 
 test_expect_success CASE_INSENSITIVE_FS 'worker detects basename collision' '
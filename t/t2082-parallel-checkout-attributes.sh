@@ -135,6 +135,93 @@ test_expect_success 'parallel-checkout and external filter' '
 	)
 '
 
+# Entries whose filter driver may run as several instances at once are written
+# by the workers too, which are then processes, each running the filter itself.
+#
+test_expect_success 'parallel-checkout with filter.<driver>.parallel' '
+	set_checkout_config 2 0 &&
+	git init parallel-filter &&
+	(
+		cd parallel-filter &&
+		write_script <<-\EOF rot13.sh &&
+		tr \
+		  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ" \
+		  "nopqrstuvwxyzabcdefghijklmNOPQRSTUVWXYZABCDEFGHIJKLM"
+		EOF
+
+		git config filter.rot13.clean "\"$(pwd)/rot13.sh\"" &&
+		git config filter.rot13.smudge "\"$(pwd)/rot13.sh\"" &&
+		git config filter.rot13.required true &&
+		git config filter.rot13.parallel true &&
+
+		echo abcd >original &&
+		echo nopq >rot13 &&
+
+		echo "[AB] filter=rot13" >.gitattributes &&
+		cp original A &&
+		cp original B &&
+		cp original C &&
+		git add A B C .gitattributes &&
+		git commit -m filter &&
+		git cat-file -p :A >A.internal &&
+		test_cmp rot13 A.internal &&
+
+		rm A B C &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git checkout A B C &&
+		grep "\"event\":\"child_start\".*\"checkout--worker\"" trace >workers &&
+		test_line_count = 2 workers &&
+		! grep "\"event\":\"thread_start\".*:checkout-worker\"" trace &&
+
+		test_cmp original A &&
+		test_cmp original B &&
+		test_cmp original C
+	)
+'
+
+test_expect_success PERL 'parallel-checkout with a parallel process filter' '
+	write_script rot13-filter.pl "$PERL_PATH" \
+		<"$TEST_DIRECTORY"/t0021/rot13-filter.pl &&
+
+	test_config_global filter.par.process \
+		"\"$(pwd)/rot13-filter.pl\" \"$(pwd)/par.log\" clean smudge delay" &&
+	test_config_global filter.par.required true &&
+	test_config_global filter.par.parallel true &&
+
+	echo "abcd" >original &&
+	echo "nopq" >rot13 &&
+
+	git init par &&
+	(
+		cd par &&
+		echo "*.p filter=par" >.gitattributes &&
+		cp ../original W.p &&
+		cp ../original X.p &&
+		cp ../original Y.p &&
+		cp ../original Z.p &&
+		git add -A &&
+		git commit -m par &&
+		git cat-file -p :W.p >W.p.internal &&
+		test_cmp W.p.internal ../rot13 &&
+		rm *
+	) &&
+
+	rm -f par.log &&
+	set_checkout_config 2 0 &&
+	test_checkout_workers 2 git -C par checkout -f &&
+
+	# Each worker ran its own filter, which was not asked to delay
+	grep START par.log >starts &&
+	test_line_count = 2 starts &&
+	! grep "\[DELAYED\]" par.log &&
+	grep "smudge W.p treeish=" par.log &&
+
+	verify_checkout par &&
+	test_cmp par/W.p original &&
+	test_cmp par/X.p original &&
+	test_cmp par/Y.p original &&
+	test_cmp par/Z.p original
+'
+
 # The delayed queue is independent from the parallel queue, and they should be
 # able to work together in the same checkout process.
 #
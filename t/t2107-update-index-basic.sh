@@ -92,4 +92,27 @@ test_expect_success '--chmod=+x and chmod=-x in the same argument list' '
 	test_cmp expect actual
 '
 
+test_expect_success '--add --stdin writes many files to one pack' '
+	test_when_finished "rm -rf many" &&
+	git init many &&
+	(
+		cd many &&
+		for i in $(test_seq 150)
+		do
+			echo "content $i" >file$i || return 1
+		done &&
+		ls file* >paths &&
+		for f in $(cat paths)
+		do
+			echo "100644 $(git hash-object $f) 0	$f" || return 1
+		done >expect &&
+		git update-index --add --stdin <paths &&
+		git ls-files --stage >actual &&
+		test_cmp expect actual &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 1 packs &&
+		git fsck --no-dangling
+	)
+'
+
 test_done
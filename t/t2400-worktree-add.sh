@@ -623,4 +623,46 @@ test_expect_success '"add" with initialized submodule, with submodule.recurse se
 	git -C project-clone -c submodule.recurse worktree add ../project-5
 '
 
+
+test_expect_success 'setup source worktree for --reuse-from' '
+	git init reuse &&
+	(
+		cd reuse &&
+		test_commit one &&
+		test_commit two &&
+		mkdir dir &&
+		test_commit dir/three &&
+		test_commit four &&
+		test-tool chmtime =-60 one.t two.t four.t &&
+		git update-index --refresh &&
+		echo dirty >dir/three.t
+	)
+'
+
+test_expect_success '"add --reuse-from" copies unchanged files' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C reuse worktree add --reuse-from . ../reused HEAD^ &&
+	grep "\"key\":\"add/reused\",\"value\":\"2\"" trace &&
+	git -C reused diff --exit-code HEAD &&
+	git -C reused status --porcelain >actual &&
+	test_must_be_empty actual &&
+	test_path_is_missing reused/four.t &&
+	echo dir/three >expect &&
+	test_cmp expect reused/dir/three.t
+'
+
+test_expect_success '"add --reuse-from" with another worktree' '
+	git -C reused worktree add --reuse-from ../reuse ../reused2 &&
+	git -C reused2 diff --exit-code HEAD &&
+	git -C reused2 status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success '"add --reuse-from" rejects bad sources' '
+	test_must_fail git -C reuse worktree add --reuse-from nowhere ../bad &&
+	test_must_fail git -C reuse worktree add --no-checkout \
+		--reuse-from . ../bad &&
+	test_path_is_missing bad
+'
+
 test_done
@@ -51,4 +51,35 @@ test_expect_success SYMLINKS 'ls-files with absolute paths to symlinks' '
 	test_cmp expect actual
 '
 
+test_expect_success 'ls-files with a pathspec reads only part of the index' '
+	git init partial &&
+	for d in a b c d e f g h
+	do
+		mkdir partial/$d &&
+		for f in 1 2 3 4 5 6 7 8
+		do
+			echo $d$f >partial/$d/$f || return 1
+		done || return 1
+	done &&
+	git -C partial add . &&
+	git -C partial ls-files >all &&
+	git -C partial ls-files d/ >expect &&
+	git -C partial ls-files -s d/3 >expect-stage &&
+
+	for version in 2 4
+	do
+		rm partial/.git/index &&
+		GIT_TEST_INDEX_THREADS=4 \
+			git -C partial -c index.version=$version add . &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.$version" \
+			git -C partial ls-files d/ >actual &&
+		test_cmp expect actual &&
+		grep "\"key\":\"read/cache_nr\",\"value\":\"16\"" trace.$version &&
+		git -C partial ls-files -s d/3 >actual &&
+		test_cmp expect-stage actual &&
+		git -C partial ls-files >actual &&
+		test_cmp all actual || return 1
+	done
+'
+
 test_done
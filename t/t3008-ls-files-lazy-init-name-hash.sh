@@ -24,4 +24,9 @@ test_expect_success 'no buffer overflow in lazy_init_name_hash' '
 	test-tool lazy-init-name-hash -m
 '
 
+test_expect_success 'names can be looked up from several threads' '
+	test-tool lazy-init-name-hash --lookup=1 &&
+	test-tool lazy-init-name-hash --lookup=4 --count=3
+'
+
 test_done
@@ -772,4 +772,13 @@ test_expect_success '--left-only/--right-only' '
 	test_cmp expect actual
 '
 
+test_expect_success 'threads do not change the output' '
+	git -c rangeDiff.threads=1 range-diff topic...changed >expect &&
+	git -c rangeDiff.threads=4 range-diff topic...changed >actual &&
+	test_cmp expect actual &&
+	git -c rangeDiff.threads=1 range-diff topic...mode-only-change >expect &&
+	git -c rangeDiff.threads=3 range-diff topic...mode-only-change >actual &&
+	test_cmp expect actual
+'
+
 test_done
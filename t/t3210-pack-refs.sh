@@ -241,6 +241,95 @@ test_expect_success 'retry acquiring packed-refs.lock' '
 	git -c core.packedrefstimeout=3000 pack-refs --all --prune
 '
 
+test_expect_success 'setup packed-refs with many refs' '
+	git init delta &&
+	(
+		cd delta &&
+		test_commit A &&
+		test_commit B &&
+		A=$(git rev-parse A) &&
+		for i in $(test_seq 200)
+		do
+			echo "create refs/heads/many-$i $A" || return 1
+		done >input &&
+		git update-ref --stdin <input &&
+		git pack-refs --all --prune &&
+		git config core.repositoryFormatVersion 1 &&
+		git config extensions.packedRefsDelta true
+	)
+'
+
+test_expect_success 'extensions.packedRefsDelta needs repository format 1' '
+	test_when_finished "rm -rf delta-v0" &&
+	git init delta-v0 &&
+	git -C delta-v0 config core.repositoryFormatVersion 0 &&
+	git -C delta-v0 config extensions.packedRefsDelta true &&
+	test_must_fail git -C delta-v0 rev-parse --git-dir 2>err &&
+	test_i18ngrep "v1-only extension" err
+'
+
+test_expect_success 'extensions.packedRefsDelta writes deletions to the delta' '
+	(
+		cd delta &&
+		cp .git/packed-refs packed-refs.before &&
+		git for-each-ref >expect &&
+		git branch -d many-1 many-2 &&
+		test_cmp packed-refs.before .git/packed-refs &&
+		grep " refs/heads/many-1\$" .git/packed-refs.delta >tombstone &&
+		grep "^$ZERO_OID " tombstone &&
+		sed -e "/refs\/heads\/many-[12]\$/d" expect >expect.deleted &&
+		git for-each-ref >actual &&
+		test_cmp expect.deleted actual &&
+		test_must_fail git rev-parse --verify -q refs/heads/many-1
+	)
+'
+
+test_expect_success 'extensions.packedRefsDelta writes updates to the delta' '
+	(
+		cd delta &&
+		B=$(git rev-parse B) &&
+		git update-ref refs/heads/many-3 B &&
+		git pack-refs --all &&
+		git update-ref -d refs/heads/many-3 &&
+		test_must_fail git rev-parse --verify -q refs/heads/many-3 &&
+		git for-each-ref refs/heads/many-3 >actual &&
+		test_must_be_empty actual &&
+		git update-ref refs/heads/many-4 B $(git rev-parse A) &&
+		test_must_fail git update-ref -d refs/heads/many-4 A &&
+		git rev-parse many-4 >actual &&
+		echo $B >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'pack-refs folds the delta into packed-refs' '
+	(
+		cd delta &&
+		git for-each-ref >expect &&
+		test_path_is_file .git/packed-refs.delta &&
+		git pack-refs --all --prune &&
+		test_path_is_missing .git/packed-refs.delta &&
+		! grep "^$ZERO_OID " .git/packed-refs &&
+		git for-each-ref >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'a large delta is folded in' '
+	(
+		cd delta &&
+		for i in $(test_seq 10 60)
+		do
+			echo "delete refs/heads/many-$i" || return 1
+		done >input &&
+		git update-ref --stdin <input &&
+		test_path_is_missing .git/packed-refs.delta &&
+		git for-each-ref refs/heads/many-10 refs/heads/many-60 >actual &&
+		test_must_be_empty actual &&
+		git rev-parse --verify refs/heads/many-9
+	)
+'
+
 test_expect_success SYMLINKS 'pack symlinked packed-refs' '
 	# First make sure that symlinking works when reading:
 	git update-ref refs/heads/lossy refs/heads/main &&
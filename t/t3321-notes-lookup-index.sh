@@ -0,0 +1,113 @@
+#!/bin/sh
+
+test_description='looking up notes in the index written by maintenance'
+
+. ./test-lib.sh
+
+index_dir=.git/objects/info/notes-index
+
+test_expect_success setup '
+	test_commit_bulk 300 &&
+	git rev-list HEAD >commits &&
+	while read commit
+	do
+		echo "N inline $commit" &&
+		echo "data <<EOF" &&
+		echo "note for $commit" &&
+		echo "EOF" || return 1
+	done <commits >notes &&
+	{
+		echo "commit refs/notes/commits" &&
+		echo "committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE" &&
+		echo "data <<EOF" &&
+		echo "many notes" &&
+		echo "EOF" &&
+		cat notes
+	} | git fast-import &&
+	git notes --ref=other add -m other HEAD~5 &&
+
+	git -c notes.useIndex=false log --notes --notes=other >expect &&
+	grep "note for $(git rev-parse HEAD~299)" expect &&
+	git ls-tree refs/notes/commits >fanout &&
+	test_line_count -lt 300 fanout
+'
+
+test_expect_success 'maintenance writes an index for each notes ref' '
+	git maintenance run --task=notes-index &&
+	test_path_is_file $index_dir/$(git rev-parse refs/notes/commits) &&
+	test_path_is_file $index_dir/$(git rev-parse refs/notes/other) &&
+	ls $index_dir >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'notes shown from the index are the same' '
+	git log --notes --notes=other >actual &&
+	test_cmp expect actual &&
+	git notes show HEAD~123 >actual &&
+	echo "note for $(git rev-parse HEAD~123)" >expect.note &&
+	test_cmp expect.note actual &&
+	test_must_fail git notes --ref=other show HEAD
+'
+
+test_expect_success 'the index is used' '
+	other=$(git rev-parse refs/notes/other) &&
+	commits=$(git rev-parse refs/notes/commits) &&
+	test_when_finished "mv $index_dir/$other.saved $index_dir/$other" &&
+	mv $index_dir/$other $index_dir/$other.saved &&
+	cp $index_dir/$commits $index_dir/$other &&
+	git notes --ref=other show HEAD~123 >actual &&
+	test_cmp expect.note actual &&
+	test_must_fail git -c notes.useIndex=false notes --ref=other \
+		show HEAD~123 2>err &&
+	test_i18ngrep "no note found" err
+'
+
+test_expect_success 'modified notes are not looked up in the index' '
+	git notes append -m appended HEAD~7 &&
+	git notes show HEAD~7 >actual &&
+	test_write_lines "note for $(git rev-parse HEAD~7)" "" appended >expect.note &&
+	test_cmp expect.note actual &&
+	git notes copy -f HEAD~8 HEAD~9 &&
+	git notes show HEAD~9 >actual &&
+	echo "note for $(git rev-parse HEAD~8)" >expect.note &&
+	test_cmp expect.note actual
+'
+
+test_expect_success 'maintenance removes the indexes of old commits' '
+	old=$(git rev-parse refs/notes/commits~2) &&
+	test_path_is_file $index_dir/$old &&
+	git maintenance run --task=notes-index &&
+	test_path_is_missing $index_dir/$old &&
+	test_path_is_file $index_dir/$(git rev-parse refs/notes/commits) &&
+	git -c notes.useIndex=false log --notes >expect &&
+	git log --notes >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'no index is written for duplicate notes' '
+	note=$(echo duplicate | git hash-object -w --stdin) &&
+	note2=$(echo another | git hash-object -w --stdin) &&
+	head=$(git rev-parse HEAD) &&
+	ab=$(echo $head | cut -c1-2) &&
+	rest=$(echo $head | cut -c3-) &&
+	sub=$(printf "100644 blob %s\t%s\n" $note2 $rest | git mktree) &&
+	tree=$(printf "100644 blob %s\t%s\n040000 tree %s\t%s\n" \
+		$note $head $sub $ab | git mktree) &&
+	commit=$(git commit-tree -m dup $tree) &&
+	git update-ref refs/notes/dup $commit &&
+	git maintenance run --task=notes-index &&
+	test_path_is_missing $index_dir/$commit &&
+	git notes --ref=dup show HEAD >actual &&
+	test_write_lines another "" duplicate >expect.note &&
+	test_cmp expect.note actual
+'
+
+test_expect_success 'a malformed index is ignored' '
+	commits=$(git rev-parse refs/notes/commits) &&
+	echo garbage >$index_dir/$commits &&
+	git log --notes -1 HEAD~7 >actual 2>err &&
+	grep appended actual &&
+	test_i18ngrep "ignoring malformed notes index" err
+'
+
+test_done
@@ -0,0 +1,128 @@
+#!/bin/sh
+
+test_description='rebase picking commits in memory'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-rebase.sh
+
+sane_unset GIT_TEST_REBASE_IN_MEMORY GIT_TEST_MERGE_ALGORITHM
+
+test_expect_success setup '
+	test_commit base &&
+	test_commit upstream &&
+	git checkout -b topic base &&
+	test_commit one &&
+	test_commit two &&
+	test_commit --no-tag three base.t changed &&
+	test_commit four &&
+	git checkout -b conflict base &&
+	test_commit five &&
+	test_commit six upstream.t &&
+	test_commit seven &&
+
+	mkdir -p .git/hooks &&
+	write_script .git/hooks/post-rewrite <<-\EOF
+	cat >>rewritten
+	EOF
+'
+
+rebase_both () {
+	branch=$1 &&
+	shift &&
+	test_tick &&
+	for mode in false true
+	do
+		git checkout -q -B $mode-$branch $branch &&
+		rm -f rewritten &&
+		git -c rebase.inMemory=$mode rebase -s ort "$@" &&
+		git log --format="%T %an %ae %ad %s" >log.$mode &&
+		git reflog -n 6 --format=%gs HEAD |
+			sed "s/$mode-$branch/BRANCH/" >reflog.$mode &&
+		sed "s/ .*//" rewritten >rewritten.$mode &&
+		git rev-parse HEAD >head.$mode || return 1
+	done &&
+	test_cmp log.false log.true &&
+	test_cmp reflog.false reflog.true &&
+	test_cmp head.false head.true &&
+	test_cmp rewritten.false rewritten.true
+}
+
+test_expect_success 'picking in memory gives the same result' '
+	rebase_both topic upstream &&
+	git diff --exit-code &&
+	git diff --cached --exit-code &&
+	test_path_is_missing .git/rebase-merge
+'
+
+test_expect_success 'picking in memory around other commands' '
+	rebase_both topic --exec "git rev-parse HEAD >>executed" upstream &&
+	test_line_count = 8 executed
+'
+
+test_expect_success 'picking in memory fast-forwards' '
+	(
+		set_fake_editor &&
+		FAKE_LINES="exec_true 1 2 3 4" &&
+		export FAKE_LINES &&
+		rebase_both topic -i base
+	) &&
+	test_cmp_rev topic HEAD
+'
+
+test_expect_success 'a conflict stops where it would without memory' '
+	git checkout -B in-memory conflict &&
+	test_must_fail git -c rebase.inMemory rebase -s ort upstream &&
+	test_cmp_rev REBASE_HEAD six &&
+	git diff --name-only --diff-filter=U >actual &&
+	echo upstream.t >expect &&
+	test_cmp expect actual &&
+	test_cmp_rev HEAD^ upstream &&
+	git log --format=%s -1 >actual &&
+	echo five >expect &&
+	test_cmp expect actual &&
+	grep "^pick $(git rev-parse five)" .git/rebase-merge/done &&
+	git rebase --abort &&
+	test_cmp_rev HEAD conflict
+'
+
+test_expect_success 'picking in memory is not done with hooks' '
+	hook=.git/hooks/prepare-commit-msg &&
+	write_script $hook <<-\EOF &&
+	echo hooked >>"$1"
+	EOF
+	test_when_finished "rm $hook" &&
+	git checkout -B hooked topic &&
+	git -c rebase.inMemory rebase -s ort upstream &&
+	git log -1 --format=%B >actual &&
+	grep hooked actual
+'
+
+test_expect_success 'many picks are checkpointed' '
+	git checkout -b many base &&
+	for i in $(test_seq 1 105)
+	do
+		echo "commit refs/heads/many" &&
+		echo "committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $i +0000" &&
+		echo "data <<EOF" &&
+		echo "commit $i" &&
+		echo "EOF" &&
+		if test $i = 1
+		then
+			echo "from $(git rev-parse base)"
+		fi &&
+		echo "M 100644 inline file$i" &&
+		echo "data <<EOF" &&
+		echo "$i" &&
+		echo "EOF" &&
+		echo || return 1
+	done | git fast-import &&
+	git reset --hard &&
+	rebase_both many upstream &&
+	git diff --exit-code &&
+	test_path_is_file file105
+'
+
+test_done
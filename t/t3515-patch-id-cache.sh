@@ -0,0 +1,93 @@
+#!/bin/sh
+
+test_description='finding equivalent commits with the patch-id cache'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+cache=.git/objects/info/patch-ids
+
+# Overwrite the full patch ids in the cache with garbage that is the same
+# for every commit, so that commits whose diffs touch the same paths look
+# equivalent when the cache is used.
+garble_full_ids () {
+	perl -e '
+		my ($file, $rawsz) = @ARGV;
+		open(my $fh, "+<", $file) or die;
+		binmode $fh;
+		read($fh, my $header, 20);
+		my $nr = unpack("N", substr($header, 16, 4));
+		seek($fh, 20 + 1024 + 2 * $nr * $rawsz, 0);
+		print $fh "\001" x ($nr * $rawsz);
+		close($fh);
+	' "$1" "$(test_oid rawsz)"
+}
+
+test_expect_success setup '
+	test_commit base file &&
+	git checkout -b side &&
+	test_commit picked &&
+	test_commit --no-tag different file side &&
+	test_commit only-side &&
+	git checkout main &&
+	git cherry-pick picked &&
+	test_commit --no-tag upstream file upstream &&
+
+	git cherry main side >expect &&
+	grep "^- $(git rev-parse picked)" expect &&
+	grep "^+ $(git rev-parse side^)" expect
+'
+
+test_expect_success 'maintenance writes the cache' '
+	git maintenance run --task=patch-ids &&
+	test_path_is_file $cache &&
+	git cherry main side >actual &&
+	test_cmp expect actual &&
+	git log --cherry-pick --format=%s main...side >actual &&
+	git -c core.patchIdCache=false log --cherry-pick --format=%s \
+		main...side >expect.log &&
+	test_cmp expect.log actual
+'
+
+test_expect_success 'the cache is used' '
+	cp $cache cache.saved &&
+	test_when_finished "mv cache.saved $cache" &&
+	garble_full_ids $cache &&
+	git cherry main side >actual &&
+	grep "^- $(git rev-parse side^)" actual &&
+	git -c core.patchIdCache=false cherry main side >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the cache is not used with other diff options' '
+	cp $cache cache.saved &&
+	test_when_finished "mv cache.saved $cache" &&
+	garble_full_ids $cache &&
+	git -c diff.algorithm=patience log --cherry-pick --format=%s \
+		main...side >actual &&
+	test_cmp expect.log actual
+'
+
+test_expect_success 'new commits are added to the cache' '
+	git checkout side &&
+	test_commit --no-tag later file later &&
+	git checkout main &&
+	git cherry main side >expect &&
+	git maintenance run --task=patch-ids &&
+	cp $cache cache.saved &&
+	test_when_finished "mv cache.saved $cache" &&
+	garble_full_ids $cache &&
+	git cherry main side >actual &&
+	grep "^- $(git rev-parse side)" actual
+'
+
+test_expect_success 'a malformed cache is ignored' '
+	echo garbage >$cache &&
+	git cherry main side >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "ignoring malformed patch-id cache" err
+'
+
+test_done
@@ -0,0 +1,108 @@
+#!/bin/sh
+
+test_description='basic git replay tests'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_commit A &&
+	test_commit B &&
+
+	git switch -c topic1 &&
+	test_commit C &&
+	git switch -c topic2 &&
+	test_commit D &&
+	test_commit E &&
+	git switch topic1 &&
+	test_commit F &&
+
+	git switch -c topic3 main &&
+	test_commit G &&
+	git mv G.t renamed.t &&
+	test_tick &&
+	git commit -m rename-G &&
+
+	git switch main &&
+	test_commit H &&
+	test_commit I &&
+
+	git switch -c conflict B &&
+	test_commit --no-tag conflict I.t
+'
+
+test_expect_success 'replay onto a new base' '
+	git replay --onto main topic1..topic2 >result &&
+
+	test_line_count = 1 result &&
+	new=$(cut -f 3 -d " " result) &&
+	git log --format=%s $new >actual &&
+	test_write_lines E D I H B A >expect &&
+	test_cmp expect actual &&
+
+	printf "update refs/heads/topic2 %s %s\n" \
+		$new $(git rev-parse topic2) >expect &&
+	test_cmp expect result &&
+
+	# the author and message are kept, the trees are the merge result
+	git log --format="%an %ae %ad%n%B" -2 topic2 >expect &&
+	git log --format="%an %ae %ad%n%B" -2 $new >actual &&
+	test_cmp expect actual &&
+	git ls-tree -r --name-only $new >actual &&
+	test_write_lines A.t B.t D.t E.t H.t I.t >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'output can be fed to update-ref' '
+	git branch copy topic3 &&
+	git replay --onto main main..copy >result &&
+	git update-ref --stdin <result &&
+	git log --format=%s copy >actual &&
+	test_write_lines rename-G G I H B A >expect &&
+	test_cmp expect actual &&
+	test_path_is_missing renamed.t
+'
+
+test_expect_success 'replay several branches sharing commits' '
+	git replay --onto main topic1 topic2 ^B >result &&
+
+	test_line_count = 2 result &&
+	new1=$(grep refs/heads/topic1 result | cut -f 3 -d " ") &&
+	new2=$(grep refs/heads/topic2 result | cut -f 3 -d " ") &&
+	git log --format=%s $new1 >actual &&
+	test_write_lines F C I H B A >expect &&
+	test_cmp expect actual &&
+	git log --format=%s $new2 >actual &&
+	test_write_lines E D C I H B A >expect &&
+	test_cmp expect actual &&
+	test $(git rev-parse $new1~1) = $(git rev-parse $new2~2)
+'
+
+test_expect_success 'works in a bare repository' '
+	git clone --bare . bare.git &&
+	git -C bare.git replay --onto main main..topic3 >result &&
+	git replay --onto main main..topic3 >expect &&
+	test_cmp expect result
+'
+
+test_expect_success 'conflicts stop the replay' '
+	test_expect_code 1 git replay --onto main B..conflict >out 2>err &&
+	test_must_be_empty out &&
+	test_i18ngrep "could not replay $(git rev-parse conflict): conflicts" err
+'
+
+test_expect_success 'merge commits are refused' '
+	git checkout -b merged topic1 &&
+	git merge --no-edit topic3 &&
+	test_must_fail git replay --onto main B..merged 2>err &&
+	test_i18ngrep "cannot replay merge commit" err
+'
+
+test_expect_success 'revisions must be references' '
+	test_must_fail git replay --onto main B..$(git rev-parse topic1) 2>err &&
+	test_i18ngrep "is not a reference" err
+'
+
+test_done
@@ -462,6 +462,30 @@ test_expect_success 'all statuses changed in folder if . is given' '
 	)
 '
 
+test_expect_success 'add with core.fsyncMethod=batch' '
+	test_when_finished "rm -rf batch" &&
+	git init batch &&
+	(
+		cd batch &&
+		for i in 1 2 3 4 5
+		do
+			echo "content $i" >file$i || return 1
+		done &&
+		git -c core.fsyncObjectFiles=true -c core.fsyncMethod=batch \
+			add file* &&
+		git count-objects >count &&
+		grep "^5 objects" count &&
+		git ls-files -s >stage &&
+		test_line_count = 5 stage &&
+		while read mode oid stage path
+		do
+			git cat-file -e $oid || return 1
+		done <stage &&
+		ls .git/objects >dirs &&
+		! grep bulk-fsync dirs
+	)
+'
+
 test_expect_success CASE_INSENSITIVE_FS 'path is case-insensitive' '
 	path="$(pwd)/BLUB" &&
 	touch "$path" &&
@@ -1307,4 +1307,40 @@ test_expect_success 'stash -c stash.useBuiltin=false warning ' '
 	test_must_be_empty err
 '
 
+test_expect_success 'stash resets HEAD like reset --hard' '
+	git reset --hard &&
+	git checkout -b reset-like &&
+	test_commit reset-like &&
+	echo changed >reset-like.t &&
+	git stash &&
+	test_cmp_rev ORIG_HEAD HEAD &&
+	git reflog -1 --format=%gs HEAD >actual &&
+	echo "reset: moving to HEAD" >expect &&
+	test_cmp expect actual &&
+	git stash pop &&
+	echo changed >expect &&
+	test_cmp expect reset-like.t
+'
+
+test_expect_success 'apply --index keeps other staged changes' '
+	git reset --hard &&
+	test_commit staged-one &&
+	test_commit staged-two &&
+	echo stashed >staged-one.t &&
+	git add staged-one.t &&
+	git stash &&
+	echo other >staged-two.t &&
+	git add staged-two.t &&
+	if test "$GIT_TEST_MERGE_ALGORITHM" = recursive
+	then
+		test_must_fail git stash apply --index
+	else
+		git stash apply --index &&
+		git diff --cached --name-only >actual &&
+		test_write_lines staged-one.t staged-two.t >expect &&
+		test_cmp expect actual &&
+		git diff --exit-code
+	fi
+'
+
 test_done
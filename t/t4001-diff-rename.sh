@@ -286,4 +286,97 @@ test_expect_success 'basename similarity vs best similarity' '
 	test_cmp expected actual
 '
 
+test_expect_success 'inexact renames can be scored on several threads' '
+	git init threads &&
+	(
+		sane_unset GIT_TEST_RENAME_THREADS &&
+		cd threads &&
+		mkdir old &&
+		for i in $(test_seq 120)
+		do
+			test_seq $i $((i + 9)) >old/$i || return 1
+		done &&
+		git add old &&
+		git commit -m old &&
+		mkdir new &&
+		for i in $(test_seq 120)
+		do
+			cp old/$i new/file$i &&
+			echo changed >>new/file$i || return 1
+		done &&
+		git rm -rq old &&
+		git add new &&
+		git commit -m new &&
+
+		git -c diff.renameThreads=1 diff-tree -r -M --name-status HEAD^ HEAD >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c diff.renameThreads=2 diff-tree -r -M --name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		grep "\"key\":\"rename/threads\",\"value\":\"2\"" trace &&
+		test_line_count = 120 actual &&
+		! grep -v "^R" actual
+	)
+'
+
+test_expect_success 'sketches find renames beyond the rename limit' '
+	(
+		cd threads &&
+		git diff-tree -r -M -l5 --name-status HEAD^ HEAD >actual &&
+		! grep "^R" actual &&
+		git -c diff.renameSketches=true \
+			diff-tree -r -M -l5 --name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		GIT_TEST_RENAME_THREADS=2 git -c diff.renameSketches=true \
+			diff-tree -r -M -l5 --name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'rename scores can be cached' '
+	git init cache &&
+	(
+		sane_unset GIT_TEST_RENAME_THREADS &&
+		cd cache &&
+		test_seq 1000 >old &&
+		git add old &&
+		git commit -m old &&
+		git mv old new &&
+		echo changed >>new &&
+		git add new &&
+		git commit -m new &&
+
+		git diff-tree -r -M HEAD^ HEAD >expect &&
+		git -c diff.renameCache=memory diff-tree -r -M HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		test_path_is_missing .git/objects/info/rename-cache &&
+		git -c diff.renameCache=true diff-tree -r -M HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		test_path_is_file .git/objects/info/rename-cache &&
+		git -c diff.renameCache=true diff-tree -r -M HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+
+		echo garbage garbage garbage >.git/objects/info/rename-cache &&
+		git -c diff.renameCache=true diff-tree -r -M HEAD^ HEAD \
+			>actual 2>err &&
+		test_cmp expect actual &&
+		test_i18ngrep "ignoring malformed rename cache" err
+	)
+'
+
+test_expect_success 'rename scores are cached when scored on threads' '
+	(
+		cd cache &&
+		rm .git/objects/info/rename-cache &&
+		GIT_TEST_RENAME_THREADS=2 git -c diff.renameCache=true \
+			diff-tree -r -M HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		test_path_is_file .git/objects/info/rename-cache &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TEST_RENAME_THREADS=2 \
+			git -c diff.renameCache=true diff-tree -r -M HEAD^ HEAD \
+			>actual &&
+		test_cmp expect actual &&
+		grep "\"key\":\"rename/prepared\",\"value\":\"0\"" trace
+	)
+'
+
 test_done
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+test_description='bounded diff algorithm'
+
+. ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-diff-alternative.sh
+
+test_diff_frobnitz "diff-algorithm=bounded"
+
+test_diff_unique "diff-algorithm=bounded"
+
+test_expect_success 'large regions without unique lines become one block' '
+	{
+		echo head &&
+		for i in $(test_seq 3000)
+		do
+			echo a && echo b || return 1
+		done &&
+		echo tail
+	} >block1 &&
+	{
+		echo head &&
+		for i in $(test_seq 3000)
+		do
+			echo b && echo a || return 1
+		done &&
+		echo tail
+	} >block2 &&
+	test_expect_code 1 git diff --no-index --numstat \
+		--diff-algorithm=bounded block1 block2 >actual &&
+	printf "6000\t6000\tblock1 => block2\n" >expect &&
+	test_cmp expect actual &&
+	test_expect_code 1 git diff --no-index --numstat \
+		--diff-algorithm=myers block1 block2 >actual &&
+	! test_cmp expect actual
+'
+
+test_expect_success 'the diff driver chooses the algorithm' '
+	git init driver &&
+	(
+		cd driver &&
+		echo "*.gen diff=generated" >.gitattributes &&
+		cp ../block1 file.gen &&
+		git add . &&
+		git commit -m initial &&
+		cp ../block2 file.gen &&
+
+		git diff --numstat >actual &&
+		test_write_lines "6000	6000	file.gen" >expect &&
+		! test_cmp expect actual &&
+
+		git -c diff.generated.algorithm=bounded diff --numstat >actual &&
+		test_cmp expect actual &&
+		git -c diff.generated.algorithm=bounded \
+			-c diff.algorithm=myers diff --stat >actual &&
+		test_i18ngrep "12000 +" actual &&
+
+		git -c diff.generated.algorithm=bounded \
+			diff --diff-algorithm=myers --numstat >actual &&
+		! test_cmp expect actual &&
+		git -c diff.generated.algorithm=bounded \
+			diff --histogram --numstat >actual &&
+		! test_cmp expect actual &&
+
+		test_must_fail git -c diff.generated.algorithm=bogus diff 2>err &&
+		test_i18ngrep "diff.generated.algorithm" err
+	)
+'
+
+test_done
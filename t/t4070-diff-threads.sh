@@ -0,0 +1,65 @@
+#!/bin/sh
+
+test_description='generating patches on several threads'
+
+. ./test-lib.sh
+
+# the tests compare the output with and without threads
+sane_unset GIT_TEST_DIFF_THREADS
+
+test_expect_success setup '
+	mkdir dir &&
+	for i in $(test_seq 40)
+	do
+		test_seq $i 100 >dir/file$i &&
+		printf "binary\0$i" >dir/bin$i || return 1
+	done &&
+	test_seq 100 | sed "s/^/line /" >textconv.txt &&
+	echo "*.txt diff=upcase" >.gitattributes &&
+	ln -s dir/file1 link &&
+	git add . &&
+	git commit -m initial &&
+
+	for i in $(test_seq 40)
+	do
+		test_seq 10 | sed "s/^/$i /" >>dir/file$i &&
+		printf "binary\0$i\0changed" >dir/bin$i || return 1
+	done &&
+	git mv dir/file40 moved &&
+	test_seq 50 | sed "s/^/new /" >>textconv.txt &&
+	rm link &&
+	ln -s dir/file2 link &&
+	git add . &&
+	git commit -m second &&
+
+	git config diff.upcase.textconv "tr a-z A-Z <"
+'
+
+for opts in "-p" "--binary --stat" "-M --full-index" \
+	"--color-moved --color=always" "--word-diff" "-R -U1"
+do
+	test_expect_success "threads do not change the output of $opts" '
+		git -c diff.threads=1 show $opts >expect &&
+		git -c diff.threads=3 show $opts >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'threads are used for the patches' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c diff.threads=3 show >out &&
+	grep "\"key\":\"patch/threads\",\"value\":\"3\"" trace.event &&
+	grep "^+NEW 1\$" out
+'
+
+test_expect_success 'threads keep the exit status' '
+	test_expect_code 1 git -c diff.threads=3 diff --exit-code HEAD^ HEAD &&
+	git -c diff.threads=3 diff --exit-code HEAD HEAD
+'
+
+test_expect_success 'negative number of threads is an error' '
+	test_must_fail git -c diff.threads=-1 show 2>err &&
+	test_i18ngrep "invalid number of threads" err
+'
+
+test_done
@@ -0,0 +1,101 @@
+#!/bin/sh
+
+test_description='git apply finding where hunks apply on threads'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_APPLY_THREADS
+
+test_expect_success setup '
+	for i in $(test_seq 1 100)
+	do
+		test_write_lines 1 2 3 4 5 6 7 8 9 10 11 12 >file$i || return 1
+	done &&
+	git add . &&
+	git commit -m base &&
+
+	for i in $(test_seq 1 100)
+	do
+		test_write_lines 1 2 3 4 5 6 7 changed 9 10 11 12 >file$i || return 1
+	done &&
+	git diff >patch &&
+	git reset --hard &&
+
+	# hunks that apply at an offset, with less context, or not at all
+	test_write_lines 0 0 1 2 3 4 5 6 7 8 9 10 11 12 >file10 &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 other 12 >file20 &&
+	test_write_lines 1 2 3 4 5 6 7 other 9 10 11 12 >file30 &&
+	git commit -a -m moved
+'
+
+check_apply () {
+	for threads in 1 4
+	do
+		git reset --hard &&
+		{
+			git -c apply.threads=$threads apply "$@" patch \
+				>out.$threads 2>err.$threads
+			echo $? >status.$threads
+		} &&
+		git diff --cached >cached.$threads &&
+		git diff >diff.$threads || return 1
+	done &&
+	test_cmp status.1 status.4 &&
+	test_cmp out.1 out.4 &&
+	test_cmp err.1 err.4 &&
+	test_cmp cached.1 cached.4 &&
+	test_cmp diff.1 diff.4
+}
+
+test_expect_success 'applying on threads gives the same result' '
+	check_apply --reject &&
+	grep "Applied patch file29 cleanly" err.4 &&
+	grep "Applying patch file30 with 1 reject" err.4 &&
+	grep "^+changed" diff.4
+'
+
+test_expect_success 'applying on threads reports offsets in order' '
+	check_apply --reject --verbose -C1 &&
+	grep "Hunk #1 succeeded at 7 (offset 2 lines)" err.4 &&
+	grep "Context reduced" err.4
+'
+
+test_expect_success 'applying to the index on threads' '
+	check_apply --index --exclude=file20 --exclude=file30 &&
+	grep "^+changed" cached.4 &&
+	test_must_be_empty diff.4 &&
+
+	check_apply --cached --exclude=file20 --exclude=file30 &&
+	grep "^+changed" cached.4 &&
+	grep "^-changed" diff.4
+'
+
+test_expect_success 'a failing patch fails the same way on threads' '
+	check_apply &&
+	echo 1 >expect &&
+	test_cmp expect status.4 &&
+	test_i18ngrep "patch failed: file30" err.4 &&
+	test_must_be_empty diff.4
+'
+
+test_expect_success 'apply.threads controls the number of threads' '
+	git reset --hard &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c apply.threads=3 apply \
+			--exclude=file20 --exclude=file30 patch &&
+	grep "threads:3" trace.perf &&
+	git reset --hard &&
+
+	rm -f trace.perf &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c apply.threads=1 apply \
+			--exclude=file20 --exclude=file30 patch &&
+	! grep "threads:" trace.perf
+'
+
+test_expect_success 'negative apply.threads is an error' '
+	test_must_fail git -c apply.threads=-1 apply patch 2>err &&
+	test_i18ngrep "invalid number of threads" err
+'
+
+test_done
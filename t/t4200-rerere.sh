@@ -674,4 +674,126 @@ test_expect_success 'test simple stage 1 handling' '
 	)
 '
 
+test_expect_success 'setup packed rerere store' '
+	test_create_repo packed &&
+	(
+		cd packed &&
+		git config rerere.enabled true &&
+		test_seq 1 10 >file &&
+		git add file &&
+		git commit -m base &&
+		git checkout -b one &&
+		test_seq 1 5 >file && echo one >>file && test_seq 7 10 >>file &&
+		git commit -a -m one &&
+		git checkout -b two main &&
+		test_seq 1 5 >file && echo two >>file && test_seq 7 10 >>file &&
+		git commit -a -m two &&
+
+		test_must_fail git merge one &&
+		test_seq 1 5 >file && echo both >>file && test_seq 7 10 >>file &&
+		cp file ../expect.packed &&
+		git rerere &&
+		git reset --hard &&
+		ls .git/rr-cache >../expect.loose
+	)
+'
+
+packed_rr_dirs () {
+	ls .git/rr-cache | sed -e "/^packed/d"
+}
+
+test_expect_success 'gc keeps loose records without rerere.packed' '
+	(
+		cd packed &&
+		git rerere gc &&
+		ls .git/rr-cache >actual &&
+		test_cmp ../expect.loose actual
+	)
+'
+
+test_expect_success 'gc packs records with rerere.packed' '
+	(
+		cd packed &&
+		git -c rerere.packed rerere gc &&
+		test_path_is_file .git/rr-cache/packed &&
+		test_path_is_file .git/rr-cache/packed.idx &&
+		packed_rr_dirs >actual &&
+		test_must_be_empty actual
+	)
+'
+
+test_expect_success 'packed resolutions are replayed' '
+	(
+		cd packed &&
+		test_must_fail git merge one 2>err &&
+		test_i18ngrep "Resolved .file. using previous resolution" err &&
+		test_cmp ../expect.packed file &&
+		dir=$(packed_rr_dirs) &&
+		test_path_is_file .git/rr-cache/$dir/unpacked &&
+		git reset --hard &&
+
+		git -c rerere.packed rerere gc &&
+		packed_rr_dirs >actual &&
+		test_must_be_empty actual &&
+		test_must_fail git merge one &&
+		test_cmp ../expect.packed file &&
+		git reset --hard
+	)
+'
+
+test_expect_success 'conflicts being resolved are not packed' '
+	(
+		cd packed &&
+		git checkout -b three main &&
+		test_seq 1 5 >file && echo three >>file && test_seq 7 10 >>file &&
+		git commit -a -m three &&
+		git checkout two &&
+		test_must_fail git merge three &&
+		git -c rerere.packed rerere gc &&
+		packed_rr_dirs >actual &&
+		test_line_count = 1 actual &&
+		git rerere clear &&
+		git reset --hard
+	)
+'
+
+test_expect_success 'forgotten packed resolutions stay forgotten' '
+	(
+		cd packed &&
+		git -c rerere.packed rerere gc &&
+		test_must_fail git merge one &&
+		git rerere forget file &&
+		git rerere clear &&
+		git reset --hard &&
+		git -c rerere.packed rerere gc &&
+		test_must_fail git merge one &&
+		grep "^<<<<<<<" file &&
+		git reset --hard
+	)
+'
+
+test_expect_success 'gc expires packed records' '
+	(
+		cd packed &&
+		test_must_fail git merge one &&
+		test_seq 1 5 >file && echo both >>file && test_seq 7 10 >>file &&
+		git rerere &&
+		git reset --hard &&
+		git -c rerere.packed rerere gc &&
+		packed_rr_dirs >actual &&
+		test_must_be_empty actual &&
+
+		git -c gc.rerereResolved=5 -c rerere.packed rerere gc &&
+		test_must_fail git merge one &&
+		test_cmp ../expect.packed file &&
+		git reset --hard &&
+		git -c rerere.packed rerere gc &&
+
+		git -c gc.rerereResolved=now -c rerere.packed rerere gc &&
+		test_must_fail git merge one &&
+		grep "^<<<<<<<" file &&
+		git reset --hard
+	)
+'
+
 test_done
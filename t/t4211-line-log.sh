@@ -315,4 +315,44 @@ test_expect_success 'line-log with --before' '
 	test_cmp expect actual
 '
 
+test_expect_success 'line-log maps ranges across changes far into a file' '
+	git checkout --orphan long &&
+	git rm -rf --cached . &&
+	test_seq 3000 >long.txt &&
+	git add long.txt &&
+	test_tick &&
+	git commit -m "add long.txt" &&
+	sed -e "s/^2900$/changed/" long.txt >tmp &&
+	mv tmp long.txt &&
+	test_tick &&
+	git commit -a -m "change line 2900" &&
+	sed -e "s/^2500$/2500\\
+inserted/" long.txt >tmp &&
+	mv tmp long.txt &&
+	test_tick &&
+	git commit -a -m "insert after line 2500" &&
+
+	git log --format=%s --no-patch -L10,20:long.txt >actual &&
+	echo "add long.txt" >expect &&
+	test_cmp expect actual &&
+
+	git log --format=%s --no-patch -L2898,2905:long.txt >actual &&
+	cat >expect <<-\EOF &&
+	change line 2900
+	add long.txt
+	EOF
+	test_cmp expect actual &&
+
+	git log --format=%s --no-patch -L2501,2502:long.txt >actual &&
+	cat >expect <<-\EOF &&
+	insert after line 2500
+	add long.txt
+	EOF
+	test_cmp expect actual &&
+
+	git log --format= -L2901,2901:long.txt >actual &&
+	grep "^@@ -2900,1 +2900,1 @@" actual &&
+	grep "^@@ -0,0 +2900,1 @@" actual
+'
+
 test_done
@@ -68,11 +68,17 @@ setup () {
 	GIT_TRACE2_PERF="$TRASH_DIRECTORY/trace.perf" git -c core.commitGraph=true log --pretty="format:%s" $1 >log_w_bloom
 }
 
+# Print the value of the "bloom" trace2 counter $1, or 0 if it was not used.
+bloom_counter () {
+	sed -n "s/.*| bloom  *| name:$1 value:\([0-9]*\)$/\1/p" \
+		"$TRASH_DIRECTORY/trace.perf" | grep . || echo 0
+}
+
 test_bloom_filters_used () {
 	log_args=$1
-	bloom_trace_prefix="statistics:{\"filter_not_present\":${2:-0},\"maybe\""
 	setup "$log_args" &&
-	grep -q "$bloom_trace_prefix" "$TRASH_DIRECTORY/trace.perf" &&
+	grep -q "| bloom  *| keyvecs:" "$TRASH_DIRECTORY/trace.perf" &&
+	test "$(bloom_counter filter_not_present)" = "${2:-0}" &&
 	test_cmp log_wo_bloom log_w_bloom &&
     test_path_is_file "$TRASH_DIRECTORY/trace.perf"
 }
@@ -80,7 +86,7 @@ test_bloom_filters_used () {
 test_bloom_filters_not_used () {
 	log_args=$1
 	setup "$log_args" &&
-	! grep -q "statistics:{\"filter_not_present\":" "$TRASH_DIRECTORY/trace.perf" &&
+	! grep -q "| bloom  *| " "$TRASH_DIRECTORY/trace.perf" &&
 	test_cmp log_wo_bloom log_w_bloom
 }
 
@@ -120,8 +126,9 @@ test_expect_success 'git log with --walk-reflogs does not use Bloom filters' '
 	test_bloom_filters_not_used "--walk-reflogs -- A"
 '
 
-test_expect_success 'git log -- multiple path specs does not use Bloom filters' '
-	test_bloom_filters_not_used "-- file4 A/file1"
+test_expect_success 'git log -- multiple path specs uses Bloom filters' '
+	test_bloom_filters_used "-- file4 A/file1" &&
+	test_bloom_filters_used "-- A/B/C A/file1 path_does_not_exist"
 '
 
 test_expect_success 'git log -- "." pathspec at root does not use Bloom filters' '
@@ -133,9 +140,26 @@ test_expect_success 'git log with wildcard that resolves to a single path uses B
 	test_bloom_filters_used "-- *renamed"
 '
 
-test_expect_success 'git log with wildcard that resolves to a multiple paths does not uses Bloom filters' '
-	test_bloom_filters_not_used "-- *" &&
-	test_bloom_filters_not_used "-- file*"
+test_expect_success 'git log with wildcard that resolves to a multiple paths uses Bloom filters' '
+	test_bloom_filters_used "-- *" &&
+	test_bloom_filters_used "-- file*"
+'
+
+test_expect_success 'git log with a wildcard pathspec uses its leading directories' '
+	test_bloom_filters_used "-- :(glob)A/**/file3" &&
+	test_bloom_filters_used "-- :(glob)A/B/*" &&
+	test_bloom_filters_used "-- :(glob)A/B/file? file4" &&
+	test_bloom_filters_used "-- A/*2"
+'
+
+test_expect_success 'git log with a wildcard pathspec without a leading directory does not use Bloom filters' '
+	test_bloom_filters_not_used "-- :(glob)**/file3" &&
+	test_bloom_filters_not_used "-- file4 :(glob)*2"
+'
+
+test_expect_success 'git log with excluded or case-insensitive pathspecs does not use Bloom filters' '
+	test_bloom_filters_not_used "-- A :(exclude)A/B" &&
+	test_bloom_filters_not_used "-- :(icase)a/file1"
 '
 
 test_expect_success 'setup - add commit-graph to the chain without Bloom filters' '
@@ -161,9 +185,10 @@ test_expect_success 'setup - add commit-graph to the chain with Bloom filters' '
 
 test_bloom_filters_used_when_some_filters_are_missing () {
 	log_args=$1
-	bloom_trace_prefix="statistics:{\"filter_not_present\":3,\"maybe\":6,\"definitely_not\":9"
 	setup "$log_args" &&
-	grep -q "$bloom_trace_prefix" "$TRASH_DIRECTORY/trace.perf" &&
+	test "$(bloom_counter filter_not_present)" = 3 &&
+	test "$(bloom_counter maybe)" = 6 &&
+	test "$(bloom_counter definitely_not)" = 9 &&
 	test_cmp log_wo_bloom log_w_bloom
 }
 
@@ -405,4 +430,100 @@ test_expect_success 'Bloom generation backfills empty commits' '
 	)
 '
 
+# Deleted directories, mode and type changes, and commits with more
+# changes than the filters hold, generated with fast-import.
+test_expect_success 'Bloom filters do not depend on the number of threads' '
+	git init threads &&
+	test_when_finished "rm -fr threads" &&
+	(
+		cd threads &&
+		perl -e "
+			for my \$i (1..300) {
+				print \"commit refs/heads/main\\n\";
+				print \"committer C <c\@example.com> \$i +0000\\n\";
+				print \"data <<EOF\\n\$i\\nEOF\\n\";
+				my \$d = \"dir\" . (\$i % 7) . \"/sub\" . (\$i % 3);
+				print \"M 100644 inline \$d/file\" . (\$i % 11) . \"\\n\";
+				print \"data <<EOF\\n\$i\\nEOF\\n\";
+				print \"D dir\" . (\$i % 5) . \"\\n\" if \$i % 10 == 0;
+				print \"M 100\" . (\$i % 2 ? 755 : 644) . \" inline exec\\n\" .
+				      \"data <<EOF\\nexec\\nEOF\\n\" if \$i % 13 == 0;
+				if (\$i % 17 == 0) {
+					print \"D flip\\n\";
+					print \"M 100644 inline flip\" .
+					      (\$i % 34 ? \"/inner\" : \"\") . \"\\n\";
+					print \"data <<EOF\\n\$i\\nEOF\\n\";
+				}
+				if (\$i % 50 == 0) {
+					for my \$j (1..40) {
+						print \"M 100644 inline many/\$j\\n\";
+						print \"data <<EOF\\n\$i \$j\\nEOF\\n\";
+					}
+				}
+				print \"\\n\";
+			}
+		" | git fast-import &&
+		git reset --hard main &&
+
+		GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=32 \
+			git -c commitGraph.threads=1 commit-graph write \
+			--reachable --changed-paths &&
+		mv .git/objects/info/commit-graph one-thread &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=32 \
+			git -c commitGraph.threads=4 commit-graph write \
+			--reachable --changed-paths &&
+		grep "\"key\":\"compute_bloom_filters_threads\",\"value\":\"4\"" \
+			trace.event &&
+		test_filter_computed 300 trace.event &&
+		test_filter_trunc_large 6 trace.event &&
+		test_cmp one-thread .git/objects/info/commit-graph &&
+
+		for path in dir1 dir2/sub1 dir3/sub0/file4 exec flip flip/inner many
+		do
+			git -c commitGraph.readChangedPaths=false log \
+				-- $path >expect &&
+			git log -- $path >actual &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
+test_expect_success 'blame uses Bloom filters after renames and with -C' '
+	git init blame &&
+	test_when_finished "rm -fr blame" &&
+	(
+		cd blame &&
+		test_write_lines 1 2 3 4 5 6 7 8 >file &&
+		git add file &&
+		git commit -m initial &&
+		for i in 1 2 3 4 5 6
+		do
+			test_commit other-$i other-$i || return 1
+		done &&
+		git mv file renamed &&
+		git commit -m rename &&
+		for i in 1 2 3 4 5 6
+		do
+			test_commit more-$i other-$i || return 1
+		done &&
+		test_write_lines 1 2 3 four 5 6 7 8 >renamed &&
+		git commit -a -m change &&
+		git commit-graph write --reachable --changed-paths &&
+
+		for args in "" "-C" "-C -C"
+		do
+			git -c core.commitGraph=false blame $args \
+				renamed >expect &&
+			GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+				git blame $args renamed >actual &&
+			test_cmp expect actual &&
+			grep "\"key\":\"bloom/response-no\",\"value\":\"1[0-9]\"" \
+				trace.event &&
+			rm trace.event || return 1
+		done
+	)
+'
+
 test_done
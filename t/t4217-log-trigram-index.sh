@@ -0,0 +1,98 @@
+#!/bin/sh
+
+test_description='git log --grep with the commit trigram index'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+index=.git/objects/info/commit-trigrams
+
+# Expect "git log" with the given arguments to show the same with and
+# without the index.
+test_log_same () {
+	git -c core.commitTrigramIndex=false log --format=%s "$@" >expect &&
+	git log --format=%s "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success setup '
+	test_commit initial &&
+	test_commit --no-tag "fix the frotz handler" &&
+	test_commit --no-tag "teach nitfol about xyzzy" &&
+	(
+		GIT_AUTHOR_NAME="Frotz Author" &&
+		GIT_AUTHOR_EMAIL=frotz@example.com &&
+		test_commit --no-tag "frotz: rework the cache"
+	) &&
+	(
+		GIT_COMMITTER_NAME="Nitfol Committer" &&
+		test_commit --no-tag "second frotz change"
+	) &&
+	test_commit --no-tag "a.b with punctuation" &&
+	git checkout -b side HEAD~3 &&
+	test_commit --no-tag "side branch work on xyzzy" &&
+	git checkout main &&
+	git merge --no-edit side &&
+	git maintenance run --task=commit-trigrams &&
+	test_path_is_file $index
+'
+
+test_expect_success 'the index does not change what is shown' '
+	for args in "--grep=frotz" "-i --grep=FROTZ" "-F --grep=a.b" \
+		"--grep=a.b" "-E --grep=(frotz|nitfol)" "--grep=^second" \
+		"--grep=frotz --grep=xyzzy" "--all-match --grep=frotz --grep=work" \
+		"--invert-grep --grep=frotz" "--author=Frotz" \
+		"--author=Frotz --grep=rework" "--author=frotz@ --author=nobody" \
+		"--committer=Nitfol" "--grep=x --author=nobody" \
+		"--grep=fr --author=Au"
+	do
+		test_log_same $args --all || return 1
+	done
+'
+
+test_expect_success 'commits that cannot match are skipped' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git log --format=%s --grep=nitfol --all >actual &&
+	test_line_count = 1 actual &&
+	grep "\"key\":\"trigrams/skipped\",\"value\":\"[1-9]" trace.event
+'
+
+test_expect_success 'commits not indexed yet are searched' '
+	test_commit --no-tag "not indexed frotz" &&
+	test_log_same --grep=frotz &&
+	git log --format=%s -1 --grep="not indexed" >actual &&
+	echo "not indexed frotz" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'mailmap and notes are searched' '
+	test_when_finished "rm -f .mailmap && git notes remove HEAD~2" &&
+	echo "Mapped Name <frotz@example.com>" >.mailmap &&
+	git log --use-mailmap --format=%s --author=Mapped >actual &&
+	echo "frotz: rework the cache" >expect &&
+	test_cmp expect actual &&
+	git notes add -m "a note about plugh" HEAD~2 &&
+	git log --notes --format=%s --grep=plugh >actual &&
+	git log -1 --format=%s HEAD~2 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commits in other encodings are not indexed' '
+	test_config i18n.commitEncoding ISO8859-1 &&
+	test_commit --no-tag "latin frotz" &&
+	git maintenance run --task=commit-trigrams &&
+	test_log_same --grep=frotz &&
+	test_log_same --encoding=ISO8859-1 --grep=frotz
+'
+
+test_expect_success 'a malformed index is ignored' '
+	git log --format=%s --grep=frotz >expect &&
+	echo garbage garbage garbage >$index &&
+	git log --format=%s --grep=frotz >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "ignoring malformed commit trigram index" err
+'
+
+test_done
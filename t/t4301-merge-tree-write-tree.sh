@@ -0,0 +1,170 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 >numbers &&
+	echo hello >greeting &&
+	echo foo >whatever &&
+	git add numbers greeting whatever &&
+	test_tick &&
+	git commit -m initial &&
+
+	git branch side1 &&
+	git branch side2 &&
+	git branch side3 &&
+
+	git checkout side1 &&
+	test_write_lines 1 2 3 4 5 6 >numbers &&
+	echo hi >greeting &&
+	echo bar >whatever &&
+	git add numbers greeting whatever &&
+	test_tick &&
+	git commit -m modify-stuff &&
+
+	git checkout side2 &&
+	test_write_lines 0 1 2 3 4 5 >numbers &&
+	echo yo >greeting &&
+	git rm whatever &&
+	mkdir whatever &&
+	>whatever/empty &&
+	git add numbers greeting whatever/empty &&
+	test_tick &&
+	git commit -m other-modifications &&
+
+	git checkout side3 &&
+	git mv numbers sequence &&
+	test_tick &&
+	git commit -m rename-numbers
+'
+
+test_expect_success 'clean merge' '
+	TREE_OID=$(git merge-tree --write-tree side1 side3) &&
+	q_to_tab <<-EOF >expect &&
+	100644 blob $(git rev-parse side1:greeting)Qgreeting
+	100644 blob $(git rev-parse side1:numbers)Qsequence
+	100644 blob $(git rev-parse side1:whatever)Qwhatever
+	EOF
+
+	git ls-tree $TREE_OID >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the mode is picked from the number of arguments' '
+	git merge-tree side1 side3 >actual &&
+	echo $TREE_OID >expect &&
+	test_cmp expect actual &&
+
+	git merge-tree $(git merge-base side1 side3) side1 side3 >trivial &&
+	! test_cmp expect trivial
+'
+
+test_expect_success 'content merge and a few conflicts' '
+	git checkout side1^0 &&
+	test_must_fail git merge side2 &&
+	expected_tree=$(git rev-parse AUTO_MERGE) &&
+
+	# We will redo the merge, while we are still in a conflicted state!
+	git ls-files -u >conflicted-file-info &&
+	test_when_finished "git reset --hard" &&
+
+	test_expect_code 1 git merge-tree --write-tree side1 side2 >RESULT &&
+	actual_tree=$(head -n 1 RESULT) &&
+
+	# Due to differences of e.g. "HEAD" vs "side1", the results will not
+	# exactly match.  Dig into individual files.
+
+	# Numbers should have three-way merged cleanly
+	test_write_lines 0 1 2 3 4 5 6 >expect &&
+	git show ${actual_tree}:numbers >actual &&
+	test_cmp expect actual &&
+
+	# whatever and whatever~<branch> should have same HASHES
+	git rev-parse ${expected_tree}:whatever ${expected_tree}:whatever~HEAD >expect &&
+	git rev-parse ${actual_tree}:whatever ${actual_tree}:whatever~side1 >actual &&
+	test_cmp expect actual &&
+
+	# greeting should have a merge conflict
+	git show ${expected_tree}:greeting >tmp &&
+	sed -e s/HEAD/side1/ tmp >expect &&
+	git show ${actual_tree}:greeting >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'conflicted file info and messages' '
+	test_expect_code 1 git merge-tree --write-tree side1 side2 >out &&
+
+	sed -e "s/[0-9a-f]\{40,\}/OBJID/g" out >actual &&
+	q_to_tab <<-\EOF >expect &&
+	OBJID
+	100644 OBJID 1Qgreeting
+	100644 OBJID 2Qgreeting
+	100644 OBJID 3Qgreeting
+	100644 OBJID 1Qwhatever~side1
+	100644 OBJID 2Qwhatever~side1
+
+	Auto-merging greeting
+	CONFLICT (content): Merge conflict in greeting
+	Auto-merging numbers
+	CONFLICT (file/directory): directory in the way of whatever from side1; moving it to whatever~side1 instead.
+	CONFLICT (modify/delete): whatever~side1 deleted in side2 and modified in side1.  Version side1 of whatever~side1 left in tree.
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success '--name-only and --no-messages' '
+	test_expect_code 1 git merge-tree --write-tree --name-only side1 side2 >out &&
+	sed -e "s/[0-9a-f]\{40,\}/OBJID/g" out >actual &&
+	cat <<-\EOF >expect &&
+	OBJID
+	greeting
+	whatever~side1
+
+	Auto-merging greeting
+	CONFLICT (content): Merge conflict in greeting
+	Auto-merging numbers
+	CONFLICT (file/directory): directory in the way of whatever from side1; moving it to whatever~side1 instead.
+	CONFLICT (modify/delete): whatever~side1 deleted in side2 and modified in side1.  Version side1 of whatever~side1 left in tree.
+	EOF
+	test_cmp expect actual &&
+
+	test_expect_code 1 git merge-tree --write-tree --no-messages side1 side2 >out &&
+	sed -e "s/[0-9a-f]\{40,\}/OBJID/g" out >actual &&
+	q_to_tab <<-\EOF >expect &&
+	OBJID
+	100644 OBJID 1Qgreeting
+	100644 OBJID 2Qgreeting
+	100644 OBJID 3Qgreeting
+	100644 OBJID 1Qwhatever~side1
+	100644 OBJID 2Qwhatever~side1
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success '-z terminates the tree and the paths with NUL' '
+	test_expect_code 1 git merge-tree --write-tree --name-only \
+		--no-messages -z \
+		side1 side2 >out &&
+	printf "%s\0greeting\0whatever~side1\0" \
+		$(git merge-tree --write-tree side1 side2 | head -n 1) >expect &&
+	test_cmp expect out
+'
+
+test_expect_success 'works in a bare repository' '
+	git clone --bare . bare.git &&
+	TREE=$(git -C bare.git merge-tree --write-tree side1 side3) &&
+	test "$TREE" = "$TREE_OID"
+'
+
+test_expect_success '--trivial-merge refuses the other options' '
+	test_must_fail git merge-tree --trivial-merge --name-only \
+		side1 side2 side3 2>err &&
+	test_i18ngrep "incompatible" err
+'
+
+test_done
@@ -351,6 +351,16 @@ test_expect_success GZIP 'extract tgz file' '
 	test_cmp_bin b.tar j.tar
 '
 
+test_expect_success GZIP 'tar.parallelGzip does not depend on archive.threads' '
+	git -c tar.parallelGzip=true -c archive.threads=1 \
+		archive --format=tgz HEAD >p1.tgz &&
+	git -c tar.parallelGzip=true -c archive.threads=4 \
+		archive --format=tgz HEAD >p4.tgz &&
+	test_cmp_bin p1.tgz p4.tgz &&
+	gzip -d -c <p4.tgz >p4.tar &&
+	test_cmp_bin b.tar p4.tar
+'
+
 test_expect_success GZIP 'remote tar.gz is allowed by default' '
 	git archive --remote=. --format=tar.gz HEAD >remote.tar.gz &&
 	test_cmp_bin j.tgz remote.tar.gz
@@ -142,4 +142,25 @@ test_expect_success 'export-subst expands %(describe) once' '
 	test_line_count = 1 substituted
 '
 
+test_expect_success 'identical .gitattributes files in different directories' '
+	test_when_finished "git reset --hard HEAD^" &&
+	mkdir -p same1/sub same2 &&
+	for d in same1 same1/sub same2
+	do
+		echo "/dropped export-ignore" >$d/.gitattributes &&
+		echo kept >$d/kept &&
+		echo dropped >$d/dropped || return 1
+	done &&
+	git add same1 same2 &&
+	git commit -m same-attributes &&
+	(cd bare && git fetch -q .. HEAD && git archive FETCH_HEAD) >same.tar &&
+	extract_tar_to_dir same &&
+	test_path_is_file same/same1/kept &&
+	test_path_is_file same/same1/sub/kept &&
+	test_path_is_file same/same2/kept &&
+	test_path_is_missing same/same1/dropped &&
+	test_path_is_missing same/same1/sub/dropped &&
+	test_path_is_missing same/same2/dropped
+'
+
 test_done
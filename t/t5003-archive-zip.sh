@@ -198,6 +198,12 @@ test_expect_success 'git archive --format=zip on large files' '
 
 check_zip large-compressed
 
+test_expect_success 'zip output does not depend on archive.threads' '
+	git -c archive.threads=1 archive --format=zip HEAD >threads-1.zip &&
+	git -c archive.threads=4 archive --format=zip HEAD >threads-4.zip &&
+	test_cmp_bin threads-1.zip threads-4.zip
+'
+
 test_expect_success 'git archive --format=zip --add-file' '
 	echo untracked >untracked &&
 	git archive --format=zip --add-file=untracked HEAD >with_untracked.zip
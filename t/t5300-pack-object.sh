@@ -57,10 +57,12 @@ test_expect_success 'pack-objects with bogus arguments' '
 '
 
 check_unpack () {
+	pack=$1 &&
+	shift &&
 	test_when_finished "rm -rf git2" &&
 	git init --bare git2 &&
-	git -C git2 unpack-objects -n <"$1".pack &&
-	git -C git2 unpack-objects <"$1".pack &&
+	git -C git2 unpack-objects -n "$@" <"$pack".pack &&
+	git -C git2 unpack-objects "$@" <"$pack".pack &&
 	(cd .git && find objects -type f -print) |
 	while read path
 	do
@@ -94,6 +96,60 @@ test_expect_success 'unpack with OFS_DELTA' '
 	check_unpack test-3-${packname_3}
 '
 
+test_expect_success 'unpack with writer threads' '
+	for threads in 1 4
+	do
+		check_unpack test-1-${packname_1} --threads=$threads &&
+		check_unpack test-2-${packname_2} --threads=$threads &&
+		check_unpack test-3-${packname_3} --threads=$threads ||
+		return 1
+	done
+'
+
+test_expect_success 'unpack with core.fsyncMethod=batch' '
+	test_config_global core.fsyncObjectFiles true &&
+	test_config_global core.fsyncMethod batch &&
+	check_unpack test-2-${packname_2} --threads=1 &&
+	check_unpack test-3-${packname_3} --threads=4
+'
+
+test_expect_success 'unpack-objects rejects bogus --threads' '
+	test_must_fail git unpack-objects --threads=nope <test-1-${packname_1}.pack
+'
+
+test_expect_success 'pack with compression threads' '
+	packname_4=$(git pack-objects --threads=4 --no-reuse-object \
+			--delta-base-offset test-4 <obj-list) &&
+	git verify-pack test-4-${packname_4}.idx &&
+	check_unpack test-4-${packname_4}
+'
+
+test_expect_success 'pack with --memory-limit' '
+	packname_8=$(git pack-objects --memory-limit=1m --no-reuse-delta \
+			test-8 <obj-list) &&
+	git verify-pack test-8-${packname_8}.idx &&
+	check_unpack test-8-${packname_8} &&
+	packname_9=$(git -c pack.memoryLimit=1m pack-objects \
+			--no-reuse-delta test-9 <obj-list) &&
+	test "$packname_8" = "$packname_9"
+'
+
+test_expect_success SANITY '--memory-limit works without a writable pack directory' '
+	test_when_finished "chmod u+w .git/objects/pack" &&
+	chmod a-w .git/objects/pack &&
+	git pack-objects --memory-limit=1m --stdout <obj-list >ro.pack &&
+	git index-pack -o ro.idx ro.pack &&
+	git verify-pack ro.idx
+'
+
+test_expect_success PTHREADS 'threaded delta search reports per-thread statistics' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.delta" \
+		git pack-objects --threads=2 --no-reuse-delta test-5 <obj-list &&
+	grep "\"delta_search\"" trace.delta >stats &&
+	grep "\"steals\"" stats &&
+	grep "\"idle_ns\"" stats
+'
+
 test_expect_success 'compare delta flavors' '
 	perl -e '\''
 		defined($_ = -s $_) or die for @ARGV;
@@ -57,4 +57,24 @@ test_expect_success \
      git config --unset core.packedGitLimit &&
      git verify-pack -v "$pack2"'
 
+test_expect_success 'window statistics are reported via trace2' '
+	git cat-file --batch-all-objects --batch >/dev/null &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c core.packedGitWindowSize=512 -c core.packedGitLimit=512 \
+		cat-file --batch-all-objects --batch >/dev/null &&
+	grep "\"key\":\"window_statistics\"" trace.event >stats &&
+	grep "\"misses\":[1-9]" stats &&
+	grep "\"evictions\":[1-9]" stats
+'
+
+test_expect_success 'repack and batch reads with core.packReadahead' '
+	git cat-file --batch-all-objects --batch-check="%(objectname)" >oids &&
+	git cat-file --batch <oids >expect &&
+	git -c core.packReadahead=16k repack -a -d -f &&
+	git verify-pack "$(ls .git/objects/pack/*.pack)" &&
+	git -c core.packReadahead=16k cat-file --batch --batch-size=3 \
+		<oids >actual &&
+	test_cmp expect actual
+'
+
 test_done
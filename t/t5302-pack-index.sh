@@ -66,6 +66,15 @@ test_expect_success 'index-pack results should match pack-objects ones' '
 	cmp "test-2-${pack2}.idx" "2.idx"
 '
 
+test_expect_success 'index-pack hashing objects in worker threads' '
+	GIT_FORCE_THREADS=1 git index-pack --threads=3 --index-version=2 \
+		-o threaded.idx "test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" threaded.idx &&
+	GIT_FORCE_THREADS=1 git index-pack --threads=3 --strict \
+		--index-version=2 --stdin threaded.pack <"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" threaded.idx
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
@@ -284,4 +293,32 @@ test_expect_success 'index-pack -v --stdin produces progress for both phases' '
 	test_i18ngrep "Resolving deltas" err
 '
 
+test_expect_success 'index-pack --fix-thin completes the same with threads' '
+	git init thin &&
+	(
+		cd thin &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			test-tool genrandom "thin $i" 4096 >file$i || return 1
+		done &&
+		git add . &&
+		git commit -q -m one &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo changed >>file$i || return 1
+		done &&
+		git commit -q -a -m two &&
+		printf "%s\n^%s\n" $(git rev-parse HEAD HEAD^) |
+		git pack-objects --thin --revs --stdout >../thin.pack &&
+		git index-pack --threads=1 --fix-thin --stdin \
+			../thin-1.pack <../thin.pack &&
+		GIT_FORCE_THREADS=1 git index-pack --threads=4 --fix-thin \
+			--stdin ../thin-4.pack <../thin.pack
+	) &&
+	test_cmp_bin thin-1.pack thin-4.pack &&
+	test_cmp_bin thin-1.idx thin-4.idx &&
+	git verify-pack -v thin-4.pack >out &&
+	grep "^chain length = 1: 10 objects" out
+'
+
 test_done
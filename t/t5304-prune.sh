@@ -368,4 +368,18 @@ test_expect_success 'old reachable-from-recent retained with bitmaps' '
 	test_must_fail git cat-file -e $to_drop
 '
 
+test_expect_success 'loose objects reachable beyond bitmaps are kept' '
+	git repack -adb &&
+	blob=$(echo bitmap-loose-reachable | git hash-object -w --stdin) &&
+	tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
+	commit=$(echo bar | git commit-tree -p HEAD $tree) &&
+	git update-ref refs/heads/beyond-bitmaps $commit &&
+	unreachable=$(echo bitmap-loose-unreachable | git hash-object -w --stdin) &&
+	git prune --expire=now &&
+	git cat-file -e $commit &&
+	git cat-file -e $tree &&
+	git cat-file -e $blob &&
+	test_must_fail git cat-file -e $unreachable
+'
+
 test_done
@@ -615,4 +615,118 @@ test_expect_success 'pack.preferBitmapTips' '
 	)
 '
 
+test_expect_success 'pack.writeBitmapLookupTable' '
+	git init lookup &&
+	test_when_finished "rm -fr lookup" &&
+	(
+		cd lookup &&
+
+		test_commit_bulk --message="%s" 103 &&
+		git log --format="create refs/tags/%s %H" HEAD >refs &&
+		git update-ref --stdin <refs &&
+
+		git repack -adb &&
+		test-tool bitmap list-commits | sort >expect &&
+		test_file_size .git/objects/pack/*.bitmap >size.before &&
+		git rev-list --count --objects --use-bitmap-index \
+			HEAD~20..HEAD >count.expect &&
+
+		git -c pack.writeBitmapLookupTable=true repack -adb &&
+		test-tool bitmap list-commits | sort >actual &&
+		test_cmp expect actual &&
+		test_file_size .git/objects/pack/*.bitmap >size.after &&
+		echo $(($(cat size.before) + 16 * $(wc -l <expect))) >size.expect &&
+		test_cmp size.expect size.after &&
+
+		git rev-list --count --objects --use-bitmap-index \
+			HEAD~20..HEAD >count.actual &&
+		test_cmp count.expect count.actual &&
+		git rev-list --test-bitmap HEAD &&
+		git rev-list --test-bitmap HEAD~50
+	)
+'
+
+test_expect_success 'repack keeps and reuses existing bitmaps' '
+	git init reuse &&
+	test_when_finished "rm -fr reuse" &&
+	(
+		cd reuse &&
+
+		test_commit_bulk --message="%s" 400 &&
+		git repack -adb &&
+		test-tool bitmap list-commits | sort >before &&
+
+		test_commit_bulk --message="new %s" 50 &&
+		GIT_TRACE2_EVENT_NESTING=4 GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git repack -adb &&
+		test-tool bitmap list-commits | sort >after &&
+
+		# commits picked again take their old bitmap as-is
+		comm -12 before after >kept &&
+		test_file_not_empty kept &&
+		kept=$(wc -l <kept) &&
+		grep "\"key\":\"num_reused_bitmaps\",\"value\":\"$((kept))\"" trace &&
+		git rev-list --test-bitmap HEAD
+	)
+'
+
+test_expect_success 'bitmaps do not depend on the number of threads' '
+	git init threads &&
+	test_when_finished "rm -fr threads" &&
+	(
+		cd threads &&
+
+		test_commit_bulk --message="%s" 150 &&
+		git -c pack.threads=1 repack -adb &&
+		cp .git/objects/pack/*.bitmap expect &&
+
+		GIT_TRACE2_EVENT_NESTING=4 GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c pack.threads=4 repack -adb &&
+		cp .git/objects/pack/*.bitmap actual &&
+		test_cmp_bin expect actual &&
+		grep "\"key\":\"xor_offsets_threads\",\"value\":\"3\"" trace
+	)
+'
+
+test_expect_success 'upload-pack tells when to give up from bitmaps' '
+	git init negotiate &&
+	test_when_finished "rm -fr negotiate client-*" &&
+	test_commit_bulk -C negotiate --message="%s" 200 &&
+	git -C negotiate repack -adb &&
+	git clone --no-local negotiate client-true &&
+	test_commit -C client-true local &&
+	cp -R client-true client-false &&
+	test_commit_bulk -C negotiate --message="new %s" 20 &&
+
+	for bitmaps in true false
+	do
+		GIT_TRACE_PACKET="$(pwd)/trace-$bitmaps" git -C client-$bitmaps \
+			-c protocol.version=2 fetch \
+			--upload-pack="git -c uploadpack.negotiateWithBitmaps=$bitmaps upload-pack" \
+			origin &&
+		grep -e "fetch> have" -e "fetch< ready" -e "fetch< ACK" \
+			trace-$bitmaps | sed "s/.*packet: *//" >negotiation-$bitmaps &&
+		git -C client-$bitmaps rev-parse origin/HEAD >actual-$bitmaps ||
+		return 1
+	done &&
+	grep ready negotiation-true &&
+	test_cmp negotiation-false negotiation-true &&
+	git -C negotiate rev-parse HEAD >expect &&
+	test_cmp expect actual-true
+'
+
+test_expect_success 'connectivity check stops at bitmapped objects' '
+	git init connected &&
+	test_when_finished "rm -fr connected connected-client trace" &&
+	test_commit_bulk -C connected 100 &&
+	git clone --no-local connected connected-client &&
+	git -C connected-client repack -adb &&
+	test_commit -C connected more &&
+
+	# Only the new commit, its tree and more.t are looked at.
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C connected-client fetch origin &&
+	grep "\"key\":\"bitmap-walked\",\"value\":\"3\"" trace &&
+	git -C connected-client fsck
+'
+
 test_done
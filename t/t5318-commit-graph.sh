@@ -357,6 +357,65 @@ test_expect_success 'check that gc computes commit-graph' '
 	test_cmp_bin commit-graph-after-gc $objdir/info/commit-graph
 '
 
+test_expect_success 'write and keep a reachability index' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write --reachable --reachability-index &&
+	graph_read_expect "11" "generation_data extra_edges reachability_index" &&
+	git commit-graph verify &&
+	git merge-base --is-ancestor commits/2 merge/1 &&
+	test_must_fail git merge-base --is-ancestor merge/1 commits/2 &&
+	test_must_fail git merge-base --is-ancestor commits/3 merge/1 &&
+	git commit-graph write --reachable &&
+	graph_read_expect "11" "generation_data extra_edges reachability_index" &&
+	git commit-graph write --reachable --no-reachability-index &&
+	graph_read_expect "11" "generation_data extra_edges"
+'
+
+test_expect_success 'log --format=%ct does not read commits in the graph' '
+	test_when_finished "rm -rf ct" &&
+	git init ct &&
+	(
+		cd ct &&
+		test_commit one &&
+		test_commit two &&
+		git repack -ad &&
+		git commit-graph write --reachable &&
+		git -c core.commitGraph=false log --graph \
+			--format="%H %P %ct" >expect &&
+		GIT_TRACE_PACK_ACCESS="$(pwd)/access" \
+			git log --graph --format="%H %P %ct" >actual &&
+		test_cmp expect actual &&
+		test_path_is_missing access &&
+		GIT_TRACE_PACK_ACCESS="$(pwd)/access" \
+			git log --format="%ct %cd" >actual &&
+		test_path_is_file access
+	)
+'
+
+test_expect_success 'log takes committer dates without time zone from the graph' '
+	test_when_finished "rm -rf cr" &&
+	git init cr &&
+	(
+		cd cr &&
+		test_commit one &&
+		test_commit two &&
+		git repack -ad &&
+		git commit-graph write --reachable &&
+		for date in relative unix iso-local "format-local:%Y-%m-%d %H:%M"
+		do
+			git -c core.commitGraph=false log --date="$date" \
+				--format="%h %cr %cd" >expect &&
+			GIT_TRACE_PACK_ACCESS="$(pwd)/access" \
+				git log --date="$date" --format="%h %cr %cd" >actual &&
+			test_cmp expect actual &&
+			test_path_is_missing access || return 1
+		done &&
+		GIT_TRACE_PACK_ACCESS="$(pwd)/access" \
+			git log --format="%cd" --date=iso >actual &&
+		test_path_is_file access
+	)
+'
+
 test_expect_success 'replace-objects invalidates commit-graph' '
 	cd "$TRASH_DIRECTORY" &&
 	test_when_finished rm -rf replace &&
@@ -603,6 +662,19 @@ test_expect_success 'detect missing commit data chunk' '
 		"missing the Commit Data chunk"
 '
 
+test_expect_success 'detect OID fanout chunk of the wrong size' '
+	corrupt_graph_and_verify $(($GRAPH_BYTE_OID_LOOKUP_ID + 11)) "\0" \
+		"OID fanout chunk is the wrong size"
+'
+
+test_expect_success 'chunk sizes are reported to trace2' '
+	cd "$TRASH_DIRECTORY/full" &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git log -1 --oneline &&
+	grep "\"category\":\"commit-graph\",\"key\":\"load/chunk/OIDF\",\"value\":\"1024\"" trace.event &&
+	grep "\"key\":\"load/chunk/CDAT\"" trace.event &&
+	rm trace.event
+'
+
 test_expect_success 'detect incorrect fanout' '
 	corrupt_graph_and_verify $GRAPH_BYTE_FANOUT1 "\01" \
 		"fanout value"
@@ -658,6 +730,12 @@ test_expect_success 'detect incorrect commit date' '
 		"commit date"
 '
 
+test_expect_success 'detect incorrect commit date with threads' '
+	test_config -C "$TRASH_DIRECTORY/full" pack.threads 4 &&
+	corrupt_graph_and_verify $GRAPH_BYTE_COMMIT_DATE "\01" \
+		"commit date"
+'
+
 test_expect_success 'detect incorrect parent for octopus merge' '
 	corrupt_graph_and_verify $GRAPH_BYTE_OCTOPUS "\01" \
 		"invalid parent"
@@ -763,6 +841,21 @@ test_expect_success 'corrupt commit-graph write (missing tree)' '
 	)
 '
 
+test_expect_success 'commits read on threads give the same graph' '
+	rm -rf repo &&
+	git init repo &&
+	(
+		cd repo &&
+		test_commit_bulk 1500 &&
+		git repack -d &&
+		git -c commitGraph.threads=1 commit-graph write &&
+		mv .git/objects/info/commit-graph expect &&
+		git -c commitGraph.threads=4 commit-graph write &&
+		test_cmp_bin expect .git/objects/info/commit-graph &&
+		git commit-graph verify
+	)
+'
+
 # We test the overflow-related code with the following repo history:
 #
 #               4:F - 5:N - 6:U
@@ -404,6 +404,13 @@ test_expect_success 'verify incorrect offset' '
 		"incorrect object offset"
 '
 
+test_expect_success 'verify incorrect offset with threads' '
+	git -c pack.threads=4 multi-pack-index verify --object-dir=$objdir &&
+	corrupt_midx_and_verify $MIDX_BYTE_OFFSET "\377" $objdir \
+		"incorrect object offset" \
+		"git -c pack.threads=4 multi-pack-index verify --object-dir=$objdir"
+'
+
 test_expect_success 'git-fsck incorrect offset' '
 	corrupt_midx_and_verify $MIDX_BYTE_OFFSET "\377" $objdir \
 		"incorrect object offset" \
@@ -824,4 +831,164 @@ test_expect_success 'load reverse index when missing .idx, .pack' '
 	)
 '
 
+test_expect_success 'existence checks do not open midx packs' '
+	git init repo &&
+	test_when_finished "rm -fr repo" &&
+	(
+		cd repo &&
+
+		git config core.multiPackIndex true &&
+
+		test_commit one &&
+		git repack -d &&
+		test_commit two &&
+		git repack -d &&
+		git multi-pack-index write &&
+
+		blob=$(git rev-parse one:one.t) &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git cat-file -e $blob &&
+		! grep open_packed_git trace &&
+		test_must_fail git cat-file -e $(test_oid deadbeef) &&
+
+		rm -f trace &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git cat-file -p $blob &&
+		grep open_packed_git trace &&
+
+		# a pack that is gone does not count
+		rm -f .git/objects/pack/pack-*.pack &&
+		test_must_fail git cat-file -e $blob
+	)
+'
+
+test_expect_success 'midx does not depend on the number of threads' '
+	git init threads &&
+	test_when_finished "rm -fr threads" &&
+	(
+		cd threads &&
+		objdir=.git/objects &&
+
+		perl -e "
+			print \"blob\\ndata <<EOF\\nblob \$_\\nEOF\\n\" for 1..10000
+		" | git fast-import &&
+		idx=$(ls $objdir/pack/pack-*.idx) &&
+		git show-index <$idx | cut -d" " -f2 >all &&
+		head -n 6000 all >first &&
+		tail -n 6000 all >second &&
+		git pack-objects $objdir/pack/pack <first &&
+		git pack-objects $objdir/pack/pack <second &&
+		rm -f $idx ${idx%.idx}.pack &&
+
+		git -c pack.threads=1 multi-pack-index write &&
+		cp $objdir/pack/multi-pack-index one-thread &&
+		rm -f $objdir/pack/multi-pack-index &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c pack.threads=3 multi-pack-index write &&
+		grep "\"key\":\"sorted_entries_threads\",\"value\":\"2\"" trace &&
+		test_cmp one-thread $objdir/pack/multi-pack-index &&
+		test-tool read-midx $objdir | grep "^num_objects: 10000" &&
+		git multi-pack-index verify
+	)
+'
+
+midx_chain=.git/objects/pack/multi-pack-index.d/multi-pack-index-chain
+
+# Sum the objects in all of the layers that are loaded.
+midx_objects () {
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git cat-file -e HEAD &&
+	sed -n "s/.*\"load\/num_objects\",\"value\":\"\([0-9]*\)\".*/\1/p" \
+		trace >counts &&
+	perl -lne "\$n += \$_; END { print \$n }" counts
+}
+
+test_expect_success 'incremental write adds layers and merges them' '
+	git init chain &&
+	(
+		cd chain &&
+		git config core.multiPackIndex true &&
+
+		for i in $(test_seq 1 30)
+		do
+			echo $i >base-$i || return 1
+		done &&
+		git add . &&
+		git commit -m base &&
+		git repack -d &&
+		git multi-pack-index write --incremental &&
+		test_path_is_missing .git/objects/pack/multi-pack-index &&
+		test_line_count = 1 $midx_chain &&
+
+		# Each new pack holds 3 objects against the 32 of the base;
+		# a layer is merged into the new one as long as it is no
+		# more than twice as large.
+		n=0 &&
+		for expect in 2 2 2 3
+		do
+			n=$(($n + 1)) &&
+			test_commit step-$n &&
+			git repack -d &&
+			git multi-pack-index write --incremental &&
+			test_line_count = $expect $midx_chain || return 1
+		done &&
+		ls .git/objects/pack/multi-pack-index.d/*.midx >layers &&
+		test_line_count = 3 layers &&
+
+		git multi-pack-index verify &&
+		git rev-list --objects --all >objects &&
+		test_line_count = $(midx_objects) objects &&
+		git fsck
+	)
+'
+
+test_expect_success 'incremental write with nothing new keeps the chain' '
+	(
+		cd chain &&
+		cp $midx_chain chain.before &&
+		git multi-pack-index write --incremental &&
+		test_cmp chain.before $midx_chain
+	)
+'
+
+test_expect_success 'plain write collapses the chain' '
+	(
+		cd chain &&
+		git rev-list --objects --all >objects &&
+		git multi-pack-index write &&
+		test_path_is_file .git/objects/pack/multi-pack-index &&
+		test_path_is_missing .git/objects/pack/multi-pack-index.d &&
+		test_line_count = $(midx_objects) objects &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'a flat multi-pack-index becomes the base layer' '
+	(
+		cd chain &&
+		test_commit flat-to-chain &&
+		git repack -d &&
+		git multi-pack-index write --incremental &&
+		test_path_is_missing .git/objects/pack/multi-pack-index &&
+		test_line_count = 2 $midx_chain &&
+		git rev-list --objects --all >objects &&
+		test_line_count = $(midx_objects) objects &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'expire collapses the chain' '
+	(
+		cd chain &&
+		git multi-pack-index expire &&
+		test_path_is_file .git/objects/pack/multi-pack-index &&
+		test_path_is_missing .git/objects/pack/multi-pack-index.d &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--incremental cannot write a bitmap' '
+	test_must_fail git -C chain multi-pack-index write \
+		--incremental --bitmap 2>err &&
+	test_i18ngrep "mutually exclusive" err
+'
+
 test_done
@@ -140,4 +140,28 @@ test_expect_success 'unmatched island core is not fatal' '
 	git -c "pack.islandcore=one" repack -adfi
 '
 
+test_expect_success 'island marks are computed from bitmaps' '
+	git repack -adfb &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c "pack.island=refs/heads/(.*)" repack -adfi &&
+	grep bitmap_marked_objects trace &&
+	is_delta_base $one $root &&
+	is_delta_base $two $root
+'
+
+test_expect_success 'bitmap island marks walk from tips outside the bitmap' '
+	git repack -adfb &&
+	commit three shared 123-longer two &&
+	git -c "pack.island=refs/heads/(.*)" repack -adfi &&
+	git verify-pack -v .git/objects/pack/*.pack >expect.raw &&
+	git -c "pack.island=refs/heads/(.*)" -c pack.useBitmaps=false \
+		repack -adfi &&
+	git verify-pack -v .git/objects/pack/*.pack >actual.raw &&
+	grep "^$OID_REGEX " expect.raw | cut -d" " -f1,7 | sort >expect &&
+	grep "^$OID_REGEX " actual.raw | cut -d" " -f1,7 | sort >actual &&
+	test_cmp expect actual &&
+	is_delta_base $one $root &&
+	! is_delta_base $root $three
+'
+
 test_done
@@ -634,4 +634,109 @@ test_expect_success 'write generation data chunk when commit-graph chain is repl
 	)
 '
 
+test_expect_success 'reachability index in a split commit-graph chain' '
+	git init reach-chain &&
+	(
+		cd reach-chain &&
+		test_commit base &&
+		git checkout -b side &&
+		test_commit side &&
+		git checkout - &&
+		test_commit main &&
+		git commit-graph write --reachable --reachability-index &&
+		git merge side &&
+		test_commit top &&
+		git commit-graph write --reachable --split=no-merge &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test-tool read-graph >output &&
+		grep reachability_index output &&
+		git commit-graph verify &&
+		git merge-base --is-ancestor side top &&
+		git merge-base --is-ancestor base main &&
+		test_must_fail git merge-base --is-ancestor side main &&
+		test_must_fail git merge-base --is-ancestor top side &&
+		git tag --contains side >actual &&
+		git -c core.commitGraph=false tag --contains side >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'setup repo for --split=upgrade' '
+	git init upgrade &&
+	(
+		cd upgrade &&
+		git config commitGraph.generationVersion 1 &&
+		for i in 1 2 3 4 5 6
+		do
+			test_commit $i || return 1
+		done &&
+		git commit-graph write --reachable --split=no-merge &&
+		for i in 7 8 9
+		do
+			test_commit $i || return 1
+		done &&
+		git commit-graph write --reachable --split=no-merge &&
+		test_line_count = 2 $graphdir/commit-graph-chain
+	)
+'
+
+test_expect_success '--split=upgrade without anything to upgrade writes nothing' '
+	(
+		cd upgrade &&
+		cp $graphdir/commit-graph-chain chain.before &&
+		git commit-graph write --reachable --split=upgrade &&
+		test_cmp chain.before $graphdir/commit-graph-chain
+	)
+'
+
+test_expect_success '--split=upgrade adds generation data to all layers' '
+	cp -R upgrade upgrade-gdat &&
+	(
+		cd upgrade-gdat &&
+		git config commitGraph.generationVersion 2 &&
+		git commit-graph write --reachable --split=upgrade &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		test-tool read-graph >output &&
+		grep "chunks:.* generation_data" output &&
+		git commit-graph verify
+	)
+'
+
+test_expect_success '--split=upgrade computes missing filters within the budget' '
+	(
+		cd upgrade &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.1" git commit-graph write \
+			--reachable --split=upgrade --changed-paths --max-new-filters=4 &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		grep "\"key\":\"filter-computed\",\"value\":\"4\"" trace.1 &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.2" git commit-graph write \
+			--reachable --split=upgrade --max-new-filters=4 &&
+		grep "\"key\":\"filter-computed\",\"value\":\"4\"" trace.2 &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.3" git commit-graph write \
+			--reachable --split=upgrade --max-new-filters=4 &&
+		grep "\"key\":\"filter-computed\",\"value\":\"1\"" trace.3 &&
+		cp $graphdir/commit-graph-chain chain.before &&
+		git commit-graph write --reachable --split=upgrade &&
+		test_cmp chain.before $graphdir/commit-graph-chain &&
+		git -c core.commitGraph=false log --oneline -- 3.t >expect &&
+		git log --oneline -- 3.t >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--split=upgrade keeps complete lower layers' '
+	(
+		cd upgrade &&
+		base=$(head -n 1 $graphdir/commit-graph-chain) &&
+		test_commit 10 &&
+		git commit-graph write --reachable --split=no-merge \
+			--no-changed-paths &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		git commit-graph write --reachable --split=upgrade --changed-paths &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test "$base" = "$(head -n 1 $graphdir/commit-graph-chain)" &&
+		git commit-graph verify
+	)
+'
+
 test_done
@@ -0,0 +1,103 @@
+#!/bin/sh
+
+test_description='pack-objects records and reuses delta candidates'
+. ./test-lib.sh
+
+max_chain() {
+	git index-pack --verify-stat-only "$1" >output &&
+	perl -lne '
+	  BEGIN { $len = 0 }
+	  /chain length = (\d+)/ and $len = $1;
+	  END { print $len }
+	' output
+}
+
+# list "object base" for every delta in the pack
+delta_bases() {
+	git verify-pack -v "$1" >output &&
+	awk "NF == 7 { print \$1, \$7 }" output | sort
+}
+
+# Each version replaces one more chunk of the file, so that the best
+# base for every version is the next one and the deltas form a chain.
+test_expect_success 'setup' '
+	for i in $(test_seq 1 10)
+	do
+		test-tool genrandom old$i 1024 >old$i &&
+		test-tool genrandom new$i 1024 >new$i || return 1
+	done &&
+	for i in $(test_seq 1 10)
+	do
+		for j in $(test_seq 1 10)
+		do
+			if test $j -le $i
+			then
+				cat new$j
+			else
+				cat old$j
+			fi || return 1
+		done >file &&
+		git add file &&
+		git commit -q -m $i || return 1
+	done
+'
+
+test_expect_success 'no candidate file by default' '
+	git repack -adf &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 1 packs &&
+	! ls .git/objects/pack/*.dcand
+'
+
+test_expect_success 'pack.deltaCandidates writes a candidate file' '
+	git -c pack.deltaCandidates=true repack -adf &&
+	ls .git/objects/pack/*.dcand >dcand &&
+	test_line_count = 1 dcand &&
+	pack=$(ls .git/objects/pack/*.pack) &&
+	test "$(cat dcand)" = "${pack%.pack}.dcand"
+'
+
+test_expect_success 'repack with candidates finds the same deltas' '
+	pack=$(ls .git/objects/pack/*.pack) &&
+	delta_bases "$pack" >expect &&
+	test_file_not_empty expect &&
+	git -c pack.deltaCandidates=true repack -adf &&
+	pack=$(ls .git/objects/pack/*.pack) &&
+	delta_bases "$pack" >actual &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'recorded bases respect --depth' '
+	git -c pack.deltaCandidates=true repack -adf --depth=50 &&
+	pack=$(ls .git/objects/pack/*.pack) &&
+	test "$(max_chain "$pack")" -ge 2 &&
+	git -c pack.deltaCandidates=true repack -adf --depth=1 &&
+	pack=$(ls .git/objects/pack/*.pack) &&
+	echo 1 >expect &&
+	max_chain "$pack" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'corrupt candidate file is ignored' '
+	dcand=$(ls .git/objects/pack/*.dcand) &&
+	chmod +w "$dcand" &&
+	echo garbage >"$dcand" &&
+	git -c pack.deltaCandidates=true repack -adf 2>err &&
+	test_i18ngrep "delta candidate file" err &&
+	git fsck
+'
+
+test_expect_success 'candidate file goes away with its pack' '
+	echo new >>file &&
+	git commit -q -a -m new &&
+	old=$(ls .git/objects/pack/*.dcand) &&
+	git -c pack.deltaCandidates=true repack -ad &&
+	test_path_is_missing "$old" &&
+	ls .git/objects/pack/*.dcand >dcand &&
+	test_line_count = 1 dcand &&
+	git count-objects -v >count &&
+	grep "^garbage: 0" count
+'
+
+test_done
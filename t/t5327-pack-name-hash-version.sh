@@ -0,0 +1,87 @@
+#!/bin/sh
+
+test_description='pack-objects --name-hash-version'
+. ./test-lib.sh
+
+# Several unrelated files that share a long enough path tail to collide
+# with the default name hash, each with a few versions.
+test_expect_success 'setup' '
+	for i in $(test_seq 1 20)
+	do
+		mkdir -p package-$i/src/components &&
+		test-tool genrandom base-$i 2048 \
+			>package-$i/src/components/index.js || return 1
+	done &&
+	git add . &&
+	git commit -q -m 0 &&
+	for v in 1 2 3
+	do
+		for i in $(test_seq 1 20)
+		do
+			test-tool genrandom v$v-$i 20 \
+				>>package-$i/src/components/index.js || return 1
+		done &&
+		git commit -q -a -m $v || return 1
+	done
+'
+
+test_expect_success 'invalid --name-hash-version is rejected' '
+	test_must_fail git pack-objects --name-hash-version=3 bad </dev/null 2>err &&
+	test_i18ngrep "invalid --name-hash-version" err
+'
+
+list_deltas() {
+	git verify-pack -v "$1" >output &&
+	awk "NF == 7 && \$2 == \"blob\"" output
+}
+
+test_expect_success 'version 2 keeps each path together' '
+	pack=$(git pack-objects --all --no-reuse-delta --window=2 \
+		--name-hash-version=2 v2 </dev/null) &&
+	git verify-pack v2-$pack.pack &&
+	list_deltas v2-$pack.pack >deltas &&
+	test_line_count = 60 deltas
+'
+
+test_expect_success 'pack.nameHashVersion sets the default' '
+	v1=$(git pack-objects --all --no-reuse-delta --window=2 \
+		--name-hash-version=1 v1 </dev/null) &&
+	v2=$(git pack-objects --all --no-reuse-delta --window=2 \
+		--name-hash-version=2 v2 </dev/null) &&
+	test "$v1" != "$v2" &&
+	pack=$(git -c pack.nameHashVersion=2 pack-objects --all \
+		--no-reuse-delta --window=2 v2-config </dev/null) &&
+	test "$pack" = "$v2" &&
+	pack=$(git -c pack.nameHashVersion=2 pack-objects --all \
+		--no-reuse-delta --window=2 --name-hash-version=1 \
+		v1-override </dev/null) &&
+	test "$pack" = "$v1"
+'
+
+test_expect_success 'version 2 writes its own bitmap name-hash cache' '
+	git -c pack.writeBitmapHashCache=false repack -adb &&
+	test-tool bitmap dump-hashes >hashes &&
+	test_must_be_empty hashes &&
+	git repack -adb &&
+	test-tool bitmap dump-hashes >v1 &&
+	test_file_not_empty v1 &&
+	git -c pack.nameHashVersion=2 repack -adb &&
+	test-tool bitmap dump-hashes >v2 &&
+	test_line_count = $(wc -l <v1) v2 &&
+	! test_cmp v1 v2 &&
+	git rev-list --count --all --objects --use-bitmap-index >count &&
+	git rev-list --count --all --objects >expect &&
+	test_cmp expect count
+'
+
+test_expect_success 'bitmapped pack-objects uses the version 2 cache' '
+	git -c pack.nameHashVersion=2 repack -adb &&
+	git -c pack.allowPackReuse=false pack-objects --all --stdout \
+		--no-reuse-delta --window=2 --use-bitmap-index \
+		</dev/null >bitmapped.pack &&
+	git index-pack bitmapped.pack &&
+	list_deltas bitmapped.pack >deltas &&
+	test_line_count = 60 deltas
+'
+
+test_done
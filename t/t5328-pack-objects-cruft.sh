@@ -0,0 +1,103 @@
+#!/bin/sh
+
+test_description='cruft packs of unreachable objects'
+. ./test-lib.sh
+
+cruft_pack() {
+	ls .git/objects/pack/pack-*.mtimes >mtimes &&
+	test_line_count = 1 mtimes &&
+	echo "$(sed "s/\.mtimes$/.pack/" mtimes)"
+}
+
+packed_objects() {
+	git show-index <"${1%.pack}.idx" >index &&
+	cut -d" " -f2 index | sort
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	git repack -ad &&
+
+	git checkout -b topic &&
+	test_commit --no-tag side &&
+	git rev-list --objects base..topic >side.objects &&
+	cut -d" " -f1 side.objects | sort >expect.side &&
+	git checkout - &&
+	git branch -D topic &&
+	git reflog expire --all --expire=all &&
+
+	echo loose >loose &&
+	git hash-object -w loose >expect.loose
+'
+
+test_expect_success 'repack --cruft packs unreachable objects' '
+	git repack -d --cruft &&
+	pack=$(cruft_pack) &&
+	packed_objects $pack >actual &&
+	sort expect.side expect.loose >expect &&
+	test_cmp expect actual &&
+
+	git count-objects -v >count &&
+	grep "^count: 0" count &&
+	git rev-list --all --objects >reachable &&
+	cut -d" " -f1 reachable | sort >reachable.objects &&
+	comm -12 reachable.objects actual >both &&
+	test_must_be_empty both &&
+	git fsck
+'
+
+test_expect_success 'cruft objects keep their mtimes across repacks' '
+	echo old >old &&
+	old=$(git hash-object -w old) &&
+	test-tool chmtime =-1000 .git/objects/$(test_oid_to_path $old) &&
+	git repack -d --cruft &&
+	git repack -d --cruft &&
+
+	git repack -d --cruft --cruft-expiration=500.seconds.ago &&
+	test_must_fail git cat-file -e $old &&
+	git cat-file -e $(cat expect.loose)
+'
+
+test_expect_success 'objects reachable from recent cruft are kept' '
+	echo old >old &&
+	old=$(git hash-object -w old) &&
+	test-tool chmtime =-1000 .git/objects/$(test_oid_to_path $old) &&
+	tree=$(printf "100644 blob $old\told\n" | git mktree) &&
+	git repack -d --cruft --cruft-expiration=500.seconds.ago &&
+	git cat-file -e $old &&
+	git cat-file -e $tree
+'
+
+test_expect_success 'reachable objects leave the cruft pack' '
+	git branch topic $(head -n 1 side.objects | cut -d" " -f1) &&
+	git repack -d --cruft &&
+	pack=$(cruft_pack) &&
+	packed_objects $pack >actual &&
+	comm -12 expect.side actual >both &&
+	test_must_be_empty both &&
+	git branch -D topic &&
+	git reflog expire --all --expire=all
+'
+
+test_expect_success 'gc.cruftPacks keeps unreachable objects packed' '
+	echo new >new &&
+	new=$(git hash-object -w new) &&
+	git -c gc.cruftPacks=true gc &&
+	git count-objects -v >count &&
+	grep "^count: 0" count &&
+	git cat-file -e $new &&
+	pack=$(cruft_pack) &&
+	packed_objects $pack >actual &&
+	grep $new actual &&
+
+	git -c gc.cruftPacks=true gc --prune=now &&
+	test_must_fail git cat-file -e $new &&
+	! ls .git/objects/pack/*.mtimes
+'
+
+test_expect_success 'pack-objects --cruft refuses --stdout' '
+	test_must_fail git pack-objects --cruft --stdout </dev/null 2>err &&
+	test_i18ngrep "cannot use --stdout with --cruft" err
+'
+
+test_done
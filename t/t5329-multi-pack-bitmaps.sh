@@ -0,0 +1,209 @@
+#!/bin/sh
+
+test_description='multi-pack reachability bitmaps'
+. ./test-lib.sh
+
+objdir=.git/objects
+midx=$objdir/pack/multi-pack-index
+
+# Several packs, each holding one more commit on top of the last.
+test_expect_success 'setup' '
+	git config core.multiPackIndex true &&
+	for i in $(test_seq 1 5)
+	do
+		test_commit $i &&
+		git repack -d || return 1
+	done &&
+	ls $objdir/pack/*.pack >packs &&
+	test_line_count = 5 packs
+'
+
+test_expect_success 'write a multi-pack bitmap' '
+	git multi-pack-index write --bitmap &&
+	ls $objdir/pack/multi-pack-index-*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	ls $objdir/pack/multi-pack-index-*.rev >revs &&
+	test_line_count = 1 revs &&
+	ls $objdir/pack/*.bitmap >all &&
+	test_cmp bitmaps all
+'
+
+test_expect_success 'bitmap is consistent' '
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'rev-list counts agree with and without bitmaps' '
+	git rev-list --count --objects --all >expect &&
+	git rev-list --count --objects --all --use-bitmap-index >actual &&
+	test_cmp expect actual &&
+	git rev-list --count --objects HEAD ^1 >expect &&
+	git rev-list --count --objects HEAD ^1 --use-bitmap-index >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rev-list --disk-usage agrees with and without bitmaps' '
+	git rev-list --disk-usage --objects --all >expect &&
+	git rev-list --disk-usage --objects --all --use-bitmap-index >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects uses the multi-pack bitmap' '
+	git pack-objects --stdout --revs --use-bitmap-index --progress \
+		<<-EOF >out.pack 2>err &&
+	HEAD
+	EOF
+	grep "pack-reused [1-9]" err &&
+	git index-pack --strict -o out.idx out.pack &&
+	git rev-list --objects HEAD | cut -d" " -f1 | sort >expect &&
+	git show-index <out.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone from a repository with a multi-pack bitmap' '
+	git clone --no-local . clone &&
+	git -C clone fsck &&
+	git -C clone rev-parse HEAD >actual &&
+	git rev-parse HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'changing the preferred pack rewrites the bitmap' '
+	for pack in $(ls $objdir/pack/*.pack)
+	do
+		git multi-pack-index write --bitmap \
+			--preferred-pack=$(basename $pack) &&
+		ls $objdir/pack/multi-pack-index-*.bitmap >bitmaps &&
+		test_line_count = 1 bitmaps &&
+		for commit in $(git rev-list HEAD)
+		do
+			git rev-list --test-bitmap $commit || return 1
+		done || return 1
+	done
+'
+
+test_expect_success 'multi-pack bitmap with a lookup table' '
+	git rev-list --count --objects --all --use-bitmap-index >expect &&
+	test_file_size $objdir/pack/multi-pack-index-*.bitmap >size.before &&
+	rm -f $objdir/pack/multi-pack-index-*.bitmap &&
+	git -c pack.writeBitmapLookupTable=true \
+		multi-pack-index write --bitmap &&
+	test_file_size $objdir/pack/multi-pack-index-*.bitmap >size.after &&
+	test $(cat size.after) -gt $(cat size.before) &&
+	git rev-list --count --objects --all --use-bitmap-index >actual &&
+	test_cmp expect actual &&
+	for commit in $(git rev-list HEAD)
+	do
+		git rev-list --test-bitmap $commit || return 1
+	done
+'
+
+test_expect_success 'multi-pack bitmap has a name-hash cache' '
+	test_when_finished "rm -fr hashes" &&
+	git init hashes &&
+	(
+		cd hashes &&
+		mkdir dir &&
+		echo one >one &&
+		echo two >dir/two &&
+		git add . &&
+		git commit -m base &&
+		git repack -adb &&
+		test-tool bitmap dump-hashes >expect &&
+		test_file_not_empty expect &&
+		rm -f $objdir/pack/*.bitmap &&
+		git multi-pack-index write --bitmap &&
+		test-tool bitmap dump-hashes >actual &&
+		test_cmp expect actual &&
+		rm -f $objdir/pack/*.bitmap &&
+		git -c pack.writeBitmapHashCache=false \
+			multi-pack-index write --bitmap &&
+		test-tool bitmap dump-hashes >actual &&
+		test_must_be_empty actual
+	)
+'
+
+test_expect_success 'writing without --bitmap removes the bitmap' '
+	test_commit 6 &&
+	git repack -d &&
+	git multi-pack-index write &&
+	test_path_is_missing $objdir/pack/multi-pack-index-*.bitmap
+'
+
+test_expect_success 'bitmap is rewritten for an unchanged midx' '
+	git multi-pack-index write --bitmap &&
+	ls $objdir/pack/multi-pack-index-*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	rm -f $objdir/pack/multi-pack-index-*.bitmap &&
+	git multi-pack-index write --bitmap &&
+	ls $objdir/pack/multi-pack-index-*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'cannot prefer an empty pack' '
+	empty=$(git pack-objects $objdir/pack/pack </dev/null) &&
+	test_must_fail git multi-pack-index write --bitmap \
+		--preferred-pack=pack-$empty.pack 2>err &&
+	test_i18ngrep "with no objects" err &&
+	rm -f $objdir/pack/pack-$empty.*
+'
+
+test_expect_success 'missing closure keeps the midx but not the bitmap' '
+	test_when_finished "rm -fr partial" &&
+	git init partial &&
+	(
+		cd partial &&
+		test_commit base &&
+		git repack -d &&
+		test_commit loose &&
+		git rev-parse loose >commit &&
+		git pack-objects $objdir/pack/pack <commit &&
+		git multi-pack-index write --bitmap 2>err &&
+		test_i18ngrep "could not write multi-pack bitmap" err &&
+		test_path_is_file $midx &&
+		git multi-pack-index verify &&
+		test_path_is_missing $objdir/pack/multi-pack-index-*.bitmap
+	)
+'
+
+test_expect_success 'a ref to a corrupt object is left out with a warning' '
+	test_when_finished "rm -fr corrupt" &&
+	git init corrupt &&
+	(
+		cd corrupt &&
+		test_commit base &&
+		git repack -d &&
+		bogus=$(echo "not a commit" |
+			git hash-object -w --literally -t commit --stdin) &&
+		echo $bogus >.git/refs/heads/bogus &&
+		git multi-pack-index write --bitmap 2>err &&
+		test_i18ngrep "leaving it out of the multi-pack bitmap" err &&
+		ls $objdir/pack/multi-pack-index-*.bitmap >bitmaps &&
+		test_line_count = 1 bitmaps &&
+		git rev-list --test-bitmap base
+	)
+'
+
+test_expect_success 'repack --geometric -b writes a multi-pack bitmap' '
+	git multi-pack-index write &&
+	test_commit 7 &&
+	git repack -d &&
+	test_commit 8 &&
+	git repack -d &&
+	git repack -d -l -b --geometric=2 &&
+	ls $objdir/pack/multi-pack-index-*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git rev-list --test-bitmap HEAD &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'repack --geometric keeps an existing bitmap' '
+	test_commit 9 &&
+	git repack -d &&
+	git repack -d -l --geometric=2 &&
+	ls $objdir/pack/multi-pack-index-*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_done
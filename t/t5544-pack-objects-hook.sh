@@ -22,11 +22,36 @@ clear_hook_results () {
 	rm -rf .git/hook.* dst.git
 }
 
+test_expect_success 'pack-objects is forked from upload-pack without a hook' '
+	rm -rf dst.git trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . dst.git &&
+	grep "\"child_class\":\"fork\",.*\"argv\":\[\"git\",\"pack-objects\"" trace >fork &&
+	git -C dst.git fsck &&
+
+	# the forked child leaves without ending the session of upload-pack
+	sid=$(sed -n "s/.*\"sid\":\"\([^\"]*\)\".*/\1/p" fork) &&
+	grep "\"event\":\"exit\",\"sid\":\"$sid\"" trace >exits &&
+	test_line_count = 1 exits &&
+	grep "\"event\":\"atexit\",\"sid\":\"$sid\"" trace >atexits &&
+	test_line_count = 1 atexits
+'
+
+test_expect_success 'pack-objects is not forked for a shallow clone' '
+	rm -rf dst.git trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git clone --depth=1 "file://$(pwd)" dst.git &&
+	grep "\"argv\":\[\"git\",\"--shallow-file\",\"\",\"pack-objects\"" trace &&
+	! grep "\"child_class\":\"fork\"" trace
+'
+
 test_expect_success 'hook runs via global config' '
 	clear_hook_results &&
+	rm -f trace &&
 	test_config_global uploadpack.packObjectsHook ./hook &&
-	git clone --no-local . dst.git 2>stderr &&
-	grep "hook running" stderr
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git clone --no-local . dst.git 2>stderr &&
+	grep "hook running" stderr &&
+	! grep "\"child_class\":\"fork\"" trace
 '
 
 test_expect_success 'hook outputs are sane' '
@@ -33,6 +33,41 @@ test_expect_success 'rejected objects are removed' '
 	test_cmp expect actual
 '
 
+test_expect_success 'connectivity is checked while pre-receive runs' '
+	git init --bare concurrent.git &&
+	write_script concurrent.git/hooks/pre-receive <<-\EOF &&
+	cat >/dev/null
+	EOF
+	test_commit concurrent &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git push concurrent.git HEAD &&
+
+	hook=$(grep "\"hook_name\":\"pre-receive\"" trace) &&
+	id=$(echo "$hook" | sed "s/.*\"child_id\":\([0-9]*\).*/\1/") &&
+	sid=$(echo "$hook" | sed "s/.*\"sid\":\"\([^\"]*\)\".*/\1/") &&
+	grep -n -F "\"sid\":\"$sid\"" trace >events &&
+	hook_start=$(grep "\"hook_name\":\"pre-receive\"" events | cut -d: -f1) &&
+	check_start=$(grep "\"child_start\".*\"rev-list\"" events | cut -d: -f1) &&
+	hook_exit=$(grep "\"child_exit\".*\"child_id\":$id," events | cut -d: -f1) &&
+	test $hook_start -lt $check_start &&
+	test $check_start -lt $hook_exit &&
+	git --git-dir=concurrent.git cat-file -e $(git rev-parse HEAD)
+'
+
+test_expect_success 'pre-receive and connectivity check share the sideband' '
+	git init --bare shared.git &&
+	write_script shared.git/hooks/pre-receive <<-\EOF &&
+	cat >/dev/null &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		echo "hook line $i" >&2
+	done
+	EOF
+	test_commit shared &&
+	git push shared.git HEAD 2>err &&
+	grep "^remote: hook line" err >lines &&
+	test_line_count = 10 lines
+'
+
 test_expect_success 'push to repo path with path separator (colon)' '
 	# The interesting failure case here is when the
 	# receiving end cannot access its original object directory,
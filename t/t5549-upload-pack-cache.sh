@@ -0,0 +1,89 @@
+#!/bin/sh
+
+test_description='upload-pack sends identical packs from its cache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git config uploadpack.packCache true &&
+	git config uploadpack.allowFilter true
+'
+
+clone_traced () {
+	rm -rf dst.git trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git "$@" &&
+	git -C dst.git fsck
+} &&
+
+clone_traced_hit () {
+	clone_traced "$@" &&
+	grep "\"key\":\"pack-cache\",\"value\":\"hit\"" trace
+}
+
+clone_traced_miss () {
+	clone_traced "$@" &&
+	grep "\"key\":\"pack-cache\",\"value\":\"miss\"" trace
+}
+
+test_expect_success 'first clone stores its pack' '
+	rm -rf .git/pack-cache &&
+	clone_traced_miss clone --no-local . dst.git &&
+	ls .git/pack-cache/*.pack >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'identical clone is sent the cached pack' '
+	clone_traced_hit clone --no-local . dst.git &&
+	git -C dst.git rev-parse two >actual &&
+	git rev-parse two >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cached pack is sent with and without sideband' '
+	clone_traced_hit -c protocol.version=0 clone --no-local . dst.git &&
+	clone_traced_hit -c protocol.version=2 clone --no-local . dst.git
+'
+
+test_expect_success 'filtered clone does not get the same pack' '
+	clone_traced_miss clone --bare --no-local --filter=blob:none . dst.git &&
+	ls .git/pack-cache/*.pack >packs &&
+	test_line_count = 2 packs &&
+	clone_traced_hit clone --bare --no-local --filter=blob:none . dst.git
+'
+
+fetch_traced () {
+	rm -rf dst.git trace &&
+	git init dst.git &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C dst.git fetch "file://$(pwd)" HEAD:refs/heads/fetched &&
+	git -C dst.git fsck
+}
+
+test_expect_success 'new tags change the request with include-tag' '
+	fetch_traced &&
+	fetch_traced &&
+	grep "\"key\":\"pack-cache\",\"value\":\"hit\"" trace &&
+	git tag -a -m new new two &&
+	fetch_traced &&
+	grep "\"key\":\"pack-cache\",\"value\":\"miss\"" trace &&
+	git -C dst.git rev-parse --verify new
+'
+
+test_expect_success 'packs are not cached without room for them' '
+	test_config uploadpack.packCacheSize 1 &&
+	clone_traced_miss clone --no-local --depth=1 "file://$(pwd)" dst.git &&
+	test_path_is_missing .git/pack-cache/tmp_pack_* &&
+	ls .git/pack-cache >packs &&
+	test_must_be_empty packs
+'
+
+test_expect_success 'expired packs are not used' '
+	clone_traced_miss clone --no-local . dst.git &&
+	test-tool chmtime =-7200 .git/pack-cache/*.pack &&
+	clone_traced_miss clone --no-local . dst.git &&
+	ls .git/pack-cache/*.pack >packs &&
+	test_line_count = 1 packs
+'
+
+test_done
@@ -220,6 +220,11 @@ test_expect_success 'fetch packed objects' '
 	git clone $HTTPD_URL/dumb/repo_pack.git
 '
 
+test_expect_success 'packed objects are not asked for as loose objects' '
+	! grep "GET /dumb/repo_pack.git/objects/[0-9a-f][0-9a-f]/" \
+		"$HTTPD_ROOT_PATH/access.log"
+'
+
 test_expect_success 'http-fetch --packfile' '
 	# Arbitrary hash. Use rev-parse so that we get one of the correct
 	# length.
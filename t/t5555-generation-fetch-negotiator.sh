@@ -0,0 +1,109 @@
+#!/bin/sh
+
+test_description='test generation fetch negotiator'
+. ./test-lib.sh
+
+have_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -ne 0
+		then
+			echo "No have $(git -C client rev-parse $1) ($1)"
+			return 1
+		fi
+		shift
+	done
+}
+
+have_not_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -eq 0
+		then
+			return 1
+		fi
+		shift
+	done
+}
+
+# trace_fetch <client_dir> <server_dir> [args]
+#
+# Trace the packet output of fetch, but make sure we disable the variable
+# in the child upload-pack, so we don't combine the results in the same file.
+trace_fetch () {
+	client=$1; shift
+	server=$1; shift
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+	git -C "$client" fetch \
+	  --upload-pack 'unset GIT_TRACE_PACKET; git-upload-pack' \
+	  "$server" "$@"
+}
+
+test_expect_success 'commits are skipped as with the skipping negotiator' '
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	for i in $(test_seq 7)
+	do
+		test_commit -C client c$i
+	done &&
+
+	# We send: "c7" (skip 1) "c5" (skip 2) "c2" (skip 4). After that, since
+	# "c1" has no parent, it is still sent as "have" even though it would
+	# normally be skipped.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	have_sent c7 c5 c2 c1 &&
+	have_not_sent c6 c4 c3
+'
+
+test_expect_success 'remote-tracking tips are sent first' '
+	rm -rf server client trace &&
+	git init server &&
+	git -C server commit --allow-empty -m base &&
+	git clone server client &&
+	test_commit -C server to_fetch &&
+
+	# Local commits are newer, and would come first by date.
+	git -C client checkout -b topic &&
+	test_tick &&
+	for i in $(test_seq 5)
+	do
+		test_commit -C client local$i
+	done &&
+
+	git -C client rev-parse origin/HEAD >expect &&
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client origin &&
+	grep "fetch> have" trace | sed "s/.*have //" >haves &&
+	head -n 1 haves >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'generation order is kept when commit dates are skewed' '
+	rm -rf server client trace &&
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	test_commit -C client base &&
+	git -C client checkout -b skewed &&
+	test_commit -C client --date "@1000000000 +0000" skewed1 &&
+	test_commit -C client --date "@1000000000 +0000" skewed2 &&
+	git -C client checkout - &&
+	test_commit -C client newer &&
+	git -C client commit-graph write --reachable &&
+
+	# "skewed2" sits above "base" in the graph, even though its date
+	# says that it is the oldest commit of all.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	grep "fetch> have" trace | sed "s/.*have //" >haves &&
+	git -C client rev-parse skewed2 newer base >expect &&
+	test_cmp expect haves
+'
+
+test_done
@@ -0,0 +1,138 @@
+#!/bin/sh
+
+test_description='test fetching bundles with --bundle-uri'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	git -C server bundle create ../one.bundle main &&
+	test_commit -C server two &&
+	git -C server bundle create ../two.bundle one..main &&
+	test_commit -C server three &&
+	git -C server bundle create ../three.bundle two..main &&
+	test_commit -C server four
+'
+
+test_expect_success 'clone with a bundle' '
+	git clone --no-local --bundle-uri="$(pwd)/one.bundle" \
+		server clone-single &&
+	git -C clone-single rev-parse one >expect &&
+	git -C clone-single rev-parse refs/bundles/main >actual &&
+	test_cmp expect actual &&
+	git -C server rev-parse four >expect &&
+	git -C clone-single rev-parse main >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone with a bundle list unbundles in creation order' '
+	cat >list <<-EOF &&
+	[bundle]
+		version = 1
+		mode = all
+		heuristic = creationToken
+	[bundle "two"]
+		uri = two.bundle
+		creationToken = 2
+	[bundle "one"]
+		uri = file://$(pwd)/one.bundle
+		creationToken = 1
+	EOF
+
+	GIT_TRACE2_EVENT="$(pwd)/trace-list" \
+		git clone --no-local --bundle-uri="$(pwd)/list" \
+		server clone-list &&
+	grep "\"key\":\"unbundled\",\"value\":\"2\"" trace-list &&
+	git -C clone-list rev-parse two >expect &&
+	git -C clone-list rev-parse refs/bundles/main >actual &&
+	test_cmp expect actual &&
+	test_cmp_config -C clone-list "$(pwd)/list" fetch.bundleuri &&
+	test_cmp_config -C clone-list 2 fetch.bundlecreationtoken
+'
+
+test_expect_success 'fetch only asks for what the bundles lack' '
+	GIT_TRACE_PACKET="$(pwd)/trace-packet" git clone --no-local \
+		--bundle-uri="$(pwd)/list" server clone-negotiate &&
+	grep "clone> have $(git -C server rev-parse two)" trace-packet
+'
+
+test_expect_success 'fetch applies bundles added to the list since' '
+	cat >>list <<-EOF &&
+	[bundle "three"]
+		uri = three.bundle
+		creationToken = 3
+	EOF
+
+	GIT_TRACE2_EVENT="$(pwd)/trace-incremental" \
+		git -C clone-list fetch origin &&
+	grep "\"key\":\"unbundled\",\"value\":\"1\"" trace-incremental &&
+	git -C clone-list rev-parse three >expect &&
+	git -C clone-list rev-parse refs/bundles/main >actual &&
+	test_cmp expect actual &&
+	test_cmp_config -C clone-list 3 fetch.bundlecreationtoken
+'
+
+test_expect_success 'a missing bundle does not fail the clone' '
+	git clone --no-local --bundle-uri="$(pwd)/missing.bundle" \
+		server clone-missing 2>err &&
+	test_i18ngrep "failed to fetch objects from bundle URI" err &&
+	git -C server rev-parse four >expect &&
+	git -C clone-missing rev-parse main >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--bundle-uri is incompatible with --depth' '
+	test_must_fail git clone --bundle-uri="$(pwd)/one.bundle" \
+		--depth=1 server clone-shallow 2>err &&
+	test_i18ngrep "incompatible" err
+'
+
+test_expect_success 'local bundles advertised by the server are not read' '
+	test_config -C server uploadpack.advertiseBundleURIs true &&
+	test_config -C server bundle.version 1 &&
+	test_config -C server bundle.mode all &&
+	test_config -C server bundle.one.uri "$(pwd)/one.bundle" &&
+	test_config -C server bundle.two.uri "file://$(pwd)/two.bundle" &&
+
+	git -c protocol.version=2 -c transfer.bundleURI=true \
+		clone "file://$(pwd)/server" clone-advertised 2>err &&
+	test_i18ngrep "ignoring non-HTTP bundle URI .*one.bundle" err &&
+	test_i18ngrep "ignoring non-HTTP bundle URI .*two.bundle" err &&
+	test_must_fail git -C clone-advertised rev-parse --verify refs/bundles/main &&
+	git -C server rev-parse four >expect &&
+	git -C clone-advertised rev-parse main >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bundle URIs with spaces or control characters are ignored' '
+	cat >unsafe-list <<-\EOF &&
+	[bundle]
+		version = 1
+		mode = all
+	[bundle "newline"]
+		uri = "http://example.com/one.bundle\nget http://example.com/x /tmp/x"
+	[bundle "space"]
+		uri = http://example.com/one.bundle /tmp/x
+	EOF
+
+	git clone --no-local --bundle-uri="$(pwd)/unsafe-list" \
+		server clone-unsafe 2>err &&
+	test_i18ngrep "unsafe characters: .http://example.com/one.bundle$" err &&
+	test_i18ngrep "unsafe characters: .http://example.com/one.bundle /tmp/x" err &&
+	test_must_fail git -C clone-unsafe rev-parse --verify refs/bundles/main
+'
+
+test_expect_success 'bundles are not requested without transfer.bundleURI' '
+	test_config -C server uploadpack.advertiseBundleURIs true &&
+	test_config -C server bundle.version 1 &&
+	test_config -C server bundle.one.uri "$(pwd)/one.bundle" &&
+
+	git -c protocol.version=2 clone "file://$(pwd)/server" clone-plain &&
+	test_must_fail git -C clone-plain rev-parse --verify refs/bundles/main
+'
+
+test_done
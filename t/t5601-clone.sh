@@ -63,6 +63,31 @@ test_expect_success 'clone checks out files' '
 
 '
 
+test_expect_success 'clone --no-hardlinks copies packs and their metadata' '
+	rm -fr meta dst &&
+	git clone --bare src meta &&
+	git -C meta repack -adb &&
+	git -C meta multi-pack-index write &&
+	git -C meta commit-graph write --reachable &&
+	git clone --bare --no-hardlinks meta dst &&
+	(
+		cd meta/objects &&
+		find . -type f | sort
+	) >expect &&
+	(
+		cd dst/objects &&
+		find . -type f | sort
+	) >actual &&
+	test_cmp expect actual &&
+	grep "\.bitmap$" actual &&
+	grep commit-graph actual &&
+	for f in $(cat expect)
+	do
+		test_cmp_bin meta/objects/$f dst/objects/$f || return 1
+	done &&
+	git -C dst fsck
+'
+
 test_expect_success 'clone respects GIT_WORK_TREE' '
 
 	GIT_WORK_TREE=worktree git clone src bare &&
@@ -235,6 +235,57 @@ test_expect_success 'use fsck before and after manually fetching a missing subtr
 	test_cmp unique_types.expected unique_types.observed
 '
 
+test_expect_success 'checkout fetches the missing subtrees in one batch' '
+	rm -rf tree-src tree-dst &&
+	git init tree-src &&
+	for i in 1 2 3 4 5
+	do
+		mkdir -p tree-src/dir$i/sub &&
+		echo $i >tree-src/dir$i/file &&
+		echo $i >tree-src/dir$i/sub/file || return 1
+	done &&
+	git -C tree-src add . &&
+	git -C tree-src commit -m "five directories" &&
+	test_config -C tree-src uploadpack.allowfilter 1 &&
+	test_config -C tree-src uploadpack.allowanysha1inwant 1 &&
+
+	git clone --no-checkout --filter=tree:1 \
+		"file://$(pwd)/tree-src" tree-dst &&
+	GIT_TRACE2_EVENT="$(pwd)/checkout-trace" \
+		git -C tree-dst checkout main &&
+	git -C tree-src ls-files -s >expect &&
+	git -C tree-dst ls-files -s >actual &&
+	test_cmp expect actual &&
+
+	# one fetch for the subtrees, one for the blobs
+	grep "\"event\":\"child_start\".*\"fetch\"" checkout-trace >fetches &&
+	test_line_count = 2 fetches
+'
+
+test_expect_success 'blame fetches the history of the file in batches' '
+	rm -rf blame-src blame-dst &&
+	git init blame-src &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		echo line $i >>blame-src/file &&
+		git -C blame-src add file &&
+		git -C blame-src commit -m "line $i" || return 1
+	done &&
+	test_config -C blame-src uploadpack.allowfilter 1 &&
+	test_config -C blame-src uploadpack.allowanysha1inwant 1 &&
+
+	git clone --bare --filter=blob:none \
+		"file://$(pwd)/blame-src" blame-dst &&
+	git -C blame-src blame file >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/blame-trace" \
+		git -C blame-dst blame main -- file >actual &&
+	test_cmp expect actual &&
+
+	# one fetch for the blob at the tip, one for its history
+	grep "\"event\":\"child_start\".*\"fetch\"" blame-trace >fetches &&
+	test_line_count = 2 fetches
+'
+
 test_expect_success 'implicitly construct combine: filter with repeated flags' '
 	GIT_TRACE=$(pwd)/trace git clone --bare \
 		--filter=blob:none --filter=tree:1 \
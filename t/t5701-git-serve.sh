@@ -241,6 +241,139 @@ test_expect_success 'unexpected lines are not allowed in fetch request' '
 	grep "unexpected line: .this-is-not-a-command." err
 '
 
+# Test the advertisement cache
+#
+# The cache is only written for refs that have not been touched for a
+# while, so backdate everything that holds them.
+age_refs () {
+	find .git/HEAD .git/refs .git/packed-refs .git/reftable 2>/dev/null |
+	xargs test-tool chmtime =-60
+}
+
+test_expect_success 'ls-refs with uploadpack.cacheAdvertisement' '
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	peel
+	symrefs
+	0000
+	EOF
+	test-tool pkt-line pack >in-plain <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >expect &&
+	test-tool serve-v2 --stateless-rpc <in-plain >expect-plain &&
+	test_config uploadpack.cacheAdvertisement true &&
+	age_refs &&
+	test-tool serve-v2 --stateless-rpc <in >actual &&
+	test_cmp expect actual &&
+	test_path_is_file .git/advertised-refs &&
+	test-tool serve-v2 --stateless-rpc <in >actual &&
+	test_cmp expect actual &&
+	test-tool serve-v2 --stateless-rpc <in-plain >actual &&
+	test_cmp expect-plain actual
+'
+
+test_expect_success 'ls-refs answers from the advertisement cache' '
+	test_when_finished "rm -f .git/advertised-refs" &&
+	test_config uploadpack.cacheAdvertisement true &&
+	dev=$(git rev-parse refs/heads/dev) &&
+	main=$(git rev-parse refs/heads/main) &&
+	sed "s/$dev refs\/heads\/dev/$main refs\/heads\/dev/" \
+		.git/advertised-refs >cache &&
+	cp cache .git/advertised-refs &&
+
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	ref-prefix refs/heads/d
+	ref-prefix refs/tags/
+	ref-prefix refs/heads/dev
+	0000
+	EOF
+
+	cat >expect <<-EOF &&
+	$main refs/heads/dev
+	$(git rev-parse refs/tags/annotated-tag) refs/tags/annotated-tag
+	$(git rev-parse refs/tags/one) refs/tags/one
+	$(git rev-parse refs/tags/two) refs/tags/two
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'advertisement cache notices ref updates' '
+	test_config uploadpack.cacheAdvertisement true &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	ref-prefix refs/heads/
+	0000
+	EOF
+	age_refs &&
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	git update-ref refs/heads/dev refs/heads/main &&
+	git update-ref refs/heads/new refs/tags/one &&
+
+	cat >expect <<-EOF &&
+	$(git rev-parse refs/heads/main) refs/heads/dev
+	$(git rev-parse refs/heads/main) refs/heads/main
+	$(git rev-parse refs/tags/one) refs/heads/new
+	$(git rev-parse refs/heads/main) refs/heads/release
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual &&
+	age_refs &&
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'advertisement cache respects hidden refs' '
+	test_config uploadpack.cacheAdvertisement true &&
+	test_config uploadpack.hideRefs refs/heads/new &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	object-format=$(test_oid algo)
+	0001
+	ref-prefix refs/heads/
+	0000
+	EOF
+
+	cat >expect <<-EOF &&
+	$(git rev-parse refs/heads/dev) refs/heads/dev
+	$(git rev-parse refs/heads/main) refs/heads/main
+	$(git rev-parse refs/heads/release) refs/heads/release
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'upload-pack --advertise-refs with the advertisement cache' '
+	git upload-pack --advertise-refs . >expect &&
+	test_config uploadpack.cacheAdvertisement true &&
+	age_refs &&
+	git upload-pack --advertise-refs . >actual &&
+	test_cmp expect actual &&
+	git upload-pack --advertise-refs . >actual &&
+	test_cmp expect actual
+'
+
 # Test the basics of object-info
 #
 test_expect_success 'basics of object-info' '
@@ -945,6 +945,66 @@ test_expect_success 'packfile URIs with fetch instead of clone' '
 		fetch "$HTTPD_URL/smart/http_parent"
 '
 
+test_expect_success 'packfile URIs are downloaded in parallel' '
+	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
+	rm -rf "$P" http_child log &&
+
+	git init "$P" &&
+	git -C "$P" config "uploadpack.allowsidebandall" "true" &&
+
+	echo my-blob >"$P/my-blob" &&
+	git -C "$P" add my-blob &&
+	echo other-blob >"$P/other-blob" &&
+	git -C "$P" add other-blob &&
+	git -C "$P" commit -m x &&
+
+	configure_exclusion "$P" my-blob >h &&
+	configure_exclusion "$P" other-blob >h2 &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TEST_SIDEBAND_ALL=1 \
+	git -c protocol.version=2 \
+		-c fetch.uriprotocols=http,https \
+		clone "$HTTPD_URL/smart/http_parent" http_child &&
+
+	# Both downloads are started before the first one is waited for.
+	grep "\"event\":\"child_start\".*http-fetch" trace >starts &&
+	test_line_count = 2 starts &&
+	sid=$(sed -n -e "1s/.*\"sid\":\"\([^\"]*\)\".*/\1/p" starts) &&
+	grep -F "\"sid\":\"$sid\"" trace |
+	grep -e "\"event\":\"child_start\".*http-fetch" \
+	     -e "\"event\":\"child_exit\"" |
+	sed -e "s/.*\"event\":\"\(child_[a-z]*\)\".*/\1/" >actual &&
+	grep -A1 child_start actual >pair &&
+	test "$(head -n 2 pair)" = "$(printf "child_start\nchild_start")"
+'
+
+test_expect_success 'packfile URI download resumes a partial pack' '
+	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
+	rm -rf "$P" http_child log &&
+
+	git init "$P" &&
+	git -C "$P" config "uploadpack.allowsidebandall" "true" &&
+
+	echo my-blob >"$P/my-blob" &&
+	git -C "$P" add my-blob &&
+	git -C "$P" commit -m x &&
+
+	configure_exclusion "$P" my-blob >h &&
+
+	git init http_child &&
+	pack="$HTTPD_DOCUMENT_ROOT_PATH/mypack-$(cat packh).pack" &&
+	temp="http_child/.git/objects/pack/pack-$(cat packh).pack.temp" &&
+	test_copy_bytes 20 <"$pack" >"$temp" &&
+
+	GIT_TRACE_CURL="$(pwd)/log" GIT_TEST_SIDEBAND_ALL=1 \
+	git -C http_child -c protocol.version=2 \
+		-c fetch.uriprotocols=http,https \
+		fetch "$HTTPD_URL/smart/http_parent" &&
+	grep "Send header: Range: bytes=20-" log &&
+	test_path_is_missing "$temp" &&
+	test_path_is_file http_child/.git/objects/pack/pack-$(cat packh).idx
+'
+
 test_expect_success 'fetching with valid packfile URI but invalid hash fails' '
 	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
 	rm -rf "$P" http_child log &&
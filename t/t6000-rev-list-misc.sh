@@ -169,4 +169,68 @@ test_expect_success 'rev-list --count --objects' '
 	test_line_count = $count actual
 '
 
+test_expect_success 'setup history for parallel tree walks' '
+	git init parallel &&
+	(
+		cd parallel &&
+		for i in $(test_seq 1 40)
+		do
+			mkdir -p a/b$((i % 5)) c &&
+			echo $i >a/b$((i % 5))/file &&
+			echo $i >>c/log &&
+			git add . &&
+			git commit -q -m $i || return 1
+		done
+	)
+'
+
+test_expect_success 'rev-list --threads walks trees in parallel' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C parallel rev-list --objects --count --threads=2 HEAD \
+		>actual &&
+	grep "\"region_enter\".*parallel-tree-walk" trace &&
+	git -C parallel rev-list --objects HEAD >objects &&
+	test_line_count = $(cat actual) objects
+'
+
+test_expect_success 'rev-list --threads gives the same answers' '
+	for range in HEAD HEAD~10 "HEAD ^HEAD~30" "--all ^HEAD~5"
+	do
+		git -C parallel rev-list --objects --count --threads=1 \
+			$range >expect &&
+		git -C parallel rev-list --objects --count --threads=4 \
+			$range >actual &&
+		test_cmp expect actual &&
+		git -C parallel rev-list --objects --disk-usage --threads=1 \
+			$range >expect &&
+		git -C parallel rev-list --objects --disk-usage --threads=4 \
+			$range >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'rev-list --threads=1 and --filter stay on one thread' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C parallel rev-list --objects --count --threads=1 HEAD &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C parallel rev-list --objects --count --threads=4 \
+		--filter=blob:none HEAD &&
+	! grep parallel-tree-walk trace
+'
+
+test_expect_success 'rev-list --threads dies on a missing tree' '
+	cp -R parallel broken &&
+	tree=$(git -C broken rev-parse HEAD~20:a) &&
+	rm -f broken/.git/objects/$(test_oid_to_path $tree) &&
+	test_must_fail git -C broken rev-list --objects --quiet \
+		--threads=4 HEAD 2>err &&
+	test_i18ngrep "bad tree object $tree" err
+'
+
+test_expect_success 'rev-list --threads rejects a bad value' '
+	test_must_fail git rev-list --threads=-1 --count HEAD 2>err &&
+	test_i18ngrep "invalid --threads" err
+'
+
 test_done
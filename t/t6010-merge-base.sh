@@ -305,4 +305,39 @@ test_expect_success 'merge-base --octopus --all for complex tree' '
 	test_cmp expected actual
 '
 
+test_expect_success 'merge-base --batch agrees with one pair at a time' '
+	git tag -l >tags &&
+	for a in CCA CCB MMA JE JAA H
+	do
+		for b in $(cat tags)
+		do
+			echo "$a $b" || return 1
+		done || return 1
+	done >pairs &&
+	test $(wc -l <pairs) -gt 64 &&
+	while read a b
+	do
+		echo $(git merge-base --all $a $b) || return 1
+	done <pairs >expect &&
+	grep "^\$" expect &&
+	git merge-base --all --batch <pairs >actual &&
+	test_cmp expect actual &&
+	while read a b
+	do
+		git merge-base $a $b || echo
+	done <pairs >expect &&
+	git merge-base --batch <pairs >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'merge-base --batch rejects bad input' '
+	echo JE >input &&
+	test_must_fail git merge-base --batch <input &&
+	echo "JE no-such-commit" >input &&
+	test_must_fail git merge-base --batch <input &&
+	test_must_fail git merge-base --batch JE JC </dev/null &&
+	git merge-base --batch </dev/null >actual &&
+	test_must_be_empty actual
+'
+
 test_done
@@ -118,6 +118,35 @@ test_expect_success 'rev-list --ancestry-path --simplify-merges G^..M -- G.t' '
 	test_cmp expect actual
 '
 
+test_expect_success 'rev-list --topo-order --ancestry-path with a commit-graph' '
+	test_when_finished "rm -f .git/objects/info/commit-graph" &&
+	git commit-graph write --reachable &&
+	for c in E F H I J L M; do echo $c; done >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git rev-list --topo-order --ancestry-path --format=%s D..M >out &&
+	sed -e "/^commit /d" out | sort >actual &&
+	test_cmp expect actual &&
+	grep "count_ancestry_path_walked" trace.txt &&
+	for c in F H I; do echo $c; done >expect &&
+	git rev-list --topo-order --ancestry-path --format=%s F...I |
+	sed -e "/^commit /d" |
+	sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'incremental --ancestry-path rewrites parents like limit_list' '
+	test_when_finished "rm -f .git/objects/info/commit-graph" &&
+	git -c core.commitGraph=false log --graph --parents \
+		--ancestry-path --format=%s D..M >expect &&
+	git commit-graph write --reachable &&
+	git log --graph --parents --ancestry-path --format=%s D..M >actual &&
+	test_cmp expect actual &&
+	git -c core.commitGraph=false log --topo-order --boundary \
+		--ancestry-path --format=%s F...I >expect &&
+	git log --topo-order --boundary --ancestry-path --format=%s F...I >actual &&
+	test_cmp expect actual
+'
+
 #   b---bc
 #  / \ /
 # a   X
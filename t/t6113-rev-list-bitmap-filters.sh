@@ -73,7 +73,7 @@ test_expect_success 'tree:1 filter' '
 	git rev-list --objects --filter=tree:1 HEAD >expect &&
 	git rev-list --use-bitmap-index \
 		     --objects --filter=tree:1 HEAD >actual &&
-	test_cmp expect actual
+	test_bitmap_traversal expect actual
 '
 
 test_expect_success 'object:type filter' '
@@ -141,4 +141,43 @@ test_expect_success 'combine filter with --filter-provided-objects' '
 	done <objects
 '
 
+test_expect_success 'set up nested trees' '
+	mkdir -p a/b/c &&
+	echo 1 >a/file &&
+	echo 2 >a/b/file &&
+	echo 3 >a/b/c/file &&
+	git add a &&
+	git commit -m nested &&
+	git repack -adb &&
+	echo 4 >a/b/c/file &&
+	echo 5 >a/b/other &&
+	git commit -a -m nested-again &&
+	git add a &&
+	git commit -m nested-other
+'
+
+for depth in 1 2 3 4
+do
+	test_expect_success "tree:$depth filter with nested trees" '
+		git rev-list --objects --filter=tree:$depth HEAD >expect &&
+		git rev-list --use-bitmap-index \
+			     --objects --filter=tree:$depth HEAD >actual &&
+		test_bitmap_traversal expect actual
+	'
+
+	test_expect_success "tree:$depth filter with haves" '
+		git rev-list --objects --filter=tree:$depth HEAD ^HEAD~2 >expect &&
+		git rev-list --use-bitmap-index \
+			     --objects --filter=tree:$depth HEAD ^HEAD~2 >actual &&
+		test_bitmap_traversal expect actual
+	'
+done
+
+test_expect_success 'tree:2 filter with specified tree' '
+	git rev-list --objects --filter=tree:2 HEAD HEAD:a/b >expect &&
+	git rev-list --use-bitmap-index \
+		     --objects --filter=tree:2 HEAD HEAD:a/b >actual &&
+	test_bitmap_traversal expect actual
+'
+
 test_done
@@ -44,8 +44,47 @@ check_du () {
 	"
 }
 
+# Like disk_usage_slow, but print the number of objects and the bytes
+# they use for each type.
+disk_usage_by_type_slow () {
+	git rev-list --no-object-names "$@" |
+	git cat-file --batch-check="%(objecttype) %(objectsize:disk)" |
+	perl -lane '
+		$count{$F[0]}++; $size{$F[0]} += $F[1];
+		END {
+			printf "%s %d %d\n", $_, $count{$_}, $size{$_}
+				for qw(commit tree blob tag);
+		}
+	'
+}
+
+check_du_by_type () {
+	args=$*
+
+	test_expect_success "generate expected sizes by type ($args)" "
+		disk_usage_by_type_slow $args >expect
+	"
+
+	test_expect_success "rev-list --disk-usage=by-type without bitmaps ($args)" "
+		git rev-list --disk-usage=by-type $args >actual &&
+		test_cmp expect actual
+	"
+
+	test_expect_success "rev-list --disk-usage=by-type with bitmaps ($args)" "
+		git rev-list --disk-usage=by-type --use-bitmap-index $args >actual &&
+		test_cmp expect actual
+	"
+}
+
 check_du HEAD
 check_du --objects HEAD
 check_du --objects HEAD^..HEAD
+check_du_by_type HEAD
+check_du_by_type --objects HEAD
+check_du_by_type --objects HEAD^..HEAD
+
+test_expect_success 'rev-list --disk-usage rejects unknown values' '
+	test_must_fail git rev-list --disk-usage=nonsense HEAD
+'
 
 test_done
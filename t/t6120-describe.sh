@@ -459,6 +459,54 @@ test_expect_success 'name-rev a rev shortly after epoch' '
 	test_cmp expect actual
 '
 
+test_expect_success 'name-rev with skewed dates uses generation numbers' '
+	git init skew &&
+	(
+		cd skew &&
+		test_commit --date "2020-01-02 00:00" old &&
+		test_commit --date "2019-01-01 00:00" skewed &&
+		test_commit --date "2020-01-03 00:00" tip &&
+		git name-rev --tags old >actual &&
+		echo "old tags/old" >expect &&
+		test_cmp expect actual &&
+		git name-rev --refs=refs/tags/tip old >actual &&
+		echo "old undefined" >expect &&
+		test_cmp expect actual &&
+		git commit-graph write --reachable &&
+		git name-rev --refs=refs/tags/tip old >actual &&
+		echo "old tags/tip~2" >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'name-rev with a reachability index' '
+	(
+		cd skew &&
+		git checkout -b side old &&
+		test_commit --date "2020-01-04 00:00" side &&
+		git commit-graph write --reachable --reachability-index &&
+		git name-rev --refs=refs/tags/side --refs=refs/tags/tip \
+			skewed old >actual &&
+		test_write_lines "skewed tags/tip~1" "old tags/tip~2" >expect &&
+		test_cmp expect actual &&
+		git name-rev --refs=refs/tags/side --refs=refs/tags/tip \
+			side >actual &&
+		echo "side tags/side" >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'describe --stdin' '
+	git describe HEAD A^0 c^0 >expect &&
+	printf "HEAD\nA^0\n\nc^0\n" | git describe --stdin >actual &&
+	test_cmp expect actual &&
+	git describe --contains B^0 c^0 >expect &&
+	printf "B^0\nc^0\n" | git describe --contains --stdin >actual &&
+	test_cmp expect actual &&
+	test_must_fail git describe --stdin HEAD </dev/null &&
+	test_must_fail git describe --stdin --dirty </dev/null
+'
+
 # A--------------main
 #  \            /
 #   \----------M2
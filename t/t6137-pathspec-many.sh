@@ -0,0 +1,84 @@
+#!/bin/sh
+
+test_description='matching paths against many pathspec items'
+
+. ./test-lib.sh
+
+# Expect "git ls-files" with all the given pathspecs to show what it
+# shows with each of them on its own.
+test_ls_files_union () {
+	for spec in "$@"
+	do
+		git ls-files -- "$spec" || return 1
+	done | sort -u >expect &&
+	git ls-files -- "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success setup '
+	for p in top a/b/c a/bc a/b/d/e a/bx/f x/y.c x/z.h x/sub/w.c \
+		 "x/we*ird" Dir/File dir/file deep/er/and/deeper/file
+	do
+		mkdir -p "$(dirname "$p")" &&
+		echo "$p" >"$p" || return 1
+	done &&
+	git add . &&
+	git commit -m files
+'
+
+test_expect_success 'literal files and directories' '
+	test_ls_files_union top a/b a/bc x/y.c dir Dir/File \
+		deep/er/and missing/file nothing
+'
+
+test_expect_success 'directories with a trailing slash' '
+	test_ls_files_union a/b/ x/ deep/er/ top a/b/d/ missing/ Dir/ \
+		no/such/
+'
+
+test_expect_success 'wildcards among literal items' '
+	test_ls_files_union "x/*.c" "a/b*" "*.h" top "deep/*/file" \
+		Dir/File "x/we*" "?op" a/bc
+'
+
+test_expect_success 'magic among literal items' '
+	test_ls_files_union ":(icase)dir/file" ":(literal)x/we*ird" \
+		":(glob)x/*.c" ":(top)a/bc" a/b top x/z.h Dir deep &&
+	git ls-files -- ":(literal)x/we*" x/y.c x/z.h a/b a/bc top Dir \
+		dir deep >actual &&
+	test_write_lines Dir/File a/b/c a/b/d/e a/bc \
+		deep/er/and/deeper/file dir/file top x/y.c x/z.h >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'exclusions among literal items' '
+	git ls-files -- a x top dir Dir deep ":(exclude)a/b" \
+		":(exclude)x/*.c" ":(exclude)top" >actual &&
+	test_write_lines Dir/File a/bc a/bx/f deep/er/and/deeper/file \
+		dir/file "x/we*ird" x/z.h >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'items relative to a subdirectory' '
+	(
+		cd a &&
+		git ls-files -- b bc ../x/y.c ../top bx/f b/d nothing \
+			../dir ../deep/er >../actual
+	) &&
+	test_write_lines b/c b/d/e bc bx/f ../deep/er/and/deeper/file \
+		../dir/file ../top ../x/y.c >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unmatched items are reported' '
+	test_must_fail git ls-files --error-unmatch -- top a/b a/bc x/y.c \
+		dir Dir/File deep missing/file 2>err &&
+	test_i18ngrep "did not match any file(s) known to git" err &&
+	test_i18ngrep "missing/file" err &&
+	! grep "a/bc" err &&
+	git rm -n -r --cached -- top a/b a/bc x/y.c dir Dir/File deep x/z.h \
+		>actual &&
+	test_line_count = 9 actual
+'
+
+test_done
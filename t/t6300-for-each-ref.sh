@@ -1144,4 +1144,114 @@ test_expect_success 'for-each-ref reports broken tags' '
 		refs/tags/broken-tag-*
 '
 
+test_expect_success REFFILES 'threaded reads of loose refs' '
+	test_when_finished "rm -rf .git/refs/loose" &&
+	for i in $(test_seq 40)
+	do
+		echo "create refs/loose/ref-$i HEAD" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	git symbolic-ref refs/loose/sym refs/loose/ref-1 &&
+	echo garbage >.git/refs/loose/garbage &&
+	GIT_TEST_LOOSE_REF_THREADS=1 git for-each-ref --format="%(refname) %(objectname) %(symref)" \
+		refs/loose >expect 2>expect.err &&
+	test_line_count = 41 expect &&
+	test_i18ngrep "ignoring broken ref refs/loose/garbage" expect.err &&
+	GIT_TEST_LOOSE_REF_THREADS=4 git for-each-ref --format="%(refname) %(objectname) %(symref)" \
+		refs/loose >actual 2>actual.err &&
+	test_cmp expect actual &&
+	test_cmp expect.err actual.err
+'
+
+
+test_expect_success 'setup for core.refObjectCache' '
+	git init object-cache &&
+	(
+		cd object-cache &&
+		test_commit one &&
+		git tag -a -m "annotated one" annotated-one &&
+		test_commit two &&
+		git tag -a -m "annotated two" annotated-two &&
+		git tag -a -m "nested" nested annotated-one &&
+		git tag blob $(echo blob | git hash-object -w --stdin)
+	)
+'
+
+test_expect_success 'core.refObjectCache gives the same results' '
+	format="%(objectname) %(objecttype) %(*objectname) %(*objecttype)" &&
+	format="$format %(taggerdate) %(committerdate:iso) %(creatordate:unix)" &&
+	format="$format %(*committerdate:raw) %(refname)" &&
+	git -C object-cache for-each-ref --format="$format" \
+		--sort=-taggerdate --sort=refname >expect &&
+	git -C object-cache -c core.refObjectCache=true for-each-ref \
+		--format="$format" --sort=-taggerdate --sort=refname >actual &&
+	test_cmp expect actual &&
+	test_path_is_file object-cache/.git/ref-object-cache &&
+	git -C object-cache -c core.refObjectCache=true for-each-ref \
+		--format="$format" --sort=-taggerdate --sort=refname >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.refObjectCache does not read cached objects' '
+	git -C object-cache for-each-ref --sort=-creatordate \
+		refs/tags/annotated-two >expect &&
+	tag=$(git -C object-cache rev-parse annotated-two) &&
+	mv object-cache/.git/objects/$(test_oid_to_path $tag) saved &&
+	test_must_fail git -C object-cache for-each-ref refs/tags/annotated-two &&
+	git -C object-cache -c core.refObjectCache=true for-each-ref \
+		--sort=-creatordate refs/tags/annotated-two >actual &&
+	mv saved object-cache/.git/objects/$(test_oid_to_path $tag) &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.refObjectCache falls back for other atoms' '
+	git -C object-cache for-each-ref --format="%(subject) %(taggerdate)" >expect &&
+	git -C object-cache -c core.refObjectCache=true for-each-ref \
+		--format="%(subject) %(taggerdate)" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.refObjectCache still reports broken tags' '
+	test_must_fail git -c core.refObjectCache=true for-each-ref \
+		--format="%(*objectname)" refs/tags/broken-tag-*
+'
+
+test_expect_success 'sorting by committerdate uses the commit-graph' '
+	git init sort-graph &&
+	(
+		cd sort-graph &&
+		test_commit one &&
+		git branch b-one &&
+		test_commit two &&
+		git branch b-two &&
+		git checkout -b side one &&
+		test_commit three &&
+		git tag -a -m "annotated" annotated &&
+		git repack -ad &&
+		git commit-graph write --reachable &&
+
+		git -c core.commitGraph=false for-each-ref --format="%(refname)" \
+			--sort=-committerdate refs/heads >expect &&
+		GIT_TRACE_PACK_ACCESS="$(pwd)/access" git for-each-ref \
+			--format="%(refname)" --sort=-committerdate refs/heads >actual &&
+		test_cmp expect actual &&
+		test_path_is_missing access &&
+
+		for format in "%(refname) %(committerdate)" \
+			      "%(refname) %(creatordate:iso)" \
+			      "%(refname) %(objecttype)"
+		do
+			git -c core.commitGraph=false for-each-ref \
+				--sort=-creatordate --format="$format" >expect &&
+			git for-each-ref --sort=-creatordate \
+				--format="$format" >actual &&
+			test_cmp expect actual || return 1
+		done &&
+		git -c core.commitGraph=false for-each-ref \
+			--sort=version:committerdate >expect &&
+		git for-each-ref --sort=version:committerdate >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
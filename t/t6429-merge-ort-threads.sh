@@ -0,0 +1,83 @@
+#!/bin/sh
+
+test_description='merge-ort content merges on threads'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_MERGE_THREADS
+
+test_expect_success setup '
+	for i in $(test_seq 1 100)
+	do
+		test_write_lines 1 2 3 4 5 6 7 8 9 >file$i || return 1
+	done &&
+	printf "\0binary\n" >bin &&
+	test_write_lines 1 2 3 >union &&
+	echo "union merge=union" >.gitattributes &&
+	git add . &&
+	git commit -m base &&
+
+	git checkout -b side1 &&
+	for i in $(test_seq 1 100)
+	do
+		test_write_lines 1 side1 3 4 5 6 7 8 9 >file$i || return 1
+	done &&
+	test_write_lines 1 2 3 4 5 6 7 8 side1 >file7 &&
+	printf "\0side1\n" >bin &&
+	test_write_lines 1 2 3 side1 >union &&
+	git commit -a -m side1 &&
+
+	git checkout -b side2 main &&
+	for i in $(test_seq 1 100)
+	do
+		test_write_lines 1 2 3 4 5 6 7 side2 9 >file$i || return 1
+	done &&
+	test_write_lines 1 2 3 4 5 6 7 8 side2 >file7 &&
+	printf "\0side2\n" >bin &&
+	test_write_lines 1 2 3 side2 >union &&
+	git commit -a -m side2 &&
+
+	test_must_fail git -c merge.threads=1 merge -s ort side1 \
+		>expect.out 2>expect.err &&
+	git ls-files -s >expect.index &&
+	git diff >expect.diff &&
+	git reset --hard
+'
+
+test_expect_success 'merging on threads gives the same result' '
+	test_must_fail git -c merge.threads=4 merge -s ort side1 \
+		>actual.out 2>actual.err &&
+	git ls-files -s >actual.index &&
+	git diff >actual.diff &&
+	test_cmp expect.out actual.out &&
+	test_cmp expect.err actual.err &&
+	test_cmp expect.index actual.index &&
+	test_cmp expect.diff actual.diff &&
+	grep "^++<<<<<<< HEAD" actual.diff &&
+	test_write_lines 1 2 3 side2 side1 >expect.union &&
+	test_cmp expect.union union &&
+	git reset --hard
+'
+
+test_expect_success 'merge.threads controls the number of threads' '
+	test_must_fail env GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c merge.threads=3 merge -s ort side1 &&
+	grep "content-merge/threads:3" trace.perf &&
+	git reset --hard &&
+
+	rm -f trace.perf &&
+	test_must_fail env GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c merge.threads=1 merge -s ort side1 &&
+	! grep "content-merge/threads" trace.perf &&
+	git reset --hard
+'
+
+test_expect_success 'negative merge.threads is an error' '
+	test_must_fail git -c merge.threads=-1 merge -s ort side1 2>err &&
+	test_i18ngrep "invalid number of threads" err
+'
+
+test_done
@@ -119,6 +119,48 @@ test_expect_success 'auto gc with too many loose objects does not attempt to cre
 	test_line_count = 1 new # There is one new pack
 '
 
+test_expect_success 'auto gc with gc.autoGeometric rolls up only small packs' '
+	git init geometric &&
+	test_when_finished "rm -rf geometric" &&
+	(
+		cd geometric &&
+		git config gc.autoGeometric 2 &&
+		git config gc.autoDetach false &&
+
+		test_commit_bulk --start=1 8 && # 24 objects
+		large=$(ls .git/objects/pack/pack-*.pack) &&
+		test_commit_bulk --start=9 1 && # 3 objects
+
+		# (3, 24) is a progression; nothing to do
+		ls .git/objects/pack/pack-*.pack | sort >before &&
+		git gc --auto &&
+		ls .git/objects/pack/pack-*.pack | sort >after &&
+		test_cmp before after &&
+
+		test_commit_bulk --start=10 1 && # 3 objects
+
+		# repack would not roll up more than 2 objects, so neither
+		# does gc start it
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git -c repack.geometricMaxObjects=2 gc --auto &&
+		! grep "\"repack\"" trace &&
+
+		# neither counts kept packs, even when writing bitmaps
+		small=$(ls .git/objects/pack/pack-*.pack | grep -v "$large" |
+			head -n 1) &&
+		touch "${small%.pack}.keep" &&
+		GIT_TRACE2_EVENT="$(pwd)/trace-keep" \
+			git -c repack.writeBitmaps=true gc --auto &&
+		! grep "\"repack\"" trace-keep &&
+		rm "${small%.pack}.keep" &&
+
+		git gc --auto &&
+		ls .git/objects/pack/pack-*.pack >after &&
+		test_line_count = 2 after &&
+		test_path_is_file "$large"
+	)
+'
+
 test_expect_success 'gc --no-quiet' '
 	GIT_PROGRESS_DELAY=0 git -c gc.writeCommitGraph=true gc --no-quiet >stdout 2>stderr &&
 	test_must_be_empty stdout &&
@@ -158,6 +200,21 @@ test_expect_success 'one of gc.reflogExpire{Unreachable,}=never does not skip "e
 	grep -E "^trace: (built-in|exec|run_command): git reflog expire --" trace.out
 '
 
+test_expect_success 'gc packs refs without spawning pack-refs' '
+	git update-ref refs/heads/in-process HEAD &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git gc &&
+	test_path_is_missing .git/refs/heads/in-process &&
+	grep "\"label\":\"in_process\",\"msg\":\"pack-refs\"" trace.event &&
+	! grep "\"child_start\".*\"pack-refs\"" trace.event &&
+
+	rm trace.event &&
+	git update-ref refs/heads/in-process HEAD &&
+	GIT_TEST_IN_PROCESS_BUILTINS=0 GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git gc &&
+	test_path_is_missing .git/refs/heads/in-process &&
+	grep "\"child_start\".*\"pack-refs\"" trace.event
+'
+
 run_and_wait_for_auto_gc () {
 	# We read stdout from gc for the side effect of waiting until the
 	# background gc process exits, closing its fd 9.  Furthermore, the
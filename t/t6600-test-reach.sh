@@ -58,6 +58,13 @@ test_expect_success 'setup' '
 	git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
 	mv .git/objects/info/commit-graph commit-graph-no-gdat &&
 	chmod u+w commit-graph-no-gdat &&
+	git commit-graph write --reachable --reachability-index &&
+	mv .git/objects/info/commit-graph commit-graph-reach &&
+	chmod u+w commit-graph-reach &&
+	git show-ref -s commit-5-5 |
+		git commit-graph write --stdin-commits --reachability-index &&
+	mv .git/objects/info/commit-graph commit-graph-half-reach &&
+	chmod u+w commit-graph-half-reach &&
 	git config core.commitGraph true
 '
 
@@ -73,6 +80,12 @@ run_all_modes () {
 	test_cmp expect actual &&
 	cp commit-graph-no-gdat .git/objects/info/commit-graph &&
 	"$@" <input >actual &&
+	test_cmp expect actual &&
+	cp commit-graph-reach .git/objects/info/commit-graph &&
+	"$@" <input >actual &&
+	test_cmp expect actual &&
+	cp commit-graph-half-reach .git/objects/info/commit-graph &&
+	"$@" <input >actual &&
 	test_cmp expect actual
 }
 
@@ -443,4 +456,70 @@ test_expect_success 'get_reachable_subset:none' '
 	test_all_modes get_reachable_subset
 '
 
+test_expect_success 'reachability index agrees with walking' '
+	test_when_finished rm -rf .git/objects/info/commit-graph &&
+	cp commit-graph-reach .git/objects/info/commit-graph &&
+	git commit-graph verify &&
+	for c in commit-1-1 commit-3-7 commit-5-5 commit-10-2 commit-9-9
+	do
+		git -c core.commitGraph=false tag --contains $c >expect &&
+		git tag --contains $c >actual &&
+		test_cmp expect actual &&
+		git -c core.commitGraph=false branch --merged $c >expect &&
+		git branch --merged $c >actual &&
+		test_cmp expect actual &&
+		git -c core.commitGraph=false branch --no-merged $c >expect &&
+		git branch --no-merged $c >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'for-each-ref ahead-behind:linear' '
+	cat >expect <<-\EOF &&
+	commit-1-1 0 2
+	commit-1-3 0 0
+	commit-1-5 2 0
+	commit-1-8 5 0
+	EOF
+	run_all_modes git for-each-ref \
+		--format="%(refname:short) %(ahead-behind:commit-1-3)" \
+		refs/heads/commit-1-1 refs/heads/commit-1-3 \
+		refs/heads/commit-1-5 refs/heads/commit-1-8
+'
+
+test_expect_success 'for-each-ref ahead-behind:grid with two bases' '
+	cat >expect <<-\EOF &&
+	commit-2-4 0 17 6 7
+	commit-4-2 0 17 4 5
+	commit-4-4 0 9 12 5
+	commit-6-4 4 5 18 3
+	commit-9-9 56 0 72 0
+	tag-6-4 4 5 18 3
+	EOF
+	run_all_modes git for-each-ref \
+		--format="%(refname:short) %(ahead-behind:commit-5-5) %(ahead-behind:commit-9-1)" \
+		refs/heads/commit-2-4 refs/heads/commit-4-2 \
+		refs/heads/commit-4-4 refs/heads/commit-6-4 \
+		refs/heads/commit-9-9 refs/tags/tag-6-4
+'
+
+test_expect_success 'for-each-ref ahead-behind agrees with rev-list' '
+	git for-each-ref --format="%(refname)" refs/heads >refs &&
+	while read ref
+	do
+		echo "$ref $(git rev-list --count commit-7-3..$ref) $(git rev-list --count $ref..commit-7-3)" ||
+		return 1
+	done <refs >expect &&
+	run_all_modes git for-each-ref \
+		--format="%(refname) %(ahead-behind:commit-7-3)" refs/heads
+'
+
+test_expect_success 'for-each-ref ahead-behind: bad base' '
+	test_must_fail git for-each-ref \
+		--format="%(ahead-behind:no-such-commit)" 2>err &&
+	test_i18ngrep "failed to find" err &&
+	test_must_fail git for-each-ref --format="%(ahead-behind)" 2>err &&
+	test_i18ngrep "expected format" err
+'
+
 test_done
@@ -788,6 +788,33 @@ test_expect_success 'traverse into directories that may have ignored entries' '
 	)
 '
 
+test_expect_success 'clean with threads reports paths in order' '
+	test_create_repo clean-threads &&
+	(
+		cd clean-threads &&
+		test_commit tracked &&
+		for d in a b c d e
+		do
+			mkdir -p $d/sub $d/repo &&
+			>$d/file &&
+			>$d/sub/file &&
+			git init -q $d/repo &&
+			>top-$d || return 1
+		done &&
+		git -c clean.threads=1 clean -n -d >../expect &&
+		git -c clean.threads=4 clean -n -d >../actual &&
+		test_cmp ../expect ../actual &&
+		git -c clean.threads=4 clean -f -d >../actual &&
+		sed "s/^Would remove/Removing/;s/^Would skip/Skipping/" \
+			../expect >../expect.removed &&
+		test_cmp ../expect.removed ../actual &&
+		git status --porcelain >../status &&
+		test_line_count = 5 ../status &&
+		test_path_is_missing a/file &&
+		test_path_is_dir e/repo/.git
+	)
+'
+
 test_expect_success MINGW 'clean does not traverse mount points' '
 	mkdir target &&
 	>target/dont-clean-me &&
@@ -409,4 +409,27 @@ test_expect_success 'status with added file in nested submodule (short)' '
 	EOF
 '
 
+test_expect_success 'submodule.diffJobs gives the same status' '
+	for jobs in 0 1 2 8
+	do
+		git -C super -c submodule.diffJobs=$jobs \
+			status --porcelain=2 >output.$jobs &&
+		git -C super -c submodule.diffJobs=$jobs \
+			diff --stat >stat.$jobs || return 1
+	done &&
+	for jobs in 0 2 8
+	do
+		test_cmp output.1 output.$jobs &&
+		test_cmp stat.1 stat.$jobs || return 1
+	done
+'
+
+test_expect_success 'submodule.diffJobs looks at submodules in parallel' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C super -c submodule.diffJobs=2 status --porcelain &&
+	grep "\"category\":\"diff\",\"label\":\"submodule-status\"" trace &&
+	test_must_fail git -C super -c submodule.diffJobs=-1 status 2>err &&
+	test_i18ngrep "negative values not allowed" err
+'
+
 test_done
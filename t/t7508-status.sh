@@ -1667,4 +1667,23 @@ test_expect_success '--no-optional-locks prevents index update' '
 	! grep ^1234567890 out
 '
 
+test_expect_success 'status reads tracked directories ahead in parallel' '
+	test_when_finished "rm -rf readahead" &&
+	mkdir -p readahead/a/b readahead/c &&
+	>readahead/a/tracked &&
+	>readahead/a/b/tracked &&
+	>readahead/c/tracked &&
+	git add readahead &&
+	>readahead/a/untracked &&
+	>readahead/a/b/untracked &&
+	mkdir readahead/d &&
+	>readahead/d/untracked &&
+	git -c core.preloadIndex=false status --porcelain -uall readahead >expect &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" GIT_TEST_PRELOAD_INDEX=1 \
+		git status --porcelain -uall readahead >actual &&
+	test_cmp expect actual &&
+	grep "readahead/directories:" trace.perf &&
+	git rm -r --cached -q readahead
+'
+
 test_done
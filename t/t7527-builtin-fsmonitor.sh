@@ -484,6 +484,49 @@ test_expect_success 'cleanup worktrees' '
 	kill_repo wt-base
 '
 
+test_expect_success 'untracked cache is shared through the daemon' '
+	test_when_finished "kill_repo test_uc" &&
+
+	git init test_uc &&
+	mkdir test_uc/dir1 test_uc/dir2 &&
+	>test_uc/dir1/tracked &&
+	>test_uc/dir1/untracked &&
+	>test_uc/dir2/untracked &&
+	git -C test_uc add dir1/tracked &&
+	git -C test_uc commit -m initial &&
+
+	git -C test_uc config core.useBuiltinFSMonitor true &&
+	git -C test_uc config core.untrackedCache true &&
+	git -C test_uc config core.fsmonitorUntrackedCache true &&
+	start_daemon test_uc &&
+	git -C test_uc status --porcelain -uall >actual &&
+
+	# Drop the untracked cache from the index, like a tool that
+	# rewrites it without one would, and change the worktree.
+	git -C test_uc -c core.untrackedCache=false \
+		update-index --no-untracked-cache &&
+	>test_uc/dir2/new &&
+	rm test_uc/dir1/untracked &&
+
+	GIT_TRACE_FSMONITOR="$PWD/trace_uc" \
+		git -C test_uc status --porcelain -uall >actual &&
+	grep "restored untracked cache" trace_uc &&
+	cat >expect <<-\EOF &&
+	?? dir2/new
+	?? dir2/untracked
+	EOF
+	test_cmp expect actual &&
+
+	# Without the daemon state, we start from scratch.
+	git -C test_uc -c core.untrackedCache=false \
+		update-index --no-untracked-cache &&
+	test-tool -C test_uc fsmonitor-client flush &&
+	GIT_TRACE_FSMONITOR="$PWD/trace_uc_flushed" \
+		git -C test_uc status --porcelain -uall >actual &&
+	! grep "restored untracked cache" trace_uc_flushed &&
+	test_cmp expect actual
+'
+
 # The next few tests perform arbitrary/contrived file operations and
 # confirm that status is correct.  That is, that the data (or lack of
 # data) from fsmonitor doesn't cause incorrect results.  And doesn't
@@ -0,0 +1,130 @@
+#!/bin/sh
+
+test_description='query--daemon answers like the plumbing it stands in for'
+
+. ./test-lib.sh
+
+test-tool simple-ipc SUPPORTS_SIMPLE_IPC || {
+	skip_all='simple IPC not supported on this platform'
+	test_done
+}
+
+stop_daemon () {
+	git query--daemon stop >/dev/null 2>&1
+	return 0
+}
+
+test_expect_success 'setup' '
+	cat >.git/info/exclude <<-\EOF &&
+	actual
+	err
+	expect
+	objects
+	EOF
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated one
+'
+
+test_expect_success 'start and stop' '
+	test_when_finished stop_daemon &&
+	git query--daemon start &&
+	git query--daemon status &&
+	test_must_fail git query--daemon start &&
+	git query--daemon stop &&
+	test_must_fail git query--daemon status
+'
+
+test_expect_success 'send needs a running daemon' '
+	test_must_fail git query--daemon send rev-parse HEAD 2>err &&
+	test_i18ngrep "not running" err
+'
+
+test_expect_success 'start the daemon' '
+	test_atexit stop_daemon &&
+	git query--daemon start
+'
+
+test_expect_success 'capabilities' '
+	git query--daemon send capabilities >actual &&
+	grep "^version 1$" actual &&
+	grep "^command status$" actual
+'
+
+test_expect_success 'unknown commands are an error' '
+	test_must_fail git query--daemon send no-such-command 2>err &&
+	test_i18ngrep "unknown command" err
+'
+
+test_expect_success 'rev-parse' '
+	git rev-parse HEAD one^{tree} two:two.t >expect &&
+	git query--daemon send rev-parse HEAD one^{tree} two:two.t >actual &&
+	test_cmp expect actual &&
+	test_must_fail git query--daemon send rev-parse no-such-rev
+'
+
+test_expect_success 'for-each-ref' '
+	git for-each-ref >expect &&
+	git query--daemon send for-each-ref >actual &&
+	test_cmp expect actual &&
+
+	git for-each-ref refs/tags "refs/heads/m*" >expect &&
+	git query--daemon send for-each-ref refs/tags "refs/heads/m*" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cat-file and object-info' '
+	cat >objects <<-\EOF &&
+	HEAD
+	annotated
+	two:two.t
+	no-such-object
+	EOF
+	git cat-file --batch <objects >expect &&
+	git query--daemon send cat-file $(cat objects) >actual &&
+	test_cmp expect actual &&
+
+	git cat-file --batch-check <objects >expect &&
+	git query--daemon send object-info $(cat objects) >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'status' '
+	echo changed >one.t &&
+	echo staged >two.t &&
+	git add two.t &&
+	echo new >"with space" &&
+	git rm -q --cached one.t &&
+	git status --porcelain --branch --no-renames >expect &&
+	git query--daemon send status >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'answers follow changes made by others' '
+	git add . &&
+	git commit -m three &&
+	git branch new-branch &&
+	git status --porcelain --branch --no-renames >expect &&
+	git query--daemon send status >actual &&
+	test_cmp expect actual &&
+
+	git for-each-ref >expect &&
+	git query--daemon send for-each-ref >actual &&
+	test_cmp expect actual &&
+
+	git repack -a -d -q &&
+	git rev-parse HEAD:one.t >expect &&
+	git query--daemon send object-info HEAD:one.t >actual &&
+	grep "^$(cat expect) blob" actual
+'
+
+test_expect_success 'answers follow packed and deleted refs' '
+	git pack-refs --all &&
+	git branch -D new-branch &&
+	git update-ref refs/heads/loose HEAD &&
+	git for-each-ref >expect &&
+	git query--daemon send for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_done
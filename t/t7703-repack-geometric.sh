@@ -180,4 +180,89 @@ test_expect_success '--geometric ignores kept packs' '
 	)
 '
 
+test_expect_success '--geometric leaves cruft packs alone' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		test_commit_bulk --start=1 4 && # 12 objects
+		echo unreachable | git hash-object -w --stdin &&
+		git repack --cruft -d &&
+		cruft=$(ls $objdir/pack/pack-*.mtimes) &&
+		test_path_is_file "${cruft%.mtimes}.pack" &&
+		cp "$cruft" mtimes.before &&
+
+		test_commit_bulk --start=5 1 && # 3 objects
+		git repack -d &&
+		test_commit_bulk --start=6 1 && # 3 objects
+		git repack -d &&
+		find $objdir/pack -name "*.pack" >before &&
+		test_line_count = 4 before &&
+
+		git repack --geometric 2 -d &&
+		find $objdir/pack -name "*.pack" >after &&
+		test_line_count = 3 after &&
+		test_path_is_file "${cruft%.mtimes}.pack" &&
+		test_cmp_bin mtimes.before "$cruft"
+	)
+'
+
+test_expect_success '--geometric-max-objects bounds the rollup' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		test_commit_bulk --start=1 1 && # 3 objects
+		test_commit_bulk --start=2 1 && # 3 objects
+		test_commit_bulk --start=3 1 && # 3 objects
+		test_commit_bulk --start=4 1 && # 3 objects
+
+		find $objdir/pack -name "*.pack" | sort >before &&
+		git repack --geometric 2 --geometric-max-objects=7 -d &&
+		find $objdir/pack -name "*.pack" | sort >after &&
+
+		# Only the two smallest packs fit; the other two are
+		# left for a later run.
+		comm -13 before after >new &&
+		comm -23 before after >removed &&
+		test_line_count = 1 new &&
+		test_line_count = 2 removed &&
+		git show-index <$(sed "s/pack$/idx/" new) >objects &&
+		test_line_count = 6 objects &&
+
+		git -c repack.geometricMaxObjects=6 repack --geometric 2 -d &&
+		find $objdir/pack -name "*.pack" >after &&
+		test_line_count = 2 after &&
+
+		# Two packs of six objects fit no more.
+		git repack --geometric 2 --geometric-max-objects=6 -d &&
+		find $objdir/pack -name "*.pack" >again &&
+		test_cmp after again
+	)
+'
+
+test_expect_success '--geometric rewrites the multi-pack-index' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		test_commit_bulk --start=1 1 && # 3 objects
+		test_commit_bulk --start=2 1 && # 3 objects
+		test_commit_bulk --start=3 4 && # 12 objects
+		git multi-pack-index write &&
+		test_path_is_file $midx &&
+
+		git repack --geometric 2 -d &&
+		test_path_is_file $midx &&
+		git multi-pack-index verify &&
+		test-tool read-midx $objdir | grep "^pack-" >midx-packs &&
+		find $objdir/pack -name "*.idx" >packs &&
+		test_line_count = 2 packs &&
+		test_line_count = 2 midx-packs
+	)
+'
+
 test_done
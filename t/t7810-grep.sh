@@ -581,6 +581,29 @@ test_expect_success 'grep ( -e A --or -e B ) --and -e B' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep -e A -e B skips to interleaved hits' '
+	test_when_finished "rm -f interleaved" &&
+	test_write_lines a1 x x b1 x a2 b2 x x x x a3 x >interleaved &&
+	cat >expected <<-\EOF &&
+	interleaved:1:a1
+	interleaved-2-x
+	--
+	interleaved:4:b1
+	interleaved-5-x
+	interleaved:6:a2
+	interleaved:7:b2
+	interleaved-8-x
+	--
+	interleaved:12:a3
+	interleaved-13-x
+	EOF
+	git grep --no-index -n -A1 -e a -e b interleaved >actual &&
+	test_cmp expected actual &&
+	echo interleaved:2 >expected &&
+	git grep --no-index -c -e a1 --or -e 2 --and -e b interleaved >actual &&
+	test_cmp expected actual
+'
+
 cat >expected <<EOF
 file:foo mmap bar
 EOF
@@ -1740,4 +1763,57 @@ test_expect_success 'grep does not report i-t-a and assume unchanged with -L' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep searches a blob without hits only once' '
+	git grep -n -e mmap HEAD >one &&
+	cat one one >expected &&
+	for threads in 1 2
+	do
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git grep --threads=$threads -n -e mmap HEAD HEAD >actual &&
+		test_cmp expected actual &&
+		grep "\"key\":\"blobs/skipped-seen\"" trace.event &&
+		rm trace.event || return 1
+	done &&
+	git grep -L -e mmap HEAD >one &&
+	cat one one >expected &&
+	git grep -L -e mmap HEAD HEAD >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep.trigramIndex skips blobs without changing results' '
+	test_when_finished "rm -f .git/objects/info/grep-trigrams" &&
+	git maintenance run --task=grep-trigrams &&
+	test_path_is_file .git/objects/info/grep-trigrams &&
+	for args in "mmap" "-i MMAP" "-F foo_mmap" "-E (foo|bar)_mmap" \
+		"-e foo --and -e bar" "-e foo --and --not -e bar_mmap" \
+		"-w mmap" "-c mmap" "-l with"
+	do
+		git grep -n $args HEAD >expected &&
+		git -c grep.trigramIndex=true grep -n $args HEAD >actual &&
+		test_cmp expected actual &&
+		git grep -n --cached $args >expected &&
+		git -c grep.trigramIndex=true grep -n --cached $args >actual &&
+		test_cmp expected actual || return 1
+	done &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c grep.trigramIndex=true grep --cached foo_mmap &&
+	grep "\"key\":\"trigrams/skipped\",\"value\":\"[1-9]" trace.event
+'
+
+test_expect_success 'grep.trigramIndex searches blobs it does not know' '
+	test_when_finished "rm -f .git/objects/info/grep-trigrams" &&
+	git maintenance run --task=grep-trigrams &&
+	echo "not indexed yet" >not-indexed &&
+	git add not-indexed &&
+	test_when_finished "git rm -f not-indexed" &&
+	echo "not-indexed:not indexed yet" >expected &&
+	git -c grep.trigramIndex=true grep --cached "indexed yet" >actual &&
+	test_cmp expected actual &&
+	echo garbage garbage garbage >.git/objects/info/grep-trigrams &&
+	git -c grep.trigramIndex=true grep --cached "indexed yet" \
+		>actual 2>err &&
+	test_cmp expected actual &&
+	test_i18ngrep "ignoring malformed grep trigram index" err
+'
+
 test_done
@@ -79,6 +79,22 @@ test_expect_success 'run --task=<task>' '
 	test_subcommand git commit-graph write --split --reachable --no-progress <run-both.txt
 '
 
+test_expect_success 'run --time-budget resumes pending tasks first' '
+	test_when_finished "rm -f .git/maintenance-pending" &&
+	test_config maintenance.gc.enabled true &&
+	test_config maintenance.commit-graph.enabled true &&
+	echo commit-graph >.git/maintenance-pending &&
+	GIT_TRACE2_EVENT="$(pwd)/run-budget.txt" \
+		git maintenance run --time-budget=600 2>/dev/null &&
+	grep "\"event\":\"region_enter\".*\"category\":\"maintenance\"" \
+		run-budget.txt >regions &&
+	sed -e "s/.*\"label\":\"\([^\"]*\)\".*/\1/" regions >actual &&
+	test_write_lines commit-graph gc >expect &&
+	test_cmp expect actual &&
+	grep "\"key\":\"elapsed-ms\"" run-budget.txt &&
+	test_path_is_missing .git/maintenance-pending
+'
+
 test_expect_success 'core.commitGraph=false prevents write process' '
 	GIT_TRACE2_EVENT="$(pwd)/no-commit-graph.txt" \
 		git -c core.commitGraph=false maintenance run \
@@ -361,6 +377,19 @@ test_expect_success 'pack-refs task' '
 	test_subcommand git pack-refs --all --prune <pack-refs.txt
 '
 
+test_expect_success 'a failing pack-refs task does not stop later tasks' '
+	git branch -f to-pack/1 HEAD &&
+	test_when_finished "rm -f .git/packed-refs.lock" &&
+	>.git/packed-refs.lock &&
+	test_must_fail env GIT_TRACE2_EVENT="$(pwd)/pack-refs-fail.txt" \
+		git -c core.packedRefsTimeout=0 maintenance run \
+		--task=pack-refs --task=commit-graph 2>err &&
+	test_i18ngrep "packed-refs.lock" err &&
+	test_subcommand git pack-refs --all --prune <pack-refs-fail.txt &&
+	test_subcommand git commit-graph write --split --reachable \
+		--no-progress <pack-refs-fail.txt
+'
+
 test_expect_success '--auto and --schedule incompatible' '
 	test_must_fail git maintenance run --auto --schedule=daily 2>err &&
 	test_i18ngrep "at most one" err
@@ -638,6 +667,21 @@ test_expect_success 'fails when running outside of a repository' '
 	nongit test_must_fail git maintenance unregister
 '
 
+test_expect_success 'daemon runs maintenance where there was activity' '
+	test_when_finished "git config --global --unset-all maintenance.repo" &&
+	git init daemon-1 &&
+	git init daemon-2 &&
+	test_commit -C daemon-1 one &&
+	git -C daemon-1 maintenance register &&
+	git -C daemon-2 maintenance register &&
+	nongit env GIT_TRACE2_EVENT="$(pwd)/daemon.txt" \
+		git maintenance daemon --interval=0 --scans=2 &&
+	grep "\"event\":\"child_start\".*daemon-[12]\",\"maintenance\",\"run\"" \
+		daemon.txt >runs &&
+	test_line_count = 2 runs &&
+	grep "\"key\":\"active\",\"value\":\"0\"" daemon.txt
+'
+
 test_expect_success 'register and unregister bare repo' '
 	test_when_finished "git config --global --unset-all maintenance.repo || :" &&
 	test_might_fail git config --global --unset-all maintenance.repo &&
@@ -322,4 +322,69 @@ test_expect_success 'blame does not coalesce non-adjacent result lines' '
 	test_cmp expect actual
 '
 
+test_expect_success 'blame -C -C gives the same result with threads' '
+	for i in 1 2 3 4 5 6
+	do
+		test_write_lines "$i one" "$i two" "$i three" >copy-src-$i || return 1
+	done &&
+	git add copy-src-* &&
+	git commit -m "copy sources" &&
+	cat copy-src-5 copy-src-2 copy-src-6 >copied &&
+	echo new >>copied &&
+	git add copied &&
+	git commit -m "copied" &&
+	git -c blame.threads=1 blame -f -C -C1 HEAD -- copied >expect &&
+	grep "^[^ ]* *copy-src-5" expect &&
+	git -c blame.threads=4 blame -f -C -C1 HEAD -- copied >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'setup history for blame.cache' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >cached &&
+	git add cached &&
+	git commit -m "cached 1" &&
+	test_write_lines 1 2 three 4 5 6 7 8 9 >cached &&
+	git commit -a -m "cached 2" &&
+	git mv cached cached-moved &&
+	test_write_lines 0 1 2 three 4 5 6 7 eight 9 >cached-moved &&
+	git commit -a -m "cached 3" &&
+	test_write_lines 0 1 2 three 4 6 7 eight 9 10 >cached-moved &&
+	git commit -a -m "cached 4"
+'
+
+test_expect_success 'blame.cache starts from the blame of an ancestor' '
+	test_when_finished "rm -f .git/objects/info/blame-cache" &&
+	git blame --porcelain HEAD cached-moved >expect &&
+	git -c blame.cache=true blame HEAD^ cached-moved >/dev/null &&
+	test_path_is_file .git/objects/info/blame-cache &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c blame.cache=true blame --porcelain HEAD cached-moved >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache/hits\",\"value\":\"1\"" trace.event &&
+	git blame -L2,4 --porcelain HEAD cached-moved >expect &&
+	git -c blame.cache=true blame -L2,4 --porcelain HEAD cached-moved >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blame.cache is not used with -C' '
+	test_when_finished "rm -f .git/objects/info/blame-cache" &&
+	git -c blame.cache=true blame HEAD^ cached-moved >/dev/null &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c blame.cache=true blame -C HEAD cached-moved >/dev/null &&
+	grep "\"key\":\"cache/hits\",\"value\":\"0\"" trace.event
+'
+
+test_expect_success 'blame.cache ignores a malformed cache' '
+	test_when_finished "rm -f .git/objects/info/blame-cache" &&
+	git blame HEAD cached-moved >expect &&
+	echo garbage garbage garbage >.git/objects/info/blame-cache &&
+	git -c blame.cache=true blame HEAD cached-moved >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "ignoring malformed blame cache" err &&
+	git -c blame.cache=true blame HEAD cached-moved >actual 2>err &&
+	test_cmp expect actual &&
+	test_must_be_empty err
+'
+
 test_done
@@ -3534,4 +3534,31 @@ test_expect_success 'Y: rewrite submodules' '
 	)
 '
 
+###
+### series Z (pack.threads)
+###
+
+test_expect_success 'Z: the pack does not depend on pack.threads' '
+	for i in $(test_seq 200)
+	do
+		test-tool genrandom $(($i / 2)) 20000 >blob &&
+		echo $i >>blob &&
+		echo blob &&
+		echo "data $(wc -c <blob)" &&
+		cat blob || return 1
+	done >Z-input &&
+	for threads in 1 4
+	do
+		rm -rf Z-$threads &&
+		git init Z-$threads &&
+		git -C Z-$threads -c pack.threads=$threads \
+			-c fastimport.unpackLimit=0 \
+			fast-import --max-pack-size=1m <Z-input &&
+		ls Z-$threads/.git/objects/pack >Z-packs-$threads &&
+		git -C Z-$threads fsck || return 1
+	done &&
+	test_line_count -gt 2 Z-packs-1 &&
+	test_cmp Z-packs-1 Z-packs-4
+'
+
 test_done
@@ -219,6 +219,28 @@ test_expect_success 'import/export-marks' '
 
 '
 
+test_expect_success 'import/export-marks in binary format' '
+	git fast-export --no-data --export-marks=text-marks marks~1 &&
+	git fast-export --no-data --marks-format=binary \
+		--export-marks=binary-marks marks~1 &&
+	git fast-export --no-data --import-marks=text-marks \
+		--export-marks=text-marks marks >expect &&
+	git fast-export --no-data --import-marks=binary-marks \
+		--export-marks=converted-marks marks >actual &&
+	test_cmp expect actual &&
+	sort text-marks >expect &&
+	sort converted-marks >actual &&
+	test_cmp expect actual &&
+	git fast-export --import-marks=binary-marks marks >actual &&
+	test $(grep ^commit\  actual | wc -l) -eq 1
+'
+
+test_expect_success 'output does not depend on --threads' '
+	git fast-export --threads=1 main marks >expect &&
+	git fast-export --threads=4 main marks >actual &&
+	test_cmp expect actual
+'
+
 cat > signed-tag-import << EOF
 tag sign-your-name
 from $(git rev-parse HEAD)
@@ -452,6 +452,8 @@ export EDITOR
 
 GIT_DEFAULT_HASH="${GIT_TEST_DEFAULT_HASH:-sha1}"
 export GIT_DEFAULT_HASH
+GIT_DEFAULT_REF_FORMAT="${GIT_TEST_DEFAULT_REF_FORMAT:-files}"
+export GIT_DEFAULT_REF_FORMAT
 GIT_TEST_MERGE_ALGORITHM="${GIT_TEST_MERGE_ALGORITHM:-ort}"
 export GIT_TEST_MERGE_ALGORITHM
 
@@ -1691,6 +1693,13 @@ test_lazy_prereq SHA1 '
 	esac
 '
 
+# REFFILES is a test if the repositories use the "files" reference
+# backend, for tests that look at or manipulate the files under .git/refs
+# and .git/logs directly.
+test_lazy_prereq REFFILES '
+	test "$GIT_DEFAULT_REF_FORMAT" = files
+'
+
 test_lazy_prereq REBASE_P '
 	test -z "$GIT_TEST_SKIP_REBASE_P"
 '
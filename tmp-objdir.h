@@ -22,9 +22,10 @@
 struct tmp_objdir;
 
 /*
- * Create a new temporary object directory; returns NULL on failure.
+ * Create a new temporary object directory with the specified prefix;
+ * returns NULL on failure.
  */
-struct tmp_objdir *tmp_objdir_create(void);
+struct tmp_objdir *tmp_objdir_create(const char *prefix);
 
 /*
  * Return a list of environment strings, suitable for use with
@@ -51,4 +52,13 @@ int tmp_objdir_destroy(struct tmp_objdir *);
  */
 void tmp_objdir_add_as_alternate(const struct tmp_objdir *);
 
+/*
+ * Make the temporary object directory the primary object store of the
+ * current process, with the original one as its first alternate, so
+ * that newly written objects go there and are still readable.  The
+ * original primary is restored when the directory is migrated or
+ * destroyed.
+ */
+void tmp_objdir_replace_primary_odb(struct tmp_objdir *);
+
 #endif /* TMP_OBJDIR_H */
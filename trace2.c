@@ -8,11 +8,13 @@
 #include "version.h"
 #include "trace2/tr2_cfg.h"
 #include "trace2/tr2_cmd_name.h"
+#include "trace2/tr2_ctr.h"
 #include "trace2/tr2_dst.h"
 #include "trace2/tr2_sid.h"
 #include "trace2/tr2_sysenv.h"
 #include "trace2/tr2_tgt.h"
 #include "trace2/tr2_tls.h"
+#include "trace2/tr2_tmr.h"
 
 static int trace2_enabled;
 
@@ -31,6 +33,7 @@ static struct tr2_tgt *tr2_tgt_builtins[] =
 	&tr2_tgt_normal,
 	&tr2_tgt_perf,
 	&tr2_tgt_event,
+	&tr2_tgt_flame,
 	NULL
 };
 /* clang-format on */
@@ -85,6 +88,30 @@ static void tr2_tgt_disable_builtins(void)
 
 static int tr2main_exit_code;
 
+static void tr2_tgt_emit_a_timer(const struct tr2_timer_metadata *meta,
+				 const struct tr2_timer *timer,
+				 int is_final_data)
+{
+	struct tr2_tgt *tgt_j;
+	int j;
+
+	for_each_wanted_builtin (j, tgt_j)
+		if (tgt_j->pfn_timer)
+			tgt_j->pfn_timer(meta, timer, is_final_data);
+}
+
+static void tr2_tgt_emit_a_counter(const struct tr2_counter_metadata *meta,
+				   const struct tr2_counter *counter,
+				   int is_final_data)
+{
+	struct tr2_tgt *tgt_j;
+	int j;
+
+	for_each_wanted_builtin (j, tgt_j)
+		if (tgt_j->pfn_counter)
+			tgt_j->pfn_counter(meta, counter, is_final_data);
+}
+
 /*
  * Our atexit routine should run after everything has finished.
  *
@@ -110,6 +137,16 @@ static void tr2main_atexit_handler(void)
 	 */
 	tr2tls_pop_unwind_self();
 
+	/*
+	 * Add the main thread's timers and counters to the totals (the
+	 * other threads did so as they exited) and emit them before the
+	 * atexit message.
+	 */
+	tr2_update_final_timers(&tr2tls_get_self()->timer_block);
+	tr2_update_final_counters(&tr2tls_get_self()->counter_block);
+	tr2_emit_final_timers(tr2_tgt_emit_a_timer);
+	tr2_emit_final_counters(tr2_tgt_emit_a_counter);
+
 	for_each_wanted_builtin (j, tgt_j)
 		if (tgt_j->pfn_atexit)
 			tgt_j->pfn_atexit(us_elapsed_absolute,
@@ -465,6 +502,7 @@ void trace2_thread_start_fl(const char *file, int line, const char *thread_name)
 void trace2_thread_exit_fl(const char *file, int line)
 {
 	struct tr2_tgt *tgt_j;
+	struct tr2tls_thread_ctx *ctx;
 	int j;
 	uint64_t us_now;
 	uint64_t us_elapsed_absolute;
@@ -500,6 +538,17 @@ void trace2_thread_exit_fl(const char *file, int line)
 	tr2tls_pop_unwind_self();
 	us_elapsed_thread = tr2tls_region_elasped_self(us_now);
 
+	/*
+	 * Emit the thread's own timers and counters that want it, and
+	 * add them to the totals for the process.
+	 */
+	ctx = tr2tls_get_self();
+	tr2_emit_per_thread_timers(tr2_tgt_emit_a_timer, &ctx->timer_block);
+	tr2_emit_per_thread_counters(tr2_tgt_emit_a_counter,
+				     &ctx->counter_block);
+	tr2_update_final_timers(&ctx->timer_block);
+	tr2_update_final_counters(&ctx->counter_block);
+
 	for_each_wanted_builtin (j, tgt_j)
 		if (tgt_j->pfn_thread_exit_fl)
 			tgt_j->pfn_thread_exit_fl(file, line,
@@ -793,6 +842,39 @@ void trace2_printf(const char *fmt, ...)
 }
 #endif
 
+void trace2_timer_start(enum trace2_timer_id tid)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (tid < 0 || tid >= TRACE2_NUMBER_OF_TIMERS)
+		BUG("trace2_timer_start: invalid timer id: %d", tid);
+
+	tr2_start_timer(tid);
+}
+
+void trace2_timer_stop(enum trace2_timer_id tid)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (tid < 0 || tid >= TRACE2_NUMBER_OF_TIMERS)
+		BUG("trace2_timer_stop: invalid timer id: %d", tid);
+
+	tr2_stop_timer(tid);
+}
+
+void trace2_counter_add(enum trace2_counter_id cid, uint64_t value)
+{
+	if (!trace2_enabled)
+		return;
+
+	if (cid < 0 || cid >= TRACE2_NUMBER_OF_COUNTERS)
+		BUG("trace2_counter_add: invalid counter id: %d", cid);
+
+	tr2_counter_increment(cid, value);
+}
+
 const char *trace2_session_id(void)
 {
 	return tr2_sid_get();
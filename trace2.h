@@ -51,6 +51,8 @@ struct json_writer;
  * [] trace2_region*    -- emit region nesting messages.
  * [] trace2_data*      -- emit region/thread/repo data messages.
  * [] trace2_printf*    -- legacy trace[1] messages.
+ * [] trace2_timer*     -- stopwatch timers (messages at exit).
+ * [] trace2_counter*   -- global counters (messages at exit).
  */
 
 /*
@@ -480,6 +482,82 @@ void trace2_printf(const char *fmt, ...);
 /* clang-format on */
 #endif
 
+/*
+ * Stopwatch timers and counters.
+ *
+ * Code that is called many times (for example, for each object or
+ * each index entry) cannot afford to emit a message each time, so it
+ * accumulates into a timer or counter instead. These are kept in
+ * per-thread storage without locking, summed up as each thread exits
+ * and reported once, in a 'timer' or 'counter' event, when the process
+ * exits. Only timers and counters that were used are reported.
+ *
+ * Timers and counters are predefined in the enums below, and described
+ * (category, name, and whether to also report the values of each
+ * thread in 'th_timer' and 'th_counter' events as it exits) in the
+ * tables in trace2/tr2_tmr.c and trace2/tr2_ctr.c.
+ *
+ * When no target is enabled, starting and stopping a timer or adding
+ * to a counter returns right away.
+ */
+enum trace2_timer_id {
+	/*
+	 * Timers for the unit tests in t/helper/test-trace2.c.
+	 */
+	TRACE2_TIMER_ID_TEST1 = 0, /* emits summary event only */
+	TRACE2_TIMER_ID_TEST2,     /* emits summary and thread events */
+
+	TRACE2_TIMER_ID_PACK_WINDOW_MAP,
+	TRACE2_TIMER_ID_PACK_INFLATE,
+
+	/* Add additional timer definitions before here. */
+	TRACE2_NUMBER_OF_TIMERS
+};
+
+/*
+ * Start or stop the given timer in the current thread. A timer may be
+ * started again before it is stopped (for example, by a recursive
+ * function); only the outermost start and stop count as an interval.
+ */
+void trace2_timer_start(enum trace2_timer_id tid);
+void trace2_timer_stop(enum trace2_timer_id tid);
+
+enum trace2_counter_id {
+	/*
+	 * Counters for the unit tests in t/helper/test-trace2.c.
+	 */
+	TRACE2_COUNTER_ID_TEST1 = 0, /* emits summary event only */
+	TRACE2_COUNTER_ID_TEST2,     /* emits summary and thread events */
+
+	TRACE2_COUNTER_ID_BLOOM_FILTER_NOT_PRESENT,
+	TRACE2_COUNTER_ID_BLOOM_FILTER_MAYBE,
+	TRACE2_COUNTER_ID_BLOOM_FILTER_DEFINITELY_NOT,
+	TRACE2_COUNTER_ID_BLOOM_FILTER_FALSE_POSITIVE,
+
+	TRACE2_COUNTER_ID_PACK_WINDOW_MISS,
+	TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT,
+	TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISS,
+
+	TRACE2_COUNTER_ID_INDEX_LSTAT,
+
+	/* in the order of OBJ_COMMIT..OBJ_TAG in enum object_type */
+	TRACE2_COUNTER_ID_OBJECT_READ_COMMIT,
+	TRACE2_COUNTER_ID_OBJECT_READ_TREE,
+	TRACE2_COUNTER_ID_OBJECT_READ_BLOB,
+	TRACE2_COUNTER_ID_OBJECT_READ_TAG,
+
+	TRACE2_COUNTER_ID_TREE_CACHE_HIT,
+	TRACE2_COUNTER_ID_TREE_CACHE_MISS,
+
+	/* Add additional counter definitions before here. */
+	TRACE2_NUMBER_OF_COUNTERS
+};
+
+/*
+ * Add `value` to the given counter in the current thread.
+ */
+void trace2_counter_add(enum trace2_counter_id cid, uint64_t value);
+
 /*
  * Optional platform-specific code to dump information about the
  * current and any parent process(es).  This is intended to allow
@@ -0,0 +1,148 @@
+#include "cache.h"
+#include "thread-utils.h"
+#include "trace2/tr2_tgt.h"
+#include "trace2/tr2_tls.h"
+#include "trace2/tr2_ctr.h"
+
+/*
+ * A global counter block to aggregate values from the partial sums
+ * from each thread.
+ */
+static struct tr2_counter_block final_counter_block; /* access under tr2tls_mutex */
+
+/*
+ * Define metadata for each global counter.
+ *
+ * This array must match the "enum trace2_counter_id" and the values
+ * in "struct tr2_counter_block.counter[*]".
+ */
+static struct tr2_counter_metadata tr2_counter_metadata[TRACE2_NUMBER_OF_COUNTERS] = {
+	[TRACE2_COUNTER_ID_TEST1] = {
+		.category = "test",
+		.name = "test1",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_TEST2] = {
+		.category = "test",
+		.name = "test2",
+		.want_per_thread_events = 1,
+	},
+	[TRACE2_COUNTER_ID_BLOOM_FILTER_NOT_PRESENT] = {
+		.category = "bloom",
+		.name = "filter_not_present",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_BLOOM_FILTER_MAYBE] = {
+		.category = "bloom",
+		.name = "maybe",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_BLOOM_FILTER_DEFINITELY_NOT] = {
+		.category = "bloom",
+		.name = "definitely_not",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_BLOOM_FILTER_FALSE_POSITIVE] = {
+		.category = "bloom",
+		.name = "false_positive",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_PACK_WINDOW_MISS] = {
+		.category = "pack",
+		.name = "window_miss",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT] = {
+		.category = "pack",
+		.name = "delta_base_cache_hit",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISS] = {
+		.category = "pack",
+		.name = "delta_base_cache_miss",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_INDEX_LSTAT] = {
+		.category = "index",
+		.name = "lstat",
+		.want_per_thread_events = 1,
+	},
+	[TRACE2_COUNTER_ID_OBJECT_READ_COMMIT] = {
+		.category = "object",
+		.name = "read_commit",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_OBJECT_READ_TREE] = {
+		.category = "object",
+		.name = "read_tree",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_OBJECT_READ_BLOB] = {
+		.category = "object",
+		.name = "read_blob",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_OBJECT_READ_TAG] = {
+		.category = "object",
+		.name = "read_tag",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_TREE_CACHE_HIT] = {
+		.category = "object",
+		.name = "tree_cache_hit",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_TREE_CACHE_MISS] = {
+		.category = "object",
+		.name = "tree_cache_miss",
+		.want_per_thread_events = 0,
+	},
+
+	/* Add additional metadata before here. */
+};
+
+void tr2_counter_increment(enum trace2_counter_id cid, uint64_t value)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	struct tr2_counter *c = &ctx->counter_block.counter[cid];
+
+	c->value += value;
+}
+
+void tr2_update_final_counters(const struct tr2_counter_block *block)
+{
+	enum trace2_counter_id cid;
+
+	tr2tls_lock();
+	for (cid = 0; cid < TRACE2_NUMBER_OF_COUNTERS; cid++)
+		final_counter_block.counter[cid].value +=
+			block->counter[cid].value;
+	tr2tls_unlock();
+}
+
+void tr2_emit_per_thread_counters(tr2_tgt_evt_counter_t *fn_apply,
+				  const struct tr2_counter_block *block)
+{
+	enum trace2_counter_id cid;
+
+	for (cid = 0; cid < TRACE2_NUMBER_OF_COUNTERS; cid++) {
+		const struct tr2_counter *c = &block->counter[cid];
+		const struct tr2_counter_metadata *md = &tr2_counter_metadata[cid];
+
+		if (md->want_per_thread_events && c->value)
+			fn_apply(md, c, 0);
+	}
+}
+
+void tr2_emit_final_counters(tr2_tgt_evt_counter_t *fn_apply)
+{
+	enum trace2_counter_id cid;
+
+	for (cid = 0; cid < TRACE2_NUMBER_OF_COUNTERS; cid++) {
+		const struct tr2_counter *c = &final_counter_block.counter[cid];
+		const struct tr2_counter_metadata *md = &tr2_counter_metadata[cid];
+
+		if (c->value)
+			fn_apply(md, c, 1);
+	}
+}
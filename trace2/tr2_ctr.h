@@ -0,0 +1,63 @@
+#ifndef TR2_CTR_H
+#define TR2_CTR_H
+
+#include "trace2.h"
+#include "trace2/tr2_tgt.h"
+
+/*
+ * Define a mechanism to allow global "counters".
+ *
+ * Counters can be used to count interesting activity that does not fit
+ * the "region and data" model, such as code called from many different
+ * regions and/or where you want to count a number of items, but don't
+ * have control of when the data would be emitted (such as when the
+ * thread or process exits).
+ *
+ * Counters are accumulated per-thread without locking, added to the
+ * process-wide totals as each thread exits, and emitted to the Trace2
+ * logs at program exit.
+ */
+
+struct tr2_counter_metadata {
+	const char *category;
+	const char *name;
+
+	/*
+	 * True if we should emit per-thread events for this counter
+	 * when individual threads exit.
+	 */
+	unsigned int want_per_thread_events:1;
+};
+
+struct tr2_counter {
+	uint64_t value;
+};
+
+struct tr2_counter_block {
+	struct tr2_counter counter[TRACE2_NUMBER_OF_COUNTERS];
+};
+
+/*
+ * Private routine used by trace2.c to increment a counter for the
+ * current thread.
+ */
+void tr2_counter_increment(enum trace2_counter_id cid, uint64_t value);
+
+/*
+ * Add the counters of an exiting thread to the process-wide totals.
+ */
+void tr2_update_final_counters(const struct tr2_counter_block *block);
+
+/*
+ * Call `fn_apply` for each counter of `block` that was used and wants
+ * per-thread events.
+ */
+void tr2_emit_per_thread_counters(tr2_tgt_evt_counter_t *fn_apply,
+				  const struct tr2_counter_block *block);
+
+/*
+ * Call `fn_apply` for each process-wide counter that was used.
+ */
+void tr2_emit_final_counters(tr2_tgt_evt_counter_t *fn_apply);
+
+#endif /* TR2_CTR_H */
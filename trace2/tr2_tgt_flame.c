@@ -0,0 +1,384 @@
+#include "cache.h"
+#include "config.h"
+#include "strmap.h"
+#include "string-list.h"
+#include "thread-utils.h"
+#include "trace2/tr2_cmd_name.h"
+#include "trace2/tr2_dst.h"
+#include "trace2/tr2_sysenv.h"
+#include "trace2/tr2_tgt.h"
+#include "trace2/tr2_tls.h"
+
+/*
+ * The flame target writes, when the process exits, one line for each
+ * distinct stack of nested regions that was seen, in the "collapsed
+ * stack" format read by flamegraph.pl and similar tools:
+ *
+ *     <command>;<thread>;<category>:<label>;... <value>
+ *
+ * where <value> is the time spent in the innermost region of the stack
+ * (excluding its nested regions) in microseconds, summed over all the
+ * times the stack was seen. Lines written by several processes to the
+ * same destination can simply be concatenated.
+ *
+ * When TR2_SYSENV_FLAME_SAMPLE is set to a frequency, a SIGPROF timer
+ * samples the process at that many times per second of CPU time, and
+ * <value> is the number of samples taken while the stack was active.
+ * This shows where CPU goes rather than where wall-clock time goes.
+ */
+static struct tr2_dst tr2dst_flame = { TR2_SYSENV_FLAME, 0, 0, 0, 0 };
+
+#if defined(SIGPROF) && defined(ITIMER_PROF) && !defined(NO_SETITIMER)
+#define FLAME_CAN_SAMPLE 1
+#else
+#define FLAME_CAN_SAMPLE 0
+#endif
+
+static int flame_sample_hz;
+
+struct flame_frame {
+	size_t path_len; /* length of the path before this frame */
+	uint64_t us_children;
+};
+
+struct flame_thread {
+	/* the thread name, followed by a ";<frame>" for each open region */
+	struct strbuf path;
+	struct flame_frame *frames;
+	size_t nr, alloc;
+	uint64_t us_children; /* of the thread itself */
+
+	/* set by the SIGPROF handler, consumed by flame_flush_samples() */
+	volatile sig_atomic_t samples;
+};
+
+static pthread_key_t flame_key;
+
+/* stack -> uint64_t value, access under tr2tls_lock() */
+static struct strmap flame_stacks = STRMAP_INIT;
+
+/* samples taken on threads we know nothing about */
+static volatile sig_atomic_t flame_unattributed_samples;
+
+static void flame_add(const char *stack, uint64_t value)
+{
+	uint64_t *total;
+
+	if (!value)
+		return;
+
+	tr2tls_lock();
+	total = strmap_get(&flame_stacks, stack);
+	if (!total) {
+		total = xcalloc(1, sizeof(*total));
+		strmap_put(&flame_stacks, stack, total);
+	}
+	*total += value;
+	tr2tls_unlock();
+}
+
+/*
+ * Frame names cannot contain the separators of the collapsed format.
+ */
+static void flame_add_name(struct strbuf *buf, const char *name)
+{
+	for (; *name; name++)
+		strbuf_addch(buf, (*name == ';' || isspace(*name)) ? '_' : *name);
+}
+
+static struct flame_thread *flame_get_self(void)
+{
+	struct flame_thread *ft = pthread_getspecific(flame_key);
+	const char *name;
+
+	if (ft)
+		return ft;
+
+	CALLOC_ARRAY(ft, 1);
+	strbuf_init(&ft->path, 0);
+
+	/*
+	 * Threads of the same kind should add up to the same stacks, so
+	 * drop the "thNN:" prefix that makes the name unique.
+	 */
+	name = tr2tls_get_self()->thread_name.buf;
+	if (name[0] == 't' && name[1] == 'h' && isdigit(name[2])) {
+		const char *colon = strchr(name, ':');
+		if (colon)
+			name = colon + 1;
+	}
+	flame_add_name(&ft->path, name);
+
+	pthread_setspecific(flame_key, ft);
+	return ft;
+}
+
+/*
+ * Charge the samples taken since the last call to the current stack,
+ * which has not changed in between.
+ */
+static void flame_flush_samples(struct flame_thread *ft)
+{
+	sig_atomic_t n;
+
+	if (!flame_sample_hz)
+		return;
+
+	n = ft->samples;
+	if (!n)
+		return;
+	ft->samples -= n;
+	flame_add(ft->path.buf, n);
+}
+
+static void flame_free_thread(struct flame_thread *ft)
+{
+	strbuf_release(&ft->path);
+	free(ft->frames);
+	free(ft);
+}
+
+/*
+ * Charge the time the thread spent outside of any region to the
+ * thread itself.
+ */
+static void flame_thread_done(struct flame_thread *ft, uint64_t us_elapsed)
+{
+	flame_flush_samples(ft);
+	strbuf_setlen(&ft->path, ft->nr ? ft->frames[0].path_len : ft->path.len);
+	if (!flame_sample_hz && us_elapsed > ft->us_children)
+		flame_add(ft->path.buf, us_elapsed - ft->us_children);
+}
+
+#if FLAME_CAN_SAMPLE
+static void flame_sigprof(int sig)
+{
+	struct flame_thread *ft = pthread_getspecific(flame_key);
+
+	if (ft)
+		ft->samples++;
+	else
+		flame_unattributed_samples++;
+}
+
+static void flame_start_sampling(void)
+{
+	struct sigaction sa;
+	struct itimerval v;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = flame_sigprof;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, NULL) < 0) {
+		flame_sample_hz = 0;
+		return;
+	}
+
+	v.it_interval.tv_sec = 0;
+	v.it_interval.tv_usec = 1000000 / flame_sample_hz;
+	if (!v.it_interval.tv_usec)
+		v.it_interval.tv_usec = 1;
+	v.it_value = v.it_interval;
+	if (setitimer(ITIMER_PROF, &v, NULL) < 0)
+		flame_sample_hz = 0;
+}
+
+static void flame_stop_sampling(void)
+{
+	struct itimerval v;
+
+	memset(&v, 0, sizeof(v));
+	setitimer(ITIMER_PROF, &v, NULL);
+}
+#else
+static void flame_start_sampling(void)
+{
+	flame_sample_hz = 0;
+}
+
+static void flame_stop_sampling(void)
+{
+}
+#endif
+
+static int fn_init(void)
+{
+	int want = tr2_dst_trace_want(&tr2dst_flame);
+	const char *hz;
+
+	if (!want)
+		return want;
+
+	pthread_key_create(&flame_key, NULL);
+
+	hz = tr2_sysenv_get(TR2_SYSENV_FLAME_SAMPLE);
+	if (hz && *hz && (flame_sample_hz = atoi(hz)) > 0)
+		flame_start_sampling();
+	else
+		flame_sample_hz = 0;
+
+	return want;
+}
+
+static void fn_term(void)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	tr2_dst_trace_disable(&tr2dst_flame);
+
+	strmap_for_each_entry(&flame_stacks, &iter, e)
+		free(e->value);
+	strmap_clear(&flame_stacks, 0);
+}
+
+static void fn_thread_exit_fl(const char *file, int line,
+			      uint64_t us_elapsed_absolute,
+			      uint64_t us_elapsed_thread)
+{
+	struct flame_thread *ft = flame_get_self();
+
+	flame_thread_done(ft, us_elapsed_thread);
+	pthread_setspecific(flame_key, NULL);
+	flame_free_thread(ft);
+}
+
+static void fn_atexit(uint64_t us_elapsed_absolute, int code)
+{
+	struct flame_thread *ft = flame_get_self();
+	struct string_list stacks = STRING_LIST_INIT_NODUP;
+	struct strbuf buf = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	const char *cmd = tr2_cmd_name_get_hierarchy();
+	size_t cmd_len;
+	int i;
+
+	flame_stop_sampling();
+	flame_thread_done(ft, us_elapsed_absolute);
+	pthread_setspecific(flame_key, NULL);
+	flame_free_thread(ft);
+
+	if (flame_unattributed_samples)
+		flame_add("unknown", flame_unattributed_samples);
+
+	if (cmd && *cmd) {
+		/* "fetch/index-pack" becomes the frames "fetch;index-pack" */
+		for (; *cmd; cmd++)
+			strbuf_addch(&buf, *cmd == '/' ? ';' : *cmd);
+	} else {
+		strbuf_addstr(&buf, "git");
+	}
+	strbuf_addch(&buf, ';');
+	cmd_len = buf.len;
+
+	tr2tls_lock();
+	strmap_for_each_entry(&flame_stacks, &iter, e)
+		string_list_append(&stacks, e->key)->util = e->value;
+	tr2tls_unlock();
+	string_list_sort(&stacks);
+
+	for (i = 0; i < stacks.nr; i++) {
+		strbuf_setlen(&buf, cmd_len);
+		strbuf_addf(&buf, "%s %"PRIu64, stacks.items[i].string,
+			    *(uint64_t *)stacks.items[i].util);
+		tr2_dst_write_line(&tr2dst_flame, &buf);
+	}
+
+	string_list_clear(&stacks, 0);
+	strbuf_release(&buf);
+}
+
+static void fn_region_enter_printf_va_fl(const char *file, int line,
+					 uint64_t us_elapsed_absolute,
+					 const char *category,
+					 const char *label,
+					 const struct repository *repo,
+					 const char *fmt, va_list ap)
+{
+	struct flame_thread *ft = flame_get_self();
+	struct flame_frame *frame;
+
+	flame_flush_samples(ft);
+
+	ALLOC_GROW(ft->frames, ft->nr + 1, ft->alloc);
+	frame = &ft->frames[ft->nr++];
+	frame->path_len = ft->path.len;
+	frame->us_children = 0;
+
+	strbuf_addch(&ft->path, ';');
+	if (category) {
+		flame_add_name(&ft->path, category);
+		strbuf_addch(&ft->path, ':');
+	}
+	if (label) {
+		flame_add_name(&ft->path, label);
+	} else if (fmt && *fmt) {
+		struct strbuf msg = STRBUF_INIT;
+		va_list copy_ap;
+
+		va_copy(copy_ap, ap);
+		strbuf_vaddf(&msg, fmt, copy_ap);
+		va_end(copy_ap);
+		flame_add_name(&ft->path, msg.buf);
+		strbuf_release(&msg);
+	}
+}
+
+static void fn_region_leave_printf_va_fl(
+	const char *file, int line, uint64_t us_elapsed_absolute,
+	uint64_t us_elapsed_region, const char *category, const char *label,
+	const struct repository *repo, const char *fmt, va_list ap)
+{
+	struct flame_thread *ft = flame_get_self();
+	struct flame_frame *frame;
+
+	if (!ft->nr)
+		return;
+
+	flame_flush_samples(ft);
+
+	frame = &ft->frames[--ft->nr];
+	if (!flame_sample_hz && us_elapsed_region > frame->us_children)
+		flame_add(ft->path.buf, us_elapsed_region - frame->us_children);
+	strbuf_setlen(&ft->path, frame->path_len);
+
+	if (ft->nr)
+		ft->frames[ft->nr - 1].us_children += us_elapsed_region;
+	else
+		ft->us_children += us_elapsed_region;
+}
+
+struct tr2_tgt tr2_tgt_flame = {
+	&tr2dst_flame,
+
+	fn_init,
+	fn_term,
+
+	NULL, /* version */
+	NULL, /* start */
+	NULL, /* exit */
+	NULL, /* signal */
+	fn_atexit,
+	NULL, /* error */
+	NULL, /* command_path */
+	NULL, /* command_name */
+	NULL, /* command_mode */
+	NULL, /* alias */
+	NULL, /* child_start */
+	NULL, /* child_exit */
+	NULL, /* thread_start */
+	fn_thread_exit_fl,
+	NULL, /* exec */
+	NULL, /* exec_result */
+	NULL, /* param */
+	NULL, /* repo */
+	fn_region_enter_printf_va_fl,
+	fn_region_leave_printf_va_fl,
+	NULL, /* data */
+	NULL, /* data_json */
+	NULL, /* printf */
+	NULL, /* timer */
+	NULL, /* counter */
+};
@@ -87,6 +87,13 @@ int tr2tls_is_main_thread(void)
 	return pthread_getspecific(tr2tls_key) == tr2tls_thread_main;
 }
 
+static void tr2tls_free_ctx(struct tr2tls_thread_ctx *ctx)
+{
+	strbuf_release(&ctx->thread_name);
+	free(ctx->array_us_start);
+	free(ctx);
+}
+
 void tr2tls_unset_self(void)
 {
 	struct tr2tls_thread_ctx *ctx;
@@ -95,8 +102,20 @@ void tr2tls_unset_self(void)
 
 	pthread_setspecific(tr2tls_key, NULL);
 
-	free(ctx->array_us_start);
-	free(ctx);
+	tr2tls_free_ctx(ctx);
+}
+
+/*
+ * Called for a thread that exits without calling trace2_thread_exit(),
+ * so that its timers and counters still make it into the totals.
+ */
+static void tr2tls_destroy_ctx(void *data)
+{
+	struct tr2tls_thread_ctx *ctx = data;
+
+	tr2_update_final_timers(&ctx->timer_block);
+	tr2_update_final_counters(&ctx->counter_block);
+	tr2tls_free_ctx(ctx);
 }
 
 void tr2tls_push_self(uint64_t us_now)
@@ -151,7 +170,7 @@ void tr2tls_init(void)
 {
 	tr2tls_start_process_clock();
 
-	pthread_key_create(&tr2tls_key, NULL);
+	pthread_key_create(&tr2tls_key, tr2tls_destroy_ctx);
 	init_recursive_mutex(&tr2tls_mutex);
 
 	tr2tls_thread_main =
@@ -167,6 +186,16 @@ void tr2tls_release(void)
 	pthread_key_delete(tr2tls_key);
 }
 
+void tr2tls_lock(void)
+{
+	pthread_mutex_lock(&tr2tls_mutex);
+}
+
+void tr2tls_unlock(void)
+{
+	pthread_mutex_unlock(&tr2tls_mutex);
+}
+
 int tr2tls_locked_increment(int *p)
 {
 	int current_value;
@@ -0,0 +1,148 @@
+#include "cache.h"
+#include "thread-utils.h"
+#include "trace2/tr2_tgt.h"
+#include "trace2/tr2_tls.h"
+#include "trace2/tr2_tmr.h"
+
+/*
+ * A global timer block to aggregate values from the partial sums from
+ * each thread.
+ */
+static struct tr2_timer_block final_timer_block; /* access under tr2tls_mutex */
+
+/*
+ * Define metadata for each stopwatch timer.
+ *
+ * This array must match "enum trace2_timer_id" and the values
+ * in "struct tr2_timer_block.timer[*]".
+ */
+static struct tr2_timer_metadata tr2_timer_metadata[TRACE2_NUMBER_OF_TIMERS] = {
+	[TRACE2_TIMER_ID_TEST1] = {
+		.category = "test",
+		.name = "test1",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_TIMER_ID_TEST2] = {
+		.category = "test",
+		.name = "test2",
+		.want_per_thread_events = 1,
+	},
+	[TRACE2_TIMER_ID_PACK_WINDOW_MAP] = {
+		.category = "pack",
+		.name = "window_map",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_TIMER_ID_PACK_INFLATE] = {
+		.category = "pack",
+		.name = "inflate",
+		.want_per_thread_events = 0,
+	},
+
+	/* Add additional metadata before here. */
+};
+
+void tr2_start_timer(enum trace2_timer_id tid)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	struct tr2_timer *t = &ctx->timer_block.timer[tid];
+
+	t->recursion_count++;
+	if (t->recursion_count > 1)
+		return; /* ignore recursive starts */
+
+	t->start_ns = getnanotime();
+}
+
+void tr2_stop_timer(enum trace2_timer_id tid)
+{
+	struct tr2tls_thread_ctx *ctx = tr2tls_get_self();
+	struct tr2_timer *t = &ctx->timer_block.timer[tid];
+	uint64_t ns_interval;
+
+	if (!t->recursion_count)
+		BUG("trace2 timer '%s' stopped without being started",
+		    tr2_timer_metadata[tid].name);
+
+	t->recursion_count--;
+	if (t->recursion_count)
+		return; /* still in recursive call(s) */
+
+	ns_interval = getnanotime() - t->start_ns;
+	t->total_ns += ns_interval;
+
+	/*
+	 * min_ns was initialized to zero (in the xcalloc()) rather
+	 * than UINT_MAX when the block of timers was allocated,
+	 * so we should always set both the min_ns and max_ns values
+	 * the first time that the timer is used.
+	 */
+	if (!t->interval_count) {
+		t->min_ns = ns_interval;
+		t->max_ns = ns_interval;
+	} else {
+		t->min_ns = ns_interval < t->min_ns ? ns_interval : t->min_ns;
+		t->max_ns = ns_interval > t->max_ns ? ns_interval : t->max_ns;
+	}
+
+	t->interval_count++;
+}
+
+/*
+ * Aggregate the stopwatch timer data from the current thread into the
+ * global timer data.  Timers that are still running (a thread exiting
+ * in the middle of an interval) contribute only their finished
+ * intervals.
+ */
+static void merge_timer(struct tr2_timer *dst, const struct tr2_timer *src)
+{
+	if (!src->interval_count)
+		return;
+
+	if (!dst->interval_count) {
+		dst->min_ns = src->min_ns;
+		dst->max_ns = src->max_ns;
+	} else {
+		dst->min_ns = src->min_ns < dst->min_ns ? src->min_ns : dst->min_ns;
+		dst->max_ns = src->max_ns > dst->max_ns ? src->max_ns : dst->max_ns;
+	}
+
+	dst->total_ns += src->total_ns;
+	dst->interval_count += src->interval_count;
+}
+
+void tr2_update_final_timers(const struct tr2_timer_block *block)
+{
+	enum trace2_timer_id tid;
+
+	tr2tls_lock();
+	for (tid = 0; tid < TRACE2_NUMBER_OF_TIMERS; tid++)
+		merge_timer(&final_timer_block.timer[tid], &block->timer[tid]);
+	tr2tls_unlock();
+}
+
+void tr2_emit_per_thread_timers(tr2_tgt_evt_timer_t *fn_apply,
+				const struct tr2_timer_block *block)
+{
+	enum trace2_timer_id tid;
+
+	for (tid = 0; tid < TRACE2_NUMBER_OF_TIMERS; tid++) {
+		const struct tr2_timer *t = &block->timer[tid];
+		const struct tr2_timer_metadata *md = &tr2_timer_metadata[tid];
+
+		if (md->want_per_thread_events && t->interval_count)
+			fn_apply(md, t, 0);
+	}
+}
+
+void tr2_emit_final_timers(tr2_tgt_evt_timer_t *fn_apply)
+{
+	enum trace2_timer_id tid;
+
+	for (tid = 0; tid < TRACE2_NUMBER_OF_TIMERS; tid++) {
+		const struct tr2_timer *t = &final_timer_block.timer[tid];
+		const struct tr2_timer_metadata *md = &tr2_timer_metadata[tid];
+
+		if (t->interval_count)
+			fn_apply(md, t, 1);
+	}
+}
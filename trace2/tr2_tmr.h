@@ -0,0 +1,74 @@
+#ifndef TR2_TMR_H
+#define TR2_TMR_H
+
+#include "trace2.h"
+#include "trace2/tr2_tgt.h"
+
+/*
+ * Define a mechanism to allow "stopwatch" timers.
+ *
+ * Timers can be used to measure "interesting" activity that does not
+ * fit the "region" model, such as code called from many different
+ * regions (like zlib) and/or where data for individual calls are not
+ * interesting or are too numerous to be efficiently logged.
+ *
+ * Timer values are accumulated during program execution and emitted
+ * to the Trace2 logs at program exit.
+ *
+ * To make this model efficient, we define a compile-time fixed set of
+ * timers and timer ids using a fixed size "timer block" array in
+ * thread-local storage.  This gives us constant time access to each
+ * timer within each thread, since we want start/stop operations within
+ * the inner loop to be fast and not require a lock.
+ */
+
+struct tr2_timer_metadata {
+	const char *category;
+	const char *name;
+
+	/*
+	 * True if we should emit per-thread events for this timer
+	 * when individual threads exit.
+	 */
+	unsigned int want_per_thread_events:1;
+};
+
+struct tr2_timer {
+	uint64_t recursion_count;
+	uint64_t start_ns;
+
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t interval_count;
+};
+
+struct tr2_timer_block {
+	struct tr2_timer timer[TRACE2_NUMBER_OF_TIMERS];
+};
+
+/*
+ * Private routines used by trace2.c to actually start/stop an
+ * individual timer in the current thread.
+ */
+void tr2_start_timer(enum trace2_timer_id tid);
+void tr2_stop_timer(enum trace2_timer_id tid);
+
+/*
+ * Add the timers of an exiting thread to the process-wide totals.
+ */
+void tr2_update_final_timers(const struct tr2_timer_block *block);
+
+/*
+ * Call `fn_apply` for each timer of `block` that was used and wants
+ * per-thread events.
+ */
+void tr2_emit_per_thread_timers(tr2_tgt_evt_timer_t *fn_apply,
+				const struct tr2_timer_block *block);
+
+/*
+ * Call `fn_apply` for each process-wide timer that was used.
+ */
+void tr2_emit_final_timers(tr2_tgt_evt_timer_t *fn_apply);
+
+#endif /* TR2_TMR_H */
@@ -1210,6 +1210,18 @@ static struct ref *get_refs_list(struct transport *transport, int for_push,
 	return get_refs_list_using_list(transport, for_push);
 }
 
+static int get_bundle_uri(struct transport *transport)
+{
+	get_helper(transport);
+
+	if (process_connect(transport, 0)) {
+		do_take_over(transport);
+		return transport->vtable->get_bundle_uri(transport);
+	}
+
+	return -1;
+}
+
 static struct ref *get_refs_list_using_list(struct transport *transport,
 					    int for_push)
 {
@@ -1288,6 +1300,7 @@ static struct ref *get_refs_list_using_list(struct transport *transport,
 static struct transport_vtable vtable = {
 	set_helper_option,
 	get_refs_list,
+	get_bundle_uri,
 	fetch,
 	push_refs,
 	connect_helper,
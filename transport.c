@@ -9,6 +9,7 @@
 #include "send-pack.h"
 #include "walker.h"
 #include "bundle.h"
+#include "bundle-uri.h"
 #include "dir.h"
 #include "refs.h"
 #include "refspec.h"
@@ -342,6 +343,31 @@ static struct ref *get_refs_via_connect(struct transport *transport, int for_pus
 	return handshake(transport, for_push, options, 1);
 }
 
+static int get_bundle_uri(struct transport *transport)
+{
+	struct git_transport_data *data = transport->data;
+	struct packet_reader reader;
+
+	if (!data->got_remote_heads)
+		free_refs(handshake(transport, 0, NULL, 0));
+
+	/*
+	 * Only protocol v2 can ask for bundles; an older server simply
+	 * has none to offer.
+	 */
+	if (data->version != protocol_v2 ||
+	    !server_supports_v2("bundle-uri", 0))
+		return 0;
+
+	packet_reader_init(&reader, data->fd[0], NULL, 0,
+			   PACKET_READ_CHOMP_NEWLINE |
+			   PACKET_READ_GENTLE_ON_EOF |
+			   PACKET_READ_DIE_ON_ERR_PACKET);
+	return get_remote_bundle_uri(data->fd[1], &reader,
+				     transport->bundles,
+				     transport->stateless_rpc);
+}
+
 static int fetch_refs_via_pack(struct transport *transport,
 			       int nr_heads, struct ref **to_fetch)
 {
@@ -880,6 +906,7 @@ static int disconnect_git(struct transport *transport)
 static struct transport_vtable taken_over_vtable = {
 	NULL,
 	get_refs_via_connect,
+	get_bundle_uri,
 	fetch_refs_via_pack,
 	git_transport_push,
 	NULL,
@@ -1029,6 +1056,7 @@ void transport_check_allowed(const char *type)
 static struct transport_vtable bundle_vtable = {
 	NULL,
 	get_refs_from_bundle,
+	NULL,
 	fetch_refs_from_bundle,
 	NULL,
 	NULL,
@@ -1038,6 +1066,7 @@ static struct transport_vtable bundle_vtable = {
 static struct transport_vtable builtin_smart_vtable = {
 	NULL,
 	get_refs_via_connect,
+	get_bundle_uri,
 	fetch_refs_via_pack,
 	git_transport_push,
 	connect_git,
@@ -1417,6 +1446,19 @@ const struct ref *transport_get_remote_refs(struct transport *transport,
 	return transport->remote_refs;
 }
 
+int transport_get_remote_bundle_uri(struct transport *transport)
+{
+	if (!transport->bundles) {
+		CALLOC_ARRAY(transport->bundles, 1);
+		init_bundle_list(transport->bundles);
+		transport->bundles->base_uri = xstrdup(transport->url);
+	}
+
+	if (!transport->vtable->get_bundle_uri)
+		return error(_("bundle-uri operation not supported by protocol"));
+	return transport->vtable->get_bundle_uri(transport);
+}
+
 int transport_fetch_refs(struct transport *transport, struct ref *refs)
 {
 	int rc;
@@ -1478,6 +1520,10 @@ int transport_disconnect(struct transport *transport)
 		ret = transport->vtable->disconnect(transport);
 	if (transport->got_remote_refs)
 		free_refs((void *)transport->remote_refs);
+	if (transport->bundles) {
+		clear_bundle_list(transport->bundles);
+		free(transport->bundles);
+	}
 	free(transport);
 	return ret;
 }
@@ -125,6 +125,12 @@ struct transport {
 	enum transport_family family;
 
 	const struct git_hash_algo *hash_algo;
+
+	/*
+	 * The bundles the remote advertised with the "bundle-uri"
+	 * command; set by transport_get_remote_bundle_uri().
+	 */
+	struct bundle_list *bundles;
 };
 
 #define TRANSPORT_PUSH_ALL			(1<<0)
@@ -278,6 +284,13 @@ const struct ref *transport_get_remote_refs(struct transport *transport,
 const struct git_hash_algo *transport_get_hash_algo(struct transport *transport);
 int transport_fetch_refs(struct transport *transport, struct ref *refs);
 void transport_unlock_pack(struct transport *transport);
+/*
+ * Ask the remote for the bundles it offers for bootstrapping a clone
+ * and store them in transport->bundles. Returns 0 on success, even if
+ * the remote offers none, and -1 if the list could not be retrieved.
+ */
+int transport_get_remote_bundle_uri(struct transport *transport);
+
 int transport_disconnect(struct transport *transport);
 char *transport_anonymize_url(const char *url);
 void transport_take_over(struct transport *transport,
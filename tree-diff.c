@@ -403,6 +403,51 @@ static inline void update_tp_entries(struct tree_desc *tp, int nparent)
 			update_tree_entry(&tp[i]);
 }
 
+/*
+ * Skip the entries at the front of t and tp that are the same byte
+ * for byte. They have the same name, mode and object name, so a plain
+ * diff has nothing to emit for them, and two versions of a large tree
+ * typically share long runs of them. Finding where such a run ends
+ * with memcmp() is a lot cheaper than comparing the entries one by
+ * one, as only the end of each entry has to be found.
+ */
+static void skip_common_entries(struct tree_desc *t, struct tree_desc *tp)
+{
+	const char *a = t->buffer, *b = tp->buffer;
+	const char *pos = a, *end;
+	size_t common = 0, len = t->size < tp->size ? t->size : tp->size;
+	size_t chunk;
+
+	/* the current entries are usually either the same or not at all */
+	if (t->entry.mode != tp->entry.mode ||
+	    !oideq(&t->entry.oid, &tp->entry.oid))
+		return;
+
+	for (chunk = 256; common < len; chunk *= 2) {
+		if (chunk > len - common)
+			chunk = len - common;
+		if (memcmp(a + common, b + common, chunk))
+			break;
+		common += chunk;
+	}
+	while (common < len && a[common] == b[common])
+		common++;
+
+	end = a + common;
+	for (;;) {
+		const char *nul = memchr(pos, '\0', end - pos);
+
+		if (!nul || end - (nul + 1) < the_hash_algo->rawsz)
+			break;
+		pos = nul + 1 + the_hash_algo->rawsz;
+	}
+	if (pos == a)
+		return;
+
+	init_tree_desc(t, pos, t->size - (pos - a));
+	init_tree_desc(tp, b + (pos - a), tp->size - (pos - a));
+}
+
 static struct combine_diff_path *ll_diff_tree_paths(
 	struct combine_diff_path *p, const struct object_id *oid,
 	const struct object_id **parents_oid, int nparent,
@@ -441,6 +486,9 @@ static struct combine_diff_path *ll_diff_tree_paths(
 			skip_uninteresting(&t, base, opt);
 			for (i = 0; i < nparent; i++)
 				skip_uninteresting(&tp[i], base, opt);
+		} else if (nparent == 1 && t.size && tp[0].size &&
+			   !opt->flags.find_copies_harder) {
+			skip_common_entries(&t, &tp[0]);
 		}
 
 		/* comparing is finished when all trees are done */
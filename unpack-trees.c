@@ -15,6 +15,8 @@
 #include "submodule-config.h"
 #include "fsmonitor.h"
 #include "object-store.h"
+#include "oidset.h"
+#include "pathspec.h"
 #include "promisor-remote.h"
 #include "entry.h"
 #include "parallel-checkout.h"
@@ -846,6 +848,159 @@ static int traverse_by_cache_tree(int pos, int nr_entries, int nr_names,
 	return 0;
 }
 
+/*
+ * In a partial clone, the trees a traversal is about to descend into
+ * may be missing, and reading them one by one costs a round trip to
+ * the promisor remote each.  Before a level is traversed, the missing
+ * subtrees it will read are fetched in one batch, and then the missing
+ * subtrees of what was just fetched, and so on, so that a missing
+ * hierarchy costs one round trip per level instead of one per tree.
+ * Subtrees the traversal will not descend into (outside the pathspec,
+ * stood for by a sparse directory entry, or covered by the cache-tree)
+ * are not fetched.
+ */
+struct prefetch_info {
+	struct traverse_info info; /* must be first */
+	struct oidset seen;
+	struct string_list missing; /* "path/" -> oid of a missing tree */
+};
+
+static int is_sparse_directory_path(struct index_state *istate,
+				    const char *path, size_t len)
+{
+	int pos;
+
+	if (!istate->sparse_index)
+		return 0;
+	pos = index_name_pos(istate, path, len);
+	return pos >= 0 && S_ISSPARSEDIR(istate->cache[pos]->ce_mode);
+}
+
+static void add_missing_tree(struct prefetch_info *pi,
+			     const struct object_id *oid, const char *path)
+{
+	if (oidset_insert(&pi->seen, oid))
+		return;
+	if (!oid_object_info_extended(the_repository, oid, NULL,
+				      OBJECT_INFO_FOR_PREFETCH))
+		return;
+	string_list_append(&pi->missing, path)->util = oiddup(oid);
+}
+
+static int prefetch_callback(int n, unsigned long mask,
+			     unsigned long dirmask,
+			     struct name_entry *names,
+			     struct traverse_info *info)
+{
+	struct prefetch_info *pi = (struct prefetch_info *)info;
+	struct unpack_trees_options *o = info->data;
+	struct strbuf path = STRBUF_INIT;
+	struct name_entry *p;
+	int i;
+
+	if (!dirmask || all_trees_same_as_cache_tree(n, dirmask, names, info))
+		return mask;
+
+	p = names;
+	while (!p->mode)
+		p++;
+	strbuf_addstr(&path, info->traverse_path);
+	strbuf_add(&path, p->path, p->pathlen);
+	strbuf_addch(&path, '/');
+	if (!is_sparse_directory_path(o->src_index, path.buf, path.len))
+		for (i = 0; i < n; i++, dirmask >>= 1)
+			if (dirmask & 1)
+				add_missing_tree(pi, &names[i].oid, path.buf);
+	strbuf_release(&path);
+	return mask;
+}
+
+static void fetch_missing_trees(struct prefetch_info *pi)
+{
+	struct unpack_trees_options *o = pi->info.data;
+	const struct pathspec *ps = pi->info.pathspec;
+
+	while (pi->missing.nr) {
+		struct string_list level = pi->missing;
+		struct oid_array to_fetch = OID_ARRAY_INIT;
+		struct strbuf path = STRBUF_INIT;
+		int i;
+
+		string_list_init(&pi->missing, 1);
+		for (i = 0; i < level.nr; i++)
+			oid_array_append(&to_fetch, level.items[i].util);
+		trace2_data_intmax("unpack_trees", the_repository,
+				   "prefetch/trees", to_fetch.nr);
+		promisor_remote_get_direct(the_repository,
+					   to_fetch.oid, to_fetch.nr);
+		oid_array_clear(&to_fetch);
+
+		for (i = 0; i < level.nr; i++) {
+			struct tree_desc desc;
+			struct name_entry entry;
+			enum object_type type;
+			unsigned long size;
+			void *buf;
+
+			buf = read_object_file(level.items[i].util, &type, &size);
+			if (!buf)
+				continue;
+			if (type != OBJ_TREE) {
+				free(buf);
+				continue;
+			}
+			strbuf_reset(&path);
+			strbuf_addstr(&path, level.items[i].string);
+			init_tree_desc(&desc, buf, size);
+			while (tree_entry(&desc, &entry)) {
+				size_t len = path.len;
+
+				if (!S_ISDIR(entry.mode))
+					continue;
+				if (ps && ps->nr) {
+					int match = tree_entry_interesting(o->src_index,
+									   &entry, &path,
+									   0, ps);
+					if (match == all_entries_not_interesting)
+						break;
+					if (match == entry_not_interesting)
+						continue;
+				}
+				strbuf_add(&path, entry.path, entry.pathlen);
+				strbuf_addch(&path, '/');
+				if (!is_sparse_directory_path(o->src_index,
+							      path.buf, path.len))
+					add_missing_tree(pi, &entry.oid, path.buf);
+				strbuf_setlen(&path, len);
+			}
+			free(buf);
+		}
+		strbuf_release(&path);
+		string_list_clear(&level, 1);
+	}
+}
+
+static void prefetch_subtrees(int n, struct tree_desc *t,
+			      struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	struct prefetch_info pi;
+
+	if (!has_promisor_remote())
+		return;
+
+	pi.info = *info;
+	pi.info.fn = prefetch_callback;
+	oidset_init(&pi.seen, 0);
+	string_list_init(&pi.missing, 1);
+
+	traverse_trees(o->src_index, n, t, &pi.info);
+	fetch_missing_trees(&pi);
+
+	oidset_clear(&pi.seen);
+	string_list_clear(&pi.missing, 1);
+}
+
 static int traverse_trees_recursive(int n, unsigned long dirmask,
 				    unsigned long df_conflicts,
 				    struct name_entry *names,
@@ -921,6 +1076,7 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 		}
 	}
 
+	prefetch_subtrees(n, t, &newinfo);
 	bottom = switch_cache_bottom(&newinfo);
 	ret = traverse_trees(o->src_index, n, t, &newinfo);
 	restore_cache_bottom(&newinfo, bottom);
@@ -931,6 +1087,14 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 	return ret;
 }
 
+/*
+ * A sparse directory entry compares like the directory it stands for.
+ */
+static unsigned ce_compare_mode(const struct cache_entry *ce)
+{
+	return S_ISSPARSEDIR(ce->ce_mode) ? S_IFDIR : S_IFREG;
+}
+
 /*
  * Compare the traverse-path to the cache entry without actually
  * having to generate the textual representation of the traverse
@@ -965,7 +1129,8 @@ static int do_compare_entry_piecewise(const struct cache_entry *ce,
 	ce_len -= pathlen;
 	ce_name = ce->name + pathlen;
 
-	return df_name_compare(ce_name, ce_len, S_IFREG, name, namelen, mode);
+	return df_name_compare(ce_name, ce_len, ce_compare_mode(ce),
+			       name, namelen, mode);
 }
 
 static int do_compare_entry(const struct cache_entry *ce,
@@ -998,7 +1163,8 @@ static int do_compare_entry(const struct cache_entry *ce,
 	ce_len -= pathlen;
 	ce_name = ce->name + pathlen;
 
-	return df_name_compare(ce_name, ce_len, S_IFREG, name, namelen, mode);
+	return df_name_compare(ce_name, ce_len, ce_compare_mode(ce),
+			       name, namelen, mode);
 }
 
 static int compare_entry(const struct cache_entry *ce, const struct traverse_info *info, const struct name_entry *n)
@@ -1007,6 +1173,14 @@ static int compare_entry(const struct cache_entry *ce, const struct traverse_inf
 	if (cmp)
 		return cmp;
 
+	/*
+	 * A sparse directory entry ends with a slash, so it matches a
+	 * directory of the same name exactly, but sorts after a file.
+	 */
+	if (S_ISSPARSEDIR(ce->ce_mode) &&
+	    ce_namelen(ce) == traverse_path_len(info, tree_entry_len(n)) + 1)
+		return !S_ISDIR(n->mode);
+
 	/*
 	 * Even if the beginning compared identically, the ce should
 	 * compare as bigger than a directory leading up to it!
@@ -1033,13 +1207,15 @@ static struct cache_entry *create_ce_entry(const struct traverse_info *info,
 	const struct name_entry *n,
 	int stage,
 	struct index_state *istate,
-	int is_transient)
+	int is_transient,
+	int is_sparse_directory)
 {
 	size_t len = traverse_path_len(info, tree_entry_len(n));
+	size_t alloc_len = is_sparse_directory ? len + 1 : len;
 	struct cache_entry *ce =
 		is_transient ?
-		make_empty_transient_cache_entry(len, NULL) :
-		make_empty_cache_entry(istate, len);
+		make_empty_transient_cache_entry(alloc_len, NULL) :
+		make_empty_cache_entry(istate, alloc_len);
 
 	ce->ce_mode = create_ce_mode(n->mode);
 	ce->ce_flags = create_ce_flags(stage);
@@ -1048,6 +1224,13 @@ static struct cache_entry *create_ce_entry(const struct traverse_info *info,
 	/* len+1 because the cache_entry allocates space for NUL */
 	make_traverse_path(ce->name, len + 1, info, n->path, n->pathlen);
 
+	if (is_sparse_directory) {
+		ce->name[len] = '/';
+		ce->name[len + 1] = '\0';
+		ce->ce_namelen++;
+		ce->ce_flags |= CE_SKIP_WORKTREE;
+	}
+
 	return ce;
 }
 
@@ -1066,6 +1249,13 @@ static int unpack_nondirectories(int n, unsigned long mask,
 	struct unpack_trees_options *o = info->data;
 	unsigned long conflicts = info->df_conflicts | dirmask;
 
+	/*
+	 * A sparse directory entry in the index is unpacked together
+	 * with the trees of the same name, like a file would be.
+	 */
+	if (mask == dirmask && src[0] && S_ISSPARSEDIR(src[0]->ce_mode))
+		conflicts = 0;
+
 	/* Do we have *only* directories? Nothing to do */
 	if (mask == dirmask && !src[0])
 		return 0;
@@ -1099,7 +1289,9 @@ static int unpack_nondirectories(int n, unsigned long mask,
 		 * not stored in the index.  otherwise construct the
 		 * cache entry from the index aware logic.
 		 */
-		src[i + o->merge] = create_ce_entry(info, names + i, stage, &o->result, o->merge);
+		src[i + o->merge] = create_ce_entry(info, names + i, stage,
+						    &o->result, o->merge,
+						    bit & dirmask);
 	}
 
 	if (o->merge) {
@@ -1203,16 +1395,45 @@ static int find_cache_pos(struct traverse_info *info,
 	return -1;
 }
 
+/*
+ * Is `ce` the sparse directory entry for the tree `p` that the traversal
+ * is looking at?
+ */
+static int is_sparse_directory_entry(const struct cache_entry *ce,
+				     const struct name_entry *p,
+				     const struct traverse_info *info)
+{
+	size_t len;
+
+	if (!ce || !S_ISSPARSEDIR(ce->ce_mode))
+		return 0;
+
+	len = traverse_path_len(info, tree_entry_len(p));
+	return ce_namelen(ce) == len + 1 &&
+	       !memcmp(ce->name + info->pathlen, p->path, p->pathlen);
+}
+
 static struct cache_entry *find_cache_entry(struct traverse_info *info,
 					    const struct name_entry *p)
 {
 	int pos = find_cache_pos(info, p->path, p->pathlen);
 	struct unpack_trees_options *o = info->data;
+	struct cache_entry *ce;
 
 	if (0 <= pos)
 		return o->src_index->cache[pos];
-	else
+
+	/*
+	 * A directory in the index is not returned, as we match its
+	 * entries while descending into it, unless it is a sparse
+	 * directory whose entries we will never see.
+	 */
+	if (pos == -1)
 		return NULL;
+	ce = o->src_index->cache[-2 - pos];
+	if (is_sparse_directory_entry(ce, p, info))
+		return ce;
+	return NULL;
 }
 
 static void debug_path(struct traverse_info *info)
@@ -1315,6 +1536,10 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 
 	/* Now handle any directories.. */
 	if (dirmask) {
+		/* a sparse directory entry already took care of the tree */
+		if (is_sparse_directory_entry(src[0], p, info))
+			return mask;
+
 		/* special case: "diff-index --cached" looking at a tree */
 		if (o->diff_index_cached &&
 		    n == 1 && dirmask == 1 && S_ISDIR(names->mode)) {
@@ -1569,6 +1794,164 @@ static void mark_new_skip_worktree(struct pattern_list *pl,
 	disable_fscache();
 }
 
+/*
+ * Whether the path of "ce" is in the cone of "pl", deciding on its
+ * leading directories first as clear_ce_flags() does. The verdict on
+ * the directory is kept in "dir" and "dir_match" for the next entry,
+ * which is most often in the same directory.
+ */
+static int in_cone(struct index_state *istate, struct pattern_list *pl,
+		   const struct cache_entry *ce, struct strbuf *dir,
+		   enum pattern_match_result *dir_match)
+{
+	const char *slash = strrchr(ce->name, '/');
+	size_t dirlen = slash ? slash - ce->name : 0;
+	int dtype = ce_to_dtype(ce);
+	enum pattern_match_result ret;
+
+	if (dir->len != dirlen || strncmp(dir->buf, ce->name, dirlen)) {
+		const char *p = ce->name;
+
+		strbuf_reset(dir);
+		strbuf_add(dir, ce->name, dirlen);
+		*dir_match = MATCHED;
+		while (p < ce->name + dirlen) {
+			const char *end = strchrnul(p, '/');
+			int dir_dtype = DT_DIR;
+
+			ret = path_matches_pattern_list(ce->name, end - ce->name,
+							p, &dir_dtype, pl, istate);
+			if (ret == MATCHED_RECURSIVE || ret == NOT_MATCHED) {
+				*dir_match = ret;
+				break;
+			}
+			p = end + 1;
+		}
+	}
+
+	if (*dir_match != MATCHED)
+		return *dir_match == MATCHED_RECURSIVE;
+
+	ret = path_matches_pattern_list(ce->name, ce_namelen(ce),
+					slash ? slash + 1 : ce->name,
+					&dtype, pl, istate);
+	return ret == MATCHED || ret == MATCHED_RECURSIVE;
+}
+
+static void mark_cone_entry(struct index_state *istate,
+			    struct pattern_list *pl, struct cache_entry *ce,
+			    struct strbuf *dir,
+			    enum pattern_match_result *dir_match)
+{
+	if (!ce_stage(ce) && !(ce->ce_flags & CE_CONFLICTED) &&
+	    !in_cone(istate, pl, ce, dir, dir_match))
+		ce->ce_flags |= CE_NEW_SKIP_WORKTREE;
+	else
+		ce->ce_flags &= ~CE_NEW_SKIP_WORKTREE;
+}
+
+/* Mark the entry at "path" and the entries under it. */
+static void mark_cone_path(struct index_state *istate,
+			   struct pattern_list *pl, const char *path,
+			   struct strbuf *dir,
+			   enum pattern_match_result *dir_match)
+{
+	size_t len = strlen(path);
+	struct strbuf prefix = STRBUF_INIT;
+	int pos;
+
+	pos = index_name_pos(istate, path, len);
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+
+		if (ce_namelen(ce) != len || memcmp(ce->name, path, len))
+			break;
+		mark_cone_entry(istate, pl, ce, dir, dir_match);
+	}
+
+	strbuf_addf(&prefix, "%s/", path);
+	pos = index_name_pos(istate, prefix.buf, prefix.len);
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+
+		if (!starts_with(ce->name, prefix.buf))
+			break;
+		mark_cone_entry(istate, pl, ce, dir, dir_match);
+	}
+	strbuf_release(&prefix);
+}
+
+/* Mark the paths of the entries of "map" that "other" does not have. */
+static void mark_cone_changes_1(struct index_state *istate,
+				struct pattern_list *pl,
+				struct hashmap *map, struct hashmap *other,
+				struct strbuf *dir,
+				enum pattern_match_result *dir_match)
+{
+	struct hashmap_iter iter;
+	struct pattern_entry *pe;
+
+	hashmap_for_each_entry(map, &iter, pe, ent) {
+		/* a pattern without the leading '/' never matches */
+		if (*pe->pattern != '/' ||
+		    hashmap_get_entry(other, pe, ent, NULL))
+			continue;
+		mark_cone_path(istate, pl, pe->pattern + 1, dir, dir_match);
+	}
+}
+
+static int can_mark_cone_changes(struct index_state *istate,
+				 struct pattern_list *old_pl,
+				 struct pattern_list *pl)
+{
+	return old_pl && old_pl->use_cone_patterns && !old_pl->full_cone &&
+	       pl->use_cone_patterns && !pl->full_cone &&
+	       !ignore_case && !istate->sparse_index;
+}
+
+/*
+ * Set CE_NEW_SKIP_WORKTREE for the cone patterns "pl" like
+ * mark_new_skip_worktree() does, given that the entries were last
+ * marked for "old_pl". Whether a path is in a cone is decided by the
+ * patterns for its leading directories and for itself, so the entries
+ * that are skipped need another look only when they are at or under a
+ * pattern that one of the cones has and the other does not.
+ */
+static void mark_cone_changes(struct index_state *istate,
+			      struct pattern_list *old_pl,
+			      struct pattern_list *pl)
+{
+	struct strbuf dir = STRBUF_INIT;
+	enum pattern_match_result dir_match = MATCHED;
+	int i;
+
+	trace2_region_enter("unpack_trees", "mark_cone_changes", the_repository);
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce_skip_worktree(ce) && !ce_stage(ce) &&
+		    !(ce->ce_flags & CE_CONFLICTED))
+			ce->ce_flags |= CE_NEW_SKIP_WORKTREE;
+		else
+			mark_cone_entry(istate, pl, ce, &dir, &dir_match);
+	}
+
+	mark_cone_changes_1(istate, pl, &old_pl->recursive_hashmap,
+			    &pl->recursive_hashmap, &dir, &dir_match);
+	mark_cone_changes_1(istate, pl, &pl->recursive_hashmap,
+			    &old_pl->recursive_hashmap, &dir, &dir_match);
+	mark_cone_changes_1(istate, pl, &old_pl->parent_hashmap,
+			    &pl->parent_hashmap, &dir, &dir_match);
+	mark_cone_changes_1(istate, pl, &pl->parent_hashmap,
+			    &old_pl->parent_hashmap, &dir, &dir_match);
+	strbuf_release(&dir);
+	trace2_region_leave("unpack_trees", "mark_cone_changes", the_repository);
+}
+
 static void populate_from_existing_patterns(struct unpack_trees_options *o,
 					    struct pattern_list *pl)
 {
@@ -1621,6 +2004,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	o->result.timestamp.sec = o->src_index->timestamp.sec;
 	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
 	o->result.version = o->src_index->version;
+	o->result.sparse_index = o->src_index->sparse_index;
 	if (!o->src_index->split_index) {
 		o->result.split_index = NULL;
 	} else if (o->src_index == o->dst_index) {
@@ -1682,6 +2066,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 		trace_performance_enter();
 		trace2_region_enter("unpack_trees", "traverse_trees", the_repository);
+		prefetch_subtrees(len, t, &info);
 		ret = traverse_trees(o->src_index, len, t, &info);
 		trace2_region_leave("unpack_trees", "traverse_trees", the_repository);
 		trace_performance_leave("traverse_trees");
@@ -1819,8 +2204,11 @@ enum update_sparsity_result update_sparsity(struct unpack_trees_options *o)
 
 	/* Set NEW_SKIP_WORKTREE on existing entries. */
 	mark_all_ce_unused(o->src_index);
-	mark_new_skip_worktree(o->pl, o->src_index, 0,
-			       CE_NEW_SKIP_WORKTREE, o->verbose_update);
+	if (can_mark_cone_changes(o->src_index, o->old_pl, o->pl))
+		mark_cone_changes(o->src_index, o->old_pl, o->pl);
+	else
+		mark_new_skip_worktree(o->pl, o->src_index, 0,
+				       CE_NEW_SKIP_WORKTREE, o->verbose_update);
 
 	/* Then loop over entries and update/remove as needed */
 	ret = UPDATE_SPARSITY_SUCCESS;
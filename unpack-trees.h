@@ -88,6 +88,15 @@ struct unpack_trees_options {
 	struct index_state result;
 
 	struct pattern_list *pl; /* for internal use */
+
+	/*
+	 * The cone mode patterns the working tree was last updated
+	 * for, if known. update_sparsity() then looks again only at
+	 * the entries that are not skipped, and at those under a
+	 * directory the two cones do not agree on.
+	 */
+	struct pattern_list *old_pl;
+
 	struct checkout_metadata meta;
 };
 
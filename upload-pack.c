@@ -26,7 +26,12 @@
 #include "serve.h"
 #include "commit-graph.h"
 #include "commit-reach.h"
+#include "advertised-refs.h"
 #include "shallow.h"
+#include "pack-cache.h"
+#include "tempfile.h"
+#include "pack-bitmap.h"
+#include "ewah/ewok.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -94,6 +99,12 @@ struct upload_pack_data {
 
 	const char *pack_objects_hook;
 
+	/* see bitmap_ok_to_give_up() */
+	struct bitmap_index *bitmap_git;
+	struct bitmap *want_reach;
+	int ready_wants;
+	int checked_haves;
+
 	unsigned stateless_rpc : 1;				/* v0 only */
 	unsigned no_done : 1;					/* v0 only */
 	unsigned daemon_mode : 1;				/* v0 only */
@@ -106,6 +117,7 @@ struct upload_pack_data {
 	unsigned wait_for_done : 1;
 	unsigned allow_filter : 1;
 	unsigned allow_filter_fallback : 1;
+	unsigned negotiate_with_bitmaps : 1;
 	unsigned long tree_filter_max_depth;
 
 	unsigned done : 1;					/* v2 only */
@@ -144,6 +156,7 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 
 	data->keepalive = 5;
 	data->advertise_sid = 0;
+	data->negotiate_with_bitmaps = 1;
 }
 
 static void upload_pack_data_clear(struct upload_pack_data *data)
@@ -160,8 +173,13 @@ static void upload_pack_data_clear(struct upload_pack_data *data)
 	string_list_clear(&data->allowed_filters, 0);
 
 	free((char *)data->pack_objects_hook);
+	bitmap_free(data->want_reach);
+	free_bitmap_index(data->bitmap_git);
 }
 
+int (*upload_pack_objects_fn)(int argc, const char **argv,
+			      const char *prefix);
+
 static void reset_timeout(unsigned int timeout)
 {
 	alarm(timeout);
@@ -187,9 +205,9 @@ static void send_client_data(int fd, const char *data, ssize_t sz,
 
 static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 {
-	FILE *fp = cb_data;
+	struct strbuf *input = cb_data;
 	if (graft->nr_parent == -1)
-		fprintf(fp, "--shallow %s\n", oid_to_hex(&graft->oid));
+		strbuf_addf(input, "--shallow %s\n", oid_to_hex(&graft->oid));
 	return 0;
 }
 
@@ -198,6 +216,9 @@ struct output_state {
 	int used;
 	unsigned packfile_uris_started : 1;
 	unsigned packfile_started : 1;
+
+	/* If not -1, everything read is copied here for the pack cache. */
+	int cache_fd;
 };
 
 static int relay_pack_data(int pack_objects_out, struct output_state *os,
@@ -220,6 +241,9 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	if (readsz < 0) {
 		return readsz;
 	}
+	if (os->cache_fd >= 0 &&
+	    write_in_full(os->cache_fd, os->buffer + os->used, readsz) < 0)
+		os->cache_fd = -1;
 	os->used += readsz;
 
 	while (!os->packfile_started) {
@@ -265,17 +289,83 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	return readsz;
 }
 
+/*
+ * Run in a child forked from upload-pack, so that pack-objects does not
+ * have to open the repository and read its packs and configuration
+ * again.
+ */
+static int forked_pack_objects(int argc, const char **argv, void *data)
+{
+	/* our marks would confuse the traversal of pack-objects */
+	clear_object_flags(~0);
+	trace_argv_printf(argv, "trace: built-in: git");
+	return upload_pack_objects_fn(argc, argv, NULL);
+}
+
+static int add_tag_to_key(const char *refname, const struct object_id *oid,
+			  int flag, void *cb_data)
+{
+	git_hash_ctx *ctx = cb_data;
+
+	the_hash_algo->update_fn(ctx, oid->hash, the_hash_algo->rawsz);
+	the_hash_algo->update_fn(ctx, refname, strlen(refname) + 1);
+	return 0;
+}
+
+/*
+ * Everything that decides which pack pack-objects sends: its arguments
+ * and input and, if it is to include tags, which tags there are.
+ */
+static void hash_pack_request(struct object_id *key,
+			      const struct strvec *args,
+			      const struct strbuf *input, int include_tag)
+{
+	git_hash_ctx ctx;
+	size_t i;
+
+	the_hash_algo->init_fn(&ctx);
+	for (i = 0; i < args->nr; i++) {
+		/* progress goes to stderr, which is not cached */
+		if (!strcmp(args->v[i], "--progress"))
+			continue;
+		the_hash_algo->update_fn(&ctx, args->v[i],
+					 strlen(args->v[i]) + 1);
+	}
+	the_hash_algo->update_fn(&ctx, input->buf, input->len);
+	if (include_tag)
+		for_each_tag_ref(add_tag_to_key, &ctx);
+	the_hash_algo->final_oid_fn(key, &ctx);
+}
+
+static int send_cached_pack(struct upload_pack_data *pack_data, int fd,
+			    struct output_state *os)
+{
+	int result;
+
+	do {
+		reset_timeout(pack_data->timeout);
+		result = relay_pack_data(fd, os, pack_data->use_sideband, 0);
+	} while (result > 0);
+
+	close(fd);
+	return result;
+}
+
 static void create_pack_file(struct upload_pack_data *pack_data,
 			     const struct string_list *uri_protocols)
 {
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
 	struct output_state output_state = { { 0 } };
+	struct strbuf input = STRBUF_INIT;
+	struct pack_cache cache;
+	struct tempfile *cache_tmp = NULL;
+	struct object_id cache_key;
+	int use_cache;
 	char progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
 	ssize_t sz;
 	int i;
-	FILE *pipe_fd;
 
 	if (!pack_data->pack_objects_hook)
 		pack_objects.git_cmd = 1;
@@ -319,27 +409,66 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	pack_objects.err = -1;
 	pack_objects.clean_on_exit = 1;
 
-	if (start_command(&pack_objects))
-		die("git upload-pack: unable to fork git-pack-objects");
-
-	pipe_fd = xfdopen(pack_objects.in, "w");
-
 	if (pack_data->shallow_nr)
-		for_each_commit_graft(write_one_shallow, pipe_fd);
+		for_each_commit_graft(write_one_shallow, &input);
 
 	for (i = 0; i < pack_data->want_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->want_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "--not\n");
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->want_obj.objects[i].item->oid));
+	strbuf_addstr(&input, "--not\n");
 	for (i = 0; i < pack_data->have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
 	for (i = 0; i < pack_data->extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "\n");
-	fflush(pipe_fd);
-	fclose(pipe_fd);
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
+	strbuf_addch(&input, '\n');
+
+	/*
+	 * A hook may not produce the same pack twice, packfile URIs
+	 * depend on configuration, and in a shallow repository the
+	 * pack depends on its shallow file, so none of those are
+	 * cached.
+	 */
+	output_state.cache_fd = -1;
+	use_cache = !pack_data->pack_objects_hook && !uri_protocols &&
+		    !is_repository_shallow(the_repository) &&
+		    !pack_cache_init(&cache, the_repository);
+	if (use_cache) {
+		int fd;
+
+		hash_pack_request(&cache_key, &pack_objects.args, &input,
+				  pack_data->use_include_tag);
+		fd = pack_cache_open(&cache, &cache_key);
+		if (fd >= 0) {
+			trace2_data_string("upload-pack", the_repository,
+					   "pack-cache", "hit");
+			child_process_clear(&pack_objects);
+			if (send_cached_pack(pack_data, fd, &output_state) < 0)
+				goto fail;
+			goto flush;
+		}
+		trace2_data_string("upload-pack", the_repository,
+				   "pack-cache", "miss");
+		cache_tmp = pack_cache_create(&cache);
+		if (cache_tmp)
+			output_state.cache_fd = get_tempfile_fd(cache_tmp);
+	}
+
+	/*
+	 * A hook is a program of its own, and for a shallow request
+	 * git itself has to handle "--shallow-file" before pack-objects
+	 * reads anything.
+	 */
+	if (!upload_pack_objects_fn || pack_data->pack_objects_hook ||
+	    pack_data->shallow_nr ||
+	    start_forked_command(&pack_objects, forked_pack_objects, NULL)) {
+		if (start_command(&pack_objects))
+			die("git upload-pack: unable to fork git-pack-objects");
+	}
+
+	write_in_full(pack_objects.in, input.buf, input.len);
+	close(pack_objects.in);
 
 	/* We read from pack_objects.err to capture stderr output for
 	 * progress bar, and pack_objects.out to capture the pack data.
@@ -437,6 +566,7 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		goto fail;
 	}
 
+ flush:
 	/* flush the data */
 	if (output_state.used > 0) {
 		send_client_data(1, output_state.buffer, output_state.used,
@@ -445,6 +575,16 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	}
 	if (pack_data->use_sideband)
 		packet_flush(1);
+
+	if (cache_tmp) {
+		if (output_state.cache_fd < 0)
+			delete_tempfile(&cache_tmp);
+		else
+			pack_cache_store(&cache, &cache_tmp, &cache_key);
+	}
+	if (use_cache)
+		pack_cache_release(&cache);
+	strbuf_release(&input);
 	return;
 
  fail:
@@ -492,13 +632,95 @@ static int got_oid(struct upload_pack_data *data,
 	return do_got_oid(data, oid);
 }
 
+static int bitmap_reaches_have(struct upload_pack_data *data,
+				struct object *have)
+{
+	struct commit_list *parents;
+
+	if (bitmap_walk_contains(data->bitmap_git, data->want_reach,
+				 &have->oid))
+		return 1;
+	if (have->type != OBJ_COMMIT)
+		return 0;
+
+	/* do_got_oid() counts these as had, too */
+	for (parents = ((struct commit *)have)->parents;
+	     parents;
+	     parents = parents->next)
+		if (bitmap_walk_contains(data->bitmap_git, data->want_reach,
+					 &parents->item->object.oid))
+			return 1;
+	return 0;
+}
+
+/*
+ * Answer the question of ok_to_give_up() from the reachability bitmaps
+ * instead of walking down from the wants: each want is done once the
+ * bitmap of what it reaches contains one of the haves. The bitmap of
+ * the first want that is not done yet is kept, so that another round
+ * of haves only has to look up the new ones.
+ *
+ * Return -1 if there are no bitmaps to use.
+ */
+static int bitmap_ok_to_give_up(struct upload_pack_data *data)
+{
+	if (!data->bitmap_git) {
+		if (!data->negotiate_with_bitmaps)
+			return -1;
+		data->bitmap_git = prepare_bitmap_git(the_repository);
+		if (!data->bitmap_git) {
+			data->negotiate_with_bitmaps = 0;
+			return -1;
+		}
+	}
+
+	for (; data->ready_wants < data->want_obj.nr; data->ready_wants++) {
+		if (!data->want_reach) {
+			struct object *want =
+				data->want_obj.objects[data->ready_wants].item;
+			struct object_list *tips = NULL;
+
+			/*
+			 * As in can_all_from_reach_with_flag(), there is
+			 * nothing to find below anything but a commit.
+			 */
+			want = deref_tag(the_repository, want, NULL, 0);
+			if (!want || want->type != OBJ_COMMIT)
+				continue;
+
+			object_list_insert(want, &tips);
+			data->want_reach = bitmap_reachable_from(data->bitmap_git,
+								 the_repository,
+								 tips);
+			object_list_free(&tips);
+			data->checked_haves = 0;
+		}
+
+		for (; data->checked_haves < data->have_obj.nr; data->checked_haves++)
+			if (bitmap_reaches_have(data,
+						data->have_obj.objects[data->checked_haves].item))
+				break;
+		if (data->checked_haves == data->have_obj.nr)
+			return 0;
+
+		bitmap_free(data->want_reach);
+		data->want_reach = NULL;
+	}
+	return 1;
+}
+
 static int ok_to_give_up(struct upload_pack_data *data)
 {
 	timestamp_t min_generation = GENERATION_NUMBER_ZERO;
+	int ret;
 
 	if (!data->have_obj.nr)
 		return 0;
 
+	ret = bitmap_ok_to_give_up(data);
+	if (ret >= 0)
+		return ret;
+
 	return can_all_from_reach_with_flag(&data->want_obj, THEY_HAVE,
 					    COMMON_KNOWN, data->oldest_have,
 					    min_generation);
@@ -1173,6 +1395,12 @@ static int check_ref(const char *refname_full, const struct object_id *oid,
 	return 0;
 }
 
+static void check_advertised_ref(const struct advertised_ref *ref,
+				 void *cb_data)
+{
+	mark_our_ref(ref->refname, ref->refname, &ref->oid);
+}
+
 static void format_symref_info(struct strbuf *buf, struct string_list *symref)
 {
 	struct string_list_item *item;
@@ -1188,18 +1416,14 @@ static void format_session_id(struct strbuf *buf, struct upload_pack_data *d) {
 		strbuf_addf(buf, " session-id=%s", trace2_session_id());
 }
 
-static int send_ref(const char *refname, const struct object_id *oid,
-		    int flag, void *cb_data)
+static void advertise_ref(const char *refname_nons,
+			  const struct object_id *oid,
+			  const struct object_id *peeled,
+			  struct upload_pack_data *data)
 {
 	static const char *capabilities = "multi_ack thin-pack side-band"
 		" side-band-64k ofs-delta shallow deepen-since deepen-not"
 		" deepen-relative no-progress include-tag multi_ack_detailed";
-	const char *refname_nons = strip_namespace(refname);
-	struct object_id peeled;
-	struct upload_pack_data *data = cb_data;
-
-	if (mark_our_ref(refname_nons, refname, oid))
-		return 0;
 
 	if (capabilities) {
 		struct strbuf symref_info = STRBUF_INIT;
@@ -1226,11 +1450,35 @@ static int send_ref(const char *refname, const struct object_id *oid,
 		packet_write_fmt(1, "%s %s\n", oid_to_hex(oid), refname_nons);
 	}
 	capabilities = NULL;
-	if (!peel_iterated_oid(oid, &peeled))
-		packet_write_fmt(1, "%s %s^{}\n", oid_to_hex(&peeled), refname_nons);
+	if (peeled)
+		packet_write_fmt(1, "%s %s^{}\n", oid_to_hex(peeled), refname_nons);
+}
+
+static int send_ref(const char *refname, const struct object_id *oid,
+		    int flag, void *cb_data)
+{
+	const char *refname_nons = strip_namespace(refname);
+	struct object_id peeled;
+
+	if (mark_our_ref(refname_nons, refname, oid))
+		return 0;
+
+	advertise_ref(refname_nons, oid,
+		      peel_iterated_oid(oid, &peeled) ? NULL : &peeled,
+		      cb_data);
 	return 0;
 }
 
+static void send_advertised_ref(const struct advertised_ref *ref,
+				void *cb_data)
+{
+	if (mark_our_ref(ref->refname, ref->refname, &ref->oid))
+		return;
+
+	advertise_ref(ref->refname, &ref->oid,
+		      ref->has_peeled ? &ref->peeled : NULL, cb_data);
+}
+
 static int find_symref(const char *refname, const struct object_id *oid,
 		       int flag, void *cb_data)
 {
@@ -1311,6 +1559,8 @@ static int upload_pack_config(const char *var, const char *value, void *cb_data)
 		data->allow_ref_in_want = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.allowsidebandall", var)) {
 		data->allow_sideband_all = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.negotiatewithbitmaps", var)) {
+		data->negotiate_with_bitmaps = git_config_bool(var, value);
 	} else if (!strcmp("core.precomposeunicode", var)) {
 		precomposed_unicode = git_config_bool(var, value);
 	} else if (!strcmp("transfer.advertisesid", var)) {
@@ -1347,12 +1597,16 @@ void upload_pack(struct upload_pack_options *options)
 	if (options->advertise_refs || !data.stateless_rpc) {
 		reset_timeout(data.timeout);
 		head_ref_namespaced(send_ref, &data);
-		for_each_namespaced_ref(send_ref, &data);
+		if (for_each_advertised_ref(the_repository, NULL,
+					    send_advertised_ref, &data))
+			for_each_namespaced_ref(send_ref, &data);
 		advertise_shallow_grafts(1);
 		packet_flush(1);
 	} else {
 		head_ref_namespaced(check_ref, NULL);
-		for_each_namespaced_ref(check_ref, NULL);
+		if (for_each_advertised_ref(the_repository, NULL,
+					    check_advertised_ref, NULL))
+			for_each_namespaced_ref(check_ref, NULL);
 	}
 
 	if (!options->advertise_refs) {
@@ -10,6 +10,16 @@ struct upload_pack_options {
 
 void upload_pack(struct upload_pack_options *options);
 
+/*
+ * If set, upload-pack forks and calls this with the arguments for
+ * pack-objects instead of running "git pack-objects", so that the
+ * child starts out with the repository, its packs and its
+ * configuration already read. The git binary sets it to
+ * cmd_pack_objects().
+ */
+extern int (*upload_pack_objects_fn)(int argc, const char **argv,
+				     const char *prefix);
+
 struct repository;
 struct strvec;
 struct packet_reader;
@@ -516,6 +516,33 @@ int git_mkstemp_mode(char *pattern, int mode)
 	return git_mkstemps_mode(pattern, 0, mode);
 }
 
+int git_fsync(int fd, enum fsync_action action)
+{
+	switch (action) {
+	case FSYNC_WRITEOUT_ONLY:
+#ifdef HAVE_SYNC_FILE_RANGE
+		/*
+		 * Push the whole file out to the device, but leave it
+		 * to a later hardware flush to empty the device's cache.
+		 */
+		return sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE |
+				       SYNC_FILE_RANGE_WRITE |
+				       SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	case FSYNC_HARDWARE_FLUSH:
+		for (;;) {
+			int err = fsync(fd);
+			if (err >= 0 || errno != EINTR)
+				return err;
+		}
+	default:
+		BUG("unexpected git_fsync(%d) call", action);
+	}
+}
+
 int xmkstemp_mode(char *filename_template, int mode)
 {
 	int fd;
@@ -57,7 +57,7 @@ void fprintf_or_die(FILE *f, const char *fmt, ...)
 
 void fsync_or_die(int fd, const char *msg)
 {
-	if (fsync(fd) < 0) {
+	if (git_fsync(fd, FSYNC_HARDWARE_FLUSH) < 0) {
 		die_errno("fsync error on '%s'", msg);
 	}
 }
@@ -36,10 +36,18 @@
  * Between those common lines, the patience diff algorithm is applied
  * recursively, until no unique line pairs can be found; these line ranges
  * are handled by the well-known Myers algorithm.
+ *
+ * The "bounded" variant (XDF_BOUNDED_DIFF) only hands line ranges of up
+ * to XDL_BOUNDED_MAX_WINDOW lines to the Myers algorithm.  Larger ranges
+ * without an anchor are reported as one changed block, after trimming
+ * their common head and tail, so that the time it takes to diff a pair
+ * of files stays roughly linear in their size, whatever they contain.
  */
 
 #define NON_UNIQUE ULONG_MAX
 
+#define XDL_BOUNDED_MAX_WINDOW 4096
+
 /*
  * This is a hash mapping from line hash to line numbers in the first and
  * second file.
@@ -306,11 +314,41 @@ static int walk_common_sequence(struct hashmap *map, struct entry *first,
 	}
 }
 
+/*
+ * Mark the line range as one changed block, except for the lines it
+ * starts and ends with on both sides.
+ */
+static void coarse_block_diff(struct hashmap *map,
+		int line1, int count1, int line2, int count2)
+{
+	while (count1 && count2 && match(map, line1, line2)) {
+		line1++;
+		line2++;
+		count1--;
+		count2--;
+	}
+	while (count1 && count2 &&
+			match(map, line1 + count1 - 1, line2 + count2 - 1)) {
+		count1--;
+		count2--;
+	}
+	while (count1--)
+		map->env->xdf1.rchg[line1++ - 1] = 1;
+	while (count2--)
+		map->env->xdf2.rchg[line2++ - 1] = 1;
+}
+
 static int fall_back_to_classic_diff(struct hashmap *map,
 		int line1, int count1, int line2, int count2)
 {
 	xpparam_t xpp;
 
+	if (XDF_DIFF_ALG(map->xpp->flags) == XDF_BOUNDED_DIFF &&
+	    count1 + count2 > XDL_BOUNDED_MAX_WINDOW) {
+		coarse_block_diff(map, line1, count1, line2, count2);
+		return 0;
+	}
+
 	memset(&xpp, 0, sizeof(xpp));
 	xpp.flags = map->xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
 
@@ -118,25 +118,25 @@ void *xdl_cha_alloc(chastore_t *cha) {
 	return data;
 }
 
-long xdl_guess_lines(mmfile_t *mf, long sample) {
-	long nl = 0, size, tsize = 0;
-	char const *data, *cur, *top;
+long xdl_count_lines(mmfile_t *mf) {
+	long nl = 0, size;
+	char const *cur, *top;
 
-	if ((cur = data = xdl_mmfile_first(mf, &size)) != NULL) {
-		for (top = data + size; nl < sample && cur < top; ) {
-			nl++;
+	/*
+	 * Count the records the way xdl_hash_record() splits them: each
+	 * ends after a LF, or at the end of the buffer. memchr() is
+	 * usually vectorized, so this is cheap compared to hashing.
+	 */
+	if ((cur = xdl_mmfile_first(mf, &size)) != NULL) {
+		for (top = cur + size; cur < top; nl++) {
 			if (!(cur = memchr(cur, '\n', top - cur)))
 				cur = top;
 			else
 				cur++;
 		}
-		tsize += (long) (cur - data);
 	}
 
-	if (nl && tsize)
-		nl = xdl_mmfile_size(mf) / (tsize / nl);
-
-	return nl + 1;
+	return nl;
 }
 
 int xdl_blankline(const char *line, long size, long flags)
@@ -298,14 +298,22 @@ unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
 	unsigned long ha = 5381;
 	char const *ptr = *data;
 
+	char const *eol;
+
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
+	/*
+	 * Find the end of the line first, so that the loop below does
+	 * not have to look for it in every byte.
+	 */
+	if (!(eol = memchr(ptr, '\n', top - ptr)))
+		eol = top;
+	for (; ptr < eol; ptr++) {
 		ha += (ha << 5);
 		ha ^= (unsigned long) *ptr;
 	}
-	*data = ptr < top ? ptr + 1: ptr;
+	*data = eol < top ? eol + 1 : eol;
 
 	return ha;
 }
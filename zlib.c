@@ -3,6 +3,9 @@
  * at init time.
  */
 #include "cache.h"
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 
 static const char *zerr_to_string(int status)
 {
@@ -146,6 +149,54 @@ int git_inflate(git_zstream *strm, int flush)
 	return status;
 }
 
+#ifdef USE_LIBDEFLATE
+ssize_t git_inflate_buffer(void *out, unsigned long out_len,
+			   const void *in, unsigned long in_len)
+{
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result res;
+	size_t in_used, out_used;
+
+	/*
+	 * A decompressor is cheap to allocate, and allocating one per call
+	 * keeps this safe to call without obj_read_mutex held.
+	 */
+	d = libdeflate_alloc_decompressor();
+	if (!d)
+		return -1;
+	res = libdeflate_zlib_decompress_ex(d, in, in_len, out, out_len,
+					    &in_used, &out_used);
+	libdeflate_free_decompressor(d);
+	if (res != LIBDEFLATE_SUCCESS || out_used != out_len)
+		return -1;
+	return in_used;
+}
+#else
+ssize_t git_inflate_buffer(void *out, unsigned long out_len,
+			   const void *in, unsigned long in_len)
+{
+	z_stream z;
+	int status;
+
+	if (in_len > ZLIB_BUF_MAX || out_len > ZLIB_BUF_MAX)
+		return -1;
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit(&z) != Z_OK)
+		return -1;
+	z.next_in = (unsigned char *)in;
+	z.avail_in = in_len;
+	z.next_out = out;
+	z.avail_out = out_len;
+	status = inflate(&z, Z_FINISH);
+	inflateEnd(&z);
+
+	if (status != Z_STREAM_END || z.total_out != out_len)
+		return -1;
+	return z.total_in;
+}
+#endif
+
 #if defined(NO_DEFLATE_BOUND) || ZLIB_VERNUM < 0x1200
 #define deflateBound(c,s)  ((s) + (((s) + 7) >> 3) + (((s) + 63) >> 6) + 11)
 #endif